@@ -6,7 +6,7 @@ TEMPLATE       = app
 TARGET         = $(nothing)
 QMAKE_STRIP    = /bin/true # prevent stripping the script(s)
 
-scripts.files  = qdirstat-cache-writer
+scripts.files  = qdirstat-cache-writer qdirstat-columns-to-parquet
 scripts.path   = $$INSTALL_PREFIX/bin
 
 INSTALLS      += scripts
@@ -0,0 +1,95 @@
+/*
+ *   File name: AggregateInfo.cpp
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QObject>
+
+#include "AggregateInfo.h"
+#include "DirInfo.h"
+#include "Exception.h"
+#include "Logger.h"
+
+
+using namespace QDirStat;
+
+
+void AggregateStats::add( const struct stat & fileStat )
+{
+    if ( count == 0 )
+    {
+	statInfo	  = fileStat;
+	statInfo.st_size   = 0;
+	statInfo.st_blocks = 0;
+	statInfo.st_nlink  = 1;
+	oldestMtime	  = fileStat.st_mtime;
+    }
+
+    statInfo.st_size   += fileStat.st_size;
+    statInfo.st_blocks += fileStat.st_blocks;
+
+    if ( fileStat.st_mtime > statInfo.st_mtime )
+	statInfo.st_mtime = fileStat.st_mtime;
+
+    if ( fileStat.st_mtime < oldestMtime )
+	oldestMtime = fileStat.st_mtime;
+
+    sizes.add ( fileStat.st_size );
+    mtimes.add( fileStat.st_mtime, fileStat.st_size );
+    ++count;
+}
+
+
+void AggregateStats::addCount( const struct stat & entryStat )
+{
+    if ( count == 0 )
+    {
+	// Whatever the first entry is, the aggregate is a plain file
+
+	statInfo	  = entryStat;
+	statInfo.st_mode  = S_IFREG | ( entryStat.st_mode & 07777 );
+	statInfo.st_size   = 0;
+	statInfo.st_blocks = 0;
+	statInfo.st_nlink  = 1;
+	countOnly	  = true;
+    }
+
+    ++count;
+}
+
+
+
+
+AggregateInfo::AggregateInfo( DirTree *		     tree,
+			      DirInfo *		     parent,
+			      const AggregateStats & stats ):
+    FileInfo( aggregateName( stats.count, stats.countOnly ),
+	      const_cast<struct stat *>( &stats.statInfo ),
+	      tree,
+	      parent ),
+    _fileCount( stats.count ),
+    _oldestMtime( stats.oldestMtime ),
+    _sizes( stats.sizes ),
+    _mtimes( stats.mtimes )
+{
+    // NOP
+}
+
+
+AggregateInfo::~AggregateInfo()
+{
+    // NOP
+}
+
+
+QString AggregateInfo::aggregateName( int count, bool countOnly )
+{
+    if ( countOnly )
+	return QObject::tr( "<%1 Entries>" ).arg( count );
+
+    return QObject::tr( "<%1 Small Files>" ).arg( count );
+}
@@ -0,0 +1,155 @@
+/*
+ *   File name: AggregateInfo.h
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef AggregateInfo_h
+#define AggregateInfo_h
+
+
+#include <string.h>	// memset()
+#include <sys/stat.h>
+
+#include "FileInfo.h"
+#include "SizeHistogram.h"
+#include "MTimeHistogram.h"
+
+
+namespace QDirStat
+{
+    // Forward declarations
+    class DirTree;
+    class DirInfo;
+
+    /**
+     * The small files of one directory that are added up while reading
+     * instead of getting a FileInfo each (see AggregateInfo).
+     **/
+    struct AggregateStats
+    {
+	AggregateStats():
+	    count( 0 ),
+	    oldestMtime( 0 ),
+	    countOnly( false )
+	    { memset( &statInfo, 0, sizeof( statInfo ) ); }
+
+	/**
+	 * Add the file with 'fileStat'.
+	 **/
+	void add( const struct stat & fileStat );
+
+	/**
+	 * Only count the entry with 'entryStat', e.g. in the counting scan
+	 * mode (see DirTree::countOnly()), where nothing but its type is
+	 * known.
+	 **/
+	void addCount( const struct stat & entryStat );
+
+	int	       count;
+	struct stat    statInfo;	// of the first file with the sums of all
+	time_t	       oldestMtime;
+	SizeHistogram  sizes;
+	MTimeHistogram mtimes;
+	bool	       countOnly;	// only counted, no sizes or mtimes
+    };
+
+
+    /**
+     * Pseudo item for the small files of a directory in the aggregated
+     * scan mode (see DirTree::setAggregateFilesBelow()): They don't get a
+     * FileInfo each; this one item counts as all of them. It has the sum of
+     * their sizes and blocks, the latest of their mtimes and their size and
+     * mtime histograms, so the totals and the statistics of the directory
+     * are the same as with the real files. The owner and the permissions
+     * are those of the first of the files.
+     *
+     * In the counting scan mode (see DirTree::countOnly()), it stands for
+     * all non-directory entries of the directory, and it only has their
+     * number.
+     *
+     * This is not a file on disk: Its path can't be opened.
+     **/
+    class AggregateInfo: public FileInfo
+    {
+    public:
+
+	/**
+	 * Constructor for the files in 'stats'.
+	 **/
+	AggregateInfo( DirTree *	      tree,
+		       DirInfo *	      parent,
+		       const AggregateStats & stats );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~AggregateInfo();
+
+	/**
+	 * Returns true if this is an AggregateInfo.
+	 *
+	 * Reimplemented - inherited from FileInfo.
+	 **/
+	virtual bool isAggregate() const Q_DECL_OVERRIDE { return true; }
+
+	/**
+	 * Return the number of files that this item stands for.
+	 **/
+	int fileCount() const { return _fileCount; }
+
+	/**
+	 * The other files besides the one that the item itself counts as.
+	 *
+	 * Reimplemented - inherited from FileInfo.
+	 **/
+	virtual int totalItems() Q_DECL_OVERRIDE { return _fileCount - 1; }
+	virtual int totalFiles() Q_DECL_OVERRIDE { return _fileCount - 1; }
+
+	virtual int totalIgnoredItems() Q_DECL_OVERRIDE
+	    { return isIgnored() ? _fileCount - 1 : 0; }
+
+	virtual int totalUnignoredItems() Q_DECL_OVERRIDE
+	    { return isIgnored() ? 0 : _fileCount - 1; }
+
+	/**
+	 * Returns the oldest mtime of the files.
+	 *
+	 * Reimplemented - inherited from FileInfo.
+	 **/
+	virtual time_t oldestFileMtime() Q_DECL_OVERRIDE { return _oldestMtime; }
+
+	/**
+	 * Return the sizes of the files by order of magnitude.
+	 **/
+	const SizeHistogram & sizeHistogram() const { return _sizes; }
+
+	/**
+	 * Return the number and total size of the files by the month of
+	 * their mtime.
+	 **/
+	const MTimeHistogram & mtimeHistogram() const { return _mtimes; }
+
+	/**
+	 * (Translated) user-visible name for 'count' aggregated files; with
+	 * 'countOnly', for entries that were only counted.
+	 **/
+	static QString aggregateName( int count, bool countOnly = false );
+
+
+    protected:
+
+	int		_fileCount;
+	time_t		_oldestMtime;
+	SizeHistogram	_sizes;
+	MTimeHistogram	_mtimes;
+
+    };	// class AggregateInfo
+
+}	// namespace QDirStat
+
+
+#endif // ifndef AggregateInfo_h
@@ -0,0 +1,456 @@
+/*
+ *   File name: AllFilesModel.cpp
+ *   Summary:	Flat data model of all files of a subtree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>	// std::sort(), std::inplace_merge()
+
+#include <QHash>
+#include <QPair>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include "AllFilesModel.h"
+#include "DirTree.h"
+#include "FileInfoIterator.h"
+#include "OwnerNames.h"
+#include "TreeWalker.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * The sort key of one file: The value of the sort column and its
+     * position in path order, so all keys are different.
+     **/
+    struct AllFilesKey
+    {
+	quint64 key;
+	int	pos;
+
+	bool operator<( const AllFilesKey & other ) const
+	    { return key != other.key ? key < other.key : pos < other.pos; }
+    };
+
+
+    /**
+     * Sorting one part of the keys or merging two sorted neighbouring
+     * parts.
+     **/
+    class SortTask: public QRunnable
+    {
+    public:
+
+	SortTask( AllFilesKey * begin, AllFilesKey * middle, AllFilesKey * end ):
+	    _begin( begin ),
+	    _middle( middle ),
+	    _end( end )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    if ( _middle )
+		std::inplace_merge( _begin, _middle, _end );
+	    else
+		std::sort( _begin, _end );
+	}
+
+    private:
+
+	AllFilesKey * _begin;
+	AllFilesKey * _middle;	// 0: sort
+	AllFilesKey * _end;
+    };
+
+
+    /**
+     * Sort 'keys': Each thread sorts one part, then neighbouring parts are
+     * merged in pairs until there is only one left.
+     **/
+    void parallelSort( QVector<AllFilesKey> & keys )
+    {
+	int parts = keys.size() < ALL_FILES_PARALLEL_SORT_MIN ? 1 : qMax( 1, QThread::idealThreadCount() );
+
+	if ( parts == 1 )
+	{
+	    std::sort( keys.begin(), keys.end() );
+	    return;
+	}
+
+	AllFilesKey * data = keys.data();
+	QVector<int> bounds;
+
+	for ( int i = 0; i <= parts; ++i )
+	    bounds << (int) ( (qint64) keys.size() * i / parts );
+
+	QThreadPool threadPool;
+	threadPool.setMaxThreadCount( parts );
+
+	for ( int i = 0; i < parts; ++i )
+	    threadPool.start( new SortTask( data + bounds.at( i ), 0, data + bounds.at( i+1 ) ) );
+
+	threadPool.waitForDone();
+
+	for ( int width = 1; width < parts; width *= 2 )
+	{
+	    for ( int i = 0; i + width < parts; i += 2 * width )
+	    {
+		threadPool.start( new SortTask( data + bounds.at( i ),
+						data + bounds.at( i + width ),
+						data + bounds.at( qMin( i + 2 * width, parts ) ) ) );
+	    }
+
+	    threadPool.waitForDone();
+	}
+    }
+
+
+    /**
+     * Return 'true' if 'a' comes before 'b' in path order.
+     **/
+    bool lessName( FileInfo * a, FileInfo * b )
+    {
+	return a->name() < b->name();
+    }
+
+}	// namespace
+
+
+
+AllFilesModel::AllFilesModel( QObject * parent ):
+    QAbstractTableModel( parent ),
+    _totalSize( 0LL ),
+    _tree( 0 ),
+    _sortCol( AF_SizeCol ),
+    _sortOrder( Qt::DescendingOrder )
+{
+    // logDebug() << "init" << endl;
+}
+
+
+AllFilesModel::~AllFilesModel()
+{
+    // logDebug() << "destroying" << endl;
+}
+
+
+void AllFilesModel::populate( FileInfo * subtree, const FileQuery & query )
+{
+    beginResetModel();
+
+    connectTree( _tree, false );
+    _tree = subtree ? subtree->tree() : 0;
+    connectTree( _tree, true );
+
+    _items.clear();
+    _order.clear();
+    _totalSize = 0LL;
+
+    if ( subtree )
+    {
+	if ( ! query.isEmpty() )
+	{
+	    FileQueryTreeWalker walker( query );
+	    walker.prepare( subtree );
+
+	    foreach ( FileInfo * item, walker.results() )
+		_items << item;
+	}
+	else if ( subtree->isDirInfo() )
+	{
+	    collect( subtree );
+	}
+	else
+	{
+	    _items << subtree;
+	}
+
+	foreach ( FileInfo * item, _items )
+	    _totalSize += item->size();
+
+	sortRows();
+    }
+
+    endResetModel();
+
+    logDebug() << _items.size() << " files" << endl;
+}
+
+
+void AllFilesModel::collect( FileInfo * dir )
+{
+    QVector<FileInfo *> children;
+    FileInfoIterator it( dir );
+
+    while ( *it )
+    {
+	children << *it;
+	++it;
+    }
+
+    std::sort( children.begin(), children.end(), lessName );
+
+    foreach ( FileInfo * child, children )
+    {
+	if ( child->isDirInfo() )
+	    collect( child );
+	else
+	    _items << child;
+    }
+}
+
+
+void AllFilesModel::connectTree( DirTree * tree, bool doConnect )
+{
+    if ( ! tree )
+	return;
+
+    if ( doConnect )
+    {
+	connect( tree, SIGNAL( clearing()		      ),
+		 this, SLOT  ( invalidate()		      ) );
+
+	connect( tree, SIGNAL( startingReading()	      ),
+		 this, SLOT  ( invalidate()		      ) );
+
+	connect( tree, SIGNAL( deletingChild   ( FileInfo * ) ),
+		 this, SLOT  ( invalidate      ( FileInfo * ) ) );
+
+	connect( tree, SIGNAL( clearingSubtree ( DirInfo * )  ),
+		 this, SLOT  ( invalidate      ( DirInfo * )  ) );
+
+	connect( tree, SIGNAL( replacingSubtree( DirInfo * )  ),
+		 this, SLOT  ( invalidate      ( DirInfo * )  ) );
+
+	connect( tree, SIGNAL( subtreesSpilled()	      ),
+		 this, SLOT  ( invalidate()		      ) );
+
+	connect( tree, SIGNAL( destroyed()		      ),
+		 this, SLOT  ( invalidate()		      ) );
+    }
+    else
+    {
+	disconnect( tree, 0, this, 0 );
+    }
+}
+
+
+void AllFilesModel::invalidate()
+{
+    if ( ! _tree )
+	return;
+
+    beginResetModel();
+
+    connectTree( _tree, false );
+    _tree = 0;
+    _items.clear();
+    _order.clear();
+    _totalSize = 0LL;
+
+    endResetModel();
+
+    emit invalidated();
+}
+
+
+void AllFilesModel::invalidate( FileInfo * )
+{
+    invalidate();
+}
+
+
+void AllFilesModel::invalidate( DirInfo * )
+{
+    invalidate();
+}
+
+
+FileInfo * AllFilesModel::item( const QModelIndex & index ) const
+{
+    if ( ! index.isValid() || index.row() < 0 || index.row() >= _order.size() )
+	return 0;
+
+    return _items.at( _order.at( index.row() ) );
+}
+
+
+int AllFilesModel::rowCount( const QModelIndex & parent ) const
+{
+    return parent.isValid() ? 0 : _order.size();
+}
+
+
+int AllFilesModel::columnCount( const QModelIndex & parent ) const
+{
+    return parent.isValid() ? 0 : AF_ColumnCount;
+}
+
+
+QVariant AllFilesModel::data( const QModelIndex & index, int role ) const
+{
+    FileInfo * file = item( index );
+
+    if ( ! file )
+	return QVariant();
+
+    switch ( role )
+    {
+	case Qt::DisplayRole:
+	    switch ( index.column() )
+	    {
+		case AF_SizeCol:	return formatSize( file->size() );
+		case AF_AllocatedCol:	return formatSize( file->allocatedSize() );
+		case AF_MTimeCol:	return formatTime( file->mtime() );
+		case AF_UserCol:	return OwnerNames::userName( file->uid() );
+		case AF_PathCol:	return file->url();
+		default:		return QVariant();
+	    }
+
+	case Qt::TextAlignmentRole:
+	    return index.column() == AF_SizeCol || index.column() == AF_AllocatedCol ?
+		(int) ( Qt::AlignRight | Qt::AlignVCenter ) :
+		(int) ( Qt::AlignLeft  | Qt::AlignVCenter );
+
+	default:
+	    return QVariant();
+    }
+}
+
+
+QVariant AllFilesModel::headerData( int		    section,
+				    Qt::Orientation orientation,
+				    int		    role ) const
+{
+    if ( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+	return QVariant();
+
+    switch ( section )
+    {
+	case AF_SizeCol:	return tr( "Size"	   );
+	case AF_AllocatedCol:	return tr( "Allocated"	   );
+	case AF_MTimeCol:	return tr( "Last Modified" );
+	case AF_UserCol:	return tr( "User"	   );
+	case AF_PathCol:	return tr( "Path"	   );
+	default:		return QVariant();
+    }
+}
+
+
+void AllFilesModel::sortRows()
+{
+    QVector<AllFilesKey> keys( _items.size() );
+
+    // Users are sorted by name: Give each one the rank of its name
+
+    QHash<uid_t, quint64> userRank;
+
+    if ( _sortCol == AF_UserCol )
+    {
+	QHash<uid_t, QString> userNames;
+
+	foreach ( FileInfo * item, _items )
+	{
+	    if ( ! userNames.contains( item->uid() ) )
+		userNames.insert( item->uid(), OwnerNames::userName( item->uid() ) );
+	}
+
+	QList<QPair<QString, uid_t> > names;
+
+	for ( QHash<uid_t, QString>::const_iterator it = userNames.constBegin();
+	      it != userNames.constEnd();
+	      ++it )
+	{
+	    names << qMakePair( it.value(), it.key() );
+	}
+
+	std::sort( names.begin(), names.end() );
+
+	for ( int i = 0; i < names.size(); ++i )
+	    userRank.insert( names.at( i ).second, i );
+    }
+
+    // The keys are unsigned: Flip the sign bit of signed values so
+    // negative ones (e.g. mtimes before 1970) sort first.
+
+    for ( int pos = 0; pos < _items.size(); ++pos )
+    {
+	FileInfo * item = _items.at( pos );
+	quint64 key;
+
+	switch ( _sortCol )
+	{
+	    case AF_SizeCol:	  key = (quint64) item->size()		^ ( 1ULL << 63 ); break;
+	    case AF_AllocatedCol: key = (quint64) item->allocatedSize() ^ ( 1ULL << 63 ); break;
+	    case AF_MTimeCol:	  key = (quint64) item->mtime()		^ ( 1ULL << 63 ); break;
+	    case AF_UserCol:	  key = userRank.value( item->uid() );			  break;
+	    case AF_PathCol:
+	    default:		  key = 0;						  break;
+	}
+
+	keys[ pos ].key = _sortOrder == Qt::DescendingOrder ? ~key : key;
+	keys[ pos ].pos = pos;
+    }
+
+    // In path order, only the direction matters
+
+    if ( _sortCol != AF_PathCol )
+	parallelSort( keys );
+
+    _order.resize( keys.size() );
+
+    for ( int row = 0; row < keys.size(); ++row )
+    {
+	_order[ row ] = _sortCol == AF_PathCol && _sortOrder == Qt::DescendingOrder ?
+	    keys.size() - 1 - row : keys.at( row ).pos;
+    }
+}
+
+
+void AllFilesModel::sort( int column, Qt::SortOrder order )
+{
+    if ( column == _sortCol && order == _sortOrder )
+	return;
+
+    emit layoutAboutToBeChanged();
+
+    // Move the persistent indexes (e.g. the current item) along with their
+    // files
+
+    QModelIndexList oldIndexes = persistentIndexList();
+    QVector<int>    oldPos;
+
+    foreach ( const QModelIndex & index, oldIndexes )
+	oldPos << ( index.row() < _order.size() ? _order.at( index.row() ) : -1 );
+
+    _sortCol   = column;
+    _sortOrder = order;
+    sortRows();
+
+    if ( ! oldIndexes.isEmpty() )
+    {
+	QVector<int> rowOfPos( _order.size() );
+
+	for ( int row = 0; row < _order.size(); ++row )
+	    rowOfPos[ _order.at( row ) ] = row;
+
+	for ( int i = 0; i < oldIndexes.size(); ++i )
+	{
+	    const QModelIndex & oldIndex = oldIndexes.at( i );
+	    changePersistentIndex( oldIndex, oldPos.at( i ) < 0 ? QModelIndex() :
+				   createIndex( rowOfPos.at( oldPos.at( i ) ), oldIndex.column() ) );
+	}
+    }
+
+    emit layoutChanged();
+}
@@ -0,0 +1,166 @@
+/*
+ *   File name: AllFilesModel.h
+ *   Summary:	Flat data model of all files of a subtree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef AllFilesModel_h
+#define AllFilesModel_h
+
+#include <QAbstractTableModel>
+#include <QVector>
+
+#include "FileInfo.h"
+#include "FileQuery.h"
+
+
+// Fewer files than this are sorted in the calling thread
+#define ALL_FILES_PARALLEL_SORT_MIN	200000
+
+
+namespace QDirStat
+{
+    class DirInfo;
+    class DirTree;
+
+
+    /**
+     * Column numbers for the "all files" view
+     **/
+    enum AllFilesColumns
+    {
+	AF_SizeCol = 0,
+	AF_AllocatedCol,
+	AF_MTimeCol,
+	AF_UserCol,
+	AF_PathCol,
+	AF_ColumnCount
+    };
+
+
+    /**
+     * Flat data model of every file (every item that is not a directory) of
+     * a subtree for a QTreeView in "list" mode: Unlike the QTreeWidget of
+     * the LocateFilesWindow, this does not create anything per row, so it
+     * can have millions of rows; the view only asks for the ones it shows.
+     * A row is just a FileInfo pointer, and the texts are only created when
+     * they are displayed.
+     *
+     * The files are collected once in path order (by directory, then by
+     * name), optionally just the ones that match a FileQuery. Sorting by
+     * another column creates a numeric key for each file and sorts the
+     * keys in worker threads, so the tree is not touched while sorting.
+     *
+     * Since the rows are pointers into the tree, the model is cleared as
+     * soon as anything in the tree is deleted or replaced (see
+     * invalidated()).
+     **/
+    class AllFilesModel: public QAbstractTableModel
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	AllFilesModel( QObject * parent = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~AllFilesModel();
+
+	/**
+	 * Collect all files of 'subtree' or, if 'query' is not empty, only
+	 * the ones that match it, and sort them by the current sort column. 0
+	 * means no files.
+	 **/
+	void populate( FileInfo * subtree, const FileQuery & query = FileQuery() );
+
+	/**
+	 * Return the file of 'index' or 0 if there is none.
+	 **/
+	FileInfo * item( const QModelIndex & index ) const;
+
+	/**
+	 * Return the total size of all files.
+	 **/
+	FileSize totalSize() const { return _totalSize; }
+
+
+	//
+	// Reimplemented from QAbstractItemModel
+	//
+
+	virtual int rowCount   ( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+	virtual int columnCount( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	virtual QVariant data( const QModelIndex & index, int role ) const Q_DECL_OVERRIDE;
+
+	virtual QVariant headerData( int	     section,
+				     Qt::Orientation orientation,
+				     int	     role ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Sort by 'column'.
+	 **/
+	virtual void sort( int column, Qt::SortOrder order = Qt::AscendingOrder ) Q_DECL_OVERRIDE;
+
+
+    signals:
+
+	/**
+	 * Emitted when the model was cleared because the tree changed.
+	 **/
+	void invalidated();
+
+
+    protected slots:
+
+	/**
+	 * Clear the model because items of the tree may be deleted.
+	 **/
+	void invalidate();
+	void invalidate( FileInfo * );
+	void invalidate( DirInfo * );
+
+
+    protected:
+
+	/**
+	 * Add the files of 'dir' and everything below it to _items, sorted
+	 * by name within each directory.
+	 **/
+	void collect( FileInfo * dir );
+
+	/**
+	 * Set up _order for the current sort column and sort order.
+	 **/
+	void sortRows();
+
+	/**
+	 * Connect to or disconnect from the signals of 'tree' that tell that
+	 * items will be deleted.
+	 **/
+	void connectTree( DirTree * tree, bool doConnect );
+
+
+	//
+	// Data members
+	//
+
+	QVector<FileInfo *>	_items;		// in path order
+	QVector<int>		_order;		// position in _items of each row
+	FileSize		_totalSize;
+	DirTree *		_tree;
+	int			_sortCol;
+	Qt::SortOrder		_sortOrder;
+    };
+
+}	// namespace QDirStat
+
+#endif	// AllFilesModel_h
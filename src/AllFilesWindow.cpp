@@ -0,0 +1,139 @@
+/*
+ *   File name: AllFilesWindow.cpp
+ *   Summary:	QDirStat "all files" window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include "AllFilesWindow.h"
+#include "AllFilesModel.h"
+#include "BusyPopup.h"
+#include "DirTree.h"
+#include "FileInfo.h"
+#include "FileQuery.h"
+#include "SelectionModel.h"
+#include "SettingsHelpers.h"
+#include "HeaderTweaker.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "Exception.h"
+
+using namespace QDirStat;
+
+
+AllFilesWindow::AllFilesWindow( SelectionModel * selectionModel,
+				QWidget *	 parent ):
+    QDialog( parent ),
+    _ui( new Ui::AllFilesWindow ),
+    _model( 0 ),
+    _selectionModel( selectionModel )
+{
+    // logDebug() << "init" << endl;
+
+    CHECK_NEW( _ui );
+    _ui->setupUi( this );
+    initWidgets();
+    readWindowSettings( this, "AllFilesWindow" );
+
+    connect( _ui->refreshButton,	      SIGNAL( clicked() ),
+	     this,			      SLOT  ( refresh() ) );
+
+    connect( _ui->queryLineEdit,	      SIGNAL( returnPressed() ),
+	     this,			      SLOT  ( refresh() ) );
+
+    connect( _ui->treeView->selectionModel(), SIGNAL( currentChanged    ( QModelIndex, QModelIndex ) ),
+	     this,			      SLOT  ( locateInMainWindow( QModelIndex ) ) );
+
+    connect( _model,			      SIGNAL( invalidated()	  ),
+	     this,			      SLOT  ( modelInvalidated() ) );
+}
+
+
+AllFilesWindow::~AllFilesWindow()
+{
+    // logDebug() << "destroying" << endl;
+    writeWindowSettings( this, "AllFilesWindow" );
+}
+
+
+void AllFilesWindow::initWidgets()
+{
+    QFont font = _ui->heading->font();
+    font.setBold( true );
+    _ui->heading->setFont( font );
+
+    _model = new AllFilesModel( this );
+    CHECK_NEW( _model );
+
+    _ui->treeView->setModel( _model );
+    _ui->treeView->sortByColumn( AF_SizeCol, Qt::DescendingOrder );
+    _ui->treeView->header()->setStretchLastSection( false );
+    HeaderTweaker::resizeToContents( _ui->treeView->header() );
+}
+
+
+void AllFilesWindow::refresh()
+{
+    populate( _subtree() );
+}
+
+
+void AllFilesWindow::reject()
+{
+    deleteLater();
+}
+
+
+void AllFilesWindow::populate( FileInfo * newSubtree )
+{
+    TRACE_SCOPE( "stats", "AllFilesWindow::populate" );
+
+    _subtree = newSubtree;
+
+    FileQuery  query( _ui->queryLineEdit->text() );
+    FileInfo * subtree = _subtree();
+
+    if ( query.isValid() && ! query.path().isEmpty() && _subtree.tree() )
+	subtree = _subtree.tree()->locate( query.path() );
+
+    if ( ! query.isValid() || ! subtree )
+    {
+	_model->populate( 0 );
+	_ui->heading->setText( query.isValid() ?
+			       tr( "Not found: %1" ).arg( query.path() ) :
+			       query.errorText() );
+	return;
+    }
+
+    {
+	BusyPopup msg( tr( "Collecting files..." ), this );
+	_model->populate( subtree, query );
+    }
+
+    QString heading = query.isEmpty() ?
+	tr( "%1 files with %2 in %3" ) :
+	tr( "%1 matching files with %2 in %3" );
+
+    _ui->heading->setText( heading
+			   .arg( _model->rowCount() )
+			   .arg( formatSize( _model->totalSize() ) )
+			   .arg( subtree->url() ) );
+}
+
+
+void AllFilesWindow::modelInvalidated()
+{
+    _ui->heading->setText( tr( "The directory tree has changed. Click \"Refresh\" to list all files of %1 again." )
+			   .arg( _subtree.url() ) );
+}
+
+
+void AllFilesWindow::locateInMainWindow( const QModelIndex & current )
+{
+    FileInfo * item = _model->item( current );
+
+    if ( item && _selectionModel )
+	_selectionModel->setCurrentItem( item, true );
+}
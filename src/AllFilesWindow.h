@@ -0,0 +1,129 @@
+/*
+ *   File name: AllFilesWindow.h
+ *   Summary:	QDirStat "all files" window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef AllFilesWindow_h
+#define AllFilesWindow_h
+
+#include <QDialog>
+#include <QModelIndex>
+
+#include "ui_all-files-window.h"
+#include "Subtree.h"
+
+
+namespace QDirStat
+{
+    class AllFilesModel;
+    class FileInfo;
+    class SelectionModel;
+
+
+    /**
+     * Modeless dialog that lists every file of a subtree in one flat list
+     * that can be sorted by size, allocated size, modification time, owner
+     * or path (see AllFilesModel). This works for millions of files, so
+     * unlike the LocateFilesWindow, it does not need to limit itself to the
+     * first few results of a search.
+     *
+     * A FileQuery (e.g. "size>1G age>2y") limits the list to the matching
+     * files; that skips all directories that cannot have any.
+     *
+     * When the user clicks on a file, it is located in the QDirStat main
+     * window's tree view, just like in the LocateFilesWindow; since the
+     * model has the FileInfo pointers, this does not need to look up the
+     * path in the tree.
+     **/
+    class AllFilesWindow: public QDialog
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 *
+	 * Notice that this widget will destroy itself upon window close.
+	 *
+	 * It is advised to use a QPointer for storing a pointer to an instance
+	 * of this class. The QPointer will keep track of this window
+	 * auto-deleting itself when closed.
+	 **/
+	AllFilesWindow( SelectionModel * selectionModel,
+			QWidget *	 parent );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~AllFilesWindow();
+
+	/**
+	 * Obtain the subtree from the last used URL.
+	 **/
+	const Subtree & subtree() const { return _subtree; }
+
+
+    public slots:
+
+	/**
+	 * Populate the window with all files of 'subtree' or with the ones
+	 * that match the query that the user entered.
+	 **/
+	void populate( FileInfo * subtree );
+
+	/**
+	 * Refresh (reload) all data.
+	 **/
+	void refresh();
+
+	/**
+	 * Reject the dialog contents, i.e. the user clicked the "Cancel" or
+	 * WM_CLOSE button. This not only closes the dialog, it also deletes
+	 * it.
+	 *
+	 * Reimplemented from QDialog.
+	 **/
+	virtual void reject() Q_DECL_OVERRIDE;
+
+
+    protected slots:
+
+	/**
+	 * Locate the file of 'current' in the main window's tree and treemap
+	 * widgets via their SelectionModel.
+	 **/
+	void locateInMainWindow( const QModelIndex & current );
+
+	/**
+	 * Notification that the model was cleared because the tree changed.
+	 **/
+	void modelInvalidated();
+
+
+    protected:
+
+	/**
+	 * One-time initialization of the widgets in this window.
+	 **/
+	void initWidgets();
+
+
+	//
+	// Data members
+	//
+
+	Ui::AllFilesWindow * _ui;
+	AllFilesModel *	     _model;
+	Subtree		     _subtree;
+	SelectionModel *     _selectionModel;
+    };
+
+}	// namespace QDirStat
+
+
+#endif	// AllFilesWindow_h
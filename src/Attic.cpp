@@ -25,7 +25,7 @@ Attic::Attic( DirTree * tree,
 
     if ( parent )
     {
-	_device = parent->device();
+	_deviceIndex = deviceIndex( parent->device() );
 	_mode	= parent->mode();
 	_uid	= parent->uid();
 	_gid	= parent->gid();
@@ -66,23 +66,9 @@ FileInfo * Attic::locate( QString url, bool findPseudoDirs )
     if ( ! _tree || ! _parent )
 	return 0;
 
-    // Search all children
-
-    FileInfo * child = firstChild();
-
-    while ( child )
-    {
-	FileInfo * foundChild = child->locate( url, findPseudoDirs );
-
-	if ( foundChild )
-	    return foundChild;
-	else
-	    child = child->next();
-    }
-
     // An attic can have neither an attic nor a dot entry, so there is no need
     // to search in either of those.
 
-    return 0;
+    return locateChild( url, findPseudoDirs );
 }
 
@@ -0,0 +1,533 @@
+/*
+ *   File name: Benchmark.cpp
+ *   Summary:	Headless benchmark of reading and processing a tree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <iostream>	// cout
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QSize>
+#include <QThreadPool>
+#include <QTimer>
+
+#include "Benchmark.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "DirTreeCache.h"
+#include "DirTreeModel.h"
+#include "FileInfoIterator.h"
+#include "FileSizeStats.h"
+#include "FileTypeStats.h"
+#include "MemoryStats.h"
+#include "MimeCategorizer.h"
+#include "TreemapExporter.h"
+#include "TreemapView.h"	// default settings
+#include "Logger.h"
+#include "Exception.h"
+
+
+#define BENCHMARK_TREEMAP_WIDTH		1920
+#define BENCHMARK_TREEMAP_HEIGHT	1080
+
+// Limits for the micro benchmarks
+#define MICRO_BENCHMARK_MAX_ROWS	1000000
+#define MICRO_BENCHMARK_MIME_CALLS	1000000
+
+
+using namespace QDirStat;
+
+
+Benchmark::Benchmark( const QString & path, const QString & label ):
+    _path( path ),
+    _label( label ),
+    _tree( 0 ),
+    _model( 0 )
+{
+    if ( _label.isEmpty() )
+	_label = QFileInfo( path ).fileName();
+}
+
+
+Benchmark::~Benchmark()
+{
+    if ( _model )
+	delete _model;
+    else
+	delete _tree;
+}
+
+
+int Benchmark::run()
+{
+    if ( ! _tmpDir.isValid() )
+    {
+	logError() << "Can't create a temporary directory" << endl;
+	return 1;
+    }
+
+    _tree = new DirTree();
+    CHECK_NEW( _tree );
+    _tree->readSettings();
+
+    if ( ! scan() )
+	return 1;
+
+    bool ok = cacheRoundTrip();
+
+    sort( NameCol,	  "sort_name"	);
+    sort( SizeCol,	  "sort_size"	);
+    sort( LatestMTimeCol, "sort_mtime"	);
+    sort( TotalItemsCol,  "sort_items"	);
+
+    ok = treemap() && ok;
+    stats();
+    memory();
+
+    return ok ? 0 : 1;
+}
+
+
+int Benchmark::runMicro()
+{
+    _model = new DirTreeModel();
+    CHECK_NEW( _model );
+    _tree = _model->tree();
+
+    if ( ! scan( true ) )
+	return 1;
+
+    modelAccess();
+
+    for ( int col = DataColumnBegin; col < DataColumnEnd; ++col )
+    {
+	DataColumn sortCol = static_cast<DataColumn>( col );
+
+	if ( sortCol != SizeDeltaCol && sortCol != SizeHistoryCol && sortCol != ReadJobsCol )
+	    sort( sortCol, "sort_" + DataColumns::toString( sortCol ) );
+    }
+
+    renderCushions( treemapLayout() );
+    mimeCategories();
+
+    return 0;
+}
+
+
+bool Benchmark::scan( bool fromCache )
+{
+    bool ok = false;
+    QElapsedTimer timer;
+
+    QMetaObject::Connection finished = QObject::connect( _tree, &DirTree::finished, [&]()
+	{
+	    ok = true;
+	    QCoreApplication::quit();
+	} );
+
+    QMetaObject::Connection aborted = QObject::connect( _tree, &DirTree::aborted, [&]()
+	{
+	    logError() << "Reading " << _path << " was aborted" << endl;
+	    QCoreApplication::quit();
+	} );
+
+    // Start reading only from the event loop: For an empty directory,
+    // DirTree emits finished() immediately.
+
+    QTimer::singleShot( 0, _tree, [&]()
+	{
+	    timer.start();
+
+	    if ( fromCache )
+		_tree->readCache( _path );
+	    else
+		_tree->startReading( _path );
+	} );
+
+    QCoreApplication::exec();
+    qint64 nanosec = timer.nsecsElapsed();
+
+    QObject::disconnect( finished );
+    QObject::disconnect( aborted  );
+
+    if ( ok )
+	report( fromCache ? "cache_read_model" : "scan", nanosec, itemCount( _tree ) );
+
+    return ok;
+}
+
+
+bool Benchmark::cacheRoundTrip()
+{
+    bool ok = true;
+    const char * formats[] = { "gz", "bin" };
+
+    for ( int i = 0; i < 2; ++i )
+    {
+	QString cacheFileName = _tmpDir.path() + "/" +
+	    ( i == 0 ? DEFAULT_CACHE_NAME : DEFAULT_BINARY_CACHE_NAME );
+
+	QString extra = QString( ",\"format\":\"%1\"" ).arg( formats[ i ] );
+	QElapsedTimer timer;
+
+	timer.start();
+
+	if ( ! _tree->writeCache( cacheFileName ) )
+	{
+	    logError() << "Writing " << cacheFileName << " failed" << endl;
+	    ok = false;
+	    continue;
+	}
+
+	report( "cache_write", timer.nsecsElapsed(), itemCount( _tree ),
+		extra + QString( ",\"bytes\":%1" ).arg( QFileInfo( cacheFileName ).size() ) );
+
+	DirTree cacheTree;
+	timer.start();
+
+	if ( ! cacheTree.readCacheNow( cacheFileName ) )
+	{
+	    logError() << "Reading " << cacheFileName << " failed" << endl;
+	    ok = false;
+	    continue;
+	}
+
+	qint64 nanosec = timer.nsecsElapsed();
+	bool   same	 = itemCount( &cacheTree ) == itemCount( _tree );
+
+	report( "cache_read", nanosec, itemCount( &cacheTree ),
+		extra + QString( ",\"ok\":%1" ).arg( same ? "true" : "false" ) );
+
+	if ( ! same )
+	{
+	    logError() << "Different number of items after reading " << cacheFileName << endl;
+	    ok = false;
+	}
+    }
+
+    return ok;
+}
+
+
+void Benchmark::sort( DataColumn sortCol, const QString & name )
+{
+    DirInfo * root = _tree->root();
+    root->dropSortCache( true ); // recursive
+
+    QElapsedTimer timer;
+    timer.start();
+
+    qint64 items = sortSubtree( root, sortCol );
+
+    report( name, timer.nsecsElapsed(), items );
+}
+
+
+qint64 Benchmark::sortSubtree( DirInfo * dir, DataColumn sortCol )
+{
+    const FileInfoList & children = dir->sortedChildren( sortCol, Qt::DescendingOrder );
+    qint64 items = children.size();
+
+    foreach ( FileInfo * child, children )
+    {
+	DirInfo * subDir = child->toDirInfo();
+
+	if ( subDir )
+	    items += sortSubtree( subDir, sortCol );
+    }
+
+    return items;
+}
+
+
+bool Benchmark::treemap()
+{
+    QString imageFileName = _tmpDir.path() + "/treemap.png";
+    QSize size( BENCHMARK_TREEMAP_WIDTH, BENCHMARK_TREEMAP_HEIGHT );
+
+    QElapsedTimer timer;
+    timer.start();
+
+    TreemapExporter exporter( imageFileName, _tree, size );
+    qint64 nanosec = timer.nsecsElapsed();
+
+    if ( ! exporter.ok() )
+    {
+	logError() << "Exporting the treemap failed" << endl;
+	return false;
+    }
+
+    report( "treemap", nanosec, itemCount( _tree ),
+	    QString( ",\"pixels\":%1" ).arg( (qint64) size.width() * size.height() ) );
+
+    return true;
+}
+
+
+void Benchmark::stats()
+{
+    FileInfo * toplevel = _tree->firstToplevel();
+
+    if ( ! toplevel )
+	return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    FileSizeStats sizeStats;
+    sizeStats.collect( toplevel );
+
+    report( "file_size_stats", timer.nsecsElapsed(), itemCount( _tree ) );
+
+    timer.start();
+
+    FileTypeStats typeStats;
+    typeStats.calc( toplevel );
+
+    report( "file_type_stats", timer.nsecsElapsed(), itemCount( _tree ) );
+}
+
+
+void Benchmark::memory()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    MemoryStats memoryStats;
+    memoryStats.addTree( _tree->root() );
+    memoryStats.sampleNodePool();
+
+    report( "memory", timer.nsecsElapsed(), itemCount( _tree ),
+	    QString( ",\"bytes\":%1,\"nodePoolBytes\":%2" )
+	    .arg( memoryStats.totalBytes() )
+	    .arg( memoryStats.nodePoolBytes() ) );
+}
+
+
+void Benchmark::report( const QString & name,
+			qint64		nanosec,
+			qint64		items,
+			const QString & extra )
+{
+    double millisec = nanosec / 1000000.0;
+    qint64 perSec   = nanosec > 0 ? qRound64( items * 1000000000.0 / nanosec ) : 0;
+
+    QString label = _label;
+    label.replace( '\\', "\\\\" ).replace( '"', "\\\"" );
+
+    QString line = QString( "{\"tree\":\"%1\",\"benchmark\":\"%2\",\"millisec\":%3,"
+			    "\"items\":%4,\"itemsPerSec\":%5%6}" )
+	.arg( label )
+	.arg( name )
+	.arg( millisec, 0, 'f', 1 )
+	.arg( items )
+	.arg( perSec )
+	.arg( extra );
+
+    std::cout << qPrintable( line ) << std::endl;
+}
+
+
+void Benchmark::modelAccess()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Expand all directories breadth-first like a view with everything
+    // open; the model exposes the rows of big directories in batches
+
+    QVector<QModelIndex> parents;
+    QVector<QModelIndex> indexes;
+    parents << QModelIndex();
+
+    for ( int p = 0; p < parents.size() && indexes.size() < MICRO_BENCHMARK_MAX_ROWS; ++p )
+    {
+	QModelIndex parent = parents.at( p );
+
+	while ( _model->canFetchMore( parent ) )
+	    _model->fetchMore( parent );
+
+	int rows = _model->rowCount( parent );
+
+	for ( int row = 0; row < rows && indexes.size() < MICRO_BENCHMARK_MAX_ROWS; ++row )
+	{
+	    QModelIndex index = _model->index( row, 0, parent );
+	    indexes << index;
+
+	    if ( _model->hasChildren( index ) )
+		parents << index;
+	}
+    }
+
+    report( "model_index", timer.nsecsElapsed(), indexes.size() );
+
+
+    // Scroll through all rows: The view asks for these roles of each
+    // visible cell
+
+    const int roles[] = { Qt::DisplayRole, Qt::DecorationRole, Qt::TextAlignmentRole, Qt::ForegroundRole };
+    const int roleCount = sizeof( roles ) / sizeof( roles[0] );
+    int cols = _model->columnCount( QModelIndex() );
+    qint64 calls = 0;
+
+    timer.start();
+
+    foreach ( const QModelIndex & index, indexes )
+    {
+	for ( int col = 0; col < cols; ++col )
+	{
+	    QModelIndex cell = col == 0 ? index : index.sibling( index.row(), col );
+
+	    for ( int i = 0; i < roleCount; ++i )
+	    {
+		_model->data( cell, roles[ i ] );
+		++calls;
+	    }
+	}
+    }
+
+    report( "model_data", timer.nsecsElapsed(), calls,
+	    QString( ",\"columns\":%1,\"roles\":%2" ).arg( cols ).arg( roleCount ) );
+
+
+    timer.start();
+
+    foreach ( const QModelIndex & index, indexes )
+	_model->parent( index );
+
+    report( "model_parent", timer.nsecsElapsed(), indexes.size() );
+
+
+    timer.start();
+
+    foreach ( const QModelIndex & index, indexes )
+	_model->rowNumber( static_cast<FileInfo *>( index.internalPointer() ) );
+
+    report( "model_row_number", timer.nsecsElapsed(), indexes.size() );
+}
+
+
+QVector<TreemapLayoutNode> Benchmark::treemapLayout()
+{
+    FileInfo * toplevel = _tree->firstToplevel();
+    QRectF rect( 0.0, 0.0, BENCHMARK_TREEMAP_WIDTH, BENCHMARK_TREEMAP_HEIGHT );
+
+    if ( ! toplevel )
+	return QVector<TreemapLayoutNode>();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    TreemapLayout layout( DefaultMinTileSize, 0, DefaultHeightScaleFactor );
+    QVector<TreemapLayoutNode> nodes = layout.layout( toplevel, rect, CushionSurface() );
+
+    report( "treemap_layout", timer.nsecsElapsed(), nodes.size() );
+
+    QThreadPool threadPool;
+    timer.start();
+
+    TreemapLayout parallelLayout( DefaultMinTileSize, 0, DefaultHeightScaleFactor, &threadPool );
+    QVector<TreemapLayoutNode> parallelNodes = parallelLayout.layout( toplevel, rect, CushionSurface() );
+
+    report( "treemap_layout_parallel", timer.nsecsElapsed(), parallelNodes.size(),
+	    QString( ",\"threads\":%1" ).arg( threadPool.maxThreadCount() ) );
+
+    return nodes;
+}
+
+
+void Benchmark::renderCushions( const QVector<TreemapLayoutNode> & nodes )
+{
+    CushionParams params;
+    params.color	  = QColor( 0x40, 0x80, 0xc0 );
+    params.ambientLight	  = DefaultAmbientLight;
+    params.lightX	  = DefaultLightX;
+    params.lightY	  = DefaultLightY;
+    params.lightZ	  = DefaultLightZ;
+    params.ensureContrast = true;
+
+    qint64 cushions = 0;
+    qint64 pixels   = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    foreach ( const TreemapLayoutNode & node, nodes )
+    {
+	if ( node.orig->isDir() || node.orig->isDotEntry() )
+	    continue;
+
+	params.rect    = node.rect;
+	params.surface = node.surface;
+
+	QImage image = TreemapTile::renderCushion( params );
+	pixels += (qint64) image.width() * image.height();
+	++cushions;
+    }
+
+    qint64 nanosec = timer.nsecsElapsed();
+    double megapixels = pixels / 1000000.0;
+
+    report( "render_cushion", nanosec, cushions,
+	    QString( ",\"megapixels\":%1,\"megapixelsPerSec\":%2" )
+	    .arg( megapixels, 0, 'f', 2 )
+	    .arg( nanosec > 0 ? megapixels * 1000000000.0 / nanosec : 0.0, 0, 'f', 1 ) );
+}
+
+
+void Benchmark::mimeCategories()
+{
+    QStringList names;
+    collectNames( _tree->firstToplevel(), names, MICRO_BENCHMARK_MIME_CALLS );
+
+    if ( names.isEmpty() )
+	return;
+
+    MimeCategorizer * categorizer = MimeCategorizer::instance();
+    qint64 calls = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while ( calls < MICRO_BENCHMARK_MIME_CALLS )
+    {
+	for ( int i = 0; i < names.size() && calls < MICRO_BENCHMARK_MIME_CALLS; ++i, ++calls )
+	    categorizer->category( names.at( i ) );
+    }
+
+    report( "mime_category", timer.nsecsElapsed(), calls,
+	    QString( ",\"names\":%1" ).arg( names.size() ) );
+}
+
+
+void Benchmark::collectNames( FileInfo * subtree, QStringList & names, int max )
+{
+    if ( ! subtree )
+	return;
+
+    FileInfoIterator it( subtree );
+
+    while ( *it && names.size() < max )
+    {
+	if ( (*it)->isDirInfo() )
+	    collectNames( *it, names, max );
+	else
+	    names << (*it)->name();
+
+	++it;
+    }
+}
+
+
+qint64 Benchmark::itemCount( DirTree * tree ) const
+{
+    FileInfo * toplevel = tree->firstToplevel();
+
+    return toplevel ? toplevel->totalItems() + 1 : 0;
+}
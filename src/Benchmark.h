@@ -0,0 +1,185 @@
+/*
+ *   File name: Benchmark.h
+ *   Summary:	Headless benchmark of reading and processing a tree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef Benchmark_h
+#define Benchmark_h
+
+
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QVector>
+
+#include "DataColumns.h"
+#include "TreemapLayout.h"
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirTreeModel;
+    class DirInfo;
+
+    /**
+     * Benchmark for 'qdirstat --benchmark': Read a directory without any
+     * GUI and measure the main operations on the tree:
+     *
+     *	 - reading the directory tree
+     *	 - writing a cache file and reading it again
+     *	 - sorting the children of all directories by some columns
+     *	 - laying out and rendering the treemap
+     *	 - collecting the file size and file type statistics
+     *
+     * Each result is printed to stdout as one line of JSON, so the results
+     * of different runs and versions can be compared by scripts:
+     *
+     *	 {"tree":"wide","benchmark":"scan","millisec":812.3,"items":100000,"itemsPerSec":123107}
+     *
+     * test/util/create-synthetic-tree creates reproducible trees for this,
+     * and test/util/run-benchmarks runs this for each of them.
+     *
+     * 'qdirstat --micro-benchmark' reads a cache file instead and measures
+     * the hot paths of the GUI (see runMicro()).
+     **/
+    class Benchmark
+    {
+    public:
+
+	/**
+	 * Constructor. 'path' is the directory for run() or the cache file
+	 * for runMicro(). 'label' is the name of the tree in the results; it
+	 * defaults to the last component of 'path'.
+	 **/
+	Benchmark( const QString & path, const QString & label = QString() );
+
+	/**
+	 * Destructor.
+	 **/
+	~Benchmark();
+
+	/**
+	 * Run all benchmarks. Return the exit code for the program.
+	 **/
+	int run();
+
+	/**
+	 * Read the cache file into a DirTreeModel and measure:
+	 *
+	 *   - index(), data(), parent() and rowNumber() of the model like a
+	 *     view that expanded all directories and is scrolled through them
+	 *   - sortedChildren() for each column
+	 *   - the treemap layout with and without worker threads
+	 *   - renderCushion() for each file tile
+	 *   - MimeCategorizer::category() for a million file names
+	 *
+	 * This needs a QApplication (for the icons and the palette of the
+	 * model), but no display. Return the exit code for the program.
+	 **/
+	int runMicro();
+
+
+    protected:
+
+	/**
+	 * Read the directory (or with 'fromCache', the cache file) into
+	 * _tree. Return 'true' on success.
+	 **/
+	bool scan( bool fromCache = false );
+
+	/**
+	 * Write a cache file and read it into another tree. Return 'true' on
+	 * success.
+	 **/
+	bool cacheRoundTrip();
+
+	/**
+	 * Sort the children of all directories by 'sortCol'.
+	 **/
+	void sort( DataColumn sortCol, const QString & name );
+
+	/**
+	 * Sort the children of 'dir' and of all its subdirectories by
+	 * 'sortCol'. Return the number of sorted children.
+	 **/
+	qint64 sortSubtree( DirInfo * dir, DataColumn sortCol );
+
+	/**
+	 * Export the treemap of the tree.
+	 **/
+	bool treemap();
+
+	/**
+	 * Collect the file size and file type statistics.
+	 **/
+	void stats();
+
+	/**
+	 * Report the memory usage of the tree.
+	 **/
+	void memory();
+
+	/**
+	 * Call index(), data(), parent() and rowNumber() of _model for up to
+	 * MICRO_BENCHMARK_MAX_ROWS rows.
+	 **/
+	void modelAccess();
+
+	/**
+	 * Lay out the treemap of the tree and return the nodes, once in the
+	 * calling thread and once with worker threads.
+	 **/
+	QVector<TreemapLayoutNode> treemapLayout();
+
+	/**
+	 * Render the cushions of all file tiles in 'nodes'.
+	 **/
+	void renderCushions( const QVector<TreemapLayoutNode> & nodes );
+
+	/**
+	 * Find the MIME category of a million file names from the tree.
+	 **/
+	void mimeCategories();
+
+	/**
+	 * Add the names of all files in 'subtree' to 'names' until there are
+	 * 'max' of them.
+	 **/
+	void collectNames( FileInfo * subtree, QStringList & names, int max );
+
+	/**
+	 * Print the result of benchmark 'name' that processed 'items' items
+	 * in 'nanosec' nanoseconds. 'extra' is added to the JSON object as
+	 * it is (",\"key\":value").
+	 **/
+	void report( const QString & name,
+		     qint64	     nanosec,
+		     qint64	     items,
+		     const QString & extra = QString() );
+
+	/**
+	 * Return the number of items in the tree.
+	 **/
+	qint64 itemCount( DirTree * tree ) const;
+
+
+	//
+	// Data members
+	//
+
+	QString	       _path;
+	QString	       _label;
+	QTemporaryDir  _tmpDir;	// for the cache file and the treemap image
+	DirTree *      _tree;
+	DirTreeModel * _model;	// only for runMicro(); owns _tree then
+    };
+
+}	// namespace QDirStat
+
+
+#endif	// Benchmark_h
@@ -0,0 +1,148 @@
+/*
+ *   File name: BtrfsQgroups.cpp
+ *   Summary:	Btrfs subvolume sizes from the quota groups for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>	// memset()
+
+#include <QFile>
+#include <QHash>
+
+#include "BtrfsQgroups.h"
+#include "Logger.h"
+
+#if HAVE_BTRFS_QGROUPS
+#  include <sys/ioctl.h>
+#  include <linux/btrfs.h>
+#endif
+
+#define SYS_FS_BTRFS	"/sys/fs/btrfs/"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Subvolume usage by path as read with updateCache().
+     **/
+    QHash<QString, SubvolumeUsage> usageCache;
+
+
+    /**
+     * Read one number from the sysfs file 'path'. Return -1 if there is
+     * none.
+     **/
+    FileSize readSysfsNumber( const QString & path )
+    {
+	QFile file( path );
+
+	if ( ! file.open( QIODevice::ReadOnly ) )
+	    return -1;
+
+	bool ok = false;
+	FileSize value = file.readAll().trimmed().toLongLong( &ok );
+
+	return ok ? value : -1;
+    }
+
+
+#if HAVE_BTRFS_QGROUPS && defined( BTRFS_IOC_GET_SUBVOL_INFO )
+
+    /**
+     * Format a Btrfs filesystem ID like the names in /sys/fs/btrfs/.
+     **/
+    QString formatFsid( const __u8 * fsid )
+    {
+	QString uuid = QString::fromLatin1( QByteArray( (const char *) fsid, BTRFS_FSID_SIZE ).toHex() );
+
+	uuid.insert( 20, '-' );
+	uuid.insert( 16, '-' );
+	uuid.insert( 12, '-' );
+	uuid.insert(  8, '-' );
+
+	return uuid;
+    }
+
+#endif
+
+}	// namespace
+
+
+
+SubvolumeUsage BtrfsQgroups::subvolumeUsage( const QString & path )
+{
+    SubvolumeUsage usage;
+
+#if HAVE_BTRFS_QGROUPS && defined( BTRFS_IOC_GET_SUBVOL_INFO )
+
+    int fd = open( path.toUtf8(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if ( fd < 0 )
+	return usage;
+
+    struct btrfs_ioctl_fs_info_args	  fsInfo;
+    struct btrfs_ioctl_get_subvol_info_args subvolInfo;
+
+    memset( &fsInfo,	 0, sizeof( fsInfo )	 );
+    memset( &subvolInfo, 0, sizeof( subvolInfo ) );
+
+    bool ok = ioctl( fd, BTRFS_IOC_FS_INFO,	    &fsInfo	) == 0 &&
+	      ioctl( fd, BTRFS_IOC_GET_SUBVOL_INFO, &subvolInfo ) == 0;
+    close( fd );
+
+    if ( ! ok )
+	return usage;
+
+    QString qgroupDir = QString( SYS_FS_BTRFS "%1/qgroups/0_%2/" )
+	.arg( formatFsid( fsInfo.fsid ) )
+	.arg( (qulonglong) subvolInfo.treeid );
+
+    usage.referenced = readSysfsNumber( qgroupDir + "referenced" );
+    usage.exclusive  = readSysfsNumber( qgroupDir + "exclusive"	 );
+
+    if ( ! usage.isValid() )
+	usage.exclusive = -1;
+
+#else
+
+    Q_UNUSED( path );
+
+#endif
+
+    return usage;
+}
+
+
+SubvolumeUsage BtrfsQgroups::updateCache( const QString & path )
+{
+    SubvolumeUsage usage = subvolumeUsage( path );
+
+    if ( usage.isValid() )
+    {
+	logDebug() << "Btrfs subvolume " << path
+		   << ": " << formatSize( usage.referenced ) << " referenced, "
+		   << formatSize( usage.exclusive ) << " exclusive" << endl;
+
+	usageCache.insert( path, usage );
+    }
+    else
+    {
+	usageCache.remove( path );
+    }
+
+    return usage;
+}
+
+
+SubvolumeUsage BtrfsQgroups::cachedUsage( const QString & path )
+{
+    return usageCache.value( path );
+}
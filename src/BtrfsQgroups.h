@@ -0,0 +1,99 @@
+/*
+ *   File name: BtrfsQgroups.h
+ *   Summary:	Btrfs subvolume sizes from the quota groups for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef BtrfsQgroups_h
+#define BtrfsQgroups_h
+
+
+#include <QString>
+
+#include "FileInfo.h"	// FileSize
+
+
+#define HAVE_BTRFS_QGROUPS 0
+
+#if defined( __linux__ ) && defined( __has_include )
+#  if __has_include( <linux/btrfs.h> )
+#    undef  HAVE_BTRFS_QGROUPS
+#    define HAVE_BTRFS_QGROUPS 1
+#  endif
+#endif
+
+
+namespace QDirStat
+{
+    /**
+     * The disk usage of one Btrfs subvolume as known by its quota group
+     * (qgroup): 'referenced' is everything the subvolume can reach,
+     * 'exclusive' is what would be freed if it were deleted, i.e. what is
+     * not shared with snapshots or reflinked copies.
+     **/
+    struct SubvolumeUsage
+    {
+	SubvolumeUsage():
+	    referenced( -1 ),
+	    exclusive( -1 )
+	    {}
+
+	bool isValid() const { return referenced >= 0; }
+
+	FileSize referenced;
+	FileSize exclusive;
+    };
+
+
+    /**
+     * Reading the subvolume sizes that Btrfs keeps track of anyway when
+     * quotas are enabled ("btrfs quota enable"), so an overview is
+     * available without reading any directories.
+     *
+     * The subvolume ID is found with the unprivileged
+     * BTRFS_IOC_GET_SUBVOL_INFO ioctl (Linux 4.18 and later), the sizes are
+     * read from /sys/fs/btrfs/<fsid>/qgroups/0_<id>/ (Linux 5.9 and later).
+     * If any of that is not available, or if quotas are disabled, there
+     * simply is no usage information.
+     **/
+    namespace BtrfsQgroups
+    {
+	/**
+	 * Return the usage of the Btrfs subvolume whose top directory is
+	 * 'path'. The result is invalid if that is not a subvolume with a
+	 * quota group.
+	 *
+	 * This does not check if 'path' is on Btrfs at all, and it might
+	 * block if it is on a stale network mount, so only use it when the
+	 * filesystem is known to be Btrfs or in a worker thread.
+	 *
+	 * This can be called from any thread.
+	 **/
+	SubvolumeUsage subvolumeUsage( const QString & path );
+
+	/**
+	 * Read the usage of the subvolume at 'path' like subvolumeUsage()
+	 * and remember it for cachedUsage(). Return the usage.
+	 *
+	 * This is only for the main thread.
+	 **/
+	SubvolumeUsage updateCache( const QString & path );
+
+	/**
+	 * Return the usage of the subvolume at 'path' that was last read
+	 * with updateCache(). This does no system calls, so it is cheap
+	 * enough for the views.
+	 *
+	 * This is only for the main thread.
+	 **/
+	SubvolumeUsage cachedUsage( const QString & path );
+
+    }	// namespace BtrfsQgroups
+
+}	// namespace QDirStat
+
+
+#endif	// BtrfsQgroups_h
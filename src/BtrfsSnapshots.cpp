@@ -0,0 +1,722 @@
+/*
+ *   File name: BtrfsSnapshots.cpp
+ *   Summary:	Reading Btrfs snapshots incrementally for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>	// memset(), memcpy()
+
+#include <QElapsedTimer>
+
+#include "BtrfsSnapshots.h"
+#include "DirInfo.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+#define HAVE_BTRFS_SNAPSHOTS 0
+
+#if defined( __linux__ ) && defined( __has_include )
+#  if __has_include( <linux/btrfs.h> ) && __has_include( <linux/btrfs_tree.h> )
+#    include <linux/btrfs.h>
+#    if defined( BTRFS_IOC_GET_SUBVOL_INFO )
+#      undef  HAVE_BTRFS_SNAPSHOTS
+#      define HAVE_BTRFS_SNAPSHOTS 1
+#    endif
+#  endif
+#endif
+
+#if HAVE_BTRFS_SNAPSHOTS
+#  include <sys/ioctl.h>
+#  include <endian.h>		// le64toh()
+#  include <linux/types.h>
+#  include <linux/btrfs_tree.h>
+#endif
+
+
+// Result buffer size for BTRFS_IOC_TREE_SEARCH_V2
+#define BTRFS_SEARCH_BUFFER_SIZE	( 256 * 1024 )
+
+
+using namespace QDirStat;
+
+
+#if HAVE_BTRFS_SNAPSHOTS
+
+namespace
+{
+    /**
+     * Iterator over the items of a subvolume tree with
+     * BTRFS_IOC_TREE_SEARCH_V2.
+     **/
+    class TreeSearch
+    {
+    public:
+
+	/**
+	 * Constructor for the items of the subvolume of 'fd' from key
+	 * ('minObjectId', 'minType', 0) to ('maxObjectId', 'maxType', max)
+	 * in tree blocks that were written in transaction 'minTransid' or
+	 * later. The key range is compared as a whole, so this also
+	 * returns other types of items of the objects in between.
+	 **/
+	TreeSearch( int	    fd,
+		    quint64 minObjectId,
+		    quint64 maxObjectId,
+		    quint32 minType,
+		    quint32 maxType,
+		    quint64 minTransid ):
+	    _fd( fd ),
+	    _buffer( ( sizeof( struct btrfs_ioctl_search_args_v2 ) +
+		       BTRFS_SEARCH_BUFFER_SIZE ) / sizeof( uint64_t ) ),
+	    _args( (struct btrfs_ioctl_search_args_v2 *) _buffer.data() ),
+	    _item( 0 ),
+	    _count( 0 ),
+	    _index( 0 ),
+	    _pos( 0 ),
+	    _atEnd( false ),
+	    _failed( false )
+	{
+	    struct btrfs_ioctl_search_key & key = _args->key;
+	    memset( &key, 0, sizeof( key ) );
+	    memset( &_header, 0, sizeof( _header ) );
+
+	    key.tree_id	     = 0;	// The subvolume of 'fd'
+	    key.min_objectid = minObjectId;
+	    key.max_objectid = maxObjectId;
+	    key.min_type     = minType;
+	    key.max_type     = maxType;
+	    key.min_offset   = 0;
+	    key.max_offset   = (uint64_t) -1;
+	    key.min_transid  = minTransid;
+	    key.max_transid  = (uint64_t) -1;
+	}
+
+	/**
+	 * Advance to the next item. Return 'false' at the end or if the
+	 * search failed (see failed()).
+	 **/
+	bool next()
+	{
+	    if ( _index >= _count && ! fetch() )
+		return false;
+
+	    const char * data = (const char *) _args->buf;
+
+	    memcpy( &_header, data + _pos, sizeof( _header ) );
+	    _item = data + _pos + sizeof( _header );
+	    _pos += sizeof( _header ) + _header.len;
+	    ++_index;
+
+	    return true;
+	}
+
+	/**
+	 * Return the header of the current item.
+	 **/
+	const struct btrfs_ioctl_search_header & header() const { return _header; }
+
+	/**
+	 * Return the current item in the on-disk format: Little endian and
+	 * not necessarily aligned.
+	 **/
+	const char * item() const { return _item; }
+
+	/**
+	 * Return 'true' if the search failed.
+	 **/
+	bool failed() const { return _failed; }
+
+    protected:
+
+	/**
+	 * Fetch the next batch of items. Return 'false' if there are none.
+	 **/
+	bool fetch()
+	{
+	    if ( _atEnd )
+		return false;
+
+	    struct btrfs_ioctl_search_key & key = _args->key;
+
+	    if ( _count > 0 )
+	    {
+		// Continue after the last item
+
+		key.min_objectid = _header.objectid;
+		key.min_type	 = _header.type;
+		key.min_offset	 = _header.offset + 1;
+
+		if ( key.min_offset == 0 ) // Overflow
+		{
+		    if ( ++key.min_type == 0 )
+			++key.min_objectid;
+		}
+
+		if ( key.min_objectid > key.max_objectid ||
+		     ( key.min_objectid == key.max_objectid && key.min_type > key.max_type ) )
+		{
+		    _atEnd = true;
+		    return false;
+		}
+	    }
+
+	    while ( true )
+	    {
+		key.nr_items	= (uint32_t) -1;
+		_args->buf_size = BTRFS_SEARCH_BUFFER_SIZE;
+
+		if ( ioctl( _fd, BTRFS_IOC_TREE_SEARCH_V2, _args ) == 0 )
+		    break;
+
+		if ( errno != EINTR )
+		{
+		    _failed = true;
+		    _atEnd  = true;
+		    return false;
+		}
+	    }
+
+	    _count = key.nr_items;
+	    _index = 0;
+	    _pos   = 0;
+	    _atEnd = _count == 0;
+
+	    return ! _atEnd;
+	}
+
+
+	int				 _fd;
+	QVector<uint64_t>		 _buffer;
+	struct btrfs_ioctl_search_args_v2 * _args;
+	struct btrfs_ioctl_search_header _header;
+	const char *			 _item;
+	quint32				 _count;
+	quint32				 _index;
+	quint64				 _pos;
+	bool				 _atEnd;
+	bool				 _failed;
+    };
+
+
+    /**
+     * Add the parent directories of the current item of 'search' to
+     * 'parents_ret' if it is an i-node reference.
+     **/
+    void addParents( const TreeSearch & search, QMultiHash<quint64, quint64> & parents_ret )
+    {
+	const struct btrfs_ioctl_search_header & header = search.header();
+
+	if ( header.type == BTRFS_INODE_REF_KEY )
+	{
+	    // The offset of the key is the parent directory
+
+	    parents_ret.insert( header.objectid, header.offset );
+	}
+	else if ( header.type == BTRFS_INODE_EXTREF_KEY )
+	{
+	    // Hard links in many directories: Each reference knows its parent
+
+	    quint32 pos = 0;
+
+	    while ( pos + sizeof( struct btrfs_inode_extref ) <= header.len )
+	    {
+		struct btrfs_inode_extref extref;
+		memcpy( &extref, search.item() + pos, sizeof( extref ) );
+
+		parents_ret.insert( header.objectid, le64toh( extref.parent_objectid ) );
+		pos += sizeof( extref ) + le16toh( extref.name_len );
+	    }
+	}
+    }
+
+
+    /**
+     * Return the path of directory 'dirIno' relative to the subvolume of
+     * 'fd' in 'path_ret'. Return 'false' if it can't be found, e.g.
+     * because it was deleted.
+     **/
+    bool dirPath( int fd, quint64 dirIno, QString & path_ret )
+    {
+	struct btrfs_ioctl_ino_lookup_args args;
+	memset( &args, 0, sizeof( args ) );
+	args.treeid   = 0;	// The subvolume of 'fd'
+	args.objectid = dirIno;
+
+	if ( ioctl( fd, BTRFS_IOC_INO_LOOKUP, &args ) != 0 )
+	    return false;
+
+	args.name[ sizeof( args.name ) - 1 ] = '\0';
+	path_ret = QString::fromUtf8( args.name );
+
+	if ( path_ret.endsWith( '/' ) )
+	    path_ret.chop( 1 );
+
+	return true;
+    }
+
+
+    /**
+     * Return 'uuid' as a QByteArray or an empty one if it is all zeroes.
+     **/
+    QByteArray uuidBytes( const __u8 * uuid )
+    {
+	for ( int i = 0; i < BTRFS_UUID_SIZE; ++i )
+	{
+	    if ( uuid[ i ] )
+		return QByteArray( (const char *) uuid, BTRFS_UUID_SIZE );
+	}
+
+	return QByteArray();
+    }
+
+}	// namespace
+
+#endif	// HAVE_BTRFS_SNAPSHOTS
+
+
+
+bool BtrfsSnapshots::isAvailable()
+{
+    return HAVE_BTRFS_SNAPSHOTS != 0;
+}
+
+
+SubvolumeInfo BtrfsSnapshots::subvolumeInfo( const QString & path )
+{
+    SubvolumeInfo info;
+
+#if HAVE_BTRFS_SNAPSHOTS
+
+    int fd = open( path.toUtf8(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if ( fd < 0 )
+	return info;
+
+    struct btrfs_ioctl_get_subvol_info_args subvolInfo;
+    memset( &subvolInfo, 0, sizeof( subvolInfo ) );
+
+    bool ok = ioctl( fd, BTRFS_IOC_GET_SUBVOL_INFO, &subvolInfo ) == 0;
+    close( fd );
+
+    if ( ! ok )
+	return info;
+
+    info.uuid	    = uuidBytes( subvolInfo.uuid );
+    info.parentUuid = uuidBytes( subvolInfo.parent_uuid );
+    info.otransid   = subvolInfo.otransid;
+    info.ctransid   = subvolInfo.ctransid;
+    info.readOnly   = ( subvolInfo.flags & BTRFS_SUBVOL_RDONLY ) != 0;
+
+#else
+
+    Q_UNUSED( path );
+
+#endif
+
+    return info;
+}
+
+
+bool BtrfsSnapshots::canCompare( const SubvolumeInfo & a,
+				 const SubvolumeInfo & b,
+				 bool *		       aIsOlder_ret )
+{
+    if ( ! a.isValid() || ! b.isValid() || a.uuid == b.uuid )
+	return false;
+
+    // The changes are found in the newer one, so the older one must not
+    // have changed since it was created: Everything that was written
+    // since then is in the newer one only.
+
+    bool aIsOlder;
+
+    if ( a.isUnchangedSnapshot() && b.isUnchangedSnapshot() )
+	aIsOlder = a.otransid <= b.otransid;
+    else if ( a.isUnchangedSnapshot() || b.isUnchangedSnapshot() )
+	aIsOlder = a.isUnchangedSnapshot();
+    else
+	return false;
+
+    bool related =
+	( ! a.parentUuid.isEmpty() && a.parentUuid == b.parentUuid ) || // Both of the same
+	a.parentUuid == b.uuid ||	// 'a' is a snapshot of 'b'
+	b.parentUuid == a.uuid;		// 'b' is a snapshot of 'a'
+
+    if ( related && aIsOlder_ret )
+	*aIsOlder_ret = aIsOlder;
+
+    return related;
+}
+
+
+bool BtrfsSnapshots::changedDirs( const QString & path,
+				  quint64	  sinceTransid,
+				  QSet<QString> & changedDirs_ret )
+{
+#if HAVE_BTRFS_SNAPSHOTS
+
+    // The tree search needs CAP_SYS_ADMIN; don't even try without root
+    // privileges. This is also checked by the kernel, of course.
+
+    if ( geteuid() != 0 )
+	return false;
+
+    int fd = open( path.toUtf8(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if ( fd < 0 )
+	return false;
+
+    QSet<quint64> dirs;		// Directories to read again
+    QSet<quint64> files;	// Changed non-directories
+    QMultiHash<quint64, quint64> parents;
+
+    // All items in the tree blocks that were written since then. Those
+    // include unchanged neighbours of the changed items; each i-node item
+    // knows its own last transaction.
+
+    TreeSearch search( fd,
+		       BTRFS_FIRST_FREE_OBJECTID, BTRFS_LAST_FREE_OBJECTID,
+		       BTRFS_INODE_ITEM_KEY, BTRFS_INODE_EXTREF_KEY,
+		       sinceTransid );
+
+    while ( search.next() )
+    {
+	const struct btrfs_ioctl_search_header & header = search.header();
+
+	if ( header.type == BTRFS_INODE_ITEM_KEY &&
+	     header.len >= sizeof( struct btrfs_inode_item ) )
+	{
+	    struct btrfs_inode_item item;
+	    memcpy( &item, search.item(), sizeof( item ) );
+
+	    if ( le64toh( item.transid ) >= sinceTransid )
+	    {
+		if ( S_ISDIR( le32toh( item.mode ) ) )
+		    dirs.insert( header.objectid );
+		else
+		    files.insert( header.objectid );
+	    }
+	}
+	else
+	{
+	    addParents( search, parents );
+	}
+    }
+
+    bool ok = ! search.failed();
+
+    // The references of a changed file might be in a tree block that was
+    // not written: Look them up one by one.
+
+    foreach ( quint64 ino, files )
+    {
+	if ( ! ok )
+	    break;
+
+	if ( ! parents.contains( ino ) )
+	{
+	    TreeSearch refSearch( fd, ino, ino, BTRFS_INODE_REF_KEY, BTRFS_INODE_EXTREF_KEY, 0 );
+
+	    while ( refSearch.next() )
+		addParents( refSearch, parents );
+
+	    ok = ! refSearch.failed();
+	}
+
+	foreach ( quint64 parent, parents.values( ino ) )
+	    dirs.insert( parent );
+    }
+
+    // Directories that were deleted are not found, but then their parent
+    // changed, too.
+
+    foreach ( quint64 dirIno, dirs )
+    {
+	if ( ! ok )
+	    break;
+
+	QString relPath;
+
+	if ( dirPath( fd, dirIno, relPath ) )
+	    changedDirs_ret.insert( relPath );
+	else if ( errno == EPERM )
+	    ok = false;
+    }
+
+    close( fd );
+
+    logDebug() << path << ": " << files.size() << " files and "
+	       << changedDirs_ret.size() << " directories changed since transaction "
+	       << sinceTransid << endl;
+
+    return ok;
+
+#else
+
+    Q_UNUSED( path );
+    Q_UNUSED( sinceTransid );
+    Q_UNUSED( changedDirs_ret );
+
+    return false;
+
+#endif
+}
+
+
+
+
+SnapshotBaselinePtr SnapshotBaseline::create( DirInfo *		    base,
+					      const SubvolumeInfo & baseInfo,
+					      const QString &	    path,
+					      const SubvolumeInfo & info )
+{
+    bool baseIsOlder = false;
+
+    if ( ! base || ! BtrfsSnapshots::canCompare( baseInfo, info, &baseIsOlder ) )
+	return SnapshotBaselinePtr();
+
+    // What changed since the older one was created is in the newer one
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QSet<QString> changedDirs;
+    QString newerPath = baseIsOlder ? path : base->url();
+    quint64 since     = baseIsOlder ? baseInfo.otransid : info.otransid;
+
+    if ( ! BtrfsSnapshots::changedDirs( newerPath, since, changedDirs ) )
+    {
+	logInfo() << "Can't find the changes in " << newerPath << " - reading " << path << endl;
+	return SnapshotBaselinePtr();
+    }
+
+    SnapshotBaselinePtr baseline( new SnapshotBaseline( base, path, changedDirs ) );
+    CHECK_NEW( baseline.data() );
+
+    logInfo() << "Reading " << changedDirs.size() << " changed directories of " << path
+	      << " and copying the rest from " << base->url()
+	      << " (" << timer.elapsed() << " millisec)" << endl;
+
+    return baseline->ok() ? baseline : SnapshotBaselinePtr();
+}
+
+
+SnapshotBaseline::SnapshotBaseline( DirInfo *		  base,
+				    const QString &	  path,
+				    const QSet<QString> & changedDirs ):
+    _basePath( base ? base->url() : QString() ),
+    _path( path ),
+    _changedDirs( changedDirs )
+{
+    foreach ( const QString & relPath, changedDirs )
+	addDirtyDir( relPath );
+
+    if ( base && base->readState() == DirFinished )
+	addDir( base, "" );
+}
+
+
+bool SnapshotBaseline::relativePath( const QString & url, QString & relPath_ret ) const
+{
+    if ( url == _path )
+    {
+	relPath_ret = "";
+	return true;
+    }
+
+    if ( url.size() <= _path.size()	 ||
+	 url.at( _path.size() ) != '/'	 ||
+	 ! url.startsWith( _path ) )
+    {
+	return false;
+    }
+
+    relPath_ret = url.mid( _path.size() + 1 );
+
+    return true;
+}
+
+
+void SnapshotBaseline::addDir( DirInfo * dir, const QString & relPath )
+{
+    quint32 dirNo = _children.size();
+    _dirs.insert( relPath, dirNo );
+    _children.resize( dirNo + 1 );
+
+    QVector<SnapshotNode> children;
+    QList<DirInfo *> subDirs;
+
+    if ( ! addChildren( dir, children, subDirs ) )
+	addDirtyDir( relPath );
+
+    _children[ dirNo ] = children;
+
+    foreach ( DirInfo * subDir, subDirs )
+    {
+	QString subPath = relPath.isEmpty() ? subDir->name() : relPath + "/" + subDir->name();
+
+	// Subdirectories that were not read completely are read again, and
+	// so are mounted filesystems and nested subvolumes
+
+	if ( subDir->readState() != DirFinished ||
+	     subDir->isExcluded()		||
+	     subDir->isEstimated()		||
+	     subDir->isPendingSubtree()		||
+	     subDir->isMountPoint() )
+	{
+	    addDirtyDir( subPath );
+	}
+	else
+	{
+	    addDir( subDir, subPath );
+	}
+    }
+}
+
+
+bool SnapshotBaseline::addChildren( FileInfo *		    parent,
+				    QVector<SnapshotNode> & children_ret,
+				    QList<DirInfo *> &	    subDirs_ret )
+{
+    bool complete = true;
+
+    for ( FileInfo * child = parent->firstChild(); child; child = child->next() )
+    {
+	if ( child->isPseudoDir() )
+	{
+	    complete = addChildren( child, children_ret, subDirs_ret ) && complete;
+	    continue;
+	}
+
+	// Aggregated files don't have nodes of their own
+
+	if ( child->isAggregate() || child->isPkgInfo() )
+	{
+	    complete = false;
+	    continue;
+	}
+
+	QByteArray name = child->name().toUtf8();
+
+	SnapshotNode node;
+	node.size	= child->rawByteSize();
+	node.blocks	= child->blocks();
+	node.mtime	= child->mtime();
+	node.mode	= child->mode();
+	node.links	= child->links();
+	node.uid	= child->uid();
+	node.gid	= child->gid();
+	node.nameOffset = _names.size();
+	node.nameLength = name.size();
+
+	_names += name;
+	children_ret << node;
+
+	if ( child->isDirInfo() )
+	    subDirs_ret << child->toDirInfo();
+    }
+
+    // The dot entry and the attic hold children of the same directory
+
+    if ( parent->dotEntry() )
+	complete = addChildren( parent->dotEntry(), children_ret, subDirs_ret ) && complete;
+
+    if ( parent->attic() )
+	complete = addChildren( parent->attic(), children_ret, subDirs_ret ) && complete;
+
+    return complete;
+}
+
+
+void SnapshotBaseline::addDirtyDir( QString relPath )
+{
+    // If a directory is already known, so are all its ancestors
+
+    while ( ! _dirtyDirs.contains( relPath ) )
+    {
+	_dirtyDirs.insert( relPath );
+
+	if ( relPath.isEmpty() )
+	    break;
+
+	int pos = relPath.lastIndexOf( '/' );
+	relPath = pos < 0 ? QString( "" ) : relPath.left( pos );
+    }
+}
+
+
+bool SnapshotBaseline::findUnchangedDir( const QString & url, quint32 & dirNo_ret ) const
+{
+    QString relPath;
+
+    if ( ! relativePath( url, relPath ) || _changedDirs.contains( relPath ) )
+	return false;
+
+    QHash<QString, quint32>::const_iterator it = _dirs.constFind( relPath );
+
+    if ( it == _dirs.constEnd() )
+	return false;
+
+    dirNo_ret = it.value();
+
+    return true;
+}
+
+
+bool SnapshotBaseline::isUnchangedSubtree( const QString & url ) const
+{
+    QString relPath;
+
+    return relativePath( url, relPath ) &&
+	! _dirtyDirs.contains( relPath ) &&
+	_dirs.contains( relPath );
+}
+
+
+bool SnapshotBaseline::isSameDir( const QString & url, ino_t inode ) const
+{
+    QString relPath;
+
+    if ( inode == 0 || ! relativePath( url, relPath ) || ! _dirs.contains( relPath ) )
+	return false;
+
+    QString basePath = relPath.isEmpty() ? _basePath : _basePath + "/" + relPath;
+    struct stat statInfo;
+
+    if ( lstat( basePath.toUtf8(), &statInfo ) != 0 )
+	return false;
+
+    return S_ISDIR( statInfo.st_mode ) && statInfo.st_ino == inode;
+}
+
+
+QString SnapshotBaseline::name( const SnapshotNode & node ) const
+{
+    return QString::fromUtf8( _names.constData() + node.nameOffset, node.nameLength );
+}
+
+
+void SnapshotBaseline::toStat( const SnapshotNode & node,
+			       dev_t		    device,
+			       struct stat &	    statInfo_ret )
+{
+    memset( &statInfo_ret, 0, sizeof( statInfo_ret ) );
+
+    statInfo_ret.st_dev	   = device;
+    statInfo_ret.st_ino	   = 0;
+    statInfo_ret.st_mode   = node.mode;
+    statInfo_ret.st_nlink  = node.links;
+    statInfo_ret.st_uid	   = node.uid;
+    statInfo_ret.st_gid	   = node.gid;
+    statInfo_ret.st_size   = node.size;
+    statInfo_ret.st_blocks = node.blocks;
+    statInfo_ret.st_mtime  = node.mtime;
+}
@@ -0,0 +1,277 @@
+/*
+ *   File name: BtrfsSnapshots.h
+ *   Summary:	Reading Btrfs snapshots incrementally for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef BtrfsSnapshots_h
+#define BtrfsSnapshots_h
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"	// FileSize
+
+
+namespace QDirStat
+{
+    class DirInfo;
+    class SnapshotBaseline;
+
+    typedef QSharedPointer<SnapshotBaseline> SnapshotBaselinePtr;
+
+
+    /**
+     * What a Btrfs subvolume knows about where it came from.
+     **/
+    struct SubvolumeInfo
+    {
+	SubvolumeInfo():
+	    otransid( 0 ),
+	    ctransid( 0 ),
+	    readOnly( false )
+	    {}
+
+	bool isValid() const { return ! uuid.isEmpty(); }
+
+	/**
+	 * Return 'true' if this is a read-only snapshot that did not change
+	 * since it was created.
+	 **/
+	bool isUnchangedSnapshot() const
+	    { return readOnly && ctransid <= otransid; }
+
+	/**
+	 * Return the transaction that the content is from.
+	 **/
+	quint64 contentTransid() const { return qMax( otransid, ctransid ); }
+
+	QByteArray uuid;
+	QByteArray parentUuid;	// Of the subvolume this is a snapshot of
+	quint64	   otransid;	// The transaction that created it
+	quint64	   ctransid;	// The transaction of the last change
+	bool	   readOnly;
+    };
+
+
+    /**
+     * Finding out in which directories two Btrfs snapshots of the same
+     * subvolume differ, so only those need to be read again.
+     *
+     * Each i-node item of a Btrfs subvolume knows the transaction in
+     * which it was changed last, and the tree search ioctl can skip all
+     * tree blocks that were not written since a given transaction (this
+     * is what "btrfs subvolume find-new" uses). Snapshots keep the
+     * i-numbers, so a directory whose i-node did not change since the
+     * other snapshot was created has the same entries there.
+     *
+     * The tree search and the i-number lookup need root privileges.
+     **/
+    namespace BtrfsSnapshots
+    {
+	/**
+	 * Return 'true' if this was built with support for this.
+	 **/
+	bool isAvailable();
+
+	/**
+	 * Return what the subvolume whose top directory is 'path' knows
+	 * about itself. The result is invalid if that is not a Btrfs
+	 * subvolume or if the kernel is older than 4.18.
+	 **/
+	SubvolumeInfo subvolumeInfo( const QString & path );
+
+	/**
+	 * Return 'true' if the directories in which 'a' and 'b' differ can
+	 * be found with changedDirs(): If one of them is a snapshot of the
+	 * other or both are snapshots of the same subvolume, and one of
+	 * them (the older one) did not change since it was created.
+	 * 'aIsOlder_ret' (if non-null) returns which one that is.
+	 **/
+	bool canCompare( const SubvolumeInfo & a,
+			 const SubvolumeInfo & b,
+			 bool *		       aIsOlder_ret = 0 );
+
+	/**
+	 * Find the directories of the subvolume at 'path' that changed in
+	 * transaction 'sinceTransid' or later: The ones whose own i-node
+	 * changed and the ones with a non-directory child whose i-node
+	 * changed. Add their paths relative to the top directory of the
+	 * subvolume ("" for the top directory itself) to 'changedDirs_ret'.
+	 *
+	 * Return 'false' if that could not be found out.
+	 **/
+	bool changedDirs( const QString & path,
+			  quint64	  sinceTransid,
+			  QSet<QString> & changedDirs_ret );
+
+    }	// namespace BtrfsSnapshots
+
+
+
+    /**
+     * One child of a directory in a SnapshotBaseline.
+     **/
+    struct SnapshotNode
+    {
+	FileSize size;
+	FileSize blocks;	// 512 byte blocks
+	time_t	 mtime;
+	mode_t	 mode;
+	nlink_t	 links;
+	uid_t	 uid;
+	gid_t	 gid;
+	quint32	 nameOffset;
+	quint32	 nameLength;
+    };
+
+
+    /**
+     * A Btrfs snapshot that is already in the tree (the base) as the
+     * baseline for reading another snapshot of the same subvolume (see
+     * DirTree::readSubvolume()): The directories in which they differ are
+     * read, the others are copied from the base. A subtree in which
+     * nothing changed at all is copied without any system calls.
+     *
+     * The nodes of the base cannot be shared with the other snapshot
+     * since each of them knows its parent, so they are copied, but only
+     * in memory.
+     *
+     * Directory paths are relative to the top directory of the snapshot.
+     * This is only for the main thread.
+     **/
+    class SnapshotBaseline
+    {
+    public:
+
+	/**
+	 * Create the baseline for reading the subvolume 'path' with the
+	 * subvolume in 'base' that is already read. Return 0 if the
+	 * directories in which they differ can't be found out.
+	 **/
+	static SnapshotBaselinePtr create( DirInfo *		 base,
+					   const SubvolumeInfo & baseInfo,
+					   const QString &	 path,
+					   const SubvolumeInfo & info );
+
+	/**
+	 * Constructor for reading 'path' with the subtree 'base' in memory;
+	 * 'changedDirs' are the directories in which they differ.
+	 **/
+	SnapshotBaseline( DirInfo *	      base,
+			  const QString &     path,
+			  const QSet<QString> & changedDirs );
+
+	/**
+	 * Return 'true' if there is anything to copy.
+	 **/
+	bool ok() const { return ! _children.isEmpty(); }
+
+	/**
+	 * Return the path of the snapshot that is read.
+	 **/
+	const QString & path() const { return _path; }
+
+	/**
+	 * Return the path of the base.
+	 **/
+	const QString & basePath() const { return _basePath; }
+
+	/**
+	 * Look up directory 'url' of the snapshot that is read. If its
+	 * entries are the same as in the base, return 'true' and its
+	 * directory number in 'dirNo_ret'.
+	 **/
+	bool findUnchangedDir( const QString & url, quint32 & dirNo_ret ) const;
+
+	/**
+	 * Return 'true' if nothing at all changed in the subtree of
+	 * directory 'url' of the snapshot that is read, provided that its
+	 * parent is the same directory as in the base.
+	 **/
+	bool isUnchangedSubtree( const QString & url ) const;
+
+	/**
+	 * Return 'true' if directory 'url' of the snapshot that is read is
+	 * the same directory as in the base, i.e. if it has the same
+	 * i-number 'inode' there. Below a directory that changed, a
+	 * subdirectory might just have the same name.
+	 *
+	 * This uses lstat().
+	 **/
+	bool isSameDir( const QString & url, ino_t inode ) const;
+
+	/**
+	 * Return the children of directory no. 'dirNo' in the base.
+	 **/
+	const QVector<SnapshotNode> & children( quint32 dirNo ) const
+	    { return _children.at( dirNo ); }
+
+	/**
+	 * Return the name of 'node'.
+	 **/
+	QString name( const SnapshotNode & node ) const;
+
+	/**
+	 * Fill 'statInfo_ret' with what lstat() would say about 'node' on
+	 * device 'device'. The i-number is unknown.
+	 **/
+	static void toStat( const SnapshotNode & node,
+			    dev_t		 device,
+			    struct stat &	 statInfo_ret );
+
+    protected:
+
+	/**
+	 * Return the path of 'url' relative to the snapshot that is read
+	 * in 'relPath_ret'. Return 'false' if it is not in the snapshot.
+	 **/
+	bool relativePath( const QString & url, QString & relPath_ret ) const;
+
+	/**
+	 * Copy directory 'dir' of the base with path 'relPath' and its
+	 * subdirectories.
+	 **/
+	void addDir( DirInfo * dir, const QString & relPath );
+
+	/**
+	 * Add the children of 'parent' (a directory or one of its pseudo
+	 * directories) to 'children_ret'; return the subdirectories in
+	 * 'subDirs_ret'. Return 'false' if not all of them could be added.
+	 **/
+	bool addChildren( FileInfo *		 parent,
+			  QVector<SnapshotNode> & children_ret,
+			  QList<DirInfo *> &	 subDirs_ret );
+
+	/**
+	 * Remember that something below 'relPath' changed.
+	 **/
+	void addDirtyDir( QString relPath );
+
+
+	QString			       _basePath;
+	QString			       _path;
+	QHash<QString, quint32>	       _dirs;	// Path -> directory number
+	QVector<QVector<SnapshotNode> > _children;
+	QByteArray		       _names;
+	QSet<QString>		       _changedDirs;
+	QSet<QString>		       _dirtyDirs;	// Changed somewhere below
+
+    };	// class SnapshotBaseline
+
+}	// namespace QDirStat
+
+
+#endif	// BtrfsSnapshots_h
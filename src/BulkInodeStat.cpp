@@ -0,0 +1,380 @@
+/*
+ *   File name: BulkInodeStat.cpp
+ *   Summary:	Filesystem-specific bulk i-node statistics for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>	// memset(), memcpy()
+
+#include <algorithm>
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "BulkInodeStat.h"
+
+
+#define HAVE_BULK_INODE_STAT 0
+
+#if defined( __linux__ ) && defined( __has_include )
+#  if __has_include( <linux/magic.h> ) && __has_include( <linux/btrfs.h> )
+#    undef  HAVE_BULK_INODE_STAT
+#    define HAVE_BULK_INODE_STAT 1
+#  endif
+#endif
+
+#if HAVE_BULK_INODE_STAT
+#  include <sys/ioctl.h>
+#  include <sys/vfs.h>		// fstatfs()
+#  include <sys/statvfs.h>	// fstatvfs()
+#  include <endian.h>		// le64toh()
+#  include <linux/types.h>
+#  include <linux/magic.h>	// XFS_SUPER_MAGIC, BTRFS_SUPER_MAGIC
+#  include <linux/btrfs.h>
+#  include <linux/btrfs_tree.h>
+#endif
+
+
+using namespace QDirStat;
+
+
+// Number of i-nodes per XFS_IOC_FSBULKSTAT call
+#define XFS_BULKSTAT_COUNT	4096
+
+// Result buffer size for BTRFS_IOC_TREE_SEARCH_V2
+#define BTRFS_SEARCH_BUFFER_SIZE	( 256 * 1024 )
+
+
+#if HAVE_BULK_INODE_STAT
+
+// The XFS bulkstat ioctl (version 1). The headers for this come with the
+// xfsprogs development package which is usually not installed, but this is
+// part of the kernel ABI, so it is defined here.
+
+struct XfsBstime
+{
+    __kernel_long_t tv_sec;
+    int32_t	    tv_nsec;
+};
+
+struct XfsBstat
+{
+    uint64_t	ino;
+    uint16_t	mode;
+    uint16_t	nlink;
+    uint32_t	uid;
+    uint32_t	gid;
+    uint32_t	rdev;
+    int32_t	blksize;
+    int64_t	size;
+    XfsBstime	atime;
+    XfsBstime	mtime;
+    XfsBstime	ctime;
+    int64_t	blocks;		// In filesystem blocks, not 512 byte blocks!
+    uint32_t	xflags;
+    int32_t	extsize;
+    int32_t	extents;
+    uint32_t	gen;
+    uint16_t	projidLo;
+    uint16_t	forkoff;
+    uint16_t	projidHi;
+    unsigned char pad[6];
+    uint32_t	cowextsize;
+    uint32_t	dmevmask;
+    uint16_t	dmstate;
+    uint16_t	aextents;
+};
+
+struct XfsFsopBulkreq
+{
+    uint64_t * lastip;
+    int32_t    icount;
+    void *     ubuffer;
+    int32_t *  ocount;
+};
+
+#define XFS_IOC_FSBULKSTAT	_IOWR( 'X', 101, struct XfsFsopBulkreq )
+
+#endif
+
+
+namespace
+{
+    // All tables collected so far. A null pointer means that the device is
+    // not supported; that result is cached, too.
+
+    QHash<dev_t, BulkInodeStat::Ptr> tables;
+    QMutex			     tablesMutex;
+}
+
+
+bool BulkInodeStat::isAvailable()
+{
+    return HAVE_BULK_INODE_STAT != 0;
+}
+
+
+BulkInodeStat::Ptr BulkInodeStat::forDirectory( int dirFd, dev_t dev )
+{
+    QMutexLocker locker( &tablesMutex );
+
+    if ( tables.contains( dev ) )
+	return tables.value( dev );
+
+    BulkInodeStat * table = 0;
+
+#if HAVE_BULK_INODE_STAT
+
+    // Both ioctls need CAP_SYS_ADMIN; don't even try without root
+    // privileges. This is also checked by the kernel, of course.
+
+    struct statfs fs;
+
+    if ( geteuid() == 0 && fstatfs( dirFd, &fs ) == 0 )
+    {
+	bool ok = false;
+	table = new BulkInodeStat();
+
+	if ( fs.f_type == XFS_SUPER_MAGIC )
+	    ok = table->collectXfs( dirFd );
+	else if ( fs.f_type == (__fsword_t) BTRFS_SUPER_MAGIC )
+	    ok = table->collectBtrfs( dirFd );
+
+	if ( ok )
+	    table->sort();
+	else
+	{
+	    delete table;
+	    table = 0;
+	}
+    }
+
+#else
+    (void) dirFd;
+#endif
+
+    Ptr ptr( table );
+    tables.insert( dev, ptr );
+
+    return ptr;
+}
+
+
+void BulkInodeStat::clear()
+{
+    QMutexLocker locker( &tablesMutex );
+    tables.clear();
+}
+
+
+bool BulkInodeStat::lookup( ino_t ino, dev_t dev, struct stat * statInfo ) const
+{
+    Inode key;
+    key.ino = ino;
+
+    QVector<Inode>::const_iterator it =
+	std::lower_bound( _inodes.constBegin(), _inodes.constEnd(), key,
+			  []( const Inode & a, const Inode & b ) { return a.ino < b.ino; } );
+
+    if ( it == _inodes.constEnd() || it->ino != ino )
+	return false;
+
+    statInfo->st_dev	= dev;
+    statInfo->st_ino	= ino;
+    statInfo->st_mode	= it->mode;
+    statInfo->st_nlink	= it->nlink;
+    statInfo->st_uid	= it->uid;
+    statInfo->st_gid	= it->gid;
+    statInfo->st_size	= it->size;
+    statInfo->st_blocks = it->blocks;
+    statInfo->st_mtime	= it->mtime;
+
+    return true;
+}
+
+
+void BulkInodeStat::sort()
+{
+    // XFS and Btrfs both return the i-nodes sorted by i-number, so this is
+    // normally a NOP; but it is cheap enough to make sure.
+
+    std::sort( _inodes.begin(), _inodes.end(),
+	       []( const Inode & a, const Inode & b ) { return a.ino < b.ino; } );
+}
+
+
+bool BulkInodeStat::collectXfs( int fd )
+{
+#if HAVE_BULK_INODE_STAT
+
+    // XFS reports the blocks in filesystem blocks
+
+    struct statvfs vfs;
+
+    if ( fstatvfs( fd, &vfs ) != 0 || vfs.f_frsize < 512 )
+	return false;
+
+    blkcnt_t blockFactor = vfs.f_frsize / 512;
+
+    QVector<XfsBstat> buffer( XFS_BULKSTAT_COUNT );
+    uint64_t lastIno = 0;
+    int32_t  count	 = 0;
+
+    XfsFsopBulkreq req;
+    req.lastip	= &lastIno;
+    req.icount	= XFS_BULKSTAT_COUNT;
+    req.ubuffer = buffer.data();
+    req.ocount	= &count;
+
+    while ( true )
+    {
+	if ( ioctl( fd, XFS_IOC_FSBULKSTAT, &req ) != 0 )
+	{
+	    if ( errno == EINTR )
+		continue;
+
+	    return false;
+	}
+
+	if ( count <= 0 ) // Done
+	    break;
+
+	for ( int i = 0; i < count; ++i )
+	{
+	    const XfsBstat & bstat = buffer[ i ];
+
+	    Inode inode;
+	    inode.ino	 = bstat.ino;
+	    inode.size	 = bstat.size;
+	    inode.blocks = bstat.blocks * blockFactor;
+	    inode.mtime	 = bstat.mtime.tv_sec;
+	    inode.mode	 = bstat.mode;
+	    inode.nlink	 = bstat.nlink;
+	    inode.uid	 = bstat.uid;
+	    inode.gid	 = bstat.gid;
+
+	    _inodes.append( inode );
+	}
+    }
+
+    return true;
+
+#else
+    (void) fd;
+    return false;
+#endif
+}
+
+
+bool BulkInodeStat::collectBtrfs( int fd )
+{
+#if HAVE_BULK_INODE_STAT
+
+    QVector<uint64_t> buffer( ( sizeof( struct btrfs_ioctl_search_args_v2 ) +
+				BTRFS_SEARCH_BUFFER_SIZE ) / sizeof( uint64_t ) );
+    struct btrfs_ioctl_search_args_v2 * args =
+	(struct btrfs_ioctl_search_args_v2 *) buffer.data();
+
+    // Search tree 0 is the subvolume tree of 'fd'. The key range is
+    // compared as a whole (object ID, type, offset), so this also returns
+    // all other items of each i-node; those are simply skipped.
+
+    struct btrfs_ioctl_search_key & key = args->key;
+    memset( &key, 0, sizeof( key ) );
+    key.tree_id	     = 0;
+    key.min_objectid = BTRFS_FIRST_FREE_OBJECTID;
+    key.max_objectid = BTRFS_LAST_FREE_OBJECTID;
+    key.min_type     = BTRFS_INODE_ITEM_KEY;
+    key.max_type     = BTRFS_INODE_ITEM_KEY;
+    key.min_offset   = 0;
+    key.max_offset   = (uint64_t) -1;
+    key.min_transid  = 0;
+    key.max_transid  = (uint64_t) -1;
+
+    while ( true )
+    {
+	key.nr_items   = (uint32_t) -1;
+	args->buf_size = BTRFS_SEARCH_BUFFER_SIZE;
+
+	if ( ioctl( fd, BTRFS_IOC_TREE_SEARCH_V2, args ) != 0 )
+	{
+	    if ( errno == EINTR )
+		continue;
+
+	    return false;
+	}
+
+	if ( key.nr_items == 0 ) // Done
+	    break;
+
+	const char * data = (const char *) args->buf;
+	uint64_t pos	  = 0;
+	struct btrfs_ioctl_search_header header;
+
+	for ( uint32_t i = 0; i < key.nr_items; ++i )
+	{
+	    memcpy( &header, data + pos, sizeof( header ) );
+	    pos += sizeof( header );
+
+	    if ( header.type == BTRFS_INODE_ITEM_KEY &&
+		 header.len >= sizeof( struct btrfs_inode_item ) )
+	    {
+		// The item is in the on-disk format: Little endian and
+		// not necessarily aligned
+
+		struct btrfs_inode_item item;
+		memcpy( &item, data + pos, sizeof( item ) );
+
+		uint64_t nbytes = le64toh( item.nbytes );
+
+		Inode inode;
+		inode.ino    = header.objectid;
+		inode.size   = le64toh( item.size );
+		inode.blocks = ( nbytes + 511 ) / 512;
+		inode.mtime  = le64toh( item.mtime.sec );
+		inode.mode   = le32toh( item.mode );
+		inode.nlink  = le32toh( item.nlink );
+		inode.uid    = le32toh( item.uid );
+		inode.gid    = le32toh( item.gid );
+
+		_inodes.append( inode );
+	    }
+
+	    pos += header.len;
+	}
+
+	// Continue after the last item
+
+	key.min_objectid = header.objectid;
+	key.min_type	 = header.type;
+	key.min_offset	 = header.offset + 1;
+
+	if ( key.min_offset == 0 ) // Overflow
+	{
+	    if ( ++key.min_type == 0 )
+		++key.min_objectid;
+	}
+
+	if ( key.min_objectid > key.max_objectid ||
+	     ( key.min_objectid == key.max_objectid && key.min_type > key.max_type ) )
+	{
+	    break;
+	}
+    }
+
+    return true;
+
+#else
+    (void) fd;
+    return false;
+#endif
+}
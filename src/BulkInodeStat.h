@@ -0,0 +1,142 @@
+/*
+ *   File name: BulkInodeStat.h
+ *   Summary:	Filesystem-specific bulk i-node statistics for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef BulkInodeStat_h
+#define BulkInodeStat_h
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <QVector>
+#include <QSharedPointer>
+
+
+namespace QDirStat
+{
+    /**
+     * The stat information of all i-nodes of one filesystem, obtained in
+     * bulk with filesystem-specific ioctls instead of one lstat() call for
+     * each directory entry:
+     *
+     *	 - XFS: XFS_IOC_FSBULKSTAT walks the i-node btrees and returns
+     *	   thousands of i-nodes per call.
+     *
+     *	 - Btrfs: BTRFS_IOC_TREE_SEARCH_V2 returns the INODE_ITEMs of one
+     *	   subvolume tree.
+     *
+     * Both need root privileges (CAP_SYS_ADMIN). Both have no path lookup
+     * at all, so they are several times faster than stat()ing each entry
+     * of a multi-TB filesystem.
+     *
+     * LocalDirReader looks up the i-numbers it got from getdents() here and
+     * only needs to stat() what is not found. Directories are always
+     * stat()ed anyway because they might be mount points: The i-number in
+     * the directory entry is the one of the covered directory, not of the
+     * root of the filesystem mounted there.
+     *
+     * One table is collected for each device the first time a directory
+     * on it is read, and it is kept until clear() is called. It is a
+     * snapshot, so it should be cleared before each new scan.
+     *
+     * This is thread-safe: Tables can be requested from any thread.
+     **/
+    class BulkInodeStat
+    {
+    public:
+
+	typedef QSharedPointer<const BulkInodeStat> Ptr;
+
+	/**
+	 * Return the table for the filesystem of the directory open as
+	 * 'dirFd', collecting it if this was not done yet. 'dev' is the
+	 * device of that directory.
+	 *
+	 * This returns 0 if the filesystem is not supported or if the
+	 * ioctls failed (typically because of missing privileges); in that
+	 * case, the caller should use stat() as usual. The result (even 0)
+	 * is cached, so this is cheap for all but the first call for each
+	 * device.
+	 *
+	 * Collecting a table may take a while for very large filesystems;
+	 * other threads requesting a table at the same time wait for that.
+	 **/
+	static Ptr forDirectory( int dirFd, dev_t dev );
+
+	/**
+	 * Discard all tables. Tables still in use by a LocalDirReader stay
+	 * valid until that reader is done with them.
+	 **/
+	static void clear();
+
+	/**
+	 * Return 'true' if this platform has any of the supported ioctls.
+	 **/
+	static bool isAvailable();
+
+	/**
+	 * Look up i-number 'ino' and fill the fields of 'statInfo' that
+	 * QDirStat uses. Leave the others untouched. Return 'false' if 'ino'
+	 * is not in this table.
+	 **/
+	bool lookup( ino_t ino, dev_t dev, struct stat * statInfo ) const;
+
+	/**
+	 * Return the number of i-nodes in this table.
+	 **/
+	int size() const { return _inodes.size(); }
+
+
+    protected:
+
+	/**
+	 * Compact stat information of one i-node.
+	 **/
+	struct Inode
+	{
+	    ino_t	ino;
+	    off_t	size;
+	    blkcnt_t	blocks;	// In 512 byte blocks, like st_blocks
+	    time_t	mtime;
+	    mode_t	mode;
+	    nlink_t	nlink;
+	    uid_t	uid;
+	    gid_t	gid;
+	};
+
+	/**
+	 * Constructor. Use forDirectory() instead.
+	 **/
+	BulkInodeStat() {}
+
+	/**
+	 * Collect the i-nodes of an XFS filesystem. Return 'true' on success.
+	 **/
+	bool collectXfs( int fd );
+
+	/**
+	 * Collect the i-nodes of the Btrfs subvolume of 'fd'. Return 'true'
+	 * on success.
+	 **/
+	bool collectBtrfs( int fd );
+
+	/**
+	 * Sort the i-nodes by i-number so lookup() can use a binary search.
+	 **/
+	void sort();
+
+
+	QVector<Inode> _inodes;
+
+    };	// class BulkInodeStat
+
+}	// namespace QDirStat
+
+
+#endif // ifndef BulkInodeStat_h
@@ -25,6 +25,11 @@
 #define SIMULATE_COMMAND	1
 #define WAIT_TIMEOUT_MILLISEC	30000
 
+// Maximum length of the paths of one batch: The whole command is one
+// argument of "sh -c", and Linux limits a single argument to 128 kB
+// (MAX_ARG_STRLEN) no matter how large ARG_MAX is
+#define CLEANUP_BATCH_MAX_BYTES	( 120 * 1024 )
+
 using namespace QDirStat;
 
 
@@ -45,6 +50,8 @@ Cleanup::Cleanup( QString   command,
     _outputWindowPolicy	   = ShowAfterTimeout;
     _outputWindowTimeout   = 500;
     _outputWindowAutoClose = false;
+    _maxParallel	   = 1;
+    _batch		   = false;
 
     QAction::setEnabled( true );
 }
@@ -80,7 +87,16 @@ void Cleanup::execute( FileInfo *item, OutputWindow * outputWindow )
 {
     if ( worksFor( item ) )
     {
-	executeRecursive( item, outputWindow );
+	if ( _recurse && _batch && canBatch() )
+	{
+	    QList<FileInfo *> items;
+	    collectRecursive( item, items );
+	    executeBatches( item, items, outputWindow );
+	}
+	else
+	{
+	    executeRecursive( item, outputWindow );
+	}
 
         // Refreshing the tree based on the cleanup's refresh policy is now
         // handled completely in CleanupCollection::execute() to be safer
@@ -126,6 +142,72 @@ void Cleanup::executeRecursive( FileInfo *item, OutputWindow * outputWindow )
 }
 
 
+void Cleanup::collectRecursive( FileInfo * item, QList<FileInfo *> & items ) const
+{
+    if ( ! worksFor( item ) )
+	return;
+
+    // The same order as executeRecursive()
+
+    for ( FileInfo * subdir = item->firstChild(); subdir; subdir = subdir->next() )
+    {
+	if ( subdir->isDir() )
+	    collectRecursive( subdir, items );
+    }
+
+    items << item;
+}
+
+
+bool Cleanup::canBatch() const
+{
+    return ( _command.contains( "%p" ) || _command.contains( "%d" ) ) && ! _command.contains( "%n" );
+}
+
+
+void Cleanup::executeBatches( FileInfo *		start,
+			      const QList<FileInfo *> & items,
+			      OutputWindow *		outputWindow )
+{
+    QString command    = expandDesktopSpecificApps( _command );
+    QString workingDir = itemDir( start );
+    int	    maxBytes   = CLEANUP_BATCH_MAX_BYTES - command.toUtf8().size();
+    int	    pos	       = 0;
+
+    // For directories, %p and %d are the same
+    command.replace( "%d", "%p" );
+
+    while ( pos < items.size() )
+    {
+	QString paths;
+	int	bytes = 0;
+
+	while ( pos < items.size() )
+	{
+	    QString path = quoted( escaped( items.at( pos )->path() ) );
+	    int	    len	 = path.toUtf8().size() + 1;
+
+	    if ( ! paths.isEmpty() && bytes + len > maxBytes )
+		break;
+
+	    if ( ! paths.isEmpty() )
+		paths += ' ';
+
+	    paths += path;
+	    bytes += len;
+	    ++pos;
+	}
+
+	QString batchCommand = command;
+	batchCommand.replace( "%p", paths );
+
+	startProcess( batchCommand, workingDir, outputWindow );
+    }
+
+    logDebug() << items.size() << " directories for " << cleanTitle() << endl;
+}
+
+
 const QString Cleanup::itemDir( const FileInfo *item ) const
 {
     QString dir = item->path();
@@ -246,6 +328,17 @@ QString Cleanup::chooseShell( OutputWindow * outputWindow ) const
 void Cleanup::runCommand( const FileInfo * item,
 			  const QString	 & command,
 			  OutputWindow	 * outputWindow ) const
+{
+    startProcess( expandVariables( item, command ), itemDir( item ), outputWindow );
+
+    // The CleanupCollection will take care about refreshing if this is
+    // configured for this cleanup.
+}
+
+
+void Cleanup::startProcess( const QString & command,
+			    const QString & workingDir,
+			    OutputWindow  * outputWindow ) const
 {
     QString shell = chooseShell( outputWindow );
 
@@ -257,19 +350,15 @@ void Cleanup::runCommand( const FileInfo * item,
 	return;
     }
 
-    QString cleanupCommand( expandVariables( item, command ));
     Process * process = new Process( parent() );
     CHECK_NEW( process );
 
     process->setProgram( shell );
-    process->setArguments( QStringList() << "-c" << cleanupCommand );
-    process->setWorkingDirectory( itemDir( item ) );
+    process->setArguments( QStringList() << "-c" << command );
+    process->setWorkingDirectory( workingDir );
     // logDebug() << "New process \"" << process << endl;
 
     outputWindow->addProcess( process );
-
-    // The CleanupCollection will take care about refreshing if this is
-    // configured for this cleanup.
 }
 
 
@@ -281,6 +370,7 @@ QMap<int, QString> Cleanup::refreshPolicyMapping()
     mapping[ RefreshThis   ] = "RefreshThis";
     mapping[ RefreshParent ] = "RefreshParent";
     mapping[ AssumeDeleted ] = "AssumeDeleted";
+    mapping[ RefreshChanged ] = "RefreshChanged";
 
     return mapping;
 }
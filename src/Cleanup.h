@@ -37,7 +37,8 @@ namespace QDirStat
 	    NoRefresh,
 	    RefreshThis,
 	    RefreshParent,
-	    AssumeDeleted
+	    AssumeDeleted,
+	    RefreshChanged
 	};
 
 	enum OutputWindowPolicy
@@ -194,6 +195,11 @@ namespace QDirStat
 	 * disk. This is the tradeoff to a very quick response. On the other
 	 * hand, the user can easily at any time hit one of the explicit
 	 * refresh buttons and everything will be back into sync again.
+	 *
+	 * RefreshChanged: Like RefreshParent, but only read those directories
+	 * again whose mtime changed; the others are taken over from the old
+	 * tree. Files that were modified in place in an unchanged directory
+	 * are not noticed.
 	 **/
 	enum RefreshPolicy refreshPolicy() const { return _refreshPolicy; }
 
@@ -250,6 +256,28 @@ namespace QDirStat
 	 **/
 	bool outputWindowAutoClose() const { return _outputWindowAutoClose; }
 
+	/**
+	 * Return the maximum number of commands that run at the same time if
+	 * multiple items are selected or if the cleanup recurses into
+	 * subdirectories. The default is 1: One after the other.
+	 **/
+	int maxParallel() const { return _maxParallel; }
+
+	/**
+	 * Return 'true' if a recursive cleanup is started for many
+	 * directories at once instead of once for each directory, like
+	 * xargs does: %p and %d expand to the paths of all directories of
+	 * one batch, as many as fit into one command line (see
+	 * CLEANUP_BATCH_MAX_BYTES). Since the working directory is that of
+	 * the item the cleanup was started for, this only works for commands
+	 * that use %p or %d, not for ones that use %n or rely on the working
+	 * directory; those are still started for each directory.
+	 *
+	 * Batches are started one after another or, with maxParallel(), at
+	 * the same time.
+	 **/
+	bool batch() const { return _batch; }
+
 	/**
 	 * Return a mapping from RefreshPolicy to string.
 	 **/
@@ -311,6 +339,8 @@ namespace QDirStat
 	void setOutputWindowPolicy   ( OutputWindowPolicy policy ) { _outputWindowPolicy    = policy;	 }
 	void setOutputWindowTimeout  ( int timeoutMillisec )	   { _outputWindowTimeout   = timeoutMillisec; }
 	void setOutputWindowAutoClose( bool autoClose )		   { _outputWindowAutoClose = autoClose; }
+	void setMaxParallel	     ( int maxParallel )	   { _maxParallel = qMax( 1, maxParallel ); }
+	void setBatch		     ( bool batch    )		   { _batch		    = batch;	 }
 
     public slots:
 
@@ -331,6 +361,26 @@ namespace QDirStat
 	 **/
 	void executeRecursive( FileInfo *item, OutputWindow * outputWindow );
 
+	/**
+	 * Add 'item' and all directories below it that this cleanup works
+	 * for to 'items', the subdirectories first.
+	 **/
+	void collectRecursive( FileInfo * item, QList<FileInfo *> & items ) const;
+
+	/**
+	 * Perform the cleanup for 'items' in batches with the working
+	 * directory of 'start'.
+	 **/
+	void executeBatches( FileInfo *		       start,
+			     const QList<FileInfo *> & items,
+			     OutputWindow *	       outputWindow );
+
+	/**
+	 * Return 'true' if the command of this cleanup can be started for
+	 * many directories at once (see batch()).
+	 **/
+	bool canBatch() const;
+
 	/**
 	 * Retrieve the directory part of a FileInfo's path.
 	 **/
@@ -409,6 +459,14 @@ namespace QDirStat
 			 const QString	& command,
 			 OutputWindow	* outputWindow) const;
 
+	/**
+	 * Start the shell with 'command' that is already expanded in
+	 * 'workingDir'.
+	 **/
+	void startProcess( const QString & command,
+			   const QString & workingDir,
+			   OutputWindow	 * outputWindow ) const;
+
 
 	//
 	// Data members
@@ -428,6 +486,8 @@ namespace QDirStat
 	OutputWindowPolicy _outputWindowPolicy;
 	int		   _outputWindowTimeout;
 	bool		   _outputWindowAutoClose;
+	int		   _maxParallel;
+	bool		   _batch;
     };
 
 
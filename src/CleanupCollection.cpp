@@ -145,13 +145,19 @@ void CleanupCollection::updateActions()
     bool busy		  = sel.containsBusyItem();
     bool treeBusy	  = sel.treeIsBusy();
 
+    // The items of a remote tree, of a filesystem image or of an imported
+    // file list are not on this machine
+    QString treeUrl	  = sel.isEmpty() ? QString() : sel.first()->tree()->url();
+    bool remote		  = RemoteReadJob::isRemoteUrl( treeUrl ) || Ext4ReadJob::isExt4Url( treeUrl ) ||
+			    NtfsReadJob::isNtfsUrl( treeUrl ) || ImportReadJob::isImportUrl( treeUrl );
+
     foreach ( Cleanup * cleanup, _cleanupList )
     {
 	if ( ! cleanup->active() || sel.isEmpty() )
 	    cleanup->setEnabled( false );
 	else
 	{
-	    bool enabled = ! busy;
+	    bool enabled = ! busy && ! remote;
 
 	    if ( treeBusy && cleanup->refreshPolicy() != Cleanup::NoRefresh )
 		enabled = false;
@@ -254,6 +260,7 @@ void CleanupCollection::execute()
     OutputWindow * outputWindow = new OutputWindow( qApp->activeWindow() );
     CHECK_NEW( outputWindow );
     outputWindow->setAutoClose( cleanup->outputWindowAutoClose() );
+    outputWindow->setMaxParallel( cleanup->maxParallel() );
 
     switch ( cleanup->outputWindowPolicy() )
     {
@@ -273,16 +280,18 @@ void CleanupCollection::execute()
 	    break;
     }
 
-    if ( cleanup->refreshPolicy() == Cleanup::RefreshThis ||
-	 cleanup->refreshPolicy() == Cleanup::RefreshParent )
+    if ( cleanup->refreshPolicy() == Cleanup::RefreshThis	||
+	 cleanup->refreshPolicy() == Cleanup::RefreshParent	||
+	 cleanup->refreshPolicy() == Cleanup::RefreshChanged )
     {
 	FileInfoSet refreshSet =
-	    cleanup->refreshPolicy() == Cleanup::RefreshParent ?
-	    Refresher::parents( selection ) : selection;
+	    cleanup->refreshPolicy() == Cleanup::RefreshThis ?
+	    selection : Refresher::parents( selection );
 
 	_selectionModel->prepareRefresh( refreshSet );
 	Refresher * refresher = new Refresher( refreshSet, this );
 	CHECK_NEW( refresher );
+	refresher->setChangedOnly( cleanup->refreshPolicy() == Cleanup::RefreshChanged );
 
 	connect( outputWindow, SIGNAL( lastProcessFinished( int ) ),
 		 refresher,    SLOT  ( refresh()		) );
@@ -515,6 +524,8 @@ void CleanupCollection::readSettings()
 	    bool askForConfirmation    = settings.value( "AskForConfirmation"	, false ).toBool();
 	    bool outputWindowAutoClose = settings.value( "OutputWindowAutoClose", false ).toBool();
 	    int	 outputWindowTimeout   = settings.value( "OutputWindowTimeout"	, 0	).toInt();
+	    int	 maxParallel	       = settings.value( "MaxParallel"		, 1	).toInt();
+	    bool batch		       = settings.value( "Batch"		, false ).toBool();
 
 	    int refreshPolicy	    = readEnumEntry( settings, "RefreshPolicy",
 						     Cleanup::NoRefresh,
@@ -539,6 +550,8 @@ void CleanupCollection::readSettings()
 		cleanup->setAskForConfirmation	 ( askForConfirmation	 );
 		cleanup->setOutputWindowAutoClose( outputWindowAutoClose );
 		cleanup->setOutputWindowTimeout	 ( outputWindowTimeout	 );
+		cleanup->setMaxParallel		 ( maxParallel		 );
+		cleanup->setBatch		 ( batch		 );
 		cleanup->setRefreshPolicy     ( static_cast<Cleanup::RefreshPolicy>( refreshPolicy ) );
 		cleanup->setOutputWindowPolicy( static_cast<Cleanup::OutputWindowPolicy>( outputWindowPolicy ) );
 
@@ -601,6 +614,12 @@ void CleanupCollection::writeSettings()
 	if ( cleanup->outputWindowTimeout() > 0 )
 	    settings.setValue( "OutputWindowTimeout"  , cleanup->outputWindowTimeout()	 );
 
+	if ( cleanup->maxParallel() > 1 )
+	    settings.setValue( "MaxParallel"	      , cleanup->maxParallel()		 );
+
+	if ( cleanup->batch() )
+	    settings.setValue( "Batch"		      , cleanup->batch()		 );
+
 	writeEnumEntry( settings, "RefreshPolicy",
 			cleanup->refreshPolicy(),
 			Cleanup::refreshPolicyMapping() );
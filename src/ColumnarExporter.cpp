@@ -0,0 +1,261 @@
+/*
+ *   File name: ColumnarExporter.cpp
+ *   Summary:	Export of a directory tree as columnar data
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <string.h>	// memset(), memcpy()
+#include <QElapsedTimer>
+
+#include "ColumnarExporter.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+// All columns start at a multiple of this in the file
+#define COLUMN_ALIGNMENT	8
+
+
+using namespace QDirStat;
+
+
+ColumnarExporter::ColumnarExporter( const QString & fileName,
+				    DirTree *	    tree,
+				    int		    rowGroupSize ):
+    _rowGroupSize( qMax( rowGroupSize, 1 ) ),
+    _file( 0 ),
+    _filePos( 0 ),
+    _rowCount( 0 )
+{
+    _ok = writeFile( fileName, tree );
+}
+
+
+bool ColumnarExporter::writeFile( const QString & fileName, DirTree * tree )
+{
+    if ( ! tree || ! tree->root() )
+	return false;
+
+    _file = fopen( (const char *) fileName.toUtf8(), "wb" );
+
+    if ( _file == 0 )
+    {
+	logError() << "Can't open " << fileName << ": " << formatErrno() << endl;
+	return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Write a preliminary header to reserve the space; the real one can
+    // only be written when all the sizes are known.
+
+    ColumnarExportHeader header;
+    memset( &header, 0, sizeof( header ) );
+    bool ok = fwrite( &header, sizeof( header ), 1, _file ) == 1;
+    _filePos = sizeof( header );
+
+    _rowCount = 0;
+    _rowGroups.clear();
+    _nameOffsets << 0;
+
+    for ( FileInfo * toplevel = tree->root()->firstChild(); toplevel && ok; toplevel = toplevel->next() )
+	ok = exportTree( toplevel, COLUMNAR_EXPORT_NO_PARENT );
+
+    if ( ok )
+	ok = flushRowGroup();
+
+    quint64 rowGroupsOffset = _filePos;
+
+    if ( ok && ! _rowGroups.isEmpty() )
+	ok = fwrite( _rowGroups.constData(), sizeof( ColumnarRowGroup ), _rowGroups.size(), _file ) == (size_t) _rowGroups.size();
+
+    memcpy( header.magic, COLUMNAR_EXPORT_MAGIC, COLUMNAR_EXPORT_MAGIC_LEN );
+    header.byteOrder	    = COLUMNAR_EXPORT_BYTE_ORDER;
+    header.headerSize	    = sizeof( ColumnarExportHeader );
+    header.rowGroupInfoSize = sizeof( ColumnarRowGroup );
+    header.rowGroupSize	    = _rowGroupSize;
+    header.rowCount	    = _rowCount;
+    header.rowGroupCount    = _rowGroups.size();
+    header.rowGroupsOffset  = rowGroupsOffset;
+
+    if ( ok )
+	ok = fseek( _file, 0, SEEK_SET ) == 0 && fwrite( &header, sizeof( header ), 1, _file ) == 1;
+
+    if ( fclose( _file ) != 0 )
+	ok = false;
+
+    _file = 0;
+
+    if ( ok )
+    {
+	logInfo() << "Exported " << _rowCount << " rows in " << _rowGroups.size()
+		  << " row groups to " << fileName << " in "
+		  << timer.elapsed() / 1000.0 << " sec" << endl;
+    }
+    else
+    {
+	logError() << "Error writing " << fileName << ": " << formatErrno() << endl;
+    }
+
+    _rowGroups = QVector<ColumnarRowGroup>();
+
+    return ok;
+}
+
+
+bool ColumnarExporter::exportTree( FileInfo * item, quint64 parentRow )
+{
+    if ( ! item )
+	return true;
+
+    // The children of a dot entry are exported as children of its parent
+
+    quint64 dirRow = parentRow;
+
+    if ( ! item->isDotEntry() )
+    {
+	dirRow = _rowCount;
+
+	if ( ! addRow( item, parentRow ) )
+	    return false;
+
+	if ( ! item->isDir() ) // Anything below would not have a parent
+	    return true;
+
+	DirInfo * dir = item->toDirInfo();
+
+	// An estimated subtree would only be read in the background
+
+	if ( dir->isPendingSubtree() && ! dir->isEstimated() )
+	    item->tree()->loadPendingSubtree( dir );
+    }
+
+    if ( item->dotEntry() && ! exportTree( item->dotEntry(), dirRow ) )
+	return false;
+
+    for ( FileInfo * child = item->firstChild(); child; child = child->next() )
+    {
+	if ( ! exportTree( child, dirRow ) )
+	    return false;
+    }
+
+    return true;
+}
+
+
+bool ColumnarExporter::addRow( FileInfo * item, quint64 parentRow )
+{
+    // Only the toplevel directory needs its complete path; for everything
+    // else, the path is implied by the parent.
+
+    _names.append( parentRow == COLUMNAR_EXPORT_NO_PARENT ?
+		   item->url().toUtf8() : item->name().toUtf8() );
+
+    _parents	 << parentRow;
+    _nameOffsets << _names.size();
+    _sizes	 << item->rawByteSize();
+    _allocated	 << item->allocatedSize();
+    _blocks	 << item->blocks();
+    _mtimes	 << item->mtime();
+    _uids	 << item->uid();
+    _gids	 << item->gid();
+    _links	 << item->links();
+    _types.append( itemType( item ) );
+
+    ++_rowCount;
+
+    if ( _parents.size() >= _rowGroupSize )
+	return flushRowGroup();
+
+    return true;
+}
+
+
+bool ColumnarExporter::flushRowGroup()
+{
+    int rows = _parents.size();
+
+    if ( rows == 0 )
+	return true;
+
+    ColumnarRowGroup rowGroup;
+    memset( &rowGroup, 0, sizeof( rowGroup ) );
+
+    rowGroup.firstRow = _rowCount - rows;
+    rowGroup.rowCount = rows;
+
+    bool ok =
+	writeColumn( rowGroup, ColParent,      _parents.constData(),	 rows * sizeof( quint64 ) ) &&
+	writeColumn( rowGroup, ColNameOffsets, _nameOffsets.constData(), ( rows + 1 ) * sizeof( quint32 ) ) &&
+	writeColumn( rowGroup, ColNameData,    _names.constData(),	 _names.size() ) &&
+	writeColumn( rowGroup, ColSize,	       _sizes.constData(),	 rows * sizeof( quint64 ) ) &&
+	writeColumn( rowGroup, ColAllocated,   _allocated.constData(),	 rows * sizeof( quint64 ) ) &&
+	writeColumn( rowGroup, ColBlocks,      _blocks.constData(),	 rows * sizeof( quint64 ) ) &&
+	writeColumn( rowGroup, ColMtime,       _mtimes.constData(),	 rows * sizeof( qint64	) ) &&
+	writeColumn( rowGroup, ColUid,	       _uids.constData(),	 rows * sizeof( quint32 ) ) &&
+	writeColumn( rowGroup, ColGid,	       _gids.constData(),	 rows * sizeof( quint32 ) ) &&
+	writeColumn( rowGroup, ColLinks,       _links.constData(),	 rows * sizeof( quint32 ) ) &&
+	writeColumn( rowGroup, ColType,	       _types.constData(),	 _types.size() );
+
+    _rowGroups << rowGroup;
+
+    _parents.clear();
+    _nameOffsets.clear();
+    _names.clear();
+    _sizes.clear();
+    _allocated.clear();
+    _blocks.clear();
+    _mtimes.clear();
+    _uids.clear();
+    _gids.clear();
+    _links.clear();
+    _types.clear();
+
+    _nameOffsets << 0;
+
+    return ok;
+}
+
+
+bool ColumnarExporter::writeColumn( ColumnarRowGroup & rowGroup,
+				    ColumnarColumn     column,
+				    const void *       data,
+				    size_t	       size )
+{
+    static const char padding[ COLUMN_ALIGNMENT ] = { 0 };
+
+    rowGroup.columnOffset[ column ] = _filePos;
+    rowGroup.columnSize	 [ column ] = size;
+
+    if ( size > 0 && fwrite( data, 1, size, _file ) != size )
+	return false;
+
+    size_t padSize = ( COLUMN_ALIGNMENT - size % COLUMN_ALIGNMENT ) % COLUMN_ALIGNMENT;
+
+    if ( padSize > 0 && fwrite( padding, 1, padSize, _file ) != padSize )
+	return false;
+
+    _filePos += size + padSize;
+
+    return true;
+}
+
+
+char ColumnarExporter::itemType( FileInfo * item )
+{
+    if	    ( item->isFile()		)	return 'F';
+    else if ( item->isDir()		)	return 'D';
+    else if ( item->isSymLink()		)	return 'L';
+    else if ( item->isBlockDevice()	)	return 'B';
+    else if ( item->isCharDevice()	)	return 'C';
+    else if ( item->isFifo()		)	return 'P';
+    else if ( item->isSocket()		)	return 'S';
+
+    return '?';
+}
@@ -0,0 +1,202 @@
+/*
+ *   File name: ColumnarExporter.h
+ *   Summary:	Export of a directory tree as columnar data
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ColumnarExporter_h
+#define ColumnarExporter_h
+
+
+#include <stdio.h>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"
+
+
+// Files with this suffix are written by ColumnarExporter instead of
+// CacheWriter (see DirTree::writeCache()).
+#define COLUMNAR_EXPORT_SUFFIX		".columns"
+#define COLUMNAR_EXPORT_MAGIC		"QDirStat columns"	// 16 bytes, no terminating 0
+#define COLUMNAR_EXPORT_MAGIC_LEN	16
+#define COLUMNAR_EXPORT_BYTE_ORDER	0x01020304
+#define COLUMNAR_EXPORT_NO_PARENT	0xFFFFFFFFFFFFFFFFULL
+
+// Maximum number of rows in one row group. This is what the exporter keeps
+// in memory at the same time.
+#define COLUMNAR_ROW_GROUP_SIZE		( 64 * 1024 )
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+    /**
+     * The columns of a columnar export file, in the order in which they are
+     * stored in each row group.
+     **/
+    enum ColumnarColumn
+    {
+	ColParent = 0,		// quint64: row of the parent directory
+	ColNameOffsets,		// quint32 [ rows + 1 ]: offsets in ColNameData
+	ColNameData,		// UTF-8, not 0-terminated
+	ColSize,		// quint64: size in bytes
+	ColAllocated,		// quint64: allocated size in bytes
+	ColBlocks,		// quint64: 512 byte blocks
+	ColMtime,		// qint64
+	ColUid,			// quint32
+	ColGid,			// quint32
+	ColLinks,		// quint32
+	ColType,		// char: 'F', 'D', 'L', 'B', 'C', 'P', 'S'
+	ColumnCount
+    };
+
+
+    /**
+     * Header of a columnar export file.
+     *
+     * The file consists of this header, the row groups and the row group
+     * table (one ColumnarRowGroup for each row group). A row group holds
+     * the values of up to 'rowGroupSize' consecutive rows, column by
+     * column; each column is a plain array that starts at an offset that is
+     * a multiple of 8.
+     *
+     * There is one row for each item of the tree, in the same order as in a
+     * cache file. The row number is the id of an item; the parent column
+     * refers to it. The toplevel directory's name is its absolute path; all
+     * others only have their name without path. All numbers are in the byte
+     * order of the machine that wrote the file; 'byteOrder' tells which one
+     * that was.
+     **/
+    struct ColumnarExportHeader
+    {
+	char	magic[ COLUMNAR_EXPORT_MAGIC_LEN ];
+	quint32 byteOrder;	// COLUMNAR_EXPORT_BYTE_ORDER
+	quint32 headerSize;	// sizeof( ColumnarExportHeader )
+	quint32 rowGroupInfoSize; // sizeof( ColumnarRowGroup )
+	quint32 rowGroupSize;	// maximum rows in one row group
+	quint64 rowCount;
+	quint64 rowGroupCount;
+	quint64 rowGroupsOffset; // offset of the row group table
+    };
+
+
+    /**
+     * Where the columns of one row group are in a columnar export file.
+     **/
+    struct ColumnarRowGroup
+    {
+	quint64 firstRow;
+	quint64 rowCount;
+	quint64 columnOffset[ ColumnCount ];
+	quint64 columnSize  [ ColumnCount ];	// in bytes
+    };
+
+
+    /**
+     * Writer for columnar export files (see ColumnarExportHeader): The raw
+     * data of each item of a tree, one array for each value, for analyzing
+     * huge trees with other tools without parsing cache files.
+     *
+     * The rows are collected in memory only until a row group is complete,
+     * so the memory needed does not depend on the size of the tree.
+     **/
+    class ColumnarExporter
+    {
+    public:
+
+	/**
+	 * Write 'tree' to file 'fileName'.
+	 *
+	 * Check ColumnarExporter::ok() to see if that went OK.
+	 **/
+	ColumnarExporter( const QString & fileName,
+			  DirTree *	  tree,
+			  int		  rowGroupSize = COLUMNAR_ROW_GROUP_SIZE );
+
+	/**
+	 * Returns true if writing the file went OK.
+	 **/
+	bool ok() const { return _ok; }
+
+	/**
+	 * Return the number of rows that were written.
+	 **/
+	quint64 rowCount() const { return _rowCount; }
+
+
+    protected:
+
+	/**
+	 * Write the export file. Returns 'true' if OK, 'false' upon error.
+	 **/
+	bool writeFile( const QString & fileName, DirTree * tree );
+
+	/**
+	 * Add 'item' recursively as a child of the directory in row
+	 * 'parentRow'. Returns 'false' upon write error.
+	 **/
+	bool exportTree( FileInfo * item, quint64 parentRow );
+
+	/**
+	 * Add the row for 'item' to the current row group and write the row
+	 * group if it is full. Returns 'false' upon write error.
+	 **/
+	bool addRow( FileInfo * item, quint64 parentRow );
+
+	/**
+	 * Write the current row group and empty it.
+	 **/
+	bool flushRowGroup();
+
+	/**
+	 * Write one column of the current row group with the padding that
+	 * is needed to align the next one.
+	 **/
+	bool writeColumn( ColumnarRowGroup & rowGroup,
+			  ColumnarColumn     column,
+			  const void *	     data,
+			  size_t	     size );
+
+	/**
+	 * Return the type character for 'item'.
+	 **/
+	static char itemType( FileInfo * item );
+
+
+	//
+	// Data members
+	//
+
+	bool			  _ok;
+	int			  _rowGroupSize;
+	FILE *			  _file;
+	quint64			  _filePos;
+	quint64			  _rowCount;
+	QVector<ColumnarRowGroup> _rowGroups;
+
+	// The columns of the current row group
+
+	QVector<quint64>	  _parents;
+	QVector<quint32>	  _nameOffsets;
+	QByteArray		  _names;
+	QVector<quint64>	  _sizes;
+	QVector<quint64>	  _allocated;
+	QVector<quint64>	  _blocks;
+	QVector<qint64>		  _mtimes;
+	QVector<quint32>	  _uids;
+	QVector<quint32>	  _gids;
+	QVector<quint32>	  _links;
+	QByteArray		  _types;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef ColumnarExporter_h
@@ -0,0 +1,636 @@
+/*
+ *   File name: ContainerLayers.cpp
+ *   Summary:	Attributing overlay layers to container images for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>	// std::sort()
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QObject>
+
+#include "ContainerLayers.h"
+#include "DirInfo.h"
+#include "MountPoints.h"
+#include "Logger.h"
+
+// Names of the directories with the layers
+#define DOCKER_STORAGE_NAME		"overlay2"
+#define CONTAINERS_STORAGE_NAME		"overlay"
+
+// Number of images in the tooltip of a storage directory
+#define TOOLTIP_MAX_IMAGES		10
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * The layers of one storage directory by their directory names and
+     * the summary of the storage directory itself.
+     **/
+    struct Storage
+    {
+	QHash<QString, LayerInfo> layers;
+	LayerInfo		  info;
+    };
+
+
+    /**
+     * The storage directories that updateCache() read by path.
+     **/
+    QHash<QString, Storage> storageCache;
+
+
+    /**
+     * Return the contents of the small file 'path' without surrounding
+     * whitespace or an empty string if it can't be read.
+     **/
+    QString readFile( const QString & path )
+    {
+	QFile file( path );
+
+	if ( ! file.open( QIODevice::ReadOnly ) )
+	    return QString();
+
+	return QString::fromUtf8( file.readAll().trimmed() );
+    }
+
+
+    /**
+     * Return the JSON document in file 'path'. It is empty if the file
+     * can't be read or parsed.
+     **/
+    QJsonDocument readJson( const QString & path )
+    {
+	QFile file( path );
+
+	if ( ! file.open( QIODevice::ReadOnly ) )
+	    return QJsonDocument();
+
+	return QJsonDocument::fromJson( file.readAll() );
+    }
+
+
+    /**
+     * Return the short form of ID 'id' like "docker images" shows it.
+     **/
+    QString shortId( QString id )
+    {
+	if ( id.startsWith( "sha256:" ) )
+	    id.remove( 0, 7 );
+
+	return id.left( 12 );
+    }
+
+
+    /**
+     * Return the first of 'names' or the short ID if there is none.
+     **/
+    QString nameOrId( const QJsonArray & names, const QString & id )
+    {
+	foreach ( const QJsonValue & name, names )
+	{
+	    if ( ! name.toString().isEmpty() )
+		return name.toString();
+	}
+
+	return shortId( id );
+    }
+
+
+    /**
+     * Add image 'image' to the users of layer 'layerId'.
+     **/
+    void addImage( Storage & storage, const QString & layerId, const QString & image )
+    {
+	LayerInfo & info = storage.layers[ layerId ];
+
+	if ( info.kind == NoLayer )
+	    info.kind = ImageLayer;
+
+	if ( ! info.images.contains( image ) )
+	    info.images << image;
+
+	if ( ! storage.info.images.contains( image ) )
+	    storage.info.images << image;
+    }
+
+
+    /**
+     * Make 'layerId' the writable layer of container 'container' that was
+     * created from image 'image'.
+     **/
+    void addContainer( Storage &       storage,
+		       const QString & layerId,
+		       const QString & container,
+		       const QString & image )
+    {
+	if ( layerId.isEmpty() )
+	    return;
+
+	LayerInfo & info = storage.layers[ layerId ];
+	info.kind = ContainerLayer;
+
+	if ( ! info.containers.contains( container ) )
+	    info.containers << container;
+
+	if ( ! image.isEmpty() && ! info.images.contains( image ) )
+	    info.images << image;
+
+	if ( ! storage.info.containers.contains( container ) )
+	    storage.info.containers << container;
+    }
+
+
+    /**
+     * Read the Docker metadata for the layers in 'storagePath'
+     * (/var/lib/docker/overlay2) into 'storage'. Return 'false' if there
+     * are none.
+     *
+     * Each layer has a directory of its own below the layer database
+     * (image/overlay2/layerdb/sha256/<chain ID>/) with its directory name
+     * in the storage in "cache-id". An image lists the diff IDs of its
+     * layers; the chain ID of a layer is that of the layer below it and
+     * its diff ID hashed together. Containers have their writable layer
+     * in layerdb/mounts/<container ID>/.
+     **/
+    bool readDocker( const QString & storagePath, Storage & storage )
+    {
+	QString root = QFileInfo( storagePath ).path();
+	QString meta = root + "/image/" DOCKER_STORAGE_NAME;
+
+	if ( ! QFileInfo( meta + "/layerdb" ).isDir() )
+	    return false;
+
+	// The directory names of the layers by their chain IDs
+
+	QHash<QString, QString> cacheIds;
+	QDir layerDb( meta + "/layerdb/sha256" );
+
+	foreach ( const QString & chainId, layerDb.entryList( QDir::Dirs | QDir::NoDotAndDotDot ) )
+	{
+	    QString cacheId = readFile( layerDb.filePath( chainId + "/cache-id" ) );
+
+	    if ( ! cacheId.isEmpty() )
+	    {
+		cacheIds.insert( "sha256:" + chainId, cacheId );
+		storage.layers[ cacheId ].kind = ImageLayer;
+	    }
+	}
+
+
+	// The tags of the images by image ID
+
+	QHash<QString, QString> imageNames;
+	QJsonObject repos = readJson( meta + "/repositories.json" ).object().value( "Repositories" ).toObject();
+
+	foreach ( const QString & repo, repos.keys() )
+	{
+	    QJsonObject tags = repos.value( repo ).toObject();
+
+	    foreach ( const QString & tag, tags.keys() )
+	    {
+		QString imageId = tags.value( tag ).toString();
+
+		// Prefer "name:tag" to "name@sha256:..."
+
+		if ( ! imageNames.contains( imageId ) || ! tag.contains( '@' ) )
+		    imageNames.insert( imageId, tag );
+	    }
+	}
+
+
+	// The layers of each image
+
+	QDir imageDb( meta + "/imagedb/content/sha256" );
+
+	foreach ( const QString & hex, imageDb.entryList( QDir::Files ) )
+	{
+	    QString imageId = "sha256:" + hex;
+	    QString name    = imageNames.value( imageId, shortId( hex ) );
+	    imageNames.insert( imageId, name );
+
+	    QJsonArray diffIds = readJson( imageDb.filePath( hex ) ).object()
+		.value( "rootfs" ).toObject().value( "diff_ids" ).toArray();
+	    QString chainId;
+
+	    foreach ( const QJsonValue & diffId, diffIds )
+	    {
+		if ( chainId.isEmpty() )
+		    chainId = diffId.toString();
+		else
+		{
+		    QByteArray chain = ( chainId + " " + diffId.toString() ).toUtf8();
+		    chainId = "sha256:" + QString::fromLatin1( QCryptographicHash::hash( chain, QCryptographicHash::Sha256 ).toHex() );
+		}
+
+		QString cacheId = cacheIds.value( chainId );
+
+		if ( ! cacheId.isEmpty() )
+		    addImage( storage, cacheId, name );
+	    }
+	}
+
+
+	// The writable layers of the containers and their init layers
+
+	QDir mounts( meta + "/layerdb/mounts" );
+
+	foreach ( const QString & containerId, mounts.entryList( QDir::Dirs | QDir::NoDotAndDotDot ) )
+	{
+	    QJsonObject config = readJson( root + "/containers/" + containerId + "/config.v2.json" ).object();
+	    QString	name   = config.value( "Name" ).toString();
+
+	    if ( name.startsWith( '/' ) )
+		name.remove( 0, 1 );
+
+	    if ( name.isEmpty() )
+		name = shortId( containerId );
+
+	    QString image = imageNames.value( config.value( "Image" ).toString() );
+
+	    addContainer( storage, readFile( mounts.filePath( containerId + "/mount-id" ) ), name, image );
+	    addContainer( storage, readFile( mounts.filePath( containerId + "/init-id"	) ), name, image );
+	}
+
+	return true;
+    }
+
+
+    /**
+     * Read the containers-storage metadata (Podman, CRI-O, Buildah) for
+     * the layers in 'storagePath' (/var/lib/containers/storage/overlay)
+     * into 'storage'. Return 'false' if there are none.
+     *
+     * The directory of a layer is its ID; overlay-layers/layers.json has
+     * the parent of each layer, overlay-images/images.json the top layer
+     * of each image and overlay-containers/containers.json the writable
+     * layer of each container.
+     **/
+    bool readContainersStorage( const QString & storagePath, Storage & storage )
+    {
+	QString root = QFileInfo( storagePath ).path();
+
+	if ( ! QFileInfo( root + "/overlay-layers/layers.json" ).isFile() )
+	    return false;
+
+	QJsonArray layers = readJson( root + "/overlay-layers/layers.json" ).array();
+	QHash<QString, QString> parents;
+
+	foreach ( const QJsonValue & value, layers )
+	{
+	    QJsonObject layer = value.toObject();
+	    QString	id    = layer.value( "id" ).toString();
+
+	    if ( id.isEmpty() )
+		continue;
+
+	    parents.insert( id, layer.value( "parent" ).toString() );
+	    storage.layers[ id ].kind = ImageLayer;
+	}
+
+	QHash<QString, QString> imageNames;
+	QJsonArray images = readJson( root + "/overlay-images/images.json" ).array();
+
+	foreach ( const QJsonValue & value, images )
+	{
+	    QJsonObject image = value.toObject();
+	    QString	id    = image.value( "id" ).toString();
+	    QString	name  = nameOrId( image.value( "names" ).toArray(), id );
+
+	    imageNames.insert( id, name );
+
+	    // From the top layer down to the base layer; the count prevents
+	    // an endless loop with broken metadata
+
+	    QString layerId = image.value( "layer" ).toString();
+
+	    for ( int i = 0; ! layerId.isEmpty() && i <= parents.size(); ++i )
+	    {
+		addImage( storage, layerId, name );
+		layerId = parents.value( layerId );
+	    }
+	}
+
+	QJsonArray containers = readJson( root + "/overlay-containers/containers.json" ).array();
+
+	foreach ( const QJsonValue & value, containers )
+	{
+	    QJsonObject container = value.toObject();
+	    QString	name	  = nameOrId( container.value( "names" ).toArray(),
+					      container.value( "id" ).toString() );
+
+	    addContainer( storage,
+			  container.value( "layer" ).toString(),
+			  name,
+			  imageNames.value( container.value( "image" ).toString() ) );
+	}
+
+	return true;
+    }
+
+
+    /**
+     * Return the info about 'path' from the mount table: A merged view
+     * or one of the layers of an overlay mount.
+     **/
+    LayerInfo overlayMountInfo( const QString & path )
+    {
+	LayerInfo info;
+
+	foreach ( MountPoint * mountPoint, MountPoints::overlayMountPoints() )
+	{
+	    QStringList lowerDirs = mountPoint->overlayLowerDirs();
+	    QString	upperDir  = mountPoint->overlayUpperDir();
+
+	    info.mountPath = mountPoint->path();
+
+	    if ( mountPoint->path() == path )
+	    {
+		info.kind	= MergedView;
+		info.layerCount = lowerDirs.size() + ( upperDir.isEmpty() ? 0 : 1 );
+
+		return info;
+	    }
+
+	    if ( upperDir == path )
+	    {
+		info.kind = ContainerLayer;
+
+		return info;
+	    }
+
+	    int layerNo = lowerDirs.indexOf( path );
+
+	    if ( layerNo >= 0 )
+	    {
+		info.kind    = ImageLayer;
+		info.layerNo = layerNo;
+
+		return info;
+	    }
+	}
+
+	return LayerInfo();
+    }
+
+
+    bool usageGreater( const ImageUsage & a, const ImageUsage & b )
+    {
+	return a.size > b.size;
+    }
+
+}	// namespace
+
+
+
+bool ContainerLayers::isStorageName( const QString & path )
+{
+    return path.endsWith( "/" DOCKER_STORAGE_NAME ) || path.endsWith( "/" CONTAINERS_STORAGE_NAME );
+}
+
+
+bool ContainerLayers::updateCache( const QString & storagePath )
+{
+    Storage storage;
+    bool    found = false;
+
+    if ( storagePath.endsWith( "/" DOCKER_STORAGE_NAME ) )
+	found = readDocker( storagePath, storage );
+    else
+	found = readContainersStorage( storagePath, storage );
+
+    if ( ! found )
+    {
+	storageCache.remove( storagePath );
+	return false;
+    }
+
+    storage.info.kind	    = LayerStorage;
+    storage.info.layerCount = storage.layers.size();
+
+    logInfo() << "Container layers in " << storagePath << ": "
+	      << storage.layers.size()		    << " layers, "
+	      << storage.info.images.size()	    << " images, "
+	      << storage.info.containers.size()	    << " containers"
+	      << endl;
+
+    storageCache.insert( storagePath, storage );
+
+    return true;
+}
+
+
+LayerInfo ContainerLayers::layerInfo( const QString & path )
+{
+    if ( storageCache.isEmpty() && MountPoints::overlayMountPoints().isEmpty() )
+	return LayerInfo();
+
+    QHash<QString, Storage>::const_iterator storage = storageCache.constFind( path );
+
+    if ( storage != storageCache.constEnd() )
+	return storage->info;
+
+    // <storage>/<layer>, <storage>/<layer>/diff or <storage>/<layer>/merged
+
+    QString layerDir = path;
+    bool    merged   = false;
+
+    if ( path.endsWith( "/diff" ) || path.endsWith( "/merged" ) )
+    {
+	merged	 = path.endsWith( "/merged" );
+	layerDir = path.left( path.lastIndexOf( '/' ) );
+    }
+
+    int slash = layerDir.lastIndexOf( '/' );
+
+    if ( slash > 0 )
+    {
+	storage = storageCache.constFind( layerDir.left( slash ) );
+
+	if ( storage != storageCache.constEnd() )
+	{
+	    LayerInfo info = storage->layers.value( layerDir.mid( slash + 1 ) );
+
+	    if ( merged )
+	    {
+		if ( info.kind != ContainerLayer )
+		    return LayerInfo();
+
+		info.kind = MergedView;
+	    }
+
+	    if ( info.isValid() )
+		return info;
+	}
+    }
+
+    return overlayMountInfo( path );
+}
+
+
+QString ContainerLayers::description( const LayerInfo & info )
+{
+    switch ( info.kind )
+    {
+	case NoLayer:
+	    break;
+
+	case ImageLayer:
+	    if ( ! info.mountPath.isEmpty() )
+		return QObject::tr( "Lower layer %1 of the overlay at %2" )
+		    .arg( info.layerNo + 1 ).arg( info.mountPath );
+
+	    if ( info.images.isEmpty() )
+		return QObject::tr( "Layer that no image uses any more" );
+
+	    if ( info.images.size() == 1 )
+		return QObject::tr( "Layer of image %1" ).arg( info.images.first() );
+
+	    return QObject::tr( "Layer shared by %1 images: %2" )
+		.arg( info.images.size() ).arg( info.images.join( ", " ) );
+
+	case ContainerLayer:
+	    if ( ! info.mountPath.isEmpty() )
+		return QObject::tr( "Upper layer of the overlay at %1" ).arg( info.mountPath );
+
+	    if ( info.images.isEmpty() )
+		return QObject::tr( "Writable layer of container %1" ).arg( info.containers.join( ", " ) );
+
+	    return QObject::tr( "Writable layer of container %1 (image %2)" )
+		.arg( info.containers.join( ", " ) ).arg( info.images.join( ", " ) );
+
+	case MergedView:
+	    if ( ! info.containers.isEmpty() )
+		return QObject::tr( "Merged view of container %1; its layers are read where they are stored" )
+		    .arg( info.containers.join( ", " ) );
+
+	    return QObject::tr( "Merged view of %1 overlay layers; they are read where they are stored" )
+		.arg( info.layerCount );
+
+	case LayerStorage:
+	    return QObject::tr( "%1 layers of %2 images and %3 containers" )
+		.arg( info.layerCount ).arg( info.images.size() ).arg( info.containers.size() );
+    }
+
+    return QString();
+}
+
+
+QString ContainerLayers::kindName( const LayerInfo & info )
+{
+    switch ( info.kind )
+    {
+	case NoLayer:		break;
+	case ImageLayer:	return QObject::tr( "Image Layer"	);
+	case ContainerLayer:	return QObject::tr( "Container Layer"	);
+	case MergedView:	return QObject::tr( "Merged View"	);
+	case LayerStorage:	return QObject::tr( "Container Layers"	);
+    }
+
+    return QString();
+}
+
+
+ImageUsageList ContainerLayers::imageUsage( DirInfo * storageDir )
+{
+    ImageUsageList result;
+    QHash<QString, Storage>::const_iterator storage = storageCache.constFind( storageDir->url() );
+
+    if ( storage == storageCache.constEnd() )
+	return result;
+
+    QHash<QString, int> index;	// in 'result' by name
+
+    for ( FileInfo * child = storageDir->firstChild(); child; child = child->next() )
+    {
+	if ( ! child->isDirInfo() )
+	    continue;
+
+	QHash<QString, LayerInfo>::const_iterator layer = storage->layers.constFind( child->name() );
+
+	if ( layer == storage->layers.constEnd() )
+	    continue;
+
+	// The writable layer of a container only belongs to the container,
+	// not to its image
+
+	QStringList owners;
+
+	if ( layer->kind == ContainerLayer )
+	{
+	    foreach ( const QString & container, layer->containers )
+		owners << QObject::tr( "%1 (container)" ).arg( container );
+	}
+	else
+	{
+	    owners = layer->images;
+	}
+
+	if ( owners.isEmpty() )
+	    owners << QObject::tr( "Unused layers" );
+
+	FileSize size = child->totalAllocatedSize();
+
+	foreach ( const QString & owner, owners )
+	{
+	    if ( ! index.contains( owner ) )
+	    {
+		index.insert( owner, result.size() );
+		result << ImageUsage();
+		result.last().name = owner;
+	    }
+
+	    ImageUsage & usage = result[ index.value( owner ) ];
+	    usage.layers++;
+	    usage.size += size;
+
+	    if ( owners.size() == 1 )
+		usage.uniqueSize += size;
+	}
+    }
+
+    std::sort( result.begin(), result.end(), usageGreater );
+
+    return result;
+}
+
+
+QString ContainerLayers::toolTip( DirInfo * dir )
+{
+    LayerInfo info = layerInfo( dir->url() );
+
+    if ( ! info.isValid() )
+	return QString();
+
+    QString text = description( info );
+
+    if ( info.kind == LayerStorage )
+    {
+	ImageUsageList usage = imageUsage( dir );
+
+	for ( int i = 0; i < usage.size() && i < TOOLTIP_MAX_IMAGES; ++i )
+	{
+	    text += "\n" + QObject::tr( "%1: %2 in %3 layers (%4 not shared)" )
+		.arg( usage.at( i ).name )
+		.arg( formatSize( usage.at( i ).size ) )
+		.arg( usage.at( i ).layers )
+		.arg( formatSize( usage.at( i ).uniqueSize ) );
+	}
+    }
+
+    return text;
+}
@@ -0,0 +1,154 @@
+/*
+ *   File name: ContainerLayers.h
+ *   Summary:	Attributing overlay layers to container images for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ContainerLayers_h
+#define ContainerLayers_h
+
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "FileInfo.h"	// FileSize
+
+
+namespace QDirStat
+{
+    class DirInfo;
+
+    /**
+     * What an overlay layer directory is
+     **/
+    enum LayerKind
+    {
+	NoLayer = 0,	// Not a layer
+	ImageLayer,	// A read-only layer of images (or a lower overlay layer)
+	ContainerLayer, // The writable layer of a container (or an upper layer)
+	MergedView,	// The mount point of an overlay filesystem
+	LayerStorage	// The directory with the layers of a container engine
+    };
+
+
+    /**
+     * Information about an overlay layer directory.
+     **/
+    struct LayerInfo
+    {
+	LayerInfo():
+	    kind( NoLayer ),
+	    layerNo( -1 ),
+	    layerCount( 0 )
+	    {}
+
+	bool isValid() const { return kind != NoLayer; }
+
+	LayerKind   kind;
+	QStringList images;	// Names of the images that use the layer
+	QStringList containers; // Names of the containers that use the layer
+	QString	    mountPath;	// The overlay mount of a layer without metadata
+	int	    layerNo;	// Of a lower layer below mountPath, 0 is the topmost
+	int	    layerCount; // Of a merged view
+    };
+
+
+    /**
+     * The disk usage of one image or container in a LayerStorage
+     * directory.
+     **/
+    struct ImageUsage
+    {
+	ImageUsage():
+	    layers( 0 ),
+	    size( 0 ),
+	    uniqueSize( 0 )
+	    {}
+
+	QString	 name;
+	int	 layers;
+	FileSize size;		// All layers
+	FileSize uniqueSize;	// Layers that no other image or container uses
+    };
+
+    typedef QList<ImageUsage> ImageUsageList;
+
+
+    /**
+     * Attributing the layer directories of overlay filesystems to the
+     * images and containers they belong to.
+     *
+     * Container engines keep each layer of an image in a directory of its
+     * own, and each running container is an overlay mount of those layers
+     * (a "merged view") that shows the same files again. The merged views
+     * are not read (see DirReadJob::shouldCrossIntoFilesystem()), so each
+     * layer is read exactly once, where it is stored; this tells which
+     * images and containers use it.
+     *
+     * This knows the metadata of Docker (/var/lib/docker/overlay2) and of
+     * containers-storage (Podman, CRI-O, Buildah:
+     * /var/lib/containers/storage/overlay) and the layers of any other
+     * overlay mount from the mount table.
+     *
+     * This is only for the main thread.
+     **/
+    namespace ContainerLayers
+    {
+	/**
+	 * Return 'true' if 'path' might be the directory with the layers of
+	 * a container engine, judging by its name. This is cheap enough to
+	 * check for each directory.
+	 **/
+	bool isStorageName( const QString & path );
+
+	/**
+	 * Read the metadata of the container engine whose layers are in
+	 * 'storagePath' and remember them for layerInfo(). Return 'true' if
+	 * there are any.
+	 **/
+	bool updateCache( const QString & storagePath );
+
+	/**
+	 * Return what directory 'path' is: a layer directory (or its "diff"
+	 * subdirectory) of a storage directory that updateCache() read, a
+	 * merged view, a layer of an overlay mount or a storage directory.
+	 * The result is invalid if it is none of those.
+	 *
+	 * This does not read any files, so it is cheap enough for the views.
+	 **/
+	LayerInfo layerInfo( const QString & path );
+
+	/**
+	 * Return a one-line description of 'info' for the user.
+	 **/
+	QString description( const LayerInfo & info );
+
+	/**
+	 * Return a short name for the kind of 'info' like "Image Layer".
+	 **/
+	QString kindName( const LayerInfo & info );
+
+	/**
+	 * Return the disk usage of each image and container of
+	 * 'storageDir' (a LayerStorage directory) from the sizes of its
+	 * layer directories in the tree, the biggest first.
+	 **/
+	ImageUsageList imageUsage( DirInfo * storageDir );
+
+	/**
+	 * Return a tooltip for 'dir': the description of its layer info
+	 * and, for a storage directory, the usage of its biggest images.
+	 * This is empty if 'dir' is not a layer directory.
+	 **/
+	QString toolTip( DirInfo * dir );
+
+    }	// namespace ContainerLayers
+
+}	// namespace QDirStat
+
+
+#endif	// ContainerLayers_h
@@ -69,7 +69,9 @@ const DataColumnList DataColumns::defaultColumns() const
 	    << UserCol
 	    << GroupCol
 	    << PermissionsCol
-	    << OctalPermissionsCol;
+	    << OctalPermissionsCol
+	    << SizeDeltaCol
+	    << SizeHistoryCol;
 
     return columns;
 }
@@ -145,6 +147,8 @@ QString DataColumns::toString( DataColumn col )
 	case GroupCol:			return "GroupCol";
 	case PermissionsCol:		return "PermissionsCol";
 	case OctalPermissionsCol:	return "OctalPermissionsCol";
+	case SizeDeltaCol:		return "SizeDeltaCol";
+	case SizeHistoryCol:		return "SizeHistoryCol";
 	case ReadJobsCol:		return "ReadJobsCol";
 	case UndefinedCol:		return "UndefinedCol";
 
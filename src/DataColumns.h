@@ -37,6 +37,8 @@ namespace QDirStat
         GroupCol,               // Group
         PermissionsCol,         // Permissions (symbolic; -rwxrxxrwx)
         OctalPermissionsCol,    // Permissions (octal; 0644)
+	SizeDeltaCol,		// Size difference to a compared cache file
+	SizeHistoryCol,		// Growth and sparkline from a size history
 	ReadJobsCol,		// Number of pending read jobs in subtree
 	UndefinedCol
     };
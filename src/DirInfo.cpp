@@ -12,21 +12,54 @@
 #include "DirInfo.h"
 #include "DirTree.h"
 #include "DotEntry.h"
+#include "AggregateInfo.h"
 #include "Attic.h"
 #include "FileInfoIterator.h"
 #include "FileInfoSorter.h"
 #include "ExcludeRules.h"
 #include "Exception.h"
 #include "DebugHelpers.h"
+#include "DirTreeCache.h"
+#include "MemoryStats.h"
 
 #define DIRECT_CHILDREN_COUNT_SANITY_CHECK 0
 
+// Minimum number of children for the child index; below that, a linear
+// search is faster anyway
+#define CHILD_INDEX_MIN_CHILDREN	32
+
+// Maximum number of different sort orders cached for each directory
+#define SORT_CACHE_MAX_ENTRIES		3
+
+// Minimum number of sorted children for the index of their rows; below
+// that, a linear search is faster anyway
+#define SORT_CACHE_MIN_ROW_INDEX	32
+
+// Default limit for the sort caches of all directories
+#define SORT_CACHE_DEFAULT_LIMIT	( 64 * 1024 * 1024 )
+
+// Serial number of the last sort cache that was created (see
+// DirInfo::hasSortCacheSerial())
+static quint64 lastSortCacheSerial = 0;
+
+// The directories with sort caches by last use (see DirInfo::SortCacheList)
+// and the bytes of all their sort caches. All this is only used in the main
+// thread.
+static QDirStat::DirInfo * sortCacheLruFirst = 0;
+static QDirStat::DirInfo * sortCacheLruLast  = 0;
+static qint64 totalSortCacheBytes = 0;
+static qint64 sortCacheLimitBytes = SORT_CACHE_DEFAULT_LIMIT;
+
 using namespace QDirStat;
 
 
+QHash<DirInfo *, DirInfo::Summary> DirInfo::_addingSummaries;
+
+
 DirInfo::DirInfo( DirTree * tree,
 		  DirInfo * parent )
     : FileInfo( tree, parent )
+    , _tree( tree )
 {
     init();
     _readState = DirFinished;
@@ -41,6 +74,7 @@ DirInfo::DirInfo( const QString & filenameWithoutPath,
 		statInfo,
 		tree,
 		parent )
+    , _tree( tree )
 {
     init();
     ensureDotEntry();
@@ -61,6 +95,7 @@ DirInfo::DirInfo( DirTree *	  tree,
 		mode,
 		size,
 		mtime )
+    , _tree( tree )
 {
     init();
     ensureDotEntry();
@@ -76,14 +111,19 @@ void DirInfo::init()
     _isMountPoint	 = false;
     _isExcluded		 = false;
     _summaryDirty	 = false;
+    _mtimeDirty		 = false;
     _deletingAll	 = false;
     _locked		 = false;
     _touched		 = false;
+    _pendingSubtree	 = false;
+    _estimated		 = false;
+    _addingChildren	 = false;
+    _atticPending	 = false;
     _pendingReadJobs	 = 0;
     _dotEntry		 = 0;
-    _firstChild		 = 0;
+    _unlinkedChildren	 = 0;
     _totalSize		 = _size;
-    _totalAllocatedSize	 = _allocatedSize;
+    _totalAllocatedSize	 = rawAllocatedSize();
     _totalBlocks	 = _blocks;
     _totalItems		 = 0;
     _totalSubDirs	 = 0;
@@ -92,37 +132,91 @@ void DirInfo::init()
     _totalUnignoredItems = 0;
     _directChildrenCount = 0;
     _errSubDirCount	 = 0;
+    _estimatedDirCount	 = 0;
     _latestMtime	 = _mtime;
     _oldestFileMtime	 = 0;
     _readState		 = DirQueued;
-    _sortedChildren	 = 0;
-    _lastSortCol	 = UndefinedCol;
-    _lastSortOrder	 = Qt::AscendingOrder;
+    _sortCaches		 = 0;
+    _childIndex		 = 0;
+    _sizeHistogram	 = 0;
+    _mtimeHistogram	 = 0;
+    _ownerUsage		 = 0;
 }
 
 
 DirInfo::~DirInfo()
 {
+    if ( this == _urlCacheNode )
+	dropUrlCache();
+
+    if ( _pendingSubtree && _tree )
+	_tree->forgetPendingSubtree( this );
+
+    if ( _tree && DirInfo::readError() )
+	_tree->forgetUnreadableDir( this );
+
+    if ( _addingChildren )
+	_addingSummaries.remove( this );
+
+    // The ancestors were already notified in deletingChild(), or they are
+    // being deleted themselves.
+
+    _deletingAll = true;
     clear();
+
+    delete _sizeHistogram;
+    delete _mtimeHistogram;
+    delete _ownerUsage;
 }
 
 
 void DirInfo::clear()
 {
+    if ( _parent && ! _deletingAll && ( firstChild() || _dotEntry || _attic ) )
+    {
+	// Only this directory itself stays; subtract all the rest from the
+	// ancestors.
+
+	if ( _summaryDirty )
+	    _parent->markAncestorsDirty();
+	else
+	{
+	    Summary summary;
+	    summary.size	    = _totalSize - _size;
+	    summary.allocatedSize   = _totalAllocatedSize - rawAllocatedSize();
+	    summary.blocks	    = _totalBlocks - _blocks;
+	    summary.items	    = _totalItems;
+	    summary.subDirs	    = _totalSubDirs;
+	    summary.files	    = _totalFiles;
+	    summary.ignoredItems    = _totalIgnoredItems;
+	    summary.unignoredItems  = _totalUnignoredItems;
+	    summary.errSubDirs	    = _errSubDirCount;
+	    summary.estimatedDirs   = _estimatedDirCount - ( _estimated ? 1 : 0 );
+	    summary.latestMtime	    = _latestMtime;
+	    summary.oldestFileMtime = _oldestFileMtime;
+
+	    if ( _sizeHistogram )
+		summary.sizes = *_sizeHistogram;
+
+	    if ( _mtimeHistogram )
+		summary.mtimes = *_mtimeHistogram;
+
+	    if ( _ownerUsage )
+		summary.owners = *_ownerUsage;
+
+	    _parent->subtractFromAncestors( summary, false );
+	}
+    }
+
     _deletingAll = true;
+    dropChildIndex();
 
     // Recursively delete all children.
 
-    while ( _firstChild )
-    {
-	FileInfo * nextChild = _firstChild->next();
-
-	if ( _parent )
-	    _parent->deletingChild( _firstChild );
+    for ( int i = 0; i < _children.size(); ++i )
+	delete _children.at( i );	// 0 for unlinked children
 
-	delete _firstChild;
-	_firstChild = nextChild; // unlink the old first child
-    }
+    dropChildren();
 
 
     // Delete the dot entry.
@@ -145,12 +239,126 @@ void DirInfo::clear()
 }
 
 
+void DirInfo::takeSubDirs( QList<DirInfo *> & dirs_ret )
+{
+    for ( int i = 0; i < _children.size(); ++i )
+    {
+	FileInfo * child = _children.at( i );
+
+	if ( child && child->isDirInfo() )
+	{
+	    child->setParent( 0 );
+	    dirs_ret << child->toDirInfo();
+	    _children[ i ] = 0;
+	    ++_unlinkedChildren;
+	}
+    }
+
+    dropChildIndex();
+
+    if ( _dotEntry )
+    {
+	_dotEntry->setParent( 0 );
+	dirs_ret << _dotEntry;
+	_dotEntry = 0;
+    }
+
+    if ( _attic )
+    {
+	_attic->setParent( 0 );
+	dirs_ret << _attic;
+	_attic = 0;
+    }
+}
+
+
+void DirInfo::takeChildren( DirInfo * other )
+{
+    if ( ! other || other == this )
+	return;
+
+    if ( firstChild() || _dotEntry || _attic )
+	clear();
+
+    for ( int i = 0; i < other->_children.size(); ++i )
+    {
+	FileInfo * child = other->_children.at( i );
+
+	if ( child )	// 0 for unlinked children
+	{
+	    appendChild( child );
+
+	    if ( child->isDirInfo() )
+		child->toDirInfo()->setTreeRecursive( _tree );
+	}
+    }
+
+    other->dropChildren();
+
+    _dotEntry = other->_dotEntry;
+    _attic    = other->_attic;
+    other->_dotEntry = 0;
+    other->_attic    = 0;
+
+    if ( _dotEntry )
+    {
+	_dotEntry->setParent( this );
+	_dotEntry->setTreeRecursive( _tree );
+    }
+
+    if ( _attic )
+    {
+	_attic->setParent( this );
+	_attic->setTreeRecursive( _tree );
+    }
+
+    changeReadState( other->_readState );
+    _pendingReadJobs = 0;
+    other->_summaryDirty = true;
+
+    if ( other->_atticPending )
+	markAtticPending();
+
+    dropSortCache();
+    markAncestorsDirty();
+}
+
+
+void DirInfo::setTreeRecursive( DirTree * tree )
+{
+    if ( DirInfo::readError() && ! isPseudoDir() && _tree != tree )
+    {
+	if ( _tree )
+	    _tree->forgetUnreadableDir( this );
+
+	if ( tree )
+	    tree->addUnreadableDir( this );
+    }
+
+    _tree = tree;
+
+    for ( int i = 0; i < _children.size(); ++i )
+    {
+	FileInfo * child = _children.at( i );
+
+	if ( child && child->isDirInfo() )
+	    child->toDirInfo()->setTreeRecursive( tree );
+    }
+
+    if ( _dotEntry )
+	_dotEntry->setTreeRecursive( tree );
+
+    if ( _attic )
+	_attic->setTreeRecursive( tree );
+}
+
+
 void DirInfo::reset()
 {
-    if ( _firstChild || _dotEntry || _attic )
+    if ( firstChild() || _dotEntry || _attic )
 	clear();
 
-    _readState	     = DirQueued;
+    changeReadState( DirQueued );
     _pendingReadJobs = 0;
     _summaryDirty    = true;
 
@@ -225,7 +433,7 @@ void DirInfo::recalc()
     // logDebug() << this << endl;
 
     _totalSize		 = _size;
-    _totalAllocatedSize	 = _allocatedSize;
+    _totalAllocatedSize	 = rawAllocatedSize();
     _totalBlocks	 = _blocks;
     _totalItems		 = 0;
     _totalSubDirs	 = 0;
@@ -234,9 +442,19 @@ void DirInfo::recalc()
     _totalUnignoredItems = 0;
     _directChildrenCount = 0;
     _errSubDirCount	 = 0;
+    _estimatedDirCount	 = _estimated ? 1 : 0;
     _latestMtime	 = _mtime;
     _oldestFileMtime	 = 0;
 
+    if ( _sizeHistogram )
+	_sizeHistogram->clear();
+
+    if ( _mtimeHistogram )
+	_mtimeHistogram->clear();
+
+    if ( _ownerUsage )
+	_ownerUsage->clear();
+
     FileInfoIterator it( this );
 
     while ( *it )
@@ -248,6 +466,7 @@ void DirInfo::recalc()
 	_totalItems	     += (*it)->totalItems() + 1;
 	_totalSubDirs	     += (*it)->totalSubDirs();
 	_errSubDirCount	     += (*it)->errSubDirCount();
+	_estimatedDirCount   += (*it)->estimatedDirCount();
 	_totalFiles	     += (*it)->totalFiles();
 	_totalIgnoredItems   += (*it)->totalIgnoredItems();
 	_totalUnignoredItems += (*it)->totalUnignoredItems();
@@ -260,8 +479,28 @@ void DirInfo::recalc()
 		_errSubDirCount++;
 	}
 
-	if ( (*it)->isFile() )
+	if ( (*it)->isAggregate() )
+	{
+	    _totalFiles++;
+	    addToSizeHistogram ( (*it)->toAggregate()->sizeHistogram()  );
+	    addToMTimeHistogram( (*it)->toAggregate()->mtimeHistogram() );
+	}
+	else if ( (*it)->isFile() )
+	{
 	    _totalFiles++;
+	    addToSizeHistogram( (*it)->size() );
+	    addToMTimeHistogram( (*it)->mtime(), (*it)->size() );
+	}
+	else if ( (*it)->isDirInfo() && (*it)->totalFiles() > 0 )
+	{
+	    addToSizeHistogram( (*it)->toDirInfo()->sizeHistogram() );
+	    addToMTimeHistogram( (*it)->toDirInfo()->mtimeHistogram() );
+	}
+
+	addToOwnerUsage( *it );
+
+	if ( (*it)->isDirInfo() )
+	    addToOwnerUsage( (*it)->toDirInfo()->ownerUsage() );
 
 	if ( ! (*it)->isDir() )
 	{
@@ -296,7 +535,100 @@ void DirInfo::recalc()
 	_errSubDirCount	   += _attic->errSubDirCount();
     }
 
+    BinaryCacheSubtree subtree;
+
+    if ( _pendingSubtree && _tree->pendingSubtree( this, subtree ) )
+    {
+	// The children are still in the cache file: Add what the cache file
+	// says about them.
+
+	_totalSize	     += subtree.totalSize	   - _size;
+	_totalAllocatedSize  += subtree.totalAllocatedSize - rawAllocatedSize();
+	_totalBlocks	     += subtree.totalBlocks	   - _blocks;
+	_totalItems	     += subtree.totalItems;
+	_totalSubDirs	     += subtree.totalSubDirs;
+	_totalFiles	     += subtree.totalFiles;
+	_totalIgnoredItems   += subtree.totalIgnoredItems;
+	_totalUnignoredItems += subtree.totalUnignoredItems;
+	_errSubDirCount	     += subtree.errSubDirCount;
+
+	addPendingMtimes( subtree );
+    }
+
     _summaryDirty = false;
+    _mtimeDirty	  = false;
+}
+
+
+void DirInfo::addPendingMtimes( const BinaryCacheSubtree & subtree )
+{
+    if ( subtree.latestMtime > _latestMtime )
+	_latestMtime = subtree.latestMtime;
+
+    if ( subtree.oldestFileMtime > 0 &&
+	 ( _oldestFileMtime == 0 || subtree.oldestFileMtime < _oldestFileMtime ) )
+    {
+	_oldestFileMtime = subtree.oldestFileMtime;
+    }
+}
+
+
+void DirInfo::setPendingSubtree( bool pending )
+{
+    _pendingSubtree = pending;
+    markAncestorsDirty();
+}
+
+
+void DirInfo::setEstimated( bool estimated )
+{
+    _estimated = estimated;
+    markAncestorsDirty();
+}
+
+
+void DirInfo::setOwnStat( FileSize size, time_t mtime )
+{
+    _size  = size;
+    _mtime = mtime;
+    markAncestorsDirty();
+}
+
+
+void DirInfo::recalcMtimes()
+{
+    _latestMtime     = _mtime;
+    _oldestFileMtime = 0;
+
+    FileInfoIterator it( this );
+
+    while ( *it )
+    {
+	time_t childLatestMtime = (*it)->latestMtime();
+
+	if ( childLatestMtime > _latestMtime )
+	    _latestMtime = childLatestMtime;
+
+	time_t childOldestFileMTime = (*it)->oldestFileMtime();
+
+	if ( childOldestFileMTime > 0 )
+	{
+	    if ( _oldestFileMtime == 0 ||
+		 childOldestFileMTime < _oldestFileMtime )
+	    {
+		_oldestFileMtime = childOldestFileMTime;
+	    }
+	}
+
+	++it;
+    }
+
+    BinaryCacheSubtree subtree;
+
+    if ( _pendingSubtree && _tree->pendingSubtree( this, subtree ) )
+	addPendingMtimes( subtree );
+
+    _mtimeDirty = false;
 }
 
 
@@ -360,6 +692,133 @@ int DirInfo::totalFiles()
 }
 
 
+SizeHistogram DirInfo::sizeHistogram()
+{
+    if ( _summaryDirty )
+	recalc();
+
+    return _sizeHistogram ? *_sizeHistogram : SizeHistogram();
+}
+
+
+bool DirInfo::hasCompleteSizeHistogram()
+{
+    if ( _summaryDirty )
+	recalc();
+
+    int count = _sizeHistogram ? _sizeHistogram->totalCount() : 0;
+
+    return count == _totalFiles;
+}
+
+
+void DirInfo::addToSizeHistogram( const SizeHistogram & histogram )
+{
+    if ( ! _sizeHistogram )
+    {
+	_sizeHistogram = new SizeHistogram();
+	CHECK_NEW( _sizeHistogram );
+    }
+
+    _sizeHistogram->add( histogram );
+}
+
+
+void DirInfo::addToSizeHistogram( FileSize size )
+{
+    if ( ! _sizeHistogram )
+    {
+	_sizeHistogram = new SizeHistogram();
+	CHECK_NEW( _sizeHistogram );
+    }
+
+    _sizeHistogram->add( size );
+}
+
+
+MTimeHistogram DirInfo::mtimeHistogram()
+{
+    if ( _summaryDirty )
+	recalc();
+
+    return _mtimeHistogram ? *_mtimeHistogram : MTimeHistogram();
+}
+
+
+bool DirInfo::hasCompleteMTimeHistogram()
+{
+    if ( _summaryDirty )
+	recalc();
+
+    int count = _mtimeHistogram ? _mtimeHistogram->totalCount() : 0;
+
+    return count == _totalFiles;
+}
+
+
+void DirInfo::addToMTimeHistogram( const MTimeHistogram & histogram )
+{
+    if ( ! _mtimeHistogram )
+    {
+	_mtimeHistogram = new MTimeHistogram();
+	CHECK_NEW( _mtimeHistogram );
+    }
+
+    _mtimeHistogram->add( histogram );
+}
+
+
+void DirInfo::addToMTimeHistogram( time_t mtime, FileSize size )
+{
+    if ( ! _mtimeHistogram )
+    {
+	_mtimeHistogram = new MTimeHistogram();
+	CHECK_NEW( _mtimeHistogram );
+    }
+
+    _mtimeHistogram->add( mtime, size );
+}
+
+
+OwnerUsage DirInfo::ownerUsage()
+{
+    if ( _summaryDirty )
+	recalc();
+
+    return _ownerUsage ? *_ownerUsage : OwnerUsage();
+}
+
+
+void DirInfo::addToOwnerUsage( const OwnerUsage & usage )
+{
+    if ( usage.isEmpty() )
+	return;
+
+    if ( ! _ownerUsage )
+    {
+	_ownerUsage = new OwnerUsage();
+	CHECK_NEW( _ownerUsage );
+    }
+
+    _ownerUsage->add( usage );
+}
+
+
+void DirInfo::addToOwnerUsage( const FileInfo * item )
+{
+    if ( ! item->hasUid() && ! item->hasGid() )
+	return;
+
+    if ( ! _ownerUsage )
+    {
+	_ownerUsage = new OwnerUsage();
+	CHECK_NEW( _ownerUsage );
+    }
+
+    _ownerUsage->add( item );
+}
+
+
 int DirInfo::totalNonDirItems()
 {
     if ( _summaryDirty )
@@ -391,6 +850,8 @@ time_t DirInfo::latestMtime()
 {
     if ( _summaryDirty )
 	recalc();
+    else if ( _mtimeDirty )
+	recalcMtimes();
 
     return _latestMtime;
 }
@@ -400,6 +861,8 @@ time_t DirInfo::oldestFileMtime()
 {
     if ( _summaryDirty )
 	recalc();
+    else if ( _mtimeDirty )
+	recalcMtimes();
 
     return _oldestFileMtime;
 }
@@ -431,15 +894,7 @@ int DirInfo::countDirectChildren()
 {
     // logDebug() << this << endl;
 
-    _directChildrenCount = 0;
-
-    FileInfo * child = _firstChild;
-
-    while ( child )
-    {
-	++_directChildrenCount;
-	child = child->next();
-    }
+    _directChildrenCount = _children.size() - _unlinkedChildren;
 
     if ( _dotEntry )
 	++_directChildrenCount;
@@ -457,6 +912,15 @@ int DirInfo::errSubDirCount()
 }
 
 
+int DirInfo::estimatedDirCount()
+{
+    if ( _summaryDirty )
+	recalc();
+
+    return _estimatedDirCount;
+}
+
+
 bool DirInfo::isFinished()
 {
     return ! isBusy();
@@ -470,14 +934,31 @@ void DirInfo::setReadState( DirReadState newReadState )
     if ( _readState == DirAborted && newReadState == DirFinished )
 	return;
 
-    _readState = newReadState;
+    changeReadState( newReadState );
 }
 
 
-bool DirInfo::isBusy()
+void DirInfo::changeReadState( DirReadState newReadState )
 {
-    if ( _pendingReadJobs > 0 && _readState != DirAborted )
-	return true;
+    bool wasError = DirInfo::readError();
+    _readState = newReadState;
+
+    // Keep the tree's list of unreadable directories up to date
+
+    if ( _tree && ! isPseudoDir() && DirInfo::readError() != wasError )
+    {
+	if ( wasError )
+	    _tree->forgetUnreadableDir( this );
+	else
+	    _tree->addUnreadableDir( this );
+    }
+}
+
+
+bool DirInfo::isBusy()
+{
+    if ( _pendingReadJobs > 0 && _readState != DirAborted )
+	return true;
 
     if ( readState() == DirReading ||
 	 readState() == DirQueued    )
@@ -501,17 +982,13 @@ void DirInfo::insertChild( FileInfo * newChild )
 	 * In any of those cases, insert the new child in the children list.
 	 *
 	 * We don't bother with this list's order - it's explicitly declared to
-	 * be unordered, so be warned! We simply insert this new child at the
-	 * list head since this operation can be performed in constant time
-	 * without the need for any additional lastChild etc. pointers or -
-	 * even worse - seeking the correct place for insertion first. This is
-	 * none of our business; the corresponding "view" object for this tree
-	 * will take care of such niceties.
+	 * be unordered, so be warned! We simply append this new child to the
+	 * children vector since this operation can be performed in (amortized)
+	 * constant time without seeking the correct place for insertion
+	 * first. This is none of our business; the corresponding "view" object
+	 * for this tree will take care of such niceties.
 	 **/
-	newChild->setNext( _firstChild );
-	_firstChild = newChild;
-	newChild->setParent( this );	// make sure the parent pointer is correct
-
+	appendChild( newChild );
 	childAdded( newChild );		// update summaries
     }
     else
@@ -528,6 +1005,7 @@ void DirInfo::insertChild( FileInfo * newChild )
 void DirInfo::moveToAttic( FileInfo * child )
 {
     unlinkChild( child );
+    _summaryDirty = true;
     addToAttic( child );
 }
 
@@ -544,12 +1022,10 @@ void DirInfo::addToAttic( FileInfo * newChild )
     if ( ! attic )
 	attic = ensureAttic();
 
-    newChild->setIgnored( true );
+    // The attic passes the new child on to this directory and its
+    // ancestors, so they count it as ignored
 
-    if ( newChild->isDir() )
-	_totalIgnoredItems += newChild->totalIgnoredItems();
-    else
-	_totalIgnoredItems++;
+    newChild->setIgnored( true );
 
     CHECK_PTR( attic );
     attic->insertChild( newChild );
@@ -565,7 +1041,7 @@ void DirInfo::childAdded( FileInfo * newChild )
 	if ( newChild->isDir() )
 	    _totalIgnoredItems += newChild->totalIgnoredItems();
 	else
-	    _totalIgnoredItems++;
+	    _totalIgnoredItems += newChild->totalIgnoredItems() + 1;
 
 	// Add ignored items only to all the totals if this directory is also
 	// ignored or if this is the attic.
@@ -576,7 +1052,7 @@ void DirInfo::childAdded( FileInfo * newChild )
     else
     {
 	if ( ! newChild->isDir() )
-	    _totalUnignoredItems++;
+	    _totalUnignoredItems += newChild->totalUnignoredItems() + 1;
     }
 
     if ( addToTotal )
@@ -594,8 +1070,23 @@ void DirInfo::childAdded( FileInfo * newChild )
 	    if ( newChild->isDir() )
 		_totalSubDirs++;
 
-	    if ( newChild->isFile() )
+	    if ( newChild->isAggregate() )
+	    {
+		// It stands for many files
+
+		_totalItems += newChild->totalItems();
+		_totalFiles += newChild->totalFiles() + 1;
+		addToSizeHistogram ( newChild->toAggregate()->sizeHistogram()  );
+		addToMTimeHistogram( newChild->toAggregate()->mtimeHistogram() );
+	    }
+	    else if ( newChild->isFile() )
+	    {
 		_totalFiles++;
+		addToSizeHistogram( newChild->size() );
+		addToMTimeHistogram( newChild->mtime(), newChild->size() );
+	    }
+
+	    addToOwnerUsage( newChild );
 
 	    if ( newChild->mtime() > _latestMtime )
 		_latestMtime = newChild->mtime();
@@ -625,55 +1116,306 @@ void DirInfo::childAdded( FileInfo * newChild )
 	}
     }
 
-    if ( _lastSortCol != ReadJobsCol )
-	dropSortCache();
+    // The order by pending read jobs is updated in readJobAdded() and
+    // readJobFinished()
 
-    if ( _parent )
+    dropSortCacheByCol( ReadJobsCol, false );
+
+    if ( _parent && ! _addingChildren )
 	_parent->childAdded( newChild );
 }
 
 
 void DirInfo::deletingChild( FileInfo * child )
 {
+    if ( _deletingAll )
+    {
+	// This whole subtree goes away anyway; the ancestors were already
+	// taken care of in clear().
+
+	_summaryDirty = true;
+
+	if ( child->parent() == this )
+	    dropSortCache();
+
+	return;
+    }
+
+    // Without the child, this directory or one of its ancestors might end
+    // up with only ignored items
+
+    markAtticPending();
+
+    if ( child->parent() != this )
+    {
+	// Something deeper down in the subtree: Whoever is its parent is
+	// not updated, so the summary can only be recalculated later.
+
+	markAncestorsDirty();
+	return;
+    }
+
     /**
-     * When children are deleted, things go downhill: Marking the summary
-     * fields as dirty (i.e. outdated) is the only thing that can be done here.
-     *
-     * The accumulated sizes could be updated (by subtracting this deleted
-     * child's values from them), but the latest mtime definitely has to be
-     * recalculated: The child now being deleted might just be the one with the
-     * latest mtime, and figuring out the second-latest cannot easily be
-     * done. So we merely mark the summary as dirty and wait until a recalc()
-     * will be triggered from outside - which might as well never happen if
-     * nobody wants to know some summary field anyway.
+     * Subtract the child's values from the summary of this directory and
+     * all its ancestors. This is cheap: It does not depend on the size of
+     * the subtree, only on its depth. Only the latest and oldest mtime
+     * cannot be updated like that: The child now being deleted might just
+     * be the one with the latest mtime, and figuring out the second-latest
+     * requires looking at all the other children. That is left to the
+     * first one who wants to know the mtime.
      **/
 
-    _summaryDirty = true;
+    subtractChild( child );
+    unlinkChild( child );
+}
+
+
+void DirInfo::subtractChild( FileInfo * child )
+{
+    if ( child->isIgnored() || child->isPseudoDir() )
+    {
+	// Those are not added up like normal children; don't bother
+
+	markAncestorsDirty();
+	return;
+    }
+
+    Summary summary;
+    summary.size	    = child->totalSize();
+    summary.allocatedSize   = child->totalAllocatedSize();
+    summary.blocks	    = child->totalBlocks();
+    summary.items	    = child->totalItems() + 1;
+    summary.subDirs	    = child->totalSubDirs() + ( child->isDir()  ? 1 : 0 );
+    summary.files	    = child->totalFiles()   + ( child->isFile() ? 1 : 0 );
+    summary.ignoredItems    = child->totalIgnoredItems();
+    summary.unignoredItems  = child->totalUnignoredItems() + ( child->isDir() ? 0 : 1 );
+    summary.errSubDirs	    = child->errSubDirCount();
+    summary.estimatedDirs   = child->estimatedDirCount();
+    summary.latestMtime	    = child->latestMtime();
+    summary.oldestFileMtime = child->oldestFileMtime();
+
+    if ( child->isAggregate() )
+    {
+	summary.sizes  = child->toAggregate()->sizeHistogram();
+	summary.mtimes = child->toAggregate()->mtimeHistogram();
+    }
+    else if ( child->isFile() )
+    {
+	summary.sizes.add( child->size() );
+	summary.mtimes.add( child->mtime(), child->size() );
+    }
+    else if ( child->isDirInfo() )
+    {
+	summary.sizes  = child->toDirInfo()->sizeHistogram();
+	summary.mtimes = child->toDirInfo()->mtimeHistogram();
+    }
+
+    summary.owners.add( child );
+
+    if ( child->isDirInfo() )
+	summary.owners.add( child->toDirInfo()->ownerUsage() );
+
+    if ( child->isDir() && child->readError() )
+	summary.errSubDirs++;
+
+    subtractFromAncestors( summary, true );
+}
 
-    if ( _parent )
-	_parent->deletingChild( child );
 
-    if ( child->parent() == this )
+void DirInfo::subtractFromAncestors( const Summary & summary, bool directChild )
+{
+    for ( DirInfo * dir = this; dir; dir = dir->parent() )
     {
-	if ( ! _deletingAll )
+	if ( dir->isAttic() )
 	{
-	    /**
-	     * Unlink the child from the children's list - but only if this
-	     * doesn't happen recursively for all children of this object: No
-	     * use bothering about the validity of the children's list if this
-	     * will all be history anyway in a moment.
-	     **/
-
-	    unlinkChild( child );
+	    dir->markAncestorsDirty();
+	    return;
 	}
-	else
+
+	if ( dir->_summaryDirty )	// Recalculated anyway
+	    continue;
+
+	dir->_totalSize		  -= summary.size;
+	dir->_totalAllocatedSize  -= summary.allocatedSize;
+	dir->_totalBlocks	  -= summary.blocks;
+	dir->_totalItems	  -= summary.items;
+	dir->_totalSubDirs	  -= summary.subDirs;
+	dir->_totalFiles	  -= summary.files;
+	dir->_totalIgnoredItems	  -= summary.ignoredItems;
+	dir->_totalUnignoredItems -= summary.unignoredItems;
+	dir->_errSubDirCount	  -= summary.errSubDirs;
+	dir->_estimatedDirCount	  -= summary.estimatedDirs;
+
+	if ( dir->_sizeHistogram )
+	    dir->_sizeHistogram->subtract( summary.sizes );
+
+	if ( dir->_mtimeHistogram )
+	    dir->_mtimeHistogram->subtract( summary.mtimes );
+
+	if ( dir->_ownerUsage )
+	    dir->_ownerUsage->subtract( summary.owners );
+
+	if ( directChild && dir == this )
+	    dir->_directChildrenCount--;
+
+	if ( summary.latestMtime >= dir->_latestMtime )
+	    dir->_mtimeDirty = true;
+
+	if ( summary.oldestFileMtime > 0 &&
+	     ( dir->_oldestFileMtime == 0 || summary.oldestFileMtime <= dir->_oldestFileMtime ) )
 	{
-	    dropSortCache();
+	    dir->_mtimeDirty = true;
 	}
     }
 }
 
 
+void DirInfo::beginAddingChildren()
+{
+    if ( _addingChildren || _summaryDirty || _mtimeDirty || ! _parent )
+	return;
+
+    _addingChildren = true;
+    _addingSummaries.insert( this, currentSummary() );
+}
+
+
+void DirInfo::endAddingChildren()
+{
+    if ( ! _addingChildren )
+	return;
+
+    _addingChildren = false;
+    Summary before = _addingSummaries.take( this );
+
+    // An ignored directory adds up its ignored children, its ancestors
+    // don't
+
+    if ( _summaryDirty || _mtimeDirty || _isIgnored || isAttic() )
+    {
+	markAncestorsDirty();
+	return;
+    }
+
+    Summary added = currentSummary();
+
+    added.size		 -= before.size;
+    added.allocatedSize	 -= before.allocatedSize;
+    added.blocks	 -= before.blocks;
+    added.items		 -= before.items;
+    added.subDirs	 -= before.subDirs;
+    added.files		 -= before.files;
+    added.ignoredItems	 -= before.ignoredItems;
+    added.unignoredItems -= before.unignoredItems;
+    added.sizes.subtract ( before.sizes  );
+    added.mtimes.subtract( before.mtimes );
+    added.owners.subtract( before.owners );
+
+    // The other values are not changed by childAdded()
+
+    added.errSubDirs	= 0;
+    added.estimatedDirs = 0;
+
+    if ( added.items > 0 || added.ignoredItems > 0 )
+	_parent->addToAncestors( added );
+}
+
+
+DirInfo::Summary DirInfo::currentSummary() const
+{
+    Summary summary;
+    summary.size	    = _totalSize;
+    summary.allocatedSize   = _totalAllocatedSize;
+    summary.blocks	    = _totalBlocks;
+    summary.items	    = _totalItems;
+    summary.subDirs	    = _totalSubDirs;
+    summary.files	    = _totalFiles;
+    summary.ignoredItems    = _totalIgnoredItems;
+    summary.unignoredItems  = _totalUnignoredItems;
+    summary.errSubDirs	    = _errSubDirCount;
+    summary.estimatedDirs   = _estimatedDirCount;
+    summary.latestMtime	    = _latestMtime;
+    summary.oldestFileMtime = _oldestFileMtime;
+
+    if ( _sizeHistogram )
+	summary.sizes = *_sizeHistogram;
+
+    if ( _mtimeHistogram )
+	summary.mtimes = *_mtimeHistogram;
+
+    if ( _ownerUsage )
+	summary.owners = *_ownerUsage;
+
+    return summary;
+}
+
+
+void DirInfo::addToAncestors( const Summary & summary )
+{
+    for ( DirInfo * dir = this; dir; dir = dir->parent() )
+    {
+	if ( dir->isAttic() || dir->_isIgnored )
+	{
+	    dir->markAncestorsDirty();
+	    return;
+	}
+
+	dir->dropSortCacheByCol( ReadJobsCol, false );
+
+	if ( dir->_summaryDirty )	// Recalculated anyway
+	    continue;
+
+	dir->_totalSize		  += summary.size;
+	dir->_totalAllocatedSize  += summary.allocatedSize;
+	dir->_totalBlocks	  += summary.blocks;
+	dir->_totalItems	  += summary.items;
+	dir->_totalSubDirs	  += summary.subDirs;
+	dir->_totalFiles	  += summary.files;
+	dir->_totalIgnoredItems	  += summary.ignoredItems;
+	dir->_totalUnignoredItems += summary.unignoredItems;
+	dir->_errSubDirCount	  += summary.errSubDirs;
+	dir->_estimatedDirCount	  += summary.estimatedDirs;
+
+	if ( summary.files > 0 )
+	{
+	    dir->addToSizeHistogram ( summary.sizes  );
+	    dir->addToMTimeHistogram( summary.mtimes );
+	}
+
+	if ( ! summary.owners.isEmpty() )
+	    dir->addToOwnerUsage( summary.owners );
+
+	if ( summary.latestMtime > dir->_latestMtime )
+	    dir->_latestMtime = summary.latestMtime;
+
+	if ( summary.oldestFileMtime > 0 &&
+	     ( dir->_oldestFileMtime == 0 || summary.oldestFileMtime < dir->_oldestFileMtime ) )
+	{
+	    dir->_oldestFileMtime = summary.oldestFileMtime;
+	}
+    }
+}
+
+
+void DirInfo::markAncestorsDirty()
+{
+    // Not stopping at the first dirty one: A local recalc() might have
+    // left a dirty directory below a clean ancestor.
+
+    for ( DirInfo * dir = this; dir; dir = dir->parent() )
+	dir->_summaryDirty = true;
+}
+
+
+void DirInfo::markAtticPending()
+{
+    // The ancestors of a flagged directory are always flagged, too
+
+    for ( DirInfo * dir = this; dir && ! dir->_atticPending; dir = dir->parent() )
+	dir->_atticPending = true;
+}
+
+
 void DirInfo::unlinkChild( FileInfo * deletedChild )
 {
     if ( deletedChild->parent() != this )
@@ -684,32 +1426,106 @@ void DirInfo::unlinkChild( FileInfo * deletedChild )
     }
 
     dropSortCache();
-    _summaryDirty = true;
 
-    if ( deletedChild == _firstChild )
+    if ( _childIndex )
+	_childIndex->remove( childIndexKey( deletedChild->name() ), deletedChild );
+
+    int pos = deletedChild->childPos();
+
+    if ( pos < 0 || pos >= _children.size() || _children.at( pos ) != deletedChild )
     {
-	// logDebug() << "Unlinking first child " << deletedChild << endl;
-	_firstChild = deletedChild->next();
+	logError() << "Couldn't unlink " << deletedChild << " from "
+		   << this << " children list" << endl;
 	return;
     }
 
-    FileInfo * child = firstChild();
+    // Leave a gap instead of moving all the following children: That would
+    // make deleting many children of a large directory quadratic, and it
+    // would break iterating over the children while unlinking some of them.
+    // The gaps are closed in compactChildren().
 
-    while ( child )
+    // The child keeps its position, so its next() still works if somebody
+    // is just iterating over the children.
+
+    _children[ pos ] = 0;
+    ++_unlinkedChildren;
+}
+
+
+FileInfo * DirInfo::childAfter( const FileInfo * child ) const
+{
+    int pos = 0;
+
+    if ( child )
+    {
+	pos = child->childPos();
+
+	// Dot entries and attics are not in the vector. An unlinked child
+	// left a gap (unless the gaps were closed in the meantime).
+
+	if ( pos < 0 || pos >= _children.size() )
+	    return 0;
+
+	if ( _children.at( pos ) != child && _children.at( pos ) != 0 )
+	    return 0;
+
+	++pos;
+    }
+
+    while ( pos < _children.size() )
     {
-	if ( child->next() == deletedChild )
+	FileInfo * nextChild = _children.at( pos++ );
+
+	if ( nextChild )	// Skip gaps of unlinked children
+	    return nextChild;
+    }
+
+    return 0;
+}
+
+
+void DirInfo::appendChild( FileInfo * newChild )
+{
+    newChild->setChildPos( _children.size() );
+    newChild->setParent( this );	// make sure the parent pointer is correct
+    _children.append( newChild );
+
+    if ( _childIndex )
+	_childIndex->insert( childIndexKey( newChild->name() ), newChild );
+}
+
+
+void DirInfo::dropChildren()
+{
+    // QVector::clear() keeps the capacity
+    _children = QVector<FileInfo *>();
+    _unlinkedChildren = 0;
+    dropChildIndex();
+}
+
+
+void DirInfo::compactChildren()
+{
+    if ( _unlinkedChildren > 0 )
+    {
+	int newSize = 0;
+
+	for ( int i = 0; i < _children.size(); ++i )
 	{
-	    // logDebug() << "Unlinking " << deletedChild << endl;
-	    child->setNext( deletedChild->next() );
+	    FileInfo * child = _children.at( i );
 
-	    return;
+	    if ( child )
+	    {
+		child->setChildPos( newSize );
+		_children[ newSize++ ] = child;
+	    }
 	}
 
-	child = child->next();
+	_children.resize( newSize );
+	_unlinkedChildren = 0;
     }
 
-    logError() << "Couldn't unlink " << deletedChild << " from "
-	       << this << " children list" << endl;
+    _children.squeeze();
 }
 
 
@@ -717,8 +1533,7 @@ void DirInfo::readJobAdded()
 {
     _pendingReadJobs++;
 
-    if ( _lastSortCol == ReadJobsCol )
-	dropSortCache();
+    dropSortCacheByCol( ReadJobsCol );
 
     if ( _parent )
 	_parent->readJobAdded();
@@ -729,8 +1544,7 @@ void DirInfo::readJobFinished( DirInfo * dir )
 {
     _pendingReadJobs--;
 
-    if ( _lastSortCol == ReadJobsCol )
-	dropSortCache();
+    dropSortCacheByCol( ReadJobsCol );
 
     if ( dir && dir != this && dir->readError() )
 	_errSubDirCount++;
@@ -742,7 +1556,7 @@ void DirInfo::readJobFinished( DirInfo * dir )
 
 void DirInfo::readJobAborted( DirInfo * dir )
 {
-    _readState = DirAborted;
+    changeReadState( DirAborted );
 
     if ( _parent )
 	_parent->readJobAborted( dir );
@@ -780,6 +1594,9 @@ bool DirInfo::readError() const
 
 QString DirInfo::sizePrefix() const
 {
+    if ( _estimatedDirCount > 0 )
+	return "~";
+
     switch ( _readState )
     {
 	case DirQueued:
@@ -810,21 +1627,26 @@ void DirInfo::finalizeLocal()
     cleanupDotEntries();
     cleanupAttics();
     checkIgnored();
+    compactChildren();
 }
 
 
 void DirInfo::finalizeAll()
 {
-    FileInfo * child = firstChild();
+    // Every directory ends up in this list before its subdirectories, so
+    // going backwards finalizes the subdirectories first. This uses a list
+    // instead of recursion, so a deep tree can't overflow the stack.
 
-    while ( child )
+    QVector<DirInfo *> dirs;
+    dirs << this;
+
+    for ( int i = 0; i < dirs.size(); ++i )
     {
-	if ( child->isDirInfo() && ! child->isDotEntry() )
+	for ( FileInfo * child = dirs.at( i )->firstChild(); child; child = child->next() )
 	{
-	    child->toDirInfo()->finalizeAll();
+	    if ( child->isDirInfo() && ! child->isDotEntry() )
+		dirs << child->toDirInfo();
 	}
-
-	child = child->next();
     }
 
     // Optimization: As long as this directory is not finalized yet, it does
@@ -836,7 +1658,8 @@ void DirInfo::finalizeAll()
     // get all their plain file children reparented to themselves, so they
     // would need to be processed in the loop, too.
 
-    finalizeLocal();
+    for ( int i = dirs.size() - 1; i >= 0; --i )
+	dirs.at( i )->finalizeLocal();
 }
 
 
@@ -847,7 +1670,7 @@ void DirInfo::cleanupDotEntries()
 
     // Reparent dot entry children if there are no subdirectories on this level
 
-    if ( ! _firstChild && ! hasAtticChildren() )
+    if ( ! firstChild() && ! hasAtticChildren() )
     {
 	takeAllChildren( _dotEntry );
 
@@ -886,8 +1709,7 @@ void DirInfo::cleanupAttics()
 	    delete _attic;
 	    _attic = 0;
 
-	    if ( _lastIncludeAttic )
-		dropSortCache();
+	    dropSortCache();
 
 	    _summaryDirty = true;
 	}
@@ -910,6 +1732,12 @@ void DirInfo::checkIgnored()
     if ( _isIgnored )
 	ignoreEmptySubDirs();
 
+    // Unignored items might still come, but if they don't, this or an empty
+    // directory below will have to move to the attic
+
+    if ( ! isPseudoDir() && totalUnignoredItems() == 0 )
+	markAtticPending();
+
     if ( ! isPseudoDir() && _parent )
 	_parent->checkIgnored();
 }
@@ -944,7 +1772,7 @@ void DirInfo::clearTouched( bool recursive )
     {
 	if ( ! isDotEntry() )
 	{
-	    FileInfo * child = _firstChild;
+	    FileInfo * child = firstChild();
 
 	    while ( child )
 	    {
@@ -968,126 +1796,526 @@ const FileInfoList & DirInfo::sortedChildren( DataColumn    sortCol,
 					      Qt::SortOrder sortOrder,
 					      bool	    includeAttic )
 {
-    if ( _sortedChildren &&
-	 sortCol      == _lastSortCol	   &&
-	 sortOrder    == _lastSortOrder	   &&
-	 includeAttic == _lastIncludeAttic    )
+    if ( _sortCaches )
     {
-	return *_sortedChildren;
-    }
+	for ( int i = 0; i < _sortCaches->size(); ++i )
+	{
+	    SortCache * cache = _sortCaches->at( i );
 
+	    if ( cache->sortCol == sortCol && cache->includeAttic == includeAttic )
+	    {
+		if ( cache->sortOrder != sortOrder )
+		{
+		    reverseSortCache( cache, sortOrder );
+		    updateSortCacheBytes();
+		}
 
-    // Clean old sorted children list and create a new one
+		if ( i > 0 )
+		    _sortCaches->move( i, 0 );
 
-    dropSortCache( true ); // recursive
-    _sortedChildren = new FileInfoList();
-    CHECK_NEW( _sortedChildren );
+		touchSortCaches();
+
+		return cache->children;
+	    }
+	}
+    }
+
+    SortCache * cache = newSortCache( sortCol, sortOrder, includeAttic );
+    FileInfoList & sortedList = cache->children;
 
 
     // Populate with unsorted children list
 
-    FileInfo * child = _firstChild;
+    sortedList.reserve( _children.size() - _unlinkedChildren + 2 );
 
-    while ( child )
+    for ( int i = 0; i < _children.size(); ++i )
     {
-	_sortedChildren->append( child );
-	child = child->next();
+	if ( _children.at( i ) )
+	    sortedList.append( _children.at( i ) );
     }
 
     if ( _dotEntry )
-	_sortedChildren->append( _dotEntry );
+	sortedList.append( _dotEntry );
 
 
-    // Sort
+    // Sort by sortCol ascending or descending (as specified in sortOrder)
+    // and then by NameCol (always in ascending order)
 
     // logDebug() << "Sorting children of " << this << " by " << sortCol << endl;
 
-    if ( sortCol != NameCol )
-    {
-	// Do secondary sorting by NameCol (always in ascending order)
-
-	std::stable_sort( _sortedChildren->begin(),
-			  _sortedChildren->end(),
-			  FileInfoSorter( NameCol, Qt::AscendingOrder ) );
-    }
-
-
-    // Primary sorting by sortCol ascending or descending (as specified in sortOrder)
+    FileInfoSortKeyList keys = FileInfoKeySorter::createKeys( sortedList, sortCol );
+    FileInfoKeySorter::sort( keys, sortCol, sortOrder );
 
-    std::stable_sort( _sortedChildren->begin(),
-		      _sortedChildren->end(),
-		      FileInfoSorter( sortCol, sortOrder ) );
+    for ( int i = 0; i < keys.size(); ++i )
+	sortedList[ i ] = keys.at( i ).item;
 
     if ( includeAttic && _attic )
-	_sortedChildren->append( _attic );
-
-    _lastSortCol      = sortCol;
-    _lastSortOrder    = sortOrder;
-    _lastIncludeAttic = includeAttic;
+	sortedList.append( _attic );
 
 
 #if DIRECT_CHILDREN_COUNT_SANITY_CHECK
 
-    if ( _sortedChildren->size() != _directChildrenCount )
+    if ( sortedList.size() != _directChildrenCount )
     {
-	Debug::dumpChildrenList( this, *_sortedChildren );
+	Debug::dumpChildrenList( this, sortedList );
 
 	THROW( Exception( QString( "_directChildrenCount of %1 corrupted; is %2, should be %3" )
 			  .arg( debugUrl() )
 			  .arg( _directChildrenCount )
-			  .arg( _sortedChildren->size() ) ) );
+			  .arg( sortedList.size() ) ) );
     }
 #endif
 
-    return *_sortedChildren;
+    updateSortCacheBytes();
+
+    return sortedList;
+}
+
+
+DirInfo::SortCache * DirInfo::newSortCache( DataColumn	  sortCol,
+					    Qt::SortOrder sortOrder,
+					    bool	  includeAttic )
+{
+    if ( ! _sortCaches )
+    {
+	_sortCaches = new SortCacheList();
+	CHECK_NEW( _sortCaches );
+	linkSortCaches();
+    }
+    else
+    {
+	touchSortCaches();
+    }
+
+    // Make room for a new sorted children list, dropping the least
+    // recently used one.
+
+    if ( _sortCaches->size() >= SORT_CACHE_MAX_ENTRIES )
+	delete _sortCaches->takeLast();
+
+    SortCache * cache = new SortCache();
+    CHECK_NEW( cache );
+    _sortCaches->prepend( cache );
+
+    cache->sortCol	= sortCol;
+    cache->sortOrder	= sortOrder;
+    cache->includeAttic = includeAttic;
+    cache->serial	= ++lastSortCacheSerial;
+
+    return cache;
+}
+
+
+void DirInfo::setSortedChildren( const FileInfoList & sortedList,
+				 DataColumn	      sortCol,
+				 Qt::SortOrder	      sortOrder,
+				 bool		      includeAttic )
+{
+    dropSortCacheByCol( sortCol );
+    newSortCache( sortCol, sortOrder, includeAttic )->children = sortedList;
+    updateSortCacheBytes();
+}
+
+
+bool DirInfo::hasSortCache( DataColumn sortCol, bool includeAttic ) const
+{
+    if ( _sortCaches )
+    {
+	foreach ( const SortCache * cache, *_sortCaches )
+	{
+	    if ( cache->sortCol == sortCol && cache->includeAttic == includeAttic )
+		return true;
+	}
+    }
+
+    return false;
+}
+
+
+bool DirInfo::lastSortOrder( bool	     includeAttic,
+			     DataColumn &    sortCol_ret,
+			     Qt::SortOrder & sortOrder_ret,
+			     quint64 &	     serial_ret ) const
+{
+    if ( _sortCaches )
+    {
+	foreach ( const SortCache * cache, *_sortCaches )
+	{
+	    if ( cache->includeAttic == includeAttic )
+	    {
+		sortCol_ret   = cache->sortCol;
+		sortOrder_ret = cache->sortOrder;
+		serial_ret    = cache->serial;
+
+		return true;
+	    }
+	}
+    }
+
+    return false;
+}
+
+
+bool DirInfo::hasSortCacheSerial( quint64 serial ) const
+{
+    if ( _sortCaches )
+    {
+	foreach ( const SortCache * cache, *_sortCaches )
+	{
+	    if ( cache->serial == serial )
+		return true;
+	}
+    }
+
+    return false;
+}
+
+
+int DirInfo::sortedRow( FileInfo *    child,
+			DataColumn    sortCol,
+			Qt::SortOrder sortOrder,
+			bool	      includeAttic )
+{
+    const FileInfoList & sortedList = sortedChildren( sortCol, sortOrder, includeAttic );
+
+    if ( sortedList.size() < SORT_CACHE_MIN_ROW_INDEX )
+	return sortedList.indexOf( child );
+
+    // sortedChildren() just moved the cache of this sort order to the front
+
+    QHash<const FileInfo *, int> & rows = _sortCaches->first()->rows;
+
+    if ( rows.isEmpty() )
+    {
+	rows.reserve( sortedList.size() );
+
+	for ( int i = 0; i < sortedList.size(); ++i )
+	    rows.insert( sortedList.at( i ), i );
+
+	updateSortCacheBytes();
+    }
+
+    return rows.value( child, -1 );
+}
+
+
+void DirInfo::reverseSortCache( SortCache * cache, Qt::SortOrder sortOrder )
+{
+    cache->rows.clear(); // All rows change
+
+    FileInfoList & list = cache->children;
+    FileInfoList::iterator end = list.end();
+
+    if ( ! list.isEmpty() && list.last()->isAttic() )
+	--end;	// The attic always stays last
+
+    std::reverse( list.begin(), end );
+
+    // Stable sorting keeps children that compare equal in their previous
+    // (secondary) order; reversing the complete list reversed that, too.
+
+    FileInfoSorter sorter( cache->sortCol, sortOrder );
+    FileInfoList::iterator runStart = list.begin();
+
+    while ( runStart != end )
+    {
+	FileInfoList::iterator runEnd = runStart + 1;
+
+	while ( runEnd != end && ! sorter( *runStart, *runEnd ) && ! sorter( *runEnd, *runStart ) )
+	    ++runEnd;
+
+	std::reverse( runStart, runEnd );
+	runStart = runEnd;
+    }
+
+    cache->sortOrder = sortOrder;
 }
 
 
 void DirInfo::dropSortCache( bool recursive )
 {
-    if ( _sortedChildren )
+    if ( _sortCaches )
     {
 	// logDebug() << "Dropping sort cache for " << this << endl;
 
-	// Intentionally deleting the list and creating a new one since
-	// QList never shrinks, it always just grows (this is documented):
-	// QList.clear() would not free the allocated space.
+	// Intentionally deleting the lists instead of just clearing them
+	// since QList never shrinks, it always just grows (this is
+	// documented): QList.clear() would not free the allocated space.
 	//
-	// If we get lucky, we won't even need the _sortedChildren list any
-	// more if nobody asks for it. This prevents pathological cases where
+	// If we get lucky, we won't even need the sorted children lists any
+	// more if nobody asks for them. This prevents pathological cases where
 	// the user opened all tree branches at once (there are menu entries to
 	// open to a certain tree level), then closed them again and now opens
 	// select branches manually.
 
-	delete _sortedChildren;
-	_sortedChildren = 0;
+	freeSortCaches();
+    }
 
-	// Optimization: If this dir didn't have any sort cache, there won't be
-	// any in the subtree, either. And dot entries don't have dir children
-	// that could have a sort cache.
+    // Subdirectories might still have sort caches when the ones of this
+    // directory were evicted, so walk the directories that have any
+    // instead of the subtree.
+
+    if ( recursive )
+    {
+	DirInfo * dir = sortCacheLruFirst;
 
-	if ( recursive )
+	while ( dir )
 	{
-	    if ( ! isDotEntry() )
-	    {
-		FileInfo * child = _firstChild;
+	    DirInfo * next = dir->_sortCaches->lruNext;
 
-		while ( child )
-		{
-		    if ( child->isDirInfo() )
-			child->toDirInfo()->dropSortCache( recursive );
+	    if ( dir->isInSubtree( this ) )
+		dir->freeSortCaches();
 
-		    child = child->next();
-		}
+	    dir = next;
+	}
+    }
+}
 
-		if ( _dotEntry )
-		    _dotEntry->dropSortCache( recursive );
-	    }
 
-	    if ( _attic )
-		_attic->dropSortCache( recursive );
+void DirInfo::dropSortCacheByCol( DataColumn sortCol, bool match )
+{
+    if ( ! _sortCaches )
+	return;
+
+    for ( int i = _sortCaches->size() - 1; i >= 0; --i )
+    {
+	if ( ( _sortCaches->at( i )->sortCol == sortCol ) == match )
+	    delete _sortCaches->takeAt( i );
+    }
+
+    if ( _sortCaches->isEmpty() )
+	freeSortCaches();
+    else
+	updateSortCacheBytes();
+}
+
+
+void DirInfo::freeSortCaches()
+{
+    if ( ! _sortCaches )
+	return;
+
+    unlinkSortCaches();
+    totalSortCacheBytes -= _sortCaches->bytes;
+
+    qDeleteAll( *_sortCaches );
+    delete _sortCaches;
+    _sortCaches = 0;
+}
+
+
+void DirInfo::linkSortCaches()
+{
+    _sortCaches->lruPrev = 0;
+    _sortCaches->lruNext = sortCacheLruFirst;
+
+    if ( sortCacheLruFirst )
+	sortCacheLruFirst->_sortCaches->lruPrev = this;
+    else
+	sortCacheLruLast = this;
+
+    sortCacheLruFirst = this;
+}
+
+
+void DirInfo::unlinkSortCaches()
+{
+    DirInfo * prev = _sortCaches->lruPrev;
+    DirInfo * next = _sortCaches->lruNext;
+
+    if ( prev )
+	prev->_sortCaches->lruNext = next;
+    else
+	sortCacheLruFirst = next;
+
+    if ( next )
+	next->_sortCaches->lruPrev = prev;
+    else
+	sortCacheLruLast = prev;
+
+    _sortCaches->lruPrev = 0;
+    _sortCaches->lruNext = 0;
+}
+
+
+void DirInfo::touchSortCaches()
+{
+    if ( sortCacheLruFirst == this )
+	return;
+
+    unlinkSortCaches();
+    linkSortCaches();
+}
+
+
+qint64 DirInfo::sortCacheListBytes() const
+{
+    if ( ! _sortCaches )
+	return 0;
+
+    qint64 bytes = MemoryStats::heapBytes( sizeof( *_sortCaches ) ) +
+	MemoryStats::arrayBytes( _sortCaches->size(), sizeof( SortCache * ) );
+
+    foreach ( const SortCache * cache, *_sortCaches )
+    {
+	bytes += MemoryStats::heapBytes( sizeof( SortCache ) );
+	bytes += MemoryStats::arrayBytes( cache->children.size(), sizeof( FileInfo * ) );
+	bytes += MemoryStats::hashBytes( cache->rows.size(), cache->rows.capacity(),
+					 sizeof( const FileInfo * ), sizeof( int ) );
+    }
+
+    return bytes;
+}
+
+
+void DirInfo::updateSortCacheBytes()
+{
+    qint64 bytes = sortCacheListBytes();
+    totalSortCacheBytes += bytes - _sortCaches->bytes;
+    _sortCaches->bytes	 = bytes;
+
+    // Not right away: The caller is about to use a sorted children list,
+    // and so might be the caller's caller with the one of the parent
+
+    if ( sortCacheLimitBytes > 0 && totalSortCacheBytes > sortCacheLimitBytes && _tree )
+	_tree->scheduleSortCacheEviction();
+}
+
+
+qint64 DirInfo::sortCacheBytes()
+{
+    return totalSortCacheBytes;
+}
+
+
+qint64 DirInfo::sortCacheLimit()
+{
+    return sortCacheLimitBytes;
+}
+
+
+void DirInfo::setSortCacheLimit( qint64 bytes )
+{
+    sortCacheLimitBytes = bytes;
+}
+
+
+int DirInfo::evictSortCaches( qint64 targetBytes )
+{
+    int count = 0;
+    DirInfo * dir = sortCacheLruLast;
+
+    while ( dir && totalSortCacheBytes > targetBytes )
+    {
+	DirInfo * prev = dir->_sortCaches->lruPrev;
+
+	if ( ! dir->_tree || ! dir->_tree->keepLoaded( dir ) )
+	{
+	    dir->freeSortCaches();
+	    ++count;
 	}
+
+	dir = prev;
     }
+
+    return count;
+}
+
+
+bool DirInfo::ensureChildIndex()
+{
+    if ( _childIndex )
+	return true;
+
+    int count = _children.size() - _unlinkedChildren;
+
+    if ( count < CHILD_INDEX_MIN_CHILDREN )
+	return false;
+
+    _childIndex = new QMultiHash<QString, FileInfo *>();
+    CHECK_NEW( _childIndex );
+    _childIndex->reserve( count );
+
+    for ( FileInfo * child = firstChild(); child; child = child->next() )
+	_childIndex->insert( childIndexKey( child->name() ), child );
+
+    return true;
+}
+
+
+void DirInfo::dropChildIndex()
+{
+    if ( _childIndex )
+    {
+	delete _childIndex;
+	_childIndex = 0;
+    }
+}
+
+
+FileInfo * DirInfo::locateChild( const QString & url, bool findPseudoDirs )
+{
+    if ( ensureChildIndex() )
+    {
+	// Only children whose name starts with the same path component can
+	// possibly match
+
+	QString key = childIndexKey( url );
+	QMultiHash<QString, FileInfo *>::const_iterator it = _childIndex->constFind( key );
+
+	while ( it != _childIndex->constEnd() && it.key() == key )
+	{
+	    FileInfo * foundChild = it.value()->locate( url, findPseudoDirs );
+
+	    if ( foundChild )
+		return foundChild;
+
+	    ++it;
+	}
+
+	return 0;
+    }
+
+    FileInfo * child = firstChild();
+
+    while ( child )
+    {
+	FileInfo * foundChild = child->locate( url, findPseudoDirs );
+
+	if ( foundChild )
+	    return foundChild;
+	else
+	    child = child->next();
+    }
+
+    return 0;
+}
+
+
+FileInfo * DirInfo::findChild( const QString & name )
+{
+    if ( ensureChildIndex() )
+    {
+	QMultiHash<QString, FileInfo *>::const_iterator it = _childIndex->constFind( name );
+
+	while ( it != _childIndex->constEnd() && it.key() == name )
+	{
+	    if ( it.value()->name() == name )
+		return it.value();
+
+	    ++it;
+	}
+
+	return 0;
+    }
+
+    for ( FileInfo * child = firstChild(); child; child = child->next() )
+    {
+	if ( child->name() == name )
+	    return child;
+    }
+
+    return 0;
 }
 
 
@@ -1104,29 +2332,72 @@ const DirInfo * DirInfo::findNearestMountPoint() const
 
 void DirInfo::takeAllChildren( DirInfo * oldParent )
 {
-    FileInfo * child = oldParent->firstChild();
-
-    if ( child )
+    if ( oldParent->firstChild() )
     {
 	// logDebug() << "Reparenting all children of " << oldParent << " to " << this << endl;
 
-	FileInfo * oldFirstChild = _firstChild;
-	_firstChild = child;
-	FileInfo * lastChild = child;
+	dropChildIndex();
+	dropUrlCache();
+	_children.reserve( _children.size() + oldParent->_children.size() - oldParent->_unlinkedChildren );
 
-	oldParent->setFirstChild( 0 );
+	for ( int i = 0; i < oldParent->_children.size(); ++i )
+	{
+	    FileInfo * child = oldParent->_children.at( i );
+
+	    if ( child )
+		appendChild( child );
+	}
+
+	oldParent->dropChildren();
 	oldParent->recalc();
 
 	_directChildrenCount = -1;
 	_summaryDirty	     = true;
+    }
+}
+
 
-	while ( child )
+void DirInfo::addMemoryUsage( MemoryStats & stats ) const
+{
+    stats.add( MemChildren, MemoryStats::arrayBytes( _children.capacity(), sizeof( FileInfo * ) ) );
+
+    if ( _sortCaches )
+	stats.add( MemSortCaches, sortCacheListBytes(), _sortCaches->size() );
+
+    if ( _childIndex )
+    {
+	qint64 bytes = MemoryStats::heapBytes( sizeof( *_childIndex ) ) +
+	    MemoryStats::hashBytes( _childIndex->size(), _childIndex->capacity(),
+				    sizeof( QString ), sizeof( FileInfo * ) );
+
+	for ( QMultiHash<QString, FileInfo *>::const_iterator it = _childIndex->constBegin();
+	      it != _childIndex->constEnd();
+	      ++it )
 	{
-	    child->setParent( this );
-	    lastChild = child;
-	    child = child->next();
+	    bytes += MemoryStats::stringBytes( it.key() );
 	}
 
-	lastChild->setNext( oldFirstChild );
+	stats.add( MemChildIndex, bytes );
+    }
+
+    if ( _sizeHistogram )
+	stats.add( MemHistograms, MemoryStats::heapBytes( sizeof( SizeHistogram ) ) );
+
+    if ( _mtimeHistogram )
+    {
+	stats.add( MemHistograms,
+		   MemoryStats::heapBytes( sizeof( MTimeHistogram ) ) +
+		   MemoryStats::arrayBytes( _mtimeHistogram->buckets().capacity(),
+					    sizeof( MTimeHistogram::Bucket ) ) );
+    }
+
+    if ( _ownerUsage )
+    {
+	stats.add( MemOwnerUsage,
+		   MemoryStats::heapBytes( sizeof( OwnerUsage ) ) +
+		   MemoryStats::arrayBytes( _ownerUsage->users().capacity(),
+					    sizeof( OwnerUsage::Entry ) ) +
+		   MemoryStats::arrayBytes( _ownerUsage->groups().capacity(),
+					    sizeof( OwnerUsage::Entry ) ) );
     }
 }
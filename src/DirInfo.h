@@ -11,8 +11,15 @@
 #define DirInfo_h
 
 
+#include <QHash>
+#include <QMultiHash>
+#include <QVector>
+
 #include "FileInfo.h"
 #include "DataColumns.h"
+#include "SizeHistogram.h"
+#include "MTimeHistogram.h"
+#include "OwnerUsage.h"
 
 
 namespace QDirStat
@@ -20,6 +27,8 @@ namespace QDirStat
     // Forward declarations
     class DirTree;
     class DotEntry;
+    class MemoryStats;
+    struct BinaryCacheSubtree;
 
     /**
      * A more specialized version of FileInfo: This class can actually manage
@@ -117,6 +126,45 @@ namespace QDirStat
 	 **/
 	virtual int totalFiles() Q_DECL_OVERRIDE;
 
+	/**
+	 * Returns the sizes of the plain files in this subtree by order of
+	 * magnitude. This is updated along with the other totals, so it does
+	 * not need to walk the subtree.
+	 *
+	 * If the children of a subdirectory are still in a cache file, their
+	 * sizes are not known yet: Then the histogram has fewer files than
+	 * totalFiles(). See also hasCompleteSizeHistogram().
+	 **/
+	SizeHistogram sizeHistogram();
+
+	/**
+	 * Returns 'true' if sizeHistogram() has all the files of this
+	 * subtree.
+	 **/
+	bool hasCompleteSizeHistogram();
+
+	/**
+	 * Returns the number and total size of the plain files in this
+	 * subtree by the month of their mtime. Just like sizeHistogram(),
+	 * this does not need to walk the subtree, and it might not have all
+	 * the files yet (see hasCompleteMTimeHistogram()).
+	 **/
+	MTimeHistogram mtimeHistogram();
+
+	/**
+	 * Returns 'true' if mtimeHistogram() has all the files of this
+	 * subtree.
+	 **/
+	bool hasCompleteMTimeHistogram();
+
+	/**
+	 * Returns the disk usage of this subtree by the owning user and
+	 * group. Like sizeHistogram(), this is updated along with the other
+	 * totals, and it does not have items that are still in a cache file
+	 * or that have no owner.
+	 **/
+	OwnerUsage ownerUsage();
+
 	/**
 	 * Returns the total number of non-directory items in this subtree,
 	 * excluding this item.
@@ -166,6 +214,14 @@ namespace QDirStat
 	 **/
 	virtual int errSubDirCount() Q_DECL_OVERRIDE;
 
+	/**
+	 * Returns the number of directories in this subtree (including this
+	 * one) whose totals are only estimated.
+	 *
+	 * Reimplemented - inherited from FileInfo.
+	 **/
+	virtual int estimatedDirCount() Q_DECL_OVERRIDE;
+
 	/**
 	 * Returns the latest modification time of this subtree.
 	 *
@@ -241,21 +297,27 @@ namespace QDirStat
 	virtual int pendingReadJobs() Q_DECL_OVERRIDE
 	    { return _pendingReadJobs;	}
 
+	/**
+	 * Returns a pointer to the DirTree this entry belongs to.
+	 *
+	 * Reimplemented - inherited from FileInfo.
+	 **/
+	virtual DirTree * tree() const Q_DECL_OVERRIDE
+	    { return _tree;		}
+
 	/**
 	 * Returns the first child of this item or 0 if there is none.
 	 * Use the child's next() method to get the next child.
 	 **/
 	virtual FileInfo * firstChild() const Q_DECL_OVERRIDE
-	    { return _firstChild;	}
+	    { return childAfter( 0 ); }
 
 	/**
-	 * Set this entry's first child.
-	 * Use this method only if you know exactly what you are doing.
-	 *
-	 * Reimplemented - inherited from FileInfo.
+	 * Return the child after 'child' in the children vector or 0 if
+	 * there is none or if 'child' is not in it. If 'child' is 0, return
+	 * the first child. This is what FileInfo::next() uses.
 	 **/
-	virtual void setFirstChild( FileInfo * newfirstChild ) Q_DECL_OVERRIDE
-	    { _firstChild = newfirstChild; }
+	FileInfo * childAfter( const FileInfo * child ) const;
 
 	/**
 	 * Insert a child into the children list.
@@ -383,8 +445,8 @@ namespace QDirStat
 	virtual void finalizeLocal();
 
 	/**
-	 * Recursively finalize all directories from here on -
-	 * call finalizeLocal() recursively.
+	 * Finalize all directories from here on: Call finalizeLocal() for
+	 * each of them, the subdirectories first.
 	 **/
 	virtual void finalizeAll();
 
@@ -438,19 +500,121 @@ namespace QDirStat
 	 * 'includeAttic' is 'true', the attic (if there is one) is added to
 	 * the list.
 	 *
-	 * This might return cached information if all parameters are the same
-	 * as for the last call to this function, and there were no children
-	 * added or removed in the meantime.
+	 * This keeps a few of the most recently used sort orders cached (see
+	 * SORT_CACHE_MAX_ENTRIES in DirInfo.cpp), so different views that
+	 * sort by different columns don't throw away each other's results.
+	 * Switching between ascending and descending order only reverses the
+	 * cached list. The caches are dropped when children are added or
+	 * removed, and the least recently used ones of all directories are
+	 * evicted when they need more than sortCacheLimit().
 	 **/
 	const FileInfoList & sortedChildren( DataColumn	   sortCol,
 					     Qt::SortOrder sortOrder,
 					     bool	   includeAttic = false );
 
+	/**
+	 * Return the row of 'child' in sortedChildren() with the same
+	 * arguments or -1 if it is not there. For many children, this uses
+	 * an index of the rows that is kept with the sorted list, so this
+	 * does not need a linear search.
+	 **/
+	int sortedRow( FileInfo *    child,
+		       DataColumn    sortCol,
+		       Qt::SortOrder sortOrder,
+		       bool	     includeAttic = false );
+
+	/**
+	 * Return 'true' if the children sorted by 'sortCol' (in any order)
+	 * are cached.
+	 **/
+	bool hasSortCache( DataColumn sortCol, bool includeAttic = false ) const;
+
+	/**
+	 * Get the sort column and order of the most recently used sorted
+	 * children list and its serial number (see hasSortCacheSerial()).
+	 * Return 'false' if there is none.
+	 **/
+	bool lastSortOrder( bool	    includeAttic,
+			    DataColumn &    sortCol_ret,
+			    Qt::SortOrder & sortOrder_ret,
+			    quint64 &	    serial_ret ) const;
+
+	/**
+	 * Return 'true' if the sorted children list with serial number
+	 * 'serial' is still cached. Serial numbers are never reused, and
+	 * all caches are dropped when children are added or removed, so this
+	 * tells whether the children changed since then.
+	 **/
+	bool hasSortCacheSerial( quint64 serial ) const;
+
+	/**
+	 * Store 'sortedList' as the children sorted by 'sortCol' and
+	 * 'sortOrder', e.g. when they were sorted in another thread. The
+	 * caller has to make sure that these are really the current
+	 * children.
+	 **/
+	void setSortedChildren( const FileInfoList & sortedList,
+				DataColumn	     sortCol,
+				Qt::SortOrder	     sortOrder,
+				bool		     includeAttic = false );
+
 	/**
 	 * Drop all cached information about children sorting.
 	 **/
 	void dropSortCache( bool recursive = false );
 
+	/**
+	 * Drop the cached children sorted by 'sortCol' if 'match' is 'true',
+	 * or all others if 'match' is 'false'.
+	 **/
+	void dropSortCacheByCol( DataColumn sortCol, bool match = true );
+
+	/**
+	 * Return the bytes that the sort caches of all directories of all
+	 * trees take (see MemoryStats).
+	 **/
+	static qint64 sortCacheBytes();
+
+	/**
+	 * Return the bytes above which the sort caches of the least recently
+	 * used directories are dropped again (see DirTree::evictSortCaches()).
+	 * 0 means no limit.
+	 **/
+	static qint64 sortCacheLimit();
+
+	/**
+	 * Set the limit for the sort caches of all directories.
+	 **/
+	static void setSortCacheLimit( qint64 bytes );
+
+	/**
+	 * Drop the sort caches of the least recently used directories until
+	 * all of them take no more than 'targetBytes'. Directories that a
+	 * view shows (see DirTree::keepLoaded()) keep theirs. Return the
+	 * number of directories whose caches were dropped.
+	 *
+	 * Only call this when nobody holds a reference to a sorted children
+	 * list, i.e. not from within a model or view operation.
+	 **/
+	static int evictSortCaches( qint64 targetBytes );
+
+	/**
+	 * Locate 'url' (relative to this directory) among the direct
+	 * children of this directory and their subtrees. This does not
+	 * search the dot entry or the attic.
+	 *
+	 * For directories with many children, this uses an index by name
+	 * that is built on first use, so this does not need a linear scan
+	 * of all children for each path component.
+	 **/
+	FileInfo * locateChild( const QString & url, bool findPseudoDirs = false );
+
+	/**
+	 * Return the direct child with name 'name' or 0 if there is none.
+	 * This uses the same index as locateChild().
+	 **/
+	FileInfo * findChild( const QString & name );
+
 	/**
 	 * Check if this directory is locked. This is purely a user lock
 	 * that can be used by the application. The DirInfo does not care
@@ -473,6 +637,26 @@ namespace QDirStat
 	 **/
 	void clear();
 
+	/**
+	 * Take the subdirectories, the dot entry and the attic out of this
+	 * directory (without deleting them) and append them to 'dirs_ret'.
+	 * Deleting this directory afterwards only deletes its direct file
+	 * children. This is for deleting a huge subtree in small steps; the
+	 * summary fields are not updated.
+	 **/
+	void takeSubDirs( QList<DirInfo *> & dirs_ret );
+
+	/**
+	 * Move all children, the dot entry and the attic of 'other' to this
+	 * directory, which must not have any children, and take over its
+	 * read state. 'other' is the toplevel of another tree that read the
+	 * same directory again (see DirTree::refresh()); everything that is
+	 * moved belongs to this directory's tree from now on.
+	 *
+	 * The totals of this directory and its ancestors are marked dirty.
+	 **/
+	void takeChildren( DirInfo * other );
+
 	/**
 	 * Reset to the same status like just after construction in preparation
 	 * of refreshing the tree from this point on:
@@ -519,7 +703,8 @@ namespace QDirStat
 
 	/**
 	 * Count the direct children unconditionally and update
-	 * _directChildrenCount.
+	 * _directChildrenCount. This is cheap: It does not need to iterate
+	 * over the children.
 	 **/
 	int countDirectChildren();
 
@@ -548,9 +733,190 @@ namespace QDirStat
 	 **/
 	void recalc();
 
+	/**
+	 * Return 'true' if the children of this directory are not loaded
+	 * yet, but are still pending in a cache file (see
+	 * DirTree::loadPendingSubtree()). The totals of such a directory
+	 * are taken from the cache file. This is also 'true' for an
+	 * estimated directory.
+	 **/
+	bool isPendingSubtree() const { return _pendingSubtree; }
+
+	/**
+	 * Return 'true' if the children of this directory were not read,
+	 * but its totals were estimated from a sample of its subtree (see
+	 * SubtreeEstimator and DirTree::addEstimatedSubtree()).
+	 **/
+	bool isEstimated() const { return _estimated; }
+
+	/**
+	 * Set or clear the "estimated" flag. This marks the totals of this
+	 * directory and all its ancestors as dirty.
+	 **/
+	void setEstimated( bool estimated );
+
+	/**
+	 * Set or clear the "pending subtree" flag. This marks the totals of
+	 * this directory and all its ancestors as dirty.
+	 **/
+	void setPendingSubtree( bool pending );
+
+	/**
+	 * Set the size and mtime of this directory itself (not of its
+	 * children), e.g. from a delta cache file. This marks the totals of
+	 * this directory and all its ancestors as dirty.
+	 **/
+	void setOwnStat( FileSize size, time_t mtime );
+
+	/**
+	 * Mark this directory and all its ancestors as dirty, e.g. when the
+	 * size that a child counts for changed.
+	 **/
+	void markAncestorsDirty();
+
+	/**
+	 * Return 'true' if the summary of this directory is outdated and
+	 * needs a recalc().
+	 **/
+	bool isSummaryDirty() const { return _summaryDirty; }
+
+	/**
+	 * Return 'true' if this directory or one in its subtree had no
+	 * unignored items at some point, so it might have to be ignored and
+	 * moved to an attic when reading is finished. See
+	 * DirTree::moveIgnoredToAttic().
+	 **/
+	bool isAtticPending() const { return _atticPending; }
+
+	/**
+	 * Set the 'attic pending' flag of this directory and all its
+	 * ancestors.
+	 **/
+	void markAtticPending();
+
+	/**
+	 * Clear the 'attic pending' flag of this directory only.
+	 **/
+	void clearAtticPending() { _atticPending = false; }
+
+	/**
+	 * Stop passing the children that are added to this directory on to
+	 * its ancestors until endAddingChildren(): Only the summary of this
+	 * directory is updated for each new child, and the ancestors get the
+	 * difference all at once at the end. For a directory with many
+	 * children in a deep tree, this saves going up the parent chain for
+	 * each one of them.
+	 *
+	 * Nothing else may change in the subtree in the meantime (like
+	 * finalizeLocal() or moving children around), and the directory may
+	 * not go away.
+	 **/
+	void beginAddingChildren();
+
+	/**
+	 * Pass what was added since beginAddingChildren() on to the
+	 * ancestors.
+	 **/
+	void endAddingChildren();
+
+	/**
+	 * Add the memory that this directory uses besides the node itself
+	 * and its name to 'stats': The children vector, the sort caches, the
+	 * child index and the histograms. This does not recurse into the
+	 * children.
+	 **/
+	void addMemoryUsage( MemoryStats & stats ) const;
+
 
     protected:
 
+	/**
+	 * Set the read state without any checks and update the tree's list
+	 * of unreadable directories.
+	 **/
+	void changeReadState( DirReadState newReadState );
+
+	/**
+	 * Recalculate only the latest and oldest mtime from the direct
+	 * children after a child was removed that might have been the one
+	 * with one of those values. Unlike recalc(), this only descends into
+	 * children whose mtimes are dirty, too.
+	 **/
+	void recalcMtimes();
+
+	/**
+	 * Add the latest and oldest mtime of pending subtree 'subtree' to
+	 * the cached mtimes.
+	 **/
+	void addPendingMtimes( const BinaryCacheSubtree & subtree );
+
+	/**
+	 * The summary values that a child (or a complete subtree) contributes
+	 * to the summary of its ancestors.
+	 **/
+	struct Summary
+	{
+	    FileSize	size;
+	    FileSize	allocatedSize;
+	    FileSize	blocks;
+	    int		items;
+	    int		subDirs;
+	    int		files;
+	    int		ignoredItems;
+	    int		unignoredItems;
+	    int		errSubDirs;
+	    int		estimatedDirs;
+	    time_t	latestMtime;
+	    time_t	oldestFileMtime;
+	    SizeHistogram sizes;
+	    MTimeHistogram mtimes;
+	    OwnerUsage	owners;
+	};
+
+	/**
+	 * Subtract the summary values of direct child 'child' that is about
+	 * to go away from this directory and all its ancestors.
+	 **/
+	void subtractChild( FileInfo * child );
+
+	/**
+	 * Subtract 'summary' from this directory and all its ancestors.
+	 * Ancestors whose summary is dirty anyway are skipped. Above an
+	 * attic, the ancestors are only marked dirty: An attic contributes
+	 * only some of its values to its parent.
+	 *
+	 * If any of the mtimes in 'summary' might have been the latest or
+	 * oldest one of an ancestor, only the mtimes of that ancestor are
+	 * marked dirty; they are recalculated on demand.
+	 **/
+	void subtractFromAncestors( const Summary & summary, bool directChild );
+
+	/**
+	 * Add 'summary' of new items in the subtree of this directory to
+	 * this directory and all its ancestors. Ancestors whose summary is
+	 * dirty anyway are skipped. From an attic or an ignored directory
+	 * upwards, the ancestors are only marked dirty: They add up ignored
+	 * items differently.
+	 **/
+	void addToAncestors( const Summary & summary );
+
+	/**
+	 * Return the summary values of this directory's current totals.
+	 **/
+	Summary currentSummary() const;
+
+	/**
+	 * Set the tree of this directory and of all directories in its
+	 * subtree.
+	 **/
+	void setTreeRecursive( DirTree * tree );
+
+	/**
+	 * The summaries of the directories between beginAddingChildren() and
+	 * endAddingChildren(). This is rarely more than one.
+	 **/
+	static QHash<DirInfo *, Summary> _addingSummaries;
+
 	/**
 	 * Clean up unneeded / undesired dot entries:
 	 * Delete dot entries that don't have any children,
@@ -565,47 +931,197 @@ namespace QDirStat
 	 **/
 	virtual void cleanupAttics();
 
+	/**
+	 * One cached sort order of the children, see sortedChildren().
+	 **/
+	struct SortCache
+	{
+	    FileInfoList	children;
+	    QHash<const FileInfo *, int> rows;	// see sortedRow(); built on first use
+	    DataColumn		sortCol;
+	    Qt::SortOrder	sortOrder;
+	    bool		includeAttic;
+	    quint64		serial;		// see hasSortCacheSerial()
+	};
+
+	/**
+	 * The sort caches of a directory, most recently used first. The
+	 * directories with sort caches are linked in a list by their last
+	 * use, most recently used first, for evicting the least recently
+	 * used ones.
+	 **/
+	struct SortCacheList: public QList<SortCache *>
+	{
+	    SortCacheList(): lruPrev( 0 ), lruNext( 0 ), bytes( 0 ) {}
+
+	    DirInfo * lruPrev;	// used more recently
+	    DirInfo * lruNext;	// used less recently
+	    qint64    bytes;	// see sortCacheListBytes()
+	};
+
+	/**
+	 * Create a new (empty) sort cache as the most recently used one,
+	 * dropping the least recently used one if there are too many.
+	 **/
+	SortCache * newSortCache( DataColumn	sortCol,
+				  Qt::SortOrder sortOrder,
+				  bool		includeAttic );
+
+	/**
+	 * Switch 'cache' to the opposite sort order 'sortOrder'. This is
+	 * O(n): It reverses the list, and then it reverses each run of
+	 * children that compare equal again, so they stay in the same
+	 * (secondary) order as with a new stable sort.
+	 **/
+	void reverseSortCache( SortCache * cache, Qt::SortOrder sortOrder );
+
+	/**
+	 * Move this directory to the front of the list of the sort caches
+	 * by last use.
+	 **/
+	void touchSortCaches();
+
+	/**
+	 * Link this directory at the front of the list of the sort caches
+	 * by last use.
+	 **/
+	void linkSortCaches();
+
+	/**
+	 * Unlink this directory from the list of the sort caches by last
+	 * use.
+	 **/
+	void unlinkSortCaches();
+
+	/**
+	 * Update the bytes of the sort caches of this directory and the
+	 * total after they changed. If that is above the limit, ask the tree
+	 * to evict some later.
+	 **/
+	void updateSortCacheBytes();
+
+	/**
+	 * Return the bytes of the sort caches of this directory.
+	 **/
+	qint64 sortCacheListBytes() const;
+
+	/**
+	 * Delete the sort caches of this directory.
+	 **/
+	void freeSortCaches();
+
+	/**
+	 * Append 'newChild' to the children vector without updating any
+	 * summary fields.
+	 **/
+	void appendChild( FileInfo * newChild );
+
+	/**
+	 * Remove all children from the children vector (without deleting
+	 * them) and free the vector's memory.
+	 **/
+	void dropChildren();
+
+	/**
+	 * Close the gaps that unlinking children left in the children vector
+	 * and free any unused capacity. This is done when a directory is
+	 * finalized: Its children normally don't change any more after that.
+	 **/
+	void compactChildren();
+
 
 	//
 	// Data members
 	//
 
-	bool		_isMountPoint:1;	// Flag: is this a mount point?
-	bool		_isExcluded:1;		// Flag: was this directory excluded?
-	bool		_summaryDirty:1;	// dirty flag for the cached values
-	bool		_deletingAll:1;		// Deleting complete children tree?
-	bool		_locked:1;		// App lock
-	bool		_touched:1;		// App 'touch' flag
-	int		_pendingReadJobs;	// number of open directories in this subtree
+	// Ordered by size so there are no padding holes
+
+	DirTree	 *	_tree;			// pointer to the parent tree
 
 	// Children management
 
-	FileInfo *	_firstChild;		// pointer to the first child
+	QVector<FileInfo *> _children;		// unordered; 0 where a child was unlinked
 	DotEntry *	_dotEntry;		// pseudo entry to hold non-dir children
 	Attic	 *	_attic;			// pseudo entry to hold ignored children
+	SortCacheList *	_sortCaches;		// 0 as long as nothing was sorted
+	QMultiHash<QString, FileInfo *> * _childIndex;	// see locateChild()
+	SizeHistogram *	_sizeHistogram;		// 0 as long as there are no files
+	MTimeHistogram * _mtimeHistogram;	// 0 as long as there are no files
+	OwnerUsage *	_ownerUsage;		// 0 as long as there is no owner
 
 	// Some cached values
 
 	FileSize	_totalSize;
 	FileSize	_totalAllocatedSize;
 	FileSize	_totalBlocks;
+	time_t		_latestMtime;
+	time_t		_oldestFileMtime;
 	int		_totalItems;
 	int		_totalSubDirs;
 	int		_totalFiles;
 	int		_totalIgnoredItems;
 	int		_totalUnignoredItems;
 	int		_directChildrenCount;
+	int		_unlinkedChildren;	// number of gaps in _children
 	int		_errSubDirCount;
-	time_t		_latestMtime;
-	time_t		_oldestFileMtime;
-
-	FileInfoList *	_sortedChildren;
-	DataColumn	_lastSortCol;
-	Qt::SortOrder	_lastSortOrder;
-	bool		_lastIncludeAttic;
+	int		_estimatedDirCount;
+	int		_pendingReadJobs;	// number of open directories in this subtree
 
 	DirReadState	_readState;
 
+	bool		_isMountPoint:1;	// Flag: is this a mount point?
+	bool		_isExcluded:1;		// Flag: was this directory excluded?
+	bool		_summaryDirty:1;	// dirty flag for the cached values
+	bool		_mtimeDirty:1;		// only the cached mtimes are outdated
+	bool		_deletingAll:1;		// Deleting complete children tree?
+	bool		_locked:1;		// App lock
+	bool		_touched:1;		// App 'touch' flag
+	bool		_pendingSubtree:1;	// Children still in a cache file
+	bool		_estimated:1;		// Totals only estimated
+	bool		_addingChildren:1;	// Ancestors are updated later
+	bool		_atticPending:1;	// See isAtticPending()
+
+
+	/**
+	 * Return the key for 'name' in the child index: The name up to the
+	 * first path delimiter (toplevel items have a full path as name).
+	 **/
+	static QString childIndexKey( const QString & name )
+	    { return name.left( name.indexOf( '/' ) ); }
+
+	/**
+	 * Build the child index if there are enough children to make that
+	 * worthwhile. Return 'true' if there is an index.
+	 **/
+	bool ensureChildIndex();
+
+	/**
+	 * Drop the child index, e.g. because the children list was
+	 * changed in a way that is not easy to reflect in the index.
+	 **/
+	void dropChildIndex();
+
+	/**
+	 * Add the file sizes of 'histogram' to this directory's, creating it
+	 * if necessary.
+	 **/
+	void addToSizeHistogram( const SizeHistogram & histogram );
+	void addToSizeHistogram( FileSize size );
+
+	/**
+	 * Add the file mtimes of 'histogram' or one file to this
+	 * directory's, creating it if necessary.
+	 **/
+	void addToMTimeHistogram( const MTimeHistogram & histogram );
+	void addToMTimeHistogram( time_t mtime, FileSize size );
+
+	/**
+	 * Add the usage in 'usage' or of one item (not its subtree) to this
+	 * directory's usage by owner, creating it if necessary.
+	 **/
+	void addToOwnerUsage( const OwnerUsage & usage );
+	void addToOwnerUsage( const FileInfo * item );
+
 
     private:
 
@@ -0,0 +1,510 @@
+/*
+ *   File name: DirListModel.cpp
+ *   Summary:	Directory tree model for browsing and completion
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>	// AT_ constants (fstatat() flags)
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>	// strerror()
+
+#include <algorithm>	// std::sort(), std::lower_bound()
+
+#include <QApplication>
+#include <QMetaObject>
+#include <QRunnable>
+#include <QStyle>
+
+#include "DirListModel.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Task for the DirLister's thread pool that lists one directory.
+     **/
+    class DirListTask: public QRunnable
+    {
+    public:
+
+	DirListTask( qulonglong request, const QString & path ):
+	    _request( request ),
+	    _path( path )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE;
+
+    protected:
+
+	/**
+	 * Return 'true' if entry 'entry' of 'dir' is a directory.
+	 **/
+	bool isDir( DIR * dir, struct dirent * entry ) const;
+
+	qulonglong _request;
+	QString	   _path;
+    };
+
+
+    bool DirListTask::isDir( DIR * dir, struct dirent * entry ) const
+    {
+#ifdef _DIRENT_HAVE_D_TYPE
+	if ( entry->d_type != DT_UNKNOWN )
+	    return entry->d_type == DT_DIR;
+#endif
+
+	int flags = AT_SYMLINK_NOFOLLOW;
+
+#ifdef AT_NO_AUTOMOUNT
+	flags |= AT_NO_AUTOMOUNT;
+#endif
+
+	struct stat statInfo;
+
+	return fstatat( dirfd( dir ), entry->d_name, &statInfo, flags ) == 0 &&
+	    S_ISDIR( statInfo.st_mode );
+    }
+
+
+    void DirListTask::run()
+    {
+	QStringList names;
+	bool truncated = false;
+	int  error     = 0;
+
+	// Opening the directory itself triggers an automount if it is an
+	// automount point: That is what the user asked for by opening it.
+
+	DIR * dir = opendir( _path.toUtf8().constData() );
+
+	if ( ! dir )
+	{
+	    error = errno ? errno : EIO;
+	}
+	else
+	{
+	    struct dirent * entry;
+
+	    while ( ( entry = readdir( dir ) ) )
+	    {
+		// Skip hidden directories and "." and ".."
+
+		if ( entry->d_name[0] == '.' || ! isDir( dir, entry ) )
+		    continue;
+
+		if ( names.size() >= DIR_LIST_MAX_ENTRIES )
+		{
+		    truncated = true;
+		    break;
+		}
+
+		names << QString::fromUtf8( entry->d_name );
+	    }
+
+	    closedir( dir );
+	}
+
+	QMetaObject::invokeMethod( DirLister::instance(), "listingDone", Qt::QueuedConnection,
+				   Q_ARG( qulonglong,  _request  ),
+				   Q_ARG( QString,     _path	 ),
+				   Q_ARG( QStringList, names	 ),
+				   Q_ARG( bool,	       truncated ),
+				   Q_ARG( int,	       error	 ) );
+    }
+
+}	// namespace
+
+
+
+DirLister * DirLister::_instance = 0;
+
+
+DirLister * DirLister::instance()
+{
+    if ( ! _instance )
+    {
+	_instance = new DirLister();
+	CHECK_NEW( _instance );
+    }
+
+    return _instance;
+}
+
+
+DirLister::DirLister():
+    QObject(),
+    _nextRequest( 1 )
+{
+    _threadPool.setMaxThreadCount( DIR_LIST_THREADS );
+}
+
+
+qulonglong DirLister::list( const QString & path )
+{
+    qulonglong request = _nextRequest++;
+
+    DirListTask * task = new DirListTask( request, path );
+    CHECK_NEW( task );
+    _threadPool.start( task ); // The pool takes over ownership of the task
+
+    return request;
+}
+
+
+void DirLister::listingDone( qulonglong	 request,
+			     QString	 path,
+			     QStringList names,
+			     bool	 truncated,
+			     int	 error )
+{
+    emit listed( request, path, names, truncated, error );
+}
+
+
+
+
+DirListModel::DirListModel( QObject * parent ):
+    QAbstractItemModel( parent )
+{
+    _root = new Node( "", 0 );
+    CHECK_NEW( _root );
+
+    Node * slash = new Node( "/", _root );
+    CHECK_NEW( slash );
+    _root->children << slash;
+    _root->state = Node::Listed;
+
+    _dirIcon = QApplication::style()->standardIcon( QStyle::SP_DirIcon );
+
+    _timeoutTimer.setInterval( DIR_LIST_TIMEOUT_MILLISEC / 4 );
+
+    connect( &_timeoutTimer, SIGNAL( timeout()	     ),
+	     this,	     SLOT  ( checkTimeouts() ) );
+
+    connect( DirLister::instance(), SIGNAL( listed( qulonglong, QString, QStringList, bool, int ) ),
+	     this,		    SLOT  ( listed( qulonglong, QString, QStringList, bool, int ) ) );
+}
+
+
+DirListModel::~DirListModel()
+{
+    delete _root;
+}
+
+
+DirListModel::Node * DirListModel::node( const QModelIndex & index ) const
+{
+    return index.isValid() ? static_cast<Node *>( index.internalPointer() ) : _root;
+}
+
+
+QModelIndex DirListModel::indexOf( Node * node ) const
+{
+    if ( ! node || node == _root )
+	return QModelIndex();
+
+    return createIndex( node->parent->children.indexOf( node ), 0, node );
+}
+
+
+QString DirListModel::path( Node * node ) const
+{
+    if ( ! node || node == _root )
+	return QString();
+
+    if ( node->parent == _root )
+	return node->name;
+
+    QString parentPath = path( node->parent );
+
+    return ( parentPath == "/" ? "" : parentPath ) + "/" + node->name;
+}
+
+
+QString DirListModel::filePath( const QModelIndex & index ) const
+{
+    return path( node( index ) );
+}
+
+
+bool DirListModel::lessName( const QString & a, const QString & b )
+{
+    int result = a.compare( b, Qt::CaseInsensitive );
+
+    return result != 0 ? result < 0 : a < b;
+}
+
+
+QModelIndex DirListModel::index( const QString & pathArg )
+{
+    if ( ! pathArg.startsWith( "/" ) )
+	return QModelIndex();
+
+    Node * current = _root->children.first();
+    QStringList components = pathArg.split( "/", QString::SkipEmptyParts );
+
+    foreach ( const QString & name, components )
+    {
+	list( current );
+
+	QList<Node *>::iterator it =
+	    std::lower_bound( current->children.begin(), current->children.end(), name,
+			      []( Node * child, const QString & name )
+			      { return lessName( child->name, name ); } );
+
+	if ( it == current->children.end() || (*it)->name != name )
+	{
+	    // Not listed yet: Add it right away
+
+	    int row = it - current->children.begin();
+	    Node * child = new Node( name, current );
+	    CHECK_NEW( child );
+
+	    beginInsertRows( indexOf( current ), row, row );
+	    current->children.insert( row, child );
+	    endInsertRows();
+
+	    current = child;
+	}
+	else
+	{
+	    current = *it;
+	}
+    }
+
+    return indexOf( current );
+}
+
+
+void DirListModel::list( const QModelIndex & index )
+{
+    list( node( index ) );
+}
+
+
+void DirListModel::list( Node * node )
+{
+    if ( ! node || node->state != Node::NotListed )
+	return;
+
+    node->state = Node::Listing;
+    node->started.start();
+    _requests.insert( DirLister::instance()->list( path( node ) ), node );
+
+    if ( ! _timeoutTimer.isActive() )
+	_timeoutTimer.start();
+}
+
+
+void DirListModel::listed( qulonglong	       request,
+			   const QString &     pathArg,
+			   const QStringList & names,
+			   bool		       truncated,
+			   int		       error )
+{
+    Node * node = _requests.take( request );
+
+    if ( ! node )	// Another model's request
+	return;
+
+    if ( _requests.isEmpty() )
+	_timeoutTimer.stop();
+
+    if ( error != 0 )
+    {
+	logWarning() << "Can't list " << pathArg << ": " << strerror( error ) << endl;
+	node->state = Node::Failed;
+    }
+    else
+    {
+	if ( node->state == Node::TimedOut )
+	    logInfo() << "Listed " << pathArg << " after all" << endl;
+
+	node->state	= Node::Listed;
+	node->truncated = truncated;
+	merge( node, names );
+    }
+
+    QModelIndex index = indexOf( node );
+    emit dataChanged( index, index );
+}
+
+
+void DirListModel::merge( Node * node, QStringList names )
+{
+    std::sort( names.begin(), names.end(), lessName );
+
+    QModelIndex parentIndex = indexOf( node );
+    int row = 0;
+    int i   = 0;
+
+    // Insert the new names in runs between the children that are already
+    // there, e.g. the ones that index( path ) added.
+
+    while ( i < names.size() )
+    {
+	while ( row < node->children.size() && lessName( node->children.at( row )->name, names.at( i ) ) )
+	    ++row;
+
+	if ( row < node->children.size() && node->children.at( row )->name == names.at( i ) )
+	{
+	    ++i;
+	    continue;
+	}
+
+	int end = i;
+
+	while ( end < names.size() &&
+		( row >= node->children.size() || lessName( names.at( end ), node->children.at( row )->name ) ) )
+	{
+	    ++end;
+	}
+
+	beginInsertRows( parentIndex, row, row + end - i - 1 );
+
+	for ( int j = i; j < end; ++j )
+	{
+	    Node * child = new Node( names.at( j ), node );
+	    CHECK_NEW( child );
+	    node->children.insert( row++, child );
+	}
+
+	endInsertRows();
+	i = end;
+    }
+}
+
+
+void DirListModel::checkTimeouts()
+{
+    foreach ( Node * node, _requests )
+    {
+	if ( node->state == Node::Listing && node->started.elapsed() > DIR_LIST_TIMEOUT_MILLISEC )
+	{
+	    logWarning() << path( node ) << " is not responding" << endl;
+	    node->state = Node::TimedOut;
+
+	    QModelIndex index = indexOf( node );
+	    emit dataChanged( index, index );
+	}
+    }
+}
+
+
+QModelIndex DirListModel::index( int		   row,
+				 int		   column,
+				 const QModelIndex & parentIndex ) const
+{
+    Node * parentNode = node( parentIndex );
+
+    if ( column != 0 || row < 0 || row >= parentNode->children.size() )
+	return QModelIndex();
+
+    return createIndex( row, column, parentNode->children.at( row ) );
+}
+
+
+QModelIndex DirListModel::parent( const QModelIndex & index ) const
+{
+    if ( ! index.isValid() )
+	return QModelIndex();
+
+    return indexOf( node( index )->parent );
+}
+
+
+int DirListModel::rowCount( const QModelIndex & parentIndex ) const
+{
+    if ( parentIndex.column() > 0 )
+	return 0;
+
+    return node( parentIndex )->children.size();
+}
+
+
+int DirListModel::columnCount( const QModelIndex & parentIndex ) const
+{
+    Q_UNUSED( parentIndex );
+
+    return 1;
+}
+
+
+bool DirListModel::hasChildren( const QModelIndex & parentIndex ) const
+{
+    Node * parentNode = node( parentIndex );
+
+    // Without listing it, there is no telling; the view finds out when the
+    // directory is opened.
+
+    return parentNode->state == Node::NotListed || ! parentNode->children.isEmpty();
+}
+
+
+bool DirListModel::canFetchMore( const QModelIndex & parentIndex ) const
+{
+    return parentIndex.isValid() && node( parentIndex )->state == Node::NotListed;
+}
+
+
+void DirListModel::fetchMore( const QModelIndex & parentIndex )
+{
+    list( node( parentIndex ) );
+}
+
+
+QVariant DirListModel::data( const QModelIndex & index, int role ) const
+{
+    if ( ! index.isValid() )
+	return QVariant();
+
+    Node * item = node( index );
+
+    switch ( role )
+    {
+	case Qt::DisplayRole:
+	case Qt::EditRole:
+	    return item->name;
+
+	case Qt::DecorationRole:
+	    return _dirIcon;
+
+	case Qt::ToolTipRole:
+	    switch ( item->state )
+	    {
+		case Node::Listing:  return tr( "Reading..." );
+		case Node::TimedOut: return tr( "Not responding" );
+		case Node::Failed:   return tr( "Can't read this directory" );
+
+		case Node::Listed:
+		    if ( item->truncated )
+			return tr( "Only the first %1 subdirectories are shown" ).arg( DIR_LIST_MAX_ENTRIES );
+		    break;
+
+		case Node::NotListed:
+		    break;
+	    }
+	    break;
+
+	case Qt::ForegroundRole:
+	    if ( item->state == Node::TimedOut || item->state == Node::Failed )
+		return QApplication::palette().brush( QPalette::Disabled, QPalette::Text );
+	    break;
+
+	default:
+	    break;
+    }
+
+    return QVariant();
+}
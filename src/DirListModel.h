@@ -0,0 +1,271 @@
+/*
+ *   File name: DirListModel.h
+ *   Summary:	Directory tree model for browsing and completion
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef DirListModel_h
+#define DirListModel_h
+
+
+#include <QAbstractItemModel>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QIcon>
+#include <QList>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+
+// A directory that takes longer than this to list is shown as not
+// responding; its entries are still added if they arrive later
+#define DIR_LIST_TIMEOUT_MILLISEC	3000
+
+// At most that many subdirectories of one directory are listed
+#define DIR_LIST_MAX_ENTRIES		10000
+
+// Threads for listing; a thread that hangs on a dead server stays busy
+#define DIR_LIST_THREADS		4
+
+
+namespace QDirStat
+{
+    /**
+     * Listing directories in worker threads for DirListModel: The workers
+     * report to this singleton, not to the models, so a model can be
+     * deleted while a listing is still running, e.g. because the server of
+     * a network mount does not respond.
+     *
+     * A listing only uses the d_type of each entry from readdir(); only
+     * entries of filesystems that don't tell the type (DT_UNKNOWN) are
+     * stat()ed, without following symlinks and without triggering
+     * automounts (AT_NO_AUTOMOUNT). Symlinks and hidden directories are
+     * skipped.
+     **/
+    class DirLister: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Return the singleton instance of this class.
+	 **/
+	static DirLister * instance();
+
+	/**
+	 * Start listing the subdirectories of 'path' in a worker thread and
+	 * return the request number for the listed() signal.
+	 **/
+	qulonglong list( const QString & path );
+
+
+    signals:
+
+	/**
+	 * Emitted when the subdirectories of 'path' for 'request' are
+	 * listed. 'truncated' is 'true' if there were more than
+	 * DIR_LIST_MAX_ENTRIES. 'error' is the errno if the directory could
+	 * not be opened, 0 otherwise.
+	 **/
+	void listed( qulonglong		 request,
+		     const QString &	 path,
+		     const QStringList & names,
+		     bool		 truncated,
+		     int		 error );
+
+
+    public slots:
+
+	/**
+	 * Notification from a worker thread that a listing is done.
+	 **/
+	void listingDone( qulonglong  request,
+			  QString     path,
+			  QStringList names,
+			  bool	      truncated,
+			  int	      error );
+
+
+    protected:
+
+	/**
+	 * Constructor. Use instance() instead.
+	 **/
+	DirLister();
+
+	static DirLister * _instance;
+
+	qulonglong  _nextRequest;
+	QThreadPool _threadPool;
+
+    };	// class DirLister
+
+
+
+    /**
+     * Model of the directory tree of the local filesystems for browsing
+     * (OpenDirDialog) and for completing paths (ExistingDirCompleter) that
+     * never blocks the GUI: Unlike QFileSystemModel, it does not stat()
+     * every entry just to show its name, and it does not watch anything;
+     * each directory is listed once, when it is first needed, by the
+     * DirLister in a worker thread, and its subdirectories are inserted
+     * when the listing is done.
+     *
+     * A directory that does not respond within DIR_LIST_TIMEOUT_MILLISEC
+     * is marked as such; a huge one only gets its first
+     * DIR_LIST_MAX_ENTRIES subdirectories.
+     *
+     * The model has one column and one toplevel item, the root directory
+     * "/".
+     **/
+    class DirListModel: public QAbstractItemModel
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	DirListModel( QObject * parent = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~DirListModel();
+
+	/**
+	 * Return the index for 'path'. The directories on the way that are
+	 * not listed yet are added right away (without checking if they
+	 * exist), and listing them is started, so their siblings show up a
+	 * little later.
+	 **/
+	QModelIndex index( const QString & path );
+
+	/**
+	 * Return the path of 'index'.
+	 **/
+	QString filePath( const QModelIndex & index ) const;
+
+	/**
+	 * Start listing the directory of 'index' unless that was done
+	 * already.
+	 **/
+	void list( const QModelIndex & index );
+
+
+	//
+	// Reimplemented from QAbstractItemModel
+	//
+
+	virtual QModelIndex index( int		       row,
+				   int		       column,
+				   const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	virtual QModelIndex parent( const QModelIndex & index ) const Q_DECL_OVERRIDE;
+
+	virtual int rowCount   ( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+	virtual int columnCount( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	virtual bool hasChildren( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	virtual bool canFetchMore( const QModelIndex & parent ) const Q_DECL_OVERRIDE;
+	virtual void fetchMore	 ( const QModelIndex & parent ) Q_DECL_OVERRIDE;
+
+	virtual QVariant data( const QModelIndex & index, int role ) const Q_DECL_OVERRIDE;
+
+
+    protected slots:
+
+	/**
+	 * Notification from the DirLister that a directory is listed.
+	 **/
+	void listed( qulonglong		 request,
+		     const QString &	 path,
+		     const QStringList & names,
+		     bool		 truncated,
+		     int		 error );
+
+	/**
+	 * Mark the directories that take too long to list.
+	 **/
+	void checkTimeouts();
+
+
+    protected:
+
+	/**
+	 * One directory of the model.
+	 **/
+	struct Node
+	{
+	    enum State { NotListed, Listing, Listed, TimedOut, Failed };
+
+	    Node( const QString & name, Node * parent ):
+		name( name ),
+		parent( parent ),
+		state( NotListed ),
+		truncated( false )
+		{}
+
+	    ~Node() { qDeleteAll( children ); }
+
+	    QString	    name;
+	    Node *	    parent;
+	    QList<Node *>   children;	// sorted by name
+	    State	    state;
+	    bool	    truncated;
+	    QElapsedTimer   started;
+	};
+
+	/**
+	 * Return the node of 'index'; the invisible root for an invalid one.
+	 **/
+	Node * node( const QModelIndex & index ) const;
+
+	/**
+	 * Return the index of 'node'.
+	 **/
+	QModelIndex indexOf( Node * node ) const;
+
+	/**
+	 * Return the path of 'node'.
+	 **/
+	QString path( Node * node ) const;
+
+	/**
+	 * Start listing 'node' unless that was done already.
+	 **/
+	void list( Node * node );
+
+	/**
+	 * Add the children of 'node' with 'names' that it does not have yet.
+	 **/
+	void merge( Node * node, QStringList names );
+
+	/**
+	 * Return 'true' if 'a' comes before 'b' in a directory.
+	 **/
+	static bool lessName( const QString & a, const QString & b );
+
+
+	//
+	// Data members
+	//
+
+	Node *			    _root;	// invisible; its only child is "/"
+	QHash<qulonglong, Node *>   _requests;
+	QTimer			    _timeoutTimer;
+	QIcon			    _dirIcon;
+
+    };	// class DirListModel
+
+}	// namespace QDirStat
+
+
+#endif	// DirListModel_h
@@ -12,16 +12,30 @@
 #include <fcntl.h>	// AT_ constants (fstatat() flags)
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/sysmacros.h>	// major(), minor()
 
 #include <QMutableListIterator>
-#include <QMultiMap>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QUrl>
 
 #include "DirReadJob.h"
 #include "DirTree.h"
 #include "DirTreeCache.h"
+#include "Ext4Image.h"
+#include "AggregateInfo.h"
 #include "Attic.h"
+#include "BtrfsQgroups.h"
+#include "BtrfsSnapshots.h"
+#include "ContainerLayers.h"
 #include "ExcludeRules.h"
+#include "ImportReader.h"
 #include "MountPoints.h"
+#include "NtfsMft.h"
+#include "RemoteAgent.h"
+#include "SubtreeEstimator.h"
+#include "Tracer.h"
 #include "Exception.h"
 
 #define DONT_TRUST_NTFS_HARD_LINKS      1
@@ -111,8 +125,14 @@ bool DirReadJob::crossingFilesystems( DirInfo * parent, DirInfo * child )
     if ( parent->device() == child->device() )
 	return false;
 
+    // Different device numbers: The mount points are found by those, so
+    // no path needs to be built in the normal case.
+
     QString childDevice	 = device( child );
-    QString parentDevice = device( parent->findNearestMountPoint() );
+    QString parentDevice = device( parent );
+
+    if ( parentDevice.isEmpty() )
+	parentDevice = device( parent->findNearestMountPoint() );
 
     if ( childDevice.isEmpty() && parent->readState() == DirCached )
     {
@@ -157,24 +177,62 @@ QString DirReadJob::device( const DirInfo * dir ) const
 
     if ( dir )
     {
-	MountPoint * mountPoint = MountPoints::findByPath( dir->url() );
+	MountPoint * mp = mountPoint( dir );
 
-	if ( mountPoint )
-	    device = mountPoint->device();
+	if ( mp )
+	    device = mp->device();
     }
 
     return device;
 }
 
 
+MountPoint * DirReadJob::mountPoint( const DirInfo * dir ) const
+{
+    MountPoint * mountPoint = MountPoints::findByDevice( dir->device() );
+
+    if ( ! mountPoint )
+	mountPoint = MountPoints::findByPath( dir->url() );
+
+    return mountPoint;
+}
+
+
+bool DirReadJob::isOnBtrfs( const DirInfo * parent, const DirInfo * dir ) const
+{
+    MountPoint * mountPoint = this->mountPoint( dir );
+
+    if ( ! mountPoint ) // Not in the mount table: A subvolume of 'parent'
+	mountPoint = this->mountPoint( parent );
+
+    return mountPoint && mountPoint->isBtrfs();
+}
+
+
+bool DirReadJob::isBtrfsSubvolume( const DirInfo * parent, const DirInfo * dir ) const
+{
+    return ! mountPoint( dir ) && isOnBtrfs( parent, dir );
+}
+
+
 bool DirReadJob::shouldCrossIntoFilesystem( const DirInfo * dir ) const
 {
-    MountPoint * mountPoint = MountPoints::findByPath( dir->url() );
+    MountPoint * mountPoint = this->mountPoint( dir );
+
+    if ( ! mountPoint )
+    {
+	// Not in the mount table, e.g. a Btrfs subvolume: Still the same
+	// filesystem
+
+	logDebug() << "Reading " << dir << " without a mount point" << endl;
+	return true;
+    }
 
     bool doCross =
 	! mountPoint->isSystemMount()  &&	//  /dev, /proc, /sys, ...
 	! mountPoint->isDuplicate()    &&	//  bind mount or multiple mounted
-	! mountPoint->isNetworkMount();		//  NFS or CIFS (Samba)
+	! mountPoint->isNetworkMount() &&	//  NFS or CIFS (Samba)
+	! mountPoint->isOverlay();		//  Container: layers are read where they are stored
 
     logDebug() << ( doCross ? "Reading" : "Not reading" )
 	       << " mounted filesystem " << mountPoint->path() << endl;
@@ -192,156 +250,165 @@ bool LocalDirReadJob::_warnedAboutNtfsHardLinks = false;
 LocalDirReadJob::LocalDirReadJob( DirTree * tree,
 				  DirInfo * dir ):
     DirReadJob( tree, dir ),
+    _aggregate( 0 ),
+    _inode( 0 ),
+    _prefetchStarted( false ),
     _applyFileChildExcludeRules( false ),
     _checkedForNtfs( false ),
-    _isNtfs( false )
+    _isNtfs( false ),
+    _sameAsSnapshot( false ),
+    _haveFilterDirNos( false )
 {
     if ( _dir )
 	_dirName = _dir->url();
+
+    if ( _tree )
+	_baseline = _tree->cacheBaseline();
 }
 
 
 LocalDirReadJob::~LocalDirReadJob()
 {
-    // NOP
+    // If a worker thread is still reading for this job, tell it to stop.
+    // The task shares ownership of the reader, so the reader will stay
+    // valid until the worker is done with it.
+
+    if ( _reader )
+	_reader->abort();
+
+    delete _aggregate;
+}
+
+
+void LocalDirReadJob::read()
+{
+    _started = true;
+    startReading();
+
+    // Don't do anything after startReading() - startReading() might call
+    // finished() which in turn makes the queue destroy this object
 }
 
 
 void LocalDirReadJob::startReading()
 {
-    struct dirent * entry;
-    struct stat	    statInfo;
-    QString	    defaultCacheName = DEFAULT_CACHE_NAME;
-    DIR *	    diskDir;
+    TRACE_SCOPE_ARG( "scan", "LocalDirReadJob::startReading", _dirName );
 
     // logDebug() << _dir << endl;
 
-    bool ok = true;
+    if ( ! _reader )
+    {
+	// Not prefetched by a worker thread: Do the system calls right here.
+
+	_reader = LocalDirReaderPtr( new LocalDirReader( _dirName.toUtf8() ) );
+	CHECK_NEW( _reader.data() );
+	_reader->setCountOnly( _tree->countOnly() );
+    }
+
+    _reader->read(); // Returns immediately if this was already done
+
+    // The layers of Docker or Podman: Find out which images they belong to
 
-    if ( access( _dirName.toUtf8(), X_OK | R_OK ) != 0 )
+    if ( ContainerLayers::isStorageName( _dirName ) )
+	ContainerLayers::updateCache( _dirName );
+
+    if ( _queue )
     {
-	ok = false;
-	logWarning() << "No permission to read directory " << _dirName << endl;
-	finishReading( _dir, DirPermissionDenied );
+	_queue->scanStats().addDirectory( _dir->device(),
+					  _dirName,
+					  _reader->entries().size(),
+					  _reader->readdirNanosec(),
+					  _reader->statLatency() );
     }
 
-    if ( ok )
+    ReadScheduler::instance()->addStats( _dir->device(),
+					 _reader->entries().size(),
+					 _reader->statLatency() );
+
+    bool ok = true;
+
+    switch ( _reader->result() )
     {
-	diskDir = ::opendir( _dirName.toUtf8() );
+	case LocalDirReader::PermissionDenied:
+	    ok = false;
+	    logWarning() << "No permission to read directory " << _dirName << endl;
+	    finishReading( _dir, DirPermissionDenied );
+	    break;
 
-	if ( ! diskDir )
-	{
-	    logWarning() << "opendir(" << _dirName << ") failed" << endl;
+	case LocalDirReader::OpenDirError:
 	    ok = false;
+	    logWarning() << "opendir(" << _dirName << ") failed" << endl;
 	    // opendir() doesn't set 'errno' according to POSIX	 :-(
 	    finishReading( _dir, DirError );
-	}
+	    break;
+
+	case LocalDirReader::Aborted:
+	case LocalDirReader::NotRead:
+	    ok = false;
+	    logError() << "Reading " << _dirName << " was aborted" << endl;
+	    finishReading( _dir, DirAborted );
+	    break;
+
+	case LocalDirReader::Ok:
+	    break;
     }
 
     if ( ok )
     {
 	_dir->setReadState( DirReading );
-	int dirFd = dirfd( diskDir );
-	int flags = AT_SYMLINK_NOFOLLOW;
-
-#ifdef AT_NO_AUTOMOUNT
-	flags |= AT_NO_AUTOMOUNT;
-#endif
 
-	QMultiMap<ino_t, QString> entryMap;
+	bool hasSubDirs = ! _reader->atEnd();	// Later chunks might have some
 
-	while ( ( entry = readdir( diskDir ) ) )
+	for ( int i = 0; i < _reader->entries().size() && ! hasSubDirs; ++i )
 	{
-	    QString entryName = QString::fromUtf8( entry->d_name );
+	    const LocalDirEntry & entry = _reader->entries().at( i );
 
-	    if ( entryName != "."  &&
-		 entryName != ".."   )
-	    {
-		entryMap.insert( entry->d_ino, entryName );
-	    }
+	    // An entry that can't be lstat()ed becomes a DirInfo, too
+	    hasSubDirs = entry.statErrno != 0 || S_ISDIR( entry.statInfo.st_mode );
 	}
 
-	// QMultiMap (just like QMap) guarantees sort order by keys, so we are
-	// now iterating over the directory entries by i-number order. Most
-	// filesystems will benefit from that since they store i-nodes sorted
-	// by i-number on disk, so (at least with rotational disks) seek times
-	// are minimized by this strategy.
-	//
-	// Notice that we need a QMultiMap, not just a map: If a file has
-	// multiple hard links in the same directory, a QMap would store only
-	// one of them, all others would go missing in the DirTree.
-
-	foreach ( QString entryName, entryMap )
-	{
-	    if ( fstatat( dirFd, entryName.toUtf8(), &statInfo, flags ) == 0 )	// OK?
-	    {
-		if ( S_ISDIR( statInfo.st_mode ) )	// directory child?
-		{
-		    DirInfo *subDir = new DirInfo( entryName, &statInfo, _tree, _dir );
-		    CHECK_NEW( subDir );
-
-		    processSubDir( entryName, subDir );
+	dropUnneededDotEntry( hasSubDirs );
 
-		}
-		else  // non-directory child
-		{
-		    if ( entryName == defaultCacheName )	// .qdirstat.cache.gz found?
-		    {
-			logDebug() << "Found cache file " << defaultCacheName << endl;
-
-			// Try to read the cache file. If that was successful and the toplevel
-			// path in that cache file matches the path of the directory we are
-			// reading right now, the directory is finished reading, the read job
-			// (this object) was just deleted, and we may no longer access any
-			// member variables; just return.
-
-			if ( readCacheFile( entryName ) )
-			    return;
-		    }
-
-#if DONT_TRUST_NTFS_HARD_LINKS
+	// The checks that are needed for this directory are decided only once
+	// here, not again for each entry (see readEntries()).
 
-                    if ( statInfo.st_nlink > 1 && isNtfs() )
-                    {
-                        // NTFS seems to return bogus hard link counts; use 1 instead.
-                        // See  https://github.com/shundhammer/qdirstat/issues/88
+	typedef bool ( LocalDirReadJob::*ReadEntriesFunc )();
 
-#if ! VERBOSE_NTFS_HARD_LINKS
-                        if ( ! _warnedAboutNtfsHardLinks )
-#endif
-                        {
-                            logWarning() << "Not trusting NTFS with hard links: \""
-                                         << _dir->url() << "/" << entryName
-                                         << "\" links: " << statInfo.st_nlink
-                                         << " -> resetting to 1"
-                                         << endl;
-                            _warnedAboutNtfsHardLinks = true;
-                        }
-
-                        statInfo.st_nlink = 1;
-                    }
-#endif
-		    FileInfo * child = new FileInfo( entryName, &statInfo, _tree, _dir );
-		    CHECK_NEW( child );
-
-		    if ( checkIgnoreFilters( entryName ) )
-		    {
-			// logDebug() << "Ignoring " << child << endl;
-			_dir->addToAttic( child );
-		    }
-		    else
-			_dir->insertChild( child );
+	static const ReadEntriesFunc readEntriesFuncs[] =
+	{
+	    &LocalDirReadJob::readEntries< 0>,
+	    &LocalDirReadJob::readEntries< 1>,
+	    &LocalDirReadJob::readEntries< 2>,
+	    &LocalDirReadJob::readEntries< 3>,
+	    &LocalDirReadJob::readEntries< 4>,
+	    &LocalDirReadJob::readEntries< 5>,
+	    &LocalDirReadJob::readEntries< 6>,
+	    &LocalDirReadJob::readEntries< 7>,
+	    &LocalDirReadJob::readEntries< 8>,
+	    &LocalDirReadJob::readEntries< 9>,
+	    &LocalDirReadJob::readEntries<10>,
+	    &LocalDirReadJob::readEntries<11>,
+	    &LocalDirReadJob::readEntries<12>,
+	    &LocalDirReadJob::readEntries<13>,
+	    &LocalDirReadJob::readEntries<14>,
+	    &LocalDirReadJob::readEntries<15>
+	};
+
+	if ( ! ( this->*readEntriesFuncs[ scanFeatures() ] )() )
+	    return;	// This job was deleted while reading a cache file
+
+	if ( _reader->nextChunk() )
+	{
+	    // A huge directory that is read in chunks: Leave this job in the
+	    // queue; the queue will call read() again for the next chunk.
+	    // Meanwhile, the tree view can show what was read so far.
 
-		    childAdded( child );
-		}
-	    }
-	    else  // lstat() error
-	    {
-		handleLstatError( entryName );
-	    }
+	    _prefetchStarted = false;
+	    return;
 	}
 
-	closedir( diskDir );
+	_reader->clearEntries();
+	addAggregate();
 	DirReadState readState = DirFinished;
 
 	//
@@ -377,6 +444,165 @@ void LocalDirReadJob::startReading()
 }
 
 
+template<int Features>
+bool LocalDirReadJob::readEntries()
+{
+    // Only this directory keeps its totals up to date while its children
+    // are created; its ancestors get them all at once afterwards
+
+    _dir->beginAddingChildren();
+
+    foreach ( const LocalDirEntry & entry, _reader->entries() )
+    {
+	QString entryName = _reader->name( entry );
+
+	if ( entry.statErrno == 0 )	// lstat() OK?
+	{
+	    struct stat statInfo = entry.statInfo;
+
+	    if ( S_ISDIR( statInfo.st_mode ) )	// directory child?
+	    {
+		DirInfo *subDir = new DirInfo( entryName, &statInfo, _tree, _dir );
+		CHECK_NEW( subDir );
+
+		processSubDir( entryName, subDir, statInfo.st_ino,
+			       Features & ScanExcludeRules );
+
+	    }
+	    else  // non-directory child
+	    {
+		if ( ( Features & ScanCacheFiles ) &&	// It would bring sizes
+		     ( entryName == QLatin1String( DEFAULT_CACHE_NAME ) ||	// .qdirstat.cache.gz found?
+		       entryName == QLatin1String( DEFAULT_ZSTD_CACHE_NAME ) ||
+		       entryName == QLatin1String( DEFAULT_BINARY_CACHE_NAME ) ) )
+		{
+		    logDebug() << "Found cache file " << entryName << endl;
+
+		    // Try to read the cache file. If that was successful and the toplevel
+		    // path in that cache file matches the path of the directory we are
+		    // reading right now, the directory is finished reading, the read job
+		    // (this object) was just deleted, and we may no longer access any
+		    // member variables; just return.
+
+		    _dir->endAddingChildren();
+
+		    if ( readCacheFile( entryName ) )
+			return false;
+
+		    _dir->beginAddingChildren();
+		}
+
+#if DONT_TRUST_NTFS_HARD_LINKS
+
+		if ( ( Features & ScanNtfs ) && statInfo.st_nlink > 1 )
+		{
+		    // NTFS seems to return bogus hard link counts; use 1 instead.
+		    // See  https://github.com/shundhammer/qdirstat/issues/88
+
+#if ! VERBOSE_NTFS_HARD_LINKS
+		    if ( ! _warnedAboutNtfsHardLinks )
+#endif
+		    {
+			logWarning() << "Not trusting NTFS with hard links: \""
+				     << _dir->url() << "/" << entryName
+				     << "\" links: " << statInfo.st_nlink
+				     << " -> resetting to 1"
+				     << endl;
+			_warnedAboutNtfsHardLinks = true;
+		    }
+
+		    statInfo.st_nlink = 1;
+		}
+#endif
+		if ( aggregateFile( entryName, statInfo, Features & ScanFilters ) )
+		    continue;
+
+		FileInfo * child = new FileInfo( entryName, &statInfo, _tree, _dir );
+		CHECK_NEW( child );
+
+		if ( entry.symLinkResolved )
+		    child->setBrokenSymLink( entry.symLinkBroken );
+
+		addFileChild( child, entryName, Features & ScanFilters );
+	    }
+	}
+	else  // lstat() error
+	{
+	    errno = entry.statErrno;
+	    handleLstatError( entryName );
+	}
+    }
+
+    _dir->endAddingChildren();
+
+    return true;
+}
+
+
+int LocalDirReadJob::scanFeatures()
+{
+    int features = 0;
+
+    if ( _tree->hasFilters() )
+	features |= ScanFilters;
+
+    if ( ! ExcludeRules::instance()->isEmpty() ||
+	 ( _tree->excludeRules() && ! _tree->excludeRules()->isEmpty() ) )
+    {
+	features |= ScanExcludeRules;
+    }
+
+#if DONT_TRUST_NTFS_HARD_LINKS
+    if ( isNtfs() )
+	features |= ScanNtfs;
+#endif
+
+    if ( ! _tree->countOnly() )
+	features |= ScanCacheFiles;
+
+    return features;
+}
+
+
+bool LocalDirReadJob::isReady() const
+{
+    return _reader && _reader->isDone();
+}
+
+
+bool LocalDirReadJob::startPrefetch( QThreadPool * pool )
+{
+    if ( _prefetchStarted || ! pool || ! _queue )
+	return false;
+
+    if ( ! _reader )
+    {
+	_reader = LocalDirReaderPtr( new LocalDirReader( _dirName.toUtf8() ) );
+	CHECK_NEW( _reader.data() );
+	_reader->setCountOnly( _tree->countOnly() );
+    }
+    else if ( _reader->isDone() )
+    {
+	return false;
+    }
+
+    _prefetchStarted = true;
+
+    // The task reports to the ReadScheduler: Unlike the queue, that is
+    // still there when the task is done.
+
+    ReadScheduler * scheduler = ReadScheduler::instance();
+    LocalDirReaderTask * task = new LocalDirReaderTask( _reader,
+							scheduler, "prefetchFinished",
+							_dir->device(), _queue->schedulerClient(),
+							scheduler->deviceNumaNode( _dir->device() ) );
+    CHECK_NEW( task );
+    pool->start( task ); // The pool takes over ownership of the task
+
+    return true;
+}
+
+
 void LocalDirReadJob::finishReading( DirInfo * dir, DirReadState readState )
 {
     // logDebug() << dir << endl;
@@ -388,38 +614,61 @@ void LocalDirReadJob::finishReading( DirInfo * dir, DirReadState readState )
 }
 
 
-void LocalDirReadJob::processSubDir( const QString & entryName, DirInfo * subDir )
+void LocalDirReadJob::processSubDir( const QString & entryName,
+				     DirInfo *	     subDir,
+				     ino_t	     inode,
+				     bool	     checkExcludeRules )
 {
     _dir->insertChild( subDir );
     childAdded( subDir );
 
-    if ( matchesExcludeRule( entryName ) )
+    if ( checkExcludeRules && matchesExcludeRule( entryName ) )
     {
 	subDir->setExcluded();
 	finishReading( subDir, DirOnRequestOnly );
+
+	if ( _queue )
+	    addExcludedToScanStats( subDir, fullName( entryName ) );
     }
     else // No exclude rule matched
     {
 	if ( ! crossingFilesystems(_dir, subDir ) ) // normal case
 	{
-	    LocalDirReadJob * job = new LocalDirReadJob( _tree, subDir );
-	    CHECK_NEW( job );
+	    LocalDirReadJob * job = newSubDirJob( subDir, inode );
 	    job->setApplyFileChildExcludeRules( true );
+	    job->setInode( inode );
 	    _tree->addJob( job );
 	}
 	else	    // The subdirectory we just found is a mount point.
 	{
 	    subDir->setMountPoint();
 
-	    if ( _tree->crossFilesystems() && shouldCrossIntoFilesystem( subDir ) )
+	    if ( _tree->btrfsSnapshotDeltas() && isBtrfsSubvolume( _dir, subDir ) )
+	    {
+		// Part of the same filesystem, maybe a snapshot of a subvolume
+		// that is already read
+
+		if ( ! _tree->readSubvolume( subDir ) )
+		    finishReading( subDir, DirOnRequestOnly ); // Until that is done
+	    }
+	    else if ( _tree->crossFilesystems() && shouldCrossIntoFilesystem( subDir ) )
 	    {
-		LocalDirReadJob * job = new LocalDirReadJob( _tree, subDir );
-		CHECK_NEW( job );
+		LocalDirReadJob * job = newSubDirJob( subDir );
 		job->setApplyFileChildExcludeRules( true );
 		_tree->addJob( job );
 	    }
 	    else
 	    {
+		// Btrfs might know the size of the subvolume anyway, and ZFS
+		// does for every dataset
+
+		MountPoint * mountPoint = this->mountPoint( subDir );
+
+		if ( isOnBtrfs( _dir, subDir ) )
+		    BtrfsQgroups::updateCache( subDir->url() );
+		else if ( mountPoint && mountPoint->isZfs() )
+		    _tree->addUnreadDataset( subDir );
+
 		finishReading( subDir, DirOnRequestOnly );
 	    }
 	}
@@ -427,6 +676,131 @@ void LocalDirReadJob::processSubDir( const QString & entryName, DirInfo * subDir
 }
 
 
+LocalDirReadJob * LocalDirReadJob::newSubDirJob( DirInfo * subDir, ino_t inode )
+{
+    LocalDirReadJob * job = 0;
+    quint64 dirNo = 0;
+    quint32 snapshotDirNo = 0;
+    SnapshotBaselinePtr snapshot = _snapshot;
+
+    // Below a directory that changed since the other snapshot, a
+    // subdirectory might be a different one with the same name. A mounted
+    // filesystem is not part of the snapshot at all.
+
+    if ( snapshot && ( subDir->isMountPoint() ||
+		       ( ! _sameAsSnapshot && ! snapshot->isSameDir( subDir->url(), inode ) ) ) )
+    {
+	snapshot.clear();
+    }
+
+    if ( snapshot && snapshot->findUnchangedDir( subDir->url(), snapshotDirNo ) )
+	job = new SnapshotDirReadJob( _tree, subDir, snapshot, snapshotDirNo );
+    else if ( _baseline && _baseline->findUnchangedDir( subDir->url(), subDir->mtime(), dirNo ) )
+	job = new BaselineDirReadJob( _tree, subDir, _baseline, dirNo );
+    else if ( _tree->shouldEstimate( subDir ) )
+	job = new EstimateDirReadJob( _tree, subDir );
+    else
+	job = new LocalDirReadJob( _tree, subDir );
+
+    CHECK_NEW( job );
+    job->setBaseline( _baseline );
+    job->setSnapshot( snapshot );
+
+    return job;
+}
+
+
+void LocalDirReadJob::dropUnneededDotEntry( bool hasSubDirs )
+{
+    // This is only done before anything was added. The views don't show any
+    // children of a directory while it is being read, so nobody else knows
+    // the dot entry yet.
+
+    if ( ! hasSubDirs && _dir->dotEntry() && ! _dir->firstChild() && ! _dir->hasAtticChildren() )
+	_dir->deleteEmptyDotEntry();
+}
+
+
+void LocalDirReadJob::addFileChild( FileInfo *	    child,
+				    const QString & entryName,
+				    bool	    checkFilters )
+{
+    if ( checkFilters && checkIgnoreFilters( entryName ) )
+    {
+	// logDebug() << "Ignoring " << child << endl;
+	_dir->addToAttic( child );
+    }
+    else
+	_dir->insertChild( child );
+
+    childAdded( child );
+}
+
+
+bool LocalDirReadJob::aggregateFile( const QString &     entryName,
+				     const struct stat & statInfo,
+				     bool		 checkFilters )
+{
+    if ( _tree->countOnly() )
+    {
+	// Only their number is known anyway
+
+	if ( checkFilters && checkIgnoreFilters( entryName ) )
+	    return false;
+
+	if ( ! _aggregate )
+	{
+	    _aggregate = new AggregateStats();
+	    CHECK_NEW( _aggregate );
+	}
+
+	_aggregate->addCount( statInfo );
+
+	return true;
+    }
+
+    FileSize threshold = _tree->aggregateFilesBelow();
+
+    // Hard links and ignored files need nodes of their own: The links are
+    // only counted once, and ignored files go to the attic.
+
+    if ( threshold <= 0			||
+	 ! S_ISREG( statInfo.st_mode )	||
+	 statInfo.st_nlink > 1		||
+	 statInfo.st_size >= threshold	||
+	 ( checkFilters && checkIgnoreFilters( entryName ) ) )
+    {
+	return false;
+    }
+
+    if ( ! _aggregate )
+    {
+	_aggregate = new AggregateStats();
+	CHECK_NEW( _aggregate );
+    }
+
+    _aggregate->add( statInfo );
+
+    return true;
+}
+
+
+void LocalDirReadJob::addAggregate()
+{
+    if ( ! _aggregate )
+	return;
+
+    AggregateInfo * aggregate = new AggregateInfo( _tree, _dir, *_aggregate );
+    CHECK_NEW( aggregate );
+
+    _dir->insertChild( aggregate );
+    childAdded( aggregate );
+
+    delete _aggregate;
+    _aggregate = 0;
+}
+
+
 bool LocalDirReadJob::matchesExcludeRule( const QString & entryName ) const
 {
     QString full = fullName( entryName );
@@ -446,7 +820,15 @@ bool LocalDirReadJob::checkIgnoreFilters( const QString & entryName ) const
     if ( ! _tree->hasFilters() )
 	return false;
 
-    return _tree->checkIgnoreFilters( fullName( entryName ) );
+    // Look up this directory in the filters only once, not for each entry
+
+    if ( ! _haveFilterDirNos )
+    {
+	_filterDirNos	  = _tree->lookupFilterDirs( _dirName );
+	_haveFilterDirNos = true;
+    }
+
+    return _tree->checkIgnoreFilters( _dirName, _filterDirNos, entryName );
 }
 
 
@@ -512,6 +894,32 @@ bool LocalDirReadJob::readCacheFile( const QString & cacheFileName )
 }
 
 
+void LocalDirReadJob::addExcludedToScanStats( DirInfo * subDir, const QString & path )
+{
+    ScanStats & stats = _queue->scanStats();
+    qint64 estimatedEntries = -1;
+
+    if ( stats.needsExcludedEstimate( subDir->device() ) )
+    {
+	// The excluded entries are part of the used i-nodes of the
+	// filesystem, but they will never be read.
+
+	struct stat statInfo;
+	SubtreeEstimator estimator( path, subDir->device() );
+
+	if ( lstat( path.toUtf8(), &statInfo ) == 0 )
+	{
+	    BinaryCacheSubtree estimate = estimator.estimate( statInfo );
+
+	    if ( estimator.ok() )
+		estimatedEntries = estimate.totalItems;
+	}
+    }
+
+    stats.addExcludedDir( subDir->device(), estimatedEntries );
+}
+
+
 void LocalDirReadJob::excludeDirLate()
 {
     logDebug() << "Excluding dir " << _dir << endl;
@@ -621,7 +1029,11 @@ bool LocalDirReadJob::isNtfs()
 
         if ( ! _dirName.isEmpty() )
         {
-            MountPoint * mountPoint = MountPoints::findNearestMountPoint( _dirName );
+            MountPoint * mountPoint = MountPoints::findByDevice( _dir->device() );
+
+            if ( ! mountPoint )
+                mountPoint = MountPoints::findNearestMountPoint( _dirName );
+
             _isNtfs = mountPoint && mountPoint->isNtfs();
         }
     }
@@ -634,84 +1046,998 @@ bool LocalDirReadJob::isNtfs()
 
 
 
-CacheReadJob::CacheReadJob( DirTree	* tree,
-			    DirInfo	* parent,
-			    CacheReader * reader )
-    : ObjDirReadJob( tree, parent )
-    , _reader( reader )
+BaselineDirReadJob::BaselineDirReadJob( DirTree *	  tree,
+					DirInfo *	  dir,
+					CacheBaselinePtr  baseline,
+					quint64		  dirNo ):
+    LocalDirReadJob( tree, dir ),
+    _dirNo( dirNo )
 {
-    if ( _reader )
-	_reader->rewind();
-
-    init();
+    setBaseline( baseline );
 }
 
 
-CacheReadJob::CacheReadJob( DirTree	  * tree,
-			    DirInfo	  * parent,
-			    const QString & cacheFileName )
-    : ObjDirReadJob( tree, parent )
+void BaselineDirReadJob::startReading()
 {
-    _reader = new CacheReader( cacheFileName, tree, parent );
+    // logDebug() << "Unchanged since baseline: " << _dir << endl;
+
+    _dir->setReadState( DirReading );
+
+    QVector<BinaryCacheNode> children = _baseline->children( _dirNo );
+    bool hasSubDirs = false;
+
+    for ( int i = 0; i < children.size() && ! hasSubDirs; ++i )
+	hasSubDirs = S_ISDIR( children.at( i ).mode );
+
+    dropUnneededDotEntry( hasSubDirs );
+
+    foreach ( const BinaryCacheNode & node, children )
+    {
+	QString entryName = _baseline->name( node );
+
+	if ( ! S_ISDIR( node.mode ) )
+	{
+	    FileInfo * child = new FileInfo( _tree, _dir, entryName,
+					     node.mode, node.size, node.mtime,
+					     node.blocks, node.links );
+	    CHECK_NEW( child );
+	    addFileChild( child, entryName );
+
+	    continue;
+	}
+
+	// A subdirectory might have changed even though this directory did
+	// not: Check its mtime, too.
+
+	struct stat statInfo;
+
+	if ( lstat( fullName( entryName ).toUtf8(), &statInfo ) != 0 )
+	{
+	    handleLstatError( entryName );
+	}
+	else if ( S_ISDIR( statInfo.st_mode ) )
+	{
+	    DirInfo * subDir = new DirInfo( entryName, &statInfo, _tree, _dir );
+	    CHECK_NEW( subDir );
+
+	    processSubDir( entryName, subDir, statInfo.st_ino );
+	}
+	else
+	{
+	    FileInfo * child = new FileInfo( entryName, &statInfo, _tree, _dir );
+	    CHECK_NEW( child );
+	    addFileChild( child, entryName );
+	}
+    }
+
+    DirReadState readState = DirFinished;
+
+    if ( _applyFileChildExcludeRules &&
+	 ExcludeRules::instance()->matchDirectChildren( _dir ) )
+    {
+	excludeDirLate();
+	readState = DirOnRequestOnly;
+    }
+
+    finishReading( _dir, readState );
+    finished();
+    // Don't add anything after finished() since this deletes this job!
+}
+
+
+
+
+
+
+SnapshotDirReadJob::SnapshotDirReadJob( DirTree *	    tree,
+					DirInfo *	    dir,
+					SnapshotBaselinePtr snapshot,
+					quint32		    dirNo ):
+    LocalDirReadJob( tree, dir ),
+    _dirNo( dirNo )
+{
+    setSnapshot( snapshot );
+    _sameAsSnapshot = true;
+}
+
+
+void SnapshotDirReadJob::startReading()
+{
+    // logDebug() << "Unchanged since " << _snapshot->basePath() << ": " << _dir << endl;
+
+    _dir->setReadState( DirReading );
+
+    const QVector<SnapshotNode> & children = _snapshot->children( _dirNo );
+    bool hasSubDirs = false;
+
+    for ( int i = 0; i < children.size() && ! hasSubDirs; ++i )
+	hasSubDirs = S_ISDIR( children.at( i ).mode );
+
+    dropUnneededDotEntry( hasSubDirs );
+
+    foreach ( const SnapshotNode & node, children )
+    {
+	QString entryName = _snapshot->name( node );
+	struct stat statInfo;
+
+	// A subdirectory might have changed somewhere below even though this
+	// directory did not. Hard links need their i-number for the hard
+	// link index.
+
+	bool unchanged = S_ISDIR( node.mode ) ?
+	    _snapshot->isUnchangedSubtree( fullName( entryName ) ) :
+	    node.links <= 1;
+
+	if ( unchanged )
+	{
+	    SnapshotBaseline::toStat( node, _dir->device(), statInfo );
+	}
+	else if ( lstat( fullName( entryName ).toUtf8(), &statInfo ) != 0 )
+	{
+	    handleLstatError( entryName );
+	    continue;
+	}
+
+	if ( S_ISDIR( statInfo.st_mode ) )
+	{
+	    DirInfo * subDir = new DirInfo( entryName, &statInfo, _tree, _dir );
+	    CHECK_NEW( subDir );
+
+	    processSubDir( entryName, subDir, statInfo.st_ino );
+	}
+	else
+	{
+	    FileInfo * child = new FileInfo( entryName, &statInfo, _tree, _dir );
+	    CHECK_NEW( child );
+	    addFileChild( child, entryName );
+	}
+    }
+
+    DirReadState readState = DirFinished;
+
+    if ( _applyFileChildExcludeRules &&
+	 ExcludeRules::instance()->matchDirectChildren( _dir ) )
+    {
+	excludeDirLate();
+	readState = DirOnRequestOnly;
+    }
+
+    finishReading( _dir, readState );
+    finished();
+    // Don't add anything after finished() since this deletes this job!
+}
+
+
+EstimateDirReadJob::EstimateDirReadJob( DirTree * tree, DirInfo * dir ):
+    LocalDirReadJob( tree, dir ),
+    _readNormally( false )
+{
+}
+
+
+void EstimateDirReadJob::startReading()
+{
+    if ( ! _readNormally )
+    {
+	struct stat statInfo;
+	SubtreeEstimator estimator( _dirName, _dir->device() );
+	BinaryCacheSubtree estimate;
+	bool useEstimate = false;
+
+	if ( lstat( _dirName.toUtf8(), &statInfo ) == 0 )
+	{
+	    estimate	= estimator.estimate( statInfo );
+	    useEstimate = estimator.ok() && ! estimator.isExact();
+	}
+
+	if ( useEstimate )
+	{
+	    // logDebug() << "Estimated " << _dir << " from " << estimator.dirsRead() << " dirs" << endl;
+
+	    _tree->addEstimatedSubtree( _dir, estimate );
+	    finishReading( _dir, DirFinished );
+	    finished();
+	    // Don't add anything after finished() since this deletes this job!
+
+	    return;
+	}
+
+	// Small enough to read it completely, or reading it failed: Let the
+	// normal read report the error.
+
+	_readNormally = true;
+    }
+
+    LocalDirReadJob::startReading();
+}
+
+
+CacheReadJob::CacheReadJob( DirTree	* tree,
+			    DirInfo	* parent,
+			    CacheReader * reader )
+    : ObjDirReadJob( tree, parent )
+    , _reader( reader )
+{
+    if ( _reader )
+	_reader->rewind();
+
+    init();
+}
+
+
+CacheReadJob::CacheReadJob( DirTree	      * tree,
+			    DirInfo	      * parent,
+			    const QString     & cacheFileName,
+			    const QStringList & deltaFileNames )
+    : ObjDirReadJob( tree, parent )
+    , _deltaFileNames( deltaFileNames )
+{
+    _reader = new CacheReader( cacheFileName, tree, parent );
+    CHECK_NEW( _reader );
+
+    init();
+}
+
+
+CacheReadJob::CacheReadJob( DirTree	      * tree,
+			    const QString     & cacheFileName,
+			    DirInfo	      * mountDir )
+    : ObjDirReadJob( tree, mountDir )
+    , _reader( 0 )
+    , _mountedFileName( cacheFileName )
+{
+    CHECK_PTR( mountDir );
+}
+
+
+void CacheReadJob::init()
+{
+    if ( _reader )
+    {
+	if ( _reader->ok() )
+	{
+	    // Deltas can only be applied to subtrees that are really there
+
+	    if ( _deltaFileNames.isEmpty() )
+		_reader->setLazyDepth( _tree->cacheLazyLoadDepth() );
+
+	    connect( _reader,	SIGNAL( childAdded    ( FileInfo * ) ),
+		     this,	SLOT  ( slotChildAdded( FileInfo * ) ) );
+	}
+	else
+	{
+	    delete _reader;
+	    _reader = 0;
+	}
+    }
+}
+
+
+CacheReadJob::~CacheReadJob()
+{
+    if ( _reader )
+	delete _reader;
+}
+
+
+void
+CacheReadJob::read()
+{
+    TRACE_SCOPE( "scan", "CacheReadJob::read" );
+
+    /*
+     * This will be called repeatedly from DirTree::timeSlicedRead() until
+     * finished() is called.
+     */
+
+    if ( ! _reader && ! _mountedFileName.isEmpty() && ! openMounted() )
+    {
+	finished();
+	return;
+    }
+
+    if ( ! _reader )
+    {
+	finished();
+	return;
+    }
+
+    // Small cache files are read in one go. The text of the others is
+    // inflated in a worker thread; only building the tree is left for
+    // here, in slices that are long enough to leave the views something
+    // worth updating in between.
+
+    if ( _reader->isSmall() )
+	_reader->read();
+    else
+	_reader->readFor( CACHE_READ_SLICE_MILLISEC );
+
+    if ( _reader->eof() && _reader->ok() && ! _deltaFileNames.isEmpty() )
+    {
+	if ( openNextDelta() )
+	    return;
+    }
+
+    if ( ! _reader || _reader->eof() || ! _reader->ok() )
+    {
+	// logDebug() << "Cache reading finished - ok: " << _reader->ok() << endl;
+	finished();
+    }
+}
+
+
+bool CacheReadJob::openMounted()
+{
+    QString fileName = _mountedFileName;
+    _mountedFileName.clear();
+
+    _reader = new CacheReader( fileName, _tree, _dir );
+    CHECK_NEW( _reader );
+
+    if ( _reader->ok() && ! _reader->isDelta() )
+    {
+	_reader->setMounted( true );
+	init();
+
+	return true;
+    }
+
+    logError() << "Can't read " << fileName << " below " << _dir << endl;
+
+    _reader->setFinalizeTree( false );
+    delete _reader;
+    _reader = 0;
+
+    _dir->setReadState( DirError );
+    _dir->finalizeLocal();
+    _tree->sendReadJobFinished( _dir );
+
+    return false;
+}
+
+
+bool CacheReadJob::openNextDelta()
+{
+    QString deltaFileName = _deltaFileNames.takeFirst();
+    DirInfo * toplevel	  = _reader->toplevel();
+
+    // Finalizing the tree and notifying the views is left to the reader
+    // of the last delta: Until then, items might still be removed.
+
+    _reader->setFinalizeTree( false );
+    delete _reader;
+    _reader = new CacheReader( deltaFileName, _tree, toplevel );
+    CHECK_NEW( _reader );
+
+    if ( ! _reader->ok() || ! _reader->isDelta() )
+    {
+	logError() << "Can't apply " << deltaFileName << " as a delta cache file" << endl;
+
+	// The remaining deltas are based on this one, so they are useless
+	// now. Deleting this reader finalizes what is there.
+
+	_deltaFileNames.clear();
+	delete _reader;
+	_reader = 0;
+
+	return false;
+    }
+
+    logDebug() << "Applying delta cache file " << deltaFileName << endl;
+
+    connect( _reader,	SIGNAL( childAdded    ( FileInfo * ) ),
+	     this,	SLOT  ( slotChildAdded( FileInfo * ) ) );
+
+    return true;
+}
+
+
+
+
+RemoteReadJob::RemoteReadJob( DirTree * tree, const QString & url )
+    : ObjDirReadJob( tree, 0 )
+    , _url( url )
+    , _distributed( false )
+    , _listed( false )
+    , _blocked( true )
+{
+    connect( tree, SIGNAL( deletingChild( FileInfo * ) ),
+	     this, SLOT  ( treeDeletingChild( FileInfo * ) ) );
+}
+
+
+RemoteReadJob::~RemoteReadJob()
+{
+    foreach ( const Agent & agent, _agents )
+    {
+	// Don't get any more signals while the process is killed
+
+	agent.process->disconnect( this );
+
+	if ( agent.process->state() != QProcess::NotRunning )
+	{
+	    agent.process->kill();
+	    agent.process->waitForFinished( 1000 );
+	}
+
+	delete agent.process;
+
+	if ( ! _tree->beingDestroyed() && ! agent.reader->atEnd() )
+	{
+	    agent.reader->finishUnfinished( DirAborted );
+	    _unassigned << agent.reader->takeUnstartedSubtrees();
+	}
+
+	delete agent.reader;
+    }
+
+    if ( ! _tree->beingDestroyed() )
+    {
+	foreach ( DirInfo * dir, _unassigned )
+	{
+	    dir->setReadState( DirAborted );
+	    dir->finalizeLocal();
+	    _tree->sendReadJobFinished( dir );
+	}
+    }
+}
+
+
+void RemoteReadJob::start( const QString & agentCommand )
+{
+    QString host;
+    QString path;
+
+    if ( ! splitRemoteUrl( _url, host, path ) )
+    {
+	logError() << "Not a remote directory: " << _url << endl;
+	wakeUp();
+
+	return;
+    }
+
+    QStringList hosts = host.split( ',', QString::SkipEmptyParts );
+    _distributed = hosts.size() > 1;
+
+    foreach ( const QString & agentHost, hosts )
+	_agents << startAgent( agentHost, agentCommand, _distributed ? AGENT_ASSIGNMENTS_PATH : path );
+
+    if ( _distributed )
+    {
+	logInfo() << "Distributed scan of " << path << " with " << hosts.size() << " agents" << endl;
+	assign( _agents.first(), AGENT_LIST_ASSIGNMENT, path );
+    }
+}
+
+
+RemoteReadJob::Agent RemoteReadJob::startAgent( const QString & host,
+						const QString & agentCommand,
+						const QString & path )
+{
+    Agent agent;
+    agent.host	      = host;
+    agent.processDone = false;
+    agent.lost	      = false;
+
+    agent.reader = new RemoteAgentReader( _tree );
+    CHECK_NEW( agent.reader );
+
+    // ssh hands the command to the remote user's shell
+
+    QString quotedPath = path;
+    quotedPath.replace( "'", "'\\''" );
+
+    QStringList args;
+    args << "--" << host << agentCommand + " '" + quotedPath + "'";
+
+    agent.process = new QProcess();
+    CHECK_NEW( agent.process );
+
+    connect( agent.process, SIGNAL( readyReadStandardOutput() ),
+	     this,	    SLOT  ( readOutput() ) );
+
+    connect( agent.process, SIGNAL( finished	    ( int, QProcess::ExitStatus ) ),
+	     this,	    SLOT  ( processFinished( int, QProcess::ExitStatus ) ) );
+
+    connect( agent.process, SIGNAL( error	  ( QProcess::ProcessError ) ),
+	     this,	    SLOT  ( processError( QProcess::ProcessError ) ) );
+
+    logInfo() << "Starting ssh " << args.join( " " ) << endl;
+    agent.process->start( "ssh", args );
+
+    return agent;
+}
+
+
+RemoteReadJob::Agent * RemoteReadJob::findAgent( QObject * sender )
+{
+    for ( int i = 0; i < _agents.size(); ++i )
+    {
+	if ( _agents.at( i ).process == sender )
+	    return &_agents[ i ];
+    }
+
+    return 0;
+}
+
+
+void RemoteReadJob::assign( Agent & agent, char type, const QString & path )
+{
+    QByteArray line;
+    line.append( type );
+    line.append( ' ' );
+    line.append( QUrl::toPercentEncoding( path, "/" ) );
+    line.append( '\n' );
+
+    agent.process->write( line );
+}
+
+
+void RemoteReadJob::read()
+{
+    TRACE_SCOPE( "scan", "RemoteReadJob::read" );
+
+    bool more = false;
+
+    for ( int i = 0; i < _agents.size(); ++i )
+    {
+	Agent & agent = _agents[ i ];
+
+	if ( agent.reader->read( 1000 ) )
+	    more = true;	// More in the next time slice
+	else if ( _distributed && ! agent.lost &&
+		  ( agent.processDone || ! agent.reader->ok() ) )
+	{
+	    takeBack( agent );
+	}
+    }
+
+    bool done = false;
+
+    if ( _agents.isEmpty() )
+	done = true;
+    else if ( _distributed )
+	done = distribute();
+    else if ( ! more )
+    {
+	Agent & agent = _agents.first();
+
+	if ( agent.reader->atEnd() || ! agent.reader->ok() || agent.processDone )
+	{
+	    if ( ! agent.reader->atEnd() )
+	    {
+		logError() << "Reading " << _url << " failed" << endl;
+		agent.reader->finishUnfinished( DirError );
+	    }
+
+	    done = true;
+	}
+    }
+
+    if ( done )
+    {
+	finished();
+	// Don't add anything after finished() since this deletes this job!
+
+	return;
+    }
+
+    if ( more )
+	return;
+
+    // Wait for more output from the agents
+
+    _blocked = true;
+
+    if ( _queue )
+	_queue->block( this );
+}
+
+
+bool RemoteReadJob::distribute()
+{
+    Agent & lister = _agents.first();
+
+    if ( ! _listed )
+    {
+	if ( lister.lost )
+	{
+	    logError() << "Listing " << _url << " on " << lister.host << " failed" << endl;
+	    return true;
+	}
+
+	if ( lister.reader->assignmentsDone() == 0 )
+	    return false;
+
+	_listed = true;
+	DirInfo * toplevel = lister.reader->toplevel();
+
+	if ( ! toplevel )
+	{
+	    logError() << "Can't read " << _url << endl;
+	    return true;
+	}
+
+	// The subdirectories that the listing left unread are the work to
+	// share; the lister is done with them
+
+	for ( FileInfo * child = toplevel->firstChild(); child; child = child->next() )
+	{
+	    if ( child->isDirInfo() && ! child->isPseudoDir() &&
+		 child->toDirInfo()->readState() == DirReading )
+	    {
+		lister.reader->forgetSubtree( child );
+		_unassigned << child->toDirInfo();
+	    }
+	}
+
+	logInfo() << "Distributing " << _unassigned.size() << " directories of " << _url
+		  << " to " << _agents.size() << " agents" << endl;
+    }
+
+    // Fill up the queues, the agent with the least work first
+
+    while ( ! _unassigned.isEmpty() )
+    {
+	Agent * next = 0;
+
+	for ( int i = 0; i < _agents.size(); ++i )
+	{
+	    Agent & agent = _agents[ i ];
+	    int pending = agent.reader->pendingSubtrees();
+
+	    if ( ! agent.lost && pending < AGENT_QUEUE_DEPTH &&
+		 ( ! next || pending < next->reader->pendingSubtrees() ) )
+	    {
+		next = &agent;
+	    }
+	}
+
+	if ( ! next )
+	    break;
+
+	DirInfo * dir = _unassigned.takeFirst();
+	next->reader->expectSubtree( dir );
+	assign( *next, AGENT_READ_ASSIGNMENT, dir->url() );
+    }
+
+    bool haveAgents = false;
+
+    foreach ( const Agent & agent, _agents )
+    {
+	if ( ! agent.lost )
+	{
+	    haveAgents = true;
+
+	    if ( agent.reader->pendingSubtrees() > 0 )
+		return false;
+	}
+    }
+
+    if ( ! haveAgents )
+    {
+	logError() << "No agent left for " << _url << endl;
+
+	foreach ( DirInfo * dir, _unassigned )
+	{
+	    dir->setReadState( DirError );
+	    dir->finalizeLocal();
+	    _tree->sendReadJobFinished( dir );
+	}
+
+	_unassigned.clear();
+    }
+
+    if ( ! _unassigned.isEmpty() )
+	return false;
+
+    // All done: Let the agents exit
+
+    foreach ( const Agent & agent, _agents )
+    {
+	if ( ! agent.processDone )
+	    agent.process->closeWriteChannel();
+    }
+
+    return true;
+}
+
+
+void RemoteReadJob::takeBack( Agent & agent )
+{
+    agent.lost = true;
+    QList<DirInfo *> unstarted = agent.reader->takeUnstartedSubtrees();
+
+    if ( agent.reader->pendingSubtrees() > 0 || ! unstarted.isEmpty() )
+    {
+	logWarning() << "Lost the agent on " << agent.host << "; reassigning "
+		     << unstarted.size() << " directories" << endl;
+    }
+
+    // What it already started is incomplete
+
+    agent.reader->finishUnfinished( DirError );
+
+    if ( ! agent.processDone )
+	agent.process->kill();
+
+    _unassigned = unstarted + _unassigned;
+}
+
+
+void RemoteReadJob::readOutput()
+{
+    Agent * agent = findAgent( sender() );
+
+    if ( agent )
+    {
+	agent->reader->addData( agent->process->readAllStandardOutput() );
+	wakeUp();
+    }
+}
+
+
+void RemoteReadJob::processFinished( int exitCode, QProcess::ExitStatus exitStatus )
+{
+    Agent * agent = findAgent( sender() );
+
+    if ( ! agent )
+	return;
+
+    agent->reader->addData( agent->process->readAllStandardOutput() );
+    logStderr( *agent );
+
+    if ( exitStatus != QProcess::NormalExit )
+	logError() << "The remote agent on " << agent->host << " crashed" << endl;
+    else if ( exitCode != 0 )
+	logError() << "The remote agent on " << agent->host << " exited with " << exitCode << endl;
+
+    agent->processDone = true;
+    wakeUp();
+}
+
+
+void RemoteReadJob::processError( QProcess::ProcessError error )
+{
+    Agent * agent = findAgent( sender() );
+
+    if ( agent && error == QProcess::FailedToStart )
+    {
+	logError() << "Can't start ssh: " << agent->process->errorString() << endl;
+	agent->processDone = true;
+	wakeUp();
+    }
+}
+
+
+void RemoteReadJob::treeDeletingChild( FileInfo * child )
+{
+    foreach ( const Agent & agent, _agents )
+	agent.reader->deletingChild( child );
+
+    QMutableListIterator<DirInfo *> it( _unassigned );
+
+    while ( it.hasNext() )
+    {
+	if ( it.next()->isInSubtree( child ) )
+	    it.remove();
+    }
+}
+
+
+void RemoteReadJob::wakeUp()
+{
+    if ( _blocked )
+    {
+	_blocked = false;
+	_tree->unblock( this );
+    }
+}
+
+
+void RemoteReadJob::logStderr( Agent & agent )
+{
+    QString output = QString::fromUtf8( agent.process->readAllStandardError() ).trimmed();
+
+    if ( ! output.isEmpty() )
+	logWarning() << "Remote agent on " << agent.host << ":\n" << output << endl;
+}
+
+
+bool RemoteReadJob::isRemoteUrl( const QString & url )
+{
+    return url.startsWith( REMOTE_URL_PREFIX );
+}
+
+
+bool RemoteReadJob::splitRemoteUrl( const QString & url,
+				    QString &	    host_ret,
+				    QString &	    path_ret )
+{
+    if ( ! isRemoteUrl( url ) )
+	return false;
+
+    QString rest  = url.mid( QString( REMOTE_URL_PREFIX ).size() );
+    int	    slash = rest.indexOf( '/' );
+
+    if ( slash < 1 )
+	return false;
+
+    host_ret = rest.left( slash );
+    path_ret = rest.mid( slash );
+
+    return true;
+}
+
+
+
+
+Ext4ReadJob::Ext4ReadJob( DirTree * tree, const QString & url )
+    : ObjDirReadJob( tree, 0 )
+{
+    _reader = new Ext4ImageReader( imageName( url ), url, tree );
     CHECK_NEW( _reader );
 
-    init();
+    connect( tree, SIGNAL( deletingChild( FileInfo * ) ),
+	     this, SLOT  ( treeDeletingChild( FileInfo * ) ) );
 }
 
 
-void CacheReadJob::init()
+Ext4ReadJob::~Ext4ReadJob()
+{
+    delete _reader;
+}
+
+
+void Ext4ReadJob::read()
+{
+    TRACE_SCOPE( "scan", "Ext4ReadJob::read" );
+
+    _reader->readFor( EXT4_READ_SLICE_MILLISEC );
+
+    if ( _reader->atEnd() || ! _reader->ok() )
+    {
+	finished();
+	// Don't add anything after finished() since this deletes this job!
+    }
+}
+
+
+void Ext4ReadJob::treeDeletingChild( FileInfo * child )
+{
+    _reader->forgetSubtree( child );
+}
+
+
+bool Ext4ReadJob::isExt4Url( const QString & url )
+{
+    return url.startsWith( EXT4_URL_PREFIX );
+}
+
+
+QString Ext4ReadJob::imageName( const QString & url )
+{
+    return url.mid( QString( EXT4_URL_PREFIX ).size() );
+}
+
+
+
+
+NtfsReadJob::NtfsReadJob( DirTree * tree, const QString & url )
+    : ObjDirReadJob( tree, 0 )
+{
+    _reader = new NtfsMftReader( volumeName( url ), url, tree );
+    CHECK_NEW( _reader );
+
+    connect( tree, SIGNAL( deletingChild( FileInfo * ) ),
+	     this, SLOT  ( treeDeletingChild( FileInfo * ) ) );
+}
+
+
+NtfsReadJob::~NtfsReadJob()
+{
+    delete _reader;
+}
+
+
+void NtfsReadJob::read()
+{
+    TRACE_SCOPE( "scan", "NtfsReadJob::read" );
+
+    _reader->readFor( NTFS_READ_SLICE_MILLISEC );
+
+    if ( _reader->atEnd() || ! _reader->ok() )
+    {
+	finished();
+	// Don't add anything after finished() since this deletes this job!
+    }
+}
+
+
+void NtfsReadJob::treeDeletingChild( FileInfo * child )
+{
+    _reader->forgetSubtree( child );
+}
+
+
+bool NtfsReadJob::isNtfsUrl( const QString & url )
+{
+    return url.startsWith( NTFS_URL_PREFIX );
+}
+
+
+QString NtfsReadJob::volumeName( const QString & url )
+{
+    return url.mid( QString( NTFS_URL_PREFIX ).size() );
+}
+
+
+
+
+ImportReadJob::ImportReadJob( DirTree * tree, const QString & url )
+    : ObjDirReadJob( tree, 0 )
 {
+    _reader = ImportReader::create( url, tree );
+
     if ( _reader )
     {
-	if ( _reader->ok() )
-	{
-	    connect( _reader,	SIGNAL( childAdded    ( FileInfo * ) ),
-		     this,	SLOT  ( slotChildAdded( FileInfo * ) ) );
-	}
-	else
-	{
-	    delete _reader;
-	    _reader = 0;
-	}
+	connect( tree, SIGNAL( deletingChild( FileInfo * ) ),
+		 this, SLOT  ( treeDeletingChild( FileInfo * ) ) );
+    }
+    else
+    {
+	logError() << "Not a file to import: " << url << endl;
     }
 }
 
 
-CacheReadJob::~CacheReadJob()
+ImportReadJob::~ImportReadJob()
 {
     if ( _reader )
 	delete _reader;
 }
 
 
-void
-CacheReadJob::read()
+void ImportReadJob::read()
 {
-    /*
-     * This will be called repeatedly from DirTree::timeSlicedRead() until
-     * finished() is called.
-     */
-
-    if ( ! _reader )
-	finished();
+    TRACE_SCOPE( "scan", "ImportReadJob::read" );
 
-    // logDebug() << "Reading 1000 cache lines" << endl;
-    _reader->read( 1000 );
+    if ( _reader )
+	_reader->readFor( IMPORT_READ_SLICE_MILLISEC );
 
-    if ( _reader->eof() || ! _reader->ok() )
+    if ( ! _reader || _reader->atEnd() || ! _reader->ok() )
     {
-	// logDebug() << "Cache reading finished - ok: " << _reader->ok() << endl;
 	finished();
+	// Don't add anything after finished() since this deletes this job!
     }
 }
 
 
+void ImportReadJob::treeDeletingChild( FileInfo * child )
+{
+    _reader->forgetSubtree( child );
+}
+
+
+bool ImportReadJob::isImportUrl( const QString & url )
+{
+    return url.startsWith( NCDU_URL_PREFIX ) || url.startsWith( FILE_LIST_URL_PREFIX );
+}
+
+
 
 
 
 DirReadJobQueue::DirReadJobQueue()
     : QObject()
+    , _workerThreads( 0 )
+    , _timeBudgetMillisec( 10 )
+    , _elevatorPos( 0, 0 )
+    , _currentJob( 0 )
+    , _elevatorOrder( false )
 {
+    _schedulerClient = ReadScheduler::instance()->addQueue( this );
+
     connect( &_timer, SIGNAL( timeout() ),
 	     this,    SLOT  ( timeSlicedRead() ) );
 }
@@ -719,7 +2045,21 @@ DirReadJobQueue::DirReadJobQueue()
 
 DirReadJobQueue::~DirReadJobQueue()
 {
+    // Prefetches that are still running or waiting for a worker thread of
+    // the shared pool only use their readers, which are aborted along with
+    // the jobs; they report to the ReadScheduler, not to this queue.
+
     clear();
+    ReadScheduler::instance()->removeQueue( _schedulerClient );
+}
+
+
+void DirReadJobQueue::setWorkerThreads( int threads )
+{
+    _workerThreads = qMax( threads, 0 );
+    ReadScheduler::instance()->setWorkerThreads( _schedulerClient, _workerThreads );
+
+    logInfo() << "Using " << _workerThreads << " worker threads for reading directories" << endl;
 }
 
 
@@ -727,22 +2067,41 @@ void DirReadJobQueue::enqueue( DirReadJob * job )
 {
     if ( job )
     {
-	_queue.append( job );
+	bool wasEmpty = _queue.isEmpty();
+	QueuePos queuePos;
+	queuePos.pos	     = _queue.insert( _queue.end(), job );
+	queuePos.dir	     = job->dir();
+	queuePos.elevatorKey = ElevatorKey( jobDevice( job ), job->inode() );
+	_queuePos.insert( job, queuePos );
+
+	if ( queuePos.dir )
+	    _jobsByDir.insert( queuePos.dir, job );
+
+	if ( queuePos.elevatorKey.second != 0 )
+	    _elevator.insert( queuePos.elevatorKey, job );
+
 	job->setQueue( this );
 
-	if ( ! _timer.isActive() )
+	if ( wasEmpty )
 	{
 	    // logDebug() << "First job queued" << endl;
+
+	    if ( ! _scanStats.isRunning() )
+		_scanStats.start();
+
 	    emit startingReading();
-	    _timer.start( 0 );
 	}
+
+	if ( ! _timer.isActive() )
+	    _timer.start( 0 );
     }
 }
 
 
 DirReadJob * DirReadJobQueue::dequeue()
 {
-    DirReadJob * job = _queue.takeFirst();
+    DirReadJob * job = _queue.first();
+    removeFromQueue( job );
 
     if ( job )
 	job->setQueue( 0 );
@@ -757,13 +2116,21 @@ void DirReadJobQueue::clear()
     qDeleteAll( _blocked );
     _queue.clear();
     _blocked.clear();
+    _queuePos.clear();
+    _jobsByDir.clear();
+    _elevator.clear();
+    _elevatorPos = ElevatorKey( 0, 0 );
+    _currentJob	 = 0;
+    _scanStats.finish();
 }
 
 
 void DirReadJobQueue::abort()
 {
-    foreach ( DirReadJob * job, _queue )
+    for ( JobList::const_iterator it = _queue.constBegin(); it != _queue.constEnd(); ++it )
     {
+	DirReadJob * job = *it;
+
 	if ( job->dir() )
 	    job->dir()->readJobAborted( job->dir() );
     }
@@ -778,34 +2145,85 @@ void DirReadJobQueue::abort()
 }
 
 
+bool DirReadJobQueue::removeFromQueue( DirReadJob * job )
+{
+    QHash<DirReadJob *, QueuePos>::iterator it = _queuePos.find( job );
+
+    if ( it == _queuePos.end() )
+	return false;
+
+    _queue.erase( it.value().pos );
+
+    if ( it.value().dir )
+	_jobsByDir.remove( it.value().dir, job );
+
+    if ( it.value().elevatorKey.second != 0 )
+	_elevator.remove( it.value().elevatorKey, job );
+
+    if ( job == _currentJob )
+	_currentJob = 0;
+
+    _queuePos.erase( it );
+
+    return true;
+}
+
+
+void DirReadJobQueue::collectJobs( DirInfo * dir, QList<DirReadJob *> & jobs ) const
+{
+    if ( ! dir || dir->pendingReadJobs() < 1 )
+	return;
+
+    QMultiHash<DirInfo *, DirReadJob *>::const_iterator it = _jobsByDir.constFind( dir );
+
+    while ( it != _jobsByDir.constEnd() && it.key() == dir )
+    {
+	jobs << it.value();
+	++it;
+    }
+
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+    {
+	if ( child->isDirInfo() )
+	    collectJobs( child->toDirInfo(), jobs );
+    }
+
+    if ( dir->attic() )
+	collectJobs( dir->attic(), jobs );
+}
+
+
 void DirReadJobQueue::killAll( DirInfo * subtree, DirReadJob * exceptJob )
 {
     if ( ! subtree )
 	return;
 
-    QMutableListIterator<DirReadJob *> it( _queue );
+    // Find the jobs for the subtree through the index and the pending read
+    // jobs counters of the DirInfo nodes: This is proportional to the
+    // number of jobs that are actually killed, not to the length of the
+    // queue.
+
+    QList<DirReadJob *> jobs;
+    collectJobs( subtree, jobs );
     int count = 0;
 
-    while ( it.hasNext() )
+    foreach ( DirReadJob * job, jobs )
     {
-	DirReadJob * job = it.next();
-
 	if ( exceptJob && job == exceptJob )
 	{
 	    logDebug() << "NOT killing " << job << endl;
 	    continue;
 	}
 
-	if ( job->dir() && job->dir()->isInSubtree( subtree ) )
+	if ( removeFromQueue( job ) )
 	{
 	    // logDebug() << "Killing " << job << endl;
 	    ++count;
-	    it.remove();
 	    delete job;
 	}
     }
 
-    it = QMutableListIterator<DirReadJob *>( _blocked );
+    QMutableListIterator<DirReadJob *> it( _blocked );
 
     while ( it.hasNext() )
     {
@@ -830,10 +2248,185 @@ void DirReadJobQueue::killAll( DirInfo * subtree, DirReadJob * exceptJob )
 }
 
 
+void DirReadJobQueue::prioritize( DirInfo * subtree )
+{
+    if ( ! subtree || _queue.count() < 2 )
+	return;
+
+    QList<DirReadJob *> jobs;
+    collectJobs( subtree, jobs );
+
+    // Move the jobs to the front in reverse order so they keep their order
+    // relative to each other.
+
+    for ( int i = jobs.size() - 1; i >= 0; --i )
+    {
+	DirReadJob * job = jobs.at( i );
+	QHash<DirReadJob *, QueuePos>::iterator it = _queuePos.find( job );
+
+	if ( it != _queuePos.end() )
+	{
+	    _queue.erase( it.value().pos );
+	    it.value().pos = _queue.insert( _queue.begin(), job );
+	}
+    }
+
+    if ( ! jobs.isEmpty() )
+	logDebug() << "Prioritized " << jobs.size() << " read jobs for " << subtree << endl;
+}
+
+
 void DirReadJobQueue::timeSlicedRead()
 {
-    if ( ! _queue.isEmpty() )
-	_queue.first()->read();
+    TRACE_SCOPE( "scan", "DirReadJobQueue::timeSlicedRead" );
+
+    // Process as many jobs as fit into the time budget: With lots of tiny
+    // directories, one job per timer event would spend most of the time in
+    // the event loop.
+
+    // With the queues of other trees busy, too, they share the main thread.
+
+    ReadScheduler * scheduler = ReadScheduler::instance();
+    int budget = scheduler->timeBudgetShare( _timeBudgetMillisec );
+    ReadScheduler::adjustThreadPriority( false );
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    int jobs = 0;
+
+    while ( ! _queue.isEmpty() )
+    {
+	if ( _workerThreads < 1 && scheduler->prefetchRunning( _schedulerClient ) == 0 )
+	{
+	    DirReadJob * job = nextJob();
+
+	    // Jobs that are ready don't need any more system calls
+
+	    int delay = job->isReady() ? 0 : scheduler->throttleDelay( jobDevice( job ) );
+
+	    if ( delay > 0 )
+	    {
+		_timer.stop();
+		scheduler->resumeLater( delay );
+		break;
+	    }
+
+	    job->read();
+	}
+	else
+	{
+	    DirReadJob * job = nextReadyJob();
+
+	    if ( ! job )
+	    {
+		// All jobs that are to be processed next are still waiting for
+		// their worker threads. Don't busy-wait for them;
+		// the ReadScheduler will resume() when they are done.
+
+		_timer.stop();
+		break;
+	    }
+
+	    job->read();
+	}
+
+	++jobs;
+
+	if ( elapsed.elapsed() >= budget )
+	    break;
+    }
+
+    _scanStats.addTimeSlice( jobs, elapsed.nsecsElapsed() );
+    _scanStats.sampleQueueLength( count() );
+
+    // In polite mode, leave some CPU time to others between the slices
+
+    _timer.setInterval( scheduler->politeMode() ? POLITE_SLICE_GAP_MILLISEC : 0 );
+}
+
+
+void DirReadJobQueue::setElevatorOrder( bool enable )
+{
+    _elevatorOrder = enable;
+
+    if ( enable )
+	logInfo() << "Reading directories in elevator order" << endl;
+}
+
+
+DirReadJob * DirReadJobQueue::nextJob()
+{
+    if ( ! _elevatorOrder || _elevator.isEmpty() )
+	return _queue.first();
+
+    // A job that was started, but is not finished yet (e.g. a huge
+    // directory that is read in chunks) needs to be continued first.
+
+    if ( _currentJob )
+	return _currentJob;
+
+    // Jobs that are not in the elevator (no i-number known, e.g. the
+    // toplevel directory or a cache file) are handled when the elevator is
+    // empty.
+
+    QMultiMap<ElevatorKey, DirReadJob *>::const_iterator it = _elevator.lowerBound( _elevatorPos );
+
+    if ( it == _elevator.constEnd() )
+    {
+	// Reached the end of the sweep; start over with the lowest one
+
+	it = _elevator.constBegin();
+    }
+
+    _elevatorPos = it.key();
+    _currentJob	 = it.value();
+
+    return _currentJob;
+}
+
+
+dev_t DirReadJobQueue::jobDevice( DirReadJob * job )
+{
+    return job && job->dir() ? job->dir()->device() : 0;
+}
+
+
+DirReadJob * DirReadJobQueue::nextReadyJob()
+{
+    ReadScheduler * scheduler = ReadScheduler::instance();
+    DirReadJob * readyJob = 0;
+    int notReady = 0;
+
+    for ( JobList::const_iterator it = _queue.constBegin(); it != _queue.constEnd(); ++it )
+    {
+	DirReadJob * job = *it;
+
+	if ( job->isReady() )
+	{
+	    if ( ! readyJob )
+		readyJob = job;
+	}
+	else
+	{
+	    scheduler->startPrefetch( _schedulerClient, job );
+
+	    // Don't look any further than the worker threads can handle
+	    if ( ++notReady >= maxLookahead() )
+		break;
+	}
+
+	if ( readyJob && ! scheduler->canPrefetch( _schedulerClient ) )
+	    break;
+    }
+
+    return readyJob;
+}
+
+
+void DirReadJobQueue::resume()
+{
+    if ( ! _queue.isEmpty() && ! _timer.isActive() )
+	_timer.start( 0 );
 }
 
 
@@ -843,7 +2436,7 @@ void DirReadJobQueue::jobFinishedNotify( DirReadJob *job )
     {
 	// Get rid of the old (finished) job.
 
-	_queue.removeOne( job );
+	removeFromQueue( job );
 	delete job;
     }
 
@@ -855,7 +2448,18 @@ void DirReadJobQueue::jobFinishedNotify( DirReadJob *job )
 	// logDebug() << "No more jobs - finishing" << endl;
 
 	if ( _blocked.isEmpty() )
+	{
+	    _scanStats.finish();
+
+	    if ( _scanStats.timeSlices() > 0 )
+	    {
+		logInfo() << "Time budget " << _timeBudgetMillisec
+			  << " millisec per slice" << endl;
+		_scanStats.logSummary();
+	    }
+
 	    emit finished();
+	}
     }
 }
 
@@ -884,3 +2488,15 @@ void DirReadJobQueue::unblock( DirReadJob * job )
     if ( _blocked.isEmpty() )
 	logDebug() << "No more jobs waiting for external processes" << endl;
 }
+
+
+void DirReadJobQueue::block( DirReadJob * job )
+{
+    if ( ! removeFromQueue( job ) )
+	return;
+
+    _blocked.append( job );
+
+    if ( _queue.isEmpty() )
+	_timer.stop();
+}
@@ -13,8 +13,20 @@
 
 #include <dirent.h>
 #include <QTimer>
+#include <QHash>
+#include <QLinkedList>
+#include <QMultiMap>
+#include <QPair>
+#include <QProcess>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
 
 #include "FileInfo.h"
+#include "LocalDirReader.h"
+#include "ReadScheduler.h"
+#include "ScanStats.h"
 #include "Logger.h"
 
 
@@ -24,9 +36,19 @@ namespace QDirStat
     class DirInfo;
     class DirTree;
     class CacheReader;
+    class CacheBaseline;
+    class SnapshotBaseline;
+    struct AggregateStats;
+    class RemoteAgentReader;
+    class Ext4ImageReader;
+    class NtfsMftReader;
+    class ImportReader;
     class DirReadJobQueue;
     class MountPoint;
 
+    typedef QSharedPointer<CacheBaseline> CacheBaselinePtr;
+    typedef QSharedPointer<SnapshotBaseline> SnapshotBaselinePtr;
+
 
     /**
      * A directory read job that can be queued. This is mainly to prevent
@@ -100,6 +122,38 @@ namespace QDirStat
 	 **/
 	void setQueue( DirReadJobQueue * queue ) { _queue = queue; }
 
+	/**
+	 * Return 'true' if this job is ready for read() to be called in the
+	 * main thread. This is only relevant if the job queue uses worker
+	 * threads: A job that does part of its work in a worker thread is not
+	 * ready as long as that part is not done yet.
+	 *
+	 * This default implementation always returns 'true'.
+	 **/
+	virtual bool isReady() const { return true; }
+
+	/**
+	 * Start the part of this job that can be done in a worker thread of
+	 * 'pool' without touching the DirTree. When that part is done, the
+	 * prefetchFinished() slot of the ReadScheduler is invoked with the
+	 * device number of the job's directory and the queue's client ID.
+	 *
+	 * Return 'true' if anything was started, 'false' if not (in
+	 * particular if it was already started before).
+	 *
+	 * This default implementation does nothing and returns 'false'.
+	 **/
+	virtual bool startPrefetch( QThreadPool * pool )
+	    { Q_UNUSED( pool ); return false; }
+
+	/**
+	 * Return the i-number of the directory this job reads or 0 if that is
+	 * unknown. This is used for ordering the jobs for rotational disks.
+	 *
+	 * This default implementation returns 0.
+	 **/
+	virtual ino_t inode() const { return 0; }
+
 
     protected:
 
@@ -145,10 +199,17 @@ namespace QDirStat
 
 	/**
 	 * Return the device name where 'dir' is on if it's a mount point.
-	 * This uses MountPoints which reads /proc/mounts.
+	 * This uses MountPoints which reads /proc/self/mountinfo.
 	 **/
 	QString device( const DirInfo * dir ) const;
 
+	/**
+	 * Return the mount point of the filesystem of 'dir': By its device
+	 * number if possible, by its path otherwise (for Btrfs subvolumes and
+	 * for directories from a cache file).
+	 **/
+	MountPoint * mountPoint( const DirInfo * dir ) const;
+
 	/**
 	 * Check if we really should cross into a mounted filesystem; don't do
 	 * it if this is a system mount, a bind mount, a filesystem mounted
@@ -156,6 +217,19 @@ namespace QDirStat
 	 **/
 	bool shouldCrossIntoFilesystem( const DirInfo * dir ) const;
 
+	/**
+	 * Return 'true' if 'dir', which is a mount point or a subvolume below
+	 * 'parent', is on Btrfs.
+	 **/
+	bool isOnBtrfs( const DirInfo * parent, const DirInfo * dir ) const;
+
+	/**
+	 * Return 'true' if 'dir', which is a mount point below 'parent', is
+	 * a Btrfs subvolume of the same filesystem that is not mounted on
+	 * its own.
+	 **/
+	bool isBtrfsSubvolume( const DirInfo * parent, const DirInfo * dir ) const;
+
 
 	DirTree *	   _tree;
 	DirInfo *	   _dir;
@@ -215,6 +289,69 @@ namespace QDirStat
 	 **/
 	virtual ~LocalDirReadJob();
 
+	/**
+	 * Return 'true' if the raw directory data were already read by a
+	 * worker thread.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual bool isReady() const Q_DECL_OVERRIDE;
+
+	/**
+	 * Read the raw directory data (the entries and their lstat() results)
+	 * in a worker thread of 'pool'.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual bool startPrefetch( QThreadPool * pool ) Q_DECL_OVERRIDE;
+
+	/**
+	 * Read the directory or the next chunk of a very large directory.
+	 *
+	 * Reimplemented from DirReadJob: Unlike the default implementation,
+	 * this can be called several times until the job has finished.
+	 **/
+	virtual void read() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return the i-number of the directory this job reads or 0 if it is
+	 * unknown.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual ino_t inode() const Q_DECL_OVERRIDE { return _inode; }
+
+	/**
+	 * Set the i-number of the directory this job reads.
+	 **/
+	void setInode( ino_t inode ) { _inode = inode; }
+
+	/**
+	 * Return the baseline that this job and the jobs for its
+	 * subdirectories use. The default is the cache baseline of the
+	 * DirTree (if it has one).
+	 **/
+	CacheBaselinePtr baseline() const { return _baseline; }
+
+	/**
+	 * Set the baseline for this job and the jobs for its
+	 * subdirectories.
+	 **/
+	void setBaseline( CacheBaselinePtr baseline ) { _baseline = baseline; }
+
+	/**
+	 * Return the other Btrfs snapshot that this job and the jobs for its
+	 * subdirectories copy what did not change from (see
+	 * DirTree::readSubvolume()).
+	 **/
+	SnapshotBaselinePtr snapshot() const { return _snapshot; }
+
+	/**
+	 * Set the snapshot baseline for this job and the jobs for its
+	 * subdirectories.
+	 **/
+	void setSnapshot( SnapshotBaselinePtr snapshot ) { _snapshot = snapshot; }
+
 	/**
 	 * Obtain information about the URL specified and create a new FileInfo
 	 * or a DirInfo (whatever is appropriate) from that information. Use
@@ -251,6 +388,11 @@ namespace QDirStat
 	/**
 	 * Read the directory. Prior to this nothing happens.
 	 *
+	 * For very large directories, this processes only one chunk of
+	 * entries (see LocalDirReader::chunkSize()) and returns without
+	 * finishing the job; read() will then be called again for the next
+	 * chunk.
+	 *
 	 * Inherited and reimplemented from DirReadJob.
 	 **/
 	virtual void startReading();
@@ -262,10 +404,76 @@ namespace QDirStat
 	void finishReading( DirInfo * dir, DirReadState readState );
 
 	/**
-	 * Process one subdirectory entry.
+	 * The checks that the entries of a directory might need, found out
+	 * once for each job (see scanFeatures()).
+	 **/
+	enum ScanFeatures
+	{
+	    ScanFilters	     = 0x01,	// The tree has ignore filters
+	    ScanExcludeRules = 0x02,	// There are exclude rules
+	    ScanNtfs	     = 0x04,	// Don't trust the hard link counts
+	    ScanCacheFiles   = 0x08	// Pick up cache files along the way
+	};
+
+	/**
+	 * Return the ScanFeatures that this job needs.
+	 **/
+	int scanFeatures();
+
+	/**
+	 * Create the children of this job's directory for the entries of the
+	 * reader. This is instantiated for each combination of ScanFeatures,
+	 * so the loop for the common case (no filters, no exclude rules)
+	 * doesn't check for them at all for each entry.
+	 *
+	 * Return 'false' if a cache file was read instead and this job was
+	 * deleted (see readCacheFile()).
+	 **/
+	template<int Features>
+	bool readEntries();
+
+	/**
+	 * Process one subdirectory entry. If 'checkExcludeRules' is
+	 * 'false', the caller already knows that there are no exclude rules.
 	 **/
 	void processSubDir( const QString & entryName,
-			    DirInfo	  * subDir    );
+			    DirInfo	  * subDir,
+			    ino_t	    inode,
+			    bool	    checkExcludeRules = true );
+
+	/**
+	 * Add the excluded subdirectory 'subDir' with path 'path' to the
+	 * scan statistics of the queue, with an estimate of what is below it
+	 * if the progress estimate needs that.
+	 **/
+	void addExcludedToScanStats( DirInfo * subDir, const QString & path );
+
+	/**
+	 * Create the read job for 'subDir' with i-number 'inode': A
+	 * SnapshotDirReadJob if this job has a snapshot baseline in which
+	 * 'subDir' is unchanged, a BaselineDirReadJob if this job has a
+	 * baseline in which 'subDir' is unchanged, an EstimateDirReadJob if
+	 * the tree is read in sampling mode and 'subDir' is deep enough, a
+	 * LocalDirReadJob otherwise. The new job uses the same baselines.
+	 **/
+	LocalDirReadJob * newSubDirJob( DirInfo * subDir, ino_t inode = 0 );
+
+	/**
+	 * Delete the dot entry of this job's directory before any children
+	 * are added if none of them will be a subdirectory ('hasSubDirs' is
+	 * 'false'): Then the files go right into the directory instead of
+	 * being moved there from the dot entry when it is finalized.
+	 **/
+	void dropUnneededDotEntry( bool hasSubDirs );
+
+	/**
+	 * Add a non-directory child to this job's directory or to its attic
+	 * if it matches an ignore filter. If 'checkFilters' is 'false', the
+	 * caller already knows that there are no filters.
+	 **/
+	void addFileChild( FileInfo *	   child,
+			   const QString & entryName,
+			   bool		   checkFilters = true );
 
 	/**
 	 * Return 'true' if 'entryName' matches an exclude rule of the
@@ -278,6 +486,24 @@ namespace QDirStat
 	 **/
 	bool checkIgnoreFilters( const QString & entryName ) const;
 
+	/**
+	 * Return 'true' if the plain file 'entryName' with 'statInfo' is only
+	 * added up in the aggregate of this directory (see
+	 * DirTree::aggregateFilesBelow()) instead of getting a node of its
+	 * own. If so, this adds it. In counting mode (DirTree::countOnly()),
+	 * this is true for all non-directories. 'checkFilters' is as for
+	 * addFileChild().
+	 **/
+	bool aggregateFile( const QString &     entryName,
+			    const struct stat & statInfo,
+			    bool		checkFilters = true );
+
+	/**
+	 * Add the AggregateInfo for the files that were aggregated to this
+	 * job's directory, if there were any.
+	 **/
+	void addAggregate();
+
 	/**
 	 * Read a cache file that was picked up along the way:
 	 *
@@ -325,10 +551,22 @@ namespace QDirStat
 	// Data members
 	//
 
-	QString _dirName;
+	QString		  _dirName;
+	LocalDirReaderPtr _reader;
+	CacheBaselinePtr  _baseline;
+	SnapshotBaselinePtr _snapshot;
+	AggregateStats *  _aggregate;
+	ino_t	_inode;
+	bool	_prefetchStarted;
 	bool	_applyFileChildExcludeRules;
 	bool	_checkedForNtfs;
 	bool	_isNtfs;
+	bool	_sameAsSnapshot;	// The entries are the ones of the snapshot baseline
+
+	// What each filter of the tree knows about this directory (see
+	// DirTree::lookupFilterDirs()), looked up on demand
+	mutable QVector<int> _filterDirNos;
+	mutable bool	     _haveFilterDirNos;
 
 	static bool _warnedAboutNtfsHardLinks;
 
@@ -336,6 +574,157 @@ namespace QDirStat
 
 
 
+    /**
+     * Read job for a directory that did not change since a cache file was
+     * written that is now used as the baseline of a scan (see
+     * DirTree::setCacheBaseline()): The directory is not read again; its
+     * non-directory children are taken from the cache file, and only its
+     * subdirectories are checked with lstat() to find out if they need to
+     * be read.
+     **/
+    class BaselineDirReadJob: public LocalDirReadJob
+    {
+    public:
+
+	/**
+	 * Constructor for 'dir' which is directory no. 'dirNo' in
+	 * 'baseline'.
+	 **/
+	BaselineDirReadJob( DirTree *	       tree,
+			    DirInfo *	       dir,
+			    CacheBaselinePtr   baseline,
+			    quint64	       dirNo );
+
+	/**
+	 * Return 'true': There is nothing to prefetch.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual bool isReady() const Q_DECL_OVERRIDE { return true; }
+
+	/**
+	 * Do nothing and return 'false': The directory is not read.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual bool startPrefetch( QThreadPool * ) Q_DECL_OVERRIDE { return false; }
+
+    protected:
+
+	/**
+	 * Create the children of the directory from the baseline.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual void startReading() Q_DECL_OVERRIDE;
+
+	quint64		 _dirNo;
+
+    };	// BaselineDirReadJob
+
+
+
+    /**
+     * Read job for a directory of a Btrfs snapshot whose entries did not
+     * change since another snapshot of the same subvolume that is already
+     * in the tree (see SnapshotBaseline): The directory is not read again;
+     * its children are copied from the other snapshot. Subdirectories in
+     * which nothing changed at all are copied without any system calls,
+     * too; only the others are checked with lstat().
+     **/
+    class SnapshotDirReadJob: public LocalDirReadJob
+    {
+    public:
+
+	/**
+	 * Constructor for 'dir' which is directory no. 'dirNo' in
+	 * 'snapshot'.
+	 **/
+	SnapshotDirReadJob( DirTree *		tree,
+			    DirInfo *		dir,
+			    SnapshotBaselinePtr snapshot,
+			    quint32		dirNo );
+
+	/**
+	 * Return 'true': There is nothing to prefetch.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual bool isReady() const Q_DECL_OVERRIDE { return true; }
+
+	/**
+	 * Do nothing and return 'false': The directory is not read.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual bool startPrefetch( QThreadPool * ) Q_DECL_OVERRIDE { return false; }
+
+    protected:
+
+	/**
+	 * Create the children of the directory from the snapshot baseline.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual void startReading() Q_DECL_OVERRIDE;
+
+	quint32		 _dirNo;
+
+    };	// SnapshotDirReadJob
+
+
+
+    /**
+     * Read job for a directory in sampling mode (see DirTree::sampling()):
+     * The subtree of the directory is only estimated with a
+     * SubtreeEstimator, and the directory becomes an estimated pending
+     * subtree (see DirTree::addEstimatedSubtree()). If the subtree is so
+     * small that the estimate is exact anyway, the directory is read
+     * normally instead.
+     **/
+    class EstimateDirReadJob: public LocalDirReadJob
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	EstimateDirReadJob( DirTree * tree, DirInfo * dir );
+
+	/**
+	 * Return 'true' unless the directory is read normally: The
+	 * estimate is not prefetched.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual bool isReady() const Q_DECL_OVERRIDE
+	    { return ! _readNormally || LocalDirReadJob::isReady(); }
+
+	/**
+	 * Return 'false' unless the directory is read normally: The
+	 * estimate is not prefetched.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual bool startPrefetch( QThreadPool * pool ) Q_DECL_OVERRIDE
+	    { return _readNormally && LocalDirReadJob::startPrefetch( pool ); }
+
+    protected:
+
+	/**
+	 * Estimate the subtree of the directory or read it normally if that
+	 * is just as cheap.
+	 *
+	 * Reimplemented from LocalDirReadJob.
+	 **/
+	virtual void startReading() Q_DECL_OVERRIDE;
+
+	bool _readNormally;
+
+    };	// EstimateDirReadJob
+
+
+
     class CacheReadJob: public ObjDirReadJob
     {
 	Q_OBJECT
@@ -361,10 +750,26 @@ namespace QDirStat
 	 *
 	 * If 'parent' is 0, the content of the cache file will replace all
 	 * current tree items.
+	 *
+	 * The delta cache files 'deltaFileNames' are applied in that order
+	 * after the cache file is read (see CacheWriter).
 	 **/
-	CacheReadJob( DirTree *	       tree,
-		      DirInfo *	       parent,
-		      const QString &  cacheFileName );
+	CacheReadJob( DirTree *		    tree,
+		      DirInfo *		    parent,
+		      const QString &	    cacheFileName,
+		      const QStringList &   deltaFileNames = QStringList() );
+
+	/**
+	 * Constructor for reading a cache file below 'mountDir' as if that
+	 * were the tree's root (see CacheReader::setMounted()). Unlike with
+	 * the other constructors, the file is only opened when the job is
+	 * started, so any number of them can be queued at the same time.
+	 *
+	 * 'mountDir' is in state DirReading until the job is done.
+	 **/
+	CacheReadJob( DirTree *	      tree,
+		      const QString & cacheFileName,
+		      DirInfo *	      mountDir );
 
 	/**
 	 * Destructor.
@@ -391,13 +796,345 @@ namespace QDirStat
 	 **/
 	void init();
 
+	/**
+	 * Replace the current cache reader with one for the next delta
+	 * cache file. Return 'false' if that cannot be opened; the current
+	 * reader is gone in any case.
+	 **/
+	bool openNextDelta();
+
+
+	/**
+	 * Open the cache file of a job that reads below a mount directory.
+	 * Return 'false' if that fails; the mount directory is marked as a
+	 * read error then.
+	 **/
+	bool openMounted();
+
 
 	CacheReader * _reader;
+	QStringList   _deltaFileNames;
+	QString	      _mountedFileName;
 
     };	// class CacheReadJob
 
 
 
+    /**
+     * Read job for a directory on a remote host (REMOTE_URL_PREFIX
+     * "[user@]host/path"): This starts the RemoteAgent ("qdirstat --agent")
+     * on that host via ssh and builds the tree from its output with a
+     * RemoteAgentReader as it comes in, much like a CacheReadJob reads a
+     * cache file.
+     *
+     * With several hosts ("host1,host2,host3/path") for a filesystem that
+     * all of them can access (like a cluster filesystem), this job is the
+     * coordinator of a distributed scan: It starts an agent for
+     * assignments on each host (see RemoteAgent::readAssignments()). The
+     * first one lists the toplevel directory; its subdirectories are then
+     * handed out to the agents with the fewest queued assignments, at most
+     * AGENT_QUEUE_DEPTH each, so no agent runs dry while the others still
+     * have work. Each subtree is merged into the directory from the
+     * listing. If an agent fails, its assignments that were not started
+     * yet go to the others.
+     *
+     * While it waits for more output, the job is blocked in the job queue.
+     **/
+    class RemoteReadJob: public ObjDirReadJob
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor for remote directory 'url'. This does not start
+	 * anything yet; add the job to the tree as a blocked job, then call
+	 * start().
+	 **/
+	RemoteReadJob( DirTree * tree, const QString & url );
+
+	/**
+	 * Destructor. This kills the remote agents if they are still
+	 * running.
+	 **/
+	virtual ~RemoteReadJob();
+
+	/**
+	 * Start the remote agents with 'agentCommand' (see
+	 * DirTree::remoteAgentCommand()).
+	 **/
+	void start( const QString & agentCommand );
+
+	/**
+	 * Process what the agents sent so far.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual void read() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if 'url' is a remote directory.
+	 **/
+	static bool isRemoteUrl( const QString & url );
+
+	/**
+	 * Split remote directory 'url' into its host (with the user name,
+	 * if there is one; a comma-separated list for a distributed scan)
+	 * and its path. Return 'false' if it is not a remote directory.
+	 **/
+	static bool splitRemoteUrl( const QString & url,
+				    QString &	    host_ret,
+				    QString &	    path_ret );
+
+    protected slots:
+
+	/**
+	 * Notification that an agent sent more output.
+	 **/
+	void readOutput();
+
+	/**
+	 * Notification that an agent (or ssh) exited.
+	 **/
+	void processFinished( int exitCode, QProcess::ExitStatus exitStatus );
+
+	/**
+	 * Notification that ssh could not be started.
+	 **/
+	void processError( QProcess::ProcessError error );
+
+	/**
+	 * Notification that 'child' is about to be deleted from the tree.
+	 **/
+	void treeDeletingChild( FileInfo * child );
+
+    protected:
+
+	/**
+	 * One remote agent.
+	 **/
+	struct Agent
+	{
+	    QString		host;
+	    QProcess *		process;
+	    RemoteAgentReader * reader;
+	    bool		processDone;
+	    bool		lost;	// Its work was taken back
+	};
+
+	/**
+	 * Start the agent for 'host' with 'agentCommand' for 'path'.
+	 **/
+	Agent startAgent( const QString & host,
+			  const QString & agentCommand,
+			  const QString & path );
+
+	/**
+	 * Return the agent that 'sender' (a QProcess) belongs to or 0.
+	 **/
+	Agent * findAgent( QObject * sender );
+
+	/**
+	 * Send an assignment of 'type' for 'path' to 'agent'.
+	 **/
+	void assign( Agent & agent, char type, const QString & path );
+
+	/**
+	 * Hand out the subdirectories to the agents. Return 'true' if the
+	 * distributed scan is done.
+	 **/
+	bool distribute();
+
+	/**
+	 * Take back the assignments from 'agent' that failed.
+	 **/
+	void takeBack( Agent & agent );
+
+	/**
+	 * Schedule this job again if it is blocked.
+	 **/
+	void wakeUp();
+
+	/**
+	 * Log what an agent or ssh wrote to stderr.
+	 **/
+	void logStderr( Agent & agent );
+
+
+	QString		    _url;
+	QList<Agent>	    _agents;
+	QList<DirInfo *>    _unassigned;
+	bool		    _distributed;
+	bool		    _listed;
+	bool		    _blocked;
+
+    };	// class RemoteReadJob
+
+
+
+    /**
+     * Read job for an ext2, ext3 or ext4 filesystem image or block device
+     * (EXT4_URL_PREFIX "ext4:/dev/sdb1", "ext4:/images/disk.img"): This
+     * reads the i-node tables in their order on the disk and then the raw
+     * directory blocks with an Ext4ImageReader (libext2fs), without any
+     * stat() call, much like a CacheReadJob reads a cache file. The
+     * filesystem does not need to be mounted.
+     **/
+    class Ext4ReadJob: public ObjDirReadJob
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor for image 'url' that is read into the root of 'tree'.
+	 **/
+	Ext4ReadJob( DirTree * tree, const QString & url );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~Ext4ReadJob();
+
+	/**
+	 * Read for one time slice.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual void read() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if 'url' is an ext2/3/4 image.
+	 **/
+	static bool isExt4Url( const QString & url );
+
+	/**
+	 * Return the name of the image file or device of 'url'.
+	 **/
+	static QString imageName( const QString & url );
+
+    protected slots:
+
+	/**
+	 * Notification that 'child' is about to be deleted from the tree.
+	 **/
+	void treeDeletingChild( FileInfo * child );
+
+    protected:
+
+	Ext4ImageReader * _reader;
+
+    };	// class Ext4ReadJob
+
+
+
+    /**
+     * Read job for an NTFS volume or image (NTFS_URL_PREFIX
+     * "ntfs:/dev/sda2"): This reads the Master File Table in one
+     * sequential pass with an NtfsMftReader and builds the tree from it in
+     * memory, without going through a filesystem driver like ntfs-3g at
+     * all. The volume may be mounted.
+     **/
+    class NtfsReadJob: public ObjDirReadJob
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor for volume 'url' that is read into the root of 'tree'.
+	 **/
+	NtfsReadJob( DirTree * tree, const QString & url );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~NtfsReadJob();
+
+	/**
+	 * Read for one time slice.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual void read() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if 'url' is an NTFS volume.
+	 **/
+	static bool isNtfsUrl( const QString & url );
+
+	/**
+	 * Return the name of the device or image file of 'url'.
+	 **/
+	static QString volumeName( const QString & url );
+
+    protected slots:
+
+	/**
+	 * Notification that 'child' is about to be deleted from the tree.
+	 **/
+	void treeDeletingChild( FileInfo * child );
+
+    protected:
+
+	NtfsMftReader * _reader;
+
+    };	// class NtfsReadJob
+
+
+
+    /**
+     * Read job that imports what other tools already know about a
+     * filesystem instead of scanning it: An ncdu JSON export
+     * (NCDU_URL_PREFIX "ncdu:/tmp/export.json") or a file list from the
+     * policy engine of GPFS or Lustre or from find(1) (FILE_LIST_URL_PREFIX
+     * "filelist:/tmp/list"). Like a CacheReadJob, this does not touch the
+     * filesystem itself at all (see ImportReader).
+     **/
+    class ImportReadJob: public ObjDirReadJob
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor for import URL 'url' that is read into the root of
+	 * 'tree'.
+	 **/
+	ImportReadJob( DirTree * tree, const QString & url );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~ImportReadJob();
+
+	/**
+	 * Read for one time slice.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual void read() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if 'url' is a file to import.
+	 **/
+	static bool isImportUrl( const QString & url );
+
+    protected slots:
+
+	/**
+	 * Notification that 'child' is about to be deleted from the tree.
+	 **/
+	void treeDeletingChild( FileInfo * child );
+
+    protected:
+
+	ImportReader * _reader;
+
+    };	// class ImportReadJob
+
+
+
     /**
      * Queue for read jobs
      *
@@ -459,6 +1196,13 @@ namespace QDirStat
 	 **/
 	void unblock( DirReadJob * job );
 
+	/**
+	 * Move a job that is in the queue back to the list of blocked jobs,
+	 * e.g. because it processed everything that an external process sent
+	 * so far. unblock() schedules it again.
+	 **/
+	void block( DirReadJob * job );
+
 	/**
 	 * Clear the queue: Remove all pending jobs from the queue and destroy
 	 * them.
@@ -475,6 +1219,12 @@ namespace QDirStat
 	 **/
 	void killAll( DirInfo * subtree, DirReadJob * exceptJob = 0 );
 
+	/**
+	 * Move all jobs for a subtree to the front of the queue so they are
+	 * processed before any others.
+	 **/
+	void prioritize( DirInfo * subtree );
+
 	/**
 	 * Notification that a job is finished.
 	 * This takes that job out of the queue and deletes it.
@@ -482,6 +1232,115 @@ namespace QDirStat
 	 **/
 	void jobFinishedNotify( DirReadJob *job );
 
+	/**
+	 * Set the number of worker threads that read directories in the
+	 * background. 0 means to read everything in the main thread.
+	 *
+	 * Even with worker threads, all FileInfo / DirInfo nodes are
+	 * created and inserted into the tree in the main thread; the workers
+	 * only do the system calls (opendir(), readdir(), lstat()), which is
+	 * where the time goes for large trees, in particular on network
+	 * filesystems and fast SSDs that can handle many parallel requests.
+	 *
+	 * The worker threads are shared with the queues of other trees (see
+	 * ReadScheduler).
+	 **/
+	void setWorkerThreads( int threads );
+
+	/**
+	 * Return the number of worker threads. 0 means to read everything in
+	 * the main thread.
+	 **/
+	int workerThreads() const { return _workerThreads; }
+
+	/**
+	 * Set the maximum number of prefetches running at the same time for
+	 * one device on rotational disks. Those suffer badly from seeking
+	 * back and forth between parallel requests, so this should be small.
+	 *
+	 * This limit is shared by the queues of all trees (see
+	 * ReadScheduler).
+	 **/
+	void setRotationalDiskConcurrency( int concurrency )
+	    { ReadScheduler::instance()->setRotationalDiskConcurrency( concurrency ); }
+
+	/**
+	 * Return the maximum number of prefetches for one rotational disk.
+	 **/
+	int rotationalDiskConcurrency() const
+	    { return ReadScheduler::instance()->rotationalDiskConcurrency(); }
+
+	/**
+	 * Set the maximum number of prefetches running at the same time for
+	 * one network mount (NFS, Samba / CIFS, sshfs) so one server is not
+	 * flooded with requests. Like the one for rotational disks, this is
+	 * shared by all queues.
+	 **/
+	void setNetworkMountConcurrency( int concurrency )
+	    { ReadScheduler::instance()->setNetworkMountConcurrency( concurrency ); }
+
+	/**
+	 * Return the maximum number of prefetches for one network mount.
+	 **/
+	int networkMountConcurrency() const
+	    { return ReadScheduler::instance()->networkMountConcurrency(); }
+
+	/**
+	 * Return the maximum number of reads that may be running at the same
+	 * time on the device of 'item': Fewer for rotational disks and
+	 * network mounts. Other I/O in worker threads, e.g. reading file
+	 * contents, should also stick to this.
+	 **/
+	int deviceConcurrency( FileInfo * item )
+	    { return ReadScheduler::instance()->deviceConcurrency( item ); }
+
+	/**
+	 * Return the ID of this queue for the ReadScheduler.
+	 **/
+	qulonglong schedulerClient() const { return _schedulerClient; }
+
+	/**
+	 * Notification from the ReadScheduler that prefetch slots became
+	 * free: Continue reading if there is anything to do.
+	 **/
+	void resume();
+
+	/**
+	 * Set the time budget for each time slice of reading in the main
+	 * thread: timeSlicedRead() processes jobs until that time is used up
+	 * and only then returns to the event loop. 0 means to process only
+	 * one job per time slice.
+	 **/
+	void setTimeBudget( int millisec ) { _timeBudgetMillisec = qMax( 0, millisec ); }
+
+	/**
+	 * Return the time budget for each time slice in milliseconds.
+	 **/
+	int timeBudget() const { return _timeBudgetMillisec; }
+
+	/**
+	 * Enable or disable elevator ordering: Instead of in the order they
+	 * were queued, read the directories in one sweep in ascending order
+	 * of their (device, i-number) and then start over with the lowest
+	 * one. Since most filesystems allocate i-nodes roughly in disk order,
+	 * this saves a lot of seeking on rotational disks.
+	 *
+	 * This only affects reading in the main thread (no worker threads),
+	 * and prioritize() has no effect while this is enabled.
+	 **/
+	void setElevatorOrder( bool enable );
+
+	/**
+	 * Return 'true' if elevator ordering is enabled.
+	 **/
+	bool elevatorOrder() const { return _elevatorOrder; }
+
+	/**
+	 * Return the performance counters of the current or the last read.
+	 **/
+	const ScanStats & scanStats() const { return _scanStats; }
+	ScanStats & scanStats() { return _scanStats; }
+
 
     signals:
 
@@ -525,9 +1384,85 @@ namespace QDirStat
 
     protected:
 
-	QList<DirReadJob *>  _queue;
+	/**
+	 * Start prefetching for as many of the first jobs in the queue as
+	 * the worker threads can handle and return the first job that is
+	 * ready to be processed in the main thread, or 0 if there is none.
+	 **/
+	DirReadJob * nextReadyJob();
+
+	/**
+	 * Return the next job to be processed in the main thread if no worker
+	 * threads are used: The head of the queue or, in elevator order, the
+	 * job with the next higher (device, i-number).
+	 **/
+	DirReadJob * nextJob();
+
+	/**
+	 * Return how many jobs nextReadyJob() looks at: Jobs for a device
+	 * that is already busy are skipped, so this needs to be somewhat
+	 * more than the prefetches that may be running at the same time.
+	 **/
+	int maxLookahead() const { return 8 * _workerThreads; }
+
+	/**
+	 * Return the device number of the directory of 'job'.
+	 **/
+	static dev_t jobDevice( DirReadJob * job );
+
+
+	/**
+	 * Remove 'job' from the queue and from the indexes, but don't delete
+	 * it. Return 'true' if it was in the queue.
+	 **/
+	bool removeFromQueue( DirReadJob * job );
+
+	/**
+	 * Add all queued jobs for 'dir' and its subdirectories to 'jobs'.
+	 * This uses the pending read jobs counters of the DirInfo nodes to
+	 * descend only into subtrees that actually have any jobs.
+	 **/
+	void collectJobs( DirInfo * dir, QList<DirReadJob *> & jobs ) const;
+
+
+	typedef QLinkedList<DirReadJob *> JobList;
+
+	typedef QPair<dev_t, ino_t> ElevatorKey;
+
+	struct QueuePos
+	{
+	    JobList::iterator pos;
+	    DirInfo *	      dir;	// The job's directory when it was queued
+	    ElevatorKey	      elevatorKey;
+	};
+
+	JobList		     _queue;
 	QList<DirReadJob *>  _blocked;
+
+	// Indexes for the queue so jobs can be removed without searching the
+	// whole queue.
+	//
+	// Don't use foreach() on _queue: It makes a copy of the list, and if
+	// the queue is modified while that copy exists, it is detached, and
+	// the iterators in _queuePos become invalid.
+
+	QHash<DirReadJob *, QueuePos>	    _queuePos;
+	QMultiHash<DirInfo *, DirReadJob *> _jobsByDir;
+
+	// Jobs with a known i-number sorted by (device, i-number) for
+	// elevator ordering, and the current elevator position
+
+	QMultiMap<ElevatorKey, DirReadJob *> _elevator;
+	ElevatorKey			     _elevatorPos;
+	DirReadJob *			     _currentJob;
+	bool				     _elevatorOrder;
+
 	QTimer		     _timer;
+	qulonglong	     _schedulerClient;
+	int		     _workerThreads;
+	int		     _timeBudgetMillisec;
+
+	ScanStats	     _scanStats;
     };
 
 
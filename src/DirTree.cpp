@@ -7,35 +7,225 @@
  */
 
 
+#include <QAtomicInt>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QRunnable>
+#include <QThread>
 
 #include "DirTree.h"
 #include "DirTreeCache.h"
+#include "ColumnarExporter.h"
 #include "DirTreeFilter.h"
+#include "DirTreeDiff.h"
+#include "SizeHistory.h"
 #include "DotEntry.h"
 #include "Attic.h"
 #include "FileInfoIterator.h"
 #include "FileInfoSet.h"
+#include "FileTypeIndex.h"
 #include "ExcludeRules.h"
 #include "PkgReader.h"
+#include "RemoteAgent.h"
 #include "MountPoints.h"
+#include "BulkInodeStat.h"
+#include "NodePool.h"
+#include "SubtreeSpiller.h"
+#include "ReadScheduler.h"
+#include "Settings.h"
 #include "Exception.h"
 
 #define VERBOSE_EXCLUDE_RULES	1
 
+// Maximum number of names in the name pool. When that is reached, the pool
+// starts over; names that are really common are back in no time.
+#define NAME_POOL_MAX_SIZE	( 256 * 1024 )
+
+// Name of the toplevel directory for readCaches()
+#define CACHES_TOPLEVEL_NAME	"Caches:"
+
+// Time slice for freeing deleted subtrees in the background
+#define REAPER_MILLISEC		20
+
+// Deleted subtrees with more items than this are not subtracted from the
+// file type index one by one; the index is just dropped.
+#define MAX_INDEX_UPDATE_ITEMS	100000
+
+// recalc() hands out this many subtrees per thread, so the threads stay busy
+// no matter how different the sizes of the subtrees are
+#define RECALC_SUBTREES_PER_THREAD	4
+
+// Evicting sort caches leaves them at this percentage of their limit, so
+// this does not happen again with the next few sorted directories
+#define SORT_CACHE_TARGET_PERCENT	75
+
+
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * Recalculate the sums of all directories in 'subtree' (including dot
+     * entries and attics), each one after everything below it, so none of
+     * them recalculates its children again on the way. This uses a list
+     * instead of recursion, so a deep tree can't overflow the stack.
+     **/
+    void recalcSubtree( DirInfo * subtree )
+    {
+	// Every directory ends up in this list before its descendants, so
+	// going backwards visits the descendants first
+
+	QVector<DirInfo *> dirs;
+	dirs << subtree;
+
+	for ( int i = 0; i < dirs.size(); ++i )
+	{
+	    DirInfo * dir = dirs.at( i );
+
+	    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+	    {
+		if ( child->isDirInfo() )
+		    dirs << child->toDirInfo();
+	    }
+
+	    if ( dir->dotEntry() )
+		dirs << dir->dotEntry();
+
+	    if ( dir->attic() )
+		dirs << dir->attic();
+	}
+
+	for ( int i = dirs.size() - 1; i >= 0; --i )
+	    dirs.at( i )->recalc();
+    }
+
+
+    /**
+     * Recalculate the directories in 'subtree' whose summary is dirty, each
+     * one after its children, without recursion. This only descends into
+     * dirty directories: Their ancestors are marked dirty along with them.
+     **/
+    void recalcDirty( DirInfo * subtree )
+    {
+	QVector<DirInfo *> dirs;
+
+	if ( subtree->isSummaryDirty() )
+	    dirs << subtree;
+
+	for ( int i = 0; i < dirs.size(); ++i )
+	{
+	    DirInfo * dir = dirs.at( i );
+
+	    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+	    {
+		if ( child->isDirInfo() && child->toDirInfo()->isSummaryDirty() )
+		    dirs << child->toDirInfo();
+	    }
+
+	    if ( dir->dotEntry() && dir->dotEntry()->isSummaryDirty() )
+		dirs << dir->dotEntry();
+
+	    if ( dir->attic() && dir->attic()->isSummaryDirty() )
+		dirs << dir->attic();
+	}
+
+	for ( int i = dirs.size() - 1; i >= 0; --i )
+	    dirs.at( i )->recalc();
+    }
+
+
+    /**
+     * Clear the 'attic pending' flag in 'subtree'. Below a directory
+     * without that flag, no directory has it.
+     **/
+    void clearAtticPending( DirInfo * subtree )
+    {
+	QVector<DirInfo *> stack;
+	stack << subtree;
+
+	while ( ! stack.isEmpty() )
+	{
+	    DirInfo * dir = stack.takeLast();
+
+	    if ( ! dir->isAtticPending() )
+		continue;
+
+	    dir->clearAtticPending();
+
+	    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+	    {
+		if ( child->isDirInfo() )
+		    stack << child->toDirInfo();
+	    }
+	}
+    }
+
+
+    /**
+     * Recalculating subtrees in a worker thread: Each task takes the next
+     * subtree that no other task has taken yet until there are no more.
+     * The subtrees don't overlap, so the tasks never write the same
+     * directory.
+     **/
+    class RecalcTask: public QRunnable
+    {
+    public:
+
+	RecalcTask( const QVector<DirInfo *> & subtrees,
+		    QAtomicInt &	       next ):
+	    _subtrees( subtrees ),
+	    _next( next )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    int i;
+
+	    while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _subtrees.size() )
+		recalcSubtree( _subtrees.at( i ) );
+	}
+
+    private:
+
+	const QVector<DirInfo *> & _subtrees;
+	QAtomicInt &		   _next;
+    };
+
+}	// namespace
+
+
 DirTree::DirTree():
     QObject(),
+    _diff( 0 ),
+    _sizeHistory( 0 ),
+    _fileTypeIndex( 0 ),
+    _extentFinder( 0 ),
     _excludeRules( 0 ),
     _beingDestroyed( false ),
     _haveClusterSize( false ),
     _blocksPerCluster( 0 )
 {
     _isBusy	      = false;
+    _generation	      = 0;
     _crossFilesystems = false;
+    _useBulkStat      = false;
+    _btrfsSnapshotDeltas   = false;
+    _zfsPlaceholders	   = false;
+    _cacheCompressionLevel = -1;
+    _cacheLazyLoadDepth	   = 0;
+    _sampling		   = false;
+    _samplingDepth	   = 2;
+    _shadowRefresh	   = false;
+    _sharedExtents	   = false;
+    _aggregateFilesBelow   = 0;
+    _countOnly		   = false;
+    _spillLimit		   = 0;
+    _spillRetryBytes	   = 0;
+    _sortCacheRetryBytes   = 0;
+    _remoteAgentCommand	   = DEFAULT_REMOTE_AGENT_COMMAND;
+    _extentThreadPool.setMaxThreadCount( 1 );
     _root = new DirInfo( this );
     CHECK_NEW( _root );
 
@@ -44,6 +234,27 @@ DirTree::DirTree():
 
     connect( this,	  SIGNAL( deletingChild	     ( FileInfo * ) ),
 	     & _jobQueue, SLOT	( deletingChildNotify( FileInfo * ) ) );
+
+    _reaperTimer.setSingleShot( true );
+    _reaperTimer.setInterval( 0 );
+
+    connect( &_reaperTimer, SIGNAL( timeout()	 ),
+	     this,	    SLOT  ( reapDeadDirs() ) );
+
+    _spillTimer.setSingleShot( true );
+    _spillTimer.setInterval( SPILL_CHECK_DELAY_MILLISEC );
+
+    connect( &_spillTimer, SIGNAL( timeout()	     ),
+	     this,	   SLOT	 ( spillColdSubtrees() ) );
+
+    // Right after the current event: Whoever sorted the directories is done
+    // with their sorted children lists by then
+
+    _sortCacheTimer.setSingleShot( true );
+    _sortCacheTimer.setInterval( 0 );
+
+    connect( &_sortCacheTimer, SIGNAL( timeout()	 ),
+	     this,		SLOT  ( evictSortCaches() ) );
 }
 
 
@@ -51,9 +262,24 @@ DirTree::~DirTree()
 {
     _beingDestroyed = true;
 
+    foreach ( const ShadowRefresh & shadow, _shadows )
+	delete shadow.tree;
+
+    _shadows.clear();
+
+    dropDiff();
+    dropFileTypeIndex();
+    dropSharedExtents();
+
+    if ( _sizeHistory )
+	delete _sizeHistory;
+
     if ( _root )
 	delete _root;
 
+    freeDeadDirs( true );
+    NodePool::trim();
+
     if ( _excludeRules )
 	delete _excludeRules;
 
@@ -63,6 +289,10 @@ DirTree::~DirTree()
 
 void DirTree::setRoot( DirInfo *newRoot )
 {
+    ++_generation;
+    dropFileTypeIndex();
+    _hardLinkIndex.clear();
+
     if ( _root )
     {
 	emit deletingChild( _root );
@@ -98,6 +328,15 @@ QString DirTree::url() const
 void DirTree::clear()
 {
     _jobQueue.clear();
+    dropShadows();
+    dropDiff();
+    _subvolumes.clear();
+    _unreadDatasets.clear();
+    dropFileTypeIndex();
+    dropSharedExtents();
+    _hardLinkIndex.clear();
+
+    ++_generation;
 
     if ( _root )
     {
@@ -105,6 +344,10 @@ void DirTree::clear()
 	_root->clear();
     }
 
+    freeDeadDirs( true );
+    NodePool::trim();
+
+    _namePool.clear();
     _isBusy	      = false;
     _haveClusterSize  = false;
     _blocksPerCluster = 0;
@@ -133,6 +376,23 @@ void DirTree::startReading( const QString & rawUrl )
     if ( _root->hasChildren() )
 	clear();
 
+    // Bulk i-node statistics always cover the complete filesystem, so they
+    // only pay off if that is what is being scanned.
+
+    bool bulkStat = _useBulkStat && mountPoint && mountPoint->path() == _url &&
+	( mountPoint->isXfs() || mountPoint->isBtrfs() );
+
+    BulkInodeStat::clear();
+    LocalDirReader::setUseBulkStat( bulkStat );
+
+    if ( bulkStat )
+	logInfo() << "Using bulk i-node statistics for " << _url << endl;
+
+    // The dataset properties are there long before the scan is done
+
+    if ( MountPoints::hasZfs() )
+	ZfsDatasets::updateCacheAsync( this, [=]() { zfsDatasetsRead(); } );
+
     _isBusy = true;
     emit startingReading();
 
@@ -185,6 +445,54 @@ void DirTree::refresh( const FileInfoSet & refreshSet )
 }
 
 
+void DirTree::refreshChanged( const FileInfoSet & refreshSet )
+{
+    FileInfoSet items = refreshSet.invalidRemoved().normalized();
+
+    foreach ( FileInfo * item, items )
+    {
+	if ( item && item->checkMagicNumber() )
+	{
+	    if( item->isDirInfo() )
+		refreshChanged( item->toDirInfo() );
+	    else if ( item->parent() )
+		refreshChanged( item->parent() );
+	}
+    }
+}
+
+
+void DirTree::refreshChanged( DirInfo * subtree )
+{
+    if ( ! _root || ! subtree )
+	return;
+
+    if ( ! subtree->checkMagicNumber() )
+    {
+	logWarning() << "Item is no longer valid - not refreshing subtree" << endl;
+	return;
+    }
+
+    if ( subtree->isDotEntry() )
+	subtree = subtree->parent();
+
+    if ( ! subtree || ! subtree->parent() || subtree->isPkgInfo() )
+    {
+	refresh( subtree );
+	return;
+    }
+
+    // Take the baseline before the old subtree is cleared. The subtree
+    // itself is read again in any case; its subdirectories are only read
+    // if their mtime changed.
+
+    CacheBaselinePtr baseline( new CacheBaseline( subtree ) );
+    CHECK_NEW( baseline.data() );
+
+    rereadSubtree( subtree, baseline->ok() ? baseline : CacheBaselinePtr() );
+}
+
+
 void DirTree::refresh( DirInfo * subtree )
 {
     if ( ! _root )
@@ -219,25 +527,215 @@ void DirTree::refresh( DirInfo * subtree )
     {
 	// logDebug() << "Refreshing subtree " << subtree << endl;
 
-	clearSubtree( subtree );
+	if ( _shadowRefresh && canShadowRefresh( subtree ) )
+	    startShadowRefresh( subtree );
+	else
+	    rereadSubtree( subtree, CacheBaselinePtr() );
+    }
+}
 
-	subtree->reset();
-	subtree->setExcluded( false );
 
-	_isBusy = true;
-	subtree->setReadState( DirReading );
-	emit startingReading();
-	addJob( new LocalDirReadJob( this, subtree ) );
+bool DirTree::canShadowRefresh( DirInfo * subtree ) const
+{
+    // The shadow tree reads the directory with the global settings only
+
+    if ( hasFilters() || _excludeRules || _sampling || _cacheBaseline )
+	return false;
+
+    // Packages, remote directories, cache files mounted with readCaches()
+
+    if ( subtree->isPkgInfo() || subtree->isPseudoDir() )
+	return false;
+
+    return subtree->url().startsWith( "/" );
+}
+
+
+void DirTree::startShadowRefresh( DirInfo * subtree )
+{
+    // A subtree in another one that is being read again already: Start
+    // that one over, it might have read past the changes.
+
+    foreach ( const ShadowRefresh & shadow, _shadows )
+    {
+	if ( subtree->isInSubtree( shadow.subtree ) )
+	{
+	    subtree = shadow.subtree;
+	    break;
+	}
+    }
+
+    dropShadows( subtree );
+
+    DirTree * shadowTree = new DirTree();
+    CHECK_NEW( shadowTree );
+
+    shadowTree->setCrossFilesystems( _crossFilesystems );
+    shadowTree->setCountOnly( _countOnly );
+    shadowTree->setScanThreads( scanThreads() );
+    shadowTree->jobQueue()->setRotationalDiskConcurrency( _jobQueue.rotationalDiskConcurrency() );
+    shadowTree->jobQueue()->setNetworkMountConcurrency	( _jobQueue.networkMountConcurrency()	);
+    shadowTree->jobQueue()->setTimeBudget		( _jobQueue.timeBudget()		);
+    shadowTree->jobQueue()->setElevatorOrder		( _jobQueue.elevatorOrder()		);
+
+    ShadowRefresh shadow;
+    shadow.subtree = subtree;
+    shadow.tree	   = shadowTree;
+    _shadows << shadow;
+
+    connect( shadowTree, SIGNAL( finished()	   ),
+	     this,	 SLOT  ( shadowFinished() ) );
+
+    logDebug() << "Reading " << subtree << " again in the background" << endl;
+
+    _isBusy = true;
+    emit startingReading();
+
+    // This might already send finished() if there is no such directory
+    // anymore
+
+    shadowTree->startReading( subtree->url() );
+}
+
+
+void DirTree::shadowFinished()
+{
+    DirTree * shadowTree = qobject_cast<DirTree *>( sender() );
+    DirInfo * subtree	 = 0;
+
+    for ( int i = 0; i < _shadows.size() && ! subtree; ++i )
+    {
+	if ( _shadows.at( i ).tree == shadowTree )
+	    subtree = _shadows.takeAt( i ).subtree;
+    }
+
+    if ( ! subtree )
+	return;
+
+    // Not deleting the shadow tree right away: It is still sending that
+    // signal
+
+    shadowTree->disconnect( this );
+    shadowTree->deleteLater();
+
+    FileInfo * toplevel = shadowTree->firstToplevel();
+
+    if ( ! toplevel || ! toplevel->isDirInfo() )
+    {
+	// Gone or no longer a directory: Leave that to a normal refresh. Its
+	// read job sends finished() when it is done.
+
+	rereadSubtree( subtree, CacheBaselinePtr() );
+	return;
+    }
+
+    replaceSubtree( subtree, toplevel->toDirInfo(), shadowTree );
+
+    if ( _jobQueue.isEmpty() && _shadows.isEmpty() )
+	slotFinished();
+}
+
+
+void DirTree::replaceSubtree( DirInfo * subtree, DirInfo * toplevel, DirTree * shadow )
+{
+    logDebug() << "Replacing the contents of " << subtree << endl;
+
+    emit replacingSubtree( subtree );
+
+    clearSubtree( subtree );
+
+    if ( subtree->isPendingSubtree() )
+    {
+	forgetPendingSubtree( subtree );
+	subtree->setPendingSubtree( false );
+	subtree->setEstimated( false );
+    }
+
+    subtree->setExcluded( false );
+    subtree->takeChildren( toplevel );
+
+    // The moved files were counted as hard links in the shadow tree, not
+    // in this one; the file type index would need each one of them
+
+    _hardLinkIndex.takeOver( shadow->_hardLinkIndex );
+    dropFileTypeIndex();
+    dropDiff();
+
+    sendReadJobFinished( subtree );
+    emit subtreeReplaced( subtree );
+}
+
+
+void DirTree::dropShadows( FileInfo * subtree )
+{
+    int i = 0;
+
+    while ( i < _shadows.size() )
+    {
+	const ShadowRefresh & shadow = _shadows.at( i );
+
+	if ( ! subtree || shadow.subtree->isInSubtree( subtree ) )
+	{
+	    logDebug() << "Discarding the shadow refresh of " << shadow.subtree << endl;
+
+	    shadow.tree->disconnect( this );
+	    shadow.tree->abortReading();
+	    shadow.tree->deleteLater();
+	    _shadows.removeAt( i );
+	}
+	else
+	{
+	    ++i;
+	}
+    }
+}
+
+
+void DirTree::rereadSubtree( DirInfo * subtree, CacheBaselinePtr baseline )
+{
+    clearSubtree( subtree );
+
+    if ( subtree->isPendingSubtree() )
+    {
+	forgetPendingSubtree( subtree );
+	subtree->setPendingSubtree( false );
+	subtree->setEstimated( false );
     }
+
+    // Not worthwhile for a subtree, and the data from the last complete
+    // scan are outdated
+
+    BulkInodeStat::clear();
+    LocalDirReader::setUseBulkStat( false );
+
+    subtree->reset();
+    subtree->setExcluded( false );
+
+    _isBusy = true;
+    subtree->setReadState( DirReading );
+    emit startingReading();
+
+    LocalDirReadJob * job = new LocalDirReadJob( this, subtree );
+    CHECK_NEW( job );
+
+    if ( baseline )
+	job->setBaseline( baseline );
+
+    addJob( job );
 }
 
 
 void DirTree::abortReading()
 {
-    if ( _jobQueue.isEmpty() )
+    if ( _jobQueue.isEmpty() && _shadows.isEmpty() )
 	return;
 
-    _jobQueue.abort();
+    dropShadows();
+
+    if ( ! _jobQueue.isEmpty() )
+	_jobQueue.abort();
+
+    _namePool.clear();
 
     _isBusy = false;
     emit aborted();
@@ -248,38 +746,101 @@ void DirTree::finalizeTree()
 {
     if ( _root && hasFilters() )
     {
-	recalc( _root );
-	ignoreEmptyDirs( _root );
-	recalc( _root );
+	++_generation;
+	dropFileTypeIndex();	// Files are moving to the attic
 	moveIgnoredToAttic( _root );
-	recalc( _root );
     }
 }
 
 
 void DirTree::slotFinished()
 {
+    if ( ! _shadows.isEmpty() )	// Still reading again for a refresh
+	return;
+
+    if ( startDeferredSubvolumes() ) // Snapshots waiting for another one
+	return;
+
+    _namePool.clear();
     finalizeTree();
+    startSharedExtents();
     _isBusy = false;
     emit finished();
 }
 
 
+void DirTree::prioritize( FileInfo * item )
+{
+    if ( ! _isBusy || ! item )
+	return;
+
+    DirInfo * dir = item->isDirInfo() ? item->toDirInfo() : item->parent();
+
+    while ( dir && ( dir->isDotEntry() || dir->isAttic() ) )
+	dir = dir->parent();
+
+    // Prioritizing the toplevel directory would just shuffle the complete
+    // queue around for nothing
+
+    if ( ! dir || dir == _root || dir->parent() == _root )
+	return;
+
+    _jobQueue.prioritize( dir );
+}
+
+
+QString DirTree::internName( const QString & name )
+{
+    QSet<QString>::const_iterator it = _namePool.constFind( name );
+
+    if ( it != _namePool.constEnd() )
+	return *it;
+
+    if ( _namePool.size() >= NAME_POOL_MAX_SIZE )
+	_namePool.clear();
+
+    _namePool.insert( name );
+
+    return name;
+}
+
+
 void DirTree::childAddedNotify( FileInfo * newChild )
 {
     if ( ! _haveClusterSize )
         detectClusterSize( newChild );
 
+    ++_generation;
+
+    if ( _fileTypeIndex )
+	_fileTypeIndex->add( newChild );
+
+    QElapsedTimer notifyTime;
+    notifyTime.start();
+
     emit childAdded( newChild );
 
     if ( newChild->dotEntry() )
 	emit childAdded( newChild->dotEntry() );
+
+    _jobQueue.scanStats().addNotifyTime( notifyTime.nsecsElapsed() );
 }
 
 
 void DirTree::deletingChildNotify( FileInfo * deletedChild )
 {
     logDebug() << "Deleting child " << deletedChild << endl;
+
+    dropDiff();
+    dropShadows( deletedChild );
+
+    if ( deletedChild->isDirInfo() && deletedChild->totalItems() > MAX_INDEX_UPDATE_ITEMS )
+	dropFileTypeIndex();
+    else
+	forgetFileTypes( deletedChild );
+
+    _hardLinkIndex.remove( deletedChild );
+    ++_generation;
     emit deletingChild( deletedChild );
 
     if ( deletedChild == _root )
@@ -343,31 +904,86 @@ void DirTree::deleteSubtree( FileInfo *subtree )
 	parent->deletingChild( subtree );
     }
 
-    delete subtree;
-
     if ( subtree == _root )
     {
 	_root = 0;
     }
 
-    emit childDeleted();
-}
-
+    if ( subtree->isDirInfo() && ! _beingDestroyed )
+    {
+	// Nothing can reach the subtree anymore: Free its nodes in the
+	// background. They keep their memory until then, so no new node
+	// can get the address of a dead one.
 
-void DirTree::clearSubtree( DirInfo * subtree )
-{
-    if ( subtree->hasChildren() )
+	subtree->setParent( 0 );
+	_deadDirs << subtree->toDirInfo();
+	_reaperTimer.start();
+    }
+    else
     {
-	emit clearingSubtree( subtree );
-	subtree->clear();
-	emit subtreeCleared( subtree );
+	delete subtree;
     }
+
+    emit childDeleted();
 }
 
 
-void DirTree::addJob( DirReadJob * job )
+void DirTree::reapDeadDirs()
 {
-    _jobQueue.enqueue( job );
+    freeDeadDirs( false );
+}
+
+
+void DirTree::freeDeadDirs( bool all )
+{
+    if ( _deadDirs.isEmpty() )
+	return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while ( ! _deadDirs.isEmpty() && ( all || timer.elapsed() < REAPER_MILLISEC ) )
+    {
+	// One directory at a time, without its subdirectories: Those are
+	// freed later.
+
+	DirInfo * dir = _deadDirs.takeLast();
+	dir->takeSubDirs( _deadDirs );
+	delete dir;
+    }
+
+    if ( _deadDirs.isEmpty() )
+    {
+	_reaperTimer.stop();
+	NodePool::trim();
+    }
+    else
+    {
+	_reaperTimer.start();
+    }
+}
+
+
+void DirTree::clearSubtree( DirInfo * subtree )
+{
+    if ( subtree->hasChildren() )
+    {
+	dropDiff();
+	dropShadows( subtree );
+	forgetFileTypes( subtree );
+	_hardLinkIndex.remove( subtree );
+	++_generation;
+	emit clearingSubtree( subtree );
+	subtree->clear();
+	NodePool::trim();
+	emit subtreeCleared( subtree );
+    }
+}
+
+
+void DirTree::addJob( DirReadJob * job )
+{
+    _jobQueue.enqueue( job );
 }
 
 
@@ -392,6 +1008,7 @@ void DirTree::sendStartingReading()
 void DirTree::sendFinished()
 {
     finalizeTree();
+    startSharedExtents();
     _isBusy = false;
     emit finished();
 }
@@ -413,7 +1030,96 @@ void DirTree::sendStartingReading( DirInfo * dir )
 void DirTree::sendReadJobFinished( DirInfo * dir )
 {
     // logDebug() << dir << endl;
+    ++_generation;
+
+    // Package files are added without a childAddedNotify()
+
+    if ( dir && dir->isPkgInfo() )
+	dropFileTypeIndex();
+
+    QElapsedTimer notifyTime;
+    notifyTime.start();
+
     emit readJobFinished( dir );
+
+    _jobQueue.scanStats().addNotifyTime( notifyTime.nsecsElapsed() );
+
+    // Not right away: Whoever loaded a pending subtree might want to show
+    // it first
+
+    FileSize liveBytes = NodePool::liveBytes();
+
+    if ( _spillLimit > 0 && liveBytes > qMax( _spillLimit, _spillRetryBytes ) && ! _spillTimer.isActive() )
+	_spillTimer.start();
+}
+
+
+bool DirTree::keepLoaded( DirInfo * dir )
+{
+    bool keep = false;
+    emit checkingSpill( dir, &keep );
+
+    return keep;
+}
+
+
+void DirTree::scheduleSortCacheEviction()
+{
+    qint64 bytes = DirInfo::sortCacheBytes();
+    qint64 limit = DirInfo::sortCacheLimit();
+
+    if ( limit > 0 && bytes > qMax( limit, _sortCacheRetryBytes ) && ! _sortCacheTimer.isActive() )
+	_sortCacheTimer.start();
+}
+
+
+void DirTree::evictSortCaches()
+{
+    qint64 bytes = DirInfo::sortCacheBytes();
+    qint64 limit = DirInfo::sortCacheLimit();
+
+    if ( limit <= 0 || bytes <= limit )
+	return;
+
+    int count = DirInfo::evictSortCaches( limit / 100 * SORT_CACHE_TARGET_PERCENT );
+
+    logDebug() << "Dropped the sort caches of " << count << " directories; "
+	       << formatSize( bytes ) << " -> " << formatSize( DirInfo::sortCacheBytes() )
+	       << endl;
+
+    // If the views use everything, don't try again for each sorted
+    // directory
+
+    if ( DirInfo::sortCacheBytes() > limit )
+	_sortCacheRetryBytes = DirInfo::sortCacheBytes() + limit / 100 * ( 100 - SORT_CACHE_TARGET_PERCENT );
+    else
+	_sortCacheRetryBytes = 0;
+}
+
+
+void DirTree::spillColdSubtrees()
+{
+    FileSize liveBytes = NodePool::liveBytes();
+
+    if ( _spillLimit <= 0 || liveBytes <= _spillLimit )
+	return;
+
+    logInfo() << "The nodes use " << formatSize( liveBytes )
+	      << "; spilling cold subtrees to disk" << endl;
+
+    SubtreeSpiller spiller( this );
+
+    if ( spiller.spill( _spillLimit / 100 * SPILL_TARGET_PERCENT ) > 0 )
+    {
+	_spillRetryBytes = 0;
+	emit subtreesSpilled();
+    }
+    else
+    {
+	// Everything is in use: Don't try again for each new directory
+
+	_spillRetryBytes = liveBytes + _spillLimit / 100 * ( 100 - SPILL_TARGET_PERCENT );
+    }
 }
 
 
@@ -435,18 +1141,792 @@ FileInfo * DirTree::locate( QString url, bool findPseudoDirs )
 }
 
 
+void DirTree::readSettings()
+{
+    Settings settings;
+    settings.beginGroup( "DirectoryTree" );
+
+    setCrossFilesystems		  ( settings.value( "CrossFilesystems",		 false	   ).toBool() );
+    setScanThreads		  ( settings.value( "ScanThreads",		 0	   ).toInt()  );
+    FileInfo::setIgnoreHardLinks  ( settings.value( "IgnoreHardLinks",		 false	   ).toBool() );
+    LocalDirReader::setUseIoUring ( settings.value( "UseIoUring",		 false	   ).toBool() );
+    LocalDirReader::setStatxDontSync( settings.value( "StatxDontSync",		 false	   ).toBool() );
+    LocalDirReader::setResolveSymLinks( settings.value( "ResolveSymLinks",	 false	   ).toBool() );
+    LocalDirReader::setChunkSize  ( settings.value( "ReadChunkSize",		 64 * 1024 ).toInt()  );
+    setUseBulkStat		  ( settings.value( "UseBulkStat",		 false	   ).toBool() );
+    setBtrfsSnapshotDeltas	  ( settings.value( "BtrfsSnapshotDeltas",	 false	   ).toBool() );
+    setZfsPlaceholders		  ( settings.value( "ZfsPlaceholders",		 false	   ).toBool() );
+    setCacheCompressionLevel	  ( settings.value( "CacheCompressionLevel",	 -1	   ).toInt()  );
+    setCacheLazyLoadDepth	  ( settings.value( "CacheLazyLoadDepth",	 0	   ).toInt()  );
+    CacheReader::setValidateTotals( settings.value( "ValidateCacheTotals",	 false	   ).toBool() );
+    CacheZstdDictionary::load	  ( settings.value( "CacheZstdDictionary",	 ""	   ).toString() );
+    setSamplingDepth		  ( settings.value( "SamplingDepth",		 2	   ).toInt()  );
+    setShadowRefresh		  ( settings.value( "ShadowRefresh",		 false	   ).toBool() );
+    setSharedExtents		  ( settings.value( "SharedExtents",		 false	   ).toBool() );
+    setAggregateFilesBelow	  ( settings.value( "AggregateFilesBelow",	 0	   ).toInt() );
+    setCountOnly		  ( settings.value( "CountOnly",		 false	   ).toBool() );
+    setSpillLimit		  ( settings.value( "SpillAboveMB",		 0	   ).toInt() * 1024LL * 1024 );
+    DirInfo::setSortCacheLimit	  ( settings.value( "SortCacheLimitMB",		 64	   ).toInt() * 1024LL * 1024 );
+    setRemoteAgentCommand	  ( settings.value( "RemoteAgentCommand",	 DEFAULT_REMOTE_AGENT_COMMAND ).toString() );
+
+    _jobQueue.setRotationalDiskConcurrency( settings.value( "RotationalDiskConcurrency", 2  ).toInt() );
+    _jobQueue.setNetworkMountConcurrency  ( settings.value( "NetworkMountConcurrency",   4  ).toInt() );
+    _jobQueue.setTimeBudget		  ( settings.value( "ReadTimeBudgetMillisec",    10 ).toInt() );
+    _jobQueue.setElevatorOrder		  ( settings.value( "ElevatorOrder",	     false ).toBool() );
+
+    // Polite mode and its limits apply to the read queues of all trees
+
+    ReadScheduler * scheduler = ReadScheduler::instance();
+    scheduler->setMaxStatRate ( settings.value( "PoliteMaxStatRate",	     0	   ).toInt()  );
+    scheduler->setBusyLatency ( settings.value( "PoliteBusyLatencyMillisec", 10	   ).toInt()  );
+    scheduler->setPoliteMode  ( settings.value( "PoliteScan",		     false ).toBool() );
+    scheduler->setNumaPlacement( settings.value( "NumaPlacement",	     true  ).toBool() );
+
+    settings.endGroup();
+}
+
+
+void DirTree::writeSettings()
+{
+    Settings settings;
+    settings.beginGroup( "DirectoryTree" );
+
+    settings.setDefaultValue( "CrossFilesystems",	   crossFilesystems()			 );
+    settings.setDefaultValue( "ScanThreads",		   scanThreads()			 );
+    settings.setDefaultValue( "IgnoreHardLinks",	   FileInfo::ignoreHardLinks()		 );
+    settings.setDefaultValue( "UseIoUring",		   LocalDirReader::useIoUring()		 );
+    settings.setDefaultValue( "StatxDontSync",		   LocalDirReader::statxDontSync()	 );
+    settings.setDefaultValue( "ResolveSymLinks",	   LocalDirReader::resolveSymLinks()	 );
+    settings.setDefaultValue( "ReadChunkSize",		   LocalDirReader::chunkSize()		 );
+    settings.setDefaultValue( "UseBulkStat",		   useBulkStat()			 );
+    settings.setDefaultValue( "BtrfsSnapshotDeltas",	   btrfsSnapshotDeltas()		 );
+    settings.setDefaultValue( "ZfsPlaceholders",	   zfsPlaceholders()			 );
+    settings.setDefaultValue( "CacheCompressionLevel",	   cacheCompressionLevel()		 );
+    settings.setDefaultValue( "CacheLazyLoadDepth",	   cacheLazyLoadDepth()			 );
+    settings.setDefaultValue( "ValidateCacheTotals",	   CacheReader::validateTotals()	 );
+    settings.setDefaultValue( "CacheZstdDictionary",	   CacheZstdDictionary::fileName()	 );
+    settings.setDefaultValue( "SamplingDepth",		   samplingDepth()			 );
+    settings.setDefaultValue( "ShadowRefresh",		   shadowRefresh()			 );
+    settings.setDefaultValue( "SharedExtents",		   sharedExtents()			 );
+    settings.setDefaultValue( "AggregateFilesBelow",	   (int) aggregateFilesBelow()		 );
+    settings.setDefaultValue( "CountOnly",		   countOnly()				 );
+    settings.setDefaultValue( "SpillAboveMB",		   (int) ( spillLimit() / ( 1024 * 1024 ) ) );
+    settings.setDefaultValue( "SortCacheLimitMB",	   (int) ( DirInfo::sortCacheLimit() / ( 1024 * 1024 ) ) );
+    settings.setDefaultValue( "RemoteAgentCommand",	   remoteAgentCommand()			 );
+    settings.setDefaultValue( "RotationalDiskConcurrency", _jobQueue.rotationalDiskConcurrency() );
+    settings.setDefaultValue( "NetworkMountConcurrency",   _jobQueue.networkMountConcurrency()	 );
+    settings.setDefaultValue( "ReadTimeBudgetMillisec",    _jobQueue.timeBudget()		 );
+    settings.setDefaultValue( "ElevatorOrder",		   _jobQueue.elevatorOrder()		 );
+    settings.setDefaultValue( "PoliteScan",		   ReadScheduler::instance()->politeMode()  );
+    settings.setDefaultValue( "PoliteMaxStatRate",	   ReadScheduler::instance()->maxStatRate() );
+    settings.setDefaultValue( "PoliteBusyLatencyMillisec", ReadScheduler::instance()->busyLatency() );
+    settings.setDefaultValue( "NumaPlacement",		   ReadScheduler::instance()->numaPlacement() );
+
+    settings.endGroup();
+}
+
+
 bool DirTree::writeCache( const QString & cacheFileName )
 {
-    CacheWriter writer( cacheFileName.toUtf8(), this );
+    if ( cacheFileName.endsWith( COLUMNAR_EXPORT_SUFFIX ) )
+    {
+	ColumnarExporter exporter( cacheFileName, this );
+	return exporter.ok();
+    }
+
+    bool binary = cacheFileName.endsWith( BINARY_CACHE_SUFFIX );
+    CacheWriter writer( cacheFileName.toUtf8(), this, binary, _cacheCompressionLevel );
+    return writer.ok();
+}
+
+
+bool DirTree::writeCacheDelta( const QString &	   deltaFileName,
+			       const QString &	   baseFileName,
+			       const QStringList & baseDeltaFileNames )
+{
+    // Read the base right away into a tree of its own: It is only needed
+    // for comparing.
+
+    DirTree baseTree;
+
+    if ( ! baseTree.readCacheNow( baseFileName, baseDeltaFileNames ) )
+    {
+	logError() << "Can't use " << baseFileName << " as the base of " << deltaFileName << endl;
+	return false;
+    }
+
+    CacheWriter writer( deltaFileName, this, &baseTree, _cacheCompressionLevel );
     return writer.ok();
 }
 
 
-void DirTree::readCache( const QString & cacheFileName )
+bool DirTree::readCacheNow( const QString &	cacheFileName,
+			    const QStringList & deltaFileNames )
+{
+    QStringList fileNames = QStringList() << cacheFileName << deltaFileNames;
+    DirInfo * toplevel = 0;
+
+    for ( int i = 0; i < fileNames.size(); ++i )
+    {
+	CacheReader reader( fileNames.at( i ), this, toplevel );
+
+	if ( ! reader.ok() || reader.isDelta() != ( i > 0 ) )
+	{
+	    logError() << "Can't read " << fileNames.at( i ) << endl;
+	    return false;
+	}
+
+	reader.setFinalizeTree( i == fileNames.size() - 1 );
+	reader.read();
+	toplevel = reader.toplevel();
+    }
+
+    return true;
+}
+
+
+void DirTree::readCache( const QString &     cacheFileName,
+			 const QStringList & deltaFileNames )
+{
+    _isBusy = true;
+    emit startingReading();
+    addJob( new CacheReadJob( this, 0, cacheFileName, deltaFileNames ) );
+}
+
+
+void DirTree::readCaches( const QStringList & cacheFileNames )
+{
+    _isBusy = true;
+    emit startingReading();
+
+    // Just like the packages in the pkg view, all mount directories are
+    // there right away, so the views know them before any of them is read.
+
+    DirInfo * top = new DirInfo( this, _root, CACHES_TOPLEVEL_NAME, S_IFDIR | 0755, 0, 0 );
+    CHECK_NEW( top );
+    _root->insertChild( top );
+
+    QSet<QString> names;
+
+    foreach ( const QString & fileName, cacheFileNames )
+    {
+	QString name = cacheMountName( fileName );
+	QString uniqueName = name;
+
+	for ( int i = 2; names.contains( uniqueName ); ++i )
+	    uniqueName = QString( "%1 (%2)" ).arg( name ).arg( i );
+
+	names.insert( uniqueName );
+
+	DirInfo * dir = new DirInfo( this, top, uniqueName, S_IFDIR | 0755, 0, 0 );
+	CHECK_NEW( dir );
+	dir->setReadState( DirReading );
+	top->insertChild( dir );
+
+	addJob( new CacheReadJob( this, fileName, dir ) );
+    }
+
+    top->setReadState( DirFinished );
+    top->finalizeLocal();
+}
+
+
+void DirTree::readRemote( const QString & url )
+{
+    _url = url;
+    logInfo() << "   url: \"" << _url << "\"" << endl;
+
+    _isBusy = true;
+    emit startingReading();
+
+    // The job is blocked until the remote agent sends something
+
+    RemoteReadJob * job = new RemoteReadJob( this, url );
+    CHECK_NEW( job );
+    addBlockedJob( job );
+    job->start( _remoteAgentCommand );
+}
+
+
+void DirTree::readExt4Image( const QString & url )
+{
+    _url = url;
+    logInfo() << "   url: \"" << _url << "\"" << endl;
+
+    _isBusy = true;
+    emit startingReading();
+
+    Ext4ReadJob * job = new Ext4ReadJob( this, url );
+    CHECK_NEW( job );
+    addJob( job );
+}
+
+
+void DirTree::readNtfsVolume( const QString & url )
+{
+    _url = url;
+    logInfo() << "   url: \"" << _url << "\"" << endl;
+
+    _isBusy = true;
+    emit startingReading();
+
+    NtfsReadJob * job = new NtfsReadJob( this, url );
+    CHECK_NEW( job );
+    addJob( job );
+}
+
+
+void DirTree::readImport( const QString & url )
+{
+    _url = url;
+    logInfo() << "   url: \"" << _url << "\"" << endl;
+
+    _isBusy = true;
+    emit startingReading();
+
+    ImportReadJob * job = new ImportReadJob( this, url );
+    CHECK_NEW( job );
+    addJob( job );
+}
+
+
+QString DirTree::cacheMountName( const QString & cacheFileName )
+{
+    // "myhost.cache.gz" -> "myhost"
+
+    QString name = QFileInfo( cacheFileName ).fileName();
+    QStringList suffixes;
+    suffixes << ".gz" << ZSTD_CACHE_SUFFIX << BINARY_CACHE_SUFFIX << ".cache";
+
+    foreach ( const QString & suffix, suffixes )
+    {
+	if ( name.endsWith( suffix ) && name.size() > suffix.size() )
+	    name.chop( suffix.size() );
+    }
+
+    return name;
+}
+
+
+bool DirTree::compareWithCache( const QString &	   cacheFileName,
+				const QStringList & deltaFileNames )
+{
+    clearDiff();
+
+    DirTreeDiff * diff = new DirTreeDiff( this );
+    CHECK_NEW( diff );
+
+    if ( ! diff->compareWithCache( cacheFileName, deltaFileNames ) )
+    {
+	delete diff;
+	return false;
+    }
+
+    _diff = diff;
+    emit diffChanged();
+
+    return true;
+}
+
+
+void DirTree::clearDiff()
+{
+    if ( ! _diff )
+	return;
+
+    dropDiff();
+    emit diffChanged();
+}
+
+
+bool DirTree::loadSizeHistory( const QString & fileName )
+{
+    SizeHistory * history = new SizeHistory();
+    CHECK_NEW( history );
+
+    if ( ! history->load( fileName ) )
+    {
+	delete history;
+	return false;
+    }
+
+    if ( _sizeHistory )
+	delete _sizeHistory;
+
+    _sizeHistory = history;
+    emit sizeHistoryChanged();
+
+    return true;
+}
+
+
+void DirTree::clearSizeHistory()
+{
+    if ( ! _sizeHistory )
+	return;
+
+    delete _sizeHistory;
+    _sizeHistory = 0;
+    emit sizeHistoryChanged();
+}
+
+
+FileTypeIndex * DirTree::fileTypeIndex()
+{
+    if ( _fileTypeIndex && ! _fileTypeIndex->isCurrent() )
+	dropFileTypeIndex();
+
+    if ( ! _fileTypeIndex && _root )
+    {
+	_fileTypeIndex = new FileTypeIndex( _root );
+	CHECK_NEW( _fileTypeIndex );
+    }
+
+    return _fileTypeIndex;
+}
+
+
+void DirTree::forgetFileTypes( FileInfo * subtree )
+{
+    if ( ! _fileTypeIndex )
+	return;
+
+    if ( _fileTypeIndex->isCurrent() )
+	_fileTypeIndex->remove( subtree );
+    else
+	dropFileTypeIndex();
+}
+
+
+void DirTree::dropFileTypeIndex()
+{
+    if ( _fileTypeIndex )
+    {
+	delete _fileTypeIndex;
+	_fileTypeIndex = 0;
+    }
+}
+
+
+void DirTree::startSharedExtents()
+{
+    dropSharedExtents();
+
+    if ( ! _sharedExtents || ! SharedExtentFinder::isSupported() ||
+	 ! _root || ! _root->hasChildren() )
+    {
+	return;
+    }
+
+    _extentFinder = new SharedExtentFinder( _root, this, "extentFinderFinished" );
+    CHECK_NEW( _extentFinder );
+
+    _extentFinder->setAutoDelete( false );
+    _extentThreadPool.start( _extentFinder );
+}
+
+
+void DirTree::dropSharedExtents()
+{
+    if ( _extentFinder )
+    {
+	_extentFinder->cancel();
+	_extentThreadPool.clear();
+	_extentThreadPool.waitForDone();
+
+	delete _extentFinder;
+	_extentFinder = 0;
+    }
+}
+
+
+void DirTree::extentFinderFinished()
+{
+    // This might be from a finder that was dropped meanwhile
+
+    if ( ! _extentFinder || ! _extentFinder->isFinished() )
+	return;
+
+    logInfo() << "Checked the extents of " << _extentFinder->todo() << " files, "
+	      << _extentFinder->cacheHits() << " from the cache" << endl;
+
+    emit sharedExtentsFinished();
+}
+
+
+ExtentUsage DirTree::extentUsage( FileInfo * item ) const
+{
+    if ( ! _extentFinder || ! _extentFinder->isCurrent() )
+	return ExtentUsage();
+
+    return _extentFinder->usage( item );
+}
+
+
+void DirTree::dropDiff()
+{
+    if ( _diff )
+    {
+	delete _diff;
+	_diff = 0;
+    }
+}
+
+
+bool DirTree::setCacheBaseline( const QString & cacheFileName )
+{
+    _cacheBaseline.clear();
+
+    if ( cacheFileName.isEmpty() )
+	return true;
+
+    CacheBaselinePtr baseline( new CacheBaseline( cacheFileName ) );
+    CHECK_NEW( baseline.data() );
+
+    if ( ! baseline->ok() )
+	return false;
+
+    _cacheBaseline = baseline;
+
+    return true;
+}
+
+
+void DirTree::loadPendingSubtree( DirInfo * dir )
+{
+    if ( ! dir || ! dir->isPendingSubtree() )
+	return;
+
+    PendingSubtree pending = _pendingSubtrees.take( dir );
+    dir->setPendingSubtree( false );
+
+    if ( pending.estimate )
+    {
+	// Refine the estimate: Read this directory; large subtrees of its
+	// subdirectories are estimated again in sampling mode.
+
+	_isBusy = true;
+	emit startingReading();
+	readEstimatedSubtree( dir );
+	return;
+    }
+
+    if ( ! pending.cacheFile )
+	return;
+
+    logDebug() << "Loading " << dir << " from " << pending.cacheFile->fileName() << endl;
+
+    // The reader finalizes the new subtree and sends the readJobFinished()
+    // signals when it is destroyed
+
+    CacheReader reader( pending.cacheFile, this, dir, pending.dirNo );
+    reader.read();
+}
+
+
+void DirTree::addPendingSubtree( DirInfo *	    dir,
+				 BinaryCacheFilePtr cacheFile,
+				 quint64	    dirNo )
+{
+    PendingSubtree pending;
+    pending.cacheFile = cacheFile;
+    pending.dirNo     = dirNo;
+
+    _pendingSubtrees.insert( dir, pending );
+    dir->setPendingSubtree( true );
+}
+
+
+bool DirTree::pendingSubtree( DirInfo * dir, BinaryCacheSubtree & subtree_ret ) const
+{
+    QHash<DirInfo *, PendingSubtree>::const_iterator it = _pendingSubtrees.constFind( dir );
+
+    if ( it == _pendingSubtrees.constEnd() )
+	return false;
+
+    if ( it->estimate )
+    {
+	subtree_ret = *it->estimate;
+	return true;
+    }
+
+    if ( ! it->cacheFile )
+	return false;
+
+    subtree_ret = it->cacheFile->subtree( it->dirNo );
+
+    return true;
+}
+
+
+bool DirTree::shouldEstimate( DirInfo * dir ) const
+{
+    // The toplevel directory is on tree level 1
+
+    return _sampling && dir && dir->treeLevel() > _samplingDepth + 1;
+}
+
+
+void DirTree::addEstimatedSubtree( DirInfo *		    dir,
+				   const BinaryCacheSubtree & estimate )
+{
+    PendingSubtree pending;
+    pending.dirNo    = 0;
+    pending.estimate = QSharedPointer<BinaryCacheSubtree>( new BinaryCacheSubtree( estimate ) );
+    CHECK_NEW( pending.estimate.data() );
+
+    _pendingSubtrees.insert( dir, pending );
+    dir->setEstimated( true );
+    dir->setPendingSubtree( true );
+}
+
+
+bool DirTree::hasEstimates() const
+{
+    return _root && _root->estimatedDirCount() > 0;
+}
+
+
+void DirTree::refineEstimates()
 {
+    _sampling = false;
+
+    QList<DirInfo *> estimatedDirs;
+
+    for ( QHash<DirInfo *, PendingSubtree>::const_iterator it = _pendingSubtrees.constBegin();
+	  it != _pendingSubtrees.constEnd();
+	  ++it )
+    {
+	if ( it->estimate )
+	    estimatedDirs << it.key();
+    }
+
+    logInfo() << "Reading " << estimatedDirs.size() << " estimated subtrees" << endl;
+
+    if ( estimatedDirs.isEmpty() )
+	return;
+
     _isBusy = true;
     emit startingReading();
-    addJob( new CacheReadJob( this, 0, cacheFileName ) );
+
+    foreach ( DirInfo * dir, estimatedDirs )
+    {
+	_pendingSubtrees.remove( dir );
+	dir->setPendingSubtree( false );
+	readEstimatedSubtree( dir );
+    }
+}
+
+
+void DirTree::readEstimatedSubtree( DirInfo * dir )
+{
+    // There are no children to clear, so this is simpler than
+    // rereadSubtree()
+
+    dir->setEstimated( false );
+    dir->reset();
+    dir->setReadState( DirReading );
+
+    LocalDirReadJob * job = new LocalDirReadJob( this, dir );
+    CHECK_NEW( job );
+    job->setApplyFileChildExcludeRules( true );
+
+    addJob( job );
+}
+
+
+bool DirTree::readSubvolume( DirInfo * subvol )
+{
+    SubvolumeRead subvolume;
+    subvolume.url	= subvol->url();
+    subvolume.info	= BtrfsSnapshots::subvolumeInfo( subvolume.url );
+    subvolume.base	= -1;
+    subvolume.deferred	= false;
+
+    // Reading it again (for a refresh): Only the ones that were found
+    // before can be its base, so they never wait for each other.
+
+    int index = 0;
+
+    while ( index < _subvolumes.size() && _subvolumes.at( index ).url != subvolume.url )
+	++index;
+
+    // The closest snapshot of the same subvolume
+
+    quint64 distance = 0;
+
+    for ( int i = 0; i < index && subvolume.info.isValid(); ++i )
+    {
+	const SubvolumeInfo & info = _subvolumes.at( i ).info;
+
+	if ( BtrfsSnapshots::canCompare( info, subvolume.info ) )
+	{
+	    quint64 dist = qMax( info.contentTransid(), subvolume.info.contentTransid() ) -
+		qMin( info.contentTransid(), subvolume.info.contentTransid() );
+
+	    if ( subvolume.base < 0 || dist < distance )
+	    {
+		subvolume.base = i;
+		distance       = dist;
+	    }
+	}
+    }
+
+    if ( subvolume.base >= 0 )
+    {
+	DirInfo * baseDir = subvolumeDir( subvolume.base );
+
+	subvolume.deferred = _subvolumes.at( subvolume.base ).deferred ||
+	    ( baseDir && baseDir->isBusy() );
+    }
+
+    if ( index < _subvolumes.size() )
+	_subvolumes[ index ] = subvolume;
+    else
+	_subvolumes << subvolume;
+
+    if ( subvolume.deferred )
+    {
+	logInfo() << "Reading " << subvolume.url << " after "
+		  << _subvolumes.at( subvolume.base ).url << endl;
+
+	return false;
+    }
+
+    addJob( newSubvolumeJob( subvol, index ) );
+
+    return true;
+}
+
+
+LocalDirReadJob * DirTree::newSubvolumeJob( DirInfo * subvol, int index )
+{
+    const SubvolumeRead & subvolume = _subvolumes.at( index );
+    SnapshotBaselinePtr snapshot;
+
+    if ( subvolume.base >= 0 )
+    {
+	DirInfo * baseDir = subvolumeDir( subvolume.base );
+
+	if ( baseDir && baseDir->readState() == DirFinished && ! baseDir->isBusy() )
+	{
+	    snapshot = SnapshotBaseline::create( baseDir, _subvolumes.at( subvolume.base ).info,
+						 subvolume.url, subvolume.info );
+	}
+    }
+
+    LocalDirReadJob * job = 0;
+    quint32 dirNo = 0;
+
+    if ( snapshot && snapshot->findUnchangedDir( subvolume.url, dirNo ) )
+	job = new SnapshotDirReadJob( this, subvol, snapshot, dirNo );
+    else
+	job = new LocalDirReadJob( this, subvol );
+
+    CHECK_NEW( job );
+    job->setSnapshot( snapshot );
+    job->setApplyFileChildExcludeRules( true );
+
+    return job;
+}
+
+
+DirInfo * DirTree::subvolumeDir( int index )
+{
+    FileInfo * item = locate( _subvolumes.at( index ).url );
+
+    return item && item->isDirInfo() ? item->toDirInfo() : 0;
+}
+
+
+bool DirTree::startDeferredSubvolumes()
+{
+    bool started = false;
+
+    for ( int i = 0; i < _subvolumes.size(); ++i )
+    {
+	SubvolumeRead & subvolume = _subvolumes[ i ];
+
+	if ( ! subvolume.deferred )
+	    continue;
+
+	// The base was found before, so it is already started if it was
+	// deferred, too; but it might not be done yet.
+
+	DirInfo * baseDir = subvolumeDir( subvolume.base );
+
+	if ( _subvolumes.at( subvolume.base ).deferred || ( baseDir && baseDir->isBusy() ) )
+	    continue;
+
+	subvolume.deferred = false;
+	DirInfo * dir = subvolumeDir( i );
+
+	if ( ! dir || dir->readState() != DirOnRequestOnly )
+	    continue;	// Gone or read in the meantime
+
+	dir->reset();
+	dir->setReadState( DirReading );
+	addJob( newSubvolumeJob( dir, i ) );
+	started = true;
+    }
+
+    return started;
+}
+
+
+void DirTree::addUnreadDataset( DirInfo * dataset )
+{
+    if ( ! _unreadDatasets.contains( dataset->url() ) )
+	_unreadDatasets << dataset->url();
+
+    // From the last time if this is a refresh; zfsDatasetsRead() updates it
+
+    DatasetUsage usage = ZfsDatasets::cachedUsage( dataset->url() );
+
+    if ( usage.isValid() && _zfsPlaceholders )
+	addDatasetPlaceholder( dataset, usage );
+}
+
+
+void DirTree::addDatasetPlaceholder( DirInfo * dir, const DatasetUsage & usage )
+{
+    // Like an estimate, the sizes include the directory itself. Nothing is
+    // known about the number of items.
+
+    BinaryCacheSubtree estimate;
+    memset( &estimate, 0, sizeof( estimate ) );
+
+    estimate.totalSize		= qMax( usage.subtreeSize(), dir->size() );
+    estimate.totalAllocatedSize = qMax( usage.subtreeSize(), dir->rawAllocatedSize() );
+    estimate.totalBlocks	= estimate.totalAllocatedSize / 512;
+    estimate.latestMtime	= dir->mtime();
+    estimate.flags		= BINARY_CACHE_DIR_ESTIMATED;
+
+    addEstimatedSubtree( dir, estimate );
+}
+
+
+void DirTree::zfsDatasetsRead()
+{
+    foreach ( const QString & url, _unreadDatasets )
+    {
+	FileInfo * item = locate( url );
+
+	if ( ! item || ! item->isDirInfo() )
+	    continue;
+
+	DirInfo * dir = item->toDirInfo();
+
+	if ( dir->readState() != DirOnRequestOnly || dir->hasChildren() )
+	    continue;	// Read in the meantime
+
+	DatasetUsage usage = ZfsDatasets::cachedUsage( url );
+
+	if ( usage.isValid() && _zfsPlaceholders )
+	    addDatasetPlaceholder( dir, usage );
+
+	emit readJobFinished( dir );	// Update the views
+    }
 }
 
 
@@ -498,7 +1978,10 @@ void DirTree::setExcludeRules( ExcludeRules * newRules )
 void DirTree::addFilter( DirTreeFilter * filter )
 {
     if ( filter )
+    {
 	_filters << filter;
+	_filterStats << MatchStats();
+    }
 }
 
 
@@ -506,14 +1989,33 @@ void DirTree::clearFilters()
 {
     qDeleteAll( _filters );
     _filters.clear();
+    _filterStats.clear();
+}
+
+
+void DirTree::addUnreadableDir( DirInfo * dir )
+{
+    if ( ! dir || _unreadableDirs.contains( dir ) )
+	return;
+
+    _unreadableDirs.insert( dir );
+
+    if ( ! _beingDestroyed )
+	emit unreadableDirAdded( dir );
 }
 
 
 bool DirTree::checkIgnoreFilters( const QString & path )
 {
-    foreach ( DirTreeFilter * filter, _filters )
+    for ( int i=0; i < _filters.size(); ++i )
     {
-	if ( filter->ignore( path ) )
+	QElapsedTimer timer;
+	timer.start();
+
+	bool ignore = _filters.at( i )->ignore( path );
+	addFilterStats( i, ignore, timer.nsecsElapsed() );
+
+	if ( ignore )
 	    return true;
     }
 
@@ -521,82 +2023,141 @@ bool DirTree::checkIgnoreFilters( const QString & path )
 }
 
 
-void DirTree::moveIgnoredToAttic( DirInfo * dir )
+QVector<int> DirTree::lookupFilterDirs( const QString & dirPath ) const
 {
-    CHECK_PTR( dir );
+    QVector<int> dirNos;
+    dirNos.reserve( _filters.size() );
 
-    if ( dir->totalIgnoredItems() == 0 && dir->totalUnignoredItems() > 0 )
-	return;
+    foreach ( DirTreeFilter * filter, _filters )
+	dirNos << filter->lookupDir( dirPath );
 
-    // Not using FileInfoIterator because we don't want to iterate over the dot
-    // entry as well, just the normal children.
+    return dirNos;
+}
 
-    FileInfo * child = dir->firstChild();
-    FileInfoList ignoredChildren;
 
-    while ( child )
+bool DirTree::checkIgnoreFilters( const QString &      dirPath,
+				  const QVector<int> & dirNos,
+				  const QString &      name )
+{
+    for ( int i=0; i < _filters.size(); ++i )
     {
-	if ( child->isIgnored() )
-	{
-	    // Don't move the child right here, otherwise the iteration breaks
-	    ignoredChildren << child;
-	}
-	else
-	{
-	    if ( child->isDirInfo() )
-		moveIgnoredToAttic( child->toDirInfo() );
-	}
+	QElapsedTimer timer;
+	timer.start();
 
-	child = child->next();
+	bool ignore = _filters.at( i )->ignoreEntry( dirPath, dirNos.value( i, 0 ), name );
+	addFilterStats( i, ignore, timer.nsecsElapsed() );
+
+	if ( ignore )
+	    return true;
     }
 
+    return false;
+}
 
-    foreach ( FileInfo * child, ignoredChildren )
-    {
-	// logDebug() << "Moving ignored " << child << " to attic" << endl;
-	dir->moveToAttic( child );
 
-	if ( child->isDirInfo() )
-	    unatticAll( child->toDirInfo() );
-    }
+void DirTree::addFilterStats( int index, bool matched, qint64 nanosec )
+{
+    MatchStats & stats = _filterStats[ index ];
 
-    if ( ! ignoredChildren.isEmpty() )
-    {
-	dir->recalc();
+    ++stats.evaluations;
+    stats.nanosec += nanosec;
 
-	if ( dir->attic() )
-	    dir->attic()->recalc();
-    }
+    if ( matched )
+	++stats.matches;
 }
 
 
-void DirTree::ignoreEmptyDirs( DirInfo * dir )
+void DirTree::moveIgnoredToAttic( DirInfo * dir )
 {
     CHECK_PTR( dir );
 
-    FileInfo * child = dir->firstChild();
-    FileInfoList ignoredChildren;
+    // Files are ignored and go to the attic right when they are read, but
+    // whether a directory is ignored is only clear when its subtree is
+    // complete. Only the directories that had no unignored items at some
+    // point are candidates for that, and only they and their ancestors
+    // are visited here (see DirInfo::isAtticPending()).
+    //
+    // Each directory on the stack is visited after its parent decided
+    // about it. 'move' is 'false' below a directory without any ignored
+    // items: Nothing is moved to the attic there, but empty directories
+    // are still ignored.
+
+    struct Visit
+    {
+	DirInfo * dir;
+	bool	  move;
+    };
+
+    QVector<Visit> stack;
+    Visit top = { dir, true };
+    stack << top;
 
-    while ( child )
+    while ( ! stack.isEmpty() )
     {
-	if ( ! child->isIgnored() && child->isDirInfo() )
+	Visit visit = stack.takeLast();
+	DirInfo * parent = visit.dir;
+	bool move = visit.move &&
+	    ! ( parent->totalIgnoredItems() == 0 && parent->totalUnignoredItems() > 0 );
+
+	parent->clearAtticPending();
+
+	// Not using FileInfoIterator because we don't want to iterate over
+	// the dot entry as well, just the normal children.
+
+	FileInfoList ignoredChildren;
+
+	for ( FileInfo * child = parent->firstChild(); child; child = child->next() )
 	{
-	    DirInfo * subDir = child->toDirInfo();
+	    if ( ! child->isIgnored() && child->isDirInfo() &&
+		 child->totalUnignoredItems() == 0 )
+		// && ! child->isMountPoint()
+	    {
+		// logDebug() << "Ignoring empty subdir " << child << endl;
+		child->setIgnored( true );
+	    }
 
-	    if ( subDir->totalUnignoredItems() == 0 )
-		// && ! subDir->isMountPoint()
+	    if ( child->isIgnored() )
 	    {
-		// logDebug() << "Ignoring empty subdir " << subDir << endl;
-		subDir->setIgnored( true );
+		if ( child->isDirInfo() )
+		    clearAtticPending( child->toDirInfo() );
+
+		// Don't move the child right here, otherwise the iteration breaks
+
+		if ( move )
+		    ignoredChildren << child;
 	    }
-	    else
+	    else if ( child->isDirInfo() && child->toDirInfo()->isAtticPending() )
 	    {
-		ignoreEmptyDirs( subDir );
+		Visit childVisit = { child->toDirInfo(), move };
+		stack << childVisit;
 	    }
 	}
 
-	child = child->next();
+	foreach ( FileInfo * child, ignoredChildren )
+	{
+	    // logDebug() << "Moving ignored " << child << " to attic" << endl;
+
+	    if ( child->isDirInfo() )
+	    {
+		// Everything in an ignored directory is shown as its normal
+		// children; the attic gets the totals with all of that
+
+		unatticAll( child->toDirInfo() );
+		recalc( child->toDirInfo() );
+	    }
+
+	    parent->moveToAttic( child );
+
+	    // The attic only added up the child itself, not its subtree
+
+	    child->parent()->markAncestorsDirty();
+	}
     }
+
+    // Only the directories that lost children to an attic and their
+    // ancestors are dirty now
+
+    recalcDirty( dir );
 }
 
 
@@ -604,22 +2165,29 @@ void DirTree::unatticAll( DirInfo * dir )
 {
     CHECK_PTR( dir );
 
-    if ( dir->attic() )
+    QVector<DirInfo *> stack;
+    stack << dir;
+
+    while ( ! stack.isEmpty() )
     {
-	// logDebug() << "Moving all attic children to the normal children list for " << dir << endl;
-	dir->takeAllChildren( dir->attic() );
-	dir->deleteEmptyAttic();
-	dir->recalc();
-    }
+	DirInfo * parent = stack.takeLast();
 
-    FileInfoIterator it( dir );
+	if ( parent->attic() )
+	{
+	    // logDebug() << "Moving all attic children to the normal children list for " << parent << endl;
+	    parent->takeAllChildren( parent->attic() );
+	    parent->deleteEmptyAttic();
+	}
 
-    while ( *it )
-    {
-	if ( (*it)->isDirInfo() )
-	    unatticAll( (*it)->toDirInfo() );
+	FileInfoIterator it( parent );
+
+	while ( *it )
+	{
+	    if ( (*it)->isDirInfo() )
+		stack << (*it)->toDirInfo();
 
-	++it;
+	    ++it;
+	}
     }
 }
 
@@ -628,23 +2196,62 @@ void DirTree::recalc( DirInfo * dir )
 {
     CHECK_PTR( dir );
 
-    FileInfo * child = dir->firstChild();
+    // Split the tree level by level until there are enough subtrees for
+    // all threads. The directories above them are recalculated last.
+    //
+    // Directories with a pending subtree read their sums from the cache
+    // file, and that is not meant for several threads at once.
+
+    int threads = _pendingSubtrees.isEmpty() ? QThread::idealThreadCount() : 1;
+
+    QVector<DirInfo *> upperDirs;
+    QVector<DirInfo *> subtrees;
+    subtrees << dir;
 
-    while ( child )
+    while ( threads > 1 && ! subtrees.isEmpty() &&
+	    subtrees.size() < threads * RECALC_SUBTREES_PER_THREAD )
     {
-	if ( child->isDirInfo() )
-	    recalc( child->toDirInfo() );
+	QVector<DirInfo *> nextLevel;
 
-	child = child->next();
+	foreach ( DirInfo * parent, subtrees )
+	{
+	    upperDirs << parent;
+
+	    for ( FileInfo * child = parent->firstChild(); child; child = child->next() )
+	    {
+		if ( child->isDirInfo() )
+		    nextLevel << child->toDirInfo();
+	    }
+
+	    if ( parent->dotEntry() )
+		nextLevel << parent->dotEntry();
+
+	    if ( parent->attic() )
+		nextLevel << parent->attic();
+	}
+
+	subtrees = nextLevel;
     }
 
-    if ( dir->dotEntry() )
-	recalc( dir->dotEntry() );
+    QAtomicInt next( 0 );
 
-    if ( dir->attic() )
-	recalc( dir->attic() );
+    if ( subtrees.size() < 2 )
+    {
+	RecalcTask task( subtrees, next );
+	task.run();
+    }
+    else
+    {
+	_threadPool.setMaxThreadCount( threads );
+
+	for ( int i = 0; i < threads; ++i )
+	    _threadPool.start( new RecalcTask( subtrees, next ) );
+
+	_threadPool.waitForDone();
+    }
 
-    dir->recalc();
+    for ( int i = upperDirs.size() - 1; i >= 0; --i )
+	upperDirs.at( i )->recalc();
 }
 
 
@@ -17,11 +17,22 @@
 #include <stdlib.h>
 
 #include <QList>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "Logger.h"
 #include "DirInfo.h"
 #include "DirReadJob.h"
+#include "BtrfsSnapshots.h"
+#include "HardLinkIndex.h"
 #include "PkgFilter.h"
+#include "SharedExtents.h"
+#include "ZfsDatasets.h"
 
 
 namespace QDirStat
@@ -30,6 +41,13 @@ namespace QDirStat
     class FileInfoSet;
     class ExcludeRules;
     class DirTreeFilter;
+    class DirTreeDiff;
+    class SizeHistory;
+    class FileTypeIndex;
+    class BinaryCacheFile;
+    struct BinaryCacheSubtree;
+
+    typedef QSharedPointer<BinaryCacheFile> BinaryCacheFilePtr;
 
 
     /**
@@ -92,6 +110,11 @@ namespace QDirStat
 	 *
 	 * When 0 is passed, the entire tree will be refreshed, i.e. from the
 	 * first toplevel element on.
+	 *
+	 * With shadowRefresh(), a subtree is read again into a separate tree
+	 * in the background while the old one stays in place; when that is
+	 * done, the new contents replace the old ones all at once (see the
+	 * replacingSubtree() and subtreeReplaced() signals).
 	 **/
 	void refresh( DirInfo * subtree = 0 );
 
@@ -100,8 +123,28 @@ namespace QDirStat
 	 **/
 	void refresh( const FileInfoSet & refreshSet );
 
+	/**
+	 * Refresh a subtree like refresh(), but only read the directories
+	 * again whose mtime changed since they were read; the contents of
+	 * all others are taken over from the old subtree. This is much
+	 * faster after a cleanup that only changed a few directories.
+	 *
+	 * Like with a cache file as a baseline, files that were modified in
+	 * place in an unchanged directory are not noticed.
+	 **/
+	void refreshChanged( DirInfo * subtree );
+
+	/**
+	 * Refresh a number of subtrees with refreshChanged().
+	 **/
+	void refreshChanged( const FileInfoSet & refreshSet );
+
 	/**
 	 * Delete a subtree.
+	 *
+	 * The subtree is unlinked from the tree and the views right away, but
+	 * the nodes of a directory subtree are freed in small steps in the
+	 * background, so deleting millions of them does not block the GUI.
 	 **/
 	void deleteSubtree( FileInfo * subtree );
 
@@ -116,6 +159,16 @@ namespace QDirStat
 	 **/
 	void finalizeTree();
 
+	/**
+	 * Read the pending directories in the subtree of 'item' (or of its
+	 * parent if it is not a directory) before any others. This is meant
+	 * for what the user is looking at right now: The current item, an
+	 * expanded tree branch, the treemap root.
+	 *
+	 * This does nothing if no read is in progress.
+	 **/
+	void prioritize( FileInfo * item );
+
 
     public:
 
@@ -193,6 +246,29 @@ namespace QDirStat
 	 **/
 	void unblock( DirReadJob * job );
 
+	/**
+	 * Start reading 'subvol', a Btrfs subvolume below another directory
+	 * of the same filesystem that was just found, in snapshot delta mode
+	 * (see btrfsSnapshotDeltas()).
+	 *
+	 * If it is a snapshot of the same subvolume as one that was found
+	 * before (or the other way round) and that one is already read, only
+	 * the directories in which they differ are read; the rest is copied
+	 * (see SnapshotBaseline). If that one is still being read, 'subvol'
+	 * is read when it is done, and this returns 'false': Then the caller
+	 * has to finish 'subvol' as DirOnRequestOnly until then.
+	 **/
+	bool readSubvolume( DirInfo * subvol );
+
+	/**
+	 * Remember that 'dataset', the mount point of a ZFS dataset, is not
+	 * read. Its size is taken from the dataset properties (see
+	 * ZfsDatasets) as soon as they are known; with zfsPlaceholders(), it
+	 * becomes an estimated subtree with those totals that is read when
+	 * it is opened.
+	 **/
+	void addUnreadDataset( DirInfo * dataset );
+
 	/**
 	 * Should directory scans cross filesystems?
 	 *
@@ -208,6 +284,250 @@ namespace QDirStat
 	void setCrossFilesystems( bool doCross )
 	    { _crossFilesystems = doCross; }
 
+	/**
+	 * Return 'true' if bulk i-node statistics should be used when a
+	 * complete XFS or Btrfs filesystem is scanned as root.
+	 **/
+	bool useBulkStat() const { return _useBulkStat; }
+
+	/**
+	 * Enable or disable bulk i-node statistics. See BulkInodeStat for
+	 * details.
+	 **/
+	void setUseBulkStat( bool use ) { _useBulkStat = use; }
+
+	/**
+	 * Return 'true' if Btrfs subvolumes below a directory of the same
+	 * filesystem are read even without crossFilesystems(), and if
+	 * snapshots of the same subvolume are read incrementally (see
+	 * readSubvolume()). This is for backup volumes with many snapshots
+	 * of nearly the same tree; it needs root privileges.
+	 **/
+	bool btrfsSnapshotDeltas() const { return _btrfsSnapshotDeltas; }
+
+	/**
+	 * Enable or disable Btrfs snapshot delta mode.
+	 **/
+	void setBtrfsSnapshotDeltas( bool enable ) { _btrfsSnapshotDeltas = enable; }
+
+	/**
+	 * Return 'true' if ZFS datasets that are not read are shown with the
+	 * totals from their dataset properties like an estimated subtree
+	 * (see addUnreadDataset()), so a storage pool can be overviewed
+	 * without reading it.
+	 **/
+	bool zfsPlaceholders() const { return _zfsPlaceholders; }
+
+	/**
+	 * Enable or disable ZFS dataset placeholders.
+	 **/
+	void setZfsPlaceholders( bool enable ) { _zfsPlaceholders = enable; }
+
+	/**
+	 * Return the zlib compression level for writing gzipped cache
+	 * files: 1 (fastest) to 9 (smallest), 0 for no compression or -1
+	 * for the zlib default.
+	 **/
+	int cacheCompressionLevel() const { return _cacheCompressionLevel; }
+
+	/**
+	 * Set the zlib compression level for writing gzipped cache files.
+	 **/
+	void setCacheCompressionLevel( int level ) { _cacheCompressionLevel = level; }
+
+	/**
+	 * Return the number of directory levels that are loaded right away
+	 * from a binary cache file. Deeper subtrees are only loaded when
+	 * they are needed (see loadPendingSubtree()). 0 means everything is
+	 * loaded right away.
+	 **/
+	int cacheLazyLoadDepth() const { return _cacheLazyLoadDepth; }
+
+	/**
+	 * Set the number of directory levels that are loaded right away
+	 * from a binary cache file.
+	 **/
+	void setCacheLazyLoadDepth( int depth ) { _cacheLazyLoadDepth = depth; }
+
+	/**
+	 * Return 'true' if directories are read in sampling mode: Below
+	 * samplingDepth() levels, the totals of a subtree are only
+	 * estimated (see SubtreeEstimator) unless it is small enough to be
+	 * read completely right away.
+	 **/
+	bool sampling() const { return _sampling; }
+
+	/**
+	 * Enable or disable sampling mode for the next read.
+	 **/
+	void setSampling( bool sampling ) { _sampling = sampling; }
+
+	/**
+	 * Return the number of directory levels below the toplevel that
+	 * are read completely in sampling mode.
+	 **/
+	int samplingDepth() const { return _samplingDepth; }
+
+	/**
+	 * Set the number of directory levels below the toplevel that are
+	 * read completely in sampling mode.
+	 **/
+	void setSamplingDepth( int depth ) { _samplingDepth = depth; }
+
+	/**
+	 * Return 'true' if refresh() reads a subtree again into a shadow
+	 * tree in the background and then swaps it in, so the old subtree
+	 * stays visible until the new one is complete. This needs the memory
+	 * for both of them in the meantime.
+	 *
+	 * Subtrees that can't be read like that (trees with filters or
+	 * exclude rules of their own, sampling mode, a cache baseline, no
+	 * local directory) are refreshed the normal way.
+	 **/
+	bool shadowRefresh() const { return _shadowRefresh; }
+
+	/**
+	 * Enable or disable shadow refresh.
+	 **/
+	void setShadowRefresh( bool shadow ) { _shadowRefresh = shadow; }
+
+	/**
+	 * Return 'true' if the extents of the large files are checked in
+	 * the background after reading, so the parts of the allocated size
+	 * that are shared with reflinked copies or snapshots are known (see
+	 * SharedExtentFinder and extentUsage()).
+	 **/
+	bool sharedExtents() const { return _sharedExtents; }
+
+	/**
+	 * Enable or disable checking the extents after reading.
+	 **/
+	void setSharedExtents( bool enable ) { _sharedExtents = enable; }
+
+	/**
+	 * Return the size below which plain files are not kept as nodes of
+	 * their own when reading directories: They are only added up in one
+	 * AggregateInfo per directory, which saves most of the memory for
+	 * trees with lots of small files. 0 (the default) means to keep all
+	 * files.
+	 **/
+	FileSize aggregateFilesBelow() const { return _aggregateFilesBelow; }
+
+	/**
+	 * Set the size below which plain files are aggregated.
+	 **/
+	void setAggregateFilesBelow( FileSize size ) { _aggregateFilesBelow = size; }
+
+	/**
+	 * Return 'true' if reading local directories only counts their
+	 * entries: That answers "where are all the i-nodes", and it is many
+	 * times faster than a normal read, in particular on network
+	 * filesystems, since only directories and entries whose type
+	 * readdir() does not tell are stat()ed (see
+	 * LocalDirReader::setCountOnly()).
+	 *
+	 * The non-directory entries of each directory become one
+	 * AggregateInfo, so totalItems(), totalFiles() and totalSubDirs()
+	 * are right, but all sizes are 0 (unknown). Cache files in the
+	 * directories are not used.
+	 **/
+	bool countOnly() const { return _countOnly; }
+
+	/**
+	 * Enable or disable counting mode for the next read.
+	 **/
+	void setCountOnly( bool countOnly ) { _countOnly = countOnly; }
+
+	/**
+	 * Return the memory for the nodes (see NodePool::liveBytes()) above
+	 * which fully read subtrees that no view shows are spilled to
+	 * temporary binary cache files and loaded again only when they are
+	 * needed (see SubtreeSpiller). 0 (the default) means never to spill.
+	 *
+	 * Notice that the nodes of all trees count.
+	 **/
+	FileSize spillLimit() const { return _spillLimit; }
+
+	/**
+	 * Set the memory limit for spilling subtrees.
+	 **/
+	void setSpillLimit( FileSize bytes ) { _spillLimit = bytes; }
+
+	/**
+	 * Return 'true' if the children of 'dir' have to stay in memory
+	 * because a view shows them. This sends the checkingSpill() signal.
+	 **/
+	bool keepLoaded( DirInfo * dir );
+
+	/**
+	 * Notification that the sort caches of all directories take more
+	 * than DirInfo::sortCacheLimit(): Evict the least recently used ones
+	 * later (see evictSortCaches()).
+	 **/
+	void scheduleSortCacheEviction();
+
+	/**
+	 * Return 'true' if the totals of 'dir' should only be estimated
+	 * when it is read.
+	 **/
+	bool shouldEstimate( DirInfo * dir ) const;
+
+	/**
+	 * Use binary cache file 'cacheFileName' from an earlier scan as the
+	 * baseline for the next scans: Directories that did not change
+	 * since then (according to their mtime) are not read again, their
+	 * files are taken from the cache file (see CacheBaseline). An empty
+	 * file name means to read everything again.
+	 *
+	 * Return 'false' if the file cannot be used as a baseline.
+	 *
+	 * The file remains mapped until this is called again, so call
+	 * setCacheBaseline( "" ) before overwriting it.
+	 **/
+	bool setCacheBaseline( const QString & cacheFileName );
+
+	/**
+	 * Return the current cache baseline or a null pointer if there is
+	 * none.
+	 **/
+	CacheBaselinePtr cacheBaseline() const { return _cacheBaseline; }
+
+	/**
+	 * Return the number of worker threads used for reading directories.
+	 * 0 means that everything is read in the main thread.
+	 **/
+	int scanThreads() const { return _jobQueue.workerThreads(); }
+
+	/**
+	 * Set the number of worker threads used for reading directories.
+	 * See DirReadJobQueue::setWorkerThreads() for details.
+	 **/
+	void setScanThreads( int threads )
+	    { _jobQueue.setWorkerThreads( threads ); }
+
+	/**
+	 * Return a string equal to 'name' that shares its data with all
+	 * other equal names passed to this while reading: Huge trees repeat
+	 * the same names over and over again ("index.js", ".git",
+	 * "CMakeLists.txt"), and with this each of them is stored only once.
+	 *
+	 * The pool is only kept while reading and limited in size; the names
+	 * already handed out stay shared even after that.
+	 **/
+	QString internName( const QString & name );
+
+	/**
+	 * Return the job queue that reads the directories, e.g. to configure
+	 * the per-device concurrency limits.
+	 **/
+	DirReadJobQueue * jobQueue() { return &_jobQueue; }
+
+	/**
+	 * Return the index of the files with multiple hard links. This is
+	 * filled while reading, so it is always up to date.
+	 **/
+	HardLinkIndex * hardLinkIndex() { return &_hardLinkIndex; }
+
 	/**
 	 * Notification that a child has been added.
 	 *
@@ -265,22 +585,251 @@ namespace QDirStat
 	bool isBusy() { return _isBusy; }
 
 	/**
-	 * Write the complete tree to a cache file.
+	 * Return the generation of this tree: A number that changes whenever
+	 * items are added, deleted or finish reading. See TreeSnapshot.
+	 **/
+	quint64 generation() const { return _generation; }
+
+	/**
+	 * Read the settings for reading directories (the [DirectoryTree]
+	 * section of the config file) and apply them to this tree, its job
+	 * queue and the static LocalDirReader and FileInfo settings.
+	 **/
+	void readSettings();
+
+	/**
+	 * Write those settings to the config file.
+	 **/
+	void writeSettings();
+
+	/**
+	 * Write the complete tree to a cache file. If the name ends with
+	 * BINARY_CACHE_SUFFIX, the binary cache format is used, otherwise
+	 * the gzipped text format. If it ends with COLUMNAR_EXPORT_SUFFIX,
+	 * the tree is exported as columnar data instead (see
+	 * ColumnarExporter); that cannot be read again.
 	 *
 	 * Returns true if OK, false upon error.
 	 **/
 	bool writeCache( const QString & cacheFileName );
 
 	/**
-	 * Read a cache file.
+	 * Write a delta cache file with only the differences between the
+	 * tree and cache file 'baseFileName' with the delta cache files
+	 * 'baseDeltaFileNames' applied to it (see CacheWriter).
+	 *
+	 * Returns true if OK, false upon error.
+	 **/
+	bool writeCacheDelta( const QString &	  deltaFileName,
+			      const QString &	  baseFileName,
+			      const QStringList & baseDeltaFileNames = QStringList() );
+
+	/**
+	 * Read a cache file and apply the delta cache files
+	 * 'deltaFileNames' to it in that order.
+	 **/
+	void readCache( const QString &	    cacheFileName,
+			const QStringList & deltaFileNames = QStringList() );
+
+	/**
+	 * Read several cache files into one tree, e.g. from many machines
+	 * with the same directory layout: Each of them gets a directory of
+	 * its own below a common toplevel directory "Caches:", named after
+	 * the cache file, and its content is read below that directory (see
+	 * CacheReader::setMounted()).
+	 *
+	 * All files are queued at once, but each one is only opened when its
+	 * read job is started.
+	 **/
+	void readCaches( const QStringList & cacheFileNames );
+
+	/**
+	 * Read directory 'url' on a remote host ("ssh://[user@]host/path")
+	 * with the remote agent (see RemoteReadJob).
+	 **/
+	void readRemote( const QString & url );
+
+	/**
+	 * Read an ext2/3/4 filesystem image or block device 'url'
+	 * ("ext4:/dev/sdb1") with libext2fs (see Ext4ReadJob).
 	 **/
-	void readCache( const QString & cacheFileName );
+	void readExt4Image( const QString & url );
+
+	/**
+	 * Read NTFS volume or image 'url' ("ntfs:/dev/sda2") from its
+	 * Master File Table (see NtfsReadJob).
+	 **/
+	void readNtfsVolume( const QString & url );
+
+	/**
+	 * Import an ncdu export ("ncdu:/tmp/export.json") or a file list
+	 * ("filelist:/tmp/list") 'url' (see ImportReadJob).
+	 **/
+	void readImport( const QString & url );
+
+	/**
+	 * Return the command that starts the remote agent on a remote host
+	 * (via ssh). The path of the directory is appended.
+	 **/
+	const QString & remoteAgentCommand() const { return _remoteAgentCommand; }
+
+	/**
+	 * Set the command that starts the remote agent.
+	 **/
+	void setRemoteAgentCommand( const QString & command ) { _remoteAgentCommand = command; }
 
 	/**
 	 * Clear the tree and read a cache file.
 	 **/
 	void clearAndReadCache( const QString & cacheFileName );
 
+	/**
+	 * Read a cache file and the delta cache files 'deltaFileNames' right
+	 * away, i.e. without read jobs and without any signals that the
+	 * views would care about. This is meant for trees that are only used
+	 * internally for comparing.
+	 *
+	 * Return 'false' if any of the files cannot be read.
+	 **/
+	bool readCacheNow( const QString &	cacheFileName,
+			   const QStringList &	deltaFileNames = QStringList() );
+
+	/**
+	 * Compare the tree with the state in a cache file with the delta
+	 * cache files 'deltaFileNames' applied to it. The result is
+	 * available with diff() until the tree changes in any way.
+	 *
+	 * Return 'false' if the cache cannot be compared with the tree.
+	 **/
+	bool compareWithCache( const QString &	   cacheFileName,
+			       const QStringList & deltaFileNames = QStringList() );
+
+	/**
+	 * Return the result of the last compareWithCache() or 0 if there is
+	 * none or if the tree has changed since then.
+	 *
+	 * Any change of the tree silently drops the result, without a
+	 * diffChanged() signal: Everybody who displays it has to update
+	 * for that change anyway.
+	 **/
+	const DirTreeDiff * diff() const { return _diff; }
+
+	/**
+	 * Discard the result of the last compareWithCache().
+	 **/
+	void clearDiff();
+
+	/**
+	 * Load the size history file 'fileName' (see SizeHistory) for the
+	 * trends of the directories of this tree. Unlike diff(), this is
+	 * kept when the tree changes since the history knows directories by
+	 * their path.
+	 *
+	 * Return 'false' if the file cannot be read.
+	 **/
+	bool loadSizeHistory( const QString & fileName );
+
+	/**
+	 * Return the size history from loadSizeHistory() or 0 if there is
+	 * none.
+	 **/
+	const SizeHistory * sizeHistory() const { return _sizeHistory; }
+
+	/**
+	 * Discard the size history.
+	 **/
+	void clearSizeHistory();
+
+	/**
+	 * Return the index of the file types in this tree. It is built the
+	 * first time it is needed (or after the MIME categories changed)
+	 * and kept up to date as files are added or deleted.
+	 **/
+	FileTypeIndex * fileTypeIndex();
+
+	/**
+	 * Remove 'subtree' from the file type index if there is one. This is
+	 * for deleting items without a deletingChildNotify().
+	 **/
+	void forgetFileTypes( FileInfo * subtree );
+
+	/**
+	 * Return how much of the allocated size of 'item' is exclusive and
+	 * how much is shared with other files. The result is invalid if
+	 * sharedExtents() is off, if checking the extents is not done yet or
+	 * if the tree has changed since then.
+	 **/
+	ExtentUsage extentUsage( FileInfo * item ) const;
+
+	/**
+	 * Load the children of 'dir' if they are still pending in a binary
+	 * cache file (see DirInfo::isPendingSubtree()). This loads only one
+	 * level; large subtrees of its subdirectories are pending again.
+	 * This sends readJobFinished() for 'dir' when done.
+	 **/
+	void loadPendingSubtree( DirInfo * dir );
+
+	/**
+	 * Remember that the subtree of 'dir' is still pending in
+	 * 'cacheFile' as its directory no. 'dirNo'.
+	 **/
+	void addPendingSubtree( DirInfo *	  dir,
+				BinaryCacheFilePtr cacheFile,
+				quint64		  dirNo );
+
+	/**
+	 * Remember that the children of 'dir' were not read, but that its
+	 * subtree has the estimated totals 'estimate'. The subtree is read
+	 * when it is needed, just like a pending subtree from a cache file.
+	 **/
+	void addEstimatedSubtree( DirInfo *		   dir,
+				  const BinaryCacheSubtree & estimate );
+
+	/**
+	 * Return 'true' if there are any estimated subtrees in the tree.
+	 **/
+	bool hasEstimates() const;
+
+	/**
+	 * Read all estimated subtrees completely and switch off sampling
+	 * mode, so the tree becomes exact.
+	 **/
+	void refineEstimates();
+
+	/**
+	 * Get the totals of the pending subtree of 'dir' from its cache
+	 * file (or its estimate) and return them in 'subtree_ret'. Return
+	 * 'false' if it is not pending.
+	 **/
+	bool pendingSubtree( DirInfo * dir, BinaryCacheSubtree & subtree_ret ) const;
+
+	/**
+	 * Forget the pending subtree of 'dir' (because it is being deleted).
+	 **/
+	void forgetPendingSubtree( DirInfo * dir )
+	    { _pendingSubtrees.remove( dir ); }
+
+	/**
+	 * Return the directories that could not be read (see
+	 * DirInfo::readError()). This is kept up to date while reading, so
+	 * nobody needs to search the tree for them.
+	 **/
+	const QSet<DirInfo *> & unreadableDirs() const { return _unreadableDirs; }
+
+	/**
+	 * Add 'dir' to the unreadable directories and send the
+	 * unreadableDirAdded() signal. DirInfo does this when its read state
+	 * becomes an error.
+	 **/
+	void addUnreadableDir( DirInfo * dir );
+
+	/**
+	 * Remove 'dir' from the unreadable directories (because it is being
+	 * deleted or read again).
+	 **/
+	void forgetUnreadableDir( DirInfo * dir )
+	    { _unreadableDirs.remove( dir ); }
+
 	/**
 	 * Read installed packages that match the specified PkgFilter and their
 	 * file lists from the system's package manager(s).
@@ -331,11 +880,45 @@ namespace QDirStat
 	 **/
 	bool checkIgnoreFilters( const QString & path );
 
+	/**
+	 * Look up directory 'dirPath' in each filter for checking its entries
+	 * with checkIgnoreFilters( dirPath, dirNos, name ).
+	 **/
+	QVector<int> lookupFilterDirs( const QString & dirPath ) const;
+
+	/**
+	 * Return 'true' if any filter wants entry 'name' of directory
+	 * 'dirPath' to be ignored. 'dirNos' is what lookupFilterDirs()
+	 * returned for 'dirPath'. Unlike checkIgnoreFilters( path ), this
+	 * does not need the full path of each entry for most filters.
+	 **/
+	bool checkIgnoreFilters( const QString &      dirPath,
+				 const QVector<int> & dirNos,
+				 const QString &      name );
+
 	/**
 	 * Return 'true' if there is any filter, 'false' if not.
 	 **/
 	bool hasFilters() const { return ! _filters.isEmpty(); }
 
+	/**
+	 * Return the filters.
+	 **/
+	const QList<DirTreeFilter *> & filters() const { return _filters; }
+
+	/**
+	 * Return how often filter no. 'index' was checked, how often it
+	 * wanted an entry to be ignored and how long that took since it was
+	 * added or since the counters were last reset.
+	 **/
+	const MatchStats & filterStats( int index ) const
+	    { return _filterStats.at( index ); }
+
+	/**
+	 * Reset the counters of all filters.
+	 **/
+	void resetFilterStats() { _filterStats.fill( MatchStats() ); }
+
 	/**
 	 * Return 'true' if this DirTree is in the process of being destroyed,
 	 * so any FileInfo / DirInfo pointers stored outside the tree might
@@ -399,6 +982,25 @@ namespace QDirStat
 	 **/
 	void subtreeCleared( DirInfo * subtree );
 
+	/**
+	 * Emitted when the children of a subtree are about to be replaced
+	 * with the ones of a shadow refresh: Right after this, the subtree
+	 * is cleared, and the new children are added at once. Views can
+	 * remember what they need to restore by path now.
+	 **/
+	void replacingSubtree( DirInfo * subtree );
+
+	/**
+	 * Emitted when replacing the children of a subtree is finished, after
+	 * readJobFinished() for the subtree.
+	 **/
+	void subtreeReplaced( DirInfo * subtree );
+
+	/**
+	 * Emitted when directory 'dir' could not be read.
+	 **/
+	void unreadableDirAdded( DirInfo * dir );
+
 	/**
 	 * Emitted when reading is started.
 	 **/
@@ -432,6 +1034,36 @@ namespace QDirStat
 	 **/
 	void progressInfo( const QString & infoLine );
 
+	/**
+	 * Emitted when the result of compareWithCache() becomes available or
+	 * when it is discarded.
+	 **/
+	void diffChanged();
+
+	/**
+	 * Emitted when a size history is loaded or discarded.
+	 **/
+	void sizeHistoryChanged();
+
+	/**
+	 * Emitted when checking the extents after reading is done, so
+	 * extentUsage() has results.
+	 **/
+	void sharedExtentsFinished();
+
+	/**
+	 * Emitted before the children of 'dir' might be spilled to disk
+	 * (see spillLimit()): Set '*keep_ret' to 'true' if they have to stay
+	 * in memory, e.g. because 'dir' is expanded in a tree view. This is
+	 * only for direct connections.
+	 **/
+	void checkingSpill( DirInfo * dir, bool * keep_ret );
+
+	/**
+	 * Emitted after subtrees were spilled to disk.
+	 **/
+	void subtreesSpilled();
+
 
     protected slots:
 
@@ -441,33 +1073,165 @@ namespace QDirStat
 	 **/
 	void slotFinished();
 
+	/**
+	 * Free some of the directories of deleted subtrees.
+	 **/
+	void reapDeadDirs();
+
+	/**
+	 * Notification that the shadow tree of a refresh has finished
+	 * reading: Replace the subtree with what it read.
+	 **/
+	void shadowFinished();
+
+	/**
+	 * Notification that the SharedExtentFinder is done.
+	 **/
+	void extentFinderFinished();
+
+	/**
+	 * Spill cold subtrees to disk if the nodes use more memory than
+	 * spillLimit().
+	 **/
+	void spillColdSubtrees();
+
+	/**
+	 * Drop the sort caches of the least recently used directories that
+	 * no view shows if all sort caches take more than
+	 * DirInfo::sortCacheLimit().
+	 **/
+	void evictSortCaches();
+
 
     protected:
 
 	/**
-	 * Recurse through the tree from 'dir' on and move any ignored items to
-	 * the attic on the same level.
+	 * Add a check of filter no. 'index' with result 'matched' that took
+	 * 'nanosec' to its counters.
 	 **/
+	void addFilterStats( int index, bool matched, qint64 nanosec );
 
-	void moveIgnoredToAttic( DirInfo * dir );
+	/**
+	 * Clear 'subtree' and start reading it again with 'baseline' (which
+	 * may be null) for its subdirectories. 'subtree' must not be a
+	 * toplevel item.
+	 **/
+	void rereadSubtree( DirInfo * subtree, CacheBaselinePtr baseline );
+
+	/**
+	 * Return 'true' if 'subtree' can be refreshed with a shadow tree.
+	 **/
+	bool canShadowRefresh( DirInfo * subtree ) const;
 
 	/**
-	 * Recurse through the tree from 'dir' on and ignore any empty dirs
-	 * (i.e. dirs without any unignored non-directory child) that are not
-	 * ignored yet.
+	 * Start reading 'subtree' again into a shadow tree.
 	 **/
-	void ignoreEmptyDirs( DirInfo * dir );
+	void startShadowRefresh( DirInfo * subtree );
 
 	/**
-	 * Move all items from the attic to the normal children list.
+	 * Replace the children of 'subtree' with those of 'toplevel', the
+	 * toplevel directory of shadow tree 'shadow'.
+	 **/
+	void replaceSubtree( DirInfo * subtree, DirInfo * toplevel, DirTree * shadow );
+
+	/**
+	 * Discard the shadow refreshes of 'subtree' and of anything in it, of
+	 * all subtrees if 'subtree' is 0.
+	 **/
+	void dropShadows( FileInfo * subtree = 0 );
+
+	/**
+	 * Start reading estimated directory 'dir' from disk. The caller has
+	 * to send startingReading().
+	 **/
+	void readEstimatedSubtree( DirInfo * dir );
+
+	/**
+	 * Create the read job for subvolume no. 'index' in _subvolumes with
+	 * its directory 'subvol'.
+	 **/
+	LocalDirReadJob * newSubvolumeJob( DirInfo * subvol, int index );
+
+	/**
+	 * Return the directory of subvolume no. 'index' in _subvolumes if it
+	 * is still in the tree, 0 if not.
+	 **/
+	DirInfo * subvolumeDir( int index );
+
+	/**
+	 * Start reading the subvolumes that waited for another snapshot to
+	 * be read. Return 'true' if anything was started.
+	 **/
+	bool startDeferredSubvolumes();
+
+	/**
+	 * Turn the unread ZFS dataset 'dir' into an estimated subtree with
+	 * the totals of 'usage'.
+	 **/
+	void addDatasetPlaceholder( DirInfo * dir, const DatasetUsage & usage );
+
+	/**
+	 * Notification that the ZFS dataset properties were read: Update the
+	 * unread datasets.
+	 **/
+	void zfsDatasetsRead();
+
+	/**
+	 * Free the directories of deleted subtrees: All of them if 'all' is
+	 * 'true', otherwise for a few milliseconds.
+	 **/
+	void freeDeadDirs( bool all );
+
+	/**
+	 * Go through the tree from 'dir' on, ignore any empty dirs (i.e. dirs
+	 * without any unignored non-directory child) that are not ignored yet
+	 * and move any ignored items to the attic on the same level. This
+	 * skips the subtrees that never had a candidate for that, and it
+	 * updates the sums of what it changed.
+	 **/
+	void moveIgnoredToAttic( DirInfo * dir );
+
+	/**
+	 * Move all items from the attic to the normal children list in the
+	 * subtree of 'dir'. The caller has to recalc() afterwards.
 	 **/
 	void unatticAll( DirInfo * dir );
 
 	/**
-	 * Recursively force a complete recalculation of all sums.
+	 * Force a complete recalculation of all sums from 'dir' on.
+	 * Independent subtrees are done in parallel.
 	 **/
 	void recalc( DirInfo * dir );
 
+	/**
+	 * Delete the result of compareWithCache() without sending a
+	 * signal.
+	 **/
+	void dropDiff();
+
+	/**
+	 * Delete the file type index. It will be built again when it is
+	 * needed.
+	 **/
+	void dropFileTypeIndex();
+
+	/**
+	 * Start checking the extents of the tree in the background if
+	 * sharedExtents() is on.
+	 **/
+	void startSharedExtents();
+
+	/**
+	 * Stop checking the extents and discard the results.
+	 **/
+	void dropSharedExtents();
+
+	/**
+	 * Return the name of the mount directory for a cache file in
+	 * readCaches(): The file name without path and suffixes.
+	 **/
+	static QString cacheMountName( const QString & cacheFileName );
+
         /**
          * Try to derive the cluster size from 'item'.
          **/
@@ -479,13 +1243,72 @@ namespace QDirStat
 
 	DirInfo *		_root;
 	DirReadJobQueue		_jobQueue;
+	HardLinkIndex		_hardLinkIndex;
 	bool			_crossFilesystems;
+	bool			_useBulkStat;
+	bool			_btrfsSnapshotDeltas;
+	bool			_zfsPlaceholders;
+	int			_cacheCompressionLevel;
+	int			_cacheLazyLoadDepth;
+	bool			_sampling;
+	int			_samplingDepth;
+	QString			_remoteAgentCommand;
+	CacheBaselinePtr	_cacheBaseline;
+	DirTreeDiff *		_diff;
+	SizeHistory *		_sizeHistory;
+	FileTypeIndex *		_fileTypeIndex;
+	SharedExtentFinder *	_extentFinder;
+
+	struct PendingSubtree
+	{
+	    BinaryCacheFilePtr cacheFile;
+	    quint64	       dirNo;
+	    QSharedPointer<BinaryCacheSubtree> estimate; // instead of a cache file
+	};
+
+	QHash<DirInfo *, PendingSubtree> _pendingSubtrees;
+
+	struct ShadowRefresh
+	{
+	    DirInfo * subtree;	// in this tree
+	    DirTree * tree;	// reading it again
+	};
+
+	QList<ShadowRefresh>	_shadows;
+
+	struct SubvolumeRead
+	{
+	    QString	  url;
+	    SubvolumeInfo info;
+	    int		  base;		// Index of the snapshot to compare with or -1
+	    bool	  deferred;	// Until the base is read
+	};
+
+	QList<SubvolumeRead>	_subvolumes;	// In the order they were found
+	QStringList		_unreadDatasets;
+	bool			_shadowRefresh;
+	bool			_sharedExtents;
+	FileSize		_aggregateFilesBelow;
+	bool			_countOnly;
+	FileSize		_spillLimit;
+	FileSize		_spillRetryBytes; // after nothing could be spilled
+	QTimer			_spillTimer;
+	qint64			_sortCacheRetryBytes; // after nothing could be evicted
+	QTimer			_sortCacheTimer;
 	bool			_isBusy;
+	quint64			_generation;
 	QString			_device;
 	QString			_url;
 	ExcludeRules *		_excludeRules;
 	QList<DirTreeFilter *>	_filters;
+	QVector<MatchStats>	_filterStats;
 	bool			_beingDestroyed;
+	QSet<QString>		_namePool;
+	QSet<DirInfo *>		_unreadableDirs;
+	QList<DirInfo *>	_deadDirs;	// Unlinked, waiting to be freed
+	QTimer			_reaperTimer;
+	QThreadPool		_threadPool;	// for recalc()
+	QThreadPool		_extentThreadPool;
         bool                    _haveClusterSize;
         int                     _blocksPerCluster;
 
@@ -8,7 +8,18 @@
 
 
 #include <ctype.h>
+#include <stddef.h>	// offsetof()
+#include <string.h>	// memcpy(), memcmp()
+#include <unistd.h>	// close(), pread()
+#include <fcntl.h>	// open()
+#include <sys/mman.h>	// mmap()
+#include <sys/stat.h>	// fstat()
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
 #include <QUrl>
+#include <QThreadPool>
+#include <QMutexLocker>
 
 #include "DirTreeCache.h"
 #include "DirTree.h"
@@ -17,6 +28,15 @@
 #include "Logger.h"
 #include "Exception.h"
 
+// HAVE_LIBZSTD is defined in src.pro if libzstd is installed
+#ifndef HAVE_LIBZSTD
+#  define HAVE_LIBZSTD 0
+#endif
+
+#if HAVE_LIBZSTD
+#  include <zstd.h>
+#endif
+
 #define KB 1024LL
 #define MB (1024LL*1024)
 #define GB (1024LL*1024*1024)
@@ -24,6 +44,12 @@
 
 #define MAX_ERROR_COUNT			1000
 
+// Number of directories with wrong totals that are logged one by one
+#define MAX_TOTALS_MISMATCH_LOG		20
+
+// Minimum number of gzip members that are inflated ahead in parallel
+#define MIN_MEMBERS_IN_PROGRESS		2
+
 #define VERBOSE_READ			0
 #define VERBOSE_CACHE_DIRS		0
 #define VERBOSE_CACHE_FILE_INFOS	0
@@ -32,490 +58,2905 @@
 using namespace QDirStat;
 
 
-CacheWriter::CacheWriter( const QString & fileName, DirTree *tree )
-{
-    _ok = writeCache( fileName, tree );
-}
+bool CacheReader::_validateTotals = false;
 
+QString	   CacheZstdDictionary::_fileName;
+QByteArray CacheZstdDictionary::_data;
 
-CacheWriter::~CacheWriter()
+
+namespace
 {
-    // NOP
-}
+    /**
+     * Return the little endian 32 bit number at 'data'.
+     **/
+    quint32 littleEndian32( const unsigned char * data )
+    {
+	return data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) | ( (quint32) data[3] << 24 );
+    }
 
+}	// namespace
 
-bool CacheWriter::writeCache( const QString & fileName, DirTree *tree )
+
+bool CacheZstdDictionary::load( const QString & fileName )
 {
-    if ( ! tree || ! tree->root() )
-	return false;
+    _fileName = fileName;
+    _data.clear();
+
+    if ( fileName.isEmpty() )
+	return true;
 
-    gzFile cache = gzopen( (const char *) fileName.toUtf8(), "w" );
+    QFile file( fileName );
 
-    if ( cache == 0 )
+    if ( ! file.open( QIODevice::ReadOnly ) )
     {
-	logError() << "Can't open " << fileName << ": " << formatErrno() << endl;
+	logError() << "Can't open zstd dictionary " << fileName << ": " << formatErrno() << endl;
 	return false;
     }
 
-    gzprintf( cache, "[qdirstat %s cache file]\n", CACHE_FORMAT_VERSION );
-    gzprintf( cache,
-	     "# Do not edit!\n"
-	     "#\n"
-	     "# Type\tpath\t\tsize\tmtime\t\t<optional fields>\n"
-	     "\n" );
-
-    writeTree( cache, tree->root()->firstChild() );
-    gzclose( cache );
+    _data = file.readAll();
+    logInfo() << "Using zstd dictionary " << fileName << " with " << _data.size() << " bytes" << endl;
 
     return true;
 }
 
 
-void CacheWriter::writeTree( gzFile cache, FileInfo * item )
+static inline int hexValue( char c )
 {
-    if ( ! item )
-	return;
+    if ( c >= 'a' )
+	return c - 'a' + 10;
 
-    //
-    // Write entry for this item
-    //
+    if ( c >= 'A' )
+	return c - 'A' + 10;
 
-    if ( ! item->isDotEntry() )
-	writeItem( cache, item );
+    return c - '0';
+}
 
-    //
-    // Write file children
-    //
 
-    if ( item->dotEntry() )
-	writeTree( cache, item->dotEntry() );
+CacheWriter::CacheWriter( const QString & fileName,
+			  DirTree *	  tree,
+			  bool		  binary,
+			  int		  compressionLevel ):
+    _compressionLevel( compressionLevel ),
+    _buffer( 0 ),
+    _bufferPos( 0 ),
+    _file( 0 ),
+    _inMember( false ),
+    _zstd( false ),
+    _zstdContext( 0 ),
+    _writeTotals( false ),
+    _writeError( false ),
+    _memberBytes( 0 ),
+    _nodeCount( 0 )
+{
+    memset( &_zstream, 0, sizeof( _zstream ) );
+    _ok = binary ? writeBinaryCache( fileName, tree ) : writeCache( fileName, tree );
+}
 
-    //
-    // Recurse through subdirectories
-    //
 
-    FileInfo * child = item->firstChild();
+CacheWriter::CacheWriter( const QString & fileName,
+			  DirTree *	  tree,
+			  DirTree *	  baseTree,
+			  int		  compressionLevel ):
+    _compressionLevel( compressionLevel ),
+    _buffer( 0 ),
+    _bufferPos( 0 ),
+    _file( 0 ),
+    _inMember( false ),
+    _zstd( false ),
+    _zstdContext( 0 ),
+    _writeTotals( true ),
+    _writeError( false ),
+    _memberBytes( 0 ),
+    _nodeCount( 0 )
+{
+    memset( &_zstream, 0, sizeof( _zstream ) );
+    _ok = baseTree ? writeCache( fileName, tree, baseTree ) : false;
+}
 
-    while ( child )
-    {
-	writeTree( cache, child );
-	child = child->next();
-    }
+
+CacheWriter::CacheWriter( const QString & fileName,
+			  DirInfo *	  subtree ):
+    _compressionLevel( Z_DEFAULT_COMPRESSION ),
+    _buffer( 0 ),
+    _bufferPos( 0 ),
+    _file( 0 ),
+    _inMember( false ),
+    _zstd( false ),
+    _zstdContext( 0 ),
+    _writeTotals( false ),
+    _writeError( false ),
+    _memberBytes( 0 ),
+    _nodeCount( 0 )
+{
+    memset( &_zstream, 0, sizeof( _zstream ) );
+    _ok = subtree ? writeBinaryCache( fileName, (FileInfo *) subtree ) : false;
 }
 
 
-void CacheWriter::writeItem( gzFile cache, FileInfo * item )
+CacheWriter::CacheWriter( int compressionLevel ):
+    _ok( false ),
+    _compressionLevel( compressionLevel ),
+    _buffer( 0 ),
+    _bufferPos( 0 ),
+    _file( 0 ),
+    _inMember( false ),
+    _zstd( false ),
+    _zstdContext( 0 ),
+    _writeTotals( false ),
+    _writeError( false ),
+    _memberBytes( 0 ),
+    _nodeCount( 0 )
 {
-    if ( ! item )
-	return;
+    memset( &_zstream, 0, sizeof( _zstream ) );
+}
 
-    // Write file type
 
-    const char * file_type = "";
-    if	    ( item->isFile()		)	file_type = "F";
-    else if ( item->isDir()		)	file_type = "D";
-    else if ( item->isSymLink()		)	file_type = "L";
-    else if ( item->isBlockDevice()	)	file_type = "BlockDev";
-    else if ( item->isCharDevice()	)	file_type = "CharDev";
-    else if ( item->isFifo()		)	file_type = "FIFO";
-    else if ( item->isSocket()		)	file_type = "Socket";
+CacheWriter::~CacheWriter()
+{
+#if HAVE_LIBZSTD
+    if ( _zstdContext )
+	ZSTD_freeCCtx( _zstdContext );
+#endif
 
-    gzprintf( cache, "%s", file_type );
+    delete[] _buffer;
+}
 
-    // Write name
 
-    if ( item->isDirInfo() && ! item->isDotEntry() )
+bool CacheWriter::writeCache( const QString & fileName, DirTree *tree, DirTree * baseTree )
+{
+    if ( ! tree || ! tree->root() )
+	return false;
+
+    DirInfo * toplevel	   = 0;
+    DirInfo * baseToplevel = 0;
+
+    if ( baseTree )
     {
-	// Use absolute path
+	if ( tree->firstToplevel() )
+	    toplevel = tree->firstToplevel()->toDirInfo();
+
+	if ( baseTree->firstToplevel() )
+	    baseToplevel = baseTree->firstToplevel()->toDirInfo();
+
+	if ( ! toplevel || ! baseToplevel || toplevel->url() != baseToplevel->url() )
+	{
+	    logError() << "The base of delta cache file " << fileName
+		       << " is not for the same directory" << endl;
+	    return false;
+	}
+    }
+
+    if ( ! openCache( fileName ) )
+	return false;
 
-	gzprintf( cache, " %s", urlEncoded( item->url() ).data() );
+    if ( baseTree )
+    {
+	append( "[qdirstat " CACHE_FORMAT_VERSION " cache delta]\n"
+		"# Do not edit!\n"
+		"#\n"
+		"# Changes against a base cache file; \"R\" removes an item.\n"
+		"#\n"
+		"# Type\tpath\t\tsize\tmtime\t\t<optional fields>\n"
+		"\n" );
+
+	writeDeltaTree( toplevel, baseToplevel );
     }
     else
     {
-	// Use relative path
+	append( "[qdirstat " CACHE_FORMAT_VERSION " cache file]\n"
+		"# Do not edit!\n"
+		"#\n"
+		"# Type\tpath\t\tsize\tmtime\t\t<optional fields>\n"
+		"\n" );
 
-	gzprintf( cache, "\t%s", urlEncoded( item->name() ).data() );
+	writeTree( tree->root()->firstChild() );
     }
 
+    return closeCache( fileName );
+}
 
-    // Write size
 
-    gzprintf( cache, "\t%s", formatSize( item->rawByteSize() ).toUtf8().data() );
+bool CacheWriter::openCache( const QString & fileName )
+{
+    // The format depends on the final name, not on the one while writing
 
+    QString finalName = fileName;
 
-    // Write mtime
+    if ( finalName.endsWith( CACHE_PART_SUFFIX ) )
+	finalName.chop( strlen( CACHE_PART_SUFFIX ) );
 
-    gzprintf( cache, "\t0x%lx", (unsigned long) item->mtime() );
+    _zstd = finalName.endsWith( ZSTD_CACHE_SUFFIX );
 
-    // Optional fields
+#if ! HAVE_LIBZSTD
+    if ( _zstd )
+    {
+	logError() << "Can't write " << fileName << ": This version was built without zstd" << endl;
+	return false;
+    }
+#endif
 
-    if ( item->isSparseFile() )
-	gzprintf( cache, "\tblocks: %lld", item->blocks() );
+    _file = fopen( (const char *) fileName.toUtf8(), "wb" );
 
-    if ( item->isFile() && item->links() > 1 )
-	gzprintf( cache, "\tlinks: %u", (unsigned) item->links() );
+    if ( _file == 0 )
+    {
+	logError() << "Can't open " << fileName << ": " << formatErrno() << endl;
+	return false;
+    }
+
+#if HAVE_LIBZSTD
+    if ( _zstd )
+    {
+	// The gzip levels 1..9 are fine for zstd, too; its default is 3
+
+	int level = _compressionLevel < 1 ? ZSTD_CLEVEL_DEFAULT : qMin( _compressionLevel, ZSTD_maxCLevel() );
+	_zstdContext = ZSTD_createCCtx();
+	CHECK_PTR( _zstdContext );
+	ZSTD_CCtx_setParameter( _zstdContext, ZSTD_c_compressionLevel, level );
+
+	QByteArray dictionary = CacheZstdDictionary::data();
+
+	if ( ! dictionary.isEmpty() &&
+	     ZSTD_isError( ZSTD_CCtx_loadDictionary( _zstdContext, dictionary.constData(), dictionary.size() ) ) )
+	{
+	    logError() << "Bad zstd dictionary " << CacheZstdDictionary::fileName() << endl;
+	    _writeError = true;
+	}
+    }
+#endif
+
+    if ( _compressionLevel < 0 || _compressionLevel > 9 )
+	_compressionLevel = Z_DEFAULT_COMPRESSION;
 
-    gzputc( cache, '\n' );
+    _buffer = new char[ CACHE_WRITE_BUFFER_SIZE ];
+    CHECK_NEW( _buffer );
+
+    _writeError = ! startMember( true );
+
+    return true;
 }
 
 
-QByteArray CacheWriter::urlEncoded( const QString & path )
+bool CacheWriter::closeCache( const QString & fileName )
 {
-    // Using a protocol ("scheme") part to avoid directory names with a colon
-    // ":" being cut off because it looks like a URL protocol.
-    QUrl url;
-    url.setScheme( "foo" );
-    url.setPath( path );
+    finishMember();
+    writeIndex();
 
-    QByteArray encoded = url.toEncoded( QUrl::RemoveScheme );
+    if ( fclose( _file ) != 0 )
+	_writeError = true;
 
-    if ( encoded.isEmpty() )
+    _file = 0;
+
+#if HAVE_LIBZSTD
+    if ( _zstdContext )
     {
-        logError() << "Invalid file/dir name: " << path << endl;
+	ZSTD_freeCCtx( _zstdContext );
+	_zstdContext = 0;
     }
+#endif
 
-    return encoded;
+    if ( _writeError )
+	logError() << "Error writing " << fileName << ": " << formatErrno() << endl;
 
+    return ! _writeError;
 }
 
 
-QString CacheWriter::formatSize( FileSize size )
+bool CacheWriter::startMember( bool first )
 {
-    if ( size >= TB && size % TB == 0 )
-        return QString( "%1T" ).arg( size / TB );
+    if ( _zstd )
+    {
+	if ( first )
+	{
+	    // A skippable frame for the offset of the index member; that is
+	    // filled in by writeIndex().
 
-    if ( size >= GB && size % GB == 0 )
-        return QString( "%1G" ).arg( size / GB );
+	    unsigned char header[ CACHE_ZSTD_HEADER_SIZE ];
+	    memset( header, 0, sizeof( header ) );
 
-    if ( size >= MB && size % MB == 0 )
-        return QString( "%1M" ).arg( size / MB );
+	    for ( int i = 0; i < 4; ++i )
+	    {
+		header[ i ]	= ( CACHE_ZSTD_SKIPPABLE_MAGIC >> ( 8 * i ) ) & 0xFF;
+		header[ 4 + i ] = ( ( CACHE_ZSTD_HEADER_SIZE - 8 ) >> ( 8 * i ) ) & 0xFF;
+	    }
 
-    if ( size >= KB && size % KB == 0 )
-        return QString( "%1K" ).arg( size / KB );
+	    memcpy( header + 8, CACHE_ZSTD_INDEX_ID, 4 );
 
-    return QString( "%1" ).arg( size );
-}
+	    if ( fwrite( header, 1, sizeof( header ), _file ) != sizeof( header ) )
+		return false;
+	}
 
+	// Each member is a frame of its own; the context starts a new one
+	// after the end of the previous one.
 
+	_memberOffsets << (qint64) ftell( _file );
+	_memberBytes = 0;
+	_inMember    = true;
 
+	return true;
+    }
 
+    // windowBits + 16: Write a gzip header and trailer, not a zlib one
 
+    if ( deflateInit2( &_zstream, _compressionLevel, Z_DEFLATED,
+		       MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+	return false;
+    }
 
+    if ( first )
+    {
+	// Reserve a header subfield for the offset of the index member; it
+	// is filled in by writeIndex(). The header has no CRC, so it can
+	// simply be overwritten in place.
 
-CacheReader::CacheReader( const QString & fileName,
-			  DirTree *	  tree,
-			  DirInfo *	  parent ):
-    QObject(),
-    _multiSlash( "//+" ) // cache regexp for multiple use
-{
-    _fileName		= fileName;
-    _buffer[0]		= 0;
-    _line		= _buffer;
-    _lineNo		= 0;
-    _ok			= true;
-    _errorCount         = 0;
-    _tree		= tree;
-    _toplevel		= parent;
-    _lastDir		= 0;
-    _lastExcludedDir	= 0;
+	memset( _gzExtra, 0, sizeof( _gzExtra ) );
+	_gzExtra[0] = CACHE_INDEX_SUBFIELD_ID1;
+	_gzExtra[1] = CACHE_INDEX_SUBFIELD_ID2;
+	_gzExtra[2] = CACHE_INDEX_SUBFIELD_LEN;
 
-    _cache = gzopen( fileName.toUtf8(), "r" );
+	memset( &_gzHeader, 0, sizeof( _gzHeader ) );
+	_gzHeader.os	    = 3; // Unix
+	_gzHeader.extra	    = _gzExtra;
+	_gzHeader.extra_len = sizeof( _gzExtra );
 
-    if ( _cache == 0 )
-    {
-	logError() << "Can't open " << fileName << ": " << formatErrno() << endl;
-	_ok = false;
-	emit error();
-	return;
+	deflateSetHeader( &_zstream, &_gzHeader );
     }
 
-    // logDebug() << "Opening " << fileName << " OK" << endl;
-    checkHeader();
+    _memberOffsets << (qint64) ftell( _file );
+    _memberBytes = 0;
+    _inMember	 = true;
+
+    return true;
 }
 
 
-CacheReader::~CacheReader()
+void CacheWriter::compress( const char * data, int len )
 {
-    if ( _cache )
-	gzclose( _cache );
-
-    logDebug() << "Cache reading finished" << endl;
+    if ( ! _inMember || len <= 0 )
+	return;
 
-    if ( _toplevel )
+    if ( _zstd )
     {
-	// logDebug() << "Finalizing recursive for " << _toplevel << endl;
-	finalizeRecursive( _toplevel );
-	_toplevel->finalizeAll();
+	_memberBytes += len;
+	compressZstd( data, len, false );
+	return;
     }
 
-    emit finished();
-}
+    unsigned char out[ 64 * 1024 ];
 
+    _zstream.next_in  = (Bytef *) data;
+    _zstream.avail_in = len;
+    _memberBytes     += len;
 
-void CacheReader::rewind()
-{
-    if ( _cache )
+    do
     {
-	gzrewind( _cache );
-	checkHeader();		// skip cache header
-    }
+	_zstream.next_out  = out;
+	_zstream.avail_out = sizeof( out );
+	deflate( &_zstream, Z_NO_FLUSH );
+
+	size_t have = sizeof( out ) - _zstream.avail_out;
+
+	if ( have > 0 && fwrite( out, 1, have, _file ) != have )
+	    _writeError = true;
+
+    } while ( _zstream.avail_out == 0 );
 }
 
 
-bool CacheReader::read( int maxLines )
+void CacheWriter::compressZstd( const char * data, int len, bool end )
 {
-    while ( ! gzeof( _cache )
-	    && _ok
-	    && ( maxLines == 0 || --maxLines > 0 ) )
+#if HAVE_LIBZSTD
+    unsigned char out[ 64 * 1024 ];
+    ZSTD_inBuffer input = { data, (size_t) len, 0 };
+    size_t remaining = 0;
+
+    do
     {
-	if ( readLine() )
+	ZSTD_outBuffer output = { out, sizeof( out ), 0 };
+	remaining = ZSTD_compressStream2( _zstdContext, &output, &input,
+					  end ? ZSTD_e_end : ZSTD_e_continue );
+
+	if ( ZSTD_isError( remaining ) )
 	{
-	    splitLine();
-	    addItem();
+	    _writeError = true;
+	    return;
 	}
-    }
 
-    return _ok && ! gzeof( _cache );
+	if ( output.pos > 0 && fwrite( out, 1, output.pos, _file ) != output.pos )
+	    _writeError = true;
+
+    } while ( end ? remaining > 0 : input.pos < input.size );
+#else
+    Q_UNUSED( data );
+    Q_UNUSED( len );
+    Q_UNUSED( end );
+    _writeError = true;
+#endif
 }
 
 
-void CacheReader::addItem()
+void CacheWriter::flushBuffer()
 {
-    if ( fieldsCount() < 4 )
-    {
-	logError() << "Syntax error in " << _fileName << ":" << _lineNo
-		   << ": Expected at least 4 fields, saw only " << fieldsCount()
-		   << endl;
-
-	setReadError( _lastDir );
+    compress( _buffer, _bufferPos );
+    _bufferPos = 0;
+}
 
-	if ( ++_errorCount > MAX_ERROR_COUNT )
-	{
-	    logError() << "Too many syntax errors. Giving up." << endl;
-	    _ok = false;
-	    emit error();
-	}
 
-	return;
+void CacheWriter::append( const char * data, int len )
+{
+    if ( reserve( len ) )
+    {
+	memcpy( _buffer + _bufferPos, data, len );
+	_bufferPos += len;
     }
+    else // Larger than the complete buffer
+    {
+	flushBuffer();
+	compress( data, len );
+    }
+}
 
-    int n = 0;
-    char * type		= field( n++ );
-    char * raw_path	= field( n++ );
-    char * size_str	= field( n++ );
-    char * mtime_str	= field( n++ );
-    char * blocks_str	= 0;
-    char * links_str	= 0;
 
-    while ( fieldsCount() > n+1 )
+void CacheWriter::appendNumber( quint64 value )
+{
+    char digits[ 24 ];
+    char * end = digits + sizeof( digits );
+    char * pos = end;
+
+    do
     {
-	char * keyword	= field( n++ );
-	char * val_str	= field( n++ );
+	*--pos = '0' + value % 10;
+	value /= 10;
+    } while ( value > 0 );
 
-	if ( strcasecmp( keyword, "blocks:" ) == 0 ) blocks_str = val_str;
-	if ( strcasecmp( keyword, "links:"  ) == 0 ) links_str	= val_str;
-    }
+    append( pos, end - pos );
+}
 
 
-    // Type
+void CacheWriter::appendHex( quint64 value )
+{
+    static const char hexDigits[] = "0123456789abcdef";
 
-    mode_t mode = S_IFREG;
+    char digits[ 24 ];
+    char * end = digits + sizeof( digits );
+    char * pos = end;
 
-    if	    ( strcasecmp( type, "F"	   ) == 0 )	mode = S_IFREG;
-    else if ( strcasecmp( type, "D"	   ) == 0 )	mode = S_IFDIR;
-    else if ( strcasecmp( type, "L"	   ) == 0 )	mode = S_IFLNK;
-    else if ( strcasecmp( type, "BlockDev" ) == 0 )	mode = S_IFBLK;
-    else if ( strcasecmp( type, "CharDev"  ) == 0 )	mode = S_IFCHR;
-    else if ( strcasecmp( type, "FIFO"	   ) == 0 )	mode = S_IFIFO;
-    else if ( strcasecmp( type, "Socket"   ) == 0 )	mode = S_IFSOCK;
+    do
+    {
+	*--pos = hexDigits[ value & 0xF ];
+	value >>= 4;
+    } while ( value > 0 );
 
+    append( pos, end - pos );
+}
 
-    // Path
 
-    if ( *raw_path == '/' )
-	_lastDir = 0;
+void CacheWriter::appendSize( FileSize size )
+{
+    char unit = 0;
+    FileSize value = size;
 
+    if	    ( size >= TB && size % TB == 0 )	{ value = size / TB; unit = 'T'; }
+    else if ( size >= GB && size % GB == 0 )	{ value = size / GB; unit = 'G'; }
+    else if ( size >= MB && size % MB == 0 )	{ value = size / MB; unit = 'M'; }
+    else if ( size >= KB && size % KB == 0 )	{ value = size / KB; unit = 'K'; }
 
-    // Size
+    if ( value < 0 )
+    {
+	append( '-' );
+	value = -value;
+    }
 
-    char * end = 0;
-    FileSize size = strtoll( size_str, &end, 10 );
+    appendNumber( value );
 
-    if ( end )
+    if ( unit )
+	append( unit );
+}
+
+
+void CacheWriter::appendEncoded( const QString & path )
+{
+    // Encode the common characters by hand just like QUrl would do in
+    // urlEncoded(): Letters, digits and some punctuation unchanged, blanks
+    // and non-ASCII characters in UTF-8 with percent notation. For
+    // anything else, fall back to QUrl to make sure the result is the
+    // same. Each UTF-16 code unit can result in at most 9 bytes.
+
+    static const char hexDigits[] = "0123456789ABCDEF";
+
+    int len = path.size();
+
+    if ( ! reserve( 9 * len ) )
+    {
+	QByteArray encoded = urlEncoded( path );
+	append( encoded.constData(), encoded.size() );
+	return;
+    }
+
+    const QChar * chars = path.constData();
+    char * start = _buffer + _bufferPos;
+    char * out	 = start;
+
+    for ( int i = 0; i < len; ++i )
+    {
+	uint c = chars[i].unicode();
+
+	if ( ( c >= 'a' && c <= 'z' ) ||
+	     ( c >= 'A' && c <= 'Z' ) ||
+	     ( c >= '0' && c <= '9' ) ||
+	     c == '/' || c == '.' || c == '-' || c == '_' ||
+	     c == '~' || c == '+' || c == ',' || c == '=' || c == '@' )
+	{
+	    *out++ = (char) c;
+	    continue;
+	}
+
+	unsigned char utf8[4];
+	int utf8Len = 0;
+
+	if ( c == ' ' )
+	{
+	    utf8[ utf8Len++ ] = ' ';
+	}
+	else if ( c < 0x80 )
+	{
+	    utf8Len = 0; // Some other ASCII character: Let QUrl handle it
+	}
+	else if ( c < 0x800 )
+	{
+	    utf8[ utf8Len++ ] = 0xC0 | ( c >> 6 );
+	    utf8[ utf8Len++ ] = 0x80 | ( c & 0x3F );
+	}
+	else if ( chars[i].isHighSurrogate() && i + 1 < len && chars[i+1].isLowSurrogate() )
+	{
+	    uint code = QChar::surrogateToUcs4( chars[i], chars[i+1] );
+	    ++i;
+
+	    utf8[ utf8Len++ ] = 0xF0 | ( code >> 18 );
+	    utf8[ utf8Len++ ] = 0x80 | ( ( code >> 12 ) & 0x3F );
+	    utf8[ utf8Len++ ] = 0x80 | ( ( code >> 6  ) & 0x3F );
+	    utf8[ utf8Len++ ] = 0x80 | ( code & 0x3F );
+	}
+	else if ( ! chars[i].isSurrogate() )
+	{
+	    utf8[ utf8Len++ ] = 0xE0 | ( c >> 12 );
+	    utf8[ utf8Len++ ] = 0x80 | ( ( c >> 6 ) & 0x3F );
+	    utf8[ utf8Len++ ] = 0x80 | ( c & 0x3F );
+	}
+
+	if ( utf8Len == 0 )
+	{
+	    QByteArray encoded = urlEncoded( path );
+	    append( encoded.constData(), encoded.size() );
+	    return;
+	}
+
+	for ( int j = 0; j < utf8Len; ++j )
+	{
+	    *out++ = '%';
+	    *out++ = hexDigits[ utf8[j] >> 4 ];
+	    *out++ = hexDigits[ utf8[j] & 0xF ];
+	}
+    }
+
+    _bufferPos += out - start;
+}
+
+
+void CacheWriter::finishMember()
+{
+    if ( ! _inMember )
+	return;
+
+    flushBuffer();
+
+    if ( _zstd )
+    {
+	compressZstd( 0, 0, true );
+	_inMember = false;
+	return;
+    }
+
+    unsigned char out[ 64 * 1024 ];
+    int result;
+
+    _zstream.next_in  = 0;
+    _zstream.avail_in = 0;
+
+    do
+    {
+	_zstream.next_out  = out;
+	_zstream.avail_out = sizeof( out );
+	result = deflate( &_zstream, Z_FINISH );
+
+	size_t have = sizeof( out ) - _zstream.avail_out;
+
+	if ( have > 0 && fwrite( out, 1, have, _file ) != have )
+	    _writeError = true;
+
+    } while ( result == Z_OK );
+
+    if ( result != Z_STREAM_END )
+	_writeError = true;
+
+    deflateEnd( &_zstream );
+    _inMember = false;
+}
+
+
+void CacheWriter::writeIndex()
+{
+    // The index is another gzip member (or zstd frame) with only comment
+    // lines, so readers that don't know about it simply skip it.
+
+    qint64 indexOffset = (qint64) ftell( _file );
+
+    if ( ! startMember( false ) )
+    {
+	_writeError = true;
+	return;
+    }
+
+    append( CACHE_INDEX_HEADER "\n" );
+
+    for ( int i = 0; i < _memberOffsets.size() - 1; ++i )
+    {
+	qint64 end = _memberOffsets.at( i+1 );
+
+	append( CACHE_INDEX_MEMBER " " );
+	appendNumber( _memberOffsets.at( i ) );
+	append( ' ' );
+	appendNumber( end - _memberOffsets.at( i ) );
+	append( '\n' );
+    }
+
+    finishMember();
+
+    unsigned char offset[ CACHE_INDEX_SUBFIELD_LEN ];
+
+    for ( int i = 0; i < CACHE_INDEX_SUBFIELD_LEN; ++i )
+	offset[i] = (unsigned char) ( ( (quint64) indexOffset >> ( 8 * i ) ) & 0xFF );
+
+    long offsetPos = _zstd ? CACHE_ZSTD_INDEX_OFFSET : CACHE_INDEX_SUBFIELD_OFFSET;
+
+    if ( fseek( _file, offsetPos, SEEK_SET ) != 0 ||
+	 fwrite( offset, 1, sizeof( offset ), _file ) != sizeof( offset ) )
+    {
+	_writeError = true;
+    }
+}
+
+
+void CacheWriter::writeTree( FileInfo * item )
+{
+    if ( ! item )
+	return;
+
+    //
+    // Start a new gzip member at a directory boundary if this one is full
+    //
+
+    if ( item->isDirInfo() && ! item->isDotEntry() )
+	checkMemberSize();
+
+    //
+    // Write entry for this item
+    //
+
+    if ( ! item->isDotEntry() )
+	writeItem( item );
+
+    //
+    // Write file children
+    //
+
+    if ( item->dotEntry() )
+	writeTree( item->dotEntry() );
+
+    //
+    // Recurse through subdirectories
+    //
+
+    FileInfo * child = item->firstChild();
+
+    while ( child )
+    {
+	writeTree( child );
+	child = child->next();
+    }
+}
+
+
+void CacheWriter::checkMemberSize()
+{
+    if ( _memberBytes + _bufferPos > CACHE_MEMBER_SIZE )
+    {
+	finishMember();
+
+	if ( ! startMember( false ) )
+	    _writeError = true;
+    }
+}
+
+
+/**
+ * Collect the direct children of 'dir' (including those in its dot entry,
+ * but not the ignored ones in its attic) in 'files' and 'subDirs'.
+ **/
+static void directChildren( DirInfo *		dir,
+			    QList<FileInfo *> & files,
+			    QList<FileInfo *> & subDirs )
+{
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+    {
+	if ( child->isDirInfo() )
+	{
+	    if ( ! child->isDotEntry() )
+		subDirs << child;
+	}
+	else
+	{
+	    files << child;
+	}
+    }
+
+    if ( dir->dotEntry() )
+    {
+	for ( FileInfo * child = dir->dotEntry()->firstChild(); child; child = child->next() )
+	    files << child;
+    }
+}
+
+
+/**
+ * Return the number of links of 'item' as written to a cache file.
+ **/
+static nlink_t cacheLinks( FileInfo * item )
+{
+    return item->isFile() && item->links() > 1 ? item->links() : 1;
+}
+
+
+/**
+ * Return 'true' if 'item' has the same values in a cache file as
+ * 'baseItem'.
+ **/
+static bool sameCacheItem( FileInfo * item, FileInfo * baseItem )
+{
+    return ( item->mode() & S_IFMT ) == ( baseItem->mode() & S_IFMT ) &&
+	item->rawByteSize()  == baseItem->rawByteSize()	 &&
+	item->mtime()	     == baseItem->mtime()	 &&
+	cacheLinks( item )   == cacheLinks( baseItem )	 &&
+	item->isSparseFile() == baseItem->isSparseFile() &&
+	( ! item->isSparseFile() || item->blocks() == baseItem->blocks() );
+}
+
+
+void CacheWriter::writeDeltaTree( DirInfo * dir, DirInfo * baseDir )
+{
+    checkMemberSize();
+
+    QList<FileInfo *> files;
+    QList<FileInfo *> subDirs;
+    QList<FileInfo *> baseFiles;
+    QList<FileInfo *> baseSubDirs;
+
+    directChildren( dir,     files,	subDirs	    );
+    directChildren( baseDir, baseFiles, baseSubDirs );
+
+    QHash<QString, FileInfo *> baseItems;
+
+    foreach ( FileInfo * item, baseFiles + baseSubDirs )
+	baseItems.insert( item->name(), item );
+
+    QList<FileInfo *> changedFiles;
+
+    foreach ( FileInfo * file, files )
+    {
+	FileInfo * baseFile = baseItems.take( file->name() );
+
+	if ( ! baseFile || ! sameCacheItem( file, baseFile ) )
+	    changedFiles << file;
+    }
+
+    QList<DirInfo *> baseDirs;	// Parallel to subDirs; 0 for a new one
+
+    foreach ( FileInfo * subDir, subDirs )
+    {
+	FileInfo * baseSubDir = baseItems.take( subDir->name() );
+
+	// A file that became a directory is replaced when the reader gets
+	// to the new directory
+
+	baseDirs << ( baseSubDir && baseSubDir->isDirInfo() ? baseSubDir->toDirInfo() : 0 );
+    }
+
+    // Whatever is left in baseItems is gone now
+
+    if ( ! changedFiles.isEmpty() || ! baseItems.isEmpty() || ! sameCacheItem( dir, baseDir ) )
+    {
+	writeItem( dir );
+
+	foreach ( FileInfo * file, changedFiles )
+	    writeItem( file );
+
+	foreach ( const QString & name, baseItems.keys() )
+	{
+	    append( "R\t" );
+	    appendEncoded( name );
+	    append( '\n' );
+	}
+    }
+
+    for ( int i = 0; i < subDirs.size(); ++i )
+    {
+	if ( baseDirs.at( i ) )
+	    writeDeltaTree( subDirs.at( i )->toDirInfo(), baseDirs.at( i ) );
+	else
+	    writeTree( subDirs.at( i ) );
+    }
+}
+
+
+void CacheWriter::writeItem( FileInfo * item )
+{
+    if ( ! item )
+	return;
+
+    // Write file type
+
+    const char * file_type = "";
+    if	    ( item->isFile()		)	file_type = "F";
+    else if ( item->isDir()		)	file_type = "D";
+    else if ( item->isSymLink()		)	file_type = "L";
+    else if ( item->isBlockDevice()	)	file_type = "BlockDev";
+    else if ( item->isCharDevice()	)	file_type = "CharDev";
+    else if ( item->isFifo()		)	file_type = "FIFO";
+    else if ( item->isSocket()		)	file_type = "Socket";
+
+    append( file_type );
+
+    // Write name
+
+    if ( item->isDirInfo() && ! item->isDotEntry() )
+    {
+	// Use absolute path
+
+	append( ' ' );
+	appendEncoded( item->url() );
+    }
+    else
+    {
+	// Use relative path
+
+	append( '\t' );
+	appendEncoded( item->name() );
+    }
+
+
+    // Write size
+
+    append( '\t' );
+    appendSize( item->rawByteSize() );
+
+
+    // Write mtime
+
+    append( "\t0x" );
+    appendHex( (unsigned long) item->mtime() );
+
+    // Optional fields
+
+    if ( item->isSparseFile() )
+    {
+	append( "\tblocks: " );
+
+	if ( item->blocks() < 0 )
+	    append( '-' );
+
+	appendNumber( qAbs( item->blocks() ) );
+    }
+
+    if ( item->isFile() && item->links() > 1 )
+    {
+	append( "\tlinks: " );
+	appendNumber( item->links() );
+    }
+
+    if ( _writeTotals && item->isDirInfo() && ! item->isDotEntry() )
+    {
+	append( "\ttotal-size: " );
+	appendNumber( item->totalSize() );
+	append( "\ttotal-items: " );
+	appendNumber( item->totalItems() );
+    }
+
+    append( '\n' );
+}
+
+
+QByteArray CacheWriter::urlEncoded( const QString & path )
+{
+    // Using a protocol ("scheme") part to avoid directory names with a colon
+    // ":" being cut off because it looks like a URL protocol.
+    QUrl url;
+    url.setScheme( "foo" );
+    url.setPath( path );
+
+    QByteArray encoded = url.toEncoded( QUrl::RemoveScheme );
+
+    if ( encoded.isEmpty() )
+    {
+        logError() << "Invalid file/dir name: " << path << endl;
+    }
+
+    return encoded;
+
+}
+
+
+bool CacheWriter::writeBinaryCache( const QString & fileName, DirTree *tree )
+{
+    if ( ! tree || ! tree->root() )
+	return false;
+
+    return writeBinaryCache( fileName, tree->root()->firstChild() );
+}
+
+
+bool CacheWriter::writeBinaryCache( const QString & fileName, FileInfo * toplevel )
+{
+    FILE * cache = fopen( (const char *) fileName.toUtf8(), "wb" );
+
+    if ( cache == 0 )
+    {
+	logError() << "Can't open " << fileName << ": " << formatErrno() << endl;
+	return false;
+    }
+
+    // Write a preliminary header to reserve the space; the real one can
+    // only be written when all the sizes are known.
+
+    BinaryCacheHeader header;
+    memset( &header, 0, sizeof( header ) );
+    bool ok = fwrite( &header, sizeof( header ), 1, cache ) == 1;
+
+    _nodeCount = 0;
+    _dirIndex.clear();
+    _strings.clear();
+    _subtrees.clear();
+
+    if ( ok )
+	ok = writeBinaryTree( cache, toplevel, BINARY_CACHE_NO_PARENT );
+
+    if ( ok && ! _dirIndex.isEmpty() )
+	ok = fwrite( _dirIndex.constData(), sizeof( quint32 ), _dirIndex.size(), cache ) == (size_t) _dirIndex.size();
+
+    if ( ok && ! _strings.isEmpty() )
+	ok = fwrite( _strings.constData(), 1, _strings.size(), cache ) == (size_t) _strings.size();
+
+    if ( ok && ! _subtrees.isEmpty() )
+	ok = fwrite( _subtrees.constData(), sizeof( BinaryCacheSubtree ), _subtrees.size(), cache ) == (size_t) _subtrees.size();
+
+    memcpy( header.magic, BINARY_CACHE_MAGIC, BINARY_CACHE_MAGIC_LEN );
+    header.byteOrder	  = BINARY_CACHE_BYTE_ORDER;
+    header.headerSize	  = sizeof( BinaryCacheHeader );
+    header.nodeSize	  = sizeof( BinaryCacheNode );
+    header.subtreeSize	  = sizeof( BinaryCacheSubtree );
+    header.nodeCount	  = _nodeCount;
+    header.nodesOffset	  = sizeof( BinaryCacheHeader );
+    header.dirCount	  = _dirIndex.size();
+    header.dirIndexOffset = header.nodesOffset    + header.nodeCount * sizeof( BinaryCacheNode );
+    header.stringsOffset  = header.dirIndexOffset + header.dirCount  * sizeof( quint32 );
+    header.stringsSize	  = _strings.size();
+    header.subtreesOffset = header.stringsOffset  + header.stringsSize;
+
+    if ( ok )
+	ok = fseek( cache, 0, SEEK_SET ) == 0 && fwrite( &header, sizeof( header ), 1, cache ) == 1;
+
+    if ( fclose( cache ) != 0 )
+	ok = false;
+
+    if ( ! ok )
+	logError() << "Error writing " << fileName << ": " << formatErrno() << endl;
+
+    // Free the memory right away
+
+    _dirIndex = QVector<quint32>();
+    _strings  = QByteArray();
+    _subtrees = QVector<BinaryCacheSubtree>();
+
+    return ok;
+}
+
+
+bool CacheWriter::writeBinaryTree( FILE * cache, FileInfo * item, quint32 parentDir )
+{
+    if ( ! item )
+	return true;
+
+    // The children of a dot entry are written as children of its parent
+
+    quint32 dirNo = parentDir;
+
+    if ( ! item->isDotEntry() )
+    {
+	if ( ! writeBinaryItem( cache, item, parentDir ) )
+	    return false;
+
+	if ( ! item->isDir() ) // Anything below would not have a parent
+	    return true;
+
+	dirNo = _dirIndex.size() - 1;
+    }
+
+    if ( item->dotEntry() && ! writeBinaryTree( cache, item->dotEntry(), dirNo ) )
+	return false;
+
+    for ( FileInfo * child = item->firstChild(); child; child = child->next() )
+    {
+	if ( ! writeBinaryTree( cache, child, dirNo ) )
+	    return false;
+    }
+
+    DirInfo * dir = item->isDotEntry() ? 0 : item->toDirInfo();
+
+    if ( dir )
+    {
+	// Now the extent of the subtree is known
+
+	BinaryCacheSubtree & subtree = _subtrees[ dirNo ];
+
+	subtree.endNode		    = _nodeCount;
+	subtree.endDir		    = _dirIndex.size();
+	subtree.totalSize	    = dir->totalSize();
+	subtree.totalAllocatedSize  = dir->totalAllocatedSize();
+	subtree.totalBlocks	    = dir->totalBlocks();
+	subtree.latestMtime	    = dir->latestMtime();
+	subtree.oldestFileMtime	    = dir->oldestFileMtime();
+	subtree.totalItems	    = dir->totalItems();
+	subtree.totalSubDirs	    = dir->totalSubDirs();
+	subtree.totalFiles	    = dir->totalFiles();
+	subtree.totalIgnoredItems   = dir->totalIgnoredItems();
+	subtree.totalUnignoredItems = dir->totalUnignoredItems();
+	subtree.errSubDirCount	    = dir->errSubDirCount();
+
+	if ( dir->readState() == DirQueued  ||
+	     dir->readState() == DirReading ||
+	     dir->readState() == DirAborted	)
+	{
+	    subtree.flags |= BINARY_CACHE_DIR_UNFINISHED;
+	}
+
+	// The children of an estimated directory were never read
+
+	if ( dir->isEstimated() )
+	    subtree.flags |= BINARY_CACHE_DIR_UNFINISHED | BINARY_CACHE_DIR_ESTIMATED;
+    }
+
+    return true;
+}
+
+
+bool CacheWriter::writeBinaryItem( FILE * cache, FileInfo * item, quint32 parentDir )
+{
+    // Only the toplevel directory needs its complete path; for everything
+    // else, the path is implied by the parent.
+
+    QByteArray name = parentDir == BINARY_CACHE_NO_PARENT ?
+	item->url().toUtf8() : item->name().toUtf8();
+
+    BinaryCacheNode node;
+    memset( &node, 0, sizeof( node ) );
+
+    node.size	    = item->rawByteSize();
+    node.blocks	    = item->isSparseFile() ? item->blocks() : -1;
+    node.mtime	    = item->mtime();
+    node.nameOffset = _strings.size();
+    node.nameLength = name.size();
+    node.parentDir  = parentDir;
+    node.mode	    = item->mode();
+    node.links	    = item->links();
+
+    _strings.append( name );
+
+    if ( item->isDir() )
+    {
+	BinaryCacheSubtree subtree;
+	memset( &subtree, 0, sizeof( subtree ) );
+
+	_dirIndex.append( _nodeCount );
+	_subtrees.append( subtree );
+    }
+
+    ++_nodeCount;
+
+    return fwrite( &node, sizeof( node ), 1, cache ) == 1;
+}
+
+
+QString CacheWriter::formatSize( FileSize size )
+{
+    if ( size >= TB && size % TB == 0 )
+        return QString( "%1T" ).arg( size / TB );
+
+    if ( size >= GB && size % GB == 0 )
+        return QString( "%1G" ).arg( size / GB );
+
+    if ( size >= MB && size % MB == 0 )
+        return QString( "%1M" ).arg( size / MB );
+
+    if ( size >= KB && size % KB == 0 )
+        return QString( "%1K" ).arg( size / KB );
+
+    return QString( "%1" ).arg( size );
+}
+
+
+
+
+
+
+
+IncrementalCacheWriter::IncrementalCacheWriter( const QString & fileName,
+						DirTree *	tree,
+						int		compressionLevel ):
+    QObject(),
+    CacheWriter( compressionLevel ),
+    _tree( tree ),
+    _fileName( fileName ),
+    _releaseCandidate( 0 ),
+    _releaseWritten( false )
+{
+    _ok = _tree && openCache( _fileName + CACHE_PART_SUFFIX );
+
+    if ( ! _ok )
+	return;
+
+    append( "[qdirstat " CACHE_FORMAT_VERSION " cache file]\n"
+	    "# Do not edit!\n"
+	    "#\n"
+	    "# Type\tpath\t\tsize\tmtime\t\t<optional fields>\n"
+	    "\n" );
+
+    connect( _tree, SIGNAL( readJobFinished( DirInfo * ) ),
+	     this,  SLOT  ( readJobFinished( DirInfo * ) ) );
+
+    connect( _tree, SIGNAL( deletingChild( FileInfo * ) ),
+	     this,  SLOT  ( deletingChild( FileInfo * ) ) );
+
+    connect( _tree, SIGNAL( clearingSubtree( DirInfo * ) ),
+	     this,  SLOT  ( clearingSubtree( DirInfo * ) ) );
+}
+
+
+IncrementalCacheWriter::~IncrementalCacheWriter()
+{
+    if ( _file )
+    {
+	if ( _inMember && ! _zstd )
+	    deflateEnd( &_zstream );
+
+	fclose( _file );
+	_file = 0;
+
+	QString partName = _fileName + CACHE_PART_SUFFIX;
+	logWarning() << "Removing unfinished cache file " << partName << endl;
+	unlink( (const char *) partName.toUtf8() );
+    }
+}
+
+
+void IncrementalCacheWriter::readJobFinished( DirInfo * dir )
+{
+    if ( ! dir || dir == _tree->root() || dir->isDotEntry() || ! _file )
+	return;
+
+    releaseFinished();
+
+    if ( _writtenDirs.contains( dir ) )
+	return;
+
+    DirInfo * parent = dir->parent();
+
+    if ( ! parent || parent == _tree->root() || _writtenDirs.contains( parent ) )
+	writeDir( dir );
+    else
+	_heldDirs[ parent ].insert( dir );
+
+    if ( _releaseWritten )
+	_releaseCandidate = dir;
+}
+
+
+void IncrementalCacheWriter::writeDir( DirInfo * dir )
+{
+    checkMemberSize();
+
+    QList<FileInfo *> files;
+    QList<FileInfo *> subDirs;
+
+    directChildren( dir, files, subDirs );
+
+    writeItem( dir );
+
+    foreach ( FileInfo * file, files )
+	writeItem( file );
+
+    _writtenDirs.insert( dir );
+
+    QSet<DirInfo *> held = _heldDirs.take( dir );
+
+    foreach ( FileInfo * child, subDirs )
+    {
+	DirInfo * subDir = child->toDirInfo();
+
+	if ( held.contains( subDir ) )
+	    writeDir( subDir );
+	else if ( subDir->readState() != DirQueued && subDir->readState() != DirReading )
+	{
+	    // Not read at all (excluded, mount point): No read job will
+	    // ever finish for it
+
+	    writeTree( subDir );
+	    _writtenDirs.insert( subDir );
+	}
+    }
+}
+
+
+void IncrementalCacheWriter::releaseFinished()
+{
+    DirInfo * dir = _releaseCandidate;
+    _releaseCandidate = 0;
+
+    // Its read job only counts as done after the readJobFinished() signal
+
+    if ( ! dir || dir->isBusy() || ! _writtenDirs.contains( dir ) )
+	return;
+
+    // Everything in a finished subtree with a written top is written: Each
+    // directory was written right after its parent or when its own read
+    // job finished. The toplevel directory stays until the end.
+
+    DirInfo * top = dir;
+
+    while ( top->parent() && top->parent() != _tree->root() && ! top->parent()->isBusy() )
+	top = top->parent();
+
+    if ( top->parent() && top->parent() != _tree->root() )
+	_tree->clearSubtree( top );	// This calls clearingSubtree()
+}
+
+
+bool IncrementalCacheWriter::finish()
+{
+    if ( ! _file )
+	return false;
+
+    disconnect( _tree, 0, this, 0 );
+
+    // Directories whose parent was never read, e.g. after an aborted read
+    // job
+
+    if ( ! _heldDirs.isEmpty() )
+    {
+	logWarning() << "Writing " << _heldDirs.size() << " directories"
+		     << " without their parents to " << _fileName << endl;
+
+	foreach ( DirInfo * parent, _heldDirs.keys() )
+	{
+	    foreach ( DirInfo * dir, _heldDirs.take( parent ) )
+	    {
+		if ( ! _writtenDirs.contains( dir ) )
+		    writeDir( dir );
+	    }
+	}
+    }
+
+    QString partName = _fileName + CACHE_PART_SUFFIX;
+    _ok = closeCache( partName );
+
+    if ( _ok && rename( (const char *) partName.toUtf8(), (const char *) _fileName.toUtf8() ) != 0 )
+    {
+	logError() << "Can't rename " << partName << " to " << _fileName
+		   << ": " << formatErrno() << endl;
+	_ok = false;
+    }
+
+    _writtenDirs.clear();
+    _heldDirs.clear();
+
+    return _ok;
+}
+
+
+void IncrementalCacheWriter::deletingChild( FileInfo * child )
+{
+    forget( child );
+}
+
+
+void IncrementalCacheWriter::clearingSubtree( DirInfo * subtree )
+{
+    for ( FileInfo * child = subtree->firstChild(); child; child = child->next() )
+	forget( child );
+
+    if ( subtree->attic() )
+	forget( subtree->attic() );
+}
+
+
+void IncrementalCacheWriter::forget( FileInfo * item )
+{
+    if ( ! item || ! item->isDirInfo() )
+	return;
+
+    DirInfo * dir = item->toDirInfo();
+
+    _writtenDirs.remove( dir );
+    _heldDirs.remove( dir );
+
+    if ( dir == _releaseCandidate )
+	_releaseCandidate = 0;
+
+    QHash<DirInfo *, QSet<DirInfo *> >::iterator it = _heldDirs.find( dir->parent() );
+
+    if ( it != _heldDirs.end() )
+	it.value().remove( dir );
+
+    clearingSubtree( dir );
+}
+
+
+
+
+CacheMember::CacheMember( const QString & fileName, qint64 offset, qint64 size, bool zstd ):
+    _fileName( fileName ),
+    _offset( offset ),
+    _size( size ),
+    _zstd( zstd ),
+    _ok( false ),
+    _done( false )
+{
+    // NOP
+}
+
+
+void CacheMember::inflate()
+{
+    bool ok = false;
+    int fd = ::open( (const char *) _fileName.toUtf8(), O_RDONLY | O_CLOEXEC );
+
+    if ( fd >= 0 )
+    {
+	QByteArray compressed( _size, Qt::Uninitialized );
+	qint64 pos = 0;
+
+	while ( pos < _size )
+	{
+	    ssize_t len = pread( fd, compressed.data() + pos, _size - pos, _offset + pos );
+
+	    if ( len <= 0 )
+		break;
+
+	    pos += len;
+	}
+
+	::close( fd );
+
+	if ( pos == _size )
+	    ok = _zstd ? decompressZstd( compressed ) : inflateData( compressed );
+    }
+
+    QMutexLocker locker( &_mutex );
+    _ok	  = ok;
+    _done = true;
+    _doneCondition.wakeAll();
+}
+
+
+bool CacheMember::inflateData( const QByteArray & compressed )
+{
+    z_stream zstream;
+    memset( &zstream, 0, sizeof( zstream ) );
+
+    // windowBits + 16: Expect a gzip header and trailer
+
+    if ( inflateInit2( &zstream, MAX_WBITS + 16 ) != Z_OK )
+	return false;
+
+    zstream.next_in  = (Bytef *) compressed.constData();
+    zstream.avail_in = compressed.size();
+
+    QByteArray data;
+    data.reserve( qMin( (qint64) CACHE_MEMBER_SIZE + MAX_CACHE_LINE_LEN,
+			(qint64) compressed.size() * 8 ) );
+
+    char out[ 64 * 1024 ];
+    int result;
+
+    do
+    {
+	zstream.next_out  = (Bytef *) out;
+	zstream.avail_out = sizeof( out );
+	result = ::inflate( &zstream, Z_NO_FLUSH );
+
+	if ( result != Z_OK && result != Z_STREAM_END )
+	    break;
+
+	data.append( out, sizeof( out ) - zstream.avail_out );
+
+    } while ( result != Z_STREAM_END && zstream.avail_in > 0 );
+
+    inflateEnd( &zstream );
+
+    if ( result != Z_STREAM_END )
+	return false;
+
+    _data = data;
+
+    return true;
+}
+
+
+bool CacheMember::decompressZstd( const QByteArray & compressed )
+{
+#if HAVE_LIBZSTD
+    ZSTD_DCtx * context = ZSTD_createDCtx();
+
+    if ( ! context )
+	return false;
+
+    QByteArray dictionary = CacheZstdDictionary::data();
+
+    if ( ! dictionary.isEmpty() )
+	ZSTD_DCtx_loadDictionary( context, dictionary.constData(), dictionary.size() );
+
+    QByteArray data;
+    data.reserve( qMin( (qint64) CACHE_MEMBER_SIZE + MAX_CACHE_LINE_LEN,
+			(qint64) compressed.size() * 8 ) );
+
+    char out[ 64 * 1024 ];
+    ZSTD_inBuffer input = { compressed.constData(), (size_t) compressed.size(), 0 };
+    size_t result = 0;
+    bool   full	  = false;
+
+    // This also reads several frames one after another (a file without an
+    // index) and skips skippable frames.
+
+    do
+    {
+	ZSTD_outBuffer output = { out, sizeof( out ), 0 };
+	result = ZSTD_decompressStream( context, &output, &input );
+
+	if ( ZSTD_isError( result ) )
+	    break;
+
+	data.append( out, output.pos );
+	full = output.pos == output.size;
+
+    } while ( input.pos < input.size || full );
+
+    ZSTD_freeDCtx( context );
+
+    // 0: The last frame is complete
+
+    if ( result != 0 )
+	return false;
+
+    _data = data;
+
+    return true;
+#else
+    Q_UNUSED( compressed );
+    return false;
+#endif
+}
+
+
+QByteArray CacheMember::waitForData( bool & ok_ret )
+{
+    QMutexLocker locker( &_mutex );
+
+    while ( ! _done )
+	_doneCondition.wait( &_mutex );
+
+    ok_ret = _ok;
+
+    return _data;
+}
+
+
+
+
+CacheStream::CacheStream( gzFile cache ):
+    _cache( cache ),
+    _ok( true ),
+    _done( false ),
+    _canceled( false )
+{
+    // NOP
+}
+
+
+CacheStream::~CacheStream()
+{
+    if ( _cache )
+	gzclose( _cache );
+}
+
+
+void CacheStream::inflate()
+{
+    QByteArray pending;		// not up to a line boundary yet
+    char buf[ 64 * 1024 ];
+    bool ok = true;
+
+    while ( true )
+    {
+	int len = gzread( _cache, buf, sizeof( buf ) );
+
+	if ( len < 0 )
+	{
+	    ok = false;
+	    len = 0;
+	}
+
+	pending.append( buf, len );
+
+	if ( len > 0 && pending.size() < CACHE_STREAM_BLOCK_SIZE )
+	    continue;
+
+	QByteArray block;
+
+	if ( len == 0 )		// The end: Whatever is left
+	{
+	    block = pending;
+	    pending.clear();
+	}
+	else
+	{
+	    int newline = pending.lastIndexOf( '\n' );
+
+	    if ( newline < 0 )	// A very long line: Wait for its end
+		continue;
+
+	    block = pending.left( newline + 1 );
+	    pending.remove( 0, newline + 1 );
+	}
+
+	if ( ! block.isEmpty() && ! addBlock( block ) )
+	    return;		// Canceled
+
+	if ( len == 0 )
+	    break;
+    }
+
+    QMutexLocker locker( &_mutex );
+    _ok	  = ok;
+    _done = true;
+    _blockAdded.wakeAll();
+}
+
+
+bool CacheStream::addBlock( const QByteArray & block )
+{
+    QMutexLocker locker( &_mutex );
+
+    while ( _blocks.size() >= CACHE_STREAM_BLOCKS_AHEAD && ! _canceled )
+	_blockTaken.wait( &_mutex );
+
+    if ( _canceled )
+	return false;
+
+    _blocks << block;
+    _blockAdded.wakeAll();
+
+    return true;
+}
+
+
+QByteArray CacheStream::waitForBlock( bool & ok_ret, bool & end_ret )
+{
+    QMutexLocker locker( &_mutex );
+
+    while ( _blocks.isEmpty() && ! _done )
+	_blockAdded.wait( &_mutex );
+
+    if ( ! _blocks.isEmpty() )
+    {
+	ok_ret	= true;
+	end_ret = false;
+	_blockTaken.wakeAll();
+
+	return _blocks.takeFirst();
+    }
+
+    ok_ret  = _ok;
+    end_ret = true;
+
+    return QByteArray();
+}
+
+
+void CacheStream::cancel()
+{
+    QMutexLocker locker( &_mutex );
+    _canceled = true;
+    _blockTaken.wakeAll();
+}
+
+
+
+
+CacheReader::CacheReader( const QString & fileName,
+			  DirTree *	  tree,
+			  DirInfo *	  parent ):
+    QObject()
+{
+    init( fileName, tree, parent );
+    _fileSize = QFileInfo( fileName ).size();
+
+    if ( openBinary( fileName ) )
+	return;
+
+    int fd = ::open( (const char *) fileName.toUtf8(), O_RDONLY | O_CLOEXEC );
+
+    if ( fd >= 0 )
+    {
+	bool haveIndex = readIndex( fd );
+	::close( fd );
+
+	if ( _zstd && ! HAVE_LIBZSTD )
+	{
+	    logError() << "Can't read " << fileName << ": This version was built without zstd" << endl;
+	    _ok = false;
+	    emit error();
+	    return;
+	}
+
+	if ( haveIndex )
+	{
+	    logDebug() << "Inflating " << _memberOffsets.size()
+		       << ( _zstd ? " zstd frames" : " gzip members" )
+		       << " of " << fileName << " in parallel" << endl;
+
+	    scheduleMembers();
+	    checkHeader();
+	    return;
+	}
+    }
+
+    if ( ! openStream() )
+    {
+	logError() << "Can't open " << fileName << ": " << formatErrno() << endl;
+	_ok = false;
+	emit error();
+	return;
+    }
+
+    // logDebug() << "Opening " << fileName << " OK" << endl;
+    checkHeader();
+}
+
+
+CacheReader::CacheReader( BinaryCacheFilePtr cacheFile,
+			  DirTree *	     tree,
+			  DirInfo *	     dir,
+			  quint64	     dirNo ):
+    QObject()
+{
+    init( cacheFile->fileName(), tree, dir );
+
+    _binaryFile	    = cacheFile;
+    _mapped	    = cacheFile->data();
+    _binaryHeader   = cacheFile->header();
+    _lazyDepth	    = 1;
+    _binaryDirBase  = dirNo;
+    _binaryDirs	    << dir;
+    _binaryDirDepths << 0;
+
+    BinaryCacheSubtree subtree = cacheFile->subtree( dirNo );
+
+    _firstNode = dirNo < _binaryHeader.dirCount ? cacheFile->dirNode( dirNo ) + 1 : 0;
+    _nextNode  = _firstNode;
+    _endNode   = subtree.endNode;
+
+    if ( _firstNode == 0 || _endNode < _firstNode || _endNode > _binaryHeader.nodeCount ||
+	 subtree.endDir <= dirNo || subtree.endDir > _binaryHeader.dirCount )
+    {
+	logError() << _fileName << ": Bad subtree for directory #" << dirNo << endl;
+	_ok	 = false;
+	_endNode = _firstNode;
+    }
+}
+
+
+void CacheReader::init( const QString & fileName, DirTree * tree, DirInfo * parent )
+{
+    _fileName		= fileName;
+    _buffer[0]		= 0;
+    _line		= _buffer;
+    _lineNo		= 0;
+    _ok			= true;
+    _errorCount         = 0;
+    _tree		= tree;
+    _toplevel		= parent;
+    _lastDir		= 0;
+    _skipFiles		= false;
+    _isDelta		= false;
+    _finalizeTree	= true;
+    _mounted		= false;
+    _fileSize		= 0;
+    _mapped		= 0;
+    _firstNode		= 0;
+    _nextNode		= 0;
+    _endNode		= 0;
+    _binaryDirBase	= 0;
+    _lazyDepth		= 0;
+    _nextMember		= 0;
+    _memberPos		= 0;
+    _membersEnd		= false;
+    _zstd		= false;
+    memset( &_binaryHeader, 0, sizeof( _binaryHeader ) );
+}
+
+
+CacheReader::~CacheReader()
+{
+    if ( _stream )
+	_stream->cancel();	// The worker thread deletes it when it's done
+
+    logDebug() << "Cache reading finished" << endl;
+
+    if ( _toplevel && _finalizeTree )
+    {
+	// logDebug() << "Finalizing " << _toplevel << endl;
+	finalizeTree();
+
+	if ( _validateTotals && _binaryFile && _binaryFile->hasSubtrees() )
+	    checkTotals();
+    }
+
+    emit finished();
+}
+
+
+void CacheReader::rewind()
+{
+    _lastDir   = 0;
+    _skipFiles = false;
+    _dirStack.clear();
+
+    if ( _mapped )
+    {
+	// Keep only the starting point of a pending subtree
+
+	int keep = _firstNode > 0 ? 1 : 0;
+
+	_nextNode = _firstNode;
+	_binaryDirs.resize( keep );
+	_binaryDirDepths.resize( keep );
+    }
+
+    if ( _stream )
+    {
+	_stream->cancel();
+	_memberData.clear();
+	_memberPos  = 0;
+	_membersEnd = false;
+
+	if ( openStream() )
+	    checkHeader();	// skip cache header
+	else
+	{
+	    logError() << "Can't open " << _fileName << ": " << formatErrno() << endl;
+	    _ok = false;
+	    emit error();
+	}
+    }
+
+    if ( ! _memberOffsets.isEmpty() )
+    {
+	_members.clear();	// Those in progress are finished and discarded
+	_memberData.clear();
+	_nextMember = 0;
+	_memberPos  = 0;
+	_membersEnd = false;
+
+	scheduleMembers();
+	checkHeader();
+    }
+}
+
+
+bool CacheReader::read( int maxLines )
+{
+    if ( _mapped )
+    {
+	readBinary( maxLines );
+
+	return ! eof();
+    }
+
+    while ( ! atEnd()
+	    && _ok
+	    && ( maxLines == 0 || --maxLines > 0 ) )
+    {
+	if ( readLine() )
+	{
+	    splitLine();
+	    addItem();
+	}
+    }
+
+    return _ok && ! atEnd();
+}
+
+
+bool CacheReader::readFor( int millisec )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    bool more;
+
+    do
+    {
+	more = read( CACHE_READ_CHUNK_LINES );
+
+    } while ( more && timer.elapsed() < millisec );
+
+    return more;
+}
+
+
+void CacheReader::addItem()
+{
+    if ( _isDelta && fieldsCount() >= 2 && strcasecmp( field( 0 ), "R" ) == 0 )
+    {
+	removeDeltaItem();
+	return;
+    }
+
+    if ( fieldsCount() < 4 )
+    {
+	logError() << "Syntax error in " << _fileName << ":" << _lineNo
+		   << ": Expected at least 4 fields, saw only " << fieldsCount()
+		   << endl;
+
+	setReadError( _lastDir );
+
+	if ( ++_errorCount > MAX_ERROR_COUNT )
+	{
+	    logError() << "Too many syntax errors. Giving up." << endl;
+	    _ok = false;
+	    emit error();
+	}
+
+	return;
+    }
+
+    int n = 0;
+    char * type		= field( n++ );
+    char * raw_path	= field( n++ );
+    char * size_str	= field( n++ );
+    char * mtime_str	= field( n++ );
+    char * blocks_str	= 0;
+    char * links_str	= 0;
+
+    while ( fieldsCount() > n+1 )
+    {
+	char * keyword	= field( n++ );
+	char * val_str	= field( n++ );
+
+	if ( strcasecmp( keyword, "blocks:" ) == 0 ) blocks_str = val_str;
+	if ( strcasecmp( keyword, "links:"  ) == 0 ) links_str	= val_str;
+    }
+
+
+    // Type
+
+    mode_t mode = S_IFREG;
+
+    if	    ( strcasecmp( type, "F"	   ) == 0 )	mode = S_IFREG;
+    else if ( strcasecmp( type, "D"	   ) == 0 )	mode = S_IFDIR;
+    else if ( strcasecmp( type, "L"	   ) == 0 )	mode = S_IFLNK;
+    else if ( strcasecmp( type, "BlockDev" ) == 0 )	mode = S_IFBLK;
+    else if ( strcasecmp( type, "CharDev"  ) == 0 )	mode = S_IFCHR;
+    else if ( strcasecmp( type, "FIFO"	   ) == 0 )	mode = S_IFIFO;
+    else if ( strcasecmp( type, "Socket"   ) == 0 )	mode = S_IFSOCK;
+
+    bool isDir	  = ( mode == S_IFDIR );
+    bool absolute = ( *raw_path == '/' );
+
+
+    // Path (decoded in place in the line buffer)
+
+    int pathLen = unescapePath( raw_path );
+
+
+    // Size
+
+    char * end = 0;
+    FileSize size = strtoll( size_str, &end, 10 );
+
+    if ( end )
+    {
+	switch ( *end )
+	{
+	    case 'K':	size *= KB; break;
+	    case 'M':	size *= MB; break;
+	    case 'G':	size *= GB; break;
+	    case 'T':	size *= TB; break;
+	    default: break;
+	}
+    }
+
+
+    // MTime
+
+    time_t mtime = strtol( mtime_str, 0, 0 );
+
+
+    // Blocks
+
+    FileSize blocks = blocks_str ? strtoll( blocks_str, 0, 10 ) : -1;
+
+
+    // Links
+
+    int links = links_str ? atoi( links_str ) : 1;
+
+
+    //
+    // Find the parent
+    //
+
+    DirInfo *	 parent	   = 0;
+    const char * name	   = raw_path;
+    int		 nameLen   = pathLen;
+    int		 parentLen = 0;
+
+    if ( absolute )
+    {
+	_lastDir   = 0;
+	_skipFiles = false;
+
+	// Split off the name. The toplevel directory "/" has no parent path.
+
+	if ( pathLen > 1 )
+	{
+	    parentLen = pathLen - 1;
+
+	    while ( raw_path[ parentLen ] != '/' )
+		--parentLen;
+
+	    name    = raw_path + parentLen + 1;
+	    nameLen = pathLen - parentLen - 1;
+
+	    if ( parentLen == 0 )	// Parent is "/"
+		parentLen = 1;
+	}
+
+	// The parent is normally the last directory or one of its ancestors
+
+	parent = findStackedDir( raw_path, parentLen );
+
+	if ( parent && parent->isExcluded() )
+	{
+	    // Everything below an excluded directory is ignored
+
+	    if ( isDir )
+	    {
+		pushDir( parent, raw_path, pathLen );
+		_skipFiles = true;
+	    }
+
+	    return;
+	}
+    }
+    else
+    {
+	if ( _skipFiles )
+	    return;
+
+	parent = _lastDir;
+    }
+
+    if ( _isDelta )
+    {
+	// An item of a delta replaces any existing one with the same path
+
+	FileInfo * existing = 0;
+
+	if ( isDir && absolute )
+	    existing = _tree->locate( QString::fromUtf8( raw_path, pathLen ) );
+	else if ( parent )
+	    existing = findDeltaChild( parent, QString::fromUtf8( name, nameLen ) );
+
+	if ( existing && isDir && existing->isDirInfo() && ! existing->isDotEntry() )
+	{
+	    // A changed directory: Keep its children. The following items
+	    // without a path are relative to it.
+
+	    DirInfo * dir = existing->toDirInfo();
+	    dir->setOwnStat( size, mtime );
+	    _lastDir = dir;
+	    pushDir( dir, raw_path, pathLen );
+
+	    return;
+	}
+
+	if ( existing )
+	{
+	    if ( existing == _toplevel )
+	    {
+		logError() << _fileName << ":" << _lineNo << ": "
+			   << "Can't replace the toplevel directory " << existing << endl;
+		return;
+	    }
+
+	    deleteQuietly( existing );
+	}
+    }
+
+    if ( ! parent && _tree->root() )
+    {
+	parent = locateParent( QString::fromUtf8( raw_path, parentLen ),
+			       QString::fromUtf8( name, nameLen ) );
+
+	if ( ! parent )
+	    return;	// Ignore this cache line completely
+    }
+
+
+    //
+    // Create a new item
+    //
+
+    QString itemName = QString::fromUtf8( name, nameLen );
+
+    if ( isDir )
+    {
+	QString url = isToplevelParent( parent ) ? QString::fromUtf8( raw_path, pathLen ) : itemName;
+	DirInfo * dir = createDir( parent, url, itemName, mode, size, mtime );
+	_lastDir = dir;
+
+	if ( absolute )
+	    pushDir( dir, raw_path, pathLen );
+
+	if ( dir->isExcluded() )
+	{
+	    _lastDir   = 0;
+	    _skipFiles = true;
+	}
+    }
+    else
+    {
+	if ( parent )
+	{
+#if VERBOSE_CACHE_FILE_INFOS
+	    logDebug() << "Creating FileInfo for "
+		       << buildPath( parent->debugUrl(), itemName ) << endl;
+#endif
+
+	    FileInfo * item = new FileInfo( _tree, parent, itemName,
+					    mode, size, mtime,
+					    blocks, links );
+	    parent->insertChild( item );
+	    _tree->childAddedNotify( item );
+	}
+	else
+	{
+	    logError() << _fileName << ":" << _lineNo << ": "
+		       << "No parent for item " << itemName << endl;
+	}
+    }
+}
+
+
+void CacheReader::removeDeltaItem()
+{
+    char * raw_path = field( 1 );
+    bool absolute   = ( *raw_path == '/' );
+    int	 pathLen    = unescapePath( raw_path );
+    QString path    = QString::fromUtf8( raw_path, pathLen );
+    FileInfo * item = 0;
+
+    if ( absolute )
+	item = _tree->locate( path );
+    else if ( _lastDir )
+	item = findDeltaChild( _lastDir, path );
+
+    if ( ! item || item == _toplevel )
+    {
+	logWarning() << _fileName << ":" << _lineNo << ": "
+		     << "Can't remove " << path << endl;
+	return;
+    }
+
+    // The directory stack might still refer to a directory in that subtree
+
+    if ( item->isDirInfo() )
+	_dirStack.clear();
+
+    deleteQuietly( item );
+}
+
+
+FileInfo * CacheReader::findDeltaChild( DirInfo * dir, const QString & name ) const
+{
+    FileInfo * child = dir->findChild( name );
+
+    if ( ! child && dir->dotEntry() )
+	child = dir->dotEntry()->toDirInfo()->findChild( name );
+
+    return child;
+}
+
+
+void CacheReader::deleteQuietly( FileInfo * item )
+{
+    if ( item == _lastDir || ( _lastDir && _lastDir->isInSubtree( item ) ) )
+    {
+	_lastDir   = 0;
+	_skipFiles = false;
+    }
+
+    _tree->forgetFileTypes( item );
+    _tree->hardLinkIndex()->remove( item );
+
+    if ( item->parent() )
+	item->parent()->deletingChild( item );
+
+    delete item;
+}
+
+
+DirInfo * CacheReader::findStackedDir( const char * path, int len )
+{
+    while ( ! _dirStack.isEmpty() )
+    {
+	const DirStackEntry & top = _dirStack.last();
+
+	if ( top.pathLen == len && memcmp( _dirPath.constData(), path, len ) == 0 )
+	    return top.dir;
+
+	if ( top.pathLen < len )
+	    break;
+
+	_dirStack.removeLast();
+    }
+
+    // Not there (the cache file is not in the usual order):
+    // The caller will have to search the tree
+
+    _dirStack.clear();
+
+    return 0;
+}
+
+
+void CacheReader::pushDir( DirInfo * dir, const char * path, int len )
+{
+    // All remaining entries are ancestors of 'dir', so their paths are also
+    // prefixes of the new _dirPath
+
+    _dirPath.resize( len );
+    memcpy( _dirPath.data(), path, len );
+
+    DirStackEntry entry;
+    entry.pathLen = len;
+    entry.dir	  = dir;
+    _dirStack.append( entry );
+}
+
+
+bool CacheReader::isToplevelParent( DirInfo * parent ) const
+{
+    return parent == _tree->root() || ( _mounted && parent == _toplevel );
+}
+
+
+DirInfo * CacheReader::locateParent( const QString & path, const QString & name )
+{
+    DirInfo * parent = 0;
+
+    if ( _mounted )
     {
-	switch ( *end )
+	// The paths are only meaningful below the toplevel directory of the
+	// cache; the tree's URLs are different here.
+
+	FileInfo * top = _toplevel ? _toplevel->firstChild() : 0;
+
+	if ( ! top )
+	    parent = _toplevel;
+	else
+	    parent = dynamic_cast<DirInfo *> ( top->locate( path ) );
+    }
+    else if ( ! _tree->root()->hasChildren() )
+	parent = _tree->root();
+
+    // Try the easy way first - the starting point of this cache
+
+    if ( ! parent && _toplevel && ! _mounted )
+	parent = dynamic_cast<DirInfo *> ( _toplevel->locate( path ) );
+
+#if DEBUG_LOCATE_PARENT
+    if ( parent )
+	logDebug() << "Using cache starting point as parent for " << buildPath( path, name ) << endl;
+#endif
+
+
+    // Fallback: Search the entire tree
+
+    if ( ! parent && ! _mounted )
+    {
+	parent = dynamic_cast<DirInfo *> ( _tree->locate( path ) );
+
+#if DEBUG_LOCATE_PARENT
+	if ( parent )
+	    logDebug() << "Located parent " << path << " in tree" << endl;
+#endif
+    }
+
+    if ( ! parent ) // Still nothing?
+    {
+	logError() << _fileName << ":" << _lineNo << ": "
+		   << "Could not locate parent \"" << path << "\" for "
+		   << name << endl;
+
+	if ( ++_errorCount > MAX_ERROR_COUNT )
 	{
-	    case 'K':	size *= KB; break;
-	    case 'M':	size *= MB; break;
-	    case 'G':	size *= GB; break;
-	    case 'T':	size *= TB; break;
-	    default: break;
+	    logError() << "Too many consistency errors. Giving up." << endl;
+	    _ok = false;
+	    emit error();
+	}
+
+#if DEBUG_LOCATE_PARENT
+	THROW( Exception( "Could not locate cache item parent" ) );
+#endif
+    }
+
+    return parent;
+}
+
+
+DirInfo * CacheReader::createDir( DirInfo *	  parent,
+				  const QString & url,
+				  const QString & name,
+				  mode_t	  mode,
+				  FileSize	  size,
+				  time_t	  mtime )
+{
+#if VERBOSE_CACHE_DIRS
+    logDebug() << "Creating DirInfo for " << url << " with parent " << parent << endl;
+#endif
+    DirInfo * dir = new DirInfo( _tree, parent, url,
+				 mode, size, mtime );
+    CHECK_NEW( dir );
+    dir->setReadState( DirReading );
+
+    if ( parent )
+	parent->insertChild( dir );
+
+    if ( ! _tree->root() )
+    {
+	_tree->setRoot( dir );
+	_toplevel = dir;
+    }
+
+    if ( ! _toplevel )
+	_toplevel = dir;
+
+    _tree->childAddedNotify( dir );
+
+    if ( dir != _toplevel )
+    {
+	if ( ExcludeRules::instance()->match( dir->url(), dir->name() ) )
+	{
+	    logDebug() << "Excluding " << name << endl;
+	    dir->setExcluded();
+	    dir->setReadState( DirOnRequestOnly );
+	    dir->finalizeLocal();
+	    _tree->sendReadJobFinished( dir );
 	}
     }
 
+    return dir;
+}
 
-    // MTime
 
-    time_t mtime = strtol( mtime_str, 0, 0 );
+bool CacheReader::openBinary( const QString & fileName )
+{
+    int fd = open( fileName.toUtf8(), O_RDONLY | O_CLOEXEC );
+
+    if ( fd < 0 )
+	return false;	// Leave the error handling to gzopen()
+
+    struct stat statInfo;
+    char magic[ BINARY_CACHE_MAGIC_LEN ];
+
+    if ( fstat( fd, &statInfo ) != 0 ||
+	 (size_t) statInfo.st_size < offsetof( BinaryCacheHeader, subtreesOffset ) ||
+	 pread( fd, magic, sizeof( magic ), 0 ) != (ssize_t) sizeof( magic ) ||
+	 memcmp( magic, BINARY_CACHE_MAGIC, BINARY_CACHE_MAGIC_LEN ) != 0 )
+    {
+	close( fd );
+
+	return false;	// Not a binary cache file
+    }
+
+    void * mapped = mmap( 0, statInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( mapped == MAP_FAILED )
+    {
+	logError() << "Can't mmap " << fileName << ": " << formatErrno() << endl;
+	_ok = false;
+	emit error();
+
+	return true;
+    }
+
+    _mapped = (const char *) mapped;
+    quint64 size = statInfo.st_size;
+
+    madvise( mapped, size, MADV_SEQUENTIAL );
+    memset( &_binaryHeader, 0, sizeof( _binaryHeader ) );
+    memcpy( &_binaryHeader, _mapped, qMin( (quint64) sizeof( _binaryHeader ), size ) );
+
+    // Make sure everything is inside the file, so the reader never needs
+    // to check that again.
+
+    BinaryCacheHeader & header = _binaryHeader;
+
+    if ( header.headerSize < sizeof( BinaryCacheHeader ) )
+    {
+	// Written before there was a subtree table
+
+	header.subtreeSize    = 0;
+	header.subtreesOffset = 0;
+    }
+
+    if ( header.byteOrder != BINARY_CACHE_BYTE_ORDER )
+    {
+	logError() << _fileName << ": Cache file from a machine with a different byte order" << endl;
+	_ok = false;
+    }
+    else if ( header.headerSize	    < offsetof( BinaryCacheHeader, subtreesOffset )	||
+	      header.nodeSize	    < sizeof( BinaryCacheNode )				||
+	      header.nodesOffset    > size						||
+	      header.nodeCount	    > ( size - header.nodesOffset ) / header.nodeSize	||
+	      header.dirIndexOffset > size						||
+	      header.dirCount	    > ( size - header.dirIndexOffset ) / sizeof( quint32 ) ||
+	      header.stringsOffset  > size						||
+	      header.stringsSize    > size - header.stringsOffset			||
+	      ( header.subtreesOffset &&
+		( header.subtreeSize	< sizeof( BinaryCacheSubtree )			||
+		  header.subtreesOffset > size						||
+		  header.dirCount	> ( size - header.subtreesOffset ) / header.subtreeSize ) ) )
+    {
+	logError() << _fileName << ": Corrupt binary cache file" << endl;
+	_ok = false;
+    }
+
+    // The BinaryCacheFile takes over the mapping in any case
+
+    _binaryFile = BinaryCacheFilePtr( new BinaryCacheFile( fileName, _mapped, size, header ) );
+    CHECK_NEW( _binaryFile.data() );
+
+    if ( _ok )
+    {
+	_endNode = header.nodeCount;
+	logDebug() << "Opened binary cache file " << _fileName << " with " << header.nodeCount << " items" << endl;
+    }
+    else
+	emit error();
+
+    return true;
+}
+
+
+BinaryCacheFile::BinaryCacheFile( const QString &	    fileName,
+				  const char *		    data,
+				  size_t		    size,
+				  const BinaryCacheHeader & header ):
+    _fileName( fileName ),
+    _data( data ),
+    _size( size ),
+    _header( header )
+{
+    // NOP
+}
+
+
+BinaryCacheFile::~BinaryCacheFile()
+{
+    if ( _data )
+	munmap( (void *) _data, _size );
+}
+
+
+BinaryCacheSubtree BinaryCacheFile::subtree( quint64 dirNo ) const
+{
+    BinaryCacheSubtree subtree;
+
+    if ( hasSubtrees() && dirNo < _header.dirCount )
+	memcpy( &subtree, _data + _header.subtreesOffset + dirNo * _header.subtreeSize, sizeof( subtree ) );
+    else
+	memset( &subtree, 0, sizeof( subtree ) );
+
+    return subtree;
+}
+
+
+quint64 BinaryCacheFile::dirNode( quint64 dirNo ) const
+{
+    quint32 nodeNo = 0;
+
+    if ( dirNo < _header.dirCount )
+	memcpy( &nodeNo, _data + _header.dirIndexOffset + dirNo * sizeof( quint32 ), sizeof( nodeNo ) );
+
+    return nodeNo;
+}
+
+
+BinaryCacheNode BinaryCacheFile::node( quint64 nodeNo ) const
+{
+    // memcpy() because the file does not guarantee any alignment
+
+    BinaryCacheNode node;
+    memcpy( &node, _data + _header.nodesOffset + nodeNo * _header.nodeSize, sizeof( node ) );
+
+    return node;
+}
+
+
+QString BinaryCacheFile::name( const BinaryCacheNode & node ) const
+{
+    if ( node.nameOffset > _header.stringsSize ||
+	 node.nameLength > _header.stringsSize - node.nameOffset )
+    {
+	return QString();
+    }
+
+    return QString::fromUtf8( _data + _header.stringsOffset + node.nameOffset, node.nameLength );
+}
+
+
+
+
+
+
+CacheBaseline::CacheBaseline( const QString & fileName ):
+    _fileName( fileName )
+{
+    BinaryCacheFilePtr cacheFile;
+
+    {
+	CacheReader reader( fileName, 0 );
+
+	if ( reader.ok() )
+	    cacheFile = reader.binaryFile();
+    }
+
+    if ( ! cacheFile || ! cacheFile->hasSubtrees() )
+    {
+	logWarning() << fileName << " is not a binary cache file with a subtree table;"
+		     << " it cannot be used as a baseline" << endl;
+	return;
+    }
+
+    // The directory index is in the order of the nodes, so the parent of
+    // each directory is always already known.
+
+    quint64 dirCount  = cacheFile->header().dirCount;
+    quint64 nodeCount = cacheFile->header().nodeCount;
+    QVector<QString> paths( dirCount );
+
+    for ( quint64 dirNo = 0; dirNo < dirCount; ++dirNo )
+    {
+	quint64 nodeNo = cacheFile->dirNode( dirNo );
+
+	if ( nodeNo >= nodeCount )
+	    continue;
+
+	BinaryCacheNode node = cacheFile->node( nodeNo );
+	QString name = cacheFile->name( node );
+	QString path;
+
+	if ( node.parentDir == BINARY_CACHE_NO_PARENT )
+	    path = name;
+	else if ( node.parentDir < dirNo && ! paths.at( node.parentDir ).isEmpty() )
+	{
+	    const QString & parentPath = paths.at( node.parentDir );
+	    path = parentPath == "/" ? "/" + name : parentPath + "/" + name;
+	}
+
+	if ( ! path.isEmpty() )
+	{
+	    paths[ dirNo ] = path;
+
+	    // A directory that was not read completely has to be read again,
+	    // but its subdirectories might still be usable
+
+	    if ( ! ( cacheFile->subtree( dirNo ).flags & BINARY_CACHE_DIR_UNFINISHED ) )
+		_dirs.insert( path, dirNo );
+	}
+    }
+
+    _cacheFile = cacheFile;
+    logInfo() << "Using " << fileName << " with " << _dirs.size() << " directories as baseline" << endl;
+}
+
+
+CacheBaseline::CacheBaseline( DirInfo * subtree ):
+    _fileName( subtree ? subtree->url() : QString() )
+{
+    if ( subtree )
+	addDir( subtree );
+
+    logDebug() << "Using " << _dirs.size() << " directories in memory as baseline for "
+	       << _fileName << endl;
+}
+
+
+void CacheBaseline::addDir( DirInfo * dir )
+{
+    // Directories that were not read completely are read again
+
+    if ( dir->readState() != DirFinished || dir->isExcluded() || dir->isEstimated() )
+	return;
+
+    quint32 dirNo = _memChildren.size();
+    _dirs.insert( dir->url(), dirNo );
+    _memMtimes << (qint64) dir->mtime();
+    _memChildren.resize( dirNo + 1 );
+
+    QVector<BinaryCacheNode> children;
+    QList<DirInfo *> subDirs;
+    addChildren( dir, children, subDirs );
+    _memChildren[ dirNo ] = children;
+
+    foreach ( DirInfo * subDir, subDirs )
+	addDir( subDir );
+}
+
+
+void CacheBaseline::addChildren( FileInfo *		    parent,
+				 QVector<BinaryCacheNode> & children_ret,
+				 QList<DirInfo *> &	    subDirs_ret )
+{
+    for ( FileInfo * child = parent->firstChild(); child; child = child->next() )
+    {
+	if ( child->isPseudoDir() )
+	{
+	    addChildren( child, children_ret, subDirs_ret );
+	    continue;
+	}
+
+	QByteArray name = child->name().toUtf8();
+
+	BinaryCacheNode node;
+	node.size	= child->rawByteSize();
+	node.blocks	= child->isSparseFile() ? child->blocks() : -1;
+	node.mtime	= child->mtime();
+	node.nameOffset = _memNames.size();
+	node.nameLength = name.size();
+	node.parentDir	= 0;	// Not used for a baseline from memory
+	node.mode	= child->mode();
+	node.links	= child->links();
+
+	_memNames += name;
+	children_ret << node;
+
+	if ( child->isDirInfo() )
+	    subDirs_ret << child->toDirInfo();
+    }
+
+    // The dot entry and the attic hold children of the same directory
+
+    if ( parent->dotEntry() )
+	addChildren( parent->dotEntry(), children_ret, subDirs_ret );
+
+    if ( parent->attic() )
+	addChildren( parent->attic(), children_ret, subDirs_ret );
+}
+
+
+QString CacheBaseline::name( const BinaryCacheNode & node ) const
+{
+    if ( _cacheFile )
+	return _cacheFile->name( node );
+
+    return QString::fromUtf8( _memNames.constData() + node.nameOffset, node.nameLength );
+}
+
+
+bool CacheBaseline::findUnchangedDir( const QString & path,
+				      time_t	      mtime,
+				      quint64 &	      dirNo_ret ) const
+{
+    QHash<QString, quint32>::const_iterator it = _dirs.constFind( path );
+
+    if ( it == _dirs.constEnd() )
+	return false;
+
+    if ( ! _cacheFile )
+    {
+	if ( _memMtimes.at( it.value() ) != (qint64) mtime )
+	    return false;
+
+	dirNo_ret = it.value();
+
+	return true;
+    }
+
+    BinaryCacheNode node = _cacheFile->node( _cacheFile->dirNode( it.value() ) );
+
+    if ( ! S_ISDIR( node.mode ) || node.mtime != (qint64) mtime )
+	return false;
+
+    dirNo_ret = it.value();
+
+    return true;
+}
+
+
+QVector<BinaryCacheNode> CacheBaseline::children( quint64 dirNo ) const
+{
+    QVector<BinaryCacheNode> children;
+
+    if ( ! _cacheFile )
+	return dirNo < (quint64) _memChildren.size() ? _memChildren.at( dirNo ) : children;
+
+    if ( dirNo >= _cacheFile->header().dirCount )
+	return children;
+
+    // Jump over the subtree of each subdirectory, so only the direct
+    // children are visited.
+
+    BinaryCacheSubtree subtree = _cacheFile->subtree( dirNo );
+    quint64 endNode = qMin( subtree.endNode, _cacheFile->header().nodeCount );
+    quint64 nextDir = dirNo + 1;
+    quint64 nodeNo  = _cacheFile->dirNode( dirNo ) + 1;
+
+    while ( nodeNo < endNode )
+    {
+	BinaryCacheNode node = _cacheFile->node( nodeNo );
+
+	if ( node.parentDir != dirNo )
+	{
+	    logError() << _fileName << ": Bad subtree for directory #" << dirNo << endl;
+	    break;
+	}
+
+	children << node;
+
+	if ( S_ISDIR( node.mode ) )
+	{
+	    BinaryCacheSubtree dirSubtree = _cacheFile->subtree( nextDir );
+
+	    if ( dirSubtree.endNode <= nodeNo || dirSubtree.endDir <= nextDir )
+	    {
+		logError() << _fileName << ": Bad subtree for directory #" << nextDir << endl;
+		break;
+	    }
+
+	    nodeNo  = dirSubtree.endNode;
+	    nextDir = dirSubtree.endDir;
+	}
+	else
+	{
+	    ++nodeNo;
+	}
+    }
+
+    return children;
+}
+
+
+BinaryCacheNode CacheReader::binaryNode( quint64 no ) const
+{
+    return _binaryFile->node( no );
+}
+
+
+QString CacheReader::binaryName( const BinaryCacheNode & node ) const
+{
+    return _binaryFile->name( node );
+}
+
+
+void CacheReader::readBinary( int maxItems )
+{
+    while ( _ok && _nextNode < _endNode &&
+	    ( maxItems == 0 || maxItems-- > 0 ) )
+    {
+	addBinaryItem( binaryNode( _nextNode++ ) );
+    }
+}
+
 
+void CacheReader::addBinaryItem( const BinaryCacheNode & node )
+{
+    QString name   = binaryName( node );
+    mode_t  mode   = node.mode;
+    bool    isDir  = S_ISDIR( mode );
+    DirInfo * parent = 0;
+    int	      depth  = 0;
+    QString url;
+
+    if ( node.parentDir == BINARY_CACHE_NO_PARENT )
+    {
+	// The toplevel directory of this cache file with its complete path
 
-    // Blocks
+	QString path;
+	splitPath( binaryName( node ), path, name );
 
-    FileSize blocks = blocks_str ? strtoll( blocks_str, 0, 10 ) : -1;
+	if ( _tree->root() )
+	{
+	    parent = locateParent( path, name );
 
+	    if ( ! parent )
+	    {
+		if ( isDir )
+		{
+		    _binaryDirs.append( 0 );  // Ignore its complete subtree
+		    _binaryDirDepths.append( 0 );
+		}
 
-    // Links
+		return;
+	    }
+	}
 
-    int links = links_str ? atoi( links_str ) : 1;
+	url = isToplevelParent( parent ) ? buildPath( path, name ) : name;
+    }
+    else
+    {
+	if ( node.parentDir <  _binaryDirBase ||
+	     node.parentDir >= _binaryDirBase + _binaryDirs.size() )
+	{
+	    logError() << _fileName << ": Item #" << _nextNode - 1
+		       << ": Parent directory #" << node.parentDir << " not found" << endl;
+	    _ok = false;
+	    emit error();
 
+	    return;
+	}
 
-    //
-    // Create a new item
-    //
+	int parentNo = node.parentDir - _binaryDirBase;
 
-    QString fullPath = unescapedPath( raw_path );
-    QString path;
-    QString name;
-    splitPath( fullPath, path, name );
+	parent = _binaryDirs.at( parentNo );
+	url    = name;
+	depth  = _binaryDirDepths.at( parentNo ) + 1;
 
-    if ( _lastExcludedDir )
-    {
-	if ( path.startsWith( _lastExcludedDirUrl ) )
+	if ( ! parent ) // Excluded directory
 	{
-	    // logDebug() << "Excluding " << path << "/" << name << endl;
+	    if ( isDir )
+	    {
+		_binaryDirs.append( 0 );
+		_binaryDirDepths.append( depth );
+	    }
+
 	    return;
 	}
     }
 
-    // Find parent in tree
-
-    DirInfo * parent = _lastDir;
-
-    if ( ! parent && _tree->root() )
+    if ( isDir )
     {
-	if ( ! _tree->root()->hasChildren() )
-	    parent = _tree->root();
+	quint64 dirNo = _binaryDirBase + _binaryDirs.size();
+	DirInfo * dir = createDir( parent, url, name, mode, node.size, node.mtime );
+	_binaryDirs.append( dir->isExcluded() ? 0 : dir );
+	_binaryDirDepths.append( depth );
 
-	// Try the easy way first - the starting point of this cache
+	BinaryCacheSubtree subtree;
+	memset( &subtree, 0, sizeof( subtree ) );
 
-	if ( ! parent && _toplevel )
-	    parent = dynamic_cast<DirInfo *> ( _toplevel->locate( path ) );
-
-#if DEBUG_LOCATE_PARENT
-	if ( parent )
-	    logDebug() << "Using cache starting point as parent for " << fullPath << endl;
-#endif
+	if ( _binaryFile )
+	    subtree = _binaryFile->subtree( dirNo );
 
+	if ( subtree.flags & BINARY_CACHE_DIR_UNFINISHED )
+	    _unfinishedDirs.insert( dir );
 
-	// Fallback: Search the entire tree
+	// The subtree table tells if there are any subdirectories. If not,
+	// the files go right into the directory instead of being moved there
+	// from its dot entry when it is finalized.
 
-	if ( ! parent )
-	{
-	    parent = dynamic_cast<DirInfo *> ( _tree->locate( path ) );
+	if ( subtree.endDir == dirNo + 1 && dir->dotEntry() )
+	    dir->deleteEmptyDotEntry();
 
-#if DEBUG_LOCATE_PARENT
-	    if ( parent )
-		logDebug() << "Located parent " << path << " in tree" << endl;
-#endif
-	}
+	if ( _lazyDepth > 0 && depth >= _lazyDepth && ! dir->isExcluded() )
+	    skipSubtree( dir, dirNo );
+    }
+    else if ( parent )
+    {
+	FileInfo * item = new FileInfo( _tree, parent, name,
+					mode, node.size, node.mtime,
+					node.blocks, node.links );
+	CHECK_NEW( item );
+	parent->insertChild( item );
+	_tree->childAddedNotify( item );
+    }
+}
 
-	if ( ! parent ) // Still nothing?
-	{
-	    logError() << _fileName << ":" << _lineNo << ": "
-		       << "Could not locate parent \"" << path << "\" for "
-		       << name << endl;
 
-            if ( ++_errorCount > MAX_ERROR_COUNT )
-            {
-                logError() << "Too many consistency errors. Giving up." << endl;
-                _ok = false;
-                emit error();
-            }
+void CacheReader::setLazyDepth( int depth )
+{
+    _lazyDepth = depth;
 
-#if DEBUG_LOCATE_PARENT
-	    THROW( Exception( "Could not locate cache item parent" ) );
-#endif
-	    return;	// Ignore this cache line completely
-	}
-    }
+    // The pending subtrees are not read in sequence, and their pages
+    // should not be dropped after the first pass.
 
-    if ( strcasecmp( type, "D" ) == 0 )
-    {
-	QString url = ( parent == _tree->root() ) ? buildPath( path, name ) : name;
-#if VERBOSE_CACHE_DIRS
-	logDebug() << "Creating DirInfo for " << url << " with parent " << parent << endl;
-#endif
-	DirInfo * dir = new DirInfo( _tree, parent, url,
-				     mode, size, mtime );
-	dir->setReadState( DirReading );
-	_lastDir = dir;
+    if ( _lazyDepth > 0 && _binaryFile )
+	madvise( (void *) _binaryFile->data(), _binaryFile->size(), MADV_NORMAL );
+}
 
-	if ( parent )
-	    parent->insertChild( dir );
 
-	if ( ! _tree->root() )
-	{
-	    _tree->setRoot( dir );
-	    _toplevel = dir;
-	}
+void CacheReader::skipSubtree( DirInfo * dir, quint64 dirNo )
+{
+    if ( ! _binaryFile || ! _binaryFile->hasSubtrees() )
+	return;
 
-	if ( ! _toplevel )
-	    _toplevel = dir;
+    quint64 nodeNo = _nextNode - 1;
+    BinaryCacheSubtree subtree = _binaryFile->subtree( dirNo );
 
-	_tree->childAddedNotify( dir );
+    if ( subtree.endNode <= nodeNo + LAZY_MIN_SUBTREE_NODES )
+	return; // Small enough to load right away
 
-	if ( dir != _toplevel )
-	{
-	    if ( ExcludeRules::instance()->match( dir->url(), dir->name() ) )
-	    {
-		logDebug() << "Excluding " << name << endl;
-		dir->setExcluded();
-		dir->setReadState( DirOnRequestOnly );
-		dir->finalizeLocal();
-		_tree->sendReadJobFinished( dir );
-
-		_lastExcludedDir    = dir;
-		_lastExcludedDirUrl = _lastExcludedDir->url();
-		_lastDir	    = 0;
-	    }
-	}
-    }
-    else
+    if ( subtree.endNode > _endNode			||
+	 subtree.endDir	 <= dirNo			||
+	 subtree.endDir	 > _binaryHeader.dirCount )
     {
-	if ( parent )
-	{
-#if VERBOSE_CACHE_FILE_INFOS
-	    logDebug() << "Creating FileInfo for "
-		       << buildPath( parent->debugUrl(), name ) << endl;
-#endif
-
-	    FileInfo * item = new FileInfo( _tree, parent, name,
-					    mode, size, mtime,
-					    blocks, links );
-	    parent->insertChild( item );
-	    _tree->childAddedNotify( item );
-	}
-	else
-	{
-	    logError() << _fileName << ":" << _lineNo << ": "
-		       << "No parent for item " << name << endl;
-	}
+	logWarning() << _fileName << ": Bad subtree for directory #" << dirNo << endl;
+	return;
     }
+
+    // The nodes and the directory numbers of the subtree are skipped; the
+    // directory numbers are only needed for their (default 0) entries in
+    // _binaryDirs.
+
+    _tree->addPendingSubtree( dir, _binaryFile, dirNo );
+    _nextNode = subtree.endNode;
+
+    int dirCount = subtree.endDir - _binaryDirBase;
+    _binaryDirs.resize( dirCount );
+    _binaryDirDepths.resize( dirCount );
 }
 
 
 bool CacheReader::eof()
 {
-    if ( ! _ok || ! _cache )
+    if ( ! _ok )
 	return true;
 
-    return gzeof( _cache );
+    if ( _mapped )
+	return _nextNode >= _endNode;
+
+    return atEnd();
 }
 
 
 QString CacheReader::firstDir()
 {
-    while ( ! gzeof( _cache ) && _ok )
+    if ( _mapped )
+    {
+	if ( ! _ok || _binaryHeader.dirCount == 0 )
+	    return "";
+
+	quint32 nodeNo;
+	memcpy( &nodeNo, _mapped + _binaryHeader.dirIndexOffset, sizeof( nodeNo ) );
+
+	if ( nodeNo >= _binaryHeader.nodeCount )
+	    return "";
+
+	return binaryName( binaryNode( nodeNo ) );
+    }
+
+    while ( ! atEnd() && _ok )
     {
 	if ( ! readLine() )
 	    return "";
@@ -548,20 +2989,29 @@ bool CacheReader::checkHeader()
 
     // Check for    [qdirstat <version> cache file]
     // or	    [kdirstat <version> cache file]
+    // or	    [qdirstat <version> cache delta]
 
     if ( fieldsCount() != 4 )	_ok = false;
 
     if ( _ok )
     {
+	_isDelta = strcmp( field( 3 ), "delta]" ) == 0;
+
 	if ( ( strcmp( field( 0 ), "[qdirstat" ) != 0 &&
 	       strcmp( field( 0 ), "[kdirstat" ) != 0	) ||
 	     strcmp( field( 2 ), "cache"     ) != 0 ||
-	     strcmp( field( 3 ), "file]"     ) != 0 )
+	     ( strcmp( field( 3 ), "file]" ) != 0 && ! _isDelta ) )
 	{
 	    _ok = false;
 	    logError() << _fileName << ":" << _lineNo
 		      << ": Unknown file format" << endl;
 	}
+	else if ( _isDelta && ! _toplevel )
+	{
+	    _ok = false;
+	    logError() << _fileName << " is a delta cache file;"
+		       << " it can only be applied after the cache file it is based on" << endl;
+	}
     }
 
     if ( _ok )
@@ -587,7 +3037,7 @@ bool CacheReader::checkHeader()
 
 bool CacheReader::readLine()
 {
-    if ( ! _ok || ! _cache )
+    if ( ! _ok || ( ! _stream && _memberOffsets.isEmpty() ) )
 	return false;
 
     _fieldsCount = 0;
@@ -596,12 +3046,12 @@ bool CacheReader::readLine()
     {
 	_lineNo++;
 
-	if ( ! gzgets( _cache, _buffer, MAX_CACHE_LINE_LEN-1 ) )
+	if ( ! getMemberLine() )
 	{
 	    _buffer[0]	= 0;
 	    _line	= _buffer;
 
-	    if ( ! gzeof( _cache ) )
+	    if ( _ok && ! atEnd() )
 	    {
 		_ok = false;
 		logError() << _fileName << ":" << _lineNo << ": Read error" << endl;
@@ -616,7 +3066,7 @@ bool CacheReader::readLine()
 
 	// logDebug() << "line[ " << _lineNo << "]: \"" << _line<< "\"" << endl;
 
-    } while ( ! gzeof( _cache ) &&
+    } while ( ! atEnd() &&
 	      ( *_line == 0   ||	// empty line
 		*_line == '#'	  ) );	// comment line
 
@@ -624,6 +3074,239 @@ bool CacheReader::readLine()
 }
 
 
+bool CacheReader::atEnd()
+{
+    if ( _stream || ! _memberOffsets.isEmpty() )
+	return _membersEnd;
+
+    return true;
+}
+
+
+bool CacheReader::getMemberLine()
+{
+    while ( _memberPos >= _memberData.size() )
+    {
+	bool ok	 = false;
+	bool end = false;
+
+	if ( _stream )
+	    _memberData = _stream->waitForBlock( ok, end );
+	else if ( _members.isEmpty() )
+	{
+	    ok	= true;
+	    end = true;
+	}
+	else
+	{
+	    CacheMemberPtr member = _members.takeFirst();
+	    scheduleMembers();
+	    _memberData = member->waitForData( ok );
+	}
+
+	_memberPos = 0;
+
+	if ( ! ok )
+	{
+	    _ok		= false;
+	    _membersEnd = true;
+	    _memberData.clear();
+	    logError() << _fileName << ":" << _lineNo
+		       << ( _stream ? ": Read error" : ": Broken gzip member" ) << endl;
+	    emit error();
+
+	    return false;
+	}
+
+	if ( end )
+	{
+	    _membersEnd = true;
+	    return false;
+	}
+    }
+
+    // Like gzgets(): Up to and including the next newline, but not more than
+    // fits into the buffer
+
+    const char * start = _memberData.constData() + _memberPos;
+    int rest = _memberData.size() - _memberPos;
+    const char * newline = (const char *) memchr( start, '\n', rest );
+    int len = newline ? newline - start + 1 : rest;
+
+    if ( len > MAX_CACHE_LINE_LEN - 2 )
+	len = MAX_CACHE_LINE_LEN - 2;
+
+    memcpy( _buffer, start, len );
+    _buffer[ len ] = 0;
+    _memberPos += len;
+
+    return true;
+}
+
+
+bool CacheReader::openStream()
+{
+    gzFile cache = gzopen( _fileName.toUtf8(), "r" );
+
+    if ( cache == 0 )
+    {
+	_stream.clear();
+	return false;
+    }
+
+    _stream = CacheStreamPtr( new CacheStream( cache ) );
+    CHECK_NEW( _stream.data() );
+
+    CacheStreamTask * task = new CacheStreamTask( _stream );
+    CHECK_NEW( task );
+    QThreadPool::globalInstance()->start( task );
+
+    return true;
+}
+
+
+void CacheReader::scheduleMembers()
+{
+    QThreadPool * pool = QThreadPool::globalInstance();
+    int maxInProgress  = qMax( MIN_MEMBERS_IN_PROGRESS, pool->maxThreadCount() );
+
+    while ( _members.size() < maxInProgress && _nextMember < _memberOffsets.size() )
+    {
+	CacheMemberPtr member( new CacheMember( _fileName,
+						_memberOffsets.at( _nextMember ),
+						_memberSizes.at( _nextMember ),
+						_zstd ) );
+	CHECK_NEW( member.data() );
+	_members << member;
+	++_nextMember;
+
+	CacheMemberTask * task = new CacheMemberTask( member );
+	CHECK_NEW( task );
+	pool->start( task );
+    }
+}
+
+
+bool CacheReader::readIndex( int fd )
+{
+    unsigned char header[ CACHE_INDEX_SUBFIELD_OFFSET + CACHE_INDEX_SUBFIELD_LEN ];
+    struct stat statInfo;
+
+    if ( fstat( fd, &statInfo ) != 0 )
+	return false;
+
+    ssize_t headerLen = pread( fd, header, sizeof( header ), 0 );
+
+    if ( headerLen >= 4 && littleEndian32( header ) == CACHE_ZSTD_FRAME_MAGIC )
+    {
+	// A zstd file without an index, e.g. from the zstd command: All
+	// frames are decompressed in one go.
+
+	_zstd = true;
+	_memberOffsets << 0;
+	_memberSizes   << statInfo.st_size;
+
+	return true;
+    }
+
+    qint64 indexOffset = 0;
+
+    if ( headerLen >= CACHE_ZSTD_HEADER_SIZE &&
+	 littleEndian32( header ) == CACHE_ZSTD_SKIPPABLE_MAGIC &&
+	 memcmp( header + 8, CACHE_ZSTD_INDEX_ID, 4 ) == 0 )
+    {
+	// Skippable frame: Magic, frame size, ID, offset of the index frame
+
+	_zstd = true;
+
+	for ( int i = CACHE_INDEX_SUBFIELD_LEN - 1; i >= 0; --i )
+	    indexOffset = ( indexOffset << 8 ) | header[ CACHE_ZSTD_INDEX_OFFSET + i ];
+
+	if ( ! readIndexMember( indexOffset, CACHE_ZSTD_HEADER_SIZE, statInfo.st_size ) )
+	{
+	    _memberOffsets.clear();
+	    _memberSizes.clear();
+	    _memberOffsets << 0;
+	    _memberSizes   << statInfo.st_size;
+	}
+
+	return true;
+    }
+
+    // Gzip header with an "extra" field: ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2)
+    // followed by the subfield with the offset of the index member
+
+    if ( headerLen != (ssize_t) sizeof( header ) )
+	return false;
+
+    if ( header[0] != 0x1f || header[1] != 0x8b || header[2] != Z_DEFLATED ||
+	 ! ( header[3] & 0x04 ) ||	// FEXTRA
+	 header[12] != CACHE_INDEX_SUBFIELD_ID1 ||
+	 header[13] != CACHE_INDEX_SUBFIELD_ID2 ||
+	 header[14] != CACHE_INDEX_SUBFIELD_LEN || header[15] != 0 )
+    {
+	return false;
+    }
+
+    for ( int i = CACHE_INDEX_SUBFIELD_LEN - 1; i >= 0; --i )
+	indexOffset = ( indexOffset << 8 ) | header[ CACHE_INDEX_SUBFIELD_OFFSET + i ];
+
+    return readIndexMember( indexOffset, 0, statInfo.st_size );
+}
+
+
+bool CacheReader::readIndexMember( qint64 indexOffset, qint64 firstOffset, qint64 fileSize )
+{
+    if ( indexOffset <= firstOffset || indexOffset >= fileSize ) // Writing was interrupted
+	return false;
+
+    CacheMember indexMember( _fileName, indexOffset, fileSize - indexOffset, _zstd );
+    indexMember.inflate();
+
+    bool ok = false;
+    QList<QByteArray> lines = indexMember.waitForData( ok ).split( '\n' );
+
+    if ( ! ok || lines.isEmpty() || lines.first() != CACHE_INDEX_HEADER )
+    {
+	logWarning() << _fileName << ": Bad cache index; reading sequentially" << endl;
+	return false;
+    }
+
+    QList<qint64> offsets;
+    QList<qint64> sizes;
+    qint64 expectedOffset = firstOffset;
+
+    for ( int i = 1; i < lines.size(); ++i )
+    {
+	QList<QByteArray> fields = lines.at( i ).split( ' ' );
+
+	if ( fields.size() != 4 || fields.at( 0 ) + " " + fields.at( 1 ) != CACHE_INDEX_MEMBER )
+	    continue;
+
+	qint64 offset = fields.at( 2 ).toLongLong();
+	qint64 size   = fields.at( 3 ).toLongLong();
+
+	if ( offset != expectedOffset || size <= 0 || offset + size > indexOffset )
+	{
+	    logWarning() << _fileName << ": Bad cache index; reading sequentially" << endl;
+	    return false;
+	}
+
+	offsets << offset;
+	sizes	<< size;
+	expectedOffset = offset + size;
+    }
+
+    if ( offsets.isEmpty() || expectedOffset != indexOffset )
+	return false;
+
+    _memberOffsets = offsets;
+    _memberSizes   = sizes;
+
+    return true;
+}
+
+
 void CacheReader::splitLine()
 {
     _fieldsCount = 0;
@@ -736,45 +3419,123 @@ QString CacheReader::buildPath( const QString & path, const QString & name ) con
 }
 
 
-QString CacheReader::unescapedPath( const QString & rawPath ) const
+int CacheReader::unescapePath( char * rawPath )
 {
-    // Using a protocol part to avoid directory names with a colon ":"
-    // being cut off because it looks like a URL protocol.
-    QString protocol = "foo:";
-    QString url = protocol + cleanPath( rawPath );
+    char * in	= rawPath;
+    char * out	= rawPath;
+    bool   slash = false;	// last character was a literal slash
 
-    return QUrl::fromEncoded( url.toUtf8() ).path();
-}
+    while ( *in )
+    {
+	if ( *in == '%' && isxdigit( (unsigned char) in[1] ) && isxdigit( (unsigned char) in[2] ) )
+	{
+	    *out++ = (char) ( ( hexValue( in[1] ) << 4 ) | hexValue( in[2] ) );
+	    in	  += 3;
+	    slash  = false;
+	}
+	else if ( *in == '/' && slash )
+	{
+	    ++in;
+	}
+	else
+	{
+	    slash  = ( *in == '/' );
+	    *out++ = *in++;
+	}
+    }
 
+    if ( slash && out - rawPath > 1 )
+	--out;
 
-QString CacheReader::cleanPath( const QString & rawPath ) const
-{
-    QString clean = rawPath;
-    return clean.replace( _multiSlash, "/" );
+    *out = 0;
+
+    return out - rawPath;
 }
 
 
-void CacheReader::finalizeRecursive( DirInfo * dir )
+void CacheReader::finalizeTree()
 {
-    if ( dir->readState() != DirOnRequestOnly )
+    // The same order as in DirInfo::finalizeAll(), but without recursion;
+    // the excluded directories were already finalized when they were read.
+
+    QVector<DirInfo *> dirs;
+    dirs << _toplevel;
+
+    for ( int i = 0; i < dirs.size(); ++i )
     {
-	if ( ! dir->readError() )
-	    dir->setReadState( DirCached );
+	DirInfo * dir = dirs.at( i );
+
+	if ( dir->readState() != DirOnRequestOnly )
+	{
+	    if ( _unfinishedDirs.contains( dir ) )
+		dir->setReadState( DirAborted );
+	    else if ( ! dir->readError() )
+		dir->setReadState( DirCached );
+	}
 
-	dir->finalizeLocal();
-	_tree->sendReadJobFinished( dir );
+	for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+	{
+	    if ( child->isDirInfo() && ! child->isDotEntry() )
+		dirs << child->toDirInfo();
+	}
     }
 
-    FileInfo * child = dir->firstChild();
+    // Subdirectories first, so each directory is finalized only once
 
-    while ( child )
+    for ( int i = dirs.size() - 1; i >= 0; --i )
+	dirs.at( i )->finalizeLocal();
+
+    foreach ( DirInfo * dir, dirs )
     {
-	if ( child->isDirInfo() )
-	    finalizeRecursive( child->toDirInfo() );
+	if ( dir->readState() != DirOnRequestOnly )
+	    _tree->sendReadJobFinished( dir );
+    }
+}
 
-	child = child->next();
+
+void CacheReader::checkTotals()
+{
+    int checked    = 0;
+    int mismatches = 0;
+
+    for ( int i = 0; i < _binaryDirs.size(); ++i )
+    {
+	DirInfo * dir = _binaryDirs.at( i );
+
+	if ( ! dir || dir->isPendingSubtree() || _unfinishedDirs.contains( dir ) )
+	    continue;
+
+	BinaryCacheSubtree subtree = _binaryFile->subtree( _binaryDirBase + i );
+
+	if ( subtree.flags & BINARY_CACHE_DIR_ESTIMATED )
+	    continue;
+
+	++checked;
+
+	if ( (quint64) dir->totalSize()		 != subtree.totalSize		||
+	     (quint64) dir->totalAllocatedSize() != subtree.totalAllocatedSize	||
+	     (quint32) dir->totalItems()	 != subtree.totalItems		||
+	     (quint32) dir->totalSubDirs()	 != subtree.totalSubDirs	||
+	     (quint32) dir->totalFiles()	 != subtree.totalFiles )
+	{
+	    if ( ++mismatches <= MAX_TOTALS_MISMATCH_LOG )
+	    {
+		logWarning() << _fileName << ": Totals of " << dir
+			     << " differ from the cache file: "
+			     << dir->totalSize() << " bytes, " << dir->totalItems() << " items instead of "
+			     << subtree.totalSize << " bytes, " << subtree.totalItems << " items"
+			     << endl;
+	    }
+	}
     }
 
+    // Exclude rules that were added since the cache file was written
+    // change the totals, too.
+
+    if ( mismatches > 0 )
+	logWarning() << _fileName << ": " << mismatches << " of " << checked << " directories have different totals" << endl;
+    else
+	logInfo() << _fileName << ": The totals of all " << checked << " directories are OK" << endl;
 }
 
 
@@ -12,27 +12,490 @@
 
 
 #include <stdio.h>
+#include <string.h>	// strlen()
 #include <zlib.h>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QRunnable>
+#include <QSharedPointer>
 #include "DirTree.h"
 
+struct ZSTD_CCtx_s;
+
 #define DEFAULT_CACHE_NAME	".qdirstat.cache.gz"
 #define CACHE_FORMAT_VERSION	"1.0"
 #define MAX_CACHE_LINE_LEN	1024
 #define MAX_FIELDS_PER_LINE	32
 
+// Text cache files are written as a sequence of independent gzip members,
+// each starting with a "D" line, so they can be inflated in parallel. A new
+// member is started when the current one has more than this many
+// (uncompressed) bytes.
+#define CACHE_MEMBER_SIZE		( 4 * 1024 * 1024 )
+
+// Text cache files that are a single gzip stream are inflated in a worker
+// thread in blocks of about this many (uncompressed) bytes, at most this many
+// blocks ahead of the main thread
+#define CACHE_STREAM_BLOCK_SIZE		( 1024 * 1024 )
+#define CACHE_STREAM_BLOCKS_AHEAD	4
+
+// Cache files up to this size are read in one go; larger ones in slices of
+// that many millisec, each in chunks of that many lines or items
+#define CACHE_READ_ALL_MAX_SIZE		( 256 * 1024 )
+#define CACHE_READ_SLICE_MILLISEC	50
+#define CACHE_READ_CHUNK_LINES		256
+
+// IncrementalCacheWriter writes to a file with this suffix until it is done
+#define CACHE_PART_SUFFIX		".part"
+
+// Size of the buffer in which CacheWriter formats the lines of a text cache
+// file before they are compressed
+#define CACHE_WRITE_BUFFER_SIZE		( 1024 * 1024 )
+
+// Gzip header "extra" subfield in the first member with the offset of the
+// index member (8 bytes, little endian). See doc/cache-file-format.txt.
+#define CACHE_INDEX_SUBFIELD_ID1	'Q'
+#define CACHE_INDEX_SUBFIELD_ID2	'D'
+#define CACHE_INDEX_SUBFIELD_LEN	8
+#define CACHE_INDEX_SUBFIELD_OFFSET	16	// of the data in the file
+#define CACHE_INDEX_HEADER		"# [qdirstat cache index]"
+#define CACHE_INDEX_MEMBER		"# member"
+
+// Text cache files with this suffix are compressed with zstd instead of gzip:
+// Each member is a zstd frame, and the offset of the index member is in a
+// skippable frame at the start of the file. When reading, this is detected
+// automatically. See doc/cache-file-format.txt.
+#define DEFAULT_ZSTD_CACHE_NAME		".qdirstat.cache.zst"
+#define ZSTD_CACHE_SUFFIX		".zst"
+#define CACHE_ZSTD_FRAME_MAGIC		0xFD2FB528
+#define CACHE_ZSTD_SKIPPABLE_MAGIC	0x184D2A5E
+#define CACHE_ZSTD_INDEX_ID		"QDSI"	// 4 bytes, no terminating 0
+#define CACHE_ZSTD_INDEX_OFFSET		12	// of the index offset in the file
+#define CACHE_ZSTD_HEADER_SIZE		20
+
+// Binary cache files (format version 2). Cache files with this suffix are
+// written in the binary format; when reading, the format is detected
+// automatically.
+#define DEFAULT_BINARY_CACHE_NAME	".qdirstat.cache.bin"
+#define BINARY_CACHE_SUFFIX		".bin"
+#define BINARY_CACHE_MAGIC		"QDirStat cache 2"	// 16 bytes, no terminating 0
+#define BINARY_CACHE_MAGIC_LEN		16
+#define BINARY_CACHE_BYTE_ORDER		0x01020304
+#define BINARY_CACHE_NO_PARENT		0xFFFFFFFF
+
+// Flag in BinaryCacheSubtree: The directory was not read completely, e.g.
+// in the checkpoint of a scan that is still running or that was aborted
+#define BINARY_CACHE_DIR_UNFINISHED	0x01
+
+// Flag in BinaryCacheSubtree: The totals are only an estimate (see
+// SubtreeEstimator)
+#define BINARY_CACHE_DIR_ESTIMATED	0x02
+
+// Directories in a binary cache file with fewer items than this in their
+// subtree are always loaded right away, even when loading lazily
+#define LAZY_MIN_SUBTREE_NODES		1000
+
 
 namespace QDirStat
 {
+    /**
+     * The optional dictionary for compressing and decompressing zstd cache
+     * files, e.g. one trained with "zstd --train" on the uncompressed text of
+     * typical cache files: With the many similar paths of a file server, this
+     * gives much better compression for the small members.
+     *
+     * A file that was written with a dictionary can only be read with the
+     * same one.
+     **/
+    class CacheZstdDictionary
+    {
+    public:
+
+	/**
+	 * Use the dictionary in file 'fileName' from now on, or none if
+	 * 'fileName' is empty. Return 'false' if it can't be read.
+	 *
+	 * This is for the main thread only, and only while no cache file is
+	 * being read or written.
+	 **/
+	static bool load( const QString & fileName );
+
+	/**
+	 * Return the name of the dictionary file or an empty string.
+	 **/
+	static const QString & fileName() { return _fileName; }
+
+	/**
+	 * Return the dictionary or an empty byte array if there is none.
+	 * This can be called from any thread.
+	 **/
+	static QByteArray data() { return _data; }
+
+    protected:
+
+	static QString	  _fileName;
+	static QByteArray _data;
+
+    };	// class CacheZstdDictionary
+
+
+    /**
+     * Header of a binary cache file.
+     *
+     * A binary cache file consists of this header, the node records (one
+     * BinaryCacheNode for each item, in the same order as in a text cache
+     * file: each directory is followed by its non-directory children and then
+     * by its subdirectories), the directory index (the node numbers of all
+     * directories as quint32) and the string table with the names (UTF-8,
+     * not 0-terminated).
+     *
+     * The toplevel directory's name is its absolute path; all others only
+     * have their name without path. All numbers are in the byte order of the
+     * machine that wrote the file; 'byteOrder' tells which one that was.
+     *
+     * Everything has a fixed size, so a reader can mmap() the file and create
+     * the tree from it without any parsing.
+     *
+     * After the string table, there may be the subtree table with one
+     * BinaryCacheSubtree for each directory (in the order of the directory
+     * index). Since each subtree is a contiguous range of nodes, a reader
+     * can skip complete subtrees and load them later.
+     **/
+    struct BinaryCacheHeader
+    {
+	char	magic[ BINARY_CACHE_MAGIC_LEN ];
+	quint32 byteOrder;	// BINARY_CACHE_BYTE_ORDER
+	quint32 headerSize;	// sizeof( BinaryCacheHeader )
+	quint32 nodeSize;	// sizeof( BinaryCacheNode )
+	quint32 subtreeSize;	// sizeof( BinaryCacheSubtree )
+	quint64 nodeCount;
+	quint64 nodesOffset;
+	quint64 dirCount;
+	quint64 dirIndexOffset;
+	quint64 stringsOffset;
+	quint64 stringsSize;
+	quint64 subtreesOffset; // 0 if there is no subtree table
+    };
+
+
+    /**
+     * One item in a binary cache file.
+     **/
+    struct BinaryCacheNode
+    {
+	quint64 size;		// size in bytes
+	qint64	blocks;		// 512 byte blocks for sparse files, -1 otherwise
+	qint64	mtime;
+	quint64 nameOffset;	// offset of the name in the string table
+	quint32 nameLength;	// length of the name in bytes
+	quint32 parentDir;	// number of the parent in the directory index
+	quint32 mode;		// mode (type and permissions)
+	quint32 links;		// number of hard links
+    };
+
+
+    /**
+     * The range and the totals of the subtree of one directory in a binary
+     * cache file.
+     **/
+    struct BinaryCacheSubtree
+    {
+	quint64 endNode;	// first node after the subtree
+	quint64 totalSize;
+	quint64 totalAllocatedSize;
+	qint64	totalBlocks;
+	qint64	latestMtime;
+	qint64	oldestFileMtime;
+	quint32 endDir;		// first directory index after the subtree
+	quint32 totalItems;
+	quint32 totalSubDirs;
+	quint32 totalFiles;
+	quint32 totalIgnoredItems;
+	quint32 totalUnignoredItems;
+	quint32 errSubDirCount;
+	quint32 flags;		// BINARY_CACHE_DIR_UNFINISHED etc.
+    };
+
+
+    /**
+     * An mmap()ed binary cache file. This is shared between the
+     * CacheReader that reads it and the directories whose subtrees are
+     * still pending in it (see DirTree::loadPendingSubtree()), so it is
+     * unmapped only when nobody needs it anymore.
+     **/
+    class BinaryCacheFile
+    {
+    public:
+
+	/**
+	 * Constructor for 'size' bytes mapped at 'data' with 'header'.
+	 * This takes over the mapping.
+	 **/
+	BinaryCacheFile( const QString &	   fileName,
+			 const char *		   data,
+			 size_t			   size,
+			 const BinaryCacheHeader & header );
+
+	/**
+	 * Destructor. This unmaps the file.
+	 **/
+	~BinaryCacheFile();
+
+	const QString & fileName() const { return _fileName; }
+	const char * data() const { return _data; }
+	size_t size() const { return _size; }
+	const BinaryCacheHeader & header() const { return _header; }
+
+	/**
+	 * Return 'true' if this file has a subtree table.
+	 **/
+	bool hasSubtrees() const { return _header.subtreesOffset != 0; }
+
+	/**
+	 * Return the subtree of directory no. 'dirNo'. If there is no subtree
+	 * table, everything in the returned BinaryCacheSubtree is 0.
+	 **/
+	BinaryCacheSubtree subtree( quint64 dirNo ) const;
+
+	/**
+	 * Return the node number of directory no. 'dirNo'.
+	 **/
+	quint64 dirNode( quint64 dirNo ) const;
+
+	/**
+	 * Return node no. 'nodeNo'. The caller has to make sure that it is
+	 * less than header().nodeCount.
+	 **/
+	BinaryCacheNode node( quint64 nodeNo ) const;
+
+	/**
+	 * Return the name of 'node'.
+	 **/
+	QString name( const BinaryCacheNode & node ) const;
+
+    protected:
+
+	QString		  _fileName;
+	const char *	  _data;
+	size_t		  _size;
+	BinaryCacheHeader _header;
+
+    };	// class BinaryCacheFile
+
+
+    /**
+     * One gzip member of a text cache file that is inflated in a worker
+     * thread while the main thread is still busy with the previous ones.
+     *
+     * This is thread-safe: inflate() is called in the worker thread,
+     * waitForData() in the main thread.
+     **/
+    class CacheMember
+    {
+    public:
+
+	/**
+	 * Constructor for the member with 'size' bytes at 'offset' of cache
+	 * file 'fileName'. With 'zstd', the member is one or more zstd
+	 * frames instead of a gzip member.
+	 **/
+	CacheMember( const QString & fileName, qint64 offset, qint64 size, bool zstd = false );
+
+	/**
+	 * Read and inflate the member. This is called in a worker thread.
+	 **/
+	void inflate();
+
+	/**
+	 * Wait until inflate() is done, then return the uncompressed data.
+	 * 'ok_ret' is set to 'false' if the member could not be read or is
+	 * broken.
+	 **/
+	QByteArray waitForData( bool & ok_ret );
+
+    protected:
+
+	/**
+	 * Inflate 'compressed' to _data. Return 'true' on success.
+	 **/
+	bool inflateData( const QByteArray & compressed );
+
+	/**
+	 * Decompress the zstd frames in 'compressed' to _data. Return 'true'
+	 * on success.
+	 **/
+	bool decompressZstd( const QByteArray & compressed );
+
+	QString		_fileName;
+	qint64		_offset;
+	qint64		_size;
+	bool		_zstd;
+	QByteArray	_data;
+	bool		_ok;
+	bool		_done;
+	QMutex		_mutex;
+	QWaitCondition	_doneCondition;
+
+    };	// class CacheMember
+
+
+    typedef QSharedPointer<CacheMember> CacheMemberPtr;
+
+
+    /**
+     * Task for a QThreadPool that inflates a CacheMember.
+     **/
+    class CacheMemberTask: public QRunnable
+    {
+    public:
+
+	CacheMemberTask( CacheMemberPtr member ):
+	    _member( member )
+	    { setAutoDelete( true ); }
+
+	virtual void run() Q_DECL_OVERRIDE { _member->inflate(); }
+
+    protected:
+
+	CacheMemberPtr _member;
+
+    };	// class CacheMemberTask
+
+
+    /**
+     * A text cache file that is a single gzip stream (i.e. without an
+     * index of its members, like from older versions): It is inflated in a
+     * worker thread in blocks that end at a line boundary, at most
+     * CACHE_STREAM_BLOCKS_AHEAD of them ahead of the main thread that
+     * builds the tree from them.
+     *
+     * This is thread-safe: inflate() is called in the worker thread,
+     * waitForBlock() and cancel() in the main thread.
+     **/
+    class CacheStream
+    {
+    public:
+
+	/**
+	 * Constructor. This takes over 'cache'; it is closed in the
+	 * destructor.
+	 **/
+	CacheStream( gzFile cache );
+
+	/**
+	 * Destructor.
+	 **/
+	~CacheStream();
+
+	/**
+	 * Inflate the complete stream block by block. This is called in a
+	 * worker thread.
+	 **/
+	void inflate();
+
+	/**
+	 * Wait for the next block and return it. At the end of the stream,
+	 * this returns an empty block and sets 'end_ret' to 'true'; 'ok_ret'
+	 * is set to 'false' if the stream could not be read completely.
+	 **/
+	QByteArray waitForBlock( bool & ok_ret, bool & end_ret );
+
+	/**
+	 * Stop inflating as soon as possible.
+	 **/
+	void cancel();
+
+    protected:
+
+	/**
+	 * Add 'block' for the main thread. Wait until there is room for it.
+	 * Return 'false' if inflating was canceled.
+	 **/
+	bool addBlock( const QByteArray & block );
+
+	gzFile		  _cache;
+	QList<QByteArray> _blocks;
+	bool		  _ok;
+	bool		  _done;
+	bool		  _canceled;
+	QMutex		  _mutex;
+	QWaitCondition	  _blockAdded;
+	QWaitCondition	  _blockTaken;
+
+    };	// class CacheStream
+
+
+    typedef QSharedPointer<CacheStream> CacheStreamPtr;
+
+
+    /**
+     * Task for a QThreadPool that inflates a CacheStream.
+     **/
+    class CacheStreamTask: public QRunnable
+    {
+    public:
+
+	CacheStreamTask( CacheStreamPtr stream ):
+	    _stream( stream )
+	    { setAutoDelete( true ); }
+
+	virtual void run() Q_DECL_OVERRIDE { _stream->inflate(); }
+
+    protected:
+
+	CacheStreamPtr _stream;
+
+    };	// class CacheStreamTask
+
+
+
     class CacheWriter
     {
     public:
 
 	/**
-	 * Write 'tree' to file 'fileName' in gzip format (using zlib).
+	 * Write 'tree' to file 'fileName' in gzip format (using zlib) or,
+	 * if 'binary' is 'true', in the binary format (see
+	 * BinaryCacheHeader). A text cache file whose name ends with
+	 * ZSTD_CACHE_SUFFIX is compressed with zstd instead of gzip,
+	 * with the CacheZstdDictionary if there is one.
+	 *
+	 * 'compressionLevel' is the zlib compression level for the gzip
+	 * format: 1 (fastest) to 9 (smallest), 0 for no compression at all
+	 * (the file is still in gzip format) or Z_DEFAULT_COMPRESSION.
 	 *
 	 * Check CacheWriter::ok() to see if writing the cache file went OK.
 	 **/
-	CacheWriter( const QString & fileName, DirTree *tree );
+	CacheWriter( const QString & fileName,
+		     DirTree *	     tree,
+		     bool	     binary	      = false,
+		     int	     compressionLevel = Z_DEFAULT_COMPRESSION );
+
+	/**
+	 * Write a delta cache file 'fileName' in gzip format with only the
+	 * differences between 'tree' and 'baseTree' (typically read from
+	 * an earlier cache file of the same directory): Each directory
+	 * whose own values or direct non-directory children changed gets a
+	 * "D" line with its totals, followed by its new or changed children
+	 * and an "R" line for each child that is gone. New directories are
+	 * written completely. CacheReader applies this to the base.
+	 **/
+	CacheWriter( const QString & fileName,
+		     DirTree *	     tree,
+		     DirTree *	     baseTree,
+		     int	     compressionLevel = Z_DEFAULT_COMPRESSION );
+
+	/**
+	 * Write only the subtree of 'subtree' to file 'fileName' in the
+	 * binary format, with 'subtree' as its directory no. 0 (see
+	 * SubtreeSpiller).
+	 **/
+	CacheWriter( const QString & fileName,
+		     DirInfo *	     subtree );
 
 	/**
 	 * Destructor
@@ -54,23 +517,125 @@ namespace QDirStat
 
     protected:
 
+	/**
+	 * Constructor for derived classes that write the cache file
+	 * themselves.
+	 **/
+	CacheWriter( int compressionLevel );
+
 	/**
 	 * Write cache file in gzip format.
 	 * Returns 'true' if OK, 'false' upon error.
 	 **/
-	bool writeCache( const QString & fileName, DirTree *tree );
+	bool writeCache( const QString & fileName, DirTree *tree, DirTree * baseTree = 0 );
+
+	/**
+	 * Open 'fileName' for writing in gzip format and start the first
+	 * member. Returns 'true' if OK, 'false' upon error.
+	 **/
+	bool openCache( const QString & fileName );
+
+	/**
+	 * Finish the last member, write the index and close the file that
+	 * openCache() opened. Returns 'true' if OK, 'false' upon error.
+	 **/
+	bool closeCache( const QString & fileName );
+
+	/**
+	 * Write the differences between directory 'dir' and 'baseDir' of
+	 * the base tree recursively to the delta cache file.
+	 **/
+	void writeDeltaTree( DirInfo * dir, DirInfo * baseDir );
+
+	/**
+	 * Start a new gzip member if the current one is full.
+	 **/
+	void checkMemberSize();
 
 	/**
-	 * Write 'item' recursively to cache file 'cache'.
+	 * Write 'item' recursively to the cache file.
 	 * Uses zlib to write gzip-compressed files.
 	 **/
-	void writeTree( gzFile cache, FileInfo * item );
+	void writeTree( FileInfo * item );
 
 	/**
-	 * Write 'item' to cache file 'cache' without recursion.
+	 * Write 'item' to the cache file without recursion.
 	 * Uses zlib to write gzip-compressed files.
 	 **/
-	void writeItem( gzFile cache, FileInfo * item );
+	void writeItem( FileInfo * item );
+
+	/**
+	 * Start a new gzip member in _file. The first one gets the
+	 * subfield for the offset of the index member in its gzip header.
+	 **/
+	bool startMember( bool first );
+
+	/**
+	 * Compress 'len' bytes of 'data' to the current gzip member.
+	 **/
+	void compress( const char * data, int len );
+
+	/**
+	 * Compress 'len' bytes of 'data' to the current zstd frame; with
+	 * 'end', finish the frame.
+	 **/
+	void compressZstd( const char * data, int len, bool end );
+
+	/**
+	 * Compress the content of the write buffer and empty it.
+	 **/
+	void flushBuffer();
+
+	/**
+	 * Make sure there is space for 'len' more bytes in the write buffer.
+	 * Return 'false' if that many bytes will never fit.
+	 **/
+	bool reserve( int len )
+	{
+	    if ( _bufferPos + len > CACHE_WRITE_BUFFER_SIZE )
+		flushBuffer();
+
+	    return len <= CACHE_WRITE_BUFFER_SIZE;
+	}
+
+	/**
+	 * Append to the write buffer.
+	 **/
+	void append( char c )
+	    { reserve( 1 ); _buffer[ _bufferPos++ ] = c; }
+
+	void append( const char * data, int len );
+
+	void append( const char * str )
+	    { append( str, strlen( str ) ); }
+
+	/**
+	 * Append 'value' in decimal or in hex (without "0x") to the write
+	 * buffer.
+	 **/
+	void appendNumber( quint64 value );
+	void appendHex( quint64 value );
+
+	/**
+	 * Append 'size' like formatSize() to the write buffer.
+	 **/
+	void appendSize( FileSize size );
+
+	/**
+	 * Append 'path' URL-encoded like urlEncoded() to the write buffer.
+	 **/
+	void appendEncoded( const QString & path );
+
+	/**
+	 * Flush and finish the current gzip member.
+	 **/
+	void finishMember();
+
+	/**
+	 * Write the index member with the offsets of all other members and
+	 * store its offset in the header of the first member.
+	 **/
+	void writeIndex();
 
         /**
          * Return the 'path' in an URL-encoded form, i.e. with some special
@@ -78,15 +643,278 @@ namespace QDirStat
          **/
         QByteArray urlEncoded( const QString & path );
 
+	/**
+	 * Write cache file in the binary format.
+	 * Returns 'true' if OK, 'false' upon error.
+	 **/
+	bool writeBinaryCache( const QString & fileName, DirTree *tree );
+
+	/**
+	 * Write the subtree of 'toplevel' to cache file 'fileName' in the
+	 * binary format.
+	 * Returns 'true' if OK, 'false' upon error.
+	 **/
+	bool writeBinaryCache( const QString & fileName, FileInfo * toplevel );
+
+	/**
+	 * Write 'item' recursively to binary cache file 'cache' as a child
+	 * of the directory with number 'parentDir'. Names are collected in
+	 * _strings, the node numbers of directories in _dirIndex and their
+	 * subtrees in _subtrees. Returns 'false' upon write error.
+	 **/
+	bool writeBinaryTree( FILE * cache, FileInfo * item, quint32 parentDir );
+
+	/**
+	 * Write the binary node record for 'item' to 'cache'.
+	 **/
+	bool writeBinaryItem( FILE * cache, FileInfo * item, quint32 parentDir );
+
+	//
+	// Data members
+	//
+
+	bool		 _ok;
+	int		 _compressionLevel;
+	char *		 _buffer;
+	int		 _bufferPos;
+	FILE *		 _file;
+	z_stream	 _zstream;
+	gz_header	 _gzHeader;
+	unsigned char	 _gzExtra[ 4 + CACHE_INDEX_SUBFIELD_LEN ];
+	bool		 _inMember;
+	bool		 _zstd;
+	struct ZSTD_CCtx_s * _zstdContext;
+	bool		 _writeTotals;
+	bool		 _writeError;
+	qint64		 _memberBytes;	 // uncompressed bytes in this member
+	QList<qint64>	 _memberOffsets;
+	quint64		 _nodeCount;
+	QVector<quint32> _dirIndex;
+	QByteArray	 _strings;
+	QVector<BinaryCacheSubtree> _subtrees;
+    };
+
+
+
+    /**
+     * Writing a gzip cache file while the tree is still being read: Each
+     * directory is written (with its direct non-directory children) as
+     * soon as its read job is finished, so the I/O of writing overlaps
+     * with reading instead of being a long phase of its own at the end.
+     *
+     * A directory is never written before its parent, so the file has the
+     * same order of "D" lines before their contents as one from
+     * CacheWriter; a directory that is finished before its parent is held
+     * back until the parent is written. The order of the directories is
+     * different, though: The reader finds a parent that is not among the
+     * last directories it read with DirTree::locate().
+     *
+     * The file is written as 'fileName' + CACHE_PART_SUFFIX and renamed to
+     * 'fileName' only in finish(), so a cache file that is still in use
+     * (e.g. as a baseline) is not overwritten while reading.
+     *
+     * With setReleaseWritten(), subtrees that are finished and written are
+     * cleared from the tree to save memory. This is only useful if nothing
+     * else needs the tree, like when scanning to a cache file without a
+     * GUI; the totals of the tree then only count what was not released.
+     **/
+    class IncrementalCacheWriter: public QObject, public CacheWriter
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor: Open the cache file and start writing the
+	 * directories of 'tree' as they are read. Create this before
+	 * reading starts.
+	 *
+	 * Check CacheWriter::ok() to see if the file could be opened.
+	 **/
+	IncrementalCacheWriter( const QString & fileName,
+				DirTree *	tree,
+				int		compressionLevel = Z_DEFAULT_COMPRESSION );
+
+	/**
+	 * Destructor. If finish() was not called, the partial file is
+	 * removed.
+	 **/
+	virtual ~IncrementalCacheWriter();
+
+	/**
+	 * Set if subtrees that are finished and written are cleared from
+	 * the tree.
+	 **/
+	void setReleaseWritten( bool release ) { _releaseWritten = release; }
+
+	/**
+	 * Return 'true' if subtrees that are finished and written are
+	 * cleared from the tree.
+	 **/
+	bool releaseWritten() const { return _releaseWritten; }
+
+	/**
+	 * Write what is left and close the cache file. Call this when the
+	 * tree is finished. Returns 'true' if OK, 'false' upon error.
+	 **/
+	bool finish();
+
+
+    protected slots:
+
+	/**
+	 * Notification that the read job of 'dir' is finished: Write it if
+	 * its parent is written already, otherwise hold it back.
+	 **/
+	void readJobFinished( DirInfo * dir );
+
+	/**
+	 * Notification that 'child' is about to be deleted.
+	 **/
+	void deletingChild( FileInfo * child );
+
+	/**
+	 * Notification that the children of 'subtree' are about to be
+	 * deleted.
+	 **/
+	void clearingSubtree( DirInfo * subtree );
+
+
+    protected:
+
+	/**
+	 * Write 'dir' with its direct non-directory children, then the
+	 * subdirectories that were held back for it and those that are
+	 * not read at all (excluded directories, mount points).
+	 **/
+	void writeDir( DirInfo * dir );
+
+	/**
+	 * Clear the largest subtree around the directory of the last read
+	 * job that is finished, if there is one.
+	 **/
+	void releaseFinished();
+
+	/**
+	 * Forget all directories of 'item' and its subtree.
+	 **/
+	void forget( FileInfo * item );
+
+
 	//
 	// Data members
 	//
 
-	bool _ok;
+	DirTree *			   _tree;
+	QString				   _fileName;
+	QSet<DirInfo *>			   _writtenDirs;
+	QHash<DirInfo *, QSet<DirInfo *> > _heldDirs;	 // by parent
+	DirInfo *			   _releaseCandidate;
+	bool				   _releaseWritten;
     };
 
 
 
+    /**
+     * A binary cache file from an earlier scan that is used as the baseline
+     * for a new scan of the same directory (see DirTree::setCacheBaseline()):
+     * A directory whose mtime is still the same as in the cache file does
+     * not need to be read again; its direct non-directory children are
+     * taken from the cache file. Its subdirectories are still checked one
+     * by one with lstat().
+     *
+     * This relies on the mtime of a directory changing whenever an entry is
+     * created, deleted or renamed in it. A file that is modified in place
+     * does not change the mtime of its directory, so its new size is not
+     * noticed.
+     *
+     * This needs the subtree table of the binary cache format; gzipped
+     * cache files cannot be used as a baseline.
+     *
+     * A baseline can also be taken from a subtree in memory right before
+     * it is read again (see DirTree::refreshChanged()), so only the
+     * directories that changed since the last scan are read.
+     **/
+    class CacheBaseline
+    {
+    public:
+
+	/**
+	 * Constructor. Use ok() to check if 'fileName' can be used.
+	 **/
+	CacheBaseline( const QString & fileName );
+
+	/**
+	 * Constructor for a baseline from 'subtree' in memory: All its
+	 * directories that were read completely are copied.
+	 **/
+	CacheBaseline( DirInfo * subtree );
+
+	/**
+	 * Return 'true' if the cache file could be opened and has a
+	 * subtree table or if there are any directories from memory.
+	 **/
+	bool ok() const { return ! _cacheFile.isNull() || ! _memChildren.isEmpty(); }
+
+	/**
+	 * Return the name of the cache file.
+	 **/
+	const QString & fileName() const { return _fileName; }
+
+	/**
+	 * Return the number of directories in the cache file.
+	 **/
+	int dirCount() const { return _dirs.size(); }
+
+	/**
+	 * Look up directory 'path'. If it is in the cache file with the
+	 * same 'mtime', return 'true' and its directory number in
+	 * 'dirNo_ret'.
+	 **/
+	bool findUnchangedDir( const QString & path,
+			       time_t	       mtime,
+			       quint64 &       dirNo_ret ) const;
+
+	/**
+	 * Return the direct children (files as well as directories) of
+	 * directory no. 'dirNo'.
+	 **/
+	QVector<BinaryCacheNode> children( quint64 dirNo ) const;
+
+	/**
+	 * Return the name of 'node'.
+	 **/
+	QString name( const BinaryCacheNode & node ) const;
+
+    protected:
+
+	/**
+	 * Copy directory 'dir' and its subdirectories from memory.
+	 **/
+	void addDir( DirInfo * dir );
+
+	/**
+	 * Add the children of 'parent' (a directory or one of its pseudo
+	 * directories) to 'children_ret'; return the subdirectories in
+	 * 'subDirs_ret'.
+	 **/
+	void addChildren( FileInfo *		   parent,
+			  QVector<BinaryCacheNode> & children_ret,
+			  QList<DirInfo *> &	   subDirs_ret );
+
+	QString			_fileName;
+	BinaryCacheFilePtr	_cacheFile;
+	QHash<QString, quint32> _dirs;	// path -> directory number
+
+	// Only for a baseline from memory
+	QVector<QVector<BinaryCacheNode> > _memChildren;
+	QVector<qint64>		_memMtimes;
+	QByteArray		_memNames;
+
+    };	// class CacheBaseline
+
+
+
     class CacheReader: public QObject
     {
 	Q_OBJECT
@@ -101,6 +929,18 @@ namespace QDirStat
 		     DirTree	   * tree,
 		     DirInfo	   * parent = 0 );
 
+	/**
+	 * Constructor for loading the pending subtree of 'dir', which is
+	 * directory no. 'dirNo' of binary cache file 'cacheFile' (see
+	 * DirTree::loadPendingSubtree()). This reads only the direct
+	 * children of 'dir'; large subtrees of its subdirectories are
+	 * pending again.
+	 **/
+	CacheReader( BinaryCacheFilePtr cacheFile,
+		     DirTree *		tree,
+		     DirInfo *		dir,
+		     quint64		dirNo );
+
 	/**
 	 * Destructor
 	 **/
@@ -114,6 +954,19 @@ namespace QDirStat
 	 **/
 	bool read( int maxLines = 0 );
 
+	/**
+	 * Read from the cache file for about 'millisec' millisec.
+	 *
+	 * Returns true if OK and there is more to read, false otherwise.
+	 **/
+	bool readFor( int millisec );
+
+	/**
+	 * Return 'true' if the cache file is small enough to be read in one
+	 * go (see CACHE_READ_ALL_MAX_SIZE).
+	 **/
+	bool isSmall() const { return _fileSize <= CACHE_READ_ALL_MAX_SIZE; }
+
 	/**
 	 * Returns true if the end of the cache file is reached (or if there
 	 * was an error).
@@ -125,6 +978,38 @@ namespace QDirStat
 	 **/
 	bool ok() const { return _ok; }
 
+	/**
+	 * Return 'true' if this is a delta cache file (see CacheWriter):
+	 * Its items replace or remove items of the tree it is applied to.
+	 **/
+	bool isDelta() const { return _isDelta; }
+
+	/**
+	 * Return the toplevel directory of what this reader reads.
+	 **/
+	DirInfo * toplevel() const { return _toplevel; }
+
+	/**
+	 * Set if the destructor finalizes the subtree that was read and
+	 * sends the readJobFinished() signals (the default). This is
+	 * switched off when more delta cache files are still to be applied
+	 * to that subtree.
+	 **/
+	void setFinalizeTree( bool finalize ) { _finalizeTree = finalize; }
+
+	/**
+	 * Read the cache below the 'parent' passed to the constructor as if
+	 * that were the tree's root: The toplevel directory of the cache
+	 * becomes a child of 'parent' with its complete path as its name, and
+	 * all other paths are relative to that toplevel directory, no matter
+	 * what the URL of 'parent' is. This is how several cache files are
+	 * read into one tree (see DirTree::readCaches()).
+	 *
+	 * This has to be set before reading anything. Delta cache files
+	 * cannot be mounted.
+	 **/
+	void setMounted( bool mounted ) { _mounted = mounted; }
+
 	/**
 	 * Resets the reader so all data lines of the cache can be read with
 	 * subsequent read() calls.
@@ -150,6 +1035,42 @@ namespace QDirStat
 	 **/
 	DirTree * tree() const { return _tree; }
 
+	/**
+	 * Returns true if this is a binary cache file.
+	 **/
+	bool isBinary() const { return _mapped != 0; }
+
+	/**
+	 * Return the binary cache file or a null pointer if this is not a
+	 * binary cache file.
+	 **/
+	BinaryCacheFilePtr binaryFile() const { return _binaryFile; }
+
+	/**
+	 * Set the number of directory levels below the toplevel directory
+	 * that are loaded right away from a binary cache file; larger
+	 * subtrees below that are left pending (see
+	 * DirTree::loadPendingSubtree()). 0 (the default) means to load
+	 * everything. This has no effect for gzipped cache files.
+	 *
+	 * Call this before the first read().
+	 **/
+	void setLazyDepth( int depth );
+
+	/**
+	 * Set if the totals of all directories that were read from a binary
+	 * cache file are compared with the ones stored in the file
+	 * afterwards, and any differences are logged. This is off by default:
+	 * The totals are not calculated again anyway, only added up while
+	 * the items are inserted.
+	 **/
+	static void setValidateTotals( bool validate ) { _validateTotals = validate; }
+
+	/**
+	 * Return 'true' if the totals are compared with the cache file.
+	 **/
+	static bool validateTotals() { return _validateTotals; }
+
 	/**
 	 * Skip leading whitespace from a string.
 	 * Returns a pointer to the first character that is non-whitespace.
@@ -193,6 +1114,11 @@ namespace QDirStat
 
     protected:
 
+	/**
+	 * Initializations common for all constructors.
+	 **/
+	void init( const QString & fileName, DirTree * tree, DirInfo * parent );
+
 	/**
 	 * Check this cache's header (see if it is a QDirStat cache at all)
 	 **/
@@ -203,6 +1129,122 @@ namespace QDirStat
 	 **/
 	void addItem();
 
+	/**
+	 * Remove the item of an "R" line of a delta cache file.
+	 **/
+	void removeDeltaItem();
+
+	/**
+	 * Return the direct child 'name' of 'dir' (also from its dot entry)
+	 * or 0 if there is none.
+	 **/
+	FileInfo * findDeltaChild( DirInfo * dir, const QString & name ) const;
+
+	/**
+	 * Delete 'item' with its subtree. Unlike DirTree::deleteSubtree(),
+	 * this does not notify any views: Nothing of the tree that is being
+	 * read was reported to them yet.
+	 **/
+	void deleteQuietly( FileInfo * item );
+
+	/**
+	 * Find the parent directory in the tree for an item with 'path'.
+	 * Return 0 if there is none.
+	 **/
+	DirInfo * locateParent( const QString & path, const QString & name );
+
+	/**
+	 * Return 'true' if 'parent' is the parent of the toplevel directory
+	 * of the cache, so that directory gets its complete path as its name.
+	 **/
+	bool isToplevelParent( DirInfo * parent ) const;
+
+	/**
+	 * Create a directory 'url' below 'parent' and check it against the
+	 * exclude rules. Return the new directory.
+	 **/
+	DirInfo * createDir( DirInfo *	     parent,
+			     const QString & url,
+			     const QString & name,
+			     mode_t	     mode,
+			     FileSize	     size,
+			     time_t	     mtime );
+
+	/**
+	 * Open 'fileName' as a binary cache file if it is one: mmap() it and
+	 * check the header. Return 'false' if this is not a binary cache
+	 * file; set _ok to 'false' if it is one, but it is broken.
+	 **/
+	bool openBinary( const QString & fileName );
+
+	/**
+	 * Add at most 'maxItems' (or all if 0) items from a binary cache
+	 * file.
+	 **/
+	void readBinary( int maxItems );
+
+	/**
+	 * Add one node from a binary cache file to _tree.
+	 **/
+	void addBinaryItem( const BinaryCacheNode & node );
+
+	/**
+	 * Skip the subtree of 'dir' (directory no. 'dirNo' of the binary
+	 * cache file) if it is large enough and leave it to
+	 * DirTree::loadPendingSubtree() to be loaded when it is needed.
+	 **/
+	void skipSubtree( DirInfo * dir, quint64 dirNo );
+
+	/**
+	 * Return the name of 'node' of a binary cache file.
+	 **/
+	QString binaryName( const BinaryCacheNode & node ) const;
+
+	/**
+	 * Return node no. 'no' of a binary cache file.
+	 **/
+	BinaryCacheNode binaryNode( quint64 no ) const;
+
+	/**
+	 * Read the index of a cache file that consists of several gzip
+	 * members from the file with descriptor 'fd' and store the members
+	 * in _memberOffsets and _memberSizes. Return 'false' if there is no
+	 * index (e.g. because this is an old single-stream cache file).
+	 **/
+	bool readIndex( int fd );
+
+	/**
+	 * Read the index member at 'indexOffset' of a file with 'fileSize'
+	 * bytes whose first member is at 'firstOffset'. Return 'false' if it
+	 * is broken.
+	 **/
+	bool readIndexMember( qint64 indexOffset, qint64 firstOffset, qint64 fileSize );
+
+	/**
+	 * Queue members for inflating in the thread pool until enough of
+	 * them are in progress.
+	 **/
+	void scheduleMembers();
+
+	/**
+	 * Start inflating the single gzip stream of the cache file in a
+	 * worker thread (again). Return 'false' if the file can't be opened.
+	 **/
+	bool openStream();
+
+	/**
+	 * Copy the next line from the inflated members or stream blocks to
+	 * _buffer like gzgets(). Return 'false' at the end of the last member
+	 * or block or upon error.
+	 **/
+	bool getMemberLine();
+
+	/**
+	 * Return 'true' if the input is exhausted, no matter if read from
+	 * parallel inflated members or from _stream.
+	 **/
+	bool atEnd();
+
 	/**
 	 * Read the next line that is not empty or a comment and store it in
 	 * _line.
@@ -240,15 +1282,28 @@ namespace QDirStat
 	QString buildPath( const QString & path, const QString & name ) const;
 
 	/**
-	 * Return an unescaped version of 'rawPath'.
+	 * Decode the URL-encoded 'rawPath' in place (the result is never
+	 * longer) and return its new length. Duplicate (or triplicate or
+	 * more) slashes are replaced by just one, and trailing slashes are
+	 * removed.
+	 **/
+	static int unescapePath( char * rawPath );
+
+	/**
+	 * Find the directory with the decoded absolute path 'path' of
+	 * 'len' bytes on _dirStack, i.e. among the last directory read from
+	 * the cache file and its ancestors. Entries of _dirStack below
+	 * that directory are removed. Return 0 if it is not there.
 	 **/
-	QString unescapedPath( const QString & rawPath ) const;
+	DirInfo * findStackedDir( const char * path, int len );
 
 	/**
-	 * Clean a path: Replace duplicate (or triplicate or more) slashes with
-	 * just one. QUrl doesn't seem to handle those well.
+	 * Make directory 'dir' with the decoded absolute path 'path' of
+	 * 'len' bytes the last directory on _dirStack. Its parent is
+	 * expected to be the top of the stack; if it was not found there,
+	 * the stack is restarted with 'dir'.
 	 **/
-	QString cleanPath( const QString & rawPath ) const;
+	void pushDir( DirInfo * dir, const char * path, int len );
 
 	/**
 	 * Returns the number of fields in the current input line after
@@ -257,11 +1312,17 @@ namespace QDirStat
 	int fieldsCount() const { return _fieldsCount; }
 
 	/**
-	 * Recursively set the read status of all dirs from 'dir' on, send tree
-	 * signals and finalize local (i.e. clean up empty or unneded dot
-	 * entries).
+	 * Set the read status of all dirs from the toplevel directory on,
+	 * finalize them (i.e. clean up empty or unneeded dot entries) and
+	 * send the tree signals.
 	 **/
-	void finalizeRecursive( DirInfo * dir );
+	void finalizeTree();
+
+	/**
+	 * Log the directories of a binary cache file whose totals are not the
+	 * same as in its subtree table (see setValidateTotals()).
+	 **/
+	void checkTotals();
 
         /**
          * Cascade a read error up to the toplevel directory node read by this
@@ -275,7 +1336,8 @@ namespace QDirStat
 	//
 
 	DirTree *	_tree;
-	gzFile		_cache;
+	CacheStreamPtr	_stream;	// for single-stream text cache files
+	qint64		_fileSize;
 	char		_buffer[ MAX_CACHE_LINE_LEN ];
 	char *		_line;
 	int		_lineNo;
@@ -285,10 +1347,50 @@ namespace QDirStat
 	bool		_ok;
         int             _errorCount;
 	DirInfo *	_toplevel;
-	DirInfo *	_lastDir;
-	DirInfo *	_lastExcludedDir;
-	QString		_lastExcludedDirUrl;
-        QRegExp         _multiSlash;
+	DirInfo *	_lastDir;	// Parent for items without a path
+	bool		_skipFiles;	// Skip items without a path (excluded dir)
+	bool		_isDelta;
+	bool		_finalizeTree;
+	bool		_mounted;
+
+	// The last directory read and its ancestors; all paths are prefixes
+	// of _dirPath, the decoded path of the last directory
+
+	struct DirStackEntry
+	{
+	    int	      pathLen;
+	    DirInfo * dir;
+	};
+
+	QVector<DirStackEntry> _dirStack;
+	QByteArray	_dirPath;
+
+	// Binary cache files
+
+	BinaryCacheFilePtr _binaryFile;
+	const char *	_mapped;	// the complete mmap()ed file
+	BinaryCacheHeader _binaryHeader;
+	quint64		_firstNode;
+	quint64		_nextNode;
+	quint64		_endNode;
+	quint64		_binaryDirBase;	// directory index of _binaryDirs[0]
+	QVector<DirInfo *> _binaryDirs;	// for each directory index; 0 if excluded
+	QVector<int>	_binaryDirDepths; // below the toplevel of this reader
+	QSet<DirInfo *> _unfinishedDirs;  // BINARY_CACHE_DIR_UNFINISHED
+	int		_lazyDepth;
+
+	static bool	_validateTotals;
+
+	// Text cache files with several gzip members
+
+	QList<qint64>	_memberOffsets;	// empty for single-stream files
+	QList<qint64>	_memberSizes;
+	int		_nextMember;	// next one to schedule
+	QList<CacheMemberPtr> _members;	// scheduled, not consumed yet
+	QByteArray	_memberData;	// the one (or stream block) currently being read
+	int		_memberPos;
+	bool		_membersEnd;	// or the end of _stream
+	bool		_zstd;		// The members are zstd frames
     };
 
 }	// namespace QDirStat
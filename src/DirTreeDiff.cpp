@@ -0,0 +1,210 @@
+/*
+ *   File name: DirTreeDiff.cpp
+ *   Summary:	Size differences between two states of a directory tree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QElapsedTimer>
+#include <QFileInfo>
+
+#include "DirTreeDiff.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "DotEntry.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+DirTreeDiff::DirTreeDiff( DirTree * tree ):
+    _tree( tree ),
+    _comparedDirs( 0 )
+{
+    CHECK_PTR( _tree );
+}
+
+
+bool DirTreeDiff::compareWithCache( const QString &	cacheFileName,
+				    const QStringList & deltaFileNames )
+{
+    DirTree oldTree;
+
+    if ( ! oldTree.readCacheNow( cacheFileName, deltaFileNames ) )
+	return false;
+
+    if ( ! compare( &oldTree ) )
+	return false;
+
+    _oldName = QFileInfo( cacheFileName ).fileName();
+
+    return true;
+}
+
+
+bool DirTreeDiff::compare( DirTree * oldTree )
+{
+    _deltas.clear();
+    _newItems.clear();
+    _comparedDirs = 0;
+
+    FileInfo * newTop = _tree->firstToplevel();
+    FileInfo * oldTop = oldTree->firstToplevel();
+
+    if ( ! newTop || ! oldTop )
+	return false;
+
+    // One of the trees may cover more than the other one; compare only the
+    // part that they have in common.
+
+    FileInfo * oldItem = oldTree->locate( newTop->url() );
+    FileInfo * newItem = newTop;
+
+    if ( ! oldItem )
+    {
+	oldItem = oldTop;
+	newItem = _tree->locate( oldTop->url() );
+    }
+
+    if ( ! newItem || ! newItem->isDirInfo() || ! oldItem->isDirInfo() )
+    {
+	logError() << "No common directory in " << newTop << " and " << oldTop << endl;
+	return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    compareDir( newItem->toDirInfo(), oldItem->toDirInfo() );
+
+    logInfo() << "Compared " << newItem << ": " << _comparedDirs << " dirs, "
+	      << _deltas.size() << " changed and " << _newItems.size() << " new items in "
+	      << timer.elapsed() / 1000.0 << " sec" << endl;
+
+    return true;
+}
+
+
+void DirTreeDiff::compareDir( DirInfo * newDir, DirInfo * oldDir )
+{
+    setDelta( newDir, newDir->totalSize() - oldDir->totalSize() );
+
+    if ( sameItem( newDir, oldDir ) )
+	return;
+
+    ++_comparedDirs;
+
+    QHash<QString, FileInfo *> oldChildren;
+    FileSize oldFilesSize = addChildren( oldDir, oldChildren );
+
+    compareChildren( newDir, oldChildren );
+
+    DotEntry * dotEntry = newDir->dotEntry();
+
+    if ( dotEntry )
+    {
+	setDelta( dotEntry, dotEntry->totalSize() - oldFilesSize );
+	compareChildren( dotEntry, oldChildren );
+    }
+}
+
+
+void DirTreeDiff::compareChildren( DirInfo *			    newParent,
+				   const QHash<QString, FileInfo *> & oldChildren )
+{
+    for ( FileInfo * child = newParent->firstChild(); child; child = child->next() )
+    {
+	FileInfo * oldChild = oldChildren.value( child->name() );
+
+	if ( ! oldChild || oldChild->isDirInfo() != child->isDirInfo() )
+	{
+	    _newItems.insert( child );
+	}
+	else if ( child->isDirInfo() )
+	{
+	    compareDir( child->toDirInfo(), oldChild->toDirInfo() );
+	}
+	else
+	{
+	    setDelta( child, child->totalSize() - oldChild->totalSize() );
+	}
+    }
+}
+
+
+FileSize DirTreeDiff::addChildren( DirInfo *			dir,
+				   QHash<QString, FileInfo *> & children )
+{
+    FileSize filesSize = 0;
+
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+    {
+	children.insert( child->name(), child );
+
+	if ( ! child->isDirInfo() )
+	    filesSize += child->totalSize();
+    }
+
+    DotEntry * dotEntry = dir->dotEntry();
+
+    if ( dotEntry )
+    {
+	for ( FileInfo * child = dotEntry->firstChild(); child; child = child->next() )
+	    children.insert( child->name(), child );
+
+	filesSize += dotEntry->totalSize();
+    }
+
+    return filesSize;
+}
+
+
+bool DirTreeDiff::sameItem( FileInfo * newItem, FileInfo * oldItem )
+{
+    return newItem->totalSize()	  == oldItem->totalSize()  &&
+	   newItem->totalItems()  == oldItem->totalItems() &&
+	   newItem->latestMtime() == oldItem->latestMtime();
+}
+
+
+bool DirTreeDiff::isNew( FileInfo * item ) const
+{
+    while ( item )
+    {
+	if ( _newItems.contains( item ) )
+	    return true;
+
+	item = item->parent();
+    }
+
+    return false;
+}
+
+
+FileSize DirTreeDiff::sizeDelta( FileInfo * item ) const
+{
+    QHash<const FileInfo *, FileSize>::const_iterator it = _deltas.constFind( item );
+
+    if ( it != _deltas.constEnd() )
+	return it.value();
+
+    return isNew( item ) ? item->totalSize() : 0;
+}
+
+
+double DirTreeDiff::sizeChange( FileInfo * item ) const
+{
+    FileSize delta   = sizeDelta( item );
+    FileSize newSize = item->totalSize();
+    FileSize oldSize = newSize - delta;
+    FileSize maxSize = qMax( newSize, oldSize );
+
+    if ( delta == 0 || maxSize <= 0 )
+	return 0.0;
+
+    return (double) delta / maxSize;
+}
@@ -0,0 +1,157 @@
+/*
+ *   File name: DirTreeDiff.h
+ *   Summary:	Size differences between two states of a directory tree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef DirTreeDiff_h
+#define DirTreeDiff_h
+
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include "FileInfo.h"
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+    /**
+     * Size differences between a DirTree and an older state of the same
+     * directories, typically read from a cache file.
+     *
+     * Both trees are walked in parallel. A subtree that has the same total
+     * size, number of items and latest mtime in both trees is considered
+     * unchanged, and it is not descended into, so comparing two states that
+     * only differ in a few places is fast even for huge trees.
+     *
+     * The result is the size delta of each changed item of the new tree.
+     * Items that are not in the old tree at all are new; everything below
+     * them is new, too. Items that were removed are not in the new tree, so
+     * they only show up in the delta of their parent.
+     *
+     * This stores pointers to the nodes of the new tree, so it has to be
+     * discarded as soon as the new tree changes; DirTree takes care of that
+     * for its diff().
+     **/
+    class DirTreeDiff
+    {
+    public:
+
+	/**
+	 * Constructor. 'tree' is the new tree.
+	 **/
+	DirTreeDiff( DirTree * tree );
+
+	/**
+	 * Compare the tree with the state in cache file 'cacheFileName' with
+	 * the delta cache files 'deltaFileNames' applied to it. The old tree
+	 * is only needed while comparing.
+	 *
+	 * Return 'false' if the cache cannot be read or if it does not have
+	 * any directory in common with the tree.
+	 **/
+	bool compareWithCache( const QString &	   cacheFileName,
+			       const QStringList & deltaFileNames = QStringList() );
+
+	/**
+	 * Compare the tree with 'oldTree'. This uses the common part of both
+	 * trees, i.e. the toplevel directory of one of them that is also in
+	 * the other one.
+	 *
+	 * Return 'false' if there is no common directory.
+	 **/
+	bool compare( DirTree * oldTree );
+
+	/**
+	 * Return a short description of what the tree is compared with,
+	 * e.g. the name of the cache file.
+	 **/
+	const QString & oldName() const { return _oldName; }
+
+	/**
+	 * Return the difference of the total size of 'item' compared to the
+	 * old tree. For new items, this is their total size.
+	 **/
+	FileSize sizeDelta( FileInfo * item ) const;
+
+	/**
+	 * Return 'true' if 'item' or any of its ancestors is not in the old
+	 * tree.
+	 **/
+	bool isNew( FileInfo * item ) const;
+
+	/**
+	 * Return the relative size change of 'item': The delta divided by the
+	 * larger of the old and the new size; 1.0 for new items, -1.0 for
+	 * items that shrank to zero, 0.0 for unchanged items.
+	 **/
+	double sizeChange( FileInfo * item ) const;
+
+	/**
+	 * Return the number of directory pairs that were compared in detail;
+	 * all others were skipped because their parents were unchanged.
+	 **/
+	int comparedDirs() const { return _comparedDirs; }
+
+
+    protected:
+
+	/**
+	 * Compare two directories that are the same in both trees and
+	 * recurse into their changed subdirectories.
+	 **/
+	void compareDir( DirInfo * newDir, DirInfo * oldDir );
+
+	/**
+	 * Compare the children of 'newParent' with their old counterparts
+	 * from 'oldChildren'.
+	 **/
+	void compareChildren( DirInfo *				newParent,
+			      const QHash<QString, FileInfo *> & oldChildren );
+
+	/**
+	 * Add the children of 'dir' and those of its dot entry to
+	 * 'children'. Files may be in the dot entry in one tree and directly
+	 * in the directory in the other, so they are combined here.
+	 *
+	 * Return the total size of the files among them.
+	 **/
+	static FileSize addChildren( DirInfo *			  dir,
+				     QHash<QString, FileInfo *> & children );
+
+	/**
+	 * Return 'true' if 'newItem' and 'oldItem' look the same, so their
+	 * subtrees don't need to be compared.
+	 **/
+	static bool sameItem( FileInfo * newItem, FileInfo * oldItem );
+
+	/**
+	 * Store the delta of an item if it is not zero.
+	 **/
+	void setDelta( const FileInfo * item, FileSize delta )
+	    { if ( delta != 0 ) _deltas.insert( item, delta ); }
+
+
+	// Data members
+
+	DirTree *			 _tree;
+	QString				 _oldName;
+	QHash<const FileInfo *, FileSize> _deltas;
+	QSet<const FileInfo *>		 _newItems;
+	int				 _comparedDirs;
+
+    };	// class DirTreeDiff
+
+}	// namespace QDirStat
+
+
+#endif // ifndef DirTreeDiff_h
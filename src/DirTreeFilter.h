@@ -43,6 +43,39 @@ namespace QDirStat
 	 **/
 	virtual bool ignore( const QString & path ) const = 0;
 
+	/**
+	 * Look up directory 'dirPath' once for checking all of its entries
+	 * with ignoreEntry() and return a number that stands for what this
+	 * filter knows about it.
+	 *
+	 * This default implementation returns 0.
+	 **/
+	virtual int lookupDir( const QString & dirPath ) const
+	    { Q_UNUSED( dirPath ); return 0; }
+
+	/**
+	 * Return 'true' if entry 'name' of directory 'dirPath' should be
+	 * ignored, 'false' if not. 'dirNo' is what lookupDir() returned for
+	 * 'dirPath'. Derived classes can reimplement this to check the name
+	 * without building the full path for each entry.
+	 *
+	 * This default implementation checks the full path with ignore().
+	 **/
+	virtual bool ignoreEntry( const QString & dirPath,
+				  int		  dirNo,
+				  const QString & name ) const
+	    {
+		Q_UNUSED( dirNo );
+		return ignore( ( dirPath == "/" ? "" : dirPath ) + "/" + name );
+	    }
+
+	/**
+	 * Return a short description of this filter for the user.
+	 *
+	 * Derived classes are required to implement this.
+	 **/
+	virtual QString description() const = 0;
+
     };	// class DirTreeFilter
 
 }	// namespace QDirStat
@@ -7,17 +7,30 @@
  */
 
 
+#include <string.h>	// memcpy()
+#include <algorithm>
+
 #include <QPalette>
+#include <QFont>
 
 #include "Qt4Compat.h"
 
 #include "DirTreeModel.h"
 #include "DirTree.h"
+#include "DirTreeDiff.h"
+#include "SizeHistory.h"
 #include "FileInfoIterator.h"
+#include "FileInfoSorter.h"
+#include "BtrfsQgroups.h"
+#include "ZfsDatasets.h"
+#include "ContainerLayers.h"
 #include "DataColumns.h"
+#include "OwnerNames.h"
 #include "SelectionModel.h"
 #include "Settings.h"
 #include "SettingsHelpers.h"
+#include "Tracer.h"
+#include "UpdateScheduler.h"
 #include "Logger.h"
 #include "Exception.h"
 #include "DebugHelpers.h"
@@ -30,6 +43,18 @@
 // like (4k)
 #define SMALL_FILE_SHOW_ALLOC_THRESHOLD         75
 
+// Directories that finish reading within this time are reported to the views
+// together (about one frame)
+#define INSERT_BATCH_MILLISEC			16
+
+// Maximum number of entries in the column text cache; this is many times
+// more cells than fit on any screen
+#define TEXT_CACHE_MAX_ENTRIES			( 16 * 1024 )
+
+// Directories with at least this many children are sorted in a worker thread
+// if they were already sorted differently before
+#define BACKGROUND_SORT_MIN_CHILDREN		( 50 * 1000 )
+
 using namespace QDirStat;
 
 
@@ -38,20 +63,38 @@ DirTreeModel::DirTreeModel( QObject * parent ):
     _tree(0),
     _selectionModel(0),
     _readJobsCol( PercentBarCol ),
+    _updates(0),
+    _inserts(0),
     _updateTimerMillisec( 333 ),
     _slowUpdateMillisec( 3000 ),
     _slowUpdate( false ),
     _sortCol( NameCol ),
     _sortOrder( Qt::AscendingOrder ),
-    _removingRows( false )
+    _removingRows( false ),
+    _updatingPersistent( false ),
+    _textCache( TEXT_CACHE_MAX_ENTRIES )
 {
     createTree();
     readSettings();
     loadIcons();
-    _updateTimer.setInterval( _updateTimerMillisec );
 
-    connect( &_updateTimer, SIGNAL( timeout()		 ),
-	     this,	    SLOT  ( sendPendingUpdates() ) );
+    // Inserting new rows goes first: The data of rows that the views
+    // don't know yet don't need an update.
+
+    _inserts = new ScheduledUpdate( this, HighPriority, INSERT_BATCH_MILLISEC );
+    CHECK_NEW( _inserts );
+
+    connect( _inserts, SIGNAL( update()		  ),
+	     this,     SLOT  ( sendPendingInserts() ) );
+
+    _updates = new ScheduledUpdate( this, NormalPriority, _updateTimerMillisec );
+    CHECK_NEW( _updates );
+
+    connect( _updates, SIGNAL( update()		  ),
+	     this,     SLOT  ( sendPendingUpdates() ) );
+
+    connect( OwnerNames::instance(), SIGNAL( namesChanged()	),
+	     this,		     SLOT  ( ownerNamesChanged() ) );
 }
 
 
@@ -59,6 +102,11 @@ DirTreeModel::~DirTreeModel()
 {
     writeSettings();
 
+    // The background sorts invoke this model when they are done
+
+    _sortThreadPool.waitForDone();
+    qDeleteAll( _backgroundSorts );
+
     if ( _tree )
 	delete _tree;
 }
@@ -66,11 +114,11 @@ DirTreeModel::~DirTreeModel()
 
 void DirTreeModel::readSettings()
 {
+    _tree->readSettings();
+
     Settings settings;
     settings.beginGroup( "DirectoryTree" );
 
-    _tree->setCrossFilesystems	( settings.value( "CrossFilesystems", false ).toBool() );
-    FileInfo::setIgnoreHardLinks( settings.value( "IgnoreHardLinks",  false ).toBool() );
     _treeIconDir	 = settings.value( "TreeIconDir" , ":/icons/tree-medium/" ).toString();
     _updateTimerMillisec = settings.value( "UpdateTimerMillisec", 333 ).toInt();
     _slowUpdateMillisec	 = settings.value( "SlowUpdateMillisec", 3000 ).toInt();
@@ -100,13 +148,14 @@ void DirTreeModel::readSettings()
 
 void DirTreeModel::writeSettings()
 {
+    if ( _tree )
+	_tree->writeSettings();
+
     Settings settings;
     settings.beginGroup( "DirectoryTree" );
 
     settings.setValue( "SlowUpdateMillisec", _slowUpdateMillisec  );
 
-    settings.setDefaultValue( "CrossFilesystems",    _tree ? _tree->crossFilesystems() : false );
-    settings.setDefaultValue( "IgnoreHardLinks",     FileInfo::ignoreHardLinks() );
     settings.setDefaultValue( "TreeIconDir",	     _treeIconDir		 );
     settings.setDefaultValue( "UpdateTimerMillisec", _updateTimerMillisec	 );
 
@@ -133,10 +182,10 @@ bool DirTreeModel::usingDarkTheme()
 void DirTreeModel::setSlowUpdate( bool slow )
 {
     _slowUpdate = slow;
-    _updateTimer.setInterval( _slowUpdate ? _slowUpdateMillisec : _updateTimerMillisec );
+    _updates->setMinInterval( _slowUpdate ? _slowUpdateMillisec : _updateTimerMillisec );
 
     if ( slow )
-	logInfo() << "Display update every " << _updateTimer.interval() << " millisec" << endl;
+	logInfo() << "Display update every " << _updates->minInterval() << " millisec" << endl;
 }
 
 
@@ -166,13 +215,30 @@ void DirTreeModel::createTree()
     connect( _tree, SIGNAL( subtreeCleared( DirInfo * ) ),
 	     this,  SLOT  ( subtreeCleared( DirInfo * ) ) );
 
+    connect( _tree, SIGNAL( subtreeReplaced( DirInfo * ) ),
+	     this,  SLOT  ( subtreeReplaced( DirInfo * ) ) );
+
+    connect( _tree, SIGNAL( checkingSpill( DirInfo *, bool * ) ),
+	     this,  SLOT  ( checkSpill	 ( DirInfo *, bool * ) ) );
+
     connect( _tree, SIGNAL( childDeleted() ),
 	     this,  SLOT  ( childDeleted() ) );
+
+    connect( _tree, SIGNAL( diffChanged() ),
+	     this,  SLOT  ( diffChanged()  ) );
+
+    connect( _tree, SIGNAL( sizeHistoryChanged() ),
+	     this,  SLOT  ( diffChanged()	 ) );
+
+    connect( _tree, SIGNAL( clearing()	   ),
+	     this,  SLOT  ( treeClearing() ) );
 }
 
 
 void DirTreeModel::clear()
 {
+    TRACE_SCOPE( "model", "DirTreeModel::clear" );
+
     if ( _tree )
     {
 	beginResetModel();
@@ -196,7 +262,6 @@ void DirTreeModel::openUrl( const QString & url )
     if ( _tree->root() &&  _tree->root()->hasChildren() )
 	clear();
 
-    _updateTimer.start();
     _tree->startReading( url );
 }
 
@@ -209,11 +274,54 @@ void DirTreeModel::readPkg( const PkgFilter & pkgFilter )
     if ( _tree->root() &&  _tree->root()->hasChildren() )
 	clear();
 
-    _updateTimer.start();
     _tree->readPkg( pkgFilter );
 }
 
 
+void DirTreeModel::readRemote( const QString & url )
+{
+    CHECK_PTR( _tree );
+
+    if ( _tree->root() &&  _tree->root()->hasChildren() )
+	clear();
+
+    _tree->readRemote( url );
+}
+
+
+void DirTreeModel::readExt4Image( const QString & url )
+{
+    CHECK_PTR( _tree );
+
+    if ( _tree->root() &&  _tree->root()->hasChildren() )
+	clear();
+
+    _tree->readExt4Image( url );
+}
+
+
+void DirTreeModel::readNtfsVolume( const QString & url )
+{
+    CHECK_PTR( _tree );
+
+    if ( _tree->root() &&  _tree->root()->hasChildren() )
+	clear();
+
+    _tree->readNtfsVolume( url );
+}
+
+
+void DirTreeModel::readImport( const QString & url )
+{
+    CHECK_PTR( _tree );
+
+    if ( _tree->root() &&  _tree->root()->hasChildren() )
+	clear();
+
+    _tree->readImport( url );
+}
+
+
 void DirTreeModel::loadIcons()
 {
     if ( _treeIconDir.isEmpty() )
@@ -238,6 +346,8 @@ void DirTreeModel::loadIcons()
     _specialIcon       = QIcon( _treeIconDir + "special.png"	    );
     _pkgIcon	       = QIcon( _treeIconDir + "folder-pkg.png"     );
     _atticIcon         = _dirIcon;
+
+    _iconPixmaps.clear();
 }
 
 
@@ -253,8 +363,12 @@ FileInfo * DirTreeModel::findChild( DirInfo * parent, int childNo ) const
 {
     CHECK_PTR( parent );
 
+    DataColumn	  sortCol;
+    Qt::SortOrder sortOrder;
+    sortOrderFor( parent, sortCol, sortOrder );
+
     const FileInfoList & childrenList =
-	parent->sortedChildren( _sortCol, _sortOrder,
+	parent->sortedChildren( sortCol, sortOrder,
 				true );	    // includeAttic
 
     if ( childNo < 0 || childNo >= childrenList.size() )
@@ -278,11 +392,12 @@ int DirTreeModel::rowNumber( FileInfo * child ) const
     if ( ! child->parent() )
 	return 0;
 
-    const FileInfoList & childrenList =
-	child->parent()->sortedChildren( _sortCol, _sortOrder,
-					 true ); // includeAttic
+    DataColumn	  sortCol;
+    Qt::SortOrder sortOrder;
+    sortOrderFor( child->parent(), sortCol, sortOrder );
 
-    int row = childrenList.indexOf( child );
+    int row = child->parent()->sortedRow( child, sortCol, sortOrder,
+					   true ); // includeAttic
 
     if ( row < 0 )
     {
@@ -323,7 +438,6 @@ int DirTreeModel::rowCount( const QModelIndex & parentIndex ) const
     if ( ! _tree )
 	return 0;
 
-    int count = 0;
     FileInfo * item = 0;
 
     if ( parentIndex.isValid() )
@@ -334,6 +448,14 @@ int DirTreeModel::rowCount( const QModelIndex & parentIndex ) const
     else
 	item = _tree->root();
 
+    return qMin( reportableRowCount( item ), exposedRowLimit( item ) );
+}
+
+
+int DirTreeModel::reportableRowCount( FileInfo * item ) const
+{
+    int count = 0;
+
     if ( ! item->isDirInfo() )
 	return 0;
 
@@ -343,6 +465,14 @@ int DirTreeModel::rowCount( const QModelIndex & parentIndex ) const
 	return 0;
     }
 
+    if ( _pendingInserts.contains( item->toDirInfo() ) )
+    {
+	// The children will be reported with beginInsertRows() very soon;
+	// if we reported them here already, the view would count them twice.
+
+	return 0;
+    }
+
     switch ( item->readState() )
     {
 	case DirQueued:
@@ -404,6 +534,53 @@ int DirTreeModel::columnCount( const QModelIndex & parent ) const
 }
 
 
+bool DirTreeModel::hasChildren( const QModelIndex & parentIndex ) const
+{
+    if ( canFetchMore( parentIndex ) )
+	return true;
+
+    return QAbstractItemModel::hasChildren( parentIndex );
+}
+
+
+bool DirTreeModel::canFetchMore( const QModelIndex & parentIndex ) const
+{
+    if ( ! _tree || ! parentIndex.isValid() )
+	return false;
+
+    FileInfo * item = static_cast<FileInfo *>( parentIndex.internalPointer() );
+    CHECK_MAGIC( item );
+
+    DirInfo * dir = item->toDirInfo();
+
+    if ( ! dir )
+	return false;
+
+    return dir->isPendingSubtree() || rowCount( parentIndex ) < reportableRowCount( dir );
+}
+
+
+void DirTreeModel::fetchMore( const QModelIndex & parentIndex )
+{
+    if ( ! canFetchMore( parentIndex ) )
+	return;
+
+    FileInfo * item = static_cast<FileInfo *>( parentIndex.internalPointer() );
+    DirInfo  * dir  = item->toDirInfo();
+
+    if ( dir->isPendingSubtree() )
+    {
+	// This sends readJobFinished() for the directory when done, so the
+	// new children are reported to the view from there.
+
+	_tree->loadPendingSubtree( dir );
+	return;
+    }
+
+    exposeRow( dir, rowCount( parentIndex ) + FETCH_MORE_ROWS - 1 );
+}
+
+
 QVariant DirTreeModel::data( const QModelIndex & index, int role ) const
 {
     if ( ! index.isValid() )
@@ -445,6 +622,43 @@ QVariant DirTreeModel::data( const QModelIndex & index, int role ) const
 		return QVariant();
 	    }
 
+	case Qt::FontRole:
+	    {
+		// Estimated subtrees (in sampling mode) are shown in italics
+
+		if ( item->isDirInfo() && item->toDirInfo()->isEstimated() )
+		{
+		    QFont font;
+		    font.setItalic( true );
+		    return font;
+		}
+
+		return QVariant();
+	    }
+
+	case Qt::ToolTipRole:
+	    {
+		if ( col == NameCol && item->isDirInfo() && item->toDirInfo()->isEstimated() )
+		{
+		    DatasetUsage dataset = ZfsDatasets::cachedUsage( item->url() );
+
+		    if ( item->isMountPoint() && dataset.isValid() )
+			return ZfsDatasets::summary( dataset ) + "\n" + tr( "Open it to read it" );
+
+		    return tr( "Estimated from a sample - open it to read it" );
+		}
+
+		if ( col == NameCol && item->isDirInfo() && ! item->isPseudoDir() )
+		{
+		    QString layerToolTip = ContainerLayers::toolTip( item->toDirInfo() );
+
+		    if ( ! layerToolTip.isEmpty() )
+			return layerToolTip;
+		}
+
+		return QVariant();
+	    }
+
 	case Qt::DecorationRole:
 	    {
 		QVariant result = columnIcon( item, col );
@@ -464,6 +678,8 @@ QVariant DirTreeModel::data( const QModelIndex & index, int role ) const
 		    case TotalFilesCol:
 		    case TotalSubDirsCol:
 		    case OctalPermissionsCol:
+		    case SizeDeltaCol:
+		    case SizeHistoryCol:
 			alignment |= Qt::AlignRight;
 			break;
 
@@ -513,6 +729,8 @@ QVariant DirTreeModel::data( const QModelIndex & index, int role ) const
 		    case GroupCol:	      return item->gid();
 		    case PermissionsCol:      return item->mode();
 		    case OctalPermissionsCol: return item->mode();
+		    case SizeDeltaCol:	      return _tree->diff() ? _tree->diff()->sizeDelta( item ) : 0;
+		    case SizeHistoryCol:      return _tree->sizeHistory() ? _tree->sizeHistory()->trend( item->url() ).growth : 0;
 		    default:		      return QVariant();
 		}
 	    }
@@ -551,6 +769,8 @@ QVariant DirTreeModel::headerData( int		   section,
 		case GroupCol:		  return tr( "Group"		  );
 		case PermissionsCol:	  return tr( "Permissions"	  );
 		case OctalPermissionsCol: return tr( "Perm."	    );
+		case SizeDeltaCol:	  return tr( "Size Delta"	  );
+		case SizeHistoryCol:	  return tr( "History"		  );
 		default:		  return QVariant();
 	    }
 
@@ -566,7 +786,9 @@ QVariant DirTreeModel::headerData( int		   section,
 		case LatestMTimeCol:
 		case OldestFileMTimeCol:
 		case PermissionsCol:
-		case OctalPermissionsCol: return Qt::AlignHCenter;
+		case OctalPermissionsCol:
+		case SizeDeltaCol:
+		case SizeHistoryCol:	  return Qt::AlignHCenter;
 		default:		  return Qt::AlignLeft;
 	    }
 
@@ -657,6 +879,8 @@ QModelIndex DirTreeModel::parent( const QModelIndex & index ) const
 
 void DirTreeModel::sort( int column, Qt::SortOrder order )
 {
+    TRACE_SCOPE( "model", "DirTreeModel::sort" );
+
     logDebug() << "Sorting by " << static_cast<DataColumn>( column )
 	       << ( order == Qt::AscendingOrder ? " ascending" : " descending" )
 	       << endl;
@@ -677,11 +901,136 @@ void DirTreeModel::sort( int column, Qt::SortOrder order )
 }
 
 
+void DirTreeModel::sortOrderFor( DirInfo *	    dir,
+				  DataColumn &	    sortCol_ret,
+				  Qt::SortOrder &   sortOrder_ret ) const
+{
+    sortCol_ret	  = _sortCol;
+    sortOrder_ret = _sortOrder;
+
+    if ( dir->hasSortCache( _sortCol, true ) ||	// includeAttic
+	 _tree->isBusy() ||
+	 dir->directChildrenCount() < BACKGROUND_SORT_MIN_CHILDREN )
+    {
+	return;
+    }
+
+    DataColumn	  oldSortCol;
+    Qt::SortOrder oldSortOrder;
+    quint64	  serial;
+
+    if ( ! dir->lastSortOrder( true, oldSortCol, oldSortOrder, serial ) )
+	return; // Nothing to show in the meantime
+
+    BackgroundSort * job = _pendingSorts.value( dir );
+
+    if ( ! job ||
+	 job->serial()	  != serial   ||
+	 job->sortCol()	  != _sortCol ||
+	 job->sortOrder() != _sortOrder )
+    {
+	const FileInfoList & children = dir->sortedChildren( oldSortCol, oldSortOrder, true );
+
+	logDebug() << "Sorting " << children.size() << " children of " << dir
+		   << " by " << _sortCol << " in the background" << endl;
+
+	job = new BackgroundSort( dir, children, _sortCol, _sortOrder, serial,
+				  const_cast<DirTreeModel *>( this ), "backgroundSortFinished" );
+	CHECK_NEW( job );
+
+	job->setAutoDelete( false );
+	_backgroundSorts << job;
+	_pendingSorts.insert( dir, job );
+	_sortThreadPool.start( job );
+    }
+
+    sortCol_ret	  = oldSortCol;
+    sortOrder_ret = oldSortOrder;
+}
+
+
+void DirTreeModel::backgroundSortFinished()
+{
+    TRACE_SCOPE( "model", "DirTreeModel::backgroundSortFinished" );
+
+    bool layoutChanging = false;
+    QSet<FileInfo *> sortedDirs;
+
+    for ( int i = _backgroundSorts.size() - 1; i >= 0; --i )
+    {
+	BackgroundSort * job = _backgroundSorts.at( i );
+
+	if ( ! job->isFinished() )
+	    continue;
+
+	_backgroundSorts.removeAt( i );
+	DirInfo * dir = job->dir();
+
+	if ( _pendingSorts.value( dir ) == job )
+	{
+	    _pendingSorts.remove( dir );
+
+	    // If the children changed in the meantime, the sort caches were
+	    // dropped
+
+	    if ( dir->hasSortCacheSerial( job->serial() ) )
+	    {
+		if ( ! layoutChanging )
+		{
+		    emit layoutAboutToBeChanged();
+		    layoutChanging = true;
+		}
+
+		dir->setSortedChildren( job->sortedChildren(), job->sortCol(), job->sortOrder(),
+					true ); // includeAttic
+		sortedDirs << dir;
+	    }
+	}
+
+	delete job;
+    }
+
+    if ( layoutChanging )
+    {
+	// Only the rows of the children of those directories changed
+
+	updatePersistentIndexes( sortedDirs );
+	emit layoutChanged();
+    }
+}
+
+
+void DirTreeModel::dropBackgroundSorts( FileInfo * subtree )
+{
+    QHash<DirInfo *, BackgroundSort *>::iterator it = _pendingSorts.begin();
+
+    while ( it != _pendingSorts.end() )
+    {
+	if ( it.key()->isInSubtree( subtree ) )
+	    it = _pendingSorts.erase( it );
+	else
+	    ++it;
+    }
+}
+
+
+void DirTreeModel::treeClearing()
+{
+    _inserts->cancel();
+    _pendingInserts.clear();
+    _exposedRows.clear();
+    _pendingSorts.clear();
+    _textCache.clear();
+}
+
+
 //---------------------------------------------------------------------------
 
 
 void DirTreeModel::busyDisplay()
 {
+    TRACE_SCOPE( "model", "DirTreeModel::busyDisplay" );
+
     emit layoutAboutToBeChanged();
 
     _sortCol = NameCol;
@@ -694,6 +1043,8 @@ void DirTreeModel::busyDisplay()
 
 void DirTreeModel::idleDisplay()
 {
+    TRACE_SCOPE( "model", "DirTreeModel::idleDisplay" );
+
     emit layoutAboutToBeChanged();
 
     _sortCol = PercentNumCol;
@@ -715,11 +1066,58 @@ QModelIndex DirTreeModel::modelIndex( FileInfo * item, int column ) const
     {
 	int row = rowNumber( item );
 	// logDebug() << item << " is row #" << row << " of " << item->parent() << endl;
-	return row < 0 ? QModelIndex() : createIndex( row, column, item );
+
+	if ( row < 0 )
+	    return QModelIndex();
+
+	if ( row >= exposedRowLimit( item->parent() ) )
+	{
+	    // Somebody wants an index for a child of a huge directory that
+	    // the views don't know yet (e.g. one that was selected in the
+	    // treemap): Report the children up to that one first.
+
+	    const_cast<DirTreeModel *>( this )->exposeRow( item->parent()->toDirInfo(), row );
+	}
+
+	return createIndex( row, column, item );
     }
 }
 
 
+void DirTreeModel::exposeRow( DirInfo * dir, int row )
+{
+    if ( ! dir )
+	return;
+
+    int oldCount = qMin( reportableRowCount( dir ), exposedRowLimit( dir ) );
+    int newCount = qMin( reportableRowCount( dir ), row + 1 );
+
+    if ( newCount <= oldCount )
+	return;
+
+    // Expose whole batches so the next rows don't need this again right away
+
+    int limit = qMax( newCount, oldCount + FETCH_MORE_ROWS );
+
+    if ( _updatingPersistent )
+    {
+	// Between layoutAboutToBeChanged() and layoutChanged() the views
+	// get the complete new layout anyway.
+
+	_exposedRows[ dir ] = limit;
+	return;
+    }
+
+    newCount = qMin( reportableRowCount( dir ), limit );
+    QModelIndex parentIndex = modelIndex( dir );
+    // logDebug() << "Exposing rows " << oldCount << " to " << newCount - 1 << " of " << dir << endl;
+
+    beginInsertRows( parentIndex, oldCount, newCount - 1 );
+    _exposedRows[ dir ] = limit;
+    endInsertRows();
+}
+
+
 
 QVariant DirTreeModel::columnText( FileInfo * item, int col ) const
 {
@@ -728,8 +1126,6 @@ QVariant DirTreeModel::columnText( FileInfo * item, int col ) const
     if ( col == _readJobsCol && item->isBusy() )
 	return tr( "[%1 Read Jobs]" ).arg( item->pendingReadJobs() );
 
-    bool limitedInfo = item->isPseudoDir() || item->readState() == DirCached || item->isPkgInfo();
-
     if ( item->isAttic() && col == PercentNumCol )
 	return QVariant();
 
@@ -741,6 +1137,32 @@ QVariant DirTreeModel::columnText( FileInfo * item, int col ) const
 	return "?";
     }
 
+    ColumnTextStamp stamp;
+
+    if ( ! textCacheStamp( item, col, stamp ) )
+	return formatColumnText( item, col );
+
+    QPair<const FileInfo *, int> key( item, col );
+    CachedColumnText * cached = _textCache.object( key );
+
+    if ( cached && cached->stamp == stamp )
+	return cached->text;
+
+    cached = new CachedColumnText;
+    CHECK_NEW( cached );
+
+    cached->stamp = stamp;
+    cached->text  = formatColumnText( item, col );
+    _textCache.insert( key, cached );
+
+    return cached->text;
+}
+
+
+QVariant DirTreeModel::formatColumnText( FileInfo * item, int col ) const
+{
+    bool limitedInfo = item->isPseudoDir() || item->readState() == DirCached || item->isPkgInfo();
+
     switch ( col )
     {
 	case NameCol:		  return item->name();
@@ -752,6 +1174,8 @@ QVariant DirTreeModel::columnText( FileInfo * item, int col ) const
 	case GroupCol:		  return limitedInfo ? QVariant() : item->groupName();
 	case PermissionsCol:	  return limitedInfo ? QVariant() : item->symbolicPermissions();
 	case OctalPermissionsCol: return limitedInfo ? QVariant() : item->octalPermissions();
+	case SizeDeltaCol:	  return sizeDeltaText( item );
+	case SizeHistoryCol:	  return sizeHistoryText( item );
     }
 
     if ( item->isDirInfo() )
@@ -790,6 +1214,69 @@ QVariant DirTreeModel::columnText( FileInfo * item, int col ) const
 }
 
 
+bool DirTreeModel::textCacheStamp( FileInfo *	     item,
+				   int		     col,
+				   ColumnTextStamp & stamp_ret ) const
+{
+    switch ( col )
+    {
+	case PercentNumCol:
+	    {
+		if ( item == _tree->firstToplevel() )
+		    return false;
+
+		float percent = item->subtreeAllocatedPercent();
+		quint32 bits;
+		memcpy( &bits, &percent, sizeof( bits ) );
+		stamp_ret.value = bits;
+
+		return true;
+	    }
+
+	case SizeCol:
+	    if ( item->isDevice() )
+		return false;
+
+	    if ( item->isDirInfo() )
+	    {
+		// sizePrefix() depends on the read state and the errors
+
+		stamp_ret.value	 = item->totalAllocatedSize();
+		stamp_ret.extra1 = item->readState();
+		stamp_ret.extra2 = item->errSubDirCount();
+	    }
+	    else // see sizeColText(), sizeText(), isSmallFile()
+	    {
+		FileSize clusterSize = item->tree() ? item->tree()->clusterSize() : 0;
+
+		stamp_ret.value	 = item->rawByteSize();
+		stamp_ret.extra1 = item->rawAllocatedSize();
+		stamp_ret.extra2 = (qint64) item->links()
+		    | ( (qint64) item->isFile()	      << 32 )
+		    | ( (qint64) item->isSparseFile() << 33 )
+		    | ( (qint64) ( item->blocks() > 0 ) << 34 )
+		    | ( (qint64) clusterSize	      << 35 );
+	    }
+
+	    return true;
+
+	case LatestMTimeCol:
+	    stamp_ret.value = item->latestMtime();
+	    return true;
+
+	case OldestFileMTimeCol:
+	    if ( ! item->isDirInfo() || item->readError() )
+		return false;
+
+	    stamp_ret.value = item->oldestFileMtime();
+	    return true;
+
+	default:
+	    return false;
+    }
+}
+
+
 int DirTreeModel::directChildrenCount( FileInfo * subtree ) const
 {
     if ( ! subtree )
@@ -910,13 +1397,76 @@ bool DirTreeModel::isSmallFile( FileInfo * item )
 }
 
 
+QVariant DirTreeModel::sizeDeltaText( FileInfo * item ) const
+{
+    const DirTreeDiff * diff = _tree->diff();
+
+    if ( ! diff || item->isAttic() )
+	return QVariant();
+
+    FileSize delta = diff->sizeDelta( item );
+
+    if ( diff->isNew( item ) )
+	return tr( "+%1 (new)" ).arg( formatSize( delta ) );
+
+    if ( delta == 0 )
+	return QVariant();
+
+    return delta > 0 ? "+" + formatSize( delta ) : "-" + formatSize( -delta );
+}
+
+
+QVariant DirTreeModel::sizeHistoryText( FileInfo * item ) const
+{
+    const SizeHistory * history = _tree->sizeHistory();
+
+    if ( ! history || ! item->isDirInfo() || item->isPseudoDir() )
+	return QVariant();
+
+    SizeTrend trend = history->trend( item->url() );
+
+    if ( ! trend.known )
+	return tr( "(new)" );
+
+    if ( trend.sparkline.isEmpty() )
+	return QVariant();
+
+    QString growth = trend.growth >= 0 ? "+" + formatSize( trend.growth ) : "-" + formatSize( -trend.growth );
+
+    return trend.sparkline + "  " + growth;
+}
+
+
 QVariant DirTreeModel::sizeColText( FileInfo * item ) const
 {
     if ( item->isDevice() )
 	return QVariant();
 
+    if ( item->tree() && item->tree()->countOnly() )
+	return QVariant();	// Only the numbers of items are known
+
     if ( item->isDirInfo() )
+    {
+	if ( item->isMountPoint() && item->readState() == DirOnRequestOnly )
+	{
+	    // An unread Btrfs subvolume: Show what its quota group knows
+
+	    SubvolumeUsage usage = BtrfsQgroups::cachedUsage( item->url() );
+
+	    if ( usage.isValid() )
+		return "~" + formatSize( usage.referenced );
+
+	    // An unread ZFS dataset: Show its dataset properties unless it
+	    // is a placeholder with those totals anyway
+
+	    DatasetUsage dataset = ZfsDatasets::cachedUsage( item->url() );
+
+	    if ( dataset.isValid() && ! item->toDirInfo()->isPendingSubtree() )
+		return "~" + formatSize( dataset.subtreeSize() );
+	}
+
 	return item->sizePrefix() + formatSize( item->totalAllocatedSize() );
+    }
 
     QString text = sizeText( item );
 
@@ -962,11 +1512,19 @@ QVariant DirTreeModel::columnIcon( FileInfo * item, int col ) const
     if ( icon.isNull() )
 	return QVariant();
 
-    bool  useDisabled = item->isIgnored() || item->isAttic();
+    bool useDisabled = item->isIgnored() || item->isAttic();
+    QPair<qint64, bool> key( icon.cacheKey(), useDisabled );
+    QHash<QPair<qint64, bool>, QVariant>::const_iterator it = _iconPixmaps.constFind( key );
+
+    if ( it != _iconPixmaps.constEnd() )
+	return it.value();
+
     QSize iconSize( icon.actualSize( QSize( 1024, 1024 ) ) );
+    QVariant pixmap = icon.pixmap( iconSize, useDisabled ?
+				   QIcon::Disabled : QIcon::Normal );
+    _iconPixmaps.insert( key, pixmap );
 
-    return icon.pixmap( iconSize, useDisabled ?
-			QIcon::Disabled : QIcon::Normal );
+    return pixmap;
 }
 
 
@@ -975,14 +1533,86 @@ void DirTreeModel::readJobFinished( DirInfo * dir )
     // logDebug() << dir << endl;
     delayedUpdate( dir );
 
-    if ( anyAncestorBusy( dir ) )
+    if ( ! dir )
     {
-	if  ( dir && ! dir->isMountPoint() )
-	    logDebug() << "Ancestor busy - ignoring readJobFinished for " << dir << endl;
+	logError() << "NULL DirInfo *" << endl;
+	return;
     }
-    else
+
+    _pendingInserts.insert( dir );
+    _inserts->request();
+}
+
+
+static bool lessTreeLevel( const DirInfo * a, const DirInfo * b )
+{
+    return a->treeLevel() < b->treeLevel();
+}
+
+
+void DirTreeModel::sendPendingInserts()
+{
+    _inserts->cancel();
+
+    if ( _pendingInserts.isEmpty() )
+	return;
+
+    // logDebug() << "Sending " << _pendingInserts.size() << " inserts" << endl;
+
+    // Parents first: newChildrenNotify() also reports any finished
+    // children and removes them from _pendingInserts.
+
+    QList<DirInfo *> dirs = _pendingInserts.toList();
+    std::stable_sort( dirs.begin(), dirs.end(), lessTreeLevel );
+
+    foreach ( DirInfo * dir, dirs )
+    {
+	if ( ! _pendingInserts.contains( dir ) )
+	    continue;
+
+	if ( anyAncestorBusy( dir ) )
+	{
+	    // It will be reported together with that ancestor
+
+	    _pendingInserts.remove( dir );
+
+	    if  ( ! dir->isMountPoint() )
+		logDebug() << "Ancestor busy - ignoring readJobFinished for " << dir << endl;
+	}
+	else
+	{
+	    newChildrenNotify( dir );
+	}
+    }
+
+    _pendingInserts.clear();
+}
+
+
+void DirTreeModel::dropPendingInserts( FileInfo * subtree, bool includeSubtree )
+{
+    QSet<DirInfo *>::iterator it = _pendingInserts.begin();
+
+    while ( it != _pendingInserts.end() )
     {
-	newChildrenNotify( dir );
+	if ( (*it)->isInSubtree( subtree ) && ( includeSubtree || *it != subtree ) )
+	    it = _pendingInserts.erase( it );
+	else
+	    ++it;
+    }
+}
+
+
+void DirTreeModel::dropExposedRows( FileInfo * subtree )
+{
+    QHash<FileInfo *, int>::iterator it = _exposedRows.begin();
+
+    while ( it != _exposedRows.end() )
+    {
+	if ( it.key()->isInSubtree( subtree ) )
+	    it = _exposedRows.erase( it );
+	else
+	    ++it;
     }
 }
 
@@ -1014,6 +1644,8 @@ void DirTreeModel::newChildrenNotify( DirInfo * dir )
 	return;
     }
 
+    _pendingInserts.remove( dir );
+
     if ( ! dir->isTouched() && dir != _tree->root() && dir != _tree->firstToplevel() )
     {
 	// logDebug() << "Remaining silent about untouched dir " << dir << endl;
@@ -1021,7 +1653,7 @@ void DirTreeModel::newChildrenNotify( DirInfo * dir )
     }
 
     QModelIndex index = modelIndex( dir );
-    int count = directChildrenCount( dir );
+    int count = qMin( directChildrenCount( dir ), exposedRowLimit( dir ) );
     // Debug::dumpDirectChildren( dir );
 
     if ( count > 0 )
@@ -1061,6 +1693,9 @@ void DirTreeModel::delayedUpdate( DirInfo * dir )
 
 	dir = dir->parent();
     }
+
+    if ( ! _pendingUpdates.isEmpty() )
+	_updates->request();
 }
 
 
@@ -1108,17 +1743,91 @@ void DirTreeModel::dataChangedNotify( DirInfo * dir )
 }
 
 
+void DirTreeModel::diffChanged()
+{
+    TRACE_SCOPE( "model", "DirTreeModel::diffChanged" );
+
+    // The deltas (or the trends) are part of any sort order by
+    // SizeDeltaCol (SizeHistoryCol) that might be cached anywhere in the
+    // tree, and they need to be displayed anyway.
+
+    emit layoutAboutToBeChanged();
+
+    if ( _tree->root() )
+	_tree->root()->dropSortCache( true ); // recursive
+
+    updatePersistentIndexes();
+    emit layoutChanged();
+}
+
+
+void DirTreeModel::ownerNamesChanged()
+{
+    // For a range of rows, the views simply repaint everything that is
+    // visible, and that fetches the names again.
+
+    int rows = rowCount( QModelIndex() );
+
+    if ( rows < 1 )
+	return;
+
+    emit dataChanged( index( 0, 0 ),
+		      index( rows - 1, DataColumns::instance()->colCount() - 1 ) );
+}
+
+
 void DirTreeModel::readingFinished()
 {
-    _updateTimer.stop();
+    _updates->cancel();
+    sendPendingInserts();
     idleDisplay();
     sendPendingUpdates();
+    memoryStats().logSummary();
 
     // dumpPersistentIndexList();
     // Debug::dumpDirectChildren( _tree->root(), "root" );
 }
 
 
+MemoryStats DirTreeModel::memoryStats() const
+{
+    TRACE_SCOPE( "model", "DirTreeModel::memoryStats" );
+
+    MemoryStats stats;
+
+    if ( _tree )
+	stats.addTree( _tree->root() );
+
+    stats.sampleNodePool();
+    stats.sampleSortCaches();
+
+    // Model structures
+
+    qint64 bytes = 0;
+    bytes += MemoryStats::hashBytes( _pendingUpdates.size(), _pendingUpdates.capacity(), sizeof( DirInfo * ), 0 );
+    bytes += MemoryStats::hashBytes( _pendingInserts.size(), _pendingInserts.capacity(), sizeof( DirInfo * ), 0 );
+    bytes += MemoryStats::hashBytes( _exposedRows.size(),    _exposedRows.capacity(),
+				     sizeof( FileInfo * ), sizeof( int ) );
+    bytes += MemoryStats::hashBytes( _pendingSorts.size(),   _pendingSorts.capacity(),
+				     sizeof( DirInfo * ), sizeof( BackgroundSort * ) );
+
+    // QCache keeps its own node with the cost and the list pointers for
+    // each object
+
+    int cachedTexts = _textCache.size();
+    bytes += MemoryStats::hashBytes( cachedTexts, cachedTexts,
+				     sizeof( QPair<const FileInfo *, int> ),
+				     sizeof( CachedColumnText * ) + 4 * sizeof( void * ) );
+    bytes += cachedTexts * MemoryStats::heapBytes( sizeof( CachedColumnText ) );
+
+    stats.add( MemModel, bytes,
+	       _pendingUpdates.size() + _pendingInserts.size() + _exposedRows.size() +
+	       _pendingSorts.size() + cachedTexts );
+
+    return stats;
+}
+
+
 void DirTreeModel::dumpPersistentIndexList() const
 {
     QModelIndexList persistentList = persistentIndexList();
@@ -1140,29 +1849,63 @@ void DirTreeModel::dumpPersistentIndexList() const
 }
 
 
-void DirTreeModel::updatePersistentIndexes()
+QHash<FileInfo *, QModelIndexList> DirTreeModel::persistentIndexesByParent() const
 {
-    QModelIndexList persistentList = persistentIndexList();
+    QHash<FileInfo *, QModelIndexList> byParent;
 
-    for ( int i=0; i < persistentList.size(); ++i )
+    foreach ( const QModelIndex & index, persistentIndexList() )
+    {
+	if ( ! index.isValid() )
+	    continue;
+
+	FileInfo * item = static_cast<FileInfo *>( index.internalPointer() );
+	CHECK_PTR( item );
+
+	// Items that are already gone are collected with the 0 key
+
+	byParent[ item->checkMagicNumber() ? item->parent() : 0 ] << index;
+    }
+
+    return byParent;
+}
+
+
+void DirTreeModel::updatePersistentIndexes( const QSet<FileInfo *> & parents )
+{
+    QHash<FileInfo *, QModelIndexList> byParent = persistentIndexesByParent();
+    QModelIndexList from;
+    QModelIndexList to;
+
+    _updatingPersistent = true;
+
+    for ( QHash<FileInfo *, QModelIndexList>::const_iterator it = byParent.constBegin();
+	  it != byParent.constEnd();
+	  ++it )
     {
-	QModelIndex oldIndex = persistentList.at(i);
+	if ( ! parents.isEmpty() && ! parents.contains( it.key() ) )
+	    continue;
 
-	if ( oldIndex.isValid() )
+	foreach ( const QModelIndex & oldIndex, it.value() )
 	{
 	    FileInfo * item = static_cast<FileInfo *>( oldIndex.internalPointer() );
 	    QModelIndex newIndex = modelIndex( item, oldIndex.column() );
 #if 0
-	    logDebug() << "Updating #" << i
-		       << " " << item
+	    logDebug() << "Updating " << item
 		       << " col " << oldIndex.column()
 		       << " row " << oldIndex.row()
 		       << " --> " << newIndex.row()
 		       << endl;
 #endif
-	    changePersistentIndex( oldIndex, newIndex );
+	    if ( newIndex != oldIndex )
+	    {
+		from << oldIndex;
+		to   << newIndex;
+	    }
 	}
     }
+
+    changePersistentIndexList( from, to );
+    _updatingPersistent = false;
 }
 
 
@@ -1205,11 +1948,28 @@ void DirTreeModel::deletingChild( FileInfo * child )
 	   child->parent()->isTouched()	 ) )
     {
 	QModelIndex parentIndex = modelIndex( child->parent(), 0 );
-	int row = rowNumber( child );
-	logDebug() << "beginRemoveRows for " << child << " row " << row << endl;
-	beginRemoveRows( parentIndex, row, row );
+	int row   = rowNumber( child );
+	int count = directChildrenCount( child->parent() );
+	int limit = exposedRowLimit( child->parent() );
+
+	if ( row < limit )
+	{
+	    logDebug() << "beginRemoveRows for " << child << " row " << row << endl;
+	    beginRemoveRows( parentIndex, row, row );
+
+	    // The next child that is not exposed yet must not move up into
+	    // the exposed rows without the views knowing it
+
+	    if ( count > limit )
+		_exposedRows[ child->parent() ] = limit - 1;
+	}
+
+	// Children that are not exposed yet can go without telling anybody
     }
 
+    dropPendingInserts( child );
+    dropExposedRows( child );
+    dropBackgroundSorts( child );
     invalidatePersistent( child, true );
 }
 
@@ -1227,7 +1987,7 @@ void DirTreeModel::clearingSubtree( DirInfo * subtree )
     if ( subtree == _tree->root() || subtree->isTouched() )
     {
 	QModelIndex subtreeIndex = modelIndex( subtree, 0 );
-	int count = directChildrenCount( subtree );
+	int count = qMin( directChildrenCount( subtree ), exposedRowLimit( subtree ) );
 
 	if ( count > 0 )
 	{
@@ -1236,6 +1996,9 @@ void DirTreeModel::clearingSubtree( DirInfo * subtree )
 	}
     }
 
+    dropPendingInserts( subtree, false );
+    dropExposedRows( subtree );
+    dropBackgroundSorts( subtree );
     invalidatePersistent( subtree, false );
 }
 
@@ -1248,27 +2011,77 @@ void DirTreeModel::subtreeCleared( DirInfo * subtree )
 }
 
 
-void DirTreeModel::invalidatePersistent( FileInfo * subtree,
-					 bool	    includeParent )
+void DirTreeModel::checkSpill( DirInfo * dir, bool * keep_ret )
 {
+    if ( *keep_ret )
+	return;
+
+    // A background sort replaces the sort order that the views show now
+
+    if ( _pendingSorts.contains( dir ) )
+    {
+	*keep_ret = true;
+	return;
+    }
+
+    // The views keep persistent indexes for their expanded branches, the
+    // current item and the selection
+
     foreach ( const QModelIndex & index, persistentIndexList() )
     {
 	FileInfo * item = static_cast<FileInfo *>( index.internalPointer() );
-	CHECK_PTR( item );
 
-	if ( ! item->checkMagicNumber() ||
-	     item->isInSubtree( subtree ) )
+	if ( item && item->isInSubtree( dir ) )
+	{
+	    *keep_ret = true;
+	    return;
+	}
+    }
+}
+
+
+void DirTreeModel::subtreeReplaced( DirInfo * subtree )
+{
+    Q_UNUSED( subtree );
+
+    // The readJobFinished() for the subtree came right before this
+
+    sendPendingInserts();
+}
+
+
+void DirTreeModel::invalidatePersistent( FileInfo * subtree,
+					 bool	    includeParent )
+{
+    QHash<FileInfo *, QModelIndexList> byParent = persistentIndexesByParent();
+    QModelIndexList from;
+    QModelIndexList invalid;
+
+    for ( QHash<FileInfo *, QModelIndexList>::const_iterator it = byParent.constBegin();
+	  it != byParent.constEnd();
+	  ++it )
+    {
+	// Items that are gone and all children of a parent in 'subtree'
+
+	bool parentInSubtree = ! it.key() || it.key()->isInSubtree( subtree );
+
+	foreach ( const QModelIndex & index, it.value() )
 	{
-	    if ( item != subtree || includeParent )
+	    FileInfo * item = static_cast<FileInfo *>( index.internalPointer() );
+
+	    if ( parentInSubtree || ( item == subtree && includeParent ) )
 	    {
-#if 1
-		logDebug() << "Invalidating " << index << endl;
-#endif
-		changePersistentIndex( index, QModelIndex() );
+		from	<< index;
+		invalid << QModelIndex();
 	    }
 	}
     }
 
+    if ( ! from.isEmpty() )
+    {
+	logDebug() << "Invalidating " << from.size() << " persistent indexes in " << subtree << endl;
+	changePersistentIndexList( from, invalid );
+    }
 }
 
 
@@ -11,22 +11,34 @@
 
 
 #include <QAbstractItemModel>
+#include <QCache>
 #include <QColor>
 #include <QIcon>
+#include <QHash>
+#include <QList>
 #include <QSet>
-#include <QTimer>
+#include <QThreadPool>
 #include <QTextStream>
 
 #include "DataColumns.h"
 #include "FileInfo.h"
+#include "MemoryStats.h"
 #include "PkgFilter.h"
 
 
+// Rows of a directory that are reported to the views at first and added by
+// each fetchMore(); the rest of a huge directory is only reported when the
+// user scrolls down that far
+#define FETCH_MORE_ROWS		( 5 * 1000 )
+
+
 namespace QDirStat
 {
     class DirTree;
     class DirInfo;
     class SelectionModel;
+    class BackgroundSort;
+    class ScheduledUpdate;
 
     enum CustomRoles
     {
@@ -34,6 +46,38 @@ namespace QDirStat
     };
 
 
+    /**
+     * The raw values that the text of a column was formatted from (see
+     * DirTreeModel::columnText()). If they are still the same, so is the
+     * text.
+     **/
+    struct ColumnTextStamp
+    {
+	ColumnTextStamp(): value( 0 ), extra1( 0 ), extra2( 0 ) {}
+
+	bool operator==( const ColumnTextStamp & other ) const
+	{
+	    return value  == other.value  &&
+		   extra1 == other.extra1 &&
+		   extra2 == other.extra2;
+	}
+
+	qint64 value;
+	qint64 extra1;
+	qint64 extra2;
+    };
+
+
+    /**
+     * One entry of the column text cache of DirTreeModel.
+     **/
+    struct CachedColumnText
+    {
+	ColumnTextStamp stamp;
+	QVariant	text;
+    };
+
+
     class DirTreeModel: public QAbstractItemModel
     {
 	Q_OBJECT
@@ -153,6 +197,29 @@ namespace QDirStat
 	 **/
 	void readPkg( const PkgFilter & pkgFilter );
 
+	/**
+	 * Clear the tree and read directory 'url' on a remote host
+	 * ("ssh://[user@]host/path").
+	 **/
+	void readRemote( const QString & url );
+
+	/**
+	 * Clear the tree and read an ext2/3/4 filesystem image or block
+	 * device ("ext4:/dev/sdb1").
+	 **/
+	void readExt4Image( const QString & url );
+
+	/**
+	 * Clear the tree and read an NTFS volume or image ("ntfs:/dev/sda2").
+	 **/
+	void readNtfsVolume( const QString & url );
+
+	/**
+	 * Clear the tree and import an ncdu export ("ncdu:/tmp/export.json")
+	 * or a file list ("filelist:/tmp/list").
+	 **/
+	void readImport( const QString & url );
+
 	/**
 	 * Clear this view's contents.
 	 **/
@@ -263,6 +330,25 @@ namespace QDirStat
 	 **/
 	virtual int columnCount( const QModelIndex & parent ) const Q_DECL_OVERRIDE;
 
+	/**
+	 * Return 'true' if 'parent' has any children. This is also true for
+	 * directories whose subtree is still pending in a cache file.
+	 **/
+	virtual bool hasChildren( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if the subtree of 'parent' is still pending in a
+	 * cache file or if not all of its children are reported to the views
+	 * yet, i.e. if fetchMore() would add anything.
+	 **/
+	virtual bool canFetchMore( const QModelIndex & parent ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Load the pending subtree of 'parent' from its cache file or report
+	 * the next FETCH_MORE_ROWS of its children to the views.
+	 **/
+	virtual void fetchMore( const QModelIndex & parent ) Q_DECL_OVERRIDE;
+
 	/**
 	 * Return data to be displayed for the specified model index and role.
 	 **/
@@ -327,6 +413,13 @@ namespace QDirStat
 	 **/
 	static bool isSmallFile( FileInfo * item );
 
+	/**
+	 * Return the memory usage of the tree and of the data structures of
+	 * this model. This walks the whole tree, so it takes a while for
+	 * large trees.
+	 **/
+	MemoryStats memoryStats() const;
+
 
 
     protected slots:
@@ -346,27 +439,65 @@ namespace QDirStat
 	/**
 	 * Process notification that the read job for 'dir' is finished.
 	 * Other read jobs might still be pending.
+	 *
+	 * The new children are not reported to the views right away: All
+	 * directories that finish within INSERT_BATCH_MILLISEC are collected
+	 * and reported together by sendPendingInserts() when the
+	 * UpdateScheduler has time for it.
 	 **/
 	void readJobFinished( DirInfo *dir );
 
+	/**
+	 * Notify the views about the new children of all directories in
+	 * _pendingInserts, parents first. Directories that were already
+	 * reported with one of their ancestors are skipped.
+	 * This is triggered by the insert timer.
+	 **/
+	void sendPendingInserts();
+
+	/**
+	 * Apply the results of all finished background sorts (see
+	 * sortOrderFor()) to the tree and tell the views about the new
+	 * order. This is invoked by BackgroundSort when it is done.
+	 **/
+	void backgroundSortFinished();
+
+	/**
+	 * Process notification that the tree is about to be cleared: Forget
+	 * everything that refers to its items.
+	 **/
+	void treeClearing();
+
 	/**
 	 * Process notification that reading the dir tree is completely
 	 * finished.
 	 **/
 	void readingFinished();
 
+	/**
+	 * Process notification that the tree was compared with a cache file
+	 * or that the result of that was discarded, or that a size history
+	 * was loaded or discarded.
+	 **/
+	void diffChanged();
+
+	/**
+	 * Repaint the user and group columns: OwnerNames knows new names.
+	 **/
+	void ownerNamesChanged();
+
 	/**
 	 * Delayed update of the data fields in the view for 'dir':
 	 * Store 'dir' and all its ancestors in _pendingUpdates.
 	 *
 	 * The updates will be sent several times per second to the views with
-	 * 'sendPendingUpdates()'.
+	 * 'sendPendingUpdates()' when the UpdateScheduler has time for it.
 	 **/
 	void delayedUpdate( DirInfo * dir );
 
 	/**
 	 * Send all pending updates to the connected views.
-	 * This is triggered by the update timer.
+	 * This is triggered by the UpdateScheduler.
 	 **/
 	void sendPendingUpdates();
 
@@ -390,6 +521,20 @@ namespace QDirStat
 	 **/
 	void subtreeCleared( DirInfo * subtree );
 
+	/**
+	 * Notification that the children of 'dir' might be spilled to disk:
+	 * Keep them if the views have anything inside, e.g. an expanded
+	 * branch, the current item or selected items.
+	 **/
+	void checkSpill( DirInfo * dir, bool * keep_ret );
+
+	/**
+	 * Notification that the children of a subtree were replaced after a
+	 * shadow refresh: Insert the new rows right away, so the views can
+	 * restore their state for them.
+	 **/
+	void subtreeReplaced( DirInfo * subtree );
+
 	/**
 	 * Invalidate all persistent indexes in 'subtree'. 'includeParent'
 	 * indicates if 'subtree' itself will become invalid.
@@ -423,8 +568,16 @@ namespace QDirStat
 
 	/**
 	 * Update the persistent indexes with current row after sorting etc.
+	 * If 'parents' is not empty, only the rows of the children of those
+	 * have changed, so only their persistent indexes are updated.
 	 **/
-	void updatePersistentIndexes();
+	void updatePersistentIndexes( const QSet<FileInfo *> & parents = QSet<FileInfo *>() );
+
+	/**
+	 * Return the valid persistent indexes grouped by the parent of their
+	 * item. Those of items that are already deleted are in the 0 entry.
+	 **/
+	QHash<FileInfo *, QModelIndexList> persistentIndexesByParent() const;
 
 	/**
 	 * Return 'true' if 'item' or any ancestor (parent or parent's parent
@@ -433,11 +586,61 @@ namespace QDirStat
 	 **/
 	bool anyAncestorBusy( FileInfo * item ) const;
 
+	/**
+	 * Forget the pending inserts (see readJobFinished()) for 'subtree'
+	 * and everything below it. If 'includeSubtree' is 'false', only
+	 * those below it.
+	 **/
+	void dropPendingInserts( FileInfo * subtree, bool includeSubtree = true );
+
+	/**
+	 * Forget how many children are exposed for 'subtree' and everything
+	 * below it.
+	 **/
+	void dropExposedRows( FileInfo * subtree );
+
+	/**
+	 * Get the sort column and order in which the children of 'dir' are
+	 * currently shown. Normally, that is the model's sort column and
+	 * order; but if sorting them would take long (many children) and
+	 * they were already sorted differently before, they are sorted in a
+	 * worker thread, and until that is done, they are still shown in the
+	 * old order.
+	 **/
+	void sortOrderFor( DirInfo *	   dir,
+			   DataColumn &	   sortCol_ret,
+			   Qt::SortOrder & sortOrder_ret ) const;
+
+	/**
+	 * Forget the background sorts for 'subtree' and everything below
+	 * it. They still finish, but their results are discarded.
+	 **/
+	void dropBackgroundSorts( FileInfo * subtree );
+
 	/**
 	 * Return the text for (model) column 'col' for 'item'.
 	 **/
 	QVariant columnText( FileInfo * item, int col ) const;
 
+	/**
+	 * Format the text for (model) column 'col' for 'item' without using
+	 * the column text cache.
+	 **/
+	QVariant formatColumnText( FileInfo * item, int col ) const;
+
+	/**
+	 * Get the raw values that the text of column 'col' of 'item' depends
+	 * on for the column text cache. Return 'false' if that column is not
+	 * cached.
+	 *
+	 * Only the columns whose formatting is expensive (sizes, percent and
+	 * times) are cached. The cache is validated with the values instead
+	 * of being invalidated when they change, so it can never show
+	 * outdated text, not even when a percentage changes because the
+	 * parent's size changed.
+	 **/
+	bool textCacheStamp( FileInfo * item, int col, ColumnTextStamp & stamp_ret ) const;
+
 	/**
 	 * Return the icon for (model) column 'col' for 'item'.
 	 **/
@@ -449,11 +652,46 @@ namespace QDirStat
 	 **/
 	int directChildrenCount( FileInfo * subtree ) const;
 
+	/**
+	 * Return the number of children of 'item' that may be reported to the
+	 * views in its current read state, no matter how many of them are
+	 * exposed yet.
+	 **/
+	int reportableRowCount( FileInfo * item ) const;
+
+	/**
+	 * Return the maximum number of children of 'dir' that are reported
+	 * to the views: FETCH_MORE_ROWS unless fetchMore() or modelIndex()
+	 * exposed more of them or deleting children exposed fewer.
+	 **/
+	int exposedRowLimit( FileInfo * dir ) const
+	    { return _exposedRows.value( dir, FETCH_MORE_ROWS ); }
+
+	/**
+	 * Make sure that row 'row' of 'dir' is reported to the views. During
+	 * updatePersistentIndexes() this is done silently since the views do
+	 * a complete layout afterwards anyway; otherwise the new rows are
+	 * inserted with beginInsertRows() / endInsertRows().
+	 **/
+	void exposeRow( DirInfo * dir, int row );
+
 	/**
 	 * Return the text for the size for 'item'
 	 **/
 	QVariant sizeColText( FileInfo * item ) const;
 
+	/**
+	 * Return the text for the size delta for 'item' if the tree is
+	 * compared with a cache file.
+	 **/
+	QVariant sizeDeltaText( FileInfo * item ) const;
+
+	/**
+	 * Return the sparkline and the growth of directory 'item' if the
+	 * tree has a size history.
+	 **/
+	QVariant sizeHistoryText( FileInfo * item ) const;
+
 	/**
 	 * Format a percentage value as string if it is non-negative.
 	 * Return QVariant() if it is negative.
@@ -488,13 +726,33 @@ namespace QDirStat
 	QString		 _treeIconDir;
 	int		 _readJobsCol;
 	QSet<DirInfo *>	 _pendingUpdates;
-	QTimer		 _updateTimer;
+	ScheduledUpdate * _updates;
+	QSet<DirInfo *>	 _pendingInserts;
+	ScheduledUpdate * _inserts;
 	int		 _updateTimerMillisec;
 	int		 _slowUpdateMillisec;
 	bool		 _slowUpdate;
 	DataColumn	 _sortCol;
 	Qt::SortOrder	 _sortOrder;
 	bool		 _removingRows;
+	bool		 _updatingPersistent;
+
+	// Directories with more or fewer than FETCH_MORE_ROWS children
+	// exposed to the views
+
+	QHash<FileInfo *, int> _exposedRows;
+
+	// Formatted text of the expensive columns by item and column, most
+	// recently used first
+
+	mutable QCache<QPair<const FileInfo *, int>, CachedColumnText> _textCache;
+
+	// All background sorts that are not finished yet and the current one
+	// for each directory
+
+	mutable QList<BackgroundSort *>		    _backgroundSorts;
+	mutable QHash<DirInfo *, BackgroundSort *> _pendingSorts;
+	mutable QThreadPool			    _sortThreadPool;
 
 	// Colors
 
@@ -518,6 +776,12 @@ namespace QDirStat
 	QIcon _specialIcon;
 	QIcon _pkgIcon;
 
+	// The pixmaps of those icons for the views by icon cache key and
+	// 'disabled' mode; rendering them for every visible row on every
+	// repaint is expensive, in particular on remote X or VNC displays
+
+	mutable QHash<QPair<qint64, bool>, QVariant> _iconPixmaps;
+
     };	// class DirTreeModel
 
 
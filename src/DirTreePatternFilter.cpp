@@ -17,21 +17,40 @@
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * Return the suffix (with the leading dot) if 'pattern' is a simple
+     * "*.suffix" pattern, an empty string otherwise.
+     **/
+    QString simpleSuffix( const QString & pattern )
+    {
+	if ( pattern.startsWith( "*." ) )
+	{
+	    QString suffix = pattern;
+	    suffix.remove( 0, 1 ); // Remove the leading "*"
+
+	    if ( QRegExp( "^\\.[a-zA-Z0-9]+" ).exactMatch( suffix ) )
+		return suffix;
+	}
+
+	return QString();
+    }
+
+}	// namespace
+
+
+
 DirTreeFilter * DirTreePatternFilter::create( const QString & pattern )
 {
     if ( pattern.isEmpty() )
 	return 0;
 
     DirTreeFilter * filter = 0;
+    QString suffix = simpleSuffix( pattern );
 
-    if ( pattern.startsWith( "*." ) )
-    {
-	QString suffix = pattern;
-	suffix.remove( 0, 1 ); // Remove the leading "*"
-
-	if ( QRegExp( "^\\.[a-zA-Z0-9]+" ).exactMatch( suffix ) )
-	    filter = new DirTreeSuffixFilter( suffix );
-    }
+    if ( ! suffix.isEmpty() )
+	filter = new DirTreeSuffixFilter( suffix );
 
     if ( ! filter )
 	filter = new DirTreePatternFilter( pattern );
@@ -90,6 +109,19 @@ DirTreeSuffixFilter::~DirTreeSuffixFilter()
 }
 
 
+bool DirTreeSuffixFilter::ignoreEntry( const QString & dirPath,
+				       int	       dirNo,
+				       const QString & name ) const
+{
+    Q_UNUSED( dirPath );
+    Q_UNUSED( dirNo );
+
+    // The suffix starts with a dot, so this is the same as for the full path
+
+    return ignore( name );
+}
+
+
 bool DirTreeSuffixFilter::ignore( const QString & path ) const
 {
     bool match = path.endsWith( _suffix );
@@ -103,3 +135,148 @@ bool DirTreeSuffixFilter::ignore( const QString & path ) const
 
     return match;
 }
+
+
+
+
+
+DirTreeFilter * DirTreePatternSetFilter::create( const QStringList & patterns )
+{
+    QStringList nonEmpty;
+
+    foreach ( const QString & pattern, patterns )
+    {
+	if ( ! pattern.isEmpty() )
+	    nonEmpty << pattern;
+    }
+
+    if ( nonEmpty.isEmpty() )
+	return 0;
+
+    DirTreeFilter * filter = new DirTreePatternSetFilter( nonEmpty );
+    CHECK_NEW( filter );
+
+    return filter;
+}
+
+
+DirTreePatternSetFilter::DirTreePatternSetFilter( const QStringList & patterns ):
+    _patterns( patterns )
+{
+    QStringList alternatives;
+
+    foreach ( const QString & pattern, _patterns )
+    {
+	QString suffix = simpleSuffix( pattern );
+
+	if ( ! suffix.isEmpty() )
+	{
+	    _suffixes.insert( suffix );
+	}
+	else if ( ! pattern.isEmpty() )
+	{
+	    // Like in DirTreePatternFilter: Without a slash, only the name
+	    // needs to match.
+
+	    QString pat = pattern.contains( "/" ) ? pattern : QString( "*/" ) + pattern;
+	    alternatives << wildcardToRegExp( pat );
+	}
+    }
+
+    if ( ! alternatives.isEmpty() )
+    {
+	_regExp = QRegExp( "(?:" + alternatives.join( "|" ) + ")",
+			   Qt::CaseSensitive, QRegExp::RegExp2 );
+
+	if ( ! _regExp.isValid() )
+	{
+	    logError() << "Invalid combined pattern " << _regExp.pattern()
+		       << ": " << _regExp.errorString() << endl;
+	}
+    }
+
+    logDebug() << "Creating pattern set filter with " << _suffixes.size() << " suffixes and "
+	       << alternatives.size() << " other patterns" << endl;
+}
+
+
+DirTreePatternSetFilter::~DirTreePatternSetFilter()
+{
+
+}
+
+
+QString DirTreePatternSetFilter::wildcardToRegExp( const QString & pattern )
+{
+    // The same wildcard syntax as QRegExp::Wildcard: '*' and '?' match any
+    // characters, including '/', and [...] is a character set.
+
+    QString regExp;
+
+    for ( int i = 0; i < pattern.size(); ++i )
+    {
+	QChar c = pattern.at( i );
+
+	if ( c == '*' )
+	    regExp += ".*";
+	else if ( c == '?' )
+	    regExp += ".";
+	else if ( c == '[' && pattern.indexOf( ']', i + 2 ) > 0 )
+	{
+	    // A ']' right after the '[' is part of the set
+
+	    int end = pattern.indexOf( ']', i + 2 );
+	    regExp += pattern.mid( i, end - i + 1 );
+	    i = end;
+	}
+	else
+	    regExp += QRegExp::escape( c );
+    }
+
+    return regExp;
+}
+
+
+bool DirTreePatternSetFilter::matchSuffix( const QString & name ) const
+{
+    if ( _suffixes.isEmpty() )
+	return false;
+
+    int dot = name.lastIndexOf( '.' );
+
+    return dot >= 0 && _suffixes.contains( name.mid( dot ) );
+}
+
+
+bool DirTreePatternSetFilter::ignoreEntry( const QString & dirPath,
+					   int		   dirNo,
+					   const QString & name ) const
+{
+    Q_UNUSED( dirNo );
+
+    if ( matchSuffix( name ) )
+	return true;
+
+    if ( _regExp.isEmpty() )
+	return false;
+
+    return _regExp.exactMatch( ( dirPath == "/" ? "" : dirPath ) + "/" + name );
+}
+
+
+bool DirTreePatternSetFilter::ignore( const QString & path ) const
+{
+    if ( matchSuffix( path.mid( path.lastIndexOf( '/' ) + 1 ) ) )
+	return true;
+
+    bool match = ! _regExp.isEmpty() && _regExp.exactMatch( path );
+
+#if VERBOSE_MATCH
+    if ( match )
+    {
+	logDebug() << "Ignoring " << path << " by pattern set filter" << endl;
+    }
+#endif
+
+    return match;
+}
@@ -11,6 +11,8 @@
 #define DirTreePatternFilter_h
 
 #include <QRegExp>
+#include <QSet>
+#include <QStringList>
 
 #include "DirTreeFilter.h"
 
@@ -55,6 +57,13 @@ namespace QDirStat
 	 **/
 	virtual bool ignore( const QString & path ) const Q_DECL_OVERRIDE;
 
+	/**
+	 * Return the pattern.
+	 *
+	 * Implemented from DirTreeFilter.
+	 **/
+	virtual QString description() const Q_DECL_OVERRIDE { return _pattern; }
+
 	/**
 	 * Return the pattern.
 	 **/
@@ -98,6 +107,23 @@ namespace QDirStat
 	 **/
 	virtual bool ignore( const QString & path ) const Q_DECL_OVERRIDE;
 
+	/**
+	 * Return 'true' if entry 'name' has the suffix. The directory does
+	 * not matter for that.
+	 *
+	 * Reimplemented from DirTreeFilter.
+	 **/
+	virtual bool ignoreEntry( const QString & dirPath,
+				  int		  dirNo,
+				  const QString & name ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Return the pattern for the suffix.
+	 *
+	 * Implemented from DirTreeFilter.
+	 **/
+	virtual QString description() const Q_DECL_OVERRIDE { return "*" + _suffix; }
+
 	/**
 	 * Return the suffix.
 	 **/
@@ -110,6 +136,91 @@ namespace QDirStat
 
     };	// class DirTreeSuffixFilter
 
+
+    /**
+     * One filter for a whole list of patterns, e.g. the ignore patterns
+     * of the unpackaged files view: Instead of one DirTreePatternFilter or
+     * DirTreeSuffixFilter for each pattern that all check every entry in
+     * turn, this looks up the suffix of an entry once in a hash of all
+     * the simple "*.suffix" patterns, and it matches all other patterns
+     * with one combined regular expression. The result is the same as
+     * with the separate filters.
+     **/
+    class DirTreePatternSetFilter: public DirTreeFilter
+    {
+    public:
+
+	/**
+	 * Factory method to create a filter from 'patterns'. Empty patterns
+	 * are skipped; if there are no others, this returns 0.
+	 *
+	 * Ownership of the created object is transferred to the caller.
+	 **/
+	static DirTreeFilter * create( const QStringList & patterns );
+
+	/**
+	 * Constructor. Each pattern works like in DirTreePatternFilter.
+	 **/
+	DirTreePatternSetFilter( const QStringList & patterns );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~DirTreePatternSetFilter();
+
+	/**
+	 * Return 'true' if the filesystem object specified by 'path'
+	 * matches any of the patterns.
+	 *
+	 * Implemented from DirTreeFilter.
+	 **/
+	virtual bool ignore( const QString & path ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if entry 'name' of directory 'dirPath' matches any
+	 * of the patterns. The full path is only built if there are any
+	 * patterns other than suffixes.
+	 *
+	 * Reimplemented from DirTreeFilter.
+	 **/
+	virtual bool ignoreEntry( const QString & dirPath,
+				  int		  dirNo,
+				  const QString & name ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Return the patterns separated by blanks.
+	 *
+	 * Implemented from DirTreeFilter.
+	 **/
+	virtual QString description() const Q_DECL_OVERRIDE { return _patterns.join( " " ); }
+
+	/**
+	 * Return the patterns.
+	 **/
+	const QStringList & patterns() const { return _patterns; }
+
+
+    protected:
+
+	/**
+	 * Return 'true' if the suffix of 'name' (from its last dot on) is
+	 * one of the suffixes.
+	 **/
+	bool matchSuffix( const QString & name ) const;
+
+	/**
+	 * Return the regular expression for wildcard 'pattern' in the
+	 * syntax of QRegExp::RegExp2.
+	 **/
+	static QString wildcardToRegExp( const QString & pattern );
+
+
+	QStringList   _patterns;
+	QSet<QString> _suffixes;
+	QRegExp	      _regExp;	// empty if there are only suffixes
+
+    };	// class DirTreePatternSetFilter
+
 }	// namespace QDirStat
 
 #endif	// DirTreePatternFilter_h
@@ -7,6 +7,8 @@
  */
 
 
+#include <QObject>
+
 #include "DirTreePkgFilter.h"
 #include "PkgManager.h"
 #include "PkgFileListCache.h"
@@ -22,7 +24,7 @@ DirTreePkgFilter::DirTreePkgFilter( PkgManager * pkgManager )
     CHECK_PTR( pkgManager );
 
     logInfo() << "Creating file list cache for " << pkgManager->name() << endl;
-    _fileListCache = pkgManager->createFileListCache( PkgFileListCache::LookupGlobal );
+    _fileListCache = pkgManager->loadFileListCache( PkgFileListCache::LookupGlobal );
     logInfo() << "Done." << endl;
 }
 
@@ -40,3 +42,28 @@ bool DirTreePkgFilter::ignore( const QString & path ) const
 
     return _fileListCache->containsFile( path );
 }
+
+
+QString DirTreePkgFilter::description() const
+{
+    return QObject::tr( "Files that belong to a package" );
+}
+
+
+int DirTreePkgFilter::lookupDir( const QString & dirPath ) const
+{
+    return _fileListCache ? _fileListCache->dirNo( dirPath ) : -1;
+}
+
+
+bool DirTreePkgFilter::ignoreEntry( const QString & dirPath,
+				    int		    dirNo,
+				    const QString & name ) const
+{
+    Q_UNUSED( dirPath );
+
+    if ( ! _fileListCache || dirNo < 0 )
+	return false;
+
+    return _fileListCache->containsFile( dirNo, name );
+}
@@ -44,6 +44,30 @@ namespace QDirStat
 	 **/
 	virtual bool ignore( const QString & path ) const Q_DECL_OVERRIDE;
 
+	/**
+	 * Look up the packaged files in directory 'dirPath'.
+	 *
+	 * Reimplemented from DirTreeFilter.
+	 **/
+	virtual int lookupDir( const QString & dirPath ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if entry 'name' of directory 'dirPath' belongs to a
+	 * package. This only looks up 'name' in the files of that directory.
+	 *
+	 * Reimplemented from DirTreeFilter.
+	 **/
+	virtual bool ignoreEntry( const QString & dirPath,
+				  int		  dirNo,
+				  const QString & name ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Return a description for the user.
+	 *
+	 * Implemented from DirTreeFilter.
+	 **/
+	virtual QString description() const Q_DECL_OVERRIDE;
+
 
     protected:
 
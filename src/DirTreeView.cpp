@@ -7,6 +7,9 @@
  */
 
 
+#include <algorithm>	// std::stable_sort()
+
+#include <QElapsedTimer>
 #include <QMenu>
 
 #include "DirTreeView.h"
@@ -26,7 +29,11 @@ using namespace QDirStat;
 
 DirTreeView::DirTreeView( QWidget * parent ):
     QTreeView( parent ),
-    _cleanupCollection(0)
+    _cleanupCollection(0),
+    _expandDepth( 0 ),
+    _expandLevel( 0 ),
+    _expandedRows( 0 ),
+    _maxExpandRows( DEFAULT_MAX_EXPAND_ROWS )
 {
     _percentBarDelegate = new PercentBarDelegate( this );
     CHECK_NEW( _percentBarDelegate );
@@ -46,8 +53,14 @@ DirTreeView::DirTreeView( QWidget * parent ):
     _headerTweaker = new HeaderTweaker( header(), this );
     CHECK_NEW( _headerTweaker );
 
+    _expandTimer.setSingleShot( true );
+    _expandTimer.setInterval( 0 );
+
     connect( this , SIGNAL( customContextMenuRequested( const QPoint & ) ),
 	     this,  SLOT  ( contextMenu		      ( const QPoint & ) ) );
+
+    connect( &_expandTimer, SIGNAL( timeout()	  ),
+	     this,	    SLOT  ( expandSlice() ) );
 }
 
 
@@ -101,6 +114,7 @@ void DirTreeView::actionContextMenu( const QPoint & pos )
 	    << "actionFileTypeStats"
 	    << "---"
 	    << "actionMoveToTrash"
+	    << "actionDeletePermanently"
 	;
 
     ActionManager::instance()->addActions( &menu, actions );
@@ -195,6 +209,45 @@ void DirTreeView::closeAllExcept( const QModelIndex & branch )
 }
 
 
+void DirTreeView::replacingSubtree( DirInfo * subtree )
+{
+    _replacedExpanded.clear();
+
+    foreach ( const QModelIndex & index, expandedIndexes() )
+    {
+	FileInfo * item = static_cast<FileInfo *>( index.internalPointer() );
+
+	if ( item && item != subtree && item->isInSubtree( subtree ) )
+	    _replacedExpanded << item->url();
+    }
+}
+
+
+void DirTreeView::subtreeReplaced( DirInfo * subtree )
+{
+    Q_UNUSED( subtree );
+
+    DirTreeModel * dirTreeModel = dynamic_cast<DirTreeModel *>( model() );
+
+    if ( ! dirTreeModel || _replacedExpanded.isEmpty() )
+	return;
+
+    // Parents first: A child can only be expanded if its parent is
+
+    _replacedExpanded.sort();
+
+    foreach ( const QString & url, _replacedExpanded )
+    {
+	FileInfo * item = dirTreeModel->tree()->locate( url, true ); // findPseudoDirs
+
+	if ( item )
+	    setExpanded( item, true );
+    }
+
+    _replacedExpanded.clear();
+}
+
+
 void DirTreeView::setExpanded( FileInfo * item, bool expanded )
 {
     DirTreeModel * dirTreeModel = dynamic_cast<DirTreeModel *>( model() );
@@ -211,3 +264,95 @@ void DirTreeView::setExpanded( FileInfo * item, bool expanded )
         QTreeView::setExpanded( index, expanded );
 }
 
+
+void DirTreeView::expandToLevel( int level )
+{
+    stopExpanding();
+
+    if ( level < 1 || ! model() )
+    {
+	collapseAll();
+	return;
+    }
+
+    _expandLevel  = level;
+    _expandDepth  = -1;	// The toplevel items are depth 0
+    _expandedRows = model()->rowCount();
+
+    for ( int row = 0; row < model()->rowCount(); ++row )
+	_expandNext << QPersistentModelIndex( model()->index( row, 0 ) );
+
+    expandSlice();
+}
+
+
+void DirTreeView::stopExpanding()
+{
+    _expandTimer.stop();
+    _expandQueue.clear();
+    _expandNext.clear();
+}
+
+
+void DirTreeView::expandSlice()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    while ( timer.elapsed() < EXPAND_SLICE_MILLISEC )
+    {
+	if ( _expandQueue.isEmpty() )
+	{
+	    // Go on with the next level, the largest branches first
+
+	    if ( _expandNext.isEmpty() || _expandDepth + 1 >= _expandLevel )
+	    {
+		stopExpanding();
+		return;
+	    }
+
+	    ++_expandDepth;
+	    _expandQueue.swap( _expandNext );
+
+	    std::stable_sort( _expandQueue.begin(), _expandQueue.end(),
+			      []( const QPersistentModelIndex & a, const QPersistentModelIndex & b )
+			      {
+				  FileInfo * itemA = static_cast<FileInfo *>( a.internalPointer() );
+				  FileInfo * itemB = static_cast<FileInfo *>( b.internalPointer() );
+
+				  return itemA && itemB && itemA->totalSize() > itemB->totalSize();
+			      } );
+	}
+
+	QPersistentModelIndex index = _expandQueue.takeFirst();
+
+	if ( ! index.isValid() || ! model()->hasChildren( index ) )
+	    continue;
+
+	if ( _expandedRows >= _maxExpandRows )
+	{
+	    logInfo() << "Stopped expanding at " << _expandedRows << " rows" << endl;
+	    stopExpanding();
+	    return;
+	}
+
+	expand( index );
+
+	int rows = model()->rowCount( index );
+	_expandedRows += rows;
+
+	if ( _expandDepth + 1 < _expandLevel )
+	{
+	    for ( int row = 0; row < rows; ++row )
+	    {
+		QModelIndex child = model()->index( row, 0, index );
+
+		if ( model()->hasChildren( child ) )
+		    _expandNext << QPersistentModelIndex( child );
+	    }
+	}
+    }
+
+    _expandTimer.start();
+}
+
@@ -11,10 +11,20 @@
 
 
 #include <QTreeView>
+#include <QStringList>
+#include <QPersistentModelIndex>
+#include <QTimer>
 
 class QAction;
 
 
+// Default maximum number of rows that expandToLevel() makes visible
+#define DEFAULT_MAX_EXPAND_ROWS	20000
+
+// Time budget of one expandToLevel() step before going back to the event loop
+#define EXPAND_SLICE_MILLISEC	20
+
+
 namespace QDirStat
 {
     class PercentBarDelegate;
@@ -23,6 +33,7 @@ namespace QDirStat
     class SelectionModelProxy;
     class CleanupCollection;
     class FileInfo;
+    class DirInfo;
 
 
     /**
@@ -89,14 +100,55 @@ namespace QDirStat
          **/
         void setExpanded( FileInfo * item, bool expanded = true );
 
+	/**
+	 * Set the maximum number of rows that expandToLevel() makes visible.
+	 **/
+	void setMaxExpandRows( int rows ) { _maxExpandRows = rows; }
+
+	/**
+	 * Return the maximum number of rows that expandToLevel() makes
+	 * visible.
+	 **/
+	int maxExpandRows() const { return _maxExpandRows; }
+
 
     public slots:
 
+	/**
+	 * Expand the branches to depth 'level'; collapse all for level 0.
+	 *
+	 * Unlike QTreeView::expandToDepth(), this does not expand everything
+	 * at once: It goes breadth-first in steps of EXPAND_SLICE_MILLISEC
+	 * from the event loop, the largest branches of each level first, and
+	 * it stops when maxExpandRows() rows are visible. So the biggest
+	 * branches show up right away, and a huge tree does not freeze the
+	 * GUI.
+	 **/
+	void expandToLevel( int level );
+
+	/**
+	 * Stop an expandToLevel() that is still going on.
+	 **/
+	void stopExpanding();
+
 	/**
 	 * Close (collapse) all branches except the one that 'branch' is in.
 	 **/
 	void closeAllExcept( const QModelIndex & branch );
 
+	/**
+	 * Notification that the children of 'subtree' are about to be
+	 * replaced after a shadow refresh: Remember the paths of the
+	 * expanded branches in it.
+	 **/
+	void replacingSubtree( DirInfo * subtree );
+
+	/**
+	 * Notification that the children of 'subtree' were replaced: Expand
+	 * the branches with the remembered paths again.
+	 **/
+	void subtreeReplaced( DirInfo * subtree );
+
 
     protected slots:
 
@@ -105,6 +157,11 @@ namespace QDirStat
 	 **/
 	void contextMenu( const QPoint & pos );
 
+	/**
+	 * Do one step of expandToLevel().
+	 **/
+	void expandSlice();
+
 
     protected:
 
@@ -134,6 +191,15 @@ namespace QDirStat
         SizeColDelegate    * _sizeColDelegate;
 	HeaderTweaker	   * _headerTweaker;
 	CleanupCollection  * _cleanupCollection;
+	QStringList	     _replacedExpanded;
+
+	QList<QPersistentModelIndex> _expandQueue;	// Current level, largest first
+	QList<QPersistentModelIndex> _expandNext;	// Next level
+	int		     _expandDepth;
+	int		     _expandLevel;
+	int		     _expandedRows;
+	int		     _maxExpandRows;
+	QTimer		     _expandTimer;
 
     };	// class DirTreeView
 
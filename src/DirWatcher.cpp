@@ -0,0 +1,499 @@
+/*
+ *   File name: DirWatcher.cpp
+ *   Summary:	Live updates of the directory tree for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <fcntl.h>	// open(), open_by_handle_at()
+#include <unistd.h>	// read(), close(), readlink()
+#include <limits.h>	// PATH_MAX
+#include <errno.h>
+#include <stdio.h>	// snprintf()
+#include <string.h>	// strerror()
+
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  include <sys/fanotify.h>
+#endif
+
+#include <QSocketNotifier>
+
+#include "DirWatcher.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "FileInfoIterator.h"
+#include "FileInfoSet.h"
+#include "PkgFilter.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+#if defined( __linux__ )
+#  define HAVE_INOTIFY 1
+#else
+#  define HAVE_INOTIFY 0
+#endif
+
+#if defined( FAN_REPORT_DFID_NAME ) && defined( FAN_MARK_FILESYSTEM )
+#  define HAVE_FANOTIFY_NAMES 1
+#else
+#  define HAVE_FANOTIFY_NAMES 0
+#endif
+
+#define EVENT_BUFFER_SIZE	65536
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Return 'true' if 'path' is 'rootPath' or below it.
+     **/
+    bool isInTree( const QString & path, const QString & rootPath )
+    {
+	if ( rootPath == "/" )
+	    return path.startsWith( '/' );
+
+	return path == rootPath || path.startsWith( rootPath + "/" );
+    }
+
+
+    /**
+     * Return 'true' if the contents of 'dir' are read and can be refreshed,
+     * i.e. if it is not an excluded directory or a mount point that is only
+     * read upon request.
+     **/
+    bool isWatchable( const DirInfo * dir )
+    {
+	return ! dir->isPseudoDir() && ! dir->isExcluded() &&
+	    dir->readState() != DirOnRequestOnly;
+    }
+
+}	// namespace
+
+
+
+DirWatcher::DirWatcher( DirTree * tree, QObject * parent ):
+    QObject( parent ),
+    _tree( tree ),
+    _fd( -1 ),
+    _mountFd( -1 ),
+    _active( false ),
+    _fanotify( false ),
+    _notifier( 0 )
+{
+    CHECK_PTR( _tree );
+
+    _refreshTimer.setSingleShot( true );
+    _refreshTimer.setInterval( DIR_WATCHER_DELAY_MILLISEC );
+
+    connect( &_refreshTimer, SIGNAL( timeout()	      ),
+	     this,	     SLOT  ( refreshPending() ) );
+
+    connect( _tree, SIGNAL( finished()	   ),
+	     this,  SLOT  ( treeFinished() ) );
+
+    connect( _tree, SIGNAL( readJobFinished( DirInfo * ) ),
+	     this,  SLOT  ( readJobFinished( DirInfo * ) ) );
+}
+
+
+DirWatcher::~DirWatcher()
+{
+    stop();
+}
+
+
+QString DirWatcher::method() const
+{
+    if ( _fd < 0 )
+	return QString();
+
+    return _fanotify ? "fanotify" : "inotify";
+}
+
+
+bool DirWatcher::start()
+{
+    stop();
+    _errorMessage.clear();
+
+    FileInfo * toplevel = _tree->firstToplevel();
+
+    if ( ! toplevel || ! toplevel->isDirInfo() || PkgFilter::isPkgUrl( _tree->url() ) )
+    {
+	_errorMessage = tr( "There is no directory to watch." );
+	return false;
+    }
+
+    _rootPath = toplevel->url();
+
+    if ( ! startFanotify() && ! startInotify() )
+    {
+	logWarning() << "Can't watch " << _rootPath << ": " << _errorMessage << endl;
+	return false;
+    }
+
+    logInfo() << "Watching " << _rootPath << " with " << method() << endl;
+    listen();
+    _active = true;
+
+    return true;
+}
+
+
+void DirWatcher::stop()
+{
+    delete _notifier;
+    _notifier = 0;
+
+    if ( _fd >= 0 )
+	close( _fd );
+
+    if ( _mountFd >= 0 )
+	close( _mountFd );
+
+    if ( _active )
+	logInfo() << "Stopped watching " << _rootPath << endl;
+
+    _fd	     = -1;
+    _mountFd = -1;
+    _active  = false;
+    _watches.clear();
+    _pendingDirs.clear();
+    _refreshTimer.stop();
+}
+
+
+bool DirWatcher::startFanotify()
+{
+#if HAVE_FANOTIFY_NAMES
+
+    _fd = fanotify_init( FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+			 O_RDONLY | O_LARGEFILE );
+
+    if ( _fd < 0 )	// Too old kernel or no permission
+    {
+	_errorMessage = QString( "fanotify: %1" ).arg( strerror( errno ) );
+	return false;
+    }
+
+    uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO |
+	FAN_MODIFY | FAN_ONDIR;
+
+    _mountFd = open( _rootPath.toUtf8(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if ( _mountFd < 0 ||
+	 fanotify_mark( _fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask,
+			AT_FDCWD, _rootPath.toUtf8() ) < 0 )
+    {
+	_errorMessage = QString( "fanotify: %1" ).arg( strerror( errno ) );
+	stop();
+
+	return false;
+    }
+
+    _fanotify = true;
+
+    return true;
+
+#else
+
+    _errorMessage = "fanotify: not supported";
+
+    return false;
+
+#endif
+}
+
+
+bool DirWatcher::startInotify()
+{
+#if HAVE_INOTIFY
+
+    DirInfo * toplevel = _tree->firstToplevel()->toDirInfo();
+
+    if ( toplevel->totalSubDirs() + 1 > INOTIFY_MAX_WATCHES )
+    {
+	_errorMessage = tr( "Too many directories to watch (%1)" )
+	    .arg( toplevel->totalSubDirs() + 1 );
+	return false;
+    }
+
+    _fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+
+    if ( _fd < 0 )
+    {
+	_errorMessage = QString( "inotify: %1" ).arg( strerror( errno ) );
+	return false;
+    }
+
+    _fanotify = false;
+    addWatches( toplevel );
+
+    return true;
+
+#else
+
+    _errorMessage = tr( "Watching directories is only supported on Linux" );
+
+    return false;
+
+#endif
+}
+
+
+void DirWatcher::addWatches( DirInfo * dir )
+{
+#if HAVE_INOTIFY
+
+    if ( ! isWatchable( dir ) )
+	return;
+
+    if ( _watches.size() >= INOTIFY_MAX_WATCHES )
+    {
+	logWarning() << "Too many directories; not watching " << dir << endl;
+	return;
+    }
+
+    QString  path = dir->url();
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+	IN_MODIFY | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+    // Adding a directory again returns its existing watch descriptor
+
+    int wd = inotify_add_watch( _fd, path.toUtf8(), mask );
+
+    if ( wd < 0 )
+    {
+	logWarning() << "Can't watch " << path << ": " << strerror( errno ) << endl;
+	return;
+    }
+
+    _watches.insert( wd, path );
+
+    for ( FileInfoIterator it( dir ); *it; ++it )
+    {
+	if ( (*it)->isDirInfo() )
+	    addWatches( (*it)->toDirInfo() );
+    }
+
+#else
+
+    Q_UNUSED( dir );
+
+#endif
+}
+
+
+void DirWatcher::listen()
+{
+    _notifier = new QSocketNotifier( _fd, QSocketNotifier::Read, this );
+    CHECK_NEW( _notifier );
+
+    connect( _notifier, SIGNAL( activated ( int ) ),
+	     this,	SLOT  ( readEvents()	) );
+}
+
+
+void DirWatcher::readEvents()
+{
+    if ( _fanotify )
+	readFanotifyEvents();
+    else
+	readInotifyEvents();
+}
+
+
+void DirWatcher::readFanotifyEvents()
+{
+#if HAVE_FANOTIFY_NAMES
+
+    char buffer[ EVENT_BUFFER_SIZE ] __attribute__ (( aligned( 8 ) ));
+    ssize_t len;
+
+    while ( ( len = read( _fd, buffer, sizeof( buffer ) ) ) > 0 )
+    {
+	struct fanotify_event_metadata * event = (struct fanotify_event_metadata *) buffer;
+
+	for ( ; FAN_EVENT_OK( event, len ); event = FAN_EVENT_NEXT( event, len ) )
+	{
+	    if ( event->mask & FAN_Q_OVERFLOW )
+	    {
+		// Events were lost: Refresh everything
+
+		logWarning() << "fanotify queue overflow" << endl;
+		addPending( _rootPath );
+		continue;
+	    }
+
+	    struct fanotify_event_info_fid * fid = (struct fanotify_event_info_fid *) ( event + 1 );
+
+	    if ( fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+		 fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID )
+	    {
+		continue;
+	    }
+
+	    // The event has the file handle of the directory: Get its path
+	    // from the file descriptor in /proc
+
+	    struct file_handle * handle = (struct file_handle *) fid->handle;
+	    int dirFd = open_by_handle_at( _mountFd, handle, O_PATH | O_CLOEXEC );
+
+	    if ( dirFd < 0 )	// Deleted meanwhile
+		continue;
+
+	    char link[ 64 ];
+	    char path[ PATH_MAX ];
+	    snprintf( link, sizeof( link ), "/proc/self/fd/%d", dirFd );
+	    ssize_t pathLen = readlink( link, path, sizeof( path ) - 1 );
+	    close( dirFd );
+
+	    if ( pathLen > 0 )
+	    {
+		path[ pathLen ] = 0;
+		QString dir = QString::fromUtf8( path );
+
+		if ( isInTree( dir, _rootPath ) )
+		    addPending( dir );
+	    }
+	}
+    }
+
+#endif
+}
+
+
+void DirWatcher::readInotifyEvents()
+{
+#if HAVE_INOTIFY
+
+    char buffer[ EVENT_BUFFER_SIZE ] __attribute__ (( aligned( __alignof__( struct inotify_event ) ) ));
+    ssize_t len;
+
+    while ( ( len = read( _fd, buffer, sizeof( buffer ) ) ) > 0 )
+    {
+	const char * end = buffer + len;
+
+	for ( const char * ptr = buffer; ptr < end; )
+	{
+	    const struct inotify_event * event = (const struct inotify_event *) ptr;
+	    ptr += sizeof( struct inotify_event ) + event->len;
+
+	    if ( event->mask & IN_Q_OVERFLOW )
+	    {
+		logWarning() << "inotify queue overflow" << endl;
+		addPending( _rootPath );
+	    }
+	    else if ( event->mask & IN_IGNORED )	// Directory deleted
+	    {
+		_watches.remove( event->wd );
+	    }
+	    else if ( _watches.contains( event->wd ) )
+	    {
+		addPending( _watches.value( event->wd ) );
+	    }
+	}
+    }
+
+#endif
+}
+
+
+void DirWatcher::addPending( const QString & path )
+{
+    _pendingDirs.insert( path );
+
+    // Not restarting a running timer: A file that is written all the time
+    // should still be updated every few seconds
+
+    if ( ! _refreshTimer.isActive() )
+	_refreshTimer.start();
+}
+
+
+void DirWatcher::refreshPending()
+{
+    if ( _pendingDirs.isEmpty() )
+	return;
+
+    if ( _tree->isBusy() )	// Try again later
+    {
+	_refreshTimer.start();
+	return;
+    }
+
+    // Find the directories in the tree; for something new, its nearest
+    // ancestor that is already there
+
+    QHash<FileInfo *, QString> paths;
+    FileInfoSet dirs;
+
+    foreach ( const QString & pendingPath, _pendingDirs )
+    {
+	QString	   path = pendingPath;
+	FileInfo * item = _tree->locate( path );
+
+	while ( ! item && path.lastIndexOf( '/' ) > 0 && path != _rootPath )
+	{
+	    path = path.left( path.lastIndexOf( '/' ) );
+	    item = _tree->locate( path );
+	}
+
+	if ( item && ! item->isDirInfo() )
+	    item = item->parent();
+
+	if ( item && isWatchable( item->toDirInfo() ) )
+	{
+	    dirs << item;
+	    paths.insert( item, pendingPath );
+	}
+    }
+
+    _pendingDirs.clear();
+
+    // A directory below another one that is refreshed now would be taken
+    // over from the old tree if its mtime did not change, e.g. when a file
+    // in it was only written to: Refresh it in the next round.
+
+    FileInfoSet refreshSet = dirs.normalized();
+
+    foreach ( FileInfo * dir, dirs )
+    {
+	if ( ! refreshSet.contains( dir ) )
+	    addPending( paths.value( dir ) );
+    }
+
+    logDebug() << "Refreshing " << refreshSet.size() << " changed directories" << endl;
+    _tree->refreshChanged( refreshSet );
+}
+
+
+void DirWatcher::treeFinished()
+{
+    if ( ! _active )
+	return;
+
+    // A different directory was opened: Watch that one instead
+
+    FileInfo * toplevel = _tree->firstToplevel();
+
+    if ( ! toplevel || toplevel->url() != _rootPath )
+	start();
+}
+
+
+void DirWatcher::readJobFinished( DirInfo * dir )
+{
+    if ( _active && ! _fanotify && dir && ! dir->isPseudoDir() &&
+	 isInTree( dir->url(), _rootPath ) )
+    {
+	addWatches( dir );
+    }
+}
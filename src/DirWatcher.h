@@ -0,0 +1,185 @@
+/*
+ *   File name: DirWatcher.h
+ *   Summary:	Live updates of the directory tree for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef DirWatcher_h
+#define DirWatcher_h
+
+
+#include <QObject>
+#include <QString>
+#include <QSet>
+#include <QHash>
+#include <QTimer>
+
+
+// Refresh the changed directories after this time: Writing to a file
+// causes a constant stream of events
+#define DIR_WATCHER_DELAY_MILLISEC	2000
+
+// Watching with inotify needs one watch for each directory
+#define INOTIFY_MAX_WATCHES		8192
+
+
+class QSocketNotifier;
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+
+    /**
+     * Watch the directories of a DirTree for changes after they were read
+     * and refresh the changed ones, so the tree stays up to date while
+     * some other process fills up the disk.
+     *
+     * Where possible, this uses fanotify (Linux 5.9 and later) with one
+     * mark for the complete filesystem of the toplevel directory. This
+     * needs root permissions. Otherwise, it uses inotify with one watch
+     * for each directory in the tree, which is only possible for trees of
+     * up to INOTIFY_MAX_WATCHES directories.
+     *
+     * The events are collected for DIR_WATCHER_DELAY_MILLISEC, then the
+     * affected directories are refreshed with DirTree::refreshChanged():
+     * Only their own entries are read again, plus any subdirectories whose
+     * mtime changed.
+     *
+     * This is only available on Linux.
+     **/
+    class DirWatcher: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor. This does not start watching yet.
+	 **/
+	DirWatcher( DirTree * tree, QObject * parent = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~DirWatcher();
+
+	/**
+	 * Start watching the tree. Return 'true' on success, 'false' if
+	 * neither fanotify nor inotify can be used for this tree. In that
+	 * case, errorMessage() says why.
+	 *
+	 * When a different directory is read, this watches that one.
+	 **/
+	bool start();
+
+	/**
+	 * Stop watching.
+	 **/
+	void stop();
+
+	/**
+	 * Return 'true' if watching was started.
+	 **/
+	bool isActive() const { return _active; }
+
+	/**
+	 * Return the name of the method that is used ("fanotify" or
+	 * "inotify") or an empty string if none.
+	 **/
+	QString method() const;
+
+	/**
+	 * Return the reason why start() failed.
+	 **/
+	const QString & errorMessage() const { return _errorMessage; }
+
+
+    protected slots:
+
+	/**
+	 * Read the events that are available on the notification file
+	 * descriptor.
+	 **/
+	void readEvents();
+
+	/**
+	 * Refresh the directories that changed since the last time.
+	 **/
+	void refreshPending();
+
+	/**
+	 * Notification that the tree finished reading: Follow a different
+	 * toplevel directory.
+	 **/
+	void treeFinished();
+
+	/**
+	 * Notification that a directory was read: Watch it with inotify.
+	 **/
+	void readJobFinished( DirInfo * dir );
+
+
+    protected:
+
+	/**
+	 * Try to watch the filesystem of the toplevel directory with
+	 * fanotify. Return 'true' on success.
+	 **/
+	bool startFanotify();
+
+	/**
+	 * Try to watch all the directories of the tree with inotify.
+	 * Return 'true' on success.
+	 **/
+	bool startInotify();
+
+	/**
+	 * Add inotify watches for 'dir' and all directories below it.
+	 **/
+	void addWatches( DirInfo * dir );
+
+	/**
+	 * Start listening on the notification file descriptor.
+	 **/
+	void listen();
+
+	/**
+	 * Read the events of fanotify or inotify, respectively.
+	 **/
+	void readFanotifyEvents();
+	void readInotifyEvents();
+
+	/**
+	 * Remember that directory 'path' changed.
+	 **/
+	void addPending( const QString & path );
+
+
+	//
+	// Data members
+	//
+
+	DirTree *	    _tree;
+	QString		    _rootPath;
+	QString		    _errorMessage;
+	int		    _fd;		// fanotify or inotify
+	int		    _mountFd;		// for open_by_handle_at()
+	bool		    _active;
+	bool		    _fanotify;
+	QSocketNotifier *   _notifier;
+	QHash<int, QString> _watches;		// inotify watch descriptors
+	QSet<QString>	    _pendingDirs;
+	QTimer		    _refreshTimer;
+
+    };	// class DirWatcher
+
+}	// namespace QDirStat
+
+
+#endif	// DirWatcher_h
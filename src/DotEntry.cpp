@@ -26,7 +26,7 @@ DotEntry::DotEntry( DirTree * tree,
 
     if ( parent )
     {
-	_device = parent->device();
+	_deviceIndex = deviceIndex( parent->device() );
 	_mode	= parent->mode();
 	_uid	= parent->uid();
 	_gid	= parent->gid();
@@ -53,10 +53,7 @@ void DotEntry::insertChild( FileInfo * newChild )
     // Whatever is added here is added directly to this node; a dot entry
     // cannot have a dot entry itself.
 
-    newChild->setNext( _firstChild );
-    _firstChild = newChild;
-    newChild->setParent( this );	// make sure the parent pointer is correct
-
+    appendChild( newChild );
     childAdded( newChild );		// update summaries
 }
 
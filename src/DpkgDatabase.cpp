@@ -0,0 +1,355 @@
+/*
+ *   File name: DpkgDatabase.cpp
+ *   Summary:	Dpkg package manager support for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <errno.h>
+#include <string.h>	// memchr(), memcmp()
+#include <unistd.h>	// close(), access()
+#include <fcntl.h>	// open()
+#include <sys/mman.h>	// mmap()
+#include <sys/stat.h>	// fstat()
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include "DpkgDatabase.h"
+#include "PkgFileListCache.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * A file that is mapped into memory for reading.
+     **/
+    class MappedFile
+    {
+    public:
+
+	MappedFile( const QString & fileName, bool logErrors ):
+	    _data( 0 ),
+	    _size( 0 ),
+	    _ok( false )
+	{
+	    int fd = open( fileName.toUtf8(), O_RDONLY | O_CLOEXEC );
+
+	    if ( fd < 0 )
+	    {
+		if ( logErrors )
+		    logError() << "Can't open " << fileName << ": " << formatErrno() << endl;
+
+		return;
+	    }
+
+	    struct stat statInfo;
+
+	    if ( fstat( fd, &statInfo ) != 0 )
+	    {
+		if ( logErrors )
+		    logError() << "Can't stat " << fileName << ": " << formatErrno() << endl;
+
+		close( fd );
+		return;
+	    }
+
+	    _size = statInfo.st_size;
+
+	    if ( _size > 0 )
+	    {
+		void * mapped = mmap( 0, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+		if ( mapped == MAP_FAILED )
+		{
+		    if ( logErrors )
+			logError() << "Can't mmap " << fileName << ": " << formatErrno() << endl;
+
+		    close( fd );
+		    return;
+		}
+
+		_data = (const char *) mapped;
+		madvise( mapped, _size, MADV_SEQUENTIAL );
+	    }
+
+	    close( fd );
+	    _ok = true;
+	}
+
+	~MappedFile()
+	{
+	    if ( _data )
+		munmap( (void *) _data, _size );
+	}
+
+	bool	     ok()   const { return _ok; }
+	const char * data() const { return _data; }
+	size_t	     size() const { return _size; }
+
+    private:
+
+	const char * _data;
+	size_t	     _size;
+	bool	     _ok;
+    };
+
+
+    /**
+     * Find the next line in the text from 'pos' to 'end' and advance 'pos'
+     * to the start of the line after it. Return 'false' at the end of the
+     * text.
+     **/
+    bool nextLine( const char * & pos,
+		   const char *	  end,
+		   const char * & line_ret,
+		   int &	  len_ret )
+    {
+	if ( pos >= end )
+	    return false;
+
+	const char * newline = (const char *) memchr( pos, '\n', end - pos );
+
+	if ( ! newline )
+	    newline = end;
+
+	line_ret = pos;
+	len_ret	 = newline - pos;
+	pos	 = newline + 1;
+
+	return true;
+    }
+
+
+    /**
+     * Return 'true' if the 'len' bytes at 'line' start with field 'key'
+     * followed by a colon.
+     **/
+    bool isField( const char * line, int len, const char * key, int keyLen )
+    {
+	return len > keyLen && line[ keyLen ] == ':' && memcmp( line, key, keyLen ) == 0;
+    }
+
+
+    /**
+     * Return the value of the field in the 'len' bytes at 'line' that
+     * starts with a key of 'keyLen' bytes.
+     **/
+    QString fieldValue( const char * line, int len, int keyLen )
+    {
+	return QString::fromUtf8( line + keyLen + 1, len - keyLen - 1 ).trimmed();
+    }
+
+
+    /**
+     * Read the file lists of some of the packages, taking the next one from
+     * 'next' until none is left.
+     **/
+    class FileListTask: public QRunnable
+    {
+    public:
+
+	FileListTask( const DpkgDatabase &		    database,
+		      const QList<DpkgDatabase::Package> & packages,
+		      QStringList *			    fileLists,
+		      bool *				    found,
+		      QAtomicInt &			    next ):
+	    _database( database ),
+	    _packages( packages ),
+	    _fileLists( fileLists ),
+	    _found( found ),
+	    _next( next )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    int i;
+
+	    while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _packages.size() )
+	    {
+		const DpkgDatabase::Package & pkg = _packages.at( i );
+		_found[ i ] = _database.readFileList( pkg.name, pkg.arch, _fileLists[ i ] );
+	    }
+	}
+
+    private:
+
+	const DpkgDatabase &		     _database;
+	const QList<DpkgDatabase::Package> & _packages;
+	QStringList *			     _fileLists;
+	bool *				     _found;
+	QAtomicInt &			     _next;
+    };
+
+}	// namespace
+
+
+DpkgDatabase::DpkgDatabase( const QString & dir ):
+    _dir( dir )
+{
+
+}
+
+
+bool DpkgDatabase::isAvailable() const
+{
+    return access( ( _dir + "/status" ).toUtf8(), R_OK ) == 0;
+}
+
+
+bool DpkgDatabase::readStatus( QList<Package> & packages_ret ) const
+{
+    MappedFile file( _dir + "/status", true );
+
+    if ( ! file.ok() )
+	return false;
+
+    // Sample stanza (fields that are not needed here are left out):
+    //
+    //	   Package: zlib1g
+    //	   Status: install ok installed
+    //	   Architecture: amd64
+    //	   Multi-Arch: same
+    //	   Version: 1:1.2.11.dfsg-2ubuntu9
+    //	   Description: compression library - runtime
+    //	    zlib is a library implementing the deflate compression method
+    //	    found in gzip and PKZIP.
+    //
+    // Stanzas are separated by empty lines; lines that start with
+    // whitespace continue the previous field.
+
+    const char * pos = file.data();
+    const char * end = pos + file.size();
+    const char * line;
+    int		 len;
+    Package	 pkg;
+    QString	 status;
+    bool	 more;
+
+    do
+    {
+	more = nextLine( pos, end, line, len );
+
+	if ( ! more || len == 0 )
+	{
+	    // Only what the dpkg-query based package list also takes
+
+	    if ( ! pkg.name.isEmpty() && status == "install ok installed" )
+		packages_ret << pkg;
+
+	    pkg	   = Package();
+	    status = QString();
+	}
+	else if ( line[0] != ' ' && line[0] != '\t' )
+	{
+	    if	    ( isField( line, len, "Package",	  7 ) ) pkg.name    = fieldValue( line, len,  7 );
+	    else if ( isField( line, len, "Version",	  7 ) ) pkg.version = fieldValue( line, len,  7 );
+	    else if ( isField( line, len, "Architecture", 12 ) ) pkg.arch    = fieldValue( line, len, 12 );
+	    else if ( isField( line, len, "Status",	  6 ) ) status	    = fieldValue( line, len,  6 );
+	}
+    }
+    while ( more );
+
+    logDebug() << "Read " << packages_ret.size() << " installed packages from "
+	       << _dir << "/status" << endl;
+
+    return true;
+}
+
+
+bool DpkgDatabase::readFileList( const QString & name,
+				 const QString & arch,
+				 QStringList &	 fileList_ret ) const
+{
+    // Packages that can be installed for several architectures at the same
+    // time have the architecture in the file name, all others do not.
+
+    QString infoDir = _dir + "/info/";
+    MappedFile archFile( infoDir + name + ":" + arch + ".list", false );
+    MappedFile plainFile( archFile.ok() ? QString() : infoDir + name + ".list", false );
+    const MappedFile & file = archFile.ok() ? archFile : plainFile;
+
+    if ( ! file.ok() )
+	return false;
+
+    const char * pos = file.data();
+    const char * end = pos + file.size();
+    const char * line;
+    int		 len;
+
+    while ( nextLine( pos, end, line, len ) )
+    {
+	if ( len > 0 && ! ( len == 2 && line[0] == '/' && line[1] == '.' ) )
+	    fileList_ret << QString::fromUtf8( line, len );
+    }
+
+    return true;
+}
+
+
+bool DpkgDatabase::readFileLists( const QList<Package> & packages,
+				  PkgFileListCache *	 cache ) const
+{
+    CHECK_PTR( cache );
+
+    if ( packages.isEmpty() )
+	return false;
+
+    // The worker threads only read the files; the cache is filled here in
+    // the calling thread since it is not thread-safe.
+
+    QVector<QStringList> fileLists( packages.size() );
+    QVector<bool>	 found( packages.size(), false );
+    QAtomicInt		 next( 0 );
+    int			 taskCount = qMax( 1, QThread::idealThreadCount() );
+
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount( taskCount );
+
+    for ( int task = 0; task < taskCount; ++task )
+	threadPool.start( new FileListTask( *this, packages, fileLists.data(), found.data(), next ) );
+
+    threadPool.waitForDone();
+
+    int readCount = 0;
+
+    for ( int i=0; i < packages.size(); ++i )
+    {
+	if ( ! found.at( i ) )
+	{
+	    logWarning() << "No file list for " << packages.at( i ).name << endl;
+	    continue;
+	}
+
+	QString pkgName = queryName( packages.at( i ).name, packages.at( i ).arch );
+
+	foreach ( const QString & path, fileLists.at( i ) )
+	    cache->add( pkgName, path );
+
+	fileLists[ i ].clear(); // Free the memory ASAP
+	++readCount;
+    }
+
+    logDebug() << "Read " << readCount << " file lists from " << _dir << "/info" << endl;
+
+    return readCount > 0;
+}
+
+
+QString DpkgDatabase::queryName( const QString & name, const QString & arch )
+{
+    if ( arch.isEmpty() || arch == "all" )
+	return name;
+
+    return name + ":" + arch;
+}
@@ -0,0 +1,101 @@
+/*
+ *   File name: DpkgDatabase.h
+ *   Summary:	Dpkg package manager support for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef DpkgDatabase_h
+#define DpkgDatabase_h
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+
+#define DPKG_DATABASE_DIR	"/var/lib/dpkg"
+
+
+namespace QDirStat
+{
+    class PkgFileListCache;
+
+
+    /**
+     * Reader for the dpkg database files: The package status in
+     * /var/lib/dpkg/status and the file list of each package in
+     * /var/lib/dpkg/info/*.list.
+     *
+     * This reads the files directly (with mmap()) instead of starting
+     * dpkg-query or dpkg processes, which is a lot faster, in particular for
+     * the file lists of many packages. If anything goes wrong here, the
+     * caller should fall back to the dpkg commands: They are the official
+     * interface, this is only how dpkg stores its data.
+     **/
+    class DpkgDatabase
+    {
+    public:
+
+	/**
+	 * One installed package from the status file.
+	 **/
+	struct Package
+	{
+	    QString name;
+	    QString version;
+	    QString arch;
+	};
+
+	/**
+	 * Constructor. 'dir' is the dpkg administrative directory.
+	 **/
+	DpkgDatabase( const QString & dir = DPKG_DATABASE_DIR );
+
+	/**
+	 * Return 'true' if the status file of the database can be read.
+	 **/
+	bool isAvailable() const;
+
+	/**
+	 * Read the installed packages from the status file into
+	 * 'packages_ret'. Return 'true' on success, 'false' on error.
+	 **/
+	bool readStatus( QList<Package> & packages_ret ) const;
+
+	/**
+	 * Read the file list of package 'name' with architecture 'arch' into
+	 * 'fileList_ret'. Return 'true' on success, 'false' if there is no
+	 * file list for this package or if it could not be read.
+	 **/
+	bool readFileList( const QString & name,
+			   const QString & arch,
+			   QStringList &   fileList_ret ) const;
+
+	/**
+	 * Read the file lists of all 'packages' in parallel and add them to
+	 * 'cache' with the package name as returned by queryName(). Return
+	 * 'true' if at least the file lists of some packages were read,
+	 * 'false' if none.
+	 **/
+	bool readFileLists( const QList<Package> & packages,
+			    PkgFileListCache *	   cache ) const;
+
+	/**
+	 * Return the name that dpkg uses for queries about a package: With
+	 * the architecture unless it is "all".
+	 **/
+	static QString queryName( const QString & name, const QString & arch );
+
+
+    protected:
+
+	QString _dir;
+
+    };	// class DpkgDatabase
+
+}	// namespace QDirStat
+
+
+#endif	// ifndef DpkgDatabase_h
@@ -8,6 +8,7 @@
 
 
 #include "DpkgPkgManager.h"
+#include "DpkgDatabase.h"
 #include "PkgFileListCache.h"
 #include "Logger.h"
 #include "Exception.h"
@@ -36,11 +37,14 @@ bool DpkgPkgManager::isAvailable()
 }
 
 
-QString DpkgPkgManager::owningPkg( const QString & path )
+QStringList DpkgPkgManager::owningPkgCommand( const QString & path )
 {
-    int exitCode = -1;
-    QString output = runCommand( "/usr/bin/dpkg", QStringList() << "-S" << path, &exitCode );
+    return QStringList() << "/usr/bin/dpkg" << "-S" << path;
+}
+
 
+QString DpkgPkgManager::parseOwningPkg( const QString & output, int exitCode )
+{
     if ( exitCode != 0 || output.contains( "no path found matching pattern" ) )
 	return "";
 
@@ -89,6 +93,26 @@ QString DpkgPkgManager::owningPkg( const QString & path )
 
 PkgInfoList DpkgPkgManager::installedPkg()
 {
+    DpkgDatabase database;
+    QList<DpkgDatabase::Package> packages;
+
+    if ( database.isAvailable() && database.readStatus( packages ) )
+    {
+	PkgInfoList pkgList;
+
+	foreach ( const DpkgDatabase::Package & package, packages )
+	{
+	    PkgInfo * pkg = new PkgInfo( package.name, package.version, package.arch, this );
+	    CHECK_NEW( pkg );
+
+	    pkgList << pkg;
+	}
+
+	return pkgList;
+    }
+
+    logWarning() << "Can't read the dpkg database; using dpkg-query" << endl;
+
     int exitCode = -1;
     QString output = runCommand( "/usr/bin/dpkg-query",
 				 QStringList()
@@ -149,6 +173,19 @@ QString DpkgPkgManager::fileListCommand( PkgInfo * pkg )
 }
 
 
+QStringList DpkgPkgManager::fileList( PkgInfo * pkg )
+{
+    CHECK_PTR( pkg );
+
+    QStringList fileList;
+
+    if ( DpkgDatabase().readFileList( pkg->baseName(), pkg->arch(), fileList ) )
+	return fileList;
+
+    return PkgManager::fileList( pkg );
+}
+
+
 QStringList DpkgPkgManager::parseFileList( const QString & output )
 {
     QStringList fileList;
@@ -186,6 +223,31 @@ QString DpkgPkgManager::queryName( PkgInfo * pkg )
 
 
 PkgFileListCache * DpkgPkgManager::createFileListCache( PkgFileListCache::LookupType lookupType )
+{
+    DpkgDatabase database;
+    QList<DpkgDatabase::Package> packages;
+
+    if ( database.isAvailable() && database.readStatus( packages ) )
+    {
+	PkgFileListCache * cache = new PkgFileListCache( this, lookupType );
+	CHECK_NEW( cache );
+
+	if ( database.readFileLists( packages, cache ) )
+	{
+	    logDebug() << "file list cache finished." << endl;
+	    return cache;
+	}
+
+	delete cache;
+    }
+
+    logWarning() << "Can't read the dpkg file lists; using dpkg -S" << endl;
+
+    return createFileListCacheFromCommand( lookupType );
+}
+
+
+PkgFileListCache * DpkgPkgManager::createFileListCacheFromCommand( PkgFileListCache::LookupType lookupType )
 {
     int exitCode = -1;
     QString output = runCommand( "/usr/bin/dpkg", QStringList() << "-S" << "*", &exitCode );
@@ -238,3 +300,14 @@ PkgFileListCache * DpkgPkgManager::createFileListCache( PkgFileListCache::Lookup
     return cache;
 }
 
+
+
+QString DpkgPkgManager::databaseStamp()
+{
+    // dpkg rewrites the status file for every change, and installing or
+    // removing a package adds or removes files in the info directory
+
+    return fileStamp( QStringList()
+		      << DPKG_DATABASE_DIR "/status"
+		      << DPKG_DATABASE_DIR "/info" );
+}
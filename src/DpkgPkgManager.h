@@ -53,16 +53,20 @@ namespace QDirStat
 	virtual bool isAvailable() Q_DECL_OVERRIDE;
 
 	/**
-	 * Return the owning package of a file or directory with full path
-	 * 'path' or an empty string if it is not owned by any package.
+	 * Return the command for getting the owning package of 'path':
 	 *
-	 * Implemented from PkgManager.
+	 *   /usr/bin/dpkg -S ${path}
 	 *
-	 * This basically executes this command:
+	 * Implemented from PkgManager.
+	 **/
+	virtual QStringList owningPkgCommand( const QString & path ) Q_DECL_OVERRIDE;
+
+	/**
+	 * Parse the output of the owningPkgCommand().
 	 *
-	 *   /usr/bin/dpkg -S ${path}
+	 * Implemented from PkgManager.
 	 **/
-	virtual QString owningPkg( const QString & path ) Q_DECL_OVERRIDE;
+	virtual QString parseOwningPkg( const QString & output, int exitCode ) Q_DECL_OVERRIDE;
 
 
 	//-----------------------------------------------------------------
@@ -83,10 +87,23 @@ namespace QDirStat
 	 *
 	 * Ownership of the list elements is transferred to the caller.
 	 *
+	 * This reads the dpkg status file directly and falls back to
+	 * dpkg-query if that fails.
+	 *
 	 * Reimplemented from PkgManager.
 	 **/
 	virtual PkgInfoList installedPkg() Q_DECL_OVERRIDE;
 
+	/**
+	 * Return the list of files and directories owned by a package.
+	 *
+	 * This reads the file list of the package from the dpkg database
+	 * directly and falls back to the file list command if that fails.
+	 *
+	 * Reimplemented from PkgManager.
+	 **/
+	virtual QStringList fileList( PkgInfo * pkg ) Q_DECL_OVERRIDE;
+
 	/**
 	 * Return 'true' if this package manager supports getting the file list
 	 * for a package.
@@ -131,6 +148,9 @@ namespace QDirStat
 	 * Ownership of the cache is transferred to the caller; make sure to
 	 * delete it when you are done with it.
 	 *
+	 * This reads the file lists from the dpkg database directly and
+	 * falls back to "dpkg -S" if that fails.
+	 *
 	 * Reimplemented from PkgManager.
 	 **/
 	virtual PkgFileListCache * createFileListCache( PkgFileListCache::LookupType lookupType = PkgFileListCache::LookupByPkg ) Q_DECL_OVERRIDE;
@@ -145,6 +165,13 @@ namespace QDirStat
 	 **/
 	virtual QString queryName( PkgInfo * pkg ) Q_DECL_OVERRIDE;
 
+	/**
+	 * Return a string that changes whenever the dpkg database changes.
+	 *
+	 * Reimplemented from PkgManager.
+	 **/
+	virtual QString databaseStamp() Q_DECL_OVERRIDE;
+
 
     protected:
 
@@ -153,6 +180,11 @@ namespace QDirStat
 	 **/
 	PkgInfoList parsePkgList( const QString & output );
 
+	/**
+	 * Create a file list cache by parsing the output of "dpkg -S".
+	 **/
+	PkgFileListCache * createFileListCacheFromCommand( PkgFileListCache::LookupType lookupType );
+
     };	// class DpkgPkgManager
 
 }	// namespace QDirStat
@@ -0,0 +1,239 @@
+/*
+ *   File name: DuplicateFilesWindow.cpp
+ *   Summary:	QDirStat "duplicate files" window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QTreeWidgetItem>
+
+#include "DuplicateFilesWindow.h"
+#include "DuplicateFinder.h"
+#include "SelectionModel.h"
+#include "SettingsHelpers.h"
+#include "HeaderTweaker.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+#define PROGRESS_MILLISEC	500
+
+// Each candidate's number is stored in its list item
+#define CandidateRole		Qt::UserRole
+
+
+using namespace QDirStat;
+
+
+DuplicateFilesWindow::DuplicateFilesWindow( SelectionModel * selectionModel,
+					    QWidget *	     parent ):
+    QDialog( parent ),
+    _ui( new Ui::DuplicateFilesWindow ),
+    _selectionModel( selectionModel ),
+    _currentFinder( 0 )
+{
+    // logDebug() << "init" << endl;
+
+    CHECK_NEW( _ui );
+    _ui->setupUi( this );
+    initWidgets();
+    readWindowSettings( this, "DuplicateFilesWindow" );
+
+    // Only one finder reads at a time; the others are canceled anyway
+
+    _threadPool.setMaxThreadCount( 1 );
+    _progressTimer.setInterval( PROGRESS_MILLISEC );
+
+    connect( _ui->refreshButton, SIGNAL( clicked() ),
+	     this,		 SLOT  ( refresh() ) );
+
+    connect( &_progressTimer,	 SIGNAL( timeout()	),
+	     this,		 SLOT  ( showProgress() ) );
+
+    connect( _ui->treeWidget,	 SIGNAL( currentItemChanged( QTreeWidgetItem *,
+							     QTreeWidgetItem * ) ),
+	     this,		 SLOT  ( locateInMainWindow( QTreeWidgetItem * ) ) );
+}
+
+
+DuplicateFilesWindow::~DuplicateFilesWindow()
+{
+    // logDebug() << "destroying" << endl;
+    writeWindowSettings( this, "DuplicateFilesWindow" );
+
+    // The finders invoke a slot of this window when they are done
+
+    foreach ( DuplicateFinder * finder, _finders )
+	finder->cancel();
+
+    _threadPool.clear();
+    _threadPool.waitForDone();
+    qDeleteAll( _finders );
+}
+
+
+void DuplicateFilesWindow::clear()
+{
+    _ui->treeWidget->clear();
+    _ui->summaryLabel->clear();
+}
+
+
+void DuplicateFilesWindow::initWidgets()
+{
+    QFont font = _ui->heading->font();
+    font.setBold( true );
+    _ui->heading->setFont( font );
+
+    _ui->treeWidget->setColumnCount( DF_ColumnCount );
+    _ui->treeWidget->setHeaderLabels( QStringList()
+				      << tr( "Size" )
+				      << tr( "Files" )
+				      << tr( "Wasted" )
+				      << tr( "Path" ) );
+    _ui->treeWidget->header()->setStretchLastSection( false );
+    HeaderTweaker::resizeToContents( _ui->treeWidget->header() );
+}
+
+
+void DuplicateFilesWindow::refresh()
+{
+    populate( _subtree() );
+}
+
+
+void DuplicateFilesWindow::reject()
+{
+    foreach ( DuplicateFinder * finder, _finders )
+	finder->cancel();
+
+    deleteLater();
+}
+
+
+void DuplicateFilesWindow::populate( FileInfo * newSubtree )
+{
+    clear();
+    _subtree = newSubtree;
+
+    _ui->heading->setText( tr( "Duplicate Files in %1" )
+			   .arg( _subtree.url() ) );
+
+    if ( _currentFinder )
+	_currentFinder->cancel();
+
+    _currentFinder = new DuplicateFinder( _subtree(), this, "finderFinished" );
+    CHECK_NEW( _currentFinder );
+
+    _currentFinder->setAutoDelete( false );
+    _finders << _currentFinder;
+    _threadPool.start( _currentFinder );
+
+    setCursor( Qt::BusyCursor );
+    showProgress();
+    _progressTimer.start();
+}
+
+
+void DuplicateFilesWindow::finderFinished()
+{
+    for ( int i = _finders.size() - 1; i >= 0; --i )
+    {
+	DuplicateFinder * finder = _finders.at( i );
+
+	if ( ! finder->isFinished() )
+	    continue;
+
+	_finders.removeAt( i );
+
+	if ( finder == _currentFinder )
+	{
+	    _currentFinder = 0;
+	    _progressTimer.stop();
+	    unsetCursor();
+	    populateFromFinder( finder );
+	}
+
+	delete finder;
+    }
+}
+
+
+void DuplicateFilesWindow::showProgress()
+{
+    if ( ! _currentFinder )
+	return;
+
+    _ui->summaryLabel->setText( tr( "Checking files (step %1 of %2): %3 of %4" )
+				.arg( _currentFinder->stage() )
+				.arg( DuplicateFinder::stageCount() )
+				.arg( _currentFinder->stageDone() )
+				.arg( _currentFinder->stageTodo() ) );
+}
+
+
+void DuplicateFilesWindow::populateFromFinder( DuplicateFinder * finder )
+{
+    clear();
+
+    if ( finder->isCanceled() )
+	return;
+
+    const QVector<DuplicateCandidate> & candidates = finder->candidates();
+    FileSize totalWasted = 0LL;
+
+    // The groups are already in order: The most wasted space first
+
+    foreach ( const DuplicateGroup & group, finder->groups() )
+    {
+	FileSize size	= candidates.at( group.first() ).size;
+	FileSize wasted = size * ( group.size() - 1 );
+	totalWasted    += wasted;
+
+	QTreeWidgetItem * groupItem = new QTreeWidgetItem();
+	CHECK_NEW( groupItem );
+
+	groupItem->setText( DF_SizeCol,	  formatSize( size ) );
+	groupItem->setText( DF_CountCol,  QString( "%1" ).arg( group.size() ) );
+	groupItem->setText( DF_WastedCol, formatSize( wasted ) );
+	groupItem->setData( DF_PathCol, CandidateRole, -1 );
+
+	foreach ( int i, group )
+	{
+	    QTreeWidgetItem * fileItem = new QTreeWidgetItem( groupItem );
+	    CHECK_NEW( fileItem );
+
+	    fileItem->setText( DF_PathCol, candidates.at( i ).path );
+	    fileItem->setData( DF_PathCol, CandidateRole, i );
+	}
+
+	for ( int col = DF_SizeCol; col < DF_PathCol; ++col )
+	    groupItem->setTextAlignment( col, Qt::AlignRight );
+
+	_ui->treeWidget->addTopLevelItem( groupItem );
+    }
+
+    _ui->summaryLabel->setText( tr( "%1 groups of duplicate files, %2 wasted" )
+				.arg( finder->groups().size() )
+				.arg( formatSize( totalWasted ) ) );
+
+    QTreeWidgetItem * firstItem = _ui->treeWidget->topLevelItem( 0 );
+
+    if ( firstItem )
+	firstItem->setExpanded( true );
+}
+
+
+void DuplicateFilesWindow::locateInMainWindow( QTreeWidgetItem * item )
+{
+    if ( ! item || item->data( DF_PathCol, CandidateRole ).toInt() < 0 )
+	return;
+
+    // Only the paths are used here: The finder and its FileInfo pointers
+    // are gone by now, and the tree might have changed in the meantime
+
+    // logDebug() << "Locating " << item->text( DF_PathCol ) << " in tree" << endl;
+    _selectionModel->setCurrentItem( item->text( DF_PathCol ) );
+}
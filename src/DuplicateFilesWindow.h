@@ -0,0 +1,156 @@
+/*
+ *   File name: DuplicateFilesWindow.h
+ *   Summary:	QDirStat "duplicate files" window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef DuplicateFilesWindow_h
+#define DuplicateFilesWindow_h
+
+#include <QDialog>
+#include <QList>
+#include <QThreadPool>
+#include <QTimer>
+
+#include "ui_duplicate-files-window.h"
+#include "Subtree.h"
+
+
+namespace QDirStat
+{
+    class DuplicateFinder;
+    class FileInfo;
+    class SelectionModel;
+
+
+    /**
+     * Modeless dialog to show the groups of files with the same contents
+     * in a subtree, the ones that waste the most space first. A click on
+     * a file locates it in the main window.
+     *
+     * A DuplicateFinder reads the files in the background; meanwhile this
+     * shows how far it got.
+     **/
+    class DuplicateFilesWindow: public QDialog
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 *
+	 * Notice that this widget will destroy itself upon window close.
+	 *
+	 * It is advised to use a QPointer for storing a pointer to an instance
+	 * of this class. The QPointer will keep track of this window
+	 * auto-deleting itself when closed.
+	 **/
+	DuplicateFilesWindow( SelectionModel * selectionModel,
+			      QWidget *	       parent );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~DuplicateFilesWindow();
+
+	/**
+	 * Obtain the subtree from the last used URL.
+	 **/
+	const Subtree & subtree() const { return _subtree; }
+
+	/**
+	 * Start finding the duplicates in 'subtree'.
+	 **/
+	void populate( FileInfo * subtree );
+
+
+    public slots:
+
+	/**
+	 * Refresh (reload) all data.
+	 **/
+	void refresh();
+
+	/**
+	 * Reject the dialog contents, i.e. the user clicked the "Cancel"
+	 * or WM_CLOSE button. This also stops the DuplicateFinder.
+	 *
+	 * Reimplemented from QDialog.
+	 **/
+	virtual void reject() Q_DECL_OVERRIDE;
+
+
+    protected slots:
+
+	/**
+	 * Notification that a DuplicateFinder is done.
+	 **/
+	void finderFinished();
+
+	/**
+	 * Show how far the current DuplicateFinder got.
+	 **/
+	void showProgress();
+
+	/**
+	 * Locate a file of the list in the main window's tree and treemap
+	 * widgets via their SelectionModel.
+	 **/
+	void locateInMainWindow( QTreeWidgetItem * item );
+
+
+    protected:
+
+	/**
+	 * Clear all data and widget contents.
+	 **/
+	void clear();
+
+	/**
+	 * One-time initialization of the widgets in this window.
+	 **/
+	void initWidgets();
+
+	/**
+	 * Fill the list with the results of 'finder'.
+	 **/
+	void populateFromFinder( DuplicateFinder * finder );
+
+
+	//
+	// Data members
+	//
+
+	Ui::DuplicateFilesWindow * _ui;
+	SelectionModel *	   _selectionModel;
+	Subtree			   _subtree;
+
+	// All finders that are not done yet and the most recent one
+
+	QList<DuplicateFinder *>   _finders;
+	DuplicateFinder *	   _currentFinder;
+	QThreadPool		   _threadPool;
+	QTimer			   _progressTimer;
+    };
+
+
+    /**
+     * Column numbers for the duplicate files tree widget
+     **/
+    enum DuplicateFilesColumns
+    {
+	DF_SizeCol = 0,
+	DF_CountCol,
+	DF_WastedCol,
+	DF_PathCol,
+	DF_ColumnCount
+    };
+
+} // namespace QDirStat
+
+
+#endif // DuplicateFilesWindow_h
@@ -0,0 +1,509 @@
+/*
+ *   File name: DuplicateFinder.cpp
+ *   Summary:	Finding files with the same contents
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include <QByteArray>
+#include <QMetaObject>
+#include <QPair>
+#include <QSemaphore>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+
+#include "DuplicateFinder.h"
+#include "DirTree.h"
+#include "DirReadJob.h"
+#include "ParallelWalker.h"
+#include "Exception.h"
+
+
+// Smaller files are not worth looking at
+#define DuplicateMinSize	1
+
+// Bytes to read at the start and at the end of each file for the quick hash
+#define HeadTailSize		4096
+
+// Block size for reading the complete contents
+#define ReadBlockSize		( 256 * 1024 )
+
+// Reading threads per CPU: Most of them are waiting for the disk
+#define ThreadsPerCpu		2
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * A file and its size for grouping the files by size.
+     **/
+    struct SizedFile
+    {
+	FileSize   size;
+	FileInfo * item;
+    };
+
+
+    bool smallerFile( const SizedFile & a, const SizedFile & b )
+    {
+	return a.size < b.size;
+    }
+
+
+    /**
+     * Add 'size' bytes at 'data' to 'hash': 64 bit words xor'ed in and
+     * multiplied by a large odd constant, with the high bits folded back
+     * into the low ones. This is not cryptographically secure, but it is
+     * fast, and good enough to tell files of the same size apart.
+     **/
+    quint64 hashBytes( const char * data, qint64 size, quint64 hash )
+    {
+	const quint64 multiplier = 0x9E3779B97F4A7C15ULL;
+
+	while ( size >= 8 )
+	{
+	    quint64 word;
+	    memcpy( &word, data, 8 );
+
+	    hash  = ( hash ^ word ) * multiplier;
+	    hash ^= hash >> 32;
+	    data += 8;
+	    size -= 8;
+	}
+
+	while ( size-- > 0 )
+	{
+	    hash  = ( hash ^ (uchar) *data++ ) * multiplier;
+	    hash ^= hash >> 32;
+	}
+
+	return hash;
+    }
+
+
+    /**
+     * Hash the file at 'path' with 'size' bytes: Completely or only the
+     * first and last HeadTailSize bytes. Files that are not larger than
+     * both of those together are always hashed completely. Return 'false'
+     * if the file could not be read or if 'canceled' was set meanwhile.
+     *
+     * This only uses system calls, so it can be called from any thread.
+     **/
+    bool hashFile( const QString &    path,
+		   FileSize	      size,
+		   bool		      complete,
+		   const QAtomicInt & canceled,
+		   quint64 &	      hash_ret )
+    {
+	int fd = ::open( path.toUtf8().constData(), O_RDONLY | O_CLOEXEC );
+
+	if ( fd < 0 )
+	    return false;
+
+	quint64 hash = (quint64) size;
+	bool	ok   = true;
+
+	if ( complete || size <= 2 * HeadTailSize )
+	{
+	    QByteArray buffer( ReadBlockSize, 0 );
+	    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+	    while ( ok )
+	    {
+		ssize_t len = ::read( fd, buffer.data(), buffer.size() );
+
+		if ( len > 0 )
+		    hash = hashBytes( buffer.constData(), len, hash );
+		else if ( len == 0 )
+		    break;
+		else if ( errno != EINTR )
+		    ok = false;
+
+		if ( canceled.loadAcquire() != 0 )
+		    ok = false;
+	    }
+	}
+	else
+	{
+	    QByteArray buffer( 2 * HeadTailSize, 0 );
+
+	    ok = ::pread( fd, buffer.data(), HeadTailSize, 0 ) == HeadTailSize &&
+		 ::pread( fd, buffer.data() + HeadTailSize, HeadTailSize,
+			  size - HeadTailSize ) == HeadTailSize;
+
+	    if ( ok )
+		hash = hashBytes( buffer.constData(), buffer.size(), hash );
+	}
+
+	::close( fd );
+	hash_ret = hash;
+
+	return ok;
+    }
+
+
+    /**
+     * One task of the thread pool of DuplicateFinder::forEachCandidate().
+     **/
+    class CandidateTask: public QRunnable
+    {
+    public:
+
+	CandidateTask( const QVector<int> &		      todo,
+		       const DuplicateCandidate *	      candidates,
+		       const QHash<dev_t, QSemaphore *> &     deviceLimits,
+		       const std::function<void( int )> &     func,
+		       const QAtomicInt &		      canceled,
+		       QAtomicInt &			      next,
+		       QAtomicInt &			      done ):
+	    _todo( todo ),
+	    _candidates( candidates ),
+	    _deviceLimits( deviceLimits ),
+	    _func( func ),
+	    _canceled( canceled ),
+	    _next( next ),
+	    _done( done )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    int i;
+
+	    while ( _canceled.loadAcquire() == 0 &&
+		    ( i = _next.fetchAndAddRelaxed( 1 ) ) < _todo.size() )
+	    {
+		int candidate = _todo.at( i );
+		QSemaphore * limit = _deviceLimits.value( _candidates[ candidate ].device );
+
+		limit->acquire();
+		_func( candidate );
+		limit->release();
+
+		_done.ref();
+	    }
+	}
+
+    private:
+
+	const QVector<int> &		     _todo;
+	const DuplicateCandidate *	     _candidates;
+	const QHash<dev_t, QSemaphore *> &   _deviceLimits;
+	const std::function<void( int )> &   _func;
+	const QAtomicInt &		     _canceled;
+	QAtomicInt &			     _next;
+	QAtomicInt &			     _done;
+    };
+
+}	// namespace
+
+
+DuplicateFinder::DuplicateFinder( FileInfo *	subtree,
+				  QObject *	receiver,
+				  const char *	slot ):
+    _threads( qMax( 1, QThread::idealThreadCount() ) * ThreadsPerCpu ),
+    _tree( subtree ? subtree->tree() : 0 ),
+    _generation( _tree ? _tree->generation() : 0 ),
+    _receiver( receiver ),
+    _slot( slot ),
+    _stage( 1 ),
+    _stageDone( 0 ),
+    _stageTodo( 0 ),
+    _canceled( 0 ),
+    _finished( 0 )
+{
+    if ( subtree )
+	collect( subtree );
+}
+
+
+DuplicateFinder::~DuplicateFinder()
+{
+    qDeleteAll( _deviceLimits );
+}
+
+
+bool DuplicateFinder::isCurrent() const
+{
+    return _tree && _tree->generation() == _generation;
+}
+
+
+void DuplicateFinder::collect( FileInfo * subtree )
+{
+    // Collect the files in parallel tasks, then sort all of them by size
+
+    int taskCount = ParallelWalker::taskCount( subtree );
+    QVector<QVector<SizedFile> > taskFiles( taskCount );
+    QVector<SizedFile> * files = taskFiles.data();
+
+    ParallelWalker::forEachFile( subtree, taskCount,
+				 [=]( int task, FileInfo * item )
+				 {
+				     if ( item->rawByteSize() >= DuplicateMinSize && ! item->isAggregate() )
+				     {
+					 SizedFile file = { item->rawByteSize(), item };
+					 files[ task ] << file;
+				     }
+				 } );
+
+    QVector<SizedFile> allFiles;
+
+    foreach ( const QVector<SizedFile> & partialFiles, taskFiles )
+	allFiles += partialFiles;
+
+    taskFiles.clear();
+    std::sort( allFiles.begin(), allFiles.end(), smallerFile );
+
+
+    // Each run of files with the same size is a group
+
+    DirReadJobQueue * queue = _tree ? _tree->jobQueue() : 0;
+    int start = 0;
+
+    while ( start < allFiles.size() )
+    {
+	int end = start + 1;
+
+	while ( end < allFiles.size() && allFiles.at( end ).size == allFiles.at( start ).size )
+	    ++end;
+
+	if ( end - start > 1 )
+	{
+	    DuplicateGroup group;
+
+	    for ( int i = start; i < end; ++i )
+	    {
+		FileInfo * item = allFiles.at( i ).item;
+		DuplicateCandidate candidate =
+		    { item, item->path(), item->rawByteSize(), item->device(), item->links(), 0, 0, false };
+
+		if ( ! _deviceLimits.contains( candidate.device ) )
+		{
+		    int limit = queue ? queue->deviceConcurrency( item ) : _threads;
+		    limit = qBound( 1, limit, _threads );
+
+		    _deviceLimits.insert( candidate.device, new QSemaphore( limit ) );
+		}
+
+		group << _candidates.size();
+		_candidates << candidate;
+	    }
+
+	    _groups << group;
+	}
+
+	start = end;
+    }
+}
+
+
+void DuplicateFinder::run()
+{
+    collapseHardLinks();
+    hashGroups( false );
+    hashGroups( true );
+
+    if ( ! isCanceled() )
+    {
+	// The ones that waste the most space first
+
+	const QVector<DuplicateCandidate> & candidates = _candidates;
+
+	std::sort( _groups.begin(), _groups.end(),
+		   [&]( const DuplicateGroup & a, const DuplicateGroup & b )
+		   {
+		       return candidates.at( a.first() ).size * ( a.size() - 1 ) >
+			      candidates.at( b.first() ).size * ( b.size() - 1 );
+		   } );
+    }
+    else
+    {
+	_groups.clear();
+    }
+
+    _finished.storeRelease( 1 );
+
+    // Nothing may touch this object after this
+
+    QMetaObject::invokeMethod( _receiver, _slot, Qt::QueuedConnection );
+}
+
+
+void DuplicateFinder::startStage( int stage, int todo )
+{
+    _stageTodo.storeRelease( todo );
+    _stageDone.storeRelease( 0 );
+    _stage.storeRelease( stage );
+}
+
+
+void DuplicateFinder::forEachCandidate( const QVector<int> &		   todo,
+					const std::function<void( int )> & func )
+{
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount( _threads );
+    QAtomicInt next( 0 );
+
+    for ( int i=0; i < _threads; ++i )
+    {
+	threadPool.start( new CandidateTask( todo, _candidates.constData(), _deviceLimits,
+					     func, _canceled, next, _stageDone ) );
+    }
+
+    threadPool.waitForDone();
+}
+
+
+void DuplicateFinder::collapseHardLinks()
+{
+    QVector<int> todo;
+
+    foreach ( const DuplicateGroup & group, _groups )
+    {
+	foreach ( int i, group )
+	{
+	    if ( _candidates.at( i ).links > 1 )
+		todo << i;
+	}
+    }
+
+    startStage( 2, todo.size() );
+
+    if ( todo.isEmpty() )
+	return;
+
+    DuplicateCandidate * candidates = _candidates.data();
+
+    forEachCandidate( todo, [=]( int i )
+		      {
+			  struct stat statInfo;
+
+			  if ( lstat( candidates[ i ].path.toUtf8().constData(), &statInfo ) == 0 )
+			      candidates[ i ].inode = statInfo.st_ino;
+			  else
+			      candidates[ i ].unreadable = true;
+		      } );
+
+    // Keep only the first link to each inode in each group
+
+    QVector<DuplicateGroup> groups;
+
+    foreach ( const DuplicateGroup & group, _groups )
+    {
+	DuplicateGroup newGroup;
+	QSet<QPair<dev_t, ino_t> > inodes;
+
+	foreach ( int i, group )
+	{
+	    const DuplicateCandidate & candidate = _candidates.at( i );
+
+	    if ( candidate.unreadable )
+		continue;
+
+	    if ( candidate.links > 1 )
+	    {
+		QPair<dev_t, ino_t> inode( candidate.device, candidate.inode );
+
+		if ( inodes.contains( inode ) )
+		    continue;
+
+		inodes.insert( inode );
+	    }
+
+	    newGroup << i;
+	}
+
+	if ( newGroup.size() > 1 )
+	    groups << newGroup;
+    }
+
+    _groups = groups;
+}
+
+
+void DuplicateFinder::hashGroups( bool complete )
+{
+    QVector<int> todo;
+
+    foreach ( const DuplicateGroup & group, _groups )
+    {
+	// Small files were already hashed completely in the first pass
+
+	if ( complete && _candidates.at( group.first() ).size <= 2 * HeadTailSize )
+	    continue;
+
+	todo += group;
+    }
+
+    startStage( complete ? 4 : 3, todo.size() );
+
+    if ( todo.isEmpty() || isCanceled() )
+	return;
+
+    DuplicateCandidate * candidates = _candidates.data();
+    const QAtomicInt &	 canceled   = _canceled;
+
+    forEachCandidate( todo, [=, &canceled]( int i )
+		      {
+			  if ( ! hashFile( candidates[ i ].path, candidates[ i ].size, complete,
+					   canceled, candidates[ i ].hash ) )
+			  {
+			      candidates[ i ].unreadable = true;
+			  }
+		      } );
+
+    // The small files keep the hash of the first pass, so splitting their
+    // groups again changes nothing
+
+    splitGroupsByHash();
+}
+
+
+void DuplicateFinder::splitGroupsByHash()
+{
+    QVector<DuplicateGroup> groups;
+    const QVector<DuplicateCandidate> & candidates = _candidates;
+
+    foreach ( DuplicateGroup group, _groups )
+    {
+	group.erase( std::remove_if( group.begin(), group.end(),
+				     [&]( int i ) { return candidates.at( i ).unreadable; } ),
+		     group.end() );
+
+	std::sort( group.begin(), group.end(),
+		   [&]( int a, int b ) { return candidates.at( a ).hash < candidates.at( b ).hash; } );
+
+	int start = 0;
+
+	while ( start < group.size() )
+	{
+	    int end = start + 1;
+
+	    while ( end < group.size() &&
+		    candidates.at( group.at( end ) ).hash == candidates.at( group.at( start ) ).hash )
+	    {
+		++end;
+	    }
+
+	    if ( end - start > 1 )
+		groups << group.mid( start, end - start );
+
+	    start = end;
+	}
+    }
+
+    _groups = groups;
+}
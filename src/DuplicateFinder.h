@@ -0,0 +1,209 @@
+/*
+ *   File name: DuplicateFinder.h
+ *   Summary:	Finding files with the same contents
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef DuplicateFinder_h
+#define DuplicateFinder_h
+
+
+#include <sys/types.h>
+#include <functional>
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QRunnable>
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"
+
+
+class QObject;
+class QSemaphore;
+
+
+namespace QDirStat
+{
+    class DirTree;
+
+    /**
+     * A file that might have duplicates: One that has the same size as
+     * some other file.
+     **/
+    struct DuplicateCandidate
+    {
+	FileInfo * item;	// only for use on the main thread, see isCurrent()
+	QString	   path;
+	FileSize   size;
+	dev_t	   device;
+	nlink_t	   links;
+	ino_t	   inode;	// only for files with more than one link
+	quint64	   hash;	// of the current stage
+	bool	   unreadable;
+    };
+
+    /**
+     * The candidate numbers of files with the same contents.
+     **/
+    typedef QVector<int> DuplicateGroup;
+
+
+    /**
+     * Finding files with the same contents in a subtree in stages, each
+     * one narrowing down the groups of files that might be the same:
+     *
+     *	 - Files of the same size (right away from the tree)
+     *	 - Only one of the hard links to the same inode (by device and
+     *	   inode number, so the links are not reported as duplicates)
+     *	 - The same hash of the first and last few kB
+     *	 - The same hash of the complete contents
+     *
+     * All but the first stage read from the disk in a thread pool in the
+     * background; the reads on a device are limited to the concurrency
+     * that the DirReadJobQueue allows for it, so rotational disks and
+     * network mounts are not flooded with requests.
+     *
+     * The hash is a fast non-cryptographic one; different files with the
+     * same 64 bit hash are possible, but very unlikely.
+     *
+     * When it is done, this invokes method 'slot' of 'receiver' with a
+     * queued connection, and it does not touch anything after that, so the
+     * receiver can delete it right away. Use it with autoDelete() off.
+     **/
+    class DuplicateFinder: public QRunnable
+    {
+    public:
+
+	/**
+	 * Constructor: Find the files of the same size in 'subtree'. This
+	 * must be called on the main thread.
+	 **/
+	DuplicateFinder( FileInfo *   subtree,
+			 QObject *    receiver,
+			 const char * slot );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~DuplicateFinder();
+
+	/**
+	 * Do the stages that read from the disk. Reimplemented from
+	 * QRunnable.
+	 **/
+	virtual void run() Q_DECL_OVERRIDE;
+
+	/**
+	 * Stop as soon as possible. This can be called from any thread.
+	 **/
+	void cancel() { _canceled.storeRelease( 1 ); }
+
+	/**
+	 * Return 'true' if cancel() was called.
+	 **/
+	bool isCanceled() const { return _canceled.loadAcquire() != 0; }
+
+	/**
+	 * Return 'true' if finding is done.
+	 **/
+	bool isFinished() const { return _finished.loadAcquire() != 0; }
+
+	/**
+	 * Return the current stage (1 .. stageCount()) and how many of the
+	 * files of that stage are done so far. This can be called from any
+	 * thread.
+	 **/
+	int stage()     const { return _stage.loadAcquire(); }
+	int stageDone() const { return _stageDone.loadAcquire(); }
+	int stageTodo() const { return _stageTodo.loadAcquire(); }
+
+	/**
+	 * Return the number of stages.
+	 **/
+	static int stageCount() { return 4; }
+
+	/**
+	 * Return the candidates. Only use this when finding is done.
+	 **/
+	const QVector<DuplicateCandidate> & candidates() const { return _candidates; }
+
+	/**
+	 * Return the groups of files with the same contents, the ones that
+	 * waste the most space first. Only use this when finding is done.
+	 **/
+	const QVector<DuplicateGroup> & groups() const { return _groups; }
+
+	/**
+	 * Return 'true' if the tree did not change since the candidates were
+	 * collected, so their 'item' pointers are still valid. This must be
+	 * called on the main thread.
+	 **/
+	bool isCurrent() const;
+
+
+    protected:
+
+	/**
+	 * Collect the files of 'subtree' and group them by size.
+	 **/
+	void collect( FileInfo * subtree );
+
+	/**
+	 * Find the inode numbers of files with more than one link and drop
+	 * the other links to the same inode from each group.
+	 **/
+	void collapseHardLinks();
+
+	/**
+	 * Hash the candidates of all groups, completely or only the head
+	 * and tail, and split up the groups by that hash.
+	 **/
+	void hashGroups( bool complete );
+
+	/**
+	 * Call 'func' for each candidate in 'todo' in the thread pool,
+	 * respecting the concurrency limit of its device.
+	 **/
+	void forEachCandidate( const QVector<int> &		todo,
+			       const std::function<void( int )> & func );
+
+	/**
+	 * Split each group into groups of candidates with the same hash.
+	 * Groups with just one candidate are dropped.
+	 **/
+	void splitGroupsByHash();
+
+	/**
+	 * Start stage no. 'stage' with 'todo' files.
+	 **/
+	void startStage( int stage, int todo );
+
+
+	//
+	// Data members
+	//
+
+	QVector<DuplicateCandidate> _candidates;
+	QVector<DuplicateGroup>	    _groups;
+	QHash<dev_t, QSemaphore *>  _deviceLimits;
+	int			    _threads;
+	DirTree *		    _tree;
+	quint64			    _generation;
+	QObject *		    _receiver;
+	const char *		    _slot;
+	QAtomicInt		    _stage;
+	QAtomicInt		    _stageDone;
+	QAtomicInt		    _stageTodo;
+	QAtomicInt		    _canceled;
+	QAtomicInt		    _finished;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef DuplicateFinder_h
@@ -7,6 +7,8 @@
  */
 
 
+#include <QElapsedTimer>
+
 #include "ExcludeRules.h"
 #include "DirInfo.h"
 #include "DotEntry.h"
@@ -19,9 +21,15 @@
 
 #define VERBOSE_EXCLUDE_MATCHES	1
 
+// Characters with a special meaning in a regexp
+#define REGEXP_SPECIAL_CHARS	"\\^$.|?*+()[]{}"
+
 using namespace QDirStat;
 
 
+int ExcludeRule::_generation = 0;
+
+
 ExcludeRule::ExcludeRule( const QRegExp & regexp,
                           bool            useFullPath,
                           bool            checkAnyFileChild ):
@@ -97,21 +105,361 @@ bool ExcludeRule::matchDirectChildren( DirInfo * dir )
 //
 
 
+namespace
+{
+    /**
+     * Return 'true' if 'text' contains any of the characters in 'chars'.
+     **/
+    bool containsAny( const QString & text, const QString & chars )
+    {
+	for ( int i=0; i < text.size(); ++i )
+	{
+	    if ( chars.contains( text.at( i ) ) )
+		return true;
+	}
+
+	return false;
+    }
+
+
+    /**
+     * Use 'ruleNo' as the result of a match if it is a match that comes
+     * before 'best'.
+     **/
+    void useFirst( int & best, int ruleNo )
+    {
+	if ( ruleNo >= 0 && ( best < 0 || ruleNo < best ) )
+	    best = ruleNo;
+    }
+
+}	// namespace
+
+
+ExcludeRuleMatcher::ExcludeRuleMatcher():
+    _ruleCount( 0 )
+{
+    _combined[ 0 ].regexp.setCaseSensitivity( Qt::CaseInsensitive );
+    _combined[ 1 ].regexp.setCaseSensitivity( Qt::CaseSensitive	  );
+}
+
+
+void ExcludeRuleMatcher::clear()
+{
+    _fixed.clear();
+    _fixedCaseInsensitive.clear();
+    _prefixes.clear();
+    _suffixes.clear();
+    _single.clear();
+    _ruleNos.clear();
+    _ruleCount = 0;
+
+    for ( int i=0; i < 2; ++i )
+    {
+	_combined[ i ].patterns.clear();
+	_combined[ i ].groupRules.clear();
+	_combined[ i ].regexp.setPattern( "" );
+    }
+}
+
+
+void ExcludeRuleMatcher::add( int ruleNo, const QRegExp & regexp )
+{
+    ++_ruleCount;
+    _ruleNos << ruleNo;
+
+    if ( addLiteral( ruleNo, regexp ) )
+	return;
+
+    QString pattern = toRegExp( regexp.pattern(), regexp.patternSyntax() );
+    QRegExp rx( pattern, regexp.caseSensitivity(), QRegExp::RegExp );
+
+    if ( pattern.isEmpty() || ! rx.isValid() )
+    {
+	_single << qMakePair( ruleNo, regexp );
+	return;
+    }
+
+    // One capture group around each alternative, followed by the capture
+    // groups of the regexp itself
+
+    Combined & combined = _combined[ regexp.caseSensitivity() == Qt::CaseSensitive ? 1 : 0 ];
+
+    if ( combined.groupRules.isEmpty() )
+	combined.groupRules << -1;	// group 0 is the complete match
+
+    combined.patterns	<< "(" + pattern + ")";
+    combined.groupRules << ruleNo;
+
+    for ( int i=0; i < rx.captureCount(); ++i )
+	combined.groupRules << -1;
+}
+
+
+bool ExcludeRuleMatcher::addLiteral( int ruleNo, const QRegExp & regexp )
+{
+    QString pattern = regexp.pattern();
+    QString special;	// the characters that are not a literal
+    QString anything;	// what matches any text
+
+    switch ( regexp.patternSyntax() )
+    {
+	case QRegExp::FixedString:
+	    break;
+
+	case QRegExp::RegExp:
+	case QRegExp::RegExp2:
+	    special  = REGEXP_SPECIAL_CHARS;
+	    anything = ".*";
+	    break;
+
+	case QRegExp::Wildcard:
+	    special  = "*?[";
+	    anything = "*";
+	    break;
+
+	case QRegExp::WildcardUnix:
+	    special  = "*?[\\";
+	    anything = "*";
+	    break;
+
+	default:
+	    return false;
+    }
+
+    QString literal;
+    QList<Affix> * affixes = 0;
+
+    if ( ! containsAny( pattern, special ) )
+    {
+	literal = pattern;
+    }
+    else if ( pattern.endsWith( anything ) &&
+	      ! containsAny( pattern.left( pattern.size() - anything.size() ), special ) )
+    {
+	literal = pattern.left( pattern.size() - anything.size() );
+	affixes = &_prefixes;
+    }
+    else if ( pattern.startsWith( anything ) &&
+	      ! containsAny( pattern.mid( anything.size() ), special ) )
+    {
+	literal = pattern.mid( anything.size() );
+	affixes = &_suffixes;
+    }
+    else
+    {
+	return false;
+    }
+
+    if ( affixes )
+    {
+	Affix affix = { literal, regexp.caseSensitivity(), ruleNo };
+	*affixes << affix;
+    }
+    else if ( regexp.caseSensitivity() == Qt::CaseSensitive )
+    {
+	if ( ! _fixed.contains( literal ) )
+	    _fixed.insert( literal, ruleNo );
+    }
+    else
+    {
+	QString key = literal.toLower();
+
+	if ( ! _fixedCaseInsensitive.contains( key ) )
+	    _fixedCaseInsensitive.insert( key, ruleNo );
+    }
+
+    return true;
+}
+
+
+QString ExcludeRuleMatcher::toRegExp( const QString &	      pattern,
+				      QRegExp::PatternSyntax syntax )
+{
+    switch ( syntax )
+    {
+	case QRegExp::RegExp:
+	case QRegExp::RegExp2:
+	    // Back references would refer to the wrong group in a combined
+	    // regexp; the difference between greedy and minimal quantifiers
+	    // does not matter for exact matches
+
+	    return QRegExp( "\\\\[1-9]" ).indexIn( pattern ) >= 0 ? QString() : pattern;
+
+	case QRegExp::FixedString:
+	    return QRegExp::escape( pattern );
+
+	case QRegExp::Wildcard:
+	case QRegExp::WildcardUnix:
+	    break;
+
+	default:
+	    return QString();
+    }
+
+    QString result;
+
+    for ( int i=0; i < pattern.size(); ++i )
+    {
+	QChar c = pattern.at( i );
+
+	if ( c == '*' )
+	{
+	    result += ".*";
+	}
+	else if ( c == '?' )
+	{
+	    result += '.';
+	}
+	else if ( c == '\\' && syntax == QRegExp::WildcardUnix && i+1 < pattern.size() )
+	{
+	    result += QRegExp::escape( pattern.at( ++i ) );
+	}
+	else if ( c == '[' )
+	{
+	    // A set of characters like in a regexp, but with '!' for negation.
+	    // A ']' right at the start is part of the set.
+
+	    int start = i+1;
+
+	    if ( start < pattern.size() && ( pattern.at( start ) == '!' || pattern.at( start ) == '^' ) )
+		++start;
+
+	    int end = pattern.indexOf( ']', start < pattern.size() ? start + 1 : start );
+
+	    if ( end < 0 )
+	    {
+		result += "\\[";
+	    }
+	    else
+	    {
+		QString set = pattern.mid( i+1, end - i - 1 );
+
+		if ( set.startsWith( '!' ) )
+		    set[ 0 ] = '^';
+
+		if ( syntax == QRegExp::Wildcard )
+		    set.replace( "\\", "\\\\" );
+
+		result += "[" + set + "]";
+		i = end;
+	    }
+	}
+	else
+	{
+	    result += QRegExp::escape( c );
+	}
+    }
+
+    return result;
+}
+
+
+void ExcludeRuleMatcher::finish()
+{
+    for ( int i=0; i < 2; ++i )
+	_combined[ i ].regexp.setPattern( _combined[ i ].patterns.join( "|" ) );
+}
+
+
+int ExcludeRuleMatcher::match( const QString & text )
+{
+    int best = -1;
+
+    if ( _ruleCount == 0 || text.isEmpty() )
+	return best;
+
+    useFirst( best, _fixed.value( text, -1 ) );
+
+    if ( ! _fixedCaseInsensitive.isEmpty() )
+	useFirst( best, _fixedCaseInsensitive.value( text.toLower(), -1 ) );
+
+    // The affixes and the single regexps are in the order of the rules
+
+    foreach ( const Affix & prefix, _prefixes )
+    {
+	if ( best >= 0 && prefix.ruleNo > best )
+	    break;
+
+	if ( text.startsWith( prefix.text, prefix.caseSensitivity ) )
+	{
+	    useFirst( best, prefix.ruleNo );
+	    break;
+	}
+    }
+
+    foreach ( const Affix & suffix, _suffixes )
+    {
+	if ( best >= 0 && suffix.ruleNo > best )
+	    break;
+
+	if ( text.endsWith( suffix.text, suffix.caseSensitivity ) )
+	{
+	    useFirst( best, suffix.ruleNo );
+	    break;
+	}
+    }
+
+    for ( int i=0; i < 2; ++i )
+    {
+	if ( ! _combined[ i ].patterns.isEmpty() )
+	    useFirst( best, match( _combined[ i ], text ) );
+    }
+
+    for ( int i=0; i < _single.size(); ++i )
+    {
+	if ( best >= 0 && _single.at( i ).first > best )
+	    break;
+
+	if ( _single[ i ].second.exactMatch( text ) )
+	{
+	    useFirst( best, _single.at( i ).first );
+	    break;
+	}
+    }
+
+    return best;
+}
+
+
+int ExcludeRuleMatcher::match( Combined & combined, const QString & text )
+{
+    if ( ! combined.regexp.exactMatch( text ) )
+	return -1;
+
+    for ( int group = 1; group < combined.groupRules.size(); ++group )
+    {
+	if ( combined.groupRules.at( group ) >= 0 && combined.regexp.pos( group ) >= 0 )
+	    return combined.groupRules.at( group );
+    }
+
+    return -1;
+}
+
+
+//
+//---------------------------------------------------------------------------
+//
+
+
 ExcludeRules::ExcludeRules():
     QObject(),
-    _listMover( _rules )
+    _listMover( _rules ),
+    _matchersGeneration( -1 )
 {
     _lastMatchingRule  = 0;
     _defaultRulesAdded = false;
+    resetStats();
 }
 
 
 ExcludeRules::ExcludeRules( const QStringList & paths ):
     QObject(),
-    _listMover( _rules )
+    _listMover( _rules ),
+    _matchersGeneration( -1 )
 {
     _lastMatchingRule  = 0;
     _defaultRulesAdded = false;
+    resetStats();
 
     foreach ( const QString & path, paths )
     {
@@ -148,9 +496,11 @@ ExcludeRules * ExcludeRules::instance()
 
 void ExcludeRules::clear()
 {
+    updateStats();
     qDeleteAll( _rules );
     _rules.clear();
     _lastMatchingRule = 0;
+    dropMatchers();
 }
 
 
@@ -158,6 +508,7 @@ void ExcludeRules::add( ExcludeRule * rule )
 {
     CHECK_PTR( rule );
     _rules << rule;
+    dropMatchers();
 }
 
 
@@ -184,32 +535,63 @@ void ExcludeRules::remove( ExcludeRule * rule )
 {
     CHECK_PTR( rule );
 
+    updateStats();	// The rule numbers change
     _rules.removeAll( rule );
     delete rule;
+    dropMatchers();
+}
+
+
+void ExcludeRules::ensureMatchers()
+{
+    if ( _matchersGeneration == ExcludeRule::generation() )
+	return;
+
+    updateStats();
+    _pathMatcher.clear();
+    _nameMatcher.clear();
+    _childMatcher.clear();
+
+    for ( int i=0; i < _rules.size(); ++i )
+    {
+	const ExcludeRule * rule = _rules.at( i );
+
+	// Those never match anything
+
+	if ( rule->regexp().pattern().isEmpty() || ! rule->regexp().isValid() )
+	    continue;
+
+	if ( rule->checkAnyFileChild() )
+	    _childMatcher.add( i, rule->regexp() );
+	else if ( rule->useFullPath() )
+	    _pathMatcher.add( i, rule->regexp() );
+	else
+	    _nameMatcher.add( i, rule->regexp() );
+    }
+
+    _pathMatcher.finish();
+    _nameMatcher.finish();
+    _childMatcher.finish();
+    _matchersGeneration = ExcludeRule::generation();
 }
 
 
 bool ExcludeRules::match( const QString & fullPath, const QString & fileName )
 {
     _lastMatchingRule = 0;
-    if ( fullPath.isEmpty() || fileName.isEmpty() )
+    int ruleNo = matchingRuleNo( fullPath, fileName );
+
+    if ( ruleNo < 0 )
 	return false;
 
-    foreach ( ExcludeRule * rule, _rules )
-    {
-	if ( rule->match( fullPath, fileName ) )
-	{
-	    _lastMatchingRule = rule;
+    _lastMatchingRule = _rules.at( ruleNo );
+    _lastMatchingRule->addMatch();
 #if VERBOSE_EXCLUDE_MATCHES
 
-	    logDebug() << fullPath << " matches " << rule << endl;
+    logDebug() << fullPath << " matches " << _lastMatchingRule << endl;
 
 #endif
-	    return true;
-	}
-    }
-
-    return false;
+    return true;
 }
 
 
@@ -219,18 +601,35 @@ bool ExcludeRules::matchDirectChildren( DirInfo * dir )
     if ( ! dir )
 	return false;
 
-    foreach ( ExcludeRule * rule, _rules )
+    ensureMatchers();
+
+    if ( _childMatcher.isEmpty() )
+	return false;
+
+    // One pass over the children for all rules
+
+    FileInfoIterator it( dir->dotEntry() ? dir->dotEntry() : dir );
+
+    while ( *it )
     {
-	if ( rule->matchDirectChildren( dir ) )
-	{
-	    _lastMatchingRule = rule;
+        if ( ! (*it)->isDir() )
+        {
+	    int ruleNo = matchRules( ChildMatcher, (*it)->name() );
+
+	    if ( ruleNo >= 0 )
+	    {
+		_lastMatchingRule = _rules.at( ruleNo );
+		_lastMatchingRule->addMatch();
 #if VERBOSE_EXCLUDE_MATCHES
 
-	    logDebug() << dir << " matches " << rule << endl;
+		logDebug() << dir << " matches " << _lastMatchingRule << endl;
 
 #endif
-	    return true;
-	}
+		return true;
+	    }
+        }
+
+        ++it;
     }
 
     return false;
@@ -239,41 +638,141 @@ bool ExcludeRules::matchDirectChildren( DirInfo * dir )
 
 const ExcludeRule * ExcludeRules::matchingRule( const QString & fullPath,
 						const QString & fileName )
+{
+    int ruleNo = matchingRuleNo( fullPath, fileName );
+
+    return ruleNo >= 0 ? _rules.at( ruleNo ) : 0;
+}
+
+
+int ExcludeRules::matchingRuleNo( const QString & fullPath,
+				  const QString & fileName )
 {
     if ( fullPath.isEmpty() || fileName.isEmpty() )
-	return 0;
+	return -1;
+
+    ensureMatchers();
+
+    int ruleNo	   = matchRules( PathMatcher, fullPath );
+    int nameRuleNo = matchRules( NameMatcher, fileName );
+
+    if ( nameRuleNo >= 0 && ( ruleNo < 0 || nameRuleNo < ruleNo ) )
+	ruleNo = nameRuleNo;
+
+    return ruleNo;
+}
+
+
+ExcludeRuleMatcher & ExcludeRules::matcher( MatcherType type )
+{
+    switch ( type )
+    {
+	case PathMatcher:  return _pathMatcher;
+	case NameMatcher:  return _nameMatcher;
+	default:	   return _childMatcher;
+    }
+}
+
+
+int ExcludeRules::matchRules( MatcherType type, const QString & text )
+{
+    ExcludeRuleMatcher & ruleMatcher = matcher( type );
+
+    if ( ruleMatcher.isEmpty() || text.isEmpty() )
+	return -1;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    int ruleNo = ruleMatcher.match( text );
+
+    MatchStats & stats = _matcherStats[ type ];
+
+    stats.nanosec += timer.nsecsElapsed();
+    ++stats.evaluations;
+    ++_pendingEvaluations[ type ];
+
+    if ( ruleNo >= 0 )
+	++stats.matches;
+
+    return ruleNo;
+}
+
+
+void ExcludeRules::updateStats()
+{
+    for ( int type = 0; type < MatcherCount; ++type )
+    {
+	if ( _pendingEvaluations[ type ] == 0 )
+	    continue;
+
+	foreach ( int ruleNo, matcher( static_cast<MatcherType>( type ) ).ruleNos() )
+	{
+	    if ( ruleNo < _rules.size() )
+		_rules.at( ruleNo )->addEvaluations( _pendingEvaluations[ type ] );
+	}
+
+	_pendingEvaluations[ type ] = 0;
+    }
+}
+
+
+void ExcludeRules::resetStats()
+{
+    for ( int type = 0; type < MatcherCount; ++type )
+    {
+	_matcherStats[ type ]	    = MatchStats();
+	_pendingEvaluations[ type ] = 0;
+    }
 
     foreach ( ExcludeRule * rule, _rules )
+	rule->clearStats();
+}
+
+
+QString ExcludeRules::matcherName( MatcherType type )
+{
+    switch ( type )
     {
-	if ( rule->match( fullPath, fileName ) )
-	    return rule;
+	case PathMatcher:  return tr( "All full path rules" );
+	case NameMatcher:  return tr( "All name rules" );
+	case ChildMatcher: return tr( "All file child rules" );
+	default:	   break;
     }
 
-    return 0;
+    return QString();
 }
 
 
 void ExcludeRules::moveUp( ExcludeRule * rule )
 {
+    updateStats();
     _listMover.moveUp( rule );
+    dropMatchers();
 }
 
 
 void ExcludeRules::moveDown( ExcludeRule * rule )
 {
+    updateStats();
     _listMover.moveDown( rule );
+    dropMatchers();
 }
 
 
 void ExcludeRules::moveToTop( ExcludeRule * rule )
 {
+    updateStats();
     _listMover.moveToTop( rule );
+    dropMatchers();
 }
 
 
 void ExcludeRules::moveToBottom( ExcludeRule * rule )
 {
+    updateStats();
     _listMover.moveToBottom( rule );
+    dropMatchers();
 }
 
 
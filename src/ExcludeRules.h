@@ -14,9 +14,14 @@
 #include <QString>
 #include <QRegExp>
 #include <QList>
+#include <QHash>
+#include <QPair>
+#include <QStringList>
+#include <QVector>
 #include <QTextStream>
 
 #include "ListMover.h"
+#include "ScanStats.h"	// MatchStats
 
 
 namespace QDirStat
@@ -92,7 +97,7 @@ namespace QDirStat
 	/**
 	 * Change this rule's regular expression.
 	 **/
-	void setRegexp( const QRegExp & regexp ) { _regexp = regexp; }
+	void setRegexp( const QRegExp & regexp ) { _regexp = regexp; ++_generation; }
 
 	/**
 	 * Return 'true' if this exclude rule uses the full path to match
@@ -103,7 +108,7 @@ namespace QDirStat
 	/**
 	 * Set the 'full path' flag.
 	 **/
-	void setUseFullPath( bool useFullPath ) { _useFullPath = useFullPath; }
+	void setUseFullPath( bool useFullPath ) { _useFullPath = useFullPath; ++_generation; }
 
         /**
          * Return 'true' if this exclude rule should be used to check against
@@ -115,13 +120,164 @@ namespace QDirStat
         /**
          * Set the 'check any file child' flag.
          **/
-        void setCheckAnyFileChild( bool check ) { _checkAnyFileChild = check; }
+        void setCheckAnyFileChild( bool check ) { _checkAnyFileChild = check; ++_generation; }
+
+        /**
+         * Return a number that changes whenever any exclude rule is
+         * changed, so an ExcludeRuleMatcher knows it needs to be built
+         * again.
+         **/
+        static int generation() { return _generation; }
+
+        /**
+         * Return how often this rule was checked and how often it was the
+         * one that matched since the counters were last reset. The time is
+         * not known for a single rule since it is matched together with
+         * the others (see ExcludeRules::matcherStats()).
+         *
+         * Call ExcludeRules::updateStats() first to get the current
+         * counters.
+         **/
+        const MatchStats & stats() const { return _stats; }
+
+        /**
+         * Add 'count' checks to the counters.
+         **/
+        void addEvaluations( qint64 count ) { _stats.evaluations += count; }
+
+        /**
+         * Add a match to the counters.
+         **/
+        void addMatch() { ++_stats.matches; }
+
+        /**
+         * Reset the counters.
+         **/
+        void clearStats() { _stats = MatchStats(); }
 
     private:
 
 	QRegExp _regexp;
 	bool	_useFullPath;
         bool    _checkAnyFileChild;
+        MatchStats _stats;
+
+        static int _generation;
+    };
+
+
+    /**
+     * The regexps of several exclude rules that are all matched against
+     * the same text (the full path or the name) combined, so matching a
+     * text does not take longer with each rule that is added:
+     *
+     *   - Fixed strings (and wildcards and regexps without any special
+     *     characters) are looked up in a hash
+     *   - Wildcards like "prefix*" and "*suffix" are compared as strings
+     *   - All other regexps and wildcards are matched together as one
+     *     regexp with an alternative for each of them
+     *
+     * Only the few regexps that can't be part of a combined one (with
+     * back references or in W3C XML schema syntax) are matched one by one.
+     **/
+    class ExcludeRuleMatcher
+    {
+    public:
+
+        /**
+         * Constructor.
+         **/
+        ExcludeRuleMatcher();
+
+        /**
+         * Remove all regexps.
+         **/
+        void clear();
+
+        /**
+         * Add 'regexp' of rule no. 'ruleNo'. Rules need to be added in
+         * ascending order.
+         **/
+        void add( int ruleNo, const QRegExp & regexp );
+
+        /**
+         * Build the combined regexps after all rules were added.
+         **/
+        void finish();
+
+        /**
+         * Return the number of a rule whose regexp matches all of 'text'
+         * or -1 if there is none. If several rules match, this is the
+         * first of them unless they are both part of the same combined
+         * regexp; then it is the one that the regexp matched.
+         **/
+        int match( const QString & text );
+
+        /**
+         * Return 'true' if there are no regexps.
+         **/
+        bool isEmpty() const { return _ruleCount == 0; }
+
+        /**
+         * Return the numbers of the rules that were added.
+         **/
+        const QVector<int> & ruleNos() const { return _ruleNos; }
+
+
+    protected:
+
+        /**
+         * A fixed prefix or suffix to compare with.
+         **/
+        struct Affix
+        {
+            QString             text;
+            Qt::CaseSensitivity caseSensitivity;
+            int                 ruleNo;
+        };
+
+        /**
+         * The regexps with the same case sensitivity combined, and the rule
+         * of each capture group that starts an alternative (-1 for the
+         * capture groups inside of the regexps).
+         **/
+        struct Combined
+        {
+            QStringList  patterns;
+            QVector<int> groupRules;
+            QRegExp      regexp;
+        };
+
+        /**
+         * Add 'regexp' of rule 'ruleNo' to the fast paths if it is a fixed
+         * string, a prefix or a suffix. Return 'false' if it is none of
+         * those.
+         **/
+        bool addLiteral( int ruleNo, const QRegExp & regexp );
+
+        /**
+         * Return the number of the rule that matched 'text' in 'combined'
+         * or -1 if none did.
+         **/
+        static int match( Combined & combined, const QString & text );
+
+        /**
+         * Return 'pattern' with syntax 'syntax' in RegExp syntax or an
+         * empty string if that is not possible.
+         **/
+        static QString toRegExp( const QString & pattern, QRegExp::PatternSyntax syntax );
+
+
+        // Data members
+
+        QHash<QString, int>        _fixed;
+        QHash<QString, int>        _fixedCaseInsensitive;  // lowercase
+        QList<Affix>               _prefixes;
+        QList<Affix>               _suffixes;
+        Combined                   _combined[ 2 ];         // case insensitive, case sensitive
+        QList<QPair<int, QRegExp> > _single;
+        QVector<int>               _ruleNos;
+        int                        _ruleCount;
     };
 
 
@@ -147,6 +303,18 @@ namespace QDirStat
 	Q_OBJECT
 
     public:
+
+	/**
+	 * The matchers for the different kinds of rules.
+	 **/
+	enum MatcherType
+	{
+	    PathMatcher = 0,	// Rules that match the full path
+	    NameMatcher,	// Rules that match the name
+	    ChildMatcher,	// Rules that match the names of the file children
+	    MatcherCount
+	};
+
 	/**
 	 * Constructor.
 	 *
@@ -205,7 +373,8 @@ namespace QDirStat
 	 *
 	 * This will return 'true' if the text matches any rule.
 	 *
-	 * Note that this operation will move current().
+	 * All rules are matched at once (see ExcludeRuleMatcher), so this
+	 * does not take longer with more rules.
 	 **/
 	bool match( const QString & fullPath, const QString & fileName );
 
@@ -253,6 +422,30 @@ namespace QDirStat
 	 **/
 	ExcludeRuleListIterator end()	{ return _rules.constEnd(); }
 
+	/**
+	 * Add the checks since the last call to the counters of the rules
+	 * (see ExcludeRule::stats()). The matchers only count how often
+	 * they were used, not how often each of their rules was checked.
+	 **/
+	void updateStats();
+
+	/**
+	 * Reset the counters of all rules and matchers.
+	 **/
+	void resetStats();
+
+	/**
+	 * Return how often the matcher for the rules of 'type' was used, how
+	 * often any of them matched and how long that took.
+	 **/
+	const MatchStats & matcherStats( MatcherType type ) const
+	    { return _matcherStats[ type ]; }
+
+	/**
+	 * Return a name for the rules with matcher 'type' for the user.
+	 **/
+	static QString matcherName( MatcherType type );
+
     public slots:
 
 	/**
@@ -293,12 +486,56 @@ namespace QDirStat
          **/
         void addDefaultRules();
 
+        /**
+         * Build the matchers again if any rule changed.
+         **/
+        void ensureMatchers();
+
+        /**
+         * Return the number of the rule that matches 'fullPath' or
+         * 'fileName' or -1 if there is none.
+         **/
+        int matchingRuleNo( const QString & fullPath,
+                            const QString & fileName );
+
+        /**
+         * Return the matcher for 'type'.
+         **/
+        ExcludeRuleMatcher & matcher( MatcherType type );
+
+        /**
+         * Match 'text' against the rules of matcher 'type' and update the
+         * counters of that matcher. Return the number of the matching rule
+         * or -1 if there is none.
+         **/
+        int matchRules( MatcherType type, const QString & text );
+
+        /**
+         * Mark the matchers as outdated after the rules were added,
+         * removed or moved.
+         **/
+        void dropMatchers() { _matchersGeneration = -1; }
+
     private:
 
 	ExcludeRuleList		 _rules;
 	ListMover<ExcludeRule *> _listMover;
 	ExcludeRule *		 _lastMatchingRule;
         bool                     _defaultRulesAdded;
+
+        // The rules that match against the full path, the name and the
+        // names of the file children
+
+        ExcludeRuleMatcher       _pathMatcher;
+        ExcludeRuleMatcher       _nameMatcher;
+        ExcludeRuleMatcher       _childMatcher;
+        int                      _matchersGeneration;
+
+        // The counters of the matchers and how often each of them was used
+        // since the counters of their rules were last updated
+
+        MatchStats               _matcherStats[ MatcherCount ];
+        qint64                   _pendingEvaluations[ MatcherCount ];
     };
 
 
@@ -152,6 +152,7 @@ void ExcludeRulesConfigPage::load( void * value )
     {
         enableEditRuleWidgets( false );
         _ui->patternLineEdit->setText( "" );
+        _ui->statsLabel->clear();
 
 	return;
     }
@@ -179,6 +180,26 @@ void ExcludeRulesConfigPage::load( void * value )
 
     if ( excludeRule->checkAnyFileChild() )
         _ui->checkAnyFileChildRadioButton->setChecked( true );
+
+    showStats( excludeRule );
+}
+
+
+void ExcludeRulesConfigPage::showStats( ExcludeRule * excludeRule )
+{
+    ExcludeRules::instance()->updateStats();
+    const MatchStats & stats = excludeRule->stats();
+
+    if ( stats.evaluations == 0 )
+    {
+        _ui->statsLabel->setText( tr( "Not checked yet." ) );
+        return;
+    }
+
+    _ui->statsLabel->setText( tr( "Checked %1 times, excluded %2 (%3%)." )
+                              .arg( stats.evaluations )
+                              .arg( stats.matches )
+                              .arg( 100.0 * stats.matches / stats.evaluations, 0, 'f', 2 ) );
 }
 
 
@@ -67,6 +67,11 @@ namespace QDirStat
          **/
         void enableEditRuleWidgets( bool enable );
 
+        /**
+         * Show the counters of 'excludeRule'.
+         **/
+        void showStats( ExcludeRule * excludeRule );
+
 	/**
 	 * Fill the exclude rule list widget from the ExcludeRules.
 	 *
@@ -7,9 +7,8 @@
  */
 
 
-#include <QFileSystemModel>
-
 #include "ExistingDirCompleter.h"
+#include "DirListModel.h"
 #include "Logger.h"
 #include "Exception.h"
 
@@ -20,14 +19,10 @@ using namespace QDirStat;
 ExistingDirCompleter::ExistingDirCompleter( QObject * parent ):
     QCompleter( parent )
 {
-    QFileSystemModel * model = new QFileSystemModel( this );
-    CHECK_NEW( model );
-    
-    model->setRootPath( "/" );
-    model->setFilter( QDir::Dirs );
-    model->setReadOnly( true );
-
-    setModel( model );
+    _model = new DirListModel( this );
+    CHECK_NEW( _model );
+
+    setModel( _model );
 }
 
 
@@ -36,3 +31,28 @@ ExistingDirCompleter::~ExistingDirCompleter()
     // NOP
 }
 
+
+QStringList ExistingDirCompleter::splitPath( const QString & path ) const
+{
+    if ( ! path.startsWith( "/" ) )
+        return QStringList() << path;
+
+    // Everything up to the last '/' is complete; list that directory so its
+    // subdirectories can be offered for the rest
+
+    QString dir = path.left( path.lastIndexOf( '/' ) );
+    _model->list( _model->index( dir.isEmpty() ? QString( "/" ) : dir ) );
+
+    QStringList components = path.split( '/', QString::SkipEmptyParts );
+
+    if ( path.endsWith( '/' ) )
+        components << "";
+
+    return QStringList() << "/" << components;
+}
+
+
+QString ExistingDirCompleter::pathFromIndex( const QModelIndex & index ) const
+{
+    return _model->filePath( index );
+}
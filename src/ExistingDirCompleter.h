@@ -16,10 +16,15 @@
 
 namespace QDirStat
 {
+    class DirListModel;
+
     /**
      * Completer class for QCombobox and related to complete names of existing
      * directories.
      *
+     * The directories are listed by a DirListModel, so a slow network mount
+     * does not block typing.
+     *
      * See ShowUnpkgFilesDialog for a usage example.
      **/
     class ExistingDirCompleter: public QCompleter
@@ -37,7 +42,26 @@ namespace QDirStat
          * Destructor.
          **/
         virtual ~ExistingDirCompleter();
-        
+
+        /**
+         * Split 'path' into the names of the directories on the way.
+         * This also starts listing the directory that is being typed in.
+         *
+         * Reimplemented from QCompleter.
+         **/
+        virtual QStringList splitPath( const QString & path ) const Q_DECL_OVERRIDE;
+
+        /**
+         * Return the path of 'index'.
+         *
+         * Reimplemented from QCompleter.
+         **/
+        virtual QString pathFromIndex( const QModelIndex & index ) const Q_DECL_OVERRIDE;
+
+    protected:
+
+        DirListModel * _model;
+
     };  // class ExistingDirCompleter
     
 }       // namespace QDirStat
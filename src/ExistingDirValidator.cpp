@@ -7,7 +7,8 @@
  */
 
 
-#include <QDir>
+#include <sys/stat.h>
+#include <fcntl.h>	// AT_ constants (fstatat() flags)
 
 #include "ExistingDirValidator.h"
 #include "Logger.h"
@@ -34,7 +35,20 @@ ExistingDirValidator::validate( QString & input, int & pos) const
 {
     Q_UNUSED( pos );
     
-    bool ok = ! input.isEmpty() && QDir( input ).exists();
+    // Just check the directory entry: Don't trigger automounts for every
+    // partial path that is being typed in
+
+    int flags = 0;
+
+#ifdef AT_NO_AUTOMOUNT
+    flags |= AT_NO_AUTOMOUNT;
+#endif
+
+    struct stat statInfo;
+
+    bool ok = ! input.isEmpty() &&
+        fstatat( AT_FDCWD, input.toUtf8().constData(), &statInfo, flags ) == 0 &&
+        S_ISDIR( statInfo.st_mode );
     
     // This is a complex way to do
     //    emit isOk( ok );
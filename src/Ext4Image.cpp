@@ -0,0 +1,426 @@
+/*
+ *   File name: Ext4Image.cpp
+ *   Summary:	Reading ext2/3/4 filesystem images for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>
+#include <string.h>	// memset()
+#include <algorithm>	// std::lower_bound()
+
+#include <QFile>
+
+#if HAVE_LIBEXT2FS
+#  include <ext2fs/ext2fs.h>
+#  include <et/com_err.h>	// error_message()
+#endif
+
+#include "Ext4Image.h"
+#include "DirInfo.h"
+#include "DirTree.h"
+#include "Logger.h"
+#include "Exception.h"
+
+#define EXT4_ROOT_INO	2
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    struct InodeLess
+    {
+	template<typename INODE>
+	bool operator()( const INODE & inode, quint32 ino ) const
+	    { return inode.ino < ino; }
+    };
+}
+
+
+Ext4ImageReader::Ext4ImageReader( const QString & imageName,
+				  const QString & url,
+				  DirTree *	  tree ):
+    _imageName( imageName ),
+    _url( url ),
+    _tree( tree ),
+    _fs( 0 ),
+    _scan( 0 ),
+    _ok( false ),
+    _atEnd( false ),
+    _scanDone( false ),
+    _currentDir( 0 ),
+    _missingInodes( 0 ),
+    _scanMillisec( 0 )
+{
+    CHECK_PTR( _tree );
+
+#if HAVE_LIBEXT2FS
+
+    ext2_filsys fs = 0;
+
+    // Without EXT2_FLAG_RW, this is read-only
+
+    errcode_t err = ext2fs_open( QFile::encodeName( _imageName ),
+				 EXT2_FLAG_64BITS,
+				 0, 0,	// superblock, block size: default
+				 unix_io_manager,
+				 &fs );
+    if ( err )
+    {
+	logError() << "Can't open " << _imageName << ": " << error_message( err ) << endl;
+	return;
+    }
+
+    _fs = fs;
+    ext2_inode_scan scan = 0;
+    err = ext2fs_open_inode_scan( fs, 0, &scan );
+
+    if ( err )
+    {
+	logError() << "Can't scan the inodes of " << _imageName << ": " << error_message( err ) << endl;
+	close();
+	return;
+    }
+
+    // Don't give up on block groups whose inode table is not initialized
+    // (uninit_bg): There are no inodes in use there.
+
+    ext2fs_inode_scan_flags( scan, EXT2_SF_SKIP_MISSING_ITABLE, 0 );
+    _scan = scan;
+    _inodes.reserve( fs->super->s_inodes_count - fs->super->s_free_inodes_count );
+    _ok = true;
+
+    logInfo() << "Reading " << _imageName << ": "
+	      << _inodes.capacity() << " inodes in use" << endl;
+#else
+
+    logError() << "Can't read " << _imageName
+	       << ": QDirStat was built without libext2fs" << endl;
+#endif
+}
+
+
+Ext4ImageReader::~Ext4ImageReader()
+{
+    if ( ! _tree->beingDestroyed() )
+    {
+	foreach ( DirInfo * dir, _pendingDirs )
+	    finishDir( dir, DirAborted );
+    }
+
+    close();
+}
+
+
+bool Ext4ImageReader::isAvailable()
+{
+#if HAVE_LIBEXT2FS
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+void Ext4ImageReader::close()
+{
+#if HAVE_LIBEXT2FS
+    if ( _scan )
+	ext2fs_close_inode_scan( _scan );
+
+    if ( _fs )
+	ext2fs_close( _fs );
+#endif
+
+    _scan = 0;
+    _fs	  = 0;
+}
+
+
+void Ext4ImageReader::readFor( int millisec )
+{
+    if ( ! _ok || _atEnd )
+	return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if ( ! _scanDone )
+    {
+	bool done = scanInodes( timer, millisec );
+	_scanMillisec += timer.elapsed();
+
+	if ( ! _ok || ! done )
+	    return;
+
+	_scanDone = true;
+	logInfo() << "Scanned " << _inodes.size() << " inodes of " << _imageName
+		  << " in " << _scanMillisec / 1000.0 << " sec" << endl;
+
+	if ( _missingInodes > 0 )
+	    logWarning() << _missingInodes << " inodes could not be read" << endl;
+
+	createToplevel();
+    }
+
+    // By ascending i-number, i.e. roughly in the order on the disk
+
+    while ( _ok && ! _pendingDirs.isEmpty() && ! timer.hasExpired( millisec ) )
+    {
+	quint32	  ino = _pendingDirs.firstKey();
+	DirInfo * dir = _pendingDirs.take( ino );
+
+	readDir( ino, dir );
+    }
+
+    if ( _pendingDirs.isEmpty() )
+    {
+	_atEnd = true;
+	_inodes.clear();
+	_inodes.squeeze();
+	close();
+    }
+}
+
+
+bool Ext4ImageReader::scanInodes( const QElapsedTimer & timer, int millisec )
+{
+#if HAVE_LIBEXT2FS
+
+    struct ext2_inode inode;
+    int count = 0;
+
+    while ( ++count % EXT4_SCAN_CHECK_INTERVAL != 0 || ! timer.hasExpired( millisec ) )
+    {
+	ext2_ino_t ino = 0;
+	errcode_t  err = ext2fs_get_next_inode( _scan, &ino, &inode );
+
+	if ( err == EXT2_ET_BAD_BLOCK_IN_INODE_TABLE )
+	{
+	    ++_missingInodes;
+	    continue;
+	}
+
+	if ( err )
+	{
+	    logError() << "Error scanning the inodes of " << _imageName << ": "
+		       << error_message( err ) << endl;
+	    _ok = false;
+	    return false;
+	}
+
+	if ( ino == 0 )		// All done
+	    return true;
+
+	if ( inode.i_links_count == 0 || inode.i_dtime != 0 )
+	    continue;
+
+	// Since the scan goes by ascending i-number, _inodes stays sorted
+
+	Inode entry;
+	entry.ino    = ino;
+	entry.mode   = inode.i_mode;
+	entry.uid    = inode_uid( inode );
+	entry.gid    = inode_gid( inode );
+	entry.links  = inode.i_links_count;
+	entry.mtime  = (time_t) inode.i_mtime;
+	entry.size   = EXT2_I_SIZE( &inode );
+	entry.blocks = ext2fs_get_stat_i_blocks( _fs, &inode );
+
+	_inodes.append( entry );
+    }
+
+    return false;
+
+#else
+    Q_UNUSED( timer );
+    Q_UNUSED( millisec );
+
+    return true;
+#endif
+}
+
+
+const Ext4ImageReader::Inode * Ext4ImageReader::inode( quint32 ino ) const
+{
+    QVector<Inode>::const_iterator it =
+	std::lower_bound( _inodes.constBegin(), _inodes.constEnd(), ino, InodeLess() );
+
+    if ( it == _inodes.constEnd() || it->ino != ino )
+	return 0;
+
+    return &( *it );
+}
+
+
+void Ext4ImageReader::toStat( const Inode & inode, struct stat * statInfo ) const
+{
+    memset( statInfo, 0, sizeof( struct stat ) );
+
+    // All from the same device that is not on this machine
+
+    statInfo->st_dev	= 0;
+    statInfo->st_ino	= inode.ino;
+    statInfo->st_mode	= inode.mode;
+    statInfo->st_nlink	= inode.links;
+    statInfo->st_uid	= inode.uid;
+    statInfo->st_gid	= inode.gid;
+    statInfo->st_size	= inode.size;
+    statInfo->st_blocks = inode.blocks;
+    statInfo->st_mtime	= inode.mtime;
+}
+
+
+void Ext4ImageReader::createToplevel()
+{
+    const Inode * root = inode( EXT4_ROOT_INO );
+
+    if ( ! root || ! S_ISDIR( root->mode ) )
+    {
+	logError() << "No root directory in " << _imageName << endl;
+	_ok = false;
+	return;
+    }
+
+    struct stat statInfo;
+    toStat( *root, &statInfo );
+
+    DirInfo * toplevel = new DirInfo( _url, &statInfo, _tree, _tree->root() );
+    CHECK_NEW( toplevel );
+
+    toplevel->setReadState( DirReading );
+    _tree->root()->insertChild( toplevel );
+    _tree->childAddedNotify( toplevel );
+
+    _pendingDirs.insert( EXT4_ROOT_INO, toplevel );
+    _seenDirs.insert( EXT4_ROOT_INO );
+}
+
+
+void Ext4ImageReader::readDir( quint32 ino, DirInfo * dir )
+{
+#if HAVE_LIBEXT2FS
+
+    _currentDir = dir;
+    errcode_t err = ext2fs_dir_iterate2( _fs, ino,
+					 0,	// flags: Skip empty entries
+					 0,	// block buffer: allocate one
+					 dirEntryCallback,
+					 this );
+    _currentDir = 0;
+
+    if ( err )
+    {
+	logError() << "Can't read directory " << dir->url() << ": "
+		   << error_message( err ) << endl;
+	finishDir( dir, DirError );
+	return;
+    }
+
+#else
+    Q_UNUSED( ino );
+#endif
+
+    finishDir( dir, DirCached );
+}
+
+
+int Ext4ImageReader::dirEntryCallback( quint32		     dir,
+				       int		     entry,
+				       struct ext2_dir_entry * dirEntry,
+				       int		     offset,
+				       int		     blockSize,
+				       char *		     buf,
+				       void *		     priv )
+{
+    Q_UNUSED( dir );
+    Q_UNUSED( entry );
+    Q_UNUSED( offset );
+    Q_UNUSED( blockSize );
+    Q_UNUSED( buf );
+
+#if HAVE_LIBEXT2FS
+    Ext4ImageReader * reader = static_cast<Ext4ImageReader *>( priv );
+    reader->addEntry( dirEntry->name, ext2fs_dirent_name_len( dirEntry ), dirEntry->inode );
+#else
+    Q_UNUSED( dirEntry );
+    Q_UNUSED( priv );
+#endif
+
+    return 0;	// Continue
+}
+
+
+void Ext4ImageReader::addEntry( const char * name, int nameLen, quint32 ino )
+{
+    if ( ( nameLen == 1 && name[0] == '.' ) ||
+	 ( nameLen == 2 && name[0] == '.' && name[1] == '.' ) )
+    {
+	return;
+    }
+
+    QString entryName = QFile::decodeName( QByteArray( name, nameLen ) );
+    const Inode * entry = inode( ino );
+
+    if ( ! entry )
+    {
+	logWarning() << "No inode " << ino << " for " << _currentDir->url()
+		     << "/" << entryName << endl;
+	return;
+    }
+
+    struct stat statInfo;
+    toStat( *entry, &statInfo );
+
+    if ( S_ISDIR( entry->mode ) )
+    {
+	if ( _seenDirs.contains( ino ) )
+	{
+	    logError() << "Directory loop at " << _currentDir->url()
+		       << "/" << entryName << endl;
+	    return;
+	}
+
+	DirInfo * subDir = new DirInfo( entryName, &statInfo, _tree, _currentDir );
+	CHECK_NEW( subDir );
+
+	subDir->setReadState( DirReading );
+	_currentDir->insertChild( subDir );
+	_tree->childAddedNotify( subDir );
+
+	_pendingDirs.insert( ino, subDir );
+	_seenDirs.insert( ino );
+    }
+    else
+    {
+	FileInfo * item = new FileInfo( entryName, &statInfo, _tree, _currentDir );
+	CHECK_NEW( item );
+
+	_currentDir->insertChild( item );
+	_tree->childAddedNotify( item );
+    }
+}
+
+
+void Ext4ImageReader::finishDir( DirInfo * dir, DirReadState readState )
+{
+    dir->setReadState( readState );
+    dir->finalizeLocal();
+    _tree->sendReadJobFinished( dir );
+}
+
+
+void Ext4ImageReader::forgetSubtree( FileInfo * subtree )
+{
+    QMutableMapIterator<quint32, DirInfo *> it( _pendingDirs );
+
+    while ( it.hasNext() )
+    {
+	if ( it.next().value()->isInSubtree( subtree ) )
+	    it.remove();
+    }
+}
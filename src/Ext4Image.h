@@ -0,0 +1,205 @@
+/*
+ *   File name: Ext4Image.h
+ *   Summary:	Reading ext2/3/4 filesystem images for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef Ext4Image_h
+#define Ext4Image_h
+
+
+#include <sys/types.h>
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"		// FileSize
+
+
+// URLs of ext2/3/4 filesystem images or devices: "ext4:/dev/sdb1",
+// "ext4:/images/disk.img"
+#define EXT4_URL_PREFIX			"ext4:"
+
+// Milliseconds that an Ext4ReadJob reads in each time slice
+#define EXT4_READ_SLICE_MILLISEC	50
+
+// Number of i-nodes that are scanned between checks of the time slice
+#define EXT4_SCAN_CHECK_INTERVAL	4096
+
+
+// libext2fs types
+struct struct_ext2_filsys;
+struct ext2_struct_inode_scan;
+struct ext2_dir_entry;
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+
+    /**
+     * Reader for an ext2, ext3 or ext4 filesystem image or unmounted (or
+     * read-only mounted) block device with libext2fs, bypassing the
+     * kernel's filesystem code completely (see Ext4ReadJob).
+     *
+     * This works in two phases, each in time slices (see readFor()):
+     *
+     *	 - First, the i-node tables of all block groups are read one after
+     *	   the other, in the order they are on the disk. The attributes of
+     *	   all i-nodes that are in use are kept in a compact table sorted
+     *	   by i-number.
+     *
+     *	 - Then the directories are read from their raw directory blocks,
+     *	   starting with the root directory 2. The tree nodes are created
+     *	   with the attributes from the table, so there is not one single
+     *	   random access for an i-node. Pending directories are read by
+     *	   ascending i-number: ext4 puts the blocks of a directory close to
+     *	   its i-node, so this is roughly the order on the disk as well.
+     *
+     * The image is only opened for reading. The directories of the tree
+     * are marked as DirCached: Their paths are not on this machine.
+     **/
+    class Ext4ImageReader
+    {
+    public:
+
+	/**
+	 * Constructor: Open 'imageName' and read it into a new toplevel
+	 * directory 'url' below the root of 'tree'. Check ok() afterwards.
+	 **/
+	Ext4ImageReader( const QString & imageName,
+			 const QString & url,
+			 DirTree *	 tree );
+
+	/**
+	 * Destructor. If reading is not finished yet, the directories that
+	 * are not read yet are marked as aborted.
+	 **/
+	virtual ~Ext4ImageReader();
+
+	/**
+	 * Return 'true' if everything went fine so far.
+	 **/
+	bool ok() const { return _ok; }
+
+	/**
+	 * Return 'true' if all directories are read.
+	 **/
+	bool atEnd() const { return _atEnd; }
+
+	/**
+	 * Continue reading for about 'millisec' milliseconds.
+	 **/
+	void readFor( int millisec );
+
+	/**
+	 * Forget about any directories in 'subtree' that are not read yet:
+	 * That subtree is about to be deleted.
+	 **/
+	void forgetSubtree( FileInfo * subtree );
+
+	/**
+	 * Return 'true' if this was built with libext2fs.
+	 **/
+	static bool isAvailable();
+
+
+    protected:
+
+	/**
+	 * The attributes of one i-node that QDirStat uses.
+	 **/
+	struct Inode
+	{
+	    quint32  ino;
+	    quint32  mode;
+	    quint32  uid;
+	    quint32  gid;
+	    quint32  links;
+	    time_t   mtime;
+	    FileSize size;
+	    FileSize blocks;	// In 512 byte blocks, like st_blocks
+	};
+
+	/**
+	 * Scan the i-node tables until 'timer' has run 'millisec'
+	 * milliseconds. Return 'true' when all are done.
+	 **/
+	bool scanInodes( const QElapsedTimer & timer, int millisec );
+
+	/**
+	 * Create the toplevel directory from the root i-node.
+	 **/
+	void createToplevel();
+
+	/**
+	 * Read directory i-node 'ino' into 'dir'.
+	 **/
+	void readDir( quint32 ino, DirInfo * dir );
+
+	/**
+	 * Add one entry of the directory that readDir() currently reads.
+	 **/
+	void addEntry( const char * name, int nameLen, quint32 ino );
+
+	/**
+	 * Callback for ext2fs_dir_iterate2().
+	 **/
+	static int dirEntryCallback( quint32		  dir,
+				     int		  entry,
+				     struct ext2_dir_entry * dirEntry,
+				     int		  offset,
+				     int		  blockSize,
+				     char *		  buf,
+				     void *		  priv );
+
+	/**
+	 * Return the attributes of i-node 'ino' or 0 if it is not in use.
+	 **/
+	const Inode * inode( quint32 ino ) const;
+
+	/**
+	 * Fill 'statInfo' with the attributes of 'inode'.
+	 **/
+	void toStat( const Inode & inode, struct stat * statInfo ) const;
+
+	/**
+	 * Mark 'dir' as read with 'readState' and notify the tree.
+	 **/
+	void finishDir( DirInfo * dir, DirReadState readState );
+
+	/**
+	 * Close the image.
+	 **/
+	void close();
+
+
+	QString			      _imageName;
+	QString			      _url;
+	DirTree *		      _tree;
+	struct struct_ext2_filsys *   _fs;
+	struct ext2_struct_inode_scan * _scan;
+	bool			      _ok;
+	bool			      _atEnd;
+	bool			      _scanDone;
+	QVector<Inode>		      _inodes;
+	QMap<quint32, DirInfo *>      _pendingDirs;	// By i-number
+	QSet<quint32>		      _seenDirs;	// Against loops in broken images
+	DirInfo *		      _currentDir;
+	int			      _missingInodes;
+	qint64			      _scanMillisec;
+
+    };	// class Ext4ImageReader
+
+}	// namespace QDirStat
+
+
+#endif	// Ext4Image_h
@@ -0,0 +1,236 @@
+/*
+ *   File name: FileAgeStatsWindow.cpp
+ *   Summary:	QDirStat file age statistics window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <time.h>
+
+#include <QTreeWidgetItem>
+
+#include "FileAgeStatsWindow.h"
+#include "FileMTimeStats.h"
+#include "MTimeHistogram.h"
+#include "DirInfo.h"
+#include "SettingsHelpers.h"
+#include "HeaderTweaker.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * The age classes of the files, youngest first: Each one starts at
+     * the age in months of the next. Files from the future count as
+     * modified this month.
+     **/
+    struct AgeClass
+    {
+	int	     minMonths;
+	const char * name;
+    };
+
+    const AgeClass ageClasses[] =
+    {
+	{   0, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "This month"	      ) },
+	{   1, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "1 - 3 months"      ) },
+	{   3, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "3 - 6 months"      ) },
+	{   6, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "6 - 12 months"     ) },
+	{  12, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "1 - 2 years"	      ) },
+	{  24, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "2 - 3 years"	      ) },
+	{  36, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "3 - 5 years"	      ) },
+	{  60, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "5 - 10 years"      ) },
+	{ 120, QT_TRANSLATE_NOOP( "QDirStat::FileAgeStatsWindow", "10 years or more" ) }
+    };
+
+    const int ageClassCount = sizeof( ageClasses ) / sizeof( ageClasses[0] );
+
+
+    /**
+     * Return the age class for a file that was modified 'months' ago.
+     **/
+    int ageClass( int months )
+    {
+	int i = ageClassCount - 1;
+
+	while ( i > 0 && months < ageClasses[ i ].minMonths )
+	    --i;
+
+	return i;
+    }
+
+}	// namespace
+
+
+FileAgeStatsWindow::FileAgeStatsWindow( QWidget * parent ):
+    QDialog( parent ),
+    _ui( new Ui::FileAgeStatsWindow )
+{
+    // logDebug() << "init" << endl;
+
+    CHECK_NEW( _ui );
+    _ui->setupUi( this );
+    initWidgets();
+    readWindowSettings( this, "FileAgeStatsWindow" );
+
+    connect( _ui->refreshButton, SIGNAL( clicked() ),
+	     this,		 SLOT  ( refresh() ) );
+}
+
+
+FileAgeStatsWindow::~FileAgeStatsWindow()
+{
+    // logDebug() << "destroying" << endl;
+    writeWindowSettings( this, "FileAgeStatsWindow" );
+}
+
+
+void FileAgeStatsWindow::clear()
+{
+    _ui->treeWidget->clear();
+    _ui->summaryLabel->clear();
+}
+
+
+void FileAgeStatsWindow::initWidgets()
+{
+    QFont font = _ui->heading->font();
+    font.setBold( true );
+    _ui->heading->setFont( font );
+
+    _ui->treeWidget->setColumnCount( FA_ColumnCount );
+    _ui->treeWidget->setHeaderLabels( QStringList()
+				      << tr( "Last Modified" )
+				      << tr( "Number" )
+				      << tr( "Total Size" )
+				      << tr( "Percentage" )
+				      << tr( "Number This Old or Older" )
+				      << tr( "Size This Old or Older" ) );
+    _ui->treeWidget->header()->setStretchLastSection( false );
+    HeaderTweaker::resizeToContents( _ui->treeWidget->header() );
+}
+
+
+void FileAgeStatsWindow::refresh()
+{
+    populate( _subtree() );
+}
+
+
+void FileAgeStatsWindow::reject()
+{
+    deleteLater();
+}
+
+
+void FileAgeStatsWindow::populate( FileInfo * newSubtree )
+{
+    TRACE_SCOPE( "stats", "FileAgeStatsWindow::populate" );
+
+    clear();
+    _subtree = newSubtree;
+
+    _ui->heading->setText( tr( "File Age Statistics for %1" )
+			   .arg( _subtree.url() ) );
+
+    FileInfo * subtree = _subtree();
+
+    if ( ! subtree || ! subtree->isDirInfo() )
+	return;
+
+    DirInfo *	   dir		= subtree->toDirInfo();
+    MTimeHistogram histogram	= dir->mtimeHistogram();
+    int		   currentMonth = MTimeHistogram::month( time( 0 ) );
+
+
+    // Add up the months of each age class
+
+    int	     counts[ ageClassCount ];
+    FileSize sums  [ ageClassCount ];
+    FileSize totalSize = 0LL;
+
+    for ( int i=0; i < ageClassCount; ++i )
+    {
+	counts[ i ] = 0;
+	sums  [ i ] = 0LL;
+    }
+
+    foreach ( const MTimeHistogram::Bucket & bucket, histogram.buckets() )
+    {
+	int i = ageClass( currentMonth - bucket.month );
+	counts[ i ] += bucket.count;
+	sums  [ i ] += bucket.sum;
+	totalSize   += bucket.sum;
+    }
+
+
+    // The "... or older" columns add up everything from the oldest class
+
+    int	     olderCounts[ ageClassCount ];
+    FileSize olderSums	[ ageClassCount ];
+    int	     olderCount = 0;
+    FileSize olderSum	= 0LL;
+
+    for ( int i = ageClassCount - 1; i >= 0; --i )
+    {
+	olderCount += counts[ i ];
+	olderSum   += sums  [ i ];
+	olderCounts[ i ] = olderCount;
+	olderSums  [ i ] = olderSum;
+    }
+
+    for ( int i=0; i < ageClassCount; ++i )
+    {
+	double percentage = totalSize > 0LL ? ( 100.0 * sums[ i ] ) / totalSize : 0.0;
+
+	QString percentStr;
+	percentStr.setNum( percentage, 'f', 2 );
+	percentStr += "%";
+
+	QTreeWidgetItem * item = new QTreeWidgetItem();
+	CHECK_NEW( item );
+
+	item->setText( FA_AgeCol,	 tr( ageClasses[ i ].name ) );
+	item->setText( FA_CountCol,	 QString( "%1" ).arg( counts[ i ] ) );
+	item->setText( FA_TotalSizeCol,	 formatSize( sums[ i ] ) );
+	item->setText( FA_PercentageCol, percentStr );
+	item->setText( FA_OlderCountCol, QString( "%1" ).arg( olderCounts[ i ] ) );
+	item->setText( FA_OlderSizeCol,	 formatSize( olderSums[ i ] ) );
+
+	item->setTextAlignment( FA_AgeCol, Qt::AlignLeft );
+
+	for ( int col = FA_CountCol; col < FA_ColumnCount; ++col )
+	    item->setTextAlignment( col, Qt::AlignRight );
+
+	_ui->treeWidget->addTopLevelItem( item );
+    }
+
+
+    // Summary: Median and anything that is missing
+
+    QStringList summary;
+    FileMTimeStats stats;
+    stats.collect( histogram );
+
+    if ( stats.dataSize() > 0 )
+    {
+	summary << tr( "Median modification time: %1" )
+	    .arg( formatTime( (time_t) stats.median() ) );
+    }
+
+    if ( ! dir->hasCompleteMTimeHistogram() )
+    {
+	summary << tr( "Some directories below this one are not read yet. "
+		       "Their files are missing here." );
+    }
+
+    _ui->summaryLabel->setText( summary.join( "\n" ) );
+}
@@ -0,0 +1,120 @@
+/*
+ *   File name: FileAgeStatsWindow.h
+ *   Summary:	QDirStat file age statistics window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef FileAgeStatsWindow_h
+#define FileAgeStatsWindow_h
+
+#include <QDialog>
+
+#include "ui_file-age-stats-window.h"
+#include "Subtree.h"
+
+
+namespace QDirStat
+{
+    class FileInfo;
+
+
+    /**
+     * Modeless dialog to display how many files and how much data of a
+     * subtree were last modified how long ago, e.g. how much has not been
+     * touched in 3 years.
+     *
+     * This uses the MTimeHistogram of the subtree's DirInfo, so it does not
+     * need to walk the subtree.
+     **/
+    class FileAgeStatsWindow: public QDialog
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 *
+	 * Notice that this widget will destroy itself upon window close.
+	 *
+	 * It is advised to use a QPointer for storing a pointer to an instance
+	 * of this class. The QPointer will keep track of this window
+	 * auto-deleting itself when closed.
+	 **/
+	FileAgeStatsWindow( QWidget * parent );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~FileAgeStatsWindow();
+
+	/**
+	 * Obtain the subtree from the last used URL.
+	 **/
+	const Subtree & subtree() const { return _subtree; }
+
+	/**
+	 * Populate the widgets for a subtree.
+	 **/
+	void populate( FileInfo * subtree );
+
+
+    public slots:
+
+	/**
+	 * Refresh (reload) all data.
+	 **/
+	void refresh();
+
+	/**
+	 * Reject the dialog contents, i.e. the user clicked the "Cancel"
+	 * or WM_CLOSE button.
+	 *
+	 * Reimplemented from QDialog.
+	 **/
+	virtual void reject() Q_DECL_OVERRIDE;
+
+
+    protected:
+
+	/**
+	 * Clear all data and widget contents.
+	 **/
+	void clear();
+
+	/**
+	 * One-time initialization of the widgets in this window.
+	 **/
+	void initWidgets();
+
+
+	//
+	// Data members
+	//
+
+	Ui::FileAgeStatsWindow * _ui;
+	Subtree			 _subtree;
+    };
+
+
+    /**
+     * Column numbers for the file age tree widget
+     **/
+    enum FileAgeColumns
+    {
+	FA_AgeCol = 0,
+	FA_CountCol,
+	FA_TotalSizeCol,
+	FA_PercentageCol,
+	FA_OlderCountCol,
+	FA_OlderSizeCol,
+	FA_ColumnCount
+    };
+
+} // namespace QDirStat
+
+
+#endif // FileAgeStatsWindow_h
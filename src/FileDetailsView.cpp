@@ -11,20 +11,34 @@
 
 #include "FileDetailsView.h"
 #include "AdaptiveTimer.h"
+#include "BtrfsQgroups.h"
+#include "ZfsDatasets.h"
+#include "ContainerLayers.h"
 #include "DirInfo.h"
+#include "DirTree.h"
 #include "DirTreeModel.h"
 #include "FileInfoSet.h"
 #include "MimeCategorizer.h"
 #include "PkgQuery.h"
+#include "OwnerNames.h"
 #include "SystemFileChecker.h"
 #include "Settings.h"
 #include "SettingsHelpers.h"
+#include "UpdateScheduler.h"
 #include "Logger.h"
 #include "Exception.h"
 
 #define ALLOCATED_FAT_PERCENT	33
 #define MAX_SYMLINK_TARGET_LEN	25
 
+// Larger selections are summed up via the UpdateScheduler
+#define SELECTION_SUMMARY_SYNC_LIMIT	1000
+
+// Wait at least this long between two sums of a large selection, and five
+// times as long as the last one took
+#define SELECTION_SUMMARY_MILLISEC	200
+#define SELECTION_SUMMARY_COST_FACTOR	5
+
 using namespace QDirStat;
 
 
@@ -32,10 +46,16 @@ FileDetailsView::FileDetailsView( QWidget * parent ):
     QStackedWidget( parent ),
     _ui( new Ui::FileDetailsView ),
     _pkgUpdateTimer( new AdaptiveTimer( this ) ),
+    _summaryUpdate( new ScheduledUpdate( this, NormalPriority, SELECTION_SUMMARY_MILLISEC ) ),
+    _userLabel( 0 ),
+    _groupLabel( 0 ),
+    _uid( 0 ),
+    _gid( 0 ),
     _labelLimit( 40 )
 {
     CHECK_NEW( _ui );
     CHECK_NEW( _pkgUpdateTimer );
+    CHECK_NEW( _summaryUpdate );
 
     _ui->setupUi( this );
     clear();
@@ -56,6 +76,15 @@ FileDetailsView::FileDetailsView( QWidget * parent ):
 
     connect( _pkgUpdateTimer, SIGNAL( deliverRequest( QVariant ) ),
 	     this,	      SLOT  ( updatePkgInfo ( QVariant ) ) );
+
+    _summaryUpdate->setCostFactor( SELECTION_SUMMARY_COST_FACTOR );
+    _summaryUpdate->setWidget( this );
+
+    connect( _summaryUpdate, SIGNAL( update()		      ),
+	     this,	     SLOT  ( updateSelectionSummary() ) );
+
+    connect( OwnerNames::instance(), SIGNAL( namesChanged()	),
+	     this,		     SLOT  ( updateOwnerLabels() ) );
 }
 
 
@@ -68,6 +97,8 @@ FileDetailsView::~FileDetailsView()
 void FileDetailsView::clear()
 {
     setCurrentPage( _ui->emptyPage );
+    _userLabel	= 0;
+    _groupLabel = 0;
 }
 
 
@@ -78,6 +109,9 @@ void FileDetailsView::setCurrentPage( QWidget *page )
     // really need to be removed from the layout. They are still children of
     // the QStackedWidget, but no longer in the layout.
 
+    if ( page != _ui->selectionSummaryPage )
+	_summaryItems.clear();
+
     while ( count() > 0 )
 	removeWidget( widget( 0 ) );
 
@@ -204,9 +238,9 @@ void FileDetailsView::showFileInfo( FileInfo * file )
 
     setFileSizeLabel( _ui->fileSizeLabel, file );
     setFileAllocatedLabel( _ui->fileAllocatedLabel, file );
+    addExtentUsage( _ui->fileAllocatedLabel, file );
 
-    _ui->fileUserLabel->setText( file->userName() );
-    _ui->fileGroupLabel->setText( file->groupName() );
+    setOwnerLabels( file, _ui->fileUserLabel, _ui->fileGroupLabel );
     _ui->filePermissionsLabel->setText( formatPermissions( file->mode() ) );
     _ui->fileMTimeLabel->setText( formatTime( file->mtime() ) );
 
@@ -267,12 +301,38 @@ void FileDetailsView::setFileAllocatedLabel( FileSizeLabel * label,
 }
 
 
+void FileDetailsView::addExtentUsage( FileSizeLabel * label,
+				      FileInfo *      item )
+{
+    CHECK_PTR( item );
+    label->setToolTip( "" );
+
+    ExtentUsage usage = item->tree() ? item->tree()->extentUsage( item ) : ExtentUsage();
+
+    if ( ! usage.isValid() || usage.shared == 0 )
+	return;
+
+    QString contextText = label->contextText();
+
+    label->setText( tr( "%1 (%2 exclusive)" )
+		    .arg( label->text() )
+		    .arg( formatSize( usage.exclusive ) ),
+		    label->value(), label->prefix() );
+    label->setContextText( contextText );
+
+    label->setToolTip( tr( "Exclusive: %1\nShared with other files: %2" )
+		       .arg( formatSize( usage.exclusive ) )
+		       .arg( formatSize( usage.shared ) ) );
+}
+
+
 void FileDetailsView::showFilePkgInfo( FileInfo * file )
 {
     CHECK_PTR( file );
 
     bool isSystemFile = SystemFileChecker::isSystemFile( file );
     setSystemFileWarningVisibility( isSystemFile );
+    _pkgPath.clear();
 
     if ( PkgQuery::foundSupportedPkgManager() )
     {
@@ -284,7 +344,8 @@ void FileDetailsView::showFilePkgInfo( FileInfo * file )
 		_ui->filePackageLabel->setText( delayHint );
 
 		_ui->filePackageCaption->setEnabled( true );
-		_pkgUpdateTimer->delayedRequest( file->url() );
+		_pkgPath = file->url();
+		_pkgUpdateTimer->delayedRequest( _pkgPath );
 	    }
     }
     else // No supported package manager found
@@ -299,9 +360,48 @@ void FileDetailsView::updatePkgInfo( const QVariant & pathVariant )
     QString path = pathVariant.toString();
     // logDebug() << "Updating pkg info for " << path << endl;
 
-    QString pkg = PkgQuery::owningPkg( path );
-    _ui->filePackageLabel->setText( pkg );
-    _ui->filePackageCaption->setEnabled( ! pkg.isEmpty() );
+    PkgQuery::owningPkgAsync( path, this, [=]( const QString & pkg )
+	{
+	    // Meanwhile, another file might have been selected
+
+	    if ( path != _pkgPath )
+		return;
+
+	    _ui->filePackageLabel->setText( pkg );
+	    _ui->filePackageCaption->setEnabled( ! pkg.isEmpty() );
+	});
+}
+
+
+void FileDetailsView::setOwnerLabels( FileInfo * item,
+				      QLabel *	 userLabel,
+				      QLabel *	 groupLabel )
+{
+    userLabel->setText( item->userName() );
+    groupLabel->setText( item->groupName() );
+
+    if ( item->hasUid() && item->hasGid() )
+    {
+	_userLabel  = userLabel;
+	_groupLabel = groupLabel;
+	_uid	    = item->uid();
+	_gid	    = item->gid();
+    }
+    else
+    {
+	_userLabel  = 0;
+	_groupLabel = 0;
+    }
+}
+
+
+void FileDetailsView::updateOwnerLabels()
+{
+    if ( ! _userLabel || ! _groupLabel )
+	return;
+
+    _userLabel->setText( OwnerNames::userName( _uid ) );
+    _groupLabel->setText( OwnerNames::groupName( _gid ) );
 }
 
 
@@ -336,8 +436,22 @@ void FileDetailsView::showDetails( DirInfo * dir )
     if ( dir->isMountPoint() )
 	dirType = tr( "Mount Point" );
 
+    QString layerToolTip;
+
+    if ( ! dir->isPseudoDir() )
+    {
+	LayerInfo layer = ContainerLayers::layerInfo( dir->url() );
+
+	if ( layer.isValid() )
+	{
+	    dirType	 = ContainerLayers::kindName( layer );
+	    layerToolTip = ContainerLayers::toolTip( dir );
+	}
+    }
+
     setLabelLimited(_ui->dirNameLabel, name );
     _ui->dirTypeLabel->setText( dirType );
+    _ui->dirTypeLabel->setToolTip( layerToolTip );
 
     _ui->dirIcon->setVisible( ! dir->readError() );
     _ui->dirUnreadableIcon->setVisible( dir->readError() );
@@ -361,7 +475,30 @@ void FileDetailsView::showSubtreeInfo( DirInfo * dir )
 	case DirQueued:
 	case DirReading:		msg = tr( "[Reading]"		); break;
 
-	case DirOnRequestOnly:		msg = tr( "[Not Read]"		); break;
+	case DirOnRequestOnly:
+	    {
+		msg = tr( "[Not Read]" );
+		SubvolumeUsage usage;
+
+		if ( dir->isMountPoint() )
+		    usage = BtrfsQgroups::cachedUsage( dir->url() );
+
+		if ( usage.isValid() )
+		{
+		    msg += " " + tr( "Btrfs: %1 (%2 exclusive)" )
+			.arg( formatSize( usage.referenced ) )
+			.arg( formatSize( usage.exclusive  ) );
+		}
+		else if ( dir->isMountPoint() )
+		{
+		    DatasetUsage dataset = ZfsDatasets::cachedUsage( dir->url() );
+
+		    if ( dataset.isValid() )
+			msg += " " + ZfsDatasets::summary( dataset );
+		}
+	    }
+	    break;
+
 	case DirPermissionDenied:	msg = tr( "[Permission Denied]" ); break;
 	case DirError:			msg = tr( "[Read Error]"	); break;
 
@@ -379,6 +516,7 @@ void FileDetailsView::showSubtreeInfo( DirInfo * dir )
 
 	setLabel( _ui->dirTotalSizeLabel,   dir->totalSize(),	       prefix );
 	setLabel( _ui->dirAllocatedLabel,   dir->totalAllocatedSize(), prefix );
+	addExtentUsage( _ui->dirAllocatedLabel, dir );
 	setLabel( _ui->dirItemCountLabel,   dir->totalItems(),	       prefix );
 	setLabel( _ui->dirFileCountLabel,   dir->totalFiles(),	       prefix );
 	setLabel( _ui->dirSubDirCountLabel, dir->totalSubDirs(),       prefix );
@@ -410,8 +548,7 @@ void FileDetailsView::showDirNodeInfo( DirInfo * dir )
 	_ui->dirOwnSizeLabel->setVisible  ( dir->size() > 0 );
 	setLabel( _ui->dirOwnSizeLabel, dir->size() );
 
-	_ui->dirUserLabel->setText( dir->userName() );
-	_ui->dirGroupLabel->setText( dir->groupName() );
+	setOwnerLabels( dir, _ui->dirUserLabel, _ui->dirGroupLabel );
 	_ui->dirPermissionsLabel->setText( formatPermissions( dir->mode() ) );
 
 	_ui->dirMTimeCaption->setVisible( dir->mtime() > 0 );
@@ -582,6 +719,51 @@ void FileDetailsView::showSelectionSummary( const FileInfoSet & selectedItems )
     // logDebug() << "Showing selection summary" << endl;
 
     setCurrentPage( _ui->selectionSummaryPage );
+
+    if ( selectedItems.size() <= SELECTION_SUMMARY_SYNC_LIMIT )
+    {
+	_summaryItems.clear();
+	showSelectionTotals( selectedItems );
+	return;
+    }
+
+    // Summing up a large selection takes a while: Do that only when the
+    // UpdateScheduler has time for it. Moving through the tree meanwhile
+    // just replaces the pending selection.
+
+    _summaryItems = selectedItems;
+    clearSelectionTotals( "..." );
+    _summaryUpdate->request();
+}
+
+
+void FileDetailsView::updateSelectionSummary()
+{
+    if ( _summaryItems.isEmpty() )	// Meanwhile, something else is shown
+	return;
+
+    // Items might have been deleted meanwhile
+
+    FileInfoSet sel = _summaryItems.invalidRemoved();
+    _summaryItems.clear();
+
+    showSelectionTotals( sel );
+}
+
+
+void FileDetailsView::clearSelectionTotals( const QString & delayHint )
+{
+    _ui->selItemCount->clear();
+    _ui->selTotalSizeLabel->setText( delayHint );
+    _ui->selAllocatedLabel->clear();
+    _ui->selFileCountLabel->clear();
+    _ui->selDirCountLabel->clear();
+    _ui->selSubtreeFileCountLabel->clear();
+}
+
+
+void FileDetailsView::showSelectionTotals( const FileInfoSet & selectedItems )
+{
     FileInfoSet sel = selectedItems.normalized();
 
     int fileCount	 = 0;
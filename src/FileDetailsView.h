@@ -18,6 +18,7 @@ namespace QDirStat
 {
     class AdaptiveTimer;
     class PkgInfo;
+    class ScheduledUpdate;
 
     /**
      * Details view for the current selection (file, directory, multiple
@@ -123,10 +124,23 @@ namespace QDirStat
     protected slots:
 
 	/**
-	 * Update package information via the AdaptiveTimer.
+	 * Update package information via the AdaptiveTimer. This only
+	 * starts the query; the label is updated when the package manager
+	 * command is finished.
 	 **/
 	void updatePkgInfo( const QVariant & path );
 
+	/**
+	 * Show the owner names again: OwnerNames knows new names.
+	 **/
+	void updateOwnerLabels();
+
+	/**
+	 * Calculate and show the totals of the selection summary via the
+	 * UpdateScheduler.
+	 **/
+	void updateSelectionSummary();
+
 
     protected:
 
@@ -186,11 +200,26 @@ namespace QDirStat
 	void setFileAllocatedLabel( FileSizeLabel * label,
 				    FileInfo *	    file );
 
+	/**
+	 * Add the exclusive part of the allocated size of 'item' to the
+	 * allocated size 'label' if some of it is shared with other files
+	 * (see DirTree::extentUsage()).
+	 **/
+	void addExtentUsage( FileSizeLabel * label, FileInfo * item );
+
 	/**
 	 * Set the text color for a label.
 	 **/
 	void setLabelColor( QLabel * label, const QColor & color );
 
+	/**
+	 * Show the user and group names of 'item' in 'userLabel' and
+	 * 'groupLabel' and remember them for updateOwnerLabels().
+	 **/
+	void setOwnerLabels( FileInfo * item,
+			     QLabel *	userLabel,
+			     QLabel *	groupLabel );
+
 
 	// Boilerplate widget setting methods
 
@@ -203,11 +232,21 @@ namespace QDirStat
 	void showDirNodeInfo( DirInfo * dir );
 	void setDirBlockVisibility( bool visible );
 
+	void showSelectionTotals( const FileInfoSet & selectedItems );
+	void clearSelectionTotals( const QString & delayHint );
+
 
 	// Data members
 
 	Ui::FileDetailsView * _ui;
 	AdaptiveTimer *	      _pkgUpdateTimer;
+	QString		      _pkgPath;	// the file that the package label is for
+	ScheduledUpdate *     _summaryUpdate;
+	FileInfoSet	      _summaryItems;	// the pending selection summary
+	QLabel *	      _userLabel;	// the last labels for setOwnerLabels()
+	QLabel *	      _groupLabel;
+	uid_t		      _uid;
+	gid_t		      _gid;
 	int		      _labelLimit;
 	QColor		      _dirReadErrColor;
 	QColor		      _normalTextColor;
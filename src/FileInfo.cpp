@@ -9,11 +9,11 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <pwd.h>	// getpwuid()
-#include <grp.h>	// getgrgid()
 #include <unistd.h>
 
 #include <QDateTime>
+#include <QVector>
+#include <QVarLengthArray>
 
 #include "FileInfo.h"
 #include "DirInfo.h"
@@ -21,6 +21,8 @@
 #include "Attic.h"
 #include "DirTree.h"
 #include "PkgInfo.h"
+#include "AggregateInfo.h"
+#include "OwnerNames.h"
 #include "SysUtil.h"
 #include "Logger.h"
 #include "Exception.h"
@@ -35,30 +37,46 @@
 using namespace QDirStat;
 
 
-bool FileInfo::_ignoreHardLinks = false;
+bool		 FileInfo::_ignoreHardLinks = false;
+const FileInfo * FileInfo::_urlCacheNode    = 0;
+QString		 FileInfo::_urlCache;
+
+
+namespace
+{
+    // See FileInfo::deviceIndex()
+    QVector<dev_t> deviceTable;
+}
 
 
 FileInfo::FileInfo( DirTree    * tree,
 		    DirInfo    * parent,
 		    const char * name )
     : _parent( parent )
-    , _next( 0 )
-    , _tree( tree )
-{
-    _isLocalFile   = true;
-    _isSparseFile  = false;
-    _isIgnored	   = false;
-    _name	   = name ? name : "";
-    _device	   = 0;
-    _mode	   = 0;
-    _links	   = 0;
-    _uid	   = 0;
-    _gid	   = 0;
-    _size	   = 0;
-    _blocks	   = 0;
-    _mtime	   = 0;
-    _allocatedSize = 0;
-    _magic	   = FileInfoMagic;
+    , _childPos( -1 )
+    , _mimeCategory( 0 )
+    , _mimeCategoryGeneration( 0 )
+{
+    Q_UNUSED( tree );
+
+    _isLocalFile     = true;
+    _isSparseFile    = false;
+    _isIgnored	     = false;
+    _allocatedIsSize = false;
+    _isIndexedLink   = false;
+    _isHardLinkCopy  = false;
+    _isSymLinkChecked = false;
+    _isBrokenSymLink  = false;
+    _name	     = name ? name : "";
+    _deviceIndex     = deviceIndex( 0 );
+    _mode	     = 0;
+    _links	     = 0;
+    _uid	     = 0;
+    _gid	     = 0;
+    _size	     = 0;
+    _blocks	     = 0;
+    _mtime	     = 0;
+    _magic	     = FileInfoMagic;
 }
 
 
@@ -67,23 +85,28 @@ FileInfo::FileInfo( const QString & filenameWithoutPath,
 		    DirTree	  * tree,
 		    DirInfo	  * parent )
     : _parent( parent )
-    , _next( 0 )
-    , _tree( tree )
+    , _childPos( -1 )
+    , _mimeCategory( 0 )
+    , _mimeCategoryGeneration( 0 )
 {
     CHECK_PTR( statInfo );
 
-    _isLocalFile   = true;
-    _isIgnored	   = false;
-    _name	   = filenameWithoutPath;
-
-    _device	   = statInfo->st_dev;
-    _mode	   = statInfo->st_mode;
-    _links	   = statInfo->st_nlink;
-    _uid	   = statInfo->st_uid;
-    _gid	   = statInfo->st_gid;
-    _mtime	   = statInfo->st_mtime;
-    _magic	   = FileInfoMagic;
-    _allocatedSize = 0;
+    _isLocalFile     = true;
+    _isIgnored	     = false;
+    _allocatedIsSize = false;
+    _isIndexedLink   = false;
+    _isHardLinkCopy  = false;
+    _isSymLinkChecked = false;
+    _isBrokenSymLink  = false;
+    _name	     = tree ? tree->internName( filenameWithoutPath ) : filenameWithoutPath;
+
+    _deviceIndex     = deviceIndex( statInfo->st_dev );
+    _mode	     = statInfo->st_mode;
+    _links	     = statInfo->st_nlink;
+    _uid	     = statInfo->st_uid;
+    _gid	     = statInfo->st_gid;
+    _mtime	     = statInfo->st_mtime;
+    _magic	     = FileInfoMagic;
 
     if ( isSpecial() )
     {
@@ -100,29 +123,26 @@ FileInfo::FileInfo( const QString & filenameWithoutPath,
 	{
 	    if ( ! filesystemCanReportBlocks() )
 	    {
-		_allocatedSize = _size;
+		_allocatedIsSize = true;
 
 		// Do not make any assumptions about fragment handling: The
 		// last block of the file might be partially unused, or the
 		// filesystem might do clever fragment handling, or it's an
 		// exported kernel table like /dev, /proc, /sys. So let's
-		// simply use the size reported by stat() for _allocatedSize.
+		// simply use the size reported by stat() for the allocated
+		// size.
 	    }
 	}
-	else
-	{
-	    _allocatedSize = _blocks * STD_BLOCK_SIZE;
-	}
 
 	_isSparseFile	= isFile()
 	    && _blocks >= 0
-	    && _allocatedSize + FRAGMENT_SIZE < _size; // allow for intelligent fragment handling
+	    && rawAllocatedSize() + FRAGMENT_SIZE < _size; // allow for intelligent fragment handling
 
 	if ( _isSparseFile )
 	{
 	    logDebug() << "Found sparse file: " << this
 		       << "    Byte size: " << formatSize( _size )
-		       << "  Allocated: " << formatSize( _allocatedSize )
+		       << "  Allocated: " << formatSize( rawAllocatedSize() )
 		       << " (" << (int) _blocks << " blocks)"
 		       << endl;
 	}
@@ -133,6 +153,16 @@ FileInfo::FileInfo( const QString & filenameWithoutPath,
 	    logDebug() << _links << " hard links: " << this << endl;
 	}
 #endif
+
+	if ( tree && isFile() && _links > 1 )
+	{
+	    // Count each inode only once in the totals
+
+	    _isIndexedLink  = true;
+	    _isHardLinkCopy = tree->hardLinkIndex()->add( this,
+							  statInfo->st_dev,
+							  statInfo->st_ino );
+	}
     }
 }
 
@@ -147,21 +177,26 @@ FileInfo::FileInfo( DirTree *	    tree,
 		    FileSize	    blocks,
 		    nlink_t	    links )
     : _parent( parent )
-    , _next( 0 )
-    , _tree( tree )
-{
-    _name	   = filenameWithoutPath;
-    _isLocalFile   = true;
-    _isIgnored	   = false;
-    _device	   = 0;
-    _mode	   = mode;
-    _size	   = size;
-    _mtime	   = mtime;
-    _allocatedSize = 0;
-    _links	   = links;
-    _uid	   = 0;
-    _gid	   = 0;
-    _magic	   = FileInfoMagic;
+    , _childPos( -1 )
+    , _mimeCategory( 0 )
+    , _mimeCategoryGeneration( 0 )
+{
+    _name	     = tree ? tree->internName( filenameWithoutPath ) : filenameWithoutPath;
+    _isLocalFile     = true;
+    _isIgnored	     = false;
+    _allocatedIsSize = false;
+    _isIndexedLink   = false;
+    _isHardLinkCopy  = false;
+    _isSymLinkChecked = false;
+    _isBrokenSymLink  = false;
+    _deviceIndex     = deviceIndex( 0 );
+    _mode	     = mode;
+    _size	     = size;
+    _mtime	     = mtime;
+    _links	     = links;
+    _uid	     = 0;
+    _gid	     = 0;
+    _magic	     = FileInfoMagic;
 
     if ( blocks < 0 )
     {
@@ -173,12 +208,13 @@ FileInfo::FileInfo( DirTree *	    tree,
 
 	// Don't make any assumptions about the file's tail. We might use
 	//
-	//   _allocatedSize = _blocks * STD_BLOCK_SIZE;
+	//   _blocks * STD_BLOCK_SIZE
 	//
-	// but that might be wrong if the filesystem has intelligent fragment
-	// handling. Simply use the byte size instead.
+	// as the allocated size, but that might be wrong if the filesystem
+	// has intelligent fragment handling. Simply use the byte size
+	// instead.
 
-	_allocatedSize = _size;
+	_allocatedIsSize = true;
     }
     else
     {
@@ -186,6 +222,12 @@ FileInfo::FileInfo( DirTree *	    tree,
 	_blocks		= blocks;
     }
 
+    // Without an inode number, the size can only be distributed over all
+    // links, wherever they are
+
+    if ( tree && S_ISREG( mode ) && links > 1 )
+	tree->hardLinkIndex()->addUnknown();
+
     // logDebug() << "Created FileInfo " << this << endl;
 }
 
@@ -207,6 +249,47 @@ FileInfo::~FileInfo()
 }
 
 
+DirTree * FileInfo::tree() const
+{
+    return _parent ? _parent->tree() : 0;
+}
+
+
+FileInfo * FileInfo::next() const
+{
+    return _parent ? _parent->childAfter( this ) : 0;
+}
+
+
+quint32 FileInfo::deviceIndex( dev_t dev )
+{
+    // Almost all nodes are on the same device as the previous one
+
+    static quint32 lastIndex = 0;
+
+    if ( lastIndex < (quint32) deviceTable.size() && deviceTable.at( lastIndex ) == dev )
+	return lastIndex;
+
+    int index = deviceTable.indexOf( dev );
+
+    if ( index < 0 )
+    {
+	index = deviceTable.size();
+	deviceTable.append( dev );
+    }
+
+    lastIndex = index;
+
+    return lastIndex;
+}
+
+
+dev_t FileInfo::deviceByIndex( quint32 index )
+{
+    return index < (quint32) deviceTable.size() ? deviceTable.at( index ) : 0;
+}
+
+
 bool FileInfo::checkMagicNumber() const
 {
     return _magic == FileInfoMagic;
@@ -215,10 +298,10 @@ bool FileInfo::checkMagicNumber() const
 
 FileSize FileInfo::size() const
 {
-    FileSize sz = _isSparseFile ? _allocatedSize : _size;
+    FileSize sz = _isSparseFile ? rawAllocatedSize() : _size;
 
     if ( _links > 1 && ! _ignoreHardLinks && isFile() )
-	sz /= _links;
+	sz = hardLinkShare( sz );
 
     return sz;
 }
@@ -226,22 +309,34 @@ FileSize FileInfo::size() const
 
 FileSize FileInfo::allocatedSize() const
 {
-    FileSize sz = _allocatedSize;
+    FileSize sz = rawAllocatedSize();
 
     if ( _links > 1 && ! _ignoreHardLinks && isFile() )
-	sz /= _links;
+	sz = hardLinkShare( sz );
 
     return sz;
 }
 
 
+FileSize FileInfo::hardLinkShare( FileSize sz ) const
+{
+    if ( _isIndexedLink )
+	return _isHardLinkCopy ? 0LL : sz;
+
+    return sz / _links;
+}
+
+
 int FileInfo::usedPercent() const
 {
     int percent = 100;
 
-    if ( _allocatedSize > 0 && _size > 0 )
+    if ( rawAllocatedSize() > 0 && _size > 0 )
     {
-        percent = qRound( ( 100.0 * size() ) / allocatedSize() );
+	// Not size() / allocatedSize(): Both are 0 for a hard link copy
+
+	FileSize sz = _isSparseFile ? rawAllocatedSize() : _size;
+        percent = qRound( ( 100.0 * sz ) / rawAllocatedSize() );
     }
 
     return percent;
@@ -250,20 +345,71 @@ int FileInfo::usedPercent() const
 
 QString FileInfo::url() const
 {
-    if ( _parent )
-    {
-	QString parentUrl = _parent->url();
+    QString result;
+    appendUrl( result );
+
+    return result;
+}
+
+
+void FileInfo::appendUrl( QString & buffer, bool useCache ) const
+{
+    // Collect this item and its ancestors up to the toplevel item, a
+    // package (which has a url() of its own) or the cached directory
+
+    QVarLengthArray<const FileInfo *, 64> chain;
+    const FileInfo * item = this;
 
-	if ( isPseudoDir() ) // don't append "/." for dot entries and attics
-	    return parentUrl;
+    while ( item )
+    {
+	chain.append( item );
 
-	if ( ! parentUrl.endsWith( "/" ) && ! _name.startsWith( "/" ) )
-	    parentUrl += "/";
+	if ( ( useCache && item == _urlCacheNode ) || item->isPkgInfo() || ! item->parent() )
+	    break;
 
-	return parentUrl + _name;
+	item = item->parent();
     }
+
+    const FileInfo * top = chain.last();
+    int start = buffer.size();
+
+    if ( useCache && top == _urlCacheNode )
+	buffer += _urlCache;
+    else if ( top->isPkgInfo() )
+	buffer += top->url();
     else
-	return _name;
+	buffer += top->name();
+
+    // Now append the rest front to back, just like the parent's URL plus
+    // "/" plus the name
+
+    for ( int i = chain.size() - 2; i >= 0; --i )
+    {
+	const FileInfo * node = chain[ i ];
+
+	if ( ! node->isPseudoDir() ) // don't append "/." for dot entries and attics
+	{
+	    if ( ! buffer.endsWith( "/" ) && ! node->_name.startsWith( "/" ) )
+		buffer += "/";
+
+	    buffer += node->_name;
+	}
+
+	if ( useCache && i == 1 && node != _urlCacheNode && ! node->isPkgInfo() )
+	{
+	    // Cache the parent's URL for the next item in the same directory
+
+	    _urlCacheNode = node;
+	    _urlCache	  = buffer.mid( start );
+	}
+    }
+}
+
+
+void FileInfo::dropUrlCache()
+{
+    _urlCacheNode = 0;
+    _urlCache.clear();
 }
 
 
@@ -291,7 +437,9 @@ QString FileInfo::path() const
 
 QString FileInfo::debugUrl() const
 {
-    if ( _tree && this == _tree->root() )
+    DirTree * dirTree = tree();
+
+    if ( dirTree && this == dirTree->root() )
 	return "<root>";
 
     if ( isDotEntry() )
@@ -301,7 +449,7 @@ QString FileInfo::debugUrl() const
     {
 	if ( _parent )
 	{
-	    if ( _tree && _parent != _tree->root() )
+	    if ( dirTree && _parent != dirTree->root() )
 		return _parent->debugUrl() + "/" + atticName();
 	}
 
@@ -351,16 +499,28 @@ bool FileInfo::isInSubtree( const FileInfo *subtree ) const
 
 FileInfo * FileInfo::locate( QString url, bool findPseudoDirs )
 {
-    if ( ! _tree )
+    DirTree * dirTree = tree();
+
+    if ( ! dirTree )
 	return 0;
 
     FileInfo * result = 0;
 
-    if ( ! url.startsWith( _name ) && this != _tree->root() )
+    // The toplevel directory of a cache file that was read below another
+    // directory has its complete path as its name, but the parent already
+    // removed the leading delimiter (see DirTree::readCaches())
+
+    if ( _name.startsWith( "/" ) && ! url.startsWith( "/" ) &&
+	 _parent && _parent != dirTree->root() )
+    {
+	url.prepend( "/" );
+    }
+
+    if ( ! url.startsWith( _name ) && this != dirTree->root() )
 	return 0;
     else					// URL starts with this node's name
     {
-	if ( this != _tree->root() )		// The root item is invisible
+	if ( this != dirTree->root() )		// The root item is invisible
 	{
 	    url.remove( 0, _name.length() );	// Remove leading name of this node
 
@@ -382,16 +542,12 @@ FileInfo * FileInfo::locate( QString url, bool findPseudoDirs )
 
 	// Search all children
 
-	FileInfo * child = firstChild();
-
-	while ( child )
+	if ( isDirInfo() )
 	{
-	    FileInfo * foundChild = child->locate( url, findPseudoDirs );
+	    FileInfo * foundChild = toDirInfo()->locateChild( url, findPseudoDirs );
 
 	    if ( foundChild )
 		return foundChild;
-	    else
-		child = child->next();
 	}
 
 
@@ -422,22 +578,7 @@ FileInfo * FileInfo::locate( QString url, bool findPseudoDirs )
 	if ( dotEntry() &&
 	     ! url.contains( "/" ) )	   // No (more) "/" in this URL
 	{
-            // logDebug() << "Searching DotEntry for " << url << " in " << this << endl;
-
-            child = dotEntry()->firstChild();
-
-            while ( child )
-            {
-                if ( child->name() == url )
-                {
-                    // logDebug() << "Found " << url << " in " << dotEntry() << endl;
-                    return child;
-                }
-
-                child = child->next();
-            }
-
-            // logDebug() << "Cant find " << url << " in DotEntry" << endl;
+	    result = dotEntry()->findChild( url );
 	}
 
 	if ( ! result && attic() )
@@ -514,12 +655,7 @@ QString FileInfo::userName() const
     if ( ! hasUid() )
 	return QString();
 
-    struct passwd * pw = getpwuid( uid() );
-
-    if ( pw )
-	return pw->pw_name;
-    else
-	return QString::number( uid() );
+    return OwnerNames::userName( uid() );
 }
 
 
@@ -528,12 +664,7 @@ QString FileInfo::groupName() const
     if ( ! hasGid() )
 	return QString();
 
-    struct group * grp = getgrgid( gid() );
-
-    if ( grp )
-	return grp->gr_name;
-    else
-	return QString::number( gid() );
+    return OwnerNames::groupName( gid() );
 }
 
 
@@ -674,6 +805,14 @@ PkgInfo * FileInfo::toPkgInfo()
 }
 
 
+AggregateInfo * FileInfo::toAggregate()
+{
+    AggregateInfo * aggregate = dynamic_cast<AggregateInfo *>( this );
+
+    return aggregate;
+}
+
+
 PkgInfo * FileInfo::pkgInfoParent() const
 {
     FileInfo * pkg = _parent;
@@ -718,6 +857,9 @@ bool FileInfo::isBrokenSymLink()
     if ( ! isSymLink() )
         return false;
 
+    if ( _isSymLinkChecked )
+        return _isBrokenSymLink;
+
     return SysUtil::isBrokenSymLink( url() );
 }
 
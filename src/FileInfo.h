@@ -19,6 +19,7 @@
 #include <QList>
 
 #include "Logger.h"
+#include "NodePool.h"
 
 // The size of a standard disk block.
 //
@@ -43,6 +44,7 @@ namespace QDirStat
     class DotEntry;
     class Attic;
     class PkgInfo;
+    class AggregateInfo;
     class DirTree;
 
 
@@ -160,6 +162,19 @@ namespace QDirStat
 	 **/
 	virtual QString url() const;
 
+	/**
+	 * Append the full URL of this object to 'buffer'. This is what url()
+	 * uses; call this directly to reuse the same buffer for many items.
+	 *
+	 * This builds the URL front to back without any recursion. The URL
+	 * of the parent of the last item is cached, so this is cheap for
+	 * each further item in the same directory.
+	 *
+	 * Without 'useCache', the cached URL is neither used nor changed, so
+	 * this can be called from worker threads.
+	 **/
+	void appendUrl( QString & buffer, bool useCache = true ) const;
+
 	/**
 	 * Returns the full path of this object. Unlike url(), this never has a
 	 * protocol prefix or a part that identifies the package this belongs
@@ -189,7 +204,7 @@ namespace QDirStat
 	 * Returns the major and minor device numbers of the device this file
 	 * resides on or 0 if this is a remote file.
 	 **/
-	dev_t device() const { return _device; }
+	dev_t device() const { return deviceByIndex( _deviceIndex ); }
 
 	/**
 	 * The file permissions and object type as returned by lstat().
@@ -269,8 +284,10 @@ namespace QDirStat
 	/**
 	 * The file size, taking into account multiple links for plain files or
 	 * the true allocated size for sparse files. For plain files with
-	 * multiple links this will be size/no_links, for sparse files it is
-	 * the number of bytes actually allocated.
+	 * multiple links this is the full size for the first link found in
+	 * the tree and 0 for the others (see isHardLinkCopy()), or size /
+	 * no_links if the inode is unknown (from a cache file); for sparse
+	 * files it is the number of bytes actually allocated.
 	 **/
 	FileSize size() const;
 
@@ -312,7 +329,8 @@ namespace QDirStat
 	 * If the filesystem can properly report the number of disk blocks
 	 * used, this is the same as blocks() * 512.
 	 **/
-	FileSize rawAllocatedSize() const { return _allocatedSize; }
+	FileSize rawAllocatedSize() const
+	    { return _allocatedIsSize ? _size : _blocks * STD_BLOCK_SIZE; }
 
 	/**
 	 * The file size in 512 byte blocks.
@@ -403,6 +421,14 @@ namespace QDirStat
 	 **/
 	virtual int errSubDirCount() { return 0; }
 
+	/**
+	 * Returns the number of directories in this subtree (including this
+	 * item) whose totals are only estimated (see DirInfo::isEstimated()).
+	 *
+	 * Derived classes that have children should overwrite this.
+	 **/
+	virtual int estimatedDirCount() { return 0; }
+
 	/**
 	 * Returns the latest modification time of this subtree.
 	 * Derived classes that have children should overwrite this.
@@ -506,10 +532,27 @@ namespace QDirStat
 	// Tree management
 	//
 
+	/**
+	 * Allocate nodes from the NodePool: There are millions of them, and
+	 * they are all deleted together.
+	 **/
+	static void * operator new( size_t size )
+	    { return NodePool::allocate( size ); }
+
+	/**
+	 * Return a node to the NodePool. Since the destructor is virtual,
+	 * 'size' is the size of the most derived class.
+	 **/
+	static void operator delete( void * ptr, size_t size )
+	    { NodePool::release( ptr, size ); }
+
 	/**
 	 * Returns a pointer to the DirTree this entry belongs to.
+	 *
+	 * Only directories store that pointer; everything else gets it from
+	 * its parent, so this returns 0 for a file that has no parent (yet).
 	 **/
-	DirTree * tree() const { return _tree; }
+	virtual DirTree * tree() const;
 
 	/**
 	 * Returns a pointer to this entry's parent entry or 0 if there is
@@ -520,18 +563,38 @@ namespace QDirStat
 	/**
 	 * Set the "parent" pointer.
 	 **/
-	void setParent( DirInfo *newParent ) { _parent = newParent; }
+	void setParent( DirInfo *newParent )
+	{
+	    if ( _parent && _parent != newParent ) // Moving: The URLs below change
+		dropUrlCache();
+
+	    _parent = newParent;
+	}
+
+	/**
+	 * Drop the cached URL that appendUrl() keeps. This is done
+	 * automatically when a node is moved or a directory is deleted.
+	 **/
+	static void dropUrlCache();
 
 	/**
 	 * Returns a pointer to the next entry on the same level
 	 * or 0 if there is none.
 	 **/
-	FileInfo * next() const { return _next;	  }
+	FileInfo * next() const;
+
+	/**
+	 * Return the position of this entry in the children vector of its
+	 * parent or -1 if it is not in any (dot entries, attics).
+	 * Only DirInfo should use this.
+	 **/
+	int childPos() const { return _childPos; }
 
 	/**
-	 * Set the "next" pointer.
+	 * Set the position in the children vector of the parent.
+	 * Only DirInfo should use this.
 	 **/
-	void  setNext( FileInfo *newNext ) { _next = newNext; }
+	void setChildPos( int pos ) { _childPos = pos; }
 
 	/**
 	 * Returns the first child of this item or 0 if there is none.
@@ -541,16 +604,6 @@ namespace QDirStat
 	 **/
 	virtual FileInfo * firstChild() const { return 0; }
 
-	/**
-	 * Set this entry's first child.
-	 * Use this method only if you know exactly what you are doing.
-	 *
-	 * This default implementation does nothing.
-	 * Derived classes might want to overwrite this.
-	 **/
-	virtual void setFirstChild( FileInfo *newFirstChild )
-	    { Q_UNUSED( newFirstChild ); }
-
 	/**
 	 * Returns true if this entry has any children.
 	 **/
@@ -733,6 +786,15 @@ namespace QDirStat
 	 **/
 	virtual bool isPkgInfo() const { return false; }
 
+	/**
+	 * Returns true if this is an AggregateInfo object: A pseudo item
+	 * for the small files of a directory (see
+	 * DirTree::setAggregateFilesBelow()).
+	 *
+	 * This default implementation always returns 'false'.
+	 **/
+	virtual bool isAggregate() const { return false; }
+
 	/**
 	 * Try to convert this to a DirInfo pointer. This returns null if this
 	 * is not a DirInfo.
@@ -757,6 +819,12 @@ namespace QDirStat
 	 **/
 	PkgInfo * toPkgInfo();
 
+	/**
+	 * Try to convert this to an AggregateInfo pointer. This returns null
+	 * if this is not an AggregateInfo.
+	 **/
+	AggregateInfo * toAggregate();
+
 	/**
 	 * Returns true if this is a sparse file, i.e. if this file has
 	 * actually fewer disk blocks allocated than its byte size would call
@@ -787,6 +855,36 @@ namespace QDirStat
 	 **/
 	void setIgnored( bool ignored ) { _isIgnored = ignored; }
 
+	/**
+	 * Returns true if this is a plain file with multiple links, and
+	 * another link to the same inode was found in the tree before, so
+	 * that one counts the size and this one doesn't (see
+	 * HardLinkIndex).
+	 **/
+	bool isHardLinkCopy() const { return _isHardLinkCopy; }
+
+	/**
+	 * Set the "hard link copy" flag. Notice that this only sets the flag;
+	 * whoever calls this needs to take care of the totals of the
+	 * ancestors.
+	 **/
+	void setHardLinkCopy( bool copy ) { _isHardLinkCopy = copy; }
+
+	/**
+	 * Return the MIME category that MimeCategorizer cached for this item
+	 * if 'generation' is still the categorizer's generation: 1 for none,
+	 * 2 for the first category etc., 0 if there is nothing cached.
+	 **/
+	int cachedMimeCategory( quint16 generation ) const
+	    { return _mimeCategoryGeneration == generation ? _mimeCategory : 0; }
+
+	/**
+	 * Cache the MIME category of this item for MimeCategorizer. This
+	 * uses space that would otherwise be padding.
+	 **/
+	void setCachedMimeCategory( int category, quint16 generation )
+	    { _mimeCategory = category; _mimeCategoryGeneration = generation; }
+
 	/**
 	 * Return the nearest PkgInfo parent or 0 if there is none.
 	 **/
@@ -856,12 +954,26 @@ namespace QDirStat
          * i.e. it does not check if the target is also a symlink if the target
          * of that also exists.
          *
-         * Intentionally not declaring this as 'const' since this might some
-         * day use cached information and do lazy initialization on its first
-         * call.
+         * If the target was already checked while reading the directory
+         * (see setBrokenSymLink()), this only returns that result;
+         * otherwise it checks the target now.
          **/
         bool isBrokenSymLink();
 
+        /**
+         * Return 'true' if the target of this symlink was checked while
+         * reading the directory, i.e. if isBrokenSymLink() does not need
+         * any system calls.
+         **/
+        bool isSymLinkChecked() const { return _isSymLinkChecked; }
+
+        /**
+         * Set the result of checking the target of this symlink (see
+         * LocalDirReader::setResolveSymLinks()).
+         **/
+        void setBrokenSymLink( bool broken )
+            { _isSymLinkChecked = true; _isBrokenSymLink = broken; }
+
         /**
          * Return the (direct) target path if this is a symlink. This does not
          * follow multiple symlink indirections, only the direct target.
@@ -907,29 +1019,63 @@ namespace QDirStat
 	// Data members.
 	//
 	// Keep this short in order to use as little memory as possible -
-	// there will be a _lot_ of entries of this kind!
+	// there will be a _lot_ of entries of this kind! The members are
+	// ordered by size so there are no padding holes.
 
-	short		_magic;			// magic number to detect if this object is valid
 	QString		_name;			// the file name (without path!)
-	bool		_isLocalFile  :1;	// flag: local or remote file?
-	bool		_isSparseFile :1;	// (cache) flag: sparse file (file with "holes")?
-	bool		_isIgnored    :1;	// flag: ignored by rule?
-	dev_t		_device;		// device this object resides on
-	mode_t		_mode;			// file permissions + object type
-	nlink_t		_links;			// number of links
-	uid_t		_uid;			// User ID of owner
-	gid_t		_gid;			// Group ID of owner
 	FileSize	_size;			// size in bytes
 	FileSize	_blocks;		// 512 bytes blocks
 	time_t		_mtime;			// modification time
-	FileSize	_allocatedSize;		// allocated size in bytes
 
 	DirInfo	 *	_parent;		// pointer to the parent entry
-	FileInfo *	_next;			// pointer to the next entry
-	DirTree	 *	_tree;			// pointer to the parent tree
+
+	mode_t		_mode;			// file permissions + object type
+	uid_t		_uid;			// User ID of owner
+	gid_t		_gid;			// Group ID of owner
+	quint32		_links;			// number of links
+	quint32		_deviceIndex;		// device this object resides on (see deviceIndex())
+	int		_childPos;		// position in the parent's children vector
+	short		_magic;			// magic number to detect if this object is valid
+	bool		_isLocalFile	 :1;	// flag: local or remote file?
+	bool		_isSparseFile	 :1;	// (cache) flag: sparse file (file with "holes")?
+	bool		_isIgnored	 :1;	// flag: ignored by rule?
+	bool		_allocatedIsSize :1;	// allocated size is _size, not _blocks * 512
+	bool		_isIndexedLink	 :1;	// flag: in the tree's HardLinkIndex?
+	bool		_isHardLinkCopy	 :1;	// flag: another link counts the size
+	bool		_isSymLinkChecked :1;	// flag: _isBrokenSymLink is known
+	bool		_isBrokenSymLink :1;	// (cache) flag: symlink target missing
+	quint8		_mimeCategory;		// see cachedMimeCategory()
+	quint16		_mimeCategoryGeneration;
 
 	static bool	_ignoreHardLinks;	// don't distribute size for multiple hard links
 
+	// The directory whose URL appendUrl() cached last and that URL. Nodes
+	// are only used in the main thread, so this does not need locking.
+	static const FileInfo * _urlCacheNode;
+	static QString		_urlCache;
+
+	/**
+	 * Return the index of device 'dev' in the device table, adding it if
+	 * it is not there yet. Storing that index instead of the dev_t in
+	 * each node saves memory: There are only a handful of different
+	 * devices even in the largest trees.
+	 *
+	 * The device table is not thread-safe; nodes are only created in the
+	 * main thread.
+	 **/
+	static quint32 deviceIndex( dev_t dev );
+
+	/**
+	 * Return the device with index 'index' in the device table.
+	 **/
+	static dev_t deviceByIndex( quint32 index );
+
+	/**
+	 * Return the part of 'sz' that this file with multiple hard links
+	 * counts for.
+	 **/
+	FileSize hardLinkShare( FileSize sz ) const;
+
     };	// class FileInfo
 
 
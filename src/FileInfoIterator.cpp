@@ -14,9 +14,37 @@
 #include "DotEntry.h"
 #include "Exception.h"
 
+// Children that FileInfoSortedBySizeIterator sorts right away; the rest is
+// only sorted when it is needed
+#define SIZE_ITERATOR_FIRST_BATCH	256
+
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * Comparison of size sort keys: By size, then by position.
+     **/
+    struct SizeKeyLess
+    {
+	SizeKeyLess( Qt::SortOrder sortOrder ):
+	    _sortOrder( sortOrder )
+	    {}
+
+	bool operator() ( const FileInfoSortKey & a, const FileInfoSortKey & b ) const
+	{
+	    if ( a.num != b.num )
+		return _sortOrder == Qt::AscendingOrder ? a.num < b.num : a.num > b.num;
+
+	    return a.pos < b.pos;
+	}
+
+	Qt::SortOrder _sortOrder;
+    };
+}
+
+
 
 FileInfoIterator::FileInfoIterator( FileInfo * parent )
 {
@@ -103,30 +131,81 @@ int FileInfoIterator::count()
 
 FileInfoSortedBySizeIterator::FileInfoSortedBySizeIterator( FileInfo	  * parent,
 							    FileSize	    minSize,
-							    Qt::SortOrder   sortOrder )
+							    Qt::SortOrder   sortOrder,
+							    FileSize ( FileInfo::*totalSizeFunc )() ):
+    _sortOrder( sortOrder ),
+    _sortedCount( 0 ),
+    _batchSize( SIZE_ITERATOR_FIRST_BATCH ),
+    _currentIndex( 0 )
 {
-    _currentIndex = 0;
     FileInfoIterator it( parent );
 
+    // Get each total size only once instead of in each comparison
+
     while ( *it )
     {
-	if ( (*it)->totalSize() >= minSize )
-	    _sortedChildren << *it;
+	FileSize size = ( (*it)->*totalSizeFunc )();
+
+	if ( size >= minSize )
+	{
+	    FileInfoSortKey key;
+	    key.item	 = *it;
+	    key.num	 = size;
+	    key.dbl	 = 0.0;
+	    key.rank	 = 0;
+	    key.nameRank = 0;
+	    key.pos	 = _keys.size();
+	    _keys << key;
+	}
 
 	++it;
     }
 
-    std::stable_sort( _sortedChildren.begin(),
-		      _sortedChildren.end(),
-		      FileInfoSorter( SizeCol, sortOrder ) );
+    sortNextBatch();
+}
+
+
+void FileInfoSortedBySizeIterator::sortNextBatch()
+{
+    int remaining = _keys.size() - _sortedCount;
+
+    if ( remaining <= 0 )
+	return;
+
+    if ( _sortedCount == 0 && remaining <= _batchSize )
+    {
+	// With all names empty, this keeps items of the same size in their
+	// previous order like std::stable_sort() with FileInfoSorter
+
+	FileInfoKeySorter::sort( _keys, SizeCol, _sortOrder );
+	_sortedCount = _keys.size();
+	return;
+    }
+
+    // Same order as above: Items of the same size by position
+
+    SizeKeyLess less( _sortOrder );
+    FileInfoSortKeyList::iterator begin = _keys.begin() + _sortedCount;
 
+    if ( remaining > _batchSize )
+    {
+	std::nth_element( begin, begin + _batchSize, _keys.end(), less );
+	remaining = _batchSize;
+
+	// If the caller needs even more, it probably needs all of them
+
+	_batchSize *= 2;
+    }
+
+    std::sort( begin, begin + remaining, less );
+    _sortedCount += remaining;
 }
 
 
 FileInfo * FileInfoSortedBySizeIterator::current()
 {
-    if ( _currentIndex >= 0 && _currentIndex < _sortedChildren.size() )
-	return _sortedChildren.at( _currentIndex );
+    if ( _currentIndex >= 0 && _currentIndex < _sortedCount )
+	return _keys.at( _currentIndex ).item;
     else
 	return 0;
 }
@@ -137,7 +216,12 @@ void FileInfoSortedBySizeIterator::next()
     // Intentionally letting _currentIndex move one position after the last so
     // current() will return 0 to indicate we are finished.
 
-    if ( _currentIndex < _sortedChildren.size() )
+    if ( _currentIndex < _keys.size() )
+    {
 	_currentIndex++;
+
+	if ( _currentIndex == _sortedCount )
+	    sortNextBatch();
+    }
 }
 
@@ -13,6 +13,7 @@
 
 #include <QList>
 #include "FileInfo.h"
+#include "FileInfoSorter.h"
 
 
 namespace QDirStat
@@ -106,17 +107,27 @@ namespace QDirStat
     };	// class FileInfoIterator
 
 
+    /**
+     * Iterator class for the children of a FileInfo object sorted by size.
+     *
+     * The children are not sorted all at once, only one batch after the
+     * other as they are needed: A caller that stops after the biggest ones
+     * (like the treemap when the rest is too small for any visible tile)
+     * only needs a linear pass over the rest.
+     **/
     class FileInfoSortedBySizeIterator
     {
     public:
 
 	/**
 	 * Constructor. Children below 'minSize' will be ignored by this
-	 * iterator.
+	 * iterator. 'totalSizeFunc' is the size that they are sorted by,
+	 * e.g. &FileInfo::totalAllocatedSize.
 	 **/
 	FileInfoSortedBySizeIterator( FileInfo	    * parent,
 				      FileSize	      minSize	= 0,
-				      Qt::SortOrder   sortOrder = Qt::DescendingOrder );
+				      Qt::SortOrder   sortOrder = Qt::DescendingOrder,
+				      FileSize ( FileInfo::*totalSizeFunc )() = &FileInfo::totalSize );
 
 	/**
 	 * Return the current child object or 0 if there is no more.
@@ -143,12 +154,47 @@ namespace QDirStat
 	/**
 	 * Return the number of items that will be processed.
 	 **/
-	int count() { return _sortedChildren.size(); }
+	int count() { return _keys.size(); }
+
+	/**
+	 * Return the position of the current child in the sorted order.
+	 **/
+	int index() const { return _currentIndex; }
+
+	/**
+	 * Return the size of the current child that it is sorted by or 0 if
+	 * there is no more.
+	 **/
+	FileSize currentSize() const
+	    { return _currentIndex < _sortedCount ? _keys.at( _currentIndex ).num : 0; }
+
+	/**
+	 * Return the child at position 'index' in the sorted order. Only
+	 * use this for children that the iterator has already been at.
+	 **/
+	FileInfo * at( int index ) const { return _keys.at( index ).item; }
+
+	/**
+	 * Return the size of the child at position 'index' that it is
+	 * sorted by. Only use this for children that the iterator has
+	 * already been at.
+	 **/
+	FileSize sizeAt( int index ) const { return _keys.at( index ).num; }
 
     protected:
 
-	FileInfoList _sortedChildren;
-	int	     _currentIndex;
+	/**
+	 * Sort the next batch of children after the ones that are already
+	 * sorted.
+	 **/
+	void sortNextBatch();
+
+
+	FileInfoSortKeyList _keys;
+	Qt::SortOrder	    _sortOrder;
+	int		    _sortedCount;
+	int		    _batchSize;
+	int		    _currentIndex;
     }; //
 
 } // namespace QDirStat
@@ -7,6 +7,9 @@
  */
 
 
+#include <QHash>
+#include <QVector>
+
 #include "FileInfoSet.h"
 #include "FileInfo.h"
 #include "DirInfo.h"
@@ -31,13 +34,89 @@ bool FileInfoSet::containsAncestorOf( FileInfo * item ) const
 }
 
 
+namespace
+{
+    typedef QHash<const FileInfo *, bool> NodeFlags;
+
+
+    /**
+     * Walk up from 'node' until 'isEnd' returns 'true' for a node (the
+     * result is 'true') or until the top (the result is 'false'), stopping
+     * early at any node that is already in 'flags'. Remember the result
+     * for all nodes on the way in 'flags'.
+     **/
+    template<typename EndCheck>
+    bool walkUp( const FileInfo * node, NodeFlags & flags, EndCheck isEnd )
+    {
+	QVector<const FileInfo *> path;
+	bool result = false;
+
+	while ( node )
+	{
+	    NodeFlags::const_iterator it = flags.constFind( node );
+
+	    if ( it != flags.constEnd() )
+	    {
+		result = it.value();
+		break;
+	    }
+
+	    path << node;
+
+	    if ( isEnd( node ) )
+	    {
+		result = true;
+		break;
+	    }
+
+	    node = node->parent();
+	}
+
+	foreach ( const FileInfo * pathNode, path )
+	    flags.insert( pathNode, result );
+
+	return result;
+    }
+
+
+    /**
+     * Return 'true' if 'node' or any of its ancestors is in 'set'.
+     **/
+    bool isInSetOrBelow( const FileInfo * node, const FileInfoSet & set, NodeFlags & inSet )
+    {
+	return walkUp( node, inSet, [&set]( const FileInfo * ancestor )
+	    { return set.contains( const_cast<FileInfo *>( ancestor ) ); } );
+    }
+
+
+    /**
+     * Return 'true' if 'item' is still part of its tree, i.e. if its root
+     * is an ancestor.
+     **/
+    bool isInTree( const FileInfo * item, NodeFlags & inTree )
+    {
+	const FileInfo * root = item->tree()->root();
+
+	return walkUp( item, inTree, [root]( const FileInfo * ancestor )
+	    { return ancestor == root; } );
+    }
+
+}	// namespace
+
+
 FileInfoSet FileInfoSet::normalized() const
 {
+    // Instead of walking up to the root from each item, remember for each
+    // node on the way if it or any of its ancestors is in the set: The
+    // items of a large selection share most of their ancestors, so each
+    // node is only visited once.
+
+    NodeFlags inSet;
     FileInfoSet normalized;
 
     foreach ( FileInfo * item, *this )
     {
-	if ( ! containsAncestorOf( item ) )
+	if ( ! item || ! isInSetOrBelow( item->parent(), *this, inSet ) )
 	    normalized << item;
 #if 0
 	else
@@ -51,11 +130,17 @@ FileInfoSet FileInfoSet::normalized() const
 
 FileInfoSet FileInfoSet::invalidRemoved() const
 {
+    NodeFlags inTree;
     FileInfoSet result;
 
     foreach ( FileInfo * item, *this )
     {
-	if ( item && item->checkMagicNumber() )
+	// The nodes of a deleted subtree are freed in the background (see
+	// DirTree::deleteSubtree()); until then, they are only detached from
+	// the tree.
+
+	if ( item && item->checkMagicNumber() &&
+	     ( ! item->tree() || isInTree( item, inTree ) ) )
 	{
 	    // logDebug() << "Keeping " << item << endl;
 	    result << item;
@@ -108,7 +108,8 @@ namespace QDirStat
 
 	/**
 	 * Return a set with all the invalid items removed, i.e. without items
-	 * where checkMagicNumber() returns 'false'.
+	 * where checkMagicNumber() returns 'false' or that are no longer
+	 * part of their tree.
 	 *
 	 * If there is reason to believe that any items of the set might have
 	 * become invalid, call this first before any other operations.
@@ -7,12 +7,103 @@
  */
 
 
+#include <string.h>	// memcpy(), memset()
 #include <algorithm>
+#include <QObject>
 #include "FileInfoSorter.h"
+#include "DirTree.h"
+#include "DirTreeDiff.h"
+#include "SizeHistory.h"
+
+// Lists with at least this many items are sorted by numeric columns with a
+// radix sort
+#define RADIX_SORT_MIN_ITEMS	1024
 
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * One item for the radix sort: The value of its sort column
+     * transformed so it sorts correctly as an unsigned number, and its
+     * index in the list of sort keys.
+     **/
+    struct RadixItem
+    {
+	quint64 key;
+	int	index;
+    };
+
+
+    inline quint64 orderedBits( qint64 value )
+    {
+	return (quint64) value ^ 0x8000000000000000ULL;
+    }
+
+
+    inline quint64 orderedBits( double value )
+    {
+	quint64 bits;
+	memcpy( &bits, &value, sizeof( bits ) );
+
+	// Negative numbers: All bits inverted; positive: Just the sign bit
+
+	return ( bits & 0x8000000000000000ULL ) ?
+	    ~bits : bits | 0x8000000000000000ULL;
+    }
+
+
+    /**
+     * Stable LSD radix sort of 'items' by their key, one byte at a time.
+     * Bytes that are the same in all keys (like the upper bytes of sizes)
+     * are skipped.
+     **/
+    void radixSort( QVector<RadixItem> & items )
+    {
+	int count[ 8 ][ 256 ];
+	memset( count, 0, sizeof( count ) );
+
+	for ( int i = 0; i < items.size(); ++i )
+	{
+	    quint64 key = items.at( i ).key;
+
+	    for ( int byte = 0; byte < 8; ++byte )
+		count[ byte ][ ( key >> ( 8 * byte ) ) & 0xFF ]++;
+	}
+
+	QVector<RadixItem> buffer( items.size() );
+
+	for ( int byte = 0; byte < 8; ++byte )
+	{
+	    int * byteCount = count[ byte ];
+	    int firstValue  = ( items.first().key >> ( 8 * byte ) ) & 0xFF;
+
+	    if ( byteCount[ firstValue ] == items.size() )
+		continue;
+
+	    int pos[ 256 ];
+	    int sum = 0;
+
+	    for ( int value = 0; value < 256; ++value )
+	    {
+		pos[ value ] = sum;
+		sum += byteCount[ value ];
+	    }
+
+	    for ( int i = 0; i < items.size(); ++i )
+	    {
+		const RadixItem & item = items.at( i );
+		buffer[ pos[ ( item.key >> ( 8 * byte ) ) & 0xFF ]++ ] = item;
+	    }
+
+	    items.swap( buffer );
+	}
+    }
+
+}	// namespace
+
+
 bool FileInfoSorter::operator() ( FileInfo * a, FileInfo * b )
 {
     if ( !a || !b ) return false;
@@ -55,6 +146,20 @@ bool FileInfoSorter::operator() ( FileInfo * a, FileInfo * b )
 	case GroupCol:		  return a->gid()	      < b->gid();
 	case PermissionsCol:	  return a->mode()	      < b->mode();
 	case OctalPermissionsCol: return a->mode()	      < b->mode();
+	case SizeDeltaCol:
+	    {
+		const DirTreeDiff * diff = a->tree() ? a->tree()->diff() : 0;
+
+		return diff && diff->sizeDelta( a ) < diff->sizeDelta( b );
+	    }
+
+	case SizeHistoryCol:
+	    {
+		const SizeHistory * history = a->tree() ? a->tree()->sizeHistory() : 0;
+
+		return history && history->trend( a->url() ).growth < history->trend( b->url() ).growth;
+	    }
+
 	case ReadJobsCol:	  return a->pendingReadJobs() < b->pendingReadJobs();
 	case UndefinedCol:	  return false;
 	    // Intentionally omitting the 'default' branch
@@ -63,3 +168,201 @@ bool FileInfoSorter::operator() ( FileInfo * a, FileInfo * b )
 
     return false;
 }
+
+
+
+bool FileInfoKeySorter::operator() ( const FileInfoSortKey & a, const FileInfoSortKey & b ) const
+{
+    // Primary sorting by the sort column in the sort order
+
+    const FileInfoSortKey & x = _sortOrder == Qt::DescendingOrder ? b : a;
+    const FileInfoSortKey & y = _sortOrder == Qt::DescendingOrder ? a : b;
+
+    if ( _sortCol == NameCol )
+    {
+	if ( x.nameRank != y.nameRank ) return x.nameRank < y.nameRank;
+	if ( x.name	!= y.name     ) return x.name	  < y.name;
+    }
+    else
+    {
+	if ( x.rank != y.rank ) return x.rank < y.rank;
+	if ( x.num  != y.num  ) return x.num  < y.num;
+	if ( x.dbl  != y.dbl  ) return x.dbl  < y.dbl;
+
+	// Secondary sorting by name (always in ascending order)
+
+	if ( a.nameRank != b.nameRank ) return a.nameRank < b.nameRank;
+	if ( a.name	!= b.name     ) return a.name	  < b.name;
+    }
+
+    return a.pos < b.pos;
+}
+
+
+FileInfoSortKeyList FileInfoKeySorter::createKeys( const FileInfoList & items, DataColumn sortCol )
+{
+    FileInfoSortKeyList keys;
+    keys.resize( items.size() );
+
+    const DirTreeDiff * diff = 0;
+
+    if ( sortCol == SizeDeltaCol && ! items.isEmpty() && items.first()->tree() )
+	diff = items.first()->tree()->diff();
+
+    const SizeHistory * history = 0;
+
+    if ( sortCol == SizeHistoryCol && ! items.isEmpty() && items.first()->tree() )
+	history = items.first()->tree()->sizeHistory();
+
+    for ( int i = 0; i < items.size(); ++i )
+    {
+	FileInfo * item	    = items.at( i );
+	FileInfoSortKey & key = keys[ i ];
+
+	key.item     = item;
+	key.num	     = 0;
+	key.dbl	     = 0.0;
+	key.rank     = 0;
+	key.nameRank = ( item->isIgnored() ? 2 : 0 ) + ( item->isDotEntry() ? 1 : 0 );
+	key.pos	     = i;
+	key.name     = item->name();
+
+	switch ( sortCol )
+	{
+	    case NameCol:	      break;
+	    case PercentBarCol:	      key.dbl = item->subtreePercent();	  break;
+	    case PercentNumCol:	      key.dbl = item->subtreePercent();	  break;
+	    case SizeCol:	      key.num = item->totalSize();	  break;
+	    case TotalItemsCol:	      key.num = item->totalItems();	  break;
+	    case TotalFilesCol:	      key.num = item->totalFiles();	  break;
+	    case TotalSubDirsCol:     key.num = item->totalSubDirs();	  break;
+	    case LatestMTimeCol:      key.num = item->latestMtime();	  break;
+	    case OldestFileMTimeCol:
+		key.num	 = item->oldestFileMtime();
+		key.rank = key.num == 0 ? 1 : 0; // Unknown last
+		break;
+
+	    case UserCol:	      key.num = item->uid();		  break;
+	    case GroupCol:	      key.num = item->gid();		  break;
+	    case PermissionsCol:      key.num = item->mode();		  break;
+	    case OctalPermissionsCol: key.num = item->mode();		  break;
+	    case SizeDeltaCol:	      key.num = diff ? diff->sizeDelta( item ) : 0; break;
+	    case SizeHistoryCol:      key.num = history ? history->trend( item->url() ).growth : 0; break;
+	    case ReadJobsCol:	      key.num = item->pendingReadJobs();  break;
+	    case UndefinedCol:	      break;
+		// Intentionally omitting the 'default' branch
+		// so the compiler can warn about unhandled enum values
+	}
+    }
+
+    return keys;
+}
+
+
+void FileInfoKeySorter::sort( FileInfoSortKeyList & keys, DataColumn sortCol, Qt::SortOrder sortOrder )
+{
+    FileInfoKeySorter sorter( sortCol, sortOrder );
+
+    if ( sortCol == NameCol || sortCol == UndefinedCol || keys.size() < RADIX_SORT_MIN_ITEMS )
+    {
+	std::sort( keys.begin(), keys.end(), sorter );
+	return;
+    }
+
+    // Numeric columns: Radix sort by the value of the sort column, then
+    // sort each run of equal values by name (usually very short runs).
+    //
+    // 'rank' is only used to sort unknown times (0) last, so those simply
+    // get the largest key.
+
+    bool useDbl = sortCol == PercentBarCol || sortCol == PercentNumCol;
+    QVector<RadixItem> items( keys.size() );
+
+    for ( int i = 0; i < keys.size(); ++i )
+    {
+	const FileInfoSortKey & key = keys.at( i );
+	quint64 radixKey = key.rank ? ~0ULL : useDbl ? orderedBits( key.dbl ) : orderedBits( key.num );
+
+	items[ i ].key	 = sortOrder == Qt::DescendingOrder ? ~radixKey : radixKey;
+	items[ i ].index = i;
+    }
+
+    radixSort( items );
+
+    FileInfoSortKeyList sortedKeys;
+    sortedKeys.reserve( keys.size() );
+
+    for ( int i = 0; i < items.size(); ++i )
+	sortedKeys << keys.at( items.at( i ).index );
+
+    int runStart = 0;
+
+    while ( runStart < items.size() )
+    {
+	int runEnd = runStart + 1;
+
+	while ( runEnd < items.size() && items.at( runEnd ).key == items.at( runStart ).key )
+	    ++runEnd;
+
+	if ( runEnd - runStart > 1 )
+	    std::sort( sortedKeys.begin() + runStart, sortedKeys.begin() + runEnd, sorter );
+
+	runStart = runEnd;
+    }
+
+    keys.swap( sortedKeys );
+}
+
+
+
+BackgroundSort::BackgroundSort( DirInfo *	     dir,
+				const FileInfoList & children,
+				DataColumn	     sortCol,
+				Qt::SortOrder	     sortOrder,
+				quint64		     serial,
+				QObject *	     receiver,
+				const char *	     slot ):
+    _dir( dir ),
+    _sortCol( sortCol ),
+    _sortOrder( sortOrder ),
+    _serial( serial ),
+    _receiver( receiver ),
+    _slot( slot ),
+    _attic( 0 ),
+    _finished( 0 )
+{
+    FileInfoList items = children;
+
+    // The attic always stays last
+
+    if ( ! items.isEmpty() && items.last()->isAttic() )
+	_attic = items.takeLast();
+
+    _keys = FileInfoKeySorter::createKeys( items, sortCol );
+}
+
+
+void BackgroundSort::run()
+{
+    FileInfoKeySorter::sort( _keys, _sortCol, _sortOrder );
+    _finished.storeRelease( 1 );
+
+    // Nothing may touch this object after this
+
+    QMetaObject::invokeMethod( _receiver, _slot, Qt::QueuedConnection );
+}
+
+
+FileInfoList BackgroundSort::sortedChildren() const
+{
+    FileInfoList sortedList;
+    sortedList.reserve( _keys.size() + 1 );
+
+    for ( int i = 0; i < _keys.size(); ++i )
+	sortedList << _keys.at( i ).item;
+
+    if ( _attic )
+	sortedList << _attic;
+
+    return sortedList;
+}
@@ -10,12 +10,22 @@
 #define FileInfoSorter_h
 
 
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QString>
+#include <QVector>
+
 #include "FileInfo.h"
 #include "DataColumns.h"
 
 
+class QObject;
+
+
 namespace QDirStat
 {
+    class DirInfo;
+
     /**
      * Functor class for sorting FileInfo objects with C++ STL sorting
      * algorithms like std::sort(), std::stable_sort().
@@ -59,6 +69,132 @@ namespace QDirStat
 
     };	   // class FileInfoSorter
 
+
+    /**
+     * The values of one item that are needed to sort it by one column (see
+     * FileInfoKeySorter).
+     **/
+    struct FileInfoSortKey
+    {
+	FileInfo * item;
+	qint64	   num;		// numeric value of the sort column
+	double	   dbl;		// floating point value of the sort column
+	int	   rank;	// sorts before 'num' and 'dbl'
+	int	   nameRank;	// sorts before 'name': ignored items and the dot entry last
+	int	   pos;		// position in the unsorted list
+	QString	   name;
+    };
+
+    typedef QVector<FileInfoSortKey> FileInfoSortKeyList;
+
+
+    /**
+     * Functor class for sorting FileInfoSortKey objects in the same order
+     * as FileInfoSorter would sort their items with a stable secondary
+     * sort by name: Sort keys are created once for each item, so the
+     * comparisons don't need any virtual calls; and since they contain
+     * everything that is needed, they can be sorted in another thread
+     * without touching the items at all.
+     *
+     * The position in the unsorted list is the last criterion, so the
+     * order is unique and std::sort() is just as good as std::stable_sort().
+     **/
+    class FileInfoKeySorter
+    {
+    public:
+	/**
+	 * Constructor. This sets the sort column and sort order that will be
+	 * used in subsequent calls.
+	 **/
+	FileInfoKeySorter( DataColumn sortCol, Qt::SortOrder sortOrder ):
+	    _sortCol( sortCol ),
+	    _sortOrder( sortOrder )
+	    {}
+
+	/**
+	 * Overloaded operator() that does the comparison.
+	 * returns 'true' if a < b, false otherwise (i.e., if a >= b).
+	 **/
+	bool operator() ( const FileInfoSortKey & a, const FileInfoSortKey & b ) const;
+
+	/**
+	 * Create the sort keys for sorting 'items' by 'sortCol'. This has to
+	 * be done in the main thread.
+	 **/
+	static FileInfoSortKeyList createKeys( const FileInfoList & items, DataColumn sortCol );
+
+	/**
+	 * Sort 'keys' by 'sortCol' in 'sortOrder'.
+	 **/
+	static void sort( FileInfoSortKeyList & keys, DataColumn sortCol, Qt::SortOrder sortOrder );
+
+    private:
+	DataColumn    _sortCol;
+	Qt::SortOrder _sortOrder;
+
+    };	   // class FileInfoKeySorter
+
+
+    /**
+     * Sorting the children of a directory in a worker thread: The sort
+     * keys are created in the constructor in the main thread, so sorting
+     * them does not access any items.
+     *
+     * When it is done, this invokes method 'slot' of 'receiver' with a
+     * queued connection, and it does not touch anything after that, so the
+     * receiver can delete it right away. Use it with autoDelete() off.
+     **/
+    class BackgroundSort: public QRunnable
+    {
+    public:
+	/**
+	 * Constructor: Sort 'children' (the current children of 'dir' in
+	 * any order, except that an attic has to be last) by 'sortCol' in
+	 * 'sortOrder'. 'serial' is the serial number of the sort cache
+	 * they were taken from (see DirInfo::hasSortCacheSerial()).
+	 **/
+	BackgroundSort( DirInfo *	     dir,
+			const FileInfoList & children,
+			DataColumn	     sortCol,
+			Qt::SortOrder	     sortOrder,
+			quint64		     serial,
+			QObject *	     receiver,
+			const char *	     slot );
+
+	/**
+	 * Sort. Reimplemented from QRunnable.
+	 **/
+	virtual void run() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if sorting is done.
+	 **/
+	bool isFinished() const { return _finished.loadAcquire() != 0; }
+
+	/**
+	 * Return the sorted children (with the attic last, if there is
+	 * one). Only use this when sorting is done.
+	 **/
+	FileInfoList sortedChildren() const;
+
+	DirInfo *     dir()	  const { return _dir; }
+	DataColumn    sortCol()	  const { return _sortCol; }
+	Qt::SortOrder sortOrder() const { return _sortOrder; }
+	quint64	      serial()	  const { return _serial; }
+
+    private:
+	DirInfo *	    _dir;
+	DataColumn	    _sortCol;
+	Qt::SortOrder	    _sortOrder;
+	quint64		    _serial;
+	QObject *	    _receiver;
+	const char *	    _slot;
+	FileInfoSortKeyList _keys;
+	FileInfo *	    _attic;
+	QAtomicInt	    _finished;
+
+    };	   // class BackgroundSort
+
 }      // namespace QDirStat
 
 #endif // FileInfoSorter_h
@@ -11,12 +11,16 @@
 #include <algorithm>
 
 #include "FileMTimeStats.h"
-#include "FileInfoIterator.h"
+#include "ParallelWalker.h"
 #include "DirTree.h"
 #include "Exception.h"
 
 #define VERBOSE_SORT_THRESHOLD  50000
 
+// Sketch for collecting an MTimeHistogram: It has only one value for each
+// month anyway
+#define HistogramSketchError	0.01
+
 using namespace QDirStat;
 
 
@@ -44,28 +48,53 @@ void FileMTimeStats::collect( FileInfo * subtree )
 {
     Q_CHECK_PTR( subtree );
 
-    if ( _data.isEmpty() )
+    // Big subtrees are walked in worker threads, each one with its own
+    // FileMTimeStats that are merged at the end
+
+    int taskCount = ParallelWalker::taskCount( subtree );
+    QVector<FileMTimeStats> taskStats = createTaskStats( taskCount );
+    FileMTimeStats * stats = taskStats.isEmpty() ? this : taskStats.data();
+
+    if ( taskStats.isEmpty() && _data.isEmpty() && ! _useSketch )
         _data.reserve( subtree->totalFiles() );
 
-    if ( subtree->isFile() )
-        _data << subtree->mtime();
+    ParallelWalker::forEachFile( subtree, taskCount,
+				 [=]( int task, FileInfo * item )
+				 {
+				     stats[ task ].addValue( item->mtime() );
+				 } );
+
+    foreach ( const FileMTimeStats & partialStats, taskStats )
+	merge( partialStats );
+}
 
-    FileInfoIterator it( subtree );
 
-    while ( *it )
+void FileMTimeStats::collect( const MTimeHistogram & histogram )
+{
+    if ( ! _useSketch )
+	setSketchError( HistogramSketchError );
+
+    foreach ( const MTimeHistogram::Bucket & bucket, histogram.buckets() )
     {
-	FileInfo * item = *it;
-
-	if ( item->hasChildren() )
-	{
-	    collect( item );
-	}
-	else if ( item->isFile() )
-	{
-            _data << item->mtime();
-	}
-	// Disregard symlinks, block devices and other special files
-
-	++it;
+	time_t start = MTimeHistogram::monthStart( bucket.month );
+	time_t end   = MTimeHistogram::monthStart( bucket.month + 1 );
+
+	_sketch.add( start + ( end - start ) / 2, bucket.count );
     }
 }
+
+
+QVector<FileMTimeStats> FileMTimeStats::createTaskStats( int taskCount ) const
+{
+    QVector<FileMTimeStats> taskStats;
+
+    if ( taskCount > 1 )
+    {
+	taskStats.resize( taskCount );
+
+	for ( int i=0; i < taskCount; ++i )
+	    taskStats[ i ].setSketchError( _sketchError );
+    }
+
+    return taskStats;
+}
@@ -10,9 +10,12 @@
 #ifndef FileMTimeStats_h
 #define FileMTimeStats_h
 
+#include <QVector>
+
 #include "PercentileStats.h"
 #include "FileInfo.h"
 #include "HistogramView.h"
+#include "MTimeHistogram.h"
 
 
 namespace QDirStat
@@ -27,10 +30,12 @@ namespace QDirStat
      * calculating a median or quantiles or histograms.
      *
      * Notice that one data item (one qreal, i.e. one 64 bit double) is
-     * stored for each file (or each matching file) in this object, so this is
-     * expensive in terms of memory usage. Also, since data usually need to be
-     * sorted for those calculations and sorting has at least logarithmic cost
-     * O( n * log(n) ), this also has heavy performance impact.
+     * stored for each file (or each matching file) in this object unless
+     * PercentileStats::setSketchError() switched to a quantile sketch, so
+     * this is expensive in terms of memory usage for big trees.
+     *
+     * The files of big trees are collected in worker threads with a
+     * ParallelWalker.
      **/
     class FileMTimeStats: public PercentileStats
     {
@@ -62,6 +67,24 @@ namespace QDirStat
 	 * unsorted after this.
 	 **/
 	void collect( FileInfo * subtree );
+
+	/**
+	 * Add the files of 'histogram', each one with the middle of the
+	 * month of its bucket. That is exact enough for ages in months or
+	 * years, and it does not need to walk any tree. Since there are no
+	 * exact data, this switches to a quantile sketch.
+	 **/
+	void collect( const MTimeHistogram & histogram );
+
+    protected:
+
+	/**
+	 * Return an empty FileMTimeStats with the same method (exact data or
+	 * sketch) as this one for each of 'taskCount' tasks of a
+	 * ParallelWalker, or none at all for just one task: That one can
+	 * collect right into this object.
+	 **/
+	QVector<FileMTimeStats> createTaskStats( int taskCount ) const;
     };
 
 }	// namespace QDirStat
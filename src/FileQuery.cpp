@@ -0,0 +1,321 @@
+/*
+ *   File name: FileQuery.cpp
+ *   Summary:	Structured queries for files in a DirTree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <pwd.h>	// getpwnam()
+#include <grp.h>	// getgrnam()
+#include <time.h>
+
+#include <QObject>
+#include <QRegExp>
+
+#include "FileQuery.h"
+#include "DirInfo.h"
+#include "OwnerUsage.h"
+#include "SizeHistogram.h"
+
+#define SECONDS_PER_DAY		( 24 * 60 * 60 )
+
+
+using namespace QDirStat;
+
+
+FileQuery::FileQuery():
+    _minSize( 0 ),
+    _maxSize( -1 ),
+    _hasMinMtime( false ),
+    _hasMaxMtime( false ),
+    _minMtime( 0 ),
+    _maxMtime( 0 ),
+    _hasUid( false ),
+    _hasGid( false ),
+    _uid( 0 ),
+    _gid( 0 )
+{
+
+}
+
+
+FileQuery::FileQuery( const QString & text ):
+    FileQuery()
+{
+    _text = text;
+    parse();
+}
+
+
+void FileQuery::parse()
+{
+    // key, operator, value: A word or a quoted string
+
+    QRegExp term( "(\\w+)\\s*(<=|>=|<|>|=)\\s*(\"[^\"]*\"|\\S+)" );
+    int pos = 0;
+
+    while ( pos < _text.size() )
+    {
+	int start = term.indexIn( _text, pos );
+
+	if ( start < 0 || ! _text.mid( pos, start - pos ).trimmed().isEmpty() )
+	{
+	    QString rest = _text.mid( pos ).trimmed();
+
+	    if ( ! rest.isEmpty() )
+		_errorText = QObject::tr( "Invalid query term: %1" ).arg( rest.section( ' ', 0, 0 ) );
+
+	    return;
+	}
+
+	QString value = term.cap( 3 );
+
+	if ( value.size() >= 2 && value.startsWith( '"' ) && value.endsWith( '"' ) )
+	    value = value.mid( 1, value.size() - 2 );
+
+	if ( ! parseTerm( term.cap( 1 ).toLower(), term.cap( 2 ), value ) )
+	    return;
+
+	pos = start + term.matchedLength();
+    }
+}
+
+
+bool FileQuery::parseTerm( const QString & key,
+			   const QString & op,
+			   const QString & value )
+{
+    if ( key == "size" )
+    {
+	FileSize size = parseSize( value );
+
+	if ( size < 0 || ( op == "<" && size == 0 ) )
+	{
+	    _errorText = QObject::tr( "Invalid size: %1" ).arg( value );
+	    return false;
+	}
+
+	if ( op.startsWith( '>' ) || op == "=" )
+	    _minSize = qMax( _minSize, op == ">" ? size + 1 : size );
+
+	if ( op.startsWith( '<' ) || op == "=" )
+	{
+	    FileSize maxSize = op == "<" ? size - 1 : size;
+	    _maxSize = _maxSize < 0 ? maxSize : qMin( _maxSize, maxSize );
+	}
+
+	return true;
+    }
+
+    if ( key == "age" )
+    {
+	qint64 age = parseAge( value );
+
+	if ( age < 0 || op == "=" )
+	{
+	    _errorText = QObject::tr( "Invalid age: %1%2" ).arg( op ).arg( value );
+	    return false;
+	}
+
+	// Older than 'age' means modified before 'now - age'
+
+	time_t limit = time( 0 ) - age;
+
+	if ( op.startsWith( '>' ) )
+	{
+	    time_t maxMtime = op == ">" ? limit - 1 : limit;
+	    _maxMtime = _hasMaxMtime ? qMin( _maxMtime, maxMtime ) : maxMtime;
+	    _hasMaxMtime = true;
+	}
+	else
+	{
+	    time_t minMtime = op == "<" ? limit + 1 : limit;
+	    _minMtime = _hasMinMtime ? qMax( _minMtime, minMtime ) : minMtime;
+	    _hasMinMtime = true;
+	}
+
+	return true;
+    }
+
+    if ( ( key == "user" || key == "group" ) && op == "=" )
+    {
+	bool ok = false;
+	uint id = value.toUInt( &ok );
+
+	if ( ! ok )
+	{
+	    if ( key == "user" )
+	    {
+		struct passwd * pw = getpwnam( value.toUtf8() );
+
+		if ( pw )
+		{
+		    id = pw->pw_uid;
+		    ok = true;
+		}
+	    }
+	    else
+	    {
+		struct group * grp = getgrnam( value.toUtf8() );
+
+		if ( grp )
+		{
+		    id = grp->gr_gid;
+		    ok = true;
+		}
+	    }
+	}
+
+	if ( ! ok )
+	{
+	    _errorText = key == "user" ?
+		QObject::tr( "Unknown user: %1" ).arg( value ) :
+		QObject::tr( "Unknown group: %1" ).arg( value );
+	    return false;
+	}
+
+	if ( key == "user" )
+	{
+	    _uid    = id;
+	    _hasUid = true;
+	}
+	else
+	{
+	    _gid    = id;
+	    _hasGid = true;
+	}
+
+	return true;
+    }
+
+    if ( key == "under" && op == "=" )
+    {
+	_path = value;
+	return true;
+    }
+
+    _errorText = QObject::tr( "Invalid query term: %1%2%3" ).arg( key ).arg( op ).arg( value );
+
+    return false;
+}
+
+
+FileSize FileQuery::parseSize( const QString & value )
+{
+    QRegExp size( "(\\d+(\\.\\d+)?)\\s*([KMGTP]?)(I?B)?", Qt::CaseInsensitive );
+
+    if ( ! size.exactMatch( value ) )
+	return -1;
+
+    double result = size.cap( 1 ).toDouble();
+    int	   power  = QString( "KMGTP" ).indexOf( size.cap( 3 ).toUpper() ) + 1;
+
+    if ( size.cap( 3 ).isEmpty() )
+	power = 0;
+
+    for ( int i = 0; i < power; ++i )
+	result *= 1024.0;
+
+    return (FileSize) result;
+}
+
+
+qint64 FileQuery::parseAge( const QString & value )
+{
+    QRegExp age( "(\\d+(\\.\\d+)?)\\s*([DWY]?)", Qt::CaseInsensitive );
+
+    if ( ! age.exactMatch( value ) )
+	return -1;
+
+    double days = age.cap( 1 ).toDouble();
+    QString unit = age.cap( 3 ).toUpper();
+
+    if ( unit == "W" )
+	days *= 7;
+    else if ( unit == "Y" )
+	days *= 365;
+
+    return (qint64) ( days * SECONDS_PER_DAY );
+}
+
+
+bool FileQuery::matches( FileInfo * item ) const
+{
+    if ( ! item || ! item->isFile() || item->isDirInfo() || item->isAggregate() )
+	return false;
+
+    if ( item->size() < _minSize )
+	return false;
+
+    if ( _maxSize >= 0 && item->size() > _maxSize )
+	return false;
+
+    if ( _hasMinMtime && item->mtime() < _minMtime )
+	return false;
+
+    if ( _hasMaxMtime && item->mtime() > _maxMtime )
+	return false;
+
+    if ( _hasUid && ( ! item->hasUid() || item->uid() != _uid ) )
+	return false;
+
+    if ( _hasGid && ( ! item->hasGid() || item->gid() != _gid ) )
+	return false;
+
+    return true;
+}
+
+
+bool FileQuery::mayContainMatches( FileInfo * item ) const
+{
+    if ( ! item || ! item->isDirInfo() )
+	return true;
+
+    DirInfo * dir = item->toDirInfo();
+
+    // The totals of a subtree only count what is loaded, but the files
+    // that are still in a cache file are not visited anyway.
+
+    if ( dir->totalFiles() == 0 )
+	return false;
+
+    if ( _minSize > 0 || _maxSize >= 0 )
+    {
+	if ( dir->totalSize() < _minSize )
+	    return false;
+
+	// Any matching file would be in one of the buckets from the one of
+	// the minimum size to the one of the maximum size
+
+	SizeHistogram histogram = dir->sizeHistogram();
+	int lastBucket = _maxSize >= 0 ? SizeHistogram::bucket( _maxSize ) : SizeHistogramBuckets - 1;
+	int count      = 0;
+
+	for ( int i = SizeHistogram::bucket( _minSize ); i <= lastBucket && count == 0; ++i )
+	    count += histogram.count( i );
+
+	if ( count == 0 )
+	    return false;
+    }
+
+    if ( _hasMinMtime && dir->latestMtime() < _minMtime )
+	return false;
+
+    if ( _hasMaxMtime && dir->oldestFileMtime() > _maxMtime )
+	return false;
+
+    if ( _hasUid || _hasGid )
+    {
+	OwnerUsage ownerUsage = dir->ownerUsage();
+
+	if ( _hasUid && ownerUsage.userFiles( _uid ) == 0 )
+	    return false;
+
+	if ( _hasGid && ownerUsage.groupFiles( _gid ) == 0 )
+	    return false;
+    }
+
+    return true;
+}
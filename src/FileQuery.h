@@ -0,0 +1,147 @@
+/*
+ *   File name: FileQuery.h
+ *   Summary:	Structured queries for files in a DirTree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef FileQuery_h
+#define FileQuery_h
+
+#include <sys/types.h>	// uid_t, gid_t
+
+#include <QString>
+
+#include "FileInfo.h"	// FileSize
+
+
+namespace QDirStat
+{
+    /**
+     * A query for plain files by size, age, owner and location, e.g.
+     *
+     *	   size>1G age>2y user=alice under=/data
+     *
+     * All terms must match. They are:
+     *
+     *	   size>N  size>=N  size<N  size<=N	  N with an optional unit
+     *						  K, M, G, T (1024 based)
+     *	   age>N   age<N			  not modified for more / less
+     *						  than N days; or with a unit
+     *						  d, w, y (365 days)
+     *	   user=NAME  group=NAME		  owner name or numeric ID
+     *	   under=PATH				  only below PATH; use quotes
+     *						  for paths with blanks
+     *
+     * Besides matching single files, this tells from the totals that each
+     * DirInfo keeps for its subtree (its total size, its SizeHistogram, its
+     * newest and oldest mtime and its OwnerUsage) if a subtree cannot
+     * contain any matching file, so the FileQueryTreeWalker does not need
+     * to visit it at all. For selective queries, that skips most of the
+     * tree.
+     **/
+    class FileQuery
+    {
+    public:
+
+	/**
+	 * Constructor for an empty query that matches all plain files.
+	 **/
+	FileQuery();
+
+	/**
+	 * Constructor: Parse 'text'. Check isValid() afterwards.
+	 **/
+	FileQuery( const QString & text );
+
+	/**
+	 * Return 'true' if the text of this query could be parsed.
+	 **/
+	bool isValid() const { return _errorText.isEmpty(); }
+
+	/**
+	 * Return a message for the user why the text could not be parsed or
+	 * an empty string if it could.
+	 **/
+	const QString & errorText() const { return _errorText; }
+
+	/**
+	 * Return 'true' if this query has no terms.
+	 **/
+	bool isEmpty() const { return _text.trimmed().isEmpty(); }
+
+	/**
+	 * Return the text of this query.
+	 **/
+	const QString & text() const { return _text; }
+
+	/**
+	 * Return the path of an "under" term or an empty string if there is
+	 * none.
+	 **/
+	const QString & path() const { return _path; }
+
+	/**
+	 * Return 'true' if 'item' is a plain file that matches all terms.
+	 **/
+	bool matches( FileInfo * item ) const;
+
+	/**
+	 * Return 'false' if the totals of 'dir' show that there is no
+	 * matching file anywhere in its subtree, 'true' if there might be
+	 * one.
+	 **/
+	bool mayContainMatches( FileInfo * dir ) const;
+
+
+    protected:
+
+	/**
+	 * Parse _text and set up the criteria.
+	 **/
+	void parse();
+
+	/**
+	 * Parse one term with 'key', 'op' and 'value'. Return 'false' and
+	 * set _errorText if it is not valid.
+	 **/
+	bool parseTerm( const QString & key,
+			const QString & op,
+			const QString & value );
+
+	/**
+	 * Parse a size like "1.5G". Return -1 if it is not valid.
+	 **/
+	static FileSize parseSize( const QString & value );
+
+	/**
+	 * Parse an age like "30d" or "2y" into seconds. Return -1 if it is
+	 * not valid.
+	 **/
+	static qint64 parseAge( const QString & value );
+
+
+	QString	 _text;
+	QString	 _errorText;
+	QString	 _path;
+
+	FileSize _minSize;		// 0: no limit
+	FileSize _maxSize;		// -1: no limit
+
+	bool	 _hasMinMtime;
+	bool	 _hasMaxMtime;
+	time_t	 _minMtime;
+	time_t	 _maxMtime;
+
+	bool	 _hasUid;
+	bool	 _hasGid;
+	uid_t	 _uid;
+	gid_t	 _gid;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef FileQuery_h
@@ -10,13 +10,22 @@
 #include <math.h>       // ceil()
 #include <algorithm>
 
+#include <QObject>
+
 #include "FileSizeStats.h"
-#include "FileInfoIterator.h"
+#include "ParallelWalker.h"
 #include "DirTree.h"
 #include "Exception.h"
 
 #define VERBOSE_SORT_THRESHOLD  50000
 
+// Sketch for collecting a SizeHistogram: It is only a few hundred values
+// anyway
+#define HistogramSketchError	0.01
+
+// Each task reports its progress after that many files
+#define ProgressStep		4096
+
 using namespace QDirStat;
 
 
@@ -42,32 +51,7 @@ void FileSizeStats::collect( DirTree * tree )
 
 void FileSizeStats::collect( FileInfo * subtree )
 {
-    Q_CHECK_PTR( subtree );
-
-    if ( _data.isEmpty() )
-        _data.reserve( subtree->totalFiles() );
-
-    if ( subtree->isFile() )
-        _data << subtree->size();
-
-    FileInfoIterator it( subtree );
-
-    while ( *it )
-    {
-	FileInfo * item = *it;
-
-	if ( item->hasChildren() )
-	{
-	    collect( item );
-	}
-	else if ( item->isFile() )
-	{
-            _data << item->size();
-	}
-	// Disregard symlinks, block devices and other special files
-
-	++it;
-    }
+    collect( subtree, "" );
 }
 
 
@@ -89,31 +73,85 @@ void FileSizeStats::collect( FileInfo * subtree, const QString & suffix )
 {
     Q_CHECK_PTR( subtree );
 
-    if ( _data.isEmpty() )
+    // Big subtrees are walked in worker threads, each one with its own
+    // FileSizeStats that are merged at the end
+
+    int taskCount = ParallelWalker::taskCount( subtree );
+    QVector<FileSizeStats> taskStats = createTaskStats( taskCount );
+    FileSizeStats * stats = taskStats.isEmpty() ? this : taskStats.data();
+
+    if ( taskStats.isEmpty() && _data.isEmpty() && ! _useSketch )
         _data.reserve( subtree->totalFiles() );
 
-    if ( subtree->isFile() && subtree->name().toLower().endsWith( suffix ) )
-        _data << subtree->size();
+    ParallelWalker::forEachFile( subtree, taskCount,
+				 [=]( int task, FileInfo * item )
+				 {
+				     if ( suffix.isEmpty() || item->name().toLower().endsWith( suffix ) )
+					 stats[ task ].addValue( item->size() );
+				 } );
+
+    foreach ( const FileSizeStats & partialStats, taskStats )
+	merge( partialStats );
+}
+
+
+void FileSizeStats::collect( const TreeSnapshot & snapshot,
+			     const QString &	  suffix,
+			     QAtomicInt *	  progress,
+			     const QAtomicInt *	  cancelled )
+{
+    int taskCount = ParallelWalker::taskCount( snapshot );
+    QVector<FileSizeStats> taskStats = createTaskStats( taskCount );
+    FileSizeStats * stats = taskStats.isEmpty() ? this : taskStats.data();
+
+    // Each task only touches its own counter
+
+    QVector<int> taskFiles( qMax( 1, taskCount ), 0 );
+    int * files = taskFiles.data();
+
+    if ( taskStats.isEmpty() && _data.isEmpty() && ! _useSketch )
+        _data.reserve( snapshot.size() );
+
+    ParallelWalker::forEachFile( snapshot, taskCount,
+				 [=]( int task, const TreeSnapshotNode & node )
+				 {
+				     if ( cancelled && cancelled->loadAcquire() )
+					 return;
+
+				     if ( suffix.isEmpty() || node.name.toLower().endsWith( suffix ) )
+					 stats[ task ].addValue( node.size );
+
+				     if ( progress && ++files[ task ] % ProgressStep == 0 )
+					 progress->fetchAndAddRelaxed( ProgressStep );
+				 } );
+
+    foreach ( const FileSizeStats & partialStats, taskStats )
+	merge( partialStats );
+}
+
+
+void FileSizeStats::collect( const SizeHistogram & histogram )
+{
+    if ( ! _useSketch )
+	setSketchError( HistogramSketchError );
+
+    histogram.addTo( _sketch );
+}
+
 
-    FileInfoIterator it( subtree );
+QVector<FileSizeStats> FileSizeStats::createTaskStats( int taskCount ) const
+{
+    QVector<FileSizeStats> taskStats;
 
-    while ( *it )
+    if ( taskCount > 1 )
     {
-	FileInfo * item = *it;
-
-	if ( item->hasChildren() )
-	{
-	    collect( item, suffix );
-	}
-	else if ( item->isFile() )
-	{
-            if ( item->name().toLower().endsWith( suffix ) )
-                _data << item->size();
-	}
-	// Disregard symlinks, block devices and other special files
-
-	++it;
+	taskStats.resize( taskCount );
+
+	for ( int i=0; i < taskCount; ++i )
+	    taskStats[ i ].setSketchError( _sketchError );
     }
+
+    return taskStats;
 }
 
 
@@ -136,13 +174,9 @@ QRealList FileSizeStats::fillBuckets( int bucketCount,
     for ( int i=0; i < bucketCount; ++i )
         buckets << 0.0;
 
-    if ( _data.isEmpty() )
+    if ( dataSize() == 0 )
         return buckets;
 
-
-    // The first call to percentile() or quantile() will cause the data to be
-    // sorted, so there is no need to sort them again here.
-
     qreal startVal = percentile( startPercentile );
     qreal endVal   = percentile( endPercentile );
     qreal bucketWidth = ( endVal - startVal ) / bucketCount;
@@ -156,23 +190,74 @@ QRealList FileSizeStats::fillBuckets( int bucketCount,
                << endl;
 #endif
 
-    for ( int i=0; i < _data.size(); ++i )
+    if ( _useSketch )
     {
-        qreal val = _data.at( i );
+        // Each value of the sketch stands for 'weight' files
 
-        if ( val < startVal )
-            continue;
+        foreach ( const QuantileSketch::WeightedValue & value, _sketch.sortedValues() )
+        {
+            if ( value.value < startVal || value.value > endVal )
+                continue;
 
-        if ( val > endVal )
-            break;
+            int index = qMin( ( value.value - startVal ) / bucketWidth, bucketCount - 1.0 );
+            buckets[ index ] += value.weight;
+        }
 
-        // TO DO: Optimize this by taking into account that the data are sorted
-        // already. We don't really need that many divisions; just when leaving
-        // the current bucket would be sufficient.
+        return buckets;
+    }
+
+    // Count the data below each bucket boundary: Only the data between the
+    // percentiles around each boundary are sorted (once) and searched, so
+    // changing the range again is fast.
+
+    int below = countBelow( startVal );
+
+    for ( int i=0; i < bucketCount; ++i )
+    {
+        // The last bucket includes the end value
 
-        int index = qMin( ( val - startVal ) / bucketWidth, bucketCount - 1.0 );
-        ++buckets[ index ];
+        int belowNext = i == bucketCount - 1 ?
+            countBelow( endVal, true ) :
+            countBelow( startVal + ( i+1 ) * bucketWidth );
+
+        buckets[ i ] = belowNext - below;
+        below = belowNext;
     }
 
     return buckets;
 }
+
+
+FileSizeStatsCollector::FileSizeStatsCollector( const TreeSnapshot & snapshot,
+						const QString &	     suffix,
+						qreal		     sketchError,
+						QObject *	     receiver,
+						const char *	     slot ):
+    _snapshot( snapshot ),
+    _suffix( suffix ),
+    _receiver( receiver ),
+    _slot( slot ),
+    _finished( 0 ),
+    _cancelled( 0 ),
+    _progress( 0 )
+{
+    _stats.setSketchError( sketchError );
+}
+
+
+void FileSizeStatsCollector::run()
+{
+    _stats.collect( _snapshot, _suffix, &_progress, &_cancelled );
+
+    if ( ! isCancelled() )
+	_stats.partitionPercentiles();
+
+    // The snapshot is not needed anymore; let the nodes go right here
+
+    _snapshot = TreeSnapshot();
+    _finished.storeRelease( 1 );
+
+    // Nothing may touch this object after this
+
+    QMetaObject::invokeMethod( _receiver, _slot, Qt::QueuedConnection );
+}
@@ -10,9 +10,17 @@
 #ifndef FileSizeStats_h
 #define FileSizeStats_h
 
+#include <QAtomicInt>
+#include <QRunnable>
+
 #include "PercentileStats.h"
 #include "FileInfo.h"
 #include "HistogramView.h"
+#include "TreeSnapshot.h"
+#include "SizeHistogram.h"
+
+
+class QObject;
 
 
 namespace QDirStat
@@ -27,9 +35,11 @@ namespace QDirStat
      *
      * Notice that one data item (one qreal, i.e. one 64 bit double) is
      * stored for each file (or each matching file) in this object, so this is
-     * expensive in terms of memory usage. Also, since data usually need to be
-     * sorted for those calculations and sorting has at least logarithmic cost
-     * O( n * log(n) ), this also has heavy performance impact.
+     * expensive in terms of memory usage. See PercentileStats for the cost
+     * of the calculations.
+     *
+     * The files of big trees are collected in worker threads with a
+     * ParallelWalker.
      **/
     class FileSizeStats: public PercentileStats
     {
@@ -80,6 +90,29 @@ namespace QDirStat
 	 **/
 	void collect( FileInfo * subtree, const QString & suffix );
 
+	/**
+	 * Append the own size of each file in 'snapshot' (with the
+	 * specified suffix unless 'suffix' is empty) to the data
+	 * collection. Unlike the other collect() methods, this can be used
+	 * in a worker thread. Notice that the data are unsorted after this.
+	 *
+	 * If 'progress' is set, the number of files that are done is added
+	 * to it every now and then. If 'cancelled' is set and becomes
+	 * non-zero, the rest of the files are skipped.
+	 **/
+	void collect( const TreeSnapshot & snapshot,
+		      const QString &	   suffix,
+		      QAtomicInt *	   progress  = 0,
+		      const QAtomicInt *   cancelled = 0 );
+
+	/**
+	 * Add the files of 'histogram', each one with the average size of its
+	 * bucket. That is only a rough approximation, but it does not need to
+	 * walk any tree. Since there are no exact data, this switches to a
+	 * quantile sketch.
+	 **/
+	void collect( const SizeHistogram & histogram );
+
         /**
          * Fill buckets for a histogram from 'startPercentile' to
          * 'endPercentile'.
@@ -87,6 +120,84 @@ namespace QDirStat
         QRealList fillBuckets( int bucketCount,
                                int startPercentile,
                                int endPercentile );
+
+    protected:
+
+	/**
+	 * Return an empty FileSizeStats with the same method (exact data or
+	 * sketch) as this one for each of 'taskCount' tasks of a
+	 * ParallelWalker, or none at all for just one task: That one can
+	 * collect right into this object.
+	 **/
+	QVector<FileSizeStats> createTaskStats( int taskCount ) const;
+    };
+
+
+    /**
+     * Collecting the file sizes of a TreeSnapshot in a worker thread and
+     * finding their percentiles.
+     *
+     * When it is done, this invokes method 'slot' of 'receiver' with a
+     * queued connection, and it does not touch anything after that, so the
+     * receiver can delete it right away. Use it with autoDelete() off.
+     **/
+    class FileSizeStatsCollector: public QRunnable
+    {
+    public:
+
+	/**
+	 * Constructor: Collect the sizes of the files in 'snapshot' with
+	 * 'suffix' (all files if 'suffix' is empty). With a 'sketchError'
+	 * other than 0.0, they are collected into a QuantileSketch (see
+	 * PercentileStats::setSketchError()).
+	 **/
+	FileSizeStatsCollector( const TreeSnapshot & snapshot,
+				const QString &	     suffix,
+				qreal		     sketchError,
+				QObject *	     receiver,
+				const char *	     slot );
+
+	/**
+	 * Collect and find the percentiles. Reimplemented from QRunnable.
+	 **/
+	virtual void run() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if collecting is done.
+	 **/
+	bool isFinished() const { return _finished.loadAcquire() != 0; }
+
+	/**
+	 * Return the statistics. Only use this when collecting is done.
+	 **/
+	const FileSizeStats & stats() const { return _stats; }
+
+	/**
+	 * Stop collecting as soon as possible. It still invokes the slot of
+	 * the receiver when it is done, but the statistics are incomplete.
+	 * This can be called from any thread.
+	 **/
+	void cancel() { _cancelled.storeRelease( 1 ); }
+
+	/**
+	 * Return 'true' if collecting was cancelled.
+	 **/
+	bool isCancelled() const { return _cancelled.loadAcquire() != 0; }
+
+	/**
+	 * Return the approximate number of files collected so far.
+	 **/
+	int progress() const { return _progress.loadAcquire(); }
+
+    private:
+	TreeSnapshot  _snapshot;
+	QString	      _suffix;
+	QObject *     _receiver;
+	const char *  _slot;
+	FileSizeStats _stats;
+	QAtomicInt    _finished;
+	QAtomicInt    _cancelled;
+	QAtomicInt    _progress;
     };
 
 }	// namespace QDirStat
@@ -16,14 +16,33 @@
 #include "FileSizeStatsWindow.h"
 #include "FileSizeStats.h"
 #include "HistogramView.h"
+#include "TreeSnapshot.h"
 #include "BucketsTableModel.h"
 #include "DirTree.h"
 #include "MainWindow.h"
+#include "Settings.h"
 #include "SettingsHelpers.h"
 #include "HeaderTweaker.h"
 #include "Logger.h"
+#include "Tracer.h"
 #include "Exception.h"
 
+// Subtrees with this many files or more use a quantile sketch
+#define DefaultSketchMinFiles	5000000
+
+// Relative rank error of the quantile sketch
+#define DefaultSketchError	0.005
+
+// Subtrees with this many files or more show a quick approximation first
+#define DefaultPreviewMinFiles	1000000
+
+// Number of results to keep for switching between subtrees and suffixes
+#define StatsCacheSize		4
+
+// Interval for updating the progress bar
+#define ProgressMillisec	200
+
+
 using namespace QDirStat;
 
 QPointer<FileSizeStatsWindow> FileSizeStatsWindow::_sharedInstance = 0;
@@ -34,7 +53,14 @@ FileSizeStatsWindow::FileSizeStatsWindow( QWidget * parent ):
     _ui( new Ui::FileSizeStatsWindow ),
     _subtree( 0 ),
     _suffix( "" ),
-    _stats( 0 )
+    _stats( 0 ),
+    _currentCollector( 0 ),
+    _statsCache( StatsCacheSize ),
+    _cacheTree( 0 ),
+    _cacheGeneration( 0 ),
+    _sketchMinFiles( DefaultSketchMinFiles ),
+    _sketchError( DefaultSketchError ),
+    _previewMinFiles( DefaultPreviewMinFiles )
 {
     // logDebug() << "init" << endl;
 
@@ -42,10 +68,14 @@ FileSizeStatsWindow::FileSizeStatsWindow( QWidget * parent ):
     _ui->setupUi( this );
     initWidgets();
     readWindowSettings( this, "FileSizeStatsWindow" );
+    readSettings();
 
     _stats = new FileSizeStats();
     CHECK_NEW( _stats );
 
+    _threadPool.setMaxThreadCount( 1 );
+    _progressTimer.setInterval( ProgressMillisec );
+
     _bucketsTableModel = new BucketsTableModel( this, _ui->histogramView );
     CHECK_NEW( _bucketsTableModel );
 
@@ -65,6 +95,16 @@ FileSizeStatsWindow::~FileSizeStatsWindow()
 {
     // logDebug() << "destroying" << endl;
     writeWindowSettings( this, "FileSizeStatsWindow" );
+    writeSettings();
+
+    // The collectors invoke a slot of this window when they are done
+
+    foreach ( FileSizeStatsCollector * collector, _collectors )
+	collector->cancel();
+
+    _threadPool.clear();
+    _threadPool.waitForDone();
+    qDeleteAll( _collectors );
 }
 
 
@@ -127,19 +167,169 @@ void FileSizeStatsWindow::initWidgets()
 
     connect( _ui->endPercentileSpinBox,	  SIGNAL( valueChanged( int ) ),
 	     this,			  SLOT	( applyOptions()      ) );
+
+    connect( _ui->stopButton,	  SIGNAL( clicked()	     ),
+	     this,		  SLOT	( stopCalc()	     ) );
+
+    connect( &_progressTimer,	  SIGNAL( timeout()	     ),
+	     this,		  SLOT	( updateProgress()   ) );
+
+    _ui->progressBar->hide();
+    _ui->stopButton->hide();
+}
+
+
+void FileSizeStatsWindow::readSettings()
+{
+    Settings settings;
+    settings.beginGroup( "FileSizeStatsWindow" );
+
+    _sketchMinFiles  = settings.value( "SketchMinFiles",  DefaultSketchMinFiles  ).toInt();
+    _sketchError     = settings.value( "SketchError",	  DefaultSketchError	 ).toDouble();
+    _previewMinFiles = settings.value( "PreviewMinFiles", DefaultPreviewMinFiles ).toInt();
+
+    settings.endGroup();
+}
+
+
+void FileSizeStatsWindow::writeSettings()
+{
+    Settings settings;
+    settings.beginGroup( "FileSizeStatsWindow" );
+
+    settings.setValue( "SketchMinFiles",  _sketchMinFiles  );
+    settings.setValue( "SketchError",	  _sketchError	   );
+    settings.setValue( "PreviewMinFiles", _previewMinFiles );
+
+    settings.endGroup();
 }
 
 
 void FileSizeStatsWindow::calc()
 {
-    _stats->clear();
+    // A collector that is still running is cancelled; its results would be
+    // discarded anyway.
 
-    if ( _suffix.isEmpty() )
-	_stats->collect( _subtree );
-    else
-	_stats->collect( _subtree, _suffix );
+    stopCalc();
+
+    DirTree * tree = _subtree->tree();
+
+    if ( tree != _cacheTree || tree->generation() != _cacheGeneration )
+    {
+	_statsCache.clear();
+	_cacheTree	 = tree;
+	_cacheGeneration = tree->generation();
+    }
+
+    FileSizeStats * cachedStats = _statsCache.object( qMakePair( _subtree, _suffix ) );
+
+    if ( cachedStats )
+    {
+	*_stats = *cachedStats;
+
+	fillHistogram();
+	fillPercentileTable();
+	return;
+    }
+
+    // For very big subtrees, keeping every single file size would need
+    // too much memory; use a quantile sketch instead.
+
+    qreal sketchError = 0.0;
 
-    _stats->sort();
+    if ( _sketchMinFiles > 0 && _subtree->totalFiles() >= _sketchMinFiles )
+	sketchError = _sketchError;
+
+    // Until the collector is done, show what the size histogram of a big
+    // directory says: That is at once, but only roughly.
+
+    if ( _suffix.isEmpty() && _previewMinFiles > 0 && _subtree->isDirInfo() &&
+	 _subtree->totalFiles() >= _previewMinFiles &&
+	 _subtree->toDirInfo()->hasCompleteSizeHistogram() )
+    {
+	_stats->clear();
+	_stats->collect( _subtree->toDirInfo()->sizeHistogram() );
+
+	fillHistogram();
+	fillPercentileTable();
+    }
+
+    _currentCollector = new FileSizeStatsCollector( TreeSnapshot( _subtree ), _suffix,
+						    sketchError,
+						    this, "collectorFinished" );
+    CHECK_NEW( _currentCollector );
+
+    _currentCollector->setAutoDelete( false );
+    _collectors << _currentCollector;
+    _threadPool.start( _currentCollector );
+
+    _ui->progressBar->setMaximum( qMax( 1, (int) _subtree->totalFiles() ) );
+    _ui->progressBar->setValue( 0 );
+    _ui->progressBar->show();
+    _ui->stopButton->show();
+    _progressTimer.start();
+
+    setCursor( Qt::BusyCursor );
+}
+
+
+void FileSizeStatsWindow::stopCalc()
+{
+    if ( _currentCollector )
+    {
+	_currentCollector->cancel();
+	_currentCollector = 0;
+    }
+
+    _progressTimer.stop();
+    _ui->progressBar->hide();
+    _ui->stopButton->hide();
+    unsetCursor();
+}
+
+
+void FileSizeStatsWindow::updateProgress()
+{
+    if ( _currentCollector )
+    {
+	_ui->progressBar->setValue( qMin( _currentCollector->progress(),
+					  _ui->progressBar->maximum() ) );
+    }
+}
+
+
+void FileSizeStatsWindow::collectorFinished()
+{
+    for ( int i = _collectors.size() - 1; i >= 0; --i )
+    {
+	FileSizeStatsCollector * collector = _collectors.at( i );
+
+	if ( ! collector->isFinished() )
+	    continue;
+
+	_collectors.removeAt( i );
+
+	if ( collector == _currentCollector )
+	{
+	    *_stats = collector->stats();
+	    stopCalc();
+
+	    // Only keep the results if nothing changed in the tree meanwhile
+
+	    if ( _subtree && _subtree->tree() == _cacheTree &&
+		 _cacheTree->generation() == _cacheGeneration )
+	    {
+		FileSizeStats * cachedStats = new FileSizeStats( *_stats );
+		CHECK_NEW( cachedStats );
+		_statsCache.insert( qMakePair( _subtree, _suffix ), cachedStats );
+	    }
+
+	    fillHistogram();
+	    fillPercentileTable();
+	}
+
+	delete collector;
+    }
 }
 
 
@@ -153,6 +343,8 @@ void FileSizeStatsWindow::populateSharedInstance( FileInfo *	  subtree,
 
 void FileSizeStatsWindow::populate( FileInfo * subtree, const QString & suffix )
 {
+    TRACE_SCOPE( "stats", "FileSizeStatsWindow::populate" );
+
     _subtree = subtree;
     _suffix  = suffix;
 
@@ -176,9 +368,6 @@ void FileSizeStatsWindow::populate( FileInfo * subtree, const QString & suffix )
 	_ui->heading->setText( tr( "File Size Statistics for %1 in %2" )
 			       .arg( suffix ).arg( url ) );
     calc();
-
-    fillHistogram();
-    fillPercentileTable();
 }
 
 
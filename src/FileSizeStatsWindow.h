@@ -11,7 +11,12 @@
 #define FileSizeStatsWindow_h
 
 #include <QDialog>
+#include <QCache>
+#include <QList>
+#include <QPair>
 #include <QPointer>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "ui_file-size-stats-window.h"
 #include "FileInfo.h"
@@ -23,6 +28,7 @@ namespace QDirStat
 {
     class DirTree;
     class FileSizeStats;
+    class FileSizeStatsCollector;
     class BucketsTableModel;
 
 
@@ -127,6 +133,23 @@ namespace QDirStat
          **/
         void showHelp();
 
+        /**
+         * Take the results of the collectors that are done and fill the
+         * window with those of the most recent one.
+         **/
+        void collectorFinished();
+
+        /**
+         * Stop the collector that is running, e.g. when the user clicks the
+         * "Stop" button. The window keeps what it shows now.
+         **/
+        void stopCalc();
+
+        /**
+         * Show how many files the running collector has done.
+         **/
+        void updateProgress();
+
     protected:
 
 	/**
@@ -135,7 +158,13 @@ namespace QDirStat
 	void clear();
 
 	/**
-	 * Calculate the statistics from the tree.
+	 * Calculate the statistics from the tree: Collect the sizes of a
+	 * snapshot of the subtree and find their percentiles in a worker
+	 * thread. When that is done, collectorFinished() fills the window
+	 * with the results.
+	 *
+	 * The results for the same subtree and suffix are taken from the
+	 * cache if the tree did not change since then.
 	 **/
 	void calc();
 
@@ -144,6 +173,12 @@ namespace QDirStat
 	 **/
 	void initWidgets();
 
+	/**
+	 * Read and write the settings for the quantile sketch.
+	 **/
+	void readSettings();
+	void writeSettings();
+
         /**
          * Update the values for the option widgets from the current ones from
          * the histogram.
@@ -225,6 +260,30 @@ namespace QDirStat
 	FileSizeStats *		    _stats;
         BucketsTableModel *         _bucketsTableModel;
 
+        // All collectors that are not done yet and the most recent one
+
+	QList<FileSizeStatsCollector *> _collectors;
+	FileSizeStatsCollector *    _currentCollector;
+	QThreadPool		    _threadPool;
+	QTimer			    _progressTimer;
+
+	// Results by subtree and suffix for tree generation _cacheGeneration
+
+	QCache<QPair<FileInfo *, QString>, FileSizeStats> _statsCache;
+	DirTree *		    _cacheTree;	// only for comparing
+	quint64			    _cacheGeneration;
+
+	// Subtrees with at least this many files use a quantile sketch with
+	// this error instead of all the data
+
+	int			    _sketchMinFiles;
+	qreal			    _sketchError;
+
+	// Subtrees with at least this many files show the results of the
+	// directory's SizeHistogram until the exact ones are there
+
+	int			    _previewMinFiles;
+
         static QPointer<FileSizeStatsWindow> _sharedInstance;
     };
 
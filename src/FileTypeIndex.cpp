@@ -0,0 +1,260 @@
+/*
+ *   File name: FileTypeIndex.cpp
+ *   Summary:	Statistics classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QVector>
+
+#include "FileTypeIndex.h"
+#include "FileTypeStats.h"	// NO_SUFFIX
+#include "DirInfo.h"
+#include "FileInfoIterator.h"
+#include "ParallelWalker.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * The part of the index that one task of the ParallelWalker builds.
+     **/
+    struct TaskIndex
+    {
+	MimeMatcher				  matcher;
+	QHash<DirInfo *, FileTypeIndex::KeySums> dirs;
+    };
+
+}	// namespace
+
+
+FileTypeIndex::FileTypeIndex( FileInfo * subtree ):
+    _categorizerGeneration( MimeCategorizer::instance()->generation() ),
+    _matcher( MimeCategorizer::instance()->matcher() )
+{
+    if ( ! subtree )
+	return;
+
+    // Each task needs its own copy of the matcher: Matching changes the
+    // QRegExps of the patterns.
+
+    int taskCount = ParallelWalker::taskCount( subtree );
+    QVector<TaskIndex> taskIndex( taskCount );
+
+    for ( int i=0; i < taskCount; ++i )
+	taskIndex[ i ].matcher = _matcher;
+
+    TaskIndex * tasks = taskIndex.data();
+
+    ParallelWalker::forEachFile( subtree, taskCount,
+				 [=]( int task, FileInfo * file )
+				 {
+				     Sums & sums = tasks[ task ].dirs[ indexDir( file ) ]
+					 [ key( file->name(), tasks[ task ].matcher ) ];
+				     sums.count++;
+				     sums.size += file->size();
+				 } );
+
+    foreach ( const TaskIndex & task, taskIndex )
+    {
+	for ( QHash<DirInfo *, KeySums>::const_iterator dirIt = task.dirs.constBegin();
+	      dirIt != task.dirs.constEnd();
+	      ++dirIt )
+	{
+	    for ( KeySums::const_iterator it = dirIt.value().constBegin();
+		  it != dirIt.value().constEnd();
+		  ++it )
+	    {
+		add( dirIt.key(), it.key(), it.value() );
+	    }
+	}
+    }
+}
+
+
+bool FileTypeIndex::isCurrent() const
+{
+    return _categorizerGeneration == MimeCategorizer::instance()->generation();
+}
+
+
+void FileTypeIndex::add( FileInfo * file )
+{
+    if ( ! file || ! file->isFile() || isInAttic( file ) )
+	return;
+
+    Sums sums;
+    sums.count = 1;
+    sums.size  = file->size();
+
+    add( indexDir( file ), key( file->name(), _matcher ), sums );
+}
+
+
+void FileTypeIndex::remove( FileInfo * subtree )
+{
+    if ( ! subtree || isInAttic( subtree ) )
+	return;
+
+    if ( subtree->isFile() )
+	subtract( indexDir( subtree ), key( subtree->name(), _matcher ), subtree->size() );
+    else
+	subtractSubtree( subtree );
+}
+
+
+void FileTypeIndex::subtractSubtree( FileInfo * subtree )
+{
+    FileInfoIterator it( subtree );
+
+    while ( *it )
+    {
+	FileInfo * item = *it;
+
+	if ( item->hasChildren() )
+	    subtractSubtree( item );
+	else if ( item->isFile() )
+	    subtract( indexDir( item ), key( item->name(), _matcher ), item->size() );
+
+	++it;
+    }
+}
+
+
+void FileTypeIndex::add( DirInfo * dir, const Key & key, const Sums & sums )
+{
+    Sums & dirSums = _dirs[ dir ][ key ];
+    dirSums.count += sums.count;
+    dirSums.size  += sums.size;
+
+    Sums & totalSums = _totals[ key ];
+    totalSums.count += sums.count;
+    totalSums.size  += sums.size;
+
+    _lastSuffixDirs[ key.lastSuffix ][ dir ] += sums.count;
+}
+
+
+void FileTypeIndex::subtract( DirInfo * dir, const Key & key, FileSize size )
+{
+    QHash<DirInfo *, KeySums>::iterator dirIt = _dirs.find( dir );
+
+    if ( dirIt == _dirs.end() || ! dirIt.value().contains( key ) )
+	return;
+
+    // Entries without any files are removed so the index doesn't keep any
+    // directories that are deleted later
+
+    Sums & dirSums = dirIt.value()[ key ];
+
+    if ( --dirSums.count > 0 )
+	dirSums.size -= size;
+    else
+    {
+	dirIt.value().remove( key );
+
+	if ( dirIt.value().isEmpty() )
+	    _dirs.erase( dirIt );
+    }
+
+    Sums & totalSums = _totals[ key ];
+
+    if ( --totalSums.count > 0 )
+	totalSums.size -= size;
+    else
+	_totals.remove( key );
+
+    QHash<DirInfo *, int> & lastSuffixDirs = _lastSuffixDirs[ key.lastSuffix ];
+
+    if ( --lastSuffixDirs[ dir ] <= 0 )
+    {
+	lastSuffixDirs.remove( dir );
+
+	if ( lastSuffixDirs.isEmpty() )
+	    _lastSuffixDirs.remove( key.lastSuffix );
+    }
+}
+
+
+FileTypeIndex::Key FileTypeIndex::key( const QString & name, const MimeMatcher & matcher )
+{
+    Key key;
+
+    // First attempt: Try the MIME categorizer.
+    //
+    // If it knows the file's suffix, it can much easier find the correct
+    // one in case there are multiple to choose from, for example ".tar.bz2",
+    // not ".bz2" for a bzipped tarball. But on Linux systems, having
+    // multiple dots in filenames is very common, e.g. in .deb or .rpm
+    // packages, so the longest possible suffix is not always the useful one
+    // (because it might contain version numbers and all kinds of irrelevant
+    // information).
+    //
+    // The suffixes the MIME categorizer knows are carefully hand-crafted,
+    // so if it knows anything about a suffix, it's the best choice.
+
+    key.category = matcher.category( name, &key.suffix );
+
+    if ( key.suffix.isEmpty() )
+    {
+	if ( name.contains( '.' ) && ! name.startsWith( '.' ) )
+	{
+	    // Fall back to the last (i.e. the shortest) suffix if the MIME
+	    // categorizer didn't know it: Use section -1 (the last one,
+	    // ignoring any trailing '.' separator).
+	    //
+	    // The downside is that this would not find a ".tar.bz", but just
+	    // the ".bz" for a compressed tarball. But it's much better than
+	    // getting a ".eab7d88df-git.deb" rather than a ".deb".
+
+	    key.suffix = name.section( '.', -1 );
+	}
+    }
+
+    key.suffix = key.suffix.toLower();
+
+    if ( key.suffix.isEmpty() )
+	key.suffix = NO_SUFFIX;
+
+    key.lastSuffix = lastSuffix( name );
+
+    return key;
+}
+
+
+QString FileTypeIndex::lastSuffix( const QString & name )
+{
+    int pos = name.lastIndexOf( '.' );
+
+    return pos < 0 ? QString() : name.mid( pos + 1 ).toLower();
+}
+
+
+bool FileTypeIndex::isInAttic( FileInfo * item )
+{
+    while ( item )
+    {
+	if ( item->isAttic() )
+	    return true;
+
+	item = item->parent();
+    }
+
+    return false;
+}
+
+
+DirInfo * FileTypeIndex::indexDir( FileInfo * file )
+{
+    DirInfo * dir = file->parent();
+
+    if ( dir && dir->isDotEntry() )
+	dir = dir->parent();
+
+    return dir;
+}
@@ -0,0 +1,173 @@
+/*
+ *   File name: FileTypeIndex.h
+ *   Summary:	Statistics classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef FileTypeIndex_h
+#define FileTypeIndex_h
+
+
+#include <QHash>
+#include <QString>
+
+#include "FileInfo.h"
+#include "MimeCategorizer.h"
+
+
+namespace QDirStat
+{
+    class DirInfo;
+
+    /**
+     * Number and total size of the files of each file type in each
+     * directory of a subtree, so FileTypeStats and LocateFileTypeWindow
+     * don't need to walk the subtree and categorize every single file each
+     * time.
+     *
+     * The DirTree keeps one of those for the whole tree once somebody asked
+     * for it and updates it when files are added or deleted. It is only
+     * valid as long as the MIME categories don't change (see isCurrent()).
+     *
+     * The files of a dot entry count for its parent directory. Just like
+     * FileInfoIterator, the index doesn't go into attics below 'subtree'.
+     **/
+    class FileTypeIndex
+    {
+    public:
+
+	/**
+	 * The file type of a file.
+	 **/
+	struct Key
+	{
+	    QString	   suffix;	// lowercase, as in FileTypeStats; NO_SUFFIX if none
+	    QString	   lastSuffix;	// lowercase, after the last '.'; empty if none
+	    MimeCategory * category;	// 0 if none
+
+	    bool operator==( const Key & other ) const
+	    {
+		return category	  == other.category &&
+		       suffix	  == other.suffix   &&
+		       lastSuffix == other.lastSuffix;
+	    }
+	};
+
+	/**
+	 * Number and total size of files.
+	 **/
+	struct Sums
+	{
+	    Sums(): count( 0 ), size( 0LL ) {}
+
+	    int	     count;
+	    FileSize size;
+	};
+
+	typedef QHash<Key, Sums> KeySums;
+
+
+	/**
+	 * Constructor: Index all files in 'subtree'. This must be called on
+	 * the main thread; big subtrees are walked in worker threads with a
+	 * ParallelWalker.
+	 **/
+	FileTypeIndex( FileInfo * subtree );
+
+	/**
+	 * Return 'true' if the MIME categories did not change since this
+	 * index was built. Otherwise it needs to be built again.
+	 **/
+	bool isCurrent() const;
+
+	/**
+	 * Add 'file' to the index.
+	 **/
+	void add( FileInfo * file );
+
+	/**
+	 * Remove 'subtree' and all files in it from the index.
+	 **/
+	void remove( FileInfo * subtree );
+
+	/**
+	 * Return the sums of all files of the index.
+	 **/
+	const KeySums & totals() const { return _totals; }
+
+	/**
+	 * Return the sums of the files of each directory.
+	 **/
+	const QHash<DirInfo *, KeySums> & dirs() const { return _dirs; }
+
+	/**
+	 * Return the directories with files with 'lastSuffix' (see
+	 * lastSuffix()).
+	 **/
+	QList<DirInfo *> dirsWithLastSuffix( const QString & lastSuffix ) const
+	    { return _lastSuffixDirs.value( lastSuffix ).keys(); }
+
+	/**
+	 * Return the file type of a file named 'name'.
+	 **/
+	static Key key( const QString & name, const MimeMatcher & matcher );
+
+	/**
+	 * Return the part of 'name' after the last '.' in lowercase or an
+	 * empty string if there is no '.'.
+	 **/
+	static QString lastSuffix( const QString & name );
+
+	/**
+	 * Return the directory that 'file' counts for: Its parent, or the
+	 * parent of its dot entry.
+	 **/
+	static DirInfo * indexDir( FileInfo * file );
+
+	/**
+	 * Return 'true' if 'item' is an attic or in one. FileInfoIterator
+	 * doesn't go there.
+	 **/
+	static bool isInAttic( FileInfo * item );
+
+
+    protected:
+
+	/**
+	 * Add 'sums' for 'key' in 'dir' to the index.
+	 **/
+	void add( DirInfo * dir, const Key & key, const Sums & sums );
+
+	/**
+	 * Subtract one file of 'size' with 'key' in 'dir' from the index.
+	 **/
+	void subtract( DirInfo * dir, const Key & key, FileSize size );
+
+	/**
+	 * Subtract all files in 'subtree' from the index.
+	 **/
+	void subtractSubtree( FileInfo * subtree );
+
+
+	// Data members
+
+	quint16				_categorizerGeneration;
+	MimeMatcher			_matcher;
+	KeySums				_totals;
+	QHash<DirInfo *, KeySums>	_dirs;
+	QHash<QString, QHash<DirInfo *, int> > _lastSuffixDirs;	// number of files
+    };
+
+
+    inline uint qHash( const FileTypeIndex::Key & key, uint seed = 0 )
+    {
+	return qHash( key.suffix, seed ) ^ qHash( key.lastSuffix ) ^ qHash( key.category );
+    }
+
+}	// namespace QDirStat
+
+
+#endif // ifndef FileTypeIndex_h
@@ -9,7 +9,6 @@
 
 #include "FileTypeStats.h"
 #include "DirTree.h"
-#include "FileInfoIterator.h"
 #include "MimeCategorizer.h"
 #include "Logger.h"
 #include "Exception.h"
@@ -109,70 +108,61 @@ void FileTypeStats::collect( FileInfo * dir )
     if ( ! dir )
 	return;
 
-    FileInfoIterator it( dir );
+    // The tree keeps an index of the file types in each directory, so for a
+    // normal directory only the sums of the directories in its subtree need
+    // to be added up. Dot entries, attics and the like are indexed right
+    // here.
 
-    while ( *it )
-    {
-	FileInfo * item = *it;
+    DirTree *	    tree  = dir->tree();
+    FileTypeIndex * index = 0;
+
+    if ( tree && dir->isDirInfo() && ! dir->isPseudoDir() &&
+	 ! FileTypeIndex::isInAttic( dir ) )
+	index = tree->fileTypeIndex();
 
-	if ( item->hasChildren() )
+    if ( index )
+    {
+	if ( dir == tree->root() )
 	{
-	    collect( item );
+	    add( index->totals() );
 	}
-	else if ( item->isFile() )
+	else
 	{
-	    QString suffix;
-
-	    // First attempt: Try the MIME categorizer.
-	    //
-	    // If it knows the file's suffix, it can much easier find the
-	    // correct one in case there are multiple to choose from, for
-	    // example ".tar.bz2", not ".bz2" for a bzipped tarball. But on
-	    // Linux systems, having multiple dots in filenames is very common,
-	    // e.g. in .deb or .rpm packages, so the longest possible suffix is
-	    // not always the useful one (because it might contain version
-	    // numbers and all kinds of irrelevant information).
-	    //
-	    // The suffixes the MIME categorizer knows are carefully
-	    // hand-crafted, so if it knows anything about a suffix, it's the
-	    // best choice.
-
-	    MimeCategory * category = _mimeCategorizer->category( item->name(), &suffix );
-
-	    if ( ! category )
-		category = _otherCategory;
-
-	    _categorySum[ category ] += item->size();
-	    ++_categoryCount[ category ];
-
-	    if ( suffix.isEmpty() )
+	    const QHash<DirInfo *, FileTypeIndex::KeySums> & dirs = index->dirs();
+
+	    for ( QHash<DirInfo *, FileTypeIndex::KeySums>::const_iterator it = dirs.constBegin();
+		  it != dirs.constEnd();
+		  ++it )
 	    {
-		if ( item->name().contains( '.' ) && ! item->name().startsWith( '.' ) )
-		{
-		    // Fall back to the last (i.e. the shortest) suffix if the
-		    // MIME categorizer didn't know it: Use section -1 (the
-		    // last one, ignoring any trailing '.' separator).
-		    //
-		    // The downside is that this would not find a ".tar.bz",
-		    // but just the ".bz" for a compressed tarball. But it's
-		    // much better than getting a ".eab7d88df-git.deb" rather
-		    // than a ".deb".
-
-		    suffix = item->name().section( '.', -1 );
-		}
+		if ( it.key() == dir || it.key()->isInSubtree( dir ) )
+		    add( it.value() );
 	    }
+	}
+    }
+    else
+    {
+	FileTypeIndex subtreeIndex( dir );
+	add( subtreeIndex.totals() );
+    }
+}
 
-	    suffix = suffix.toLower();
 
-	    if ( suffix.isEmpty() )
-		suffix = NO_SUFFIX;
+void FileTypeStats::add( const FileTypeIndex::KeySums & sums )
+{
+    for ( FileTypeIndex::KeySums::const_iterator it = sums.constBegin();
+	  it != sums.constEnd();
+	  ++it )
+    {
+	MimeCategory * category = it.key().category;
 
-	    _suffixSum[ suffix ] += item->size();
-	    ++_suffixCount[ suffix ];
-	}
-	// Disregard symlinks, block devices and other special files
+	if ( ! category )
+	    category = _otherCategory;
+
+	_categorySum  [ category ] += it.value().size;
+	_categoryCount[ category ] += it.value().count;
 
-	++it;
+	_suffixSum  [ it.key().suffix ] += it.value().size;
+	_suffixCount[ it.key().suffix ] += it.value().count;
     }
 }
 
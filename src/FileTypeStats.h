@@ -15,6 +15,7 @@
 
 #include "ui_file-type-stats-window.h"
 #include "DirInfo.h"
+#include "FileTypeIndex.h"
 
 #define NO_SUFFIX "//<No Suffix>" // A slash is illegal in Linux/Unix filenames
 
@@ -142,11 +143,16 @@ namespace QDirStat
 	/**
 	 * Collect information from the associated widget tree:
 	 *
-	 * Recursively go through the tree and collect sizes for each file type
-	 * (filename extension).
+	 * Collect sizes for each file type (filename extension) in the tree.
+	 * This uses the FileTypeIndex of the DirTree if possible.
 	 **/
 	void collect( FileInfo * dir );
 
+	/**
+	 * Add the sums of a FileTypeIndex.
+	 **/
+	void add( const FileTypeIndex::KeySums & sums );
+
 	/**
 	 * Remove useless content from the maps. On a Linux system, there tend
 	 * to be a lot of files that have a '.' in the name, but it's not a
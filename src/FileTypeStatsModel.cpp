@@ -0,0 +1,441 @@
+/*
+ *   File name: FileTypeStatsModel.cpp
+ *   Summary:	Data model for the file type statistics window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>
+
+#include <QFont>
+#include <QHash>
+#include <QPair>
+
+#include "FileTypeStatsModel.h"
+#include "FileTypeStats.h"
+#include "MimeCategory.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+FileTypeStatsModel::FileTypeStatsModel( QObject * parent ):
+    QAbstractItemModel( parent ),
+    _totalSize( 0LL ),
+    _sortCol( FT_TotalSizeCol ),
+    _sortOrder( Qt::DescendingOrder )
+{
+    // logDebug() << "init" << endl;
+}
+
+
+FileTypeStatsModel::~FileTypeStatsModel()
+{
+    // logDebug() << "destroying" << endl;
+}
+
+
+void FileTypeStatsModel::populate( const FileTypeStats * stats )
+{
+    beginResetModel();
+
+    _categories.clear();
+    _totalSize = stats ? stats->totalSize() : 0LL;
+
+    if ( ! stats )
+    {
+	endResetModel();
+	return;
+    }
+
+
+    //
+    // Toplevel rows for the categories
+    //
+
+    QHash<MimeCategory *, int> categoryRow;
+    int otherRow = -1;
+
+    for ( CategoryFileSizeMapIterator it = stats->categorySumBegin();
+	  it != stats->categorySumEnd();
+	  ++it )
+    {
+	MimeCategory * category = it.key();
+
+	if ( category )
+	{
+	    Category cat;
+	    cat.row.name     = category->name();
+	    cat.row.category = category;
+	    cat.row.count    = stats->categoryCount( category );
+	    cat.row.sum	     = it.value();
+	    cat.fetched	     = 0;
+
+	    categoryRow.insert( category, _categories.size() );
+
+	    if ( category == stats->otherCategory() )
+		otherRow = _categories.size();
+
+	    _categories << cat;
+	}
+    }
+
+
+    //
+    // Rows for each individual suffix (below a category)
+    //
+
+    QVector<Row> otherSuffixes;
+    int	     otherCount = 0;
+    FileSize otherSum	= 0LL;
+
+    for ( StringFileSizeMapIterator it = stats->suffixSumBegin();
+	  it != stats->suffixSumEnd();
+	  ++it )
+    {
+	Row row;
+	row.suffix   = it.key();
+	row.name     = row.suffix == NO_SUFFIX ? tr( "<No Extension>" ) : "*." + row.suffix;
+	row.category = stats->category( row.suffix );
+	row.count    = stats->suffixCount( row.suffix );
+	row.sum	     = it.value();
+
+	int parentRow = row.category ? categoryRow.value( row.category, -1 ) : -1;
+
+	if ( parentRow >= 0 )
+	{
+	    _categories[ parentRow ].suffixes << row;
+	}
+	else
+	{
+	    if ( row.category )
+		logError() << "ERROR: No parent category item for " << row.suffix << endl;
+
+	    otherSuffixes << row;
+	    otherCount += row.count;
+	    otherSum   += row.sum;
+	}
+    }
+
+    // Put the remaining suffixes below a separate category "other"
+
+    if ( ! otherSuffixes.isEmpty() )
+    {
+	if ( otherRow < 0 )
+	{
+	    Category cat;
+	    cat.row.category = stats->otherCategory();
+	    cat.row.count    = otherCount;
+	    cat.row.sum	     = otherSum;
+	    cat.fetched	     = 0;
+
+	    otherRow = _categories.size();
+	    _categories << cat;
+	}
+
+	_categories[ otherRow ].row.name = tr( "Other" );
+	_categories[ otherRow ].suffixes << otherSuffixes;
+    }
+
+    sortRows();
+
+    for ( int i=0; i < _categories.size(); ++i )
+	_categories[ i ].fetched = qMin( FILE_TYPE_TOP_N, _categories.at( i ).suffixes.size() );
+
+    endResetModel();
+}
+
+
+const FileTypeStatsModel::Row * FileTypeStatsModel::row( const QModelIndex & index ) const
+{
+    if ( ! index.isValid() )
+	return 0;
+
+    if ( index.internalId() == 0 )
+    {
+	return index.row() < _categories.size() ? &_categories.at( index.row() ).row : 0;
+    }
+
+    int categoryRow = index.internalId() - 1;
+
+    if ( categoryRow >= _categories.size() )
+	return 0;
+
+    const Category & cat = _categories.at( categoryRow );
+
+    return index.row() < cat.fetched ? &cat.suffixes.at( index.row() ) : 0;
+}
+
+
+QString FileTypeStatsModel::suffix( const QModelIndex & index ) const
+{
+    const Row * item = row( index );
+
+    return item ? item->suffix : QString();
+}
+
+
+MimeCategory * FileTypeStatsModel::category( const QModelIndex & index ) const
+{
+    if ( ! row( index ) )
+	return 0;
+
+    int categoryRow = index.internalId() == 0 ? index.row() : index.internalId() - 1;
+
+    return _categories.at( categoryRow ).row.category;
+}
+
+
+QModelIndex FileTypeStatsModel::index( int		   row,
+				       int		   column,
+				       const QModelIndex & parent ) const
+{
+    if ( row < 0 || column < 0 || column >= FT_ColumnCount )
+	return QModelIndex();
+
+    if ( ! parent.isValid() )
+    {
+	return row < _categories.size() ? createIndex( row, column, (quintptr) 0 ) : QModelIndex();
+    }
+
+    if ( parent.internalId() != 0 || parent.row() >= _categories.size() )
+	return QModelIndex();
+
+    if ( row >= _categories.at( parent.row() ).fetched )
+	return QModelIndex();
+
+    return createIndex( row, column, (quintptr) parent.row() + 1 );
+}
+
+
+QModelIndex FileTypeStatsModel::parent( const QModelIndex & index ) const
+{
+    if ( ! index.isValid() || index.internalId() == 0 )
+	return QModelIndex();
+
+    return createIndex( index.internalId() - 1, 0, (quintptr) 0 );
+}
+
+
+int FileTypeStatsModel::rowCount( const QModelIndex & parent ) const
+{
+    if ( ! parent.isValid() )
+	return _categories.size();
+
+    if ( parent.column() > 0 || parent.internalId() != 0 || parent.row() >= _categories.size() )
+	return 0;
+
+    return _categories.at( parent.row() ).fetched;
+}
+
+
+int FileTypeStatsModel::columnCount( const QModelIndex & parent ) const
+{
+    Q_UNUSED( parent );
+
+    return FT_ColumnCount;
+}
+
+
+bool FileTypeStatsModel::hasChildren( const QModelIndex & parent ) const
+{
+    if ( ! parent.isValid() )
+	return ! _categories.isEmpty();
+
+    if ( parent.column() > 0 || parent.internalId() != 0 || parent.row() >= _categories.size() )
+	return false;
+
+    return ! _categories.at( parent.row() ).suffixes.isEmpty();
+}
+
+
+bool FileTypeStatsModel::canFetchMore( const QModelIndex & parent ) const
+{
+    if ( ! parent.isValid() || parent.internalId() != 0 || parent.row() >= _categories.size() )
+	return false;
+
+    const Category & cat = _categories.at( parent.row() );
+
+    return cat.fetched < cat.suffixes.size();
+}
+
+
+void FileTypeStatsModel::fetchMore( const QModelIndex & parent )
+{
+    if ( ! canFetchMore( parent ) )
+	return;
+
+    Category & cat = _categories[ parent.row() ];
+    int newFetched = qMin( cat.fetched + FILE_TYPE_FETCH_CHUNK, cat.suffixes.size() );
+
+    beginInsertRows( parent.sibling( parent.row(), 0 ), cat.fetched, newFetched - 1 );
+    cat.fetched = newFetched;
+    endInsertRows();
+}
+
+
+QVariant FileTypeStatsModel::data( const QModelIndex & index, int role ) const
+{
+    const Row * item = row( index );
+
+    if ( ! item )
+	return QVariant();
+
+    switch ( role )
+    {
+	case Qt::DisplayRole:
+	    switch ( index.column() )
+	    {
+		case FT_NameCol:	return item->name;
+		case FT_CountCol:	return QString( "%1" ).arg( item->count );
+		case FT_TotalSizeCol:	return formatSize( item->sum );
+
+		case FT_PercentageCol:
+		    {
+			double percentage = _totalSize == 0LL ? 0.0 : ( 100.0 * item->sum ) / (double) _totalSize;
+			QString percentStr;
+			percentStr.setNum( percentage, 'f', 2 );
+
+			return percentStr + "%";
+		    }
+
+		default:
+		    return QVariant();
+	    }
+
+	case Qt::TextAlignmentRole:
+	    return index.column() == FT_NameCol ?
+		(int) ( Qt::AlignLeft  | Qt::AlignVCenter ) :
+		(int) ( Qt::AlignRight | Qt::AlignVCenter );
+
+	case Qt::FontRole:
+	    if ( index.internalId() == 0 )	// Category
+	    {
+		QFont font;
+		font.setBold( true );
+
+		return font;
+	    }
+	    return QVariant();
+
+	default:
+	    return QVariant();
+    }
+}
+
+
+QVariant FileTypeStatsModel::headerData( int		 section,
+					 Qt::Orientation orientation,
+					 int		 role ) const
+{
+    if ( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+	return QVariant();
+
+    switch ( section )
+    {
+	case FT_NameCol:	return tr( "Name"	);
+	case FT_CountCol:	return tr( "Number"	);
+	case FT_TotalSizeCol:	return tr( "Total Size" );
+	case FT_PercentageCol:	return tr( "Percentage" );
+	default:		return QVariant();
+    }
+}
+
+
+bool FileTypeStatsModel::lessThan( const Row & a, const Row & b ) const
+{
+    bool less;
+
+    switch ( _sortCol )
+    {
+	case FT_NameCol:	less = a.name  < b.name;  break;
+	case FT_CountCol:	less = a.count < b.count; break;
+	case FT_TotalSizeCol:
+	case FT_PercentageCol:
+	default:		less = a.sum   < b.sum;   break;
+    }
+
+    return less;
+}
+
+
+void FileTypeStatsModel::sortRows()
+{
+    auto cmp = [this]( const Row & a, const Row & b )
+	{
+	    return _sortOrder == Qt::AscendingOrder ? lessThan( a, b ) : lessThan( b, a );
+	};
+
+    std::stable_sort( _categories.begin(), _categories.end(),
+		      [&]( const Category & a, const Category & b ) { return cmp( a.row, b.row ); } );
+
+    for ( int i=0; i < _categories.size(); ++i )
+    {
+	QVector<Row> & suffixes = _categories[ i ].suffixes;
+	std::stable_sort( suffixes.begin(), suffixes.end(), cmp );
+    }
+}
+
+
+void FileTypeStatsModel::sort( int column, Qt::SortOrder order )
+{
+    if ( column == _sortCol && order == _sortOrder )
+	return;
+
+    emit layoutAboutToBeChanged();
+
+    // Remember where the persistent indexes (e.g. the current item) were
+
+    QModelIndexList oldIndexes = persistentIndexList();
+    QList<QPair<MimeCategory *, QString> > oldRows;
+
+    foreach ( const QModelIndex & index, oldIndexes )
+    {
+	oldRows << qMakePair( category( index ), suffix( index ) );
+    }
+
+    _sortCol   = column;
+    _sortOrder = order;
+    sortRows();
+
+    // Move them along with their rows; a suffix that is now beyond the
+    // fetched ones is gone from the view
+
+    for ( int i=0; i < oldIndexes.size(); ++i )
+    {
+	const QModelIndex & oldIndex = oldIndexes.at( i );
+	QModelIndex newIndex;
+
+	for ( int catRow = 0; catRow < _categories.size() && ! newIndex.isValid(); ++catRow )
+	{
+	    const Category & cat = _categories.at( catRow );
+
+	    if ( cat.row.category != oldRows.at( i ).first )
+		continue;
+
+	    if ( oldIndex.internalId() == 0 )
+	    {
+		newIndex = createIndex( catRow, oldIndex.column(), (quintptr) 0 );
+	    }
+	    else
+	    {
+		for ( int suffixRow = 0; suffixRow < cat.fetched; ++suffixRow )
+		{
+		    if ( cat.suffixes.at( suffixRow ).suffix == oldRows.at( i ).second )
+		    {
+			newIndex = createIndex( suffixRow, oldIndex.column(), (quintptr) catRow + 1 );
+			break;
+		    }
+		}
+	    }
+	}
+
+	changePersistentIndex( oldIndex, newIndex );
+    }
+
+    emit layoutChanged();
+}
@@ -0,0 +1,171 @@
+/*
+ *   File name: FileTypeStatsModel.h
+ *   Summary:	Data model for the file type statistics window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef FileTypeStatsModel_h
+#define FileTypeStatsModel_h
+
+#include <QAbstractItemModel>
+#include <QVector>
+
+#include "FileInfo.h"
+
+
+// Number of suffixes of each category that are there right away
+#define FILE_TYPE_TOP_N		100
+
+// Number of suffixes that are added each time a view wants more
+#define FILE_TYPE_FETCH_CHUNK	1000
+
+
+namespace QDirStat
+{
+    class FileTypeStats;
+    class MimeCategory;
+
+
+    /**
+     * Column numbers for the file type tree view
+     **/
+    enum FileTypeColumns
+    {
+	FT_NameCol = 0,
+	FT_CountCol,
+	FT_TotalSizeCol,
+	FT_PercentageCol,
+	FT_ColumnCount
+    };
+
+
+    /**
+     * Data model for the file type statistics window: The MIME categories
+     * are the toplevel items, the suffixes are their children.
+     *
+     * The data are copied from the FileTypeStats into flat vectors, but the
+     * suffixes of a category are only handed out to the view as far as it
+     * asks for them (see canFetchMore() and fetchMore()): The largest
+     * FILE_TYPE_TOP_N (in the current sort order) at first, then more in
+     * chunks of FILE_TYPE_FETCH_CHUNK. So a tree with hundreds of thousands
+     * of different pseudo suffixes (hash-named files, numbered logs) does
+     * not need an item for each of them.
+     **/
+    class FileTypeStatsModel: public QAbstractItemModel
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	FileTypeStatsModel( QObject * parent = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~FileTypeStatsModel();
+
+	/**
+	 * Take over the results of 'stats'. 0 means no results.
+	 **/
+	void populate( const FileTypeStats * stats );
+
+	/**
+	 * Return the suffix (as in FileTypeStats) of a suffix item or an
+	 * empty string for a category item.
+	 **/
+	QString suffix( const QModelIndex & index ) const;
+
+	/**
+	 * Return the MIME category of a category item or the one a suffix
+	 * item is listed under.
+	 **/
+	MimeCategory * category( const QModelIndex & index ) const;
+
+
+	//
+	// Reimplemented from QAbstractItemModel
+	//
+
+	virtual QModelIndex index( int		       row,
+				   int		       column,
+				   const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	virtual QModelIndex parent( const QModelIndex & index ) const Q_DECL_OVERRIDE;
+
+	virtual int rowCount   ( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+	virtual int columnCount( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	virtual bool hasChildren( const QModelIndex & parent = QModelIndex() ) const Q_DECL_OVERRIDE;
+
+	virtual bool canFetchMore( const QModelIndex & parent ) const Q_DECL_OVERRIDE;
+	virtual void fetchMore	 ( const QModelIndex & parent ) Q_DECL_OVERRIDE;
+
+	virtual QVariant data( const QModelIndex & index, int role ) const Q_DECL_OVERRIDE;
+
+	virtual QVariant headerData( int	     section,
+				     Qt::Orientation orientation,
+				     int	     role ) const Q_DECL_OVERRIDE;
+
+	/**
+	 * Sort by 'column'. This sorts all suffixes of each category, not
+	 * only the ones the view has so far.
+	 **/
+	virtual void sort( int column, Qt::SortOrder order = Qt::AscendingOrder ) Q_DECL_OVERRIDE;
+
+
+    protected:
+
+	/**
+	 * One line of the view: A category or a suffix.
+	 **/
+	struct Row
+	{
+	    QString	   name;
+	    QString	   suffix;	// empty for categories
+	    MimeCategory * category;
+	    int		   count;
+	    FileSize	   sum;
+	};
+
+	struct Category
+	{
+	    Row		 row;
+	    QVector<Row> suffixes;
+	    int		 fetched;	// the rows of the view
+	};
+
+	/**
+	 * Return the row of 'index' or 0 if there is none.
+	 **/
+	const Row * row( const QModelIndex & index ) const;
+
+	/**
+	 * Return 'true' if 'a' comes before 'b' in the current sort order.
+	 **/
+	bool lessThan( const Row & a, const Row & b ) const;
+
+	/**
+	 * Sort everything in the current sort order.
+	 **/
+	void sortRows();
+
+
+	//
+	// Data members
+	//
+
+	QVector<Category> _categories;
+	FileSize	  _totalSize;
+	int		  _sortCol;
+	Qt::SortOrder	  _sortOrder;
+    };
+
+}	// namespace QDirStat
+
+#endif	// FileTypeStatsModel_h
@@ -11,8 +11,7 @@
 #define FileTypeStatsWindow_h
 
 #include <QDialog>
-#include <QMap>
-#include <QTreeWidgetItem>
+#include <QModelIndex>
 #include <QPointer>
 
 #include "ui_file-type-stats-window.h"
@@ -24,6 +23,7 @@ namespace QDirStat
     class DirTree;
     class FileInfo;
     class FileTypeStats;
+    class FileTypeStatsModel;
     class MimeCategory;
     class SelectionModel;
     class LocateFileTypeWindow;
@@ -104,7 +104,7 @@ namespace QDirStat
 	/**
 	 * Enable or disable the actions depending on the current item.
 	 **/
-	void enableActions( QTreeWidgetItem * currentItem );
+	void enableActions();
 
     protected:
 
@@ -133,129 +133,10 @@ namespace QDirStat
         Subtree                     _subtree;
 	SelectionModel *	    _selectionModel;
 	FileTypeStats *		    _stats;
+	FileTypeStatsModel *	    _model;
 	static QPointer<LocateFileTypeWindow> _locateFileTypeWindow;
     };
 
-
-    /**
-     * Column numbers for the file type tree widget
-     **/
-    enum FileTypeColumns
-    {
-	FT_NameCol = 0,
-	FT_CountCol,
-	FT_TotalSizeCol,
-	FT_PercentageCol,
-	FT_ColumnCount
-    };
-
-
-    /**
-     * Item class for the file type tree widget, representing either a MIME
-     * category or a suffix.
-     **/
-    class FileTypeItem: public QTreeWidgetItem
-    {
-    public:
-
-	/**
-	 * Constructor. After creating, this item has to be inserted into the
-	 * tree at the appropriate place: Toplevel for categories, below a
-	 * category for suffixes.
-	 **/
-	FileTypeItem( const QString & name,
-		      int	      count,
-		      FileSize	      totalSize,
-		      float	      percentage );
-	//
-	// Getters
-	//
-
-	QString	 name()	      const { return _name; }
-	int	 count()      const { return _count; }
-	FileSize totalSize()  const { return _totalSize; }
-	float	 percentage() const { return _percentage; }
-
-	/**
-	 * Set the font to bold face for all columns.
-	 **/
-	void setBold();
-
-	/**
-	 * Less-than operator for sorting.
-	 **/
-	virtual bool operator<(const QTreeWidgetItem & other) const Q_DECL_OVERRIDE;
-
-    protected:
-
-	QString		_name;
-	int		_count;
-	FileSize	_totalSize;
-	float		_percentage;
-    };
-
-
-    /**
-     * Specialized item class for MIME categories.
-     **/
-    class CategoryFileTypeItem: public FileTypeItem
-    {
-    public:
-
-	/**
-	 * Constructor.
-	 **/
-	CategoryFileTypeItem( MimeCategory * category,
-			      int	     count,
-			      FileSize	     totalSize,
-			      float	     percentage );
-
-	/**
-	 * Return the MIME category of this item.
-	 **/
-	MimeCategory * category() const { return _category; }
-
-    protected:
-
-	MimeCategory * _category;
-    };
-
-
-    /**
-     * Specialized item class for suffix file types.
-     **/
-    class SuffixFileTypeItem: public FileTypeItem
-    {
-    public:
-
-	/**
-	 * Constructor.
-	 **/
-	SuffixFileTypeItem( const QString & suffix,
-			    int		    count,
-			    FileSize	    totalSize,
-			    float	    percentage );
-
-	/**
-	 * Return this file type's suffix.
-	 **/
-	QString suffix() const { return _suffix; }
-
-    protected:
-
-	QString _suffix;
-    };
-
-
-    /**
-     * Functor for std::sort to compare FileTypeItems by size descending.
-     **/
-    struct FileTypeItemCompare
-    {
-	bool operator() ( FileTypeItem * a, FileTypeItem * b )
-	    { return a->totalSize() > b->totalSize(); }
-    };
-
 } // namespace QDirStat
 
 
@@ -7,9 +7,17 @@
  */
 
 
+#include <errno.h>
+#include <string.h>	// strerror()
+#include <sys/statvfs.h>
+#include <thread>
+
+#include <QAtomicInt>
 #include <QFileIconProvider>
 
 #include "FilesystemsWindow.h"
+#include "BtrfsQgroups.h"
+#include "ZfsDatasets.h"
 #include "MountPoints.h"
 #include "SettingsHelpers.h"
 #include "HeaderTweaker.h"
@@ -17,17 +25,85 @@
 #include "Logger.h"
 #include "Exception.h"
 
-#define WARN_PERCENT	10.0
+#define WARN_PERCENT		       10.0
+#define SIZE_QUERY_CHECK_MILLISEC      100
+#define SIZE_QUERY_TIMEOUT_MILLISEC   3000
 
 using namespace QDirStat;
 
 
+namespace QDirStat
+{
+    /**
+     * The result of one statvfs() call in a worker thread. The worker only
+     * writes the values, then sets 'done'; the main thread only reads them
+     * after 'done' is set.
+     **/
+    struct SizeQuery
+    {
+	QByteArray  path;
+	QAtomicInt  done;
+	int	    errNo;
+	FileSize    total;
+	FileSize    free;
+	FileSize    available;
+	bool	    isBtrfs;
+	SubvolumeUsage subvolume;
+    };
+}
+
+
+namespace
+{
+    /**
+     * The queries that are not finished yet by path. A worker thread that
+     * hangs in statvfs() cannot be stopped, so a new query for the same
+     * path waits for the same worker instead of starting another one.
+     *
+     * This is only used in the main thread.
+     **/
+    QHash<QByteArray, QSharedPointer<SizeQuery> > pendingSizeQueries;
+
+
+    /**
+     * Call statvfs() for 'query'. This is called in a worker thread.
+     **/
+    void runSizeQuery( QSharedPointer<SizeQuery> query )
+    {
+	struct statvfs fs;
+
+	if ( statvfs( query->path.constData(), &fs ) == 0 )
+	{
+	    query->errNo     = 0;
+	    query->total     = (FileSize) fs.f_blocks * fs.f_frsize;
+	    query->free	     = (FileSize) fs.f_bfree  * fs.f_frsize;
+	    query->available = (FileSize) fs.f_bavail * fs.f_frsize;
+
+	    if ( query->isBtrfs )
+		query->subvolume = BtrfsQgroups::subvolumeUsage( QString::fromUtf8( query->path ) );
+	}
+	else
+	{
+	    query->errNo = errno;
+	}
+
+	query->done.storeRelease( 1 );
+    }
+
+}	// namespace
+
+
 FilesystemsWindow::FilesystemsWindow( QWidget * parent ):
     QDialog( parent ),
     _ui( new Ui::FilesystemsWindow )
 {
     CHECK_NEW( _ui );
     _ui->setupUi( this );
+    _sizeTimer.setInterval( SIZE_QUERY_CHECK_MILLISEC );
+
+    connect( &_sizeTimer, SIGNAL( timeout()	    ),
+	     this,	  SLOT	( checkSizeQueries() ) );
+
     MountPoints::reload();
     initWidgets();
     readWindowSettings( this, "FilesystemsWindow" );
@@ -52,6 +128,9 @@ void FilesystemsWindow::populate()
 	FilesystemItem * item = new FilesystemItem( mountPoint, _ui->fsTree );
 	CHECK_NEW( item );
 
+	if ( MountPoints::hasSizeInfo() )
+	    startSizeQuery( item );
+
 	QIcon icon = iconProvider.icon( mountPoint->isNetworkMount() ?
 					 QFileIconProvider::Network :
 					 QFileIconProvider::Drive      );
@@ -60,6 +139,112 @@ void FilesystemsWindow::populate()
 
     if ( MountPoints::hasBtrfs() )
 	showBtrfsFreeSizeWarning();
+
+    if ( MountPoints::hasZfs() )
+	ZfsDatasets::updateCacheAsync( this, [this]() { showDatasetUsage(); } );
+}
+
+
+void FilesystemsWindow::showDatasetUsage()
+{
+    for ( int i = 0; i < _ui->fsTree->topLevelItemCount(); ++i )
+    {
+	FilesystemItem * item = dynamic_cast<FilesystemItem *>( _ui->fsTree->topLevelItem( i ) );
+
+	if ( item )
+	{
+	    DatasetUsage usage = ZfsDatasets::cachedUsage( item->mountPath() );
+
+	    if ( usage.isValid() )
+		item->setDatasetUsage( usage );
+	}
+    }
+}
+
+
+void FilesystemsWindow::startSizeQuery( FilesystemItem * item )
+{
+    QByteArray path = item->mountPath().toUtf8();
+    QSharedPointer<SizeQuery> query = pendingSizeQueries.value( path );
+
+    if ( ! query )
+    {
+	query = QSharedPointer<SizeQuery>( new SizeQuery );
+	CHECK_NEW( query );
+
+	query->path	 = path;
+	query->errNo	 = 0;
+	query->total	 = -1;
+	query->free	 = -1;
+	query->available = -1;
+	query->isBtrfs	 = item->fsType().toLower() == "btrfs";
+
+	pendingSizeQueries.insert( path, query );
+
+	// Not a thread pool: A worker that hangs in statvfs() on a stale
+	// network mount can neither be canceled nor waited for, not even
+	// when the program exits.
+
+	std::thread( runSizeQuery, query ).detach();
+    }
+    else
+    {
+	logInfo() << "Still waiting for the sizes of " << item->mountPath() << endl;
+    }
+
+    if ( _sizeQueries.isEmpty() )
+    {
+	_sizeClock.start();
+	_sizeTimer.start();
+    }
+
+    _sizeQueries.insert( item, query );
+}
+
+
+void FilesystemsWindow::checkSizeQueries()
+{
+    bool overdue = _sizeClock.elapsed() > SIZE_QUERY_TIMEOUT_MILLISEC;
+    QHash<FilesystemItem *, QSharedPointer<SizeQuery> >::iterator it = _sizeQueries.begin();
+
+    while ( it != _sizeQueries.end() )
+    {
+	FilesystemItem *	  item	= it.key();
+	QSharedPointer<SizeQuery> query = it.value();
+
+	if ( query->done.loadAcquire() )
+	{
+	    pendingSizeQueries.remove( query->path );
+
+	    if ( query->errNo == 0 )
+	    {
+		item->setSizes( query->total, query->free, query->available );
+
+		if ( query->subvolume.isValid() )
+		    item->setSubvolumeUsage( query->subvolume );
+	    }
+	    else
+		item->setSizeMessage( tr( "error" ), QString::fromUtf8( strerror( query->errNo ) ) );
+
+	    it = _sizeQueries.erase( it );
+	}
+	else
+	{
+	    if ( overdue && ! item->hasSizes() && item->text( FS_TotalSizeCol ).isEmpty() )
+	    {
+		logWarning() << item->mountPath() << " is not responding" << endl;
+
+		item->setSizeMessage( tr( "not responding" ),
+				      tr( "The filesystem did not report its sizes in time.\n"
+					  "Its server might be unreachable." ) );
+	    }
+
+	    ++it;
+	}
+    }
+
+    if ( _sizeQueries.isEmpty() )
+	_sizeTimer.stop();
 }
 
 
@@ -90,6 +275,10 @@ void FilesystemsWindow::reject()
 
 void FilesystemsWindow::clear()
 {
+    // The workers keep any unfinished queries alive in 'pendingSizeQueries'
+
+    _sizeQueries.clear();
+    _sizeTimer.stop();
     _ui->fsTree->clear();
     _ui->messagePanel->clear();
 }
@@ -182,10 +371,10 @@ FilesystemItem::FilesystemItem( MountPoint  * mountPoint,
     _device	    ( mountPoint->device()	    ),
     _mountPath	    ( mountPoint->path()	    ),
     _fsType	    ( mountPoint->filesystemType()  ),
-    _totalSize	    ( mountPoint->totalSize()	    ),
-    _usedSize	    ( mountPoint->usedSize()	    ),
-    _reservedSize   ( mountPoint->reservedSize()    ),
-    _freeSize	    ( mountPoint->freeSizeForUser() ),
+    _totalSize	    ( -1 ),
+    _usedSize	    ( -1 ),
+    _reservedSize   ( -1 ),
+    _freeSize	    ( -1 ),
     _isNetworkMount ( mountPoint->isNetworkMount()  ),
     _isReadOnly	    ( mountPoint->isReadOnly()	    )
 {
@@ -196,10 +385,30 @@ FilesystemItem::FilesystemItem( MountPoint  * mountPoint,
     setText( FS_TypeCol,      _fsType	 );
 
     setTextAlignment( FS_TypeCol, Qt::AlignHCenter );
+}
 
-    if ( parent->columnCount() >= FS_TotalSizeCol && _totalSize >= 0 )
+
+void FilesystemItem::setSizes( FileSize total,
+			       FileSize free,
+			       FileSize available )
+{
+    _totalSize	  = total;
+    _usedSize	  = total - free;
+    _reservedSize = free  - available;
+    _freeSize	  = available;
+
+    QTreeWidget * parent = treeWidget();
+
+    for ( int col = FS_TotalSizeCol; col <= FS_FreePercentCol; ++col )
+    {
+	setText( col, "" );
+	setToolTip( col, "" );
+	setData( col, Qt::ForegroundRole, QVariant() );
+    }
+
+    if ( parent && parent->columnCount() >= FS_TotalSizeCol && _totalSize >= 0 )
     {
-	blanks = QString( 3, ' ' ); // Enforce left margin
+	QString blanks = QString( 3, ' ' ); // Enforce left margin
 
 	setText( FS_TotalSizeCol, blanks + formatSize( _totalSize	      ) );
 	setText( FS_UsedSizeCol,  blanks + formatSize( _usedSize	      ) );
@@ -234,6 +443,50 @@ FilesystemItem::FilesystemItem( MountPoint  * mountPoint,
 }
 
 
+void FilesystemItem::setSubvolumeUsage( const SubvolumeUsage & usage )
+{
+    QTreeWidget * parent = treeWidget();
+
+    if ( ! parent || parent->columnCount() <= FS_UsedSizeCol )
+	return;
+
+    setToolTip( FS_UsedSizeCol,
+		QObject::tr( "Subvolume %1: %2 referenced, %3 exclusive" )
+		.arg( _mountPath )
+		.arg( formatSize( usage.referenced ) )
+		.arg( formatSize( usage.exclusive  ) ) );
+}
+
+
+void FilesystemItem::setDatasetUsage( const DatasetUsage & usage )
+{
+    QTreeWidget * parent = treeWidget();
+
+    if ( ! parent || parent->columnCount() <= FS_UsedSizeCol )
+	return;
+
+    setToolTip( FS_UsedSizeCol,
+		QObject::tr( "Dataset %1\n%2" )
+		.arg( _device )
+		.arg( ZfsDatasets::summary( usage ) ) );
+}
+
+
+void FilesystemItem::setSizeMessage( const QString & message,
+				     const QString & toolTip )
+{
+    QTreeWidget * parent = treeWidget();
+
+    if ( ! parent || parent->columnCount() <= FS_TotalSizeCol )
+	return;
+
+    setText( FS_TotalSizeCol, message );
+    setToolTip( FS_TotalSizeCol, toolTip );
+    setTextAlignment( FS_TotalSizeCol, Qt::AlignHCenter );
+    setForeground( FS_TotalSizeCol, Qt::red );
+}
+
+
 bool FilesystemItem::operator<( const QTreeWidgetItem & rawOther ) const
 {
     const FilesystemItem & other = dynamic_cast<const FilesystemItem &>( rawOther );
@@ -11,6 +11,10 @@
 #define FilesystemsWindow_h
 
 #include <QDialog>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSharedPointer>
+#include <QTimer>
 #include <QTreeWidgetItem>
 
 #include "ui_filesystems-window.h"
@@ -21,6 +25,10 @@
 namespace QDirStat
 {
     class MountPoint;
+    class FilesystemItem;
+    struct SizeQuery;
+    struct SubvolumeUsage;
+    struct DatasetUsage;
 
     /**
      * Modeless dialog to display details about mounted filesystems:
@@ -34,6 +42,12 @@ namespace QDirStat
      *
      * The sizes may not be available on all platforms (no Qt 4 support!) or
      * for some filesystem types.
+     *
+     * The sizes are queried with statvfs() in worker threads, and each row
+     * is filled in when its answer arrives. A stale network mount can block
+     * that call for a very long time; such rows are marked as not
+     * responding after a timeout, but they are still filled in if the
+     * answer arrives later.
      **/
     class FilesystemsWindow: public QDialog
     {
@@ -105,6 +119,12 @@ namespace QDirStat
 	 **/
 	void readSelectedFilesystem();
 
+	/**
+	 * Check for size queries that are finished or overdue and update
+	 * their rows.
+	 **/
+	void checkSizeQueries();
+
 
     protected:
 
@@ -123,12 +143,27 @@ namespace QDirStat
 	 **/
 	void showBtrfsFreeSizeWarning();
 
+	/**
+	 * Show the dataset properties of the ZFS filesystems in the tool tips
+	 * of their "Used" column once they are read.
+	 **/
+	void showDatasetUsage();
+
+	/**
+	 * Start querying the sizes of the filesystem of 'item' in a worker
+	 * thread.
+	 **/
+	void startSizeQuery( FilesystemItem * item );
+
 
 	//
 	// Data members
 	//
 
-	Ui::FilesystemsWindow * _ui;
+	Ui::FilesystemsWindow *				   _ui;
+	QHash<FilesystemItem *, QSharedPointer<SizeQuery> > _sizeQueries;
+	QTimer						   _sizeTimer;
+	QElapsedTimer					   _sizeClock;
 
     };	// class FilesystemsWindow
 
@@ -172,6 +207,37 @@ namespace QDirStat
 	bool	 isNetworkMount() const { return _isNetworkMount; }
 	bool	 isReadOnly()	  const { return _isReadOnly;	  }
 
+	/**
+	 * Fill in the size columns from the raw statvfs() values: the total
+	 * size, the free size (including the part reserved for root) and the
+	 * free size for unprivileged users, all in bytes.
+	 **/
+	void setSizes( FileSize total, FileSize free, FileSize available );
+
+	/**
+	 * Show the quota group sizes of a Btrfs subvolume in the tool tip of
+	 * the "Used" column.
+	 **/
+	void setSubvolumeUsage( const SubvolumeUsage & usage );
+
+	/**
+	 * Show the dataset properties of a ZFS dataset in the tool tip of the
+	 * "Used" column.
+	 **/
+	void setDatasetUsage( const DatasetUsage & usage );
+
+	/**
+	 * Show 'message' instead of the sizes, e.g. if the filesystem does
+	 * not respond.
+	 **/
+	void setSizeMessage( const QString & message,
+			     const QString & toolTip = QString() );
+
+	/**
+	 * Return 'true' if the sizes are filled in.
+	 **/
+	bool hasSizes() const { return _totalSize >= 0; }
+
 	/**
 	 * Less-than operator for sorting.
 	 **/
@@ -0,0 +1,61 @@
+/*
+ *   File name: FindFilesDialog.cpp
+ *   Summary:	QDirStat "find files" dialog
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include "Qt4Compat.h"
+
+#include "FindFilesDialog.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+FindFilesDialog::FindFilesDialog( QWidget * parent ):
+    QDialog( parent ),
+    _ui( new Ui::FindFilesDialog )
+{
+    // logDebug() << "init" << endl;
+
+    CHECK_NEW( _ui );
+    _ui->setupUi( this );
+    qEnableClearButton( _ui->patternField );
+    _ui->patternField->setFocus();
+}
+
+
+FindFilesDialog::~FindFilesDialog()
+{
+    delete _ui;
+}
+
+
+PkgFilter FindFilesDialog::filter()
+{
+    int mode        = _ui->filterModeComboBox->currentIndex();
+    QString pattern = _ui->patternField->text();
+
+    return PkgFilter( pattern, (PkgFilter::FilterMode) mode );
+}
+
+
+PkgFilter FindFilesDialog::askFilter( bool &    canceled_ret,
+                                      QWidget * parent )
+{
+    FindFilesDialog dialog( parent );
+    int result = dialog.exec();
+
+    PkgFilter filter( "" );
+    canceled_ret = (result == QDialog::Rejected );
+
+    if ( ! canceled_ret )
+        filter = dialog.filter();
+
+    return filter;
+}
@@ -0,0 +1,64 @@
+/*
+ *   File name: FindFilesDialog.h
+ *   Summary:	QDirStat "find files" dialog
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef FindFilesDialog_h
+#define FindFilesDialog_h
+
+#include <QDialog>
+
+#include "ui_find-files-dialog.h"
+#include "PkgFilter.h"
+
+
+namespace QDirStat
+{
+    /**
+     * Dialog to let the user enter a name pattern to find files in the
+     * tree. The pattern uses the same filter modes as the ones for
+     * packages, so this returns a PkgFilter.
+     **/
+    class FindFilesDialog: public QDialog
+    {
+	Q_OBJECT
+
+    public:
+	/**
+	 * Constructor.
+	 *
+	 * Consider using the static method instead.
+	 **/
+	FindFilesDialog( QWidget * parent = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~FindFilesDialog();
+
+	/**
+	 * Open a "find files" dialog and wait for the user to enter
+	 * values. 'canceled_ret' is a return parameter that is set to 'true'
+	 * if the user canceled the dialog.
+	 **/
+	static PkgFilter askFilter( bool &    canceled_ret,
+				    QWidget * parent = 0   );
+
+	/**
+	 * The filter the user entered.
+	 **/
+	PkgFilter filter();
+
+    protected:
+
+	Ui::FindFilesDialog * _ui;
+
+    };	// class FindFilesDialog
+
+}	// namespace QDirStat
+
+#endif	// FindFilesDialog_h
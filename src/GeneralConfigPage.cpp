@@ -74,7 +74,9 @@ void GeneralConfigPage::readSettings()
     settings.beginGroup( "DirectoryTree" );
 
     _ui->crossFilesystemsCheckBox->setChecked( settings.value( "CrossFilesystems"    , false ).toBool() );
+    _ui->statxDontSyncCheckBox->setChecked   ( settings.value( "StatxDontSync"	     , false ).toBool() );
     _ui->treeUpdateIntervalSpinBox->setValue ( settings.value( "UpdateTimerMillisec" ,   333 ).toInt()  );
+    _ui->scanThreadsSpinBox->setValue	     ( settings.value( "ScanThreads"	     ,	   0 ).toInt()	);
     QString treeIconDir = settings.value( "TreeIconDir", ":/icons/tree-medium/" ).toString();
 
     int index = treeIconDir.contains( "/tree-small" ) ? 1 : 0;
@@ -101,7 +103,9 @@ void GeneralConfigPage::writeSettings()
     settings.beginGroup( "DirectoryTree" );
 
     settings.setValue( "CrossFilesystems"    , _ui->crossFilesystemsCheckBox->isChecked() );
+    settings.setValue( "StatxDontSync"	     , _ui->statxDontSyncCheckBox->isChecked()	  );
     settings.setValue( "UpdateTimerMillisec" , _ui->treeUpdateIntervalSpinBox->value()    );
+    settings.setValue( "ScanThreads"	     , _ui->scanThreadsSpinBox->value()		  );
 
     switch ( _ui->treeIconThemeComboBox->currentIndex() )
     {
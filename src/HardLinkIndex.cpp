@@ -0,0 +1,156 @@
+/*
+ *   File name: HardLinkIndex.cpp
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include "HardLinkIndex.h"
+#include "DirInfo.h"
+
+
+using namespace QDirStat;
+
+
+HardLinkIndex::HardLinkIndex():
+    _complete( true )
+{
+}
+
+
+bool HardLinkIndex::add( FileInfo * file, dev_t device, ino_t inode )
+{
+    Inode key = { device, inode };
+    FileInfoList & links = _inodes[ key ];
+
+    links << file;
+    _links.insert( file, key );
+
+    return links.size() > 1;
+}
+
+
+void HardLinkIndex::remove( FileInfo * subtree )
+{
+    if ( ! subtree || _links.isEmpty() )
+	return;
+
+    // There are only a few files with hard links even in big trees, so
+    // this is a lot cheaper than walking the subtree
+
+    QList<FileInfo *> removed;
+
+    if ( _links.contains( subtree ) )
+    {
+	removed << subtree;
+    }
+    else if ( subtree->isDirInfo() )
+    {
+	QHash<FileInfo *, Inode>::const_iterator it = _links.constBegin();
+
+	for ( ; it != _links.constEnd(); ++it )
+	{
+	    if ( it.key()->isInSubtree( subtree ) )
+		removed << it.key();
+	}
+    }
+
+    foreach ( FileInfo * file, removed )
+    {
+	Inode key = _links.take( file );
+	QHash<Inode, FileInfoList>::iterator it = _inodes.find( key );
+
+	if ( it == _inodes.end() )
+	    continue;
+
+	FileInfoList & links = it.value();
+	bool wasFirst = ! links.isEmpty() && links.first() == file;
+	links.removeOne( file );
+
+	if ( links.isEmpty() )
+	{
+	    _inodes.erase( it );
+	}
+	else if ( wasFirst && ! links.first()->isInSubtree( subtree ) )
+	{
+	    // The next link now counts for the totals
+
+	    FileInfo * next = links.first();
+	    next->setHardLinkCopy( false );
+
+	    if ( next->parent() )
+		next->parent()->markAncestorsDirty();
+	}
+    }
+}
+
+
+void HardLinkIndex::clear()
+{
+    _inodes.clear();
+    _links.clear();
+    _complete = true;
+}
+
+
+void HardLinkIndex::takeOver( HardLinkIndex & other )
+{
+    QHash<Inode, FileInfoList>::const_iterator it = other._inodes.constBegin();
+
+    for ( ; it != other._inodes.constEnd(); ++it )
+    {
+	foreach ( FileInfo * file, it.value() )
+	{
+	    if ( add( file, it.key().device, it.key().inode ) && ! file->isHardLinkCopy() )
+	    {
+		file->setHardLinkCopy( true );
+
+		if ( file->parent() )
+		    file->parent()->markAncestorsDirty();
+	    }
+	}
+    }
+
+    if ( ! other._complete )
+	_complete = false;
+
+    other.clear();
+}
+
+
+FileInfoList HardLinkIndex::links( FileInfo * file ) const
+{
+    QHash<FileInfo *, Inode>::const_iterator it = _links.constFind( file );
+
+    if ( it == _links.constEnd() )
+	return FileInfoList();
+
+    return _inodes.value( it.value() );
+}
+
+
+QList<FileInfoList> HardLinkIndex::groups( FileInfo * subtree ) const
+{
+    QList<FileInfoList> result;
+
+    if ( ! subtree )
+	return result;
+
+    foreach ( const FileInfoList & links, _inodes )
+    {
+	FileInfoList group;
+
+	foreach ( FileInfo * file, links )
+	{
+	    if ( file->isInSubtree( subtree ) )
+		group << file;
+	}
+
+	if ( ! group.isEmpty() )
+	    result << group;
+    }
+
+    return result;
+}
@@ -0,0 +1,139 @@
+/*
+ *   File name: HardLinkIndex.h
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef HardLinkIndex_h
+#define HardLinkIndex_h
+
+
+#include <sys/types.h>
+
+#include <QHash>
+#include <QList>
+
+#include "FileInfo.h"
+
+
+namespace QDirStat
+{
+    /**
+     * The files of a tree with more than one hard link, grouped by their
+     * device and inode number.
+     *
+     * FileInfo does not keep the inode number, so the DirTree fills this
+     * while reading, right when each file is created from its stat()
+     * data. Only files with more than one link are in here, so this is
+     * tiny compared to the tree.
+     *
+     * The first link to an inode that was found counts the size of the
+     * file for the totals, the others count 0 (see
+     * FileInfo::isHardLinkCopy()). When that first link is removed, the
+     * next one takes over.
+     *
+     * Files from a cache file don't have an inode number. They still
+     * distribute their size over all their links, and this index is not
+     * complete (see isComplete()).
+     **/
+    class HardLinkIndex
+    {
+    public:
+
+	/**
+	 * An inode on a device.
+	 **/
+	struct Inode
+	{
+	    dev_t device;
+	    ino_t inode;
+
+	    bool operator==( const Inode & other ) const
+		{ return inode == other.inode && device == other.device; }
+	};
+
+	/**
+	 * Constructor.
+	 **/
+	HardLinkIndex();
+
+	/**
+	 * Add 'file' with inode 'inode' on device 'device' to the index.
+	 * Return 'true' if another link to the same inode is already in
+	 * the index, i.e. if 'file' is a copy that does not count.
+	 **/
+	bool add( FileInfo * file, dev_t device, ino_t inode );
+
+	/**
+	 * Note that a file with more than one link was added to the tree
+	 * without an inode number, so it is not in the index.
+	 **/
+	void addUnknown() { _complete = false; }
+
+	/**
+	 * Remove all files in 'subtree' from the index. If the first link
+	 * to an inode goes away, the next one that is not in 'subtree'
+	 * counts for the totals from now on; the totals of its ancestors
+	 * are marked dirty.
+	 **/
+	void remove( FileInfo * subtree );
+
+	/**
+	 * Remove everything from the index.
+	 **/
+	void clear();
+
+	/**
+	 * Move all files from index 'other' to this one, e.g. when the
+	 * files were moved to this index's tree. Files that are now a copy
+	 * of a link that was already in this index stop counting for the
+	 * totals; the totals of their ancestors are marked dirty.
+	 **/
+	void takeOver( HardLinkIndex & other );
+
+	/**
+	 * Return 'true' if all files with more than one link in the tree
+	 * are in the index.
+	 **/
+	bool isComplete() const { return _complete; }
+
+	/**
+	 * Return the number of files in the index.
+	 **/
+	int size() const { return _links.size(); }
+
+	/**
+	 * Return all links in the tree to the same inode as 'file', the one
+	 * that counts first, or an empty list if 'file' is not in the index.
+	 **/
+	FileInfoList links( FileInfo * file ) const;
+
+	/**
+	 * Return the groups of links to the same inode that have at least
+	 * one link in 'subtree', with only the links in 'subtree'.
+	 **/
+	QList<FileInfoList> groups( FileInfo * subtree ) const;
+
+
+    protected:
+
+	// Data members
+
+	QHash<Inode, FileInfoList> _inodes;
+	QHash<FileInfo *, Inode>   _links;
+	bool			   _complete;
+    };
+
+
+    inline uint qHash( const HardLinkIndex::Inode & key, uint seed = 0 )
+    {
+	return qHash( (quint64) key.inode, seed ) ^ qHash( (quint64) key.device );
+    }
+
+}	// namespace QDirStat
+
+
+#endif // ifndef HardLinkIndex_h
@@ -217,33 +217,27 @@ void HistogramView::addQuartileText()
 
 void HistogramView::addHistogramBars()
 {
-    qreal barWidth = _histogramWidth / _buckets.size();
-    qreal maxVal   = _bucketMaxValue;
+    qreal maxVal = _bucketMaxValue;
 
     if ( _useLogHeightScale )
 	maxVal = log2( maxVal );
 
+    QRealList fillHeights;
+
     for ( int i=0; i < _buckets.size(); ++i )
     {
-	// logDebug() << "Adding bar #" << i << " with value " << _buckets[ i ] << endl;
-	QRectF rect;
-	rect.setX( i * barWidth );
-	rect.setY( 0 );
-	rect.setHeight( -_histogramHeight );
-	rect.setWidth( barWidth );
-
 	qreal val = _buckets[i];
 
 	if ( _useLogHeightScale && val > 1.0 )
 	    val = log2( val );
 
-	qreal fillHeight = maxVal == 0 ?
-	    0.0 :
-	    val / maxVal * _histogramHeight;
-
-	HistogramBar * bar = new HistogramBar( this, i, rect, fillHeight );
-	CHECK_NEW( bar );
+	fillHeights << ( maxVal == 0 ? 0.0 : val / maxVal * _histogramHeight );
     }
+
+    QRectF rect( 0, 0, _histogramWidth, -_histogramHeight );
+
+    HistogramBars * bars = new HistogramBars( this, rect, fillHeights );
+    CHECK_NEW( bars );
 }
 
 
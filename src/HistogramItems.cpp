@@ -6,9 +6,9 @@
  *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
  */
 
-#include <QGraphicsRectItem>
+#include <QGraphicsSceneHoverEvent>
 #include <QGraphicsSceneMouseEvent>
-#include <QToolTip>
+#include <QPainter>
 
 #include "HistogramItems.h"
 #include "FileInfo.h"
@@ -18,74 +18,115 @@
 using namespace QDirStat;
 
 
-HistogramBar::HistogramBar( HistogramView * parent,
-			    int		    number,
-			    const QRectF &  rect,
-			    qreal	    fillHeight ):
-    QGraphicsRectItem( rect ),
+HistogramBars::HistogramBars( HistogramView *	  parent,
+			      const QRectF &	  rect,
+			      const QRealList & fillHeights ):
+    QGraphicsItem(),
     _parentView( parent ),
-    _number( number )
+    _rect( rect.normalized() ),
+    _pen( parent->barPen() ),
+    _brush( parent->barBrush() ),
+    _barCount( fillHeights.size() ),
+    _toolTipBar( -1 )
 {
-    setPen( Qt::NoPen );
+    _barWidth = _barCount > 0 ? _rect.width() / _barCount : 0.0;
 
-    // Setting NoPen so this rectangle remains invisible: This full-height
-    // rectangle is just for clicking. For the bar content, we create a visible
-    // separate child item with the correct height.
+    for ( int i=0; i < _barCount; ++i )
+    {
+	// logDebug() << "Adding bar #" << i << " with height " << fillHeights[ i ] << endl;
 
-    QRectF childRect = rect;
-    childRect.setHeight( -fillHeight );
+	_path.addRect( QRectF( _rect.left() + i * _barWidth, _rect.bottom() - fillHeights[i],
+			       _barWidth, fillHeights[i] ) );
+    }
 
-    QGraphicsRectItem * filledRect = new QGraphicsRectItem( childRect, this );
-    CHECK_NEW( filledRect );
+    // Painting the path again only when the view is scaled; for moving
+    // the markers or for tooltips, the pixmap is enough.
 
-    filledRect->setPen( _parentView->barPen() );
-    filledRect->setBrush( _parentView->barBrush() );
+    setCacheMode( DeviceCoordinateCache );
+    setAcceptHoverEvents( true );
+    setZValue( HistogramView::BarLayer );
 
     // setFlags( ItemIsSelectable );
     _parentView->scene()->addItem( this );
+}
+
+
+int HistogramBars::barAt( const QPointF & pos ) const
+{
+    if ( _barWidth <= 0.0 || pos.x() < _rect.left() || pos.x() >= _rect.right() )
+	return -1;
+
+    return qMin( (int) ( ( pos.x() - _rect.left() ) / _barWidth ), _barCount - 1 );
+}
+
 
-    _startVal = _parentView->bucketStart( _number );
-    _endVal   = _parentView->bucketEnd  ( _number );
+QRectF HistogramBars::boundingRect() const
+{
+    qreal margin = _pen.widthF() / 2 + 0.5;
 
-    QString tooltip = QObject::tr( "Bucket #%1:\n%2 Files\n%3 .. %4" )
-	.arg( _number + 1 )
-	.arg( _parentView->bucket( _number ) )
-	.arg( formatSize( _startVal ) )
-	.arg( formatSize( _endVal ) );
+    return _rect.adjusted( -margin, -margin, margin, margin );
+}
 
-    setToolTip( tooltip );
-    filledRect->setToolTip( tooltip );
 
-    setZValue( HistogramView::InvisibleBarLayer );
-    filledRect->setZValue( HistogramView::BarLayer );
+void HistogramBars::paint( QPainter *			    painter,
+			   const QStyleOptionGraphicsItem * option,
+			   QWidget *			    widget )
+{
+    Q_UNUSED( option );
+    Q_UNUSED( widget );
+
+    painter->setPen( _pen );
+    painter->setBrush( _brush );
+    painter->drawPath( _path );
 }
 
 
-void HistogramBar::mousePressEvent( QGraphicsSceneMouseEvent * event )
+QString HistogramBars::barToolTip( int number ) const
 {
-    switch ( event->button() )
+    return QObject::tr( "Bucket #%1:\n%2 Files\n%3 .. %4" )
+	.arg( number + 1 )
+	.arg( _parentView->bucket( number ) )
+	.arg( formatSize( _parentView->bucketStart( number ) ) )
+	.arg( formatSize( _parentView->bucketEnd  ( number ) ) );
+}
+
+
+void HistogramBars::hoverMoveEvent( QGraphicsSceneHoverEvent * event )
+{
+    int number = barAt( event->pos() );
+
+    if ( number != _toolTipBar )
     {
-	case Qt::LeftButton:
-	    {
-		QGraphicsRectItem::mousePressEvent( event );
+	_toolTipBar = number;
+	setToolTip( number < 0 ? QString() : barToolTip( number ) );
+    }
 
-#if 0
-                // FIXME: This does not work. Why?
+    QGraphicsItem::hoverMoveEvent( event );
+}
 
-                QPointF pos( event->scenePos() );
-                QToolTip::showText( QPoint( pos.x(), pos.y() ), toolTip(), _parentView );
-#endif
 
-		logDebug() << "Histogram bar #" << _number
-			   << ": " << _parentView->bucket( _number ) << " items;"
-			   << " range: " << formatSize( _startVal )
-			   << " .. " << formatSize( _endVal )
-			   << endl;
+void HistogramBars::mousePressEvent( QGraphicsSceneMouseEvent * event )
+{
+    switch ( event->button() )
+    {
+	case Qt::LeftButton:
+	    {
+		QGraphicsItem::mousePressEvent( event );
+		int number = barAt( event->pos() );
+
+		if ( number >= 0 )
+		{
+		    logDebug() << "Histogram bar #" << number
+			       << ": " << _parentView->bucket( number ) << " items;"
+			       << " range: " << formatSize( _parentView->bucketStart( number ) )
+			       << " .. " << formatSize( _parentView->bucketEnd( number ) )
+			       << endl;
+		}
 	    }
 	    break;
 
 	default:
-	    QGraphicsRectItem::mousePressEvent( event );
+	    QGraphicsItem::mousePressEvent( event );
 	    break;
     }
 }
@@ -10,8 +10,9 @@
 #ifndef HistogramItems_h
 #define HistogramItems_h
 
-#include <QGraphicsRectItem>
+#include <QGraphicsItem>
 #include <QGraphicsLineItem>
+#include <QPainterPath>
 
 #include "HistogramItems.h"
 #include "HistogramView.h"
@@ -20,30 +21,61 @@
 namespace QDirStat
 {
     /**
-     * GraphicsItem class for a histogram bar.
+     * GraphicsItem class for all bars of a histogram.
      *
-     * This creates an invisible full-height item so it is clickable, even for
-     * very small values, and a visible child rectangle to display the correct
-     * height.
+     * The bars are one single path that is painted into a cached pixmap, so
+     * even the maximum number of buckets is only one item in the scene. The
+     * item covers the full height of the histogram, so each bar is
+     * clickable and has a tooltip, even for very small values.
      **/
-    class HistogramBar: public QGraphicsRectItem
+    class HistogramBars: public QGraphicsItem
     {
     public:
 	/**
-	 * Constructor. 'number' is the number of the bar (0 being the
-	 * leftmost) in the histogram.
+	 * Constructor. 'rect' is the area of the histogram from y = 0
+	 * upwards (i.e. with a negative height), 'fillHeights' are the
+	 * heights of the bars from left to right.
 	 **/
-	HistogramBar( HistogramView * parent,
-		      int	      number,
-		      const QRectF &  rect,
-		      qreal	      fillHeight );
+	HistogramBars( HistogramView *	 parent,
+		       const QRectF &	 rect,
+		       const QRealList & fillHeights );
 
 	/**
-	 * Return the number of this bar.
+	 * Return the number of the bar (0 being the leftmost) at 'pos' in
+	 * item coordinates or -1 if there is none.
 	 **/
-	int number() const { return _number; }
+	int barAt( const QPointF & pos ) const;
+
+	/**
+	 * Return the bounding rectangle.
+	 *
+	 * Reimplemented from QGraphicsItem.
+	 **/
+	virtual QRectF boundingRect() const Q_DECL_OVERRIDE;
+
+	/**
+	 * Paint the bars.
+	 *
+	 * Reimplemented from QGraphicsItem.
+	 **/
+	virtual void paint( QPainter *			     painter,
+			    const QStyleOptionGraphicsItem * option,
+			    QWidget *			     widget = 0 ) Q_DECL_OVERRIDE;
 
     protected:
+
+	/**
+	 * Return the tooltip for bar no. 'number'.
+	 **/
+	QString barToolTip( int number ) const;
+
+	/**
+	 * Hover move event: Switch the tooltip to the bar under the mouse.
+	 *
+	 * Reimplemented from QGraphicsItem.
+	 **/
+	virtual void hoverMoveEvent( QGraphicsSceneHoverEvent * event ) Q_DECL_OVERRIDE;
+
 	/**
 	 * Mouse press event
 	 *
@@ -52,9 +84,13 @@ namespace QDirStat
 	virtual void mousePressEvent( QGraphicsSceneMouseEvent * event ) Q_DECL_OVERRIDE;
 
 	HistogramView * _parentView;
-	int		_number;
-	qreal		_startVal;
-	qreal		_endVal;
+	QRectF		_rect;
+	QPainterPath	_path;
+	QPen		_pen;
+	QBrush		_brush;
+	qreal		_barWidth;
+	int		_barCount;
+	int		_toolTipBar;
     };
 
 
@@ -462,7 +462,11 @@ void HistogramView::fitToViewport()
     // this all by itself, but no: Everybody has to waste hours upon hours of
     // life time with this crap.
 
-    QRectF rect = scene()->sceneRect().normalized();
+    // QGraphicsScene never resets the min and max in both dimensions where it
+    // ever created QGraphicsItems, which makes its sceneRect() call pretty
+    // useless; the items know better.
+
+    QRectF rect = scene()->itemsBoundingRect().normalized();
     // logDebug() << "Old scene rect: " << rect << endl;
 
     scene()->setSceneRect( rect );
@@ -507,17 +511,22 @@ void HistogramView::rebuild()
     if ( _geometryDirty )
         autoResize();
 
-    // QGraphicsScene never resets the min and max in both dimensions where it
-    // ever created QGraphicsItems, which makes its sceneRect() call pretty
-    // useless. Let's create a new one without those bad old memories.
+    // Reusing the scene: Creating a new one each time is expensive while
+    // the percentiles are changed interactively. fitToViewport() sets the
+    // scene rect from the items instead.
 
     if ( scene() )
-	delete scene();
-
-    QGraphicsScene * newScene = new QGraphicsScene( this );
-    CHECK_NEW( newScene);
-    setScene( newScene );
-    scene()->setBackgroundBrush( Qt::white );
+    {
+	scene()->clear();
+	scene()->setSceneRect( QRectF() );
+    }
+    else
+    {
+	QGraphicsScene * newScene = new QGraphicsScene( this );
+	CHECK_NEW( newScene);
+	setScene( newScene );
+	scene()->setBackgroundBrush( Qt::white );
+    }
 
     if ( _buckets.size() < 1 || _percentiles.size() != 101 )
     {
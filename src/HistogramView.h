@@ -67,7 +67,6 @@ namespace QDirStat
         {
             PanelBackgroundLayer = -100,
             MiscLayer = 0, // Default if no zValue specified
-            InvisibleBarLayer,
             BarLayer,
             AxisLayer,
             MarkerLayer,
@@ -0,0 +1,943 @@
+/*
+ *   File name: ImportReader.cpp
+ *   Summary:	Importers for file lists from other tools for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>
+#include <ctype.h>	// isspace(), isdigit()
+#include <stdlib.h>	// strtod()
+#include <string.h>	// memchr()
+
+#include <QDateTime>
+#include <QMutexLocker>
+
+#include "ImportReader.h"
+#include "DirInfo.h"
+#include "DirTree.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+ImportReader * ImportReader::create( const QString & url, DirTree * tree )
+{
+    ImportReader * reader = 0;
+
+    if ( url.startsWith( NCDU_URL_PREFIX ) )
+	reader = new NcduReader( url.mid( QString( NCDU_URL_PREFIX ).size() ), tree );
+    else if ( url.startsWith( FILE_LIST_URL_PREFIX ) )
+	reader = new FileListReader( url.mid( QString( FILE_LIST_URL_PREFIX ).size() ), tree );
+    else
+	return 0;
+
+    CHECK_NEW( reader );
+
+    return reader;
+}
+
+
+ImportReader::ImportReader( const QString & fileName, DirTree * tree ):
+    _fileName( fileName ),
+    _file( fileName ),
+    _tree( tree ),
+    _toplevel( 0 ),
+    _ok( true ),
+    _atEnd( false ),
+    _items( 0 )
+{
+    CHECK_PTR( _tree );
+
+    if ( ! _file.open( QIODevice::ReadOnly ) )
+    {
+	logError() << "Can't open " << _fileName << ": " << _file.errorString() << endl;
+	_ok = false;
+    }
+}
+
+
+ImportReader::~ImportReader()
+{
+    if ( ! _atEnd && ! _tree->beingDestroyed() )
+	finalizeTree( DirAborted );
+}
+
+
+DirInfo * ImportReader::createToplevel( const QString & name,
+					mode_t		mode,
+					FileSize	size,
+					time_t		mtime )
+{
+    _toplevel = createDir( _tree->root(), name, mode, size, mtime );
+
+    return _toplevel;
+}
+
+
+DirInfo * ImportReader::createDir( DirInfo *	   parent,
+				   const QString & name,
+				   mode_t	   mode,
+				   FileSize	   size,
+				   time_t	   mtime )
+{
+    DirInfo * dir = new DirInfo( _tree, parent, name, mode, size, mtime );
+    CHECK_NEW( dir );
+
+    dir->setReadState( DirReading );
+    parent->insertChild( dir );
+    _tree->childAddedNotify( dir );
+
+    return dir;
+}
+
+
+void ImportReader::finalizeTree( DirReadState readState )
+{
+    if ( ! _toplevel )
+	return;
+
+    // Like CacheReader::finalizeTree()
+
+    QVector<DirInfo *> dirs;
+    dirs << _toplevel;
+
+    for ( int i = 0; i < dirs.size(); ++i )
+    {
+	DirInfo * dir = dirs.at( i );
+
+	if ( dir->readState() == DirReading )
+	    dir->setReadState( readState );
+
+	for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+	{
+	    if ( child->isDirInfo() && ! child->isDotEntry() )
+		dirs << child->toDirInfo();
+	}
+    }
+
+    // Subdirectories first, so each directory is finalized only once
+
+    for ( int i = dirs.size() - 1; i >= 0; --i )
+	dirs.at( i )->finalizeLocal();
+
+    foreach ( DirInfo * dir, dirs )
+    {
+	if ( dir->readState() != DirOnRequestOnly )
+	    _tree->sendReadJobFinished( dir );
+    }
+}
+
+
+void ImportReader::finish( DirReadState readState )
+{
+    logInfo() << "Imported " << _items << " items from " << _fileName << endl;
+
+    finalizeTree( readState );
+    _atEnd = true;
+}
+
+
+void ImportReader::forgetSubtree( FileInfo * subtree )
+{
+    if ( _toplevel && _toplevel->isInSubtree( subtree ) )
+    {
+	_toplevel = 0;
+	_atEnd	  = true;	// Nothing left to read into
+    }
+}
+
+
+
+
+void FileListChunk::parse()
+{
+    const char * pos = _text.constData();
+    const char * end = pos + _text.size();
+
+    while ( pos < end )
+    {
+	const char * newline = (const char *) memchr( pos, '\n', end - pos );
+	const char * lineEnd = newline ? newline : end;
+	int	     len     = lineEnd - pos;
+
+	if ( len > 0 && pos[ len - 1 ] == '\r' )
+	    --len;
+
+	if ( len > 0 && *pos != '#' )
+	{
+	    FileListEntry entry;
+
+	    if ( parseLine( pos, len, entry ) )
+		_entries << entry;
+	    else
+		++_badLines;
+	}
+
+	pos = lineEnd + 1;
+    }
+
+    _text = QByteArray();
+
+    QMutexLocker locker( &_mutex );
+    _done = true;
+    _doneCondition.wakeAll();
+}
+
+
+bool FileListChunk::waitForDone( int millisec )
+{
+    QMutexLocker locker( &_mutex );
+
+    if ( ! _done )
+	_doneCondition.wait( &_mutex, millisec );
+
+    return _done;
+}
+
+
+bool FileListChunk::parseLine( const char * line, int len, FileListEntry & entry )
+{
+    QByteArray text = QByteArray::fromRawData( line, len );
+    int separator = text.indexOf( " -- " );
+
+    if ( separator < 0 )
+	return false;
+
+    QList<QByteArray> fields = text.left( separator ).simplified().split( ' ' );
+    int	 field = fields.size() - 1;
+    bool ok    = false;
+
+    // MTIME: Seconds since the epoch or a date and a time
+
+    double mtime = fields.at( field ).toDouble( &ok );
+
+    if ( ! ok && field >= 1 )
+    {
+	QString	  timestamp = QString::fromLatin1( fields.at( field - 1 ) + ' ' + fields.at( field ).left( 8 ) );
+	QDateTime dateTime  = QDateTime::fromString( timestamp, "yyyy-MM-dd hh:mm:ss" );
+
+	ok    = dateTime.isValid();
+	mtime = dateTime.toMSecsSinceEpoch() / 1000;
+	--field;
+    }
+
+    if ( ! ok || field < 3 )
+	return false;
+
+    entry.mtime	 = (time_t) mtime;
+    entry.blocks = fields.at( field - 1 ).toLongLong( &ok ) * 2;
+
+    if ( ok )
+	entry.size = fields.at( field - 2 ).toLongLong( &ok );
+
+    if ( ! ok )
+	return false;
+
+    entry.type = fields.at( field - 3 ).at( 0 );
+
+    if ( entry.type == '-' )	// "-rw-r--r--"
+	entry.type = 'f';
+
+    // PATH
+
+    QByteArray path = text.mid( separator + 4 );
+
+    if ( path.contains( '%' ) )
+	path = QByteArray::fromPercentEncoding( path );
+
+    while ( path.size() > 1 && path.endsWith( '/' ) )
+	path.chop( 1 );
+
+    if ( ! path.startsWith( '/' ) )
+	return false;
+
+    entry.path = path;
+    entry.name = QFile::decodeName( path.mid( path.lastIndexOf( '/' ) + 1 ) );
+
+    return true;
+}
+
+
+
+
+FileListReader::FileListReader( const QString & fileName, DirTree * tree ):
+    ImportReader( fileName, tree ),
+    _lastDir( 0 ),
+    _badLines( 0 )
+{
+    if ( ! _ok )
+	return;
+
+    createToplevel( "/", S_IFDIR | 0755, 0, 0 );
+    _dirs.insert( "/", _toplevel );
+
+    logInfo() << "Importing file list " << _fileName << " with "
+	      << _threadPool.maxThreadCount() << " threads" << endl;
+}
+
+
+FileListReader::~FileListReader()
+{
+    _threadPool.clear();
+    _threadPool.waitForDone();
+}
+
+
+void FileListReader::startChunks()
+{
+    int maxChunks = 2 * qMax( 1, _threadPool.maxThreadCount() );
+
+    while ( _chunks.size() < maxChunks && ! _file.atEnd() )
+    {
+	QByteArray block = _file.read( FILE_LIST_CHUNK_SIZE );
+
+	if ( block.isEmpty() )
+	{
+	    logError() << "Error reading " << _fileName << ": " << _file.errorString() << endl;
+	    _ok = false;
+	    return;
+	}
+
+	block.prepend( _rest );
+	_rest.clear();
+
+	// Each chunk ends at a line boundary
+
+	if ( ! _file.atEnd() )
+	{
+	    int newline = block.lastIndexOf( '\n' );
+
+	    if ( newline < 0 )	// A very long line
+	    {
+		_rest = block;
+		continue;
+	    }
+
+	    _rest = block.mid( newline + 1 );
+	    block.truncate( newline + 1 );
+	}
+
+	FileListChunkPtr chunk( new FileListChunk( block ) );
+	CHECK_NEW( chunk.data() );
+
+	_chunks << chunk;
+	_threadPool.start( new FileListChunkTask( chunk ) );
+    }
+}
+
+
+void FileListReader::readFor( int millisec )
+{
+    if ( ! _ok || _atEnd )
+	return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while ( ! _atEnd )
+    {
+	startChunks();
+
+	if ( ! _ok )
+	    return;
+
+	if ( _chunks.isEmpty() )
+	{
+	    if ( _badLines > 0 )
+		logWarning() << _badLines << " invalid lines in " << _fileName << endl;
+
+	    finish( DirCached );
+	    return;
+	}
+
+	int remaining = millisec - timer.elapsed();
+
+	if ( remaining <= 0 || ! _chunks.first()->waitForDone( remaining ) )
+	    return;
+
+	FileListChunkPtr chunk = _chunks.takeFirst();
+	_badLines += chunk->badLines();
+
+	foreach ( const FileListEntry & entry, chunk->entries() )
+	    addEntry( entry );
+    }
+}
+
+
+void FileListReader::addEntry( const FileListEntry & entry )
+{
+    if ( entry.name.isEmpty() )		// "/"
+	return;
+
+    int	      slash  = entry.path.lastIndexOf( '/' );
+    DirInfo * parent = dir( slash > 0 ? entry.path.left( slash ) : QByteArray( "/" ) );
+
+    if ( ! parent )
+	return;
+
+    ++_items;
+
+    if ( entry.type == 'd' )
+    {
+	// Unless it was already created for one of its children
+
+	if ( ! _dirs.contains( entry.path ) )
+	    _dirs.insert( entry.path, createDir( parent, entry.name, S_IFDIR | 0755, entry.size, entry.mtime ) );
+
+	return;
+    }
+
+    mode_t mode;
+
+    switch ( entry.type )
+    {
+	case 'l': mode = S_IFLNK  | 0777; break;
+	case 'p': mode = S_IFIFO  | 0644; break;
+	case 's': mode = S_IFSOCK | 0644; break;
+	case 'c': mode = S_IFCHR  | 0644; break;
+	case 'b': mode = S_IFBLK  | 0644; break;
+	default:  mode = S_IFREG  | 0644; break;
+    }
+
+    FileInfo * item = new FileInfo( _tree, parent, entry.name, mode,
+				    entry.size, entry.mtime, entry.blocks );
+    CHECK_NEW( item );
+
+    parent->insertChild( item );
+    _tree->childAddedNotify( item );
+}
+
+
+DirInfo * FileListReader::dir( const QByteArray & path )
+{
+    if ( path == "/" )
+	return _toplevel;
+
+    // Most lines are from the same directory as the one before
+
+    if ( _lastDir && path == _lastDirPath )
+	return _lastDir;
+
+    DirInfo * result = _dirs.value( path, 0 );
+
+    if ( ! result )
+    {
+	int	  slash	 = path.lastIndexOf( '/' );
+	DirInfo * parent = dir( slash > 0 ? path.left( slash ) : QByteArray( "/" ) );
+
+	if ( ! parent )
+	    return 0;
+
+	result = createDir( parent, QFile::decodeName( path.mid( slash + 1 ) ), S_IFDIR | 0755, 0, 0 );
+	_dirs.insert( path, result );
+    }
+
+    _lastDirPath = path;
+    _lastDir	 = result;
+
+    return result;
+}
+
+
+void FileListReader::forgetSubtree( FileInfo * subtree )
+{
+    ImportReader::forgetSubtree( subtree );
+
+    QMutableHashIterator<QByteArray, DirInfo *> it( _dirs );
+
+    while ( it.hasNext() )
+    {
+	if ( it.next().value()->isInSubtree( subtree ) )
+	    it.remove();
+    }
+
+    _lastDir = 0;
+    _lastDirPath.clear();
+}
+
+
+
+
+NcduReader::NcduReader( const QString & fileName, DirTree * tree ):
+    ImportReader( fileName, tree ),
+    _data( 0 ),
+    _pos( 0 ),
+    _end( 0 )
+{
+    if ( ! _ok )
+	return;
+
+    _data = (const char *) _file.map( 0, _file.size() );
+
+    if ( ! _data )
+    {
+	logError() << "Can't map " << _fileName << ": " << _file.errorString() << endl;
+	_ok = false;
+	return;
+    }
+
+    _pos = _data;
+    _end = _data + _file.size();
+
+    if ( ! parseHeader() )
+    {
+	logError() << _fileName << " is not an ncdu export" << endl;
+	_ok = false;
+    }
+}
+
+
+NcduReader::~NcduReader()
+{
+    if ( _data )
+	_file.unmap( (uchar *) _data );
+}
+
+
+bool NcduReader::parseHeader()
+{
+    double majorVersion = 0.0;
+    double minorVersion = 0.0;
+
+    if ( ! expect( '[' ) || ! parseNumber( majorVersion ) || majorVersion != 1.0 ||
+	 ! expect( ',' ) || ! parseNumber( minorVersion ) || ! expect( ',' ) ||
+	 peek() != '{'	 || ! skipValue()		  ||	// metadata
+	 ! expect( ',' ) || ! expect( '[' ) )
+    {
+	return false;
+    }
+
+    Item item;
+
+    if ( ! parseItem( item ) )
+	return false;
+
+    createToplevel( QFile::decodeName( item.name ),
+		    S_ISDIR( item.mode ) ? item.mode : S_IFDIR | 0755,
+		    item.asize, item.mtime );
+    _dirStack << _toplevel;
+
+    return true;
+}
+
+
+void NcduReader::readFor( int millisec )
+{
+    if ( ! _ok || _atEnd )
+	return;
+
+    QElapsedTimer timer;
+    timer.start();
+    int count = 0;
+
+    while ( ! _dirStack.isEmpty() )
+    {
+	if ( ! parseNext() )
+	{
+	    logError() << "Syntax error in " << _fileName << " at byte " << _pos - _data << endl;
+	    _ok = false;
+	    return;
+	}
+
+	if ( ++count % IMPORT_CHECK_INTERVAL == 0 && timer.hasExpired( millisec ) )
+	    return;
+    }
+
+    finish( DirCached );
+}
+
+
+bool NcduReader::parseNext()
+{
+    char next = peek();
+
+    if ( next == ',' )
+    {
+	++_pos;
+	next = peek();
+    }
+
+    Item item;
+
+    switch ( next )
+    {
+	case ']':	// End of the current directory
+	    ++_pos;
+	    _dirStack.removeLast();
+	    return true;
+
+	case '{':	// A file
+	    if ( ! parseItem( item ) )
+		return false;
+
+	    addItem( item, false );
+	    return true;
+
+	case '[':	// A directory with its attributes and its children
+	    ++_pos;
+
+	    if ( ! parseItem( item ) )
+		return false;
+
+	    addItem( item, true );
+	    return true;
+
+	default:
+	    return false;
+    }
+}
+
+
+bool NcduReader::parseItem( Item & item )
+{
+    item.asize	   = 0;
+    item.dsize	   = -1;
+    item.mtime	   = 0;
+    item.mode	   = 0;
+    item.links	   = 1;
+    item.readError = false;
+    item.notReg	   = false;
+
+    if ( ! expect( '{' ) )
+	return false;
+
+    if ( peek() == '}' )
+    {
+	++_pos;
+	return true;
+    }
+
+    while ( true )
+    {
+	QByteArray key;
+
+	if ( ! parseString( key ) || ! expect( ':' ) )
+	    return false;
+
+	char next = peek();
+	bool ok	  = true;
+
+	if ( key == "name" )
+	    ok = parseString( item.name );
+	else if ( key == "excluded" )
+	{
+	    // "pattern", "otherfs", "kernfs" or "frmlnk"
+
+	    if ( next == '"' )
+		ok = parseString( item.excluded );
+	    else if ( ( ok = skipValue() ) && next == 't' )
+		item.excluded = "yes";
+	}
+	else if ( key == "read_error" || key == "notreg" )
+	{
+	    ok = skipValue();
+
+	    if ( key == "read_error" )
+		item.readError = ( next == 't' );
+	    else
+		item.notReg    = ( next == 't' );
+	}
+	else if ( isdigit( next ) || next == '-' )
+	{
+	    double value = 0.0;
+	    ok = parseNumber( value );
+
+	    if	    ( key == "asize" ) item.asize = (FileSize) value;
+	    else if ( key == "dsize" ) item.dsize = (FileSize) value;
+	    else if ( key == "mtime" ) item.mtime = (time_t)   value;
+	    else if ( key == "mode"  ) item.mode  = (mode_t)   value;
+	    else if ( key == "nlink" ) item.links = (int)      value;
+	}
+	else
+	    ok = skipValue();
+
+	if ( ! ok )
+	    return false;
+
+	next = peek();
+
+	if ( next != ',' && next != '}' )
+	    return false;
+
+	++_pos;
+
+	if ( next == '}' )
+	    return true;
+    }
+}
+
+
+void NcduReader::addItem( const Item & item, bool isDir )
+{
+    DirInfo * parent = _dirStack.last();
+
+    if ( ! parent )	// Deleted while reading
+    {
+	if ( isDir )
+	    _dirStack << 0;
+
+	return;
+    }
+
+    ++_items;
+    QString name = QFile::decodeName( item.name );
+
+    // Excluded directories are objects like files, not arrays
+
+    bool excludedDir = ! item.excluded.isEmpty() && ( item.mode == 0 || S_ISDIR( item.mode ) );
+
+    if ( isDir || excludedDir )
+    {
+	DirInfo * dir = createDir( parent, name,
+				   S_ISDIR( item.mode ) ? item.mode : S_IFDIR | 0755,
+				   item.asize, item.mtime );
+
+	if ( isDir )
+	{
+	    if ( item.readError )
+		dir->setReadState( DirError );
+
+	    _dirStack << dir;
+	}
+	else
+	{
+	    dir->setExcluded();
+	    dir->setReadState( DirOnRequestOnly );
+	    dir->finalizeLocal();
+	    _tree->sendReadJobFinished( dir );
+	}
+
+	return;
+    }
+
+    mode_t mode = item.mode;
+
+    if ( mode == 0 )	// Without the extended information ("ncdu -e")
+	mode = item.notReg ? S_IFLNK | 0777 : S_IFREG | 0644;
+
+    FileInfo * newItem = new FileInfo( _tree, parent, name, mode,
+				       item.asize, item.mtime,
+				       item.dsize >= 0 ? item.dsize / STD_BLOCK_SIZE : -1,
+				       qMax( item.links, 1 ) );
+    CHECK_NEW( newItem );
+
+    parent->insertChild( newItem );
+    _tree->childAddedNotify( newItem );
+}
+
+
+char NcduReader::peek()
+{
+    while ( _pos < _end && isspace( (uchar) *_pos ) )
+	++_pos;
+
+    return _pos < _end ? *_pos : 0;
+}
+
+
+bool NcduReader::expect( char expected )
+{
+    if ( peek() != expected )
+	return false;
+
+    ++_pos;
+
+    return true;
+}
+
+
+static bool parseHex4( const char * pos, const char * end, uint & result )
+{
+    if ( end - pos < 4 )
+	return false;
+
+    bool ok = false;
+    result = QByteArray( pos, 4 ).toUInt( &ok, 16 );
+
+    return ok;
+}
+
+
+bool NcduReader::parseString( QByteArray & result )
+{
+    if ( peek() != '"' )
+	return false;
+
+    ++_pos;
+    result.clear();
+    const char * start = _pos;
+
+    while ( _pos < _end )
+    {
+	char current = *_pos;
+
+	if ( current == '"' )
+	{
+	    result.append( start, _pos - start );
+	    ++_pos;
+	    return true;
+	}
+
+	if ( current != '\\' )
+	{
+	    ++_pos;
+	    continue;
+	}
+
+	result.append( start, _pos - start );
+
+	if ( ++_pos >= _end )
+	    return false;
+
+	char escaped = *_pos++;
+
+	switch ( escaped )
+	{
+	    case 'b': result += '\b'; break;
+	    case 'f': result += '\f'; break;
+	    case 'n': result += '\n'; break;
+	    case 'r': result += '\r'; break;
+	    case 't': result += '\t'; break;
+
+	    case 'u':
+		{
+		    uint code = 0;
+
+		    if ( ! parseHex4( _pos, _end, code ) )
+			return false;
+
+		    _pos += 4;
+		    uint low = 0;
+
+		    if ( code >= 0xD800 && code < 0xDC00 &&	// Surrogate pair
+			 _end - _pos >= 6 && _pos[0] == '\\' && _pos[1] == 'u' &&
+			 parseHex4( _pos + 2, _end, low ) && low >= 0xDC00 && low < 0xE000 )
+		    {
+			code = 0x10000 + ( ( code - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+			_pos += 6;
+		    }
+
+		    if ( code < 0x80 )	// Keep raw bytes as they are
+			result += (char) code;
+		    else
+			result += QString::fromUcs4( &code, 1 ).toUtf8();
+		}
+		break;
+
+	    default:	// '"', '\\', '/'
+		result += escaped;
+		break;
+	}
+
+	start = _pos;
+    }
+
+    return false;
+}
+
+
+bool NcduReader::parseNumber( double & result )
+{
+    peek();
+
+    const char * start = _pos;
+
+    while ( _pos < _end && *_pos && ( isdigit( (uchar) *_pos ) || strchr( "+-.eE", *_pos ) ) )
+	++_pos;
+
+    int len = _pos - start;
+    char buffer[ 64 ];
+
+    if ( len == 0 || len >= (int) sizeof( buffer ) )
+	return false;
+
+    memcpy( buffer, start, len );
+    buffer[ len ] = 0;
+
+    char * numberEnd = 0;
+    result = strtod( buffer, &numberEnd );
+
+    return numberEnd == buffer + len;
+}
+
+
+bool NcduReader::skipValue()
+{
+    char next = peek();
+
+    if ( next == '"' )
+    {
+	QByteArray dummy;
+	return parseString( dummy );
+    }
+
+    if ( next == '{' || next == '[' )
+    {
+	char close = next == '{' ? '}' : ']';
+	++_pos;
+
+	if ( peek() == close )
+	{
+	    ++_pos;
+	    return true;
+	}
+
+	while ( true )
+	{
+	    if ( next == '{' )
+	    {
+		QByteArray key;
+
+		if ( ! parseString( key ) || ! expect( ':' ) )
+		    return false;
+	    }
+
+	    if ( ! skipValue() )
+		return false;
+
+	    char separator = peek();
+
+	    if ( separator != ',' && separator != close )
+		return false;
+
+	    ++_pos;
+
+	    if ( separator == close )
+		return true;
+	}
+    }
+
+    if ( next == 't' || next == 'f' || next == 'n' )	// true, false, null
+    {
+	while ( _pos < _end && isalpha( (uchar) *_pos ) )
+	    ++_pos;
+
+	return true;
+    }
+
+    double dummy = 0.0;
+
+    return parseNumber( dummy );
+}
+
+
+void NcduReader::forgetSubtree( FileInfo * subtree )
+{
+    ImportReader::forgetSubtree( subtree );
+
+    for ( int i = 0; i < _dirStack.size(); ++i )
+    {
+	if ( _dirStack.at( i ) && _dirStack.at( i )->isInSubtree( subtree ) )
+	{
+	    for ( int j = i; j < _dirStack.size(); ++j )
+		_dirStack[ j ] = 0;
+
+	    break;
+	}
+    }
+}
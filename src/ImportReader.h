@@ -0,0 +1,443 @@
+/*
+ *   File name: ImportReader.h
+ *   Summary:	Importers for file lists from other tools for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ImportReader_h
+#define ImportReader_h
+
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "FileInfo.h"		// FileSize
+
+
+// URLs of files to import: "ncdu:/tmp/export.json", "filelist:/tmp/list"
+#define NCDU_URL_PREFIX			"ncdu:"
+#define FILE_LIST_URL_PREFIX		"filelist:"
+
+// Milliseconds that an ImportReadJob reads in each time slice
+#define IMPORT_READ_SLICE_MILLISEC	50
+
+// Bytes of a file list that one worker thread parses at once
+#define FILE_LIST_CHUNK_SIZE		( 4 * 1024 * 1024 )
+
+// Number of items between checks of the time slice
+#define IMPORT_CHECK_INTERVAL		1024
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+
+    /**
+     * Abstract base class for readers that build a DirTree from what
+     * other tools already know about a filesystem, so it does not need to
+     * be scanned again (see ImportReadJob). The directories of the tree
+     * are marked as DirCached.
+     **/
+    class ImportReader
+    {
+    public:
+
+	/**
+	 * Create the reader for import URL 'url' that reads into the root
+	 * of 'tree' or return 0 if 'url' is not an import URL. Check ok()
+	 * afterwards.
+	 **/
+	static ImportReader * create( const QString & url, DirTree * tree );
+
+	/**
+	 * Destructor. If reading is not finished yet, the directories that
+	 * are read so far are marked as aborted.
+	 **/
+	virtual ~ImportReader();
+
+	/**
+	 * Return 'true' if everything went fine so far.
+	 **/
+	bool ok() const { return _ok; }
+
+	/**
+	 * Return 'true' if everything is read.
+	 **/
+	bool atEnd() const { return _atEnd; }
+
+	/**
+	 * Continue reading for about 'millisec' milliseconds.
+	 **/
+	virtual void readFor( int millisec ) = 0;
+
+	/**
+	 * Notification that 'subtree' is about to be deleted.
+	 *
+	 * Derived classes that keep pointers to directories need to
+	 * reimplement this and call this base class method.
+	 **/
+	virtual void forgetSubtree( FileInfo * subtree );
+
+
+    protected:
+
+	/**
+	 * Constructor. The file 'fileName' is opened here.
+	 **/
+	ImportReader( const QString & fileName, DirTree * tree );
+
+	/**
+	 * Create the toplevel directory 'name' below the root of the tree
+	 * and return it; this is also _toplevel.
+	 **/
+	DirInfo * createToplevel( const QString & name,
+				  mode_t	  mode,
+				  FileSize	  size,
+				  time_t	  mtime );
+
+	/**
+	 * Create a directory 'name' in 'parent' that is read now.
+	 **/
+	DirInfo * createDir( DirInfo *	     parent,
+			     const QString & name,
+			     mode_t	     mode,
+			     FileSize	     size,
+			     time_t	     mtime );
+
+	/**
+	 * Mark all directories as 'readState' (unless they are already
+	 * finished otherwise) and finalize them.
+	 **/
+	void finalizeTree( DirReadState readState );
+
+	/**
+	 * Finish reading with 'readState'.
+	 **/
+	void finish( DirReadState readState );
+
+
+	QString	   _fileName;
+	QFile	   _file;
+	DirTree *  _tree;
+	DirInfo *  _toplevel;
+	bool	   _ok;
+	bool	   _atEnd;
+	qint64	   _items;
+
+    };	// class ImportReader
+
+
+
+    /**
+     * One entry of a file list.
+     **/
+    struct FileListEntry
+    {
+	QByteArray path;	 // Raw, without escapes
+	QString	   name;
+	char	   type;	 // 'f', 'd', 'l' or another find(1) %y type
+	FileSize   size;
+	FileSize   blocks;	 // 512 byte blocks
+	time_t	   mtime;
+    };
+
+
+    /**
+     * A chunk of a file list that is parsed in a worker thread.
+     *
+     * This is thread-safe: parse() is called in the worker thread, all
+     * other methods in the main thread.
+     **/
+    class FileListChunk
+    {
+    public:
+
+	/**
+	 * Constructor for 'text' with complete lines.
+	 **/
+	FileListChunk( const QByteArray & text ):
+	    _text( text ),
+	    _badLines( 0 ),
+	    _done( false )
+	    {}
+
+	/**
+	 * Parse the lines. This is called in a worker thread.
+	 **/
+	void parse();
+
+	/**
+	 * Wait up to 'millisec' milliseconds for parse() to finish. Return
+	 * 'true' if it did.
+	 **/
+	bool waitForDone( int millisec );
+
+	/**
+	 * Return the entries. Only call this after waitForDone().
+	 **/
+	const QVector<FileListEntry> & entries() const { return _entries; }
+
+	/**
+	 * Return the number of lines that could not be parsed.
+	 **/
+	int badLines() const { return _badLines; }
+
+	/**
+	 * Parse one line 'line' of 'len' bytes into 'entry'. Return 'false'
+	 * if it is not valid.
+	 **/
+	static bool parseLine( const char * line, int len, FileListEntry & entry );
+
+    protected:
+
+	QByteArray		_text;
+	QVector<FileListEntry>	_entries;
+	int			_badLines;
+	bool			_done;
+	QMutex			_mutex;
+	QWaitCondition		_doneCondition;
+
+    };	// class FileListChunk
+
+
+    typedef QSharedPointer<FileListChunk> FileListChunkPtr;
+
+
+    /**
+     * Task for a QThreadPool that parses a FileListChunk.
+     **/
+    class FileListChunkTask: public QRunnable
+    {
+    public:
+
+	FileListChunkTask( FileListChunkPtr chunk ):
+	    _chunk( chunk )
+	    { setAutoDelete( true ); }
+
+	virtual void run() Q_DECL_OVERRIDE { _chunk->parse(); }
+
+    protected:
+
+	FileListChunkPtr _chunk;
+
+    };	// class FileListChunkTask
+
+
+
+    /**
+     * Importer for flat file lists with one line for each file, as they
+     * come from the policy engines of cluster filesystems (a GPFS
+     * mmapplypolicy LIST rule, a Lustre robinhood report) or from find(1):
+     *
+     *	   [...] TYPE SIZE KB_ALLOCATED MTIME -- PATH
+     *
+     * TYPE is a find(1) %y letter ('f', 'd', 'l', ...) or a mode string
+     * like "drwxr-xr-x", of which only the first character counts; MTIME
+     * is seconds since the epoch or "YYYY-MM-DD hh:mm:ss". Any fields
+     * before those four (like the inode, generation and snapshot ID of a
+     * GPFS list) are ignored. PATH is absolute; "%XX" is an escaped byte,
+     * like with ESCAPE '%' in a GPFS policy. With find(1):
+     *
+     *	   find /data -printf '%y %s %k %T@ -- %p\n'
+     *
+     * The lines may come in any order; directories that are not in the
+     * list are created as needed. The file is parsed in chunks by worker
+     * threads in parallel; only adding the entries to the tree is left
+     * for the main thread.
+     **/
+    class FileListReader: public ImportReader
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	FileListReader( const QString & fileName, DirTree * tree );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~FileListReader();
+
+	/**
+	 * Continue reading for about 'millisec' milliseconds.
+	 *
+	 * Implemented from ImportReader.
+	 **/
+	virtual void readFor( int millisec ) Q_DECL_OVERRIDE;
+
+	/**
+	 * Notification that 'subtree' is about to be deleted.
+	 *
+	 * Reimplemented from ImportReader.
+	 **/
+	virtual void forgetSubtree( FileInfo * subtree ) Q_DECL_OVERRIDE;
+
+    protected:
+
+	/**
+	 * Read more chunks from the file and hand them to the worker
+	 * threads until there are enough of them in progress.
+	 **/
+	void startChunks();
+
+	/**
+	 * Add 'entry' to the tree.
+	 **/
+	void addEntry( const FileListEntry & entry );
+
+	/**
+	 * Return the directory for raw path 'path'; create it and its
+	 * parents if it does not exist yet.
+	 **/
+	DirInfo * dir( const QByteArray & path );
+
+
+	QThreadPool		      _threadPool;
+	QList<FileListChunkPtr>	      _chunks;
+	QByteArray		      _rest;	// Incomplete line
+	QHash<QByteArray, DirInfo *>  _dirs;	// By raw path
+	QByteArray		      _lastDirPath;
+	DirInfo *		      _lastDir;
+	int			      _badLines;
+
+    };	// class FileListReader
+
+
+
+    /**
+     * Importer for the JSON export files of ncdu ("ncdu -o"):
+     *
+     *	   [1, 0, { metadata },
+     *	    [ { "name": "/dir", ... },
+     *	      { "name": "file", "asize": 123, "dsize": 4096, ... },
+     *	      [ { "name": "subdir", ... }, ... ],
+     *	      ...
+     *	    ]
+     *	   ]
+     *
+     * The file is mapped into memory and parsed as a stream, so even huge
+     * exports do not need more memory than the tree that is built from
+     * them.
+     **/
+    class NcduReader: public ImportReader
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	NcduReader( const QString & fileName, DirTree * tree );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~NcduReader();
+
+	/**
+	 * Continue reading for about 'millisec' milliseconds.
+	 *
+	 * Implemented from ImportReader.
+	 **/
+	virtual void readFor( int millisec ) Q_DECL_OVERRIDE;
+
+	/**
+	 * Notification that 'subtree' is about to be deleted.
+	 *
+	 * Reimplemented from ImportReader.
+	 **/
+	virtual void forgetSubtree( FileInfo * subtree ) Q_DECL_OVERRIDE;
+
+    protected:
+
+	/**
+	 * One item of the export.
+	 **/
+	struct Item
+	{
+	    QByteArray name;
+	    FileSize   asize;
+	    FileSize   dsize;
+	    time_t     mtime;
+	    mode_t     mode;
+	    int	       links;
+	    bool       readError;
+	    bool       notReg;
+	    QByteArray excluded;
+	};
+
+	/**
+	 * Parse the header of the export up to the toplevel directory.
+	 **/
+	bool parseHeader();
+
+	/**
+	 * Parse the next element of the current directory. Return 'false'
+	 * on a syntax error.
+	 **/
+	bool parseNext();
+
+	/**
+	 * Parse an object with the attributes of an item.
+	 **/
+	bool parseItem( Item & item );
+
+	/**
+	 * Add 'item' to the current directory. If 'isDir' is 'true', it
+	 * becomes the new current directory.
+	 **/
+	void addItem( const Item & item, bool isDir );
+
+	/**
+	 * Skip whitespace and return the next character or 0 at the end.
+	 **/
+	char peek();
+
+	/**
+	 * Skip whitespace and 'expected'. Return 'false' if that is not
+	 * the next character.
+	 **/
+	bool expect( char expected );
+
+	/**
+	 * Parse a string into 'result' without the quotes and escapes.
+	 **/
+	bool parseString( QByteArray & result );
+
+	/**
+	 * Parse a number.
+	 **/
+	bool parseNumber( double & result );
+
+	/**
+	 * Skip any value.
+	 **/
+	bool skipValue();
+
+
+	const char *	   _data;
+	const char *	   _pos;
+	const char *	   _end;
+	QVector<DirInfo *> _dirStack;	// 0 for directories that are gone
+
+    };	// class NcduReader
+
+}	// namespace QDirStat
+
+
+#endif	// ImportReader_h
@@ -0,0 +1,373 @@
+/*
+ *   File name: IoUringStatx.cpp
+ *   Summary:	Batched statx() via io_uring for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>	// memset()
+
+#include "IoUringStatx.h"
+
+#if HAVE_IO_URING_STATX
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#endif
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Per-thread holder for the ring so it is destroyed when the thread
+     * exits.
+     **/
+    struct RingHolder
+    {
+	RingHolder(): ring( 0 ), tried( false ) {}
+	~RingHolder() { delete ring; }
+
+	IoUringStatx *	ring;
+	bool		tried;
+    };
+
+    thread_local RingHolder ringHolder;
+}
+
+
+IoUringStatx::IoUringStatx( unsigned entries ):
+    _ringFd( -1 ),
+    _sqEntries( 0 ),
+    _cqEntries( 0 ),
+    _sqRing( 0 ),
+    _cqRing( 0 ),
+    _sqRingSize( 0 ),
+    _cqRingSize( 0 ),
+    _sqes( 0 ),
+    _sqesSize( 0 ),
+    _sqHead( 0 ),
+    _sqTail( 0 ),
+    _sqMask( 0 ),
+    _sqArray( 0 ),
+    _cqHead( 0 ),
+    _cqTail( 0 ),
+    _cqMask( 0 ),
+    _cqes( 0 )
+{
+#if HAVE_IO_URING_STATX
+
+    struct io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+
+    int fd = (int) syscall( __NR_io_uring_setup, entries, &params );
+
+    if ( fd < 0 )
+	return;
+
+    _ringFd    = fd;
+    _sqEntries = params.sq_entries;
+    _cqEntries = params.cq_entries;
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    _cqRingSize = params.cq_off.cqes  + params.cq_entries * sizeof( struct io_uring_cqe );
+
+    bool singleMmap = ( params.features & IORING_FEAT_SINGLE_MMAP );
+
+    if ( singleMmap )
+    {
+	if ( _cqRingSize > _sqRingSize )
+	    _sqRingSize = _cqRingSize;
+
+	_cqRingSize = 0;
+    }
+
+    _sqRing = mmap( 0, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    _ringFd, IORING_OFF_SQ_RING );
+
+    if ( _sqRing == MAP_FAILED )
+    {
+	_sqRing = 0;
+	close();
+	return;
+    }
+
+    if ( singleMmap )
+	_cqRing = _sqRing;
+    else
+    {
+	_cqRing = mmap( 0, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			_ringFd, IORING_OFF_CQ_RING );
+
+	if ( _cqRing == MAP_FAILED )
+	{
+	    _cqRing = 0;
+	    close();
+	    return;
+	}
+    }
+
+    _sqesSize = params.sq_entries * sizeof( struct io_uring_sqe );
+    _sqes = mmap( 0, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  _ringFd, IORING_OFF_SQES );
+
+    if ( _sqes == MAP_FAILED )
+    {
+	_sqes = 0;
+	close();
+	return;
+    }
+
+    char * sq = (char *) _sqRing;
+    char * cq = (char *) _cqRing;
+
+    _sqHead  = (unsigned *) ( sq + params.sq_off.head	      );
+    _sqTail  = (unsigned *) ( sq + params.sq_off.tail	      );
+    _sqMask  = (unsigned *) ( sq + params.sq_off.ring_mask    );
+    _sqArray = (unsigned *) ( sq + params.sq_off.array	      );
+    _cqHead  = (unsigned *) ( cq + params.cq_off.head	      );
+    _cqTail  = (unsigned *) ( cq + params.cq_off.tail	      );
+    _cqMask  = (unsigned *) ( cq + params.cq_off.ring_mask    );
+    _cqes    = (void *)	    ( cq + params.cq_off.cqes	      );
+
+    if ( ! probeStatx() )
+	close();
+
+#else
+    (void) entries;
+#endif
+}
+
+
+IoUringStatx::~IoUringStatx()
+{
+    close();
+}
+
+
+void IoUringStatx::close()
+{
+#if HAVE_IO_URING_STATX
+
+    if ( _sqes )
+	munmap( _sqes, _sqesSize );
+
+    if ( _cqRing && _cqRing != _sqRing )
+	munmap( _cqRing, _cqRingSize );
+
+    if ( _sqRing )
+	munmap( _sqRing, _sqRingSize );
+
+    if ( _ringFd >= 0 )
+	::close( _ringFd );
+
+#endif
+
+    _sqes   = 0;
+    _cqRing = 0;
+    _sqRing = 0;
+    _ringFd = -1;
+}
+
+
+bool IoUringStatx::probeStatx()
+{
+#if HAVE_IO_URING_STATX
+
+    // IORING_REGISTER_PROBE was introduced in the same kernel version
+    // (Linux 5.6) as IORING_OP_STATX, so if probing fails, there is no
+    // IORING_OP_STATX either.
+
+    const unsigned opCount = 256;
+    const size_t size = sizeof( struct io_uring_probe ) + opCount * sizeof( struct io_uring_probe_op );
+    char buffer[ size ];
+    memset( buffer, 0, size );
+    struct io_uring_probe * probe = (struct io_uring_probe *) buffer;
+
+    if ( syscall( __NR_io_uring_register, _ringFd, IORING_REGISTER_PROBE, probe, opCount ) < 0 )
+	return false;
+
+    if ( probe->last_op < IORING_OP_STATX )
+	return false;
+
+    return ( probe->ops[ IORING_OP_STATX ].flags & IO_URING_OP_SUPPORTED ) != 0;
+
+#else
+    return false;
+#endif
+}
+
+
+#if HAVE_IO_URING_STATX
+
+bool IoUringStatx::statx( int		       dirFd,
+			  const char * const * names,
+			  int		       count,
+			  int		       flags,
+			  unsigned	       mask,
+			  struct statx *       results,
+			  int *		       errNos )
+{
+    if ( ! isOk() )
+	return false;
+
+    struct io_uring_sqe * sqes = (struct io_uring_sqe *) _sqes;
+
+    int submitted = 0;	// Requests handed to the kernel
+    int completed = 0;	// Completion events harvested
+    int queued	  = 0;	// Requests in the submission queue, not yet submitted
+
+    while ( completed < count )
+    {
+	// Fill the submission queue as far as the completion queue can take
+	// the results
+
+	unsigned tail = *_sqTail;
+	unsigned head = __atomic_load_n( _sqHead, __ATOMIC_ACQUIRE );
+
+	while ( submitted + queued < count &&
+		tail - head < _sqEntries &&
+		submitted + queued - completed < (int) _cqEntries )
+	{
+	    int i = submitted + queued;
+	    unsigned index = tail & *_sqMask;
+	    struct io_uring_sqe * sqe = &sqes[ index ];
+
+	    memset( sqe, 0, sizeof( *sqe ) );
+	    sqe->opcode	     = IORING_OP_STATX;
+	    sqe->fd	     = dirFd;
+	    sqe->addr	     = (unsigned long) names[ i ];
+	    sqe->len	     = mask;
+	    sqe->off	     = (unsigned long) &results[ i ];
+	    sqe->statx_flags = flags;
+	    sqe->user_data   = i;
+
+	    _sqArray[ index ] = index;
+	    ++tail;
+	    ++queued;
+	}
+
+	__atomic_store_n( _sqTail, tail, __ATOMIC_RELEASE );
+
+	int ret = (int) syscall( __NR_io_uring_enter, _ringFd, queued, 1,
+				 IORING_ENTER_GETEVENTS, 0, 0 );
+	if ( ret < 0 )
+	{
+	    if ( errno == EINTR || errno == EAGAIN || errno == EBUSY )
+		continue;
+
+	    // Requests that were already submitted might still complete and
+	    // write into 'results', so don't return before that is done.
+	    // That is very unlikely, though; this is mostly a setup problem.
+
+	    drain( submitted - completed, count, errNos );
+	    close();
+	    return false;
+	}
+
+	submitted += ret;
+	queued	  -= ret;
+	completed += harvest( count, errNos );
+    }
+
+    return true;
+}
+
+
+int IoUringStatx::harvest( int count, int * errNos )
+{
+    struct io_uring_cqe * cqes = (struct io_uring_cqe *) _cqes;
+
+    unsigned cqHead = *_cqHead;
+    unsigned cqTail = __atomic_load_n( _cqTail, __ATOMIC_ACQUIRE );
+    int	     events = 0;
+
+    while ( cqHead != cqTail )
+    {
+	struct io_uring_cqe * cqe = &cqes[ cqHead & *_cqMask ];
+	int i = (int) cqe->user_data;
+
+	if ( i >= 0 && i < count )
+	    errNos[ i ] = cqe->res < 0 ? -cqe->res : 0;
+
+	++cqHead;
+	++events;
+    }
+
+    __atomic_store_n( _cqHead, cqHead, __ATOMIC_RELEASE );
+
+    return events;
+}
+
+
+void IoUringStatx::drain( int pending, int count, int * errNos )
+{
+    // There are never more requests in flight than the completion queue
+    // can take, so none of their events can get lost.
+
+    pending -= harvest( count, errNos );
+
+    while ( pending > 0 )
+    {
+	int ret = (int) syscall( __NR_io_uring_enter, _ringFd, 0, 1,
+				 IORING_ENTER_GETEVENTS, 0, 0 );
+
+	if ( ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+	{
+	    // Can't wait in the kernel: Poll the completion queue instead
+
+	    usleep( 1000 );
+	}
+
+	pending -= harvest( count, errNos );
+    }
+}
+
+#endif // HAVE_IO_URING_STATX
+
+
+IoUringStatx * IoUringStatx::forCurrentThread()
+{
+    if ( ! ringHolder.tried )
+    {
+	ringHolder.tried = true;
+
+	if ( isAvailable() )
+	{
+	    ringHolder.ring = new IoUringStatx();
+
+	    if ( ! ringHolder.ring->isOk() )
+	    {
+		delete ringHolder.ring;
+		ringHolder.ring = 0;
+	    }
+	}
+    }
+
+    if ( ringHolder.ring && ! ringHolder.ring->isOk() )
+    {
+	// The ring failed at some point; don't try again in this thread
+
+	delete ringHolder.ring;
+	ringHolder.ring = 0;
+    }
+
+    return ringHolder.ring;
+}
+
+
+bool IoUringStatx::isAvailable()
+{
+    // Probe only once per process: Initialization of function-local statics
+    // is thread-safe.
+
+    static bool available = IoUringStatx( 4 ).isOk();
+
+    return available;
+}
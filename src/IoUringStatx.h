@@ -0,0 +1,168 @@
+/*
+ *   File name: IoUringStatx.h
+ *   Summary:	Batched statx() via io_uring for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef IoUringStatx_h
+#define IoUringStatx_h
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+#define HAVE_IO_URING_STATX 0
+
+#if defined( __linux__ ) && defined( STATX_BASIC_STATS ) && defined( __has_include )
+#  if __has_include( <linux/io_uring.h> )
+#    undef  HAVE_IO_URING_STATX
+#    define HAVE_IO_URING_STATX 1
+#  endif
+#endif
+
+
+namespace QDirStat
+{
+    /**
+     * Batched statx() calls through the Linux io_uring interface: Instead of
+     * one blocking system call per directory entry, all requests for a
+     * directory are submitted to the kernel in one go, and the results are
+     * collected as they come in. On network filesystems this turns thousands
+     * of round trips into a handful of system calls.
+     *
+     * This uses the raw system calls, so there is no dependency on liburing.
+     *
+     * An object of this class owns one ring; it must be used from only one
+     * thread at a time. Use forCurrentThread() to get one for the current
+     * thread.
+     *
+     * If the kernel does not support io_uring or IORING_OP_STATX
+     * (Linux 5.6 and later), isOk() returns 'false', and the caller is
+     * expected to fall back to plain fstatat() calls.
+     **/
+    class IoUringStatx
+    {
+    public:
+
+	/**
+	 * Constructor. Set up a ring with 'entries' submission queue entries.
+	 **/
+	IoUringStatx( unsigned entries = 256 );
+
+	/**
+	 * Destructor.
+	 **/
+	~IoUringStatx();
+
+	/**
+	 * Return 'true' if the ring could be set up and the kernel supports
+	 * IORING_OP_STATX.
+	 **/
+	bool isOk() const { return _ringFd >= 0; }
+
+#if HAVE_IO_URING_STATX
+
+	/**
+	 * Call statx() for 'count' entries 'names' relative to directory
+	 * file descriptor 'dirFd' with 'flags' (AT_SYMLINK_NOFOLLOW etc.)
+	 * and 'mask' (STATX_* constants).
+	 *
+	 * The result of each call is stored in 'results[i]'. 'errNos[i]' is 0
+	 * on success and the errno value of that single statx() call
+	 * otherwise.
+	 *
+	 * This returns 'false' if the ring itself failed; in that case, the
+	 * caller should fall back to plain fstatat() for all entries.
+	 **/
+	bool statx( int			 dirFd,
+		    const char * const * names,
+		    int			 count,
+		    int			 flags,
+		    unsigned		 mask,
+		    struct statx *	 results,
+		    int *		 errNos );
+
+#endif
+
+	/**
+	 * Return the ring for the current thread, creating it if necessary.
+	 * This returns 0 if io_uring is not available.
+	 *
+	 * The ring is destroyed when the thread exits.
+	 **/
+	static IoUringStatx * forCurrentThread();
+
+	/**
+	 * Return 'true' if io_uring statx() is available on this system.
+	 **/
+	static bool isAvailable();
+
+
+    protected:
+
+	/**
+	 * Tear down the ring.
+	 **/
+	void close();
+
+	/**
+	 * Check if the kernel supports IORING_OP_STATX.
+	 **/
+	bool probeStatx();
+
+#if HAVE_IO_URING_STATX
+
+	/**
+	 * Take all events from the completion queue of a statx() call with
+	 * 'count' entries and store their errno values in 'errNos'. Return
+	 * the number of events.
+	 **/
+	int harvest( int count, int * errNos );
+
+	/**
+	 * Wait until the kernel is done with 'pending' requests that were
+	 * already submitted, so they can't write into their results any
+	 * more. This also works if io_uring_enter() fails: The kernel posts
+	 * the completions to the completion queue anyway.
+	 **/
+	void drain( int pending, int count, int * errNos );
+
+#endif
+
+
+	int		_ringFd;
+	unsigned	_sqEntries;
+	unsigned	_cqEntries;
+
+	void *		_sqRing;
+	void *		_cqRing;
+	size_t		_sqRingSize;
+	size_t		_cqRingSize;
+	void *		_sqes;
+	size_t		_sqesSize;
+
+	unsigned *	_sqHead;
+	unsigned *	_sqTail;
+	unsigned *	_sqMask;
+	unsigned *	_sqArray;
+	unsigned *	_cqHead;
+	unsigned *	_cqTail;
+	unsigned *	_cqMask;
+	void *		_cqes;
+
+    private:
+
+	// Disable copying
+	IoUringStatx( const IoUringStatx & );
+	IoUringStatx & operator=( const IoUringStatx & );
+
+    };	// class IoUringStatx
+
+}	// namespace QDirStat
+
+
+#endif // ifndef IoUringStatx_h
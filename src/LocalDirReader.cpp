@@ -0,0 +1,997 @@
+/*
+ *   File name: LocalDirReader.cpp
+ *   Summary:	Low-level local directory reading for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>	// AT_ constants (fstatat() flags)
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>	// PATH_MAX
+#include <stdint.h>
+#include <string.h>	// memset()
+#include <sys/sysmacros.h>	// makedev()
+#include <time.h>		// clock_gettime()
+
+#ifdef __linux__
+#  include <sys/syscall.h>	// SYS_getdents64
+#endif
+
+#include <algorithm>
+
+#include <QHash>
+#include <QObject>
+#include <QMetaObject>
+
+#include "LocalDirReader.h"
+#include "IoUringStatx.h"
+#include "ReadScheduler.h"
+#include "Tracer.h"
+
+#if HAVE_GETATTRLISTBULK
+#  include <sys/attr.h>
+#  include <sys/vnode.h>	// VREG, VDIR etc.
+#endif
+
+
+using namespace QDirStat;
+
+
+// Below this number of entries, io_uring is not worth the overhead
+#define IO_URING_MIN_ENTRIES	16
+
+// Number of statx() requests submitted at once; between those batches, an
+// abort() is noticed
+#define IO_URING_BATCH_SIZE	256
+
+
+#ifdef STATX_BASIC_STATS
+
+// The fields of struct stat that the FileInfo constructor actually uses
+// (st_dev is always returned) plus the i-number for hard link handling.
+// Everything else may be left out, which saves the filesystem some work.
+#define STATX_MASK	( STATX_TYPE  | STATX_MODE  | STATX_NLINK | STATX_UID  | \
+			  STATX_GID   | STATX_MTIME | STATX_INO	  | STATX_SIZE | \
+			  STATX_BLOCKS )
+
+// Set if the kernel turned out not to support statx()
+static QAtomicInt statxMissing( 0 );
+
+#endif
+
+
+bool LocalDirReader::_useIoUring    = false;
+bool LocalDirReader::_useBulkStat   = false;
+bool LocalDirReader::_statxDontSync = false;
+bool LocalDirReader::_resolveSymLinks = false;
+int  LocalDirReader::_chunkSize	    = 64 * 1024;
+
+
+#ifdef __linux__
+
+// The record format of the getdents64() system call. glibc does not export
+// this (at least not in all versions), but it is part of the kernel ABI.
+
+struct LinuxDirent64
+{
+    uint64_t	   d_ino;
+    int64_t	   d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char	   d_name[1];
+};
+
+#endif
+
+
+// Buffer size for getdents64(): Large enough for several hundred entries per
+// system call
+#define GETDENTS_BUFFER_SIZE	( 64 * 1024 )
+
+// The file type bits of st_mode for a d_type
+#ifndef DTTOIF
+#  define DTTOIF( dirType )	( (dirType) << 12 )
+#endif
+
+
+namespace QDirStat
+{
+    /**
+     * A directory entry while the names are collected: Only the i-number
+     * (for sorting), where the name is in the name buffer and the d_type
+     * (DT_UNKNOWN if the filesystem does not tell).
+     **/
+    struct RawDirEntry
+    {
+	ino_t	      ino;
+	int	      nameOffset;
+	int	      nameLen;
+	unsigned char type;
+	int	      attrIndex; // In _bulkAttrs, -1 if none
+    };
+}
+
+
+static bool lessByInode( const RawDirEntry & a, const RawDirEntry & b )
+{
+    return a.ino < b.ino;
+}
+
+
+/**
+ * Return a monotonic time stamp in nanoseconds.
+ **/
+static inline qint64 nowNanosec()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (qint64) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/**
+ * Return 'true' if 'name' is "." or "..".
+ **/
+static inline bool isDotOrDotDot( const char * name )
+{
+    return name[0] == '.' &&
+	( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) );
+}
+
+
+#if HAVE_GETATTRLISTBULK
+
+/**
+ * Copy the next attribute from a getattrlistbulk() buffer to 'value' and
+ * advance 'field' if 'attr' is in 'returned'. Return 'true' if it is.
+ **/
+template<typename T>
+static inline bool takeAttr( const char * & field,
+			     attrgroup_t    returned,
+			     attrgroup_t    attr,
+			     T *	    value )
+{
+    if ( ! ( returned & attr ) )
+	return false;
+
+    memcpy( value, field, sizeof( T ) );
+    field += sizeof( T );
+
+    return true;
+}
+
+
+/**
+ * Return the d_type for a vnode type.
+ **/
+static unsigned char vnodeDirType( fsobj_type_t objType )
+{
+    switch ( objType )
+    {
+	case VREG:  return DT_REG;
+	case VDIR:  return DT_DIR;
+	case VLNK:  return DT_LNK;
+	case VBLK:  return DT_BLK;
+	case VCHR:  return DT_CHR;
+	case VFIFO: return DT_FIFO;
+	case VSOCK: return DT_SOCK;
+	default:    return DT_UNKNOWN;
+    }
+}
+
+#endif
+
+
+#ifdef STATX_BASIC_STATS
+
+/**
+ * Convert a statx() result with the fields of STATX_MASK to the traditional
+ * struct stat.
+ **/
+static void statxToStat( const struct statx & stx, struct stat * statInfo )
+{
+    ino_t ino = statInfo->st_ino;
+    memset( statInfo, 0, sizeof( *statInfo ) );
+
+    statInfo->st_dev	= makedev( stx.stx_dev_major, stx.stx_dev_minor );
+    statInfo->st_ino	= ( stx.stx_mask & STATX_INO ) ? stx.stx_ino : ino;
+    statInfo->st_mode	= stx.stx_mode;
+    statInfo->st_nlink	= stx.stx_nlink;
+    statInfo->st_uid	= stx.stx_uid;
+    statInfo->st_gid	= stx.stx_gid;
+    statInfo->st_size	= stx.stx_size;
+    statInfo->st_blocks = stx.stx_blocks;
+    statInfo->st_mtime	= stx.stx_mtime.tv_sec;
+}
+
+#endif
+
+
+LocalDirReader::LocalDirReader( const QByteArray & dirName ):
+    _dirName( dirName ),
+    _result( NotRead ),
+    _dirFd( -1 ),
+    _diskDir( 0 ),
+    _atEnd( false ),
+    _dirDev( 0 ),
+    _countOnly( false ),
+    _done( 0 ),
+    _aborted( 0 ),
+    _readdirNanosec( 0 )
+{
+    // Make sure this is a deep copy: QByteArray's reference counting is
+    // thread-safe, but there is no need to share anything with the main
+    // thread other than what is explicitly handed over.
+
+    _dirName.detach();
+}
+
+
+LocalDirReader::~LocalDirReader()
+{
+    closeDir();
+}
+
+
+void LocalDirReader::read()
+{
+    if ( isDone() )
+	return;
+
+    if ( isAborted() )
+    {
+	closeDir();
+	setResult( Aborted );
+	return;
+    }
+
+    if ( _dirFd < 0 ) // First chunk
+    {
+	if ( access( _dirName.constData(), X_OK | R_OK ) != 0 )
+	{
+	    setResult( PermissionDenied );
+	    return;
+	}
+
+	if ( ! openDir() )
+	{
+	    setResult( OpenDirError );
+	    return;
+	}
+
+	if ( _useBulkStat || _countOnly )
+	{
+	    struct stat dirInfo;
+
+	    if ( fstat( _dirFd, &dirInfo ) == 0 )
+	    {
+		_dirDev = dirInfo.st_dev;
+
+		// Counting needs no stat information of the files at all
+
+		if ( ! _countOnly )
+		    _bulkStat = BulkInodeStat::forDirectory( _dirFd, _dirDev );
+	    }
+	}
+    }
+
+    int flags = statFlags();
+
+    _statLatency.clear();
+    qint64 startTime = nowNanosec();
+
+    RawDirEntryList rawEntries;
+    readNames( rawEntries );
+
+    _readdirNanosec = nowNanosec() - startTime;
+
+    // Process the entries in i-number order: Most filesystems store i-nodes
+    // sorted by i-number on disk, so (at least with rotational disks) seek
+    // times are minimized by this strategy. In chunked mode, this is only
+    // done within each chunk.
+    //
+    // Notice that this must not drop any entries with the same i-number: If
+    // a file has multiple hard links in the same directory, they all need to
+    // show up in the DirTree.
+    //
+    // Sorting the small (i-number, name offset) pairs is a lot cheaper than
+    // sorting the complete entries with their struct stat.
+
+    std::sort( rawEntries.begin(), rawEntries.end(), lessByInode );
+
+    _entries.resize( rawEntries.size() );
+
+    for ( int i = 0; i < rawEntries.size(); ++i )
+    {
+	LocalDirEntry & entry = _entries[ i ];
+
+	memset( &entry.statInfo, 0, sizeof( entry.statInfo ) );
+	entry.nameOffset      = rawEntries[ i ].nameOffset;
+	entry.nameLen	      = rawEntries[ i ].nameLen;
+	entry.statInfo.st_ino = rawEntries[ i ].ino;
+	entry.statErrno	      = 0;
+	entry.symLinkResolved = false;
+	entry.symLinkBroken   = false;
+
+	if ( _countOnly )
+	    entry.statInfo.st_mode = DTTOIF( rawEntries[ i ].type );
+	else if ( rawEntries[ i ].attrIndex >= 0 )
+	    entry.statInfo = _bulkAttrs.at( rawEntries[ i ].attrIndex );
+    }
+
+    rawEntries = RawDirEntryList();
+    _bulkAttrs = QVector<struct stat>();
+
+    int bulkCount = _countOnly ? statFromTypes() : _bulkStat ? statBulk() : 0;
+
+#if HAVE_GETATTRLISTBULK
+
+    if ( ! _countOnly )
+	bulkCount = statFromAttrList();
+
+#endif
+    int start	  = bulkCount;
+
+    if ( _useIoUring && _entries.size() - start >= IO_URING_MIN_ENTRIES )
+    {
+	qint64 batchStart = nowNanosec();
+	int    batchEnd	  = statIoUring( _dirFd, flags, start );
+
+	if ( batchEnd > start )
+	    _statLatency.add( ( nowNanosec() - batchStart ) / ( batchEnd - start ), batchEnd - start );
+
+	start = batchEnd;
+    }
+
+    qint64 statStart = nowNanosec();
+
+    for ( int i = start; i < _entries.size() && ! isAborted(); ++i )
+    {
+	statEntry( _dirFd, _entries[ i ], flags );
+
+	qint64 statEnd = nowNanosec();
+	_statLatency.add( statEnd - statStart );
+	statStart = statEnd;
+    }
+
+    if ( bulkCount > 0 && bulkCount < _entries.size() )
+    {
+	// Restore the i-number order
+
+	std::inplace_merge( _entries.begin(), _entries.begin() + bulkCount, _entries.end(),
+			    []( const LocalDirEntry & a, const LocalDirEntry & b )
+			    { return a.statInfo.st_ino < b.statInfo.st_ino; } );
+    }
+
+    if ( _countOnly )
+    {
+	// The sizes of the few entries that were stat()ed anyway would only
+	// make the totals look real.
+
+	for ( int i = 0; i < _entries.size(); ++i )
+	{
+	    _entries[ i ].statInfo.st_size   = 0;
+	    _entries[ i ].statInfo.st_blocks = 0;
+	}
+    }
+
+    if ( _resolveSymLinks && ! _countOnly && ! isAborted() )
+	resolveSymLinkTargets();
+
+    if ( _atEnd || isAborted() )
+	closeDir();
+
+    setResult( isAborted() ? Aborted : Ok );
+}
+
+
+void LocalDirReader::statNames( const QList<QByteArray> & names )
+{
+    if ( isDone() )
+	return;
+
+    if ( ! openDir() )
+    {
+	setResult( OpenDirError );
+	return;
+    }
+
+    _entries.resize( names.size() );
+
+    for ( int i = 0; i < names.size(); ++i )
+    {
+	LocalDirEntry & entry = _entries[ i ];
+
+	memset( &entry.statInfo, 0, sizeof( entry.statInfo ) );
+	entry.nameOffset = _names.size();
+	entry.nameLen	 = names.at( i ).size();
+	entry.statErrno	 = 0;
+	entry.symLinkResolved = false;
+	entry.symLinkBroken   = false;
+
+	_names.append( names.at( i ).constData(), entry.nameLen + 1 ); // Including the 0 byte
+    }
+
+    int flags = statFlags();
+    int start = 0;
+
+    if ( _useIoUring && _entries.size() >= IO_URING_MIN_ENTRIES )
+	start = statIoUring( _dirFd, flags, start );
+
+    for ( int i = start; i < _entries.size() && ! isAborted(); ++i )
+	statEntry( _dirFd, _entries[ i ], flags );
+
+    closeDir();
+    setResult( isAborted() ? Aborted : Ok );
+}
+
+
+bool LocalDirReader::nextChunk()
+{
+    if ( ! isDone() || _result != Ok || _atEnd )
+	return false;
+
+    clearEntries();
+    _result = NotRead;
+    _done.storeRelease( 0 );
+
+    return true;
+}
+
+
+void LocalDirReader::setResult( Result result )
+{
+    _result = result;
+    _done.storeRelease( 1 );
+}
+
+
+bool LocalDirReader::openDir()
+{
+#if defined( __linux__ ) || HAVE_GETATTRLISTBULK
+
+    _dirFd = ::open( _dirName.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+#else
+
+    _diskDir = ::opendir( _dirName.constData() );
+    _dirFd   = _diskDir ? dirfd( _diskDir ) : -1;
+
+#endif
+
+    return _dirFd >= 0;
+}
+
+
+void LocalDirReader::closeDir()
+{
+    if ( _diskDir )
+	closedir( _diskDir ); // This also closes _dirFd
+    else if ( _dirFd >= 0 )
+	::close( _dirFd );
+
+    _diskDir = 0;
+    _dirFd   = -1;
+    _atEnd   = true;
+    _bulkStat.clear();
+}
+
+
+void LocalDirReader::addName( const char *	 name,
+			      int		 len,
+			      ino_t		 ino,
+			      unsigned char	 type,
+			      RawDirEntryList & rawEntries )
+{
+    RawDirEntry rawEntry;
+    rawEntry.ino	= ino;
+    rawEntry.nameOffset = _names.size();
+    rawEntry.nameLen	= len;
+    rawEntry.type	= type;
+    rawEntry.attrIndex	= -1;
+    rawEntries.append( rawEntry );
+
+    _names.append( name, len + 1 ); // Including the terminating 0 byte
+}
+
+
+void LocalDirReader::readNames( RawDirEntryList & rawEntries )
+{
+#ifdef __linux__
+
+    // Use getdents64() directly with a large buffer: readdir() would use a
+    // much smaller one, and it would copy each entry once more.
+    //
+    // The chunk size is only checked after each buffer, so a chunk may have
+    // a few hundred entries more; but that way no partly used buffer needs
+    // to be kept until the next chunk.
+
+    QByteArray buffer( GETDENTS_BUFFER_SIZE, '\0' );
+    char * buf = buffer.data();
+
+    while ( ! isAborted() && ( _chunkSize <= 0 || rawEntries.size() < _chunkSize ) )
+    {
+	long len = syscall( SYS_getdents64, _dirFd, buf, GETDENTS_BUFFER_SIZE );
+
+	if ( len < 0 && errno == EINTR )
+	    continue;
+
+	if ( len <= 0 ) // End of directory or error
+	{
+	    _atEnd = true;
+	    break;
+	}
+
+	for ( long pos = 0; pos < len; )
+	{
+	    const LinuxDirent64 * dirEntry = (const LinuxDirent64 *) ( buf + pos );
+	    pos += dirEntry->d_reclen;
+
+	    if ( ! isDotOrDotDot( dirEntry->d_name ) )
+	    {
+		addName( dirEntry->d_name, strlen( dirEntry->d_name ), dirEntry->d_ino,
+			 dirEntry->d_type, rawEntries );
+	    }
+	}
+    }
+
+#elif HAVE_GETATTRLISTBULK
+
+    readAttrListBulk( rawEntries );
+
+#else
+
+    while ( ! isAborted() && ( _chunkSize <= 0 || rawEntries.size() < _chunkSize ) )
+    {
+	struct dirent * dirEntry = readdir( _diskDir );
+
+	if ( ! dirEntry )
+	{
+	    _atEnd = true;
+	    break;
+	}
+
+	if ( ! isDotOrDotDot( dirEntry->d_name ) )
+	{
+#ifdef _DIRENT_HAVE_D_TYPE
+	    unsigned char type = dirEntry->d_type;
+#else
+	    unsigned char type = DT_UNKNOWN;
+#endif
+	    addName( dirEntry->d_name, strlen( dirEntry->d_name ), dirEntry->d_ino,
+		     type, rawEntries );
+	}
+    }
+
+#endif
+}
+
+
+int LocalDirReader::statFromTypes()
+{
+    // Entries whose type is known from readdir() go to the front; both
+    // parts keep their i-number order. Directories are still stat()ed:
+    // They might be mount points, and they need their device.
+
+    LocalDirEntryList rest;
+    int found = 0;
+
+    for ( int i = 0; i < _entries.size(); ++i )
+    {
+	LocalDirEntry entry = _entries[ i ];
+
+	if ( entry.statInfo.st_mode != 0 && ! S_ISDIR( entry.statInfo.st_mode ) )
+	{
+	    entry.statInfo.st_dev   = _dirDev;
+	    entry.statInfo.st_nlink = 1;
+	    _entries[ found++ ] = entry;
+	}
+	else
+	{
+	    entry.statInfo.st_mode = 0;
+	    rest.append( entry );
+	}
+    }
+
+    for ( int i = 0; i < rest.size(); ++i )
+	_entries[ found + i ] = rest[ i ];
+
+    return found;
+}
+
+
+int LocalDirReader::statBulk()
+{
+    // Entries with a stat from the bulk table go to the front; both parts
+    // keep their i-number order.
+
+    LocalDirEntryList rest;
+    int found = 0;
+
+    for ( int i = 0; i < _entries.size(); ++i )
+    {
+	LocalDirEntry entry = _entries[ i ];
+
+	// Directories might be mount points, and then the i-number from
+	// getdents() is the one of the covered directory. Leave them to
+	// lstat().
+
+	if ( _bulkStat->lookup( entry.statInfo.st_ino, _dirDev, &entry.statInfo ) &&
+	     ! S_ISDIR( entry.statInfo.st_mode ) )
+	{
+	    _entries[ found++ ] = entry;
+	}
+	else
+	{
+	    rest.append( _entries[ i ] ); // Without any bulk stat data
+	}
+    }
+
+    for ( int i = 0; i < rest.size(); ++i )
+	_entries[ found + i ] = rest[ i ];
+
+    return found;
+}
+
+
+#if HAVE_GETATTRLISTBULK
+
+void LocalDirReader::readAttrListBulk( RawDirEntryList & rawEntries )
+{
+    // Only what lstat() would return for QDirStat. The data fork is what
+    // st_size and st_blocks are about; resource forks are not counted.
+
+    const attrgroup_t commonAttrs = ATTR_CMN_DEVID   | ATTR_CMN_OBJTYPE | ATTR_CMN_MODTIME    |
+				    ATTR_CMN_OWNERID | ATTR_CMN_GRPID	| ATTR_CMN_ACCESSMASK |
+				    ATTR_CMN_FILEID;
+    const attrgroup_t fileAttrs	  = ATTR_FILE_LINKCOUNT | ATTR_FILE_DATALENGTH | ATTR_FILE_DATAALLOCSIZE;
+
+    struct attrlist attrList;
+    memset( &attrList, 0, sizeof( attrList ) );
+    attrList.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attrList.commonattr	 = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_ERROR | ATTR_CMN_NAME | commonAttrs;
+    attrList.fileattr	 = fileAttrs;
+
+    QByteArray buffer( GETDENTS_BUFFER_SIZE, '\0' );
+    char * buf = buffer.data();
+
+    while ( ! isAborted() && ( _chunkSize <= 0 || rawEntries.size() < _chunkSize ) )
+    {
+	int count = getattrlistbulk( _dirFd, &attrList, buf, GETDENTS_BUFFER_SIZE, 0 );
+
+	if ( count < 0 && errno == EINTR )
+	    continue;
+
+	if ( count <= 0 ) // End of directory or error
+	{
+	    _atEnd = true;
+	    break;
+	}
+
+	const char * entryStart = buf;
+
+	for ( int i = 0; i < count; ++i )
+	{
+	    // Each entry starts with its length and the set of attributes
+	    // that are really there; those follow in the order of their
+	    // bits, except that the error code comes first.
+
+	    uint32_t length;
+	    attribute_set_t returned;
+	    const char * field = entryStart;
+
+	    memcpy( &length, field, sizeof( length ) );
+	    field += sizeof( length );
+	    memcpy( &returned, field, sizeof( returned ) );
+	    field += sizeof( returned );
+	    entryStart += length;
+
+	    uint32_t	    errorCode	  = 0;
+	    attrreference_t nameRef;
+	    dev_t	    dev		  = 0;
+	    fsobj_type_t    objType	  = VNON;
+	    struct timespec mtime	  = { 0, 0 };
+	    uid_t	    uid		  = 0;
+	    gid_t	    gid		  = 0;
+	    uint32_t	    accessMask	  = 0;
+	    uint64_t	    fileId	  = 0;
+	    uint32_t	    linkCount	  = 0;
+	    off_t	    dataLength	  = 0;
+	    off_t	    dataAllocSize = 0;
+
+	    takeAttr( field, returned.commonattr, ATTR_CMN_ERROR, &errorCode );
+	    const char * nameField = field;
+
+	    if ( ! takeAttr( field, returned.commonattr, ATTR_CMN_NAME, &nameRef ) )
+		continue;
+
+	    const char * name = nameField + nameRef.attr_dataoffset;
+
+	    takeAttr( field, returned.commonattr, ATTR_CMN_DEVID,      &dev	   );
+	    takeAttr( field, returned.commonattr, ATTR_CMN_OBJTYPE,    &objType	   );
+	    takeAttr( field, returned.commonattr, ATTR_CMN_MODTIME,    &mtime	   );
+	    takeAttr( field, returned.commonattr, ATTR_CMN_OWNERID,    &uid	   );
+	    takeAttr( field, returned.commonattr, ATTR_CMN_GRPID,      &gid	   );
+	    takeAttr( field, returned.commonattr, ATTR_CMN_ACCESSMASK, &accessMask );
+	    takeAttr( field, returned.commonattr, ATTR_CMN_FILEID,     &fileId	   );
+
+	    takeAttr( field, returned.fileattr, ATTR_FILE_LINKCOUNT,	 &linkCount	);
+	    takeAttr( field, returned.fileattr, ATTR_FILE_DATALENGTH,	 &dataLength	);
+	    takeAttr( field, returned.fileattr, ATTR_FILE_DATAALLOCSIZE, &dataAllocSize );
+
+	    if ( isDotOrDotDot( name ) )
+		continue;
+
+	    unsigned char type = vnodeDirType( objType );
+	    addName( name, strlen( name ), fileId, type, rawEntries );
+
+	    // Anything incomplete is left to lstat(), and so are directories
+	    // since they might be mount points
+
+	    if ( errorCode == 0 && type != DT_UNKNOWN && type != DT_DIR &&
+		 ( returned.commonattr & commonAttrs ) == commonAttrs &&
+		 ( returned.fileattr   & fileAttrs   ) == fileAttrs )
+	    {
+		struct stat statInfo;
+		memset( &statInfo, 0, sizeof( statInfo ) );
+
+		statInfo.st_dev	   = dev;
+		statInfo.st_ino	   = fileId;
+		statInfo.st_mode   = DTTOIF( type ) | ( accessMask & ~S_IFMT );
+		statInfo.st_nlink  = linkCount;
+		statInfo.st_uid	   = uid;
+		statInfo.st_gid	   = gid;
+		statInfo.st_size   = dataLength;
+		statInfo.st_blocks = ( dataAllocSize + 511 ) / 512;
+		statInfo.st_mtime  = mtime.tv_sec;
+
+		rawEntries.last().attrIndex = _bulkAttrs.size();
+		_bulkAttrs.append( statInfo );
+	    }
+	}
+    }
+}
+
+
+int LocalDirReader::statFromAttrList()
+{
+    // Entries with attributes from getattrlistbulk() go to the front; both
+    // parts keep their i-number order.
+
+    LocalDirEntryList rest;
+    int found = 0;
+
+    for ( int i = 0; i < _entries.size(); ++i )
+    {
+	const LocalDirEntry & entry = _entries[ i ];
+
+	if ( entry.statInfo.st_mode != 0 )
+	    _entries[ found++ ] = entry;
+	else
+	    rest.append( entry );
+    }
+
+    for ( int i = 0; i < rest.size(); ++i )
+	_entries[ found + i ] = rest[ i ];
+
+    return found;
+}
+
+#endif
+
+
+int LocalDirReader::statIoUring( int dirFd, int flags, int start )
+{
+    int done = start;
+
+#if HAVE_IO_URING_STATX
+
+    IoUringStatx * ring = IoUringStatx::forCurrentThread();
+
+    if ( ! ring )
+	return start;
+
+    QVector<const char *> names( IO_URING_BATCH_SIZE );
+    QVector<struct statx> results( IO_URING_BATCH_SIZE );
+    QVector<int>	  errNos( IO_URING_BATCH_SIZE );
+
+    while ( done < _entries.size() && ! isAborted() )
+    {
+	int count = qMin( _entries.size() - done, IO_URING_BATCH_SIZE );
+
+	for ( int i = 0; i < count; ++i )
+	    names[ i ] = rawName( _entries[ done + i ] );
+
+	if ( ! ring->statx( dirFd, names.constData(), count, statxFlags( flags ), STATX_MASK,
+			    results.data(), errNos.data() ) )
+	{
+	    break; // Fall back to fstatat() for the rest
+	}
+
+	for ( int i = 0; i < count; ++i )
+	{
+	    LocalDirEntry & entry = _entries[ done + i ];
+
+	    if ( errNos[ i ] == 0 )
+		statxToStat( results[ i ], &entry.statInfo );
+	    else
+	    {
+		entry.statErrno = errNos[ i ];
+	    }
+	}
+
+	done += count;
+    }
+
+#else
+    Q_UNUSED( dirFd );
+    Q_UNUSED( flags );
+#endif
+
+    return done;
+}
+
+
+
+void LocalDirReader::resolveSymLinkTargets()
+{
+    // The links of one directory often point to the same few targets
+    // (e.g. into the same package directory of a Nix store): Check each of
+    // them only once. This maps a target to 'true' if it is missing.
+
+    QHash<QByteArray, bool> brokenTargets;
+    QByteArray targetBuf( PATH_MAX, 0 );
+    int flags = statFlags();
+
+    for ( int i = 0; i < _entries.size() && ! isAborted(); ++i )
+    {
+	LocalDirEntry & entry = _entries[ i ];
+
+	if ( entry.statErrno != 0 || ! S_ISLNK( entry.statInfo.st_mode ) )
+	    continue;
+
+	ssize_t len = readlinkat( _dirFd, rawName( entry ), targetBuf.data(), targetBuf.size() );
+
+	if ( len <= 0 || len >= targetBuf.size() )
+	    continue;
+
+	QByteArray target( targetBuf.constData(), len );
+	QHash<QByteArray, bool>::const_iterator it = brokenTargets.constFind( target );
+	bool broken;
+
+	if ( it != brokenTargets.constEnd() )
+	{
+	    broken = it.value();
+	}
+	else
+	{
+	    // Relative targets start from this directory, just like with
+	    // the entry names
+
+	    struct stat statInfo;
+
+	    if ( fstatat( _dirFd, target.constData(), &statInfo, flags ) == 0 )
+		broken = false;
+	    else if ( errno == EACCES )	// We don't know
+		continue;
+	    else
+		broken = true;
+
+	    brokenTargets.insert( target, broken );
+	}
+
+	entry.symLinkResolved = true;
+	entry.symLinkBroken   = broken;
+    }
+}
+
+
+int LocalDirReader::statFlags()
+{
+    int flags = AT_SYMLINK_NOFOLLOW;
+
+#ifdef AT_NO_AUTOMOUNT
+    flags |= AT_NO_AUTOMOUNT;
+#endif
+
+    return flags;
+}
+
+
+int LocalDirReader::statxFlags( int flags )
+{
+#if defined( STATX_BASIC_STATS ) && defined( AT_STATX_DONT_SYNC )
+
+    if ( _statxDontSync )
+	flags |= AT_STATX_DONT_SYNC;
+
+#endif
+
+    return flags;
+}
+
+
+void LocalDirReader::statEntry( int dirFd, LocalDirEntry & entry, int flags )
+{
+#ifdef STATX_BASIC_STATS
+
+    if ( ! statxMissing.loadAcquire() )
+    {
+	struct statx stx;
+
+	if ( ::statx( dirFd, rawName( entry ), statxFlags( flags ), STATX_MASK, &stx ) == 0 )
+	{
+	    statxToStat( stx, &entry.statInfo );
+	    return;
+	}
+
+	if ( errno != ENOSYS )
+	{
+	    entry.statErrno = errno ? errno : EIO;
+	    return;
+	}
+
+	// Kernel older than 4.11 or a seccomp filter that does not know
+	// statx(): Use fstatat() from now on.
+
+	statxMissing.storeRelease( 1 );
+    }
+
+#endif
+
+    if ( fstatat( dirFd, rawName( entry ), &entry.statInfo, flags ) != 0 )
+	entry.statErrno = errno ? errno : EIO;
+}
+
+
+
+
+LocalDirReaderTask::LocalDirReaderTask( LocalDirReaderPtr reader,
+					QObject *	  receiver,
+					const char *	  notifySlot,
+					qulonglong	  device,
+					qulonglong	  client,
+					int		  numaNode ):
+    QRunnable(),
+    _reader( reader ),
+    _receiver( receiver ),
+    _notifySlot( notifySlot ),
+    _device( device ),
+    _client( client ),
+    _numaNode( numaNode )
+{
+    setAutoDelete( true );
+}
+
+
+LocalDirReaderTask::~LocalDirReaderTask()
+{
+    // NOP
+}
+
+
+void LocalDirReaderTask::run()
+{
+    ReadScheduler::adjustThreadPriority( true );
+    ReadScheduler::adjustThreadPlacement( _numaNode );
+
+    if ( _reader )
+    {
+	TRACE_SCOPE_ARG( "scan", "LocalDirReader::read", QString::fromUtf8( _reader->dirName() ) );
+	_reader->read(); // Returns immediately if the reader was aborted
+    }
+
+    if ( _receiver && _notifySlot )
+    {
+	QMetaObject::invokeMethod( _receiver, _notifySlot, Qt::QueuedConnection,
+				   Q_ARG( qulonglong, _device ),
+				   Q_ARG( qulonglong, _client ) );
+    }
+}
@@ -0,0 +1,492 @@
+/*
+ *   File name: LocalDirReader.h
+ *   Summary:	Low-level local directory reading for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef LocalDirReader_h
+#define LocalDirReader_h
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QRunnable>
+
+#include "BulkInodeStat.h"
+#include "ScanStats.h"	// LatencyHistogram
+
+
+// macOS 10.10 and later: getattrlistbulk() returns the names of the entries
+// of a directory together with their attributes
+
+#define HAVE_GETATTRLISTBULK 0
+
+#if defined( __APPLE__ ) && defined( __has_include )
+#  if __has_include( <sys/attr.h> )
+#    undef  HAVE_GETATTRLISTBULK
+#    define HAVE_GETATTRLISTBULK 1
+#  endif
+#endif
+
+
+class QObject;
+
+
+namespace QDirStat
+{
+    /**
+     * One entry of a local directory as obtained by LocalDirReader: Where to
+     * find the raw name (as returned by readdir()) in the reader's name
+     * buffer and the result of lstat().
+     *
+     * If statx() was used, only the fields of struct stat that QDirStat
+     * needs are filled in, the others are 0.
+     **/
+    struct LocalDirEntry
+    {
+	int	    nameOffset; // Offset of the name in the reader's name buffer
+	int	    nameLen;	// Length of the name without the 0 byte
+	struct stat statInfo;
+	int	    statErrno;	// 0 if lstat() was successful
+	bool	    symLinkResolved; // The target of this symlink was checked
+	bool	    symLinkBroken;   // The target of this symlink does not exist
+    };
+
+    typedef QVector<LocalDirEntry> LocalDirEntryList;
+
+    struct RawDirEntry;
+    typedef QVector<RawDirEntry> RawDirEntryList;
+
+
+    /**
+     * Low-level reader for one local directory: access(), opendir(),
+     * readdir() and lstat() for each entry, but nothing else.
+     *
+     * In particular, this does not create any FileInfo or DirInfo objects,
+     * it does not touch the DirTree, and it does not log anything, so it is
+     * safe to use this from a worker thread while the main thread processes
+     * the results of other directories. Creating the tree nodes from the
+     * entries is left to LocalDirReadJob, which always does that in the main
+     * thread.
+     *
+     * The entries are sorted by i-number before lstat() is called for each
+     * of them. Most filesystems store i-nodes sorted by i-number on disk, so
+     * this minimizes seek times (at least with rotational disks).
+     *
+     * On macOS, getattrlistbulk() is used instead of readdir(): It returns
+     * the attributes of many entries with each call, so only directories
+     * (which might be mount points) and entries without attributes still
+     * need an lstat().
+     **/
+    class LocalDirReader
+    {
+    public:
+
+	enum Result
+	{
+	    NotRead,		// read() was not called yet
+	    Ok,			// Success
+	    PermissionDenied,	// access() failed
+	    OpenDirError,	// opendir() failed
+	    Aborted		// abort() was called while reading
+	};
+
+	/**
+	 * Constructor. 'dirName' is the full path of the directory in UTF-8.
+	 *
+	 * This does not read anything yet. Call read() for that.
+	 **/
+	LocalDirReader( const QByteArray & dirName );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~LocalDirReader();
+
+	/**
+	 * Read the directory and lstat() all its entries.
+	 *
+	 * For very large directories, this reads only one chunk of about
+	 * chunkSize() entries. If atEnd() returns 'false' afterwards, the
+	 * caller should process the entries and then call nextChunk() and
+	 * read() again.
+	 *
+	 * This may be called from any thread, but only from one at a time.
+	 **/
+	void read();
+
+	/**
+	 * Instead of reading the directory, lstat() only the entries with
+	 * 'names' (in UTF-8), e.g. those that some package owns. Afterwards,
+	 * entries() has one entry for each name in the same order; check
+	 * their statErrno since some of them might not exist.
+	 *
+	 * This uses io_uring in the same way as read() if enabled. It may be
+	 * called from any thread, but only instead of read(), not in
+	 * addition to it.
+	 **/
+	void statNames( const QList<QByteArray> & names );
+
+	/**
+	 * Prepare reading the next chunk: Free the entries of the current
+	 * one and reset the 'done' status. Return 'false' if there is no
+	 * other chunk or if reading was not successful.
+	 **/
+	bool nextChunk();
+
+	/**
+	 * Return 'true' if all entries of the directory were read, i.e. if
+	 * the current chunk is the last one.
+	 **/
+	bool atEnd() const { return _atEnd; }
+
+	/**
+	 * Return 'true' if read() is completely done with the current chunk,
+	 * no matter if successful or not. This is safe to call from any
+	 * thread.
+	 **/
+	bool isDone() const { return _done.loadAcquire() != 0; }
+
+	/**
+	 * Tell a read() that might be in progress in another thread to stop
+	 * as soon as possible. The result will be 'Aborted' in that case.
+	 **/
+	void abort() { _aborted.storeRelease( 1 ); }
+
+	/**
+	 * Return 'true' if abort() was called.
+	 **/
+	bool isAborted() const { return _aborted.loadAcquire() != 0; }
+
+	/**
+	 * Return the result of read().
+	 **/
+	Result result() const { return _result; }
+
+	/**
+	 * Return the directory entries (without "." and ".."), sorted by
+	 * i-number. Check result() first.
+	 **/
+	const LocalDirEntryList & entries() const { return _entries; }
+
+	/**
+	 * Return the raw name of 'entry' as a 0-terminated string. This is
+	 * valid as long as the entries are.
+	 **/
+	const char * rawName( const LocalDirEntry & entry ) const
+	    { return _names.constData() + entry.nameOffset; }
+
+	/**
+	 * Return the name of 'entry' decoded from UTF-8.
+	 **/
+	QString name( const LocalDirEntry & entry ) const
+	    { return QString::fromUtf8( rawName( entry ), entry.nameLen ); }
+
+	/**
+	 * Return the full path of the directory (in UTF-8).
+	 **/
+	const QByteArray & dirName() const { return _dirName; }
+
+	/**
+	 * Free the memory used by the entries.
+	 **/
+	void clearEntries() { _entries = LocalDirEntryList(); _names = QByteArray(); }
+
+	/**
+	 * Return the time the last read() spent reading the names of the
+	 * entries in nanoseconds.
+	 **/
+	qint64 readdirNanosec() const { return _readdirNanosec; }
+
+	/**
+	 * Return the times of the lstat() calls of the last read(). For
+	 * batched io_uring calls, each entry counts with the average time.
+	 * Entries from the bulk i-node statistics or from getattrlistbulk()
+	 * are not included.
+	 **/
+	const LatencyHistogram & statLatency() const { return _statLatency; }
+
+	/**
+	 * Enable or disable using io_uring for batched statx() calls (Linux
+	 * 5.6 and later). If the kernel does not support that, this silently
+	 * falls back to one fstatat() call for each entry.
+	 *
+	 * This is a global setting for all LocalDirReaders in all threads;
+	 * set it only while no directory is being read.
+	 **/
+	static void setUseIoUring( bool use ) { _useIoUring = use; }
+
+	/**
+	 * Return 'true' if io_uring is used for batched statx() calls.
+	 **/
+	static bool useIoUring() { return _useIoUring; }
+
+	/**
+	 * Enable or disable AT_STATX_DONT_SYNC for statx(): On network and
+	 * FUSE filesystems (CIFS, sshfs, Ceph), this uses whatever file
+	 * attributes the client has cached instead of asking the server for
+	 * the latest ones. That is a lot faster, but the sizes and times might
+	 * be slightly outdated. Local filesystems ignore this.
+	 *
+	 * This is a global setting for all LocalDirReaders in all threads;
+	 * set it only while no directory is being read.
+	 **/
+	static void setStatxDontSync( bool dontSync ) { _statxDontSync = dontSync; }
+
+	/**
+	 * Return 'true' if AT_STATX_DONT_SYNC is used.
+	 **/
+	static bool statxDontSync() { return _statxDontSync; }
+
+	/**
+	 * Enable or disable bulk i-node statistics (see BulkInodeStat): On
+	 * XFS and Btrfs, when running as root, get the stat information of
+	 * all i-nodes of the filesystem with a few ioctl() calls and look up
+	 * the entries there instead of calling lstat() for each of them.
+	 *
+	 * This only pays off for scanning complete filesystems since it
+	 * always collects all i-nodes of the filesystem.
+	 *
+	 * This is a global setting for all LocalDirReaders in all threads;
+	 * set it only while no directory is being read.
+	 **/
+	static void setUseBulkStat( bool use ) { _useBulkStat = use; }
+
+	/**
+	 * Return 'true' if bulk i-node statistics are used.
+	 **/
+	static bool useBulkStat() { return _useBulkStat; }
+
+	/**
+	 * Enable or disable checking the targets of symlinks while reading:
+	 * Each symlink is read with readlinkat(), and its target is lstat()ed
+	 * (relative targets from the directory), which sets symLinkResolved
+	 * and symLinkBroken of its entry. Links with the same target in the
+	 * same directory only need one lstat(). If the target can't be
+	 * checked (no permission), the entry is left unresolved.
+	 *
+	 * This is a global setting for all LocalDirReaders in all threads;
+	 * set it only while no directory is being read.
+	 **/
+	static void setResolveSymLinks( bool resolve ) { _resolveSymLinks = resolve; }
+
+	/**
+	 * Return 'true' if the targets of symlinks are checked while reading.
+	 **/
+	static bool resolveSymLinks() { return _resolveSymLinks; }
+
+	/**
+	 * Set the maximum number of entries to read, sort and lstat() in one
+	 * chunk. 0 means no limit, i.e. always read the complete directory at
+	 * once.
+	 *
+	 * Huge directories (millions of entries) are processed chunk by chunk
+	 * so memory usage stays limited, and the (partial) results show up in
+	 * the tree while reading continues.
+	 **/
+	static void setChunkSize( int size ) { _chunkSize = size; }
+
+	/**
+	 * Return the maximum number of entries in one chunk.
+	 **/
+	static int chunkSize() { return _chunkSize; }
+
+	/**
+	 * Enable or disable counting mode: Only directories and entries
+	 * whose type readdir() does not tell (DT_UNKNOWN) are stat()ed; the
+	 * others only get their type, their i-number and the device of the
+	 * directory. The sizes of all entries are 0.
+	 *
+	 * Set this before read().
+	 **/
+	void setCountOnly( bool countOnly ) { _countOnly = countOnly; }
+
+	/**
+	 * Return 'true' if this reader is in counting mode.
+	 **/
+	bool countOnly() const { return _countOnly; }
+
+
+    protected:
+
+	/**
+	 * Read the names of the entries of the directory (except "." and
+	 * "..") into the name buffer and add one entry for each to
+	 * 'rawEntries'. This stops after about chunkSize() entries.
+	 **/
+	void readNames( RawDirEntryList & rawEntries );
+
+#if HAVE_GETATTRLISTBULK
+
+	/**
+	 * Read the names of the entries with getattrlistbulk() like
+	 * readNames() and their attributes into _bulkAttrs.
+	 **/
+	void readAttrListBulk( RawDirEntryList & rawEntries );
+
+	/**
+	 * Move the entries that got their stat information from
+	 * getattrlistbulk() to the start of the entries list and return
+	 * their number, just like statBulk(). Directories are left to
+	 * lstat() since they might be mount points.
+	 **/
+	int statFromAttrList();
+
+#endif
+
+	/**
+	 * Open the directory. Return 'true' on success.
+	 **/
+	bool openDir();
+
+	/**
+	 * Close the directory if it is open.
+	 **/
+	void closeDir();
+
+	/**
+	 * Set the result and mark the current chunk as done.
+	 **/
+	void setResult( Result result );
+
+	/**
+	 * Add a name with 'len' bytes to the name buffer and an entry to
+	 * 'rawEntries'.
+	 **/
+	void addName( const char *	 name,
+		      int		 len,
+		      ino_t		 ino,
+		      unsigned char	 type,
+		      RawDirEntryList & rawEntries );
+
+	/**
+	 * In counting mode, fill in the stat information of the entries
+	 * whose type is known from readdir() and that are no directories,
+	 * and move them to the start of the entries list. Return their
+	 * number; the others still need to be stat()ed.
+	 **/
+	int statFromTypes();
+
+	/**
+	 * Obtain the stat information for as many entries as possible from
+	 * the bulk i-node statistics and move them to the start of the
+	 * entries list. Return the number of entries processed; the others
+	 * still need to be stat()ed.
+	 **/
+	int statBulk();
+
+	/**
+	 * Obtain the stat information for the entries from 'start' on via
+	 * io_uring. Return the index of the first entry that was not
+	 * processed; that one and the following ones (if any) need to be
+	 * done with fstatat().
+	 **/
+	int statIoUring( int dirFd, int flags, int start );
+
+	/**
+	 * Obtain the stat information for one entry. This uses statx() with
+	 * only the fields that are really needed if the kernel supports it,
+	 * and fstatat() otherwise.
+	 **/
+	void statEntry( int dirFd, LocalDirEntry & entry, int flags );
+
+	/**
+	 * Check the targets of the symlinks among the entries.
+	 **/
+	void resolveSymLinkTargets();
+
+	/**
+	 * Return 'flags' plus the statx()-specific flags from the settings.
+	 **/
+	static int statxFlags( int flags );
+
+	/**
+	 * Return the flags for fstatat() and statx() for the entries.
+	 **/
+	static int statFlags();
+
+
+	QByteArray	  _dirName;
+	LocalDirEntryList _entries;
+	QByteArray	  _names;	// All entry names, each with a 0 byte
+	Result		  _result;
+	int		  _dirFd;
+	DIR *		  _diskDir;	// Only if readdir() is used
+	bool		  _atEnd;
+	BulkInodeStat::Ptr _bulkStat;
+	QVector<struct stat> _bulkAttrs; // From getattrlistbulk()
+	dev_t		  _dirDev;
+	bool		  _countOnly;
+	QAtomicInt	  _done;
+	QAtomicInt	  _aborted;
+	qint64		  _readdirNanosec;
+	LatencyHistogram  _statLatency;
+
+	static bool	  _useIoUring;
+	static bool	  _useBulkStat;
+	static bool	  _statxDontSync;
+	static bool	  _resolveSymLinks;
+	static int	  _chunkSize;
+
+    };	// class LocalDirReader
+
+
+    typedef QSharedPointer<LocalDirReader> LocalDirReaderPtr;
+
+
+    /**
+     * Task for a QThreadPool that runs a LocalDirReader in a worker thread.
+     *
+     * When the reader is done, the slot 'notifySlot' of 'receiver' is
+     * invoked with 'device' and 'client' as its qulonglong arguments with a
+     * queued connection, i.e. in the thread of 'receiver'. The receiver is
+     * required to make sure that it outlives the thread pool.
+     *
+     * The task shares ownership of the reader with whoever created it, so
+     * the reader stays valid even if that owner is deleted while the task is
+     * still running.
+     *
+     * If 'numaNode' is not -1, the worker thread runs on the CPUs of that
+     * NUMA node (see ReadScheduler::deviceNumaNode()).
+     **/
+    class LocalDirReaderTask: public QRunnable
+    {
+    public:
+
+	LocalDirReaderTask( LocalDirReaderPtr reader,
+			    QObject *	      receiver,
+			    const char *      notifySlot,
+			    qulonglong	      device,
+			    qulonglong	      client,
+			    int		      numaNode = -1 );
+
+	virtual ~LocalDirReaderTask();
+
+	virtual void run() Q_DECL_OVERRIDE;
+
+    protected:
+
+	LocalDirReaderPtr _reader;
+	QObject *	  _receiver;
+	const char *	  _notifySlot;
+	qulonglong	  _device;
+	qulonglong	  _client;
+	int		  _numaNode;
+
+    };	// class LocalDirReaderTask
+
+}	// namespace QDirStat
+
+
+#endif // ifndef LocalDirReader_h
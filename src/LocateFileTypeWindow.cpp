@@ -12,6 +12,7 @@
 #include "LocateFileTypeWindow.h"
 #include "DirTree.h"
 #include "DotEntry.h"
+#include "FileTypeIndex.h"
 #include "SelectionModel.h"
 #include "SettingsHelpers.h"
 #include "HeaderTweaker.h"
@@ -114,7 +115,10 @@ void LocateFileTypeWindow::populate( const QString & suffix, FileInfo * newSubtr
     // For better Performance: Disable sorting while inserting many items
     _ui->treeWidget->setSortingEnabled( false );
 
-    populateRecursive( newSubtree ? newSubtree : _subtree() );
+    FileInfo * subtree = newSubtree ? newSubtree : _subtree();
+
+    if ( ! populateFromIndex( subtree ) )
+	populateRecursive( subtree );
 
     _ui->treeWidget->setSortingEnabled( true );
     _ui->treeWidget->sortByColumn( SSR_PathCol, Qt::AscendingOrder );
@@ -142,28 +146,40 @@ void LocateFileTypeWindow::populate( const QString & suffix, FileInfo * newSubtr
 }
 
 
-void LocateFileTypeWindow::populateRecursive( FileInfo * dir )
+bool LocateFileTypeWindow::populateFromIndex( FileInfo * subtree )
 {
-    if ( ! dir )
-	return;
+    if ( ! subtree || ! subtree->isDirInfo() || subtree->isPseudoDir() ||
+	 FileTypeIndex::isInAttic( subtree ) || ! subtree->tree() )
+    {
+	return false;
+    }
 
-    FileInfoSet matches = matchingFiles( dir );
+    FileTypeIndex * index = subtree->tree()->fileTypeIndex();
 
-    if ( ! matches.isEmpty() )
+    if ( ! index )
+	return false;
+
+    // Only the directories that have any files with the last part of the
+    // search suffix need to be checked
+
+    QString lastSuffix = FileTypeIndex::lastSuffix( _searchSuffix );
+
+    foreach ( DirInfo * dir, index->dirsWithLastSuffix( lastSuffix ) )
     {
-	// Create a search result for this path
+	if ( dir == subtree || dir->isInSubtree( subtree ) )
+	    addResult( dir );
+    }
 
-	FileSize totalSize = 0LL;
+    return true;
+}
 
-	foreach ( FileInfo * file, matches )
-	    totalSize += file->size();
 
-	SuffixSearchResultItem * searchResultItem =
-	    new SuffixSearchResultItem( dir->url(), matches.size(), totalSize );
-	CHECK_NEW( searchResultItem );
+void LocateFileTypeWindow::populateRecursive( FileInfo * dir )
+{
+    if ( ! dir )
+	return;
 
-	_ui->treeWidget->addTopLevelItem( searchResultItem );
-    }
+    addResult( dir );
 
 
     // Recurse through any subdirectories
@@ -183,6 +199,28 @@ void LocateFileTypeWindow::populateRecursive( FileInfo * dir )
 }
 
 
+void LocateFileTypeWindow::addResult( FileInfo * dir )
+{
+    FileInfoSet matches = matchingFiles( dir );
+
+    if ( ! matches.isEmpty() )
+    {
+	// Create a search result for this path
+
+	FileSize totalSize = 0LL;
+
+	foreach ( FileInfo * file, matches )
+	    totalSize += file->size();
+
+	SuffixSearchResultItem * searchResultItem =
+	    new SuffixSearchResultItem( dir->url(), matches.size(), totalSize );
+	CHECK_NEW( searchResultItem );
+
+	_ui->treeWidget->addTopLevelItem( searchResultItem );
+    }
+}
+
+
 FileInfoSet LocateFileTypeWindow::matchingFiles( FileInfo * item )
 {
     FileInfoSet result;
@@ -130,6 +130,21 @@ namespace QDirStat
 	 **/
 	void populateRecursive( FileInfo * dir );
 
+	/**
+	 * Create search result items for the directories below 'subtree'
+	 * with files matching the search suffix that the FileTypeIndex of the
+	 * tree knows about.
+	 *
+	 * Return 'false' if there is no usable index for 'subtree'.
+	 **/
+	bool populateFromIndex( FileInfo * subtree );
+
+	/**
+	 * Create a search result item for 'dir' if it has any files matching
+	 * the search suffix.
+	 **/
+	void addResult( FileInfo * dir );
+
 	/**
 	 * Return all direct file children matching the current search suffix.
 	 **/
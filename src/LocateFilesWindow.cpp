@@ -7,9 +7,12 @@
  */
 
 
+#include <QMutex>
+#include <QMutexLocker>
+
 #include "LocateFilesWindow.h"
 #include "DirTree.h"
-#include "FileInfoIterator.h"
+#include "ParallelWalker.h"
 #include "DotEntry.h"
 #include "SelectionModel.h"
 #include "SettingsHelpers.h"
@@ -108,7 +111,16 @@ void LocateFilesWindow::populate( FileInfo * newSubtree )
     // For better Performance: Disable sorting while inserting many items
     _ui->treeWidget->setSortingEnabled( false );
 
-    populateRecursive( newSubtree ? newSubtree : _subtree() );
+    if ( _treeWalker->hasResults() )
+    {
+        // No need to walk the tree again
+        foreach ( FileInfo * item, _treeWalker->results() )
+            addResult( item, _treeWalker->resultGroup( item ) );
+    }
+    else
+    {
+        populateParallel( newSubtree ? newSubtree : _subtree() );
+    }
 
     _ui->treeWidget->setSortingEnabled( true );
     _ui->treeWidget->sortByColumn( LocateListPathCol, Qt::AscendingOrder );
@@ -138,33 +150,56 @@ void LocateFilesWindow::populate( FileInfo * newSubtree )
 }
 
 
-void LocateFilesWindow::populateRecursive( FileInfo * dir )
+void LocateFilesWindow::populateParallel( FileInfo * subtree )
 {
-    if ( ! dir )
+    if ( ! subtree )
 	return;
 
-    FileInfoIterator it( dir );
-
-    while ( *it )
-    {
-	FileInfo * item = *it;
+    int taskCount = _treeWalker->taskCount( subtree );
 
-        if ( _treeWalker->check( item ) )
-        {
-            LocateListItem * locateListItem =
-                new LocateListItem( item->url(), item->size(), item->mtime() );
-            CHECK_NEW( locateListItem );
+    // The tasks only collect the matching items; this thread picks them up
+    // from time to time while the others are still searching. It must not
+    // process any events meanwhile: A refresh, a directory watcher or a
+    // delete job could then change the tree that the tasks are walking.
 
-            _ui->treeWidget->addTopLevelItem( locateListItem );
-        }
+    TreeWalker * treeWalker = _treeWalker;
+    QMutex	 mutex;
+    FileInfoList found;
 
-	if ( item->hasChildren() )
+    auto addFound = [&]()
 	{
-	    populateRecursive( item );
-	}
+	    FileInfoList items;
+	    {
+		QMutexLocker locker( &mutex );
+		items.swap( found );
+	    }
+
+	    foreach ( FileInfo * item, items )
+		addResult( item );
+	};
+
+    ParallelWalker::forEachItem( subtree, taskCount,
+				 [&]( int task, FileInfo * item )
+				 {
+				     if ( treeWalker->checkInTask( task, item ) )
+				     {
+					 QMutexLocker locker( &mutex );
+					 found << item;
+				     }
+				 },
+				 addFound );
+    addFound();
+}
 
-        ++it;
-    }
+
+void LocateFilesWindow::addResult( FileInfo * item, FileInfo * group )
+{
+    LocateListItem * locateListItem =
+        new LocateListItem( item->url(), item->size(), item->mtime(),
+                            group ? group->url() : QString() );
+    CHECK_NEW( locateListItem );
+
+    _ui->treeWidget->addTopLevelItem( locateListItem );
 }
 
 
@@ -198,9 +233,11 @@ void LocateFilesWindow::sortByColumn( int col, Qt::SortOrder order )
 
 LocateListItem::LocateListItem( const QString & path,
                                 FileSize	size,
-                                time_t          mtime ):
+                                time_t          mtime,
+                                const QString & groupPath ):
     QTreeWidgetItem( QTreeWidgetItem::UserType ),
     _path( path ),
+    _groupPath( groupPath.isEmpty() ? path : groupPath ),
     _size( size ),
     _mtime( mtime )
 {
@@ -225,7 +262,12 @@ bool LocateListItem::operator<( const QTreeWidgetItem & rawOther ) const
 
     switch ( col )
     {
-	case LocateListPathCol:  return path()  < other.path();
+	case LocateListPathCol:
+	    if ( _groupPath != other._groupPath )
+		return _groupPath < other._groupPath;
+
+	    return path() < other.path();
+
 	case LocateListSizeCol:  return size()  < other.size();
 	case LocateListMTimeCol: return mtime() < other.mtime();
 	default:	         return QTreeWidgetItem::operator<( rawOther );
@@ -100,7 +100,8 @@ namespace QDirStat
 	 *
 	 * This clears the old search results first, then searches the subtree
 	 * and populates the search result list with the items where
-	 * TreeWalker::check() returns 'true'.
+	 * TreeWalker::check() returns 'true' or, if the TreeWalker already
+	 * found them in TreeWalker::prepare(), with TreeWalker::results().
 	 **/
 	void populate( FileInfo * subtree = 0 );
 
@@ -141,10 +142,19 @@ namespace QDirStat
 	void initWidgets();
 
 	/**
-	 * Recursively locate directories that contain files matching the
-	 * search suffix and create a search result item for each one.
+	 * Check all items in 'subtree' with the TreeWalker and create a
+	 * search result item for each match. Big subtrees are checked in
+	 * worker threads; the matches found so far are shown while they are
+	 * running.
 	 **/
-	void populateRecursive( FileInfo * dir );
+	void populateParallel( FileInfo * subtree );
+
+	/**
+	 * Create a search result item for 'item' that is kept together with
+	 * the others of 'group' when sorted by path (see
+	 * TreeWalker::resultGroup()).
+	 **/
+	void addResult( FileInfo * item, FileInfo * group = 0 );
 
 
 	//
@@ -193,11 +203,13 @@ namespace QDirStat
     public:
 
 	/**
-	 * Constructor.
+	 * Constructor. Items with the same 'groupPath' stay together when
+	 * sorted by path.
 	 **/
 	LocateListItem( const QString & path,
                         FileSize	size,
-                        time_t          mtime );
+                        time_t          mtime,
+                        const QString & groupPath = QString() );
 
 	//
 	// Getters
@@ -215,6 +227,7 @@ namespace QDirStat
     protected:
 
 	QString		_path;
+	QString		_groupPath;
 	FileSize	_size;
         time_t          _mtime;
     };
@@ -19,6 +19,9 @@
 #include <QSizeF>
 #include <QSize>
 #include <QStringList>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
 
 #include <stdio.h>	// stderr, fprintf()
 #include <stdlib.h>	// abort(), mkdtemp()
@@ -42,6 +45,151 @@ static void qt_logger( QtMsgType msgType,
 #endif
 
 
+/**
+ * The device behind the log stream: Collect whatever the stream flushes
+ * (normally a complete line with each 'endl') and write it to the log file
+ * in a separate thread.
+ **/
+class LogWriter: public QIODevice
+{
+public:
+
+    /**
+     * Constructor: Start the thread that writes to file descriptor 'fd'.
+     **/
+    LogWriter( int fd );
+
+    /**
+     * Destructor: Write everything that is still pending and stop the
+     * thread.
+     **/
+    virtual ~LogWriter();
+
+    /**
+     * Wait until everything written so far is in the file.
+     **/
+    void flush();
+
+    /**
+     * Write the pending data until the writer is stopped. This is called
+     * in the thread.
+     **/
+    void writeLoop();
+
+    virtual bool isSequential() const Q_DECL_OVERRIDE { return true; }
+
+protected:
+
+    virtual qint64 readData( char *, qint64 ) Q_DECL_OVERRIDE { return -1; }
+    virtual qint64 writeData( const char * data, qint64 len ) Q_DECL_OVERRIDE;
+
+private:
+
+    class Thread: public QThread
+    {
+    public:
+	Thread( LogWriter * writer ): _writer( writer ) {}
+
+    protected:
+	virtual void run() Q_DECL_OVERRIDE { _writer->writeLoop(); }
+
+	LogWriter * _writer;
+    };
+
+    int		   _fd;
+    Thread	   _thread;
+    QMutex	   _mutex;
+    QWaitCondition _dataPending;
+    QWaitCondition _dataWritten;
+    QByteArray	   _pending;
+    bool	   _writing;
+    bool	   _stopping;
+};
+
+
+LogWriter::LogWriter( int fd ):
+    _fd( fd ),
+    _thread( this ),
+    _writing( false ),
+    _stopping( false )
+{
+    open( QIODevice::WriteOnly | QIODevice::Unbuffered );
+    _thread.start( QThread::LowPriority );
+}
+
+
+LogWriter::~LogWriter()
+{
+    _mutex.lock();
+    _stopping = true;
+    _dataPending.wakeOne();
+    _mutex.unlock();
+
+    _thread.wait();
+}
+
+
+qint64 LogWriter::writeData( const char * data, qint64 len )
+{
+    QMutexLocker locker( &_mutex );
+    _pending.append( data, len );
+    _dataPending.wakeOne();
+
+    return len;
+}
+
+
+void LogWriter::flush()
+{
+    QMutexLocker locker( &_mutex );
+
+    while ( _writing || ! _pending.isEmpty() )
+	_dataWritten.wait( &_mutex );
+}
+
+
+void LogWriter::writeLoop()
+{
+    QMutexLocker locker( &_mutex );
+
+    while ( true )
+    {
+	while ( _pending.isEmpty() && ! _stopping )
+	    _dataPending.wait( &_mutex );
+
+	if ( _pending.isEmpty() ) // stopping and nothing left to write
+	    break;
+
+	QByteArray data;
+	data.swap( _pending );
+	_writing = true;
+	locker.unlock();
+
+	const char * pos  = data.constData();
+	qint64	     left = data.size();
+
+	while ( left > 0 )
+	{
+	    ssize_t written = ::write( _fd, pos, left );
+
+	    if ( written < 0 && errno == EINTR )
+		continue;
+
+	    if ( written <= 0 ) // Nowhere to report that; drop the rest
+		break;
+
+	    pos	 += written;
+	    left -= written;
+	}
+
+	locker.relock();
+	_writing = false;
+	_dataWritten.wakeAll();
+    }
+}
+
+
+
 Logger * Logger::_defaultLogger = 0;
 
 
@@ -82,6 +230,12 @@ Logger::~Logger()
     if ( _logFile.isOpen() )
     {
 	logInfo() << "-- Log End --\n" << endl;
+
+	_logStream.flush();
+	_logStream.setDevice( 0 );
+	delete _writer; // This writes everything that is still pending
+	_writer = 0;
+
 	_logFile.close();
     }
 
@@ -100,6 +254,7 @@ Logger::~Logger()
 void Logger::init()
 {
     _logLevel = LogSeverityVerbose;
+    _writer   = 0;
     _nullDevice.setFileName( "/dev/null" );
 }
 
@@ -138,7 +293,9 @@ void Logger::openLogFile( const QString & filename )
 		setDefaultLogger();
 
 	    fprintf( stderr, "Logging to %s\n", qPrintable( filename ) );
-	    _logStream.setDevice( &_logFile );
+
+	    _writer = new LogWriter( _logFile.handle() );
+	    _logStream.setDevice( _writer );
 	    _logStream << "\n\n";
 	    log( __FILE__, __LINE__, __FUNCTION__, LogSeverityInfo )
 		<< "-- Log Start --" << endl;
@@ -260,6 +417,25 @@ void Logger::newline()
 }
 
 
+void Logger::flush( Logger * logger )
+{
+    if ( ! logger )
+	logger = Logger::defaultLogger();
+
+    if ( logger )
+	logger->flush();
+}
+
+
+void Logger::flush()
+{
+    _logStream.flush();
+
+    if ( _writer )
+	_writer->flush();
+}
+
+
 QString Logger::timeStamp()
 {
     return QDateTime::currentDateTime().toString( "yyyy-MM-dd hh:mm:ss.zzz" );
@@ -318,6 +494,7 @@ static void qt_logger( QtMsgType msgType, const char *msg)
     if ( msgType == QtFatalMsg )
     {
 	fprintf( stderr, "FATAL: %s\n", msg );
+	Logger::flush( 0 );
 	abort();
     }
 
@@ -325,6 +502,7 @@ static void qt_logger( QtMsgType msgType, const char *msg)
 	 QString( msg ).contains( "cannot connect to X server" ) )
     {
 	fprintf( stderr, "FATAL: %s\n", msg );
+	Logger::flush( 0 );
 	exit( 1 );
     }
 }
@@ -411,12 +589,14 @@ static void qt_logger( QtMsgType msgType,
             }
 
             logInfo() << "-- Exiting --\n" << endl;
+	    Logger::flush( 0 );
 	    exit( 1 ); // Don't dump core, just exit
         }
 	else
         {
             fprintf( stderr, "FATAL: %s\n", qPrintable( msg ) );
             logInfo() << "-- Aborting with core dump --\n" << endl;
+	    Logger::flush( 0 );
 	    abort(); // Exit with core dump (it might contain a useful backtrace)
         }
     }
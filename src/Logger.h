@@ -38,17 +38,39 @@ enum LogSeverity
 // Unlike qDebug() etc., they also record the location in the source code that
 // wrote the log entry.
 //
+// If the severity is below the log level, the rest of the statement is not
+// evaluated at all, so disabled log statements are cheap even if their
+// arguments are not.
+//
 // These macros all use the default logger. Create similar macros to use your
 // own class-specific logger.
 
-#define logVerbose()	Logger::log( 0, __FILE__, __LINE__, __FUNCTION__, LogSeverityVerbose   )
-#define logDebug()	Logger::log( 0, __FILE__, __LINE__, __FUNCTION__, LogSeverityDebug     )
-#define logInfo()	Logger::log( 0, __FILE__, __LINE__, __FUNCTION__, LogSeverityInfo      )
-#define logWarning()	Logger::log( 0, __FILE__, __LINE__, __FUNCTION__, LogSeverityWarning   )
-#define logError()	Logger::log( 0, __FILE__, __LINE__, __FUNCTION__, LogSeverityError     )
+#define LOG_STATEMENT( SEVERITY )					\
+    ! Logger::isEnabled( 0, SEVERITY ) ? (void) 0 :			\
+    LogStatementEnd() & Logger::log( 0, __FILE__, __LINE__, __FUNCTION__, SEVERITY )
+
+#define logVerbose()	LOG_STATEMENT( LogSeverityVerbose )
+#define logDebug()	LOG_STATEMENT( LogSeverityDebug	  )
+#define logInfo()	LOG_STATEMENT( LogSeverityInfo	  )
+#define logWarning()	LOG_STATEMENT( LogSeverityWarning )
+#define logError()	LOG_STATEMENT( LogSeverityError	  )
 #define logNewline()	Logger::newline( 0 )
 
 
+class LogWriter;
+
+
+/**
+ * Helper for the log macros: Turn a complete log statement into a 'void'
+ * expression. This binds weaker than operator<<(), so it is applied after
+ * everything was written to the stream.
+ **/
+struct LogStatementEnd
+{
+    void operator&( QTextStream & ) {}
+};
+
+
 /**
  * Logging class. Use one of the macros above for stream output:
  *
@@ -61,6 +83,9 @@ enum LogSeverity
  * QByteArray, int).
  *
  * This class also redirects Qt logging (qDebug() etc.) to the same log file.
+ *
+ * The log file is written by a separate thread, so writing a log line never
+ * waits for the disk.
  */
 class Logger
 {
@@ -123,6 +148,26 @@ public:
     void newline();
     static void newline( Logger * logger );
 
+    /**
+     * Wait until everything logged so far is in the log file. Use this
+     * before exiting the program without the normal cleanup.
+     */
+    void flush();
+    static void flush( Logger * logger );
+
+    /**
+     * Return 'true' if messages with 'severity' are logged at all.
+     *
+     * If 'logger' is 0, the default logger is used.
+     */
+    static bool isEnabled( Logger * logger, LogSeverity severity )
+    {
+	if ( ! logger )
+	    logger = _defaultLogger;
+
+	return ! logger || severity >= logger->_logLevel;
+    }
+
     /**
      * Return a timestamp string in the format used in the log file:
      * "yyyy-MM-dd hh:mm:ss.zzz"
@@ -167,17 +212,13 @@ public:
      * Return the current log level, i.e. the severity that will actually be
      * logged. Any lower severity will be suppressed.
      *
-     * Notice that due to the way C++ evaluates expressions, the runtime cost
-     * will not change significantly, only the log file size:
+     * With the log macros, a suppressed statement does not evaluate its
+     * arguments:
      *
      *	   logDebug() << "Result: " << myObj->result() << endl;
      *
-     * Even if the log level is higher than logDebug(), this will still call
-     * myObj->result() and its operator<<(). If you want to avoid that, use
-     * your own 'if' around the log output:
-     *
-     * if ( logLevel() >= LogSeverityDebug )
-     *	   logDebug() ...
+     * If the log level is higher than logDebug(), this will not even call
+     * myObj->result(). This is not true for direct calls to log().
      */
     LogSeverity logLevel() const { return _logLevel; }
 
@@ -265,6 +306,7 @@ private:
 
     static Logger * _defaultLogger;
     QFile	    _logFile;
+    LogWriter *	    _writer;
     QTextStream	    _logStream;
     QFile	    _nullDevice;
     QTextStream	    _nullStream;
@@ -0,0 +1,156 @@
+/*
+ *   File name: MTimeHistogram.cpp
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>
+
+#include "MTimeHistogram.h"
+
+
+#define SecondsPerDay	86400
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Less-than for finding the bucket of a month with std::lower_bound().
+     **/
+    bool bucketBefore( const MTimeHistogram::Bucket & bucket, int month )
+    {
+	return bucket.month < month;
+    }
+
+}	// namespace
+
+
+int MTimeHistogram::month( time_t mtime )
+{
+    if ( mtime <= 0 )
+	return 0;
+
+    // Civil date from the number of days since 1970-01-01 without any
+    // calls to gmtime() or friends: This is called for every file. Years
+    // start on March 1st here so the leap day is at the end.
+
+    qint64 days = mtime / SecondsPerDay + 719468;	// days since 0000-03-01
+    qint64 era	= days / 146097;			// 400 years
+    qint64 doe	= days - era * 146097;			// day of era
+    qint64 yoe	= ( doe - doe/1460 + doe/36524 - doe/146096 ) / 365;
+    qint64 doy	= doe - ( 365*yoe + yoe/4 - yoe/100 );	// day of year
+    qint64 mp	= ( 5*doy + 2 ) / 153;			// month from March
+    qint64 year = yoe + era * 400 + ( mp >= 10 ? 1 : 0 );
+    qint64 mon	= mp < 10 ? mp + 2 : mp - 10;		// 0 for January
+
+    return (int) ( ( year - 1970 ) * 12 + mon );
+}
+
+
+time_t MTimeHistogram::monthStart( int month )
+{
+    qint64 year = 1970 + month / 12;
+    qint64 mon	= month % 12;				// 0 for January
+    qint64 mp	= mon >= 2 ? mon - 2 : mon + 10;	// month from March
+
+    if ( mon < 2 )
+	--year;
+
+    qint64 era	= year / 400;
+    qint64 yoe	= year - era * 400;
+    qint64 doy	= ( 153*mp + 2 ) / 5;
+    qint64 doe	= yoe * 365 + yoe/4 - yoe/100 + doy;
+    qint64 days = era * 146097 + doe - 719468;
+
+    return (time_t) ( days * SecondsPerDay );
+}
+
+
+int MTimeHistogram::totalCount() const
+{
+    int total = 0;
+
+    foreach ( const Bucket & bucket, _buckets )
+	total += bucket.count;
+
+    return total;
+}
+
+
+void MTimeHistogram::change( int month, int count, FileSize sum )
+{
+    QVector<Bucket>::iterator it =
+	std::lower_bound( _buckets.begin(), _buckets.end(), month, bucketBefore );
+
+    if ( it != _buckets.end() && it->month == month )
+    {
+	it->count += count;
+	it->sum	  += sum;
+
+	if ( it->count == 0 )
+	    _buckets.erase( it );
+    }
+    else if ( count != 0 )
+    {
+	Bucket bucket = { month, count, sum };
+	_buckets.insert( it, bucket );
+    }
+}
+
+
+void MTimeHistogram::merge( const MTimeHistogram & other, int sign )
+{
+    if ( other._buckets.isEmpty() )
+	return;
+
+    if ( _buckets.isEmpty() && sign > 0 )
+    {
+	_buckets = other._buckets;
+	return;
+    }
+
+    // Both are sorted by month: Merge them in one pass
+
+    QVector<Bucket> result;
+    result.reserve( _buckets.size() + other._buckets.size() );
+
+    QVector<Bucket>::const_iterator it	    = _buckets.constBegin();
+    QVector<Bucket>::const_iterator otherIt = other._buckets.constBegin();
+
+    while ( it != _buckets.constEnd() || otherIt != other._buckets.constEnd() )
+    {
+	Bucket bucket;
+
+	if ( otherIt == other._buckets.constEnd() ||
+	     ( it != _buckets.constEnd() && it->month < otherIt->month ) )
+	{
+	    bucket = *it++;
+	}
+	else
+	{
+	    bucket.month = otherIt->month;
+	    bucket.count = sign * otherIt->count;
+	    bucket.sum	 = sign * otherIt->sum;
+
+	    if ( it != _buckets.constEnd() && it->month == otherIt->month )
+	    {
+		bucket.count += it->count;
+		bucket.sum   += it->sum;
+		++it;
+	    }
+
+	    ++otherIt;
+	}
+
+	if ( bucket.count != 0 )
+	    result << bucket;
+    }
+
+    _buckets = result;
+}
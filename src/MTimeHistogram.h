@@ -0,0 +1,116 @@
+/*
+ *   File name: MTimeHistogram.h
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef MTimeHistogram_h
+#define MTimeHistogram_h
+
+
+#include <time.h>
+#include <QVector>
+
+#include "FileInfo.h"	// FileSize
+
+
+namespace QDirStat
+{
+    /**
+     * Number and total size of files by the month of their mtime.
+     *
+     * Each DirInfo keeps one of those for all the files in its subtree and
+     * updates it along with its other totals (just like its SizeHistogram),
+     * so questions like "how much data below this directory was not
+     * touched in 3 years" can be answered without walking the subtree.
+     *
+     * Only months that have any files are stored, so a directory with files
+     * from just a few months needs only a few buckets.
+     **/
+    class MTimeHistogram
+    {
+    public:
+
+	/**
+	 * The files of one month.
+	 **/
+	struct Bucket
+	{
+	    int	     month;	// see month()
+	    int	     count;
+	    FileSize sum;
+	};
+
+	/**
+	 * Constructor for an empty histogram.
+	 **/
+	MTimeHistogram() {}
+
+	/**
+	 * Remove all files.
+	 **/
+	void clear() { _buckets.clear(); }
+
+	/**
+	 * Return 'true' if there are no files.
+	 **/
+	bool isEmpty() const { return _buckets.isEmpty(); }
+
+	/**
+	 * Return the month of 'mtime': The number of months since January
+	 * 1970 (UTC). Anything before that is month 0.
+	 **/
+	static int month( time_t mtime );
+
+	/**
+	 * Return the first second of 'month' (see month()).
+	 **/
+	static time_t monthStart( int month );
+
+	/**
+	 * Add or remove one file with 'mtime' and 'size'.
+	 **/
+	void add     ( time_t mtime, FileSize size ) { change( month( mtime ),  1,  size ); }
+	void subtract( time_t mtime, FileSize size ) { change( month( mtime ), -1, -size ); }
+
+	/**
+	 * Add or remove all files of 'other'.
+	 **/
+	void add     ( const MTimeHistogram & other ) { merge( other,  1 ); }
+	void subtract( const MTimeHistogram & other ) { merge( other, -1 ); }
+
+	/**
+	 * Return the months with any files, sorted by month.
+	 **/
+	const QVector<Bucket> & buckets() const { return _buckets; }
+
+	/**
+	 * Return the number of files in all buckets.
+	 **/
+	int totalCount() const;
+
+
+    protected:
+
+	/**
+	 * Add 'count' files with a total size of 'sum' to the bucket of
+	 * 'month'. Buckets that become empty are removed.
+	 **/
+	void change( int month, int count, FileSize sum );
+
+	/**
+	 * Add the buckets of 'other' multiplied by 'sign'.
+	 **/
+	void merge( const MTimeHistogram & other, int sign );
+
+
+	QVector<Bucket> _buckets;	// sorted by month, no empty ones
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef MTimeHistogram_h
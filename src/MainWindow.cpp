@@ -7,12 +7,20 @@
  */
 
 
+#include <stdio.h>	// rename()
+
 #include <QApplication>
 #include <QCloseEvent>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QSignalMapper>
 #include <QClipboard>
+#include <QHeaderView>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
 
 #include "MainWindow.h"
 #include "ActionManager.h"
@@ -24,14 +32,18 @@
 #include "DebugHelpers.h"
 #include "DirTree.h"
 #include "DirTreeCache.h"
+#include "DirTreeDiff.h"
+#include "SizeHistory.h"
 #include "DirTreeModel.h"
 #include "DirTreePatternFilter.h"
 #include "DirTreePkgFilter.h"
+#include "DirWatcher.h"
 #include "Exception.h"
 #include "ExcludeRules.h"
 #include "FileDetailsView.h"
 #include "FileInfo.h"
 #include "FileSizeStatsWindow.h"
+#include "FindFilesDialog.h"
 #include "HeaderTweaker.h"
 #include "Logger.h"
 #include "MimeCategorizer.h"
@@ -42,18 +54,25 @@
 #include "PanelMessage.h"
 #include "PkgManager.h"
 #include "PkgQuery.h"
+#include "RemoteAgent.h"
 #include "Refresher.h"
+#include "Trash.h"
 #include "SelectionModel.h"
 #include "Settings.h"
 #include "SettingsHelpers.h"
 #include "ShowUnpkgFilesDialog.h"
 #include "SysUtil.h"
-#include "Trash.h"
+#include "TreemapTile.h"
+#include "UpdateScheduler.h"
 #include "Version.h"
 
 #define LONG_MESSAGE		25*1000
 #define UPDATE_MILLISEC		200
 
+// Write a checkpoint of a scan that is still running after this time; see
+// resumeReading()
+#define CHECKPOINT_INTERVAL_SEC	600
+
 #if (QT_VERSION < QT_VERSION_CHECK( 5, 13, 0 ))
 #  define HAVE_SIGNAL_MAPPER	  1
 #else
@@ -72,6 +91,33 @@ using QDirStat::CleanupCollection;
 using QDirStat::PkgFilter;
 
 
+namespace
+{
+    /**
+     * Create the PkgQuery instance in a worker thread and call
+     * MainWindow::pkgQueryReady() in the main thread when that is done.
+     **/
+    class PkgQueryInit: public QRunnable
+    {
+    public:
+
+	PkgQueryInit( QObject * receiver ):
+	    _receiver( receiver )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    PkgQuery::instance();
+	    QMetaObject::invokeMethod( _receiver, "pkgQueryReady", Qt::QueuedConnection );
+	}
+
+    private:
+	QObject * _receiver;
+    };
+
+}	// namespace
+
+
 MainWindow::MainWindow():
     QMainWindow(),
     _ui( new Ui::MainWindow ),
@@ -81,9 +127,13 @@ MainWindow::MainWindow():
     _verboseSelection( false ),
     _urlInWindowTitle( false ),
     _useTreemapHover( false ),
+    _verifySparseFiles( true ),
     _statusBarTimeout( 3000 ), // millisec
     _treeLevelMapper(0),
-    _currentLayout( 0 )
+    _currentLayout( 0 ),
+    _elapsedTimeUpdate( 0 ),
+    _nameIndexBuilder( 0 ),
+    _dirWatcher( 0 )
 {
     CHECK_PTR( _ui );
 
@@ -92,8 +142,11 @@ MainWindow::MainWindow():
     initLayoutActions();
     createLayouts();
     readSettings();
-    _updateTimer.setInterval( UPDATE_MILLISEC );
+    _elapsedTimeUpdate = new ScheduledUpdate( this, NormalPriority, UPDATE_MILLISEC );
+    CHECK_NEW( _elapsedTimeUpdate );
+    _elapsedTimeUpdate->setWidget( this );
     _treeExpandTimer.setSingleShot( true );
+    _checkpointTimer.setInterval( CHECKPOINT_INTERVAL_SEC * 1000 );
     _dUrl = _ui->actionDonate->iconText();
     _futureSelection.setUseRootFallback( false );
 
@@ -111,6 +164,9 @@ MainWindow::MainWindow():
 
     _dirTreeModel->setSelectionModel( _selectionModel );
 
+    _dirWatcher = new DirWatcher( _dirTreeModel->tree(), this );
+    CHECK_NEW( _dirWatcher );
+
     _cleanupCollection = new CleanupCollection( _selectionModel );
     CHECK_NEW( _cleanupCollection );
 
@@ -135,26 +191,16 @@ MainWindow::MainWindow():
     connectActions();
     changeLayout( _layoutName );
 
-    if ( ! PkgQuery::haveGetInstalledPkgSupport() ||
-	 ! PkgQuery::haveFileListSupport()	    )
-    {
-	logInfo() << "No package manager support "
-		  << "for getting installed packages or file lists"
-		  << endl;
-
-	_ui->actionOpenPkg->setEnabled( false );
-    }
-
-    PkgManager * pkgManager = PkgQuery::primaryPkgManager();
+    // Checking the package managers starts external commands: Do that in
+    // the background so reading a directory can start right away. Until
+    // then, the package actions are disabled.
 
-    if ( ! pkgManager || ! pkgManager->supportsFileListCache() )
-    {
-	logInfo() << "No package manager support "
-		  << "for getting a file lists cache"
-		  << endl;
+    _ui->actionOpenPkg->setEnabled( false );
+    _ui->actionShowUnpkgFiles->setEnabled( false );
 
-	_ui->actionShowUnpkgFiles->setEnabled( false );
-    }
+    PkgQueryInit * pkgQueryInit = new PkgQueryInit( this );
+    CHECK_NEW( pkgQueryInit );
+    _threadPool.start( pkgQueryInit );
 
     if ( ! _ui->actionShowTreemap->isChecked() )
 	_ui->treemapView->disable();
@@ -179,12 +225,25 @@ MainWindow::~MainWindow()
     if ( _configDialog )
 	delete _configDialog;
 
+    // This waits for the deleting threads, but it doesn't touch the tree
+    // anymore
+
+    delete _parallelDeleter;
+    delete _trashJob;
+    delete _trashEmptier;
+
     delete _ui->dirTreeView;
     delete _cleanupCollection;
     delete _selectionModel;
+    delete _dirWatcher;
     delete _dirTreeModel;
 
     qDeleteAll( _layouts );
+
+    // Wait for a NameIndexBuilder that might still be busy
+
+    _threadPool.waitForDone();
+    delete _nameIndexBuilder;
 }
 
 
@@ -193,6 +252,12 @@ void MainWindow::connectSignals()
     connect( _selectionModel,		SIGNAL( currentBranchChanged( QModelIndex ) ),
 	     _ui->dirTreeView,		SLOT  ( closeAllExcept	    ( QModelIndex ) ) );
 
+    connect( _dirTreeModel->tree(),	SIGNAL( replacingSubtree( DirInfo * ) ),
+	     _ui->dirTreeView,		SLOT  ( replacingSubtree( DirInfo * ) ) );
+
+    connect( _dirTreeModel->tree(),	SIGNAL( subtreeReplaced ( DirInfo * ) ),
+	     _ui->dirTreeView,		SLOT  ( subtreeReplaced ( DirInfo * ) ) );
+
     connect( _dirTreeModel->tree(),	SIGNAL( startingReading() ),
 	     this,			SLOT  ( startingReading() ) );
 
@@ -202,6 +267,9 @@ void MainWindow::connectSignals()
     connect( _dirTreeModel->tree(),	SIGNAL( aborted()	  ),
 	     this,			SLOT  ( readingAborted()  ) );
 
+    connect( _dirTreeModel->tree(),	SIGNAL( sharedExtentsFinished() ),
+	     this,			SLOT  ( updateFileDetailsView() ) );
+
     connect( _selectionModel,		SIGNAL( selectionChanged() ),
 	     this,			SLOT  ( updateActions()	   ) );
 
@@ -217,18 +285,30 @@ void MainWindow::connectSignals()
     connect( _ui->treemapView,		SIGNAL( treemapChanged() ),
 	     this,			SLOT  ( updateActions()	 ) );
 
+    connect( _selectionModel,		SIGNAL( currentItemChanged( FileInfo *, FileInfo * ) ),
+	     _dirTreeModel->tree(),	SLOT  ( prioritize	  ( FileInfo *		   ) ) );
+
+    connect( _ui->dirTreeView,		SIGNAL( expanded	  ( QModelIndex ) ),
+	     this,			SLOT  ( prioritizeReading ( QModelIndex ) ) );
+
+    connect( _ui->treemapView,		SIGNAL( treemapChanged()	 ),
+	     this,			SLOT  ( prioritizeTreemapRoot() ) );
+
     connect( _cleanupCollection,	SIGNAL( startingCleanup( QString ) ),
 	     this,			SLOT  ( startingCleanup( QString ) ) );
 
     connect( _cleanupCollection,	SIGNAL( cleanupFinished( int ) ),
 	     this,			SLOT  ( cleanupFinished( int ) ) );
 
-    connect( &_updateTimer,		SIGNAL( timeout()	  ),
+    connect( _elapsedTimeUpdate,	SIGNAL( update()	  ),
 	     this,			SLOT  ( showElapsedTime() ) );
 
     connect( &_treeExpandTimer,		  SIGNAL( timeout()	  ),
              _ui->actionExpandTreeLevel1, SLOT( trigger()          ) );
 
+    connect( &_checkpointTimer,		SIGNAL( timeout()	  ),
+	     this,			SLOT  ( writeCheckpoint() ) );
+
     if ( _useTreemapHover )
     {
 	connect( _ui->treemapView,	SIGNAL( hoverEnter ( FileInfo * ) ),
@@ -260,15 +340,25 @@ void MainWindow::connectActions()
     // "File" menu
 
     CONNECT_ACTION( _ui->actionOpenDir,			    this, askOpenDir()	      );
+    CONNECT_ACTION( _ui->actionEstimateDir,		    this, askEstimateDir()    );
+    CONNECT_ACTION( _ui->actionOpenRemote,		    this, askOpenRemote()     );
+    CONNECT_ACTION( _ui->actionRefineEstimates,		    this, refineEstimates()   );
     CONNECT_ACTION( _ui->actionOpenPkg,			    this, askOpenPkg()	      );
     CONNECT_ACTION( _ui->actionShowUnpkgFiles,		    this, askShowUnpkgFiles() );
     CONNECT_ACTION( _ui->actionRefreshAll,		    this, refreshAll()	      );
     CONNECT_ACTION( _ui->actionRefreshSelected,		    this, refreshSelected()   );
     CONNECT_ACTION( _ui->actionReadExcludedDirectory,	    this, refreshSelected()   );
     CONNECT_ACTION( _ui->actionContinueReadingAtMountPoint, this, refreshSelected()   );
+
+    connect( _ui->actionWatchChanges, SIGNAL( toggled( bool )	 ),
+	     this,		      SLOT  ( toggleWatchChanges() ) );
     CONNECT_ACTION( _ui->actionStopReading,		    this, stopReading()	      );
+    CONNECT_ACTION( _ui->actionResumeReading,		    this, resumeReading()     );
     CONNECT_ACTION( _ui->actionAskWriteCache,		    this, askWriteCache()     );
     CONNECT_ACTION( _ui->actionAskReadCache,		    this, askReadCache()      );
+    CONNECT_ACTION( _ui->actionAskCompareWithCache,	    this, askCompareWithCache() );
+    CONNECT_ACTION( _ui->actionStopComparing,		    this, stopComparing()     );
+    CONNECT_ACTION( _ui->actionAskLoadSizeHistory,	    this, askLoadSizeHistory() );
     CONNECT_ACTION( _ui->actionQuit,			    qApp, quit()	      );
 
 
@@ -324,10 +414,13 @@ void MainWindow::connectActions()
 
     CONNECT_ACTION( _ui->actionFileSizeStats,	   this, showFileSizeStats() );
     CONNECT_ACTION( _ui->actionFileTypeStats,	   this, showFileTypeStats() );
+    CONNECT_ACTION( _ui->actionFileAgeStats,	   this, showFileAgeStats() );
+    CONNECT_ACTION( _ui->actionOwnerUsage,	   this, showOwnerUsage() );
 
     _ui->actionFileTypeStats->setShortcutContext( Qt::ApplicationShortcut );
 
     CONNECT_ACTION( _ui->actionShowFilesystems,	   this, showFilesystems() );
+    CONNECT_ACTION( _ui->actionShowScanStats,	   this, showScanStats() );
 
 
 
@@ -335,6 +428,8 @@ void MainWindow::connectActions()
 
     CONNECT_ACTION( _ui->actionCopyPathToClipboard, this, copyCurrentPathToClipboard() );
     CONNECT_ACTION( _ui->actionMoveToTrash,	    this, moveToTrash() );
+    CONNECT_ACTION( _ui->actionDeletePermanently,   this, deletePermanently() );
+    CONNECT_ACTION( _ui->actionEmptyTrash,	    this, emptyTrash() );
 
 
     // "Go To" menu
@@ -365,6 +460,10 @@ void MainWindow::connectActions()
     CONNECT_ACTION( _ui->actionDiscoverHardLinkedFiles, this, discoverHardLinkedFiles() );
     CONNECT_ACTION( _ui->actionDiscoverBrokenSymLinks,  this, discoverBrokenSymLinks()  );
     CONNECT_ACTION( _ui->actionDiscoverSparseFiles,     this, discoverSparseFiles()     );
+    CONNECT_ACTION( _ui->actionDiscoverFastestGrowingDirs, this, discoverFastestGrowingDirs() );
+    CONNECT_ACTION( _ui->actionFindFiles,               this, findFiles()               );
+    CONNECT_ACTION( _ui->actionDiscoverDuplicateFiles,  this, discoverDuplicateFiles()  );
+    CONNECT_ACTION( _ui->actionDiscoverAllFiles,        this, discoverAllFiles()        );
 
 
     // "Settings" menu
@@ -411,11 +510,22 @@ void MainWindow::updateActions()
     FileInfo * currentItem   = _selectionModel->currentItem();
     FileInfo * firstToplevel = _dirTreeModel->tree()->firstToplevel();
     bool pkgView	     = firstToplevel && firstToplevel->isPkgInfo();
+    bool remote		     = RemoteReadJob::isRemoteUrl( _dirTreeModel->tree()->url() ) ||
+			       Ext4ReadJob::isExt4Url( _dirTreeModel->tree()->url() ) ||
+			       NtfsReadJob::isNtfsUrl( _dirTreeModel->tree()->url() ) ||
+			       ImportReadJob::isImportUrl( _dirTreeModel->tree()->url() );
 
     _ui->actionStopReading->setEnabled( reading );
+    _ui->actionResumeReading->setEnabled( ! reading && firstToplevel && ! pkgView &&
+					  haveCheckpoint( _dirTreeModel->tree()->url() ) );
     _ui->actionRefreshAll->setEnabled	( ! reading );
+    _ui->actionRefineEstimates->setEnabled( ! reading && _dirTreeModel->tree()->hasEstimates() );
     _ui->actionAskReadCache->setEnabled ( ! reading );
     _ui->actionAskWriteCache->setEnabled( ! reading );
+    _ui->actionAskCompareWithCache->setEnabled( ! reading && firstToplevel && ! pkgView );
+    _ui->actionStopComparing->setEnabled( _dirTreeModel->tree()->diff() );
+    _ui->actionDiscoverFastestGrowingDirs->setEnabled( _dirTreeModel->tree()->sizeHistory() );
+    _ui->actionWatchChanges->setEnabled( ( firstToplevel && ! pkgView && ! remote ) || _dirWatcher->isActive() );
 
     _ui->actionCopyPathToClipboard->setEnabled( currentItem );
     _ui->actionGoUp->setEnabled( currentItem && currentItem->treeLevel() > 1 );
@@ -423,21 +533,30 @@ void MainWindow::updateActions()
 
     FileInfoSet selectedItems = _selectionModel->selectedItems();
     FileInfo * sel	      = selectedItems.first();
-    int selSize		      = selectedItems.size();
+    int selSize		      = _selectionModel->selectedCount();
 
     bool oneDirSelected	   = selSize == 1 && sel && sel->isDir() && ! sel->isPkgInfo();
-    bool pseudoDirSelected = selectedItems.containsPseudoDir();
-    bool pkgSelected	   = selectedItems.containsPkg();
+    bool pseudoDirSelected = _selectionModel->selectionContainsPseudoDir();
+    bool pkgSelected	   = _selectionModel->selectionContainsPkg();
 
-    _ui->actionMoveToTrash->setEnabled( sel && ! pseudoDirSelected && ! pkgSelected && ! reading );
-    _ui->actionRefreshSelected->setEnabled( selSize == 1 && ! sel->isExcluded() && ! sel->isMountPoint() && ! pkgView );
-    _ui->actionContinueReadingAtMountPoint->setEnabled( oneDirSelected && sel->isMountPoint() );
-    _ui->actionReadExcludedDirectory->setEnabled      ( oneDirSelected && sel->isExcluded()   );
+    // The items of a remote tree are not on this machine
+
+    _ui->actionMoveToTrash->setEnabled( sel && ! pseudoDirSelected && ! pkgSelected && ! reading &&
+					! remote && ! _trashJob );
+    _ui->actionDeletePermanently->setEnabled( sel && ! pseudoDirSelected && ! pkgSelected && ! reading &&
+					      ! remote && ! _parallelDeleter );
+    _ui->actionEmptyTrash->setEnabled( ! reading && ! _trashJob && ! _trashEmptier );
+    _ui->actionRefreshSelected->setEnabled( selSize == 1 && ! sel->isExcluded() && ! sel->isMountPoint() &&
+					    ! pkgView && ! remote );
+    _ui->actionContinueReadingAtMountPoint->setEnabled( oneDirSelected && sel->isMountPoint() && ! remote );
+    _ui->actionReadExcludedDirectory->setEnabled      ( oneDirSelected && sel->isExcluded()   && ! remote );
 
     bool nothingOrOneDir = selectedItems.isEmpty() || oneDirSelected;
 
     _ui->actionFileSizeStats->setEnabled( ! reading && nothingOrOneDir );
     _ui->actionFileTypeStats->setEnabled( ! reading && nothingOrOneDir );
+    _ui->actionFileAgeStats->setEnabled ( ! reading && nothingOrOneDir );
+    _ui->actionOwnerUsage->setEnabled   ( ! reading && nothingOrOneDir );
 
     bool showingTreemap = _ui->treemapView->isVisible();
 
@@ -461,10 +580,14 @@ void MainWindow::readSettings()
     _verboseSelection	  = settings.value( "VerboseSelection"	      , false ).toBool();
     _urlInWindowTitle	  = settings.value( "UrlInWindowTitle"	      , false ).toBool();
     _useTreemapHover	  = settings.value( "UseTreemapHover"	      , false ).toBool();
+    _verifySparseFiles	  = settings.value( "VerifySparseFiles"	      , true  ).toBool();
     _layoutName		  = settings.value( "Layout"		      , "L2"  ).toString();
+    int maxExpandRows	  = settings.value( "MaxExpandRows"	      , DEFAULT_MAX_EXPAND_ROWS ).toInt();
 
     settings.endGroup();
 
+    _ui->dirTreeView->setMaxExpandRows( maxExpandRows );
+
     settings.beginGroup( "MainWindow-Subwindows" );
     QByteArray mainSplitterState = settings.value( "MainSplitter" , QByteArray() ).toByteArray();
     QByteArray topSplitterState	 = settings.value( "TopSplitter"  , QByteArray() ).toByteArray();
@@ -535,6 +658,8 @@ void MainWindow::writeSettings()
     settings.setDefaultValue( "StatusBarTimeoutMillisec", _statusBarTimeout );
     settings.setDefaultValue( "UrlInWindowTitle"	, _urlInWindowTitle );
     settings.setDefaultValue( "UseTreemapHover"		, _useTreemapHover );
+    settings.setDefaultValue( "VerifySparseFiles"	, _verifySparseFiles );
+    settings.setDefaultValue( "MaxExpandRows"		, _ui->dirTreeView->maxExpandRows() );
 
     settings.endGroup();
 
@@ -614,23 +739,12 @@ void MainWindow::closeEvent( QCloseEvent *event )
 
 void MainWindow::busyDisplay()
 {
-    _ui->treemapView->disable();
-    updateActions();
-
-    if ( _unreadableDirsWindow )
-    {
-	// Close the window that lists unreadable directories: With the next
-	// directory read, things might have changed; the user may have fixed
-	// permissions or ownership of those directories.
-	//
-	// Closing this window also deletes it (because it has the
-	// DeleteOnClose flag set). The QPointer we use will take care of
-	// resetting itself to 0 when the underlying QObject is deleted.
+    if ( ! _ui->treemapView->progressiveRebuild() )
+	_ui->treemapView->disable();
 
-	_unreadableDirsWindow->close();
-    }
+    updateActions();
 
-    _updateTimer.start();
+    _elapsedTimeUpdate->request();
 
     // It would be nice to sort by read jobs during reading, but this confuses
     // the hell out of the Qt side of the data model; so let's sort by name
@@ -654,7 +768,7 @@ void MainWindow::idleDisplay()
     logInfo() << endl;
 
     updateActions();
-    _updateTimer.stop();
+    _elapsedTimeUpdate->cancel();
     int sortCol = QDirStat::DataColumns::toViewCol( QDirStat::PercentNumCol );
     _ui->dirTreeView->sortByColumn( sortCol, Qt::DescendingOrder );
 
@@ -678,6 +792,9 @@ void MainWindow::startingReading()
 {
     _stopWatch.start();
     busyDisplay();
+
+    if ( ! checkpointFileName( _dirTreeModel->tree()->url() ).isEmpty() )
+	_checkpointTimer.start();
 }
 
 
@@ -691,12 +808,35 @@ void MainWindow::readingFinished()
     _ui->statusBar->showMessage( tr( "Finished. Elapsed time: %1").arg( elapsedTime ), LONG_MESSAGE );
     logInfo() << "Reading finished after " << elapsedTime << endl;
 
+    // A complete tree does not need its checkpoint anymore
+
+    DirTree * tree = _dirTreeModel->tree();
+    tree->setCacheBaseline( "" );
+
+    if ( _checkpointTimer.isActive() )
+    {
+	_checkpointTimer.stop();
+
+	if ( tree->firstToplevel() && tree->firstToplevel()->readState() != DirCached )
+	{
+	    QString checkpoint = checkpointFileName( tree->url() );
+
+	    if ( ! checkpoint.isEmpty() && QFile::exists( checkpoint ) )
+	    {
+		logInfo() << "Removing checkpoint " << checkpoint << endl;
+		QFile::remove( checkpoint );
+	    }
+	}
+    }
+
     if ( _dirTreeModel->tree()->firstToplevel() &&
 	 _dirTreeModel->tree()->firstToplevel()->errSubDirCount() > 0 )
     {
 	showDirPermissionsWarning();
     }
 
+    buildNameIndex();
+
     // Debug::dumpModelTree( _dirTreeModel, QModelIndex(), "" );
 }
 
@@ -709,6 +849,95 @@ void MainWindow::readingAborted()
     QString elapsedTime = formatTime( _stopWatch.elapsed() );
     _ui->statusBar->showMessage( tr( "Aborted. Elapsed time: %1").arg( elapsedTime ), LONG_MESSAGE );
     logInfo() << "Reading aborted after " << elapsedTime << endl;
+
+    if ( _checkpointTimer.isActive() )
+    {
+	_checkpointTimer.stop();
+	writeCheckpoint();
+    }
+
+    _dirTreeModel->tree()->setCacheBaseline( "" );
+    updateActions();
+}
+
+
+QString MainWindow::checkpointFileName( const QString & url )
+{
+    // Only for directories from disk, not for the pkg view or several
+    // cache files
+
+    if ( ! url.startsWith( "/" ) )
+	return QString();
+
+    QByteArray xdg_cache_home = qgetenv( "XDG_CACHE_HOME" );
+    QString cacheDir = xdg_cache_home.isEmpty() ?
+	QDir::homePath() + "/.cache" :
+	QString::fromUtf8( xdg_cache_home );
+
+    QByteArray hash = QCryptographicHash::hash( url.toUtf8(), QCryptographicHash::Md5 ).toHex();
+
+    return cacheDir + "/qdirstat/checkpoint-" + QString::fromLatin1( hash ) + BINARY_CACHE_SUFFIX;
+}
+
+
+bool MainWindow::haveCheckpoint( const QString & url )
+{
+    QString checkpoint = checkpointFileName( url );
+
+    return ! checkpoint.isEmpty() && QFile::exists( checkpoint );
+}
+
+
+void MainWindow::writeCheckpoint()
+{
+    DirTree * tree = _dirTreeModel->tree();
+    FileInfo * toplevel = tree->firstToplevel();
+    QString checkpoint = checkpointFileName( tree->url() );
+
+    // A filtered tree (like the unpackaged files) or one from a cache file
+    // can't be used for resuming a scan.
+    //
+    // Don't leave files owned by root in the user's home directory.
+
+    if ( checkpoint.isEmpty() || ! toplevel || toplevel->readState() == DirCached ||
+	 toplevel->isPkgInfo() || tree->hasFilters() || SysUtil::runningWithSudo() )
+    {
+	return;
+    }
+
+    if ( ! QDir().mkpath( QFileInfo( checkpoint ).path() ) )
+	return;
+
+    // The checkpoint might be in use as the baseline of this scan, so it
+    // must not be overwritten in place
+
+    logInfo() << "Writing checkpoint " << checkpoint << " for " << tree->url() << endl;
+    QString tmpName = checkpoint + ".new";
+    CacheWriter writer( tmpName, tree,
+			true ); // binary
+
+    if ( ! writer.ok() || rename( tmpName.toUtf8().constData(), checkpoint.toUtf8().constData() ) != 0 )
+    {
+	logError() << "Writing checkpoint " << checkpoint << " failed" << endl;
+	QFile::remove( tmpName );
+    }
+}
+
+
+bool MainWindow::useCheckpoint( const QString & url )
+{
+    QString checkpoint = checkpointFileName( url );
+
+    if ( checkpoint.isEmpty() || ! QFile::exists( checkpoint ) )
+	return false;
+
+    if ( ! _dirTreeModel->tree()->setCacheBaseline( checkpoint ) )
+    {
+	logWarning() << "Can't use checkpoint " << checkpoint << " for " << url << endl;
+	return false;
+    }
+
+    return true;
 }
 
 
@@ -720,6 +949,14 @@ void MainWindow::openUrl( const QString & url )
 	readPkg( url );
     else if ( isUnpkgUrl( url ) )
 	showUnpkgFiles( url );
+    else if ( RemoteReadJob::isRemoteUrl( url ) )
+	readRemote( url );
+    else if ( Ext4ReadJob::isExt4Url( url ) )
+	readExt4Image( url );
+    else if ( NtfsReadJob::isNtfsUrl( url ) )
+	readNtfsVolume( url );
+    else if ( ImportReadJob::isImportUrl( url ) )
+	readImport( url );
     else
 	openDir( url );
 }
@@ -753,7 +990,7 @@ void MainWindow::openDir( const QString & url )
 }
 
 
-void MainWindow::askOpenDir()
+void MainWindow::askOpenDir( bool sampling )
 {
     QString path;
     DirTree * tree = _dirTreeModel->tree();
@@ -770,11 +1007,90 @@ void MainWindow::askOpenDir()
     {
 	tree->reset();
 	tree->setCrossFilesystems( crossFilesystems );
+	tree->setSampling( sampling );
+
+	// An earlier scan of that directory might have been aborted
+
+	QString url = QFileInfo( path ).absoluteFilePath();
+
+	if ( ! sampling && haveCheckpoint( url ) )
+	{
+	    int ret = QMessageBox::question( this,
+					     tr( "Resume Reading" ), // Title
+					     tr( "An earlier scan of %1 was not finished.\n"
+						 "Resume it and read only the remaining directories?" ).arg( url ),
+					     QMessageBox::Yes | QMessageBox::No );
+
+	    if ( ret == QMessageBox::Yes )
+		useCheckpoint( url );
+	    else
+		QFile::remove( checkpointFileName( url ) );
+	}
+
 	openUrl( path );
     }
 }
 
 
+void MainWindow::askEstimateDir()
+{
+    askOpenDir( true ); // sampling
+}
+
+
+void MainWindow::askOpenRemote()
+{
+    QString url = _dirTreeModel->tree()->url();
+
+    if ( ! RemoteReadJob::isRemoteUrl( url ) )
+	url = REMOTE_URL_PREFIX;
+
+    bool ok = false;
+    url = QInputDialog::getText( this,
+				 tr( "Open Remote Directory" ),
+				 tr( "Directory on a remote host (%1[user@]host/path);\n"
+				     "several hosts separated by commas for a distributed scan:" )
+				 .arg( REMOTE_URL_PREFIX ),
+				 QLineEdit::Normal,
+				 url,
+				 &ok ).trimmed();
+
+    if ( ! ok || url.isEmpty() )
+	return;
+
+    // Also accept the scp notation "[user@]host:/path"
+
+    int colon = url.indexOf( ":/" );
+
+    if ( ! RemoteReadJob::isRemoteUrl( url ) && colon > 0 )
+	url = REMOTE_URL_PREFIX + url.left( colon ) + url.mid( colon + 1 );
+
+    QString host;
+    QString path;
+
+    if ( ! RemoteReadJob::splitRemoteUrl( url, host, path ) )
+    {
+	QMessageBox::warning( this, tr( "Error" ),
+			      tr( "Not a remote directory: %1" ).arg( url ) );
+	return;
+    }
+
+    openUrl( url );
+}
+
+
+void MainWindow::refineEstimates()
+{
+    DirTree * tree = _dirTreeModel->tree();
+
+    if ( ! tree->hasEstimates() )
+	return;
+
+    tree->refineEstimates();
+    updateActions();
+}
+
+
 void MainWindow::askOpenPkg()
 {
     bool canceled;
@@ -854,10 +1170,9 @@ void MainWindow::showUnpkgFiles( const UnpkgSettings & unpkgSettings )
     tree->clearFilters();
     tree->addFilter( filter );
 
-    foreach ( const QString & pattern, unpkgSettings.ignorePatterns )
-    {
-	tree->addFilter( DirTreePatternFilter::create( pattern ) );
-    }
+    // All ignore patterns in one filter that checks each entry only once
+
+    tree->addFilter( DirTreePatternSetFilter::create( unpkgSettings.ignorePatterns ) );
 
 
     // Start reading the directory
@@ -903,6 +1218,14 @@ void MainWindow::refreshAll()
 
 	if ( PkgFilter::isPkgUrl( url ) )
 	    _dirTreeModel->readPkg( url );
+	else if ( RemoteReadJob::isRemoteUrl( url ) )
+	    _dirTreeModel->readRemote( url );
+	else if ( Ext4ReadJob::isExt4Url( url ) )
+	    _dirTreeModel->readExt4Image( url );
+	else if ( NtfsReadJob::isNtfsUrl( url ) )
+	    _dirTreeModel->readNtfsVolume( url );
+	else if ( ImportReadJob::isImportUrl( url ) )
+	    _dirTreeModel->readImport( url );
 	else
 	    _dirTreeModel->openUrl( url );
 
@@ -925,6 +1248,29 @@ void MainWindow::refreshSelected()
 }
 
 
+void MainWindow::toggleWatchChanges()
+{
+    if ( ! _ui->actionWatchChanges->isChecked() )
+    {
+	_dirWatcher->stop();
+	_ui->statusBar->showMessage( tr( "Stopped watching for changes." ), _statusBarTimeout );
+    }
+    else if ( _dirWatcher->start() )
+    {
+	_ui->statusBar->showMessage( tr( "Watching for changes with %1." )
+				     .arg( _dirWatcher->method() ), _statusBarTimeout );
+    }
+    else
+    {
+	_ui->actionWatchChanges->setChecked( false );
+	_ui->statusBar->showMessage( tr( "Can't watch for changes: %1" )
+				     .arg( _dirWatcher->errorMessage() ), LONG_MESSAGE );
+    }
+
+    updateActions();
+}
+
+
 void MainWindow::applyFutureSelection()
 {
     FileInfo * sel = _futureSelection.subtree();
@@ -952,22 +1298,138 @@ void MainWindow::stopReading()
 }
 
 
-void MainWindow::readCache( const QString & cacheFileName )
+void MainWindow::resumeReading()
+{
+    DirTree * tree = _dirTreeModel->tree();
+    QString url = tree->url();
+
+    if ( url.isEmpty() || tree->isBusy() )
+	return;
+
+    // Only the directories that are not in the checkpoint or that changed
+    // since then are read from disk; see CacheBaseline
+
+    if ( useCheckpoint( url ) )
+    {
+	logInfo() << "Resuming scan of " << url << endl;
+	_enableDirPermissionsWarning = true;
+	_dirTreeModel->openUrl( url );
+	updateActions();
+    }
+    else
+    {
+	_ui->statusBar->showMessage( tr( "No checkpoint to resume reading %1" ).arg( url ), LONG_MESSAGE );
+    }
+}
+
+
+void MainWindow::readCache( const QString &	cacheFileName,
+			    const QStringList & deltaFileNames )
 {
     _dirTreeModel->clear();
 
     if ( ! cacheFileName.isEmpty() )
-	_dirTreeModel->tree()->readCache( cacheFileName );
+	_dirTreeModel->tree()->readCache( cacheFileName, deltaFileNames );
+}
+
+
+void MainWindow::readCaches( const QStringList & cacheFileNames )
+{
+    _dirTreeModel->clear();
+
+    if ( ! cacheFileNames.isEmpty() )
+	_dirTreeModel->tree()->readCaches( cacheFileNames );
 }
 
 
 void MainWindow::askReadCache()
+{
+    QStringList fileNames = QFileDialog::getOpenFileNames( this, // parent
+							   tr( "Select QDirStat cache file(s)" ),
+							   DEFAULT_CACHE_NAME );
+    if ( fileNames.size() == 1 )
+	readCache( fileNames.first() );
+    else if ( fileNames.size() > 1 )
+	readCaches( fileNames );
+}
+
+
+void MainWindow::askCompareWithCache()
 {
     QString fileName = QFileDialog::getOpenFileName( this, // parent
-						     tr( "Select QDirStat cache file" ),
+						     tr( "Select QDirStat cache file to compare with" ),
 						     DEFAULT_CACHE_NAME );
     if ( ! fileName.isEmpty() )
-	readCache( fileName );
+	compareWithCache( fileName );
+}
+
+
+void MainWindow::compareWithCache( const QString &     cacheFileName,
+				   const QStringList & deltaFileNames )
+{
+    DirTree * tree = _dirTreeModel->tree();
+
+    if ( tree->compareWithCache( cacheFileName, deltaFileNames ) )
+    {
+	// Show the biggest growth first
+
+	int deltaCol = DataColumns::toViewCol( SizeDeltaCol );
+	_ui->dirTreeView->header()->setSectionHidden( deltaCol, false );
+	_ui->dirTreeView->sortByColumn( deltaCol, Qt::DescendingOrder );
+
+	showProgress( tr( "Comparing with %1" ).arg( tree->diff()->oldName() ) );
+    }
+    else
+    {
+	QMessageBox::critical( this,
+			       tr( "Error" ), // Title
+			       tr( "ERROR comparing with cache file %1" ).arg( cacheFileName ) );
+    }
+
+    updateActions();
+}
+
+
+void MainWindow::stopComparing()
+{
+    _dirTreeModel->tree()->clearDiff();
+    updateActions();
+}
+
+
+void MainWindow::askLoadSizeHistory()
+{
+    QString fileName = QFileDialog::getOpenFileName( this, // parent
+						     tr( "Select QDirStat size history file" ) );
+    if ( fileName.isEmpty() )
+	return;
+
+    DirTree * tree = _dirTreeModel->tree();
+
+    if ( tree->loadSizeHistory( fileName ) )
+    {
+	// Show the biggest growth first
+
+	int historyCol = DataColumns::toViewCol( SizeHistoryCol );
+
+	if ( historyCol >= 0 )
+	{
+	    _ui->dirTreeView->header()->setSectionHidden( historyCol, false );
+	    _ui->dirTreeView->sortByColumn( historyCol, Qt::DescendingOrder );
+	}
+
+	showProgress( tr( "Size history with %1 scans from %2" )
+		      .arg( tree->sizeHistory()->scanCount() )
+		      .arg( fileName ) );
+    }
+    else
+    {
+	QMessageBox::critical( this,
+			       tr( "Error" ), // Title
+			       tr( "ERROR reading size history file %1" ).arg( fileName ) );
+    }
+
+    updateActions();
 }
 
 
@@ -1004,38 +1466,71 @@ void MainWindow::readPkg( const PkgFilter & pkgFilter )
 }
 
 
-void MainWindow::updateWindowTitle( const QString & url )
+void MainWindow::readRemote( const QString & url )
 {
-    QString windowTitle = "QDirStat";
-
-    if ( SysUtil::runningAsRoot() )
-	windowTitle += tr( " [root]" );
-
-    if ( _urlInWindowTitle )
-	windowTitle += " " + url;
-
-    setWindowTitle( windowTitle );
+    updateWindowTitle( url );
+    _dirTreeModel->readRemote( url );
+    updateActions();
+    expandTreeToLevel( 1 );
 }
 
 
-void MainWindow::expandTreeToLevel( int level )
+void MainWindow::readExt4Image( const QString & url )
 {
-    logDebug() << "Expanding tree to level " << level << endl;
-
-    if ( level < 1 )
-	_ui->dirTreeView->collapseAll();
-    else
-	_ui->dirTreeView->expandToDepth( level - 1 );
+    updateWindowTitle( url );
+    _dirTreeModel->readExt4Image( url );
+    updateActions();
+    expandTreeToLevel( 1 );
 }
 
 
-void MainWindow::showProgress( const QString & text )
+void MainWindow::readNtfsVolume( const QString & url )
 {
-    _ui->statusBar->showMessage( text, _statusBarTimeout );
+    updateWindowTitle( url );
+    _dirTreeModel->readNtfsVolume( url );
+    updateActions();
+    expandTreeToLevel( 1 );
 }
 
 
-void MainWindow::showCurrent( FileInfo * item )
+void MainWindow::readImport( const QString & url )
+{
+    updateWindowTitle( url );
+    _dirTreeModel->readImport( url );
+    updateActions();
+    expandTreeToLevel( 1 );
+}
+
+
+void MainWindow::updateWindowTitle( const QString & url )
+{
+    QString windowTitle = "QDirStat";
+
+    if ( SysUtil::runningAsRoot() )
+	windowTitle += tr( " [root]" );
+
+    if ( _urlInWindowTitle )
+	windowTitle += " " + url;
+
+    setWindowTitle( windowTitle );
+}
+
+
+void MainWindow::expandTreeToLevel( int level )
+{
+    logDebug() << "Expanding tree to level " << level << endl;
+
+    _ui->dirTreeView->expandToLevel( level );
+}
+
+
+void MainWindow::showProgress( const QString & text )
+{
+    _ui->statusBar->showMessage( text, _statusBarTimeout );
+}
+
+
+void MainWindow::showCurrent( FileInfo * item )
 {
     if ( item )
     {
@@ -1164,38 +1659,308 @@ void MainWindow::navigateToToplevel()
 
 void MainWindow::moveToTrash()
 {
+    if ( _trashJob )
+	return;
+
     FileInfoSet selectedItems = _selectionModel->selectedItems().normalized();
 
+    if ( selectedItems.isEmpty() )
+	return;
+
     // Prepare output window
 
-    OutputWindow * outputWindow = new OutputWindow( qApp->activeWindow() );
-    CHECK_NEW( outputWindow );
+    _trashOutputWindow = new OutputWindow( qApp->activeWindow() );
+    CHECK_NEW( _trashOutputWindow );
+
+    _trashOutputWindow->showAfterTimeout();
+
+    // Move all selected items to trash in the background. Each one is
+    // removed from the tree when it is in the trash.
+
+    _trashJob = new TrashJob( selectedItems, this );
+    CHECK_NEW( _trashJob );
+
+    connect( _trashJob,		 SIGNAL( trashed  ( QString ) ),
+	     this,		 SLOT  ( trashed  ( QString ) ) );
+
+    connect( _trashJob,		 SIGNAL( error	  ( QString ) ),
+	     _trashOutputWindow, SLOT  ( addStderr( QString ) ) );
+
+    connect( _trashJob,		 SIGNAL( progress     ( int, int, qint64 ) ),
+	     this,		 SLOT  ( trashProgress( int, int, qint64 ) ) );
+
+    connect( _trashJob,		 SIGNAL( finished     ( int ) ),
+	     this,		 SLOT  ( trashFinished() ) );
+
+    _trashJob->start();
+    updateActions();
+}
+
+
+void MainWindow::trashed( const QString & path )
+{
+    if ( _trashOutputWindow )
+	_trashOutputWindow->addStdout( tr( "Moved to trash: %1" ).arg( path ) );
+}
+
+
+void MainWindow::trashProgress( int done, int total, qint64 bytesCopied )
+{
+    QString msg = tr( "Moving to trash... %1 of %2 items" ).arg( done ).arg( total );
+
+    if ( bytesCopied > 0 )
+	msg += " " + tr( "(%1 copied)" ).arg( formatSize( bytesCopied ) );
 
-    // Prepare refresher
+    showProgress( msg );
+}
 
-    FileInfoSet refreshSet = Refresher::parents( selectedItems );
-    _selectionModel->prepareRefresh( refreshSet );
-    Refresher * refresher  = new Refresher( refreshSet, this );
-    CHECK_NEW( refresher );
 
-    connect( outputWindow, SIGNAL( lastProcessFinished( int ) ),
-	     refresher,	   SLOT	 ( refresh()		      ) );
+void MainWindow::trashFinished()
+{
+    if ( ! _trashJob || ! _trashJob->isFinished() )
+	return;
 
-    outputWindow->showAfterTimeout();
+    // Read again what is left of the items that were copied to the trash,
+    // but could not be deleted completely; the others are already gone
+    // from the tree or unchanged.
 
-    // Move all selected items to trash
+    FileInfoSet refreshSet = _trashJob->failedItems();
+    Refresher * refresher  = 0;
 
-    foreach ( FileInfo * item, selectedItems )
+    if ( ! refreshSet.isEmpty() )
     {
-	bool success = Trash::trash( item->path() );
+	_selectionModel->prepareRefresh( refreshSet );
+	refresher = new Refresher( refreshSet, this );
+	CHECK_NEW( refresher );
+    }
 
-	if ( success )
-	    outputWindow->addStdout( tr( "Moved to trash: %1" ).arg( item->path() ) );
-	else
-	    outputWindow->addStderr( tr( "Move to trash failed for %1" ).arg( item->path() ) );
+    QString summary = tr( "Moved %1 of %2 items to the trash" )
+	.arg( _trashJob->trashedCount() )
+	.arg( _trashJob->totalCount() );
+
+    if ( _trashOutputWindow )
+    {
+	if ( refresher )
+	{
+	    connect( _trashOutputWindow, SIGNAL( lastProcessFinished( int ) ),
+		     refresher,		 SLOT  ( refresh()		  ) );
+	}
+
+	_trashOutputWindow->noMoreProcesses();
+    }
+    else if ( refresher )
+    {
+	refresher->refresh();
+    }
+
+    _trashJob->deleteLater();
+    _trashJob = 0;
+
+    _ui->statusBar->showMessage( summary, LONG_MESSAGE );
+    updateActions();
+}
+
+
+void MainWindow::deletePermanently()
+{
+    if ( _parallelDeleter )
+	return;
+
+    FileInfoSet selectedItems = _selectionModel->selectedItems().normalized();
+
+    if ( selectedItems.isEmpty() )
+	return;
+
+    QString msg;
+
+    if ( selectedItems.size() == 1 )
+	msg = tr( "<h3>Delete Permanently</h3>%1<br><br>This cannot be undone!" )
+	    .arg( selectedItems.first()->url() );
+    else
+	msg = tr( "<h3>Delete Permanently</h3>%1 items<br><br>This cannot be undone!" )
+	    .arg( selectedItems.size() );
+
+    int ret = QMessageBox::question( this,
+				     tr( "Please Confirm" ),
+				     msg,
+				     QMessageBox::Yes | QMessageBox::No );
+
+    if ( ret != QMessageBox::Yes )
+	return;
+
+    // Only the errors go to the output window; it shows up only if there
+    // are any or if deleting takes long.
+
+    _deleteOutputWindow = new OutputWindow( qApp->activeWindow() );
+    CHECK_NEW( _deleteOutputWindow );
+
+    _deleteOutputWindow->showAfterTimeout();
+
+    _parallelDeleter = new ParallelDeleter( selectedItems, this );
+    CHECK_NEW( _parallelDeleter );
+
+    connect( _parallelDeleter,	  SIGNAL( error    ( QString ) ),
+	     _deleteOutputWindow, SLOT	( addStderr( QString ) ) );
+
+    connect( _parallelDeleter,	  SIGNAL( progress	 ( int, int ) ),
+	     this,		  SLOT	( deleteProgress ( int, int ) ) );
+
+    connect( _parallelDeleter,	  SIGNAL( finished	 ( int ) ),
+	     this,		  SLOT	( deleteFinished () ) );
+
+    _parallelDeleter->start();
+    updateActions();
+}
+
+
+void MainWindow::deleteProgress( int done, int total )
+{
+    showProgress( tr( "Deleting... %1 of %2 items" ).arg( done ).arg( total ) );
+}
+
+
+void MainWindow::deleteFinished()
+{
+    if ( ! _parallelDeleter || ! _parallelDeleter->isFinished() )
+	return;
+
+    // Read again what is left of the items that could not be deleted
+    // completely; everything else is already gone from the tree.
+
+    FileInfoSet refreshSet = _parallelDeleter->failedItems();
+    Refresher * refresher  = 0;
+
+    if ( ! refreshSet.isEmpty() )
+    {
+	_selectionModel->prepareRefresh( refreshSet );
+	refresher = new Refresher( refreshSet, this );
+	CHECK_NEW( refresher );
+    }
+
+    QString summary = tr( "Deleted %1 of %2 items" )
+	.arg( _parallelDeleter->doneCount() )
+	.arg( _parallelDeleter->totalCount() );
+
+    if ( _deleteOutputWindow )
+    {
+	if ( refresher )
+	{
+	    connect( _deleteOutputWindow, SIGNAL( lastProcessFinished( int ) ),
+		     refresher,		  SLOT	( refresh()		   ) );
+	}
+
+	_deleteOutputWindow->addStdout( summary );
+	_deleteOutputWindow->noMoreProcesses();
+    }
+    else if ( refresher )
+    {
+	refresher->refresh();
+    }
+
+    _parallelDeleter->deleteLater();
+    _parallelDeleter = 0;
+
+    _ui->statusBar->showMessage( summary, LONG_MESSAGE );
+    updateActions();
+}
+
+
+void MainWindow::emptyTrash()
+{
+    if ( _trashEmptier || _trashJob )
+	return;
+
+    int ret = QMessageBox::question( this,
+				     tr( "Please Confirm" ),
+				     tr( "<h3>Empty Trash</h3>"
+					 "Delete everything in the trash bin?<br><br>"
+					 "This cannot be undone!" ),
+				     QMessageBox::Yes | QMessageBox::No );
+
+    if ( ret != QMessageBox::Yes )
+	return;
+
+    _emptyTrashOutputWindow = new OutputWindow( qApp->activeWindow() );
+    CHECK_NEW( _emptyTrashOutputWindow );
+
+    _emptyTrashOutputWindow->showAfterTimeout();
+
+    // All trash directories at once; if one of them is in the tree, the
+    // deleted items are removed from there.
+
+    _trashEmptier = new ParallelDeleter( Trash::contentDirs(), _dirTreeModel->tree(), this );
+    CHECK_NEW( _trashEmptier );
+
+    connect( _trashEmptier,	      SIGNAL( error	 ( QString ) ),
+	     _emptyTrashOutputWindow, SLOT  ( addStderr( QString ) ) );
+
+    connect( _trashEmptier,	      SIGNAL( progress		 ( int, int ) ),
+	     this,		      SLOT  ( emptyTrashProgress ( int, int ) ) );
+
+    connect( _trashEmptier,	      SIGNAL( finished		 ( int ) ),
+	     this,		      SLOT  ( emptyTrashFinished () ) );
+
+    _trashEmptier->start();
+    updateActions();
+}
+
+
+void MainWindow::emptyTrashProgress( int done, int total )
+{
+    // Items that the tree does not know are only counted in their
+    // directories, so the number of items might be exceeded.
+
+    QString msg = tr( "Emptying the trash... %1 of %2 items" ).arg( done ).arg( qMax( done, total ) );
+
+    if ( _trashEmptier && _trashEmptier->bytesFreed() > 0 )
+	msg += " " + tr( "(%1 freed)" ).arg( formatSize( _trashEmptier->bytesFreed() ) );
+
+    showProgress( msg );
+}
+
+
+void MainWindow::emptyTrashFinished()
+{
+    if ( ! _trashEmptier || ! _trashEmptier->isFinished() )
+	return;
+
+    FileInfoSet refreshSet = _trashEmptier->failedItems();
+    Refresher * refresher  = 0;
+
+    if ( ! refreshSet.isEmpty() )
+    {
+	_selectionModel->prepareRefresh( refreshSet );
+	refresher = new Refresher( refreshSet, this );
+	CHECK_NEW( refresher );
+    }
+
+    QString summary = tr( "Emptied the trash: %1 freed" )
+	.arg( formatSize( _trashEmptier->bytesFreed() ) );
+
+    if ( _trashEmptier->errorCount() > 0 )
+	summary += " " + tr( "(%1 errors)" ).arg( _trashEmptier->errorCount() );
+
+    if ( _emptyTrashOutputWindow )
+    {
+	if ( refresher )
+	{
+	    connect( _emptyTrashOutputWindow, SIGNAL( lastProcessFinished( int ) ),
+		     refresher,		      SLOT  ( refresh()		       ) );
+	}
+
+	_emptyTrashOutputWindow->addStdout( summary );
+	_emptyTrashOutputWindow->noMoreProcesses();
+    }
+    else if ( refresher )
+    {
+	refresher->refresh();
     }
 
-    outputWindow->noMoreProcesses();
+    _trashEmptier->deleteLater();
+    _trashEmptier = 0;
+
+    _ui->statusBar->showMessage( summary, LONG_MESSAGE );
+    updateActions();
 }
 
 
@@ -1229,8 +1994,23 @@ void MainWindow::openConfigDialog()
 
 void MainWindow::showElapsedTime()
 {
-    showProgress( tr( "Reading... %1" )
-		  .arg( formatTime( _stopWatch.elapsed(), false ) ) );
+    QString msg = tr( "Reading... %1" ).arg( formatTime( _stopWatch.elapsed(), false ) );
+    const ScanStats & stats = _dirTreeModel->tree()->jobQueue()->scanStats();
+
+    if ( stats.isRunning() && stats.percentDone() >= 0 )
+    {
+	msg += "  " + tr( "%1%, %2 items/sec" )
+	    .arg( stats.percentDone() )
+	    .arg( qRound64( stats.perSecond( stats.entryCount() ) ) );
+
+	if ( stats.remainingMillisec() >= 0 )
+	    msg += ", " + tr( "about %1 left" ).arg( formatTime( stats.remainingMillisec(), false ) );
+    }
+
+    showProgress( msg );
+
+    if ( _dirTreeModel->tree()->isBusy() )
+	_elapsedTimeUpdate->request();
 }
 
 
@@ -1260,6 +2040,36 @@ void MainWindow::showFileSizeStats()
 }
 
 
+void MainWindow::showFileAgeStats()
+{
+    if ( ! _fileAgeStatsWindow )
+    {
+	// This deletes itself when the user closes it. The associated QPointer
+	// keeps track of that and sets the pointer to 0 when it happens.
+
+	_fileAgeStatsWindow = new FileAgeStatsWindow( this );
+    }
+
+    _fileAgeStatsWindow->populate( selectedDirOrRoot() );
+    _fileAgeStatsWindow->show();
+}
+
+
+void MainWindow::showOwnerUsage()
+{
+    if ( ! _ownerUsageWindow )
+    {
+	// This deletes itself when the user closes it. The associated QPointer
+	// keeps track of that and sets the pointer to 0 when it happens.
+
+	_ownerUsageWindow = new OwnerUsageWindow( this );
+    }
+
+    _ownerUsageWindow->populate( selectedDirOrRoot() );
+    _ownerUsageWindow->show();
+}
+
+
 void MainWindow::showFilesystems()
 {
     if ( ! _filesystemsWindow )
@@ -1278,6 +2088,21 @@ void MainWindow::showFilesystems()
 }
 
 
+void MainWindow::showScanStats()
+{
+    if ( ! _scanStatsWindow )
+    {
+	// This deletes itself when the user closes it. The associated QPointer
+	// keeps track of that and sets the pointer to 0 when it happens.
+
+	_scanStatsWindow = new ScanStatsWindow( _dirTreeModel, this );
+    }
+
+    _scanStatsWindow->populate();
+    _scanStatsWindow->show();
+}
+
+
 void MainWindow::discoverLargestFiles()
 {
     discoverFiles( new QDirStat::LargestFilesTreeWalker(),
@@ -1320,12 +2145,130 @@ void MainWindow::discoverBrokenSymLinks()
 
 void MainWindow::discoverSparseFiles()
 {
-    discoverFiles( new QDirStat::SparseFilesTreeWalker(),
+    discoverFiles( new QDirStat::SparseFilesTreeWalker( _verifySparseFiles ),
                    tr( "Sparse Files in %1" ) );
     _locateFilesWindow->sortByColumn( LocateListSizeCol, Qt::DescendingOrder );
 }
 
 
+void MainWindow::discoverFastestGrowingDirs()
+{
+    if ( ! _dirTreeModel->tree()->sizeHistory() )
+	return;
+
+    discoverFiles( new QDirStat::FastestGrowingDirsTreeWalker(),
+                   tr( "Fastest Growing Directories in %1" ) );
+}
+
+
+void MainWindow::discoverDuplicateFiles()
+{
+    if ( ! _duplicateFilesWindow )
+    {
+	// This deletes itself when the user closes it. The associated QPointer
+	// keeps track of that and sets the pointer to 0 when it happens.
+
+	_duplicateFilesWindow = new DuplicateFilesWindow( _selectionModel, this );
+    }
+
+    _duplicateFilesWindow->populate( selectedDirOrRoot() );
+    _duplicateFilesWindow->show();
+}
+
+
+void MainWindow::discoverAllFiles()
+{
+    if ( ! _allFilesWindow )
+    {
+	// This deletes itself when the user closes it. The associated QPointer
+	// keeps track of that and sets the pointer to 0 when it happens.
+
+	_allFilesWindow = new AllFilesWindow( _selectionModel, this );
+    }
+
+    _allFilesWindow->show();
+    _allFilesWindow->populate( selectedDirOrRoot() );
+}
+
+
+void MainWindow::findFiles()
+{
+    bool canceled;
+    PkgFilter filter = FindFilesDialog::askFilter( canceled, this );
+
+    if ( canceled )
+        return;
+
+    // Without a current index, this walks the tree; the next search can
+    // use the index again.
+
+    if ( ! _nameIndex.isCurrent() )
+        buildNameIndex();
+
+    discoverFiles( new QDirStat::NameSearchTreeWalker( filter, _nameIndex ),
+                   tr( "Files Matching \"%1\" in %2" ).arg( filter.pattern() ) );
+    _locateFilesWindow->sortByColumn( LocateListPathCol, Qt::AscendingOrder );
+}
+
+
+void MainWindow::buildNameIndex()
+{
+    DirTree * tree = _dirTreeModel->tree();
+
+    if ( _nameIndexBuilder || tree->isBusy() || ! tree->root() )
+        return;
+
+    _nameIndexBuilder = new NameIndexBuilder( TreeSnapshot( tree->root() ),
+                                              this, "nameIndexFinished" );
+    CHECK_NEW( _nameIndexBuilder );
+
+    _nameIndexBuilder->setAutoDelete( false );
+    _threadPool.start( _nameIndexBuilder );
+}
+
+
+void MainWindow::nameIndexFinished()
+{
+    if ( ! _nameIndexBuilder || ! _nameIndexBuilder->isFinished() )
+        return;
+
+    // If the tree changed meanwhile, this index is never used; the next
+    // findFiles() starts a new one.
+
+    _nameIndex = _nameIndexBuilder->index();
+    delete _nameIndexBuilder;
+    _nameIndexBuilder = 0;
+}
+
+
+void MainWindow::pkgQueryReady()
+{
+    _ui->actionOpenPkg->setEnabled( true );
+    _ui->actionShowUnpkgFiles->setEnabled( true );
+
+    if ( ! PkgQuery::haveGetInstalledPkgSupport() ||
+	 ! PkgQuery::haveFileListSupport()	    )
+    {
+	logInfo() << "No package manager support "
+		  << "for getting installed packages or file lists"
+		  << endl;
+
+	_ui->actionOpenPkg->setEnabled( false );
+    }
+
+    PkgManager * pkgManager = PkgQuery::primaryPkgManager();
+
+    if ( ! pkgManager || ! pkgManager->supportsFileListCache() )
+    {
+	logInfo() << "No package manager support "
+		  << "for getting a file lists cache"
+		  << endl;
+
+	_ui->actionShowUnpkgFiles->setEnabled( false );
+    }
+}
+
+
 void MainWindow::discoverFiles( TreeWalker *    treeWalker,
                                 const QString & headingText )
 {
@@ -1345,9 +2288,12 @@ void MainWindow::discoverFiles( TreeWalker *    treeWalker,
 
     if ( sel )
     {
+        // Show the window first so the first results already show up
+        // while searching big subtrees
+
         _locateFilesWindow->setHeading( headingText.arg( sel->url() ) );
-        _locateFilesWindow->populate( sel );
         _locateFilesWindow->show();
+        _locateFilesWindow->populate( sel );
     }
 }
 
@@ -1623,6 +2569,21 @@ void MainWindow::selectionChanged()
 }
 
 
+void MainWindow::prioritizeReading( const QModelIndex & index )
+{
+    _dirTreeModel->tree()->prioritize( _dirTreeModel->itemFromIndex( index ) );
+}
+
+
+void MainWindow::prioritizeTreemapRoot()
+{
+    TreemapTile * rootTile = _ui->treemapView->rootTile();
+
+    if ( rootTile )
+	_dirTreeModel->tree()->prioritize( rootTile->orig() );
+}
+
+
 void MainWindow::currentItemChanged( FileInfo * newCurrent, FileInfo * oldCurrent )
 {
     showSummary();
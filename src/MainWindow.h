@@ -15,11 +15,21 @@
 #include <QElapsedTimer>
 #include <QTimer>
 #include <QPointer>
+#include <QThreadPool>
 
 #include "ui_main-window.h"
+#include "AllFilesWindow.h"
+#include "DuplicateFilesWindow.h"
+#include "FileAgeStatsWindow.h"
 #include "FileTypeStatsWindow.h"
 #include "FilesystemsWindow.h"
 #include "LocateFilesWindow.h"
+#include "NameIndex.h"
+#include "OutputWindow.h"
+#include "OwnerUsageWindow.h"
+#include "ParallelDeleter.h"
+#include "ScanStatsWindow.h"
+#include "TrashJob.h"
 #include "TreeWalker.h"
 #include "PanelMessage.h"
 #include "UnreadableDirsWindow.h"
@@ -38,16 +48,23 @@ namespace QDirStat
     class CleanupCollection;
     class ConfigDialog;
     class DirTreeModel;
+    class DirWatcher;
     class FileInfo;
+    class ScheduledUpdate;
     class SelectionModel;
     class UnpkgSettings;
 }
 
 using QDirStat::FileInfo;
+using QDirStat::AllFilesWindow;
+using QDirStat::DuplicateFilesWindow;
+using QDirStat::FileAgeStatsWindow;
+using QDirStat::OwnerUsageWindow;
 using QDirStat::FileTypeStatsWindow;
 using QDirStat::PanelMessage;
 using QDirStat::UnreadableDirsWindow;
 using QDirStat::FilesystemsWindow;
+using QDirStat::ScanStatsWindow;
 using QDirStat::LocateFilesWindow;
 
 
@@ -79,8 +96,29 @@ public slots:
 
     /**
      * Open a directory selection dialog and open the selected URL.
+     *
+     * With 'sampling', the directory is read in sampling mode: Only the
+     * first few levels are read completely, the totals of the subtrees
+     * below are only estimated (see DirTree::setSampling()).
+     **/
+    void askOpenDir( bool sampling = false );
+
+    /**
+     * Open a directory selection dialog and read the selected directory in
+     * sampling mode for a quick estimate.
      **/
-    void askOpenDir();
+    void askEstimateDir();
+
+    /**
+     * Ask for a directory on a remote host and read it there with the
+     * remote agent (see RemoteReadJob).
+     **/
+    void askOpenRemote();
+
+    /**
+     * Read all the estimated subtrees of the tree completely.
+     **/
+    void refineEstimates();
 
     /**
      * Open a package selection dialog and open the selected URL.
@@ -122,29 +160,100 @@ public slots:
      **/
     void refreshSelected();
 
+    /**
+     * Start or stop watching the tree for changes, depending on the state
+     * of _ui->actionWatchChanges.
+     **/
+    void toggleWatchChanges();
+
     /**
      * Stop reading if reading is in process.
      **/
     void stopReading();
 
+    /**
+     * Continue an aborted scan of the current directory from its
+     * checkpoint: Only the directories that were not read completely
+     * and the ones that changed since then are read again.
+     **/
+    void resumeReading();
+
     /**
      * Clear the current tree and replace it with the list of installed
      * packages from the system's package manager that match 'pkgUrl'.
      **/
     void readPkg( const QDirStat::PkgFilter & pkgFilter );
 
+    /**
+     * Clear the current tree and read directory 'url' on a remote host
+     * ("ssh://[user@]host/path") with the remote agent.
+     **/
+    void readRemote( const QString & url );
+
+    /**
+     * Clear the current tree and read an ext2/3/4 filesystem image or
+     * block device ("ext4:/dev/sdb1").
+     **/
+    void readExt4Image( const QString & url );
+
+    /**
+     * Clear the current tree and read an NTFS volume or image
+     * ("ntfs:/dev/sda2").
+     **/
+    void readNtfsVolume( const QString & url );
+
+    /**
+     * Clear the current tree and import an ncdu export
+     * ("ncdu:/tmp/export.json") or a file list ("filelist:/tmp/list").
+     **/
+    void readImport( const QString & url );
+
     /**
      * Clear the current tree and replace it with the content of the specified
-     * cache file.
+     * cache file with the delta cache files 'deltaFileNames' applied to it.
+     **/
+    void readCache( const QString &	cacheFileName,
+		    const QStringList & deltaFileNames = QStringList() );
+
+    /**
+     * Clear the current tree and replace it with the content of several
+     * cache files, each one below a directory of its own (see
+     * DirTree::readCaches()).
      **/
-    void readCache( const QString & cacheFileName );
+    void readCaches( const QStringList & cacheFileNames );
 
     /**
-     * Open a file selection dialog to ask for a cache file, clear the
-     * current tree and replace it with the content of the cache file.
+     * Open a file selection dialog to ask for one or more cache files,
+     * clear the current tree and replace it with the content of the cache
+     * files.
      **/
     void askReadCache();
 
+    /**
+     * Open a file selection dialog to ask for a cache file and compare the
+     * current tree with it.
+     **/
+    void askCompareWithCache();
+
+    /**
+     * Compare the current tree with the state in a cache file with the
+     * delta cache files 'deltaFileNames' applied to it and show the size
+     * differences in the tree view and the treemap.
+     **/
+    void compareWithCache( const QString &     cacheFileName,
+			   const QStringList & deltaFileNames = QStringList() );
+
+    /**
+     * Stop showing the differences to a cache file.
+     **/
+    void stopComparing();
+
+    /**
+     * Open a file selection dialog to ask for a size history file (see
+     * SizeHistory) and show the trends of the directories from it.
+     **/
+    void askLoadSizeHistory();
+
     /**
      * Open a file selection dialog and save the current tree to the selected
      * file.
@@ -158,7 +267,9 @@ public slots:
     void updateWindowTitle( const QString & url );
 
     /**
-     * Expand the directory tree's branches to depth 'level'.
+     * Expand the directory tree's branches to depth 'level'. This goes on
+     * in the background, the largest branches first, up to a maximum
+     * number of rows (see DirTreeView::expandToLevel()).
      **/
     void expandTreeToLevel( int level );
 
@@ -193,6 +304,18 @@ public slots:
      **/
     void moveToTrash();
 
+    /**
+     * Delete the selected items permanently with a ParallelDeleter after
+     * asking for confirmation.
+     **/
+    void deletePermanently();
+
+    /**
+     * Delete everything in all trash directories with a ParallelDeleter in
+     * the background after asking for confirmation.
+     **/
+    void emptyTrash();
+
     /**
      * Navigate one directory level up.
      **/
@@ -217,6 +340,25 @@ public slots:
     void discoverHardLinkedFiles();
     void discoverBrokenSymLinks();
     void discoverSparseFiles();
+    void discoverFastestGrowingDirs();
+
+    /**
+     * Ask the user for a name pattern and list the matching files in the
+     * LocateFilesWindow.
+     **/
+    void findFiles();
+
+    /**
+     * Open a non-modal DuplicateFilesWindow that lists the files with the
+     * same contents in the current directory.
+     **/
+    void discoverDuplicateFiles();
+
+    /**
+     * Open a non-modal AllFilesWindow that lists all files of the current
+     * directory in one sortable list.
+     **/
+    void discoverAllFiles();
 
     /**
      * Show online help.
@@ -277,6 +419,60 @@ protected slots:
      **/
     void readingAborted();
 
+    /**
+     * Take over the NameIndex that was built in the background.
+     **/
+    void nameIndexFinished();
+
+    /**
+     * Write the tree that is being read to its checkpoint file, so the
+     * scan can be resumed after it was aborted or the program crashed.
+     **/
+    void writeCheckpoint();
+
+    /**
+     * Enable the package actions that the available package managers
+     * support. This is called when the package managers were checked in
+     * the background.
+     **/
+    void pkgQueryReady();
+
+    /**
+     * Show the progress of the ParallelDeleter in the status bar.
+     **/
+    void deleteProgress( int done, int total );
+
+    /**
+     * Refresh what the ParallelDeleter could not delete and clean up.
+     **/
+    void deleteFinished();
+
+    /**
+     * Notification that the TrashJob moved 'path' to the trash.
+     **/
+    void trashed( const QString & path );
+
+    /**
+     * Show the progress of the TrashJob in the status bar.
+     **/
+    void trashProgress( int done, int total, qint64 bytesCopied );
+
+    /**
+     * Refresh what the TrashJob could not move completely and clean up.
+     **/
+    void trashFinished();
+
+    /**
+     * Show the progress of emptying the trash in the status bar.
+     **/
+    void emptyTrashProgress( int done, int total );
+
+    /**
+     * Refresh what is left of the trash directories in the tree and clean
+     * up.
+     **/
+    void emptyTrashFinished();
+
     /**
      * Change display mode to "busy" (while reading a directory tree):
      * Sort tree view by read jobs, hide treemap view.
@@ -335,11 +531,27 @@ protected slots:
      **/
     void showFileSizeStats();
 
+    /**
+     * Show file age statistics for the currently selected directory.
+     **/
+    void showFileAgeStats();
+
+    /**
+     * Show the disk usage by owner for the currently selected directory.
+     **/
+    void showOwnerUsage();
+
     /**
      * Show detailed information about mounted filesystems in a separate window.
      **/
     void showFilesystems();
 
+    /**
+     * Show the performance counters of reading the tree in a separate
+     * window.
+     **/
+    void showScanStats();
+
     /**
      * Change the main window layout. If no name is passed, the function tries
      * to check if the sender is a QAction and use its data().
@@ -347,7 +559,8 @@ protected slots:
     void changeLayout( const QString & name = QString() );
 
     /**
-     * Show the elapsed time while reading.
+     * Show the elapsed time while reading and request the next update of
+     * it.
      **/
     void showElapsedTime();
 
@@ -384,6 +597,17 @@ protected slots:
      **/
     void notImplemented();
 
+    /**
+     * Read the pending directories below the item with model index 'index'
+     * first, e.g. because the user just expanded that tree branch.
+     **/
+    void prioritizeReading( const QModelIndex & index );
+
+    /**
+     * Read the pending directories below the treemap root first.
+     **/
+    void prioritizeTreemapRoot();
+
 #if 1
     //
     // Debugging slots
@@ -423,6 +647,30 @@ protected:
      **/
     void mapTreeExpandAction( QAction * action, int level );
 
+    /**
+     * Start building a NameIndex of the tree for findFiles() in the
+     * background unless that is already in progress.
+     **/
+    void buildNameIndex();
+
+    /**
+     * Return the name of the checkpoint file for directory 'url' or an
+     * empty string if there is none for that kind of URL.
+     **/
+    static QString checkpointFileName( const QString & url );
+
+    /**
+     * Return 'true' if there is a checkpoint of an unfinished scan of
+     * directory 'url'.
+     **/
+    static bool haveCheckpoint( const QString & url );
+
+    /**
+     * Use the checkpoint of directory 'url' as the baseline for reading
+     * it. Return 'true' on success.
+     **/
+    bool useCheckpoint( const QString & url );
+
     /**
      * Common part of all "discover" actions: Create or reuse a
      * LocateFilesWindow with the specified TreeWalker.
@@ -482,11 +730,22 @@ private:
     QDirStat::CleanupCollection *  _cleanupCollection;
     QDirStat::ConfigDialog	*  _configDialog;
     QActionGroup		*  _layoutActionGroup;
+    QPointer<AllFilesWindow>	   _allFilesWindow;
+    QPointer<DuplicateFilesWindow> _duplicateFilesWindow;
     QPointer<FileTypeStatsWindow>  _fileTypeStatsWindow;
+    QPointer<FileAgeStatsWindow>   _fileAgeStatsWindow;
+    QPointer<OwnerUsageWindow>	   _ownerUsageWindow;
     QPointer<FilesystemsWindow>    _filesystemsWindow;
+    QPointer<ScanStatsWindow>	   _scanStatsWindow;
     QPointer<LocateFilesWindow>    _locateFilesWindow;
     QPointer<PanelMessage>	   _dirPermissionsWarning;
     QPointer<UnreadableDirsWindow> _unreadableDirsWindow;
+    QPointer<QDirStat::ParallelDeleter> _parallelDeleter;
+    QPointer<OutputWindow>	   _deleteOutputWindow;
+    QPointer<QDirStat::TrashJob>   _trashJob;
+    QPointer<OutputWindow>	   _trashOutputWindow;
+    QPointer<QDirStat::ParallelDeleter> _trashEmptier;
+    QPointer<OutputWindow>	   _emptyTrashOutputWindow;
     QString			   _dUrl;
     QElapsedTimer		   _stopWatch;
     bool			   _modified;
@@ -494,14 +753,20 @@ private:
     bool			   _verboseSelection;
     bool			   _urlInWindowTitle;
     bool			   _useTreemapHover;
+    bool			   _verifySparseFiles;
     QString			   _layoutName;
     int				   _statusBarTimeout; // millisec
     QSignalMapper	       *   _treeLevelMapper;
     QMap<QString, TreeLayout *>	   _layouts;
     TreeLayout *		   _currentLayout;
-    QTimer			   _updateTimer;
+    QDirStat::ScheduledUpdate *	   _elapsedTimeUpdate;
     QTimer                         _treeExpandTimer;
+    QTimer			   _checkpointTimer;
     QDirStat::Subtree              _futureSelection;
+    QThreadPool			   _threadPool;
+    QDirStat::NameIndexBuilder *   _nameIndexBuilder;
+    QDirStat::DirWatcher *	   _dirWatcher;
+    QDirStat::NameIndex		   _nameIndex;
 
 }; // class MainWindow
 
@@ -0,0 +1,238 @@
+/*
+ *   File name: MemoryStats.cpp
+ *   Summary:	Memory usage accounting for directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QObject>
+
+#include "MemoryStats.h"
+#include "FileInfo.h"
+#include "DirInfo.h"
+#include "DotEntry.h"
+#include "Attic.h"
+#include "PkgInfo.h"
+#include "FileInfoIterator.h"
+#include "NodePool.h"
+#include "Logger.h"
+
+
+// Header of the heap data of QString, QVector, QList and QHash:
+// Reference count, size, capacity and offset (Qt 5)
+#define QT_ARRAY_HEADER_BYTES	24
+
+// glibc malloc(): One size_t of overhead, 16 byte alignment
+#define MALLOC_OVERHEAD_BYTES	8
+#define MALLOC_ALIGNMENT	16
+
+
+using namespace QDirStat;
+
+
+MemoryStats::MemoryStats()
+{
+    clear();
+}
+
+
+void MemoryStats::clear()
+{
+    for ( int i = 0; i < MemCategoryCount; ++i )
+    {
+	_bytes[ i ] = 0;
+	_count[ i ] = 0;
+    }
+
+    _nodePoolBytes     = 0;
+    _allSortCacheBytes = 0;
+    _sortCacheLimit    = 0;
+}
+
+
+void MemoryStats::addTree( FileInfo * subtree )
+{
+    if ( ! subtree )
+	return;
+
+    if ( subtree->isPkgInfo() )
+    {
+	PkgInfo * pkg = static_cast<PkgInfo *>( subtree );
+
+	add( MemPkgInfo, nodeBytes( sizeof( PkgInfo ) ) );
+	add( MemNames, stringBytes( pkg->baseName() ) +
+		       stringBytes( pkg->version()  ) +
+		       stringBytes( pkg->arch()	    ), 0 );
+    }
+    else if ( subtree->isDotEntry() )
+	add( MemDotEntry, nodeBytes( sizeof( DotEntry ) ) );
+    else if ( subtree->isAttic() )
+	add( MemAttic,	  nodeBytes( sizeof( Attic ) ) );
+    else if ( subtree->isDirInfo() )
+	add( MemDirInfo,  nodeBytes( sizeof( DirInfo ) ) );
+    else
+	add( MemFileInfo, nodeBytes( sizeof( FileInfo ) ) );
+
+    add( MemNames, stringBytes( subtree->name() ) );
+
+    DirInfo * dir = subtree->toDirInfo();
+
+    if ( ! dir )
+	return;
+
+    dir->addMemoryUsage( *this );
+
+    FileInfoIterator it( dir ); // This includes the dot entry
+
+    while ( *it )
+    {
+	addTree( *it );
+	++it;
+    }
+
+    addTree( dir->attic() );
+}
+
+
+qint64 MemoryStats::totalBytes() const
+{
+    qint64 total = 0;
+
+    for ( int i = 0; i < MemCategoryCount; ++i )
+	total += _bytes[ i ];
+
+    return total;
+}
+
+
+void MemoryStats::sampleNodePool()
+{
+    _nodePoolBytes = NodePool::chunkBytes();
+}
+
+
+void MemoryStats::sampleSortCaches()
+{
+    _allSortCacheBytes = DirInfo::sortCacheBytes();
+    _sortCacheLimit    = DirInfo::sortCacheLimit();
+}
+
+
+QString MemoryStats::categoryName( MemoryCategory category )
+{
+    switch ( category )
+    {
+	case MemFileInfo:	return QObject::tr( "File nodes"	    );
+	case MemDirInfo:	return QObject::tr( "Directory nodes"	    );
+	case MemDotEntry:	return QObject::tr( "Dot entries"	    );
+	case MemAttic:		return QObject::tr( "Attics"		    );
+	case MemPkgInfo:	return QObject::tr( "Package nodes"	    );
+	case MemNames:		return QObject::tr( "Names"		    );
+	case MemChildren:	return QObject::tr( "Children vectors"	    );
+	case MemSortCaches:	return QObject::tr( "Sort caches"	    );
+	case MemChildIndex:	return QObject::tr( "Child name indexes"   );
+	case MemHistograms:	return QObject::tr( "Histograms"	    );
+	case MemOwnerUsage:	return QObject::tr( "Owner usage tables"   );
+	case MemModel:		return QObject::tr( "Model structures"	    );
+	case MemCategoryCount:	break;
+    }
+
+    return "?";
+}
+
+
+qint64 MemoryStats::heapBytes( qint64 size )
+{
+    if ( size <= 0 )
+	return 0;
+
+    size += MALLOC_OVERHEAD_BYTES;
+
+    return ( ( size + MALLOC_ALIGNMENT - 1 ) / MALLOC_ALIGNMENT ) * MALLOC_ALIGNMENT;
+}
+
+
+qint64 MemoryStats::nodeBytes( size_t size )
+{
+    if ( size > NodePool::maxNodeSize() )
+	return heapBytes( size );
+
+    return NodePool::nodeBytes( size );
+}
+
+
+qint64 MemoryStats::stringBytes( const QString & str )
+{
+    // Empty strings all share one static object
+
+    if ( str.capacity() == 0 )
+	return 0;
+
+    return heapBytes( QT_ARRAY_HEADER_BYTES + ( str.capacity() + 1 ) * sizeof( QChar ) );
+}
+
+
+qint64 MemoryStats::arrayBytes( int capacity, size_t elementSize )
+{
+    if ( capacity <= 0 )
+	return 0;
+
+    return heapBytes( QT_ARRAY_HEADER_BYTES + capacity * (qint64) elementSize );
+}
+
+
+qint64 MemoryStats::hashBytes( int    size,
+			       int    buckets,
+			       size_t keySize,
+			       size_t valueSize )
+{
+    if ( buckets <= 0 )
+	return 0;
+
+    // Each entry is a separate node with the 'next' pointer, the hash
+    // value, the key and the value
+
+    qint64 nodeSize = sizeof( void * ) + sizeof( uint ) + keySize + valueSize;
+    nodeSize = ( ( nodeSize + sizeof( void * ) - 1 ) / sizeof( void * ) ) * sizeof( void * );
+
+    return heapBytes( QT_ARRAY_HEADER_BYTES + buckets * (qint64) sizeof( void * ) ) +
+	size * heapBytes( nodeSize );
+}
+
+
+QStringList MemoryStats::summary() const
+{
+    QStringList lines;
+
+    for ( int i = 0; i < MemCategoryCount; ++i )
+    {
+	MemoryCategory category = static_cast<MemoryCategory>( i );
+
+	if ( _bytes[ i ] == 0 )
+	    continue;
+
+	lines << QString( "%1: %2 in %3 objects" )
+	    .arg( categoryName( category ) )
+	    .arg( formatSize( _bytes[ i ] ) )
+	    .arg( _count[ i ] );
+    }
+
+    lines << QString( "Total: %1; node pool chunks: %2" )
+	.arg( formatSize( totalBytes() ) )
+	.arg( formatSize( _nodePoolBytes ) );
+
+    lines << QString( "Sort caches of all trees: %1; limit: %2" )
+	.arg( formatSize( _allSortCacheBytes ) )
+	.arg( _sortCacheLimit > 0 ? formatSize( _sortCacheLimit ) : QString( "none" ) );
+
+    return lines;
+}
+
+
+void MemoryStats::logSummary() const
+{
+    foreach ( const QString & line, summary() )
+	logInfo() << "Memory: " << line << endl;
+}
@@ -0,0 +1,193 @@
+/*
+ *   File name: MemoryStats.h
+ *   Summary:	Memory usage accounting for directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef MemoryStats_h
+#define MemoryStats_h
+
+
+#include <stddef.h>	// size_t
+
+#include <QString>
+#include <QStringList>
+
+
+namespace QDirStat
+{
+    class FileInfo;
+
+    /**
+     * The kinds of memory that MemoryStats counts
+     **/
+    enum MemoryCategory
+    {
+	MemFileInfo = 0,	// Plain FileInfo nodes (files, symlinks, ...)
+	MemDirInfo,		// DirInfo nodes
+	MemDotEntry,		// DotEntry nodes
+	MemAttic,		// Attic nodes
+	MemPkgInfo,		// PkgInfo nodes
+	MemNames,		// The name strings of all nodes
+	MemChildren,		// The children vectors of the directories
+	MemSortCaches,		// The sorted children lists of the directories
+	MemChildIndex,		// The name indexes of large directories
+	MemHistograms,		// The size and mtime histograms of the directories
+	MemOwnerUsage,		// The usage by owner tables of the directories
+	MemModel,		// The data structures of the DirTreeModel
+	MemCategoryCount	// Number of categories; must be the last one
+    };
+
+
+    /**
+     * Memory usage of a directory tree by kind of object: How many bytes
+     * the nodes, their names, the children vectors, the sort caches etc.
+     * take.
+     *
+     * The numbers are estimates from the sizes and capacities of the
+     * objects and of Qt's containers, including the rounding of the
+     * NodePool and of malloc(). String data that is shared between nodes
+     * is counted for each of them. The chunks that the NodePool currently
+     * holds are reported separately: They also include free nodes.
+     *
+     * Calculating this means walking the whole tree, so do that only on
+     * demand and after reading, not while reading.
+     **/
+    class MemoryStats
+    {
+    public:
+
+	/**
+	 * Constructor: Create empty statistics.
+	 **/
+	MemoryStats();
+
+	/**
+	 * Reset all counters.
+	 **/
+	void clear();
+
+	/**
+	 * Add 'count' objects with 'bytes' bytes in total to 'category'.
+	 **/
+	void add( MemoryCategory category, qint64 bytes, qint64 count = 1 )
+	{
+	    _bytes[ category ] += bytes;
+	    _count[ category ] += count;
+	}
+
+	/**
+	 * Add 'subtree' with all its children, dot entries and attics
+	 * recursively.
+	 **/
+	void addTree( FileInfo * subtree );
+
+	/**
+	 * Return the bytes of 'category'.
+	 **/
+	qint64 bytes( MemoryCategory category ) const { return _bytes[ category ]; }
+
+	/**
+	 * Return the number of objects of 'category'.
+	 **/
+	qint64 count( MemoryCategory category ) const { return _count[ category ]; }
+
+	/**
+	 * Return the bytes of all categories.
+	 **/
+	qint64 totalBytes() const;
+
+	/**
+	 * Return the bytes of the NodePool chunks when the statistics were
+	 * calculated.
+	 **/
+	qint64 nodePoolBytes() const { return _nodePoolBytes; }
+
+	/**
+	 * Record the current size of the NodePool.
+	 **/
+	void sampleNodePool();
+
+	/**
+	 * Return the bytes of the sort caches of all trees (see
+	 * DirInfo::sortCacheBytes()) when the statistics were calculated.
+	 * MemSortCaches only has those of the tree that was added.
+	 **/
+	qint64 allSortCacheBytes() const { return _allSortCacheBytes; }
+
+	/**
+	 * Return the limit for the sort caches of all trees when the
+	 * statistics were calculated.
+	 **/
+	qint64 sortCacheLimit() const { return _sortCacheLimit; }
+
+	/**
+	 * Record the current size and limit of the sort caches of all
+	 * trees.
+	 **/
+	void sampleSortCaches();
+
+	/**
+	 * Return a human-readable name for 'category'.
+	 **/
+	static QString categoryName( MemoryCategory category );
+
+	/**
+	 * Return the bytes of a block of 'size' bytes on the heap, including
+	 * the overhead of malloc().
+	 **/
+	static qint64 heapBytes( qint64 size );
+
+	/**
+	 * Return the bytes of a node of 'size' bytes in the NodePool.
+	 **/
+	static qint64 nodeBytes( size_t size );
+
+	/**
+	 * Return the heap bytes of the data of 'str' (not of the QString
+	 * object itself, which is part of its owner).
+	 **/
+	static qint64 stringBytes( const QString & str );
+
+	/**
+	 * Return the heap bytes of the data of a QVector or QList with
+	 * 'capacity' elements of 'elementSize' bytes each.
+	 **/
+	static qint64 arrayBytes( int capacity, size_t elementSize );
+
+	/**
+	 * Return the heap bytes of the data of a QHash with 'buckets' buckets
+	 * and 'size' entries of 'keySize' + 'valueSize' bytes each.
+	 **/
+	static qint64 hashBytes( int    size,
+				 int    buckets,
+				 size_t keySize,
+				 size_t valueSize );
+
+	/**
+	 * Return a summary, one line for each category.
+	 **/
+	QStringList summary() const;
+
+	/**
+	 * Write the summary to the log.
+	 **/
+	void logSummary() const;
+
+
+    protected:
+
+	qint64 _bytes[ MemCategoryCount ];
+	qint64 _count[ MemCategoryCount ];
+	qint64 _nodePoolBytes;
+	qint64 _allSortCacheBytes;
+	qint64 _sortCacheLimit;
+    };
+
+}	// namespace QDirStat
+
+
+#endif	// MemoryStats_h
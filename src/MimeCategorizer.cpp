@@ -34,7 +34,8 @@ MimeCategorizer * MimeCategorizer::instance()
 
 MimeCategorizer::MimeCategorizer():
     QObject( 0 ),
-    _mapsDirty( true )
+    _mapsDirty( true ),
+    _generation( 0 )
 {
     // logDebug() << "Creating MimeCategorizer" << endl;
     readSettings();
@@ -63,77 +64,55 @@ MimeCategory * MimeCategorizer::category( FileInfo * item )
 
     if ( item->isDir() || item->isDirInfo() )
 	return 0;
-    else
-	return category( item->name() );
-}
-
-
-MimeCategory * MimeCategorizer::category( const QString & filename,
-					  QString	* suffix_ret )
-{
-    if ( suffix_ret )
-	*suffix_ret = "";
-
-    if ( filename.isEmpty() )
-	return 0;
-
-    // Build suffix maps for fast lookup
 
     if ( _mapsDirty )
 	buildMaps();
 
-    MimeCategory * category = 0;
+    // The category is only looked up by name once for each item; the
+    // items cache its index in _categories until the categories change.
 
-    // Find the filename suffix: Section #1
-    // (ignoring any leading '.' separator)
-    QString suffix = filename.section( '.', 1 );
+    int cached = item->cachedMimeCategory( _generation );
 
-    while ( ! suffix.isEmpty() )
-    {
-	// Try case sensitive first
+    if ( cached > 0 )
+	return cached > 1 ? _categories.at( cached - 2 ) : 0;
 
-	category = _caseSensitiveSuffixMap.value( suffix, 0 );
+    MimeCategory * matchedCategory = category( item->name() );
+    int index = matchedCategory ? _categories.indexOf( matchedCategory ) : -1;
 
-	if ( ! category )
-	    category = _caseInsensitiveSuffixMap.value( suffix.toLower(), 0 );
+    if ( index < 254 )	// What fits into the cache
+	item->setCachedMimeCategory( index + 2, _generation );
 
-	if ( category && suffix_ret )
-	    *suffix_ret = suffix;
+    return matchedCategory;
+}
 
-	// No match so far? Try the next suffix. Some files might have more
-	// than one, e.g., "tar.bz2" - if there is no match for "tar.bz2",
-	// there might be one for just "bz2".
 
-	suffix = suffix.section( '.', 1 );
-    }
+MimeCategory * MimeCategorizer::category( const QString & filename,
+					  QString	* suffix_ret )
+{
+    // Build suffix maps for fast lookup
 
-    if ( ! category ) // No match yet?
-	category = matchPatterns( filename );
+    if ( _mapsDirty )
+	buildMaps();
 
-#if 0
-    if ( category )
-	logVerbose() << "Found " << category << " for " << filename << endl;
-#endif
+    return _matcher.category( filename, suffix_ret );
+}
 
-    return category;
+
+MimeMatcher MimeCategorizer::matcher()
+{
+    if ( _mapsDirty )
+	buildMaps();
+
+    return _matcher;
 }
 
 
-MimeCategory * MimeCategorizer::matchPatterns( const QString & filename ) const
+quint16 MimeCategorizer::generation()
 {
-    foreach ( MimeCategory * category, _categories )
-    {
-	if ( category )
-	{
-	    foreach ( const QRegExp & pattern, category->patternList() )
-	    {
-		if ( pattern.exactMatch( filename ) )
-		    return category;
-	    }
-	}
-    }
+    if ( _mapsDirty )
+	buildMaps();
 
-    return 0; // No match
+    return _generation;
 }
 
 
@@ -158,38 +137,20 @@ void MimeCategorizer::remove( MimeCategory * category )
 
 void MimeCategorizer::buildMaps()
 {
-    _caseInsensitiveSuffixMap.clear();
-    _caseSensitiveSuffixMap.clear();
+    _matcher = MimeMatcher();
 
     foreach ( MimeCategory * category, _categories )
     {
 	CHECK_PTR( category );
-
-	addSuffixes( _caseInsensitiveSuffixMap, category, category->caseInsensitiveSuffixList() );
-	addSuffixes( _caseSensitiveSuffixMap,	category, category->caseSensitiveSuffixList()	);
+	_matcher.add( category );
     }
 
     _mapsDirty = false;
-}
 
+    // Invalidate the categories that are cached in the items
 
-void MimeCategorizer::addSuffixes( QMap<QString, MimeCategory *> & suffixMap,
-				   MimeCategory			 * category,
-				   const QStringList		 & suffixList  )
-{
-    foreach ( const QString & suffix, suffixList )
-    {
-	if ( suffixMap.contains( suffix ) )
-	{
-	    logError() << "Duplicate suffix: " << suffix << " for "
-		       << suffixMap.value( suffix ) << " and " << category
-		       << endl;
-	}
-	else
-	{
-	    suffixMap[ suffix ] = category;
-	}
-    }
+    if ( ++_generation == 0 )
+	++_generation;
 }
 
 
@@ -231,6 +192,11 @@ void MimeCategorizer::writeSettings()
     // logDebug() << endl;
     MimeCategorySettings settings;
 
+    // This is where the config page applies changes of the suffixes or
+    // patterns of existing categories
+
+    _mapsDirty = true;
+
     // Remove all leftover cleanup descriptions
     settings.removeGroups( settings.groupPrefix() );
 
@@ -480,3 +446,237 @@ void MimeCategorizer::addDefaultCategories()
     libs->addSuffix ( "dll" );
     libs->addSuffix ( "so" );
 }
+
+
+
+SuffixTrie::SuffixTrie()
+{
+    _nodeCategories << 0;	// The root
+}
+
+
+MimeCategory * SuffixTrie::add( const QString & suffix, MimeCategory * category )
+{
+    int node = 0;
+
+    for ( int i = suffix.size() - 1; i >= 0; --i )
+    {
+	quint64 key = edgeKey( node, suffix.at( i ) );
+	int child = _edges.value( key, -1 );
+
+	if ( child < 0 )
+	{
+	    child = _nodeCategories.size();
+	    _nodeCategories << 0;
+	    _edges.insert( key, child );
+	}
+
+	node = child;
+    }
+
+    if ( node == 0 )	// Empty suffix
+	return 0;
+
+    MimeCategory * existing = _nodeCategories.at( node );
+
+    if ( ! existing )
+	_nodeCategories[ node ] = category;
+
+    return existing;
+}
+
+
+int SuffixTrie::match( const QString & filename,
+		       bool	       toLower,
+		       MimeCategory ** category_ret ) const
+{
+    int node  = 0;
+    int found = -1;
+
+    // The first character can't start a suffix: There is no '.' before it
+
+    for ( int i = filename.size() - 1; i > 0 && ! _edges.isEmpty(); --i )
+    {
+	QChar ch = filename.at( i );
+	node = _edges.value( edgeKey( node, toLower ? ch.toLower() : ch ), -1 );
+
+	if ( node < 0 )
+	    break;
+
+	if ( _nodeCategories.at( node ) && filename.at( i-1 ) == '.' )
+	{
+	    found = i;
+	    *category_ret = _nodeCategories.at( node );
+	}
+    }
+
+    return found;
+}
+
+
+PatternFilter::PatternFilter( const QRegExp & pattern ):
+    caseSensitivity( pattern.caseSensitivity() )
+{
+    // Anything that might have a special meaning in a wildcard pattern
+    // ends the literal parts
+
+    static const QString special( "*?[]\\" );
+
+    QString text  = pattern.pattern();
+    int	    first = -1;
+    int	    last  = -1;
+
+    for ( int i=0; i < text.size(); ++i )
+    {
+	if ( special.contains( text.at( i ) ) )
+	{
+	    if ( first < 0 )
+		first = i;
+
+	    last = i;
+	}
+    }
+
+    isLiteral = first < 0;
+
+    if ( isLiteral )
+    {
+	prefix = text;
+    }
+    else
+    {
+	prefix = text.left( first );
+	suffix = text.mid( last + 1 );
+    }
+}
+
+
+bool PatternFilter::mightMatch( const QString & filename ) const
+{
+    if ( isLiteral )
+	return filename.compare( prefix, caseSensitivity ) == 0;
+
+    return filename.size() >= prefix.size() + suffix.size() &&
+	filename.startsWith( prefix, caseSensitivity ) &&
+	filename.endsWith  ( suffix, caseSensitivity );
+}
+
+
+MimeMatcher::MimeMatcher( const MimeMatcher & other ):
+    _caseInsensitiveSuffixes( other._caseInsensitiveSuffixes ),
+    _caseSensitiveSuffixes( other._caseSensitiveSuffixes ),
+    _patternFilters( other._patternFilters ),
+    _patternCategories( other._patternCategories )
+{
+    copyPatterns( other );
+}
+
+
+MimeMatcher & MimeMatcher::operator=( const MimeMatcher & other )
+{
+    if ( &other != this )
+    {
+	_caseInsensitiveSuffixes = other._caseInsensitiveSuffixes;
+	_caseSensitiveSuffixes	 = other._caseSensitiveSuffixes;
+	_patternFilters		 = other._patternFilters;
+	_patternCategories	 = other._patternCategories;
+	copyPatterns( other );
+    }
+
+    return *this;
+}
+
+
+void MimeMatcher::copyPatterns( const MimeMatcher & other )
+{
+    // Copying the list would only share it; appending makes a new QRegExp
+    // for each pattern.
+
+    _patterns.clear();
+
+    foreach ( const QRegExp & pattern, other._patterns )
+	_patterns << pattern;
+}
+
+
+void MimeMatcher::add( MimeCategory * category )
+{
+    for ( int i=0; i < 2; ++i )
+    {
+	bool caseSensitive = i == 0;
+	SuffixTrie & suffixes = caseSensitive ? _caseSensitiveSuffixes : _caseInsensitiveSuffixes;
+
+	foreach ( const QString & suffix, caseSensitive ?
+		  category->caseSensitiveSuffixList() : category->caseInsensitiveSuffixList() )
+	{
+	    MimeCategory * existing = suffixes.add( suffix, category );
+
+	    if ( existing )
+	    {
+		logError() << "Duplicate suffix: " << suffix << " for "
+			   << existing << " and " << category
+			   << endl;
+	    }
+	}
+    }
+
+    foreach ( const QRegExp & pattern, category->patternList() )
+    {
+	_patterns	    << pattern;
+	_patternFilters	    << PatternFilter( pattern );
+	_patternCategories << category;
+    }
+}
+
+
+MimeCategory * MimeMatcher::category( const QString & filename,
+				      QString	    * suffix_ret ) const
+{
+    if ( suffix_ret )
+	*suffix_ret = "";
+
+    if ( filename.isEmpty() )
+	return 0;
+
+    // Find the longest suffix (i.e. the one that starts after the first
+    // '.') that is known, e.g. "tar.bz2" rather than just "bz2". If a
+    // suffix is known both case sensitive and case insensitive, the case
+    // sensitive one wins.
+
+    MimeCategory * category	       = 0;
+    MimeCategory * insensitiveCategory = 0;
+
+    int pos		= _caseSensitiveSuffixes.match( filename, false, &category );
+    int insensitivePos	= _caseInsensitiveSuffixes.match( filename, true, &insensitiveCategory );
+
+    if ( insensitivePos >= 0 && ( pos < 0 || insensitivePos < pos ) )
+    {
+	pos	 = insensitivePos;
+	category = insensitiveCategory;
+    }
+
+    if ( category && suffix_ret )
+	*suffix_ret = filename.mid( pos );
+
+    if ( ! category ) // No match yet?
+	category = matchPatterns( filename );
+
+    return category;
+}
+
+
+MimeCategory * MimeMatcher::matchPatterns( const QString & filename ) const
+{
+    for ( int i=0; i < _patterns.size(); ++i )
+    {
+	const PatternFilter & filter = _patternFilters.at( i );
+
+	if ( filter.mightMatch( filename ) &&
+	     ( filter.isLiteral || _patterns.at( i ).exactMatch( filename ) ) )
+	{
+	    return _patternCategories.at( i );
+	}
+    }
+
+    return 0; // No match
+}
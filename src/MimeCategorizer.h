@@ -10,7 +10,8 @@
 #define MimeCategorizer_h
 
 #include <QObject>
-#include <QMap>
+#include <QHash>
+#include <QVector>
 
 #include "MimeCategory.h"
 
@@ -19,6 +20,145 @@ namespace QDirStat
 {
     class FileInfo;
 
+
+    /**
+     * All suffixes of a MimeMatcher with the same case sensitivity, stored
+     * backwards in a trie: Starting from the end of a file name, each
+     * character leads to the next node until the name has no more
+     * characters that fit. The longest suffix on the way that starts right
+     * after a '.' is the one that matches.
+     *
+     * Matching needs no temporary strings and only one hash lookup for
+     * each character of the suffix.
+     **/
+    class SuffixTrie
+    {
+    public:
+
+	/**
+	 * Constructor for an empty trie.
+	 **/
+	SuffixTrie();
+
+	/**
+	 * Add 'suffix' (without the leading '.') for 'category'.
+	 *
+	 * Return the category the suffix already had or 0 if it is new. A
+	 * suffix that is already there keeps the category it had.
+	 **/
+	MimeCategory * add( const QString & suffix, MimeCategory * category );
+
+	/**
+	 * Find the longest suffix of 'filename' in the trie, comparing the
+	 * lowercase characters of the name if 'toLower' is true. Return the
+	 * position of the suffix in the name (after the '.') or -1 if there
+	 * is none. '*category_ret' returns the category of the suffix.
+	 **/
+	int match( const QString & filename,
+		   bool		   toLower,
+		   MimeCategory ** category_ret ) const;
+
+    protected:
+
+	/**
+	 * Return the key of the edge from 'node' with 'ch'.
+	 **/
+	static quint64 edgeKey( int node, QChar ch )
+	    { return ( (quint64) node << 16 ) | ch.unicode(); }
+
+
+	// Data members
+
+	QVector<MimeCategory *> _nodeCategories;	// one for each node; 0 if no suffix ends there
+	QHash<quint64, int>	_edges;			// edgeKey() -> child node
+    };
+
+
+    /**
+     * The literal parts of a wildcard pattern that any matching file name
+     * must have, so most names can be rejected without running the QRegExp
+     * at all. A pattern without any wildcards needs no QRegExp.
+     **/
+    struct PatternFilter
+    {
+	PatternFilter(): isLiteral( false ), caseSensitivity( Qt::CaseSensitive ) {}
+	PatternFilter( const QRegExp & pattern );
+
+	/**
+	 * Return 'false' if 'filename' can't possibly match the pattern.
+	 **/
+	bool mightMatch( const QString & filename ) const;
+
+	QString		    prefix;	// before the first wildcard; whole pattern if literal
+	QString		    suffix;	// after the last wildcard
+	bool		    isLiteral;
+	Qt::CaseSensitivity caseSensitivity;
+    };
+
+
+    /**
+     * A copy of the suffixes and patterns of the categories of a
+     * MimeCategorizer to find the category of file names in a worker
+     * thread: The categorizer itself may only be used on the main thread.
+     *
+     * Get a matcher with MimeCategorizer::matcher() on the main thread and
+     * use one copy of it in each worker thread; copies don't share their
+     * patterns since matching changes a QRegExp. The categories themselves
+     * are not copied, so they must not change while a matcher is in use.
+     **/
+    class MimeMatcher
+    {
+    public:
+
+	/**
+	 * Constructor for an empty matcher that doesn't find anything.
+	 **/
+	MimeMatcher() {}
+
+	/**
+	 * Copy constructor and assignment operator: Copy the patterns.
+	 **/
+	MimeMatcher( const MimeMatcher & other );
+	MimeMatcher & operator=( const MimeMatcher & other );
+
+	/**
+	 * Return the MimeCategory for a filename or 0 if it doesn't fit into
+	 * any of the available categories. See MimeCategorizer::category().
+	 **/
+	MimeCategory * category( const QString & filename, QString * suffix_ret = 0 ) const;
+
+    protected:
+
+	friend class MimeCategorizer;
+
+	/**
+	 * Add the suffixes and patterns of 'category'. Suffixes that
+	 * another category already has are reported and skipped.
+	 **/
+	void add( MimeCategory * category );
+
+	/**
+	 * Try all patterns in the order of the categories until the first
+	 * match. Return the matched category or 0 if none matched.
+	 **/
+	MimeCategory * matchPatterns( const QString & filename ) const;
+
+	/**
+	 * Copy the patterns of 'other', not just the list.
+	 **/
+	void copyPatterns( const MimeMatcher & other );
+
+
+	// Data members
+
+	SuffixTrie			_caseInsensitiveSuffixes;
+	SuffixTrie			_caseSensitiveSuffixes;
+	QRegExpList			_patterns;
+	QVector<PatternFilter>		_patternFilters;	// one for each pattern
+	QList<MimeCategory *>		_patternCategories;	// one for each pattern
+    };
+
+
     /**
      * Class to determine the MimeCategory of filenames.
      *
@@ -73,6 +213,18 @@ namespace QDirStat
 	 **/
 	MimeCategory * category( const QString & filename, QString * suffix_ret = 0 );
 
+	/**
+	 * Return a matcher with the current suffixes and patterns for use in
+	 * a worker thread.
+	 **/
+	MimeMatcher matcher();
+
+	/**
+	 * Return a number that changes each time the categories or their
+	 * suffixes and patterns change.
+	 **/
+	quint16 generation();
+
 	/**
 	 * Add a MimeCategory.
 	 **/
@@ -119,22 +271,6 @@ namespace QDirStat
 	 **/
 	void buildMaps();
 
-	/**
-	 * Add all suffixes in 'suffixList' as key to 'suffixMap' with value
-	 * 'category'.
-	 *
-	 * This provides a really fast map lookup for each suffix.
-	 **/
-	void addSuffixes( QMap<QString, MimeCategory *> & suffixMap,
-			  MimeCategory			* category,
-			  const QStringList		& suffixList  );
-
-	/**
-	 * Iterate over all categories and try all patterns until the first
-	 * match. Return the matched category or 0 if none matched.
-	 **/
-	MimeCategory * matchPatterns( const QString & filename ) const;
-
 	/**
 	 * Add default categories in case none were read from the settings.
 	 **/
@@ -147,11 +283,9 @@ namespace QDirStat
 	static MimeCategorizer *	_instance;
 
 	bool				_mapsDirty;
+	quint16				_generation;	// for the categories cached in the items
 	MimeCategoryList		_categories;
-
-	QMap<QString, MimeCategory *>	_caseInsensitiveSuffixMap;
-	QMap<QString, MimeCategory *>	_caseSensitiveSuffixMap;
-
+	MimeMatcher			_matcher;
     };	// class MimeCategorizer
 
 }	// namespace QDirStat
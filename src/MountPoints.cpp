@@ -7,9 +7,18 @@
  */
 
 
+#include <sys/sysmacros.h>	// makedev()
+#include <fcntl.h>		// open()
+#include <poll.h>
+#include <unistd.h>		// close()
+
+#include <QCoreApplication>
 #include <QFile>
 #include <QRegExp>
+#include <QThread>
+#include <QSet>
 #include <QFileInfo>
+#include <QDir>
 
 #include "MountPoints.h"
 #include "SysUtil.h"
@@ -18,9 +27,96 @@
 
 #define LSBLK_TIMEOUT_SEC       10
 
+#define MOUNT_INFO_FILE		"/proc/self/mountinfo"
+
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * Replace the octal escapes like "\040" for a blank in a path from the
+     * mount table.
+     **/
+    QString unescapePath( const QString & path )
+    {
+	if ( ! path.contains( '\\' ) )
+	    return path;
+
+	QByteArray raw = path.toUtf8();
+	QByteArray result;
+	result.reserve( raw.size() );
+
+	for ( int i = 0; i < raw.size(); ++i )
+	{
+	    if ( raw[ i ] == '\\' && i + 3 < raw.size() &&
+		 raw[ i+1 ] >= '0' && raw[ i+1 ] <= '7' &&
+		 raw[ i+2 ] >= '0' && raw[ i+2 ] <= '7' &&
+		 raw[ i+3 ] >= '0' && raw[ i+3 ] <= '7' )
+	    {
+		result += (char) ( ( raw[ i+1 ] - '0' ) * 64 +
+				   ( raw[ i+2 ] - '0' ) * 8  +
+				   ( raw[ i+3 ] - '0' ) );
+		i += 3;
+	    }
+	    else
+	    {
+		result += raw[ i ];
+	    }
+	}
+
+	return QString::fromUtf8( result );
+    }
+
+
+    /**
+     * Return the paths of overlay option 'name' ("lowerdir", "upperdir")
+     * in 'options'. The paths of one option are separated by colons;
+     * "\:" is a colon in a path. Newer kernels also accept the lower
+     * layers one by one in "lowerdir+" options.
+     **/
+    QStringList overlayOptionPaths( const QStringList & options, const QString & name )
+    {
+	QStringList paths;
+
+	foreach ( const QString & option, options )
+	{
+	    int eq = option.indexOf( '=' );
+
+	    if ( eq < 0 )
+		continue;
+
+	    QString key = option.left( eq );
+
+	    if ( key != name && key != name + "+" )
+		continue;
+
+	    QString value = unescapePath( option.mid( eq + 1 ) );
+	    QString path;
+
+	    for ( int i = 0; i < value.size(); ++i )
+	    {
+		if ( value[ i ] == '\\' && i + 1 < value.size() )
+		    path += value[ ++i ];
+		else if ( value[ i ] == ':' && key == name )
+		{
+		    paths << path;
+		    path.clear();
+		}
+		else
+		    path += value[ i ];
+	    }
+
+	    if ( ! path.isEmpty() )
+		paths << path;
+	}
+
+	return paths;
+    }
+
+}	// namespace
+
+
 MountPoint::MountPoint( const QString & device,
 			const QString & path,
 			const QString & filesystemType,
@@ -28,12 +124,16 @@ MountPoint::MountPoint( const QString & device,
     _device( device ),
     _path( path ),
     _filesystemType( filesystemType ),
+    _deviceId( 0 ),
     _isDuplicate( false )
 {
     _mountOptions = mountOptions.split( "," );
 
 #if HAVE_Q_STORAGE_INFO
-    _storageInfo = QStorageInfo( path );
+    // Not querying the size information yet: This is a statfs() call that
+    // might hang on a network mount, and most mount points are never asked.
+
+    _haveStorageInfo = false;
 #endif
 }
 
@@ -44,6 +144,12 @@ QString MountPoint::mountOptionsStr() const
 }
 
 
+void MountPoint::setSuperOptions( const QString & superOptions )
+{
+    _superOptions = superOptions.split( ",", QString::SkipEmptyParts );
+}
+
+
 bool MountPoint::isReadOnly() const
 {
     return _mountOptions.contains( "ro" );
@@ -56,9 +162,75 @@ bool MountPoint::isBtrfs() const
 }
 
 
+bool MountPoint::isXfs() const
+{
+    return _filesystemType.toLower() == "xfs";
+}
+
+
+bool MountPoint::isZfs() const
+{
+    return _filesystemType.toLower() == "zfs";
+}
+
+
 bool MountPoint::isNtfs() const
 {
-    return _filesystemType.toLower().startsWith( "ntfs" );
+    QString fsType = _filesystemType.toLower();
+
+    // Until lsblk told otherwise, "fuseblk" is most likely ntfs-3g
+
+    return fsType.startsWith( "ntfs" ) || fsType == "fuseblk";
+}
+
+
+bool MountPoint::isOverlay() const
+{
+    QString fsType = _filesystemType.toLower();
+
+    return fsType == "overlay" || fsType == "fuse.fuse-overlayfs";
+}
+
+
+QStringList MountPoint::overlayLowerDirs() const
+{
+    if ( ! isOverlay() )
+	return QStringList();
+
+    QStringList options = _superOptions.isEmpty() ? _mountOptions : _superOptions;
+    QStringList dirs	= overlayOptionPaths( options, "lowerdir" );
+
+    // Docker switches to relative paths when the options get too long;
+    // they are relative to the storage directory, two levels above the
+    // ".../<id>/merged" mount point.
+
+    QDir base( _path + "/../.." );
+
+    for ( int i = 0; i < dirs.size(); ++i )
+    {
+	if ( QDir::isRelativePath( dirs[ i ] ) )
+	    dirs[ i ] = QDir::cleanPath( base.absoluteFilePath( dirs[ i ] ) );
+    }
+
+    return dirs;
+}
+
+
+QString MountPoint::overlayUpperDir() const
+{
+    if ( ! isOverlay() )
+	return QString();
+
+    QStringList options = _superOptions.isEmpty() ? _mountOptions : _superOptions;
+    QStringList dirs	= overlayOptionPaths( options, "upperdir" );
+
+    if ( dirs.isEmpty() )
+	return QString();
+
+    if ( QDir::isRelativePath( dirs.first() ) )
+	return QDir::cleanPath( QDir( _path + "/../.." ).absoluteFilePath( dirs.first() ) );
+
+    return dirs.first();
 }
 
 
@@ -80,9 +252,10 @@ bool MountPoint::isSystemMount() const
     // Samba mounts have "//hostname/some/path".
     //
     // This check filters out system devices like "cgroup", "tmpfs", "sysfs"
-    // and all those other kernel-table devices.
+    // and all those other kernel-table devices. A ZFS pool is mounted with
+    // just its name, e.g. "tank".
 
-    if ( ! _device.contains( "/" ) )	return true;
+    if ( ! _device.contains( "/" ) && ! isZfs() ) return true;
 
     if ( _path.startsWith( "/dev"  ) )	return true;
     if ( _path.startsWith( "/proc" ) )	return true;
@@ -106,33 +279,51 @@ bool MountPoint::hasSizeInfo() const
 }
 
 
+const QStorageInfo & MountPoint::storageInfo() const
+{
+    if ( ! _haveStorageInfo )
+    {
+	_storageInfo	 = QStorageInfo( _path );
+	_haveStorageInfo = true;
+    }
+
+    return _storageInfo;
+}
+
+
+void MountPoint::refreshSizeInfo()
+{
+    _haveStorageInfo = false;
+}
+
+
 FileSize MountPoint::totalSize() const
 {
-    return _storageInfo.bytesTotal();
+    return storageInfo().bytesTotal();
 }
 
 
 FileSize MountPoint::usedSize() const
 {
-    return _storageInfo.bytesTotal() - _storageInfo.bytesFree();
+    return storageInfo().bytesTotal() - storageInfo().bytesFree();
 }
 
 
 FileSize MountPoint::reservedSize() const
 {
-    return _storageInfo.bytesFree() - _storageInfo.bytesAvailable();
+    return storageInfo().bytesFree() - storageInfo().bytesAvailable();
 }
 
 
 FileSize MountPoint::freeSizeForUser() const
 {
-    return _storageInfo.bytesAvailable();
+    return storageInfo().bytesAvailable();
 }
 
 
 FileSize MountPoint::freeSizeForRoot() const
 {
-    return _storageInfo.bytesFree();
+    return storageInfo().bytesFree();
 }
 
 #else  // ! HAVE_Q_STORAGE_INFO
@@ -141,6 +332,7 @@ FileSize MountPoint::freeSizeForRoot() const
 // and statfs() is Linux-specific (not POSIX).
 
 bool	 MountPoint::hasSizeInfo()	const	{ return false; }
+void	 MountPoint::refreshSizeInfo()		{}
 FileSize MountPoint::totalSize()	const	{ return -1; }
 FileSize MountPoint::usedSize()		const	{ return -1; }
 FileSize MountPoint::reservedSize()	const	{ return -1; }
@@ -167,7 +359,8 @@ MountPoints * MountPoints::instance()
 }
 
 
-MountPoints::MountPoints()
+MountPoints::MountPoints():
+    _mountInfoFd( -1 )
 {
     init();
 }
@@ -182,11 +375,23 @@ MountPoints::~MountPoints()
 void MountPoints::init()
 {
     qDeleteAll( _mountPointList );
+    qDeleteAll( _unmounted );
     _mountPointList.clear();
+    _unmounted.clear();
     _mountPointMap.clear();
+    _deviceMap.clear();
+    _lines.clear();
+    _ntfsDevices.clear();
+    _checkedNtfs     = false;
     _isPopulated     = false;
     _hasBtrfs	     = false;
     _checkedForBtrfs = false;
+
+    if ( _mountInfoFd >= 0 )
+    {
+	::close( _mountInfoFd );
+	_mountInfoFd = -1;
+    }
 }
 
 
@@ -243,18 +448,11 @@ MountPoint * MountPoints::findNearestMountPoint( const QString & startPath )
 }
 
 
-bool MountPoints::isDeviceMounted( const QString & device )
+MountPoint * MountPoints::findByDevice( dev_t deviceId )
 {
-    // Do NOT call ensurePopulated() here: This would cause a recursion in the
-    // populating process!
-
-    foreach ( MountPoint * mountPoint, instance()->_mountPointList )
-    {
-	if ( mountPoint->device() == device )
-	    return true;
-    }
+    instance()->ensurePopulated();
 
-    return false;
+    return instance()->_deviceMap.value( deviceId, 0 );
 }
 
 
@@ -272,21 +470,72 @@ bool MountPoints::hasBtrfs()
 }
 
 
+bool MountPoints::hasZfs()
+{
+    instance()->ensurePopulated();
+
+    foreach ( MountPoint * mountPoint, instance()->_mountPointList )
+    {
+	if ( mountPoint->isZfs() )
+	    return true;
+    }
+
+    return false;
+}
+
+
 void MountPoints::ensurePopulated()
 {
     if ( _isPopulated )
+    {
+	// Only read the mount table again if the kernel says it changed
+
+	if ( mountTableChanged() )
+	    read( MOUNT_INFO_FILE );
+
 	return;
+    }
 
-    read( "/proc/mounts" ) || read( "/etc/mtab" );
+    // Open this before reading so no change in the meantime is missed
+
+    _mountInfoFd = open( MOUNT_INFO_FILE, O_RDONLY | O_CLOEXEC );
+
+    if ( ! read( MOUNT_INFO_FILE ) )
+    {
+	if ( _mountInfoFd >= 0 )
+	{
+	    ::close( _mountInfoFd );
+	    _mountInfoFd = -1;
+	}
+
+	read( "/proc/mounts" ) || read( "/etc/mtab" );
+    }
 
     if ( ! _isPopulated )
-	logError() << "Could not read either /proc/mounts or /etc/mtab" << endl;
+	logError() << "Could not read " << MOUNT_INFO_FILE << ", /proc/mounts or /etc/mtab" << endl;
 
     _isPopulated = true;
     // dumpNormalMountPoints();
 }
 
 
+bool MountPoints::mountTableChanged()
+{
+    if ( _mountInfoFd < 0 )
+	return false;
+
+    // The kernel reports a change of the mount table as POLLPRI | POLLERR
+    // once for each open file descriptor of /proc/self/mountinfo.
+
+    struct pollfd pollFd;
+    pollFd.fd	   = _mountInfoFd;
+    pollFd.events  = POLLPRI;
+    pollFd.revents = 0;
+
+    return poll( &pollFd, 1, 0 ) > 0 && ( pollFd.revents & ( POLLPRI | POLLERR ) );
+}
+
+
 bool MountPoints::read( const QString & filename )
 {
     QFile file( filename );
@@ -297,76 +546,199 @@ bool MountPoints::read( const QString & filename )
 	return false;
     }
 
-    QStringList ntfsDevices = findNtfsDevices();
+    // Lines that did not change keep their MountPoint, so only the
+    // differences to the last read are applied: Each line of
+    // /proc/self/mountinfo starts with a unique mount ID.
+
+    bool mountInfo = filename == MOUNT_INFO_FILE;
+    QHash<QString, MountPoint *> oldLines = _lines;
+    QList<MountPoint *> mountPoints;
+    QHash<QString, MountPoint *> lines;
     QTextStream in( &file );
     int lineNo = 0;
-    int count  = 0;
-    QString line = in.readLine();
+    int added  = 0;
 
-    while ( ! line.isNull() ) // in.atEnd() always returns true for /proc/*
+    for ( QString line = in.readLine(); ! line.isNull(); line = in.readLine() )
     {
+	// in.atEnd() always returns true for /proc/*
+
 	++lineNo;
-	QStringList fields = line.split( QRegExp( "\\s+" ), QString::SkipEmptyParts );
 
-	if ( fields.isEmpty() ) // allow empty lines
+	if ( line.trimmed().isEmpty() ) // allow empty lines
 	    continue;
 
-	if ( fields.size() < 4 )
+	MountPoint * mountPoint = mountInfo ? oldLines.take( line ) : 0;
+
+	if ( ! mountPoint )
 	{
-	    logError() << "Bad line " << filename << ":" << lineNo << ": " << line << endl;
-	    continue;
+	    mountPoint = parseLine( line, mountInfo );
+
+	    if ( ! mountPoint )
+	    {
+		logError() << "Bad line " << filename << ":" << lineNo << ": " << line << endl;
+		continue;
+	    }
+
+	    ++added;
 	}
 
+	mountPoints << mountPoint;
+
+	if ( mountInfo )
+	    lines.insert( line, mountPoint );
+    }
+
+    if ( mountPoints.isEmpty() )
+    {
+	logWarning() << "Not a single mount point in " << filename << endl;
+	return false;
+    }
+
+    // Somebody might still have a pointer to a mount point that is gone
+    // now; those are only deleted in clear().
+
+    _unmounted << oldLines.values();
+
+    if ( _isPopulated )
+    {
+	logDebug() << "Mount table changed: " << added << " new, "
+		   << oldLines.size() << " removed" << endl;
+    }
+
+    _mountPointList = mountPoints;
+    _lines	    = lines;
+    updateIndexes();
+
+    logDebug() << "Read " << _mountPointList.size() << " mount points from " << filename << endl;
+    _isPopulated = true;
+
+    return true;
+}
+
+
+MountPoint * MountPoints::parseLine( const QString & line, bool mountInfo )
+{
+    QStringList fields = line.split( QRegExp( "\\s+" ), QString::SkipEmptyParts );
+
+    QString device;
+    QString path;
+    QString fsType;
+    QString mountOpts;
+    QString superOpts;
+    dev_t   deviceId = 0;
+
+    if ( mountInfo )
+    {
+	// File format (/proc/self/mountinfo):
+	//
+	//   25 1 8:6 / / rw,relatime shared:1 - ext4 /dev/sda6 rw,errors=remount-ro
+	//   38 25 0:35 / /nas/work rw,relatime shared:7 - nfs nas:/share/work rw
+	//
+	// The optional fields before the "-" vary in number. The options
+	// after the device are those of the filesystem itself, e.g. the
+	// layers of an overlay filesystem.
+
+	int sep = fields.indexOf( "-", 6 );
+
+	if ( fields.size() < 6 || sep < 0 || sep + 2 >= fields.size() )
+	    return 0;
+
+	QStringList majorMinor = fields[2].split( ':' );
+
+	if ( majorMinor.size() == 2 )
+	    deviceId = makedev( majorMinor[0].toUInt(), majorMinor[1].toUInt() );
+
+	path	  = fields[4];
+	mountOpts = fields[5];
+	fsType	  = fields[ sep + 1 ];
+	device	  = unescapePath( fields[ sep + 2 ] );
+
+	if ( sep + 3 < fields.size() )
+	    superOpts = fields[ sep + 3 ];
+    }
+    else
+    {
 	// File format (/proc/mounts or /etc/mtab):
 	//
 	//   /dev/sda6 / ext4 rw,relatime,errors=remount-ro,data=ordered 0 0
 	//   /dev/sda7 /work ext4 rw,relatime,data=ordered 0 0
 	//   nas:/share/work /nas/work nfs rw,local_lock=none 0 0
 
-	QString device	  = fields[0];
-	QString path	  = fields[1];
-	QString fsType	  = fields[2];
-	QString mountOpts = fields[3];
+	if ( fields.size() < 4 )
+	    return 0;
+
+	device	  = fields[0];
+	path	  = fields[1];
+	fsType	  = fields[2];
+	mountOpts = fields[3];
 	// ignoring fsck and dump order (0 0)
+    }
 
-        path.replace( "\\040", " " );
+    path = unescapePath( path );
 
-        if ( fsType == "fuseblk" && ntfsDevices.contains( device ) )
-            fsType = "ntfs";
+    if ( fsType == "fuseblk" && ntfsDevices().contains( device ) )
+	fsType = "ntfs";
 
-	MountPoint * mountPoint = new MountPoint( device, path, fsType, mountOpts );
-	CHECK_NEW( mountPoint );
+    MountPoint * mountPoint = new MountPoint( device, path, fsType, mountOpts );
+    CHECK_NEW( mountPoint );
+    mountPoint->setDeviceId( deviceId );
+    mountPoint->setSuperOptions( superOpts );
 
-	if ( ( ! mountPoint->isSystemMount() ) && isDeviceMounted( device ) )
-	{
-	    mountPoint->setDuplicate();
-	    logInfo() << "Found duplicate mount of " << device << " at " << path << endl;
-	}
+    if ( mountPoint->isSnapPackage() )
+    {
+	QString pkgName = path.section( "/", 1, 1, QString::SectionSkipEmpty );
+	logInfo() << "Found snap package \"" << pkgName << "\" at " << path << endl;
+    }
 
-        if ( mountPoint->isSnapPackage() )
-        {
-            QString pkgName = path.section( "/", 1, 1, QString::SectionSkipEmpty );
-            logInfo() << "Found snap package \"" << pkgName << "\" at " << path << endl;
-        }
+    return mountPoint;
+}
 
-	_mountPointList << mountPoint;
-	_mountPointMap[ path ] = mountPoint;
-	++count;
 
-	line = in.readLine();
-    }
+void MountPoints::updateIndexes()
+{
+    _mountPointMap.clear();
+    _deviceMap.clear();
+    _checkedForBtrfs = false;
+
+    QSet<QString> devices;
 
-    if ( count < 1 )
+    foreach ( MountPoint * mountPoint, _mountPointList )
     {
-	logWarning() << "Not a single mount point in " << filename << endl;
-	return false;
+	QString device = mountPoint->device();
+	bool duplicate = ! mountPoint->isSystemMount() && devices.contains( device );
+
+	if ( duplicate && ! mountPoint->isDuplicate() )
+	    logInfo() << "Found duplicate mount of " << device << " at " << mountPoint->path() << endl;
+
+	mountPoint->setDuplicate( duplicate );
+	devices.insert( device );
+
+	_mountPointMap[ mountPoint->path() ] = mountPoint;
+
+	if ( mountPoint->deviceId() != 0 && ! _deviceMap.contains( mountPoint->deviceId() ) )
+	    _deviceMap.insert( mountPoint->deviceId(), mountPoint );
     }
-    else
+}
+
+
+const QStringList & MountPoints::ntfsDevices()
+{
+    // lsblk is only needed (and only started once) if anything is mounted
+    // with fuseblk. In the GUI thread, don't wait for it: The mount points
+    // are updated when it is finished.
+
+    if ( ! _checkedNtfs )
     {
-        logDebug() << "Read " << _mountPointList.size() << " mount points from " << filename << endl;
-	_isPopulated = true;
-	return true;
+	_checkedNtfs = true;
+	QCoreApplication * app = QCoreApplication::instance();
+
+	if ( app && QThread::currentThread() == app->thread() )
+	    findNtfsDevicesAsync( app );
+	else
+	    _ntfsDevices = findNtfsDevices();
     }
+
+    return _ntfsDevices;
 }
 
 
@@ -384,33 +756,83 @@ bool MountPoints::checkForBtrfs()
 }
 
 
-QStringList MountPoints::findNtfsDevices()
+QString MountPoints::lsblkCommand()
 {
-    QString lsblkCommand = "/bin/lsblk";
+    QString command = "/bin/lsblk";
+
+    if ( ! SysUtil::haveCommand( command ) )
+        command = "/usr/bin/lsblk";
 
-    if ( ! SysUtil::haveCommand( lsblkCommand ) )
-        lsblkCommand = "/usr/bin/lsblk";
-    if ( ! SysUtil::haveCommand( lsblkCommand ) )
+    if ( ! SysUtil::haveCommand( command ) )
     {
         logInfo() << "No lsblk command available" << endl;
 
-        return QStringList();
+        return QString();
     }
 
+    return command;
+}
+
+
+QStringList MountPoints::lsblkArgs()
+{
+    return QStringList() << "--noheading" << "--list" << "--output" << "name,fstype";
+}
+
+
+QStringList MountPoints::findNtfsDevices()
+{
+    QString command = lsblkCommand();
+
+    if ( command.isEmpty() )
+        return QStringList();
+
     logDebug() << endl;
-    QStringList ntfsDevices;
     int exitCode;
-    QString output = SysUtil::runCommand( lsblkCommand,
-                                          QStringList()
-                                          << "--noheading"
-                                          << "--list"
-                                          << "--output"
-                                          << "name,fstype",
+    QString output = SysUtil::runCommand( command,
+                                          lsblkArgs(),
                                           &exitCode,
                                           LSBLK_TIMEOUT_SEC,
                                           true,         // logCommand
                                           false,        // logOutput
                                           false );      // ignoreErrCode
+
+    return parseNtfsDevices( output, exitCode );
+}
+
+
+void MountPoints::findNtfsDevicesAsync( QObject * context )
+{
+    QString command = lsblkCommand();
+
+    if ( command.isEmpty() )
+        return;
+
+    SysUtil::runCommandAsync( command, lsblkArgs(), context,
+                              [=]( const QString & output, int exitCode )
+        {
+            _ntfsDevices = parseNtfsDevices( output, exitCode );
+
+            foreach ( MountPoint * mountPoint, _mountPointList )
+            {
+                if ( mountPoint->filesystemType() == "fuseblk" &&
+                     _ntfsDevices.contains( mountPoint->device() ) )
+                {
+                    mountPoint->setFilesystemType( "ntfs" );
+                }
+            }
+        },
+        LSBLK_TIMEOUT_SEC,
+        true,           // logCommand
+        false,          // logOutput
+        false );        // ignoreErrCode
+}
+
+
+QStringList MountPoints::parseNtfsDevices( const QString & output, int exitCode )
+{
+    QStringList ntfsDevices;
+
     if ( exitCode == 0 )
     {
         QStringList lines = output.split( "\n" )
@@ -447,6 +869,21 @@ QList<MountPoint *> MountPoints::normalMountPoints()
 }
 
 
+QList<MountPoint *> MountPoints::overlayMountPoints()
+{
+    instance()->ensurePopulated();
+    QList<MountPoint *> result;
+
+    foreach ( MountPoint * mountPoint, instance()->_mountPointList )
+    {
+	if ( mountPoint->isOverlay() )
+	    result << mountPoint;
+    }
+
+    return result;
+}
+
+
 void MountPoints::dumpNormalMountPoints()
 {
     foreach ( MountPoint * mountPoint, normalMountPoints() )
@@ -465,7 +902,9 @@ void MountPoints::dump()
 
 void MountPoints::reload()
 {
-    instance()->clear();
+    if ( instance()->_mountInfoFd < 0 )
+	instance()->clear();
+
     instance()->ensurePopulated();
 }
 
@@ -14,8 +14,11 @@
 #include <QStringList>
 #include <QList>
 #include <QMap>
+#include <QHash>
 #include <QTextStream>
 
+class QObject;
+
 #if (QT_VERSION < QT_VERSION_CHECK( 5, 4, 0 ))
 #  define HAVE_Q_STORAGE_INFO 0
 #else
@@ -48,6 +51,19 @@ namespace QDirStat
 	 **/
 	QString device() const { return _device; }
 
+	/**
+	 * Return the device number of the mounted filesystem (the
+	 * "major:minor" field of /proc/self/mountinfo) or 0 if it is not
+	 * known. This is the st_dev that lstat() returns for the files on
+	 * this filesystem.
+	 **/
+	dev_t deviceId() const { return _deviceId; }
+
+	/**
+	 * Set the device number of the mounted filesystem.
+	 **/
+	void setDeviceId( dev_t deviceId ) { _deviceId = deviceId; }
+
 	/**
 	 * Return the path where the device is mounted to.
 	 **/
@@ -58,6 +74,12 @@ namespace QDirStat
 	 **/
 	QString filesystemType() const { return _filesystemType; }
 
+	/**
+	 * Set the filesystem type. This is used when lsblk found out that a
+	 * "fuseblk" mount is NTFS.
+	 **/
+	void setFilesystemType( const QString & fsType ) { _filesystemType = fsType; }
+
 	/**
 	 * Return the individual mount options as a list of strings
 	 * ["rw", "nosuid", "nodev", "relatime", "rsize=32768"].
@@ -69,6 +91,19 @@ namespace QDirStat
 	 **/
 	QString mountOptionsStr() const;
 
+	/**
+	 * Return the options of the filesystem itself (the "super options"
+	 * of /proc/self/mountinfo) as a list of strings, like
+	 * ["rw", "lowerdir=/a:/b", "upperdir=/c", "workdir=/d"]. This is
+	 * empty if they are not known.
+	 **/
+	QStringList superOptions() const { return _superOptions; }
+
+	/**
+	 * Set the options of the filesystem itself.
+	 **/
+	void setSuperOptions( const QString & superOptions );
+
 	/**
 	 * Return 'true' if the filesystem is mounted read-only.
 	 **/
@@ -79,12 +114,43 @@ namespace QDirStat
 	 **/
 	bool isBtrfs() const;
 
+	/**
+	 * Return 'true' if the filesystem type of this mount point is "xfs".
+	 **/
+	bool isXfs() const;
+
+	/**
+	 * Return 'true' if the filesystem type of this mount point is "zfs".
+	 * The device is the name of the dataset then (e.g. "tank/home").
+	 **/
+	bool isZfs() const;
+
 	/**
 	 * Return 'true' if the filesystem type of this mount point starts with
-	 * "ntfs".
+	 * "ntfs" or if it is "fuseblk" (which lsblk did not identify as NTFS
+	 * yet, but which is most likely ntfs-3g).
 	 **/
         bool isNtfs() const;
 
+	/**
+	 * Return 'true' if this is an overlay filesystem ("overlay" or
+	 * fuse-overlayfs), i.e. a merged view of the directories of its
+	 * layers that are somewhere else.
+	 **/
+	bool isOverlay() const;
+
+	/**
+	 * Return the absolute paths of the lower (read-only) layers of an
+	 * overlay filesystem, the topmost first.
+	 **/
+	QStringList overlayLowerDirs() const;
+
+	/**
+	 * Return the absolute path of the upper (writable) layer of an
+	 * overlay filesystem or an empty string if there is none.
+	 **/
+	QString overlayUpperDir() const;
+
 	/**
 	 * Return 'true' if this is a network filesystem like NFS or Samba
 	 * (cifs).
@@ -95,6 +161,7 @@ namespace QDirStat
 	 * Return 'true' if this is a system mount, i.e. one of the known
 	 * system mount points like /dev, /proc, /sys, or if the device name
 	 * does not start with a slash (e.g. cgroup, tmpfs, sysfs, ...)
+	 * unless it is a ZFS dataset.
 	 **/
 	bool isSystemMount() const;
 
@@ -122,6 +189,13 @@ namespace QDirStat
 	 **/
 	bool hasSizeInfo() const;
 
+	/**
+	 * Query the size information again. It is queried the first time it
+	 * is needed and then kept, even if the mount point is kept across
+	 * changes of the mount table.
+	 **/
+	void refreshSizeInfo();
+
 	/**
 	 * Total size of the filesystem of this mount point.
 	 * This returns -1 if no size information is available.
@@ -158,10 +232,18 @@ namespace QDirStat
 	QString	    _path;
 	QString	    _filesystemType;
 	QStringList _mountOptions;
+	QStringList _superOptions;
+	dev_t	    _deviceId;
 	bool	    _isDuplicate;
 
 #if HAVE_Q_STORAGE_INFO
-	QStorageInfo _storageInfo;
+	/**
+	 * Return the storage info; this queries it the first time.
+	 **/
+	const QStorageInfo & storageInfo() const;
+
+	mutable QStorageInfo _storageInfo;
+	mutable bool	     _haveStorageInfo;
 #endif
     }; // class MountPoint
 
@@ -198,7 +280,7 @@ namespace QDirStat
 	 * Return the mount point for 'path' if there is one or 0 if there is
 	 * not. Ownership of the returned object is not transferred to the
 	 * caller, i.e. the caller should not delete it. The pointer remains
-	 * valid until the next call to clear().
+	 * valid until the next call to clear(), even if it is unmounted.
 	 **/
 	static MountPoint * findByPath( const QString & path );
 
@@ -212,15 +294,32 @@ namespace QDirStat
 	 **/
 	static MountPoint * findNearestMountPoint( const QString & path );
 
+	/**
+	 * Return the mount point of the filesystem with device number
+	 * 'deviceId' (the st_dev of its files) or 0 if there is none. If the
+	 * filesystem is mounted more than once, this is the first mount.
+	 * Ownership of the returned object is not transferred to the caller.
+	 *
+	 * This is much cheaper than the path-based lookups, but it only
+	 * works if /proc/self/mountinfo could be read. Btrfs subvolumes have
+	 * device numbers of their own that are not in the mount table.
+	 **/
+	static MountPoint * findByDevice( dev_t deviceId );
+
 	/**
 	 * Return 'true' if any mount point has filesystem type "btrfs".
 	 **/
 	static bool hasBtrfs();
 
+	/**
+	 * Return 'true' if any mount point has filesystem type "zfs".
+	 **/
+	static bool hasZfs();
+
 	/**
 	 * Ensure the mount points are populated with the content of
-	 * /proc/mounts, falling back to /etc/mtab if /proc/mounts cannot be
-	 * read.
+	 * /proc/self/mountinfo, falling back to /proc/mounts and /etc/mtab
+	 * (without device numbers) if that cannot be read.
 	 **/
 	void ensurePopulated();
 
@@ -233,6 +332,12 @@ namespace QDirStat
 	 **/
 	static QList<MountPoint *> normalMountPoints();
 
+	/**
+	 * Return a list of the overlay filesystems (see
+	 * MountPoint::isOverlay()) in the order in which they were mounted.
+	 **/
+	static QList<MountPoint *> overlayMountPoints();
+
 	/**
 	 * Dump all current mount points to the log. This does not call
 	 * ensurePopulated() first.
@@ -252,8 +357,14 @@ namespace QDirStat
 	static bool hasSizeInfo();
 
         /**
-         * Clear all information and reload it from disk.
-         * NOTICE: This invalidates ALL MountPoint pointers!
+         * Bring the mount points up to date. With /proc/self/mountinfo,
+         * this only applies the changes since the last read (if there are
+         * any), and the pointers to the mount points that are still
+         * mounted stay valid. Otherwise, this clears all information and
+         * reloads it from disk, which invalidates ALL MountPoint pointers!
+         *
+         * Notice that the mount points are kept up to date anyway: Each
+         * lookup checks for changes first.
          **/
         static void reload();
 
@@ -277,9 +388,10 @@ namespace QDirStat
 	void init();
 
 	/**
-	 * Read 'filename' (in /proc/mounts or /etc/mnt syntax) and populate
-	 * the mount points with the content. Return 'true' on success, 'false'
-	 * on failure.
+	 * Read 'filename' (in /proc/self/mountinfo, /proc/mounts or /etc/mnt
+	 * syntax) and populate the mount points with the content. Mount
+	 * points from /proc/self/mountinfo whose line did not change are
+	 * kept. Return 'true' on success, 'false' on failure.
 	 **/
 	bool read( const QString & filename );
 
@@ -294,10 +406,54 @@ namespace QDirStat
          **/
         QStringList findNtfsDevices();
 
+        /**
+         * Like findNtfsDevices(), but start lsblk in the background and
+         * update _ntfsDevices and the "fuseblk" mount points when it is
+         * finished. 'context' is the QObject for the callback.
+         **/
+        void findNtfsDevicesAsync( QObject * context );
+
+        /**
+         * Return the NTFS devices from the output of lsblk.
+         **/
+        QStringList parseNtfsDevices( const QString & output, int exitCode );
+
+        /**
+         * Return the path of the lsblk command or an empty string if it
+         * is not available.
+         **/
+        QString lsblkCommand();
+
+        /**
+         * Return the arguments for lsblk.
+         **/
+        QStringList lsblkArgs();
+
+	/**
+	 * Return 'true' if the mount table changed since it was last read.
+	 * This polls /proc/self/mountinfo without blocking.
+	 **/
+	bool mountTableChanged();
+
+	/**
+	 * Create a mount point from 'line' of /proc/self/mountinfo (if
+	 * 'mountInfo' is 'true') or of /proc/mounts. Return 0 if the line
+	 * can't be parsed.
+	 **/
+	MountPoint * parseLine( const QString & line, bool mountInfo );
+
+	/**
+	 * Rebuild the lookup maps and the duplicate flags from the list of
+	 * mount points.
+	 **/
+	void updateIndexes();
+
 	/**
-	 * Return 'true' if 'device' is mounted.
+	 * Return the NTFS devices from lsblk. This starts lsblk the first
+	 * time it is needed; in the main thread, it does not wait for it and
+	 * returns an empty list until it is finished.
 	 **/
-	bool isDeviceMounted( const QString & device );
+	const QStringList & ntfsDevices();
 
 	//
 	// Data members
@@ -307,6 +463,12 @@ namespace QDirStat
 
 	QList<MountPoint *>	    _mountPointList;
 	QMap<QString, MountPoint *> _mountPointMap;
+	QHash<dev_t, MountPoint *>  _deviceMap;
+	QHash<QString, MountPoint *> _lines;	// mountinfo line -> mount point
+	QList<MountPoint *>	    _unmounted;	// Deleted in clear()
+	QStringList		    _ntfsDevices;
+	bool			    _checkedNtfs;
+	int			    _mountInfoFd;
 	bool			    _isPopulated;
 	bool			    _hasBtrfs;
 	bool			    _checkedForBtrfs;
@@ -0,0 +1,331 @@
+/*
+ *   File name: NameIndex.cpp
+ *   Summary:	Index for finding files by name in a DirTree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>
+#include <iterator>
+
+#include <QMetaObject>
+
+#include "NameIndex.h"
+#include "DirTree.h"
+#include "PkgFilter.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Add 'literal' to 'literals' if it is not empty and clear it.
+     **/
+    void flush( QString & literal, QStringList & literals )
+    {
+	if ( ! literal.isEmpty() )
+	    literals << literal;
+
+	literal.clear();
+    }
+
+
+    /**
+     * Return the literal parts of a wildcard pattern: Everything between
+     * '*', '?' and character classes in brackets.
+     **/
+    QStringList wildcardLiterals( const QString & pattern )
+    {
+	QStringList literals;
+	QString	    literal;
+
+	for ( int i=0; i < pattern.size(); ++i )
+	{
+	    QChar c = pattern.at( i );
+
+	    if ( c == '*' || c == '?' )
+	    {
+		flush( literal, literals );
+	    }
+	    else if ( c == '[' )
+	    {
+		flush( literal, literals );
+		i = pattern.indexOf( ']', i + 1 );
+
+		if ( i < 0 )
+		    break;
+	    }
+	    else
+	    {
+		literal += c;
+	    }
+	}
+
+	flush( literal, literals );
+
+	return literals;
+    }
+
+
+    /**
+     * Return the literal parts of a regular expression. This is very
+     * conservative: Anything with alternatives or groups has none, and
+     * escaped characters are treated like special characters.
+     **/
+    QStringList regExpLiterals( const QString & pattern )
+    {
+	QStringList literals;
+	QString	    literal;
+
+	if ( pattern.contains( '|' ) || pattern.contains( '(' ) )
+	    return literals;
+
+	const QString special( "\\.[]{}*+?^$" );
+
+	for ( int i=0; i < pattern.size(); ++i )
+	{
+	    QChar c	= pattern.at( i );
+	    QChar next = i + 1 < pattern.size() ? pattern.at( i + 1 ) : QChar();
+
+	    if ( special.contains( c ) )
+	    {
+		flush( literal, literals );
+
+		if ( c == '\\' )
+		    ++i;		// skip the escaped character
+		else if ( c == '[' )
+		    i = pattern.indexOf( ']', i + 1 );
+		else if ( c == '{' )
+		    i = pattern.indexOf( '}', i + 1 );
+
+		if ( i < 0 )
+		    break;
+	    }
+	    else if ( next == '*' || next == '?' || next == '{' )
+	    {
+		// This character might not be there at all
+
+		flush( literal, literals );
+	    }
+	    else
+	    {
+		literal += c;
+	    }
+	}
+
+	flush( literal, literals );
+
+	return literals;
+    }
+
+
+    /**
+     * Less-than for sorting lists by size.
+     **/
+    bool shorterList( const QVector<int> * a, const QVector<int> * b )
+    {
+	return a->size() < b->size();
+    }
+
+}	// namespace
+
+
+NameIndex::NameIndex():
+    _tree( 0 ),
+    _generation( 0 )
+{
+
+}
+
+
+NameIndex::NameIndex( const TreeSnapshot & snapshot ):
+    _tree( snapshot.tree() ),
+    _generation( snapshot.generation() )
+{
+    const QVector<TreeSnapshotNode> & nodes = snapshot.nodes();
+    _items.reserve( nodes.size() );
+
+    for ( int i=0; i < nodes.size(); ++i )
+    {
+	const TreeSnapshotNode & node = nodes.at( i );
+	_items << node.item;
+
+	if ( node.isDir() || node.subtreeEnd > i + 1 )
+	{
+	    Range range = { i, node.subtreeEnd };
+	    _subtrees.insert( node.item, range );
+	}
+
+	QString name = node.name.toLower();
+
+	for ( int pos = 0; pos + 3 <= name.size(); ++pos )
+	{
+	    QVector<int> & items = _trigrams[ trigram( name.constData() + pos ) ];
+
+	    // Only once for each name, even if it has that trigram more often
+
+	    if ( items.isEmpty() || items.last() != i )
+		items << i;
+	}
+    }
+
+    // Growing the lists left some unused space at the end of most of them
+
+    for ( QHash<quint64, QVector<int> >::iterator it = _trigrams.begin();
+	  it != _trigrams.end();
+	  ++it )
+    {
+	it.value().squeeze();
+    }
+}
+
+
+bool NameIndex::isCurrent() const
+{
+    return _tree && _tree->generation() == _generation;
+}
+
+
+FileInfoList NameIndex::find( const PkgFilter & filter, FileInfo * subtree ) const
+{
+    FileInfoList result;
+    QHash<FileInfo *, Range>::const_iterator it = _subtrees.constFind( subtree );
+
+    if ( it == _subtrees.constEnd() )
+	return result;
+
+    Range range = { it.value().begin + 1, it.value().end };
+
+    foreach ( int i, candidates( literals( filter ), range ) )
+    {
+	FileInfo * item = _items.at( i );
+
+	if ( filter.matches( item->name() ) )
+	    result << item;
+    }
+
+    return result;
+}
+
+
+QVector<int> NameIndex::candidates( const QStringList & literals,
+				    const Range &	range ) const
+{
+    QVector<int> result;
+    QVector<const QVector<int> *> lists;
+
+    foreach ( const QString & literal, literals )
+    {
+	QString lower = literal.toLower();
+
+	for ( int pos = 0; pos + 3 <= lower.size(); ++pos )
+	{
+	    QHash<quint64, QVector<int> >::const_iterator it =
+		_trigrams.constFind( trigram( lower.constData() + pos ) );
+
+	    if ( it == _trigrams.constEnd() )	// no name has this trigram
+		return result;
+
+	    lists << &it.value();
+	}
+    }
+
+    if ( lists.isEmpty() )
+    {
+	// Nothing to narrow it down: Every item needs to be checked
+
+	result.reserve( range.end - range.begin );
+
+	for ( int i = range.begin; i < range.end; ++i )
+	    result << i;
+
+	return result;
+    }
+
+    // Start with the shortest list, restricted to the range, and intersect
+    // it with each of the others
+
+    std::sort( lists.begin(), lists.end(), shorterList );
+    const QVector<int> & first = *lists.first();
+
+    QVector<int>::const_iterator begin =
+	std::lower_bound( first.constBegin(), first.constEnd(), range.begin );
+    QVector<int>::const_iterator end =
+	std::lower_bound( begin, first.constEnd(), range.end );
+
+    result.reserve( end - begin );
+    std::copy( begin, end, std::back_inserter( result ) );
+
+    for ( int i = 1; i < lists.size() && ! result.isEmpty(); ++i )
+    {
+	QVector<int> intersection;
+	std::set_intersection( result.constBegin(),	  result.constEnd(),
+			       lists.at( i )->constBegin(), lists.at( i )->constEnd(),
+			       std::back_inserter( intersection ) );
+	result.swap( intersection );
+    }
+
+    return result;
+}
+
+
+QStringList NameIndex::literals( const PkgFilter & filter )
+{
+    QStringList literals;
+
+    switch ( filter.filterMode() )
+    {
+	case PkgFilter::Contains:
+	case PkgFilter::StartsWith:
+	case PkgFilter::ExactMatch:
+	    literals << filter.pattern();
+	    break;
+
+	case PkgFilter::Wildcard:
+	    literals = wildcardLiterals( filter.pattern() );
+	    break;
+
+	case PkgFilter::RegExp:
+	    literals = regExpLiterals( filter.pattern() );
+	    break;
+
+	case PkgFilter::SelectAll:
+	case PkgFilter::Auto:
+	    break;
+    }
+
+    return literals;
+}
+
+
+
+
+NameIndexBuilder::NameIndexBuilder( const TreeSnapshot & snapshot,
+				    QObject *		 receiver,
+				    const char *	 slot ):
+    _snapshot( snapshot ),
+    _receiver( receiver ),
+    _slot( slot ),
+    _finished( 0 )
+{
+
+}
+
+
+void NameIndexBuilder::run()
+{
+    _index = NameIndex( _snapshot );
+
+    // The snapshot is not needed anymore; let the nodes go right here
+
+    _snapshot = TreeSnapshot();
+    _finished.storeRelease( 1 );
+
+    // Nothing may touch this object after this
+
+    QMetaObject::invokeMethod( _receiver, _slot, Qt::QueuedConnection );
+}
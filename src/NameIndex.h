@@ -0,0 +1,186 @@
+/*
+ *   File name: NameIndex.h
+ *   Summary:	Index for finding files by name in a DirTree
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef NameIndex_h
+#define NameIndex_h
+
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QRunnable>
+#include <QStringList>
+#include <QVector>
+
+#include "FileInfo.h"
+#include "TreeSnapshot.h"
+
+
+class QObject;
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class PkgFilter;
+
+
+    /**
+     * Index of the names of all items of a tree for finding items by name
+     * without walking the tree: For each trigram (each 3 consecutive
+     * characters) of the lower case names, this keeps the (sorted) numbers
+     * of the items with that trigram in their name. A search pattern
+     * usually has some literal parts; only the items that have all of
+     * their trigrams need to be checked against the pattern.
+     *
+     * This is built from a TreeSnapshot, so it can be built in a worker
+     * thread (see NameIndexBuilder). Like a snapshot, it refers to the
+     * items of the tree, so it can only be used as long as the tree did
+     * not change (see isCurrent()).
+     *
+     * Copying a NameIndex is cheap: All data are implicitly shared.
+     **/
+    class NameIndex
+    {
+    public:
+
+	/**
+	 * Create an empty index.
+	 **/
+	NameIndex();
+
+	/**
+	 * Build the index of all items in 'snapshot'. This can be called
+	 * from any thread.
+	 **/
+	explicit NameIndex( const TreeSnapshot & snapshot );
+
+	/**
+	 * Return 'true' if this index is empty.
+	 **/
+	bool isEmpty() const { return _items.isEmpty(); }
+
+	/**
+	 * Return 'true' if the tree did not change since the snapshot for
+	 * this index was taken, so it can still be used. This must be
+	 * called on the main thread.
+	 **/
+	bool isCurrent() const;
+
+	/**
+	 * Return 'true' if 'subtree' is a directory in this index, so find()
+	 * can be used for it.
+	 **/
+	bool hasSubtree( FileInfo * subtree ) const
+	    { return _subtrees.contains( subtree ); }
+
+	/**
+	 * Return the items below 'subtree' (but not 'subtree' itself) whose
+	 * name matches 'filter' in the order of the tree. Only use this on
+	 * the main thread if isCurrent() returns 'true'.
+	 **/
+	FileInfoList find( const PkgFilter & filter, FileInfo * subtree ) const;
+
+	/**
+	 * Return the parts of the pattern of 'filter' that any matching
+	 * name must contain literally (ignoring case). This may also return
+	 * nothing at all, e.g. for a regular expression with alternatives.
+	 **/
+	static QStringList literals( const PkgFilter & filter );
+
+
+    protected:
+
+	/**
+	 * A range of item numbers from 'begin' up to, but not including,
+	 * 'end'. For a subtree, that is the directory and everything below
+	 * it.
+	 **/
+	struct Range
+	{
+	    int begin;
+	    int end;
+	};
+
+	/**
+	 * Return the key of the trigram that starts at 'chars'. Those need
+	 * to be lower case already.
+	 **/
+	static quint64 trigram( const QChar * chars )
+	{
+	    return ( (quint64) chars[0].unicode() << 32 ) |
+		   ( (quint64) chars[1].unicode() << 16 ) |
+		     (quint64) chars[2].unicode();
+	}
+
+	/**
+	 * Return the numbers of the items in 'range' that have all the
+	 * trigrams of 'literals', or all items in 'range' if 'literals'
+	 * have no trigrams at all.
+	 **/
+	QVector<int> candidates( const QStringList & literals,
+				 const Range &	     range ) const;
+
+
+	//
+	// Data members
+	//
+
+	QVector<FileInfo *>			_items;	    // preorder, like the snapshot
+	QHash<FileInfo *, Range>		_subtrees;  // the directories
+	QHash<quint64, QVector<int> >		_trigrams;
+	DirTree *				_tree;
+	quint64					_generation;
+    };
+
+
+    /**
+     * Building a NameIndex from a TreeSnapshot in a worker thread.
+     *
+     * When it is done, this invokes method 'slot' of 'receiver' with a
+     * queued connection, and it does not touch anything after that, so the
+     * receiver can delete it right away. Use it with autoDelete() off.
+     **/
+    class NameIndexBuilder: public QRunnable
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	NameIndexBuilder( const TreeSnapshot & snapshot,
+			  QObject *	       receiver,
+			  const char *	       slot );
+
+	/**
+	 * Build the index. Reimplemented from QRunnable.
+	 **/
+	virtual void run() Q_DECL_OVERRIDE;
+
+	/**
+	 * Return 'true' if building is done.
+	 **/
+	bool isFinished() const { return _finished.loadAcquire() != 0; }
+
+	/**
+	 * Return the index. Only use this when building is done.
+	 **/
+	const NameIndex & index() const { return _index; }
+
+    private:
+	TreeSnapshot _snapshot;
+	QObject *    _receiver;
+	const char * _slot;
+	NameIndex    _index;
+	QAtomicInt   _finished;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef NameIndex_h
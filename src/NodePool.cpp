@@ -0,0 +1,196 @@
+/*
+ *   File name: NodePool.cpp
+ *   Summary:	Memory pool for the DirTree nodes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <stdlib.h>	// posix_memalign(), free()
+#include <string.h>	// memset()
+#include <new>		// operator new, std::bad_alloc
+
+#include <QSet>
+
+#include "NodePool.h"
+
+
+using namespace QDirStat;
+
+
+// Offset of the first node in a chunk: After the chunk header, rounded up
+// to the granularity so all nodes are properly aligned
+#define FIRST_NODE_OFFSET	( ( ( sizeof( Chunk ) + Granularity - 1 ) / Granularity ) * Granularity )
+
+
+NodePool * NodePool::instance()
+{
+    // Intentionally never deleted: Nodes might still be deleted during
+    // program shutdown after static objects are already destroyed.
+
+    static NodePool * pool = new NodePool();
+
+    return pool;
+}
+
+
+NodePool::NodePool():
+    _chunkPos( 0 ),
+    _chunkEnd( 0 ),
+    _liveBytes( 0 )
+{
+    memset( _freeList, 0, sizeof( _freeList ) );
+}
+
+
+void * NodePool::allocate( size_t size )
+{
+    NodePool * pool = instance();
+
+    if ( size > MaxNodeSize )
+    {
+	void * ptr = ::operator new( size );
+	pool->_liveBytes += size;
+
+	return ptr;
+    }
+
+    size_t sizeClass = ( size + Granularity - 1 ) / Granularity;
+    void * ptr = 0;
+
+    if ( pool->_freeList[ sizeClass ] )
+    {
+	FreeNode * node = pool->_freeList[ sizeClass ];
+	pool->_freeList[ sizeClass ] = node->next;
+	ptr = node;
+    }
+    else
+    {
+	size_t bytes = sizeClass * Granularity;
+
+	if ( pool->_chunkPos + bytes > pool->_chunkEnd )
+	    pool->newChunk(); // The rest of the old one is wasted, but that is less than MaxNodeSize
+
+	ptr = pool->_chunkPos;
+	pool->_chunkPos += bytes;
+    }
+
+    chunk( ptr )->liveNodes++;
+    pool->_liveBytes += sizeClass * Granularity;
+
+    return ptr;
+}
+
+
+void NodePool::release( void * ptr, size_t size )
+{
+    if ( ! ptr )
+	return;
+
+    NodePool * pool = instance();
+
+    if ( size > MaxNodeSize )
+    {
+	::operator delete( ptr );
+	pool->_liveBytes -= size;
+
+	return;
+    }
+
+    size_t sizeClass = ( size + Granularity - 1 ) / Granularity;
+
+    chunk( ptr )->liveNodes--;
+    pool->_liveBytes -= sizeClass * Granularity;
+
+    FreeNode * node = (FreeNode *) ptr;
+    node->next = pool->_freeList[ sizeClass ];
+    pool->_freeList[ sizeClass ] = node;
+}
+
+
+void NodePool::newChunk()
+{
+    void * mem = 0;
+
+    if ( posix_memalign( &mem, ChunkSize, ChunkSize ) != 0 )
+	throw std::bad_alloc();
+
+    Chunk * newChunk = (Chunk *) mem;
+    newChunk->liveNodes = 0;
+    _chunks << newChunk;
+
+    _chunkPos = (char *) mem + FIRST_NODE_OFFSET;
+    _chunkEnd = (char *) mem + ChunkSize;
+}
+
+
+void NodePool::trim()
+{
+    NodePool * pool  = instance();
+    Chunk * current = pool->_chunkPos ? chunk( pool->_chunkPos - 1 ) : 0;
+    QSet<Chunk *> emptyChunks;
+
+    foreach ( Chunk * ch, pool->_chunks )
+    {
+	if ( ch->liveNodes == 0 )
+	    emptyChunks << ch;
+    }
+
+    if ( emptyChunks.isEmpty() )
+	return;
+
+    if ( emptyChunks.size() == pool->_chunks.size() )
+    {
+	// Nothing alive at all: No need to look at the free lists
+
+	foreach ( Chunk * ch, pool->_chunks )
+	    free( ch );
+
+	pool->_chunks.clear();
+	memset( pool->_freeList, 0, sizeof( pool->_freeList ) );
+	pool->_chunkPos = 0;
+	pool->_chunkEnd = 0;
+
+	return;
+    }
+
+    // Drop the free nodes in the empty chunks from the free lists
+
+    for ( size_t sizeClass = 0; sizeClass <= MaxNodeSize / Granularity; ++sizeClass )
+    {
+	FreeNode ** link = &pool->_freeList[ sizeClass ];
+
+	while ( *link )
+	{
+	    if ( emptyChunks.contains( chunk( *link ) ) )
+		*link = (*link)->next;
+	    else
+		link = &(*link)->next;
+	}
+    }
+
+    if ( current && emptyChunks.contains( current ) )
+    {
+	pool->_chunkPos = 0;
+	pool->_chunkEnd = 0;
+    }
+
+    QList<Chunk *> chunks;
+
+    foreach ( Chunk * ch, pool->_chunks )
+    {
+	if ( emptyChunks.contains( ch ) )
+	    free( ch );
+	else
+	    chunks << ch;
+    }
+
+    pool->_chunks = chunks;
+}
+
+
+size_t NodePool::chunkBytes()
+{
+    return instance()->_chunks.size() * ChunkSize;
+}
@@ -0,0 +1,144 @@
+/*
+ *   File name: NodePool.h
+ *   Summary:	Memory pool for the DirTree nodes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef NodePool_h
+#define NodePool_h
+
+
+#include <stddef.h>	// size_t
+
+#include <QList>
+
+
+namespace QDirStat
+{
+    /**
+     * Memory pool for FileInfo, DirInfo and their derived classes: Instead
+     * of one malloc() for each of the millions of nodes of a large tree,
+     * nodes are carved out of large chunks by simple pointer bumping.
+     * Deleted nodes go to a free list for their size, so they are reused
+     * for the next node of the same size.
+     *
+     * Each chunk counts its live nodes. trim() returns all chunks without
+     * any live node to the system at once; DirTree calls that after
+     * clearing the tree or a subtree. This avoids fragmenting the heap
+     * with millions of small blocks that are freed in random order.
+     *
+     * This is not thread-safe: Nodes are only created and deleted in the
+     * main thread.
+     **/
+    class NodePool
+    {
+    public:
+
+	/**
+	 * Allocate 'size' bytes for a node.
+	 **/
+	static void * allocate( size_t size );
+
+	/**
+	 * Release a node of 'size' bytes that was obtained with
+	 * allocate().
+	 **/
+	static void release( void * ptr, size_t size );
+
+	/**
+	 * Return all chunks that have no live nodes anymore to the system.
+	 * This takes time proportional to the number of free nodes, so call
+	 * this only after deleting many nodes, not after each one.
+	 **/
+	static void trim();
+
+	/**
+	 * Return the number of bytes of all chunks that are currently
+	 * allocated from the system.
+	 **/
+	static size_t chunkBytes();
+
+	/**
+	 * Return the number of bytes of all nodes that are currently alive,
+	 * including the large ones that are not in the chunks. Unlike
+	 * chunkBytes(), this goes down right away when nodes are deleted.
+	 **/
+	static size_t liveBytes() { return instance()->_liveBytes; }
+
+	/**
+	 * Return the bytes that a node of 'size' bytes takes in a chunk.
+	 * This is only meaningful up to maxNodeSize().
+	 **/
+	static size_t nodeBytes( size_t size )
+	    { return ( ( size + Granularity - 1 ) / Granularity ) * Granularity; }
+
+	/**
+	 * Return the size of the largest node that is allocated from the
+	 * chunks; larger ones are allocated with plain operator new.
+	 **/
+	static size_t maxNodeSize() { return MaxNodeSize; }
+
+
+    protected:
+
+	/**
+	 * Return the pool instance.
+	 **/
+	static NodePool * instance();
+
+	/**
+	 * Constructor. Use instance() instead.
+	 **/
+	NodePool();
+
+	struct FreeNode
+	{
+	    FreeNode * next;
+	};
+
+	/**
+	 * Header at the start of each chunk. Chunks are aligned to their
+	 * size, so the chunk of a node can be found by masking the lower
+	 * bits of its address.
+	 **/
+	struct Chunk
+	{
+	    size_t liveNodes;
+	};
+
+	/**
+	 * Return the chunk that 'ptr' belongs to.
+	 **/
+	static Chunk * chunk( void * ptr )
+	    { return (Chunk *) ( (size_t) ptr & ~( ChunkSize - 1 ) ); }
+
+	/**
+	 * Allocate a new chunk and make it the current one for pointer
+	 * bumping.
+	 **/
+	void newChunk();
+
+	// Node sizes are rounded up to multiples of this
+	static const size_t Granularity = 16;
+
+	// Larger objects are allocated with plain operator new
+	static const size_t MaxNodeSize = 512;
+
+	// Size and alignment of each chunk; this must be a power of 2
+	static const size_t ChunkSize	= 1024 * 1024;
+
+	FreeNode *	_freeList[ MaxNodeSize / Granularity + 1 ];
+	QList<Chunk *>	_chunks;
+	char *		_chunkPos;
+	char *		_chunkEnd;
+	size_t		_liveBytes;
+
+    };	// class NodePool
+
+}	// namespace QDirStat
+
+
+#endif // ifndef NodePool_h
@@ -0,0 +1,695 @@
+/*
+ *   File name: NtfsMft.cpp
+ *   Summary:	Reading the MFT of NTFS volumes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>
+#include <fcntl.h>	// open()
+#include <unistd.h>	// pread(), close()
+#include <string.h>	// memcmp(), memset(), strerror()
+#include <errno.h>
+#include <algorithm>	// std::sort(), std::lower_bound()
+
+#include <QFile>
+#include <QtEndian>
+
+#include "NtfsMft.h"
+#include "DirInfo.h"
+#include "DirTree.h"
+#include "Logger.h"
+#include "Exception.h"
+
+#define NTFS_ROOT_RECORD	5
+#define NTFS_FIXUP_STRIDE	512
+#define NTFS_REF_MASK		0x0000FFFFFFFFFFFFULL
+
+// Attribute types
+#define AT_STANDARD_INFORMATION 0x10
+#define AT_FILE_NAME		0x30
+#define AT_DATA			0x80
+#define AT_INDEX_ALLOCATION	0xA0
+#define AT_END			0xFFFFFFFF
+
+// MFT record header flags
+#define MFT_RECORD_IN_USE	0x0001
+#define MFT_RECORD_IS_DIR	0x0002
+
+// Non-resident attribute flags
+#define ATTR_IS_COMPRESSED	0x0001
+#define ATTR_IS_SPARSE		0x8000
+
+#define FILE_ATTR_REPARSE_POINT 0x0400
+#define FILE_NAME_DOS		2
+
+// 100 ns intervals from 1601-01-01 to 1970-01-01
+#define NTFS_TIME_OFFSET	116444736000000000LL
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    inline quint16 le16( const uchar * pos ) { return qFromLittleEndian<quint16>( pos ); }
+    inline quint32 le32( const uchar * pos ) { return qFromLittleEndian<quint32>( pos ); }
+    inline quint64 le64( const uchar * pos ) { return qFromLittleEndian<quint64>( pos ); }
+
+
+    /**
+     * Convert an NTFS timestamp to time_t.
+     **/
+    time_t ntfsTime( quint64 ntfsTime )
+    {
+	return (time_t) ( ( (qint64) ntfsTime - NTFS_TIME_OFFSET ) / 10000000LL );
+    }
+
+
+    /**
+     * Decode a little-endian UTF-16 name of 'len' characters.
+     **/
+    QString utf16Name( const uchar * pos, int len )
+    {
+	QString name;
+	name.reserve( len );
+
+	for ( int i = 0; i < len; ++i )
+	    name += QChar( le16( pos + 2 * i ) );
+
+	return name;
+    }
+
+
+    struct LinkParentLess
+    {
+	template<typename LINK>
+	bool operator()( const LINK & link1, const LINK & link2 ) const
+	    { return link1.parent < link2.parent; }
+
+	template<typename LINK>
+	bool operator()( const LINK & link, quint32 parent ) const
+	    { return link.parent < parent; }
+
+	template<typename LINK>
+	bool operator()( quint32 parent, const LINK & link ) const
+	    { return parent < link.parent; }
+    };
+}
+
+
+NtfsMftReader::NtfsMftReader( const QString & imageName,
+			      const QString & url,
+			      DirTree *	      tree ):
+    _imageName( imageName ),
+    _url( url ),
+    _tree( tree ),
+    _fd( -1 ),
+    _ok( false ),
+    _atEnd( false ),
+    _recordsDone( false ),
+    _clusterSize( 0 ),
+    _recordSize( 0 ),
+    _extentNo( 0 ),
+    _extentPos( 0 ),
+    _recordNo( 0 ),
+    _damagedRecords( 0 ),
+    _readMillisec( 0 )
+{
+    CHECK_PTR( _tree );
+
+    _fd = ::open( QFile::encodeName( _imageName ), O_RDONLY | O_CLOEXEC );
+
+    if ( _fd < 0 )
+    {
+	logError() << "Can't open " << _imageName << ": " << strerror( errno ) << endl;
+	return;
+    }
+
+    _ok = openVolume();
+
+    if ( ! _ok )
+	close();
+}
+
+
+NtfsMftReader::~NtfsMftReader()
+{
+    if ( ! _tree->beingDestroyed() )
+    {
+	foreach ( DirInfo * dir, _pendingDirs )
+	    finishDir( dir, DirAborted );
+    }
+
+    close();
+}
+
+
+void NtfsMftReader::close()
+{
+    if ( _fd >= 0 )
+	::close( _fd );
+
+    _fd = -1;
+}
+
+
+bool NtfsMftReader::openVolume()
+{
+    uchar boot[ NTFS_FIXUP_STRIDE ];
+
+    if ( pread( _fd, boot, sizeof( boot ), 0 ) != (ssize_t) sizeof( boot ) ||
+	 memcmp( boot + 3, "NTFS    ", 8 ) != 0 )
+    {
+	logError() << _imageName << " is not an NTFS volume" << endl;
+	return false;
+    }
+
+    int bytesPerSector	  = le16( boot + 0x0B );
+    int sectorsPerCluster = boot[ 0x0D ];
+
+    if ( sectorsPerCluster > 0x80 )	// Negative: 2^-n
+	sectorsPerCluster = 1 << ( 256 - sectorsPerCluster );
+
+    _clusterSize = bytesPerSector * sectorsPerCluster;
+
+    qint8 clustersPerRecord = (qint8) boot[ 0x40 ];
+    _recordSize = clustersPerRecord < 0 ?
+	1 << -clustersPerRecord : clustersPerRecord * _clusterSize;
+
+    if ( bytesPerSector < 256 || _clusterSize <= 0 ||
+	 _recordSize < NTFS_FIXUP_STRIDE || _recordSize > 64 * 1024 ||
+	 _recordSize % NTFS_FIXUP_STRIDE != 0 )
+    {
+	logError() << "Unexpected NTFS geometry in " << _imageName << endl;
+	return false;
+    }
+
+    // The first MFT record is the one of the MFT itself with its extents
+
+    qint64     mftOffset = (qint64) le64( boot + 0x30 ) * _clusterSize;
+    QByteArray buffer( _recordSize, 0 );
+    uchar *    data = (uchar *) buffer.data();
+
+    if ( pread( _fd, data, _recordSize, mftOffset ) != _recordSize ||
+	 memcmp( data, "FILE", 4 ) != 0 || ! applyFixups( data ) )
+    {
+	logError() << "Can't read the MFT of " << _imageName << endl;
+	return false;
+    }
+
+    const uchar * end	 = data + qMin( le32( data + 0x18 ), (quint32) _recordSize );
+    const uchar * attr	 = data + le16( data + 0x14 );
+    qint64	  mftSize = -1;
+
+    while ( attr + 0x10 <= end && le32( attr ) != AT_END )
+    {
+	quint32 len = le32( attr + 4 );
+
+	if ( len < 0x10 || attr + len > end )
+	    break;
+
+	if ( le32( attr ) == AT_DATA && attr[ 8 ] && attr[ 9 ] == 0 && len >= 0x40 )
+	{
+	    if ( ! decodeRunList( attr, attr + len, _extents ) )
+		break;
+
+	    mftSize = le64( attr + 0x30 );
+	    break;
+	}
+
+	attr += len;
+    }
+
+    if ( mftSize <= 0 || _extents.isEmpty() )
+    {
+	logError() << "No usable MFT data in " << _imageName << endl;
+	return false;
+    }
+
+    // The extents of a very fragmented MFT might continue in another
+    // record (an $ATTRIBUTE_LIST); the records beyond what is known here
+    // are simply not read.
+
+    _records.resize( mftSize / _recordSize );
+    _buffer.resize( NTFS_READ_CHUNK_RECORDS * _recordSize );
+
+    logInfo() << "Reading " << _imageName << ": " << _records.size() << " MFT records in "
+	      << _extents.size() << " extents" << endl;
+
+    return true;
+}
+
+
+bool NtfsMftReader::decodeRunList( const uchar *	   attr,
+				   const uchar *	   end,
+				   QVector<Extent> & extents ) const
+{
+    const uchar * pos = attr + le16( attr + 0x20 );
+    qint64	  lcn = 0;
+
+    while ( pos < end && *pos )
+    {
+	int lenBytes = *pos & 0x0F;
+	int offBytes = *pos >> 4;
+	++pos;
+
+	// A run without an offset is sparse: Not for the MFT
+
+	if ( lenBytes == 0 || lenBytes > 8 || offBytes == 0 || offBytes > 8 ||
+	     pos + lenBytes + offBytes > end )
+	{
+	    return false;
+	}
+
+	quint64 length = 0;
+
+	for ( int i = 0; i < lenBytes; ++i )
+	    length |= (quint64) pos[ i ] << ( 8 * i );
+
+	pos += lenBytes;
+	quint64 delta = 0;
+
+	for ( int i = 0; i < offBytes; ++i )
+	    delta |= (quint64) pos[ i ] << ( 8 * i );
+
+	if ( offBytes < 8 && ( pos[ offBytes - 1 ] & 0x80 ) )	// Negative
+	    delta |= ~0ULL << ( 8 * offBytes );
+
+	pos += offBytes;
+	lcn += (qint64) delta;
+
+	Extent extent;
+	extent.offset = lcn * _clusterSize;
+	extent.length = (qint64) length * _clusterSize;
+	extents << extent;
+    }
+
+    return true;
+}
+
+
+bool NtfsMftReader::applyFixups( uchar * data ) const
+{
+    // The last two bytes of each 512 byte block are stored in the update
+    // sequence array; the block has the update sequence number instead.
+
+    int usaOffset = le16( data + 4 );
+    int usaCount  = le16( data + 6 );
+
+    if ( usaCount < 1 || usaOffset + 2 * usaCount > _recordSize ||
+	 ( usaCount - 1 ) * NTFS_FIXUP_STRIDE > _recordSize )
+    {
+	return false;
+    }
+
+    const uchar * usa = data + usaOffset;
+
+    for ( int i = 1; i < usaCount; ++i )
+    {
+	uchar * pos = data + i * NTFS_FIXUP_STRIDE - 2;
+
+	if ( memcmp( pos, usa, 2 ) != 0 )	// Torn write
+	    return false;
+
+	memcpy( pos, usa + 2 * i, 2 );
+    }
+
+    return true;
+}
+
+
+void NtfsMftReader::readFor( int millisec )
+{
+    if ( ! _ok || _atEnd )
+	return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if ( ! _recordsDone )
+    {
+	bool done = readRecords( timer, millisec );
+	_readMillisec += timer.elapsed();
+
+	if ( ! _ok || ! done )
+	    return;
+
+	_recordsDone = true;
+	close();
+
+	logInfo() << "Read " << _recordNo << " MFT records of " << _imageName
+		  << " in " << _readMillisec / 1000.0 << " sec" << endl;
+
+	if ( _damagedRecords > 0 )
+	    logWarning() << _damagedRecords << " damaged MFT records" << endl;
+
+	std::sort( _links.begin(), _links.end(), LinkParentLess() );
+	createToplevel();
+    }
+
+    while ( _ok && ! _pendingDirs.isEmpty() && ! timer.hasExpired( millisec ) )
+    {
+	quint32	  recordNo = _pendingDirs.firstKey();
+	DirInfo * dir	   = _pendingDirs.take( recordNo );
+
+	buildDir( recordNo, dir );
+    }
+
+    if ( _pendingDirs.isEmpty() )
+    {
+	_atEnd = true;
+	_records.clear();
+	_records.squeeze();
+	_links.clear();
+	_links.squeeze();
+    }
+}
+
+
+bool NtfsMftReader::readRecords( const QElapsedTimer & timer, int millisec )
+{
+    do
+    {
+	if ( _recordNo >= (quint32) _records.size() )
+	    return true;
+
+	if ( _extentNo >= _extents.size() )
+	{
+	    logWarning() << "Only " << _recordNo << " MFT records in the known extents" << endl;
+	    _records.resize( _recordNo );
+	    return true;
+	}
+
+	const Extent & extent = _extents.at( _extentNo );
+	qint64 chunk = qMin( extent.length - _extentPos, (qint64) _buffer.size() );
+	chunk = qMin( chunk, (qint64) ( _records.size() - _recordNo ) * _recordSize );
+	chunk -= chunk % _recordSize;
+
+	if ( chunk <= 0 )	// Less than one record left in this extent
+	{
+	    logError() << "Unexpected MFT layout in " << _imageName << endl;
+	    _ok = false;
+	    return false;
+	}
+
+	if ( pread( _fd, _buffer.data(), chunk, extent.offset + _extentPos ) != chunk )
+	{
+	    logError() << "Can't read the MFT of " << _imageName << ": " << strerror( errno ) << endl;
+	    _ok = false;
+	    return false;
+	}
+
+	for ( qint64 pos = 0; pos < chunk; pos += _recordSize )
+	    parseRecord( _recordNo++, (uchar *) _buffer.data() + pos );
+
+	_extentPos += chunk;
+
+	if ( _extentPos >= extent.length )
+	{
+	    ++_extentNo;
+	    _extentPos = 0;
+	}
+    }
+    while ( ! timer.hasExpired( millisec ) );
+
+    return false;
+}
+
+
+void NtfsMftReader::parseRecord( quint32 recordNo, uchar * data )
+{
+    if ( memcmp( data, "FILE", 4 ) != 0 )	// Never used
+	return;
+
+    quint16 headerFlags = le16( data + 0x16 );
+
+    if ( ! ( headerFlags & MFT_RECORD_IN_USE ) )
+	return;
+
+    if ( ! applyFixups( data ) )
+    {
+	++_damagedRecords;
+	return;
+    }
+
+    // The attributes of an extension record belong to its base record
+
+    quint64 baseRecordNo = le64( data + 0x20 ) & NTFS_REF_MASK;
+
+    if ( baseRecordNo >= (quint64) _records.size() )
+	return;
+
+    if ( baseRecordNo == 0 )
+    {
+	Record & record = _records[ recordNo ];
+	record.flags   |= NTFS_RECORD_IN_USE;
+	record.sequence = le16( data + 0x10 );
+
+	if ( headerFlags & MFT_RECORD_IS_DIR )
+	    record.flags |= NTFS_RECORD_IS_DIR;
+    }
+    else
+    {
+	recordNo = (quint32) baseRecordNo;
+    }
+
+    Record &	  record = _records[ recordNo ];
+    const uchar * end	 = data + qMin( le32( data + 0x18 ), (quint32) _recordSize );
+    const uchar * attr	 = data + le16( data + 0x14 );
+
+    while ( attr + 0x10 <= end && le32( attr ) != AT_END )
+    {
+	quint32 type	    = le32( attr );
+	quint32 len	    = le32( attr + 4 );
+	bool	nonResident = attr[ 8 ];
+
+	if ( len < 0x10 || attr + len > end )
+	{
+	    ++_damagedRecords;
+	    return;
+	}
+
+	const uchar * value    = 0;
+	quint32	      valueLen = 0;
+
+	if ( nonResident )
+	{
+	    if ( len < 0x40 )
+	    {
+		attr += len;
+		continue;
+	    }
+	}
+	else if ( len >= 0x18 )
+	{
+	    valueLen = le32( attr + 0x10 );
+	    value    = attr + le16( attr + 0x14 );
+
+	    if ( value + valueLen > attr + len )
+		value = 0;
+	}
+
+	switch ( type )
+	{
+	    case AT_STANDARD_INFORMATION:
+
+		if ( value && valueLen >= 0x24 )
+		{
+		    record.mtime = ntfsTime( le64( value + 0x08 ) );
+
+		    if ( le32( value + 0x20 ) & FILE_ATTR_REPARSE_POINT )
+			record.flags |= NTFS_RECORD_IS_REPARSE_POINT;
+		}
+		break;
+
+	    case AT_FILE_NAME:
+
+		if ( value && valueLen >= 0x42 )
+		{
+		    int nameLen = value[ 0x40 ];
+
+		    // Skip the generated 8.3 names
+
+		    if ( value[ 0x41 ] == FILE_NAME_DOS || 0x42 + 2U * nameLen > valueLen )
+			break;
+
+		    quint64 parentRef = le64( value );
+
+		    if ( ( parentRef & NTFS_REF_MASK ) > 0xFFFFFFFFULL )
+			break;
+
+		    Link link;
+		    link.record		= recordNo;
+		    link.parent		= (quint32) ( parentRef & NTFS_REF_MASK );
+		    link.parentSequence = (quint16) ( parentRef >> 48 );
+		    link.name		= utf16Name( value + 0x42, nameLen );
+
+		    _links << link;
+		    ++record.links;
+		}
+		break;
+
+	    case AT_DATA:
+
+		// Only the unnamed stream, not any alternate data streams
+
+		if ( attr[ 9 ] != 0 )
+		    break;
+
+		if ( ! nonResident )
+		{
+		    record.size = valueLen;	// Stored in the MFT record
+		}
+		else if ( le64( attr + 0x10 ) == 0 )	// The first part
+		{
+		    quint16 flags = le16( attr + 0x0C );
+		    record.size = le64( attr + 0x30 );
+
+		    if ( ( flags & ( ATTR_IS_COMPRESSED | ATTR_IS_SPARSE ) ) && len >= 0x48 )
+			record.allocated = le64( attr + 0x40 );
+		    else
+			record.allocated = le64( attr + 0x28 );
+		}
+		break;
+
+	    case AT_INDEX_ALLOCATION:
+
+		if ( nonResident && le64( attr + 0x10 ) == 0 )
+		{
+		    record.size	     = le64( attr + 0x30 );
+		    record.allocated = le64( attr + 0x28 );
+		}
+		break;
+
+	    default:
+		break;
+	}
+
+	attr += len;
+    }
+}
+
+
+void NtfsMftReader::toStat( quint32 recordNo, struct stat * statInfo ) const
+{
+    const Record & record = _records.at( recordNo );
+    memset( statInfo, 0, sizeof( struct stat ) );
+
+    if ( record.flags & NTFS_RECORD_IS_REPARSE_POINT )	     // Symlinks, junctions
+	statInfo->st_mode = S_IFLNK | 0777;
+    else if ( record.flags & NTFS_RECORD_IS_DIR )
+	statInfo->st_mode = S_IFDIR | 0755;
+    else
+	statInfo->st_mode = S_IFREG | 0644;
+
+    // All from the same device that is not on this machine
+
+    statInfo->st_dev	= 0;
+    statInfo->st_ino	= recordNo;
+    statInfo->st_nlink	= qMax( record.links, (quint16) 1 );
+    statInfo->st_size	= record.size;
+    statInfo->st_blocks = ( record.allocated + STD_BLOCK_SIZE - 1 ) / STD_BLOCK_SIZE;
+    statInfo->st_mtime	= record.mtime;
+}
+
+
+void NtfsMftReader::createToplevel()
+{
+    if ( _records.size() <= NTFS_ROOT_RECORD ||
+	 ( _records.at( NTFS_ROOT_RECORD ).flags & NTFS_RECORD_IS_DIR ) == 0 )
+    {
+	logError() << "No root directory in " << _imageName << endl;
+	_ok = false;
+	return;
+    }
+
+    struct stat statInfo;
+    toStat( NTFS_ROOT_RECORD, &statInfo );
+
+    DirInfo * toplevel = new DirInfo( _url, &statInfo, _tree, _tree->root() );
+    CHECK_NEW( toplevel );
+
+    toplevel->setReadState( DirReading );
+    _tree->root()->insertChild( toplevel );
+    _tree->childAddedNotify( toplevel );
+
+    _records[ NTFS_ROOT_RECORD ].flags |= NTFS_RECORD_SEEN;
+    _pendingDirs.insert( NTFS_ROOT_RECORD, toplevel );
+}
+
+
+void NtfsMftReader::buildDir( quint32 recordNo, DirInfo * dir )
+{
+    QVector<Link>::const_iterator it =
+	std::lower_bound( _links.constBegin(), _links.constEnd(), recordNo, LinkParentLess() );
+    quint16 sequence = _records.at( recordNo ).sequence;
+
+    for ( ; it != _links.constEnd() && it->parent == recordNo; ++it )
+    {
+	// The root directory is its own parent. A different sequence number
+	// means the name is from a directory that was deleted since.
+
+	if ( it->record == recordNo || it->parentSequence != sequence )
+	    continue;
+
+	Record & record = _records[ it->record ];
+
+	if ( ! ( record.flags & NTFS_RECORD_IN_USE ) )
+	    continue;
+
+	struct stat statInfo;
+	toStat( it->record, &statInfo );
+
+	if ( S_ISDIR( statInfo.st_mode ) )
+	{
+	    if ( record.flags & NTFS_RECORD_SEEN )
+	    {
+		logError() << "Directory loop at " << dir->url() << "/" << it->name << endl;
+		continue;
+	    }
+
+	    DirInfo * subDir = new DirInfo( it->name, &statInfo, _tree, dir );
+	    CHECK_NEW( subDir );
+
+	    subDir->setReadState( DirReading );
+	    dir->insertChild( subDir );
+	    _tree->childAddedNotify( subDir );
+
+	    record.flags |= NTFS_RECORD_SEEN;
+	    _pendingDirs.insert( it->record, subDir );
+	}
+	else
+	{
+	    FileInfo * item = new FileInfo( it->name, &statInfo, _tree, dir );
+	    CHECK_NEW( item );
+
+	    dir->insertChild( item );
+	    _tree->childAddedNotify( item );
+	}
+    }
+
+    finishDir( dir, DirCached );
+}
+
+
+void NtfsMftReader::finishDir( DirInfo * dir, DirReadState readState )
+{
+    dir->setReadState( readState );
+    dir->finalizeLocal();
+    _tree->sendReadJobFinished( dir );
+}
+
+
+void NtfsMftReader::forgetSubtree( FileInfo * subtree )
+{
+    QMutableMapIterator<quint32, DirInfo *> it( _pendingDirs );
+
+    while ( it.hasNext() )
+    {
+	if ( it.next().value()->isInSubtree( subtree ) )
+	    it.remove();
+    }
+}
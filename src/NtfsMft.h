@@ -0,0 +1,225 @@
+/*
+ *   File name: NtfsMft.h
+ *   Summary:	Reading the MFT of NTFS volumes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef NtfsMft_h
+#define NtfsMft_h
+
+
+#include <sys/types.h>
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"		// FileSize
+
+
+// URLs of NTFS volumes or images: "ntfs:/dev/sda2", "ntfs:/images/c.img"
+#define NTFS_URL_PREFIX			"ntfs:"
+
+// Milliseconds that an NtfsReadJob reads in each time slice
+#define NTFS_READ_SLICE_MILLISEC	50
+
+// Number of MFT records that are read from the volume at once
+#define NTFS_READ_CHUNK_RECORDS		1024
+
+// Flags of NtfsMftReader::Record
+#define NTFS_RECORD_IN_USE		0x0001
+#define NTFS_RECORD_IS_DIR		0x0002
+#define NTFS_RECORD_IS_REPARSE_POINT	0x0004
+#define NTFS_RECORD_SEEN		0x0008	// Directory is in the tree
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+
+    /**
+     * Reader for the Master File Table of an NTFS volume or image (see
+     * NtfsReadJob). The MFT has one record for each file with its names
+     * and the references to their parent directories, its size and its
+     * timestamps, so one sequential pass over the MFT is all it takes to
+     * know the whole tree; the directory indexes are never read.
+     *
+     * This works in two phases, each in time slices (see readFor()):
+     *
+     *	 - The records of the MFT are read in large chunks, in the order
+     *	   of the MFT's extents on the disk, and a compact table of the
+     *	   attributes and the names of all records in use is built.
+     *
+     *	 - The tree is built from that table in memory, starting with the
+     *	   root directory (record 5).
+     *
+     * The volume is only opened for reading. NTFS has no Unix owners, so
+     * the directories are marked as DirCached.
+     **/
+    class NtfsMftReader
+    {
+    public:
+
+	/**
+	 * Constructor: Open 'imageName' and read it into a new toplevel
+	 * directory 'url' below the root of 'tree'. Check ok() afterwards.
+	 **/
+	NtfsMftReader( const QString & imageName,
+		       const QString & url,
+		       DirTree *       tree );
+
+	/**
+	 * Destructor. If reading is not finished yet, the directories that
+	 * are not read yet are marked as aborted.
+	 **/
+	virtual ~NtfsMftReader();
+
+	/**
+	 * Return 'true' if everything went fine so far.
+	 **/
+	bool ok() const { return _ok; }
+
+	/**
+	 * Return 'true' if the whole tree is built.
+	 **/
+	bool atEnd() const { return _atEnd; }
+
+	/**
+	 * Continue reading for about 'millisec' milliseconds.
+	 **/
+	void readFor( int millisec );
+
+	/**
+	 * Forget about any directories in 'subtree' that are not built yet:
+	 * That subtree is about to be deleted.
+	 **/
+	void forgetSubtree( FileInfo * subtree );
+
+
+    protected:
+
+	/**
+	 * One extent of the MFT on the volume.
+	 **/
+	struct Extent
+	{
+	    qint64 offset;	// Bytes
+	    qint64 length;	// Bytes
+	};
+
+	/**
+	 * What QDirStat uses of one MFT record.
+	 **/
+	struct Record
+	{
+	    FileSize size;
+	    FileSize allocated;
+	    time_t   mtime;
+	    quint16  flags;	// NTFS_RECORD_*
+	    quint16  sequence;
+	    quint16  links;	// Names other than DOS 8.3 names
+	};
+
+	/**
+	 * One name of a file in a directory.
+	 **/
+	struct Link
+	{
+	    quint32 record;
+	    quint32 parent;
+	    quint16 parentSequence;
+	    QString name;
+	};
+
+	/**
+	 * Read the boot sector and the first record of the MFT with the
+	 * extents of the MFT.
+	 **/
+	bool openVolume();
+
+	/**
+	 * Read MFT records until 'timer' has run 'millisec' milliseconds.
+	 * Return 'true' when all are done.
+	 **/
+	bool readRecords( const QElapsedTimer & timer, int millisec );
+
+	/**
+	 * Parse MFT record 'recordNo' in 'data'.
+	 **/
+	void parseRecord( quint32 recordNo, uchar * data );
+
+	/**
+	 * Apply the update sequence ("fixups") to the MFT record in 'data'.
+	 * Return 'false' if it is damaged.
+	 **/
+	bool applyFixups( uchar * data ) const;
+
+	/**
+	 * Decode the runlist ("mapping pairs") of a non-resident attribute
+	 * into extents. Return 'false' if it is damaged.
+	 **/
+	bool decodeRunList( const uchar *	 attr,
+			    const uchar *	 end,
+			    QVector<Extent> & extents ) const;
+
+	/**
+	 * Create the toplevel directory from the root directory record.
+	 **/
+	void createToplevel();
+
+	/**
+	 * Create the children of directory record 'recordNo' in 'dir'.
+	 **/
+	void buildDir( quint32 recordNo, DirInfo * dir );
+
+	/**
+	 * Fill 'statInfo' for record 'recordNo'.
+	 **/
+	void toStat( quint32 recordNo, struct stat * statInfo ) const;
+
+	/**
+	 * Mark 'dir' as read with 'readState' and notify the tree.
+	 **/
+	void finishDir( DirInfo * dir, DirReadState readState );
+
+	/**
+	 * Close the volume.
+	 **/
+	void close();
+
+
+	QString			 _imageName;
+	QString			 _url;
+	DirTree *		 _tree;
+	int			 _fd;
+	bool			 _ok;
+	bool			 _atEnd;
+	bool			 _recordsDone;
+
+	int			 _clusterSize;
+	int			 _recordSize;
+	QVector<Extent>		 _extents;
+	int			 _extentNo;
+	qint64			 _extentPos;
+	quint32			 _recordNo;
+	QByteArray		 _buffer;
+
+	QVector<Record>		 _records;	// By record number
+	QVector<Link>		 _links;	// Sorted by parent when done
+	QMap<quint32, DirInfo *> _pendingDirs;	// By record number
+	int			 _damagedRecords;
+	qint64			 _readMillisec;
+
+    };	// class NtfsMftReader
+
+}	// namespace QDirStat
+
+
+#endif	// NtfsMft_h
@@ -9,13 +9,13 @@
 
 #include <QPushButton>
 #include <QDir>
-#include <QFileSystemModel>
 #include <QTimer>
 
 #include "Qt4Compat.h"
 
 #include "OpenDirDialog.h"
 #include "MountPoints.h"
+#include "DirListModel.h"
 #include "ExistingDirCompleter.h"
 #include "ExistingDirValidator.h"
 #include "Settings.h"
@@ -45,7 +45,7 @@ bool OpenDirDialog::_crossFilesystems = false;
 OpenDirDialog::OpenDirDialog( QWidget * parent ):
     QDialog( parent ),
     _ui( new Ui::OpenDirDialog ),
-    _filesystemModel( new QFileSystemModel( this ) ),
+    _filesystemModel( new DirListModel( this ) ),
     _settingPath( false )
 {
     CHECK_NEW( _ui );
@@ -95,17 +95,7 @@ void OpenDirDialog::initPathComboBox()
 
 void OpenDirDialog::initDirTree()
 {
-    _filesystemModel->setRootPath( "/" );
-    _filesystemModel->setFilter( QDir::Dirs       |
-                                 QDir::NoDot      |
-                                 QDir::NoDotDot   |
-                                 QDir::NoSymLinks |
-                                 QDir::Drives      );
-
     _ui->dirTreeView->setModel( _filesystemModel );
-    _ui->dirTreeView->hideColumn( 3 );  // Date Modified
-    _ui->dirTreeView->hideColumn( 2 );  // Type
-    _ui->dirTreeView->hideColumn( 1 );  // Size
     _ui->dirTreeView->setHeaderHidden( true );
 }
 
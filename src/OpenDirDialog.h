@@ -15,11 +15,11 @@
 
 #include "ui_open-dir-dialog.h"
 
-class QFileSystemModel;
 
 
 namespace QDirStat
 {
+    class DirListModel;
     class ExistingDirValidator;
 
     /**
@@ -130,7 +130,7 @@ namespace QDirStat
 
 
 	Ui::OpenDirDialog *     _ui;
-        QFileSystemModel *      _filesystemModel;
+        DirListModel *          _filesystemModel;
 	QPushButton *           _okButton;
         ExistingDirValidator *  _validator;
         bool                    _settingPath;
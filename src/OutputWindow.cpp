@@ -9,6 +9,7 @@
 
 #include <QApplication>
 #include <QCloseEvent>
+#include <QTextDocument>
 #include <QTimer>
 
 #include "OutputWindow.h"
@@ -23,6 +24,10 @@ using QDirStat::readFontEntry;
 using QDirStat::writeFontEntry;
 
 
+// Interval for adding the collected output to the output area
+#define FLUSH_MILLISEC	50
+
+
 #define CONNECT_ACTION(ACTION, RECEIVER, RCVR_SLOT) \
     connect( (ACTION), SIGNAL( triggered() ), (RECEIVER), SLOT( RCVR_SLOT ) )
 
@@ -34,7 +39,9 @@ OutputWindow::OutputWindow( QWidget * parent ):
     _noMoreProcesses( false ),
     _closed( false ),
     _killedAll( false ),
-    _errorCount( 0 )
+    _errorCount( 0 ),
+    _maxParallel( 1 ),
+    _maxLines( 0 )
 {
     _ui->setupUi( this );
     logDebug() << "Creating" << endl;
@@ -43,6 +50,12 @@ OutputWindow::OutputWindow( QWidget * parent ):
     _ui->terminal->clear();
     setAutoClose( false );
 
+    _flushTimer.setSingleShot( true );
+    _flushTimer.setInterval( FLUSH_MILLISEC );
+
+    connect( &_flushTimer, SIGNAL( timeout()	),
+	     this,	   SLOT	 ( flushText() ) );
+
     CONNECT_ACTION( _ui->actionZoomIn,	    this, zoomIn()    );
     CONNECT_ACTION( _ui->actionZoomOut,	    this, zoomOut()   );
     CONNECT_ACTION( _ui->actionResetZoom,   this, resetZoom() );
@@ -97,8 +110,7 @@ void OutputWindow::addProcess( Process * process )
     connect( process, SIGNAL( finished	     ( int, QProcess::ExitStatus ) ),
 	     this,    SLOT  ( processFinished( int, QProcess::ExitStatus ) ) );
 
-    if ( ! hasActiveProcess() )
-	startNextProcess();
+    startNextProcess();
 }
 
 
@@ -116,8 +128,14 @@ void OutputWindow::addStdout( const QString output )
 
 void OutputWindow::addStderr( const QString output )
 {
-    _errorCount++;
     addText( output, _stderrColor );
+    noteStderr( output );
+}
+
+
+void OutputWindow::noteStderr( const QString & output )
+{
+    _errorCount++;
     logWarning() << output << ( output.endsWith( "\n" ) ? "" : "\n" );
 
     if ( _showOnStderr && ! isVisible() && ! _closed )
@@ -125,6 +143,39 @@ void OutputWindow::addStderr( const QString output )
 }
 
 
+void OutputWindow::addProcessText( Process *	   process,
+				   const QString & text,
+				   const QColor &  textColor )
+{
+    if ( _maxParallel > 1 && process )
+	_processOutput[ process ] << qMakePair( text, textColor );
+    else
+	addText( text, textColor );
+}
+
+
+void OutputWindow::flushProcessOutput( Process * process )
+{
+    if ( _maxParallel <= 1 || ! process )
+	return;
+
+    QString dir = process->workingDirectory();
+
+    if ( dir != _lastWorkingDir )
+    {
+	addCommandLine( "cd " + dir );
+	_lastWorkingDir = dir;
+    }
+
+    addCommandLine( command( process ) );
+
+    typedef QPair<QString, QColor> OutputChunk;
+
+    foreach ( const OutputChunk & chunk, _processOutput.take( process ) )
+	addText( chunk.first, chunk.second );
+}
+
+
 void OutputWindow::addText( const QString & rawText, const QColor & textColor )
 {
     if ( rawText.isEmpty() )
@@ -135,18 +186,47 @@ void OutputWindow::addText( const QString & rawText, const QColor & textColor )
     if ( ! text.endsWith( "\n" ) )
 	text += "\n";
 
-    _ui->terminal->moveCursor( QTextCursor::End );
-    QTextCursor cursor( _ui->terminal->textCursor() );
+    if ( ! _pendingText.isEmpty() && _pendingText.last().second == textColor )
+	_pendingText.last().first += text;
+    else
+	_pendingText << qMakePair( text, textColor );
 
-    QTextCharFormat format;
-    format.setForeground( QBrush( textColor ) );
-    cursor.setCharFormat( format );
-    cursor.insertText( text );
+    if ( ! _flushTimer.isActive() )
+	_flushTimer.start();
+}
+
+
+void OutputWindow::flushText()
+{
+    if ( _pendingText.isEmpty() )
+	return;
+
+    QTextCursor cursor( _ui->terminal->document() );
+    cursor.movePosition( QTextCursor::End );
+    cursor.beginEditBlock();
+
+    typedef QPair<QString, QColor> TextChunk;
+
+    foreach ( const TextChunk & chunk, _pendingText )
+    {
+	QTextCharFormat format;
+	format.setForeground( QBrush( chunk.second ) );
+	cursor.setCharFormat( format );
+	cursor.insertText( chunk.first );
+    }
+
+    cursor.endEditBlock();
+    _pendingText.clear();
+
+    // Scroll to the end
+
+    _ui->terminal->moveCursor( QTextCursor::End );
 }
 
 
 void OutputWindow::clearOutput()
 {
+    _pendingText.clear();
     _ui->terminal->clear();
 }
 
@@ -178,7 +258,7 @@ void OutputWindow::readStdout()
     Process * process = senderProcess( __FUNCTION__ );
 
     if ( process )
-	addStdout( QString::fromUtf8( process->readAllStandardOutput() ) );
+	addProcessText( process, QString::fromUtf8( process->readAllStandardOutput() ), _stdoutColor );
 }
 
 
@@ -187,17 +267,25 @@ void OutputWindow::readStderr()
     Process * process = senderProcess( __FUNCTION__ );
 
     if ( process )
-	addStderr( QString::fromUtf8( process->readAllStandardError() ) );
+    {
+	QString output = QString::fromUtf8( process->readAllStandardError() );
+
+	addProcessText( process, output, _stderrColor );
+	noteStderr( output );
+    }
 }
 
 
 void OutputWindow::processFinished( int exitCode, QProcess::ExitStatus exitStatus )
 {
+    Process * process = senderProcess( __FUNCTION__ );
+    QString   error;
+
     switch ( exitStatus )
     {
 	case QProcess::NormalExit:
 	    logDebug() << "Process finished normally." << endl;
-	    addCommandLine( tr( "Process finished." ) );
+	    addProcessText( process, tr( "Process finished." ), _commandTextColor );
 	    break;
 
 	case QProcess::CrashExit:
@@ -210,20 +298,25 @@ void OutputWindow::processFinished( int exitCode, QProcess::ExitStatus exitStatu
 		// crashed or could not be started.
 
 		logError() << "Process crashed." << endl;
-		addStderr( tr( "Process crashed." ) );
+		error = tr( "Process crashed." );
 	    }
 	    else
 	    {
 		logError() << "Process crashed. Exit code: " << exitCode << endl;
-		addStderr( tr( "Process crashed. Exit code: %1" ).arg( exitCode ) );
+		error = tr( "Process crashed. Exit code: %1" ).arg( exitCode );
 	    }
 	    break;
     }
 
-    Process * process = senderProcess( __FUNCTION__ );
+    if ( ! error.isEmpty() )
+    {
+	addProcessText( process, error, _stderrColor );
+	noteStderr( error );
+    }
 
     if ( process )
     {
+	flushProcessOutput( process );
 	_processList.removeAll( process );
 
 	if ( _processList.isEmpty() && _noMoreProcesses )
@@ -270,16 +363,18 @@ void OutputWindow::processError( QProcess::ProcessError error )
 	    break;
     }
 
+    Process * process = senderProcess( __FUNCTION__ );
+
     if ( ! msg.isEmpty() )
     {
 	logError() << msg << endl;
-	addStderr( msg );
+	addProcessText( process, msg, _stderrColor );
+	noteStderr( msg );
     }
 
-    Process * process = senderProcess( __FUNCTION__ );
-
     if ( process )
     {
+	flushProcessOutput( process );
 	_processList.removeAll( process );
 
 	if ( _processList.isEmpty() && _noMoreProcesses )
@@ -374,6 +469,7 @@ void OutputWindow::killAll()
     {
 	logInfo() << "Killing process " << process << endl;
 	process->kill();
+	flushProcessOutput( process );
 	_processList.removeAll( process );
 	process->deleteLater();
 	++killCount;
@@ -411,6 +507,23 @@ bool OutputWindow::hasActiveProcess() const
 }
 
 
+int OutputWindow::runningCount() const
+{
+    int count = 0;
+
+    foreach ( Process * process, _processList )
+    {
+	if ( process->state() == QProcess::Starting ||
+	     process->state() == QProcess::Running )
+	{
+	    ++count;
+	}
+    }
+
+    return count;
+}
+
+
 Process * OutputWindow::pickQueuedProcess()
 {
     foreach ( Process * process, _processList )
@@ -425,19 +538,23 @@ Process * OutputWindow::pickQueuedProcess()
 
 Process * OutputWindow::startNextProcess()
 {
-    Process * process = pickQueuedProcess();
+    Process * process = runningCount() < _maxParallel ? pickQueuedProcess() : 0;
 
     if ( process )
     {
-	QString dir = process->workingDirectory();
-
-	if ( dir != _lastWorkingDir )
+	if ( _maxParallel <= 1 ) // Otherwise with the output when it's finished
 	{
-	    addCommandLine( "cd " + dir );
-	    _lastWorkingDir = dir;
+	    QString dir = process->workingDirectory();
+
+	    if ( dir != _lastWorkingDir )
+	    {
+		addCommandLine( "cd " + dir );
+		_lastWorkingDir = dir;
+	    }
+
+	    addCommandLine( command( process ) );
 	}
 
-	addCommandLine( command( process ) );
 	logInfo() << "Starting: " << process << endl;
 
 	process->start();
@@ -525,10 +642,16 @@ void OutputWindow::readSettings()
     _stderrColor	 = readColorEntry( settings, "StdErrTextColor"	 , QColor( Qt::red    ) );
     _terminalDefaultFont = readFontEntry ( settings, "TerminalFont"	 , _ui->terminal->font() );
     _defaultShowTimeout	 = settings.value( "DefaultShowTimeoutMillisec", 500 ).toInt();
+    _maxLines		 = settings.value( "MaxLines", 50000 ).toInt();
 
     settings.endGroup();
 
     _ui->terminal->setFont( _terminalDefaultFont );
+
+    // Only the last lines are kept; older ones are dropped from the top.
+    // 0 means unlimited.
+
+    _ui->terminal->document()->setMaximumBlockCount( qMax( 0, _maxLines ) );
 }
 
 
@@ -543,6 +666,7 @@ void OutputWindow::writeSettings()
     writeColorEntry( settings, "StdErrTextColor"   , _stderrColor	  );
     writeFontEntry ( settings, "TerminalFont"	   , _terminalDefaultFont );
     settings.setValue( "DefaultShowTimeoutMillisec", _defaultShowTimeout  );
+    settings.setValue( "MaxLines",		     _maxLines		  );
 
     settings.endGroup();
 }
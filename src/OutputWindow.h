@@ -10,9 +10,12 @@
 #define OutputWindow_h
 
 #include <QDialog>
+#include <QHash>
 #include <QList>
+#include <QPair>
 #include <QTextStream>
 #include <QStringList>
+#include <QTimer>
 
 #include "ui_output-window.h"
 #include "Process.h"
@@ -173,6 +176,24 @@ public:
      **/
     bool hasActiveProcess() const;
 
+    /**
+     * Return the number of processes that are running right now.
+     **/
+    int runningCount() const;
+
+    /**
+     * Return the maximum number of processes running at the same time.
+     **/
+    int maxParallel() const { return _maxParallel; }
+
+    /**
+     * Set the maximum number of processes running at the same time. With
+     * more than one, the output of each process (including its command
+     * line) is collected and shown as one block when it is finished, so
+     * the output of different processes is not mixed up. The default is 1.
+     **/
+    void setMaxParallel( int maxParallel ) { _maxParallel = qMax( 1, maxParallel ); }
+
     /**
      * Get the command of the process. Since usually processes are started via
      * a shell ("/bin/sh -c theRealCommand arg1 arg2 ..."), this is typically
@@ -270,6 +291,12 @@ protected slots:
      **/
     void timeoutShow();
 
+    /**
+     * Add the text that was collected since the last call to the output
+     * area.
+     **/
+    void flushText();
+
 
 signals:
 
@@ -303,10 +330,31 @@ protected:
 
     /**
      * Add one or more lines of text in text color 'textColor' to the output
-     * area.
+     * area. The text is collected and added in one go every few
+     * milliseconds, so a process with a lot of output does not keep the
+     * GUI busy with many small updates.
      **/
     void addText( const QString & text, const QColor & textColor );
 
+    /**
+     * Add text of 'process' in 'textColor': Right away if only one process
+     * runs at a time, otherwise to the collected output of that process.
+     **/
+    void addProcessText( Process *	 process,
+			 const QString & text,
+			 const QColor &	 textColor );
+
+    /**
+     * Show the collected output of 'process' and forget it.
+     **/
+    void flushProcessOutput( Process * process );
+
+    /**
+     * Record stderr output for the error count and the log and open the
+     * window if configured.
+     **/
+    void noteStderr( const QString & output );
+
     /**
      * Obtain the process to use from sender(). Return 0 if this is not a
      * QProcess.
@@ -320,8 +368,9 @@ protected:
     Process * pickQueuedProcess();
 
     /**
-     * Try to start the next inactive process, if there is any. Return that
-     * process or 0 if there is none.
+     * Try to start the next inactive process, if there is any and if the
+     * limit of parallel processes is not reached yet. Return that process
+     * or 0 if there is none.
      **/
     Process * startNextProcess();
 
@@ -349,6 +398,12 @@ protected:
     QColor		_stderrColor;
     QFont		_terminalDefaultFont;
     int			_defaultShowTimeout;
+    int			_maxParallel;
+    int			_maxLines;
+    QTimer		_flushTimer;
+    QList<QPair<QString, QColor> > _pendingText;
+
+    QHash<Process *, QList<QPair<QString, QColor> > > _processOutput;
 
 };	// class OutputWindow
 
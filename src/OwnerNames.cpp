@@ -0,0 +1,227 @@
+/*
+ *   File name: OwnerNames.cpp
+ *   Summary:	Cache for the names of user and group IDs
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <pwd.h>	// getpwuid_r()
+#include <grp.h>	// getgrgid_r()
+#include <errno.h>
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include "OwnerNames.h"
+#include "Exception.h"
+
+
+// Buffer for getpwuid_r() and getgrgid_r(); larger groups need more
+#define NSS_BUFFER_SIZE		16384
+#define NSS_MAX_BUFFER_SIZE	( 4 * 1024 * 1024 )
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Look up the pending names in a worker thread.
+     **/
+    class OwnerNamesLookup: public QRunnable
+    {
+    public:
+
+	virtual void run() Q_DECL_OVERRIDE
+	    { OwnerNames::instance()->lookUpPending(); }
+    };
+
+
+    qint64 now()
+    {
+	return QDateTime::currentMSecsSinceEpoch() / 1000;
+    }
+
+}	// namespace
+
+
+
+OwnerNames * OwnerNames::_instance = 0;
+
+
+OwnerNames * OwnerNames::instance()
+{
+    static QMutex mutex;
+    QMutexLocker locker( &mutex );
+
+    if ( ! _instance )
+    {
+	_instance = new OwnerNames();
+	CHECK_NEW( _instance );
+    }
+
+    return _instance;
+}
+
+
+OwnerNames::OwnerNames():
+    QObject(),
+    _lookupRunning( false )
+{
+
+}
+
+
+QString OwnerNames::userName( uid_t uid )
+{
+    OwnerNames * self = instance();
+
+    return self->name( self->_users, self->_pendingUsers, uid );
+}
+
+
+QString OwnerNames::groupName( gid_t gid )
+{
+    OwnerNames * self = instance();
+
+    return self->name( self->_groups, self->_pendingGroups, gid );
+}
+
+
+QString OwnerNames::name( EntryHash & cache, QList<uint> & pending, uint id )
+{
+    QMutexLocker locker( &_mutex );
+
+    EntryHash::iterator it = cache.find( id );
+
+    if ( it == cache.end() )
+    {
+	Entry entry;
+	entry.name    = QString::number( id );
+	entry.expires = 0;
+	entry.pending = false;
+
+	it = cache.insert( id, entry );
+    }
+
+    if ( ! it->pending && it->expires <= now() )
+    {
+	it->pending = true;
+	pending << id;
+
+	if ( ! _lookupRunning )
+	{
+	    _lookupRunning = true;
+	    QThreadPool::globalInstance()->start( new OwnerNamesLookup() );
+	}
+    }
+
+    return it->name;
+}
+
+
+void OwnerNames::lookUpPending()
+{
+    bool changed = false;
+
+    while ( true )
+    {
+	QList<uint> users;
+	QList<uint> groups;
+
+	{
+	    QMutexLocker locker( &_mutex );
+
+	    if ( _pendingUsers.isEmpty() && _pendingGroups.isEmpty() )
+	    {
+		_lookupRunning = false;
+		break;
+	    }
+
+	    users.swap( _pendingUsers );
+	    groups.swap( _pendingGroups );
+	}
+
+	// Without holding the mutex: This is what might take long
+
+	QHash<uint, QString> userNames;
+	QHash<uint, QString> groupNames;
+
+	foreach ( uint uid, users )
+	    userNames.insert( uid, lookUpUser( uid ) );
+
+	foreach ( uint gid, groups )
+	    groupNames.insert( gid, lookUpGroup( gid ) );
+
+	QMutexLocker locker( &_mutex );
+	qint64 expires = now() + OWNER_NAMES_TTL_SEC;
+
+	for ( int i = 0; i < 2; ++i )
+	{
+	    EntryHash & cache = i == 0 ? _users : _groups;
+	    const QHash<uint, QString> & names = i == 0 ? userNames : groupNames;
+
+	    for ( QHash<uint, QString>::const_iterator it = names.begin(); it != names.end(); ++it )
+	    {
+		Entry & entry  = cache[ it.key() ];
+		QString name   = it.value().isEmpty() ? QString::number( it.key() ) : it.value();
+
+		if ( entry.name != name )
+		    changed = true;
+
+		entry.name    = name;
+		entry.expires = expires;
+		entry.pending = false;
+	    }
+	}
+    }
+
+    if ( changed )
+	emit namesChanged();
+}
+
+
+QString OwnerNames::lookUpUser( uid_t uid )
+{
+    QByteArray	    buffer( NSS_BUFFER_SIZE, 0 );
+    struct passwd   pw;
+    struct passwd * result = 0;
+    int		    err;
+
+    while ( ( err = getpwuid_r( uid, &pw, buffer.data(), buffer.size(), &result ) ) == ERANGE &&
+	    buffer.size() < NSS_MAX_BUFFER_SIZE )
+    {
+	buffer.resize( 2 * buffer.size() );
+    }
+
+    if ( err != 0 || ! result )
+	return QString();
+
+    return QString::fromUtf8( pw.pw_name );
+}
+
+
+QString OwnerNames::lookUpGroup( gid_t gid )
+{
+    QByteArray	   buffer( NSS_BUFFER_SIZE, 0 );
+    struct group   grp;
+    struct group * result = 0;
+    int		   err;
+
+    while ( ( err = getgrgid_r( gid, &grp, buffer.data(), buffer.size(), &result ) ) == ERANGE &&
+	    buffer.size() < NSS_MAX_BUFFER_SIZE )
+    {
+	buffer.resize( 2 * buffer.size() );
+    }
+
+    if ( err != 0 || ! result )
+	return QString();
+
+    return QString::fromUtf8( grp.gr_name );
+}
@@ -0,0 +1,130 @@
+/*
+ *   File name: OwnerNames.h
+ *   Summary:	Cache for the names of user and group IDs
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef OwnerNames_h
+#define OwnerNames_h
+
+
+#include <sys/types.h>	// uid_t, gid_t
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+
+
+// Look up names again after this time: They might have changed in LDAP
+#define OWNER_NAMES_TTL_SEC	600
+
+
+namespace QDirStat
+{
+    /**
+     * Process-wide cache for the names of user IDs and group IDs.
+     *
+     * With LDAP or SSSD behind NSS, each getpwuid() or getgrgid() call may
+     * be a network round trip, and views that show the owner of many files
+     * would call them for each file.
+     *
+     * An ID that is not in the cache yet is looked up in a worker thread;
+     * meanwhile, its number is returned, and namesChanged() is emitted when
+     * new names are known. After OWNER_NAMES_TTL_SEC, a name is looked up
+     * again the same way; the old name is returned until then.
+     *
+     * All static methods can be called from any thread.
+     **/
+    class OwnerNames: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Return the singleton instance of this class.
+	 **/
+	static OwnerNames * instance();
+
+	/**
+	 * Return the name of user 'uid' or its number if the name is not
+	 * known (yet).
+	 **/
+	static QString userName( uid_t uid );
+
+	/**
+	 * Return the name of group 'gid' or its number if the name is not
+	 * known (yet).
+	 **/
+	static QString groupName( gid_t gid );
+
+	/**
+	 * Look up the names of all pending IDs. This is called in a worker
+	 * thread.
+	 **/
+	void lookUpPending();
+
+
+    signals:
+
+	/**
+	 * Emitted (from the worker thread) when names were added to the
+	 * cache or changed.
+	 **/
+	void namesChanged();
+
+
+    protected:
+
+	/**
+	 * Constructor. Use instance() instead.
+	 **/
+	OwnerNames();
+
+	struct Entry
+	{
+	    QString name;
+	    qint64  expires;	// seconds since the epoch
+	    bool    pending;
+	};
+
+	typedef QHash<uint, Entry> EntryHash;
+
+	/**
+	 * Return the cached name of 'id' in 'cache' and start a lookup if
+	 * it is not there or expired.
+	 **/
+	QString name( EntryHash & cache, QList<uint> & pending, uint id );
+
+	/**
+	 * Look up the name of a user or group with NSS. Return an empty
+	 * string if there is none.
+	 **/
+	static QString lookUpUser ( uid_t uid );
+	static QString lookUpGroup( gid_t gid );
+
+
+	//
+	// Data members
+	//
+
+	static OwnerNames * _instance;
+
+	QMutex	    _mutex;
+	EntryHash   _users;
+	EntryHash   _groups;
+	QList<uint> _pendingUsers;
+	QList<uint> _pendingGroups;
+	bool	    _lookupRunning;
+
+    };	// class OwnerNames
+
+}	// namespace QDirStat
+
+
+#endif	// OwnerNames_h
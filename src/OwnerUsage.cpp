@@ -0,0 +1,124 @@
+/*
+ *   File name: OwnerUsage.cpp
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>
+
+#include "OwnerUsage.h"
+#include "AggregateInfo.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    bool idLessThan( const OwnerUsage::Entry & entry, uint id )
+    {
+	return entry.id < id;
+    }
+
+}	// namespace
+
+
+void OwnerUsage::clear()
+{
+    _users.clear();
+    _groups.clear();
+}
+
+
+void OwnerUsage::add( const OwnerUsage & other )
+{
+    addList( _users,  other._users,   1 );
+    addList( _groups, other._groups,  1 );
+}
+
+
+void OwnerUsage::subtract( const OwnerUsage & other )
+{
+    addList( _users,  other._users,  -1 );
+    addList( _groups, other._groups, -1 );
+}
+
+
+int OwnerUsage::totalFiles() const
+{
+    int files = 0;
+
+    foreach ( const Entry & entry, _users )
+	files += entry.files;
+
+    return files;
+}
+
+
+void OwnerUsage::addItem( const FileInfo * item, int sign )
+{
+    if ( item->isPseudoDir() )
+	return;
+
+    Entry entry;
+    entry.files		= item->isFile() ? 1 : 0;
+
+    if ( item->isAggregate() )
+	entry.files = static_cast<const AggregateInfo *>( item )->fileCount();
+    entry.size		= item->size();
+    entry.allocatedSize = item->allocatedSize();
+
+    if ( item->hasUid() )
+    {
+	entry.id = item->uid();
+	addEntry( _users, entry, sign );
+    }
+
+    if ( item->hasGid() )
+    {
+	entry.id = item->gid();
+	addEntry( _groups, entry, sign );
+    }
+}
+
+
+void OwnerUsage::addEntry( EntryList & list, const Entry & entry, int sign )
+{
+    EntryList::iterator it = std::lower_bound( list.begin(), list.end(), entry.id, idLessThan );
+
+    if ( it == list.end() || it->id != entry.id )
+    {
+	if ( sign < 0 ) // Nothing to subtract from
+	    return;
+
+	list.insert( it, entry );
+	return;
+    }
+
+    it->files	      += sign * entry.files;
+    it->size	      += sign * entry.size;
+    it->allocatedSize += sign * entry.allocatedSize;
+
+    if ( it->files <= 0 && it->size <= 0 && it->allocatedSize <= 0 )
+	list.erase( it );
+}
+
+
+int OwnerUsage::files( const EntryList & list, uint id )
+{
+    EntryList::const_iterator it = std::lower_bound( list.begin(), list.end(), id, idLessThan );
+
+    return it == list.end() || it->id != id ? 0 : it->files;
+}
+
+
+void OwnerUsage::addList( EntryList &	    list,
+			  const EntryList & other,
+			  int		    sign )
+{
+    foreach ( const Entry & entry, other )
+	addEntry( list, entry, sign );
+}
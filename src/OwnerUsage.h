@@ -0,0 +1,128 @@
+/*
+ *   File name: OwnerUsage.h
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef OwnerUsage_h
+#define OwnerUsage_h
+
+
+#include <QVector>
+
+#include "FileInfo.h"	// FileSize
+
+
+namespace QDirStat
+{
+    /**
+     * Disk usage by the user and by the group that own the items: For each
+     * user ID and each group ID, the number of files and the total size
+     * and allocated size of all items that it owns.
+     *
+     * Each DirInfo keeps one of those for all the items in its subtree and
+     * updates it along with its other totals (like the SizeHistogram), so
+     * the usage by owner of any subtree is available at once without
+     * walking it.
+     *
+     * The tables are sparse: Only owners that have something in the subtree
+     * are in there, sorted by their ID. Items without an owner (read from a
+     * cache file or packages) are not counted.
+     **/
+    class OwnerUsage
+    {
+    public:
+
+	struct Entry
+	{
+	    uint     id;
+	    int	     files;
+	    FileSize size;
+	    FileSize allocatedSize;
+	};
+
+	typedef QVector<Entry> EntryList;
+
+	/**
+	 * Constructor for an empty table.
+	 **/
+	OwnerUsage() {}
+
+	/**
+	 * Remove everything.
+	 **/
+	void clear();
+
+	/**
+	 * Return 'true' if there is nothing in the tables.
+	 **/
+	bool isEmpty() const { return _users.isEmpty() && _groups.isEmpty(); }
+
+	/**
+	 * Add or remove the item itself (not its subtree) for its owner.
+	 **/
+	void add     ( const FileInfo * item ) { addItem( item,  1 ); }
+	void subtract( const FileInfo * item ) { addItem( item, -1 ); }
+
+	/**
+	 * Add or remove everything in 'other'.
+	 **/
+	void add     ( const OwnerUsage & other );
+	void subtract( const OwnerUsage & other );
+
+	/**
+	 * Return the usage by user ID or by group ID, sorted by the ID.
+	 **/
+	const EntryList & users()  const { return _users;  }
+	const EntryList & groups() const { return _groups; }
+
+	/**
+	 * Return the number of files in the users table.
+	 **/
+	int totalFiles() const;
+
+	/**
+	 * Return the number of files of user ID or group ID 'id'.
+	 **/
+	int userFiles ( uint id ) const { return files( _users,  id ); }
+	int groupFiles( uint id ) const { return files( _groups, id ); }
+
+
+    protected:
+
+	/**
+	 * Add (with 'sign' 1) or subtract (with 'sign' -1) 'item'.
+	 **/
+	void addItem( const FileInfo * item, int sign );
+
+	/**
+	 * Add the values of 'entry' multiplied by 'sign' to the entry with
+	 * the same ID in 'list', creating it if necessary. An entry that is
+	 * left without anything is removed.
+	 **/
+	static void addEntry( EntryList & list, const Entry & entry, int sign );
+
+	/**
+	 * Return the number of files of the entry with 'id' in 'list'.
+	 **/
+	static int files( const EntryList & list, uint id );
+
+	/**
+	 * Add all entries of 'other' multiplied by 'sign' to 'list'.
+	 **/
+	static void addList( EntryList &       list,
+			     const EntryList & other,
+			     int	       sign );
+
+
+	EntryList _users;
+	EntryList _groups;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef OwnerUsage_h
@@ -0,0 +1,182 @@
+/*
+ *   File name: OwnerUsageWindow.cpp
+ *   Summary:	QDirStat disk usage by owner window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>
+
+#include <QTreeWidgetItem>
+
+#include "OwnerUsageWindow.h"
+#include "OwnerNames.h"
+#include "DirInfo.h"
+#include "SettingsHelpers.h"
+#include "HeaderTweaker.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    bool biggerAllocatedSize( const OwnerUsage::Entry & a, const OwnerUsage::Entry & b )
+    {
+	return a.allocatedSize > b.allocatedSize;
+    }
+
+}	// namespace
+
+
+OwnerUsageWindow::OwnerUsageWindow( QWidget * parent ):
+    QDialog( parent ),
+    _ui( new Ui::OwnerUsageWindow )
+{
+    // logDebug() << "init" << endl;
+
+    CHECK_NEW( _ui );
+    _ui->setupUi( this );
+    initWidgets();
+    readWindowSettings( this, "OwnerUsageWindow" );
+
+    connect( _ui->refreshButton, SIGNAL( clicked() ),
+	     this,		 SLOT  ( refresh() ) );
+
+    // The names are looked up in the background; show them when they are
+    // known.
+
+    connect( OwnerNames::instance(), SIGNAL( namesChanged() ),
+	     this,		     SLOT  ( refresh()	    ) );
+}
+
+
+OwnerUsageWindow::~OwnerUsageWindow()
+{
+    // logDebug() << "destroying" << endl;
+    writeWindowSettings( this, "OwnerUsageWindow" );
+}
+
+
+void OwnerUsageWindow::clear()
+{
+    _ui->treeWidget->clear();
+    _ui->summaryLabel->clear();
+}
+
+
+void OwnerUsageWindow::initWidgets()
+{
+    QFont font = _ui->heading->font();
+    font.setBold( true );
+    _ui->heading->setFont( font );
+
+    _ui->treeWidget->setColumnCount( OU_ColumnCount );
+    _ui->treeWidget->setHeaderLabels( QStringList()
+				      << tr( "Owner" )
+				      << tr( "Files" )
+				      << tr( "Size" )
+				      << tr( "Allocated" )
+				      << tr( "Percentage" ) );
+    _ui->treeWidget->header()->setStretchLastSection( false );
+    HeaderTweaker::resizeToContents( _ui->treeWidget->header() );
+}
+
+
+void OwnerUsageWindow::refresh()
+{
+    populate( _subtree() );
+}
+
+
+void OwnerUsageWindow::reject()
+{
+    deleteLater();
+}
+
+
+void OwnerUsageWindow::populate( FileInfo * newSubtree )
+{
+    TRACE_SCOPE( "stats", "OwnerUsageWindow::populate" );
+
+    clear();
+    _subtree = newSubtree;
+
+    _ui->heading->setText( tr( "Disk Usage by Owner for %1" )
+			   .arg( _subtree.url() ) );
+
+    FileInfo * subtree = _subtree();
+
+    if ( ! subtree || ! subtree->isDirInfo() )
+	return;
+
+    DirInfo *  dir   = subtree->toDirInfo();
+    OwnerUsage usage = dir->ownerUsage();
+
+    // The subtree's own directory is not in its OwnerUsage
+
+    usage.add( dir );
+    FileSize totalAllocatedSize = dir->totalAllocatedSize();
+
+    addEntries( tr( "Users"  ), usage.users(),  false, totalAllocatedSize );
+    addEntries( tr( "Groups" ), usage.groups(), true,  totalAllocatedSize );
+
+    _ui->treeWidget->expandAll();
+
+
+    // Summary: Anything that is missing
+
+    if ( usage.totalFiles() < dir->totalFiles() )
+    {
+	_ui->summaryLabel->setText( tr( "Some files below this directory have no known owner "
+					"(e.g. because they were read from a cache file). "
+					"They are missing here." ) );
+    }
+}
+
+
+void OwnerUsageWindow::addEntries( const QString &		 title,
+				   const OwnerUsage::EntryList & entries,
+				   bool				 isGroup,
+				   FileSize			 totalAllocatedSize )
+{
+    QTreeWidgetItem * topItem = new QTreeWidgetItem();
+    CHECK_NEW( topItem );
+
+    topItem->setText( OU_NameCol, title );
+    _ui->treeWidget->addTopLevelItem( topItem );
+
+    OwnerUsage::EntryList sorted = entries;
+    std::stable_sort( sorted.begin(), sorted.end(), biggerAllocatedSize );
+
+    foreach ( const OwnerUsage::Entry & entry, sorted )
+    {
+	double percentage = totalAllocatedSize > 0LL ?
+	    ( 100.0 * entry.allocatedSize ) / totalAllocatedSize : 0.0;
+
+	QString percentStr;
+	percentStr.setNum( percentage, 'f', 2 );
+	percentStr += "%";
+
+	QTreeWidgetItem * item = new QTreeWidgetItem( topItem );
+	CHECK_NEW( item );
+
+	item->setText( OU_NameCol,	    isGroup ?
+		       OwnerNames::groupName( entry.id ) :
+		       OwnerNames::userName ( entry.id ) );
+	item->setText( OU_FilesCol,	    QString( "%1" ).arg( entry.files ) );
+	item->setText( OU_SizeCol,	    formatSize( entry.size ) );
+	item->setText( OU_AllocatedSizeCol, formatSize( entry.allocatedSize ) );
+	item->setText( OU_PercentageCol,    percentStr );
+
+	item->setTextAlignment( OU_NameCol, Qt::AlignLeft );
+
+	for ( int col = OU_FilesCol; col < OU_ColumnCount; ++col )
+	    item->setTextAlignment( col, Qt::AlignRight );
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ *   File name: OwnerUsageWindow.h
+ *   Summary:	QDirStat disk usage by owner window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef OwnerUsageWindow_h
+#define OwnerUsageWindow_h
+
+#include <QDialog>
+
+#include "ui_owner-usage-window.h"
+#include "OwnerUsage.h"
+#include "Subtree.h"
+
+
+namespace QDirStat
+{
+    class FileInfo;
+
+
+    /**
+     * Modeless dialog to display how much disk space in a subtree each
+     * user and each group uses, the biggest ones first.
+     *
+     * This uses the OwnerUsage of the subtree's DirInfo, so it does not
+     * need to walk the subtree.
+     **/
+    class OwnerUsageWindow: public QDialog
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 *
+	 * Notice that this widget will destroy itself upon window close.
+	 *
+	 * It is advised to use a QPointer for storing a pointer to an instance
+	 * of this class. The QPointer will keep track of this window
+	 * auto-deleting itself when closed.
+	 **/
+	OwnerUsageWindow( QWidget * parent );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~OwnerUsageWindow();
+
+	/**
+	 * Obtain the subtree from the last used URL.
+	 **/
+	const Subtree & subtree() const { return _subtree; }
+
+	/**
+	 * Populate the widgets for a subtree.
+	 **/
+	void populate( FileInfo * subtree );
+
+
+    public slots:
+
+	/**
+	 * Refresh (reload) all data.
+	 **/
+	void refresh();
+
+	/**
+	 * Reject the dialog contents, i.e. the user clicked the "Cancel"
+	 * or WM_CLOSE button.
+	 *
+	 * Reimplemented from QDialog.
+	 **/
+	virtual void reject() Q_DECL_OVERRIDE;
+
+
+    protected:
+
+	/**
+	 * Clear all data and widget contents.
+	 **/
+	void clear();
+
+	/**
+	 * One-time initialization of the widgets in this window.
+	 **/
+	void initWidgets();
+
+	/**
+	 * Add a toplevel item 'title' with one child item for each entry of
+	 * 'entries', the biggest ones first. 'isGroup' tells if the IDs are
+	 * group IDs or user IDs.
+	 **/
+	void addEntries( const QString &	       title,
+			 const OwnerUsage::EntryList & entries,
+			 bool			       isGroup,
+			 FileSize		       totalAllocatedSize );
+
+
+	//
+	// Data members
+	//
+
+	Ui::OwnerUsageWindow * _ui;
+	Subtree		       _subtree;
+    };
+
+
+    /**
+     * Column numbers for the owner usage tree widget
+     **/
+    enum OwnerUsageColumns
+    {
+	OU_NameCol = 0,
+	OU_FilesCol,
+	OU_SizeCol,
+	OU_AllocatedSizeCol,
+	OU_PercentageCol,
+	OU_ColumnCount
+    };
+
+} // namespace QDirStat
+
+
+#endif // OwnerUsageWindow_h
@@ -0,0 +1,274 @@
+/*
+ *   File name: PacManDatabase.cpp
+ *   Summary:	PacMan package manager support for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <functional>
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QFile>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include "PacManDatabase.h"
+#include "PkgFileListCache.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    typedef std::function<void( int )> IndexFunc;
+
+
+    /**
+     * Call 'func' for the next index from 'next' until 'count' is reached.
+     **/
+    class IndexTask: public QRunnable
+    {
+    public:
+
+	IndexTask( int count, const IndexFunc & func, QAtomicInt & next ):
+	    _count( count ),
+	    _func( func ),
+	    _next( next )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    int i;
+
+	    while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _count )
+		_func( i );
+	}
+
+    private:
+
+	int		  _count;
+	const IndexFunc & _func;
+	QAtomicInt &	  _next;
+    };
+
+
+    /**
+     * Call 'func' for each index from 0 to 'count' - 1 in worker threads
+     * and wait until all are done.
+     **/
+    void forEachIndex( int count, const IndexFunc & func )
+    {
+	QAtomicInt next( 0 );
+	int taskCount = qMax( 1, QThread::idealThreadCount() );
+
+	QThreadPool threadPool;
+	threadPool.setMaxThreadCount( taskCount );
+
+	for ( int task = 0; task < taskCount; ++task )
+	    threadPool.start( new IndexTask( count, func, next ) );
+
+	threadPool.waitForDone();
+    }
+
+
+    /**
+     * Read the lines of file 'fileName' into 'lines_ret'. Return 'true' on
+     * success, 'false' on error.
+     **/
+    bool readLines( const QString & fileName, QList<QByteArray> & lines_ret )
+    {
+	QFile file( fileName );
+
+	if ( ! file.open( QIODevice::ReadOnly ) )
+	    return false;
+
+	lines_ret = file.readAll().split( '\n' );
+
+	return true;
+    }
+
+}	// namespace
+
+
+PacManDatabase::PacManDatabase( const QString & dir ):
+    _dir( dir )
+{
+
+}
+
+
+bool PacManDatabase::isAvailable() const
+{
+    // Every local database since pacman 4.2 has this file; older or
+    // unknown layouts are left to the pacman command.
+
+    QList<QByteArray> lines;
+
+    if ( ! readLines( _dir + "/ALPM_DB_VERSION", lines ) || lines.isEmpty() )
+	return false;
+
+    bool ok = false;
+    lines.first().trimmed().toInt( &ok );
+
+    return ok;
+}
+
+
+bool PacManDatabase::readPackages( QList<Package> & packages_ret ) const
+{
+    QStringList pkgDirs = QDir( _dir ).entryList( QDir::Dirs | QDir::NoDotAndDotDot );
+
+    if ( pkgDirs.isEmpty() )
+    {
+	logError() << "No packages in " << _dir << endl;
+	return false;
+    }
+
+    QVector<Package> packages( pkgDirs.size() );
+    QVector<bool>    found( pkgDirs.size(), false );
+    Package *	     packagesData = packages.data();
+    bool *	     foundData	  = found.data();
+
+    forEachIndex( pkgDirs.size(), [&]( int i )
+	{
+	    foundData[ i ] = readDesc( pkgDirs.at( i ), packagesData[ i ] );
+	} );
+
+    for ( int i=0; i < pkgDirs.size(); ++i )
+    {
+	if ( found.at( i ) )
+	    packages_ret << packages.at( i );
+	else
+	    logWarning() << "Can't read " << _dir << "/" << pkgDirs.at( i ) << "/desc" << endl;
+    }
+
+    logDebug() << "Read " << packages_ret.size() << " installed packages from " << _dir << endl;
+
+    return ! packages_ret.isEmpty();
+}
+
+
+bool PacManDatabase::readDesc( const QString & pkgDir, Package & package_ret ) const
+{
+    // Sample 'desc' file (sections that are not needed here are left out):
+    //
+    //	   %NAME%
+    //	   pacman
+    //
+    //	   %VERSION%
+    //	   5.1.1-3
+    //
+    //	   %ARCH%
+    //	   x86_64
+
+    QList<QByteArray> lines;
+
+    if ( ! readLines( _dir + "/" + pkgDir + "/desc", lines ) )
+	return false;
+
+    for ( int i=0; i < lines.size() - 1; ++i )
+    {
+	const QByteArray & line = lines.at( i );
+
+	if	( line == "%NAME%"    ) package_ret.name    = QString::fromUtf8( lines.at( ++i ) );
+	else if ( line == "%VERSION%" ) package_ret.version = QString::fromUtf8( lines.at( ++i ) );
+	else if ( line == "%ARCH%"    ) package_ret.arch    = QString::fromUtf8( lines.at( ++i ) );
+    }
+
+    // The directory name has to match, or readFileList() would not find
+    // the file list.
+
+    return ! package_ret.name.isEmpty() &&
+	pkgDir == package_ret.name + "-" + package_ret.version;
+}
+
+
+bool PacManDatabase::readFileList( const QString & name,
+				   const QString & version,
+				   QStringList &   fileList_ret ) const
+{
+    // Sample 'files' file:
+    //
+    //	   %FILES%
+    //	   etc/
+    //	   etc/pacman.conf
+    //	   usr/
+    //	   usr/bin/
+    //	   usr/bin/pacman
+    //
+    //	   %BACKUP%
+    //	   etc/pacman.conf	2d6b4e0a3ae3dc5ba5ac5a2d974d4ab0
+    //
+    // The paths are relative to the root directory; "pacman -Qlq" outputs
+    // them with a leading slash, so this does the same.
+
+    QList<QByteArray> lines;
+
+    if ( ! readLines( _dir + "/" + name + "-" + version + "/files", lines ) )
+	return false;
+
+    bool inFiles = false;
+
+    foreach ( const QByteArray & line, lines )
+    {
+	if ( line.startsWith( '%' ) )
+	    inFiles = line == "%FILES%";
+	else if ( inFiles && ! line.isEmpty() )
+	    fileList_ret << "/" + QString::fromUtf8( line );
+    }
+
+    return true;
+}
+
+
+bool PacManDatabase::readFileLists( const QList<Package> & packages,
+				    PkgFileListCache *	   cache ) const
+{
+    CHECK_PTR( cache );
+
+    if ( packages.isEmpty() )
+	return false;
+
+    // The worker threads only read the files; the cache is filled here in
+    // the calling thread since it is not thread-safe.
+
+    QVector<QStringList> fileLists( packages.size() );
+    QVector<bool>	 found( packages.size(), false );
+    QStringList *	 fileListsData = fileLists.data();
+    bool *		 foundData     = found.data();
+
+    forEachIndex( packages.size(), [&]( int i )
+	{
+	    const Package & pkg = packages.at( i );
+	    foundData[ i ] = readFileList( pkg.name, pkg.version, fileListsData[ i ] );
+	} );
+
+    int readCount = 0;
+
+    for ( int i=0; i < packages.size(); ++i )
+    {
+	if ( ! found.at( i ) )
+	{
+	    logWarning() << "No file list for " << packages.at( i ).name << endl;
+	    continue;
+	}
+
+	foreach ( const QString & path, fileLists.at( i ) )
+	    cache->add( packages.at( i ).name, path );
+
+	fileLists[ i ].clear(); // Free the memory ASAP
+	++readCount;
+    }
+
+    logDebug() << "Read " << readCount << " file lists from " << _dir << endl;
+
+    return readCount > 0;
+}
@@ -0,0 +1,99 @@
+/*
+ *   File name: PacManDatabase.h
+ *   Summary:	PacMan package manager support for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef PacManDatabase_h
+#define PacManDatabase_h
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+
+#define PACMAN_LOCAL_DB_DIR	"/var/lib/pacman/local"
+
+
+namespace QDirStat
+{
+    class PkgFileListCache;
+
+
+    /**
+     * Reader for the local pacman database: One directory
+     * <name>-<version> for each installed package with a 'desc' file with
+     * the package data and a 'files' file with its file list.
+     *
+     * This reads those plain text files directly instead of starting a
+     * pacman process for each package. If the database layout is not
+     * recognized, the caller should fall back to the pacman commands.
+     **/
+    class PacManDatabase
+    {
+    public:
+
+	/**
+	 * One installed package from its 'desc' file.
+	 **/
+	struct Package
+	{
+	    QString name;
+	    QString version;
+	    QString arch;
+	};
+
+	/**
+	 * Constructor. 'dir' is the local database directory.
+	 **/
+	PacManDatabase( const QString & dir = PACMAN_LOCAL_DB_DIR );
+
+	/**
+	 * Return 'true' if the layout of the database is one that this
+	 * class knows how to read.
+	 **/
+	bool isAvailable() const;
+
+	/**
+	 * Read all installed packages into 'packages_ret'. Return 'true' on
+	 * success, 'false' on error.
+	 **/
+	bool readPackages( QList<Package> & packages_ret ) const;
+
+	/**
+	 * Read the file list of package 'name' with version 'version' into
+	 * 'fileList_ret'. Return 'true' on success, 'false' if there is no
+	 * file list for this package or if it could not be read.
+	 **/
+	bool readFileList( const QString & name,
+			   const QString & version,
+			   QStringList &   fileList_ret ) const;
+
+	/**
+	 * Read the file lists of all 'packages' in parallel and add them to
+	 * 'cache' with the package name. Return 'true' if at least the file
+	 * lists of some packages were read, 'false' if none.
+	 **/
+	bool readFileLists( const QList<Package> & packages,
+			    PkgFileListCache *	   cache ) const;
+
+
+    protected:
+
+	/**
+	 * Read the 'desc' file in package directory 'pkgDir' into
+	 * 'package_ret'. Return 'true' on success, 'false' on error.
+	 **/
+	bool readDesc( const QString & pkgDir, Package & package_ret ) const;
+
+	QString _dir;
+
+    };	// class PacManDatabase
+
+}	// namespace QDirStat
+
+
+#endif	// ifndef PacManDatabase_h
@@ -8,6 +8,7 @@
 
 
 #include "PacManPkgManager.h"
+#include "PacManDatabase.h"
 #include "Logger.h"
 #include "Exception.h"
 
@@ -28,13 +29,14 @@ bool PacManPkgManager::isAvailable()
 }
 
 
-QString PacManPkgManager::owningPkg( const QString & path )
+QStringList PacManPkgManager::owningPkgCommand( const QString & path )
 {
-    int exitCode = -1;
-    QString output = runCommand( "/usr/bin/pacman",
-                                 QStringList() << "-Qo" << path,
-                                 &exitCode );
+    return QStringList() << "/usr/bin/pacman" << "-Qo" << path;
+}
+
 
+QString PacManPkgManager::parseOwningPkg( const QString & output, int exitCode )
+{
     if ( exitCode != 0 || output.contains( "No package owns" ) )
 	return "";
 
@@ -46,8 +48,9 @@ QString PacManPkgManager::owningPkg( const QString & path )
     // blank-separated section #4; let's remove the part before the package
     // name.
 
-    output.remove( QRegExp( "^.*is owned by " ) );
-    QString pkg = output.section( " ", 0, 0 );
+    QString pkg = output;
+    pkg.remove( QRegExp( "^.*is owned by " ) );
+    pkg = pkg.section( " ", 0, 0 );
 
     return pkg;
 }
@@ -55,6 +58,26 @@ QString PacManPkgManager::owningPkg( const QString & path )
 
 PkgInfoList PacManPkgManager::installedPkg()
 {
+    PacManDatabase database;
+    QList<PacManDatabase::Package> packages;
+
+    if ( database.isAvailable() && database.readPackages( packages ) )
+    {
+        PkgInfoList pkgList;
+
+        foreach ( const PacManDatabase::Package & package, packages )
+        {
+            PkgInfo * pkg = new PkgInfo( package.name, package.version, package.arch, this );
+            CHECK_NEW( pkg );
+
+            pkgList << pkg;
+        }
+
+        return pkgList;
+    }
+
+    logWarning() << "Can't read the pacman database; using pacman -Qn" << endl;
+
     int exitCode = -1;
     QString output = runCommand( "/usr/bin/pacman",
                                  QStringList() << "-Qn",
@@ -99,6 +122,19 @@ PkgInfoList PacManPkgManager::parsePkgList( const QString & output )
 }
 
 
+QStringList PacManPkgManager::fileList( PkgInfo * pkg )
+{
+    CHECK_PTR( pkg );
+
+    QStringList fileList;
+
+    if ( PacManDatabase().readFileList( pkg->baseName(), pkg->version(), fileList ) )
+        return fileList;
+
+    return PkgManager::fileList( pkg );
+}
+
+
 QString PacManPkgManager::fileListCommand( PkgInfo * pkg )
 {
     return QString( "/usr/bin/pacman -Qlq %1" ).arg( pkg->baseName() );
@@ -110,3 +146,41 @@ QStringList PacManPkgManager::parseFileList( const QString & output )
     return output.split( "\n" );
 }
 
+
+
+bool PacManPkgManager::supportsFileListCache()
+{
+    return PacManDatabase().isAvailable();
+}
+
+
+PkgFileListCache * PacManPkgManager::createFileListCache( PkgFileListCache::LookupType lookupType )
+{
+    PacManDatabase database;
+    QList<PacManDatabase::Package> packages;
+
+    if ( ! database.isAvailable() || ! database.readPackages( packages ) )
+        return 0;
+
+    PkgFileListCache * cache = new PkgFileListCache( this, lookupType );
+    CHECK_NEW( cache );
+
+    if ( ! database.readFileLists( packages, cache ) )
+    {
+        delete cache;
+        return 0;
+    }
+
+    logDebug() << "file list cache finished." << endl;
+
+    return cache;
+}
+
+
+QString PacManPkgManager::databaseStamp()
+{
+    // Each installed package version has its own directory, so every
+    // change adds or removes one
+
+    return fileStamp( QStringList() << PACMAN_LOCAL_DB_DIR );
+}
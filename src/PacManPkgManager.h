@@ -50,16 +50,20 @@ namespace QDirStat
 	virtual bool isAvailable() Q_DECL_OVERRIDE;
 
 	/**
-	 * Return the owning package of a file or directory with full path
-	 * 'path' or an empty string if it is not owned by any package.
+	 * Return the command for getting the owning package of 'path':
 	 *
-	 * Implemented from PkgManager.
+	 *   /usr/bin/pacman -Qo ${path}
 	 *
-	 * This basically executes this command:
+	 * Implemented from PkgManager.
+	 **/
+	virtual QStringList owningPkgCommand( const QString & path ) Q_DECL_OVERRIDE;
+
+	/**
+	 * Parse the output of the owningPkgCommand().
 	 *
-	 *   /usr/bin/rpm -qf ${path}
+	 * Implemented from PkgManager.
 	 **/
-	virtual QString owningPkg( const QString & path ) Q_DECL_OVERRIDE;
+	virtual QString parseOwningPkg( const QString & output, int exitCode ) Q_DECL_OVERRIDE;
 
 
         //-----------------------------------------------------------------
@@ -80,10 +84,23 @@ namespace QDirStat
          *
          * Ownership of the list elements is transferred to the caller.
          *
+         * This reads the local pacman database directly and falls back to
+         * "pacman -Qn" if its layout is not recognized.
+         *
 	 * Reimplemented from PkgManager.
          **/
         virtual PkgInfoList installedPkg();
 
+        /**
+         * Return the list of files and directories owned by a package.
+         *
+         * This reads the file list from the local pacman database directly
+         * and falls back to the file list command if that fails.
+         *
+	 * Reimplemented from PkgManager.
+         **/
+        virtual QStringList fileList( PkgInfo * pkg ) Q_DECL_OVERRIDE;
+
         /**
          * Return 'true' if this package manager supports getting the file list
          * for a package.
@@ -108,6 +125,34 @@ namespace QDirStat
          **/
         virtual QStringList parseFileList( const QString & output ) Q_DECL_OVERRIDE;
 
+        /**
+         * Return 'true' if this package manager supports building a file list
+         * cache for getting all file lists for all packages. This is only
+         * supported if the local pacman database can be read directly.
+         *
+	 * Reimplemented from PkgManager.
+         **/
+        virtual bool supportsFileListCache() Q_DECL_OVERRIDE;
+
+        /**
+         * Create a file list cache with the specified lookup type for all
+         * installed packages from the local pacman database.
+         *
+         * Ownership of the cache is transferred to the caller; make sure to
+         * delete it when you are done with it.
+         *
+	 * Reimplemented from PkgManager.
+         **/
+        virtual PkgFileListCache * createFileListCache( PkgFileListCache::LookupType lookupType = PkgFileListCache::LookupByPkg ) Q_DECL_OVERRIDE;
+
+        /**
+         * Return a string that changes whenever the local pacman database
+         * changes.
+         *
+	 * Reimplemented from PkgManager.
+         **/
+        virtual QString databaseStamp() Q_DECL_OVERRIDE;
+
 
     protected:
 
@@ -0,0 +1,792 @@
+/*
+ *   File name: ParallelDeleter.cpp
+ *   Summary:	Deleting subtrees in worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>	// strcmp()
+#include <unistd.h>
+
+#include <functional>
+
+#include <QHash>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#include "ParallelDeleter.h"
+#include "Attic.h"
+#include "DirReadJob.h"
+#include "DirTree.h"
+#include "DotEntry.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+// Deleting threads per CPU: Most of them are waiting for the disk
+#define ThreadsPerCpu		2
+
+#define PROGRESS_MILLISEC	500
+
+#define DIR_OPEN_FLAGS		( O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC )
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * A task in the thread pool that just calls 'func'.
+     **/
+    class DeleteTask: public QRunnable
+    {
+    public:
+
+	DeleteTask( const std::function<void()> & func ):
+	    _func( func )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	    { _func(); }
+
+    private:
+
+	std::function<void()> _func;
+    };
+
+
+    /**
+     * Return an error message for 'path' with the text for errno.
+     **/
+    QString errorMessage( const QString & text, const QByteArray & path )
+    {
+	return text.arg( QString::fromUtf8( path ) ).arg( formatErrno() );
+    }
+
+}	// namespace
+
+
+ParallelDeleter::ParallelDeleter( const FileInfoSet & items, QObject * parent ):
+    QObject( parent ),
+    _tree( items.isEmpty() ? 0 : items.first()->tree() ),
+    _generation( 0 ),
+    _itemsValid( true ),
+    _jobData( 0 ),
+    _level( -1 ),
+    _totalCount( 0 ),
+    _errorCount( 0 ),
+    _finished( false ),
+    _next( 0 ),
+    _running( 0 ),
+    _doneCount( 0 ),
+    _canceled( 0 ),
+    _bytesFreed( 0 )
+{
+    // Stick to the concurrency that reading may use on the devices of the
+    // items, so rotational disks and network mounts are not flooded
+
+    DirReadJobQueue * queue = _tree ? _tree->jobQueue() : 0;
+    int threads = qMax( 1, QThread::idealThreadCount() ) * ThreadsPerCpu;
+
+    foreach ( FileInfo * item, items )
+    {
+	if ( queue )
+	    threads = qBound( 1, queue->deviceConcurrency( item ), threads );
+    }
+
+    init( threads );
+
+
+    // The selected files of the same directory go to one job
+
+    QHash<FileInfo *, int> fileJobs;
+
+    foreach ( FileInfo * item, items )
+    {
+	if ( item->isDirInfo() && ! item->isPseudoDir() )
+	{
+	    collect( item );
+	    continue;
+	}
+
+	FileInfo * dir = item->parent();
+
+	while ( dir && dir->isPseudoDir() )
+	    dir = dir->parent();
+
+	if ( ! dir )
+	    continue;
+
+	if ( ! fileJobs.contains( dir ) )
+	{
+	    Job job;
+	    job.dir	    = dir->path().toUtf8();
+	    job.dirSize	    = 0;
+	    job.item	    = dir;
+	    job.device	    = item->device();
+	    job.parent	    = -1;
+	    job.removeDir   = false;
+	    job.emptyDir    = false;
+	    job.childFailed = false;
+	    job.ok	    = false;
+
+	    fileJobs.insert( dir, addJob( job, 0 ) );
+	    --_totalCount; // The directory itself stays
+	}
+
+	Job & job = _jobs[ fileJobs.value( dir ) ];
+	job.files     << item->name().toUtf8();
+	job.sizes     << item->allocatedSize();
+	job.fileItems << item;
+	++_totalCount;
+    }
+
+    logDebug() << "Deleting " << _totalCount << " items in " << _jobs.size()
+	       << " directories on " << _levels.size() << " levels with "
+	       << threads << " threads" << endl;
+}
+
+
+ParallelDeleter::ParallelDeleter( const QStringList & dirs,
+				  DirTree *	      tree,
+				  QObject *	      parent ):
+    QObject( parent ),
+    _tree( tree ),
+    _generation( 0 ),
+    _itemsValid( true ),
+    _jobData( 0 ),
+    _level( -1 ),
+    _totalCount( 0 ),
+    _errorCount( 0 ),
+    _finished( false ),
+    _next( 0 ),
+    _running( 0 ),
+    _doneCount( 0 ),
+    _canceled( 0 ),
+    _bytesFreed( 0 )
+{
+    // The directories are typically on different devices, so they are
+    // emptied concurrently with the full thread pool.
+
+    init( qMax( 1, QThread::idealThreadCount() ) * ThreadsPerCpu );
+
+    foreach ( const QString & dir, dirs )
+	collectContents( dir );
+
+    logDebug() << "Emptying " << dirs.size() << " directories: "
+	       << _totalCount << " known items in " << _jobs.size()
+	       << " jobs on " << _levels.size() << " levels" << endl;
+}
+
+
+void ParallelDeleter::init( int threads )
+{
+    _threadPool.setMaxThreadCount( threads );
+    _progressTimer.setInterval( PROGRESS_MILLISEC );
+
+    connect( &_progressTimer, SIGNAL( timeout()	 ),
+	     this,	      SLOT  ( reportProgress() ) );
+}
+
+
+ParallelDeleter::~ParallelDeleter()
+{
+    cancel();
+    _threadPool.waitForDone();
+}
+
+
+void ParallelDeleter::collect( FileInfo * item )
+{
+    collectDir( item, -1, 0 );
+}
+
+
+void ParallelDeleter::collectContents( const QString & dir )
+{
+    FileInfo * item = _tree && ! _tree->isBusy() ? _tree->locate( dir ) : 0;
+
+    // Only a directory that is read completely can be taken from the tree
+
+    if ( ! item || ! item->isDirInfo() || item->isExcluded() ||
+	 item->readState() != DirFinished || item->toDirInfo()->isPendingSubtree() )
+    {
+	collectDiskContents( dir );
+
+	if ( item )
+	    _emptiedPaths << dir;
+
+	return;
+    }
+
+    Job job;
+    job.dir	    = dir.toUtf8();
+    job.dirSize	    = 0;
+    job.item	    = item;
+    job.device	    = item->device();
+    job.parent	    = -1;
+    job.removeDir   = false;
+    job.emptyDir    = true;	// Anything that was added after reading
+    job.childFailed = false;
+    job.ok	    = false;
+
+    int jobNo = addJob( job, 0 );
+    --_totalCount; // The directory itself stays
+
+    collectChildren( item, jobNo, 0 );
+}
+
+
+void ParallelDeleter::collectDiskContents( const QString & dir )
+{
+    QByteArray	path = dir.toUtf8();
+    struct stat statInfo;
+
+    if ( ::lstat( path.constData(), &statInfo ) != 0 )
+    {
+	if ( errno != ENOENT )
+	    _startErrors << errorMessage( tr( "Can't stat %1: %2" ), path );
+
+	return;
+    }
+
+    Job job;
+    job.dir	    = path;
+    job.dirSize	    = 0;
+    job.item	    = 0;
+    job.device	    = statInfo.st_dev;
+    job.parent	    = -1;
+    job.removeDir   = false;
+    job.emptyDir    = true;
+    job.childFailed = false;
+    job.ok	    = false;
+
+    int jobNo = addJob( job, 0 );
+    --_totalCount; // The directory itself stays
+
+    // Only one level here; the subdirectories are read by the workers
+
+    DIR * dirStream = ::opendir( path.constData() );
+
+    if ( ! dirStream )
+    {
+	_startErrors << errorMessage( tr( "Can't read %1: %2" ), path );
+	return;
+    }
+
+    int fd = ::dirfd( dirStream );
+    struct dirent * entry;
+
+    while ( ( entry = ::readdir( dirStream ) ) )
+    {
+	const char * name = entry->d_name;
+
+	if ( strcmp( name, "." ) == 0 || strcmp( name, ".." ) == 0 )
+	    continue;
+
+	if ( ::fstatat( fd, name, &statInfo, AT_SYMLINK_NOFOLLOW ) != 0 )
+	    continue;	// The emptyDir job will find it if it is still there
+
+	if ( S_ISDIR( statInfo.st_mode ) && statInfo.st_dev == _jobs.at( jobNo ).device )
+	{
+	    Job subDirJob;
+	    subDirJob.dir	  = path + "/" + name;
+	    subDirJob.dirSize	  = statInfo.st_blocks * STD_BLOCK_SIZE;
+	    subDirJob.item	  = 0;
+	    subDirJob.device	  = statInfo.st_dev;
+	    subDirJob.parent	  = jobNo;
+	    subDirJob.removeDir	  = true;
+	    subDirJob.emptyDir	  = false;
+	    subDirJob.childFailed = false;
+	    subDirJob.ok	  = false;
+
+	    addJob( subDirJob, 1 );
+	}
+	else if ( ! S_ISDIR( statInfo.st_mode ) )
+	{
+	    _jobs[ jobNo ].files << QByteArray( name );
+	    _jobs[ jobNo ].sizes << statInfo.st_blocks * STD_BLOCK_SIZE;
+	    ++_totalCount;
+	}
+    }
+
+    ::closedir( dirStream );
+}
+
+
+void ParallelDeleter::collectDir( FileInfo * dir, int parentJob, int level )
+{
+    if ( dir->isMountPoint() )
+    {
+	// Never delete anything on another filesystem; this also keeps the
+	// parent directory.
+
+	_startErrors << tr( "Not deleting mount point %1" ).arg( dir->url() );
+
+	if ( parentJob >= 0 )
+	    _jobs[ parentJob ].childFailed = true;
+
+	return;
+    }
+
+    Job job;
+    job.dir	    = dir->path().toUtf8();
+    job.dirSize	    = dir->allocatedSize();
+    job.item	    = dir;
+    job.device	    = dir->device();
+    job.parent	    = parentJob;
+    job.removeDir   = true;
+    job.emptyDir    = false;
+    job.childFailed = false;
+    job.ok	    = false;
+
+    int jobNo = addJob( job, level );
+    collectChildren( dir, jobNo, level );
+}
+
+
+void ParallelDeleter::collectChildren( FileInfo * parent, int jobNo, int level )
+{
+    for ( FileInfo * child = parent->firstChild(); child; child = child->next() )
+    {
+	if ( child->isPseudoDir() )
+	    collectChildren( child, jobNo, level );
+	else if ( child->isDirInfo() )
+	    collectDir( child, jobNo, level + 1 );
+	else
+	{
+	    Job & job = _jobs[ jobNo ];
+	    job.files << child->name().toUtf8();
+	    job.sizes << child->allocatedSize();
+
+	    if ( ! job.removeDir ) // Each file needs to be removed from the tree
+		job.fileItems << child;
+
+	    ++_totalCount;
+	}
+    }
+
+    // The files in the dot entry and the ignored ones in the attic are in
+    // the same directory on the disk
+
+    if ( parent->dotEntry() )
+	collectChildren( parent->dotEntry(), jobNo, level );
+
+    if ( parent->attic() )
+	collectChildren( parent->attic(), jobNo, level );
+}
+
+
+int ParallelDeleter::addJob( const Job & job, int level )
+{
+    if ( level >= _levels.size() )
+	_levels.resize( level + 1 );
+
+    int jobNo = _jobs.size();
+    _levels[ level ] << jobNo;
+    _jobs << job;
+    ++_totalCount;
+
+    return jobNo;
+}
+
+
+void ParallelDeleter::start()
+{
+    foreach ( const QString & message, _startErrors )
+    {
+	++_errorCount;
+	emit error( message );
+    }
+
+    _generation = _tree ? _tree->generation() : 0;
+    _jobData	= _jobs.data();
+    _level	= _levels.size() - 1;
+    _progressTimer.start();
+
+    startLevel();
+}
+
+
+void ParallelDeleter::cancel()
+{
+    _canceled.storeRelease( 1 );
+}
+
+
+void ParallelDeleter::startLevel()
+{
+    while ( _level >= 0 && _levels.at( _level ).isEmpty() )
+	--_level;
+
+    if ( _level < 0 || _canceled.loadAcquire() )
+    {
+	finish();
+	return;
+    }
+
+    int taskCount = qMin( _threadPool.maxThreadCount(), _levels.at( _level ).size() );
+
+    _next.storeRelease( 0 );
+    _running.storeRelease( taskCount );
+
+    for ( int i=0; i < taskCount; ++i )
+    {
+	DeleteTask * task = new DeleteTask( [this]() { runTask(); } );
+	CHECK_NEW( task );
+
+	_threadPool.start( task );
+    }
+}
+
+
+void ParallelDeleter::runTask()
+{
+    const QVector<int> & level = _levels.at( _level );
+    int i;
+
+    while ( ! _canceled.loadAcquire() &&
+	    ( i = _next.fetchAndAddRelaxed( 1 ) ) < level.size() )
+    {
+	doJob( _jobData[ level.at( i ) ] );
+    }
+
+    // The last task of this level hands over to the main thread; nothing
+    // may touch this object after that.
+
+    if ( _running.fetchAndAddOrdered( -1 ) == 1 )
+	QMetaObject::invokeMethod( this, "levelFinished", Qt::QueuedConnection );
+}
+
+
+void ParallelDeleter::doJob( Job & job )
+{
+    job.ok = true;
+    int done = 0;
+    int fd = ::open( job.dir.constData(), DIR_OPEN_FLAGS );
+
+    if ( fd < 0 )
+    {
+	if ( errno == ENOENT ) // Somebody else was faster
+	{
+	    _doneCount.fetchAndAddRelaxed( job.files.size() + ( job.removeDir ? 1 : 0 ) );
+	    return;
+	}
+
+	job.errors << errorMessage( tr( "Can't open %1: %2" ), job.dir );
+	job.ok = false;
+	return;
+    }
+
+    qint64 freed = 0;
+
+    for ( int i=0; i < job.files.size(); ++i )
+    {
+	const QByteArray & name = job.files.at( i );
+
+	if ( ::unlinkat( fd, name.constData(), 0 ) == 0 )
+	{
+	    ++done;
+	    freed += job.sizes.value( i );
+	}
+	else if ( errno == ENOENT )
+	{
+	    ++done;
+	}
+	else
+	{
+	    job.errors << errorMessage( tr( "Can't delete %1: %2" ), job.dir + "/" + name );
+	    job.ok = false;
+	}
+    }
+
+    ::close( fd );
+
+    if ( job.emptyDir )
+    {
+	// Whatever else is in there, but not in a subdirectory that could
+	// not be deleted: That was already reported.
+
+	if ( job.childFailed || ! job.ok )
+	    job.ok = false;
+	else
+	    job.ok = removeContents( job.dir, job.device, job.errors );
+    }
+
+    if ( job.removeDir )
+    {
+	if ( ! job.ok || job.childFailed )
+	{
+	    // The reason was already reported
+
+	    job.ok = false;
+	}
+	else
+	{
+	    bool removed = ::rmdir( job.dir.constData() ) == 0 || errno == ENOENT;
+
+	    if ( ! removed && ( errno == ENOTEMPTY || errno == EEXIST ) )
+	    {
+		// Something that is not in the tree
+
+		if ( removeContents( job.dir, job.device, job.errors ) )
+		{
+		    removed = ::rmdir( job.dir.constData() ) == 0 || errno == ENOENT;
+
+		    if ( ! removed )
+			job.errors << errorMessage( tr( "Can't remove directory %1: %2" ), job.dir );
+		}
+	    }
+	    else if ( ! removed )
+	    {
+		job.errors << errorMessage( tr( "Can't remove directory %1: %2" ), job.dir );
+	    }
+
+	    if ( removed )
+	    {
+		++done;
+		freed += job.dirSize;
+	    }
+	    else
+		job.ok = false;
+	}
+    }
+
+    addBytesFreed( freed );
+    _doneCount.fetchAndAddRelaxed( done );
+}
+
+
+bool ParallelDeleter::removeContents( const QByteArray & dir,
+				      dev_t		 device,
+				      QStringList &	 errors_ret )
+{
+    int fd = ::open( dir.constData(), DIR_OPEN_FLAGS );
+
+    if ( fd < 0 )
+    {
+	errors_ret << errorMessage( tr( "Can't open %1: %2" ), dir );
+	return false;
+    }
+
+    DIR * dirStream = ::fdopendir( fd );
+
+    if ( ! dirStream )
+    {
+	errors_ret << errorMessage( tr( "Can't read %1: %2" ), dir );
+	::close( fd );
+	return false;
+    }
+
+    bool ok = true;
+    qint64 freed = 0;
+    struct dirent * entry;
+
+    while ( ( entry = ::readdir( dirStream ) ) )
+    {
+	const char * name = entry->d_name;
+
+	if ( strcmp( name, "." ) == 0 || strcmp( name, ".." ) == 0 )
+	    continue;
+
+	QByteArray  path = dir + "/" + name;
+	struct stat statInfo;
+
+	if ( ::fstatat( fd, name, &statInfo, AT_SYMLINK_NOFOLLOW ) != 0 )
+	{
+	    if ( errno != ENOENT )
+	    {
+		errors_ret << errorMessage( tr( "Can't stat %1: %2" ), path );
+		ok = false;
+	    }
+
+	    continue;
+	}
+
+	if ( S_ISDIR( statInfo.st_mode ) )
+	{
+	    if ( statInfo.st_dev != device )
+	    {
+		errors_ret << tr( "Not deleting mount point %1" ).arg( QString::fromUtf8( path ) );
+		ok = false;
+	    }
+	    else if ( ! removeContents( path, device, errors_ret ) )
+	    {
+		ok = false;
+	    }
+	    else if ( ::unlinkat( fd, name, AT_REMOVEDIR ) == 0 )
+	    {
+		freed += statInfo.st_blocks * STD_BLOCK_SIZE;
+	    }
+	    else if ( errno != ENOENT )
+	    {
+		errors_ret << errorMessage( tr( "Can't remove directory %1: %2" ), path );
+		ok = false;
+	    }
+	}
+	else if ( ::unlinkat( fd, name, 0 ) == 0 )
+	{
+	    // Only the last link frees the disk space
+
+	    if ( statInfo.st_nlink <= 1 )
+		freed += statInfo.st_blocks * STD_BLOCK_SIZE;
+	}
+	else if ( errno != ENOENT )
+	{
+	    errors_ret << errorMessage( tr( "Can't delete %1: %2" ), path );
+	    ok = false;
+	}
+    }
+
+    ::closedir( dirStream ); // This also closes fd
+    addBytesFreed( freed );
+
+    return ok;
+}
+
+
+void ParallelDeleter::addBytesFreed( qint64 bytes )
+{
+    if ( bytes == 0 )
+	return;
+
+    QMutexLocker locker( &_bytesMutex );
+    _bytesFreed += bytes;
+}
+
+
+qint64 ParallelDeleter::bytesFreed() const
+{
+    QMutexLocker locker( &_bytesMutex );
+    return _bytesFreed;
+}
+
+
+void ParallelDeleter::levelFinished()
+{
+    foreach ( int jobNo, _levels.at( _level ) )
+    {
+	Job & job = _jobs[ jobNo ];
+
+	foreach ( const QString & message, job.errors )
+	{
+	    ++_errorCount;
+	    emit error( message );
+	}
+
+	job.errors.clear();
+
+	if ( job.ok )
+	{
+	    if ( job.removeDir )
+		removeFromTree( job.item, QString::fromUtf8( job.dir ) );
+	    else
+	    {
+		// Take the names from the job, not from the items: If the
+		// tree changed in the meantime, the items might be gone.
+
+		for ( int i=0; i < job.fileItems.size() && i < job.files.size(); ++i )
+		{
+		    removeFromTree( job.fileItems.at( i ),
+				    QString::fromUtf8( job.dir + "/" + job.files.at( i ) ) );
+		}
+	    }
+	}
+	else if ( job.parent >= 0 )
+	{
+	    _jobs[ job.parent ].childFailed = true;
+	}
+
+	job.files.clear(); // Free the memory ASAP
+    }
+
+    reportProgress();
+
+    --_level;
+    startLevel();
+}
+
+
+void ParallelDeleter::removeFromTree( FileInfo * item, const QString & path )
+{
+    if ( ! _tree )
+	return;
+
+    if ( _tree->isBusy() )
+    {
+	logWarning() << "Not updating the tree for " << path
+		     << ": DirTree is being read" << endl;
+	_itemsValid = false;
+	return;
+    }
+
+    if ( _tree->generation() != _generation )
+    {
+	// Something else changed the tree: The items might be gone
+
+	_itemsValid = false;
+    }
+
+    if ( ! _itemsValid )
+	item = _tree->locate( path );
+
+    if ( item )
+	_tree->deleteSubtree( item );
+
+    _generation = _tree->generation();
+}
+
+
+void ParallelDeleter::reportProgress()
+{
+    emit progress( doneCount(), _totalCount );
+}
+
+
+void ParallelDeleter::finish()
+{
+    _progressTimer.stop();
+    _finished = true;
+
+    // A failed job (or one that was never started) that has no parent job
+    // is what is left of a selected item.
+
+    foreach ( const Job & job, _jobs )
+    {
+	if ( job.parent < 0 && ! job.ok )
+	    _failedPaths << QString::fromUtf8( job.dir );
+    }
+
+    logDebug() << "Deleted " << doneCount() << " of " << _totalCount << " items; "
+	       << _errorCount << " errors" << endl;
+
+    reportProgress();
+    emit finished( _errorCount );
+}
+
+
+FileInfoSet ParallelDeleter::failedItems() const
+{
+    FileInfoSet items;
+
+    if ( ! _tree )
+	return items;
+
+    foreach ( const QString & path, _failedPaths + _emptiedPaths )
+    {
+	FileInfo * item = _tree->locate( path );
+
+	if ( item )
+	    items << item;
+    }
+
+    return items.normalized();
+}
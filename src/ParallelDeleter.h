@@ -0,0 +1,296 @@
+/*
+ *   File name: ParallelDeleter.h
+ *   Summary:	Deleting subtrees in worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ParallelDeleter_h
+#define ParallelDeleter_h
+
+
+#include <sys/types.h>
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+
+#include "FileInfoSet.h"
+
+
+namespace QDirStat
+{
+    class DirTree;
+
+    /**
+     * Deleting the selected items and everything below them without any
+     * external rm commands: The deleter knows the subtree from the DirTree,
+     * so it can unlink() the files of many directories in parallel in a
+     * bounded thread pool instead of one after the other.
+     *
+     * The directories are done level by level, the deepest ones first, so
+     * each directory is already empty when it is removed. After each level,
+     * the deleted directories are removed from the DirTree right away, so
+     * the views shrink while the deleter is working, and nothing needs to
+     * be read again.
+     *
+     * Anything on the disk that the tree does not know (excluded or unread
+     * directories, files that were created after reading) is found and
+     * deleted with readdir() when a directory is not empty at the end, but
+     * never on another filesystem. Directories that could not be removed
+     * completely are refreshed when the deleter is finished.
+     *
+     * This lives on the main thread; only the unlink() and rmdir() calls
+     * are done in the worker threads.
+     **/
+    class ParallelDeleter: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor: Prepare deleting 'items', which should be normalized
+	 * and must not contain pseudo directories or packages.
+	 **/
+	ParallelDeleter( const FileInfoSet & items, QObject * parent = 0 );
+
+	/**
+	 * Constructor: Prepare deleting everything in the directories 'dirs'
+	 * (e.g. the trash directories), but not the directories themselves.
+	 *
+	 * Whatever of them 'tree' knows is collected from the tree (so it is
+	 * deleted directory by directory in parallel and removed from the
+	 * tree); for the others, each subdirectory is one job that deletes
+	 * it with readdir(). 'tree' may be 0.
+	 **/
+	ParallelDeleter( const QStringList & dirs,
+			 DirTree *	     tree,
+			 QObject *	     parent = 0 );
+
+	/**
+	 * Destructor. This cancels the deleter and waits for the worker
+	 * threads.
+	 **/
+	virtual ~ParallelDeleter();
+
+	/**
+	 * Start deleting.
+	 **/
+	void start();
+
+	/**
+	 * Stop deleting after the directories that are in progress.
+	 **/
+	void cancel();
+
+	/**
+	 * Return 'true' if the deleter is finished.
+	 **/
+	bool isFinished() const { return _finished; }
+
+	/**
+	 * Return the number of files and directories that are deleted so
+	 * far and the number of those that the tree knows of.
+	 **/
+	int doneCount()  const { return _doneCount.loadAcquire(); }
+	int totalCount() const { return _totalCount; }
+
+	/**
+	 * Return the number of the errors so far.
+	 **/
+	int errorCount() const { return _errorCount; }
+
+	/**
+	 * Return the number of bytes freed so far: The allocated sizes of
+	 * the deleted files and directories.
+	 **/
+	qint64 bytesFreed() const;
+
+	/**
+	 * Return the directories that are still in the tree because they
+	 * could not be deleted completely and the emptied directories (see
+	 * the second constructor) that are in the tree, but were not read
+	 * there. Only use this when the deleter is finished.
+	 **/
+	FileInfoSet failedItems() const;
+
+
+    signals:
+
+	/**
+	 * Emitted from time to time while deleting.
+	 **/
+	void progress( int done, int total );
+
+	/**
+	 * Emitted for each error.
+	 **/
+	void error( const QString & message );
+
+	/**
+	 * Emitted when the deleter is finished or canceled.
+	 **/
+	void finished( int errorCount );
+
+
+    protected slots:
+
+	/**
+	 * Notification that the worker threads are done with the current
+	 * level: Update the tree and start the next level.
+	 **/
+	void levelFinished();
+
+	/**
+	 * Emit the progress.
+	 **/
+	void reportProgress();
+
+
+    protected:
+
+	/**
+	 * What to do in one directory: Unlink 'files', then remove the
+	 * directory itself if 'removeDir' is set or everything else in it if
+	 * 'emptyDir' is set.
+	 **/
+	struct Job
+	{
+	    QByteArray	      dir;
+	    QList<QByteArray> files;
+	    QVector<FileSize> sizes;	      // Allocated sizes of 'files'
+	    FileSize	      dirSize;	      // Allocated size of 'dir' itself
+	    FileInfo *	      item;	      // The directory; only for the main thread
+	    QList<FileInfo *> fileItems;      // The selected files if ! removeDir
+	    dev_t	      device;
+	    int		      parent;	      // Job index or -1
+	    bool	      removeDir;
+	    bool	      emptyDir;
+	    bool	      childFailed;    // Set on the main thread
+	    bool	      ok;	      // Set by the worker
+	    QStringList	      errors;	      // Set by the worker
+	};
+
+	/**
+	 * Common initializations of both constructors: Set up the thread pool
+	 * with 'threads' threads and the progress timer.
+	 **/
+	void init( int threads );
+
+	/**
+	 * Add the jobs for emptying directory 'dir'.
+	 **/
+	void collectContents( const QString & dir );
+
+	/**
+	 * Add the jobs for emptying directory 'dir' that is not in the tree:
+	 * One for the subdirectories each and one for the other entries.
+	 **/
+	void collectDiskContents( const QString & dir );
+
+	/**
+	 * Add the jobs for 'item' and its subtree.
+	 **/
+	void collect( FileInfo * item );
+
+	/**
+	 * Add the job for directory 'dir' on 'level' and the jobs for its
+	 * subdirectories.
+	 **/
+	void collectDir( FileInfo * dir, int parentJob, int level );
+
+	/**
+	 * Add the children of 'parent' (the directory of job 'jobNo' or one
+	 * of its pseudo directories) to that job or to new subdirectory
+	 * jobs.
+	 **/
+	void collectChildren( FileInfo * parent, int jobNo, int level );
+
+	/**
+	 * Add a new job and return its index.
+	 **/
+	int addJob( const Job & job, int level );
+
+	/**
+	 * Start the worker threads for '_levels[ _level ]'.
+	 **/
+	void startLevel();
+
+	/**
+	 * Do the jobs of the current level until there are no more. This is
+	 * called in the worker threads.
+	 **/
+	void runTask();
+
+	/**
+	 * Do one job. This is called in the worker threads.
+	 **/
+	void doJob( Job & job );
+
+	/**
+	 * Unlink everything in 'dir' that is still there, recursively, but
+	 * only on 'device'. This is called in the worker threads.
+	 **/
+	bool removeContents( const QByteArray & dir,
+			     dev_t		device,
+			     QStringList &	errors_ret );
+
+	/**
+	 * Add 'bytes' to the bytes freed so far. This is called in the
+	 * worker threads.
+	 **/
+	void addBytesFreed( qint64 bytes );
+
+	/**
+	 * Remove 'item' with 'path' from the tree. If anything else changed
+	 * the tree in the meantime, 'item' might be gone, so it is looked up
+	 * by 'path' instead.
+	 **/
+	void removeFromTree( FileInfo * item, const QString & path );
+
+	/**
+	 * Wrap up when all levels are done.
+	 **/
+	void finish();
+
+
+	//
+	// Data members
+	//
+
+	DirTree *	     _tree;
+	quint64		     _generation;
+	bool		     _itemsValid;
+	QVector<Job>	     _jobs;
+	Job *		     _jobData;	      // _jobs.data() for the worker threads
+	QVector<QVector<int> > _levels;	      // Job indices by depth
+	int		     _level;	      // Current level, counting down
+	int		     _totalCount;
+	int		     _errorCount;
+	QStringList	     _startErrors;
+	QStringList	     _failedPaths;
+	QStringList	     _emptiedPaths;   // In the tree
+	bool		     _finished;
+	QThreadPool	     _threadPool;
+	QTimer		     _progressTimer;
+	QAtomicInt	     _next;	      // Next index in the current level
+	QAtomicInt	     _running;	      // Worker tasks of the current level
+	QAtomicInt	     _doneCount;
+	QAtomicInt	     _canceled;
+	mutable QMutex	     _bytesMutex;
+	qint64		     _bytesFreed;
+
+    };	// class ParallelDeleter
+
+}	// namespace QDirStat
+
+
+#endif	// ParallelDeleter_h
@@ -0,0 +1,324 @@
+/*
+ *   File name: ParallelWalker.cpp
+ *   Summary:	Walking the files of a subtree in worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include "ParallelWalker.h"
+#include "FileInfo.h"
+#include "FileInfoIterator.h"
+#include "TreeSnapshot.h"
+
+
+// Subtrees with fewer items are walked in the calling thread
+#define ParallelWalkMinItems	100000
+
+// Subtrees with fewer items are walked in the calling thread by I/O tasks
+#define ParallelIoWalkMinItems	1000
+
+// I/O tasks for each CPU: Most of them are waiting most of the time
+#define IoTasksPerCpu		4
+
+// Interval for calling the progress function of forEachItem()
+#define ProgressMillisec	250
+
+// Parts of the subtree for each task, so tasks that are done early can take
+// over some of the work of the others
+#define PartsPerTask		8
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * One part of a subtree: Either a directory with everything below it
+     * or only the files directly in a directory that is too big for
+     * one part.
+     **/
+    struct WalkPart
+    {
+	FileInfo * dir;
+	bool	   recursive;
+    };
+
+
+    /**
+     * Call 'func' for each file below 'dir' or, with 'allItems', for each
+     * item below 'dir'.
+     **/
+    void walkFiles( FileInfo *			     dir,
+		    bool			     recursive,
+		    bool			     allItems,
+		    int				     task,
+		    const ParallelWalker::FileFunc & func )
+    {
+	FileInfoIterator it( dir );
+
+	while ( *it )
+	{
+	    FileInfo * item = *it;
+
+	    if ( allItems )
+		func( task, item );
+
+	    if ( item->hasChildren() )
+	    {
+		if ( recursive )
+		    walkFiles( item, true, allItems, task, func );
+	    }
+	    else if ( item->isFile() && ! allItems )
+	    {
+		func( task, item );
+	    }
+	    // Disregard symlinks, block devices and other special files
+
+	    ++it;
+	}
+    }
+
+
+    /**
+     * Split the subtree of 'dir' into parts with no more than 'maxItems'
+     * items (except for the items directly in a directory). With
+     * 'allItems', the subdirectories themselves also need a part for the
+     * items directly in their parent.
+     **/
+    void split( FileInfo * dir, int maxItems, bool allItems, QVector<WalkPart> & parts )
+    {
+	if ( dir->totalItems() <= maxItems )
+	{
+	    WalkPart part = { dir, true };
+	    parts << part;
+	    return;
+	}
+
+	bool haveFiles = false;
+	FileInfoIterator it( dir );
+
+	while ( *it )
+	{
+	    if ( (*it)->hasChildren() )
+		split( *it, maxItems, allItems, parts );
+
+	    if ( allItems || ! (*it)->hasChildren() )
+		haveFiles = true;
+
+	    ++it;
+	}
+
+	if ( haveFiles )
+	{
+	    WalkPart part = { dir, false };
+	    parts << part;
+	}
+    }
+
+
+    class FileTask: public QRunnable
+    {
+    public:
+
+	FileTask( const QVector<WalkPart> &	   parts,
+		  bool				   allItems,
+		  int				   task,
+		  const ParallelWalker::FileFunc & func,
+		  QAtomicInt &			   next ):
+	    _parts( parts ),
+	    _allItems( allItems ),
+	    _task( task ),
+	    _func( func ),
+	    _next( next )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    int i;
+
+	    while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _parts.size() )
+		walkFiles( _parts.at( i ).dir, _parts.at( i ).recursive, _allItems, _task, _func );
+	}
+
+    private:
+
+	const QVector<WalkPart> &	 _parts;
+	bool				 _allItems;
+	int				 _task;
+	const ParallelWalker::FileFunc & _func;
+	QAtomicInt &			 _next;
+    };
+
+
+    class NodeTask: public QRunnable
+    {
+    public:
+
+	NodeTask( const TreeSnapshot &		   snapshot,
+		  int				   partCount,
+		  int				   task,
+		  const ParallelWalker::NodeFunc & func,
+		  QAtomicInt &			   next ):
+	    _snapshot( snapshot ),
+	    _partCount( partCount ),
+	    _task( task ),
+	    _func( func ),
+	    _next( next )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    const QVector<TreeSnapshotNode> & nodes = _snapshot.nodes();
+	    int i;
+
+	    while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _partCount )
+	    {
+		int begin = (qint64) nodes.size() * i	    / _partCount;
+		int end	  = (qint64) nodes.size() * ( i+1 ) / _partCount;
+
+		for ( int pos = begin; pos < end; ++pos )
+		{
+		    if ( nodes.at( pos ).isFile() )
+			_func( _task, nodes.at( pos ) );
+		}
+	    }
+	}
+
+    private:
+
+	const TreeSnapshot &		 _snapshot;
+	int				 _partCount;
+	int				 _task;
+	const ParallelWalker::NodeFunc & _func;
+	QAtomicInt &			 _next;
+    };
+
+
+    /**
+     * Walk 'subtree' in 'taskCount' tasks and call 'progress' (if set)
+     * while waiting for them.
+     **/
+    void walkParallel( FileInfo *			  subtree,
+		       int				  taskCount,
+		       bool				  allItems,
+		       const ParallelWalker::FileFunc &	  func,
+		       const ParallelWalker::ProgressFunc & progress )
+    {
+	QVector<WalkPart> parts;
+	split( subtree, qMax( 1, subtree->totalItems() / ( taskCount * PartsPerTask ) ),
+	       allItems, parts );
+
+	QThreadPool threadPool;
+	threadPool.setMaxThreadCount( taskCount );
+	QAtomicInt next( 0 );
+
+	for ( int task = 0; task < taskCount; ++task )
+	    threadPool.start( new FileTask( parts, allItems, task, func, next ) );
+
+	if ( progress )
+	{
+	    while ( ! threadPool.waitForDone( ProgressMillisec ) )
+		progress();
+	}
+	else
+	{
+	    threadPool.waitForDone();
+	}
+    }
+
+}	// namespace
+
+
+int ParallelWalker::taskCount( FileInfo * subtree )
+{
+    if ( ! subtree || subtree->totalItems() < ParallelWalkMinItems )
+	return 1;
+
+    return qMax( 1, QThread::idealThreadCount() );
+}
+
+
+int ParallelWalker::ioTaskCount( FileInfo * subtree )
+{
+    if ( ! subtree || subtree->totalItems() < ParallelIoWalkMinItems )
+	return 1;
+
+    return qMax( 1, QThread::idealThreadCount() ) * IoTasksPerCpu;
+}
+
+
+int ParallelWalker::taskCount( const TreeSnapshot & snapshot )
+{
+    if ( snapshot.size() < ParallelWalkMinItems )
+	return 1;
+
+    return qMax( 1, QThread::idealThreadCount() );
+}
+
+
+void ParallelWalker::forEachFile( FileInfo *	   subtree,
+				  int		   taskCount,
+				  const FileFunc & func )
+{
+    if ( ! subtree )
+	return;
+
+    if ( subtree->isFile() )
+	func( 0, subtree );
+
+    if ( taskCount <= 1 )
+	walkFiles( subtree, true, false, 0, func );
+    else
+	walkParallel( subtree, taskCount, false, func, ProgressFunc() );
+}
+
+
+void ParallelWalker::forEachItem( FileInfo *	       subtree,
+				  int		       taskCount,
+				  const FileFunc &     func,
+				  const ProgressFunc & progress )
+{
+    if ( ! subtree )
+	return;
+
+    if ( taskCount <= 1 )
+	walkFiles( subtree, true, true, 0, func );
+    else
+	walkParallel( subtree, taskCount, true, func, progress );
+}
+
+
+void ParallelWalker::forEachFile( const TreeSnapshot & snapshot,
+				  int		       taskCount,
+				  const NodeFunc &     func )
+{
+    if ( snapshot.isEmpty() )
+	return;
+
+    taskCount     = qMax( 1, taskCount );
+    int partCount = qMin( snapshot.size(), taskCount * PartsPerTask );
+    QAtomicInt next( 0 );
+
+    if ( taskCount == 1 )
+    {
+	NodeTask( snapshot, 1, 0, func, next ).run();
+	return;
+    }
+
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount( taskCount );
+
+    for ( int task = 0; task < taskCount; ++task )
+	threadPool.start( new NodeTask( snapshot, partCount, task, func, next ) );
+
+    threadPool.waitForDone();
+}
@@ -0,0 +1,97 @@
+/*
+ *   File name: ParallelWalker.h
+ *   Summary:	Walking the files of a subtree in worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ParallelWalker_h
+#define ParallelWalker_h
+
+
+#include <functional>
+
+
+namespace QDirStat
+{
+    class FileInfo;
+    class TreeSnapshot;
+    struct TreeSnapshotNode;
+
+    /**
+     * Calling a function for each file of a subtree in worker threads, e.g.
+     * to collect statistics: The subtree is split into parts of similar
+     * size, and each task of a thread pool handles one part after the
+     * other. Each task number only runs in one thread at a time, so with
+     * one accumulator for each task, the function doesn't need any
+     * locking; merge the accumulators when it's done.
+     *
+     * The live tree is only read, and the calling thread waits until all
+     * tasks are done, so nothing can change it meanwhile. Use that only on
+     * the main thread. A TreeSnapshot can be walked from any thread.
+     *
+     * The function must not use anything that is not thread safe, e.g. the
+     * Logger or the MimeCategorizer (use a MimeMatcher instead).
+     **/
+    class ParallelWalker
+    {
+    public:
+
+	typedef std::function<void( int task, FileInfo * file )> FileFunc;
+	typedef std::function<void( int task, const TreeSnapshotNode & node )> NodeFunc;
+	typedef std::function<void()> ProgressFunc;
+
+	/**
+	 * Return the number of tasks to use for 'subtree': 1 for small
+	 * subtrees that are not worth any threads.
+	 **/
+	static int taskCount( FileInfo * subtree );
+
+	/**
+	 * Return the number of tasks to use for a function that waits for
+	 * I/O for some items (e.g. lstat() calls) on 'subtree': More tasks
+	 * than CPUs, and even for smaller subtrees.
+	 **/
+	static int ioTaskCount( FileInfo * subtree );
+	static int taskCount( const TreeSnapshot & snapshot );
+
+	/**
+	 * Call 'func' for each file in 'subtree' (including 'subtree' itself
+	 * if it is a file) in task numbers 0 .. taskCount-1. This must be
+	 * called on the main thread; it returns when all files are done.
+	 **/
+	static void forEachFile( FileInfo *	    subtree,
+				 int		    taskCount,
+				 const FileFunc &   func );
+
+	/**
+	 * Call 'func' for each item of any kind in 'subtree' (but not for
+	 * 'subtree' itself) in task numbers 0 .. taskCount-1, directories
+	 * and dot entries included. This must be called on the main thread.
+	 *
+	 * While the tasks are running, 'progress' (if set) is called on the
+	 * main thread every few hundred milliseconds, e.g. to show partial
+	 * results. It must not change the tree. This returns when all items
+	 * are done.
+	 **/
+	static void forEachItem( FileInfo *	      subtree,
+				 int		      taskCount,
+				 const FileFunc &     func,
+				 const ProgressFunc & progress = ProgressFunc() );
+
+	/**
+	 * Call 'func' for each file node of 'snapshot' in task numbers 0 ..
+	 * taskCount-1. This can be called from any thread; it returns when
+	 * all nodes are done.
+	 **/
+	static void forEachFile( const TreeSnapshot & snapshot,
+				 int		      taskCount,
+				 const NodeFunc &     func );
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef ParallelWalker_h
@@ -8,6 +8,8 @@
 
 
 #include <QPainter>
+#include <QPixmap>
+#include <QPixmapCache>
 #include <QTreeView>
 
 #include "PercentBar.h"
@@ -154,6 +156,81 @@ QSize PercentBarDelegate::sizeHint( const QStyleOptionViewItem & option,
 
 
 
+namespace
+{
+    /**
+     * Draw a percent bar with its fill part 'fillWidth' pixels wide into
+     * the rectangle at 'x', 'y' with width 'w' and height 'h'.
+     **/
+    void drawPercentBar( QPainter *	painter,
+			 int		x,
+			 int		y,
+			 int		w,
+			 int		h,
+			 int		fillWidth,
+			 int		penWidth,
+			 const QColor & fillColor,
+			 const QColor & barBackground,
+			 const QColor & background )
+    {
+	QPen pen( painter->pen() );
+	pen.setWidth( 0 );
+	painter->setPen( pen );
+	painter->setBrush( Qt::NoBrush );
+
+
+	// Fill bar background.
+
+	painter->fillRect( x + penWidth, y + penWidth,
+			   w - 2 * penWidth + 1, h - 2 * penWidth + 1,
+			   barBackground );
+	/*
+	 * Notice: The Xlib XDrawRectangle() function always fills one
+	 * pixel less than specified. Although this is very likely just a
+	 * plain old bug, it is documented that way. Obviously, Qt just
+	 * maps the fillRect() call directly to XDrawRectangle() so they
+	 * inherited that bug (although the Qt doc stays silent about
+	 * it). So it is really necessary to compensate for that missing
+	 * pixel in each dimension.
+	 *
+	 * If you don't believe it, see for yourself.
+	 * Hint: Try the xmag program to zoom into the drawn pixels.
+	 **/
+
+	// Fill the desired percentage.
+
+	painter->fillRect( x + penWidth, y + penWidth,
+			   fillWidth+1, h - 2 * penWidth+1,
+			   fillColor );
+
+
+	// Draw 3D shadows.
+
+	pen.setColor( contrastingColor ( Qt::black, background ) );
+	painter->setPen( pen );
+	painter->drawLine( x, y, x+w, y );
+	painter->drawLine( x, y, x, y+h );
+
+	pen.setColor( contrastingColor( barBackground.darker(), background ) );
+	painter->setPen( pen );
+	painter->drawLine( x+1, y+1, x+w-1, y+1 );
+	painter->drawLine( x+1, y+1, x+1, y+h-1 );
+
+	pen.setColor( contrastingColor( barBackground.lighter(), background ) );
+	painter->setPen( pen );
+	painter->drawLine( x+1, y+h, x+w, y+h );
+	painter->drawLine( x+w, y, x+w, y+h );
+
+	pen.setColor( contrastingColor( Qt::white, background ) );
+	painter->setPen( pen );
+	painter->drawLine( x+2, y+h-1, x+w-1, y+h-1 );
+	painter->drawLine( x+w-1, y+1, x+w-1, y+h-1 );
+    }
+
+}	// namespace
+
+
+
 namespace QDirStat
 {
     void paintPercentBar( float		 percent,
@@ -166,74 +243,56 @@ namespace QDirStat
 	int penWidth = 2;
 	int extraMargin = 4;
 	int itemMargin = 4;
-	int x = cellRect.x() + itemMargin;
-	int y = cellRect.y() + extraMargin;
-	int w = cellRect.width() - 2 * itemMargin;
+	int x = itemMargin + indentPixel;
+	int y = extraMargin;
+	int w = cellRect.width() - 2 * itemMargin - indentPixel;
 	int h = cellRect.height() - 2 * extraMargin;
-	int fillWidth;
 
-	painter->eraseRect( cellRect );
-	w -= indentPixel;
-	x += indentPixel;
+	if ( w <= 0 )
+	{
+	    painter->eraseRect( cellRect );
+	    return;
+	}
+
+	int fillWidth = (int) ( ( w - 2 * penWidth ) * percent / 100.0);
+	QColor background = painter->background().color();
 
-	if ( w > 0 )
+#if (QT_VERSION >= QT_VERSION_CHECK( 5, 6, 0 ))
+	qreal pixelRatio = painter->device()->devicePixelRatioF();
+#else
+	qreal pixelRatio = 1.0;
+#endif
+
+	// Bars only differ in these, so each one is rendered only once and
+	// then just copied from the pixmap cache when the view is painted
+
+	QString key = QString( "PercentBar-%1x%2@%3-%4-%5-%6-%7-%8" )
+	    .arg( cellRect.width() ).arg( cellRect.height() ).arg( pixelRatio )
+	    .arg( indentPixel ).arg( fillWidth )
+	    .arg( fillColor.rgba() ).arg( barBackground.rgba() ).arg( background.rgba() );
+
+	QPixmap pixmap;
+
+	if ( ! QPixmapCache::find( key, &pixmap ) )
 	{
-	    QPen pen( painter->pen() );
-	    pen.setWidth( 0 );
-	    painter->setPen( pen );
-	    painter->setBrush( Qt::NoBrush );
-	    fillWidth = (int) ( ( w - 2 * penWidth ) * percent / 100.0);
-
-
-	    // Fill bar background.
-
-	    painter->fillRect( x + penWidth, y + penWidth,
-			       w - 2 * penWidth + 1, h - 2 * penWidth + 1,
-			       barBackground );
-	    /*
-	     * Notice: The Xlib XDrawRectangle() function always fills one
-	     * pixel less than specified. Although this is very likely just a
-	     * plain old bug, it is documented that way. Obviously, Qt just
-	     * maps the fillRect() call directly to XDrawRectangle() so they
-	     * inherited that bug (although the Qt doc stays silent about
-	     * it). So it is really necessary to compensate for that missing
-	     * pixel in each dimension.
-	     *
-	     * If you don't believe it, see for yourself.
-	     * Hint: Try the xmag program to zoom into the drawn pixels.
-	     **/
-
-	    // Fill the desired percentage.
-
-	    painter->fillRect( x + penWidth, y + penWidth,
-			       fillWidth+1, h - 2 * penWidth+1,
-			       fillColor );
-
-
-	    // Draw 3D shadows.
-
-	    QColor background = painter->background().color();
-
-	    pen.setColor( contrastingColor ( Qt::black, background ) );
-	    painter->setPen( pen );
-	    painter->drawLine( x, y, x+w, y );
-	    painter->drawLine( x, y, x, y+h );
-
-	    pen.setColor( contrastingColor( barBackground.darker(), background ) );
-	    painter->setPen( pen );
-	    painter->drawLine( x+1, y+1, x+w-1, y+1 );
-	    painter->drawLine( x+1, y+1, x+1, y+h-1 );
-
-	    pen.setColor( contrastingColor( barBackground.lighter(), background ) );
-	    painter->setPen( pen );
-	    painter->drawLine( x+1, y+h, x+w, y+h );
-	    painter->drawLine( x+w, y, x+w, y+h );
-
-	    pen.setColor( contrastingColor( Qt::white, background ) );
-	    painter->setPen( pen );
-	    painter->drawLine( x+2, y+h-1, x+w-1, y+h-1 );
-	    painter->drawLine( x+w-1, y+1, x+w-1, y+h-1 );
+	    pixmap = QPixmap( cellRect.size() * pixelRatio );
+
+#if (QT_VERSION >= QT_VERSION_CHECK( 5, 6, 0 ))
+	    pixmap.setDevicePixelRatio( pixelRatio );
+#endif
+	    pixmap.fill( background );
+
+	    QPainter pixmapPainter( &pixmap );
+	    pixmapPainter.setPen( painter->pen() );
+
+	    drawPercentBar( &pixmapPainter, x, y, w, h, fillWidth, penWidth,
+			    fillColor, barBackground, background );
+	    pixmapPainter.end();
+
+	    QPixmapCache::insert( key, pixmap );
 	}
+
+	painter->drawPixmap( cellRect.topLeft(), pixmap );
     }
 
 
@@ -109,6 +109,9 @@ namespace QDirStat
     /**
      * Paint a percent bar into a widget.
      * 'indentPixel' is the number of pixels to indent the bar.
+     *
+     * The bars are rendered into pixmaps that are kept in the QPixmapCache,
+     * so painting the same bar again is just copying that pixmap.
      **/
     void paintPercentBar( float		 percent,
 			  QPainter *	 painter,
@@ -7,7 +7,7 @@
  */
 
 
-#include <math.h>       // ceil()
+#include <math.h>       // ceil(), floor()
 #include <algorithm>
 
 #include "PercentileStats.h"
@@ -19,7 +19,9 @@ using namespace QDirStat;
 
 
 PercentileStats::PercentileStats():
-    _sorted( false )
+    _sorted( false ),
+    _useSketch( false ),
+    _sketchError( 0.0 )
 {
 
 }
@@ -37,29 +39,185 @@ void PercentileStats::clear()
     // list to _data.
 
     _data = QRealList();
+    _sorted = false;
+    _partitionPos.clear();
+    _sortedPos.clear();
+    _sketch.clear();
 }
 
 
-void PercentileStats::sort()
+void PercentileStats::setSketchError( qreal epsilon )
 {
-    if ( _data.size() > VERBOSE_SORT_THRESHOLD )
+    clear();
+    _useSketch	 = epsilon > 0.0;
+    _sketchError = _useSketch ? epsilon : 0.0;
+
+    if ( _useSketch )
+        _sketch = QuantileSketch( QuantileSketch::kForError( epsilon ) );
+}
+
+
+void PercentileStats::merge( const PercentileStats & other )
+{
+    if ( _useSketch != other._useSketch )
+        THROW( Exception( "Can't merge exact statistics with a sketch" ) );
+
+    if ( _useSketch )
+    {
+        _sketch.merge( other._sketch );
+    }
+    else
+    {
+        _data += other._data;
+        _sorted = false;
+        _partitionPos.clear();
+        _sortedPos.clear();
+    }
+}
+
+
+void PercentileStats::sort( bool verbose )
+{
+    if ( _useSketch )   // The sketch is sorted when it is needed
+        return;
+
+    verbose = verbose && _data.size() > VERBOSE_SORT_THRESHOLD;
+
+    if ( verbose )
         logDebug() << "Sorting " << _data.size() << " elements" << endl;
 
     std::sort( _data.begin(), _data.end() );
     _sorted = true;
 
-    if ( _data.size() > VERBOSE_SORT_THRESHOLD )
+    if ( verbose )
         logDebug() << "Sorting done." << endl;
 }
 
 
+void PercentileStats::partitionPercentiles()
+{
+    if ( _data.isEmpty() || _sorted || _useSketch )
+        return;
+
+    for ( int i=0; i <= 100; ++i )
+        valueAt( percentileEnd( i ) );
+}
+
+
+qreal PercentileStats::valueAt( int pos )
+{
+    if ( _sorted || ( pos < _sortedPos.size() && _sortedPos.testBit( pos ) ) )
+        return _data.at( pos );
+
+    // Find the closest positions around 'pos' that are already there: Only
+    // the elements between them can belong at 'pos'.
+
+    QList<int>::iterator it = std::lower_bound( _partitionPos.begin(), _partitionPos.end(), pos );
+
+    if ( it != _partitionPos.end() && *it == pos )
+        return _data.at( pos );
+
+    int first = it == _partitionPos.begin() ? 0		   : *( it - 1 ) + 1;
+    int last  = it == _partitionPos.end()   ? _data.size() : *it;
+
+    std::nth_element( _data.begin() + first, _data.begin() + pos, _data.begin() + last );
+    _partitionPos.insert( it, pos );
+
+    return _data.at( pos );
+}
+
+
+void PercentileStats::sortSegment( int first, int last )
+{
+    if ( first >= last )
+        return;
+
+    if ( _sortedPos.size() != _data.size() )
+        _sortedPos = QBitArray( _data.size() );
+
+    if ( _sortedPos.testBit( first ) )
+        return;
+
+    std::sort( _data.begin() + first, _data.begin() + last );
+    _sortedPos.fill( true, first, last );
+}
+
+
+int PercentileStats::countBelow( qreal value, bool orEqual )
+{
+    if ( dataSize() == 0 )
+        return 0;
+
+    if ( _useSketch )
+    {
+        qint64 count = 0;
+
+        foreach ( const QuantileSketch::WeightedValue & val, _sketch.sortedValues() )
+        {
+            if ( val.value > value || ( val.value == value && ! orEqual ) )
+                break;
+
+            count += val.weight;
+        }
+
+        return (int) count;
+    }
+
+    if ( _sorted )
+    {
+        QRealList::iterator it = orEqual ?
+            std::upper_bound( _data.begin(), _data.end(), value ) :
+            std::lower_bound( _data.begin(), _data.end(), value );
+
+        return it - _data.begin();
+    }
+
+    partitionPercentiles();
+
+    // Find the first partition position with an element that does not
+    // count: Everything up to the one before it counts, nothing from there
+    // on. Only the elements between them need to be checked.
+
+    int lo = 0;
+    int hi = _partitionPos.size();
+
+    while ( lo < hi )
+    {
+        int   mid = ( lo + hi ) / 2;
+        qreal val = _data.at( _partitionPos.at( mid ) );
+
+        if ( val < value || ( val == value && orEqual ) )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int first = lo == 0			 ? 0		: _partitionPos.at( lo - 1 ) + 1;
+    int last  = lo == _partitionPos.size() ? _data.size() : _partitionPos.at( lo );
+
+    sortSegment( first, last );
+
+    QRealList::iterator it = orEqual ?
+        std::upper_bound( _data.begin() + first, _data.begin() + last, value ) :
+        std::lower_bound( _data.begin() + first, _data.begin() + last, value );
+
+    return it - _data.begin();
+}
+
+
+int PercentileStats::percentileEnd( int number ) const
+{
+    return qMin( (int) floor( number * _data.size() / 100.0 ), _data.size() - 1 );
+}
+
+
 qreal PercentileStats::median()
 {
-    if ( _data.isEmpty() )
+    if ( dataSize() == 0 )
         return 0;
 
-    if ( ! _sorted )
-        sort();
+    if ( _useSketch )
+        return _sketch.quantile( 0.5 );
 
     int centerPos = _data.size() / 2;
 
@@ -69,7 +227,7 @@ qreal PercentileStats::median()
     // _data.size() is 5, we get _data[2] which is the center of
     // [0, 1, 2, 3, 4].
 
-    qreal result = _data.at( centerPos );
+    qreal result = valueAt( centerPos );
 
     if ( _data.size() % 2 == 0 ) // Even number of data
     {
@@ -79,7 +237,7 @@ qreal PercentileStats::median()
         // _data[3], and now we need to average this with _data[2] of
         // [0, 1, 2, 3, 4, 5].
 
-        result = ( result + _data.at( centerPos - 1 ) ) / 2.0;
+        result = ( result + valueAt( centerPos - 1 ) ) / 2.0;
     }
 
     return result;
@@ -88,9 +246,12 @@ qreal PercentileStats::median()
 
 qreal PercentileStats::average()
 {
-    if ( _data.isEmpty() )
+    if ( dataSize() == 0 )
         return 0.0;
 
+    if ( _useSketch )
+        return _sketch.sum() / _sketch.count();
+
     int count = _data.size();
     qreal sum = 0.0;
 
@@ -103,31 +264,31 @@ qreal PercentileStats::average()
 
 qreal PercentileStats::min()
 {
-    if ( _data.isEmpty() )
+    if ( dataSize() == 0 )
         return 0.0;
 
-    if ( ! _sorted )
-        sort();
+    if ( _useSketch )
+        return _sketch.min();
 
-    return _data.first();
+    return valueAt( 0 );
 }
 
 
 qreal PercentileStats::max()
 {
-    if ( _data.isEmpty() )
+    if ( dataSize() == 0 )
         return 0.0;
 
-    if ( ! _sorted )
-        sort();
+    if ( _useSketch )
+        return _sketch.max();
 
-    return _data.last();
+    return valueAt( _data.size() - 1 );
 }
 
 
 qreal PercentileStats::quantile( int order, int number )
 {
-    if ( _data.isEmpty() )
+    if ( dataSize() == 0 )
         return 0.0;
 
     if ( number > order )
@@ -143,14 +304,14 @@ qreal PercentileStats::quantile( int order, int number )
         THROW( Exception( msg ) );
     }
 
-    if ( ! _sorted )
-        sort();
+    if ( _useSketch )
+        return _sketch.quantile( number / (qreal) order );
 
     if ( number == 0 )
-        return _data.first();
+        return valueAt( 0 );
 
     if ( number == order )
-        return _data.last();
+        return valueAt( _data.size() - 1 );
 
     int pos = ( _data.size() * number ) / order;
 
@@ -158,14 +319,14 @@ qreal PercentileStats::quantile( int order, int number )
     // decimal place, so don't subtract 1 to compensate for starting _data with
     // index 0.
 
-    qreal result = _data.at( pos );
+    qreal result = valueAt( pos );
 
     if ( ( _data.size() * number ) % order == 0 )
     {
         // Same as in median: We hit between two elements, so use the average
         // between them.
 
-        result = ( result + _data.at( pos - 1 ) ) / 2.0;
+        result = ( result + valueAt( pos - 1 ) ) / 2.0;
     }
 
     return result;
@@ -192,16 +353,44 @@ QRealList PercentileStats::percentileSums()
     for ( int i=0; i <= 100; ++i )
         sums << 0.0;
 
-    if ( ! _sorted )
-        sort();
+    if ( dataSize() == 0 )
+        return sums;
 
-    qreal percentileSize = _data.size() / 100.0;
+    if ( _useSketch )
+    {
+        // Each value of the sketch stands for 'weight' values of the
+        // percentile its rank belongs to
+
+        QVector<QuantileSketch::WeightedValue> values = _sketch.sortedValues();
+        qreal  percentileSize = _sketch.count() / 100.0;
+        qint64 rank	      = 0;
+
+        foreach ( const QuantileSketch::WeightedValue & value, values )
+        {
+            int percentile = qBound( 1, (int) ceil( rank / percentileSize ), 100 );
 
-    for ( int i=0; i < _data.size(); ++i )
+            sums[ percentile ] += value.value * value.weight;
+            rank += value.weight;
+        }
+
+        return sums;
+    }
+
+    // Once the element at the end of each percentile is in its sorted
+    // position, all elements of that percentile are between it and the
+    // end of the previous one, just not sorted among themselves.
+
+    partitionPercentiles();
+    int start = 0;
+
+    for ( int percentile=1; percentile <= 100; ++percentile )
     {
-        int percentile = qMax( 1, (int) ceil( i / percentileSize ) );
+        int end = percentileEnd( percentile );
+
+        for ( int i=start; i <= end; ++i )
+            sums[ percentile ] += _data.at(i);
 
-        sums[ percentile ] += _data.at(i);
+        start = qMax( start, end + 1 );
     }
 
 #if 0
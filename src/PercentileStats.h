@@ -11,6 +11,9 @@
 #define PercentileStats_h
 
 #include <QList>
+#include <QBitArray>
+
+#include "QuantileSketch.h"
 
 
 typedef QList<qreal> QRealList;
@@ -25,9 +28,17 @@ namespace QDirStat
      *
      * Notice that one data item (one qreal, i.e. one 64 bit double) is
      * stored for each file (or each matching file) in this object, so this is
-     * expensive in terms of memory usage. Also, since data usually need to be
-     * sorted for those calculations and sorting has at least logarithmic cost
-     * O( n * log(n) ), this also has heavy performance impact.
+     * expensive in terms of memory usage.
+     *
+     * The data are not sorted completely for those calculations: Each
+     * quantile only moves its element into its sorted position with
+     * std::nth_element() between the closest positions that were already
+     * found before, so all percentiles together cost about O( n * log(100) )
+     * instead of O( n * log(n) ) for sorting.
+     *
+     * For very big trees, the data can be collected into a QuantileSketch
+     * instead (see setSketchError()): That needs only constant memory, but
+     * the results are approximate.
      **/
     class PercentileStats
     {
@@ -56,29 +67,75 @@ namespace QDirStat
         virtual void collect() = 0;
 
 	/**
-	 * Sort the collected data in ascending order.
-	 * This is necessary after all collect() calls.
-         *
-	 * The functions accessing results like min(), max(), median(),
-	 * quantile(), percentile() etc. all implicitly sort the data if they
-	 * are not sorted yet.
+	 * Sort the collected data in ascending order. This is only needed
+	 * if the data themselves are used in sorted order; the functions
+	 * accessing results like min(), max(), median(), quantile(),
+	 * percentile() etc. don't need it.
+	 *
+	 * Use 'verbose' = 'false' in worker threads: The logger may only be
+	 * used in the main thread.
+	 **/
+	void sort( bool verbose = true );
+
+	/**
+	 * Move the elements at all percentile boundaries into their sorted
+	 * positions, e.g. in a worker thread right after collect(), so all
+	 * later calculations only have to look at the elements between two
+	 * of them.
+	 **/
+	void partitionPercentiles();
+
+	/**
+	 * Collect the data into a QuantileSketch that keeps the quantiles
+	 * within about 'epsilon' (e.g. 0.01 for 1%) of their rank instead of
+	 * keeping all of them. 0.0 keeps all data (the default). This clears
+	 * the data collected so far.
+	 **/
+	void setSketchError( qreal epsilon );
+
+	/**
+	 * Return 'true' if the data are collected into a QuantileSketch.
+	 **/
+	bool usesSketch() const { return _useSketch; }
+
+	/**
+	 * Return the error of the sketch that setSketchError() set or 0.0 if
+	 * all data are kept.
+	 **/
+	qreal sketchError() const { return _sketchError; }
+
+	/**
+	 * Add one data point. Derived classes use this in collect().
+	 **/
+	void addValue( qreal value )
+	{
+	    if ( _useSketch )
+		_sketch.add( value );
+	    else
+		_data << value;
+	}
+
+	/**
+	 * Add all data of 'other', e.g. of another subtree. Both need to use
+	 * the same method (exact data or sketch).
 	 **/
-	void sort();
+	void merge( const PercentileStats & other );
 
         /**
          * Return the size of the collected data, i.e. the number of data
          * points.
          **/
-        int dataSize() const { return _data.size(); }
+        int dataSize() const { return _useSketch ? (int) _sketch.count() : _data.size(); }
 
 	/**
-	 * Return a reference to the collected data.
+	 * Return a reference to the collected data. This is empty if
+	 * usesSketch().
 	 **/
 	QRealList & data() { return _data; }
 
 
-	// All calculation functions below will sort the internal data first if
-	// they are not sorted yet. This is why they are not const.
+	// All calculation functions below move elements of the internal data
+	// around to find them. This is why they are not const.
 
 	/**
 	 * Calculate the median.
@@ -135,11 +192,56 @@ namespace QDirStat
          **/
         QRealList percentileSums();
 
+	/**
+	 * Return the number of data points that are less than 'value' or,
+	 * if 'orEqual' is true, less than or equal to it.
+	 *
+	 * This only needs a binary search in the part of the data between
+	 * the two percentiles around 'value'. That part is sorted the first
+	 * time it is needed, so counting again in the same range of values
+	 * does not touch the other data at all.
+	 **/
+	int countBelow( qreal value, bool orEqual = false );
+
 
     protected:
 
-	QRealList _data;
-	bool	  _sorted;
+	/**
+	 * Return the element that would be at 'pos' if the data were sorted:
+	 * Move it there with std::nth_element() unless it was found before.
+	 **/
+	qreal valueAt( int pos );
+
+	/**
+	 * Return the position of the last element that belongs to percentile
+	 * no. 'number' in percentileSums().
+	 **/
+	int percentileEnd( int number ) const;
+
+	/**
+	 * Sort the data from 'first' to before 'last' unless that was done
+	 * before. They have to be between two partition positions.
+	 **/
+	void sortSegment( int first, int last );
+
+
+	// Data members
+
+	QRealList      _data;
+	bool	       _sorted;
+	bool	       _useSketch;
+	qreal	       _sketchError;
+	QuantileSketch _sketch;
+
+	// Ascending positions in _data that already hold the element that
+	// would be there in sorted data. All elements before each of them are
+	// less than or equal, the ones after it greater than or equal.
+
+	QList<int>     _partitionPos;
+
+	// Positions in _data that sortSegment() already sorted
+
+	QBitArray      _sortedPos;
     };
 
 }	// namespace QDirStat
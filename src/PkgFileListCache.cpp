@@ -6,6 +6,9 @@
  *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
  */
 
+#include <QDataStream>
+#include <QFile>
+
 #include "PkgFileListCache.h"
 #include "Exception.h"
 #include "Logger.h"
@@ -20,6 +23,8 @@ do {									  \
 	THROW( Exception( "Cache not set up for this type of lookup" ) ); \
 } while ( false )
 
+#define CACHE_FILE_MAGIC	0x51445046	// "QDPF"
+#define CACHE_FILE_VERSION	1
 
 
 
@@ -28,7 +33,7 @@ PkgFileListCache::PkgFileListCache( PkgManager * pkgManager,
     _pkgManager( pkgManager ),
     _lookupType( lookupType )
 {
-
+    clear();
 }
 
 
@@ -42,7 +47,11 @@ QStringList PkgFileListCache::fileList( const QString & pkgName )
 {
     CHECK_LOOKUP_TYPE( LookupByPkg );
 
-    QStringList fileList( _pkgFileNames.values( pkgName ) );
+    QStringList fileList;
+
+    foreach ( int node, _pkgNodes.value( pkgName ) )
+	fileList << path( node );
+
     fileList.sort();
 
     return fileList;
@@ -53,7 +62,7 @@ bool PkgFileListCache::containsPkg( const QString & pkgName ) const
 {
     CHECK_LOOKUP_TYPE( LookupByPkg );
 
-    return _pkgFileNames.contains( pkgName );
+    return _pkgNodes.contains( pkgName );
 }
 
 
@@ -61,7 +70,155 @@ bool PkgFileListCache::containsFile( const QString & fileName ) const
 {
     CHECK_LOOKUP_TYPE( LookupGlobal );
 
-    return _fileNames.contains( fileName );
+    int node = findNode( fileName );
+
+    return node > 0 && _nodes.at( node ).owned;
+}
+
+
+QString PkgFileListCache::owningPkg( const QString & path ) const
+{
+    CHECK_LOOKUP_TYPE( LookupByPkg );
+
+    if ( _owners.isEmpty() )
+    {
+	for ( QHash<QString, QVector<int> >::const_iterator it = _pkgNodes.constBegin();
+	      it != _pkgNodes.constEnd();
+	      ++it )
+	{
+	    foreach ( int node, it.value() )
+	    {
+		if ( ! _owners.contains( node ) )
+		    _owners.insert( node, it.key() );
+	    }
+	}
+    }
+
+    int node = findNode( path );
+
+    return node > 0 ? _owners.value( node ) : QString();
+}
+
+
+int PkgFileListCache::dirNo( const QString & dir ) const
+{
+    CHECK_LOOKUP_TYPE( LookupGlobal );
+
+    return findNode( dir );
+}
+
+
+bool PkgFileListCache::containsFile( int dirNo, const QString & name ) const
+{
+    if ( dirNo < 0 || dirNo >= _nodes.size() )
+	return false;
+
+    int nameId = _nameIds.value( name, -1 );
+
+    if ( nameId < 0 )
+	return false;
+
+    int node = findChild( dirNo, nameId );
+
+    return node > 0 && _nodes.at( node ).owned;
+}
+
+
+int PkgFileListCache::findNode( const QString & path ) const
+{
+    int node  = 0;
+    int start = 0;
+
+    while ( start < path.size() )
+    {
+	int end = path.indexOf( '/', start );
+
+	if ( end < 0 )
+	    end = path.size();
+
+	if ( end > start )
+	{
+	    int nameId = _nameIds.value( path.mid( start, end - start ), -1 );
+
+	    if ( nameId < 0 )
+		return -1;
+
+	    node = findChild( node, nameId );
+
+	    // No package owns anything below this point
+
+	    if ( node < 0 )
+		return -1;
+	}
+
+	start = end + 1;
+    }
+
+    return node;
+}
+
+
+int PkgFileListCache::addNode( const QString & path )
+{
+    int node  = 0;
+    int start = 0;
+
+    while ( start < path.size() )
+    {
+	int end = path.indexOf( '/', start );
+
+	if ( end < 0 )
+	    end = path.size();
+
+	if ( end > start )
+	{
+	    int nameId = internName( path.mid( start, end - start ) );
+	    int child  = findChild( node, nameId );
+
+	    if ( child < 0 )
+	    {
+		Node newNode = { node, nameId, false };
+		child = _nodes.size();
+		_nodes << newNode;
+		_children.insert( childKey( node, nameId ), child );
+	    }
+
+	    node = child;
+	}
+
+	start = end + 1;
+    }
+
+    return node;
+}
+
+
+int PkgFileListCache::internName( const QString & name )
+{
+    QHash<QString, int>::const_iterator it = _nameIds.constFind( name );
+
+    if ( it != _nameIds.constEnd() )
+	return it.value();
+
+    int nameId = _names.size();
+    _names << name;
+    _nameIds.insert( name, nameId );
+
+    return nameId;
+}
+
+
+QString PkgFileListCache::path( int node ) const
+{
+    if ( node <= 0 )
+	return "/";
+
+    QStringList components;
+
+    for ( ; node > 0; node = _nodes.at( node ).parent )
+	components.prepend( _names.at( _nodes.at( node ).nameId ) );
+
+    return "/" + components.join( "/" );
 }
 
 
@@ -69,23 +226,169 @@ void PkgFileListCache::remove( const QString & pkgName )
 {
     CHECK_LOOKUP_TYPE( LookupByPkg );
 
-    _pkgFileNames.remove( pkgName );
+    // This leaves the trie nodes alone: Other packages might share them
+
+    _pkgNodes.remove( pkgName );
+    _owners.clear();
 }
 
 
 void PkgFileListCache::clear()
 {
-    _pkgFileNames.clear();
-    _fileNames.clear();
+    _nodes.clear();
+    _children.clear();
+    _nameIds.clear();
+    _names.clear();
+    _pkgNodes.clear();
+    _owners.clear();
+
+    Node root = { -1, -1, false };
+    _nodes << root;
 }
 
 
 void PkgFileListCache::add( const QString & pkgName,
 			    const QString & fileName )
 {
+    int node = addNode( fileName );
+    _nodes[ node ].owned = true;
+
     if ( _lookupType & LookupByPkg )
-	_pkgFileNames.insert( pkgName, fileName );
+    {
+	_pkgNodes[ pkgName ] << node;
+	_owners.clear();
+    }
+}
+
+
+bool PkgFileListCache::save( const QString & fileName, const QString & stamp ) const
+{
+    // Write to a temporary file first so a crash can't leave a truncated
+    // cache file behind
+
+    QString tmpName = fileName + ".new";
+    QFile   file( tmpName );
+
+    if ( ! file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+	logError() << "Can't open " << tmpName << ": " << file.errorString() << endl;
+	return false;
+    }
+
+    QDataStream out( &file );
+    out.setVersion( QDataStream::Qt_4_6 );
+
+    out << (quint32) CACHE_FILE_MAGIC << (quint32) CACHE_FILE_VERSION << stamp;
+    out << _names << (qint32) _nodes.size();
+
+    foreach ( const Node & node, _nodes )
+	out << (qint32) node.parent << (qint32) node.nameId << (quint8) node.owned;
+
+    out << _pkgNodes;
+    file.close();
+
+    if ( out.status() != QDataStream::Ok || file.error() != QFile::NoError )
+    {
+	logError() << "Error writing " << tmpName << endl;
+	QFile::remove( tmpName );
+
+	return false;
+    }
+
+    QFile::remove( fileName );
+
+    if ( ! QFile::rename( tmpName, fileName ) )
+    {
+	logError() << "Can't rename " << tmpName << " to " << fileName << endl;
+	QFile::remove( tmpName );
+
+	return false;
+    }
+
+    logDebug() << "Saved file list cache with " << _nodes.size() << " paths to " << fileName << endl;
+
+    return true;
+}
+
+
+bool PkgFileListCache::load( const QString & fileName, const QString & stamp )
+{
+    QFile file( fileName );
+
+    if ( ! file.open( QIODevice::ReadOnly ) )
+	return false;
+
+    QDataStream in( &file );
+    in.setVersion( QDataStream::Qt_4_6 );
+
+    quint32 magic	= 0;
+    quint32 version	= 0;
+    QString fileStamp;
+
+    in >> magic >> version >> fileStamp;
+
+    if ( magic != CACHE_FILE_MAGIC || version != CACHE_FILE_VERSION )
+    {
+	logWarning() << fileName << " is not a file list cache" << endl;
+	return false;
+    }
+
+    if ( fileStamp != stamp )
+    {
+	logInfo() << "The package database changed; not using " << fileName << endl;
+	return false;
+    }
+
+    clear();
+    _nodes.clear();
+
+    qint32 nodeCount = 0;
+    in >> _names >> nodeCount;
+
+    for ( int i=0; i < nodeCount && in.status() == QDataStream::Ok; ++i )
+    {
+	qint32 parent;
+	qint32 nameId;
+	quint8 owned;
+
+	in >> parent >> nameId >> owned;
+
+	// Parents always come before their children
+
+	if ( parent >= i || nameId >= _names.size() || ( i > 0 && ( parent < 0 || nameId < 0 ) ) )
+	    break;
+
+	Node node = { parent, nameId, owned != 0 };
+	_nodes << node;
+
+	if ( i > 0 )
+	    _children.insert( childKey( parent, nameId ), i );
+    }
+
+    in >> _pkgNodes;
+    bool ok = in.status() == QDataStream::Ok && _nodes.size() == nodeCount && nodeCount > 0;
+
+    foreach ( const QVector<int> & pkgNodes, _pkgNodes )
+    {
+	foreach ( int node, pkgNodes )
+	{
+	    if ( node <= 0 || node >= _nodes.size() )
+		ok = false;
+	}
+    }
+
+    if ( ! ok )
+    {
+	logError() << "Error reading " << fileName << endl;
+	clear();
+
+	return false;
+    }
+
+    for ( int i=0; i < _names.size(); ++i )
+	_nameIds.insert( _names.at( i ), i );
+
+    logDebug() << "Loaded file list cache with " << _nodes.size() << " paths from " << fileName << endl;
 
-    if ( _lookupType & LookupGlobal )
-	_fileNames.insert( fileName );
+    return true;
 }
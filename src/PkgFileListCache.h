@@ -10,8 +10,9 @@
 #define PkgFileListCache_h
 
 #include <QString>
-#include <QMultiMap>
-#include <QSet>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
 
 
 namespace QDirStat
@@ -31,6 +32,12 @@ namespace QDirStat
      * installed package.
      *
      * Use PkgManager::createFileListCache() to create and fill such a cache.
+     *
+     * The paths are stored as a trie of path components, and each component
+     * name is stored only once no matter how many directories it appears
+     * in: Most of the millions of packaged paths on a typical system share
+     * long prefixes like /usr/share/doc and names like "README" or
+     * "copyright".
      **/
     class PkgFileListCache
     {
@@ -72,11 +79,29 @@ namespace QDirStat
 	 **/
 	bool containsFile( const QString & fileName ) const;
 
+	/**
+	 * Return the name of a package that owns 'path' or an empty string
+	 * if no package in the cache owns it.
+	 **/
+	QString owningPkg( const QString & path ) const;
+
+	/**
+	 * Return the number of directory 'dir' for containsFile( dirNo, name )
+	 * or -1 if no package has anything in it or anywhere below it.
+	 **/
+	int dirNo( const QString & dir ) const;
+
+	/**
+	 * Return 'true' if the cache contains file 'name' in the directory
+	 * with number 'dirNo' (see dirNo()), 'false' if not.
+	 **/
+	bool containsFile( int dirNo, const QString & name ) const;
+
 	/**
 	 * Return 'true' if the cache is empty, 'false' if not.
 	 **/
 	bool isEmpty() const
-	    { return _pkgFileNames.isEmpty() && _fileNames.isEmpty(); }
+	    { return _nodes.size() <= 1; }
 
 	/**
 	 * Remove the entries for a package from the cache.
@@ -93,6 +118,21 @@ namespace QDirStat
 	 **/
 	void add( const QString & pkgName, const QString & fileName );
 
+	/**
+	 * Write the cache to file 'fileName' together with 'stamp', the state
+	 * of the package database it was created from. Return 'true' on
+	 * success, 'false' on error.
+	 **/
+	bool save( const QString & fileName, const QString & stamp ) const;
+
+	/**
+	 * Replace the content of the cache with what save() wrote to file
+	 * 'fileName', but only if that was saved with the same 'stamp'.
+	 * Return 'true' on success, 'false' if the file is missing, outdated
+	 * or unreadable.
+	 **/
+	bool load( const QString & fileName, const QString & stamp );
+
 	/**
 	 * Return the package manager parent of this cache.
 	 **/
@@ -106,10 +146,67 @@ namespace QDirStat
 
     protected:
 
-	PkgManager *		    _pkgManager;
-	LookupType		    _lookupType;
-	QMultiMap<QString, QString> _pkgFileNames;
-	QSet<QString>		    _fileNames;
+	/**
+	 * One path component in the trie. Node 0 is the root directory.
+	 **/
+	struct Node
+	{
+	    int	 parent;
+	    int	 nameId;
+	    bool owned;	  // Some package owns this path itself
+	};
+
+	/**
+	 * Return the trie node for 'path' or -1 if there is none.
+	 **/
+	int findNode( const QString & path ) const;
+
+	/**
+	 * Return the child of node 'parent' with name 'nameId' or -1 if
+	 * there is none.
+	 **/
+	int findChild( int parent, int nameId ) const
+	    { return _children.value( childKey( parent, nameId ), -1 ); }
+
+	/**
+	 * Return the trie node for 'path' and create it and any missing
+	 * parent nodes.
+	 **/
+	int addNode( const QString & path );
+
+	/**
+	 * Return the ID of component name 'name' and add it if it is new.
+	 **/
+	int internName( const QString & name );
+
+	/**
+	 * Return the full path of trie node 'node'.
+	 **/
+	QString path( int node ) const;
+
+	/**
+	 * Return the key in _children for child 'nameId' of node 'parent'.
+	 **/
+	static quint64 childKey( int parent, int nameId )
+	    { return ( (quint64) parent << 32 ) | (quint32) nameId; }
+
+
+	PkgManager *		     _pkgManager;
+	LookupType		     _lookupType;
+
+	QVector<Node>		     _nodes;
+	QHash<quint64, int>	     _children;
+	QHash<QString, int>	     _nameIds;
+	QVector<QString>	     _names;
+
+	// For LookupByPkg: The trie nodes of the files of each package
+
+	QHash<QString, QVector<int> > _pkgNodes;
+
+	// For owningPkg(): The package of each node that a package owns,
+	// created from _pkgNodes when it is first needed
+
+	mutable QHash<int, QString>   _owners;
     };
 }	// namespace QDirStat
 
@@ -7,6 +7,12 @@
  */
 
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <QDir>
+#include <QFileInfo>
+
 #include "PkgManager.h"
 #include "Logger.h"
 #include "Exception.h"
@@ -27,6 +33,18 @@ PkgManager::~PkgManager()
 }
 
 
+QString PkgManager::owningPkg( const QString & path )
+{
+    QStringList args = owningPkgCommand( path );
+    QString command  = args.takeFirst();
+
+    int exitCode = -1;
+    QString output = runCommand( command, args, &exitCode );
+
+    return parseOwningPkg( output, exitCode );
+}
+
+
 QStringList PkgManager::fileList( PkgInfo * pkg )
 {
     QStringList fileList;
@@ -46,3 +64,85 @@ QStringList PkgManager::fileList( PkgInfo * pkg )
     return fileList;
 }
 
+
+
+PkgFileListCache * PkgManager::loadFileListCache( PkgFileListCache::LookupType lookupType )
+{
+    PkgFileListCache * cache = savedFileListCache( lookupType );
+
+    if ( cache )
+	return cache;
+
+    QString stamp = databaseStamp();
+
+    if ( stamp.isEmpty() )
+	return createFileListCache( lookupType );
+
+    // The cache on disk has to be good for all lookup types
+
+    QString fileName = fileListCacheName();
+    cache = createFileListCache( PkgFileListCache::LookupAll );
+
+    // Don't leave files owned by root in the user's home directory
+
+    if ( cache && ! SysUtil::runningWithSudo() )
+    {
+	if ( QDir().mkpath( QFileInfo( fileName ).path() ) )
+	    cache->save( fileName, stamp );
+    }
+
+    return cache;
+}
+
+
+PkgFileListCache * PkgManager::savedFileListCache( PkgFileListCache::LookupType lookupType )
+{
+    QString stamp = databaseStamp();
+
+    if ( stamp.isEmpty() )
+	return 0;
+
+    PkgFileListCache * cache = new PkgFileListCache( this, lookupType );
+    CHECK_NEW( cache );
+
+    if ( cache->load( fileListCacheName(), stamp ) )
+	return cache;
+
+    delete cache;
+
+    return 0;
+}
+
+
+QString PkgManager::fileStamp( const QStringList & paths )
+{
+    QStringList stamps;
+
+    foreach ( const QString & path, paths )
+    {
+	struct stat statInfo;
+
+	if ( stat( path.toUtf8(), &statInfo ) == 0 )
+	{
+	    stamps << QString( "%1:%2:%3:%4:%5" )
+		.arg( path )
+		.arg( (qulonglong) statInfo.st_dev )
+		.arg( (qulonglong) statInfo.st_ino )
+		.arg( (qlonglong)  statInfo.st_size )
+		.arg( (qlonglong)  statInfo.st_mtime );
+	}
+    }
+
+    return stamps.join( ";" );
+}
+
+
+QString PkgManager::fileListCacheName()
+{
+    QByteArray xdg_cache_home = qgetenv( "XDG_CACHE_HOME" );
+    QString cacheDir = xdg_cache_home.isEmpty() ?
+	QDir::homePath() + "/.cache" :
+	QString::fromUtf8( xdg_cache_home );
+
+    return cacheDir + "/qdirstat/pkg-file-lists-" + name() + ".cache";
+}
@@ -97,9 +97,26 @@ namespace QDirStat
 	 * Return the owning package of a file or directory with full path
 	 * 'path' or an empty string if it is not owned by any package.
 	 *
+	 * This runs the owningPkgCommand() and waits until it is finished;
+	 * in the GUI thread, use PkgQuery::owningPkgAsync() instead.
+	 **/
+	QString owningPkg( const QString & path );
+
+	/**
+	 * Return the command for getting the owning package of 'path' as
+	 * the first list element and its arguments as the others.
+	 *
 	 * Derived classes are required to implement this.
 	 **/
-	virtual QString owningPkg( const QString & path ) = 0;
+	virtual QStringList owningPkgCommand( const QString & path ) = 0;
+
+	/**
+	 * Parse the output and the exit code of the owningPkgCommand() and
+	 * return the owning package or an empty string if there is none.
+	 *
+	 * Derived classes are required to implement this.
+	 **/
+	virtual QString parseOwningPkg( const QString & output, int exitCode ) = 0;
 
 
 	//-----------------------------------------------------------------
@@ -177,12 +194,56 @@ namespace QDirStat
 	virtual PkgFileListCache * createFileListCache( PkgFileListCache::LookupType lookupType = PkgFileListCache::LookupByPkg )
 	    { Q_UNUSED( lookupType ); return 0; }
 
+	/**
+	 * Return a string that changes whenever the package database
+	 * changes, e.g. with the inodes and modification times of its files,
+	 * or an empty string if that is unknown.
+	 *
+	 * This default implementation returns an empty string.
+	 **/
+	virtual QString databaseStamp()
+	    { return QString(); }
+
+	/**
+	 * Like createFileListCache(), but use the copy on disk from a
+	 * previous call as long as databaseStamp() is still the same, and
+	 * write a new copy otherwise.
+	 *
+	 * Ownership of the cache is transferred to the caller.
+	 **/
+	PkgFileListCache * loadFileListCache( PkgFileListCache::LookupType lookupType = PkgFileListCache::LookupByPkg );
+
+	/**
+	 * Return the copy of the file list cache on disk that
+	 * loadFileListCache() wrote if it is still up to date, or 0 if
+	 * there is none. Unlike loadFileListCache(), this never asks the
+	 * package manager.
+	 *
+	 * Ownership of the cache is transferred to the caller.
+	 **/
+	PkgFileListCache * savedFileListCache( PkgFileListCache::LookupType lookupType = PkgFileListCache::LookupByPkg );
+
 	/**
 	 * Return a name suitable for a detailed queries for 'pkg'.
 	 */
 	virtual QString queryName( PkgInfo * pkg )
 	    { return pkg->name(); }
 
+
+    protected:
+
+	/**
+	 * Return a stamp for databaseStamp() with the device, inode, size
+	 * and modification time of each of 'paths' that exists or an empty
+	 * string if none of them exists.
+	 **/
+	static QString fileStamp( const QStringList & paths );
+
+	/**
+	 * Return the name of the file for loadFileListCache().
+	 **/
+	QString fileListCacheName();
+
     }; // class PkgManager
 
 } // namespace QDirStat
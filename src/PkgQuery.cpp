@@ -7,6 +7,9 @@
  */
 
 
+#include <QMutex>
+#include <QMutexLocker>
+
 #include "PkgQuery.h"
 #include "PkgManager.h"
 #include "DpkgPkgManager.h"
@@ -29,6 +32,7 @@
 using namespace QDirStat;
 
 using SysUtil::runCommand;
+using SysUtil::runCommandAsync;
 using SysUtil::tryRunCommand;
 using SysUtil::haveCommand;
 
@@ -38,6 +42,12 @@ PkgQuery * PkgQuery::_instance = 0;
 
 PkgQuery * PkgQuery::instance()
 {
+    // The main window creates the instance in a worker thread: Checking the
+    // package managers starts external commands.
+
+    static QMutex mutex;
+    QMutexLocker locker( &mutex );
+
     if ( ! _instance )
     {
 	_instance = new PkgQuery();
@@ -48,7 +58,8 @@ PkgQuery * PkgQuery::instance()
 }
 
 
-PkgQuery::PkgQuery()
+PkgQuery::PkgQuery():
+    _fileListCache( 0 )
 {
     _cache.setMaxCost( CACHE_SIZE );
     checkPkgManagers();
@@ -57,6 +68,7 @@ PkgQuery::PkgQuery()
 
 PkgQuery::~PkgQuery()
 {
+    delete _fileListCache;
     qDeleteAll( _pkgManagers );
 }
 
@@ -126,6 +138,14 @@ QString PkgQuery::owningPkg( const QString & path )
 }
 
 
+void PkgQuery::owningPkgAsync( const QString &	 path,
+			       QObject *	 context,
+			       OwningPkgCallback callback )
+{
+    instance()->getOwningPackageAsync( path, context, callback );
+}
+
+
 PkgInfoList PkgQuery::installedPkg()
 {
     return instance()->getInstalledPkg();
@@ -140,47 +160,183 @@ QStringList PkgQuery::fileList( PkgInfo * pkg )
 
 QString PkgQuery::getOwningPackage( const QString & path )
 {
-    QString pkg = "";
-    QString foundBy;
-    bool haveResult = false;
+    QString pkg;
+    bool skipPrimary = false;
 
-    if ( _cache.contains( path ) )
+    if ( cachedOwningPkg( path, pkg, skipPrimary ) )
+	return pkg;
+
+    QString foundBy = "all";
+
+    foreach ( PkgManager * pkgManager, _pkgManagers )
+    {
+	if ( skipPrimary && pkgManager == _pkgManagers.first() )
+	    continue;
+
+	pkg = pkgManager->owningPkg( path );
+
+	if ( ! pkg.isEmpty() )
+	{
+	    foundBy = pkgManager->name();
+	    break;
+	}
+    }
+
+    addOwningPkg( path, pkg, foundBy );
+
+    return pkg;
+}
+
+
+void PkgQuery::getOwningPackageAsync( const QString &	path,
+				      QObject *		context,
+				      OwningPkgCallback callback )
+{
+    QString pkg;
+    bool skipPrimary = false;
+
+    if ( cachedOwningPkg( path, pkg, skipPrimary ) )
     {
-	haveResult = true;
-	foundBy	   = "Cache";
-	pkg	   = *( _cache[ path ] );
+	callback( pkg );
+	return;
     }
 
+    QList<PkgManager *> pkgManagers = _pkgManagers;
+
+    if ( skipPrimary && ! pkgManagers.isEmpty() )
+	pkgManagers.removeFirst();
+
+    queryOwningPkg( path, pkgManagers, context, callback );
+}
 
-    if ( ! haveResult )
+
+void PkgQuery::queryOwningPkg( const QString &	   path,
+			       QList<PkgManager *> pkgManagers,
+			       QObject *	   context,
+			       OwningPkgCallback   callback )
+{
+    if ( pkgManagers.isEmpty() )
     {
-	foreach ( PkgManager * pkgManager, _pkgManagers )
+	addOwningPkg( path, "", "all" );
+	callback( "" );
+	return;
+    }
+
+    PkgManager * pkgManager = pkgManagers.takeFirst();
+    QStringList	 args	    = pkgManager->owningPkgCommand( path );
+    QString	 command    = args.takeFirst();
+
+    runCommandAsync( command, args, context, [=]( const QString & output, int exitCode )
 	{
-	    pkg = pkgManager->owningPkg( path );
+	    QString pkg = pkgManager->parseOwningPkg( output, exitCode );
 
-	    if ( ! pkg.isEmpty() )
+	    if ( pkg.isEmpty() ) // Ask the next package manager
 	    {
-		haveResult = true;
-		foundBy	   = pkgManager->name();
-		break;
+		queryOwningPkg( path, pkgManagers, context, callback );
+		return;
 	    }
-	}
 
-	if ( foundBy.isEmpty() )
-	    foundBy = "all";
+	    addOwningPkg( path, pkg, pkgManager->name() );
+	    callback( pkg );
+	});
+}
+
+
+bool PkgQuery::cachedOwningPkg( const QString & path,
+				QString &	pkg_ret,
+				bool &		skipPrimary_ret )
+{
+    QString foundBy;
+    skipPrimary_ret = false;
+
+    if ( _cache.contains( path ) )
+    {
+	foundBy = "Cache";
+	pkg_ret = *( _cache[ path ] );
+    }
+    else
+    {
+	// The file list cache only knows the primary package manager: If it
+	// does not own the path, ask the others.
+
+	skipPrimary_ret = owningPkgFromFileListCache( path, pkg_ret );
+
+	if ( pkg_ret.isEmpty() )
+	    return false;
 
-	// Insert package name (even if empty) into the cache
-	_cache.insert( path, new QString( pkg ), CACHE_COST );
+	foundBy = "File list cache";
     }
 
+    logOwningPkg( path, pkg_ret, foundBy );
+
+    return true;
+}
+
+
+void PkgQuery::addOwningPkg( const QString & path,
+			     const QString & pkg,
+			     const QString & foundBy )
+{
+    // Insert package name (even if empty) into the cache
+    _cache.insert( path, new QString( pkg ), CACHE_COST );
+
+    logOwningPkg( path, pkg, foundBy );
+}
+
+
+void PkgQuery::logOwningPkg( const QString & path,
+			     const QString & pkg,
+			     const QString & foundBy )
+{
 #if VERBOSE_PKG_QUERY
     if ( pkg.isEmpty() )
 	logDebug() << foundBy << ": No package owns " << path << endl;
     else
 	logDebug() << foundBy << ": Package " << pkg << " owns " << path << endl;
+#else
+    Q_UNUSED( path );
+    Q_UNUSED( pkg );
+    Q_UNUSED( foundBy );
 #endif
+}
 
-    return pkg;
+
+bool PkgQuery::owningPkgFromFileListCache( const QString & path, QString & pkg_ret )
+{
+    PkgManager * pkgManager = primaryPkgManager();
+
+    if ( ! pkgManager )
+	return false;
+
+    // Only a few stat() calls, so this is checked for each query; after
+    // any change of the package database, the cache is outdated.
+
+    QString stamp = pkgManager->databaseStamp();
+
+    if ( stamp.isEmpty() )
+	return false;
+
+    if ( _fileListCache && stamp != _fileListCacheStamp )
+    {
+	delete _fileListCache;
+	_fileListCache = 0;
+    }
+
+    if ( ! _fileListCache )
+    {
+	// Never build a new cache here: That would block the caller for a
+	// long time. Only use what viewing the packages saved.
+
+	_fileListCache	    = pkgManager->savedFileListCache( PkgFileListCache::LookupAll );
+	_fileListCacheStamp = stamp;
+    }
+
+    if ( ! _fileListCache )
+	return false;
+
+    pkg_ret = _fileListCache->owningPkg( path );
+
+    return true;
 }
 
 
@@ -10,15 +10,21 @@
 #ifndef PkgQuery_h
 #define PkgQuery_h
 
+#include <functional>
+
 #include <QString>
 #include <QCache>
 
 #include "PkgInfo.h"
 
 
+class QObject;
+
+
 namespace QDirStat
 {
     class PkgManager;
+    class PkgFileListCache;
 
 
     /**
@@ -28,14 +34,36 @@ namespace QDirStat
     {
     public:
 
+	/**
+	 * Callback for owningPkgAsync() with the owning package or an empty
+	 * string.
+	 **/
+	typedef std::function<void( const QString & pkg )> OwningPkgCallback;
+
 	/**
 	 * Return the owning package of a file or directory with full path
 	 * 'path' or an empty string if it is not owned by any package.
+	 *
+	 * This waits for the package manager commands; in the GUI thread,
+	 * use owningPkgAsync() instead.
 	 **/
 	static QString owningPkg( const QString & path );
 
 	/**
-	 * Return the singleton instance of this class.
+	 * Find the owning package of 'path' without waiting for the package
+	 * manager commands and call 'callback' with it (or with an empty
+	 * string) in the thread of 'context'. If the result is cached, this
+	 * calls 'callback' right away. If 'context' is destroyed before the
+	 * result is known, 'callback' is never called.
+	 **/
+	static void owningPkgAsync( const QString &   path,
+				    QObject *	      context,
+				    OwningPkgCallback callback );
+
+	/**
+	 * Return the singleton instance of this class. The first call checks
+	 * the available package managers, which starts external commands;
+	 * this may be called from any thread.
 	 **/
 	static PkgQuery * instance();
 
@@ -80,6 +108,14 @@ namespace QDirStat
 	 **/
 	QString getOwningPackage( const QString & path );
 
+	/**
+	 * Find the owning package of 'path' like getOwningPackage(), but
+	 * call 'callback' with it instead of waiting for the result.
+	 **/
+	void getOwningPackageAsync( const QString &   path,
+				    QObject *	      context,
+				    OwningPkgCallback callback );
+
         /**
          * Return the list of installed packages.
          *
@@ -129,6 +165,49 @@ namespace QDirStat
 	 **/
 	void checkPkgManager( PkgManager * pkgManager );
 
+	/**
+	 * Look up the owning package of 'path' in the file list cache of
+	 * the primary package manager that PkgManager::loadFileListCache()
+	 * saved. Return 'false' if there is no such cache or if it is
+	 * outdated; otherwise set 'pkg_ret' (to an empty string if the
+	 * primary package manager does not own 'path').
+	 **/
+	bool owningPkgFromFileListCache( const QString & path, QString & pkg_ret );
+
+	/**
+	 * Look up the owning package of 'path' in the cache and in the file
+	 * list cache. Return 'true' and set 'pkg_ret' if it is known there.
+	 * 'skipPrimary_ret' is set to 'true' if the primary package manager
+	 * does not need to be asked anymore.
+	 **/
+	bool cachedOwningPkg( const QString & path,
+			      QString &	      pkg_ret,
+			      bool &	      skipPrimary_ret );
+
+	/**
+	 * Ask 'pkgManagers' one after the other for the owning package of
+	 * 'path' with asynchronous commands until one of them knows it.
+	 **/
+	void queryOwningPkg( const QString &	 path,
+			     QList<PkgManager *> pkgManagers,
+			     QObject *		 context,
+			     OwningPkgCallback	 callback );
+
+	/**
+	 * Add the owning package 'pkg' (even if empty) of 'path' that
+	 * 'foundBy' found to the cache.
+	 **/
+	void addOwningPkg( const QString & path,
+			   const QString & pkg,
+			   const QString & foundBy );
+
+	/**
+	 * Log the owning package of 'path' if VERBOSE_PKG_QUERY is set.
+	 **/
+	void logOwningPkg( const QString & path,
+			   const QString & pkg,
+			   const QString & foundBy );
+
 
 	// Data members
 
@@ -136,6 +215,8 @@ namespace QDirStat
 	QList <PkgManager *>	 _pkgManagers;
 	QList <PkgManager *>	 _secondaryPkgManagers;
 	QCache<QString, QString> _cache;
+	PkgFileListCache *	 _fileListCache;
+	QString			 _fileListCacheStamp;
 
     }; // class PkgQuery
 
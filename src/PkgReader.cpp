@@ -10,12 +10,15 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <QRunnable>
+
 #include "PkgReader.h"
 #include "PkgQuery.h"
 #include "PkgManager.h"
 #include "PkgFileListCache.h"
 #include "DirTree.h"
 #include "ProcessStarter.h"
+#include "ReadScheduler.h"
 #include "Settings.h"
 #include "Logger.h"
 #include "Exception.h"
@@ -191,13 +194,14 @@ void PkgReader::createCachePkgReadJobs()
     PkgManager * pkgManager = PkgQuery::primaryPkgManager();
     CHECK_PTR( pkgManager );
 
-    QSharedPointer<PkgFileListCache> fileListCache( pkgManager->createFileListCache() );
+    QSharedPointer<PkgFileListCache> fileListCache( pkgManager->loadFileListCache() );
     // The shared pointer will take care of deleting the cache when the last
     // job that uses it is destroyed.
 
     if ( ! fileListCache )
     {
 	logError() << "Creating the file list cache failed" << endl;
+	createAsyncPkgReadJobs();
 	return;
     }
 
@@ -295,10 +299,54 @@ void PkgReader::writeSettings()
 
 
 
-QMap<QString, struct stat> PkgReadJob::_statCache;
+namespace
+{
+    /**
+     * lstat() the files of a package into the shared stat cache in a
+     * worker thread, then notify the ReadScheduler like a
+     * LocalDirReaderTask.
+     **/
+    class PkgPrefetchTask: public QRunnable
+    {
+    public:
+
+	PkgPrefetchTask( PkgPrefetchPtr prefetch,
+			 qulonglong	device,
+			 qulonglong	client ):
+	    _prefetch( prefetch ),
+	    _device( device ),
+	    _client( client )
+	    {
+		setAutoDelete( true );
+	    }
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    ReadScheduler::adjustThreadPriority( true );
+
+	    PkgReadJob::statCache().prefetch( _prefetch->paths );
+	    _prefetch->done.storeRelease( 1 );
+
+	    QMetaObject::invokeMethod( ReadScheduler::instance(), "prefetchFinished",
+				       Qt::QueuedConnection,
+				       Q_ARG( qulonglong, _device ),
+				       Q_ARG( qulonglong, _client ) );
+	}
+
+    private:
+
+	PkgPrefetchPtr _prefetch;
+	qulonglong     _device;
+	qulonglong     _client;
+    };
+
+}	// namespace
+
+
+
+
+PkgStatCache PkgReadJob::_statCache;
 int PkgReadJob::_activeJobs = 0;
-int PkgReadJob::_cacheHits  = 0;
-int PkgReadJob::_lstatCalls = 0;
 
 
 PkgReadJob::PkgReadJob( DirTree * tree,
@@ -325,21 +373,12 @@ void PkgReadJob::clearStatCache()
 {
     _statCache.clear();
     _activeJobs = 0;
-    _cacheHits  = 0;
-    _lstatCalls = 0;
 }
 
 
 void PkgReadJob::reportCacheStats()
 {
-    float hitPercent = 0.0;
-
-    if ( _lstatCalls > 0 )
-        hitPercent = ( 100.0 * _cacheHits ) /_lstatCalls;
-
-    logDebug() << _lstatCalls << " lstat() calls" << endl;
-    logDebug() << _cacheHits << " stat cache hits ("
-               << qRound( hitPercent ) << "%)" << endl;
+    _statCache.reportStats();
 }
 
 
@@ -351,11 +390,29 @@ void PkgReadJob::startReading()
 
     _pkg->setReadState( DirReading );
 
-    foreach ( const QString & path, fileList() )
+    QStringList paths;
+
+    if ( _prefetch )
+    {
+	paths = _prefetch->paths;
+	_prefetch.clear();
+    }
+    else // Not prefetched by a worker thread
+    {
+	paths = fileList();
+
+	// lstat() the files directory by directory in batches first, so
+	// addFile() finds them all in the cache
+
+	_statCache.prefetch( paths );
+    }
+
+    foreach ( const QString & path, paths )
     {
 	addFile( path );
     }
 
+    _items.clear();
     finalizeAll( _pkg );
     _tree->sendReadJobFinished( _pkg );
     finished();
@@ -363,6 +420,26 @@ void PkgReadJob::startReading()
 }
 
 
+bool PkgReadJob::startPrefetch( QThreadPool * pool )
+{
+    if ( _prefetch || ! pool || ! _queue )
+	return false;
+
+    // The file list caches and the processes are only for the main thread
+
+    _prefetch = PkgPrefetchPtr( new PkgPrefetch( fileList() ) );
+    CHECK_NEW( _prefetch.data() );
+
+    PkgPrefetchTask * task = new PkgPrefetchTask( _prefetch,
+						  _pkg->device(),
+						  _queue->schedulerClient() );
+    CHECK_NEW( task );
+    pool->start( task ); // The pool takes over ownership of the task
+
+    return true;
+}
+
+
 QStringList PkgReadJob::fileList()
 {
     logDebug() << "Using default PkgQuery::fileList() for " << _pkg << endl;
@@ -378,60 +455,95 @@ void PkgReadJob::addFile( const QString & fileListPath )
 
     // logDebug() << "Adding " << fileListPath << " to " << _pkg << endl;
 
-    QStringList remaining = fileListPath.split( "/", QString::SkipEmptyParts );
-    QStringList currentPath;
-    DirInfo *	parent = _pkg;
+    QStringList pathComponents = fileListPath.split( "/", QString::SkipEmptyParts );
+
+    if ( pathComponents.isEmpty() )
+	return;
+
+    QString path = QString( "/" ) + pathComponents.join( "/" );
 
-    while ( ! remaining.isEmpty() )
+    if ( _items.contains( path ) )	// A directory that was created for a file before
+	return;
+
+    DirInfo * parent = dir( pathComponents, pathComponents.size() - 1 );
+
+    if ( ! parent )
+	return;
+
+    FileInfo * item = createItem( pathComponents, _tree, parent );
+
+    if ( ! item )
     {
-	QString currentName = remaining.takeFirst();
-	currentPath << currentName;
+	parent->setReadState( DirError );
+	return;
+    }
 
-	FileInfo * newParent = _pkg->locate( parent, QStringList() << currentName );
+    _items.insert( path, item );
+}
 
-	if ( ! newParent )
-	{
-	    newParent = createItem( currentPath, _tree, parent );
 
-	    if ( ! newParent )
-	    {
-		parent->setReadState( DirError );
-		return;
-	    }
+DirInfo * PkgReadJob::dir( const QStringList & pathComponents, int count )
+{
+    if ( count < 1 )
+	return _pkg;
 
-	    // logDebug() << "Created " << newParent << endl;
-	}
+    QStringList dirComponents = pathComponents.mid( 0, count );
+    QString	path	      = QString( "/" ) + dirComponents.join( "/" );
+    FileInfo *	item	      = _items.value( path, 0 );
 
-	if ( ! remaining.isEmpty() )
-	{
-	    parent = newParent->toDirInfo();
+    if ( ! item )
+    {
+	DirInfo * parent = dir( pathComponents, count - 1 );
 
-	    if ( ! parent )
-	    {
-		logWarning() << newParent << " should be a directory, but is not" << endl;
-		return;
-	    }
+	if ( ! parent )
+	    return 0;
+
+	item = createItem( dirComponents, _tree, parent );
+
+	if ( ! item )
+	{
+	    parent->setReadState( DirError );
+	    return 0;
 	}
+
+	// logDebug() << "Created " << item << endl;
+	_items.insert( path, item );
     }
+
+    DirInfo * dirInfo = item->toDirInfo();
+
+    if ( ! dirInfo )
+	logWarning() << item << " should be a directory, but is not" << endl;
+
+    return dirInfo;
 }
 
 
 void PkgReadJob::finalizeAll( DirInfo * subtree )
 {
-    FileInfo * child = subtree->firstChild();
+    // Subdirectories first, but without recursion: See DirInfo::finalizeAll()
 
-    while( child )
-    {
-	if ( child->isDirInfo() )
-	    finalizeAll( child->toDirInfo() );
+    QVector<DirInfo *> dirs;
+    dirs << subtree;
 
-	child = child->next();
+    for ( int i = 0; i < dirs.size(); ++i )
+    {
+	for ( FileInfo * child = dirs.at( i )->firstChild(); child; child = child->next() )
+	{
+	    if ( child->isDirInfo() )
+		dirs << child->toDirInfo();
+	}
     }
 
-    if ( ! subtree->readError() )
-	subtree->setReadState( DirFinished );
+    for ( int i = dirs.size() - 1; i >= 0; --i )
+    {
+	DirInfo * dir = dirs.at( i );
 
-    subtree->finalizeLocal();
+	if ( ! dir->readError() )
+	    dir->setReadState( DirFinished );
+
+	dir->finalizeLocal();
+    }
 }
 
 
@@ -478,22 +590,8 @@ struct stat * PkgReadJob::lstat( const QString & path )
 {
     static struct stat statInfo;
 
-    if ( _statCache.contains( path ) )
-    {
-        ++_cacheHits;
-        // logDebug() << "stat cache hit for " << path << endl;
-        statInfo = _statCache.value( path );
-    }
-    else
-    {
-        int result = ::lstat( path.toUtf8(), &statInfo );
-        ++_lstatCalls;
-
-        if ( result != 0 )
-            return 0;	// lstat() failed
-
-        _statCache.insert( path, statInfo );
-    }
+    if ( ! _statCache.lstat( path, &statInfo ) )
+	return 0;	// lstat() failed
 
 
     if ( S_ISDIR( statInfo.st_mode ) )	// directory?
@@ -10,12 +10,16 @@
 #define PkgReader_h
 
 #include <QMap>
+#include <QHash>
+#include <QAtomicInt>
 #include <QSharedPointer>
+#include <QStringList>
 
 #include "DirReadJob.h"
 #include "PkgInfo.h"
 #include "PkgFilter.h"
 #include "Process.h"
+#include "PkgStatCache.h"
 
 
 namespace QDirStat
@@ -25,6 +29,25 @@ namespace QDirStat
     class PkgFileListCache;
 
 
+    /**
+     * The file list of a package and whether all of its files are in the
+     * stat cache yet. This is shared between a PkgReadJob and the task
+     * that does the lstat() calls in a worker thread, so the task can
+     * still finish if the job is deleted in the meantime.
+     **/
+    struct PkgPrefetch
+    {
+	PkgPrefetch( const QStringList & fileList ): paths( fileList ) {}
+
+	bool isDone() const { return done.loadAcquire() != 0; }
+
+	QStringList paths;
+	QAtomicInt  done;
+    };
+
+    typedef QSharedPointer<PkgPrefetch> PkgPrefetchPtr;
+
+
     /**
      * A class for reading information about installed packages.
      *
@@ -162,17 +185,41 @@ namespace QDirStat
 	virtual ~PkgReadJob();
 
 	/**
-	 * Start reading the file list of the package.
+	 * Create the nodes for the files of the package. The packages don't
+	 * share any nodes, but the tree does not allow more than one thread,
+	 * so this is done in the main thread from the stat cache that the
+	 * prefetch filled.
 	 *
 	 * Reimplemented from DirReadJob.
 	 **/
 	virtual void startReading() Q_DECL_OVERRIDE;
 
+	/**
+	 * Return 'true' if the files of the package are in the stat cache.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual bool isReady() const Q_DECL_OVERRIDE
+	    { return _prefetch && _prefetch->isDone(); }
+
+	/**
+	 * Get the file list in the main thread and start the lstat() calls
+	 * for it in a worker thread of 'pool'.
+	 *
+	 * Reimplemented from DirReadJob.
+	 **/
+	virtual bool startPrefetch( QThreadPool * pool ) Q_DECL_OVERRIDE;
+
 	/**
 	 * Return the parent PkgInfo node.
 	 **/
 	PkgInfo * pkg() const { return _pkg; }
 
+	/**
+	 * Return the stat cache that all package read jobs share.
+	 **/
+	static PkgStatCache & statCache() { return _statCache; }
+
 
     protected:
 
@@ -192,6 +239,13 @@ namespace QDirStat
          **/
         void addFile( const QString & path );
 
+        /**
+         * Return the directory of the first 'count' of 'pathComponents',
+         * creating it and its parents if they are not there yet. Return 0
+         * if that fails or if it is not a directory.
+         **/
+        DirInfo * dir( const QStringList & pathComponents, int count );
+
 	/**
 	 * Obtain information about the file or directory specified in
          * 'pathComponents' and create a new FileInfo or a DirInfo (whatever is
@@ -229,12 +283,15 @@ namespace QDirStat
 
         // Data members
 
-	PkgInfo * _pkg;
+	PkgInfo *      _pkg;
+	PkgPrefetchPtr _prefetch;
+
+        // The items of this package by path, so adding a file only needs
+        // one lookup for its parent directory
+        QHash<QString, FileInfo *> _items;
 
-        static QMap<QString, struct stat> _statCache;
-        static int                        _activeJobs;
-        static int                        _cacheHits;
-        static int                        _lstatCalls;
+        static PkgStatCache _statCache;
+        static int          _activeJobs;
 
     };	// class PkgReadJob
 
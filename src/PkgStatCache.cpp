@@ -0,0 +1,199 @@
+/*
+ *   File name: PkgStatCache.cpp
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+#include <errno.h>
+#include <string.h>	// memset()
+
+#include <QMap>
+#include <QMutexLocker>
+
+#include "PkgStatCache.h"
+#include "LocalDirReader.h"
+#include "Logger.h"
+
+
+using namespace QDirStat;
+
+
+PkgStatCache::PkgStatCache():
+    _cacheHits( 0 ),
+    _lstatCalls( 0 )
+{
+
+}
+
+
+void PkgStatCache::prefetch( const QStringList & paths )
+{
+    // Collect the names that are not known yet for each directory
+
+    QMap<QString, QList<QByteArray> > missing;
+    QMutexLocker locker( &_mutex );
+
+    foreach ( const QString & path, paths )
+    {
+	QString normalized = path;
+
+	while ( normalized.size() > 1 && normalized.endsWith( '/' ) )
+	    normalized.chop( 1 );
+
+	int pos = normalized.lastIndexOf( '/' );
+
+	if ( pos < 0 || pos == normalized.size() - 1 )
+	    continue;
+
+	QString dir  = pos == 0 ? QString( "/" ) : normalized.left( pos );
+	QString name = normalized.mid( pos + 1 );
+
+	if ( ! _entries.contains( Key( dirNo( dir ), name ) ) )
+	    missing[ dir ] << name.toUtf8();
+    }
+
+    locker.unlock();
+
+    for ( QMap<QString, QList<QByteArray> >::const_iterator it = missing.constBegin();
+	  it != missing.constEnd();
+	  ++it )
+    {
+	LocalDirReader reader( it.key().toUtf8() );
+	reader.statNames( it.value() );
+
+	if ( reader.result() != LocalDirReader::Ok )
+	    continue; // Leave those names to lstat()
+
+	QMutexLocker dirLocker( &_mutex );
+	int dir = dirNo( it.key() );
+
+	foreach ( const LocalDirEntry & dirEntry, reader.entries() )
+	{
+	    _entries.insert( Key( dir, reader.name( dirEntry ) ),
+			     entry( dirEntry.statInfo, dirEntry.statErrno ) );
+	    ++_lstatCalls;
+	}
+    }
+}
+
+
+bool PkgStatCache::lstat( const QString & path, struct stat * statInfo_ret )
+{
+    QMutexLocker locker( &_mutex );
+    Key cacheKey = key( path );
+    QHash<Key, Entry>::const_iterator it = _entries.constFind( cacheKey );
+    Entry cached;
+
+    if ( it != _entries.constEnd() )
+    {
+	++_cacheHits;
+	cached = it.value();
+    }
+    else
+    {
+	locker.unlock();
+
+	struct stat statInfo;
+	int result = ::lstat( path.toUtf8(), &statInfo );
+	cached = entry( statInfo, result == 0 ? 0 : ( errno ? errno : EIO ) );
+
+	locker.relock();
+	++_lstatCalls;
+	_entries.insert( cacheKey, cached );
+    }
+
+    locker.unlock();
+
+    if ( cached.errNo != 0 )
+	return false;
+
+    memset( statInfo_ret, 0, sizeof( *statInfo_ret ) );
+
+    statInfo_ret->st_dev    = cached.dev;
+    statInfo_ret->st_ino    = cached.ino;
+    statInfo_ret->st_mode   = cached.mode;
+    statInfo_ret->st_nlink  = cached.nlink;
+    statInfo_ret->st_uid    = cached.uid;
+    statInfo_ret->st_gid    = cached.gid;
+    statInfo_ret->st_size   = cached.size;
+    statInfo_ret->st_blocks = cached.blocks;
+    statInfo_ret->st_mtime  = cached.mtime;
+
+    return true;
+}
+
+
+void PkgStatCache::clear()
+{
+    QMutexLocker locker( &_mutex );
+
+    _dirNos.clear();
+    _entries.clear();
+    _cacheHits	= 0;
+    _lstatCalls = 0;
+}
+
+
+void PkgStatCache::reportStats() const
+{
+    QMutexLocker locker( &_mutex );
+    float hitPercent = 0.0;
+
+    if ( _lstatCalls > 0 )
+	hitPercent = ( 100.0 * _cacheHits ) /_lstatCalls;
+
+    logDebug() << _lstatCalls << " lstat() calls" << endl;
+    logDebug() << _cacheHits << " stat cache hits ("
+	       << qRound( hitPercent ) << "%)" << endl;
+}
+
+
+int PkgStatCache::dirNo( const QString & dir )
+{
+    QHash<QString, int>::const_iterator it = _dirNos.constFind( dir );
+
+    if ( it != _dirNos.constEnd() )
+	return it.value();
+
+    int no = _dirNos.size();
+    _dirNos.insert( dir, no );
+
+    return no;
+}
+
+
+PkgStatCache::Key PkgStatCache::key( const QString & path )
+{
+    int pos = path.lastIndexOf( '/' );
+
+    if ( pos < 0 )
+	return Key( -1, path );
+
+    return Key( dirNo( pos == 0 ? QString( "/" ) : path.left( pos ) ), path.mid( pos + 1 ) );
+}
+
+
+PkgStatCache::Entry PkgStatCache::entry( const struct stat & statInfo, int errNo )
+{
+    Entry entry;
+    memset( &entry, 0, sizeof( entry ) );
+
+    entry.errNo = errNo;
+
+    if ( errNo == 0 )
+    {
+	entry.dev    = statInfo.st_dev;
+	entry.ino    = statInfo.st_ino;
+	entry.mode   = statInfo.st_mode;
+	entry.nlink  = statInfo.st_nlink;
+	entry.uid    = statInfo.st_uid;
+	entry.gid    = statInfo.st_gid;
+	entry.size   = statInfo.st_size;
+	entry.blocks = statInfo.st_blocks;
+	entry.mtime  = statInfo.st_mtime;
+    }
+
+    return entry;
+}
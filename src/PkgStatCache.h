@@ -0,0 +1,121 @@
+/*
+ *   File name: PkgStatCache.h
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+#ifndef PkgStatCache_h
+#define PkgStatCache_h
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+
+
+namespace QDirStat
+{
+    /**
+     * Cache for the lstat() results of the files of packages: Many packages
+     * share directories, and each file is only stat()ed once for all of
+     * them.
+     *
+     * The entries are keyed by an interned directory number and the name
+     * in that directory, and they store only the fields of struct stat that
+     * FileInfo uses. prefetch() fills the cache with one batch of statx()
+     * calls (via io_uring if enabled) for each directory, just like the
+     * normal directory scan.
+     *
+     * This is thread-safe: The package read jobs prefetch their files in
+     * worker threads. The system calls are done without holding the lock,
+     * so two threads might stat the same name at the same time; that only
+     * costs a little extra work.
+     **/
+    class PkgStatCache
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	PkgStatCache();
+
+	/**
+	 * lstat() all 'paths' that are not in the cache yet, grouped by
+	 * directory.
+	 **/
+	void prefetch( const QStringList & paths );
+
+	/**
+	 * Fill 'statInfo_ret' with the lstat() result for 'path' from the
+	 * cache or with a new lstat() call. Return 'false' if lstat() failed.
+	 **/
+	bool lstat( const QString & path, struct stat * statInfo_ret );
+
+	/**
+	 * Clear the cache and the statistics.
+	 **/
+	void clear();
+
+	/**
+	 * Write statistics about the cache to the log.
+	 **/
+	void reportStats() const;
+
+
+    protected:
+
+	/**
+	 * The parts of struct stat that FileInfo uses.
+	 **/
+	struct Entry
+	{
+	    dev_t     dev;
+	    ino_t     ino;
+	    mode_t    mode;
+	    nlink_t   nlink;
+	    uid_t     uid;
+	    gid_t     gid;
+	    off_t     size;
+	    blkcnt_t  blocks;
+	    time_t    mtime;
+	    int	      errNo;	// 0 if lstat() was successful
+	};
+
+	typedef QPair<int, QString> Key;
+
+	/**
+	 * Return the number for directory 'dir' and add it if it is new.
+	 * The caller needs to hold the lock for this and for key().
+	 **/
+	int dirNo( const QString & dir );
+
+	/**
+	 * Split 'path' into the directory number and the name.
+	 **/
+	Key key( const QString & path );
+
+	/**
+	 * Create a cache entry from 'statInfo' or from an lstat() error
+	 * 'errNo'.
+	 **/
+	static Entry entry( const struct stat & statInfo, int errNo );
+
+
+	mutable QMutex	    _mutex;
+	QHash<QString, int> _dirNos;
+	QHash<Key, Entry>   _entries;
+	int		    _cacheHits;
+	int		    _lstatCalls;
+    };
+
+}	// namespace QDirStat
+
+
+#endif	// PkgStatCache_h
@@ -0,0 +1,241 @@
+/*
+ *   File name: QuantileSketch.cpp
+ *   Summary:	Statistics classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <math.h>	// ceil(), pow()
+#include <algorithm>
+
+#include "QuantileSketch.h"
+
+
+// Each level may hold this much less than the one above it
+#define LevelCapacityFactor	( 2.0 / 3.0 )
+
+#define MinLevelCapacity	2
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    bool lessValue( const QuantileSketch::WeightedValue & a,
+		    const QuantileSketch::WeightedValue & b )
+    {
+	return a.value < b.value;
+    }
+
+}	// namespace
+
+
+QuantileSketch::QuantileSketch( int k ):
+    _k( qMax( MinLevelCapacity, k ) )
+{
+    clear();
+}
+
+
+int QuantileSketch::kForError( qreal epsilon )
+{
+    if ( epsilon <= 0.0 )
+	return DefaultSketchK;
+
+    // Empirical error of KLL sketches: epsilon = 2.296 / k^0.9723
+
+    return qMax( MinLevelCapacity, (int) ceil( pow( 2.296 / epsilon, 1.0 / 0.9723 ) ) );
+}
+
+
+void QuantileSketch::clear()
+{
+    _count  = 0;
+    _min    = 0.0;
+    _max    = 0.0;
+    _sum    = 0.0;
+    _random = 0x9e3779b9;
+
+    _levels.clear();
+    _levels.append( QVector<qreal>() );
+    updateSize();
+}
+
+
+void QuantileSketch::add( qreal value, qint64 weight )
+{
+    if ( weight <= 0 )
+	return;
+
+    if ( _count == 0 || value < _min ) _min = value;
+    if ( _count == 0 || value > _max ) _max = value;
+
+    _count += weight;
+    _sum   += value * weight;
+
+    // Each value on level h stands for 2^h values: Add the value on the
+    // levels of the bits of 'weight'
+
+    for ( int level = 0; weight > 0; ++level, weight >>= 1 )
+    {
+	if ( weight & 1 )
+	{
+	    while ( _levels.size() <= level )
+		_levels.append( QVector<qreal>() );
+
+	    _levels[ level ] << value;
+	}
+    }
+
+    updateSize();
+    compress();
+}
+
+
+void QuantileSketch::merge( const QuantileSketch & other )
+{
+    if ( other._count == 0 )
+	return;
+
+    if ( _count == 0 || other._min < _min ) _min = other._min;
+    if ( _count == 0 || other._max > _max ) _max = other._max;
+
+    _count += other._count;
+    _sum   += other._sum;
+
+    while ( _levels.size() < other._levels.size() )
+	_levels.append( QVector<qreal>() );
+
+    for ( int level = 0; level < other._levels.size(); ++level )
+	_levels[ level ] += other._levels.at( level );
+
+    updateSize();
+    compress();
+}
+
+
+qreal QuantileSketch::quantile( qreal fraction ) const
+{
+    if ( _count == 0 )
+	return 0.0;
+
+    if ( fraction <= 0.0 )
+	return _min;
+
+    if ( fraction >= 1.0 )
+	return _max;
+
+    QVector<WeightedValue> values = sortedValues();
+    qreal  rank	       = fraction * _count;
+    qint64 accumulated = 0;
+
+    foreach ( const WeightedValue & value, values )
+    {
+	accumulated += value.weight;
+
+	if ( accumulated >= rank )
+	    return value.value;
+    }
+
+    return _max;
+}
+
+
+QVector<QuantileSketch::WeightedValue> QuantileSketch::sortedValues() const
+{
+    QVector<WeightedValue> values;
+
+    for ( int level = 0; level < _levels.size(); ++level )
+    {
+	foreach ( qreal value, _levels.at( level ) )
+	{
+	    WeightedValue weightedValue;
+	    weightedValue.value	 = value;
+	    weightedValue.weight = 1LL << level;
+	    values << weightedValue;
+	}
+    }
+
+    std::sort( values.begin(), values.end(), lessValue );
+
+    return values;
+}
+
+
+int QuantileSketch::capacity( int level ) const
+{
+    int depth = _levels.size() - 1 - level;
+
+    return qMax( MinLevelCapacity, (int) ceil( _k * pow( LevelCapacityFactor, depth ) ) );
+}
+
+
+void QuantileSketch::compress()
+{
+    // If there are more values than the levels can hold, at least one of
+    // them is full. Compacting the top level adds another one, which gives
+    // all levels below it more space.
+
+    while ( _retained >= _totalCapacity )
+    {
+	for ( int level = 0; level < _levels.size(); ++level )
+	{
+	    if ( _levels.at( level ).size() >= capacity( level ) )
+	    {
+		compact( level );
+		break;
+	    }
+	}
+
+	updateSize();
+    }
+}
+
+
+void QuantileSketch::updateSize()
+{
+    _retained	   = 0;
+    _totalCapacity = 0;
+
+    for ( int level = 0; level < _levels.size(); ++level )
+    {
+	_retained      += _levels.at( level ).size();
+	_totalCapacity += capacity( level );
+    }
+}
+
+
+void QuantileSketch::compact( int level )
+{
+    if ( level + 1 >= _levels.size() )
+	_levels.append( QVector<qreal>() );
+
+    QVector<qreal> & values = _levels[ level ];
+    std::sort( values.begin(), values.end() );
+
+    // With an odd number of values, one of them stays on this level so the
+    // total weight stays the same
+
+    bool  odd	   = values.size() % 2 != 0;
+    qreal leftover = odd ? values.takeLast() : 0.0;
+
+    // xorshift random numbers: Which half moves up must not depend on the
+    // values
+
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+
+    QVector<qreal> & nextLevel = _levels[ level + 1 ];
+
+    for ( int i = _random & 1; i < values.size(); i += 2 )
+	nextLevel << values.at( i );
+
+    values.clear();
+
+    if ( odd )
+	values << leftover;
+}
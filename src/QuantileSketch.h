@@ -0,0 +1,158 @@
+/*
+ *   File name: QuantileSketch.h
+ *   Summary:	Statistics classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef QuantileSketch_h
+#define QuantileSketch_h
+
+
+#include <QVector>
+
+
+// This keeps quantiles within about 1.3% of the rank
+#define DefaultSketchK	200
+
+
+namespace QDirStat
+{
+    /**
+     * Approximate quantiles of a stream of values in (almost) constant
+     * memory: A KLL sketch as described by Zohar Karnin, Kevin Lang and
+     * Edo Liberty in "Optimal Quantile Approximation in Streams".
+     *
+     * The values are collected in levels; each value of level h stands for
+     * 2^h of the original values. When a level is full, it is sorted and
+     * every other value of it (starting at random with the first or the
+     * second one) moves up one level. The lower levels get less space than
+     * the higher ones, so this keeps only about 3 * k values. The error of
+     * a quantile is about 2.3 / k^0.97 of the rank.
+     *
+     * Two sketches can be merged, e.g. the ones of several subtrees.
+     **/
+    class QuantileSketch
+    {
+    public:
+
+	/**
+	 * One value that stands for 'weight' original values.
+	 **/
+	struct WeightedValue
+	{
+	    qreal  value;
+	    qint64 weight;
+	};
+
+
+	/**
+	 * Constructor. 'k' is the accuracy parameter: Bigger values of 'k'
+	 * need more memory, but make the quantiles more exact.
+	 **/
+	QuantileSketch( int k = DefaultSketchK );
+
+	/**
+	 * Return the 'k' that gives quantiles within about 'epsilon' (e.g.
+	 * 0.01 for 1%) of the rank.
+	 **/
+	static int kForError( qreal epsilon );
+
+	/**
+	 * Remove all values.
+	 **/
+	void clear();
+
+	/**
+	 * Add one value.
+	 **/
+	void add( qreal value )
+	{
+	    if ( _count == 0 || value < _min ) _min = value;
+	    if ( _count == 0 || value > _max ) _max = value;
+
+	    _count++;
+	    _sum += value;
+	    _levels[0] << value;
+
+	    if ( ++_retained >= _totalCapacity )
+		compress();
+	}
+
+	/**
+	 * Add 'value' 'weight' times.
+	 **/
+	void add( qreal value, qint64 weight );
+
+	/**
+	 * Add all values of 'other' to this sketch.
+	 **/
+	void merge( const QuantileSketch & other );
+
+	/**
+	 * Return the number of values that were added.
+	 **/
+	qint64 count() const { return _count; }
+
+	/**
+	 * Return the exact minimum, maximum and sum of all values.
+	 **/
+	qreal min() const { return _min; }
+	qreal max() const { return _max; }
+	qreal sum() const { return _sum; }
+
+	/**
+	 * Return the approximate quantile for 'fraction' (0.0 .. 1.0) of the
+	 * values, e.g. 0.5 for the median.
+	 **/
+	qreal quantile( qreal fraction ) const;
+
+	/**
+	 * Return all values that the sketch keeps with their weights in
+	 * ascending order. The weights add up to count().
+	 **/
+	QVector<WeightedValue> sortedValues() const;
+
+
+    protected:
+
+	/**
+	 * Return the number of values that 'level' may hold.
+	 **/
+	int capacity( int level ) const;
+
+	/**
+	 * Compact the lowest full level until there is space again.
+	 **/
+	void compress();
+
+	/**
+	 * Count the values that are kept and how many would fit.
+	 **/
+	void updateSize();
+
+	/**
+	 * Move every other value of 'level' up one level.
+	 **/
+	void compact( int level );
+
+
+	// Data members
+
+	int			 _k;
+	qint64			 _count;
+	qreal			 _min;
+	qreal			 _max;
+	qreal			 _sum;
+	int			 _retained;
+	int			 _totalCapacity;
+	quint32			 _random;
+	QVector<QVector<qreal> > _levels;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef QuantileSketch_h
@@ -0,0 +1,670 @@
+/*
+ *   File name: ReadScheduler.cpp
+ *   Summary:	Sharing the worker threads between all directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/sysmacros.h>	// major(), minor()
+#include <sched.h>		// sched_setscheduler()
+#include <unistd.h>
+
+#if defined( __linux__ )
+#  include <sys/syscall.h>	// SYS_ioprio_set
+#endif
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QVector>
+
+#include "ReadScheduler.h"
+#include "DirReadJob.h"
+#include "DirInfo.h"
+#include "MountPoints.h"
+#include "ScanStats.h"
+#include "Logger.h"
+#include "Exception.h"
+
+// From linux/ioprio.h, which is not always installed
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_NONE	0
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Set the I/O priority class of the calling thread to 'idle' or back to
+     * the default (from the CPU priority).
+     **/
+    void setIdleIoPriority( bool idle )
+    {
+#if defined( SYS_ioprio_set )
+	int ioClass = idle ? IOPRIO_CLASS_IDLE : IOPRIO_CLASS_NONE;
+
+	// With IOPRIO_WHO_PROCESS, 0 is the calling thread
+
+	syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioClass << IOPRIO_CLASS_SHIFT );
+#else
+	Q_UNUSED( idle );
+#endif
+    }
+
+
+    /**
+     * Let the calling thread only use CPU time that nobody else wants, or
+     * restore the normal scheduling.
+     **/
+    void setIdleCpuPriority( bool idle )
+    {
+#if defined( SCHED_IDLE )
+	struct sched_param param;
+	param.sched_priority = 0;
+
+	// On Linux, 0 is the calling thread, not the whole process
+
+	sched_setscheduler( 0, idle ? SCHED_IDLE : SCHED_OTHER, &param );
+#else
+	Q_UNUSED( idle );
+#endif
+    }
+
+    /**
+     * Return 'true' if 'device' is a rotational disk according to sysfs.
+     * Devices that are not backed by a block device (btrfs subvolumes,
+     * tmpfs, network mounts) are reported as non-rotational.
+     **/
+    bool isRotational( dev_t device )
+    {
+	if ( major( device ) == 0 )
+	    return false;
+
+	QString sysDir = QString( "/sys/dev/block/%1:%2/" )
+	    .arg( major( device ) ).arg( minor( device ) );
+
+	// A partition does not have its own queue/ directory; use the one of
+	// the disk it belongs to.
+
+	QStringList candidates;
+	candidates << sysDir + "queue/rotational"
+		   << sysDir + "../queue/rotational";
+
+	foreach ( const QString & path, candidates )
+	{
+	    QFile file( path );
+
+	    if ( file.open( QIODevice::ReadOnly ) )
+		return file.readAll().trimmed() == "1";
+	}
+
+	return false;
+    }
+
+
+#if defined( __linux__ )
+
+    // The CPUs of each NUMA node and of the whole process. These are only
+    // written once in the main thread before the first worker uses them.
+
+    QVector<cpu_set_t> numaNodeCpus;
+    cpu_set_t	       processCpus;
+    bool	       numaNodesRead = false;
+
+
+    /**
+     * Parse a CPU list from sysfs like "0-7,16-23" into 'cpus_ret'.
+     **/
+    void parseCpuList( const QString & cpuList, cpu_set_t & cpus_ret )
+    {
+	CPU_ZERO( &cpus_ret );
+
+	foreach ( const QString & range, cpuList.split( ',', QString::SkipEmptyParts ) )
+	{
+	    QStringList limits = range.split( '-' );
+	    int first = limits.first().toInt();
+	    int last  = limits.last().toInt();
+
+	    for ( int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu )
+	    {
+		if ( CPU_ISSET( cpu, &processCpus ) )	// Respect taskset etc.
+		    CPU_SET( cpu, &cpus_ret );
+	    }
+	}
+    }
+
+
+    /**
+     * Read the CPUs of the NUMA nodes from sysfs if that was not done yet.
+     **/
+    void readNumaNodes()
+    {
+	if ( numaNodesRead )
+	    return;
+
+	numaNodesRead = true;
+
+	if ( sched_getaffinity( 0, sizeof( processCpus ), &processCpus ) != 0 )
+	    return;
+
+	QDir nodeDir( "/sys/devices/system/node" );
+	QStringList nodes = nodeDir.entryList( QStringList() << "node*", QDir::Dirs );
+
+	foreach ( const QString & node, nodes )
+	{
+	    bool ok     = false;
+	    int  nodeNo = node.mid( 4 ).toInt( &ok );
+
+	    if ( ! ok || nodeNo < 0 )
+		continue;
+
+	    QFile file( nodeDir.filePath( node + "/cpulist" ) );
+
+	    if ( ! file.open( QIODevice::ReadOnly ) )
+		continue;
+
+	    cpu_set_t none;
+	    CPU_ZERO( &none );
+
+	    while ( numaNodeCpus.size() <= nodeNo )	// Not sorted numerically
+		numaNodeCpus.append( none );
+
+	    parseCpuList( QString::fromLatin1( file.readAll().trimmed() ), numaNodeCpus[ nodeNo ] );
+	}
+
+	if ( numaNodeCpus.size() > 1 )
+	    logInfo() << "NUMA nodes: " << numaNodeCpus.size() << endl;
+    }
+
+
+    /**
+     * Return the NUMA node of the hardware behind block device 'device'
+     * according to sysfs, or -1 if it is not known: The first one that a
+     * device on the path to it in /sys/devices (the disk, its controller,
+     * the PCI bridges) knows.
+     **/
+    int findNumaNode( dev_t device )
+    {
+	if ( major( device ) == 0 )
+	    return -1;
+
+	QString path = QFileInfo( QString( "/sys/dev/block/%1:%2" )
+				  .arg( major( device ) ).arg( minor( device ) ) ).canonicalFilePath();
+
+	while ( path.startsWith( "/sys/devices/" ) )
+	{
+	    QFile file( path + "/numa_node" );
+
+	    if ( file.open( QIODevice::ReadOnly ) )
+		return file.readAll().trimmed().toInt();	// -1 for "no node"
+
+	    path = path.left( path.lastIndexOf( '/' ) );
+	}
+
+	return -1;
+    }
+
+#endif	// __linux__
+
+}	// namespace
+
+
+
+ReadScheduler * ReadScheduler::_instance = 0;
+QAtomicInt	ReadScheduler::_politeThreads( 0 );
+
+
+ReadScheduler * ReadScheduler::instance()
+{
+    if ( ! _instance )
+    {
+	_instance = new ReadScheduler();
+	CHECK_NEW( _instance );
+    }
+
+    return _instance;
+}
+
+
+ReadScheduler::ReadScheduler():
+    QObject(),
+    _nextClient( 1 ),
+    _workerThreads( 0 ),
+    _prefetchRunning( 0 ),
+    _rotationalDiskConcurrency( 2 ),
+    _networkMountConcurrency( 4 ),
+    _numaPlacement( true ),
+    _politeMode( false ),
+    _maxStatRate( 0 ),
+    _busyLatencyMillisec( 10 )
+{
+    _resumeTimer.setSingleShot( true );
+
+    connect( &_resumeTimer, SIGNAL( timeout()	   ),
+	     this,	    SLOT  ( resumeQueues() ) );
+}
+
+
+qulonglong ReadScheduler::addQueue( DirReadJobQueue * queue )
+{
+    Client client;
+    client.queue	   = queue;
+    client.workerThreads   = 0;
+    client.prefetchRunning = 0;
+
+    qulonglong id = _nextClient++;
+    _clients.insert( id, client );
+
+    return id;
+}
+
+
+void ReadScheduler::removeQueue( qulonglong client )
+{
+    bool hadWorkers = _clients.value( client ).workerThreads > 0;
+    _clients.remove( client );
+
+    if ( hadWorkers )
+	setWorkerThreads( 0, 0 );	// Recalculate the pool size
+}
+
+
+void ReadScheduler::setWorkerThreads( qulonglong client, int threads )
+{
+    QHash<qulonglong, Client>::iterator it = _clients.find( client );
+
+    if ( it != _clients.end() )
+	it.value().workerThreads = qMax( threads, 0 );
+
+    int maxThreads = 0;
+
+    foreach ( const Client & other, _clients )
+	maxThreads = qMax( maxThreads, other.workerThreads );
+
+    if ( maxThreads == _workerThreads )
+	return;
+
+    // Idle threads of the pool expire by themselves if it shrinks
+
+    _workerThreads = maxThreads;
+
+    if ( _workerThreads > 0 )
+	_threadPool.setMaxThreadCount( _workerThreads );
+
+    logInfo() << "The read queues share " << _workerThreads << " worker threads" << endl;
+}
+
+
+void ReadScheduler::setRotationalDiskConcurrency( int concurrency )
+{
+    _rotationalDiskConcurrency = qMax( 1, concurrency );
+    _deviceConcurrency.clear();
+}
+
+
+void ReadScheduler::setNetworkMountConcurrency( int concurrency )
+{
+    _networkMountConcurrency = qMax( 1, concurrency );
+    _deviceConcurrency.clear();
+}
+
+
+int ReadScheduler::deviceConcurrency( FileInfo * item )
+{
+    dev_t device = item ? item->device() : 0;
+    QHash<dev_t, int>::const_iterator it = _deviceConcurrency.constFind( device );
+
+    if ( it != _deviceConcurrency.constEnd() )
+	return it.value() > 0 ? it.value() : maxPrefetch();
+
+    int concurrency = 0;
+    QString type;
+
+    if ( item )
+    {
+	MountPoint * mountPoint = MountPoints::findByDevice( device );
+
+	if ( ! mountPoint )
+	    mountPoint = MountPoints::findNearestMountPoint( item->url() );
+
+	if ( mountPoint && mountPoint->isNetworkMount() )
+	{
+	    concurrency = _networkMountConcurrency;
+	    type = "network mount";
+	}
+	else if ( isRotational( device ) )
+	{
+	    concurrency = _rotationalDiskConcurrency;
+	    type = "rotational disk";
+	}
+    }
+
+    if ( ! type.isEmpty() )
+    {
+	logInfo() << "Device " << major( device ) << ":" << minor( device )
+		  << " is a " << type << "; limiting to "
+		  << concurrency << " parallel reads" << endl;
+    }
+
+    _deviceConcurrency.insert( device, concurrency );
+
+    return concurrency > 0 ? concurrency : maxPrefetch();
+}
+
+
+int ReadScheduler::activeQueues( bool withWorkers ) const
+{
+    int active = 0;
+
+    foreach ( const Client & client, _clients )
+    {
+	if ( client.queue && ! client.queue->isEmpty() &&
+	     ( ! withWorkers || client.workerThreads > 0 ) )
+	{
+	    ++active;
+	}
+    }
+
+    return active;
+}
+
+
+int ReadScheduler::prefetchShare( qulonglong client ) const
+{
+    int workers = _clients.value( client ).workerThreads;
+
+    if ( workers < 1 )
+	return 0;
+
+    // Round up so the shares use all slots
+
+    int active = qMax( 1, activeQueues( true ) );
+    int share  = ( maxPrefetch() + active - 1 ) / active;
+
+    return qMin( share, 2 * workers );
+}
+
+
+bool ReadScheduler::canPrefetch( qulonglong client ) const
+{
+    return _prefetchRunning < maxPrefetch() &&
+	   prefetchRunning( client ) < prefetchShare( client );
+}
+
+
+bool ReadScheduler::startPrefetch( qulonglong client, DirReadJob * job )
+{
+    if ( ! job || ! canPrefetch( client ) )
+	return false;
+
+    dev_t device = job->dir() ? job->dir()->device() : 0;
+
+    if ( _devicePrefetchRunning.value( device, 0 ) >= deviceConcurrency( job->dir() ) )
+	return false;
+
+    int delay = throttleDelay( device );
+
+    if ( delay > 0 )
+    {
+	resumeLater( delay );
+	return false;
+    }
+
+    if ( ! job->startPrefetch( &_threadPool ) )
+	return false;
+
+    ++_prefetchRunning;
+    ++_devicePrefetchRunning[ device ];
+    ++_clients[ client ].prefetchRunning;
+
+    return true;
+}
+
+
+int ReadScheduler::prefetchRunning( qulonglong client ) const
+{
+    return _clients.value( client ).prefetchRunning;
+}
+
+
+int ReadScheduler::timeBudgetShare( int millisec ) const
+{
+    int active = activeQueues( false );
+
+    if ( active < 2 || millisec < 1 )
+	return millisec;
+
+    return qMax( 1, millisec / active );
+}
+
+
+void ReadScheduler::prefetchFinished( qulonglong device, qulonglong client )
+{
+    if ( _prefetchRunning > 0 )
+	--_prefetchRunning;
+
+    int running = _devicePrefetchRunning.value( (dev_t) device, 0 ) - 1;
+
+    if ( running > 0 )
+	_devicePrefetchRunning[ (dev_t) device ] = running;
+    else
+	_devicePrefetchRunning.remove( (dev_t) device );
+
+    // The queue might be gone already
+
+    QHash<qulonglong, Client>::iterator it = _clients.find( client );
+
+    if ( it != _clients.end() && it.value().prefetchRunning > 0 )
+	--it.value().prefetchRunning;
+
+    // A slot was freed for the device and for all queues, so not only that
+    // queue might be able to go on.
+
+    resumeQueues();
+}
+
+
+void ReadScheduler::resumeQueues()
+{
+    foreach ( const Client & client, _clients )
+    {
+	if ( client.queue )
+	    client.queue->resume();
+    }
+}
+
+
+void ReadScheduler::resumeLater( int millisec )
+{
+    if ( ! _resumeTimer.isActive() || _resumeTimer.remainingTime() > millisec )
+	_resumeTimer.start( millisec );
+}
+
+
+void ReadScheduler::setPoliteMode( bool polite )
+{
+    if ( polite == _politeMode )
+	return;
+
+    _politeMode = polite;
+    _politeThreads.storeRelease( polite ? 1 : 0 );
+    _throttles.clear();
+
+    if ( polite )
+    {
+	logInfo() << "Polite scan mode: idle I/O priority, at most "
+		  << _maxStatRate << " lstat() calls per sec and device (0: no limit),"
+		  << " backing off above " << _busyLatencyMillisec << " ms latency" << endl;
+    }
+}
+
+
+void ReadScheduler::setNumaPlacement( bool enabled )
+{
+    _numaPlacement = enabled;
+    _deviceNumaNode.clear();
+}
+
+
+int ReadScheduler::deviceNumaNode( dev_t device )
+{
+#if defined( __linux__ )
+    if ( ! _numaPlacement )
+	return -1;
+
+    QHash<dev_t, int>::const_iterator it = _deviceNumaNode.constFind( device );
+
+    if ( it != _deviceNumaNode.constEnd() )
+	return it.value();
+
+    readNumaNodes();
+    int node = -1;
+
+    if ( numaNodeCpus.size() > 1 )
+    {
+	node = findNumaNode( device );
+
+	if ( node >= numaNodeCpus.size() || ( node >= 0 && CPU_COUNT( &numaNodeCpus[ node ] ) == 0 ) )
+	    node = -1;	// No CPUs there that this process may use
+
+	if ( node >= 0 )
+	{
+	    logInfo() << "Reading device " << major( device ) << ":" << minor( device )
+		      << " on the CPUs of NUMA node " << node << endl;
+	}
+    }
+
+    _deviceNumaNode.insert( device, node );
+
+    return node;
+#else
+    Q_UNUSED( device );
+    return -1;
+#endif
+}
+
+
+void ReadScheduler::adjustThreadPlacement( int node )
+{
+#if defined( __linux__ )
+    static thread_local int applied = -1;
+
+    if ( node == applied )
+	return;
+
+    applied = node;
+    const cpu_set_t & cpus = node >= 0 ? numaNodeCpus.at( node ) : processCpus;
+
+    // With 0, this is the calling thread, not the whole process
+
+    sched_setaffinity( 0, sizeof( cpus ), &cpus );
+#else
+    Q_UNUSED( node );
+#endif
+}
+
+
+void ReadScheduler::adjustThreadPriority( bool worker )
+{
+    static thread_local int applied = 0;
+    int polite = _politeThreads.loadAcquire();
+
+    if ( polite == applied )
+	return;
+
+    applied = polite;
+    setIdleIoPriority( polite );
+
+    if ( worker )
+	setIdleCpuPriority( polite );
+}
+
+
+DeviceThrottle & ReadScheduler::refill( dev_t device )
+{
+    DeviceThrottle & throttle = _throttles[ device ];
+
+    if ( ! throttle.refilled.isValid() )
+    {
+	throttle.refilled.start();
+	throttle.budget = _maxStatRate;
+    }
+    else if ( _maxStatRate > 0 )
+    {
+	// Up to one second of unused calls can be saved up for later
+
+	qint64 millisec = throttle.refilled.restart();
+	throttle.budget = qMin( (double) _maxStatRate,
+				throttle.budget + _maxStatRate * millisec / 1000.0 );
+    }
+
+    return throttle;
+}
+
+
+int ReadScheduler::throttleDelay( dev_t device )
+{
+    if ( ! _politeMode )
+	return 0;
+
+    DeviceThrottle & throttle = refill( device );
+    int delay = 0;
+
+    if ( _maxStatRate > 0 && throttle.budget < 0.0 )
+	delay = (int) ( -throttle.budget * 1000.0 / _maxStatRate ) + 1;
+
+    if ( throttle.backoffMillisec > 0 )
+	delay = qMax( delay, (int) ( throttle.backoffMillisec - throttle.backoffStart.elapsed() ) );
+
+    return qMax( delay, 0 );
+}
+
+
+void ReadScheduler::addStats( dev_t		       device,
+			      qint64		       statCalls,
+			      const LatencyHistogram & statLatency )
+{
+    if ( ! _politeMode )
+	return;
+
+    DeviceThrottle & throttle = refill( device );
+
+    if ( _maxStatRate > 0 )
+	throttle.budget -= statCalls;
+
+    if ( _busyLatencyMillisec < 1 || statLatency.count() < POLITE_MIN_LATENCY_SAMPLES )
+	return;
+
+    if ( statLatency.percentile( 50 ) > _busyLatencyMillisec * 1000000LL )
+    {
+	// The device is busy with something else: Back off, more and more
+	// while that goes on.
+
+	if ( throttle.backoffMillisec == 0 )
+	{
+	    logInfo() << "Device " << major( device ) << ":" << minor( device )
+		      << " is busy; backing off" << endl;
+	}
+
+	throttle.backoffMillisec = throttle.backoffMillisec > 0 ?
+	    qMin( 2 * throttle.backoffMillisec, POLITE_MAX_BACKOFF_MILLISEC ) :
+	    POLITE_MIN_BACKOFF_MILLISEC;
+
+	throttle.backoffStart.start();
+	++throttle.backoffCount;
+    }
+    else if ( throttle.backoffMillisec > 0 )
+    {
+	throttle.backoffMillisec /= 2;
+
+	if ( throttle.backoffMillisec < POLITE_MIN_BACKOFF_MILLISEC )
+	    throttle.backoffMillisec = 0;
+    }
+}
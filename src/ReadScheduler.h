@@ -0,0 +1,362 @@
+/*
+ *   File name: ReadScheduler.h
+ *   Summary:	Sharing the worker threads between all directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ReadScheduler_h
+#define ReadScheduler_h
+
+
+#include <sys/types.h>
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QThreadPool>
+#include <QTimer>
+
+
+// Polite mode: A busy device gets a break of that long, doubling up to the
+// maximum for as long as it stays busy
+#define POLITE_MIN_BACKOFF_MILLISEC	100
+#define POLITE_MAX_BACKOFF_MILLISEC	8000
+
+// Directories with fewer lstat() calls don't tell if the device is busy
+#define POLITE_MIN_LATENCY_SAMPLES	16
+
+// Polite mode: Pause between two time slices of reading in the main thread
+#define POLITE_SLICE_GAP_MILLISEC	10
+
+
+namespace QDirStat
+{
+    class DirReadJob;
+    class DirReadJobQueue;
+    class FileInfo;
+    class LatencyHistogram;
+
+    /**
+     * The throttling state of one device in polite mode.
+     **/
+    struct DeviceThrottle
+    {
+	DeviceThrottle():
+	    budget( 0.0 ),
+	    backoffMillisec( 0 ),
+	    backoffCount( 0 )
+	    {}
+
+	double	      budget;		// lstat() calls that may be done now
+	QElapsedTimer refilled;
+	int	      backoffMillisec;	// 0 unless the device is busy
+	QElapsedTimer backoffStart;
+	int	      backoffCount;	// how often the device was busy
+    };
+
+
+    /**
+     * Central scheduler for the prefetches of the read job queues of all
+     * directory trees, e.g. several trees of the scan daemon or the shadow
+     * trees that refresh parts of a tree, so they don't each bring their
+     * own worker threads and flood the same disks:
+     *
+     * All prefetches run in one thread pool, and the concurrency limits
+     * for rotational disks and network mounts (see deviceConcurrency())
+     * apply to all queues together.
+     *
+     * The prefetch slots are shared fairly: Each queue that has jobs gets
+     * at most its share of maxPrefetch(), so a huge tree does not starve a
+     * small one. For the same reason, the time budget of the time slices in
+     * the main thread is divided between the queues (see
+     * timeBudgetShare()).
+     *
+     * The workers report back to this scheduler, not to the queues, so a
+     * queue can be deleted while its prefetches are still running.
+     *
+     * In polite mode (see setPoliteMode()), reading stays out of the way of
+     * other work on the same machine and devices, e.g. on a file server
+     * during business hours: The I/O of the reading threads has the idle
+     * priority class, the worker threads only get idle CPU time, the main
+     * thread pauses between its time slices, the lstat() calls on each
+     * device are limited to maxStatRate() per second, and a device whose
+     * lstat() calls take longer than busyLatency() (the median of one
+     * directory) gets increasing breaks.
+     *
+     * On machines with several NUMA nodes (see setNumaPlacement()), the
+     * prefetches for a disk run on the CPUs of the node that the disk's
+     * controller is attached to, so the system calls for all directories
+     * of that disk don't bounce between the sockets.
+     *
+     * This is for the main (GUI) thread only.
+     **/
+    class ReadScheduler: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Return the singleton instance of this class.
+	 **/
+	static ReadScheduler * instance();
+
+	/**
+	 * Register 'queue' and return its client ID for the other calls.
+	 * DirReadJobQueue does this itself.
+	 **/
+	qulonglong addQueue( DirReadJobQueue * queue );
+
+	/**
+	 * Unregister the queue with client ID 'client'. Its prefetches that
+	 * are still running keep counting for their devices until they are
+	 * done.
+	 **/
+	void removeQueue( qulonglong client );
+
+	/**
+	 * Set the number of worker threads that 'client' wants. The thread
+	 * pool has as many threads as the queue that wants the most.
+	 **/
+	void setWorkerThreads( qulonglong client, int threads );
+
+	/**
+	 * Return the number of threads of the thread pool.
+	 **/
+	int workerThreads() const { return _workerThreads; }
+
+	/**
+	 * Set the maximum number of prefetches running at the same time for
+	 * one rotational disk, for all queues together.
+	 **/
+	void setRotationalDiskConcurrency( int concurrency );
+
+	/**
+	 * Return the maximum number of prefetches for one rotational disk.
+	 **/
+	int rotationalDiskConcurrency() const { return _rotationalDiskConcurrency; }
+
+	/**
+	 * Set the maximum number of prefetches running at the same time for
+	 * one network mount, for all queues together.
+	 **/
+	void setNetworkMountConcurrency( int concurrency );
+
+	/**
+	 * Return the maximum number of prefetches for one network mount.
+	 **/
+	int networkMountConcurrency() const { return _networkMountConcurrency; }
+
+	/**
+	 * Return the maximum number of reads that may be running at the same
+	 * time on the device of 'item': Fewer for rotational disks and
+	 * network mounts, maxPrefetch() for anything else.
+	 **/
+	int deviceConcurrency( FileInfo * item );
+
+	/**
+	 * Return the maximum number of prefetches that may be running or
+	 * waiting for a worker thread at the same time for all queues.
+	 **/
+	int maxPrefetch() const { return 2 * _workerThreads; }
+
+	/**
+	 * Return 'true' if 'client' may start another prefetch: Neither all
+	 * prefetch slots nor its own share of them are in use.
+	 **/
+	bool canPrefetch( qulonglong client ) const;
+
+	/**
+	 * Start the prefetch of 'job' of queue 'client' if that queue and the
+	 * device of the job have a free slot. Return 'true' if it was
+	 * started.
+	 **/
+	bool startPrefetch( qulonglong client, DirReadJob * job );
+
+	/**
+	 * Return the number of prefetches of 'client' that are running or
+	 * waiting for a worker thread.
+	 **/
+	int prefetchRunning( qulonglong client ) const;
+
+	/**
+	 * Return the part of a time budget of 'millisec' that one queue may
+	 * use for its time slice while others are busy, too.
+	 **/
+	int timeBudgetShare( int millisec ) const;
+
+	/**
+	 * Enable or disable polite mode for all queues.
+	 **/
+	void setPoliteMode( bool polite );
+
+	/**
+	 * Return 'true' if polite mode is enabled.
+	 **/
+	bool politeMode() const { return _politeMode; }
+
+	/**
+	 * Set the maximum number of lstat() calls per second for each device
+	 * in polite mode. 0 means no limit.
+	 **/
+	void setMaxStatRate( int callsPerSec ) { _maxStatRate = qMax( 0, callsPerSec ); }
+
+	/**
+	 * Return the maximum number of lstat() calls per second and device.
+	 **/
+	int maxStatRate() const { return _maxStatRate; }
+
+	/**
+	 * Set the lstat() latency above which a device counts as busy in
+	 * polite mode. 0 means never to back off.
+	 **/
+	void setBusyLatency( int millisec ) { _busyLatencyMillisec = qMax( 0, millisec ); }
+
+	/**
+	 * Return the lstat() latency above which a device counts as busy.
+	 **/
+	int busyLatency() const { return _busyLatencyMillisec; }
+
+	/**
+	 * Enable or disable running the prefetches for a disk on the CPUs of
+	 * its NUMA node. This has no effect on machines with only one node.
+	 **/
+	void setNumaPlacement( bool enabled );
+
+	/**
+	 * Return 'true' if NUMA placement is enabled.
+	 **/
+	bool numaPlacement() const { return _numaPlacement; }
+
+	/**
+	 * Return the NUMA node that 'device' is attached to, or -1 if that is
+	 * not known, if this machine has only one node, or if NUMA placement
+	 * is disabled.
+	 **/
+	int deviceNumaNode( dev_t device );
+
+	/**
+	 * Let the calling thread only run on the CPUs of NUMA node 'node', or
+	 * on all CPUs of the process again for -1. This is cheap unless the
+	 * node changed, and it can be called from any thread.
+	 **/
+	static void adjustThreadPlacement( int node );
+
+	/**
+	 * Return the number of millisec until the next directory may be read
+	 * from 'device', or 0 if that may be done right away.
+	 **/
+	int throttleDelay( dev_t device );
+
+	/**
+	 * Notification that a directory (or a chunk of one) on 'device' was
+	 * read with 'statCalls' lstat() calls that took 'statLatency'.
+	 **/
+	void addStats( dev_t		      device,
+		       qint64		      statCalls,
+		       const LatencyHistogram & statLatency );
+
+	/**
+	 * Return the throttling state of 'device' for display.
+	 **/
+	DeviceThrottle deviceThrottle( dev_t device ) const
+	    { return _throttles.value( device ); }
+
+	/**
+	 * Resume all queues after 'millisec', e.g. when a device may be
+	 * read again.
+	 **/
+	void resumeLater( int millisec );
+
+	/**
+	 * Give the calling thread the I/O priority (and, for a 'worker'
+	 * thread, the CPU priority) of the current mode. This is cheap
+	 * unless the mode changed, and it can be called from any thread.
+	 **/
+	static void adjustThreadPriority( bool worker );
+
+
+    public slots:
+
+	/**
+	 * Notification from a worker thread that a prefetch of queue
+	 * 'client' for a directory on 'device' is done.
+	 **/
+	void prefetchFinished( qulonglong device, qulonglong client );
+
+
+    protected slots:
+
+	/**
+	 * Resume all queues that have jobs.
+	 **/
+	void resumeQueues();
+
+
+    protected:
+
+	/**
+	 * Constructor. Use instance() instead.
+	 **/
+	ReadScheduler();
+
+	/**
+	 * Return the number of queues that have jobs; with 'withWorkers',
+	 * only those that use worker threads.
+	 **/
+	int activeQueues( bool withWorkers ) const;
+
+	/**
+	 * Return the prefetch share of 'client'.
+	 **/
+	int prefetchShare( qulonglong client ) const;
+
+	/**
+	 * Return the throttling state of 'device' with the lstat() budget
+	 * refilled for the time since the last time.
+	 **/
+	DeviceThrottle & refill( dev_t device );
+
+
+	struct Client
+	{
+	    DirReadJobQueue * queue;
+	    int		      workerThreads;
+	    int		      prefetchRunning;
+	};
+
+
+	//
+	// Data members
+	//
+
+	static ReadScheduler *	 _instance;
+	static QAtomicInt	 _politeThreads;	// politeMode() for other threads
+
+	QHash<qulonglong, Client> _clients;
+	qulonglong		 _nextClient;
+	int			 _workerThreads;
+	int			 _prefetchRunning;
+	int			 _rotationalDiskConcurrency;
+	int			 _networkMountConcurrency;
+	QHash<dev_t, int>	 _devicePrefetchRunning;
+	QHash<dev_t, int>	 _deviceConcurrency;	// Cache; 0 for no special limit
+	QHash<dev_t, int>	 _deviceNumaNode;	// Cache; -1 for none
+	bool			 _numaPlacement;
+	bool			 _politeMode;
+	int			 _maxStatRate;
+	int			 _busyLatencyMillisec;
+	QHash<dev_t, DeviceThrottle> _throttles;
+	QTimer			 _resumeTimer;
+	QThreadPool		 _threadPool;
+
+    };	// class ReadScheduler
+
+}	// namespace QDirStat
+
+
+#endif	// ReadScheduler_h
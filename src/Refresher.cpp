@@ -18,7 +18,8 @@ using namespace QDirStat;
 Refresher::Refresher( const FileInfoSet items, QObject * parent ):
     QObject( parent ),
     _items( items ),
-    _tree( 0 )
+    _tree( 0 ),
+    _changedOnly( false )
 {
     // logDebug() << "Creating refresher for " <<  _items.size() << " items" << endl;
 
@@ -38,7 +39,10 @@ void Refresher::refresh()
     {
 	logDebug() << "Refreshing " << _items.size() << " items" << endl;
 
-	_tree->refresh( _items );
+	if ( _changedOnly )
+	    _tree->refreshChanged( _items );
+	else
+	    _tree->refresh( _items );
     }
     else
     {
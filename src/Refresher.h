@@ -53,6 +53,13 @@ namespace QDirStat
 	 **/
 	static FileInfoSet parents( const FileInfoSet children );
 
+	/**
+	 * Only read the directories again whose mtime changed (see
+	 * DirTree::refreshChanged()). The default is to read the complete
+	 * subtrees again.
+	 **/
+	void setChangedOnly( bool changedOnly ) { _changedOnly = changedOnly; }
+
     public slots:
 
 	/**
@@ -69,6 +76,7 @@ namespace QDirStat
 
 	FileInfoSet _items;
         DirTree *   _tree;
+	bool	    _changedOnly;
     };
 }	// namespace QDirStat
 
@@ -0,0 +1,854 @@
+/*
+ *   File name: RemoteAgent.cpp
+ *   Summary:	Streaming scan results from a remote host for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <QFileInfo>
+
+#include "RemoteAgent.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "DirReadJob.h"
+#include "ExcludeRules.h"
+#include "Logger.h"
+#include "Exception.h"	// CHECK_NEW
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Map a signed number to an unsigned one so small negative numbers
+     * are small, too, and back.
+     **/
+    quint64 zigzag( qint64 value )
+    {
+	return ( (quint64) value << 1 ) ^ (quint64) ( value >> 63 );
+    }
+
+
+    qint64 unzigzag( quint64 value )
+    {
+	return (qint64) ( value >> 1 ) ^ -(qint64) ( value & 1 );
+    }
+
+}	// namespace
+
+
+
+RemoteAgent::RemoteAgent( DirTree * tree, FILE * out, QObject * parent ):
+    QObject( parent ),
+    _tree( tree ),
+    _out( out ),
+    _ok( true ),
+    _nextDirNo( 0 ),
+    _inputNotifier( 0 ),
+    _inputFd( -1 ),
+    _assigned( false ),
+    _busy( false ),
+    _inputDone( false ),
+    _ended( false )
+{
+    CHECK_PTR( _tree );
+
+    _buffer.reserve( AGENT_FLUSH_SIZE + 4096 );
+    _buffer.append( AGENT_MAGIC, AGENT_MAGIC_LEN );
+
+    connect( _tree, SIGNAL( readJobFinished( DirInfo * ) ),
+	     this,  SLOT  ( readJobFinished( DirInfo * ) ) );
+
+    connect( _tree, SIGNAL( finished() ),
+	     this,  SLOT  ( finished() ) );
+
+    connect( _tree, SIGNAL( aborted() ),
+	     this,  SLOT  ( aborted() ) );
+
+    // Send what there is from time to time even if the buffer is not full
+    // yet: Reading a slow filesystem should still show some progress.
+
+    connect( &_flushTimer, SIGNAL( timeout() ),
+	     this,	   SLOT	 ( flush()   ) );
+
+    _flushTimer.start( AGENT_FLUSH_MILLISEC );
+}
+
+
+RemoteAgent::~RemoteAgent()
+{
+    flush();
+    delete _inputNotifier;
+}
+
+
+void RemoteAgent::readAssignments( int fd )
+{
+    _assigned = true;
+    _inputFd  = fd;
+
+    _inputNotifier = new QSocketNotifier( fd, QSocketNotifier::Read );
+    CHECK_NEW( _inputNotifier );
+
+    connect( _inputNotifier, SIGNAL( activated( int ) ),
+	     this,	     SLOT  ( readInput()     ) );
+}
+
+
+void RemoteAgent::readInput()
+{
+    char    buffer[ 4096 ];
+    ssize_t len = ::read( _inputFd, buffer, sizeof( buffer ) );
+
+    if ( len > 0 )
+    {
+	_input.append( buffer, len );
+	int newline;
+
+	while ( ( newline = _input.indexOf( '\n' ) ) >= 0 )
+	{
+	    QByteArray line = _input.left( newline );
+	    _input.remove( 0, newline + 1 );
+
+	    if ( line.size() < 3 || line.at( 1 ) != ' ' ||
+		 ( line.at( 0 ) != AGENT_LIST_ASSIGNMENT && line.at( 0 ) != AGENT_READ_ASSIGNMENT ) )
+	    {
+		logError() << "Bad assignment: " << line << endl;
+		continue;
+	    }
+
+	    _assignments << QString( QChar( line.at( 0 ) ) ) + " " +
+		QString::fromUtf8( QByteArray::fromPercentEncoding( line.mid( 2 ) ) );
+	}
+    }
+    else if ( len == 0 || ( errno != EINTR && errno != EAGAIN ) )
+    {
+	// No more assignments: Finish the ones that are still queued
+
+	_inputDone = true;
+	_inputNotifier->setEnabled( false );
+    }
+
+    startNextAssignment();
+}
+
+
+void RemoteAgent::startNextAssignment()
+{
+    if ( _busy || _ended )
+	return;
+
+    if ( ! _ok )
+    {
+	sendEnd( true );
+	return;
+    }
+
+    if ( _assignments.isEmpty() )
+    {
+	if ( _inputDone )
+	    sendEnd( false );
+
+	return;
+    }
+
+    QString assignment = _assignments.takeFirst();
+    QString path       = assignment.mid( 2 );
+
+    // Each assignment has a new tree; only the numbers go on
+
+    _dirNos.clear();
+    _sentDirs.clear();
+
+    if ( assignment.at( 0 ) == AGENT_LIST_ASSIGNMENT )
+    {
+	listDir( path );
+	finishAssignment();
+    }
+    else if ( QFileInfo( path ).isDir() )
+    {
+	_busy = true;
+	_tree->startReading( path );
+    }
+    else
+    {
+	// Nothing is sent for it, so the other side knows it failed
+
+	logError() << "Not a directory: " << path << endl;
+	finishAssignment();
+    }
+}
+
+
+void RemoteAgent::finishAssignment()
+{
+    _buffer.append( AGENT_ASSIGNMENT_DONE_RECORD );
+    _busy = false;
+    flush();
+
+    // Not right away: This might be called from a signal of the tree
+
+    QTimer::singleShot( 0, this, SLOT( startNextAssignment() ) );
+}
+
+
+void RemoteAgent::listDir( const QString & path )
+{
+    _tree->clear();
+
+    FileInfo * item = LocalDirReadJob::stat( path, _tree, _tree->root(), false );
+
+    if ( ! item || ! item->isDirInfo() )
+    {
+	logError() << "Not a directory: " << path << endl;
+	return;
+    }
+
+    DirInfo * dir     = item->toDirInfo();
+    DIR *     diskDir = opendir( path.toUtf8() );
+
+    if ( ! diskDir )
+    {
+	logError() << "Can't open " << path << ": " << formatErrno() << endl;
+	dir->setReadState( DirError );
+	sendDir( dir );
+	return;
+    }
+
+    struct dirent * entry;
+
+    while ( ( entry = readdir( diskDir ) ) )
+    {
+	QString name = QString::fromUtf8( entry->d_name );
+
+	if ( name == "." || name == ".." )
+	    continue;
+
+	QString	   fullPath = path == "/" ? path + name : path + "/" + name;
+	FileInfo * child    = LocalDirReadJob::stat( fullPath, _tree, dir, false );
+
+	if ( ! child || ! child->isDirInfo() )
+	    continue;
+
+	// Subdirectories stay queued for read assignments unless they are
+	// excluded or mount points like in a LocalDirReadJob
+
+	DirInfo * subDir = child->toDirInfo();
+
+	if ( ExcludeRules::instance()->match( fullPath, name ) )
+	{
+	    subDir->setExcluded();
+	    subDir->setReadState( DirOnRequestOnly );
+	}
+	else if ( subDir->isMountPoint() && ! _tree->crossFilesystems() )
+	{
+	    subDir->setReadState( DirOnRequestOnly );
+	}
+
+	if ( subDir->readState() == DirOnRequestOnly )
+	    subDir->finalizeLocal();
+    }
+
+    closedir( diskDir );
+
+    dir->setReadState( DirFinished );
+    dir->finalizeLocal();
+    sendDir( dir );
+}
+
+
+void RemoteAgent::readJobFinished( DirInfo * dir )
+{
+    if ( ! dir || dir == _tree->root() || dir->isPseudoDir() || ! _ok )
+	return;
+
+    sendDir( dir );
+
+    if ( _buffer.size() >= AGENT_FLUSH_SIZE )
+	flush();
+}
+
+
+void RemoteAgent::finished()
+{
+    // Directories that never had a read job of their own (e.g. because
+    // their jobs were killed) are still missing
+
+    FileInfo * toplevel = _tree->firstToplevel();
+
+    if ( toplevel && toplevel->isDirInfo() )
+	sendRemaining( toplevel->toDirInfo() );
+
+    if ( _assigned )
+	finishAssignment();
+    else
+	sendEnd( false );
+}
+
+
+void RemoteAgent::aborted()
+{
+    sendEnd( true );
+}
+
+
+void RemoteAgent::sendEnd( bool aborted )
+{
+    if ( _ended )
+	return;
+
+    _ended = true;
+    _buffer.append( AGENT_END_RECORD );
+    appendNumber( aborted ? 1 : 0 );
+    _flushTimer.stop();
+    flush();
+
+    emit done();
+}
+
+
+void RemoteAgent::flush()
+{
+    if ( _buffer.isEmpty() || ! _ok )
+	return;
+
+    if ( fwrite( _buffer.constData(), _buffer.size(), 1, _out ) != 1 ||
+	 fflush( _out ) != 0 )
+    {
+	logError() << "Writing the scan results failed: " << formatErrno() << endl;
+	_ok = false;
+
+	// Nobody is listening anymore
+
+	_tree->abortReading();
+    }
+
+    _buffer.clear();
+}
+
+
+quint32 RemoteAgent::announceDir( DirInfo * dir )
+{
+    QHash<DirInfo *, quint32>::const_iterator it = _dirNos.constFind( dir );
+
+    if ( it != _dirNos.constEnd() )
+	return it.value();
+
+    // The parent has to be known first; the toplevel directory is sent
+    // with its complete path
+
+    bool	isToplevel = ! dir->parent() || dir->parent() == _tree->root();
+    quint32	parentNo   = isToplevel ? 0 : announceDir( dir->parent() ) + 1;
+    QByteArray	name	   = isToplevel ? dir->url().toUtf8() : dir->name().toUtf8();
+    quint32	dirNo	   = _nextDirNo++;
+
+    _dirNos.insert( dir, dirNo );
+
+    _buffer.append( AGENT_DIR_RECORD );
+    appendNumber( parentNo );
+    appendNumber( dir->mode() );
+    appendNumber( dir->rawByteSize() );
+    appendNumber( zigzag( dir->mtime() ) );
+    appendName( name );
+
+    return dirNo;
+}
+
+
+void RemoteAgent::sendDir( DirInfo * dir )
+{
+    if ( _sentDirs.contains( dir ) )
+	return;
+
+    quint32 dirNo = announceDir( dir );
+
+    // All subdirectories before the state record: The reader finalizes
+    // the directory when it gets that.
+
+    QList<DirInfo *> doneSubDirs;
+
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+    {
+	if ( child->isDirInfo() && ! child->isPseudoDir() )
+	{
+	    DirInfo * subDir = child->toDirInfo();
+	    announceDir( subDir );
+
+	    // Excluded directories and mount points don't get a read job
+	    // of their own
+
+	    if ( subDir->readState() != DirQueued && subDir->readState() != DirReading )
+		doneSubDirs << subDir;
+	}
+    }
+
+    sendFiles( dir, dirNo );
+
+    if ( dir->dotEntry() )
+	sendFiles( dir->dotEntry(), dirNo );
+
+    DirReadState readState = dir->readState();
+
+    if ( readState == DirQueued || readState == DirReading )
+	readState = DirAborted;
+
+    int flags = 0;
+
+    if ( dir->isExcluded() )
+	flags |= AGENT_DIR_EXCLUDED;
+
+    if ( dir->isMountPoint() )
+	flags |= AGENT_DIR_MOUNT_POINT;
+
+    _buffer.append( AGENT_STATE_RECORD );
+    appendNumber( dirNo );
+    appendNumber( readState );
+    appendNumber( flags );
+    _sentDirs.insert( dir );
+
+    foreach ( DirInfo * subDir, doneSubDirs )
+	sendDir( subDir );
+}
+
+
+void RemoteAgent::sendRemaining( DirInfo * dir )
+{
+    sendDir( dir );
+
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+    {
+	if ( child->isDirInfo() && ! child->isPseudoDir() )
+	    sendRemaining( child->toDirInfo() );
+    }
+}
+
+
+void RemoteAgent::sendFiles( FileInfo * parent, quint32 dirNo )
+{
+    for ( FileInfo * item = parent->firstChild(); item; item = item->next() )
+    {
+	if ( item->isDirInfo() )
+	    continue;
+
+	FileSize blocks = item->isSparseFile() ? item->blocks() : -1;
+
+	_buffer.append( AGENT_FILE_RECORD );
+	appendNumber( dirNo );
+	appendNumber( item->mode() );
+	appendNumber( item->rawByteSize() );
+	appendNumber( zigzag( item->mtime() ) );
+	appendNumber( blocks + 1 );
+	appendNumber( item->links() );
+	appendName( item->name().toUtf8() );
+    }
+}
+
+
+void RemoteAgent::appendNumber( quint64 value )
+{
+    char bytes[ 10 ];
+    int	 len = 0;
+
+    do
+    {
+	bytes[ len ] = value & 0x7f;
+	value >>= 7;
+
+	if ( value )
+	    bytes[ len ] |= 0x80;
+
+	++len;
+    }
+    while ( value );
+
+    _buffer.append( bytes, len );
+}
+
+
+void RemoteAgent::appendName( const QByteArray & name )
+{
+    appendNumber( name.size() );
+    _buffer.append( name );
+}
+
+
+
+
+RemoteAgentReader::RemoteAgentReader( DirTree * tree, DirInfo * parent ):
+    _tree( tree ),
+    _parent( parent ? parent : tree->root() ),
+    _pos( 0 ),
+    _haveMagic( false ),
+    _ok( true ),
+    _atEnd( false ),
+    _subtreeStarted( false ),
+    _assignmentsDone( 0 )
+{
+    CHECK_PTR( _tree );
+}
+
+
+void RemoteAgentReader::addData( const QByteArray & data )
+{
+    // Drop what was already processed before it piles up
+
+    if ( _pos > 0 )
+    {
+	_buffer.remove( 0, _pos );
+	_pos = 0;
+    }
+
+    _buffer.append( data );
+}
+
+
+bool RemoteAgentReader::read( int maxRecords )
+{
+    if ( ! _haveMagic )
+    {
+	if ( _buffer.size() < AGENT_MAGIC_LEN )
+	    return false;
+
+	if ( memcmp( _buffer.constData(), AGENT_MAGIC, AGENT_MAGIC_LEN ) != 0 )
+	{
+	    logError() << "Unexpected output from the remote agent: "
+		       << _buffer.left( 80 ) << endl;
+	    _ok = false;
+	    return false;
+	}
+
+	_haveMagic = true;
+	_pos = AGENT_MAGIC_LEN;
+    }
+
+    int count = 0;
+
+    while ( _ok && ! _atEnd )
+    {
+	if ( maxRecords > 0 && count++ >= maxRecords )
+	    return true;
+
+	if ( ! readRecord() )
+	    return false;
+    }
+
+    return false;
+}
+
+
+bool RemoteAgentReader::readRecord()
+{
+    const char * pos = _buffer.constData() + _pos;
+    const char * end = _buffer.constData() + _buffer.size();
+
+    if ( pos >= end )
+	return false;
+
+    char type = *pos++;
+
+    switch ( type )
+    {
+	case AGENT_DIR_RECORD:
+	    {
+		quint64 parentNo, mode, size, mtime;
+		QString name;
+
+		if ( ! readNumber( pos, end, parentNo ) ||
+		     ! readNumber( pos, end, mode     ) ||
+		     ! readNumber( pos, end, size     ) ||
+		     ! readNumber( pos, end, mtime    ) ||
+		     ! readName	 ( pos, end, name     )	  )
+		{
+		    return false;
+		}
+
+		DirInfo * parent = _parent;
+
+		if ( parentNo > 0 )
+		    parent = dir( parentNo - 1 );
+		else if ( ! _expected.isEmpty() && ! _subtreeStarted )
+		{
+		    // The subtree of an assignment: Merge it into the
+		    // directory that is waiting for it
+
+		    DirInfo * subtree = _expected.first();
+		    _subtreeStarted = true;
+		    _dirs.append( subtree );
+		    break;
+		}
+		else if ( ! _dirs.isEmpty() )
+		{
+		    logError() << "More than one toplevel directory from the remote agent" << endl;
+		    _ok = false;
+		}
+
+		if ( ! _ok )
+		    return false;
+
+		DirInfo * newDir = 0;
+
+		if ( parent )
+		{
+		    newDir = new DirInfo( _tree, parent, name,
+					  (mode_t) mode, (FileSize) size, (time_t) unzigzag( mtime ) );
+		    CHECK_NEW( newDir );
+		    newDir->setReadState( DirReading );
+		    parent->insertChild( newDir );
+		    _tree->childAddedNotify( newDir );
+		}
+
+		_dirs.append( newDir );
+	    }
+	    break;
+
+	case AGENT_FILE_RECORD:
+	    {
+		quint64 dirNo, mode, size, mtime, blocks, links;
+		QString name;
+
+		if ( ! readNumber( pos, end, dirNo  ) ||
+		     ! readNumber( pos, end, mode   ) ||
+		     ! readNumber( pos, end, size   ) ||
+		     ! readNumber( pos, end, mtime  ) ||
+		     ! readNumber( pos, end, blocks ) ||
+		     ! readNumber( pos, end, links  ) ||
+		     ! readName	 ( pos, end, name   )	)
+		{
+		    return false;
+		}
+
+		DirInfo * parent = dir( dirNo );
+
+		if ( ! _ok )
+		    return false;
+
+		if ( parent )
+		{
+		    FileInfo * item = new FileInfo( _tree, parent, name,
+						    (mode_t) mode, (FileSize) size,
+						    (time_t) unzigzag( mtime ),
+						    (FileSize) blocks - 1, (nlink_t) links );
+		    CHECK_NEW( item );
+		    parent->insertChild( item );
+		    _tree->childAddedNotify( item );
+		}
+	    }
+	    break;
+
+	case AGENT_STATE_RECORD:
+	    {
+		quint64 dirNo, readState, flags;
+
+		if ( ! readNumber( pos, end, dirNo     ) ||
+		     ! readNumber( pos, end, readState ) ||
+		     ! readNumber( pos, end, flags     )   )
+		{
+		    return false;
+		}
+
+		DirInfo * finishedDir = dir( dirNo );
+
+		if ( readState > DirError )
+		{
+		    logError() << "Bad read state " << readState << " from the remote agent" << endl;
+		    _ok = false;
+		}
+
+		if ( ! _ok )
+		    return false;
+
+		if ( finishedDir )
+		{
+		    if ( flags & AGENT_DIR_EXCLUDED )
+			finishedDir->setExcluded();
+
+		    if ( flags & AGENT_DIR_MOUNT_POINT )
+			finishedDir->setMountPoint();
+
+		    // Like a directory from a cache file: Some details are
+		    // not known
+
+		    if ( readState == DirFinished )
+			readState = DirCached;
+
+		    finishDir( finishedDir, (DirReadState) readState );
+		}
+	    }
+	    break;
+
+	case AGENT_END_RECORD:
+	    {
+		quint64 aborted;
+
+		if ( ! readNumber( pos, end, aborted ) )
+		    return false;
+
+		_atEnd = true;
+
+		// The remote agent finished what it could
+
+		finishUnfinished( aborted ? DirAborted : DirError );
+	    }
+	    break;
+
+	case AGENT_ASSIGNMENT_DONE_RECORD:
+	    {
+		if ( ! _expected.isEmpty() )
+		{
+		    DirInfo * subtree = _expected.takeFirst();
+
+		    // The agent could not read it at all
+
+		    if ( subtree && ! _subtreeStarted )
+			finishDir( subtree, DirError );
+
+		    _subtreeStarted = false;
+		}
+
+		++_assignmentsDone;
+	    }
+	    break;
+
+	default:
+	    logError() << "Bad record type " << (int) type << " from the remote agent" << endl;
+	    _ok = false;
+	    return false;
+    }
+
+    _pos = pos - _buffer.constData();
+
+    return true;
+}
+
+
+bool RemoteAgentReader::readNumber( const char *& pos, const char * end, quint64 & value_ret )
+{
+    quint64 value = 0;
+    int	    shift = 0;
+
+    while ( pos < end )
+    {
+	unsigned char byte = (unsigned char) *pos++;
+	value |= (quint64) ( byte & 0x7f ) << shift;
+
+	if ( ! ( byte & 0x80 ) )
+	{
+	    value_ret = value;
+	    return true;
+	}
+
+	shift += 7;
+
+	if ( shift > 63 )
+	{
+	    logError() << "Bad number from the remote agent" << endl;
+	    _ok = false;
+	    return false;
+	}
+    }
+
+    return false;	// Incomplete
+}
+
+
+bool RemoteAgentReader::readName( const char *& pos, const char * end, QString & name_ret )
+{
+    quint64 len;
+
+    if ( ! readNumber( pos, end, len ) || (quint64) ( end - pos ) < len )
+	return false;
+
+    name_ret = QString::fromUtf8( pos, (int) len );
+    pos += len;
+
+    return true;
+}
+
+
+DirInfo * RemoteAgentReader::dir( quint64 dirNo )
+{
+    if ( dirNo >= (quint64) _dirs.size() )
+    {
+	logError() << "Directory #" << dirNo << " from the remote agent not found" << endl;
+	_ok = false;
+
+	return 0;
+    }
+
+    return _dirs.at( dirNo );
+}
+
+
+void RemoteAgentReader::finishDir( DirInfo * dir, DirReadState readState )
+{
+    dir->setReadState( readState );
+    dir->finalizeLocal();
+    _tree->sendReadJobFinished( dir );
+}
+
+
+void RemoteAgentReader::finishUnfinished( DirReadState readState )
+{
+    foreach ( DirInfo * dir, _dirs )
+    {
+	if ( dir && dir->readState() == DirReading )
+	    finishDir( dir, readState );
+    }
+}
+
+
+void RemoteAgentReader::deletingChild( FileInfo * child )
+{
+    forgetSubtree( child );
+
+    // Whatever is sent for an expected subtree that is gone is ignored
+
+    for ( int i = 0; i < _expected.size(); ++i )
+    {
+	if ( _expected.at( i ) && _expected.at( i )->isInSubtree( child ) )
+	    _expected[ i ] = 0;
+    }
+}
+
+
+void RemoteAgentReader::forgetSubtree( FileInfo * subtree )
+{
+    for ( int i = 0; i < _dirs.size(); ++i )
+    {
+	if ( _dirs.at( i ) && _dirs.at( i )->isInSubtree( subtree ) )
+	    _dirs[ i ] = 0;
+    }
+}
+
+
+void RemoteAgentReader::expectSubtree( DirInfo * dir )
+{
+    _expected << dir;
+}
+
+
+QList<DirInfo *> RemoteAgentReader::takeUnstartedSubtrees()
+{
+    QList<DirInfo *> unstarted;
+
+    // The first one stays if the agent already sent parts of it
+
+    while ( _expected.size() > ( _subtreeStarted ? 1 : 0 ) )
+    {
+	DirInfo * dir = _expected.takeLast();
+
+	if ( dir )
+	    unstarted.prepend( dir );
+    }
+
+    return unstarted;
+}
@@ -0,0 +1,401 @@
+/*
+ *   File name: RemoteAgent.h
+ *   Summary:	Streaming scan results from a remote host for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef RemoteAgent_h
+#define RemoteAgent_h
+
+
+#include <stdio.h>
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+#include "FileInfo.h"
+
+
+// URLs of directories on a remote host: "ssh://[user@]host/path"
+#define REMOTE_URL_PREFIX		"ssh://"
+
+// The command that is started on the remote host via ssh. The path of
+// the directory is appended, or "-" for an agent that gets assignments.
+#define DEFAULT_REMOTE_AGENT_COMMAND	"qdirstat --agent"
+#define AGENT_ASSIGNMENTS_PATH		"-"
+
+// Start of the agent's output (16 bytes, no terminating 0)
+#define AGENT_MAGIC			"QDirStat agent 1"
+#define AGENT_MAGIC_LEN			16
+
+// Record types
+#define AGENT_DIR_RECORD		'D'
+#define AGENT_FILE_RECORD		'F'
+#define AGENT_STATE_RECORD		'S'
+#define AGENT_END_RECORD		'E'
+#define AGENT_ASSIGNMENT_DONE_RECORD	'A'
+
+// Assignments: List only the directory itself or read the complete subtree
+#define AGENT_LIST_ASSIGNMENT		'L'
+#define AGENT_READ_ASSIGNMENT		'R'
+
+// A distributed scan keeps at most this many assignments queued for each
+// agent
+#define AGENT_QUEUE_DEPTH		2
+
+// Flags in a state record
+#define AGENT_DIR_EXCLUDED		0x01
+#define AGENT_DIR_MOUNT_POINT		0x02
+
+// The agent writes its output when it has this many bytes or after this
+// time, whichever comes first
+#define AGENT_FLUSH_SIZE		( 64 * 1024 )
+#define AGENT_FLUSH_MILLISEC		250
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+
+    /**
+     * The agent that is started on a remote host with "qdirstat --agent
+     * <dir>" (see RemoteReadJob): While its DirTree reads the directory
+     * like any local directory, it writes each directory that is finished
+     * as compact binary records to a file (stdout), so the other side can
+     * build its tree while the scan is still going on.
+     *
+     * The output starts with AGENT_MAGIC. Each record starts with its type
+     * byte; all numbers are unsigned LEB128 varints (mtimes zigzag encoded),
+     * so the format does not depend on the byte order:
+     *
+     *	 'D' parent+1 mode size mtime nameLength name
+     *	     A directory. Directories are numbered in the order of their 'D'
+     *	     records, starting with 0; 'parent+1' is 0 for the toplevel
+     *	     directory, whose name is its absolute path.
+     *
+     *	 'F' parent mode size mtime blocks+1 links nameLength name
+     *	     A non-directory item. 'blocks' is -1 unless it is a sparse file.
+     *
+     *	 'S' dir readState flags
+     *	     A directory is finished; all its children were sent before.
+     *
+     *	 'E' aborted
+     *	     The end of the scan.
+     *
+     *	 'A'
+     *	     An assignment is done (see readAssignments()).
+     *
+     * A directory is sent before anything that is inside it. Ignored
+     * files (in the attic) are not sent.
+     **/
+    class RemoteAgent: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor: Write what 'tree' reads to 'out'.
+	 **/
+	RemoteAgent( DirTree * tree, FILE * out, QObject * parent = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~RemoteAgent();
+
+	/**
+	 * Return 'true' if everything could be written.
+	 **/
+	bool ok() const { return _ok; }
+
+	/**
+	 * Read the directories as assignments from file descriptor 'fd'
+	 * (stdin) instead of one directory that is read directly with the
+	 * tree. This is for a distributed scan where several agents share
+	 * the work (see RemoteReadJob).
+	 *
+	 * Each line is an assignment: AGENT_LIST_ASSIGNMENT or
+	 * AGENT_READ_ASSIGNMENT, a blank and the percent-encoded absolute
+	 * path of a directory. A list assignment sends only the directory
+	 * and its direct children, with the subdirectories still unread; a
+	 * read assignment sends the complete subtree with the directory as
+	 * the toplevel. Each assignment ends with an 'A' record. The
+	 * directory numbers continue across assignments.
+	 *
+	 * When the input ends, the end record follows the last assignment.
+	 **/
+	void readAssignments( int fd );
+
+
+    signals:
+
+	/**
+	 * Emitted after the end record was sent.
+	 **/
+	void done();
+
+
+    protected slots:
+
+	/**
+	 * Send directory 'dir' now that it is finished.
+	 **/
+	void readJobFinished( DirInfo * dir );
+
+	/**
+	 * Send everything that is still missing and the end record.
+	 **/
+	void finished();
+
+	/**
+	 * Send the end record for an aborted scan.
+	 **/
+	void aborted();
+
+	/**
+	 * Write the buffered records.
+	 **/
+	void flush();
+
+	/**
+	 * Read more assignments from the input.
+	 **/
+	void readInput();
+
+	/**
+	 * Start the next assignment if there is one and nothing else is
+	 * going on. Send the end record if that was the last one.
+	 **/
+	void startNextAssignment();
+
+
+    protected:
+
+	/**
+	 * Send the end record ('aborted' or not).
+	 **/
+	void sendEnd( bool aborted );
+
+	/**
+	 * Send the 'A' record for an assignment and go on with the next one.
+	 **/
+	void finishAssignment();
+
+	/**
+	 * Send directory 'path' with its direct children, but without
+	 * reading its subdirectories.
+	 **/
+	void listDir( const QString & path );
+
+	/**
+	 * Send the 'D' record for 'dir' (and for its parents first) unless
+	 * that was already done. Return the number of the directory.
+	 **/
+	quint32 announceDir( DirInfo * dir );
+
+	/**
+	 * Send the subdirectories, the files and the state of 'dir' unless
+	 * that was already done.
+	 **/
+	void sendDir( DirInfo * dir );
+
+	/**
+	 * Send all directories in the subtree of 'dir' that were not sent
+	 * yet.
+	 **/
+	void sendRemaining( DirInfo * dir );
+
+	/**
+	 * Send the 'F' records for the non-directory children of 'parent'
+	 * (a directory or its dot entry) for directory no. 'dirNo'.
+	 **/
+	void sendFiles( FileInfo * parent, quint32 dirNo );
+
+	/**
+	 * Append to the buffer.
+	 **/
+	void appendNumber( quint64 value );
+	void appendName( const QByteArray & name );
+
+
+	//
+	// Data members
+	//
+
+	DirTree *		  _tree;
+	FILE *			  _out;
+	bool			  _ok;
+	QByteArray		  _buffer;
+	QHash<DirInfo *, quint32> _dirNos;
+	quint32			  _nextDirNo;
+	QSet<DirInfo *>		  _sentDirs;
+	QTimer			  _flushTimer;
+
+	QSocketNotifier *	  _inputNotifier;
+	int			  _inputFd;
+	QByteArray		  _input;
+	QStringList		  _assignments;
+	bool			  _assigned;
+	bool			  _busy;
+	bool			  _inputDone;
+	bool			  _ended;
+
+    };	// class RemoteAgent
+
+
+
+    /**
+     * Reader for the output of a RemoteAgent: Create the items in a
+     * DirTree from the records as they come in (see RemoteReadJob).
+     *
+     * Directories that are finished become DirCached like the directories
+     * of a cache file: Owners and permissions are not known.
+     *
+     * For a distributed scan, the reader of each agent can be told which
+     * existing directories (from the listing of another agent) the
+     * subtrees of its assignments go to: Their toplevel records are merged
+     * into those directories instead of becoming a new toplevel.
+     **/
+    class RemoteAgentReader
+    {
+    public:
+
+	/**
+	 * Constructor: Read the toplevel directory into 'parent' or into
+	 * the root of 'tree' if 'parent' is 0.
+	 **/
+	RemoteAgentReader( DirTree * tree, DirInfo * parent = 0 );
+
+	/**
+	 * Add what the agent sent.
+	 **/
+	void addData( const QByteArray & data );
+
+	/**
+	 * Process at most 'maxRecords' records (all of them if 0). Return
+	 * 'true' if there are more complete records, 'false' if more data
+	 * are needed (or upon error or at the end).
+	 **/
+	bool read( int maxRecords = 0 );
+
+	/**
+	 * Return 'true' if everything was read without error so far.
+	 **/
+	bool ok() const { return _ok; }
+
+	/**
+	 * Return 'true' if the end record was read.
+	 **/
+	bool atEnd() const { return _atEnd; }
+
+	/**
+	 * Return the toplevel directory or 0 if there is none yet.
+	 **/
+	DirInfo * toplevel() const { return _dirs.isEmpty() ? 0 : _dirs.first(); }
+
+	/**
+	 * Set all directories that are not finished yet to 'readState'.
+	 **/
+	void finishUnfinished( DirReadState readState );
+
+	/**
+	 * Notification that 'child' is about to be deleted: Forget all
+	 * directories in its subtree; anything that is still sent for them
+	 * is ignored.
+	 **/
+	void deletingChild( FileInfo * child );
+
+	/**
+	 * Forget all directories in the subtree of 'subtree': Leave them to
+	 * another reader.
+	 **/
+	void forgetSubtree( FileInfo * subtree );
+
+	/**
+	 * Expect the subtree of the next read assignment for existing
+	 * directory 'dir'.
+	 **/
+	void expectSubtree( DirInfo * dir );
+
+	/**
+	 * Return the number of expected subtrees that are not done yet.
+	 **/
+	int pendingSubtrees() const { return _expected.size(); }
+
+	/**
+	 * Return the number of assignments that are done.
+	 **/
+	int assignmentsDone() const { return _assignmentsDone; }
+
+	/**
+	 * Return the expected subtrees that were not started yet and stop
+	 * expecting them, so they can go to another reader.
+	 **/
+	QList<DirInfo *> takeUnstartedSubtrees();
+
+    protected:
+
+	/**
+	 * Process the record at _pos. Return 'false' if it is not complete
+	 * yet (or upon error).
+	 **/
+	bool readRecord();
+
+	/**
+	 * Read a number at 'pos' and advance 'pos'. Return 'false' if it is
+	 * not complete yet.
+	 **/
+	bool readNumber( const char *& pos, const char * end, quint64 & value_ret );
+
+	/**
+	 * Read a name at 'pos' and advance 'pos'. Return 'false' if it is
+	 * not complete yet.
+	 **/
+	bool readName( const char *& pos, const char * end, QString & name_ret );
+
+	/**
+	 * Return directory no. 'dirNo' or 0 if it was deleted. Set an error
+	 * if there is no such directory.
+	 **/
+	DirInfo * dir( quint64 dirNo );
+
+	/**
+	 * Finish directory 'dir' with 'readState'.
+	 **/
+	void finishDir( DirInfo * dir, DirReadState readState );
+
+
+	//
+	// Data members
+	//
+
+	DirTree *	    _tree;
+	DirInfo *	    _parent;
+	QByteArray	    _buffer;
+	int		    _pos;
+	bool		    _haveMagic;
+	bool		    _ok;
+	bool		    _atEnd;
+	QVector<DirInfo *>  _dirs;
+	QList<DirInfo *>    _expected;
+	bool		    _subtreeStarted;
+	int		    _assignmentsDone;
+
+    };	// class RemoteAgentReader
+
+}	// namespace QDirStat
+
+
+#endif	// RemoteAgent_h
@@ -0,0 +1,276 @@
+/*
+ *   File name: RpmDatabase.cpp
+ *   Summary:	RPM package manager support for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <stdlib.h>	// free()
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+
+#include "RpmDatabase.h"
+#include "PkgFileListCache.h"
+#include "Logger.h"
+#include "Exception.h"
+
+// HAVE_LIBRPM is defined in src.pro if librpm is installed
+
+#ifndef HAVE_LIBRPM
+#  define HAVE_LIBRPM 0
+#endif
+
+#if HAVE_LIBRPM
+#  include <rpm/rpmlib.h>	// rpmReadConfigFiles()
+#  include <rpm/rpmts.h>
+#  include <rpm/rpmdb.h>
+#  include <rpm/rpmfi.h>
+#  include <rpm/rpmmacro.h>	// rpmExpand()
+#  include <rpm/header.h>
+#endif
+
+
+using namespace QDirStat;
+
+
+#if HAVE_LIBRPM
+
+namespace
+{
+    /**
+     * An iterator over the headers of the installed packages, optionally
+     * only those with one name.
+     **/
+    class HeaderIterator
+    {
+    public:
+
+	HeaderIterator( const QString & name = QString() )
+	{
+	    QByteArray key = name.toUtf8();
+
+	    _ts = rpmtsCreate();
+	    _mi = name.isEmpty() ?
+		rpmtsInitIterator( _ts, RPMDBI_PACKAGES, 0, 0 ) :
+		rpmtsInitIterator( _ts, RPMDBI_NAME, key.constData(), key.size() );
+	}
+
+	~HeaderIterator()
+	{
+	    rpmdbFreeIterator( _mi );
+	    rpmtsFree( _ts );
+	}
+
+	/**
+	 * Return the next header or 0 at the end. The header is only valid
+	 * until the next call.
+	 **/
+	Header next()
+	    { return _mi ? rpmdbNextIterator( _mi ) : 0; }
+
+	/**
+	 * Return the transaction set for rpmfiNew().
+	 **/
+	rpmts ts() const { return _ts; }
+
+    private:
+
+	rpmts		   _ts;
+	rpmdbMatchIterator _mi;
+    };
+
+
+    QString headerString( Header header, rpmTagVal tag )
+    {
+	const char * str = headerGetString( header, tag );
+
+	return str ? QString::fromUtf8( str ) : QString();
+    }
+
+
+    RpmDatabase::Package package( Header header )
+    {
+	RpmDatabase::Package pkg;
+
+	pkg.name    = headerString( header, RPMTAG_NAME );
+	pkg.version = headerString( header, RPMTAG_VERSION ) + "-" +
+	    headerString( header, RPMTAG_RELEASE );
+	pkg.arch    = headerString( header, RPMTAG_ARCH );
+
+	return pkg;
+    }
+
+
+    void addFiles( rpmts ts, Header header, QStringList & fileList_ret )
+    {
+	rpmfi fi = rpmfiNew( ts, header, RPMTAG_BASENAMES, RPMFI_NOHEADER );
+
+	if ( ! fi )
+	    return;
+
+	rpmfiInit( fi, 0 );
+
+	while ( rpmfiNext( fi ) >= 0 )
+	    fileList_ret << QString::fromUtf8( rpmfiFN( fi ) );
+
+	rpmfiFree( fi );
+    }
+
+}	// namespace
+
+#endif	// HAVE_LIBRPM
+
+
+bool RpmDatabase::isAvailable()
+{
+#if HAVE_LIBRPM
+    static bool initialized = false;
+    static bool ok	    = false;
+
+    if ( ! initialized )
+    {
+	ok = rpmReadConfigFiles( 0, 0 ) == 0;
+	initialized = true;
+
+	if ( ! ok )
+	    logWarning() << "Can't read the rpm configuration" << endl;
+    }
+
+    return ok;
+#else
+    return false;
+#endif
+}
+
+
+qint64 RpmDatabase::stamp()
+{
+#if HAVE_LIBRPM
+    if ( ! isAvailable() )
+	return 0;
+
+    char *  dbPath = rpmExpand( "%{_dbpath}", NULL );
+    QString dir	   = QString::fromUtf8( dbPath );
+    free( dbPath );
+
+    qint64 latest = 0;
+
+    foreach ( const QFileInfo & file, QDir( dir ).entryInfoList( QDir::Files ) )
+	latest = qMax( latest, file.lastModified().toMSecsSinceEpoch() );
+
+    return latest;
+#else
+    return 0;
+#endif
+}
+
+
+bool RpmDatabase::readPackages( QList<Package> & packages_ret )
+{
+#if HAVE_LIBRPM
+    if ( ! isAvailable() )
+	return false;
+
+    HeaderIterator it;
+    Header	   header;
+
+    while ( ( header = it.next() ) )
+	packages_ret << package( header );
+
+    logDebug() << "Read " << packages_ret.size() << " installed packages with librpm" << endl;
+
+    return ! packages_ret.isEmpty();
+#else
+    Q_UNUSED( packages_ret );
+    return false;
+#endif
+}
+
+
+bool RpmDatabase::readFileList( const QString & name,
+				const QString & version,
+				const QString & arch,
+				QStringList &	fileList_ret )
+{
+#if HAVE_LIBRPM
+    if ( ! isAvailable() )
+	return false;
+
+    HeaderIterator it( name );
+    Header	   header;
+
+    while ( ( header = it.next() ) )
+    {
+	Package pkg = package( header );
+
+	if ( pkg.version == version && pkg.arch == arch )
+	{
+	    addFiles( it.ts(), header, fileList_ret );
+	    return true;
+	}
+    }
+
+    return false;
+#else
+    Q_UNUSED( name );
+    Q_UNUSED( version );
+    Q_UNUSED( arch );
+    Q_UNUSED( fileList_ret );
+    return false;
+#endif
+}
+
+
+bool RpmDatabase::readFileLists( PkgFileListCache * cache )
+{
+    CHECK_PTR( cache );
+
+#if HAVE_LIBRPM
+    if ( ! isAvailable() )
+	return false;
+
+    HeaderIterator it;
+    Header	   header;
+    int		   pkgCount = 0;
+
+    while ( ( header = it.next() ) )
+    {
+	Package	    pkg = package( header );
+	QString	    pkgName = queryName( pkg.name, pkg.version, pkg.arch );
+	QStringList fileList;
+
+	addFiles( it.ts(), header, fileList );
+
+	foreach ( const QString & path, fileList )
+	    cache->add( pkgName, path );
+
+	++pkgCount;
+    }
+
+    logDebug() << "Read the file lists of " << pkgCount << " packages with librpm" << endl;
+
+    return pkgCount > 0;
+#else
+    return false;
+#endif
+}
+
+
+QString RpmDatabase::queryName( const QString & name,
+				const QString & version,
+				const QString & arch )
+{
+    QString queryName = name;
+
+    if ( ! version.isEmpty() )
+	queryName += "-" + version;
+
+    if ( ! arch.isEmpty() )
+	queryName += "." + arch;
+
+    return queryName;
+}
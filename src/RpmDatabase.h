@@ -0,0 +1,96 @@
+/*
+ *   File name: RpmDatabase.h
+ *   Summary:	RPM package manager support for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef RpmDatabase_h
+#define RpmDatabase_h
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+
+namespace QDirStat
+{
+    class PkgFileListCache;
+
+
+    /**
+     * In-process queries of the rpm database with librpm instead of
+     * starting rpm processes and parsing their output.
+     *
+     * This is only available if QDirStat was built with librpm (see
+     * src.pro); otherwise isAvailable() returns 'false', and the caller
+     * should use the rpm commands.
+     *
+     * librpm is not thread-safe, so use this only from one thread.
+     **/
+    class RpmDatabase
+    {
+    public:
+
+	/**
+	 * One installed package.
+	 **/
+	struct Package
+	{
+	    QString name;
+	    QString version;	// Including the release
+	    QString arch;
+	};
+
+	/**
+	 * Return 'true' if librpm is available and its configuration could
+	 * be read.
+	 **/
+	static bool isAvailable();
+
+	/**
+	 * Return a value that changes whenever the rpm database changes:
+	 * The latest modification time of its files in milliseconds since
+	 * the epoch, or 0 if that is unknown.
+	 **/
+	static qint64 stamp();
+
+	/**
+	 * Read all installed packages into 'packages_ret'. Return 'true' on
+	 * success, 'false' on error.
+	 **/
+	static bool readPackages( QList<Package> & packages_ret );
+
+	/**
+	 * Read the file list of package 'name' with 'version' (including the
+	 * release) and 'arch' into 'fileList_ret'. Return 'true' on success,
+	 * 'false' if there is no such package or on error.
+	 **/
+	static bool readFileList( const QString & name,
+				  const QString & version,
+				  const QString & arch,
+				  QStringList &	  fileList_ret );
+
+	/**
+	 * Read the file lists of all installed packages into 'cache' with
+	 * the package names as returned by queryName(). Return 'true' on
+	 * success, 'false' on error.
+	 **/
+	static bool readFileLists( PkgFileListCache * cache );
+
+	/**
+	 * Return the name that rpm uses for queries about a package:
+	 * <name>-<version>-<release>.<arch>.
+	 **/
+	static QString queryName( const QString & name,
+				  const QString & version,
+				  const QString & arch );
+
+    };	// class RpmDatabase
+
+}	// namespace QDirStat
+
+
+#endif	// ifndef RpmDatabase_h
@@ -29,7 +29,10 @@ using namespace QDirStat;
 
 
 RpmPkgManager::RpmPkgManager():
-    _getPkgListWarningSec( 7 )
+    _getPkgListWarningSec( 7 ),
+    _dbPackagesStamp( 0 ),
+    _dbFileLists( 0 ),
+    _dbFileListsStamp( 0 )
 {
     readSettings();
 
@@ -49,6 +52,12 @@ RpmPkgManager::RpmPkgManager():
 }
 
 
+RpmPkgManager::~RpmPkgManager()
+{
+    delete _dbFileLists;
+}
+
+
 bool RpmPkgManager::isPrimaryPkgManager()
 {
     return tryRunCommand( QString( "%1 -qf %1" ).arg( _rpmCommand ),
@@ -62,13 +71,14 @@ bool RpmPkgManager::isAvailable()
 }
 
 
-QString RpmPkgManager::owningPkg( const QString & path )
+QStringList RpmPkgManager::owningPkgCommand( const QString & path )
 {
-    int exitCode = -1;
-    QString output = runCommand( _rpmCommand,
-				 QStringList() << "-qf" << "--queryformat" << "%{name}" << path,
-				 &exitCode );
+    return QStringList() << _rpmCommand << "-qf" << "--queryformat" << "%{name}" << path;
+}
 
+
+QString RpmPkgManager::parseOwningPkg( const QString & output, int exitCode )
+{
     if ( exitCode != 0 || output.contains( "not owned by any package" ) )
 	return "";
 
@@ -80,6 +90,21 @@ QString RpmPkgManager::owningPkg( const QString & path )
 
 PkgInfoList RpmPkgManager::installedPkg()
 {
+    if ( readDbPackages() )
+    {
+	PkgInfoList pkgList;
+
+	foreach ( const RpmDatabase::Package & package, _dbPackages )
+	{
+	    PkgInfo * pkg = new PkgInfo( package.name, package.version, package.arch, this );
+	    CHECK_NEW( pkg );
+
+	    pkgList << pkg;
+	}
+
+	return pkgList;
+    }
+
     int exitCode = -1;
     QElapsedTimer timer;
     timer.start();
@@ -137,6 +162,28 @@ PkgInfoList RpmPkgManager::parsePkgList( const QString & output )
 }
 
 
+QStringList RpmPkgManager::fileList( PkgInfo * pkg )
+{
+    CHECK_PTR( pkg );
+
+    QStringList fileList;
+
+    // Use the file lists of all packages only if they are already there;
+    // reading them just for one package would be a waste.
+
+    if ( _dbFileLists && _dbFileListsStamp == RpmDatabase::stamp() &&
+	 _dbFileLists->containsPkg( queryName( pkg ) ) )
+    {
+	return _dbFileLists->fileList( queryName( pkg ) );
+    }
+
+    if ( RpmDatabase::readFileList( pkg->baseName(), pkg->version(), pkg->arch(), fileList ) )
+	return fileList;
+
+    return PkgManager::fileList( pkg );
+}
+
+
 QString RpmPkgManager::fileListCommand( PkgInfo * pkg )
 {
     return QString( "%1 -ql %2" )
@@ -174,6 +221,17 @@ QString RpmPkgManager::queryName( PkgInfo * pkg )
 
 PkgFileListCache * RpmPkgManager::createFileListCache( PkgFileListCache::LookupType lookupType )
 {
+    if ( readDbFileLists() )
+    {
+	// The copy shares the data with _dbFileLists until either of them
+	// is changed.
+
+	PkgFileListCache * cache = new PkgFileListCache( *_dbFileLists );
+	CHECK_NEW( cache );
+
+	return cache;
+    }
+
     int exitCode = -1;
     QString queryFormat = "[%{=NAME}-%{=VERSION}-%{=RELEASE}.%{=ARCH} | %{FILENAMES}\n]";
 
@@ -225,6 +283,79 @@ PkgFileListCache * RpmPkgManager::createFileListCache( PkgFileListCache::LookupT
 }
 
 
+QString RpmPkgManager::databaseStamp()
+{
+    qint64 stamp = RpmDatabase::stamp();
+
+    if ( stamp != 0 )
+	return QString::number( stamp );
+
+    // Without librpm: The package database files of the known rpm database
+    // backends in the usual places
+
+    QStringList paths;
+
+    foreach ( const QString & dir, QStringList() << "/var/lib/rpm" << "/usr/lib/sysimage/rpm" )
+    {
+	paths << dir + "/rpmdb.sqlite"
+	      << dir + "/Packages.db"
+	      << dir + "/Packages";
+    }
+
+    return fileStamp( paths );
+}
+
+
+bool RpmPkgManager::readDbPackages()
+{
+    if ( ! RpmDatabase::isAvailable() )
+	return false;
+
+    qint64 stamp = RpmDatabase::stamp();
+
+    if ( ! _dbPackages.isEmpty() && stamp != 0 && stamp == _dbPackagesStamp )
+    {
+	logDebug() << "rpm database unchanged; reusing the package list" << endl;
+	return true;
+    }
+
+    _dbPackages.clear();
+    _dbPackagesStamp = stamp;
+
+    return RpmDatabase::readPackages( _dbPackages );
+}
+
+
+bool RpmPkgManager::readDbFileLists()
+{
+    if ( ! RpmDatabase::isAvailable() )
+	return false;
+
+    qint64 stamp = RpmDatabase::stamp();
+
+    if ( _dbFileLists && stamp != 0 && stamp == _dbFileListsStamp )
+    {
+	logDebug() << "rpm database unchanged; reusing the file lists" << endl;
+	return true;
+    }
+
+    delete _dbFileLists;
+    _dbFileLists      = new PkgFileListCache( this, PkgFileListCache::LookupAll );
+    _dbFileListsStamp = stamp;
+    CHECK_NEW( _dbFileLists );
+
+    if ( ! RpmDatabase::readFileLists( _dbFileLists ) )
+    {
+	delete _dbFileLists;
+	_dbFileLists = 0;
+
+	return false;
+    }
+
+    return true;
+}
+
+
 void RpmPkgManager::readSettings()
 {
     Settings settings;
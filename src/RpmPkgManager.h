@@ -14,6 +14,7 @@
 
 #include "PkgManager.h"
 #include "PkgInfo.h"
+#include "RpmDatabase.h"
 
 
 namespace QDirStat
@@ -32,7 +33,7 @@ namespace QDirStat
     public:
 
 	RpmPkgManager();
-	virtual ~RpmPkgManager() {}
+	virtual ~RpmPkgManager();
 
 	/**
 	 * Return the name of this package manager.
@@ -57,16 +58,20 @@ namespace QDirStat
 	virtual bool isAvailable() Q_DECL_OVERRIDE;
 
 	/**
-	 * Return the owning package of a file or directory with full path
-	 * 'path' or an empty string if it is not owned by any package.
+	 * Return the command for getting the owning package of 'path':
 	 *
-	 * Implemented from PkgManager.
+	 *   /usr/bin/rpm -qf ${path}
 	 *
-	 * This basically executes this command:
+	 * Implemented from PkgManager.
+	 **/
+	virtual QStringList owningPkgCommand( const QString & path ) Q_DECL_OVERRIDE;
+
+	/**
+	 * Parse the output of the owningPkgCommand().
 	 *
-	 *   /usr/bin/rpm -qf ${path}
+	 * Implemented from PkgManager.
 	 **/
-	virtual QString owningPkg( const QString & path ) Q_DECL_OVERRIDE;
+	virtual QString parseOwningPkg( const QString & output, int exitCode ) Q_DECL_OVERRIDE;
 
 
 	//-----------------------------------------------------------------
@@ -87,10 +92,22 @@ namespace QDirStat
 	 *
 	 * Ownership of the list elements is transferred to the caller.
 	 *
+	 * This uses librpm if available and falls back to "rpm -qa".
+	 *
 	 * Reimplemented from PkgManager.
 	 **/
 	virtual PkgInfoList installedPkg() Q_DECL_OVERRIDE;
 
+	/**
+	 * Return the list of files and directories owned by a package.
+	 *
+	 * This uses librpm if available and falls back to the file list
+	 * command.
+	 *
+	 * Reimplemented from PkgManager.
+	 **/
+	virtual QStringList fileList( PkgInfo * pkg ) Q_DECL_OVERRIDE;
+
 	/**
 	 * Return 'true' if this package manager supports getting the file list
 	 * for a package.
@@ -135,6 +152,9 @@ namespace QDirStat
 	 * Ownership of the cache is transferred to the caller; make sure to
 	 * delete it when you are done with it.
 	 *
+	 * With librpm, the file lists are kept until the rpm database
+	 * changes, so this is cheap for all but the first call.
+	 *
 	 * Reimplemented from PkgManager.
 	 **/
 	virtual PkgFileListCache * createFileListCache( PkgFileListCache::LookupType lookupType = PkgFileListCache::LookupByPkg ) Q_DECL_OVERRIDE;
@@ -149,6 +169,13 @@ namespace QDirStat
 	 **/
 	virtual QString queryName( PkgInfo * pkg ) Q_DECL_OVERRIDE;
 
+	/**
+	 * Return a string that changes whenever the rpm database changes.
+	 *
+	 * Reimplemented from PkgManager.
+	 **/
+	virtual QString databaseStamp() Q_DECL_OVERRIDE;
+
 
     protected:
 
@@ -168,12 +195,34 @@ namespace QDirStat
 	 **/
 	void rebuildRpmDbWarning();
 
+	/**
+	 * Read the installed packages with librpm into _dbPackages unless
+	 * they are still up to date. Return 'true' on success, 'false' if
+	 * librpm can't be used.
+	 **/
+	bool readDbPackages();
+
+	/**
+	 * Read the file lists of all installed packages with librpm into
+	 * _dbFileLists unless they are still up to date. Return 'true' on
+	 * success, 'false' if librpm can't be used.
+	 **/
+	bool readDbFileLists();
+
 
 	// Data members
 
 	QString _rpmCommand;
 	int	_getPkgListWarningSec;
 
+	// What was read with librpm and the RpmDatabase::stamp() of the rpm
+	// database at that time
+
+	QList<RpmDatabase::Package> _dbPackages;
+	qint64			    _dbPackagesStamp;
+	PkgFileListCache *	    _dbFileLists;
+	qint64			    _dbFileListsStamp;
+
     }; // class RpmPkgManager
 
 } // namespace QDirStat
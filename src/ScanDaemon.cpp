@@ -0,0 +1,401 @@
+/*
+ *   File name: ScanDaemon.cpp
+ *   Summary:	Headless service that answers queries about directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>	// std::sort()
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include "ScanDaemon.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "DirWatcher.h"
+#include "FileTypeStats.h"
+#include "OwnerNames.h"
+#include "OwnerUsage.h"
+#include "TreeWalker.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    struct SuffixUsage
+    {
+	QString	 suffix;
+	FileSize size;
+	int	 count;
+    };
+
+
+    bool largerSuffixUsage( const SuffixUsage & a, const SuffixUsage & b )
+    {
+	return a.size > b.size;
+    }
+
+
+    QJsonArray toJson( const OwnerUsage::EntryList & entries, bool groups )
+    {
+	QJsonArray array;
+
+	foreach ( const OwnerUsage::Entry & entry, entries )
+	{
+	    QJsonObject obj;
+	    obj[ "id"		 ] = (int) entry.id;
+	    obj[ "name"		 ] = groups ?
+		OwnerNames::groupName( entry.id ) :
+		OwnerNames::userName ( entry.id );
+	    obj[ "files"	 ] = entry.files;
+	    obj[ "size"		 ] = (qint64) entry.size;
+	    obj[ "allocatedSize" ] = (qint64) entry.allocatedSize;
+	    array.append( obj );
+	}
+
+	return array;
+    }
+
+}	// namespace
+
+
+
+ScanDaemon::ScanDaemon( QObject * parent ):
+    QObject( parent ),
+    _server( 0 )
+{
+}
+
+
+ScanDaemon::~ScanDaemon()
+{
+    qDeleteAll( _watchers );
+    qDeleteAll( _trees );
+    delete _server;
+}
+
+
+bool ScanDaemon::start( const QString & socketName, const QStringList & dirs )
+{
+    foreach ( const QString & dir, dirs )
+    {
+	if ( ! QFileInfo( dir ).isDir() )
+	{
+	    logError() << "Not a directory: " << dir << endl;
+	    return false;
+	}
+    }
+
+    _server = new QLocalServer();
+    CHECK_NEW( _server );
+
+    _server->setSocketOptions( QLocalServer::UserAccessOption );
+
+    // A socket from a daemon that was killed is still there
+
+    QLocalServer::removeServer( socketName );
+
+    if ( ! _server->listen( socketName ) )
+    {
+	logError() << "Can't listen on " << socketName << ": " << _server->errorString() << endl;
+	return false;
+    }
+
+    connect( _server, SIGNAL( newConnection() ),
+	     this,    SLOT  ( newConnection() ) );
+
+    foreach ( const QString & dir, dirs )
+    {
+	DirTree * tree = new DirTree();
+	CHECK_NEW( tree );
+
+	tree->readSettings();
+	tree->startReading( dir );
+	_trees << tree;
+
+	// The watcher adds the directories as they are read
+
+	DirWatcher * watcher = new DirWatcher( tree );
+	CHECK_NEW( watcher );
+
+	if ( ! watcher->start() )
+	    logWarning() << "Not watching " << dir << " for changes" << endl;
+
+	_watchers << watcher;
+    }
+
+    logInfo() << "Answering queries for " << dirs.join( ", " )
+	      << " on " << _server->fullServerName() << endl;
+
+    return true;
+}
+
+
+void ScanDaemon::newConnection()
+{
+    QLocalSocket * socket;
+
+    while ( ( socket = _server->nextPendingConnection() ) )
+    {
+	connect( socket, SIGNAL( readyRead()	),
+		 this,	 SLOT  ( readRequests() ) );
+
+	connect( socket, SIGNAL( disconnected() ),
+		 socket, SLOT  ( deleteLater()	) );
+    }
+}
+
+
+void ScanDaemon::readRequests()
+{
+    QLocalSocket * socket = qobject_cast<QLocalSocket *>( sender() );
+
+    if ( ! socket )
+	return;
+
+    while ( socket->canReadLine() )
+    {
+	QByteArray	line = socket->readLine().trimmed();
+	QJsonParseError parseError;
+	QJsonDocument	doc = QJsonDocument::fromJson( line, &parseError );
+	QJsonObject	response;
+
+	if ( line.isEmpty() )
+	    continue;
+
+	if ( doc.isObject() )
+	    response = query( doc.object() );
+	else if ( parseError.error != QJsonParseError::NoError )
+	    response = error( parseError.errorString() );
+	else
+	    response = error( "Not a JSON object" );
+
+	socket->write( QJsonDocument( response ).toJson( QJsonDocument::Compact ) + '\n' );
+    }
+
+    if ( socket->bytesAvailable() > SCAN_DAEMON_MAX_REQUEST_SIZE )
+    {
+	logWarning() << "Request too long; closing the connection" << endl;
+	socket->disconnectFromServer();
+    }
+}
+
+
+QJsonObject ScanDaemon::query( const QJsonObject & request )
+{
+    QString queryName = request.value( "query" ).toString();
+
+    if ( queryName == "status" )
+	return status();
+
+    QString path = request.value( "path" ).toString();
+
+    if ( path.isEmpty() )
+	return error( "No path" );
+
+    DirTree  * tree = findTree( path );
+    FileInfo * item = tree ? tree->locate( path ) : 0;
+
+    if ( ! item )
+	return error( "Not found: " + path );
+
+    int count = request.value( "count" ).toInt( SCAN_DAEMON_DEFAULT_COUNT );
+    count = qBound( 1, count, SCAN_DAEMON_MAX_COUNT );
+
+    QJsonObject response;
+
+    if ( queryName == "totals" )
+	response = totals( item );
+    else if ( queryName == "top" )
+	response = top( item, count );
+    else if ( queryName == "owners" )
+	response = owners( item );
+    else if ( queryName == "suffixes" )
+	response = suffixes( item, count );
+    else if ( queryName == "cache" )
+    {
+	QString fileName = request.value( "file" ).toString();
+
+	if ( fileName.isEmpty() )
+	    return error( "No file" );
+
+	if ( ! tree->writeCache( fileName ) )
+	    return error( "Can't write " + fileName );
+
+	response[ "file" ] = fileName;
+    }
+    else
+    {
+	return error( "Unknown query: " + queryName );
+    }
+
+    response[ "path" ] = item->url();
+    response[ "busy" ] = tree->isBusy();
+
+    return response;
+}
+
+
+DirTree * ScanDaemon::findTree( const QString & path ) const
+{
+    DirTree * best    = 0;
+    int	      bestLen = -1;
+
+    // The deepest toplevel wins for trees inside other trees
+
+    foreach ( DirTree * tree, _trees )
+    {
+	FileInfo * toplevel = tree->firstToplevel();
+
+	if ( ! toplevel )
+	    continue;
+
+	QString url = toplevel->url();
+
+	if ( ( path == url || path.startsWith( url.endsWith( "/" ) ? url : url + "/" ) ) &&
+	     url.size() > bestLen )
+	{
+	    best    = tree;
+	    bestLen = url.size();
+	}
+    }
+
+    return best;
+}
+
+
+QJsonObject ScanDaemon::status() const
+{
+    QJsonArray trees;
+
+    for ( int i = 0; i < _trees.size(); ++i )
+    {
+	DirTree *  tree	    = _trees.at( i );
+	FileInfo * toplevel = tree->firstToplevel();
+	QJsonObject obj	    = toplevel ? totals( toplevel ) : QJsonObject();
+
+	obj[ "path"	] = tree->url();
+	obj[ "busy"	] = tree->isBusy();
+	obj[ "watching" ] = _watchers.at( i )->method();
+	trees.append( obj );
+    }
+
+    QJsonObject response;
+    response[ "trees" ] = trees;
+
+    return response;
+}
+
+
+QJsonObject ScanDaemon::totals( FileInfo * item )
+{
+    QJsonObject response;
+
+    response[ "size"	      ] = (qint64) item->totalSize();
+    response[ "allocatedSize" ] = (qint64) item->totalAllocatedSize();
+    response[ "items"	      ] = item->totalItems();
+    response[ "files"	      ] = item->totalFiles();
+    response[ "subDirs"	      ] = item->totalSubDirs();
+    response[ "latestMtime"   ] = (qint64) item->latestMtime();
+
+    if ( item->isDirInfo() )
+	response[ "readState" ] = (int) item->readState();
+
+    return response;
+}
+
+
+QJsonObject ScanDaemon::top( FileInfo * item, int count )
+{
+    LargestFilesTreeWalker walker;
+    walker.prepare( item );
+
+    QJsonArray files;
+
+    foreach ( FileInfo * file, walker.results() )
+    {
+	if ( files.size() >= count )
+	    break;
+
+	QJsonObject obj;
+	obj[ "path"  ] = file->url();
+	obj[ "size"  ] = (qint64) file->size();
+	obj[ "mtime" ] = (qint64) file->mtime();
+	files.append( obj );
+    }
+
+    QJsonObject response;
+    response[ "files" ] = files;
+
+    return response;
+}
+
+
+QJsonObject ScanDaemon::owners( FileInfo * item )
+{
+    if ( ! item->isDirInfo() )
+	return error( "Not a directory: " + item->url() );
+
+    OwnerUsage usage = item->toDirInfo()->ownerUsage();
+
+    QJsonObject response;
+    response[ "users"  ] = toJson( usage.users(),  false );
+    response[ "groups" ] = toJson( usage.groups(), true  );
+
+    return response;
+}
+
+
+QJsonObject ScanDaemon::suffixes( FileInfo * item, int count )
+{
+    FileTypeStats stats;
+    stats.calc( item );
+
+    QList<SuffixUsage> list;
+
+    for ( StringFileSizeMapIterator it = stats.suffixSumBegin(); it != stats.suffixSumEnd(); ++it )
+    {
+	SuffixUsage usage;
+	usage.suffix = it.key() == NO_SUFFIX ? QString( "" ) : it.key();
+	usage.size   = it.value();
+	usage.count  = stats.suffixCount( it.key() );
+	list << usage;
+    }
+
+    std::sort( list.begin(), list.end(), largerSuffixUsage );
+
+    QJsonArray array;
+
+    for ( int i = 0; i < list.size() && i < count; ++i )
+    {
+	QJsonObject obj;
+	obj[ "suffix" ] = list.at( i ).suffix;
+	obj[ "size"   ] = (qint64) list.at( i ).size;
+	obj[ "count"  ] = list.at( i ).count;
+	array.append( obj );
+    }
+
+    QJsonObject response;
+    response[ "suffixes" ] = array;
+
+    return response;
+}
+
+
+QJsonObject ScanDaemon::error( const QString & message )
+{
+    QJsonObject response;
+    response[ "error" ] = message;
+
+    return response;
+}
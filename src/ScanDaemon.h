@@ -0,0 +1,167 @@
+/*
+ *   File name: ScanDaemon.h
+ *   Summary:	Headless service that answers queries about directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ScanDaemon_h
+#define ScanDaemon_h
+
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+
+
+// Number of entries in a list that a query returns by default and at most
+#define SCAN_DAEMON_DEFAULT_COUNT	20
+#define SCAN_DAEMON_MAX_COUNT		1000
+
+// A request line that is longer than this closes the connection
+#define SCAN_DAEMON_MAX_REQUEST_SIZE	( 64 * 1024 )
+
+
+class QLocalServer;
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirWatcher;
+    class FileInfo;
+
+
+    /**
+     * Long-running headless service ("qdirstat --daemon"): Read some
+     * directories, keep their trees current with a DirWatcher each and
+     * answer queries about them on a local socket, so a question about a
+     * volume doesn't need a new scan.
+     *
+     * The protocol is one JSON object per line in each direction: Each
+     * request has a "query" and mostly a "path"; the response is the
+     * result or {"error": "..."}. Lists have at most "count" entries
+     * (SCAN_DAEMON_DEFAULT_COUNT by default):
+     *
+     *	 {"query": "status"}
+     *	     the trees with their totals and whether they are still busy
+     *
+     *	 {"query": "totals",   "path": "/data/projects"}
+     *	 {"query": "top",      "path": "/data", "count": 10}
+     *	     the largest files (the same as "Discover" -> "Largest Files")
+     *
+     *	 {"query": "owners",   "path": "/data"}
+     *	     the usage by user and by group
+     *
+     *	 {"query": "suffixes", "path": "/data", "count": 10}
+     *	     the usage by filename suffix
+     *
+     *	 {"query": "cache",    "path": "/data", "file": "/tmp/data.cache.gz"}
+     *	     Write the complete tree to that cache file, so QDirStat can
+     *	     show it at once with "qdirstat --cache /tmp/data.cache.gz"
+     *	     instead of reading the directory again.
+     *
+     * Responses to queries for a tree that is still being read have
+     * "busy": true; they are based on what was read so far.
+     *
+     * Only the user who started the daemon can connect to the socket.
+     **/
+    class ScanDaemon: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor. This does not start anything yet.
+	 **/
+	ScanDaemon( QObject * parent = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~ScanDaemon();
+
+	/**
+	 * Start reading and watching 'dirs' and listen on local socket
+	 * 'socketName' (a name or an absolute path). Return 'false' if
+	 * that fails.
+	 **/
+	bool start( const QString & socketName, const QStringList & dirs );
+
+	/**
+	 * Answer one request.
+	 **/
+	QJsonObject query( const QJsonObject & request );
+
+
+    protected slots:
+
+	/**
+	 * Notification that a client connected.
+	 **/
+	void newConnection();
+
+	/**
+	 * Answer the complete requests that a client sent.
+	 **/
+	void readRequests();
+
+
+    protected:
+
+	/**
+	 * Return the tree that contains 'path' or 0.
+	 **/
+	DirTree * findTree( const QString & path ) const;
+
+	/**
+	 * Return the status of all trees.
+	 **/
+	QJsonObject status() const;
+
+	/**
+	 * Return the totals of 'item'.
+	 **/
+	static QJsonObject totals( FileInfo * item );
+
+	/**
+	 * Return the 'count' largest files in the subtree of 'item'.
+	 **/
+	static QJsonObject top( FileInfo * item, int count );
+
+	/**
+	 * Return the usage by owner in the subtree of 'item'.
+	 **/
+	static QJsonObject owners( FileInfo * item );
+
+	/**
+	 * Return the 'count' filename suffixes that use the most space in
+	 * the subtree of 'item'.
+	 **/
+	static QJsonObject suffixes( FileInfo * item, int count );
+
+	/**
+	 * Return a response for an error.
+	 **/
+	static QJsonObject error( const QString & message );
+
+
+	//
+	// Data members
+	//
+
+	QLocalServer *	    _server;
+	QList<DirTree *>    _trees;
+	QList<DirWatcher *> _watchers;
+
+    };	// class ScanDaemon
+
+}	// namespace QDirStat
+
+
+#endif	// ScanDaemon_h
@@ -0,0 +1,386 @@
+/*
+ *   File name: ScanStats.cpp
+ *   Summary:	Performance counters for reading directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <string.h>		// memset()
+#include <sys/sysmacros.h>	// major(), minor()
+#include <sys/statvfs.h>	// statvfs()
+
+#include "ScanStats.h"
+#include "MountPoints.h"
+#include "Logger.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Return the number of used i-nodes of the filesystem on 'device' if
+     * 'path' is its mount point, -1 otherwise or if that is unknown.
+     **/
+    qint64 usedInodes( dev_t device, const QString & path )
+    {
+	MountPoint * mountPoint = MountPoints::findByDevice( device );
+
+	if ( ! mountPoint || mountPoint->path() != path || mountPoint->isNetworkMount() )
+	    return -1;
+
+	struct statvfs vfs;
+
+	if ( statvfs( path.toUtf8(), &vfs ) != 0 || vfs.f_files == 0 )
+	    return -1;	// Btrfs always reports 0 i-nodes
+
+	qint64 used = (qint64) vfs.f_files - (qint64) vfs.f_ffree;
+
+	logDebug() << path << ": " << used << " used i-nodes" << endl;
+
+	return used;
+    }
+
+}	// namespace
+
+
+qint64 DeviceScanStats::expectedEntries() const
+{
+    if ( ! hasEstimate() )
+	return -1;
+
+    qint64 excluded = excludedEntries;
+
+    // Extrapolate the excluded subdirectories that were not estimated
+
+    if ( estimatedExcludedDirs > 0 && excludedDirs > estimatedExcludedDirs )
+	excluded = excluded * excludedDirs / estimatedExcludedDirs;
+
+    return qMax( usedInodes - 1 - excluded, entries );
+}
+
+
+
+
+void LatencyHistogram::clear()
+{
+    memset( _buckets, 0, sizeof( _buckets ) );
+    _count = 0;
+}
+
+
+void LatencyHistogram::merge( const LatencyHistogram & other )
+{
+    for ( int i = 0; i < LATENCY_BUCKETS; ++i )
+	_buckets[ i ] += other._buckets[ i ];
+
+    _count += other._count;
+}
+
+
+int LatencyHistogram::bucket( qint64 nanosec )
+{
+    int bucket = 0;
+
+    while ( nanosec > 1 && bucket < LATENCY_BUCKETS - 1 )
+    {
+	nanosec >>= 1;
+	++bucket;
+    }
+
+    return bucket;
+}
+
+
+qint64 LatencyHistogram::percentile( int percent ) const
+{
+    if ( _count == 0 )
+	return 0;
+
+    qint64 rank = ( _count * percent + 99 ) / 100;
+    qint64 sum	= 0;
+
+    for ( int i = 0; i < LATENCY_BUCKETS; ++i )
+    {
+	sum += _buckets[ i ];
+
+	if ( sum >= rank && sum > 0 )
+	    return 1LL << ( i + 1 );
+    }
+
+    return 1LL << LATENCY_BUCKETS;
+}
+
+
+
+
+ScanStats::ScanStats()
+{
+    start();
+    finish();
+}
+
+
+void ScanStats::start()
+{
+    _running	      = true;
+    _elapsedMillisec  = 0;
+    _dirs	      = 0;
+    _entries	      = 0;
+    _readdirNanosec   = 0;
+    _queueLength      = 0;
+    _maxQueueLength   = 0;
+    _queueLengthSum   = 0;
+    _queueSamples     = 0;
+    _timeSlices	      = 0;
+    _timeSliceJobs    = 0;
+    _timeSliceNanosec = 0;
+    _notifyCount      = 0;
+    _notifyNanosec    = 0;
+    _devices.clear();
+    _clock.start();
+}
+
+
+void ScanStats::finish()
+{
+    if ( ! _running )
+	return;
+
+    _elapsedMillisec = _clock.elapsed();
+    _running	     = false;
+    _queueLength     = 0;
+}
+
+
+qint64 ScanStats::elapsedMillisec() const
+{
+    return _running ? _clock.elapsed() : _elapsedMillisec;
+}
+
+
+void ScanStats::addDirectory( dev_t			 device,
+			      const QString &		 path,
+			      qint64			 entries,
+			      qint64			 readdirNanosec,
+			      const LatencyHistogram & statLatency )
+{
+    _dirs	    += 1;
+    _entries	    += entries;
+    _readdirNanosec += readdirNanosec;
+
+    DeviceScanStats & deviceStats = _devices[ device ];
+
+    if ( deviceStats.dirs == 0 )
+	deviceStats.usedInodes = usedInodes( device, path );
+
+    deviceStats.dirs	       += 1;
+    deviceStats.entries	       += entries;
+    deviceStats.readdirNanosec += readdirNanosec;
+    deviceStats.statLatency.merge( statLatency );
+}
+
+
+bool ScanStats::needsExcludedEstimate( dev_t device ) const
+{
+    QMap<dev_t, DeviceScanStats>::const_iterator it = _devices.constFind( device );
+
+    return it != _devices.constEnd() &&
+	it.value().hasEstimate() &&
+	it.value().estimatedExcludedDirs < MAX_EXCLUDED_ESTIMATES;
+}
+
+
+void ScanStats::addExcludedDir( dev_t device, qint64 estimatedEntries )
+{
+    DeviceScanStats & deviceStats = _devices[ device ];
+
+    ++deviceStats.excludedDirs;
+
+    if ( estimatedEntries >= 0 )
+    {
+	++deviceStats.estimatedExcludedDirs;
+	deviceStats.excludedEntries += estimatedEntries;
+    }
+}
+
+
+void ScanStats::addTimeSlice( int jobs, qint64 nanosec )
+{
+    ++_timeSlices;
+    _timeSliceJobs    += jobs;
+    _timeSliceNanosec += nanosec;
+}
+
+
+void ScanStats::sampleQueueLength( int length )
+{
+    _queueLength     = length;
+    _maxQueueLength  = qMax( _maxQueueLength, length );
+    _queueLengthSum += length;
+    ++_queueSamples;
+}
+
+
+double ScanStats::avgQueueLength() const
+{
+    return _queueSamples > 0 ? (double) _queueLengthSum / _queueSamples : 0.0;
+}
+
+
+double ScanStats::perSecond( qint64 count ) const
+{
+    qint64 millisec = elapsedMillisec();
+
+    return millisec > 0 ? 1000.0 * count / millisec : 0.0;
+}
+
+
+qint64 ScanStats::expectedEntries() const
+{
+    qint64 expected = -1;
+
+    foreach ( const DeviceScanStats & deviceStats, _devices )
+    {
+	if ( deviceStats.hasEstimate() )
+	    expected = qMax( expected, 0LL ) + deviceStats.expectedEntries();
+    }
+
+    return expected;
+}
+
+
+qint64 ScanStats::estimatedEntriesDone() const
+{
+    qint64 done = 0;
+
+    foreach ( const DeviceScanStats & deviceStats, _devices )
+    {
+	// Hard links make more entries than i-nodes
+
+	if ( deviceStats.hasEstimate() )
+	    done += qMin( deviceStats.entries, deviceStats.expectedEntries() );
+    }
+
+    return done;
+}
+
+
+int ScanStats::percentDone() const
+{
+    qint64 expected = expectedEntries();
+
+    if ( expected <= 0 )
+	return -1;
+
+    int percent = (int) ( 100 * estimatedEntriesDone() / expected );
+
+    return _running ? qMin( percent, 99 ) : percent;
+}
+
+
+qint64 ScanStats::remainingMillisec() const
+{
+    qint64 expected = expectedEntries();
+    qint64 done	    = estimatedEntriesDone();
+    double rate	    = perSecond( done );
+
+    if ( ! _running || expected <= 0 || rate <= 0.0 )
+	return -1;
+
+    return qRound64( 1000.0 * ( expected - done ) / rate );
+}
+
+
+LatencyHistogram ScanStats::statLatency() const
+{
+    LatencyHistogram all;
+
+    foreach ( const DeviceScanStats & deviceStats, _devices )
+	all.merge( deviceStats.statLatency );
+
+    return all;
+}
+
+
+QString ScanStats::deviceName( dev_t device )
+{
+    MountPoint * mountPoint = MountPoints::findByDevice( device );
+
+    if ( mountPoint )
+	return mountPoint->path();
+
+    return QString( "%1:%2" ).arg( major( device ) ).arg( minor( device ) );
+}
+
+
+QString ScanStats::formatLatency( qint64 nanosec )
+{
+    if ( nanosec < 1000 )
+	return QString( "%1 ns" ).arg( nanosec );
+
+    if ( nanosec < 1000000 )
+	return QString( "%1 us" ).arg( nanosec / 1000.0, 0, 'f', 1 );
+
+    return QString( "%1 ms" ).arg( nanosec / 1000000.0, 0, 'f', 1 );
+}
+
+
+QStringList ScanStats::summary() const
+{
+    QStringList lines;
+    qint64 millisec = elapsedMillisec();
+
+    lines << QString( "Read %1 directories with %2 entries in %3 sec" )
+	.arg( _dirs ).arg( _entries ).arg( millisec / 1000.0, 0, 'f', 1 );
+
+    lines << QString( "%1 directories/sec, %2 entries/sec" )
+	.arg( qRound64( perSecond( _dirs    ) ) )
+	.arg( qRound64( perSecond( _entries ) ) );
+
+    if ( expectedEntries() >= 0 )
+    {
+	lines << QString( "Progress: %1 of about %2 entries of whole filesystems (%3%)" )
+	    .arg( estimatedEntriesDone() ).arg( expectedEntries() ).arg( percentDone() );
+    }
+
+    lines << QString( "Job queue length: average %1, maximum %2" )
+	.arg( avgQueueLength(), 0, 'f', 1 ).arg( _maxQueueLength );
+
+    if ( _timeSlices > 0 )
+    {
+	lines << QString( "Main thread: %1 jobs in %2 time slices, %3 ms" )
+	    .arg( _timeSliceJobs ).arg( _timeSlices ).arg( _timeSliceNanosec / 1000000 );
+    }
+
+    lines << QString( "View notifications: %1 in %2 ms" )
+	.arg( _notifyCount ).arg( _notifyNanosec / 1000000 );
+
+    for ( QMap<dev_t, DeviceScanStats>::const_iterator it = _devices.constBegin();
+	  it != _devices.constEnd();
+	  ++it )
+    {
+	const LatencyHistogram & latency = it.value().statLatency;
+
+	lines << QString( "%1: %2 directories, %3 entries, readdir %4 ms, lstat p50 < %5, p90 < %6, p99 < %7" )
+	    .arg( deviceName( it.key() ) )
+	    .arg( it.value().dirs )
+	    .arg( it.value().entries )
+	    .arg( it.value().readdirNanosec / 1000000 )
+	    .arg( formatLatency( latency.percentile( 50 ) ) )
+	    .arg( formatLatency( latency.percentile( 90 ) ) )
+	    .arg( formatLatency( latency.percentile( 99 ) ) );
+    }
+
+    return lines;
+}
+
+
+void ScanStats::logSummary() const
+{
+    foreach ( const QString & line, summary() )
+	logInfo() << line << endl;
+}
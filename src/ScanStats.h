@@ -0,0 +1,353 @@
+/*
+ *   File name: ScanStats.h
+ *   Summary:	Performance counters for reading directory trees
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ScanStats_h
+#define ScanStats_h
+
+
+#include <sys/types.h>	// dev_t
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+
+#define LATENCY_BUCKETS		40	// 1 nanosec .. 18 minutes
+
+// Estimate at most this many excluded subtrees of each device for the
+// progress estimate; the others are extrapolated from them
+#define MAX_EXCLUDED_ESTIMATES	20
+
+
+namespace QDirStat
+{
+    /**
+     * How often an exclude rule or a filter was checked, how often it
+     * matched, and how long that took.
+     **/
+    struct MatchStats
+    {
+	MatchStats(): evaluations( 0 ), matches( 0 ), nanosec( 0 ) {}
+
+	qint64 evaluations;
+	qint64 matches;
+	qint64 nanosec;
+    };
+
+
+    /**
+     * A latency histogram with logarithmic buckets: Bucket i counts the
+     * values from 2^i to 2^(i+1) - 1 nanoseconds. That is coarse, but
+     * cheap enough to record every single system call, and percentiles are
+     * accurate within a factor of 2.
+     *
+     * This is a plain value class without any locking; use one for each
+     * thread and merge them.
+     **/
+    class LatencyHistogram
+    {
+    public:
+
+	/**
+	 * Constructor: Create an empty histogram.
+	 **/
+	LatencyHistogram() { clear(); }
+
+	/**
+	 * Remove all values.
+	 **/
+	void clear();
+
+	/**
+	 * Add 'count' values of 'nanosec' each.
+	 **/
+	void add( qint64 nanosec, qint64 count = 1 )
+	{
+	    _buckets[ bucket( nanosec ) ] += count;
+	    _count += count;
+	}
+
+	/**
+	 * Add all values of 'other'.
+	 **/
+	void merge( const LatencyHistogram & other );
+
+	/**
+	 * Return the number of values.
+	 **/
+	qint64 count() const { return _count; }
+
+	/**
+	 * Return the upper bound in nanoseconds of the bucket that contains
+	 * the 'percent' percentile, or 0 if there are no values.
+	 **/
+	qint64 percentile( int percent ) const;
+
+	/**
+	 * Return the bucket number for 'nanosec'.
+	 **/
+	static int bucket( qint64 nanosec );
+
+    protected:
+
+	qint64 _buckets[ LATENCY_BUCKETS ];
+	qint64 _count;
+    };
+
+
+    /**
+     * The counters for one device.
+     **/
+    struct DeviceScanStats
+    {
+	DeviceScanStats():
+	    dirs( 0 ),
+	    entries( 0 ),
+	    readdirNanosec( 0 ),
+	    usedInodes( -1 ),
+	    excludedDirs( 0 ),
+	    estimatedExcludedDirs( 0 ),
+	    excludedEntries( 0 )
+	    {}
+
+	/**
+	 * Return 'true' if the number of entries that will be read from this
+	 * device is known.
+	 **/
+	bool hasEstimate() const { return usedInodes >= 0; }
+
+	/**
+	 * Return the number of entries that will be read from this device:
+	 * The used i-nodes without the mount point itself (which is not an
+	 * entry) and without what is below the excluded subdirectories. -1
+	 * if unknown.
+	 **/
+	qint64 expectedEntries() const;
+
+	qint64		 dirs;
+	qint64		 entries;
+	qint64		 readdirNanosec;
+	LatencyHistogram statLatency;
+	qint64		 usedInodes;	// Of the whole filesystem, -1 if unknown
+	qint64		 excludedDirs;
+	qint64		 estimatedExcludedDirs;
+	qint64		 excludedEntries;	// Below the estimated ones
+    };
+
+
+    /**
+     * Performance counters for reading a directory tree: How many
+     * directories and entries were read per second, how long the lstat()
+     * calls took on each device, how long the job queue was, and how much
+     * time the main thread spent in reading time slices and in the
+     * notifications for the views.
+     *
+     * It also estimates how far reading has come: When the first directory
+     * that is read from a device is the mount point of that device, the
+     * whole filesystem will be read, so the number of used i-nodes that
+     * statvfs() reports is what the number of entries will be. Devices
+     * for which this is not known (a subdirectory of a filesystem, network
+     * filesystems, Btrfs which does not count i-nodes) are left out of the
+     * estimate; so are mount points that are not read at all. For the
+     * subdirectories that are excluded by an exclude rule, the job
+     * estimates how many entries they contain (see SubtreeEstimator), and
+     * those are not waited for.
+     *
+     * The job queue owns one of these and resets it whenever reading
+     * starts. It is only used in the main thread; the worker threads
+     * record their system call times in their LocalDirReader, and those
+     * are added here when the main thread processes the reader.
+     **/
+    class ScanStats
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	ScanStats();
+
+	/**
+	 * Reset all counters and start the clock.
+	 **/
+	void start();
+
+	/**
+	 * Stop the clock.
+	 **/
+	void finish();
+
+	/**
+	 * Return 'true' if reading is in progress.
+	 **/
+	bool isRunning() const { return _running; }
+
+	/**
+	 * Add one directory 'path' (or one chunk of a huge directory) on
+	 * 'device' with 'entries' entries. 'readdirNanosec' is the time for
+	 * reading the names, 'statLatency' has the times of the lstat()
+	 * calls.
+	 *
+	 * For the first directory of a device, this calls statvfs() if that
+	 * directory is its mount point.
+	 **/
+	void addDirectory( dev_t		    device,
+			   const QString &	    path,
+			   qint64		    entries,
+			   qint64		    readdirNanosec,
+			   const LatencyHistogram & statLatency );
+
+	/**
+	 * Return 'true' if the entries below the next excluded subdirectory on
+	 * 'device' should be estimated for the progress estimate: If there
+	 * is an estimate for that device and not too many excluded
+	 * subdirectories were estimated already.
+	 **/
+	bool needsExcludedEstimate( dev_t device ) const;
+
+	/**
+	 * Add a subdirectory on 'device' that is not read because an exclude
+	 * rule matched. 'estimatedEntries' is how many entries are below it,
+	 * -1 if that was not estimated.
+	 **/
+	void addExcludedDir( dev_t device, qint64 estimatedEntries = -1 );
+
+	/**
+	 * Add one time slice of the job queue in which 'jobs' jobs were
+	 * processed in 'nanosec' nanoseconds.
+	 **/
+	void addTimeSlice( int jobs, qint64 nanosec );
+
+	/**
+	 * Record the current length of the job queue.
+	 **/
+	void sampleQueueLength( int length );
+
+	/**
+	 * Add 'nanosec' spent in notifying the views about new children or
+	 * finished directories.
+	 **/
+	void addNotifyTime( qint64 nanosec )
+	{
+	    _notifyNanosec += nanosec;
+	    ++_notifyCount;
+	}
+
+	/**
+	 * Return the time since start() (until finish() if finished).
+	 **/
+	qint64 elapsedMillisec() const;
+
+	qint64 dirCount()	   const { return _dirs;	   }
+	qint64 entryCount()	   const { return _entries;	   }
+	qint64 readdirNanosec()	   const { return _readdirNanosec; }
+	int    queueLength()	   const { return _queueLength;	   }
+	int    maxQueueLength()	   const { return _maxQueueLength; }
+	qint64 timeSlices()	   const { return _timeSlices;	   }
+	qint64 timeSliceJobs()	   const { return _timeSliceJobs;  }
+	qint64 timeSliceNanosec()  const { return _timeSliceNanosec; }
+	qint64 notifyCount()	   const { return _notifyCount;	   }
+	qint64 notifyNanosec()	   const { return _notifyNanosec;  }
+
+	/**
+	 * Return the average queue length over all samples.
+	 **/
+	double avgQueueLength() const;
+
+	/**
+	 * Return 'count' per second of the elapsed time.
+	 **/
+	double perSecond( qint64 count ) const;
+
+	/**
+	 * Return the number of entries that will be read from all devices
+	 * with an estimate, or -1 if there is none.
+	 **/
+	qint64 expectedEntries() const;
+
+	/**
+	 * Return the number of entries read so far from all devices with an
+	 * estimate.
+	 **/
+	qint64 estimatedEntriesDone() const;
+
+	/**
+	 * Return how many percent of the expected entries are read, or -1 if
+	 * that is unknown. While reading is in progress, this is at most 99.
+	 **/
+	int percentDone() const;
+
+	/**
+	 * Return the estimated time until reading is finished in
+	 * milliseconds, or -1 if that is unknown.
+	 **/
+	qint64 remainingMillisec() const;
+
+	/**
+	 * Return the lstat() latencies of all devices.
+	 **/
+	LatencyHistogram statLatency() const;
+
+	/**
+	 * Return the counters by device.
+	 **/
+	const QMap<dev_t, DeviceScanStats> & devices() const { return _devices; }
+
+	/**
+	 * Return a human-readable name for 'device': Its mount point if it
+	 * is known, "major:minor" otherwise.
+	 **/
+	static QString deviceName( dev_t device );
+
+	/**
+	 * Format a latency in nanoseconds.
+	 **/
+	static QString formatLatency( qint64 nanosec );
+
+	/**
+	 * Return a summary of the most important counters, one line each.
+	 **/
+	QStringList summary() const;
+
+	/**
+	 * Write the summary to the log.
+	 **/
+	void logSummary() const;
+
+
+    protected:
+
+	bool	      _running;
+	QElapsedTimer _clock;
+	qint64	      _elapsedMillisec;	// When finished
+
+	qint64	      _dirs;
+	qint64	      _entries;
+	qint64	      _readdirNanosec;
+
+	int	      _queueLength;
+	int	      _maxQueueLength;
+	qint64	      _queueLengthSum;
+	qint64	      _queueSamples;
+
+	qint64	      _timeSlices;
+	qint64	      _timeSliceJobs;
+	qint64	      _timeSliceNanosec;
+
+	qint64	      _notifyCount;
+	qint64	      _notifyNanosec;
+
+	QMap<dev_t, DeviceScanStats> _devices;
+    };
+
+}	// namespace QDirStat
+
+
+#endif	// ScanStats_h
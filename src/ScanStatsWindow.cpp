@@ -0,0 +1,439 @@
+/*
+ *   File name: ScanStatsWindow.cpp
+ *   Summary:	QDirStat "Scan Statistics" window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include "ScanStatsWindow.h"
+#include "DirTree.h"
+#include "DirTreeModel.h"
+#include "DirTreeFilter.h"
+#include "ExcludeRules.h"
+#include "ScanStats.h"
+#include "ReadScheduler.h"
+#include "SettingsHelpers.h"
+#include "HeaderTweaker.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "Exception.h"
+
+#define UPDATE_MILLISEC		500
+
+
+using namespace QDirStat;
+
+
+ScanStatsWindow::ScanStatsWindow( DirTreeModel * model, QWidget * parent ):
+    QDialog( parent ),
+    _ui( new Ui::ScanStatsWindow ),
+    _model( model ),
+    _tree( model ? model->tree() : 0 )
+{
+    CHECK_NEW( _ui );
+    _ui->setupUi( this );
+    initWidgets();
+    readWindowSettings( this, "ScanStatsWindow" );
+
+    _updateTimer.setInterval( UPDATE_MILLISEC );
+
+    connect( &_updateTimer, SIGNAL( timeout()  ),
+	     this,	    SLOT  ( populate() ) );
+
+    if ( _tree )
+    {
+	connect( _tree, SIGNAL( finished()	 ),
+		 this,	SLOT  ( populateMemory() ) );
+    }
+
+    _updateTimer.start();
+    populateMemory();
+}
+
+
+ScanStatsWindow::~ScanStatsWindow()
+{
+    writeWindowSettings( this, "ScanStatsWindow" );
+    delete _ui;
+}
+
+
+void ScanStatsWindow::initWidgets()
+{
+    _ui->countersTree->setHeaderLabels( QStringList() << tr( "Counter" ) << tr( "Value" ) );
+
+    QStringList headers;
+    headers << tr( "Device"	    )
+	    << tr( "Directories"    )
+	    << tr( "Entries"	    )
+	    << tr( "Expected"	    )
+	    << tr( "readdir"	    )
+	    << tr( "lstat p50"	    )
+	    << tr( "lstat p90"	    )
+	    << tr( "lstat p99"	    )
+	    << tr( "Throttle"	    );
+
+    _ui->devicesTree->setHeaderLabels( headers );
+
+    QTreeWidgetItem * hItem = _ui->devicesTree->headerItem();
+
+    for ( int col = 0; col < headers.size(); ++col )
+	hItem->setTextAlignment( col, Qt::AlignHCenter );
+
+    hItem->setToolTip( SS_ExpectedCol, tr( "The used i-nodes of the filesystem without the excluded subtrees" ) );
+    hItem->setToolTip( SS_ReaddirCol, tr( "Total time for reading the directory entries" ) );
+    hItem->setToolTip( SS_Stat50Col,  tr( "Half of the lstat() calls were faster than this" ) );
+    hItem->setToolTip( SS_Stat99Col,  tr( "99% of the lstat() calls were faster than this" ) );
+    hItem->setToolTip( SS_ThrottleCol, tr( "What polite mode currently does for this device" ) );
+
+    _ui->rulesTree->setHeaderLabels( QStringList()
+				     << tr( "Rule or Filter" )
+				     << tr( "Checked" )
+				     << tr( "Matched" )
+				     << tr( "Hit Rate" )
+				     << tr( "Time" ) );
+
+    hItem = _ui->rulesTree->headerItem();
+
+    for ( int col = SR_EvaluationsCol; col <= SR_TimeCol; ++col )
+	hItem->setTextAlignment( col, Qt::AlignHCenter );
+
+    hItem->setToolTip( SR_TimeCol, tr( "The rules of each kind are matched together, "
+				       "so the time is only known for all of them" ) );
+
+    _ui->memoryTree->setHeaderLabels( QStringList()
+				      << tr( "Memory" )
+				      << tr( "Objects" )
+				      << tr( "Size" ) );
+
+    hItem = _ui->memoryTree->headerItem();
+    hItem->setTextAlignment( SM_CountCol, Qt::AlignHCenter );
+    hItem->setTextAlignment( SM_BytesCol, Qt::AlignHCenter );
+
+    connect( _ui->logButton, SIGNAL( clicked()	  ),
+	     this,	     SLOT  ( writeToLog() ) );
+
+    connect( _ui->memoryButton, SIGNAL( clicked()	    ),
+	     this,		SLOT  ( populateMemory() ) );
+
+    connect( _ui->resetRulesButton, SIGNAL( clicked()	     ),
+	     this,		    SLOT  ( resetRuleStats() ) );
+}
+
+
+const ScanStats * ScanStatsWindow::scanStats() const
+{
+    return _tree ? &_tree->jobQueue()->scanStats() : 0;
+}
+
+
+void ScanStatsWindow::populate()
+{
+    TRACE_SCOPE( "stats", "ScanStatsWindow::populate" );
+
+    const ScanStats * stats = scanStats();
+
+    _ui->countersTree->clear();
+    _ui->devicesTree->clear();
+
+    if ( ! stats )
+	return;
+
+    qint64 millisec = stats->elapsedMillisec();
+
+    _ui->heading->setText( stats->isRunning() ?
+			   tr( "Reading..." ) :
+			   tr( "Last Read" ) );
+
+    addCounter( tr( "Elapsed time" ),
+		tr( "%1 sec" ).arg( millisec / 1000.0, 0, 'f', 1 ) );
+    addCounter( tr( "Directories" ),
+		tr( "%1  (%2 / sec)" )
+		.arg( stats->dirCount() )
+		.arg( qRound64( stats->perSecond( stats->dirCount() ) ) ) );
+    addCounter( tr( "Entries" ),
+		tr( "%1  (%2 / sec)" )
+		.arg( stats->entryCount() )
+		.arg( qRound64( stats->perSecond( stats->entryCount() ) ) ) );
+
+    if ( stats->expectedEntries() >= 0 )
+    {
+	QString progress = tr( "%1%  (%2 of about %3 entries)" )
+	    .arg( stats->percentDone() )
+	    .arg( stats->estimatedEntriesDone() )
+	    .arg( stats->expectedEntries() );
+
+	if ( stats->remainingMillisec() >= 0 )
+	    progress += tr( ", about %1 sec left" ).arg( qRound64( stats->remainingMillisec() / 1000.0 ) );
+
+	addCounter( tr( "Progress" ), progress );
+    }
+    else
+    {
+	addCounter( tr( "Progress" ), tr( "unknown (no whole filesystem with i-node counts)" ) );
+    }
+
+    LatencyHistogram latency = stats->statLatency();
+
+    addCounter( tr( "lstat() latency" ),
+		tr( "p50 < %1, p90 < %2, p99 < %3" )
+		.arg( ScanStats::formatLatency( latency.percentile( 50 ) ) )
+		.arg( ScanStats::formatLatency( latency.percentile( 90 ) ) )
+		.arg( ScanStats::formatLatency( latency.percentile( 99 ) ) ) );
+
+    addCounter( tr( "Job queue length" ),
+		tr( "%1 now, %2 average, %3 maximum" )
+		.arg( stats->queueLength() )
+		.arg( stats->avgQueueLength(), 0, 'f', 1 )
+		.arg( stats->maxQueueLength() ) );
+    addCounter( tr( "Main thread reading" ),
+		tr( "%1 ms in %2 time slices" )
+		.arg( stats->timeSliceNanosec() / 1000000 )
+		.arg( stats->timeSlices() ) );
+    addCounter( tr( "View notifications" ),
+		tr( "%1 ms for %2 notifications" )
+		.arg( stats->notifyNanosec() / 1000000 )
+		.arg( stats->notifyCount() ) );
+
+    ReadScheduler * scheduler = ReadScheduler::instance();
+
+    if ( scheduler->politeMode() )
+    {
+	QString rate = scheduler->maxStatRate() > 0 ?
+	    tr( "at most %1 lstat() / sec per device" ).arg( scheduler->maxStatRate() ) :
+	    tr( "no lstat() rate limit" );
+
+	addCounter( tr( "Polite mode" ),
+		    tr( "idle I/O and CPU priority, %1, backing off above %2 ms lstat() latency" )
+		    .arg( rate )
+		    .arg( scheduler->busyLatency() ) );
+    }
+    else
+    {
+	addCounter( tr( "Polite mode" ), tr( "off" ) );
+    }
+
+    const QMap<dev_t, DeviceScanStats> & devices = stats->devices();
+
+    for ( QMap<dev_t, DeviceScanStats>::const_iterator it = devices.constBegin();
+	  it != devices.constEnd();
+	  ++it )
+    {
+	const DeviceScanStats & device = it.value();
+
+	QTreeWidgetItem * item = new QTreeWidgetItem( _ui->devicesTree );
+	CHECK_NEW( item );
+
+	item->setText( SS_DeviceCol,  ScanStats::deviceName( it.key() ) );
+	item->setText( SS_DirsCol,    QString::number( device.dirs    ) );
+	item->setText( SS_EntriesCol, QString::number( device.entries ) );
+
+	if ( device.hasEstimate() )
+	    item->setText( SS_ExpectedCol, QString::number( device.expectedEntries() ) );
+
+	item->setText( SS_ReaddirCol, tr( "%1 ms" ).arg( device.readdirNanosec / 1000000 ) );
+	item->setText( SS_Stat50Col,  ScanStats::formatLatency( device.statLatency.percentile( 50 ) ) );
+	item->setText( SS_Stat90Col,  ScanStats::formatLatency( device.statLatency.percentile( 90 ) ) );
+	item->setText( SS_Stat99Col,  ScanStats::formatLatency( device.statLatency.percentile( 99 ) ) );
+	item->setText( SS_ThrottleCol, throttleText( it.key() ) );
+
+	for ( int col = SS_DirsCol; col <= SS_Stat99Col; ++col )
+	    item->setTextAlignment( col, Qt::AlignRight );
+    }
+
+    HeaderTweaker::resizeToContents( _ui->countersTree->header() );
+    HeaderTweaker::resizeToContents( _ui->devicesTree->header()	 );
+
+    populateRules();
+}
+
+
+void ScanStatsWindow::populateRules()
+{
+    _ui->rulesTree->clear();
+
+    addRules( ExcludeRules::instance() );
+
+    if ( _tree )
+    {
+	if ( _tree->excludeRules() )
+	    addRules( _tree->excludeRules() );
+
+	for ( int i=0; i < _tree->filters().size(); ++i )
+	{
+	    addRuleItem( tr( "Filter: %1" ).arg( _tree->filters().at( i )->description() ),
+			 _tree->filterStats( i ),
+			 true ); // showTime
+	}
+    }
+
+    HeaderTweaker::resizeToContents( _ui->rulesTree->header() );
+}
+
+
+void ScanStatsWindow::addRules( ExcludeRules * rules )
+{
+    rules->updateStats();
+
+    for ( ExcludeRuleListIterator it = rules->begin(); it != rules->end(); ++it )
+	addRuleItem( (*it)->regexp().pattern(), (*it)->stats(), false );
+
+    for ( int type = 0; type < ExcludeRules::MatcherCount; ++type )
+    {
+	ExcludeRules::MatcherType matcherType = static_cast<ExcludeRules::MatcherType>( type );
+	const MatchStats & stats = rules->matcherStats( matcherType );
+
+	if ( stats.evaluations > 0 )
+	    addRuleItem( ExcludeRules::matcherName( matcherType ), stats, true );
+    }
+}
+
+
+void ScanStatsWindow::addRuleItem( const QString &    name,
+				   const MatchStats & stats,
+				   bool		      showTime )
+{
+    QTreeWidgetItem * item = new QTreeWidgetItem( _ui->rulesTree );
+    CHECK_NEW( item );
+
+    item->setText( SR_RuleCol,	      name );
+    item->setText( SR_EvaluationsCol, QString::number( stats.evaluations ) );
+    item->setText( SR_MatchesCol,     QString::number( stats.matches	 ) );
+
+    if ( stats.evaluations > 0 )
+    {
+	item->setText( SR_MatchPercentCol,
+		       QString( "%1%" ).arg( 100.0 * stats.matches / stats.evaluations, 0, 'f', 2 ) );
+    }
+
+    if ( showTime )
+	item->setText( SR_TimeCol, tr( "%1 ms" ).arg( stats.nanosec / 1000000.0, 0, 'f', 1 ) );
+
+    for ( int col = SR_EvaluationsCol; col <= SR_TimeCol; ++col )
+	item->setTextAlignment( col, Qt::AlignRight );
+}
+
+
+void ScanStatsWindow::resetRuleStats()
+{
+    ExcludeRules::instance()->resetStats();
+
+    if ( _tree )
+    {
+	if ( _tree->excludeRules() )
+	    _tree->excludeRules()->resetStats();
+
+	_tree->resetFilterStats();
+    }
+
+    populateRules();
+}
+
+
+QString ScanStatsWindow::throttleText( dev_t device ) const
+{
+    ReadScheduler * scheduler = ReadScheduler::instance();
+
+    if ( ! scheduler->politeMode() )
+	return QString();
+
+    DeviceThrottle throttle = scheduler->deviceThrottle( device );
+    QString text;
+
+    if ( throttle.backoffMillisec > 0 )
+	text = tr( "busy, pausing %1 ms" ).arg( throttle.backoffMillisec );
+    else if ( scheduler->maxStatRate() > 0 && throttle.budget < 0.0 )
+	text = tr( "rate limit" );
+    else
+	text = tr( "running" );
+
+    if ( throttle.backoffCount > 0 )
+	text += tr( " (busy %1 times)" ).arg( throttle.backoffCount );
+
+    return text;
+}
+
+
+void ScanStatsWindow::populateMemory()
+{
+    _ui->memoryTree->clear();
+    _memoryStats.clear();
+
+    if ( ! _model )
+	return;
+
+    _memoryStats = _model->memoryStats();
+
+    for ( int i = 0; i < MemCategoryCount; ++i )
+    {
+	MemoryCategory category = static_cast<MemoryCategory>( i );
+
+	if ( _memoryStats.bytes( category ) > 0 )
+	{
+	    addMemoryItem( MemoryStats::categoryName( category ),
+			   _memoryStats.count( category ),
+			   _memoryStats.bytes( category ) );
+	}
+    }
+
+    addMemoryItem( tr( "Total" ), -1, _memoryStats.totalBytes() );
+    addMemoryItem( tr( "Node pool chunks" ), -1, _memoryStats.nodePoolBytes() );
+    addMemoryItem( tr( "Sort caches of all trees" ), -1, _memoryStats.allSortCacheBytes() );
+
+    HeaderTweaker::resizeToContents( _ui->memoryTree->header() );
+}
+
+
+void ScanStatsWindow::addMemoryItem( const QString & name, qint64 count, qint64 bytes )
+{
+    QTreeWidgetItem * item = new QTreeWidgetItem( _ui->memoryTree );
+    CHECK_NEW( item );
+
+    item->setText( SM_CategoryCol, name );
+    item->setText( SM_BytesCol,	   formatSize( bytes ) );
+    item->setTextAlignment( SM_CountCol, Qt::AlignRight );
+    item->setTextAlignment( SM_BytesCol, Qt::AlignRight );
+
+    if ( count >= 0 )
+	item->setText( SM_CountCol, QString::number( count ) );
+}
+
+
+void ScanStatsWindow::addCounter( const QString & name, const QString & value )
+{
+    QTreeWidgetItem * item = new QTreeWidgetItem( _ui->countersTree );
+    CHECK_NEW( item );
+
+    item->setText( 0, name  );
+    item->setText( 1, value );
+}
+
+
+void ScanStatsWindow::writeToLog()
+{
+    const ScanStats * stats = scanStats();
+
+    if ( stats )
+	stats->logSummary();
+
+    for ( int i=0; i < _ui->rulesTree->topLevelItemCount(); ++i )
+    {
+	QTreeWidgetItem * item = _ui->rulesTree->topLevelItem( i );
+
+	logInfo() << "Rule " << item->text( SR_RuleCol )
+		  << ": checked "  << item->text( SR_EvaluationsCol )
+		  << ", matched "  << item->text( SR_MatchesCol )
+		  << ( item->text( SR_TimeCol ).isEmpty() ? "" : ", " + item->text( SR_TimeCol ) )
+		  << endl;
+    }
+
+    _memoryStats.logSummary();
+}
+
+
+void ScanStatsWindow::reject()
+{
+    deleteLater();
+}
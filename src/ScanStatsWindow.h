@@ -0,0 +1,210 @@
+/*
+ *   File name: ScanStatsWindow.h
+ *   Summary:	QDirStat "Scan Statistics" window
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ScanStatsWindow_h
+#define ScanStatsWindow_h
+
+#include <sys/types.h>	// dev_t
+
+#include <QDialog>
+#include <QPointer>
+#include <QTimer>
+
+#include "ui_scan-stats-window.h"
+#include "MemoryStats.h"
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirTreeModel;
+    class ExcludeRules;
+    class ScanStats;
+    struct MatchStats;
+
+    /**
+     * Modeless dialog to show the performance counters of reading the
+     * directory tree (see ScanStats) while reading is in progress and
+     * afterwards:
+     *
+     *	 - directories and entries per second
+     *	 - how far reading has come
+     *	 - job queue length
+     *	 - time spent in the main thread
+     *	 - lstat() latency percentiles for each device
+     *	 - what polite mode does for each device (see ReadScheduler)
+     *	 - how often each exclude rule and filter was checked and matched
+     *
+     * It also shows the memory usage of the tree (see MemoryStats). That
+     * needs a walk through the whole tree, so it is only calculated when
+     * the window is opened, when reading is finished and on request.
+     **/
+    class ScanStatsWindow: public QDialog
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 *
+	 * Notice that this widget will destroy itself upon window close.
+	 *
+	 * It is advised to use a QPointer for storing a pointer to an instance
+	 * of this class. The QPointer will keep track of this window
+	 * auto-deleting itself when closed.
+	 **/
+	ScanStatsWindow( DirTreeModel * model, QWidget * parent );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~ScanStatsWindow();
+
+
+    public slots:
+
+	/**
+	 * Show the current counters.
+	 **/
+	void populate();
+
+	/**
+	 * Calculate and show the memory usage.
+	 **/
+	void populateMemory();
+
+	/**
+	 * Reject the dialog contents, i.e. the user clicked the "Close" or
+	 * WM_CLOSE button. This not only closes the dialog, it also deletes
+	 * it.
+	 *
+	 * Reimplemented from QDialog.
+	 **/
+	virtual void reject() Q_DECL_OVERRIDE;
+
+
+    protected slots:
+
+	/**
+	 * Write the summary of the counters and of the memory usage to the
+	 * log.
+	 **/
+	void writeToLog();
+
+	/**
+	 * Reset the counters of the exclude rules and of the filters of the
+	 * tree.
+	 **/
+	void resetRuleStats();
+
+
+    protected:
+
+	/**
+	 * One-time initialization of the widgets in this window.
+	 **/
+	void initWidgets();
+
+	/**
+	 * Return the counters or 0 if the tree is gone.
+	 **/
+	const ScanStats * scanStats() const;
+
+	/**
+	 * Return the polite mode throttling state of 'device' for the
+	 * devices list.
+	 **/
+	QString throttleText( dev_t device ) const;
+
+	/**
+	 * Show the counters of the exclude rules and filters.
+	 **/
+	void populateRules();
+
+	/**
+	 * Add the rules of 'rules' and their matchers to the rules list.
+	 **/
+	void addRules( ExcludeRules * rules );
+
+	/**
+	 * Add a line for an exclude rule or filter to the rules list. The
+	 * time is only shown if 'showTime' is 'true'.
+	 **/
+	void addRuleItem( const QString &    name,
+			  const MatchStats & stats,
+			  bool		     showTime );
+
+	/**
+	 * Add a line with 'name' and 'value' to the counters list.
+	 **/
+	void addCounter( const QString & name, const QString & value );
+
+	/**
+	 * Add a line for 'category' to the memory list.
+	 **/
+	void addMemoryItem( const QString & name, qint64 count, qint64 bytes );
+
+
+	//
+	// Data members
+	//
+
+	Ui::ScanStatsWindow *  _ui;
+	QPointer<DirTreeModel> _model;
+	QPointer<DirTree>      _tree;
+	QTimer		       _updateTimer;
+	MemoryStats	       _memoryStats;
+
+    };	// class ScanStatsWindow
+
+
+    /**
+     * Column numbers for the devices tree widget
+     **/
+    enum ScanStatsDeviceColumns
+    {
+	SS_DeviceCol = 0,
+	SS_DirsCol,
+	SS_EntriesCol,
+	SS_ExpectedCol,
+	SS_ReaddirCol,
+	SS_Stat50Col,
+	SS_Stat90Col,
+	SS_Stat99Col,
+	SS_ThrottleCol
+    };
+
+
+    /**
+     * Column numbers for the exclude rules tree widget
+     **/
+    enum ScanStatsRulesColumns
+    {
+	SR_RuleCol = 0,
+	SR_EvaluationsCol,
+	SR_MatchesCol,
+	SR_MatchPercentCol,
+	SR_TimeCol
+    };
+
+
+    /**
+     * Column numbers for the memory tree widget
+     **/
+    enum ScanStatsMemoryColumns
+    {
+	SM_CategoryCol = 0,
+	SM_CountCol,
+	SM_BytesCol
+    };
+
+}	// namespace QDirStat
+
+#endif	// ScanStatsWindow_h
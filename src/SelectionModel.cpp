@@ -25,6 +25,8 @@ SelectionModel::SelectionModel( DirTreeModel * dirTreeModel, QObject * parent ):
     _currentItem(0),
     _currentBranch(0),
     _selectedItemsDirty(false),
+    _pseudoDirCount(0),
+    _pkgCount(0),
     _verbose(false)
 {
     connect( this, SIGNAL( currentChanged	  ( QModelIndex, QModelIndex ) ),
@@ -38,6 +40,12 @@ SelectionModel::SelectionModel( DirTreeModel * dirTreeModel, QObject * parent ):
 
     connect( dirTreeModel->tree(), SIGNAL( clearing() ),
 	     this,		   SLOT	 ( clear()    ) );
+
+    connect( dirTreeModel->tree(), SIGNAL( replacingSubtree( DirInfo * ) ),
+	     this,		   SLOT	 ( replacingSubtree( DirInfo * ) ) );
+
+    connect( dirTreeModel->tree(), SIGNAL( subtreeReplaced ( DirInfo * ) ),
+	     this,		   SLOT	 ( subtreeReplaced ( DirInfo * ) ) );
 }
 
 
@@ -60,28 +68,99 @@ void SelectionModel::clear()
 
 FileInfoSet SelectionModel::selectedItems()
 {
-    if ( _selectedItemsDirty )
+    updateSelectedItems();
+
+    return _selectedItems;
+}
+
+
+int SelectionModel::selectedCount()
+{
+    updateSelectedItems();
+
+    return _selectedItems.size();
+}
+
+
+bool SelectionModel::selectionContainsPseudoDir()
+{
+    updateSelectedItems();
+
+    return _pseudoDirCount > 0;
+}
+
+
+bool SelectionModel::selectionContainsPkg()
+{
+    updateSelectedItems();
+
+    return _pkgCount > 0;
+}
+
+
+void SelectionModel::updateSelectedItems()
+{
+    if ( ! _selectedItemsDirty )
+	return;
+
+    // Build set of selected items from the selected model indexes: One
+    // item for each selected row, not for each index in all its columns
+
+    _selectedItems.clear();
+    _pseudoDirCount = 0;
+    _pkgCount	    = 0;
+
+    foreach ( const QItemSelectionRange & range, selection() )
+	addRange( range, true );
+
+    _selectedItemsDirty = false;
+}
+
+
+void SelectionModel::addRange( const QItemSelectionRange & range, bool select )
+{
+    if ( ! range.isValid() )
+	return;
+
+    for ( int row = range.top(); row <= range.bottom(); ++row )
     {
-	// Build set of selected items from the selected model indexes
+	QModelIndex index = _dirTreeModel->index( row, 0, range.parent() );
 
-	_selectedItems.clear();
+	if ( ! index.isValid() )
+	    continue;
 
-	foreach ( const QModelIndex index, selectedIndexes() )
+	FileInfo * item = static_cast<FileInfo *>( index.internalPointer() );
+	CHECK_MAGIC( item );
+
+	int sign = 0;
+
+	if ( select )
 	{
-	    if ( index.isValid() )
+	    if ( ! _selectedItems.contains( item ) )
 	    {
-		FileInfo * item = static_cast<FileInfo *>( index.internalPointer() );
-		CHECK_MAGIC( item );
-
-		// logDebug() << "Adding " << item << " col " << index.column() << " to selected items" << endl;
+		// logDebug() << "Adding " << item << " to selected items" << endl;
 		_selectedItems << item;
+		sign = 1;
 	    }
 	}
+	else if ( _selectedItems.remove( item ) )
+	{
+	    sign = -1;
+	}
+
+	if ( item->isPseudoDir() )
+	    _pseudoDirCount += sign;
 
-	_selectedItemsDirty = false;
+	if ( item->isPkgInfo() )
+	    _pkgCount += sign;
     }
+}
 
-    return _selectedItems;
+
+bool SelectionModel::isCompleteRows( const QItemSelectionRange & range ) const
+{
+    return range.left() == 0 &&
+	range.right() >= _dirTreeModel->columnCount( range.parent() ) - 1;
 }
 
 
@@ -111,10 +190,31 @@ void SelectionModel::propagateCurrentChanged( const QModelIndex & newCurrentInde
 void SelectionModel::propagateSelectionChanged( const QItemSelection & selected,
 						const QItemSelection & deselected )
 {
-    Q_UNUSED( selected );
-    Q_UNUSED( deselected );
+    if ( ! _selectedItemsDirty )
+    {
+	// Apply only the changes. A row that is deselected only in some
+	// columns might still be selected in the others; leave that to a
+	// complete rebuild.
+
+	foreach ( const QItemSelectionRange & range, deselected )
+	{
+	    if ( ! isCompleteRows( range ) )
+	    {
+		_selectedItemsDirty = true;
+		break;
+	    }
+	}
+
+	if ( ! _selectedItemsDirty )
+	{
+	    foreach ( const QItemSelectionRange & range, deselected )
+		addRange( range, false );
+
+	    foreach ( const QItemSelectionRange & range, selected )
+		addRange( range, true );
+	}
+    }
 
-    _selectedItemsDirty = true;
     emit selectionChanged();
     emit selectionChanged( selectedItems() );
 }
@@ -268,6 +368,89 @@ void SelectionModel::deletingChildNotify( FileInfo * deletedChild )
 }
 
 
+void SelectionModel::replacingSubtree( DirInfo * subtree )
+{
+    // The subtree itself stays; only what is inside it goes away
+
+    FileInfoSet remaining;
+    _replacedSelection.clear();
+    _replacedCurrent.clear();
+    _replacedBranch.clear();
+
+    foreach ( FileInfo * item, selectedItems() )
+    {
+	if ( item != subtree && item->isInSubtree( subtree ) )
+	    _replacedSelection << item->url();
+	else
+	    remaining << item;
+    }
+
+    if ( _currentItem && _currentItem != subtree && _currentItem->isInSubtree( subtree ) )
+    {
+	_replacedCurrent = _currentItem->url();
+	setCurrentItem( subtree );
+    }
+
+    if ( _currentBranch && _currentBranch != subtree && _currentBranch->isInSubtree( subtree ) )
+    {
+	_replacedBranch = _currentBranch->url();
+	_currentBranch	= subtree;
+    }
+
+    if ( ! _replacedSelection.isEmpty() )
+	setSelectedItems( remaining );
+}
+
+
+void SelectionModel::subtreeReplaced( DirInfo * subtree )
+{
+    Q_UNUSED( subtree );
+
+    DirTree * tree = _dirTreeModel->tree();
+
+    if ( ! _replacedBranch.isEmpty() )
+    {
+	// Not sending currentBranchChanged(): That would close all other
+	// branches that the tree view is about to open again
+
+	FileInfo * branch = tree->locate( _replacedBranch, true ); // findPseudoDirs
+
+	if ( branch )
+	    _currentBranch = branch;
+    }
+
+    if ( ! _replacedSelection.isEmpty() )
+    {
+	FileInfoSet selection = selectedItems();
+
+	foreach ( const QString & url, _replacedSelection )
+	{
+	    FileInfo * item = tree->locate( url, true );
+
+	    if ( item )
+		selection << item;
+	}
+
+	if ( _verbose )
+	    logDebug() << "Selecting " << selection.size() << " items again" << endl;
+
+	setSelectedItems( selection );
+    }
+
+    if ( ! _replacedCurrent.isEmpty() )
+    {
+	FileInfo * current = tree->locate( _replacedCurrent, true );
+
+	if ( current )
+	    setCurrentItem( current );
+    }
+
+    _replacedSelection.clear();
+    _replacedCurrent.clear();
+    _replacedBranch.clear();
+}
+
+
 void SelectionModel::dumpSelectedItems()
 {
     logDebug() << "Current item: " << _currentItem << endl;
@@ -11,6 +11,7 @@
 
 
 #include <QItemSelectionModel>
+#include <QStringList>
 
 #include "FileInfoSet.h"
 
@@ -18,6 +19,7 @@
 namespace QDirStat
 {
     class FileInfo;
+    class DirInfo;
     class DirTreeModel;
 
     /**
@@ -28,8 +30,10 @@ namespace QDirStat
      *
      * This is only a thin wrapper around QItemSelectionModel. The
      * QItemSelectionModel base class is the master with its QModelIndex based
-     * selection; this subclass fetches that QModelIndex selection and
-     * translates each item into a FileInfo pointer on demand.
+     * selection; this subclass keeps a FileInfo pointer set of the selected
+     * rows. That set is updated with the ranges of rows that were selected
+     * or deselected, so selecting a few more rows does not translate the
+     * complete selection again.
      **/
     class SelectionModel: public QItemSelectionModel
     {
@@ -52,6 +56,21 @@ namespace QDirStat
 	 **/
 	FileInfoSet selectedItems();
 
+	/**
+	 * Return the number of selected items. Unlike selectedItems().size(),
+	 * this is also cheap for a large selection that has just changed.
+	 **/
+	int selectedCount();
+
+	/**
+	 * Return 'true' if any selected item is a pseudo directory (a dot
+	 * entry or an attic) or a PkgInfo item, respectively. This is kept
+	 * up to date along with the selected items, so it does not need to
+	 * check all of them.
+	 **/
+	bool selectionContainsPseudoDir();
+	bool selectionContainsPkg();
+
 	/**
 	 * Return the current item (the one that has the keyboard focus).
 	 * This might return 0 if currently no item has the keyboard focus.
@@ -208,9 +227,42 @@ namespace QDirStat
 	 **/
 	void deletingChildNotify( FileInfo *deletedChild );
 
+	/**
+	 * Notification that the children of 'subtree' are about to be
+	 * replaced after a shadow refresh: Remember the paths of the
+	 * selected items, the current item and the current branch in it and
+	 * let go of the items.
+	 **/
+	void replacingSubtree( DirInfo * subtree );
+
+	/**
+	 * Notification that the children of 'subtree' were replaced: Select
+	 * the items with the remembered paths again.
+	 **/
+	void subtreeReplaced( DirInfo * subtree );
+
 
     protected:
 
+	/**
+	 * Rebuild the set of selected items from the selected model indexes
+	 * if it is dirty.
+	 **/
+	void updateSelectedItems();
+
+	/**
+	 * Add the items of all rows in 'range' to the selected items or (if
+	 * 'select' is 'false') remove them.
+	 **/
+	void addRange( const QItemSelectionRange & range, bool select );
+
+	/**
+	 * Return 'true' if 'range' covers all columns of its rows, i.e. if
+	 * its rows are completely deselected when it is deselected.
+	 **/
+	bool isCompleteRows( const QItemSelectionRange & range ) const;
+
+
 	// Data members
 
 	DirTreeModel	* _dirTreeModel;
@@ -218,8 +270,16 @@ namespace QDirStat
 	FileInfo	* _currentBranch;
 	FileInfoSet	  _selectedItems;
 	bool		  _selectedItemsDirty;
+	int		  _pseudoDirCount;	// selected dot entries and attics
+	int		  _pkgCount;		// selected PkgInfo items
 	bool		  _verbose;
 
+	// Paths in a subtree that is being replaced
+
+	QStringList	  _replacedSelection;
+	QString		  _replacedCurrent;
+	QString		  _replacedBranch;
+
     };	// class SelectionModel
 
 
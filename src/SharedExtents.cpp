@@ -0,0 +1,605 @@
+/*
+ *   File name: SharedExtents.cpp
+ *   Summary:	Disk usage with shared extents (reflinks, snapshots) for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include <QByteArray>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+
+#include "SharedExtents.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "DirReadJob.h"
+#include "FileInfoIterator.h"
+#include "Exception.h"
+
+#if HAVE_FIEMAP
+#  include <linux/fs.h>		// FS_IOC_FIEMAP
+#  include <linux/fiemap.h>
+#endif
+
+
+// Extents to get with one FIEMAP call
+#define FiemapBatchSize		256
+
+// Querying threads per CPU: Most of them are waiting for the disk
+#define ThreadsPerCpu		2
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Fill 'extents_ret' with the extents of the file at 'path'. Return
+     * 'false' if they can't be found, e.g. because the filesystem doesn't
+     * support FIEMAP, or if 'canceled' was set meanwhile.
+     *
+     * This only uses system calls, so it can be called from any thread.
+     **/
+    bool readExtents( const QString &	 path,
+		      const QAtomicInt & canceled,
+		      FileExtentList &	 extents_ret )
+    {
+#if HAVE_FIEMAP
+	int fd = ::open( path.toUtf8().constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW );
+
+	if ( fd < 0 )
+	    return false;
+
+	QByteArray buffer( sizeof( struct fiemap ) +
+			   FiemapBatchSize * sizeof( struct fiemap_extent ), 0 );
+	struct fiemap * map = (struct fiemap *) buffer.data();
+
+	FileExtentList extents;
+	quint64 start = 0;
+	bool	ok    = true;
+	bool	last  = false;
+
+	while ( ok && ! last )
+	{
+	    memset( buffer.data(), 0, buffer.size() );
+	    map->fm_start	 = start;
+	    map->fm_length	 = FIEMAP_MAX_OFFSET - start;
+	    map->fm_extent_count = FiemapBatchSize;
+
+	    if ( ioctl( fd, FS_IOC_FIEMAP, map ) < 0 )
+	    {
+		if ( errno != EINTR )
+		    ok = false;
+
+		continue;
+	    }
+
+	    if ( map->fm_mapped_extents == 0 )
+		break;
+
+	    for ( uint i = 0; i < map->fm_mapped_extents; ++i )
+	    {
+		const struct fiemap_extent & mapped = map->fm_extents[ i ];
+
+		// Extents without their own place on the disk can't be shared
+
+		const uint noPlace = FIEMAP_EXTENT_UNKNOWN     |
+				     FIEMAP_EXTENT_DATA_INLINE |
+				     FIEMAP_EXTENT_DATA_TAIL;
+
+		FileExtent extent;
+		extent.physical = ( mapped.fe_flags & noPlace ) ? 0 : mapped.fe_physical;
+		extent.length	= mapped.fe_length;
+		extent.shared	= ( mapped.fe_flags & FIEMAP_EXTENT_SHARED ) != 0;
+		extents << extent;
+
+		start = mapped.fe_logical + mapped.fe_length;
+
+		if ( mapped.fe_flags & FIEMAP_EXTENT_LAST )
+		    last = true;
+	    }
+
+	    if ( extents.size() > SHARED_EXTENTS_MAX_EXTENTS || canceled.loadAcquire() != 0 )
+		ok = false;
+	}
+
+	::close( fd );
+
+	if ( ok )
+	    extents_ret = extents;
+
+	return ok;
+#else
+	Q_UNUSED( path );
+	Q_UNUSED( canceled );
+	Q_UNUSED( extents_ret );
+
+	return false;
+#endif
+    }
+
+
+    /**
+     * Find the extents of 'candidate' from the ExtentCache or with
+     * FIEMAP.
+     **/
+    void findExtents( ExtentCandidate &	 candidate,
+		      const QAtomicInt & canceled,
+		      QAtomicInt &	 cacheHits )
+    {
+	struct stat statInfo;
+
+	if ( lstat( candidate.path.toUtf8().constData(), &statInfo ) != 0 ||
+	     ! S_ISREG( statInfo.st_mode ) )
+	{
+	    return;
+	}
+
+	ExtentCacheKey key;
+	key.device    = statInfo.st_dev;
+	key.inode     = statInfo.st_ino;
+	key.mtime     = statInfo.st_mtim.tv_sec;
+	key.mtimeNsec = statInfo.st_mtim.tv_nsec;
+
+	if ( ExtentCache::instance()->find( key, candidate.extents ) )
+	{
+	    candidate.ok = true;
+	    cacheHits.ref();
+	}
+	else if ( readExtents( candidate.path, canceled, candidate.extents ) )
+	{
+	    candidate.ok = true;
+	    ExtentCache::instance()->insert( key, candidate.extents );
+	}
+    }
+
+
+    /**
+     * One task of the thread pool of SharedExtentFinder::queryExtents().
+     **/
+    class ExtentTask: public QRunnable
+    {
+    public:
+
+	ExtentTask( ExtentCandidate *			candidates,
+		    int					count,
+		    const QHash<dev_t, QSemaphore *> &	deviceLimits,
+		    const QAtomicInt &			canceled,
+		    QAtomicInt &			next,
+		    QAtomicInt &			done,
+		    QAtomicInt &			cacheHits ):
+	    _candidates( candidates ),
+	    _count( count ),
+	    _deviceLimits( deviceLimits ),
+	    _canceled( canceled ),
+	    _next( next ),
+	    _done( done ),
+	    _cacheHits( cacheHits )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    int i;
+
+	    while ( _canceled.loadAcquire() == 0 &&
+		    ( i = _next.fetchAndAddRelaxed( 1 ) ) < _count )
+	    {
+		ExtentCandidate & candidate = _candidates[ i ];
+		QSemaphore * limit = _deviceLimits.value( candidate.device );
+
+		limit->acquire();
+		findExtents( candidate, _canceled, _cacheHits );
+		limit->release();
+
+		_done.ref();
+	    }
+	}
+
+    private:
+
+	ExtentCandidate *		     _candidates;
+	int				     _count;
+	const QHash<dev_t, QSemaphore *> &   _deviceLimits;
+	const QAtomicInt &		     _canceled;
+	QAtomicInt &			     _next;
+	QAtomicInt &			     _done;
+	QAtomicInt &			     _cacheHits;
+    };
+
+
+    /**
+     * A reference of a candidate to a range on the disk for the interval
+     * index of SharedExtentFinder::addUp().
+     **/
+    struct ExtentRef
+    {
+	quint64 start;
+	quint64 end;
+	int	candidate;
+	bool	shared;
+    };
+
+
+    bool startsBefore( const ExtentRef & a, const ExtentRef & b )
+    {
+	return a.start < b.start;
+    }
+
+}	// namespace
+
+
+
+ExtentCache * ExtentCache::_instance = 0;
+
+
+ExtentCache * ExtentCache::instance()
+{
+    if ( ! _instance )
+    {
+	_instance = new ExtentCache();
+	CHECK_NEW( _instance );
+    }
+
+    return _instance;
+}
+
+
+ExtentCache::ExtentCache():
+    _pass( 0 )
+{
+}
+
+
+bool ExtentCache::find( const ExtentCacheKey & key, FileExtentList & extents_ret )
+{
+    QMutexLocker locker( &_mutex );
+    QHash<ExtentCacheKey, Entry>::iterator it = _entries.find( key );
+
+    if ( it == _entries.end() )
+	return false;
+
+    it.value().lastPass = _pass;
+    extents_ret = it.value().extents;
+
+    return true;
+}
+
+
+void ExtentCache::insert( const ExtentCacheKey & key, const FileExtentList & extents )
+{
+    QMutexLocker locker( &_mutex );
+
+    Entry entry;
+    entry.extents  = extents;
+    entry.lastPass = _pass;
+    _entries.insert( key, entry );
+}
+
+
+void ExtentCache::startPass()
+{
+    QMutexLocker locker( &_mutex );
+    ++_pass;
+}
+
+
+void ExtentCache::prune()
+{
+    QMutexLocker locker( &_mutex );
+    QHash<ExtentCacheKey, Entry>::iterator it = _entries.begin();
+
+    while ( it != _entries.end() )
+    {
+	if ( _pass - it.value().lastPass >= SHARED_EXTENTS_CACHE_PASSES )
+	    it = _entries.erase( it );
+	else
+	    ++it;
+    }
+}
+
+
+void ExtentCache::clear()
+{
+    QMutexLocker locker( &_mutex );
+    _entries.clear();
+}
+
+
+
+
+SharedExtentFinder::SharedExtentFinder( FileInfo *   subtree,
+					QObject *    receiver,
+					const char * slot ):
+    _threads( qMax( 1, QThread::idealThreadCount() ) * ThreadsPerCpu ),
+    _tree( subtree ? subtree->tree() : 0 ),
+    _generation( _tree ? _tree->generation() : 0 ),
+    _receiver( receiver ),
+    _slot( slot ),
+    _done( 0 ),
+    _cacheHits( 0 ),
+    _canceled( 0 ),
+    _finished( 0 )
+{
+    ExtentCache::instance()->startPass();
+
+    if ( subtree && subtree->isDirInfo() )
+	collect( subtree );
+}
+
+
+SharedExtentFinder::~SharedExtentFinder()
+{
+    qDeleteAll( _deviceLimits );
+}
+
+
+bool SharedExtentFinder::isCurrent() const
+{
+    return _tree && _tree->generation() == _generation;
+}
+
+
+void SharedExtentFinder::collect( FileInfo * subtree )
+{
+    DirReadJobQueue * queue = _tree ? _tree->jobQueue() : 0;
+
+    QVector<ExtentDir> todo;
+    ExtentDir top = { subtree->toDirInfo(), -1, 0, 0, 0, 0, -1 };
+    todo << top;
+
+    while ( ! todo.isEmpty() )
+    {
+	ExtentDir dir = todo.takeLast();
+	dir.allocated = dir.dir->totalAllocatedSize();
+
+	int parent = _dirs.size();
+	_dirIndex.insert( dir.dir, parent );
+	_dirs << dir;
+
+	// The dot entry is just another directory here
+
+	FileInfoIterator it( dir.dir );
+
+	while ( *it )
+	{
+	    FileInfo * item = *it;
+
+	    if ( item->isDirInfo() )
+	    {
+		ExtentDir subDir = { item->toDirInfo(), parent, 0, 0, 0, 0, -1 };
+		todo << subDir;
+	    }
+	    else if ( item->isFile() && item->isLocalFile() && ! item->isHardLinkCopy() &&
+		      ! item->isAggregate() && item->allocatedSize() >= SHARED_EXTENTS_MIN_SIZE )
+	    {
+		ExtentCandidate candidate;
+		candidate.item	    = item;
+		candidate.path	    = item->path();
+		candidate.device    = item->device();
+		candidate.allocated = item->allocatedSize();
+		candidate.parent    = parent;
+		candidate.exclusive = 0;
+		candidate.shared    = 0;
+		candidate.ok	    = false;
+
+		if ( ! _deviceLimits.contains( candidate.device ) )
+		{
+		    int limit = queue ? queue->deviceConcurrency( item ) : _threads;
+		    limit = qBound( 1, limit, _threads );
+
+		    _deviceLimits.insert( candidate.device, new QSemaphore( limit ) );
+		}
+
+		_fileIndex.insert( item, _candidates.size() );
+		_candidates << candidate;
+	    }
+
+	    ++it;
+	}
+    }
+}
+
+
+void SharedExtentFinder::run()
+{
+    queryExtents();
+
+    if ( ! isCanceled() )
+	addUp();
+
+    ExtentCache::instance()->prune();
+    _finished.storeRelease( 1 );
+
+    // Nothing may touch this object after this
+
+    QMetaObject::invokeMethod( _receiver, _slot, Qt::QueuedConnection );
+}
+
+
+void SharedExtentFinder::queryExtents()
+{
+    if ( _candidates.isEmpty() )
+	return;
+
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount( _threads );
+    QAtomicInt next( 0 );
+
+    for ( int i=0; i < _threads; ++i )
+    {
+	threadPool.start( new ExtentTask( _candidates.data(), _candidates.size(), _deviceLimits,
+					  _canceled, next, _done, _cacheHits ) );
+    }
+
+    threadPool.waitForDone();
+}
+
+
+void SharedExtentFinder::addUp()
+{
+    // The interval index: All extents with a place on the disk, sorted by
+    // that place
+
+    QVector<ExtentRef> refs;
+
+    for ( int i = 0; i < _candidates.size(); ++i )
+    {
+	ExtentCandidate & candidate = _candidates[ i ];
+
+	if ( ! candidate.ok )
+	    continue;
+
+	foreach ( const FileExtent & extent, candidate.extents )
+	{
+	    if ( extent.physical == 0 || extent.length == 0 )
+	    {
+		candidate.exclusive += extent.length;
+	    }
+	    else
+	    {
+		ExtentRef ref = { extent.physical, extent.physical + extent.length, i, extent.shared };
+		refs << ref;
+	    }
+	}
+
+	candidate.extents.clear();	// It's in the cache and in 'refs'
+    }
+
+    std::sort( refs.begin(), refs.end(), startsBefore );
+
+
+    // Go through the disk in segments where the same extents overlap
+
+    QVector<ExtentRef> active;
+    quint64 pos	    = 0;
+    int	    next    = 0;
+    int	    segment = 0;
+
+    while ( next < refs.size() || ! active.isEmpty() )
+    {
+	if ( active.isEmpty() )
+	    pos = refs.at( next ).start;
+
+	while ( next < refs.size() && refs.at( next ).start == pos )
+	    active << refs.at( next++ );
+
+	quint64 end = next < refs.size() ? refs.at( next ).start : ~( (quint64) 0 );
+
+	foreach ( const ExtentRef & ref, active )
+	    end = qMin( end, ref.end );
+
+	FileSize length = end - pos;
+
+	if ( active.size() == 1 && ! active.first().shared )
+	{
+	    _candidates[ active.first().candidate ].exclusive += length;
+	}
+	else
+	{
+	    // Each candidate only once, even if it uses this more than once
+	    // itself
+
+	    ++segment;
+
+	    for ( int i = 0; i < active.size(); ++i )
+	    {
+		int  candidate = active.at( i ).candidate;
+		bool seen      = false;
+
+		for ( int j = 0; j < i && ! seen; ++j )
+		    seen = active.at( j ).candidate == candidate;
+
+		if ( ! seen )
+		{
+		    _candidates[ candidate ].shared += length;
+		    addSharedToDirs( candidate, segment, length );
+		}
+	    }
+	}
+
+	pos = end;
+
+	active.erase( std::remove_if( active.begin(), active.end(),
+				      [=]( const ExtentRef & ref ) { return ref.end == pos; } ),
+		      active.end() );
+    }
+
+
+    // The exclusive parts are simply added up
+
+    foreach ( const ExtentCandidate & candidate, _candidates )
+    {
+	if ( ! candidate.ok )
+	    continue;
+
+	for ( int i = candidate.parent; i >= 0; i = _dirs.at( i ).parent )
+	{
+	    _dirs[ i ].queriedAllocated += candidate.allocated;
+	    _dirs[ i ].exclusive	+= candidate.exclusive;
+	}
+    }
+}
+
+
+void SharedExtentFinder::addSharedToDirs( int candidate, int segment, FileSize length )
+{
+    // The ancestors of a directory that has this segment already have it,
+    // too
+
+    for ( int i = _candidates.at( candidate ).parent;
+	  i >= 0 && _dirs.at( i ).lastSegment != segment;
+	  i = _dirs.at( i ).parent )
+    {
+	_dirs[ i ].lastSegment = segment;
+	_dirs[ i ].shared     += length;
+    }
+}
+
+
+ExtentUsage SharedExtentFinder::usage( FileInfo * item ) const
+{
+    ExtentUsage result;
+
+    if ( ! item || ! isFinished() || isCanceled() )
+	return result;
+
+    if ( item->isDirInfo() )
+    {
+	int i = _dirIndex.value( item->toDirInfo(), -1 );
+
+	if ( i >= 0 )
+	{
+	    // The files without extents count with their allocated size
+
+	    const ExtentDir & dir = _dirs.at( i );
+	    result.exclusive = qMax( 0LL, dir.allocated - dir.queriedAllocated ) + dir.exclusive;
+	    result.shared    = dir.shared;
+	}
+    }
+    else
+    {
+	int i = _fileIndex.value( item, -1 );
+
+	if ( i >= 0 && _candidates.at( i ).ok )
+	{
+	    result.exclusive = _candidates.at( i ).exclusive;
+	    result.shared    = _candidates.at( i ).shared;
+	}
+    }
+
+    return result;
+}
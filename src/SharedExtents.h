@@ -0,0 +1,371 @@
+/*
+ *   File name: SharedExtents.h
+ *   Summary:	Disk usage with shared extents (reflinks, snapshots) for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef SharedExtents_h
+#define SharedExtents_h
+
+
+#include <sys/types.h>
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QRunnable>
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"
+
+
+#define HAVE_FIEMAP 0
+
+#if defined( __linux__ ) && defined( __has_include )
+#  if __has_include( <linux/fiemap.h> )
+#    undef  HAVE_FIEMAP
+#    define HAVE_FIEMAP 1
+#  endif
+#endif
+
+// Smaller files are not queried; they count as exclusive
+#define SHARED_EXTENTS_MIN_SIZE		( 1024 * 1024 )
+
+// Files with more extents than this count as exclusive
+#define SHARED_EXTENTS_MAX_EXTENTS	( 64 * 1024 )
+
+// Cache entries that were not used in that many passes are dropped
+#define SHARED_EXTENTS_CACHE_PASSES	8
+
+
+class QObject;
+class QSemaphore;
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+    /**
+     * The disk usage of a file or a subtree by the extents that it
+     * references: 'exclusive' is only used by this file (or subtree),
+     * 'shared' is also used by other files, e.g. reflinked copies or
+     * snapshots. For subtrees, extents that several of its files share are
+     * only counted once, so exclusive + shared is what the subtree really
+     * uses on the disk.
+     **/
+    struct ExtentUsage
+    {
+	ExtentUsage():
+	    exclusive( -1 ),
+	    shared( -1 )
+	    {}
+
+	bool isValid() const { return exclusive >= 0; }
+
+	FileSize exclusive;
+	FileSize shared;
+    };
+
+
+    /**
+     * One extent of a file on the disk as reported by FIEMAP.
+     **/
+    struct FileExtent
+    {
+	quint64 physical;	// 0 if it has no known place on the disk
+	quint64 length;
+	bool	shared;		// the filesystem knows that others use it, too
+    };
+
+    typedef QVector<FileExtent> FileExtentList;
+
+
+    /**
+     * The identity of a file version for the ExtentCache.
+     **/
+    struct ExtentCacheKey
+    {
+	dev_t	device;
+	ino_t	inode;
+	time_t	mtime;
+	long	mtimeNsec;
+
+	bool operator==( const ExtentCacheKey & other ) const
+	{
+	    return inode     == other.inode  &&
+		   device    == other.device &&
+		   mtime     == other.mtime  &&
+		   mtimeNsec == other.mtimeNsec;
+	}
+    };
+
+
+    inline uint qHash( const ExtentCacheKey & key, uint seed = 0 )
+    {
+	return qHash( (quint64) key.inode, seed ) ^
+	    qHash( (quint64) key.device ) ^
+	    qHash( (quint64) key.mtime );
+    }
+
+
+    /**
+     * Cache for the extents of files by device, inode number and mtime,
+     * so repeated passes of SharedExtentFinder only query the files that
+     * changed. It is shared by all trees.
+     *
+     * Entries that were not used in the last SHARED_EXTENTS_CACHE_PASSES
+     * passes are dropped at the end of a pass.
+     *
+     * Notice that a new snapshot of a file does not change the file's
+     * mtime, so the 'shared' flags of a cached file can be out of date;
+     * sharing within the scanned files is still found because that only
+     * depends on the extents' places on the disk.
+     *
+     * This can be used from any thread.
+     **/
+    class ExtentCache
+    {
+    public:
+
+	/**
+	 * Return the singleton instance of this class.
+	 **/
+	static ExtentCache * instance();
+
+	/**
+	 * Fill 'extents_ret' with the extents of the file version 'key'.
+	 * Return 'false' if they are not in the cache.
+	 **/
+	bool find( const ExtentCacheKey & key, FileExtentList & extents_ret );
+
+	/**
+	 * Add the extents of file version 'key' to the cache.
+	 **/
+	void insert( const ExtentCacheKey & key, const FileExtentList & extents );
+
+	/**
+	 * Notification that a pass starts.
+	 **/
+	void startPass();
+
+	/**
+	 * Drop the entries that were not used for a while.
+	 **/
+	void prune();
+
+	/**
+	 * Remove everything from the cache.
+	 **/
+	void clear();
+
+
+    protected:
+
+	/**
+	 * Constructor. Use instance() instead.
+	 **/
+	ExtentCache();
+
+	struct Entry
+	{
+	    FileExtentList extents;
+	    int		   lastPass;
+	};
+
+
+	// Data members
+
+	static ExtentCache *		   _instance;
+
+	QMutex				   _mutex;
+	QHash<ExtentCacheKey, Entry>	   _entries;
+	int				   _pass;
+    };
+
+
+    /**
+     * A file of SharedExtentFinder.
+     **/
+    struct ExtentCandidate
+    {
+	FileInfo *     item;		// only for use on the main thread
+	QString	       path;
+	dev_t	       device;
+	FileSize       allocated;
+	int	       parent;		// in the dirs
+	FileExtentList extents;
+	FileSize       exclusive;
+	FileSize       shared;
+	bool	       ok;
+    };
+
+
+    /**
+     * A directory of SharedExtentFinder.
+     **/
+    struct ExtentDir
+    {
+	DirInfo * dir;			// only for use on the main thread
+	int	  parent;		// in the dirs, -1 for the top
+	FileSize  allocated;		// totalAllocatedSize()
+	FileSize  queriedAllocated;	// of the files with extents
+	FileSize  exclusive;		// of the files with extents
+	FileSize  shared;
+	int	  lastSegment;
+    };
+
+
+    /**
+     * Finding out how much of the allocated size of a subtree is really
+     * its own on filesystems with shared extents like Btrfs or XFS with
+     * reflinks: Because of reflinked copies and snapshots, the
+     * allocated size from the number of blocks can be much more than what
+     * the subtree really uses.
+     *
+     * The extents of the files of at least SHARED_EXTENTS_MIN_SIZE are
+     * queried with the FIEMAP ioctl in a thread pool in the background,
+     * unless they are in the ExtentCache. The reads on a device are
+     * limited to the concurrency that the DirReadJobQueue allows for it.
+     *
+     * The extents of all files are then sorted by their place on the disk
+     * (an interval index), so parts that several files use are found and
+     * counted only once for each directory; the filesystem's 'shared'
+     * flag also counts, for sharing with files outside of the subtree.
+     * Smaller files and files whose extents could not be found count as
+     * exclusive with their allocated size.
+     *
+     * FIEMAP reports the logical length of an extent, so compressed
+     * extents count with their uncompressed size.
+     *
+     * When it is done, this invokes method 'slot' of 'receiver' with a
+     * queued connection, and it does not touch anything after that, so the
+     * receiver can delete it right away. Use it with autoDelete() off.
+     **/
+    class SharedExtentFinder: public QRunnable
+    {
+    public:
+
+	/**
+	 * Constructor: Collect the files of 'subtree'. This must be called
+	 * on the main thread.
+	 **/
+	SharedExtentFinder( FileInfo *	 subtree,
+			    QObject *	 receiver,
+			    const char * slot );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~SharedExtentFinder();
+
+	/**
+	 * Return 'true' if the extents of files can be queried at all on
+	 * this system.
+	 **/
+	static bool isSupported() { return HAVE_FIEMAP; }
+
+	/**
+	 * Query the extents and add them up. Reimplemented from QRunnable.
+	 **/
+	virtual void run() Q_DECL_OVERRIDE;
+
+	/**
+	 * Stop as soon as possible. This can be called from any thread.
+	 **/
+	void cancel() { _canceled.storeRelease( 1 ); }
+
+	/**
+	 * Return 'true' if cancel() was called.
+	 **/
+	bool isCanceled() const { return _canceled.loadAcquire() != 0; }
+
+	/**
+	 * Return 'true' if finding is done.
+	 **/
+	bool isFinished() const { return _finished.loadAcquire() != 0; }
+
+	/**
+	 * Return how many of the files are done so far and how many there
+	 * are. This can be called from any thread.
+	 **/
+	int done() const { return _done.loadAcquire(); }
+	int todo() const { return _candidates.size(); }
+
+	/**
+	 * Return the number of files whose extents came from the cache.
+	 * Only use this when finding is done.
+	 **/
+	int cacheHits() const { return _cacheHits.loadAcquire(); }
+
+	/**
+	 * Return 'true' if the tree did not change since the files were
+	 * collected, so the results still apply. This must be called on the
+	 * main thread.
+	 **/
+	bool isCurrent() const;
+
+	/**
+	 * Return the usage of 'item', a file or a directory of the subtree.
+	 * The result is invalid for files that were too small to be queried
+	 * and if finding is not done or was canceled. This must be called on
+	 * the main thread.
+	 **/
+	ExtentUsage usage( FileInfo * item ) const;
+
+
+    protected:
+
+	/**
+	 * Collect the directories and the large files of 'subtree'.
+	 **/
+	void collect( FileInfo * subtree );
+
+	/**
+	 * Find the extents of all candidates, from the cache or with FIEMAP.
+	 **/
+	void queryExtents();
+
+	/**
+	 * Sort the extents of all candidates by their place on the disk and
+	 * add up the exclusive and the shared parts for the candidates and
+	 * their directories.
+	 **/
+	void addUp();
+
+	/**
+	 * Add 'length' shared bytes that candidate 'candidate' uses to all
+	 * its directories that did not count that segment yet.
+	 **/
+	void addSharedToDirs( int candidate, int segment, FileSize length );
+
+
+	//
+	// Data members
+	//
+
+	QVector<ExtentCandidate>   _candidates;
+	QVector<ExtentDir>	   _dirs;
+	QHash<FileInfo *, int>	   _fileIndex;
+	QHash<DirInfo *, int>	   _dirIndex;
+	QHash<dev_t, QSemaphore *> _deviceLimits;
+	int			   _threads;
+	DirTree *		   _tree;
+	quint64			   _generation;
+	QObject *		   _receiver;
+	const char *		   _slot;
+	QAtomicInt		   _done;
+	QAtomicInt		   _cacheHits;
+	QAtomicInt		   _canceled;
+	QAtomicInt		   _finished;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef SharedExtents_h
@@ -0,0 +1,79 @@
+/*
+ *   File name: SizeHistogram.cpp
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include "SizeHistogram.h"
+#include "QuantileSketch.h"
+
+
+using namespace QDirStat;
+
+
+void SizeHistogram::clear()
+{
+    for ( int i=0; i < SizeHistogramBuckets; ++i )
+    {
+	_counts[ i ] = 0;
+	_sums  [ i ] = 0LL;
+    }
+}
+
+
+int SizeHistogram::bucket( FileSize size )
+{
+    int i = 0;
+
+    while ( size > 0 && i < SizeHistogramBuckets - 1 )
+    {
+	size >>= 1;
+	++i;
+    }
+
+    return i;
+}
+
+
+void SizeHistogram::add( const SizeHistogram & other )
+{
+    for ( int i=0; i < SizeHistogramBuckets; ++i )
+    {
+	_counts[ i ] += other._counts[ i ];
+	_sums  [ i ] += other._sums  [ i ];
+    }
+}
+
+
+void SizeHistogram::subtract( const SizeHistogram & other )
+{
+    for ( int i=0; i < SizeHistogramBuckets; ++i )
+    {
+	_counts[ i ] -= other._counts[ i ];
+	_sums  [ i ] -= other._sums  [ i ];
+    }
+}
+
+
+int SizeHistogram::totalCount() const
+{
+    int total = 0;
+
+    for ( int i=0; i < SizeHistogramBuckets; ++i )
+	total += _counts[ i ];
+
+    return total;
+}
+
+
+void SizeHistogram::addTo( QuantileSketch & sketch ) const
+{
+    for ( int i=0; i < SizeHistogramBuckets; ++i )
+    {
+	if ( _counts[ i ] > 0 )
+	    sketch.add( (qreal) _sums[ i ] / _counts[ i ], _counts[ i ] );
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ *   File name: SizeHistogram.h
+ *   Summary:	Support classes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef SizeHistogram_h
+#define SizeHistogram_h
+
+
+#include "FileInfo.h"	// FileSize
+
+
+// Bucket 0 is for empty files, the last one for 256 GB and more
+#define SizeHistogramBuckets	40
+
+
+namespace QDirStat
+{
+    class QuantileSketch;
+
+    /**
+     * Number and total size of files by the order of magnitude of their
+     * size: Bucket 0 is for empty files, bucket i for files from 2^(i-1) to
+     * 2^i - 1 bytes, and the last bucket for everything bigger.
+     *
+     * Each DirInfo keeps one of those for all the files in its subtree and
+     * updates it along with its other totals, so a rough size distribution
+     * of any subtree is available at once without walking it.
+     **/
+    class SizeHistogram
+    {
+    public:
+
+	/**
+	 * Constructor for an empty histogram.
+	 **/
+	SizeHistogram() { clear(); }
+
+	/**
+	 * Remove all files.
+	 **/
+	void clear();
+
+	/**
+	 * Return the bucket for a file with 'size'.
+	 **/
+	static int bucket( FileSize size );
+
+	/**
+	 * Add or remove one file with 'size'.
+	 **/
+	void add( FileSize size )
+	    { int i = bucket( size ); _counts[ i ]++; _sums[ i ] += size; }
+
+	void subtract( FileSize size )
+	    { int i = bucket( size ); _counts[ i ]--; _sums[ i ] -= size; }
+
+	/**
+	 * Add or remove all files of 'other'.
+	 **/
+	void add( const SizeHistogram & other );
+	void subtract( const SizeHistogram & other );
+
+	/**
+	 * Return the number of files or their total size in 'bucket'.
+	 **/
+	int	 count( int bucket ) const { return _counts[ bucket ]; }
+	FileSize sum  ( int bucket ) const { return _sums  [ bucket ]; }
+
+	/**
+	 * Return the number of files in all buckets.
+	 **/
+	int totalCount() const;
+
+	/**
+	 * Add the files to 'sketch', each bucket with its average size.
+	 **/
+	void addTo( QuantileSketch & sketch ) const;
+
+
+    protected:
+
+	int	 _counts[ SizeHistogramBuckets ];
+	FileSize _sums	[ SizeHistogramBuckets ];
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef SizeHistogram_h
@@ -0,0 +1,541 @@
+/*
+ *   File name: SizeHistory.cpp
+ *   Summary:	Compact history of directory totals across scans
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include "SizeHistory.h"
+#include "DirInfo.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+#define HISTORY_FILE_MAGIC	0x51445348	// "QDSH"
+#define HISTORY_FILE_VERSION	1
+
+// Number of different sparkline levels (U+2581 .. U+2588)
+#define SPARKLINE_LEVELS	8
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Append 'value' to 'data' with 7 bits per byte, least significant
+     * first; the high bit of a byte is set if more bytes follow.
+     **/
+    void appendVarint( QByteArray & data, quint64 value )
+    {
+	while ( value >= 0x80 )
+	{
+	    data.append( (char) ( ( value & 0x7f ) | 0x80 ) );
+	    value >>= 7;
+	}
+
+	data.append( (char) value );
+    }
+
+
+    /**
+     * Read a value that appendVarint() wrote from 'pos', which is advanced
+     * past it. Return 'false' if there are not enough bytes before 'end'.
+     **/
+    bool readVarint( const char *& pos, const char * end, quint64 & value_ret )
+    {
+	value_ret = 0;
+
+	for ( int shift = 0; pos < end && shift < 64; shift += 7 )
+	{
+	    quint8 byte = (quint8) *pos++;
+	    value_ret |= (quint64) ( byte & 0x7f ) << shift;
+
+	    if ( ! ( byte & 0x80 ) )
+		return true;
+	}
+
+	return false;
+    }
+
+
+    /**
+     * Map signed values to unsigned ones so small negative values also
+     * get small: 0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ...
+     **/
+    quint64 zigzag( qint64 value )
+    {
+	return ( (quint64) value << 1 ) ^ (quint64) ( value >> 63 );
+    }
+
+
+    qint64 unzigzag( quint64 value )
+    {
+	return (qint64) ( value >> 1 ) ^ -( (qint64) ( value & 1 ) );
+    }
+
+
+    qint64 sizeUnits( FileSize size )
+    {
+	return ( size + SIZE_HISTORY_SIZE_UNIT / 2 ) / SIZE_HISTORY_SIZE_UNIT;
+    }
+
+}	// namespace
+
+
+
+SizeHistory::SizeHistory():
+    _maxScans( SIZE_HISTORY_DEFAULT_MAX_SCANS )
+{
+}
+
+
+quint64 SizeHistory::pathHash( const QString & path )
+{
+    // 64 bit FNV-1a: Stable across program runs and platforms, unlike
+    // qHash(), and with 64 bits, collisions are unlikely even for
+    // millions of directories.
+
+    QByteArray utf8 = path.toUtf8();
+    quint64 hash = 14695981039346656037ULL;
+
+    for ( int i=0; i < utf8.size(); ++i )
+    {
+	hash ^= (quint8) utf8.at( i );
+	hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+void SizeHistory::collect( DirInfo * dir, const QString & path, TotalsList & totals )
+{
+    quint64 hash = pathHash( path );
+    QHash<quint64, int>::const_iterator it = _index.constFind( hash );
+    int index;
+
+    if ( it != _index.constEnd() )
+    {
+	index = it.value();
+    }
+    else
+    {
+	index = _hashes.size();
+	_hashes << hash;
+	_index.insert( hash, index );
+	totals.resize( _hashes.size() );
+    }
+
+    Totals & dirTotals	 = totals[ index ];
+    dirTotals.size	 = sizeUnits( dir->totalSize() );
+    dirTotals.allocated	 = sizeUnits( dir->totalAllocatedSize() );
+    dirTotals.items	 = dir->totalItems();
+
+    QString prefix = path == "/" ? "" : path;
+
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+    {
+	if ( child->isDirInfo() && ! child->isPseudoDir() )
+	    collect( child->toDirInfo(), prefix + "/" + child->name(), totals );
+    }
+}
+
+
+QByteArray SizeHistory::encode( const TotalsList & oldTotals, const TotalsList & newTotals )
+{
+    QByteArray data;
+    int next = 0;	// The index after the last changed directory
+
+    for ( int i=0; i < newTotals.size(); ++i )
+    {
+	const Totals & newDir = newTotals.at( i );
+	Totals oldDir = i < oldTotals.size() ? oldTotals.at( i ) : Totals();
+
+	if ( newDir == oldDir )
+	    continue;
+
+	appendVarint( data, i - next );
+	appendVarint( data, zigzag( newDir.size	     - oldDir.size	) );
+	appendVarint( data, zigzag( newDir.allocated - oldDir.allocated ) );
+	appendVarint( data, zigzag( newDir.items     - oldDir.items	) );
+	next = i + 1;
+    }
+
+    return data;
+}
+
+
+bool SizeHistory::apply( const Scan & scan, TotalsList & totals, QVector<int> * changed_ret ) const
+{
+    const char * pos = scan.data.constData();
+    const char * end = pos + scan.data.size();
+    quint64 next = 0;
+
+    while ( pos < end )
+    {
+	quint64 gap, size, allocated, items;
+
+	if ( ! readVarint( pos, end, gap	) ||
+	     ! readVarint( pos, end, size	) ||
+	     ! readVarint( pos, end, allocated ) ||
+	     ! readVarint( pos, end, items	) )
+	{
+	    return false;
+	}
+
+	quint64 index = next + gap;
+
+	if ( index >= (quint64) totals.size() )
+	    return false;
+
+	Totals & dirTotals     = totals[ index ];
+	dirTotals.size	      += unzigzag( size	     );
+	dirTotals.allocated   += unzigzag( allocated );
+	dirTotals.items	      += unzigzag( items     );
+	next = index + 1;
+
+	if ( changed_ret )
+	    *changed_ret << (int) index;
+    }
+
+    return true;
+}
+
+
+void SizeHistory::addScan( DirInfo * subtree, time_t scanTime )
+{
+    if ( ! subtree )
+	return;
+
+    TotalsList totals( _hashes.size() );
+    collect( subtree, subtree->url(), totals );
+    _latest.resize( _hashes.size() );
+
+    Scan scan;
+    scan.time = scanTime;
+    scan.data = encode( _latest, totals );
+
+    _scans << scan;
+    _latest = totals;
+
+    logInfo() << "Added scan of " << subtree << " with " << scan.data.size()
+	      << " bytes; " << _hashes.size() << " dirs in " << _scans.size() << " scans" << endl;
+
+    dropOldScans();
+    updateTrends();
+}
+
+
+void SizeHistory::dropOldScans()
+{
+    if ( _scans.size() <= _maxScans )
+	return;
+
+    // Merge the scans to drop into the first one that is kept: That one
+    // then has the absolute totals, i.e. the differences to zero.
+
+    int drop = _scans.size() - _maxScans;
+    TotalsList totals( _hashes.size() );
+
+    for ( int i=0; i <= drop; ++i )
+	apply( _scans.at( i ), totals );
+
+    _scans[ drop ].data = encode( TotalsList(), totals );
+    _scans.remove( 0, drop );
+
+
+    // Directories that are not mentioned in any scan any more are always
+    // zero, i.e. they are gone: Remove them and renumber the others.
+
+    QVector<int> used;
+    TotalsList	 scratch( _hashes.size() );
+    QVector<int> newIndex( _hashes.size(), -1 );
+
+    for ( int i=0; i < _scans.size(); ++i )
+	apply( _scans.at( i ), scratch, &used );
+
+    foreach ( int index, used )
+	newIndex[ index ] = 0;
+
+    QVector<quint64> hashes;
+
+    for ( int i=0; i < _hashes.size(); ++i )
+    {
+	if ( newIndex.at( i ) >= 0 )
+	{
+	    newIndex[ i ] = hashes.size();
+	    hashes << _hashes.at( i );
+	}
+    }
+
+    if ( hashes.size() == _hashes.size() )
+	return;
+
+    logInfo() << "Removing " << _hashes.size() - hashes.size() << " old dirs from the history" << endl;
+
+    TotalsList oldTotals( _hashes.size() );
+    TotalsList oldRenumbered;
+
+    for ( int i=0; i < _scans.size(); ++i )
+    {
+	TotalsList newTotals = oldTotals;
+	apply( _scans.at( i ), newTotals );
+
+	TotalsList renumbered( hashes.size() );
+
+	for ( int j=0; j < newTotals.size(); ++j )
+	{
+	    if ( newIndex.at( j ) >= 0 )
+		renumbered[ newIndex.at( j ) ] = newTotals.at( j );
+	}
+
+	_scans[ i ].data = encode( oldRenumbered, renumbered );
+	oldTotals     = newTotals;
+	oldRenumbered = renumbered;
+    }
+
+    _hashes = hashes;
+    _latest = oldRenumbered;
+    _index.clear();
+
+    for ( int i=0; i < _hashes.size(); ++i )
+	_index.insert( _hashes.at( i ), i );
+}
+
+
+void SizeHistory::updateTrends()
+{
+    _trends.clear();
+
+    if ( _scans.isEmpty() )
+	return;
+
+    // Find the directories that changed at all and their range: Each scan
+    // after the first one only mentions the directories that changed.
+
+    TotalsList	   totals( _hashes.size() );
+    QVector<int>   changed;
+    apply( _scans.first(), totals );
+
+    QVector<qint64> minSize( totals.size() );
+    QVector<qint64> maxSize( totals.size() );
+
+    for ( int i=0; i < totals.size(); ++i )
+	minSize[ i ] = maxSize[ i ] = totals.at( i ).size;
+
+    for ( int scan = 1; scan < _scans.size(); ++scan )
+    {
+	QVector<int> scanChanged;
+	apply( _scans.at( scan ), totals, &scanChanged );
+
+	foreach ( int index, scanChanged )
+	{
+	    qint64 size = totals.at( index ).size;
+
+	    if ( size < minSize.at( index ) || size > maxSize.at( index ) )
+	    {
+		if ( minSize.at( index ) == maxSize.at( index ) )
+		    changed << index;
+
+		minSize[ index ] = qMin( minSize.at( index ), size );
+		maxSize[ index ] = qMax( maxSize.at( index ), size );
+	    }
+	}
+    }
+
+    if ( changed.isEmpty() )
+	return;
+
+
+    // Go through the scans again to get the sparkline levels of those
+
+    foreach ( int index, changed )
+    {
+	Trend trend;
+	trend.levels.reserve( _scans.size() );
+	_trends.insert( index, trend );
+    }
+
+    totals.fill( Totals() );
+
+    for ( int scan = 0; scan < _scans.size(); ++scan )
+    {
+	apply( _scans.at( scan ), totals );
+
+	foreach ( int index, changed )
+	{
+	    qint64 size	 = totals.at( index ).size;
+	    qint64 range = maxSize.at( index ) - minSize.at( index );
+	    Trend & trend = _trends[ index ];
+
+	    if ( scan == 0 )
+		trend.first = size;
+
+	    trend.last = size;
+	    trend.levels.append( (char) ( ( size - minSize.at( index ) ) * ( SPARKLINE_LEVELS - 1 ) / range ) );
+	}
+    }
+}
+
+
+SizeTrend SizeHistory::trend( const QString & url ) const
+{
+    SizeTrend result;
+    QHash<quint64, int>::const_iterator it = _index.constFind( pathHash( url ) );
+
+    if ( it == _index.constEnd() )
+	return result;
+
+    result.known = true;
+    QHash<int, Trend>::const_iterator trendIt = _trends.constFind( it.value() );
+
+    if ( trendIt != _trends.constEnd() )
+    {
+	const Trend & trend = trendIt.value();
+	result.growth = ( trend.last - trend.first ) * SIZE_HISTORY_SIZE_UNIT;
+
+	for ( int i=0; i < trend.levels.size(); ++i )
+	    result.sparkline += QChar( 0x2581 + trend.levels.at( i ) );
+    }
+
+    return result;
+}
+
+
+bool SizeHistory::save( const QString & fileName ) const
+{
+    // Write to a temporary file first so a crash can't leave a truncated
+    // history file behind
+
+    QString tmpName = fileName + ".new";
+    QFile   file( tmpName );
+
+    if ( ! file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+	logError() << "Can't open " << tmpName << ": " << file.errorString() << endl;
+	return false;
+    }
+
+    QDataStream out( &file );
+    out.setVersion( QDataStream::Qt_4_6 );
+
+    out << (quint32) HISTORY_FILE_MAGIC << (quint32) HISTORY_FILE_VERSION;
+    out << _hashes << (qint32) _scans.size();
+
+    foreach ( const Scan & scan, _scans )
+	out << scan.time << scan.data;
+
+    file.close();
+
+    if ( out.status() != QDataStream::Ok || file.error() != QFile::NoError )
+    {
+	logError() << "Error writing " << tmpName << endl;
+	QFile::remove( tmpName );
+
+	return false;
+    }
+
+    QFile::remove( fileName );
+
+    if ( ! QFile::rename( tmpName, fileName ) )
+    {
+	logError() << "Can't rename " << tmpName << " to " << fileName << endl;
+	QFile::remove( tmpName );
+
+	return false;
+    }
+
+    logInfo() << "Saved size history with " << _scans.size() << " scans of "
+	      << _hashes.size() << " dirs to " << fileName << endl;
+
+    return true;
+}
+
+
+bool SizeHistory::load( const QString & fileName )
+{
+    QFile file( fileName );
+
+    if ( ! file.open( QIODevice::ReadOnly ) )
+    {
+	logError() << "Can't open " << fileName << ": " << file.errorString() << endl;
+	return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QDataStream in( &file );
+    in.setVersion( QDataStream::Qt_4_6 );
+
+    quint32 magic   = 0;
+    quint32 version = 0;
+
+    in >> magic >> version;
+
+    if ( magic != HISTORY_FILE_MAGIC || version != HISTORY_FILE_VERSION )
+    {
+	logError() << fileName << " is not a size history file" << endl;
+	return false;
+    }
+
+    QVector<quint64> hashes;
+    qint32 scanCount = 0;
+
+    in >> hashes >> scanCount;
+
+    QVector<Scan> scans;
+
+    for ( int i=0; i < scanCount && in.status() == QDataStream::Ok; ++i )
+    {
+	Scan scan;
+	in >> scan.time >> scan.data;
+	scans << scan;
+    }
+
+    if ( in.status() != QDataStream::Ok || scans.size() != scanCount )
+    {
+	logError() << "Error reading " << fileName << endl;
+	return false;
+    }
+
+    _hashes = hashes;
+    _scans  = scans;
+    _index.clear();
+
+    for ( int i=0; i < _hashes.size(); ++i )
+	_index.insert( _hashes.at( i ), i );
+
+    _latest = TotalsList( _hashes.size() );
+
+    foreach ( const Scan & scan, _scans )
+    {
+	if ( ! apply( scan, _latest ) )
+	{
+	    logError() << "Corrupt scan data in " << fileName << endl;
+
+	    int maxScans = _maxScans;
+	    *this = SizeHistory();
+	    _maxScans = maxScans;
+
+	    return false;
+	}
+    }
+
+    _fileName = fileName;
+    updateTrends();
+
+    logInfo() << "Loaded " << fileName << " with " << _scans.size() << " scans of "
+	      << _hashes.size() << " dirs (" << _trends.size() << " changed) in "
+	      << timer.elapsed() / 1000.0 << " sec" << endl;
+
+    return true;
+}
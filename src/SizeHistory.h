@@ -0,0 +1,224 @@
+/*
+ *   File name: SizeHistory.h
+ *   Summary:	Compact history of directory totals across scans
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef SizeHistory_h
+#define SizeHistory_h
+
+
+#include <time.h>
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"
+
+
+// Number of scans that are kept by default; older ones are dropped
+#define SIZE_HISTORY_DEFAULT_MAX_SCANS	30
+
+// Sizes are stored in units of this many bytes
+#define SIZE_HISTORY_SIZE_UNIT		1024
+
+
+namespace QDirStat
+{
+    class DirInfo;
+
+
+    /**
+     * The trend of one directory in a SizeHistory.
+     **/
+    struct SizeTrend
+    {
+	SizeTrend(): known( false ), growth( 0 ) {}
+
+	bool	 known;		// The directory is in the history
+	FileSize growth;	// Total size now minus in the oldest scan
+	QString	 sparkline;	// One block character per scan; empty if unchanged
+    };
+
+
+    /**
+     * The total size, allocated size and number of items of each directory
+     * for the last few scans (the nightly scans of a host, for example), to
+     * find out which directories grow and how fast.
+     *
+     * This is meant to be small enough to keep many scans of many hosts:
+     *
+     * - Directories are identified by a 64 bit hash of their path. Each
+     *   path hash is stored only once for all scans.
+     *
+     * - Each scan only stores the directories that changed since the
+     *   previous one: The gap to the previous changed directory and the
+     *   differences of the three totals, each as a variable-length integer
+     *   (zigzag-encoded, 7 bits per byte). Sizes are stored in units of
+     *   SIZE_HISTORY_SIZE_UNIT bytes. The oldest scan is stored against
+     *   zero, i.e. with the absolute totals. So an unchanged directory
+     *   costs nothing per scan, a changed one a few bytes.
+     *
+     * - When there are more than maxScans() scans, the oldest ones are
+     *   merged into the next one, and directories that no longer exist in
+     *   any scan are removed.
+     *
+     * The trends (see trend()) are calculated once when the history is
+     * loaded or changed; after that, this can be used by several threads at
+     * the same time as long as it is not changed.
+     **/
+    class SizeHistory
+    {
+    public:
+
+	/**
+	 * Constructor: An empty history.
+	 **/
+	SizeHistory();
+
+	/**
+	 * Read the history from file 'fileName'. Return 'true' on success.
+	 **/
+	bool load( const QString & fileName );
+
+	/**
+	 * Write the history to file 'fileName'. Return 'true' on success.
+	 **/
+	bool save( const QString & fileName ) const;
+
+	/**
+	 * Add the totals of all directories of 'subtree' as a new scan that
+	 * was done at 'scanTime'.
+	 **/
+	void addScan( DirInfo * subtree, time_t scanTime );
+
+	/**
+	 * Return the trend of the directory with path 'url'.
+	 **/
+	SizeTrend trend( const QString & url ) const;
+
+	/**
+	 * Return the number of scans.
+	 **/
+	int scanCount() const { return _scans.size(); }
+
+	/**
+	 * Return the time of scan no. 'scan' (0 is the oldest one).
+	 **/
+	time_t scanTime( int scan ) const { return (time_t) _scans.at( scan ).time; }
+
+	/**
+	 * Return the number of different directories in all scans.
+	 **/
+	int dirCount() const { return _hashes.size(); }
+
+	/**
+	 * Return the name of the file this was loaded from.
+	 **/
+	const QString & fileName() const { return _fileName; }
+
+	/**
+	 * Return the maximum number of scans to keep.
+	 **/
+	int maxScans() const { return _maxScans; }
+
+	/**
+	 * Set the maximum number of scans to keep. This takes effect with the
+	 * next addScan().
+	 **/
+	void setMaxScans( int maxScans ) { _maxScans = qMax( 1, maxScans ); }
+
+	/**
+	 * Return the hash of 'path' that identifies a directory.
+	 **/
+	static quint64 pathHash( const QString & path );
+
+
+    protected:
+
+	/**
+	 * The totals of one directory in one scan. The sizes are in units of
+	 * SIZE_HISTORY_SIZE_UNIT.
+	 **/
+	struct Totals
+	{
+	    Totals(): size( 0 ), allocated( 0 ), items( 0 ) {}
+
+	    bool operator==( const Totals & other ) const
+		{ return size == other.size && allocated == other.allocated && items == other.items; }
+
+	    qint64 size;
+	    qint64 allocated;
+	    qint64 items;
+	};
+
+	typedef QVector<Totals> TotalsList;
+
+	struct Scan
+	{
+	    qint64     time;
+	    QByteArray data;	// The encoded differences to the previous scan
+	};
+
+	/**
+	 * Summary of one changed directory for trend().
+	 **/
+	struct Trend
+	{
+	    qint64     first;	// Size in the oldest scan
+	    qint64     last;	// Size in the newest scan
+	    QByteArray levels;	// 0..7 for each scan
+	};
+
+	/**
+	 * Add the totals of 'dir' and its subdirectories with path 'path' to
+	 * 'totals', adding new directories to the path hashes as needed.
+	 **/
+	void collect( DirInfo * dir, const QString & path, TotalsList & totals );
+
+	/**
+	 * Return the encoded differences from 'oldTotals' to 'newTotals'.
+	 **/
+	static QByteArray encode( const TotalsList & oldTotals, const TotalsList & newTotals );
+
+	/**
+	 * Apply the differences of 'scan' to 'totals'. For each changed
+	 * directory, its index is added to 'changed_ret' if that is
+	 * non-null. Return 'false' if the data are corrupt.
+	 **/
+	bool apply( const Scan & scan, TotalsList & totals, QVector<int> * changed_ret = 0 ) const;
+
+	/**
+	 * Merge the oldest scans into the next one until there are at most
+	 * maxScans() scans, then remove the directories that don't exist in
+	 * any scan.
+	 **/
+	void dropOldScans();
+
+	/**
+	 * Calculate the trends of all directories from the scans.
+	 **/
+	void updateTrends();
+
+
+	// Data members
+
+	QString			_fileName;
+	int			_maxScans;
+	QVector<quint64>	_hashes;	// Path hash of each directory
+	QHash<quint64, int>	_index;		// Path hash -> position in _hashes
+	QVector<Scan>		_scans;		// Oldest first
+	TotalsList		_latest;	// Totals after the newest scan
+	QHash<int, Trend>	_trends;	// Only the directories that changed
+
+    };	// class SizeHistory
+
+}	// namespace QDirStat
+
+
+#endif	// SizeHistory_h
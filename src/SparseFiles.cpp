@@ -0,0 +1,141 @@
+/*
+ *   File name: SparseFiles.cpp
+ *   Summary:	Checking sparse file candidates for holes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <QMutexLocker>
+
+#include "SparseFiles.h"
+
+
+using namespace QDirStat;
+
+
+SparseFileCache * SparseFileCache::instance()
+{
+    // A function-local static is created only once even if several
+    // threads get here at the same time
+
+    static SparseFileCache instance;
+
+    return &instance;
+}
+
+
+SparseFileCache::SparseFileCache()
+{
+}
+
+
+FileSize SparseFileCache::dataBytes( const QString & path )
+{
+#ifdef SEEK_DATA
+    // Open without following symlinks and without blocking on a FIFO that
+    // was put there since the scan
+
+    int fd = open( path.toUtf8().constData(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC );
+
+    if ( fd < 0 )
+	return -1;
+
+    struct stat statInfo;
+
+    if ( fstat( fd, &statInfo ) != 0 || ! S_ISREG( statInfo.st_mode ) )
+    {
+	close( fd );
+	return -1;
+    }
+
+    ExtentCacheKey key;
+    key.device	  = statInfo.st_dev;
+    key.inode	  = statInfo.st_ino;
+    key.mtime	  = statInfo.st_mtim.tv_sec;
+    key.mtimeNsec = statInfo.st_mtim.tv_nsec;
+
+    {
+	QMutexLocker locker( &_mutex );
+	QHash<ExtentCacheKey, FileSize>::const_iterator it = _entries.constFind( key );
+
+	if ( it != _entries.constEnd() )
+	{
+	    close( fd );
+	    return it.value();
+	}
+    }
+
+    FileSize data = findDataBytes( fd, statInfo.st_size );
+    close( fd );
+
+    if ( data >= 0 )
+    {
+	QMutexLocker locker( &_mutex );
+
+	if ( _entries.size() >= SPARSE_FILES_CACHE_MAX_ENTRIES )
+	    _entries.clear();
+
+	_entries.insert( key, data );
+    }
+
+    return data;
+
+#else	// ! SEEK_DATA
+
+    Q_UNUSED( path );
+    return -1;
+
+#endif
+}
+
+
+FileSize SparseFileCache::findDataBytes( int fd, FileSize size )
+{
+#ifdef SEEK_DATA
+    FileSize data = 0;
+    off_t    pos  = 0;
+
+    // Filesystems without support for holes report the whole file as one
+    // data region, so they are not mistaken for sparse files.
+
+    while ( pos < size )
+    {
+	off_t dataStart = lseek( fd, pos, SEEK_DATA );
+
+	if ( dataStart < 0 )
+	    return errno == ENXIO ? data : -1;	// ENXIO: Only a hole up to the end
+
+	off_t holeStart = lseek( fd, dataStart, SEEK_HOLE );
+
+	if ( holeStart <= dataStart )
+	    return -1;
+
+	data += holeStart - dataStart;
+	pos   = holeStart;
+    }
+
+    return data;
+
+#else	// ! SEEK_DATA
+
+    Q_UNUSED( fd );
+    Q_UNUSED( size );
+    return -1;
+
+#endif
+}
+
+
+void SparseFileCache::clear()
+{
+    QMutexLocker locker( &_mutex );
+    _entries.clear();
+}
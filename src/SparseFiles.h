@@ -0,0 +1,92 @@
+/*
+ *   File name: SparseFiles.h
+ *   Summary:	Checking sparse file candidates for holes for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef SparseFiles_h
+#define SparseFiles_h
+
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include "FileInfo.h"
+#include "SharedExtents.h"	// ExtentCacheKey
+
+
+// The cache is cleared when it gets more entries than this
+#define SPARSE_FILES_CACHE_MAX_ENTRIES	( 256 * 1024 )
+
+
+namespace QDirStat
+{
+    /**
+     * The number of bytes in the data regions (i.e. not in holes) of
+     * regular files, found with lseek() SEEK_DATA / SEEK_HOLE and cached
+     * by device, inode number and mtime, so checking the same file again
+     * (e.g. after a rescan in the same session) does not read its layout
+     * again.
+     *
+     * This is what tells real sparse files apart: Comparing the allocated
+     * blocks with the size (FileInfo::isSparseFile()) also catches files
+     * on compressed filesystems (btrfs, ZFS) that don't have any holes.
+     *
+     * This can be used from any thread, but it does I/O, so it belongs in
+     * worker threads.
+     **/
+    class SparseFileCache
+    {
+    public:
+
+	/**
+	 * Return the singleton instance of this class. This is thread safe,
+	 * so the first call may also come from a worker thread.
+	 **/
+	static SparseFileCache * instance();
+
+	/**
+	 * Return the number of bytes in the data regions of the regular
+	 * file 'path', from the cache if the file did not change since it
+	 * was last checked. Return -1 if that can't be found out (no such
+	 * file, no permission, not a regular file, no SEEK_DATA support on
+	 * this platform).
+	 *
+	 * This does not write anything to the log.
+	 **/
+	FileSize dataBytes( const QString & path );
+
+	/**
+	 * Remove everything from the cache.
+	 **/
+	void clear();
+
+
+    protected:
+
+	/**
+	 * Constructor. Use instance() instead.
+	 **/
+	SparseFileCache();
+
+	/**
+	 * Find the data bytes of the open file 'fd' with 'size' bytes.
+	 * Return -1 on error.
+	 **/
+	static FileSize findDataBytes( int fd, FileSize size );
+
+
+	// Data members
+
+	QMutex				   _mutex;
+	QHash<ExtentCacheKey, FileSize>	   _entries;
+    };
+
+}	// namespace QDirStat
+
+
+#endif	// SparseFiles_h
@@ -104,7 +104,7 @@ Cleanup * StdCleanup::compressSubtree( QObject * parent )
     cleanup->setWorksForDir	( true	);
     cleanup->setWorksForFile	( false );
     cleanup->setWorksForDotEntry( false );
-    cleanup->setRefreshPolicy( Cleanup::RefreshParent );
+    cleanup->setRefreshPolicy( Cleanup::RefreshChanged );
 
     return cleanup;
 }
@@ -120,6 +120,7 @@ Cleanup * StdCleanup::makeClean( QObject * parent )
     cleanup->setWorksForFile	( false );
     cleanup->setWorksForDotEntry( true	);
     cleanup->setRefreshPolicy( Cleanup::RefreshThis );
+    cleanup->setMaxParallel( 4 );
 
     return cleanup;
 }
@@ -137,6 +138,7 @@ Cleanup * StdCleanup::gitClean( QObject * parent )
     cleanup->setAskForConfirmation( true );
     cleanup->setRefreshPolicy( Cleanup::RefreshThis );
     cleanup->setOutputWindowPolicy( Cleanup::ShowAlways );
+    cleanup->setMaxParallel( 4 );
 
     return cleanup;
 }
@@ -169,7 +171,7 @@ Cleanup * StdCleanup::hardDelete( QObject * parent )
     cleanup->setWorksForFile	( true	);
     cleanup->setWorksForDotEntry( false );
     cleanup->setAskForConfirmation( true );
-    cleanup->setRefreshPolicy( Cleanup::RefreshParent );
+    cleanup->setRefreshPolicy( Cleanup::RefreshChanged );
     cleanup->setIcon( ":/icons/delete.png" );
     cleanup->setShortcut( Qt::CTRL + Qt::Key_Delete );
 
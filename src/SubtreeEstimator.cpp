@@ -0,0 +1,329 @@
+/*
+ *   File name: SubtreeEstimator.cpp
+ *   Summary:	Estimating the size of a directory tree by sampling
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>	// AT_ constants (fstatat() flags)
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>	// llround()
+#include <algorithm>	// std::swap()
+
+#include <QVector>
+
+#include "SubtreeEstimator.h"
+#include "Logger.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * One entry of a directory that is read for an estimate.
+     **/
+    struct SampleEntry
+    {
+	QByteArray  name;
+	struct stat statInfo;
+	bool	    haveStat;
+    };
+
+    typedef QVector<SampleEntry> SampleEntryList;
+
+
+    /**
+     * Move a random selection of 'count' entries to the start of 'list'.
+     **/
+    void pickSample( SampleEntryList & list, int count, std::minstd_rand & random )
+    {
+	for ( int i = 0; i < count && i < list.size() - 1; ++i )
+	{
+	    int j = i + (int) ( random() % ( list.size() - i ) );
+
+	    if ( j != i )
+		std::swap( list[ i ], list[ j ] );
+	}
+    }
+
+
+    quint64 toUInt64( double value )
+    {
+	return value > 0.0 ? (quint64) llround( value ) : 0;
+    }
+
+
+    quint32 toUInt32( double value )
+    {
+	return value > 0.0 ? (quint32) llround( value ) : 0;
+    }
+
+}	// namespace
+
+
+
+SubtreeEstimator::Totals::Totals():
+    size( 0.0 ),
+    allocatedSize( 0.0 ),
+    blocks( 0.0 ),
+    items( 0.0 ),
+    subDirs( 0.0 ),
+    files( 0.0 ),
+    unignoredItems( 0.0 ),
+    latestMtime( 0 ),
+    oldestFileMtime( 0 )
+{
+}
+
+
+void SubtreeEstimator::Totals::add( const struct stat & statInfo )
+{
+    bool   isFile	 = S_ISREG( statInfo.st_mode );
+    double allocated	 = statInfo.st_blocks * 512.0;
+    double entrySize	 = statInfo.st_size;
+
+    // The same as FileInfo: Sparse files count with their allocated size,
+    // hard links with their share
+
+    if ( isFile && allocated < entrySize )
+	entrySize = allocated;
+
+    if ( isFile && statInfo.st_nlink > 1 )
+    {
+	entrySize /= statInfo.st_nlink;
+	allocated /= statInfo.st_nlink;
+    }
+
+    size	  += entrySize;
+    allocatedSize += allocated;
+    blocks	  += statInfo.st_blocks;
+    items	  += 1.0;
+
+    if ( S_ISDIR( statInfo.st_mode ) )
+	subDirs += 1.0;
+    else
+	unignoredItems += 1.0;
+
+    if ( isFile )
+    {
+	files += 1.0;
+
+	if ( oldestFileMtime == 0 || statInfo.st_mtime < oldestFileMtime )
+	    oldestFileMtime = statInfo.st_mtime;
+    }
+
+    if ( statInfo.st_mtime > latestMtime )
+	latestMtime = statInfo.st_mtime;
+}
+
+
+void SubtreeEstimator::Totals::add( const Totals & other, double factor )
+{
+    size	   += factor * other.size;
+    allocatedSize  += factor * other.allocatedSize;
+    blocks	   += factor * other.blocks;
+    items	   += factor * other.items;
+    subDirs	   += factor * other.subDirs;
+    files	   += factor * other.files;
+    unignoredItems += factor * other.unignoredItems;
+
+    // The mtimes can't be extrapolated; use what the sample has
+
+    if ( other.latestMtime > latestMtime )
+	latestMtime = other.latestMtime;
+
+    if ( other.oldestFileMtime > 0 &&
+	 ( oldestFileMtime == 0 || other.oldestFileMtime < oldestFileMtime ) )
+    {
+	oldestFileMtime = other.oldestFileMtime;
+    }
+}
+
+
+
+
+SubtreeEstimator::SubtreeEstimator( const QString & path, dev_t device ):
+    _path( path.toUtf8() ),
+    _device( device ),
+    _ok( false ),
+    _exact( false ),
+    _dirsRead( 0 )
+{
+}
+
+
+BinaryCacheSubtree SubtreeEstimator::estimate( const struct stat & dirStat )
+{
+    _ok	      = true;
+    _exact    = true;
+    _dirsRead = 0;
+
+    // The same directory always gets the same sample
+
+    _random.seed( (unsigned) dirStat.st_ino );
+
+    Totals below = estimateDir( _path, ESTIMATE_MAX_DIRS );
+
+    BinaryCacheSubtree subtree;
+    memset( &subtree, 0, sizeof( subtree ) );
+
+    // Like in the subtree table of a binary cache file, the sizes include
+    // the directory itself, the counts don't
+
+    subtree.totalSize		= dirStat.st_size + toUInt64( below.size );
+    subtree.totalAllocatedSize	= dirStat.st_blocks * 512 + toUInt64( below.allocatedSize );
+    subtree.totalBlocks		= dirStat.st_blocks + (qint64) toUInt64( below.blocks );
+    subtree.latestMtime		= qMax( (time_t) dirStat.st_mtime, below.latestMtime );
+    subtree.oldestFileMtime	= below.oldestFileMtime;
+    subtree.totalItems		= toUInt32( below.items );
+    subtree.totalSubDirs	= toUInt32( below.subDirs );
+    subtree.totalFiles		= toUInt32( below.files );
+    subtree.totalUnignoredItems = toUInt32( below.unignoredItems );
+    subtree.flags		= BINARY_CACHE_DIR_ESTIMATED;
+
+    return subtree;
+}
+
+
+SubtreeEstimator::Totals SubtreeEstimator::estimateDir( const QByteArray & path, int budget )
+{
+    Totals totals;
+    ++_dirsRead;
+
+    DIR * diskDir = opendir( path.constData() );
+
+    if ( ! diskDir )
+    {
+	if ( path == _path )
+	    _ok = false;
+	else
+	    logDebug() << "Can't open " << path << " for an estimate" << endl;
+
+	return totals;
+    }
+
+    int dirFd = dirfd( diskDir );
+    SampleEntryList subDirs;
+    SampleEntryList others;
+    struct dirent * dirEntry;
+
+    while ( ( dirEntry = readdir( diskDir ) ) )
+    {
+	const char * name = dirEntry->d_name;
+
+	if ( strcmp( name, "." ) == 0 || strcmp( name, ".." ) == 0 )
+	    continue;
+
+	SampleEntry entry;
+	entry.name     = name;
+	entry.haveStat = false;
+
+	unsigned char type = dirEntry->d_type;
+
+	if ( type == DT_UNKNOWN )
+	{
+	    // Not every filesystem reports the type: lstat() is needed anyway
+
+	    if ( fstatat( dirFd, name, &entry.statInfo, AT_SYMLINK_NOFOLLOW ) != 0 )
+		continue;
+
+	    entry.haveStat = true;
+	    type = S_ISDIR( entry.statInfo.st_mode ) ? DT_DIR : DT_REG;
+	}
+
+	if ( type == DT_DIR )
+	    subDirs << entry;
+	else
+	    others << entry;
+    }
+
+    // Non-directory entries: lstat() a sample, extrapolate to all of them
+
+    if ( ! others.isEmpty() )
+    {
+	int count = qMin( others.size(), ESTIMATE_SAMPLE_FILES );
+	pickSample( others, count, _random );
+
+	Totals sample;
+	int sampled = 0;
+
+	for ( int i = 0; i < count; ++i )
+	{
+	    SampleEntry & entry = others[ i ];
+
+	    if ( ! entry.haveStat &&
+		 fstatat( dirFd, entry.name.constData(), &entry.statInfo, AT_SYMLINK_NOFOLLOW ) != 0 )
+	    {
+		continue;
+	    }
+
+	    sample.add( entry.statInfo );
+	    ++sampled;
+	}
+
+	if ( sampled > 0 )
+	    totals.add( sample, (double) others.size() / sampled );
+
+	if ( count < others.size() )
+	    _exact = false;
+    }
+
+    // Subdirectories: Share the budget among a sample of them
+
+    if ( ! subDirs.isEmpty() )
+    {
+	int count     = qMin( subDirs.size(), ESTIMATE_SAMPLE_DIRS );
+	int remaining = qMax( budget - 1, 0 );
+	pickSample( subDirs, count, _random );
+
+	Totals sample;
+	int sampled = 0;
+
+	for ( int i = 0; i < count; ++i )
+	{
+	    SampleEntry & entry = subDirs[ i ];
+
+	    if ( ! entry.haveStat &&
+		 fstatat( dirFd, entry.name.constData(), &entry.statInfo, AT_SYMLINK_NOFOLLOW ) != 0 )
+	    {
+		continue;
+	    }
+
+	    sample.add( entry.statInfo );
+	    ++sampled;
+
+	    if ( entry.statInfo.st_dev != _device ) // Mount point: Don't cross
+		continue;
+
+	    int share = remaining / count + ( i < remaining % count ? 1 : 0 );
+
+	    if ( share > 0 )
+	    {
+		QByteArray subPath = path == "/" ? path + entry.name : path + "/" + entry.name;
+		sample.add( estimateDir( subPath, share ) );
+	    }
+	    else
+	    {
+		_exact = false;
+	    }
+	}
+
+	if ( sampled > 0 )
+	    totals.add( sample, (double) subDirs.size() / sampled );
+
+	if ( count < subDirs.size() )
+	    _exact = false;
+    }
+
+    closedir( diskDir );
+
+    return totals;
+}
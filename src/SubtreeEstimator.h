@@ -0,0 +1,135 @@
+/*
+ *   File name: SubtreeEstimator.h
+ *   Summary:	Estimating the size of a directory tree by sampling
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef SubtreeEstimator_h
+#define SubtreeEstimator_h
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <random>
+
+#include <QByteArray>
+#include <QString>
+
+#include "DirTreeCache.h"	// BinaryCacheSubtree
+
+
+// lstat() at most this many non-directory entries of each directory
+#define ESTIMATE_SAMPLE_FILES	50
+
+// Descend into at most this many subdirectories of each directory
+#define ESTIMATE_SAMPLE_DIRS	3
+
+// Read at most this many directories for one estimate
+#define ESTIMATE_MAX_DIRS	60
+
+
+namespace QDirStat
+{
+    /**
+     * Estimate the totals of a directory subtree without reading all of
+     * it: For each directory, all entries are listed with readdir(), but
+     * only a random sample of ESTIMATE_SAMPLE_FILES non-directory entries
+     * is checked with lstat(), and only ESTIMATE_SAMPLE_DIRS random
+     * subdirectories are read; the totals of the others are extrapolated
+     * from those. The ESTIMATE_MAX_DIRS directories that can be read for
+     * the estimate are evenly shared among the sampled subdirectories.
+     *
+     * Other filesystems below the directory are not read. Exclude rules
+     * and filters are not used either.
+     *
+     * The result has the same meaning as the subtree table of a binary
+     * cache file (see BinaryCacheSubtree) with the
+     * BINARY_CACHE_DIR_ESTIMATED flag, so it can be used for a pending
+     * subtree (see DirTree::addEstimatedSubtree()).
+     **/
+    class SubtreeEstimator
+    {
+    public:
+
+	/**
+	 * Constructor for directory 'path' on device 'device'.
+	 **/
+	SubtreeEstimator( const QString & path, dev_t device );
+
+	/**
+	 * Estimate the subtree of the directory. 'dirStat' is the lstat()
+	 * result of the directory itself; its own size is included in the
+	 * result.
+	 **/
+	BinaryCacheSubtree estimate( const struct stat & dirStat );
+
+	/**
+	 * Return 'true' if the directory itself could be read. Otherwise,
+	 * the result of estimate() is meaningless.
+	 **/
+	bool ok() const { return _ok; }
+
+	/**
+	 * Return 'true' if nothing had to be extrapolated: The subtree is
+	 * small enough that the estimate is the exact result.
+	 **/
+	bool isExact() const { return _exact; }
+
+	/**
+	 * Return the number of directories that were read for the
+	 * estimate.
+	 **/
+	int dirsRead() const { return _dirsRead; }
+
+    protected:
+
+	/**
+	 * The totals of a subtree. These are 'double' since they are
+	 * extrapolated.
+	 **/
+	struct Totals
+	{
+	    Totals();
+
+	    void add( const struct stat & statInfo );
+	    void add( const Totals & other, double factor = 1.0 );
+
+	    double size;
+	    double allocatedSize;
+	    double blocks;
+	    double items;
+	    double subDirs;
+	    double files;
+	    double unignoredItems;
+	    time_t latestMtime;
+	    time_t oldestFileMtime;
+	};
+
+	/**
+	 * Estimate the totals of everything below directory 'path' (not
+	 * including the directory itself). This may read up to 'budget'
+	 * directories, including this one.
+	 **/
+	Totals estimateDir( const QByteArray & path, int budget );
+
+
+	//
+	// Data members
+	//
+
+	QByteArray	_path;
+	dev_t		_device;
+	bool		_ok;
+	bool		_exact;
+	int		_dirsRead;
+	std::minstd_rand _random;
+
+    };	// class SubtreeEstimator
+
+}	// namespace QDirStat
+
+
+#endif	// SubtreeEstimator_h
@@ -0,0 +1,144 @@
+/*
+ *   File name: SubtreeSpiller.cpp
+ *   Summary:	Moving cold subtrees of a directory tree to disk
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>	// std::sort()
+
+#include <QDir>
+#include <QTemporaryFile>
+
+#include "SubtreeSpiller.h"
+#include "DirTree.h"
+#include "DirInfo.h"
+#include "DirTreeCache.h"
+#include "NodePool.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    bool moreItems( DirInfo * a, DirInfo * b )
+    {
+	return a->totalItems() > b->totalItems();
+    }
+
+}	// namespace
+
+
+
+SubtreeSpiller::SubtreeSpiller( DirTree * tree ):
+    _tree( tree )
+{
+    // NOP
+}
+
+
+int SubtreeSpiller::spill( FileSize targetBytes )
+{
+    FileInfo * toplevel = _tree ? _tree->firstToplevel() : 0;
+
+    if ( ! toplevel || ! toplevel->isDirInfo() )
+	return 0;
+
+    // Ask the views before anything changes: Spilling one subtree might
+    // make them drop what they show.
+
+    QList<DirInfo *> candidates;
+    collect( toplevel->toDirInfo(), candidates );
+    std::sort( candidates.begin(), candidates.end(), moreItems );
+
+    int spilled = 0;
+
+    foreach ( DirInfo * dir, candidates )
+    {
+	if ( (FileSize) NodePool::liveBytes() <= targetBytes )
+	    break;
+
+	if ( ! spillSubtree( dir ) )
+	    break;	// Most likely, the disk is full: The others won't do any better
+
+	++spilled;
+    }
+
+    logInfo() << "Spilled " << spilled << " of " << candidates.size() << " cold subtrees;"
+	      << " the nodes now use " << formatSize( NodePool::liveBytes() ) << endl;
+
+    return spilled;
+}
+
+
+void SubtreeSpiller::collect( DirInfo * dir, QList<DirInfo *> & candidates )
+{
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
+    {
+	if ( ! child->isDirInfo() )
+	    continue;
+
+	DirInfo * subDir = child->toDirInfo();
+
+	if ( subDir->isPendingSubtree() || subDir->totalItems() < SPILL_MIN_ITEMS )
+	    continue;
+
+	if ( _tree->keepLoaded( subDir ) || ! isSpillable( subDir ) )
+	    collect( subDir, candidates );	// Parts of it might be cold
+	else
+	    candidates << subDir;
+    }
+}
+
+
+bool SubtreeSpiller::isSpillable( DirInfo * dir )
+{
+    return dir->readState()	    == DirFinished &&
+	   dir->estimatedDirCount() == 0	   &&
+	   dir->totalIgnoredItems() == 0	   &&
+	   ! dir->isBusy();
+}
+
+
+bool SubtreeSpiller::spillSubtree( DirInfo * dir )
+{
+    // The file is removed when 'tmpFile' goes out of scope; the mapping of
+    // the binary cache file keeps its contents.
+
+    QTemporaryFile tmpFile( QDir::tempPath() + "/" + SPILL_FILE_TEMPLATE + BINARY_CACHE_SUFFIX );
+
+    if ( ! tmpFile.open() )
+    {
+	logError() << "Can't create a file to spill " << dir << " to: " << tmpFile.errorString() << endl;
+	return false;
+    }
+
+    QString fileName = tmpFile.fileName();
+    tmpFile.close();
+
+    CacheWriter writer( fileName, dir );
+
+    if ( ! writer.ok() )
+	return false;
+
+    CacheReader reader( fileName, _tree, 0 );
+    BinaryCacheFilePtr cacheFile = reader.binaryFile();
+
+    if ( ! reader.ok() || ! cacheFile )
+    {
+	logError() << "Can't map " << fileName << endl;
+	return false;
+    }
+
+    // logDebug() << "Spilling " << dir << " to " << fileName << endl;
+
+    _tree->clearSubtree( dir );
+    _tree->addPendingSubtree( dir, cacheFile, 0 );
+
+    return true;
+}
@@ -0,0 +1,110 @@
+/*
+ *   File name: SubtreeSpiller.h
+ *   Summary:	Moving cold subtrees of a directory tree to disk
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef SubtreeSpiller_h
+#define SubtreeSpiller_h
+
+
+#include <QList>
+
+#include "FileInfo.h"
+
+
+// Smaller subtrees are not worth a file of their own
+#define SPILL_MIN_ITEMS		1000
+
+// Spilling goes on until the nodes use that much of the limit
+#define SPILL_TARGET_PERCENT	75
+
+// Delay after a directory was read until checking the memory again
+#define SPILL_CHECK_DELAY_MILLISEC 500
+
+// Name of the temporary files in the temp directory
+#define SPILL_FILE_TEMPLATE	"qdirstat-spill-XXXXXX"
+
+
+namespace QDirStat
+{
+    class DirTree;
+    class DirInfo;
+
+    /**
+     * Spilling cold subtrees of a DirTree to disk when its nodes use too
+     * much memory (see DirTree::spillLimit()):
+     *
+     * Fully read subtrees that no view shows (see DirTree::keepLoaded())
+     * are written to a temporary binary cache file each, and their
+     * children are deleted. The directory itself stays as the stub of a
+     * pending subtree in that file (see DirTree::addPendingSubtree()), so
+     * it keeps its totals, and its children are loaded again when a view
+     * needs them, e.g. when it is expanded in the tree view or zoomed
+     * into in the treemap.
+     *
+     * The file is mapped right away and removed from the disk, so it goes
+     * away when the subtree is loaded again or deleted. It is not gzipped:
+     * Loading a subtree only needs its direct children, and those can be
+     * found in a binary cache file without reading the rest.
+     *
+     * Like with any binary cache file, the size and mtime histograms and
+     * the owners of a spilled subtree are gone until it is loaded again.
+     * Subtrees with ignored items (which are not in cache files) or
+     * estimated directories are not spilled.
+     *
+     * The largest subtrees go first, so there are only a few files.
+     **/
+    class SubtreeSpiller
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	SubtreeSpiller( DirTree * tree );
+
+	/**
+	 * Spill cold subtrees until the nodes of all trees (see
+	 * NodePool::liveBytes()) use no more than 'targetBytes' or until
+	 * there are no more. Return the number of spilled subtrees.
+	 **/
+	int spill( FileSize targetBytes );
+
+	/**
+	 * Spill the subtree of 'dir' to a temporary file and turn 'dir'
+	 * into a pending subtree. Return 'false' upon error; the subtree is
+	 * unchanged then.
+	 **/
+	bool spillSubtree( DirInfo * dir );
+
+
+    protected:
+
+	/**
+	 * Add the cold subtrees below 'dir' to 'candidates', the ones that
+	 * are in use only with their cold parts.
+	 **/
+	void collect( DirInfo * dir, QList<DirInfo *> & candidates );
+
+	/**
+	 * Return 'true' if the subtree of 'dir' can be spilled at all.
+	 **/
+	bool isSpillable( DirInfo * dir );
+
+
+	//
+	// Data members
+	//
+
+	DirTree * _tree;
+
+    };	// class SubtreeSpiller
+
+}	// namespace QDirStat
+
+
+#endif	// SubtreeSpiller_h
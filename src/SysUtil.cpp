@@ -15,9 +15,10 @@
 #include <sys/stat.h>   // lstat()
 #include <sys/types.h>
 
+#include <QTimer>
+
 #include "SysUtil.h"
 #include "Process.h"
-#include "DirSaver.h"
 #include "Logger.h"
 #include "Exception.h"
 
@@ -25,6 +26,65 @@
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * Return the output of 'process' when it is done and log it like
+     * runCommand() does. 'finished' is 'false' if it timed out.
+     **/
+    QString commandResult( QProcess &	       process,
+			   const QString &     command,
+			   const QStringList & args,
+			   bool		       finished,
+			   int *	       exitCode_ret,
+			   bool		       logOutput,
+			   bool		       ignoreErrCode )
+    {
+	QString output = QString::fromUtf8( process.readAll() );
+
+	if ( finished )
+	{
+	    if ( process.exitStatus() == QProcess::NormalExit )
+	    {
+		if ( exitCode_ret )
+		    *exitCode_ret = process.exitCode();
+
+		if ( ! ignoreErrCode && process.exitCode() )
+		{
+		    logError() << "Command exited with exit code "
+			       << process.exitCode() << ": "
+			       << command << "\" args: " << args
+			       << endl;
+		}
+	    }
+	    else
+	    {
+		logError() << "Command crashed: \"" << command << "\" args: " << args << endl;
+		output = "ERROR: Command crashed\n\n" + output;
+	    }
+	}
+	else
+	{
+	    logError() << "Timeout or crash: \"" << command << "\" args: " << args << endl;
+	    output = "ERROR: Timeout or crash\n\n" + output;
+	}
+
+	if ( logOutput || ( process.exitCode() != 0 && ! ignoreErrCode ) )
+	{
+	    QString logOutput = output.trimmed();
+
+	    if ( logOutput.contains( '\n' ) )
+		logDebug() << "Output: \n" << output << endl;
+	    else
+		logDebug() << "Output: \"" << logOutput << "\"" << endl;
+	}
+
+	return output;
+    }
+
+}	// namespace
+
+
 bool SysUtil::tryRunCommand( const QString & commandLine,
 			     const QRegExp & expectedResult,
 			     bool	     logCommand,
@@ -104,46 +164,88 @@ QString SysUtil::runCommand( const QString &	 command,
 
     process.start();
     bool success = process.waitForFinished( timeout_sec * 1000 );
-    QString output = QString::fromUtf8( process.readAll() );
 
-    if ( success )
-    {
-	if ( process.exitStatus() == QProcess::NormalExit )
-	{
-	    if ( exitCode_ret )
-		*exitCode_ret = process.exitCode();
+    return commandResult( process, command, args, success,
+			  exitCode_ret, logOutput, ignoreErrCode );
+}
 
-	    if ( ! ignoreErrCode && process.exitCode() )
-	    {
-		logError() << "Command exited with exit code "
-			   << process.exitCode() << ": "
-			   << command << "\" args: " << args
-			   << endl;
-	    }
-	}
-	else
-	{
-	    logError() << "Command crashed: \"" << command << "\" args: " << args << endl;
-	    output = "ERROR: Command crashed\n\n" + output;
-	}
-    }
-    else
+
+void SysUtil::runCommandAsync( const QString &	   command,
+			       const QStringList & args,
+			       QObject *	   context,
+			       CommandCallback	   callback,
+			       int		   timeout_sec,
+			       bool		   logCommand,
+			       bool		   logOutput,
+			       bool		   ignoreErrCode )
+{
+    CHECK_PTR( context );
+
+    if ( ! haveCommand( command ) )
     {
-	logError() << "Timeout or crash: \"" << command << "\" args: " << args << endl;
-	output = "ERROR: Timeout or crash\n\n" + output;
+	logInfo() << "Command not found: " << command << endl;
+	callback( "ERROR: Command not found", -1 );
+	return;
     }
 
-    if ( logOutput || ( process.exitCode() != 0 && ! ignoreErrCode ) )
-    {
-        QString logOutput = output.trimmed();
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert( "LANG", "C" ); // Prevent output in translated languages
 
-        if ( logOutput.contains( '\n' ) )
-            logDebug() << "Output: \n" << output << endl;
-        else
-            logDebug() << "Output: \"" << logOutput << "\"" << endl;
-    }
+    // The context owns the process, so the process is killed if the
+    // context is destroyed first.
+
+    Process * process = new Process( context );
+    CHECK_NEW( process );
+
+    process->setProgram( command );
+    process->setArguments( args );
+    process->setProcessEnvironment( env );
+    process->setProcessChannelMode( QProcess::MergedChannels ); // combine stdout and stderr
+
+    // The timer is still active when the process finishes in time
+
+    QTimer * timer = new QTimer( process );
+    CHECK_NEW( timer );
+    timer->setSingleShot( true );
 
-    return output;
+    QObject::connect( timer, &QTimer::timeout, process, &QProcess::kill );
+
+    QObject::connect( process,
+		      static_cast<void (QProcess::*)( int, QProcess::ExitStatus )>( &QProcess::finished ),
+		      context, [=]()
+	{
+	    int exitCode = -1;
+	    QString output = commandResult( *process, command, args, timer->isActive(),
+					    &exitCode, logOutput, ignoreErrCode );
+	    timer->stop();
+	    process->deleteLater();
+	    callback( output, exitCode );
+	});
+
+#if (QT_VERSION < QT_VERSION_CHECK( 5, 6, 0 ))
+    void ( QProcess::*errorSignal )( QProcess::ProcessError ) = &QProcess::error;
+#else
+    void ( QProcess::*errorSignal )( QProcess::ProcessError ) = &QProcess::errorOccurred;
+#endif
+
+    // Without starting, there is no finished() signal
+
+    QObject::connect( process, errorSignal, context, [=]( QProcess::ProcessError error )
+	{
+	    if ( error != QProcess::FailedToStart )
+		return;
+
+	    logError() << "Could not start \"" << command << "\" args: " << args << endl;
+	    timer->stop();
+	    process->deleteLater();
+	    callback( "ERROR: Could not start command", -1 );
+	});
+
+    if ( logCommand )
+	logDebug() << command << " " << args.join( " " ) << endl;
+
+    timer->start( timeout_sec * 1000 );
+    process->start();
 }
 
 
@@ -193,20 +295,24 @@ QString SysUtil::symLinkTarget( const QString & path )
 }
 
 
-bool SysUtil::isBrokenSymLink( const QString & path )
+bool SysUtil::isBrokenSymLink( const QString & path, bool quiet )
 {
-    QByteArray target = readLink( path );
+    QByteArray target = readLink( path.toUtf8(), quiet );
 
     if ( target.size() == 0 )   // path is not a symlink
         return false;           // so it's also not a broken symlink
 
 
-    // Start from the symlink's parent directory
+    // A relative target starts from the symlink's parent directory. Don't
+    // change the working directory for that: It is the same for all threads.
 
-    QStringList pathSegments = path.split( '/', QString::SkipEmptyParts );
-    pathSegments.removeLast(); // We already know it's a symlink, not a directory
-    QString parentPath = QString( path.startsWith( "/" ) ? "/" : "" ) + pathSegments.join( '/' );
-    DirSaver dir( parentPath );
+    if ( ! target.startsWith( '/' ) )
+    {
+        int lastSlash = path.lastIndexOf( '/' );
+
+        if ( lastSlash >= 0 )
+            target = path.left( lastSlash + 1 ).toUtf8() + target;
+    }
 
     // We can't use access() here since that would follow symlinks.
     // Let's use lstat() instead.
@@ -222,18 +328,25 @@ bool SysUtil::isBrokenSymLink( const QString & path )
     {
         if ( errno == EACCES )  // permission denied for one of the dirs in target
         {
-            logWarning() << "Permission denied for one of the directories"
-                         << " in symlink target " << QString::fromUtf8( target )
-                         << " of symlink " << path
-                         << endl;
+            if ( ! quiet )
+            {
+                logWarning() << "Permission denied for one of the directories"
+                             << " in symlink target " << QString::fromUtf8( target )
+                             << " of symlink " << path
+                             << endl;
+            }
 
             return false;       // We don't know if the symlink is broken
         }
         else
         {
-            logWarning() << "Broken symlink " << path
-                         << " errno: " << strerror( errno )
-                         << endl;
+            if ( ! quiet )
+            {
+                logWarning() << "Broken symlink " << path
+                             << " errno: " << strerror( errno )
+                             << endl;
+            }
+
             return true;
         }
     }
@@ -246,14 +359,15 @@ QByteArray SysUtil::readLink( const QString & path )
 }
 
 
-QByteArray SysUtil::readLink( const QByteArray & path )
+QByteArray SysUtil::readLink( const QByteArray & path, bool quiet )
 {
     QByteArray targetBuf( PATH_MAX, 0 );
     ssize_t len = ::readlink( path, targetBuf.data(), targetBuf.size() );
 
     if ( len == 0 )
     {
-        logWarning() << QString::fromUtf8( path ) << " is not a symlink" << endl;
+        if ( ! quiet )
+            logWarning() << QString::fromUtf8( path ) << " is not a symlink" << endl;
     }
     else if ( len == targetBuf.size() )
     {
@@ -263,8 +377,12 @@ QByteArray SysUtil::readLink( const QByteArray & path )
         // Since this is a very pathological case, we won't attempty any crazy
         // workarounds and simply fail with an error in the log.
 
-        logError() << "Symlink target of " << QString::fromUtf8( path )
-                   << " is longer than " << PATH_MAX << " bytes" << endl;
+        if ( ! quiet )
+        {
+            logError() << "Symlink target of " << QString::fromUtf8( path )
+                       << " is longer than " << PATH_MAX << " bytes" << endl;
+        }
+
         targetBuf.clear();
     }
     else
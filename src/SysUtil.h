@@ -11,10 +11,14 @@
 #define SysUtil_h
 
 #include <sys/types.h> // uid_t
+#include <functional>
 
 #include <QString>
+#include <QStringList>
 #include <QRegExp>
 
+class QObject;
+
 
 // Override these before #include
 
@@ -107,6 +111,36 @@ namespace QDirStat
 			    bool		logOutput     = LOG_OUTPUT,
 			    bool		ignoreErrCode = false );
 
+	/**
+	 * Callback for runCommandAsync(): The command's output and its exit
+	 * code (-1 if it crashed, timed out or could not be started).
+	 **/
+	typedef std::function<void( const QString & output, int exitCode )> CommandCallback;
+
+	/**
+	 * Start a command with arguments 'args' and return immediately; when
+	 * it is finished, call 'callback' with its output and its exit code.
+	 * Use this instead of runCommand() in the GUI thread: That blocks
+	 * until the command is finished.
+	 *
+	 * If the command is not finished after 'timeout_sec', it is killed
+	 * and the output starts with "ERROR: Timeout" like for runCommand().
+	 * If 'context' is destroyed before that, the command is killed and
+	 * the callback is never called.
+	 *
+	 * The output is the same as with runCommand(), and so is the logging.
+	 * If the command does not exist, the callback is called right away.
+	 * Call this in the thread of 'context'; it needs an event loop.
+	 **/
+	void runCommandAsync( const QString &	  command,
+			      const QStringList & args,
+			      QObject *		  context,
+			      CommandCallback	  callback,
+			      int		  timeout_sec	= COMMAND_TIMEOUT_SEC,
+			      bool		  logCommand	= LOG_COMMANDS,
+			      bool		  logOutput	= LOG_OUTPUT,
+			      bool		  ignoreErrCode = false );
+
 	/**
 	 * Return 'true' if the specified command is available and executable.
 	 **/
@@ -154,8 +188,11 @@ namespace QDirStat
         /**
          * Return 'true' if a symbolic link is broken, i.e. the (first level)
          * target of the symlink does not exist in the filesystem.
+         *
+         * With 'quiet', this does not log anything, so it can be called from
+         * any thread.
          **/
-        bool isBrokenSymLink( const QString & path );
+        bool isBrokenSymLink( const QString & path, bool quiet = false );
 
         /**
          * Read the (first level) target of a symbolic link, assuming UTF-8
@@ -174,8 +211,9 @@ namespace QDirStat
          * This is a more user-friendly version of readlink(2).
          *
          * This returns an empty QByteArray if 'path' is not a symlink.
+         * With 'quiet', this does not log anything.
          **/
-        QByteArray readLink( const QByteArray & path );
+        QByteArray readLink( const QByteArray & path, bool quiet = false );
 
     }	// namespace SysUtil
 }	// namespace QDirStat
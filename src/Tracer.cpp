@@ -0,0 +1,246 @@
+/*
+ *   File name: Tracer.cpp
+ *   Summary:	Trace events in the Chrome trace event format
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QMutexLocker>
+
+#include "Tracer.h"
+#include "Logger.h"
+
+
+using namespace QDirStat;
+
+
+Tracer * Tracer::_instance = 0;
+
+
+namespace
+{
+    QAtomicInt lastThreadId;
+}
+
+
+Tracer::Tracer( const QString & fileName ):
+    _fileName( fileName ),
+    _dropped( 0 )
+{
+    if ( _fileName.isEmpty() )
+	return;
+
+    if ( _instance )
+    {
+	logError() << "Tracing is already enabled" << endl;
+	return;
+    }
+
+    threadId(); // The main thread gets number 1
+    _clock.start();
+    _instance = this;
+
+    logInfo() << "Tracing to " << _fileName << endl;
+}
+
+
+Tracer::~Tracer()
+{
+    if ( _instance == this )
+    {
+	_instance = 0;
+	write();
+    }
+}
+
+
+qint64 Tracer::now()
+{
+    return _instance ? _instance->_clock.nsecsElapsed() / 1000 : 0;
+}
+
+
+int Tracer::threadId()
+{
+    static thread_local int id = lastThreadId.fetchAndAddRelaxed( 1 ) + 1;
+
+    return id;
+}
+
+
+void Tracer::addComplete( const char *	  category,
+			  const char *	  name,
+			  qint64	  startMicrosec,
+			  const QString & arg )
+{
+    if ( ! _instance )
+	return;
+
+    Event event;
+    event.category = category;
+    event.name	   = name;
+    event.phase	   = 'X';
+    event.start	   = startMicrosec;
+    event.duration = now() - startMicrosec;
+    event.arg	   = arg;
+
+    _instance->add( event );
+}
+
+
+void Tracer::addInstant( const char * category, const char * name )
+{
+    if ( ! _instance )
+	return;
+
+    Event event;
+    event.category = category;
+    event.name	   = name;
+    event.phase	   = 'i';
+    event.start	   = now();
+    event.duration = 0;
+
+    _instance->add( event );
+}
+
+
+void Tracer::add( Event & event )
+{
+    event.threadId = threadId();
+
+    QMutexLocker locker( &_mutex );
+
+    if ( _events.size() < TRACER_MAX_EVENTS )
+	_events.append( event );
+    else
+	++_dropped;
+}
+
+
+QByteArray Tracer::jsonString( const QString & str )
+{
+    QByteArray utf8 = str.toUtf8();
+    QByteArray result;
+    result.reserve( utf8.size() + 2 );
+    result += '"';
+
+    for ( int i = 0; i < utf8.size(); ++i )
+    {
+	unsigned char c = utf8.at( i );
+
+	if ( c == '"' || c == '\\' )
+	{
+	    result += '\\';
+	    result += c;
+	}
+	else if ( c < 0x20 )
+	{
+	    result += "\\u00";
+	    result += QByteArray::number( c, 16 ).rightJustified( 2, '0' );
+	}
+	else
+	{
+	    result += c;
+	}
+    }
+
+    result += '"';
+
+    return result;
+}
+
+
+bool Tracer::write()
+{
+    QFile file( _fileName );
+
+    if ( ! file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+	logError() << "Can't open trace file " << _fileName
+		   << ": " << file.errorString() << endl;
+	return false;
+    }
+
+    QMutexLocker locker( &_mutex );
+    QByteArray line;
+
+    file.write( "{\"traceEvents\":[\n" );
+
+    // Metadata events for the thread names
+
+    int threads = lastThreadId.load();
+
+    for ( int tid = 1; tid <= threads; ++tid )
+    {
+	QString threadName = tid == 1 ?
+	    QString( "Main thread" ) :
+	    QString( "Worker thread %1" ).arg( tid - 1 );
+
+	line  = "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":";
+	line += QByteArray::number( tid );
+	line += ",\"args\":{\"name\":";
+	line += jsonString( threadName );
+	line += "}}";
+
+	file.write( tid == 1 ? "" : ",\n" );
+	file.write( line );
+    }
+
+    for ( int i = 0; i < _events.size(); ++i )
+    {
+	const Event & event = _events.at( i );
+
+	line  = "{\"ph\":\"";
+	line += event.phase;
+	line += "\",\"cat\":\"";
+	line += event.category;
+	line += "\",\"name\":\"";
+	line += event.name;
+	line += "\",\"pid\":1,\"tid\":";
+	line += QByteArray::number( event.threadId );
+	line += ",\"ts\":";
+	line += QByteArray::number( event.start );
+
+	if ( event.phase == 'X' )
+	{
+	    line += ",\"dur\":";
+	    line += QByteArray::number( event.duration );
+	}
+	else
+	{
+	    line += ",\"s\":\"t\"";
+	}
+
+	if ( ! event.arg.isEmpty() )
+	{
+	    line += ",\"args\":{\"arg\":";
+	    line += jsonString( event.arg );
+	    line += "}";
+	}
+
+	line += "}";
+
+	file.write( ",\n" );
+	file.write( line );
+    }
+
+    file.write( "\n]}\n" );
+
+    if ( file.error() != QFile::NoError )
+    {
+	logError() << "Error writing trace file " << _fileName
+		   << ": " << file.errorString() << endl;
+	return false;
+    }
+
+    logInfo() << "Wrote " << _events.size() << " trace events to " << _fileName << endl;
+
+    if ( _dropped > 0 )
+	logWarning() << "Dropped " << _dropped << " trace events" << endl;
+
+    return true;
+}
@@ -0,0 +1,186 @@
+/*
+ *   File name: Tracer.h
+ *   Summary:	Trace events in the Chrome trace event format
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef Tracer_h
+#define Tracer_h
+
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+
+#define TRACER_MAX_EVENTS	2000000
+
+
+/**
+ * Trace the duration of the current scope (until the closing brace) as an
+ * event 'NAME' in category 'CATEGORY'. Both have to be string literals.
+ *
+ * When tracing is disabled, this only costs a check of a static pointer
+ * when entering and leaving the scope.
+ **/
+#define TRACE_SCOPE( CATEGORY, NAME )		\
+    QDirStat::TraceScope traceScope_( CATEGORY, NAME )
+
+/**
+ * The same as TRACE_SCOPE, but with an argument (typically a path) that is
+ * shown with the event. 'ARG' is only evaluated when tracing is enabled.
+ **/
+#define TRACE_SCOPE_ARG( CATEGORY, NAME, ARG )	\
+    QDirStat::TraceScope traceScope_( CATEGORY, NAME, QDirStat::Tracer::isEnabled() ? QString( ARG ) : QString() )
+
+/**
+ * Trace an event without any duration.
+ **/
+#define TRACE_INSTANT( CATEGORY, NAME )		\
+    if ( ! QDirStat::Tracer::isEnabled() ) {} else QDirStat::Tracer::addInstant( CATEGORY, NAME )
+
+
+namespace QDirStat
+{
+    /**
+     * Trace recorder: Collects events from the trace points in the main
+     * thread and the worker threads in memory and writes them to a file in
+     * the Chrome trace event format when it is destroyed. That file can be
+     * loaded into chrome://tracing or https://ui.perfetto.dev to see what
+     * took how long in which thread.
+     *
+     * Create one instance at the start of main() with the trace file name
+     * (from the QDIRSTAT_TRACE environment variable); with an empty name,
+     * tracing is disabled. Use the TRACE_SCOPE macros for the trace points.
+     **/
+    class Tracer
+    {
+    public:
+
+	/**
+	 * Constructor. If 'fileName' is not empty, this enables tracing.
+	 **/
+	Tracer( const QString & fileName );
+
+	/**
+	 * Destructor. This writes the trace file and disables tracing.
+	 **/
+	~Tracer();
+
+	/**
+	 * Return 'true' if tracing is enabled.
+	 **/
+	static bool isEnabled() { return _instance != 0; }
+
+	/**
+	 * Return the time since tracing was enabled in microseconds.
+	 **/
+	static qint64 now();
+
+	/**
+	 * Add a complete event that started at 'startMicrosec' (see now())
+	 * and ended now. 'category' and 'name' have to be string literals.
+	 * This may be called from any thread.
+	 **/
+	static void addComplete( const char *	 category,
+				 const char *	 name,
+				 qint64		 startMicrosec,
+				 const QString & arg = QString() );
+
+	/**
+	 * Add an instant event.
+	 **/
+	static void addInstant( const char * category, const char * name );
+
+	/**
+	 * Write the trace file. Return 'true' on success.
+	 **/
+	bool write();
+
+
+    protected:
+
+	/**
+	 * One trace event
+	 **/
+	struct Event
+	{
+	    const char * category;
+	    const char * name;
+	    char	 phase;		// 'X': complete, 'i': instant
+	    int		 threadId;
+	    qint64	 start;		// microseconds
+	    qint64	 duration;	// microseconds
+	    QString	 arg;
+	};
+
+	/**
+	 * Add 'event' (with the thread ID set).
+	 **/
+	void add( Event & event );
+
+	/**
+	 * Return the small number of the current thread for the trace file.
+	 **/
+	static int threadId();
+
+	/**
+	 * Return 'str' as a JSON string literal.
+	 **/
+	static QByteArray jsonString( const QString & str );
+
+
+	//
+	// Data members
+	//
+
+	QString		_fileName;
+	QElapsedTimer	_clock;
+	QMutex		_mutex;
+	QVector<Event>	_events;
+	qint64		_dropped;
+
+	static Tracer * _instance;
+    };
+
+
+    /**
+     * RAII helper for the TRACE_SCOPE macros.
+     **/
+    class TraceScope
+    {
+    public:
+
+	TraceScope( const char *    category,
+		    const char *    name,
+		    const QString & arg = QString() ):
+	    _category( category ),
+	    _name( name ),
+	    _start( Tracer::isEnabled() ? Tracer::now() : -1 )
+	{
+	    if ( _start >= 0 )
+		_arg = arg;
+	}
+
+	~TraceScope()
+	{
+	    if ( _start >= 0 && Tracer::isEnabled() )
+		Tracer::addComplete( _category, _name, _start, _arg );
+	}
+
+    protected:
+
+	const char * _category;
+	const char * _name;
+	qint64	     _start;
+	QString	     _arg;
+    };
+
+}	// namespace QDirStat
+
+
+#endif	// Tracer_h
@@ -14,6 +14,7 @@
 #include <QTextStream>
 
 #include "Trash.h"
+#include "MountPoints.h"
 #include "Logger.h"
 #include "Exception.h"
 
@@ -81,6 +82,19 @@ QString Trash::toplevel( const QString & rawPath )
     dev_t dev = device( rawPath );
     QFileInfo fileInfo( rawPath );
     QString path = fileInfo.canonicalPath();
+
+    // The mount table knows the mount point of the device; this saves a
+    // stat() for each directory level. A bind mount might not be the one
+    // that 'path' is on, though.
+
+    QDirStat::MountPoint * mountPoint = QDirStat::MountPoints::findByDevice( dev );
+
+    if ( mountPoint &&
+	 ( mountPoint->path() == "/" || path == mountPoint->path() ||
+	   path.startsWith( mountPoint->path() + "/" ) ) )
+    {
+	return mountPoint->path();
+    }
     QStringList components = path.split( "/", QString::SkipEmptyParts );
     QString lastPath;
 
@@ -198,6 +212,35 @@ bool Trash::trash( const QString & path )
 }
 
 
+bool Trash::prepare( const QString & path,
+		     QString &	     targetPath_ret,
+		     QString &	     infoPath_ret )
+{
+    try
+    {
+	TrashDir * trashDir = instance()->trashDir( path );
+
+	if ( ! trashDir )
+	    return false;
+
+	QString targetName = trashDir->uniqueName( path );
+	trashDir->createTrashInfo( path, targetName );
+
+	targetPath_ret = trashDir->filesPath() + "/" + targetName;
+	infoPath_ret   = trashDir->infoPath()  + "/" + targetName + ".trashinfo";
+    }
+    catch ( const FileException & ex )
+    {
+	CAUGHT( ex );
+	logError() << "Move to trash failed for " << path << endl;
+
+	return false;
+    }
+
+    return true;
+}
+
+
 bool Trash::restore( const QString & path )
 {
     Q_UNUSED( path )
@@ -210,11 +253,59 @@ bool Trash::restore( const QString & path )
 }
 
 
-void Trash::empty()
+QStringList Trash::contentDirs()
 {
-    // TO DO
-    // TO DO
-    // TO DO
+    QStringList trashPaths;
+
+    foreach ( TrashDir * trashDir, instance()->_trashDirs )
+	trashPaths << trashDir->path();
+
+    // Network mounts might not respond, and nothing can be deleted on
+    // read-only ones
+
+    foreach ( QDirStat::MountPoint * mountPoint, QDirStat::MountPoints::normalMountPoints() )
+    {
+	if ( mountPoint->isNetworkMount() || mountPoint->isReadOnly() )
+	    continue;
+
+	// Everything in there will be deleted, so they have to be real
+	// directories of this user, and $TOPDIR/.Trash has to have the
+	// sticky bit like trashDir() checks (see the XDG Trash spec).
+
+	QString topDir = mountPoint->path() == "/" ? "" : mountPoint->path();
+	QStringList candidates;
+	struct stat statBuf;
+
+	if ( lstat( ( topDir + "/.Trash" ).toUtf8(), &statBuf ) == 0 &&
+	     S_ISDIR( statBuf.st_mode ) && ( statBuf.st_mode & S_ISVTX ) )
+	{
+	    candidates << topDir + QString( "/.Trash/%1" ).arg( getuid() );
+	}
+
+	candidates << topDir + QString( "/.Trash-%1" ).arg( getuid() );
+
+	foreach ( const QString & candidate, candidates )
+	{
+	    if ( trashPaths.contains( candidate ) )
+		continue;
+
+	    if ( lstat( candidate.toUtf8(), &statBuf ) == 0 &&
+		 S_ISDIR( statBuf.st_mode ) && statBuf.st_uid == getuid() )
+	    {
+		trashPaths << candidate;
+	    }
+	}
+    }
+
+    QStringList dirs;
+
+    foreach ( const QString & trashPath, trashPaths )
+    {
+	dirs << trashPath + "/files"
+	     << trashPath + "/info";
+    }
+
+    return dirs;
 }
 
 
@@ -246,7 +337,7 @@ QString TrashDir::uniqueName( const QString & path )
     if ( ! extension.isEmpty() )
 	name += "." + extension;
 
-    while ( filesDir.exists( name ) )
+    while ( filesDir.exists( name ) || _reservedNames.contains( name ) )
     {
 	name = QString( "%1_%2" ).arg( baseName ).arg( ++count );
 
@@ -258,6 +349,11 @@ QString TrashDir::uniqueName( const QString & path )
     // Trash/info directory: Without a corresponding file or directory in the
     // Trash/files directory, that .trashinfo file is worthless anyway and can
     // safely be overwritten.
+    //
+    // But a name that was handed out before might still be waiting to be
+    // moved to Trash/files by a TrashJob, so it is never handed out again.
+
+    _reservedNames.insert( name );
 
     return name;
 }
@@ -15,6 +15,8 @@
 #include <unistd.h>
 #include <QObject>
 #include <QMap>
+#include <QSet>
+#include <QStringList>
 
 class TrashDir;
 typedef QMap<dev_t, TrashDir *> TrashDirMap;
@@ -44,6 +46,23 @@ public:
      **/
     static bool trash( const QString & path );
 
+    /**
+     * Prepare throwing 'path' into the trash without moving it yet: Find
+     * the trash directory, reserve a unique name there and create the
+     * .trashinfo file. Return the path that 'path' should be moved to in
+     * 'targetPath_ret' and the path of the .trashinfo file in
+     * 'infoPath_ret'.
+     *
+     * The move itself is then up to the caller, typically a
+     * QDirStat::TrashJob in a worker thread. This is not thread-safe; use
+     * it only from the main thread.
+     *
+     * Return 'true' on success, 'false' on error.
+     **/
+    static bool prepare( const QString & path,
+			 QString &	 targetPath_ret,
+			 QString &	 infoPath_ret );
+
     /**
      * Restore a file or directory from the trash to its original location.
      * Return 'true' on success, 'false' on error.
@@ -51,14 +70,15 @@ public:
     static bool restore( const QString & path );
 
     /**
-     * Empty the trash can, i.e. delete all its contents permanently.
+     * Return the "files" and "info" subdirectories of all trash directories
+     * of this user: the ones that were used during the life time of the
+     * singleton of this class and the ones that exist in the toplevel
+     * directories of the local filesystems. This does not create any.
      *
-     * This does not just affect files or directories moved to the trash with
-     * this class, but everything in all known trash directories, i.e. all
-     * trash directories that were used during the life time of the singleton
-     * of this class.
+     * Emptying the trash means deleting everything in them; that is done
+     * in the background by a QDirStat::ParallelDeleter.
      **/
-    static void empty();
+    static QStringList contentDirs();
 
     /**
      * Return the singleton object for this class. The first use will create
@@ -157,8 +177,8 @@ public:
 
     /**
      * Create a name that is unique within this trash directory.
-     * If no file or directory with 'name' exists yet in Trash/files or
-     * Trash/info, append a number.
+     * If a file or directory with 'name' exists already in Trash/files or
+     * if that name was returned before, append a number.
      **/
     QString uniqueName( const QString & name );
 
@@ -196,8 +216,9 @@ protected:
     // Data members
     //
 
-    QString _path;
-    dev_t   _device;
+    QString	  _path;
+    dev_t	  _device;
+    QSet<QString> _reservedNames;  // Files that may not be moved yet
 };
 
 
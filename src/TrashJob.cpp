@@ -0,0 +1,667 @@
+/*
+ *   File name: TrashJob.cpp
+ *   Summary:	Moving items to the trash in worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>	// rename()
+#include <string.h>	// strcmp()
+#include <unistd.h>
+
+#include <functional>
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include "TrashJob.h"
+#include "DirReadJob.h"
+#include "DirTree.h"
+#include "Trash.h"
+#include "Logger.h"
+#include "Exception.h"
+
+#if defined( __linux__ )
+#  include <sys/syscall.h>
+#endif
+
+#if defined( __linux__ ) && defined( __NR_copy_file_range )
+#  define HAVE_COPY_FILE_RANGE 1
+#else
+#  define HAVE_COPY_FILE_RANGE 0
+#endif
+
+
+// Copying is limited by the disks, not by the CPUs
+#define MAX_THREADS		4
+
+#define PROGRESS_MILLISEC	500
+
+// Bytes per copy_file_range() or read() call
+#define COPY_CHUNK_SIZE		( 8 * 1024 * 1024 )
+#define READ_BUFFER_SIZE	( 1024 * 1024 )
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * A task in the thread pool that just calls 'func'.
+     **/
+    class TrashTask: public QRunnable
+    {
+    public:
+
+	TrashTask( const std::function<void()> & func ):
+	    _func( func )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	    { _func(); }
+
+    private:
+
+	std::function<void()> _func;
+    };
+
+
+    /**
+     * Return an error message for 'path' with the text for errno.
+     **/
+    QString errorMessage( const QString & text, const QByteArray & path )
+    {
+	return text.arg( QString::fromUtf8( path ) ).arg( formatErrno() );
+    }
+
+
+    /**
+     * Write 'size' bytes from 'buf' to 'fd'. Return 'false' on error.
+     **/
+    bool writeAll( int fd, const char * buf, ssize_t size )
+    {
+	while ( size > 0 )
+	{
+	    ssize_t written = write( fd, buf, size );
+
+	    if ( written < 0 )
+	    {
+		if ( errno == EINTR )
+		    continue;
+
+		return false;
+	    }
+
+	    buf	 += written;
+	    size -= written;
+	}
+
+	return true;
+    }
+
+
+    /**
+     * Set the times of 'path' to those in 'statInfo'.
+     **/
+    void copyTimes( const QByteArray & path, const struct stat & statInfo )
+    {
+	struct timespec times[ 2 ];
+	times[ 0 ] = statInfo.st_atim;
+	times[ 1 ] = statInfo.st_mtim;
+
+	utimensat( AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW );
+    }
+
+}	// namespace
+
+
+TrashJob::TrashJob( const FileInfoSet & items, QObject * parent ):
+    QObject( parent ),
+    _tree( items.isEmpty() ? 0 : items.first()->tree() ),
+    _generation( 0 ),
+    _itemsValid( true ),
+    _itemData( 0 ),
+    _doneCount( 0 ),
+    _trashedCount( 0 ),
+    _errorCount( 0 ),
+    _finished( false ),
+    _bytesCopied( 0 ),
+    _canceled( 0 )
+{
+    // Stick to the concurrency that reading may use on the devices of the
+    // items, so rotational disks and network mounts are not flooded
+
+    DirReadJobQueue * queue = _tree ? _tree->jobQueue() : 0;
+    int threads = MAX_THREADS;
+
+    foreach ( FileInfo * item, items )
+    {
+	if ( queue )
+	    threads = qBound( 1, queue->deviceConcurrency( item ), threads );
+
+	Item trashItem;
+	trashItem.item	 = item;
+	trashItem.path	 = item->path();
+	trashItem.copied = false;
+	trashItem.ok	 = false;
+
+	_items << trashItem;
+    }
+
+    _threadPool.setMaxThreadCount( threads );
+    _progressTimer.setInterval( PROGRESS_MILLISEC );
+
+    connect( &_progressTimer, SIGNAL( timeout()	 ),
+	     this,	      SLOT  ( reportProgress() ) );
+}
+
+
+TrashJob::~TrashJob()
+{
+    cancel();
+    _threadPool.waitForDone();
+}
+
+
+void TrashJob::start()
+{
+    _generation = _tree ? _tree->generation() : 0;
+    _itemData	= _items.data();
+    _progressTimer.start();
+
+    int started = 0;
+
+    for ( int i = 0; i < _items.size(); ++i )
+    {
+	Item & item = _items[ i ];
+
+	if ( ! Trash::prepare( item.path, item.targetPath, item.infoPath ) )
+	{
+	    item.errors << tr( "Move to trash failed for %1" ).arg( item.path );
+	    continue;
+	}
+
+	TrashTask * task = new TrashTask( [this, i]()
+	    {
+		moveItem( _itemData[ i ] );
+
+		// This may be the last item: Nothing may touch this object
+		// after that.
+
+		QMetaObject::invokeMethod( this, "itemFinished", Qt::QueuedConnection,
+					   Q_ARG( int, i ) );
+	    } );
+	CHECK_NEW( task );
+
+	_threadPool.start( task );
+	++started;
+    }
+
+    logDebug() << "Moving " << started << " of " << _items.size() << " items to the trash with "
+	       << _threadPool.maxThreadCount() << " threads" << endl;
+
+    // Those that could not be prepared are done already
+
+    for ( int i = 0; i < _items.size(); ++i )
+    {
+	if ( _items.at( i ).targetPath.isEmpty() )
+	    itemFinished( i );
+    }
+}
+
+
+void TrashJob::cancel()
+{
+    _canceled.storeRelease( 1 );
+}
+
+
+void TrashJob::moveItem( Item & item )
+{
+    if ( _canceled.loadAcquire() )
+	return;
+
+    QByteArray src  = item.path.toUtf8();
+    QByteArray dest = item.targetPath.toUtf8();
+
+    if ( rename( src, dest ) == 0 )
+    {
+	item.ok = true;
+	return;
+    }
+
+    if ( errno != EXDEV )
+    {
+	item.errors << errorMessage( tr( "Could not move %1 to the trash: %2" ), src );
+	return;
+    }
+
+    // The trash dir is on another device: Copy, then delete the original
+
+    struct stat statInfo;
+
+    if ( lstat( src, &statInfo ) != 0 )
+    {
+	item.errors << errorMessage( tr( "Could not move %1 to the trash: %2" ), src );
+	return;
+    }
+
+    if ( ! copyTree( src, dest, statInfo.st_dev, item.errors ) )
+    {
+	// Leave the original alone; a partial copy is worthless
+
+	QStringList ignored;
+	struct stat destInfo;
+
+	if ( lstat( dest, &destInfo ) == 0 )
+	    removeTree( dest, destInfo.st_dev, ignored );
+
+	return;
+    }
+
+    item.copied = true;
+
+    if ( ! removeTree( src, statInfo.st_dev, item.errors ) )
+	return;
+
+    item.ok = true;
+}
+
+
+bool TrashJob::copyTree( const QByteArray & src,
+			 const QByteArray & dest,
+			 dev_t		    device,
+			 QStringList &	    errors_ret )
+{
+    if ( _canceled.loadAcquire() )
+	return false;
+
+    struct stat statInfo;
+
+    if ( lstat( src, &statInfo ) != 0 )
+    {
+	errors_ret << errorMessage( tr( "Could not copy %1: %2" ), src );
+	return false;
+    }
+
+    if ( statInfo.st_dev != device )
+    {
+	errors_ret << tr( "Not moving mount point %1 to the trash" )
+	    .arg( QString::fromUtf8( src ) );
+	return false;
+    }
+
+    if ( S_ISREG( statInfo.st_mode ) )
+    {
+	if ( ! copyFile( src, dest, statInfo.st_mode, errors_ret ) )
+	    return false;
+    }
+    else if ( S_ISLNK( statInfo.st_mode ) )
+    {
+	QByteArray target( statInfo.st_size + 1, '\0' );
+	ssize_t len = readlink( src, target.data(), target.size() );
+
+	if ( len < 0 || len >= target.size() )
+	{
+	    errors_ret << errorMessage( tr( "Could not read symlink %1: %2" ), src );
+	    return false;
+	}
+
+	target.truncate( len );
+
+	if ( symlink( target, dest ) != 0 )
+	{
+	    errors_ret << errorMessage( tr( "Could not create symlink %1: %2" ), dest );
+	    return false;
+	}
+    }
+    else if ( S_ISDIR( statInfo.st_mode ) )
+    {
+	if ( mkdir( dest, 0700 ) != 0 )
+	{
+	    errors_ret << errorMessage( tr( "Could not create directory %1: %2" ), dest );
+	    return false;
+	}
+
+	DIR * dir = opendir( src );
+
+	if ( ! dir )
+	{
+	    errors_ret << errorMessage( tr( "Could not read directory %1: %2" ), src );
+	    return false;
+	}
+
+	bool ok = true;
+	struct dirent * entry;
+
+	while ( ok && ( entry = readdir( dir ) ) )
+	{
+	    if ( strcmp( entry->d_name, "."  ) == 0 ||
+		 strcmp( entry->d_name, ".." ) == 0 )
+	    {
+		continue;
+	    }
+
+	    ok = copyTree( src	+ "/" + entry->d_name,
+			   dest + "/" + entry->d_name,
+			   device, errors_ret );
+	}
+
+	closedir( dir );
+
+	if ( ! ok )
+	    return false;
+
+	chmod( dest, statInfo.st_mode & 07777 );
+    }
+    else
+    {
+	errors_ret << tr( "Not copying special file %1 to the trash" )
+	    .arg( QString::fromUtf8( src ) );
+	return false;
+    }
+
+    copyTimes( dest, statInfo );
+
+    return true;
+}
+
+
+bool TrashJob::copyFile( const QByteArray & src,
+			 const QByteArray & dest,
+			 mode_t		    mode,
+			 QStringList &	    errors_ret )
+{
+    int in = open( src, O_RDONLY | O_NOFOLLOW | O_CLOEXEC );
+
+    if ( in < 0 )
+    {
+	errors_ret << errorMessage( tr( "Could not open %1: %2" ), src );
+	return false;
+    }
+
+    int out = open( dest, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600 );
+
+    if ( out < 0 )
+    {
+	errors_ret << errorMessage( tr( "Could not create %1: %2" ), dest );
+	close( in );
+	return false;
+    }
+
+    bool ok	  = true;
+    bool useRead  = ! HAVE_COPY_FILE_RANGE;
+
+#if HAVE_COPY_FILE_RANGE
+
+    // Let the kernel copy without the data going through user space. Older
+    // kernels don't support this across filesystems; then fall back to
+    // read() and write().
+
+    bool copiedAny = false;
+
+    while ( ! _canceled.loadAcquire() )
+    {
+	ssize_t copied = syscall( __NR_copy_file_range, in, 0, out, 0, COPY_CHUNK_SIZE, 0 );
+
+	if ( copied < 0 )
+	{
+	    if ( errno == EINTR )
+		continue;
+
+	    if ( ! copiedAny &&
+		 ( errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP ) )
+	    {
+		useRead = true;
+	    }
+	    else
+	    {
+		errors_ret << errorMessage( tr( "Could not copy %1: %2" ), src );
+		ok = false;
+	    }
+
+	    break;
+	}
+
+	if ( copied == 0 )
+	    break;
+
+	copiedAny = true;
+	addBytesCopied( copied );
+    }
+
+#endif
+
+    if ( ok && useRead )
+    {
+	QByteArray buf( READ_BUFFER_SIZE, '\0' );
+
+	while ( ! _canceled.loadAcquire() )
+	{
+	    ssize_t len = read( in, buf.data(), buf.size() );
+
+	    if ( len < 0 && errno == EINTR )
+		continue;
+
+	    if ( len == 0 )
+		break;
+
+	    if ( len < 0 || ! writeAll( out, buf.constData(), len ) )
+	    {
+		errors_ret << errorMessage( tr( "Could not copy %1: %2" ), src );
+		ok = false;
+		break;
+	    }
+
+	    addBytesCopied( len );
+	}
+    }
+
+    if ( _canceled.loadAcquire() )
+	ok = false;
+
+    fchmod( out, mode & 07777 );
+    close( in );
+
+    if ( close( out ) != 0 && ok )
+    {
+	errors_ret << errorMessage( tr( "Could not write %1: %2" ), dest );
+	ok = false;
+    }
+
+    return ok;
+}
+
+
+bool TrashJob::removeTree( const QByteArray & path,
+			   dev_t	      device,
+			   QStringList &      errors_ret )
+{
+    struct stat statInfo;
+
+    if ( lstat( path, &statInfo ) != 0 )
+    {
+	if ( errno == ENOENT )
+	    return true;
+
+	errors_ret << errorMessage( tr( "Could not delete %1: %2" ), path );
+	return false;
+    }
+
+    if ( statInfo.st_dev != device )
+    {
+	errors_ret << tr( "Not deleting mount point %1" ).arg( QString::fromUtf8( path ) );
+	return false;
+    }
+
+    if ( ! S_ISDIR( statInfo.st_mode ) )
+    {
+	if ( unlink( path ) != 0 )
+	{
+	    errors_ret << errorMessage( tr( "Could not delete %1: %2" ), path );
+	    return false;
+	}
+
+	return true;
+    }
+
+    DIR * dir = opendir( path );
+
+    if ( ! dir )
+    {
+	errors_ret << errorMessage( tr( "Could not read directory %1: %2" ), path );
+	return false;
+    }
+
+    bool ok = true;
+    struct dirent * entry;
+
+    while ( ( entry = readdir( dir ) ) )
+    {
+	if ( strcmp( entry->d_name, "."	 ) == 0 ||
+	     strcmp( entry->d_name, ".." ) == 0 )
+	{
+	    continue;
+	}
+
+	if ( ! removeTree( path + "/" + entry->d_name, device, errors_ret ) )
+	    ok = false;
+    }
+
+    closedir( dir );
+
+    if ( ok && rmdir( path ) != 0 )
+    {
+	errors_ret << errorMessage( tr( "Could not delete directory %1: %2" ), path );
+	ok = false;
+    }
+
+    return ok;
+}
+
+
+void TrashJob::addBytesCopied( qint64 bytes )
+{
+    QMutexLocker locker( &_bytesMutex );
+    _bytesCopied += bytes;
+}
+
+
+qint64 TrashJob::bytesCopied() const
+{
+    QMutexLocker locker( &_bytesMutex );
+    return _bytesCopied;
+}
+
+
+void TrashJob::itemFinished( int itemNo )
+{
+    Item & item = _items[ itemNo ];
+    ++_doneCount;
+
+    foreach ( const QString & message, item.errors )
+    {
+	++_errorCount;
+	emit error( message );
+    }
+
+    if ( item.ok )
+    {
+	++_trashedCount;
+	emit trashed( item.path );
+	removeFromTree( item.item, item.path );
+    }
+    else if ( item.copied )
+    {
+	// The copy in the trash is complete, but some of the original is
+	// still there
+
+	_failedPaths << item.path;
+    }
+    else if ( ! item.infoPath.isEmpty() )
+    {
+	// Nothing was moved: The .trashinfo file is worthless
+
+	QFile::remove( item.infoPath );
+    }
+
+    if ( _doneCount == _items.size() )
+	finish();
+}
+
+
+void TrashJob::removeFromTree( FileInfo * item, const QString & path )
+{
+    if ( ! _tree )
+	return;
+
+    if ( _tree->isBusy() )
+    {
+	logWarning() << "Not updating the tree for " << path
+		     << ": DirTree is being read" << endl;
+	_itemsValid = false;
+	return;
+    }
+
+    if ( _tree->generation() != _generation )
+    {
+	// Something else changed the tree: The items might be gone
+
+	_itemsValid = false;
+    }
+
+    if ( ! _itemsValid )
+	item = _tree->locate( path );
+
+    if ( item )
+	_tree->deleteSubtree( item );
+
+    _generation = _tree->generation();
+}
+
+
+void TrashJob::reportProgress()
+{
+    emit progress( _doneCount, _items.size(), bytesCopied() );
+}
+
+
+void TrashJob::finish()
+{
+    _progressTimer.stop();
+    _finished = true;
+
+    logDebug() << "Moved " << _trashedCount << " of " << _items.size()
+	       << " items to the trash; copied " << bytesCopied() << " bytes; "
+	       << _errorCount << " errors" << endl;
+
+    reportProgress();
+    emit finished( _errorCount );
+}
+
+
+FileInfoSet TrashJob::failedItems() const
+{
+    FileInfoSet items;
+
+    if ( ! _tree )
+	return items;
+
+    foreach ( const QString & path, _failedPaths )
+    {
+	FileInfo * item = _tree->locate( path );
+
+	if ( item )
+	    items << item;
+    }
+
+    return items.normalized();
+}
@@ -0,0 +1,238 @@
+/*
+ *   File name: TrashJob.h
+ *   Summary:	Moving items to the trash in worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef TrashJob_h
+#define TrashJob_h
+
+
+#include <sys/types.h>
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+
+#include "FileInfoSet.h"
+
+
+namespace QDirStat
+{
+    class DirTree;
+
+    /**
+     * Moving the selected items to the trash without blocking the GUI.
+     *
+     * The .trashinfo files are created on the main thread (see
+     * Trash::prepare()), then the items are moved in a thread pool. A
+     * rename() is tried first; if the trash directory is on another device,
+     * the item is copied (with copy_file_range() where the kernel supports
+     * it) and the original is deleted when the copy is complete. Copying
+     * never crosses into another filesystem below the item.
+     *
+     * Each item is removed from the DirTree as soon as it is in the trash,
+     * so nothing needs to be read again. If an item was copied, but the
+     * original could not be deleted completely, what is left of it is
+     * reported by failedItems(). If copying fails, the partial copy is
+     * removed again and the original stays unchanged.
+     **/
+    class TrashJob: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor: Prepare moving 'items' to the trash. They should be
+	 * normalized and must not contain pseudo directories or packages.
+	 **/
+	TrashJob( const FileInfoSet & items, QObject * parent = 0 );
+
+	/**
+	 * Destructor. This cancels the job and waits for the worker threads.
+	 **/
+	virtual ~TrashJob();
+
+	/**
+	 * Create the .trashinfo files and start moving.
+	 **/
+	void start();
+
+	/**
+	 * Stop after the files that are being copied right now. Items that
+	 * are not completely copied yet stay where they are.
+	 **/
+	void cancel();
+
+	/**
+	 * Return 'true' if the job is finished.
+	 **/
+	bool isFinished() const { return _finished; }
+
+	/**
+	 * Return the number of items that are done (successfully or not) and
+	 * the number of all items.
+	 **/
+	int doneCount()  const { return _doneCount; }
+	int totalCount() const { return _items.size(); }
+
+	/**
+	 * Return the number of the items that are in the trash now.
+	 **/
+	int trashedCount() const { return _trashedCount; }
+
+	/**
+	 * Return the number of the errors so far.
+	 **/
+	int errorCount() const { return _errorCount; }
+
+	/**
+	 * Return the number of bytes copied to other devices so far.
+	 **/
+	qint64 bytesCopied() const;
+
+	/**
+	 * Return the items that are still in the tree, but changed on disk:
+	 * They were copied to the trash, but could not be deleted
+	 * completely. Only use this when the job is finished.
+	 **/
+	FileInfoSet failedItems() const;
+
+
+    signals:
+
+	/**
+	 * Emitted from time to time while moving.
+	 **/
+	void progress( int done, int total, qint64 bytesCopied );
+
+	/**
+	 * Emitted when 'path' is in the trash.
+	 **/
+	void trashed( const QString & path );
+
+	/**
+	 * Emitted for each error.
+	 **/
+	void error( const QString & message );
+
+	/**
+	 * Emitted when the job is finished or canceled.
+	 **/
+	void finished( int errorCount );
+
+
+    protected slots:
+
+	/**
+	 * Notification that the worker threads are done with item no.
+	 * 'itemNo': Update the tree.
+	 **/
+	void itemFinished( int itemNo );
+
+	/**
+	 * Emit the progress.
+	 **/
+	void reportProgress();
+
+
+    protected:
+
+	/**
+	 * One item to move to the trash.
+	 **/
+	struct Item
+	{
+	    FileInfo *	item;		// Only for the main thread
+	    QString	path;
+	    QString	targetPath;	// In Trash/files
+	    QString	infoPath;	// The .trashinfo file
+	    bool	copied;		// Set by the worker
+	    bool	ok;		// Set by the worker
+	    QStringList errors;		// Set by the worker
+	};
+
+	/**
+	 * Move one item. This is called in the worker threads.
+	 **/
+	void moveItem( Item & item );
+
+	/**
+	 * Copy 'src' with everything below it to 'dest', but only on
+	 * 'device'. This is called in the worker threads.
+	 **/
+	bool copyTree( const QByteArray & src,
+		       const QByteArray & dest,
+		       dev_t		  device,
+		       QStringList &	  errors_ret );
+
+	/**
+	 * Copy the contents of regular file 'src' with 'mode' to 'dest'.
+	 * This is called in the worker threads.
+	 **/
+	bool copyFile( const QByteArray & src,
+		       const QByteArray & dest,
+		       mode_t		  mode,
+		       QStringList &	  errors_ret );
+
+	/**
+	 * Delete 'path' with everything below it, but only on 'device'.
+	 * This is called in the worker threads.
+	 **/
+	bool removeTree( const QByteArray & path,
+			 dev_t		    device,
+			 QStringList &	    errors_ret );
+
+	/**
+	 * Add 'bytes' to the bytes copied so far. This is called in the
+	 * worker threads.
+	 **/
+	void addBytesCopied( qint64 bytes );
+
+	/**
+	 * Remove 'item' with 'path' from the tree. If anything else changed
+	 * the tree in the meantime, 'item' might be gone, so it is looked up
+	 * by 'path' instead.
+	 **/
+	void removeFromTree( FileInfo * item, const QString & path );
+
+	/**
+	 * Wrap up when all items are done.
+	 **/
+	void finish();
+
+
+	//
+	// Data members
+	//
+
+	DirTree *	     _tree;
+	quint64		     _generation;
+	bool		     _itemsValid;
+	QVector<Item>	     _items;
+	Item *		     _itemData;	      // _items.data() for the worker threads
+	int		     _doneCount;
+	int		     _trashedCount;
+	int		     _errorCount;
+	QStringList	     _failedPaths;
+	bool		     _finished;
+	QThreadPool	     _threadPool;
+	QTimer		     _progressTimer;
+	mutable QMutex	     _bytesMutex;
+	qint64		     _bytesCopied;
+	QAtomicInt	     _canceled;
+
+    };	// class TrashJob
+
+}	// namespace QDirStat
+
+
+#endif	// TrashJob_h
@@ -0,0 +1,89 @@
+/*
+ *   File name: TreeSnapshot.cpp
+ *   Summary:	Read-only copy of a directory tree for worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include "TreeSnapshot.h"
+#include "DirTree.h"
+#include "FileInfoIterator.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+TreeSnapshot::TreeSnapshot():
+    _tree( 0 ),
+    _generation( 0 )
+{
+
+}
+
+
+TreeSnapshot::TreeSnapshot( FileInfo * subtree ):
+    _tree( 0 ),
+    _generation( 0 )
+{
+    if ( ! subtree )
+	return;
+
+    _tree	= subtree->tree();
+    _generation = _tree ? _tree->generation() : 0;
+
+    _nodes.reserve( subtree->totalItems() + 1 );
+    add( subtree, -1, 0 );
+}
+
+
+void TreeSnapshot::add( FileInfo * item, int parent, int depth )
+{
+    int index = _nodes.size();
+
+    TreeSnapshotNode node;
+    node.item	       = item;
+    node.name	       = item->name();
+    node.size	       = item->size();
+    node.allocatedSize = item->allocatedSize();
+    node.mtime	       = item->mtime();
+    node.mode	       = item->mode();
+    node.parent	       = parent;
+    node.subtreeEnd    = index + 1;
+    node.depth	       = depth;
+    _nodes << node;
+
+    FileInfoIterator it( item );
+
+    while ( *it )
+    {
+	if ( (*it)->isDotEntry() )
+	{
+	    // The children of a dot entry belong to its parent
+
+	    FileInfoIterator dotIt( *it );
+
+	    while ( *dotIt )
+	    {
+		add( *dotIt, index, depth + 1 );
+		++dotIt;
+	    }
+	}
+	else
+	{
+	    add( *it, index, depth + 1 );
+	}
+
+	++it;
+    }
+
+    _nodes[ index ].subtreeEnd = _nodes.size();
+}
+
+
+bool TreeSnapshot::isCurrent() const
+{
+    return _tree && _tree->generation() == _generation;
+}
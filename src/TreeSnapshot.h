@@ -0,0 +1,137 @@
+/*
+ *   File name: TreeSnapshot.h
+ *   Summary:	Read-only copy of a directory tree for worker threads
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef TreeSnapshot_h
+#define TreeSnapshot_h
+
+
+#include <QString>
+#include <QVector>
+
+#include "FileInfo.h"
+
+
+namespace QDirStat
+{
+    class DirTree;
+
+    /**
+     * The values of one item in a TreeSnapshot.
+     **/
+    struct TreeSnapshotNode
+    {
+	FileInfo * item;	// only for use on the main thread, see TreeSnapshot
+	QString	   name;
+	FileSize   size;
+	FileSize   allocatedSize;
+	time_t	   mtime;
+	mode_t	   mode;
+	int	   parent;	// index of the parent node, -1 for the first one
+	int	   subtreeEnd;	// index after the last node of this subtree
+	int	   depth;	// 0 for the first one
+
+	bool isDir()	 const { return S_ISDIR( mode ); }
+	bool isFile()	 const { return S_ISREG( mode ); }
+	bool isSymLink() const { return S_ISLNK( mode ); }
+    };
+
+
+    /**
+     * An immutable copy of the values of a subtree that worker threads can
+     * walk while the live DirTree changes on the main thread: The DirTree
+     * and its items must only be used on the main thread.
+     *
+     * Creating a snapshot is a single linear pass over the subtree on the
+     * main thread. Copying a snapshot is cheap: The nodes are implicitly
+     * shared, and implicit sharing is thread-safe.
+     *
+     * The nodes are in preorder; the children of a dot entry are treated
+     * like children of its parent, and the dot entry itself is omitted.
+     * So the nodes of a subtree are the range from its index to its
+     * 'subtreeEnd'.
+     *
+     * Each snapshot has the generation of its tree (see
+     * DirTree::generation()). The 'item' pointers of the nodes may only be
+     * used on the main thread, and only while isCurrent() says that the
+     * tree did not change since the snapshot was taken.
+     **/
+    class TreeSnapshot
+    {
+    public:
+
+	/**
+	 * Create an empty snapshot.
+	 **/
+	TreeSnapshot();
+
+	/**
+	 * Create a snapshot of 'subtree'. This must be called on the main
+	 * thread.
+	 **/
+	explicit TreeSnapshot( FileInfo * subtree );
+
+	/**
+	 * Return 'true' if this snapshot is empty.
+	 **/
+	bool isEmpty() const { return _nodes.isEmpty(); }
+
+	/**
+	 * Return the number of nodes.
+	 **/
+	int size() const { return _nodes.size(); }
+
+	/**
+	 * Return node no. 'index'.
+	 **/
+	const TreeSnapshotNode & node( int index ) const { return _nodes.at( index ); }
+
+	/**
+	 * Return all nodes.
+	 **/
+	const QVector<TreeSnapshotNode> & nodes() const { return _nodes; }
+
+	/**
+	 * Return the tree of this snapshot. Only use this on the main thread.
+	 **/
+	DirTree * tree() const { return _tree; }
+
+	/**
+	 * Return the generation of the tree when this snapshot was taken.
+	 **/
+	quint64 generation() const { return _generation; }
+
+	/**
+	 * Return 'true' if the tree did not change since this snapshot was
+	 * taken, so the 'item' pointers of the nodes are still valid. This
+	 * must be called on the main thread.
+	 **/
+	bool isCurrent() const;
+
+
+    protected:
+
+	/**
+	 * Add 'item' and everything below it with parent node 'parent'.
+	 **/
+	void add( FileInfo * item, int parent, int depth );
+
+
+	//
+	// Data members
+	//
+
+	QVector<TreeSnapshotNode> _nodes;
+	DirTree *		  _tree;
+	quint64			  _generation;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef TreeSnapshot_h
@@ -7,9 +7,16 @@
  */
 
 
+#include <algorithm>
+
+#include <QVector>
+
 #include "TreeWalker.h"
-#include "FileSizeStats.h"
-#include "FileMTimeStats.h"
+#include "ParallelWalker.h"
+#include "DirTree.h"
+#include "FileInfoIterator.h"
+#include "SizeHistory.h"
+#include "SparseFiles.h"
 #include "SysUtil.h"
 #include "Logger.h"
 #include "Exception.h"
@@ -20,69 +27,383 @@
 using namespace QDirStat;
 
 
-void LargestFilesTreeWalker::prepare( FileInfo * subtree )
+namespace
 {
-    _threshold = 0;
+    /**
+     * A file that might be one of the top files.
+     **/
+    struct Candidate
+    {
+	qint64	   key;
+	FileInfo * file;
+    };
 
-    FileSizeStats stats;
-    stats.collect( subtree );
-    stats.sort();
 
-    if ( stats.dataSize() <= 100 )
-        _threshold = stats.quartile( 3 );
-    else if ( stats.dataSize() <= 1000 )
-        _threshold = stats.percentile( 99 );
-    else
+    /**
+     * Heap order for the candidates: The one with the lowest key, i.e. the
+     * first one to drop when there is a better one, is on top of the heap.
+     * std::sort_heap() with this sorts the best one first.
+     **/
+    bool betterCandidate( const Candidate & a, const Candidate & b )
     {
-        int index = stats.dataSize() - RESULTS_COUNT;
-        _threshold = stats.data().at( index );
+	return a.key > b.key;
     }
+
+
+    /**
+     * The best candidates that one task found so far.
+     **/
+    struct TopFiles
+    {
+	TopFiles(): fileCount( 0 ) {}
+
+	/**
+	 * Add a candidate if it is better than the worst one in the heap
+	 * or if the heap is not full yet.
+	 **/
+	void add( const Candidate & candidate )
+	{
+	    if ( heap.size() < RESULTS_COUNT )
+	    {
+		heap << candidate;
+		std::push_heap( heap.begin(), heap.end(), betterCandidate );
+	    }
+	    else if ( candidate.key > heap.first().key )
+	    {
+		std::pop_heap( heap.begin(), heap.end(), betterCandidate );
+		heap.last() = candidate;
+		std::push_heap( heap.begin(), heap.end(), betterCandidate );
+	    }
+	}
+
+	QVector<Candidate> heap;
+	int		   fileCount;
+    };
+
+
+    qint64 sizeKey( const FileInfo * file )
+    {
+	return file->size();
+    }
+
+
+    qint64 newKey( const FileInfo * file )
+    {
+	return file->mtime();
+    }
+
+
+    qint64 oldKey( const FileInfo * file )
+    {
+	return -( (qint64) file->mtime() );
+    }
+
+
+    bool lessName( FileInfo * a, FileInfo * b )
+    {
+	return a->name() < b->name();
+    }
+
+}	// namespace
+
+
+int TreeWalker::taskCount( FileInfo * subtree ) const
+{
+    return isIoBound() ?
+        ParallelWalker::ioTaskCount( subtree ) :
+        ParallelWalker::taskCount  ( subtree );
 }
 
 
-void NewFilesTreeWalker::prepare( FileInfo * subtree )
+qint64 TreeWalker::findTopFiles( FileInfo * subtree,
+				 qint64 ( * key )( const FileInfo * file ) )
 {
-    _threshold = 0;
+    _results.clear();
+
+    if ( ! subtree )
+	return 0;
+
+    // Each task keeps its own top files; merge them at the end
+
+    int taskCount = ParallelWalker::taskCount( subtree );
+    QVector<TopFiles> taskTopFiles( taskCount );
+    TopFiles * topFiles = taskTopFiles.data();
 
-    FileMTimeStats stats;
-    stats.collect( subtree );
-    stats.sort();
+    ParallelWalker::forEachFile( subtree, taskCount,
+				 [=]( int task, FileInfo * file )
+				 {
+				     Candidate candidate = { key( file ), file };
+				     topFiles[ task ].add( candidate );
+				     ++topFiles[ task ].fileCount;
+				 } );
 
-    if ( stats.dataSize() <= 100 )
-        _threshold = stats.quartile( 3 );
-    else if ( stats.dataSize() <= 1000 )
-        _threshold = stats.percentile( 99 );
-    else
+    TopFiles top = taskTopFiles.first();
+
+    for ( int task = 1; task < taskCount; ++task )
     {
-        int index = stats.dataSize() - RESULTS_COUNT;
-        _threshold = stats.data().at( index );
+	top.fileCount += taskTopFiles.at( task ).fileCount;
+
+	foreach ( const Candidate & candidate, taskTopFiles.at( task ).heap )
+	    top.add( candidate );
     }
+
+    if ( top.heap.isEmpty() )
+	return 0;
+
+    std::sort_heap( top.heap.begin(), top.heap.end(), betterCandidate );
+
+
+    // Small subtrees get the top quarter, medium ones the top percent;
+    // all of those fit into the heap. Files with the same key as the last
+    // one are also kept.
+
+    int count = RESULTS_COUNT;
+
+    if ( top.fileCount <= 100 )
+	count = ( top.fileCount + 3 ) / 4;
+    else if ( top.fileCount <= 1000 )
+	count = ( top.fileCount + 99 ) / 100;
+
+    count = qMin( count, top.heap.size() );
+
+    while ( count < top.heap.size() &&
+	    top.heap.at( count ).key == top.heap.at( count - 1 ).key )
+    {
+	++count;
+    }
+
+    for ( int i=0; i < count; ++i )
+	_results << top.heap.at( i ).file;
+
+    return top.heap.at( count - 1 ).key;
+}
+
+
+void LargestFilesTreeWalker::prepare( FileInfo * subtree )
+{
+    _threshold = findTopFiles( subtree, sizeKey );
+}
+
+
+void NewFilesTreeWalker::prepare( FileInfo * subtree )
+{
+    _threshold = findTopFiles( subtree, newKey );
 }
 
 
 void OldFilesTreeWalker::prepare( FileInfo * subtree )
 {
-    _threshold = 0;
+    _threshold = -findTopFiles( subtree, oldKey );
+}
+
+
+bool BrokenSymLinksTreeWalker::check( FileInfo * item )
+{
+    if ( ! item || ! item->isSymLink() )
+        return false;
+
+    // Checked already while reading the directory?
+
+    if ( item->isSymLinkChecked() )
+        return item->isBrokenSymLink();
+
+    // This runs in worker threads: Don't touch the URL cache or the log
+
+    QString path;
+    item->appendUrl( path, false );
+
+    return SysUtil::isBrokenSymLink( path, true );
+}
+
+
+bool SparseFilesTreeWalker::check( FileInfo * item )
+{
+    if ( ! item || ! item->isFile() || ! item->isSparseFile() )
+        return false;
+
+    if ( ! _verify )
+        return true;
+
+    QString path;
+    item->appendUrl( path, false );
+
+    FileSize data = SparseFileCache::instance()->dataBytes( path );
+
+    return data < 0 || data < item->size();
+}
+
+
+void FastestGrowingDirsTreeWalker::prepare( FileInfo * subtree )
+{
+    _results.clear();
+    _threshold = 1;
+    _history   = subtree && subtree->tree() ? subtree->tree()->sizeHistory() : 0;
+
+    if ( ! subtree || ! subtree->isDirInfo() || ! _history )
+        return;
+
+    // There are a lot fewer directories than files, so there is no need
+    // for a bounded heap or for worker threads here.
+
+    QVector<QPair<FileSize, FileInfo *> > growth;
+    collect( subtree, subtree->url(), growth );
+
+    int count = qMin( growth.size(), RESULTS_COUNT );
 
-    FileMTimeStats stats;
-    stats.collect( subtree );
-    stats.sort();
+    std::partial_sort( growth.begin(), growth.begin() + count, growth.end(),
+                       []( const QPair<FileSize, FileInfo *> & a,
+                           const QPair<FileSize, FileInfo *> & b )
+                       { return a.first > b.first; } );
 
-    if ( stats.dataSize() <= 100 )
-        _threshold = stats.quartile( 1 );
-    else if ( stats.dataSize() <= 1000 )
-        _threshold = stats.percentile( 1 );
-    else
+    for ( int i=0; i < count; ++i )
+        _results << growth.at( i ).second;
+
+    if ( count > 0 )
+        _threshold = growth.at( count - 1 ).first;
+}
+
+
+void FastestGrowingDirsTreeWalker::collect( FileInfo *                        dir,
+                                            const QString &                   path,
+                                            QVector<QPair<FileSize, FileInfo *> > & growth ) const
+{
+    FileSize dirGrowth = _history->trend( path ).growth;
+
+    if ( dirGrowth > 0 )
+        growth << qMakePair( dirGrowth, dir );
+
+    QString prefix = path == "/" ? "" : path;
+
+    for ( FileInfo * child = dir->firstChild(); child; child = child->next() )
     {
-        int index = RESULTS_COUNT;
-        _threshold = stats.data().at( index );
+        if ( child->isDirInfo() && ! child->isPseudoDir() )
+            collect( child, prefix + "/" + child->name(), growth );
     }
 }
 
 
-bool BrokenSymLinksTreeWalker::check( FileInfo * item )
+bool FastestGrowingDirsTreeWalker::check( FileInfo * item )
 {
-    return item &&
-        item->isSymLink() &&
-        SysUtil::isBrokenSymLink( item->url() );
+    if ( ! item || ! item->isDirInfo() || item->isPseudoDir() || ! _history )
+        return false;
+
+    QString path;
+    item->appendUrl( path, false );
+
+    return _history->trend( path ).growth >= _threshold;
+}
+
+
+void HardLinkedFilesTreeWalker::prepare( FileInfo * subtree )
+{
+    _results.clear();
+    _groups.clear();
+
+    DirTree * tree = subtree ? subtree->tree() : 0;
+    _hasResults = tree && tree->hardLinkIndex()->isComplete();
+
+    if ( ! _hasResults )
+        return;
+
+    foreach ( const FileInfoList & links, tree->hardLinkIndex()->groups( subtree ) )
+    {
+        foreach ( FileInfo * file, links )
+        {
+            _results << file;
+            _groups.insert( file, links.first() );
+        }
+    }
+}
+
+
+void NameSearchTreeWalker::prepare( FileInfo * subtree )
+{
+    _results.clear();
+    _taskFilters.clear();
+    _hasResults = _index.isCurrent() && _index.hasSubtree( subtree );
+
+    if ( _hasResults )
+    {
+        _results = _index.find( _filter, subtree );
+        return;
+    }
+
+    // A QRegExp keeps the state of its last match, so each task needs its
+    // own copy
+
+    int tasks = taskCount( subtree );
+
+    for ( int task = 0; task < tasks; ++task )
+        _taskFilters << PkgFilter( _filter );
+}
+
+
+bool NameSearchTreeWalker::check( FileInfo * item )
+{
+    if ( ! item )
+        return false;
+
+    PkgFilter filter( _filter );
+
+    return filter.matches( item->name() );
+}
+
+
+bool NameSearchTreeWalker::checkInTask( int task, FileInfo * item )
+{
+    if ( task < 0 || task >= _taskFilters.size() )
+        return check( item );
+
+    return item && _taskFilters.at( task ).matches( item->name() );
+}
+
+
+void FileQueryTreeWalker::prepare( FileInfo * subtree )
+{
+    _results.clear();
+    _visitedDirs = 0;
+    _skippedDirs = 0;
+
+    if ( ! subtree )
+	return;
+
+    if ( subtree->isDirInfo() )
+	collect( subtree );
+    else if ( _query.matches( subtree ) )
+	_results << subtree;
+
+    logDebug() << _results.size() << " matches in " << subtree
+	       << "; visited " << _visitedDirs << " directories, skipped " << _skippedDirs
+	       << endl;
+}
+
+
+void FileQueryTreeWalker::collect( FileInfo * dir )
+{
+    if ( ! _query.mayContainMatches( dir ) )
+    {
+	++_skippedDirs;
+	return;
+    }
+
+    ++_visitedDirs;
+
+    QVector<FileInfo *> children;
+    FileInfoIterator it( dir );
+
+    while ( *it )
+    {
+	children << *it;
+	++it;
+    }
+
+    std::sort( children.begin(), children.end(), lessName );
+
+    foreach ( FileInfo * child, children )
+    {
+	if ( child->isDirInfo() )
+	    collect( child );
+	else if ( _query.matches( child ) )
+	    _results << child;
+    }
 }
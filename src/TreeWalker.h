@@ -10,11 +10,21 @@
 #ifndef TreeWalker_h
 #define TreeWalker_h
 
+#include <QHash>
+#include <QPair>
+#include <QVector>
+
 #include "FileInfo.h"
+#include "FileQuery.h"
+#include "NameIndex.h"
+#include "PkgFilter.h"
 
 
 namespace QDirStat
 {
+    class SizeHistory;
+
+
     /**
      * Abstract base class to walk recursively through a FileInfo tree to check
      * for each tree item whether or not it should be used for further
@@ -28,6 +38,8 @@ namespace QDirStat
      *   - files with multiple hard links
      *   - broken symlinks
      *   - sparse files
+     *   - fastest growing directories
+     *   - files that match a FileQuery
      **/
     class TreeWalker
     {
@@ -41,8 +53,8 @@ namespace QDirStat
          * calculate thresholds for later checks, e.g. up to which value an
          * item is considered to belong to the category. This may involve
          * traversing the tree a first time to calculate that value, e.g. by
-         * adding all appropriate items to an internal list that is sorted so
-         * the value of the nth first or last element is used.
+         * keeping the n best items so the value of the last of them is used;
+         * those items can also be kept as the results (see hasResults()).
          *
          * This default implementation does nothing.
          **/
@@ -52,10 +64,82 @@ namespace QDirStat
          * Check if 'item' fits into the category (largest / newest / oldest
          * file etc.). Return 'true' if it fits, 'false' if not.
          *
+         * For big subtrees, this is called from several worker threads at
+         * the same time (see ParallelWalker), so it must be thread safe: It
+         * may only read the tree, and it must not use the Logger.
+         *
          * Derived classes are required to implement this.
          **/
         virtual bool check( FileInfo * item ) = 0;
 
+        /**
+         * Check 'item' in worker task number 'task' (0 .. taskCount()-1
+         * for the subtree of prepare()). Derived classes that need their
+         * own copy of something that is not thread safe in each task can
+         * set those up in prepare() and reimplement this.
+         *
+         * This default implementation calls check().
+         **/
+        virtual bool checkInTask( int /* task */, FileInfo * item )
+            { return check( item ); }
+
+        /**
+         * Return the number of worker tasks to use for checking the items
+         * of 'subtree' (see ParallelWalker).
+         **/
+        int taskCount( FileInfo * subtree ) const;
+
+        /**
+         * Return 'true' if check() waits for I/O, so it pays off to use
+         * more worker threads than CPUs even for smaller subtrees.
+         *
+         * This default implementation returns 'false'.
+         **/
+        virtual bool isIoBound() const { return false; }
+
+        /**
+         * Return 'true' if prepare() already found all the items of the
+         * category, so they can be taken from results() without walking the
+         * tree again with check().
+         *
+         * This default implementation returns 'false'.
+         **/
+        virtual bool hasResults() const { return false; }
+
+        /**
+         * Return the items that prepare() found, best first. This is only
+         * meaningful if hasResults() returns 'true'.
+         **/
+        const FileInfoList & results() const { return _results; }
+
+        /**
+         * Return the first item of the group that 'item' of the results()
+         * belongs to, e.g. the first of several hard links to the same
+         * file, or 0 if it is not in a group. The LocateFilesWindow keeps
+         * the items of a group together.
+         *
+         * This default implementation returns 0.
+         **/
+        virtual FileInfo * resultGroup( FileInfo * /* item */ ) const { return 0; }
+
+    protected:
+
+        /**
+         * Walk 'subtree' once and keep the files with the highest 'key' in
+         * _results, best first: The top RESULTS_COUNT files for big
+         * subtrees, the top 1% for medium and the top 25% for small ones.
+         * Return the key of the last file in _results (0 if there are no
+         * files).
+         *
+         * This uses a bounded heap of candidates, so it neither needs to
+         * store nor to sort the values of all files.
+         **/
+        qint64 findTopFiles( FileInfo * subtree,
+                             qint64 ( * key )( const FileInfo * file ) );
+
+
+        FileInfoList _results;
+
     };  // class TreeWalker
 
 
@@ -67,10 +151,13 @@ namespace QDirStat
     public:
 
         /**
-         * Find the threshold for what is considered a "large file".
+         * Find the largest files and the threshold for what is considered
+         * a "large file".
          **/
         virtual void prepare( FileInfo * subtree );
 
+        virtual bool hasResults() const { return true; }
+
         virtual bool check( FileInfo * item )
             { return item && item->isFile() && item->size() >= _threshold; }
 
@@ -88,10 +175,13 @@ namespace QDirStat
     public:
 
         /**
-         * Find the threshold for what is considered a "new file".
+         * Find the newest files and the threshold for what is considered a
+         * "new file".
          **/
         virtual void prepare( FileInfo * subtree );
 
+        virtual bool hasResults() const { return true; }
+
         virtual bool check( FileInfo * item )
             { return item && item->isFile() && item->mtime() >= _threshold; }
 
@@ -109,10 +199,13 @@ namespace QDirStat
     public:
 
         /**
-         * Find the threshold for what is considered an "old file".
+         * Find the oldest files and the threshold for what is considered an
+         * "old file".
          **/
         virtual void prepare( FileInfo * subtree );
 
+        virtual bool hasResults() const { return true; }
+
         virtual bool check( FileInfo * item )
             { return item && item->isFile() && item->mtime() <= _threshold; }
 
@@ -129,8 +222,28 @@ namespace QDirStat
     {
     public:
 
+        HardLinkedFilesTreeWalker():
+            _hasResults( false )
+            {}
+
+        /**
+         * Take the files from the tree's HardLinkIndex, grouped by inode,
+         * if it is complete.
+         **/
+        virtual void prepare( FileInfo * subtree );
+
+        virtual bool hasResults() const { return _hasResults; }
+
+        virtual FileInfo * resultGroup( FileInfo * item ) const
+            { return _groups.value( item ); }
+
         virtual bool check( FileInfo * item )
             { return item && item->isFile() && item->links() > 1; }
+
+    protected:
+
+        bool                          _hasResults;
+        QHash<FileInfo *, FileInfo *> _groups;
     };
 
 
@@ -142,18 +255,169 @@ namespace QDirStat
     public:
 
         virtual bool check( FileInfo * item );
+
+        virtual bool isIoBound() const { return true; }
     };
 
 
     /**
      * TreeWalker to find sparse files.
+     *
+     * The candidates are the files with fewer allocated blocks than their
+     * size (FileInfo::isSparseFile()). With 'verify', each candidate is
+     * also checked for holes (SparseFileCache), so files that are only
+     * compressed by the filesystem are left out; candidates that can't be
+     * checked (e.g. no permission) are still listed.
      **/
     class SparseFilesTreeWalker: public TreeWalker
     {
     public:
 
-        virtual bool check( FileInfo * item )
-            { return item && item->isFile() && item->isSparseFile(); }
+        /**
+         * Constructor.
+         **/
+        SparseFilesTreeWalker( bool verify = false ):
+            _verify( verify )
+            {}
+
+        virtual bool check( FileInfo * item );
+
+        virtual bool isIoBound() const { return _verify; }
+
+    protected:
+
+        bool _verify;
+    };
+
+
+    /**
+     * TreeWalker to find the directories that grew the most according to
+     * the size history of the tree (see DirTree::sizeHistory()): The top
+     * RESULTS_COUNT of them, but only those that grew at all.
+     **/
+    class FastestGrowingDirsTreeWalker: public TreeWalker
+    {
+    public:
+
+        FastestGrowingDirsTreeWalker():
+            _history( 0 ),
+            _threshold( 1 )
+            {}
+
+        /**
+         * Find the fastest growing directories with the current size
+         * history of the tree of 'subtree'.
+         **/
+        virtual void prepare( FileInfo * subtree );
+
+        virtual bool hasResults() const { return true; }
+
+        virtual bool check( FileInfo * item );
+
+    protected:
+
+        /**
+         * Add the growth of 'dir' with path 'path' and of all directories
+         * below it to 'growth'.
+         **/
+        void collect( FileInfo *                        dir,
+                      const QString &                   path,
+                      QVector<QPair<FileSize, FileInfo *> > & growth ) const;
+
+        const SizeHistory * _history;
+        FileSize            _threshold;
+    };
+
+
+    /**
+     * TreeWalker to find items by name.
+     *
+     * With a current NameIndex for the subtree, prepare() finds them right
+     * away; otherwise each item is checked.
+     **/
+    class NameSearchTreeWalker: public TreeWalker
+    {
+    public:
+
+        /**
+         * Constructor: Find the items whose name matches 'filter', using
+         * 'index' if it is still current when prepare() is called.
+         **/
+        NameSearchTreeWalker( const PkgFilter & filter,
+                              const NameIndex & index = NameIndex() ):
+            _filter( filter ),
+            _index( index ),
+            _hasResults( false )
+            {}
+
+        /**
+         * Find the matching items in the index if possible.
+         **/
+        virtual void prepare( FileInfo * subtree );
+
+        virtual bool hasResults() const { return _hasResults; }
+
+        virtual bool check( FileInfo * item );
+
+        virtual bool checkInTask( int task, FileInfo * item );
+
+    protected:
+
+        PkgFilter          _filter;
+        NameIndex          _index;
+        bool               _hasResults;
+        QVector<PkgFilter> _taskFilters;
+    };
+
+
+    /**
+     * TreeWalker to find the files that match a FileQuery.
+     *
+     * prepare() walks the subtree in path order, but it skips each
+     * directory whose totals show that there is no matching file below it
+     * (see FileQuery::mayContainMatches()), so a selective query only
+     * visits a small part of the tree.
+     **/
+    class FileQueryTreeWalker: public TreeWalker
+    {
+    public:
+
+        /**
+         * Constructor.
+         **/
+        FileQueryTreeWalker( const FileQuery & query ):
+            _query( query ),
+            _visitedDirs( 0 ),
+            _skippedDirs( 0 )
+            {}
+
+        /**
+         * Find the matching files. The results are in path order.
+         **/
+        virtual void prepare( FileInfo * subtree );
+
+        virtual bool hasResults() const { return true; }
+
+        virtual bool check( FileInfo * item ) { return _query.matches( item ); }
+
+        /**
+         * Return the number of directories that prepare() looked into and
+         * the number of those that it skipped.
+         **/
+        int visitedDirs() const { return _visitedDirs; }
+        int skippedDirs() const { return _skippedDirs; }
+
+    protected:
+
+        /**
+         * Add the matching files of 'dir' and below to _results, sorted
+         * by name within each directory.
+         **/
+        void collect( FileInfo * dir );
+
+        FileQuery _query;
+        int       _visitedDirs;
+        int       _skippedDirs;
     };
 
 }       // namespace QDirStat
@@ -0,0 +1,327 @@
+/*
+ *   File name: TreemapExporter.cpp
+ *   Summary:	Export of a treemap as an image without any widgets
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <sys/stat.h>	// S_IXUSR
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include "TreemapExporter.h"
+#include "TreemapView.h"	// default settings
+#include "DirTree.h"
+#include "MimeCategorizer.h"
+#include "Settings.h"
+#include "SettingsHelpers.h"
+#include "Logger.h"
+#include "Exception.h"
+
+
+// The directory tiles are painted in squares of this many pixels, each one
+// in one go in a worker thread
+#define ExportTileSize	512
+
+
+using namespace QDirStat;
+
+
+class TreemapExporter::PaintTask: public QRunnable
+{
+public:
+
+    PaintTask( const TreemapExporter * exporter,
+	       const QVector<QRect> &  rects,
+	       uchar *		       raster,
+	       int		       bytesPerLine,
+	       QAtomicInt &	       next ):
+	_exporter( exporter ),
+	_rects( rects ),
+	_raster( raster ),
+	_bytesPerLine( bytesPerLine ),
+	_next( next )
+	{}
+
+    virtual void run() Q_DECL_OVERRIDE
+    {
+	int i;
+
+	while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _rects.size() )
+	    _exporter->paintDirs( _rects.at( i ), _raster, _bytesPerLine );
+    }
+
+private:
+
+    const TreemapExporter * _exporter;
+    const QVector<QRect> &  _rects;
+    uchar *		    _raster;
+    int			    _bytesPerLine;
+    QAtomicInt &	    _next;
+};
+
+
+class TreemapExporter::CushionTask: public QRunnable
+{
+public:
+
+    CushionTask( const QVector<CushionParams> & params,
+		 uchar *			raster,
+		 int				bytesPerLine,
+		 const QSize &			rasterSize,
+		 QAtomicInt &			next ):
+	_params( params ),
+	_raster( raster ),
+	_bytesPerLine( bytesPerLine ),
+	_rasterSize( rasterSize ),
+	_next( next )
+	{}
+
+    virtual void run() Q_DECL_OVERRIDE
+    {
+	int i;
+
+	while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _params.size() )
+	{
+	    const CushionParams & params = _params.at( i );
+
+	    int x      = qRound( params.rect.x() );
+	    int y      = qRound( params.rect.y() );
+	    int width  = qMin( qRound( params.rect.width()  ), _rasterSize.width()  - x );
+	    int height = qMin( qRound( params.rect.height() ), _rasterSize.height() - y );
+
+	    if ( x < 0 || y < 0 || width < 1 || height < 1 )
+		continue;
+
+	    // The files don't overlap, so each cushion can be rendered
+	    // right into its part of the raster
+
+	    QImage image( _raster + y * _bytesPerLine + x * sizeof( QRgb ),
+			  width, height, _bytesPerLine, QImage::Format_RGB32 );
+
+	    TreemapTile::renderCushion( params, image );
+	}
+    }
+
+private:
+
+    const QVector<CushionParams> & _params;
+    uchar *			   _raster;
+    int				   _bytesPerLine;
+    QSize			   _rasterSize;
+    QAtomicInt &		   _next;
+};
+
+
+
+
+TreemapExporter::TreemapExporter( const QString & fileName,
+				  DirTree *	  tree,
+				  const QSize &	  size )
+{
+    _ok = writeFile( fileName, tree, size );
+}
+
+
+void TreemapExporter::readSettings()
+{
+    Settings settings;
+    settings.beginGroup( "Treemaps" );
+
+    _ambientLight      = settings.value( "AmbientLight",      DefaultAmbientLight	).toInt();
+    _heightScaleFactor = settings.value( "HeightScaleFactor", DefaultHeightScaleFactor	).toDouble();
+    _ensureContrast    = settings.value( "EnsureContrast",    true			).toBool();
+    _useDirGradient    = settings.value( "UseDirGradient",    true			).toBool();
+    _minTileSize       = settings.value( "MinTileSize",	      DefaultMinTileSize	).toInt();
+
+    _dirGradientStart  = readColorEntry( settings, "DirGradientStart", QColor( 0x60, 0x60, 0x70 ) );
+    _dirGradientEnd    = readColorEntry( settings, "DirGradientEnd",   QColor( 0x70, 0x70, 0x80 ) );
+
+    settings.endGroup();
+}
+
+
+bool TreemapExporter::writeFile( const QString & fileName, DirTree * tree, const QSize & size )
+{
+    if ( ! tree || ! tree->firstToplevel() || size.isEmpty() )
+	return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    readSettings();
+
+    QThreadPool threadPool;
+    int threads = qMax( 1, QThread::idealThreadCount() );
+
+    FileInfo * root = tree->firstToplevel();
+    _rootRect = QRect( QPoint( 0, 0 ), size );
+
+    TreemapLayout layout( _minTileSize,
+			  0,	// minDirTileSize
+			  _heightScaleFactor,
+			  &threadPool );
+
+    _nodes = layout.layout( root, _rootRect, CushionSurface() );
+
+    QImage raster( size, QImage::Format_RGB32 );
+
+    if ( raster.isNull() )
+    {
+	logError() << "Can't create an image with " << size.width() << "x" << size.height()
+		   << " pixels" << endl;
+	return false;
+    }
+
+    // The tile colors are taken in the main thread: MimeCategorizer is not
+    // thread safe.
+
+    QVector<CushionParams> params;
+    _dirNodes.clear();
+
+    for ( int i = 0; i < _nodes.size(); ++i )
+    {
+	FileInfo * orig = _nodes.at( i ).orig;
+
+	if ( orig->isDir() || orig->isDotEntry() )
+	    _dirNodes << i;
+	else
+	    params << cushionParams( _nodes.at( i ) );
+    }
+
+    uchar * bits	 = raster.bits();
+    int	    bytesPerLine = raster.bytesPerLine();
+
+    // The directories first so the files are painted on top of them
+
+    QVector<QRect> rects;
+
+    for ( int y = 0; y < size.height(); y += ExportTileSize )
+    {
+	for ( int x = 0; x < size.width(); x += ExportTileSize )
+	    rects << ( QRect( x, y, ExportTileSize, ExportTileSize ) & _rootRect );
+    }
+
+    QAtomicInt nextRect( 0 );
+    threadPool.setMaxThreadCount( threads );
+
+    for ( int i = 0; i < threads; ++i )
+	threadPool.start( new PaintTask( this, rects, bits, bytesPerLine, nextRect ) );
+
+    threadPool.waitForDone();
+
+    QAtomicInt nextCushion( 0 );
+
+    for ( int i = 0; i < threads; ++i )
+	threadPool.start( new CushionTask( params, bits, bytesPerLine, size, nextCushion ) );
+
+    threadPool.waitForDone();
+
+    logInfo() << "Rendered " << _nodes.size() << " tiles in "
+	      << timer.elapsed() / 1000.0 << " sec" << endl;
+
+    if ( ! raster.save( fileName, "PNG" ) )
+    {
+	logError() << "Can't write " << fileName << endl;
+	return false;
+    }
+
+    logInfo() << "Wrote treemap " << fileName << " in " << timer.elapsed() / 1000.0 << " sec" << endl;
+
+    return true;
+}
+
+
+void TreemapExporter::paintDirs( const QRect & rect, uchar * raster, int bytesPerLine ) const
+{
+    QImage image( raster + rect.y() * bytesPerLine + rect.x() * sizeof( QRgb ),
+		  rect.width(), rect.height(), bytesPerLine, QImage::Format_RGB32 );
+
+    QPainter painter( &image );
+    painter.translate( -rect.topLeft() );
+    painter.fillRect( rect, QColor( 0x60, 0x60, 0x60 ) );
+
+    QBrush brush = dirBrush( _rootRect );
+
+    if ( brush.style() != Qt::NoBrush )
+	painter.fillRect( _rootRect, brush );
+
+    // Each parent comes before its children in the layout
+
+    foreach ( int i, _dirNodes )
+    {
+	const QRectF & nodeRect = _nodes.at( i ).rect;
+
+	if ( nodeRect.intersects( rect ) )
+	{
+	    brush = dirBrush( nodeRect );
+
+	    if ( brush.style() != Qt::NoBrush )
+		painter.fillRect( nodeRect, brush );
+	}
+    }
+}
+
+
+QBrush TreemapExporter::dirBrush( const QRectF & rect ) const
+{
+    if ( ! _useDirGradient )
+	return QColor( 0x60, 0x60, 0x60 );
+
+    if ( qMax( rect.width(), rect.height() ) < _minTileSize )
+	return Qt::NoBrush;
+
+    QLinearGradient gradient( rect.topLeft(), rect.bottomRight() );
+    gradient.setColorAt( 0.0, _dirGradientStart );
+    gradient.setColorAt( 1.0, _dirGradientEnd	);
+
+    return gradient;
+}
+
+
+CushionParams TreemapExporter::cushionParams( const TreemapLayoutNode & node ) const
+{
+    CushionParams params;
+
+    params.rect		  = node.rect;
+    params.surface	  = node.surface;
+    params.color	  = tileColor( node.orig );
+    params.ambientLight	  = _ambientLight;
+    params.lightX	  = DefaultLightX;
+    params.lightY	  = DefaultLightY;
+    params.lightZ	  = DefaultLightZ;
+    params.ensureContrast = _ensureContrast;
+
+    return params;
+}
+
+
+QColor TreemapExporter::tileColor( FileInfo * file ) const
+{
+    if ( file->isFile() )
+    {
+	MimeCategory * category = MimeCategorizer::instance()->category( file );
+
+	if ( category )
+	    return category->color();
+
+	// Special case: Executables
+
+	if ( ( file->mode() & S_IXUSR ) == S_IXUSR )
+	    return Qt::magenta;
+    }
+    else
+    {
+	return Qt::blue;
+    }
+
+    return Qt::white;
+}
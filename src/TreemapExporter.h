@@ -0,0 +1,119 @@
+/*
+ *   File name: TreemapExporter.h
+ *   Summary:	Export of a treemap as an image without any widgets
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef TreemapExporter_h
+#define TreemapExporter_h
+
+
+#include <QBrush>
+#include <QColor>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+#include "TreemapLayout.h"
+
+
+namespace QDirStat
+{
+    class DirTree;
+
+    /**
+     * Writer for an image file with the treemap of a tree, e.g. for very
+     * big images for reports: This does not need a display, and it does not
+     * create a QGraphicsScene with a graphics item for each tile. The tiles
+     * are laid out with TreemapLayout and shaded with the same cushions and
+     * the same treemap settings as in TreemapView, so they look the same.
+     *
+     * The image is painted in worker threads: First the directory tiles in
+     * squares of ExportTileSize pixels, then the cushions of the files
+     * directly into the image.
+     **/
+    class TreemapExporter
+    {
+    public:
+
+	/**
+	 * Write the treemap of 'tree' with 'size' pixels to PNG file
+	 * 'fileName'.
+	 *
+	 * Check TreemapExporter::ok() to see if that went OK.
+	 **/
+	TreemapExporter( const QString & fileName,
+			 DirTree *	 tree,
+			 const QSize &	 size );
+
+	/**
+	 * Returns true if writing the file went OK.
+	 **/
+	bool ok() const { return _ok; }
+
+
+    protected:
+
+	/**
+	 * Read the treemap settings of TreemapView.
+	 **/
+	void readSettings();
+
+	/**
+	 * Lay out, paint and write the treemap. Returns 'true' if OK, 'false'
+	 * upon error.
+	 **/
+	bool writeFile( const QString & fileName, DirTree * tree, const QSize & size );
+
+	/**
+	 * Paint the part 'rect' of the directory tiles into 'raster'. This
+	 * is called in worker threads.
+	 **/
+	void paintDirs( const QRect & rect, uchar * raster, int bytesPerLine ) const;
+
+	/**
+	 * Return the brush for a directory tile with 'rect' like
+	 * TreemapTile uses it.
+	 **/
+	QBrush dirBrush( const QRectF & rect ) const;
+
+	/**
+	 * Return the parameters for rendering the cushion of 'node'.
+	 **/
+	CushionParams cushionParams( const TreemapLayoutNode & node ) const;
+
+	/**
+	 * Return the color of a file tile like TreemapView::tileColor().
+	 **/
+	QColor tileColor( FileInfo * file ) const;
+
+	class PaintTask;
+	class CushionTask;
+
+
+	//
+	// Data members
+	//
+
+	bool			   _ok;
+	QRect			   _rootRect;
+	QVector<TreemapLayoutNode> _nodes;
+	QVector<int>		   _dirNodes;	// indices in _nodes
+
+	int	_ambientLight;
+	double	_heightScaleFactor;
+	int	_minTileSize;
+	bool	_ensureContrast;
+	bool	_useDirGradient;
+	QColor	_dirGradientStart;
+	QColor	_dirGradientEnd;
+    };
+
+}	// namespace QDirStat
+
+
+#endif // ifndef TreemapExporter_h
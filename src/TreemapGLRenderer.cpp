@@ -0,0 +1,277 @@
+/*
+ *   File name: TreemapGLRenderer.cpp
+ *   Summary:	OpenGL cushion shading for the treemap view
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QOpenGLShaderProgram>
+
+#include "TreemapGLRenderer.h"
+#include "TreemapTile.h"
+#include "Exception.h"
+#include "Logger.h"
+
+
+// Position (2), cushion surface coefficients xx2, xx1, yy2, yy1 (4),
+// color (3), shade (1)
+#define FloatsPerVertex	    10
+
+#define PositionAttribute   0
+#define SurfaceAttribute    1
+#define ColorAttribute	    2
+#define ShadeAttribute	    3
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    const char * vertexShader =
+	"attribute vec2  position;\n"
+	"attribute vec4  surface;\n"
+	"attribute vec3  color;\n"
+	"attribute float shade;\n"
+	"uniform   mat4  matrix;\n"
+	"varying   vec2  scenePos;\n"
+	"varying   vec4  coefficients;\n"
+	"varying   vec3  tileColor;\n"
+	"varying   float cushion;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"    gl_Position  = matrix * vec4( position, 0.0, 1.0 );\n"
+	"    scenePos	  = position;\n"
+	"    coefficients = surface;\n"
+	"    tileColor	  = color;\n"
+	"    cushion	  = shade;\n"
+	"}\n";
+
+    // The same as TreemapTile::renderCushion(): The surface normal of the
+    // cushion at pixel ( x, y ) is ( nx, ny, 1 ) with
+    //
+    //	 nx = 2 * xx2 * x + xx1
+    //	 ny = 2 * yy2 * y + yy1
+
+    const char * fragmentShader =
+	"#ifdef GL_ES\n"
+	"precision highp float;\n"
+	"#endif\n"
+	"uniform vec3  light;\n"
+	"uniform float ambient;\n"
+	"varying vec2  scenePos;\n"
+	"varying vec4  coefficients;\n"
+	"varying vec3  tileColor;\n"
+	"varying float cushion;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"    if ( cushion < 0.5 )\n"
+	"    {\n"
+	"	 gl_FragColor = vec4( tileColor, 1.0 );\n"
+	"	 return;\n"
+	"    }\n"
+	"\n"
+	"    vec2  pixel = floor( scenePos );\n"
+	"    float nx	 = 2.0 * coefficients.x * pixel.x + coefficients.y;\n"
+	"    float ny	 = 2.0 * coefficients.z * pixel.y + coefficients.w;\n"
+	"    float cosa	 = ( nx * light.x + ny * light.y + light.z ) / sqrt( nx * nx + ny * ny + 1.0 );\n"
+	"    vec3  maxColor = max( tileColor - ambient, 0.0 );\n"
+	"\n"
+	"    gl_FragColor = vec4( clamp( maxColor * cosa, 0.0, 1.0 - ambient ) + ambient, 1.0 );\n"
+	"}\n";
+
+}	// namespace
+
+
+TreemapGLRenderer::TreemapGLRenderer():
+    _dirty( false ),
+    _initialized( false ),
+    _failed( false ),
+    _program( 0 ),
+    _buffer( QOpenGLBuffer::VertexBuffer )
+{
+
+}
+
+
+TreemapGLRenderer::~TreemapGLRenderer()
+{
+    if ( _buffer.isCreated() )
+	_buffer.destroy();
+
+    if ( _program )
+	delete _program;
+}
+
+
+void TreemapGLRenderer::clear()
+{
+    _vertices.clear();
+    _cushionRects.clear();
+    _dirty = true;
+}
+
+
+void TreemapGLRenderer::addCushion( const CushionParams & params )
+{
+    const QRectF & rect = params.rect;
+    const float	   surface[4] =
+	{
+	    (float) params.surface.xx2(),
+	    (float) params.surface.xx1(),
+	    (float) params.surface.yy2(),
+	    (float) params.surface.yy1()
+	};
+
+    // The cushion covers the same pixels as the image from
+    // TreemapTile::renderCushion()
+
+    QRectF pixels( QPointF( (int) rect.x(), (int) rect.y() ),
+		   QSizeF( qRound( rect.width() ), qRound( rect.height() ) ) );
+
+    addVertex( pixels.topLeft(),     surface, params.color, 1.0 );
+    addVertex( pixels.topRight(),    surface, params.color, 1.0 );
+    addVertex( pixels.bottomRight(), surface, params.color, 1.0 );
+
+    addVertex( pixels.topLeft(),     surface, params.color, 1.0 );
+    addVertex( pixels.bottomRight(), surface, params.color, 1.0 );
+    addVertex( pixels.bottomLeft(),  surface, params.color, 1.0 );
+
+    _cushionRects << rect;
+}
+
+
+void TreemapGLRenderer::addRect( const QRectF & rect,
+				 const QColor & startColor,
+				 const QColor & endColor )
+{
+    static const float noSurface[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+    // A linear gradient along the diagonal is linear in x and y, so
+    // interpolating the colors of the corners gets it exactly.
+
+    double width2  = rect.width()  * rect.width();
+    double height2 = rect.height() * rect.height();
+    double t	   = width2 + height2 > 0.0 ? width2 / ( width2 + height2 ) : 0.5;
+
+    QColor topRight	= QColor::fromRgbF( startColor.redF()   + t * ( endColor.redF()   - startColor.redF()   ),
+					    startColor.greenF() + t * ( endColor.greenF() - startColor.greenF() ),
+					    startColor.blueF()  + t * ( endColor.blueF()  - startColor.blueF()  ) );
+    QColor bottomLeft	= QColor::fromRgbF( endColor.redF()   + t * ( startColor.redF()   - endColor.redF()   ),
+					    endColor.greenF() + t * ( startColor.greenF() - endColor.greenF() ),
+					    endColor.blueF()  + t * ( startColor.blueF()  - endColor.blueF()  ) );
+
+    addVertex( rect.topLeft(),	   noSurface, startColor, 0.0 );
+    addVertex( rect.topRight(),	   noSurface, topRight,	  0.0 );
+    addVertex( rect.bottomRight(), noSurface, endColor,	  0.0 );
+
+    addVertex( rect.topLeft(),	   noSurface, startColor, 0.0 );
+    addVertex( rect.bottomRight(), noSurface, endColor,	  0.0 );
+    addVertex( rect.bottomLeft(),  noSurface, bottomLeft, 0.0 );
+}
+
+
+void TreemapGLRenderer::addVertex( const QPointF & pos,
+				   const float	   surface[4],
+				   const QColor &  color,
+				   float	   shade )
+{
+    _vertices << pos.x() << pos.y()
+	      << surface[0] << surface[1] << surface[2] << surface[3]
+	      << color.redF() << color.greenF() << color.blueF()
+	      << shade;
+
+    _dirty = true;
+}
+
+
+bool TreemapGLRenderer::init()
+{
+    _initialized = true;
+    initializeOpenGLFunctions();
+
+    _program = new QOpenGLShaderProgram();
+    CHECK_NEW( _program );
+
+    _program->addShaderFromSourceCode( QOpenGLShader::Vertex,	vertexShader   );
+    _program->addShaderFromSourceCode( QOpenGLShader::Fragment, fragmentShader );
+
+    _program->bindAttributeLocation( "position", PositionAttribute );
+    _program->bindAttributeLocation( "surface",	 SurfaceAttribute  );
+    _program->bindAttributeLocation( "color",	 ColorAttribute	   );
+    _program->bindAttributeLocation( "shade",	 ShadeAttribute	   );
+
+    if ( ! _program->link() )
+    {
+	logError() << "Can't link the treemap shaders: " << _program->log() << endl;
+	return false;
+    }
+
+    if ( ! _buffer.create() )
+    {
+	logError() << "Can't create an OpenGL vertex buffer" << endl;
+	return false;
+    }
+
+    _buffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
+
+    return true;
+}
+
+
+void TreemapGLRenderer::render( const QMatrix4x4 & matrix,
+				const QSize &	   viewportSize,
+				int		   ambientLight,
+				double		   lightX,
+				double		   lightY,
+				double		   lightZ )
+{
+    if ( ! _initialized )
+	_failed = ! init();
+
+    if ( _failed || _vertices.isEmpty() )
+	return;
+
+    _buffer.bind();
+
+    if ( _dirty )
+    {
+	_buffer.allocate( _vertices.constData(), _vertices.size() * sizeof( GLfloat ) );
+	_dirty = false;
+    }
+
+    glViewport( 0, 0, viewportSize.width(), viewportSize.height() );
+    glDisable( GL_DEPTH_TEST );
+    glDisable( GL_BLEND );
+
+    _program->bind();
+    _program->setUniformValue( "matrix",  matrix );
+    _program->setUniformValue( "light",	  (float) lightX, (float) lightY, (float) lightZ );
+    _program->setUniformValue( "ambient", (float) ( ambientLight / 255.0 ) );
+
+    int stride = FloatsPerVertex * sizeof( GLfloat );
+
+    _program->enableAttributeArray( PositionAttribute );
+    _program->enableAttributeArray( SurfaceAttribute  );
+    _program->enableAttributeArray( ColorAttribute    );
+    _program->enableAttributeArray( ShadeAttribute    );
+
+    _program->setAttributeBuffer( PositionAttribute, GL_FLOAT, 0,		       2, stride );
+    _program->setAttributeBuffer( SurfaceAttribute,  GL_FLOAT, 2 * sizeof( GLfloat ), 4, stride );
+    _program->setAttributeBuffer( ColorAttribute,    GL_FLOAT, 6 * sizeof( GLfloat ), 3, stride );
+    _program->setAttributeBuffer( ShadeAttribute,    GL_FLOAT, 9 * sizeof( GLfloat ), 1, stride );
+
+    glDrawArrays( GL_TRIANGLES, 0, _vertices.size() / FloatsPerVertex );
+
+    _program->disableAttributeArray( PositionAttribute );
+    _program->disableAttributeArray( SurfaceAttribute  );
+    _program->disableAttributeArray( ColorAttribute    );
+    _program->disableAttributeArray( ShadeAttribute    );
+
+    _program->release();
+    _buffer.release();
+}
@@ -0,0 +1,127 @@
+/*
+ *   File name: TreemapGLRenderer.h
+ *   Summary:	OpenGL cushion shading for the treemap view
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef TreemapGLRenderer_h
+#define TreemapGLRenderer_h
+
+
+#include <QColor>
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions>
+#include <QRectF>
+#include <QSize>
+#include <QVector>
+
+
+class QOpenGLShaderProgram;
+
+
+namespace QDirStat
+{
+    struct CushionParams;
+
+    /**
+     * Renderer that shades the treemap cushions in a fragment shader
+     * instead of rendering them into images: The rectangles of the tiles
+     * and the coefficients of their cushion surfaces are uploaded once for
+     * each treemap rebuild; after that, each repaint of the treemap (e.g.
+     * for a highlight) only draws them again on the GPU.
+     *
+     * The directory tiles that can still be seen are filled with their
+     * color or gradient before the cushions.
+     *
+     * Everything except adding tiles must be called while the OpenGL
+     * context of the treemap is current: In TreemapView::drawBackground()
+     * (with QPainter::beginNativePainting()) or with makeCurrent().
+     **/
+    class TreemapGLRenderer: protected QOpenGLFunctions
+    {
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	TreemapGLRenderer();
+
+	/**
+	 * Destructor. This deletes the OpenGL objects, so the context needs
+	 * to be current.
+	 **/
+	~TreemapGLRenderer();
+
+	/**
+	 * Remove all tiles.
+	 **/
+	void clear();
+
+	/**
+	 * Add a cushion. The lighting of 'params' is not used; that comes
+	 * from render().
+	 **/
+	void addCushion( const CushionParams & params );
+
+	/**
+	 * Add a rectangle with a linear gradient from 'startColor' at the top
+	 * left to 'endColor' at the bottom right.
+	 **/
+	void addRect( const QRectF & rect,
+		      const QColor & startColor,
+		      const QColor & endColor );
+
+	/**
+	 * Return the rectangles of the cushions in the order they were added.
+	 **/
+	const QVector<QRectF> & cushionRects() const { return _cushionRects; }
+
+	/**
+	 * Draw all tiles into the current framebuffer with 'viewportSize'
+	 * pixels. 'matrix' maps scene coordinates to normalized device
+	 * coordinates.
+	 **/
+	void render( const QMatrix4x4 & matrix,
+		     const QSize &	viewportSize,
+		     int		ambientLight,
+		     double		lightX,
+		     double		lightY,
+		     double		lightZ );
+
+    protected:
+
+	/**
+	 * Initialize OpenGL and compile the shaders. Returns 'false' if that
+	 * failed.
+	 **/
+	bool init();
+
+	/**
+	 * Add one vertex.
+	 **/
+	void addVertex( const QPointF & pos,
+			const float	surface[4],
+			const QColor &	color,
+			float		shade );
+
+
+	// Data members
+
+	QVector<GLfloat>       _vertices;
+	QVector<QRectF>	       _cushionRects;
+	bool		       _dirty;
+	bool		       _initialized;
+	bool		       _failed;
+	QOpenGLShaderProgram * _program;
+	QOpenGLBuffer	       _buffer;
+
+    };	// class TreemapGLRenderer
+
+}	// namespace QDirStat
+
+
+#endif // ifndef TreemapGLRenderer_h
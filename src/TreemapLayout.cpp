@@ -0,0 +1,333 @@
+/*
+ *   File name: TreemapLayout.cpp
+ *   Summary:	Squarified treemap layout as plain data
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include "TreemapLayout.h"
+#include "FileInfoIterator.h"
+#include "Exception.h"
+
+
+// Subtrees with at least this many pixels are laid out in a worker thread
+// if they are not more than ParallelLayoutMaxDepth levels below the root of
+// the layout; the smaller ones are not worth starting a task.
+#define ParallelLayoutMinPixels	     ( 128 * 128 )
+
+// Subtrees bigger than this are split up further unless they are already
+// ParallelLayoutMaxDepth levels below the root
+#define ParallelLayoutMaxChunkPixels ( 512 * 512 )
+#define ParallelLayoutMaxDepth	     3
+
+
+using namespace QDirStat;
+
+
+class TreemapLayout::ChunkTask: public QRunnable
+{
+public:
+
+    ChunkTask( TreemapLayout * layout, Chunk * chunk ):
+	_layout( layout ),
+	_chunk( chunk )
+	{}
+
+    virtual void run() Q_DECL_OVERRIDE
+    {
+	_layout->layoutSubtree( _chunk->dir, _chunk->rect, _chunk->surface,
+				-1,	// parent
+				0,	// depth
+				false,	// parallel
+				_chunk->nodes );
+    }
+
+private:
+
+    TreemapLayout * _layout;
+    Chunk *	    _chunk;
+};
+
+
+
+
+TreemapLayout::TreemapLayout( int	    minTileSize,
+			      int	    minDirTileSize,
+			      double	    heightScaleFactor,
+			      QThreadPool * threadPool ):
+    _minTileSize( minTileSize ),
+    _minDirTileSize( minDirTileSize ),
+    _heightScaleFactor( heightScaleFactor ),
+    _threadPool( threadPool ),
+    _keepSubtree( 0 )
+{
+
+}
+
+
+QVector<TreemapLayoutNode> TreemapLayout::layout( FileInfo *		 dir,
+						  const QRectF &	 rect,
+						  const CushionSurface & surface )
+{
+    QVector<TreemapLayoutNode> nodes;
+
+    if ( _threadPool )
+	_threadPool->setMaxThreadCount( qMax( 1, QThread::idealThreadCount() ) );
+
+    layoutSubtree( dir, rect, surface, -1, 0, _threadPool != 0, nodes );
+
+    if ( _chunks.isEmpty() )
+	return nodes;
+
+    _threadPool->waitForDone();
+
+    // Append the nodes of the worker threads after the node of the
+    // directory they belong to
+
+    foreach ( Chunk * chunk, _chunks )
+    {
+	int offset = nodes.size();
+
+	foreach ( TreemapLayoutNode node, chunk->nodes )
+	{
+	    node.parent = node.parent < 0 ? chunk->parent : node.parent + offset;
+	    nodes << node;
+	}
+    }
+
+    qDeleteAll( _chunks );
+    _chunks.clear();
+
+    return nodes;
+}
+
+
+void TreemapLayout::layoutSubtree( FileInfo *		      dir,
+				   const QRectF &	      rect,
+				   const CushionSurface &     surface,
+				   int			      parent,
+				   int			      depth,
+				   bool			      parallel,
+				   QVector<TreemapLayoutNode> & nodes )
+{
+    if ( dir->totalAllocatedSize() == 0 )	// Prevent division by zero
+	return;
+
+    if ( dir == _keepSubtree )
+	return;
+
+    if ( qMin( rect.width(), rect.height() ) < _minDirTileSize )
+	return;
+
+    double scale	= rect.width() * (double) rect.height() / dir->totalAllocatedSize();
+    FileSize minSize	= (FileSize) ( _minTileSize / scale );
+
+    // A tile is only created if it is at least minTileSize in both
+    // directions (allowing for rounding). A layout row that starts with a
+    // child smaller than this can't get any, and neither can any row after
+    // it since the children only get smaller; so the rest of them is left
+    // to the parent tile together.
+
+    FileSize minVisibleSize = (FileSize) ( ( _minTileSize - 1 ) * _minTileSize / scale );
+
+    FileInfoSortedBySizeIterator it( dir, minSize, Qt::DescendingOrder,
+				     &FileInfo::totalAllocatedSize );
+    QRectF childrenRect = rect;
+
+    // The rows are consecutive ranges of the sorted children, and the
+    // iterator already has their sizes: No lists of children and no more
+    // calls to totalAllocatedSize() for each row.
+
+    while ( *it && it.currentSize() >= minVisibleSize )
+    {
+	FileSize sum   = 0;
+	int	 begin = it.index();
+	int	 end   = squarify( childrenRect, scale, it, sum );
+
+	childrenRect = layoutRow( childrenRect, scale, surface, it, begin, end, sum,
+				  parent, depth, parallel, nodes );
+    }
+}
+
+
+int TreemapLayout::squarify( const QRectF &		    rect,
+			     double			    scale,
+			     FileInfoSortedBySizeIterator & it,
+			     FileSize &			    sum_ret )
+{
+    int begin  = it.index();
+    int length = qMax( rect.width(), rect.height() );
+    sum_ret    = 0;
+
+    if ( length == 0 )	// Sanity check
+    {
+	if ( *it )	// Prevent endless loop in case of error:
+	    ++it;	// Advance iterator.
+
+	return begin;	// Empty row
+    }
+
+
+    double lastWorstAspectRatio = -1.0;
+    double firstSize		= it.currentSize();
+
+    // This is a bit ugly, but doing all calculations in the 'size' dimension
+    // is more efficient here since that requires only one scaling before
+    // doing all other calculations in the loop.
+    const double scaledLengthSquare = length * (double) length / scale;
+
+    // The row sum is kept as the candidates are added, and the worst aspect
+    // ratio of a row is that of its first (biggest) or its last (smallest)
+    // child, so each candidate is O(1).
+
+    while ( *it )
+    {
+	FileSize size	= it.currentSize();
+	double	 newSum = sum_ret + size;
+
+	if ( it.index() > begin && newSum != 0 && size != 0 )
+	{
+	    double sumSquare	    = newSum * newSum;
+	    double worstAspectRatio = qMax( scaledLengthSquare * firstSize / sumSquare,
+					    sumSquare / ( scaledLengthSquare * size ) );
+
+	    if ( lastWorstAspectRatio >= 0.0 &&
+		 worstAspectRatio > lastWorstAspectRatio )
+	    {
+		break;	// Not improving any more
+	    }
+
+	    lastWorstAspectRatio = worstAspectRatio;
+	}
+
+	sum_ret += size;
+	++it;
+    }
+
+    return it.index();
+}
+
+
+QRectF TreemapLayout::layoutRow( const QRectF &			rect,
+				 double				scale,
+				 const CushionSurface &		surface,
+				 const FileInfoSortedBySizeIterator & it,
+				 int				begin,
+				 int				end,
+				 FileSize			sum,
+				 int				parent,
+				 int				depth,
+				 bool				parallel,
+				 QVector<TreemapLayoutNode> &	nodes )
+{
+    if ( begin >= end )
+	return rect;
+
+    // Determine the direction in which to subdivide.
+    // We always use the longer side of the rectangle.
+    Orientation dir = rect.width() > rect.height() ? TreemapHorizontal : TreemapVertical;
+
+    // This row's primary length is the longer one.
+    int primary = qMax( rect.width(), rect.height() );
+
+    // This row's secondary length is determined by the area (the number of
+    // pixels) to be allocated for all of the row's items.
+
+    int secondary = (int) ( sum * scale / primary );
+
+    if ( sum == 0 )	// Prevent division by zero.
+	return rect;
+
+    if ( secondary < _minTileSize )	// We don't want tiles that small.
+	return rect;
+
+
+    // Set up a cushion surface for this layout row:
+    // Add another ridge perpendicular to the row's direction
+    // that optically groups this row's tiles together.
+
+    CushionSurface rowCushionSurface = surface;
+
+    rowCushionSurface.addRidge( dir == TreemapHorizontal ? TreemapVertical : TreemapHorizontal,
+				surface.height() * _heightScaleFactor,
+				rect );
+
+    int offset = 0;
+    int remaining = primary;
+
+    for ( int i = begin; i < end; ++i )
+    {
+	FileInfo * item = it.at( i );
+	int childSize = (int) ( it.sizeAt( i ) / (double) sum * primary + 0.5 );
+
+	if ( childSize > remaining )	// Prevent overflow because of accumulated rounding errors
+	    childSize = remaining;
+
+	remaining -= childSize;
+
+	if ( childSize >= _minTileSize )
+	{
+	    TreemapLayoutNode node;
+
+	    if ( dir == TreemapHorizontal )
+		node.rect = QRectF( rect.x() + offset, rect.y(), childSize, secondary );
+	    else
+		node.rect = QRectF( rect.x(), rect.y() + offset, secondary, childSize );
+
+	    node.orig	 = item;
+	    node.surface = rowCushionSurface;
+	    node.parent	 = parent;
+
+	    int index = nodes.size();
+	    nodes << node;
+
+	    // The subtree gets the row's cushion surface; the tile's own
+	    // ridge is only added after that.
+
+	    double pixels = node.rect.width() * node.rect.height();
+
+	    if ( parallel && item->isDirInfo() && item != _keepSubtree && pixels >= ParallelLayoutMinPixels &&
+		 ( pixels <= ParallelLayoutMaxChunkPixels || depth >= ParallelLayoutMaxDepth ) )
+	    {
+		Chunk * chunk = new Chunk;
+		CHECK_NEW( chunk );
+
+		chunk->dir     = item;
+		chunk->rect    = node.rect;
+		chunk->surface = rowCushionSurface;
+		chunk->parent  = index;
+		_chunks << chunk;
+
+		_threadPool->start( new ChunkTask( this, chunk ) );
+	    }
+	    else
+	    {
+		layoutSubtree( item, node.rect, rowCushionSurface, index, depth + 1,
+			       parallel && depth < ParallelLayoutMaxDepth, nodes );
+	    }
+
+	    nodes[ index ].surface.addRidge( dir,
+					     rowCushionSurface.height() * _heightScaleFactor,
+					     nodes[ index ].rect );
+	    offset += childSize;
+	}
+    }
+
+
+    // Subtract the layouted area from the rectangle.
+
+    QRectF newRect;
+
+    if ( dir == TreemapHorizontal )
+	newRect = QRectF( rect.x(), rect.y() + secondary, rect.width(), rect.height() - secondary );
+    else
+	newRect = QRectF( rect.x() + secondary, rect.y(), rect.width() - secondary, rect.height() );
+
+    return newRect;
+}
@@ -0,0 +1,159 @@
+/*
+ *   File name: TreemapLayout.h
+ *   Summary:	Squarified treemap layout as plain data
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef TreemapLayout_h
+#define TreemapLayout_h
+
+
+#include <QList>
+#include <QRectF>
+#include <QVector>
+
+#include "FileInfo.h"
+#include "TreemapTile.h"	// CushionSurface
+
+
+class QThreadPool;
+
+
+namespace QDirStat
+{
+    class FileInfoSortedBySizeIterator;
+
+    /**
+     * One tile of a TreemapLayout: Everything that is needed to create the
+     * TreemapTile for it.
+     **/
+    struct TreemapLayoutNode
+    {
+	FileInfo *     orig;
+	QRectF	       rect;
+	CushionSurface surface;
+	int	       parent;	// index of the parent node, -1 for the layout's root
+    };
+
+
+    /**
+     * Squarified layout of the tiles of a subtree without creating any
+     * graphics items: The result is a list of nodes where each parent comes
+     * before its children, so the tiles can be created in that order.
+     *
+     * Once the rectangle of a directory is known, its subtree can be laid
+     * out independently of its siblings; big subtrees near the top are laid
+     * out in worker threads. This only reads the items of the subtree, and
+     * the main thread waits until all of them are done, so the tree can't
+     * change meanwhile.
+     **/
+    class TreemapLayout
+    {
+    public:
+
+	/**
+	 * Constructor. 'minTileSize', 'minDirTileSize' and
+	 * 'heightScaleFactor' are the same as in TreemapView. If
+	 * 'threadPool' is 0, everything is done in the calling thread.
+	 **/
+	TreemapLayout( int	     minTileSize,
+		       int	     minDirTileSize,
+		       double	     heightScaleFactor,
+		       QThreadPool * threadPool = 0 );
+
+	/**
+	 * Don't lay out the subtree of 'dir', only its own node, e.g. because
+	 * its old tiles are kept. 0 (the default) lays out everything.
+	 **/
+	void setKeepSubtree( FileInfo * dir ) { _keepSubtree = dir; }
+
+	/**
+	 * Lay out all tiles below 'dir' in 'rect' where 'dir' has cushion
+	 * surface 'surface'.
+	 **/
+	QVector<TreemapLayoutNode> layout( FileInfo *		dir,
+					   const QRectF &	rect,
+					   const CushionSurface & surface );
+
+	/**
+	 * Lay out the subtree of 'dir' below node 'parent' of 'nodes'.
+	 * Subtrees that are big enough are left to worker threads at
+	 * 'depth' 0 .. ParallelLayoutMaxDepth if 'parallel' is set.
+	 **/
+	void layoutSubtree( FileInfo *		   dir,
+			    const QRectF &	   rect,
+			    const CushionSurface & surface,
+			    int			   parent,
+			    int			   depth,
+			    bool		   parallel,
+			    QVector<TreemapLayoutNode> & nodes );
+
+    protected:
+
+	/**
+	 * Squarify as many children as possible: Try to squeeze members
+	 * referred to by 'it' into 'rect' until the aspect ratio doesn't get
+	 * better any more. Moves 'it' until there is no more improvement or
+	 * 'it' runs out of items; the children that it moved over are the
+	 * row that should be laid out in 'rect'. Returns the position (see
+	 * FileInfoSortedBySizeIterator::index()) after the end of the row
+	 * and their total size in 'sum_ret'.
+	 *
+	 * 'scale' is the scaling factor between file sizes and pixels.
+	 **/
+	int squarify( const QRectF &		   rect,
+		      double			   scale,
+		      FileInfoSortedBySizeIterator & it,
+		      FileSize &		   sum_ret );
+
+	/**
+	 * Lay out the children from position 'begin' to before 'end' of 'it'
+	 * with the total size 'sum' within 'rect' along its longer side and
+	 * their subtrees. Returns the new rectangle with the layouted area
+	 * subtracted.
+	 **/
+	QRectF layoutRow( const QRectF &		 rect,
+			  double			 scale,
+			  const CushionSurface &	 surface,
+			  const FileInfoSortedBySizeIterator & it,
+			  int				 begin,
+			  int				 end,
+			  FileSize			 sum,
+			  int				 parent,
+			  int				 depth,
+			  bool				 parallel,
+			  QVector<TreemapLayoutNode> &	 nodes );
+
+	/**
+	 * A subtree that a worker thread lays out.
+	 **/
+	struct Chunk
+	{
+	    FileInfo *		       dir;
+	    QRectF		       rect;
+	    CushionSurface	       surface;
+	    int			       parent;	// in the nodes of the main thread
+	    QVector<TreemapLayoutNode> nodes;
+	};
+
+	class ChunkTask;
+
+
+	// Data members
+
+	int	       _minTileSize;
+	int	       _minDirTileSize;
+	double	       _heightScaleFactor;
+	QThreadPool *  _threadPool;
+	FileInfo *     _keepSubtree;
+	QList<Chunk *> _chunks;
+
+    };	// class TreemapLayout
+
+}	// namespace QDirStat
+
+
+#endif // ifndef TreemapLayout_h
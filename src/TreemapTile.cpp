@@ -9,12 +9,19 @@
 
 #include <math.h>
 
+#if defined( __SSE2__ )
+#  include <emmintrin.h>
+#elif defined( __ARM_NEON )
+#  include <arm_neon.h>
+#endif
+
 #include <QImage>
 #include <QPainter>
 #include <QGraphicsSceneMouseEvent>
 #include <QMenu>
 
 #include "TreemapTile.h"
+#include "TreemapLayout.h"
 #include "TreemapView.h"
 #include "SelectionModel.h"
 #include "ActionManager.h"
@@ -25,6 +32,135 @@
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * Shade one row of a cushion: Write 'width' pixels to 'line' for the
+     * cushion normals ( nx0 + x * nxStep, ny ) with light vector
+     * ( lightX, lightY, lightZ ).
+     *
+     * This works in float and uses SSE2 (x86_64) or NEON (ARM) for four
+     * pixels at a time if the compiler targets one of them; one
+     * Newton-Raphson step after the reciprocal square root estimate makes
+     * it as exact as the 8 bit colors need. The rest is done in plain C++.
+     **/
+    void renderCushionRow( QRgb *	line,
+			   int		width,
+			   float	nx0,
+			   float	nxStep,
+			   float	ny,
+			   float	lightX,
+			   float	lightY,
+			   float	lightZ,
+			   const float	maxColor[3],
+			   int		ambientLight )
+    {
+	// The parts of the formula that are the same for the whole row
+
+	const float lightYZ = ny * lightY + lightZ;
+	const float ny2	    = ny * ny + 1.0f;
+	const float limit   = 255 - ambientLight;	// no wrapping into other channels
+	int x = 0;
+
+#if defined( __SSE2__ )
+
+	const __m128  vLightX  = _mm_set1_ps( lightX );
+	const __m128  vLightYZ = _mm_set1_ps( lightYZ );
+	const __m128  vNy2     = _mm_set1_ps( ny2 );
+	const __m128  vHalf    = _mm_set1_ps( 0.5f );
+	const __m128  vThree   = _mm_set1_ps( 3.0f );
+	const __m128  vZero    = _mm_setzero_ps();
+	const __m128  vLimit   = _mm_set1_ps( limit );
+	const __m128  vRed     = _mm_set1_ps( maxColor[0] );
+	const __m128  vGreen   = _mm_set1_ps( maxColor[1] );
+	const __m128  vBlue    = _mm_set1_ps( maxColor[2] );
+	const __m128i vBase    = _mm_set1_epi32( 0xff000000 | ambientLight << 16 | ambientLight << 8 | ambientLight );
+	const __m128  vStep4   = _mm_set1_ps( 4.0f * nxStep );
+	__m128	      vNx      = _mm_add_ps( _mm_set1_ps( nx0 ),
+					     _mm_mul_ps( _mm_set_ps( 3.0f, 2.0f, 1.0f, 0.0f ),
+							 _mm_set1_ps( nxStep ) ) );
+
+	for ( ; x + 4 <= width; x += 4 )
+	{
+	    __m128 len2 = _mm_add_ps( _mm_mul_ps( vNx, vNx ), vNy2 );
+	    __m128 r	= _mm_rsqrt_ps( len2 );
+
+	    // r = r * ( 3 - len2 * r * r ) / 2
+
+	    r = _mm_mul_ps( _mm_mul_ps( vHalf, r ),
+			    _mm_sub_ps( vThree, _mm_mul_ps( len2, _mm_mul_ps( r, r ) ) ) );
+
+	    __m128 cosa = _mm_mul_ps( _mm_add_ps( _mm_mul_ps( vNx, vLightX ), vLightYZ ), r );
+
+	    __m128 red	 = _mm_min_ps( _mm_max_ps( _mm_add_ps( _mm_mul_ps( vRed,   cosa ), vHalf ), vZero ), vLimit );
+	    __m128 green = _mm_min_ps( _mm_max_ps( _mm_add_ps( _mm_mul_ps( vGreen, cosa ), vHalf ), vZero ), vLimit );
+	    __m128 blue	 = _mm_min_ps( _mm_max_ps( _mm_add_ps( _mm_mul_ps( vBlue,  cosa ), vHalf ), vZero ), vLimit );
+
+	    __m128i pixels = _mm_or_si128( _mm_slli_epi32( _mm_cvttps_epi32( red   ), 16 ),
+					   _mm_or_si128( _mm_slli_epi32( _mm_cvttps_epi32( green ), 8 ),
+							 _mm_cvttps_epi32( blue ) ) );
+
+	    _mm_storeu_si128( (__m128i *) ( line + x ), _mm_add_epi32( pixels, vBase ) );
+	    vNx = _mm_add_ps( vNx, vStep4 );
+	}
+
+#elif defined( __ARM_NEON )
+
+	const float32x4_t vLightX  = vdupq_n_f32( lightX );
+	const float32x4_t vLightYZ = vdupq_n_f32( lightYZ );
+	const float32x4_t vNy2	   = vdupq_n_f32( ny2 );
+	const float32x4_t vHalf	   = vdupq_n_f32( 0.5f );
+	const float32x4_t vZero	   = vdupq_n_f32( 0.0f );
+	const float32x4_t vLimit   = vdupq_n_f32( limit );
+	const float32x4_t vRed	   = vdupq_n_f32( maxColor[0] );
+	const float32x4_t vGreen   = vdupq_n_f32( maxColor[1] );
+	const float32x4_t vBlue	   = vdupq_n_f32( maxColor[2] );
+	const uint32x4_t  vBase	   = vdupq_n_u32( 0xff000000 | ambientLight << 16 | ambientLight << 8 | ambientLight );
+	const float32x4_t vStep4   = vdupq_n_f32( 4.0f * nxStep );
+	const float	  offsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	float32x4_t	  vNx	   = vmlaq_n_f32( vdupq_n_f32( nx0 ), vld1q_f32( offsets ), nxStep );
+
+	for ( ; x + 4 <= width; x += 4 )
+	{
+	    float32x4_t len2 = vmlaq_f32( vNy2, vNx, vNx );
+	    float32x4_t r    = vrsqrteq_f32( len2 );
+
+	    r = vmulq_f32( r, vrsqrtsq_f32( vmulq_f32( len2, r ), r ) );
+	    r = vmulq_f32( r, vrsqrtsq_f32( vmulq_f32( len2, r ), r ) );
+
+	    float32x4_t cosa  = vmulq_f32( vmlaq_f32( vLightYZ, vNx, vLightX ), r );
+	    float32x4_t red   = vminq_f32( vmaxq_f32( vmlaq_f32( vHalf, vRed,   cosa ), vZero ), vLimit );
+	    float32x4_t green = vminq_f32( vmaxq_f32( vmlaq_f32( vHalf, vGreen, cosa ), vZero ), vLimit );
+	    float32x4_t blue  = vminq_f32( vmaxq_f32( vmlaq_f32( vHalf, vBlue,  cosa ), vZero ), vLimit );
+
+	    uint32x4_t pixels = vorrq_u32( vshlq_n_u32( vcvtq_u32_f32( red ), 16 ),
+					   vorrq_u32( vshlq_n_u32( vcvtq_u32_f32( green ), 8 ),
+						      vcvtq_u32_f32( blue ) ) );
+
+	    vst1q_u32( (uint32_t *) ( line + x ), vaddq_u32( pixels, vBase ) );
+	    vNx = vaddq_f32( vNx, vStep4 );
+	}
+
+#endif
+
+	for ( ; x < width; ++x )
+	{
+	    float nx   = nx0 + x * nxStep;
+	    float cosa = ( nx * lightX + lightYZ ) / sqrtf( nx * nx + ny2 );
+	    int	  rgb[3];
+
+	    for ( int i = 0; i < 3; ++i )
+		rgb[i] = (int) qBound( 0.0f, maxColor[i] * cosa + 0.5f, limit );
+
+	    line[x] = qRgb( rgb[0] + ambientLight,
+			    rgb[1] + ambientLight,
+			    rgb[2] + ambientLight );
+	}
+    }
+
+}	// namespace
+
+
 TreemapTile::TreemapTile( TreemapView *	 parentView,
 			  TreemapTile *	 parentTile,
 			  FileInfo *	 orig,
@@ -66,6 +202,19 @@ TreemapTile::TreemapTile( TreemapView *		 parentView,
 }
 
 
+TreemapTile::TreemapTile( TreemapView *		    parentView,
+			  TreemapTile *		    parentTile,
+			  const TreemapLayoutNode & node ):
+    QGraphicsRectItem( node.rect, parentTile ),
+    _parentView( parentView ),
+    _parentTile( parentTile ),
+    _orig( node.orig ),
+    _cushionSurface( node.surface )
+{
+    init();
+}
+
+
 TreemapTile::~TreemapTile()
 {
     // DO NOT try to delete the _highlighter: It is owned by the TreemapView /
@@ -81,9 +230,28 @@ void TreemapTile::init()
 
     setZValue( _parentTile ? ( _parentTile->zValue() + 1.0 ) : 0.0 );
 
-    setBrush( QColor( 0x60, 0x60, 0x60 ) );
+    updateBrush();
     setPen( Qt::NoPen );
 
+    setFlags( ItemIsSelectable );
+    _inRaster	 = false;
+    _highlighter = 0;
+    setAcceptHoverEvents(true);
+
+    if ( ! _parentTile )
+	_parentView->scene()->addItem( this );
+
+    _parentView->addTile( this );
+
+    // logDebug() << "Creating treemap tile for " << this
+    //		  << " size " << formatSize( _orig->totalAllocatedSize() ) << endl;
+}
+
+
+void TreemapTile::updateBrush()
+{
+    setBrush( QColor( 0x60, 0x60, 0x60 ) );
+
     if ( _orig->isDir() || _orig->isDotEntry() )
     {
         if ( _parentView->useDirGradient() )
@@ -101,16 +269,76 @@ void TreemapTile::init()
             }
         }
     }
+}
 
-    setFlags( ItemIsSelectable );
-    _highlighter = 0;
-    setAcceptHoverEvents(true);
 
-    if ( ! _parentTile )
-	_parentView->scene()->addItem( this );
+void TreemapTile::updateZValue()
+{
+    setZValue( _parentTile ? ( _parentTile->zValue() + 1.0 ) : 0.0 );
 
-    // logDebug() << "Creating treemap tile for " << this
-    //		  << " size " << formatSize( _orig->totalAllocatedSize() ) << endl;
+    foreach ( QGraphicsItem * graphicsItem, childItems() )
+    {
+	TreemapTile * child = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	if ( child )
+	    child->updateZValue();
+    }
+}
+
+
+void TreemapTile::setParentTile( TreemapTile * parentTile )
+{
+    _parentTile = parentTile;
+    setParentItem( parentTile );    // a toplevel item stays in the scene
+    updateZValue();
+}
+
+
+void TreemapTile::rescale( double sx, double dx, double sy, double dy )
+{
+    QRectF oldRect = rect();
+
+    setRect( QRectF( sx * oldRect.x() + dx,
+		     sy * oldRect.y() + dy,
+		     sx * oldRect.width(),
+		     sy * oldRect.height() ) );
+
+    _cushionSurface.rescale( sx, dx, sy, dy );
+    updateBrush();
+
+    // The old cushion doesn't fit anymore
+
+    _cushion  = QPixmap();
+    _inRaster = false;
+    setFlag( ItemHasNoContents, false );
+
+    if ( _highlighter )
+    {
+	_highlighter->highlight( this );
+	_highlighter->setVisible( isSelected() && this != _parentView->rootTile() );
+    }
+
+    foreach ( QGraphicsItem * graphicsItem, childItems() )
+    {
+	TreemapTile * child = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	if ( child )
+	    child->rescale( sx, dx, sy, dy );
+    }
+}
+
+
+void TreemapTile::addCushionSurface( const CushionSurface & surface )
+{
+    _cushionSurface.add( surface );
+
+    foreach ( QGraphicsItem * graphicsItem, childItems() )
+    {
+	TreemapTile * child = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	if ( child )
+	    child->addCushionSurface( surface );
+    }
 }
 
 
@@ -120,6 +348,9 @@ void TreemapTile::createChildren( const QRectF & rect,
     if ( _orig->totalAllocatedSize() == 0 )	// Prevent division by zero
 	return;
 
+    if ( qMin( rect.width(), rect.height() ) < _parentView->minDirTileSize() )
+	return;		// Not that much detail while the tree is being read
+
     if ( _parentView->squarify() )
 	createSquarifiedChildren( rect );
     else
@@ -146,7 +377,8 @@ void TreemapTile::createChildrenSimple( const QRectF & rect,
 
     _cushionSurface.addRidge( childDir, _cushionSurface.height(), rect );
     FileSize minSize = (FileSize) ( _parentView->minTileSize() / scale );
-    FileInfoSortedBySizeIterator it( _orig, minSize );
+    FileInfoSortedBySizeIterator it( _orig, minSize, Qt::DescendingOrder,
+				     &FileInfo::totalAllocatedSize );
 
     while ( *it )
     {
@@ -172,6 +404,12 @@ void TreemapTile::createChildrenSimple( const QRectF & rect,
 
 	    offset += childSize;
 	}
+	else
+	{
+	    // All the others are even smaller
+
+	    break;
+	}
 
 	++count;
 	++it;
@@ -187,173 +425,25 @@ void TreemapTile::createSquarifiedChildren( const QRectF & rect )
 	return;
     }
 
-    double scale	= rect.width() * (double) rect.height() / _orig->totalAllocatedSize();
-    FileSize minSize	= (FileSize) ( _parentView->minTileSize() / scale );
-
-    FileInfoSortedBySizeIterator it( _orig, minSize );
-    QRectF childrenRect = rect;
-
-    while ( *it )
-    {
-	FileInfoList row = squarify( childrenRect, scale, it );
-	childrenRect = layoutRow( childrenRect, scale, row );
-    }
-}
-
+    TreemapLayout layout( _parentView->minTileSize(),
+			  _parentView->minDirTileSize(),
+			  _parentView->heightScaleFactor(),
+			  _parentView->threadPool() );
 
-FileInfoList TreemapTile::squarify( const QRectF & rect,
-				    double	  scale,
-				    FileInfoSortedBySizeIterator & it )
-{
-    // logDebug() << "squarify() " << this << " " << rect << endl;
+    layout.setKeepSubtree( _parentView->keepSubtree() );
+    QVector<TreemapLayoutNode> nodes = layout.layout( _orig, rect, _cushionSurface );
+    QVector<TreemapTile *>     tiles( nodes.size() );
 
-    FileInfoList row;
-    int length = qMax( rect.width(), rect.height() );
+    // Each parent comes before its children
 
-    if ( length == 0 )	// Sanity check
+    for ( int i = 0; i < nodes.size(); ++i )
     {
-	logWarning()  << "Zero length" << endl;
+	const TreemapLayoutNode & node = nodes.at( i );
+	TreemapTile * parentTile = node.parent < 0 ? this : tiles.at( node.parent );
 
-	if ( *it )	// Prevent endless loop in case of error:
-	    ++it;	// Advance iterator.
-
-	return row;
+	tiles[ i ] = new TreemapTile( _parentView, parentTile, node );
+	CHECK_NEW( tiles[ i ] );
     }
-
-
-    bool   improvingAspectRatio = true;
-    double lastWorstAspectRatio = -1.0;
-    double sum			= 0;
-
-    // This is a bit ugly, but doing all calculations in the 'size' dimension
-    // is more efficient here since that requires only one scaling before
-    // doing all other calculations in the loop.
-    const double scaledLengthSquare = length * (double) length / scale;
-
-    while ( *it && improvingAspectRatio )
-    {
-	sum += (*it)->totalAllocatedSize();
-
-	if ( ! row.isEmpty() && sum != 0 && (*it)->totalAllocatedSize() != 0 )
-	{
-	    double sumSquare	    = sum * sum;
-	    double worstAspectRatio = qMax( scaledLengthSquare * row.first()->totalAllocatedSize() / sumSquare,
-                                            sumSquare / ( scaledLengthSquare * (*it)->totalAllocatedSize() ) );
-
-	    if ( lastWorstAspectRatio >= 0.0 &&
-		 worstAspectRatio > lastWorstAspectRatio )
-	    {
-		improvingAspectRatio = false;
-	    }
-
-	    lastWorstAspectRatio = worstAspectRatio;
-	}
-
-	if ( improvingAspectRatio )
-	{
-	    // logDebug() << "Adding " << *it << " size " << (*it)->totalAllocatedSize() << endl;
-	    row.append( *it );
-	    ++it;
-	}
-	else
-	{
-	    // logDebug() << "Getting worse after adding " << *it << " size " << (*it)->totalAllocatedSize() << endl;
-	}
-    }
-
-    return row;
-}
-
-
-QRectF TreemapTile::layoutRow( const QRectF & rect,
-			       double	      scale,
-			       FileInfoList & row )
-{
-    if ( row.isEmpty() )
-	return rect;
-
-    // Determine the direction in which to subdivide.
-    // We always use the longer side of the rectangle.
-    Orientation dir = rect.width() > rect.height() ? TreemapHorizontal : TreemapVertical;
-
-    // This row's primary length is the longer one.
-    int primary = qMax( rect.width(), rect.height() );
-
-    // This row's secondary length is determined by the area (the number of
-    // pixels) to be allocated for all of the row's items.
-
-    FileSize sum = 0;
-
-    foreach ( FileInfo * item, row )
-	sum += item->totalAllocatedSize();
-
-    int secondary = (int) ( sum * scale / primary );
-
-    if ( sum == 0 )	// Prevent division by zero.
-	return rect;
-
-    if ( secondary < _parentView->minTileSize() )	// We don't want tiles that small.
-	return rect;
-
-
-    // Set up a cushion surface for this layout row:
-    // Add another ridge perpendicular to the row's direction
-    // that optically groups this row's tiles together.
-
-    CushionSurface rowCushionSurface = _cushionSurface;
-
-    rowCushionSurface.addRidge( dir == TreemapHorizontal ? TreemapVertical : TreemapHorizontal,
-				_cushionSurface.height() * _parentView->heightScaleFactor(),
-				rect );
-
-    int offset = 0;
-    int remaining = primary;
-    FileInfoList::const_iterator it  = row.constBegin();
-    FileInfoList::const_iterator end = row.constEnd();
-
-    while ( it != end )
-    {
-	int childSize = (int) ( (*it)->totalAllocatedSize() / (double) sum * primary + 0.5 );
-
-	if ( childSize > remaining )	// Prevent overflow because of accumulated rounding errors
-	    childSize = remaining;
-
-	remaining -= childSize;
-
-	if ( childSize >= _parentView->minTileSize() )
-	{
-	    QRectF childRect;
-
-	    if ( dir == TreemapHorizontal )
-		childRect = QRectF( rect.x() + offset, rect.y(), childSize, secondary );
-	    else
-		childRect = QRectF( rect.x(), rect.y() + offset, secondary, childSize );
-
-	    TreemapTile * tile = new TreemapTile( _parentView, this, *it, childRect, rowCushionSurface );
-	    CHECK_NEW( tile );
-
-	    tile->cushionSurface().addRidge( dir,
-					     rowCushionSurface.height() * _parentView->heightScaleFactor(),
-					     childRect );
-	    offset += childSize;
-	}
-
-	++it;
-    }
-
-
-    // Subtract the layouted area from the rectangle.
-
-    QRectF newRect;
-
-    if ( dir == TreemapHorizontal )
-	newRect = QRectF( rect.x(), rect.y() + secondary, rect.width(), rect.height() - secondary );
-    else
-	newRect = QRectF( rect.x() + secondary, rect.y(), rect.width() - secondary, rect.height() );
-
-    // logDebug() << "Left over:" << " " << newRect << " " << this << endl;
-
-    return newRect;
 }
 
 
@@ -368,6 +458,18 @@ void TreemapTile::paint( QPainter			* painter,
     if ( size.height() < 1.0 || size.width() < 1.0 )
 	return;
 
+    if ( _orig->isDirInfo() && _orig->toDirInfo()->isEstimated() )
+    {
+	// The children of an estimated subtree were never read: Show it
+	// hatched instead of as one big file
+
+	painter->setPen( QPen( _parentView->outlineColor(), 1 ) );
+	setBrush( QBrush( _parentView->estimatedColor(), Qt::BDiagPattern ) );
+	QGraphicsRectItem::paint( painter, option, widget );
+
+	return;
+    }
+
     if ( _parentView->doCushionShading() )
     {
 	if ( _orig->isDir() || _orig->isDotEntry() )
@@ -376,8 +478,13 @@ void TreemapTile::paint( QPainter			* painter,
 	}
 	else
 	{
-	    if ( _cushion.isNull() )
-		_cushion = renderCushion();
+	    if ( _cushion.isNull() && ! _inRaster )
+	    {
+		QImage image = renderCushion( cushionParams() );
+
+		if ( ! image.isNull() )
+		    _cushion = QPixmap::fromImage( image );
+	    }
 
 	    QRectF rect = QGraphicsRectItem::rect();
 
@@ -434,73 +541,94 @@ void TreemapTile::paint( QPainter			* painter,
 }
 
 
-QPixmap TreemapTile::renderCushion()
+void TreemapTile::setInRaster()
 {
-    QRectF rect = QGraphicsRectItem::rect();
+    _inRaster = true;
+    _cushion  = QPixmap();
 
-    if ( rect.width() < 1.0 || rect.height() < 1.0 )
-	return QPixmap();
-
-    // logDebug() << endl;
+    setFlag( ItemHasNoContents, ! isSelected() );
+}
 
-    double nx;
-    double ny;
-    double cosa;
-    int	   x, y;
-    int	   red, green, blue;
 
+bool TreemapTile::needsCushion() const
+{
+    return _parentView->doCushionShading()  &&
+	! _orig->isDir() && ! _orig->isDotEntry() &&
+	_cushion.isNull() && ! _inRaster;
+}
 
-    // Cache some values. They are used for each loop iteration, so let's try
-    // to keep multiple indirect references down.
 
-    int		ambientLight = parentView()->ambientLight();
-    double	lightX	     = parentView()->lightX();
-    double	lightY	     = parentView()->lightY();
-    double	lightZ	     = parentView()->lightZ();
+CushionParams TreemapTile::cushionParams() const
+{
+    CushionParams params;
+
+    params.rect		  = QGraphicsRectItem::rect();
+    params.surface	  = _cushionSurface;
+    params.color	  = _parentView->tileColor( _orig );
+    params.ambientLight	  = _parentView->ambientLight();
+    params.lightX	  = _parentView->lightX();
+    params.lightY	  = _parentView->lightY();
+    params.lightZ	  = _parentView->lightZ();
+    params.ensureContrast = _parentView->ensureContrast();
+
+    return params;
+}
 
-    double	xx2	     = cushionSurface().xx2();
-    double	xx1	     = cushionSurface().xx1();
-    double	yy2	     = cushionSurface().yy2();
-    double	yy1	     = cushionSurface().yy1();
 
-    int		x0	     = rect.x();
-    int		y0	     = rect.y();
+QImage TreemapTile::renderCushion( const CushionParams & params )
+{
+    const QRectF & rect = params.rect;
 
-    QColor	color	     = parentView()->tileColor( _orig );
-    int		maxRed	     = qMax( 0, color.red()   - ambientLight );
-    int		maxGreen     = qMax( 0, color.green() - ambientLight );
-    int		maxBlue	     = qMax( 0, color.blue()  - ambientLight );
+    if ( rect.width() < 1.0 || rect.height() < 1.0 )
+	return QImage();
 
     QImage image( qRound( rect.width() ), qRound( rect.height() ), QImage::Format_RGB32 );
+    renderCushion( params, image );
 
-    for ( y = 0; y < rect.height(); y++ )
-    {
-	for ( x = 0; x < rect.width(); x++ )
-	{
-	    nx = 2.0 * xx2 * (x+x0) + xx1;
-	    ny = 2.0 * yy2 * (y+y0) + yy1;
-	    cosa  = ( nx * lightX + ny * lightY + lightZ ) / sqrt( nx*nx + ny*ny + 1.0 );
+    return image;
+}
 
-	    red	  = (int) ( maxRed   * cosa + 0.5 );
-	    green = (int) ( maxGreen * cosa + 0.5 );
-	    blue  = (int) ( maxBlue  * cosa + 0.5 );
 
-	    if ( red   < 0 )	red   = 0;
-	    if ( green < 0 )	green = 0;
-	    if ( blue  < 0 )	blue  = 0;
+void TreemapTile::renderCushion( const CushionParams & params, QImage & image )
+{
+    const QRectF & rect = params.rect;
 
-	    red	  += ambientLight;
-	    green += ambientLight;
-	    blue  += ambientLight;
+    // Cache some values. They are used for each row, so let's try to keep
+    // multiple indirect references down.
 
-	    image.setPixel( x, y, qRgb( red, green, blue) );
-	}
+    int		ambientLight = params.ambientLight;
+    double	xx2	     = params.surface.xx2();
+    double	xx1	     = params.surface.xx1();
+    double	yy2	     = params.surface.yy2();
+    double	yy1	     = params.surface.yy1();
+
+    int		x0	     = rect.x();
+    int		y0	     = rect.y();
+    float	maxColor[3];
+
+    maxColor[0] = qMax( 0, params.color.red()   - ambientLight );
+    maxColor[1] = qMax( 0, params.color.green() - ambientLight );
+    maxColor[2] = qMax( 0, params.color.blue()  - ambientLight );
+
+    // The surface normal is ( nx, ny, 1 ) with
+    //
+    //	 nx = 2 * xx2 * ( x + x0 ) + xx1
+    //	 ny = 2 * yy2 * ( y + y0 ) + yy1
+
+    for ( int y = 0; y < image.height(); y++ )
+    {
+	renderCushionRow( (QRgb *) image.scanLine( y ),
+			  image.width(),
+			  2.0 * xx2 * x0 + xx1,		// nx at x = 0
+			  2.0 * xx2,			// nx step
+			  2.0 * yy2 * ( y + y0 ) + yy1,	// ny
+			  params.lightX, params.lightY, params.lightZ,
+			  maxColor,
+			  ambientLight );
     }
 
-    if ( _parentView->ensureContrast() )
+    if ( params.ensureContrast )
 	ensureContrast( image );
-
-    return QPixmap::fromImage( image );
 }
 
 
@@ -587,6 +715,13 @@ QVariant TreemapTile::itemChange( GraphicsItemChange   change,
 	bool selected = value.toBool();
 	// logDebug() << this << ( selected ? " is selected" : " is deselected" ) << endl;
 
+	if ( _inRaster && ! _orig->hasChildren() )
+	{
+	    // Only the selection frame needs to be painted on top of the raster
+
+	    setFlag( ItemHasNoContents, ! selected );
+	}
+
 	if ( _orig->hasChildren() )
 	{
 	    if ( ! selected && _highlighter )
@@ -758,6 +893,7 @@ void TreemapTile::contextMenuEvent( QGraphicsSceneContextMenuEvent * event )
 	    << "actionResetTreemapZoom"
 	    << "---"
 	    << "actionMoveToTrash"
+	    << "actionDeletePermanently"
 	;
 
     ActionManager::instance()->addActions( &menu, actions );
@@ -823,6 +959,35 @@ void CushionSurface::addRidge( Orientation dim, double height, const QRectF & re
 }
 
 
+void CushionSurface::rescale( double sx, double dx, double sy, double dy )
+{
+    // Each ridge is 4 * height / ( x2 - x1 ) * ( x - x1 ) * ( x2 - x ), so
+    // for the stretched one the polynome is multiplied by 'sx' in addition
+    // to the substitution x = ( x' - dx ) / sx.
+
+    if ( sx != 0.0 )
+    {
+	_xx1 -= 2.0 * dx * _xx2 / sx;
+	_xx2 /= sx;
+    }
+
+    if ( sy != 0.0 )
+    {
+	_yy1 -= 2.0 * dy * _yy2 / sy;
+	_yy2 /= sy;
+    }
+}
+
+
+void CushionSurface::add( const CushionSurface & other )
+{
+    _xx2 += other.xx2();
+    _xx1 += other.xx1();
+    _yy2 += other.yy2();
+    _yy1 += other.yy1();
+}
+
+
 double CushionSurface::squareRidge( double squareCoefficient, double height, int x1, int x2 )
 {
     if ( x2 != x1 ) // Avoid division by zero
@@ -12,6 +12,8 @@
 
 
 #include <QGraphicsRectItem>
+#include <QHash>
+#include <QImage>
 #include <QRectF>
 
 #include "FileInfoIterator.h"
@@ -26,6 +28,7 @@ namespace QDirStat
     class FileInfo;
     class TreemapView;
     class HighlightRect;
+    struct TreemapLayoutNode;
 
     enum Orientation
     {
@@ -67,6 +70,19 @@ namespace QDirStat
 	 **/
 	void addRidge( Orientation dim, double height, const QRectF & rect );
 
+	/**
+	 * Adapt this surface to its rectangle being moved and stretched with
+	 * x' = sx * x + dx and y' = sy * y + dy: The result is the same as if
+	 * all ridges had been added to the moved and stretched rectangles.
+	 **/
+	void rescale( double sx, double dx, double sy, double dy );
+
+	/**
+	 * Add the coefficients of 'other' to this surface. The height stays
+	 * as it is.
+	 **/
+	void add( const CushionSurface & other );
+
 	/**
 	 * Set the cushion's height.
 	 **/
@@ -124,6 +140,62 @@ namespace QDirStat
     }; // class CushionSurface
 
 
+    /**
+     * Everything that is needed to render the cushion of one tile. This is
+     * taken from the tile in the main thread so the cushion itself can be
+     * rendered in any thread.
+     **/
+    struct CushionParams
+    {
+	QRectF	       rect;
+	CushionSurface surface;
+	QColor	       color;
+	int	       ambientLight;
+	double	       lightX;
+	double	       lightY;
+	double	       lightZ;
+	bool	       ensureContrast;
+    };
+
+
+    /**
+     * Two CushionParams are equal if they render the same cushion, so the
+     * rendered cushions can be cached by them.
+     **/
+    inline bool operator==( const CushionParams & a, const CushionParams & b )
+    {
+	return a.rect		== b.rect	    &&
+	    a.surface.xx2()	== b.surface.xx2()  &&
+	    a.surface.xx1()	== b.surface.xx1()  &&
+	    a.surface.yy2()	== b.surface.yy2()  &&
+	    a.surface.yy1()	== b.surface.yy1()  &&
+	    a.color		== b.color	    &&
+	    a.ambientLight	== b.ambientLight   &&
+	    a.lightX		== b.lightX	    &&
+	    a.lightY		== b.lightY	    &&
+	    a.lightZ		== b.lightZ	    &&
+	    a.ensureContrast	== b.ensureContrast;
+    }
+
+
+    inline uint qHash( const CushionParams & params, uint seed = 0 )
+    {
+	// The lighting is the same for most of them
+
+	uint hash = seed;
+
+	hash = 31 * hash + ::qHash( params.rect.x() );
+	hash = 31 * hash + ::qHash( params.rect.y() );
+	hash = 31 * hash + ::qHash( params.rect.width() );
+	hash = 31 * hash + ::qHash( params.rect.height() );
+	hash = 31 * hash + ::qHash( params.surface.xx1() );
+	hash = 31 * hash + ::qHash( params.surface.yy1() );
+	hash = 31 * hash + params.color.rgb();
+
+	return hash;
+    }
+
+
 
     /**
      * This is the basic building block of a treemap view: One single tile of a
@@ -163,6 +235,14 @@ namespace QDirStat
 		     const CushionSurface & cushionSurface,
 		     Orientation	    orientation = TreemapAuto );
 
+	/**
+	 * Constructor for a tile of a TreemapLayout: This does not create
+	 * any children; the layout already has them.
+	 **/
+	TreemapTile( TreemapView	       * parentView,
+		     TreemapTile	       * parentTile,
+		     const TreemapLayoutNode & node );
+
     public:
 	/**
 	 * Destructor.
@@ -190,6 +270,72 @@ namespace QDirStat
 	 **/
 	CushionSurface & cushionSurface() { return _cushionSurface; }
 
+	/**
+	 * Return 'true' if this tile is painted with a cushion that is not
+	 * rendered yet.
+	 **/
+	bool needsCushion() const;
+
+	/**
+	 * Return the parameters for rendering the cushion of this tile.
+	 **/
+	CushionParams cushionParams() const;
+
+	/**
+	 * Notification that this tile is already painted in the raster of
+	 * the whole treemap (see TreemapView::renderCushions()): Don't paint
+	 * anything anymore unless it is selected.
+	 **/
+	void setInRaster();
+
+	/**
+	 * Render a cushion as described in "cushioned treemaps" by Jarke
+	 * J. van Wijk and Huub van de Wetering	 of the TU Eindhoven, NL.
+	 *
+	 * This does not use any tile, so it can be used in any thread.
+	 **/
+	static QImage renderCushion( const CushionParams & params );
+
+	/**
+	 * Render a cushion like above into 'image' which starts at the top
+	 * left corner of params.rect. 'image' may also be smaller than that
+	 * rectangle or refer to a part of a bigger image, so the cushion can
+	 * be rendered directly where it is needed.
+	 **/
+	static void renderCushion( const CushionParams & params, QImage & image );
+
+	/**
+	 * Return the highlighter of this tile or 0 if it never was selected.
+	 **/
+	HighlightRect * highlighter() const { return _highlighter; }
+
+	/**
+	 * Create the child tiles again in this tile's rectangle after the
+	 * old ones were deleted because the sizes in this subtree changed.
+	 * The rectangle itself stays as it is.
+	 **/
+	void relayoutChildren() { createChildren( rect(), TreemapAuto ); }
+
+	/**
+	 * Move this tile together with its subtree to below 'parentTile' or
+	 * make it a toplevel tile if 'parentTile' is 0.
+	 **/
+	void setParentTile( TreemapTile * parentTile );
+
+	/**
+	 * Move and stretch this tile and all tiles below it with
+	 * x' = sx * x + dx and y' = sy * y + dy, e.g. for zooming without
+	 * laying them out again. Their cushions need to be rendered again
+	 * after this.
+	 **/
+	void rescale( double sx, double dx, double sy, double dy );
+
+	/**
+	 * Add 'surface' to the cushion surfaces of this tile and all tiles
+	 * below it.
+	 **/
+	void addCushionSurface( const CushionSurface & surface );
+
 
     protected:
 
@@ -234,29 +380,11 @@ namespace QDirStat
 	 * for the user in finding wasted disk space are omitted from handling
 	 * and, most important, don't need to be sorted by size (which has a
 	 * cost of O(n*ln(n)) in the best case, so reducing n helps a lot).
-	 **/
-	void createSquarifiedChildren( const QRectF & rect );
-
-	/**
-	 * Squarify as many children as possible: Try to squeeze members
-	 * referred to by 'it' into 'rect' until the aspect ratio doesn't get
-	 * better any more. Returns a list of children that should be laid out
-	 * in 'rect'. Moves 'it' until there is no more improvement or 'it'
-	 * runs out of items.
 	 *
-	 * 'scale' is the scaling factor between file sizes and pixels.
+	 * The layout of the whole subtree is done by TreemapLayout, big
+	 * subtrees in worker threads; this only creates the tiles for it.
 	 **/
-	FileInfoList squarify( const QRectF & rect,
-			       double	     scale,
-			       FileInfoSortedBySizeIterator & it   );
-
-	/**
-	 * Lay out all members of 'row' within 'rect' along its longer side.
-	 * Returns the new rectangle with the layouted area subtracted.
-	 **/
-	QRectF layoutRow( const QRectF	& rect,
-			  double	  scale,
-			  FileInfoList	& row );
+	void createSquarifiedChildren( const QRectF & rect );
 
 	/**
 	 * Paint this tile.
@@ -328,24 +456,18 @@ namespace QDirStat
          **/
         virtual void hoverLeaveEvent( QGraphicsSceneHoverEvent * event ) Q_DECL_OVERRIDE;
 
-	/**
-	 * Render a cushion as described in "cushioned treemaps" by Jarke
-	 * J. van Wijk and Huub van de Wetering	 of the TU Eindhoven, NL.
-	 **/
-	QPixmap renderCushion();
-
 	/**
 	 * Check if the contrast of the specified image is sufficient to
 	 * visually distinguish an outline at the right and bottom borders
 	 * and add a grey line there, if necessary.
 	 **/
-	void ensureContrast( QImage & image );
+	static void ensureContrast( QImage & image );
 
 	/**
 	 * Returns a color that gives a reasonable contrast to 'col': Lighter
 	 * if 'col' is dark, darker if 'col' is light.
 	 **/
-	QRgb contrastingColor( QRgb col );
+	static QRgb contrastingColor( QRgb col );
 
     private:
 
@@ -354,6 +476,17 @@ namespace QDirStat
 	 **/
 	void init();
 
+	/**
+	 * Set the brush for the current rectangle of this tile.
+	 **/
+	void updateBrush();
+
+	/**
+	 * Set the z value one level higher than the parent's, also for all
+	 * tiles below this one.
+	 **/
+	void updateZValue();
+
 
     protected:
 
@@ -364,6 +497,7 @@ namespace QDirStat
 	FileInfo *	_orig;
 	CushionSurface	_cushionSurface;
 	QPixmap		_cushion;
+	bool		_inRaster;
 	HighlightRect * _highlighter;
 
     }; // class TreemapTile
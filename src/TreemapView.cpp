@@ -7,12 +7,24 @@
  */
 
 
+#include <string.h>	// memcpy()
+#include <algorithm>
+
+#include <QAtomicInt>
+#include <QGraphicsPixmapItem>
+#include <QOpenGLWidget>
+#include <QPainter>
 #include <QResizeEvent>
 #include <QRegExp>
+#include <QRunnable>
+#include <QThread>
 #include <QTimer>
+#include <QVector>
 
 #include "TreemapView.h"
 #include "DirTree.h"
+#include "DirTreeDiff.h"
+#include "DirInfo.h"
 #include "Exception.h"
 #include "Logger.h"
 #include "SelectionModel.h"
@@ -20,14 +32,141 @@
 #include "SettingsHelpers.h"
 #include "SignalBlocker.h"
 #include "TreemapTile.h"
+#include "TreemapGLRenderer.h"
+#include "Tracer.h"
 #include "MimeCategorizer.h"
 #include "DelayedRebuilder.h"
+#include "UpdateScheduler.h"
 
 #define UpdateMinSize	      20
 
+// Render the cushions in worker threads only if there are at least that many
+// pixels; below that, just starting the threads costs more
+#define ParallelCushionMinPixels  ( 256 * 1024 )
+
+// When an item is deleted, only the smallest tile around it is laid out again
+// whose children get at most this much more area than they should; the
+// rectangle of that tile and of everything outside it stay as they are.
+#define MaxRelayoutGrowth	  0.05
+
+// While reading, rebuild the treemap at most this often, but only spend
+// about one tenth of the time with rebuilding
+#define ProgressiveRebuildMinInterval	2000	// millisec
+#define ProgressiveRebuildTimeFactor	10
+
+// While resizing, the old treemap is stretched to the new size unless its
+// aspect ratio would change by more than this factor; then a coarse one is
+// built
+#define ResizePreviewMaxDistortion	1.5
+
 using namespace QDirStat;
 
 
+namespace
+{
+    /**
+     * Rendering cushions in a worker thread: Each task takes the next
+     * cushion that no other task has taken yet until there are no more,
+     * so the threads stay busy no matter how the sizes of the tiles vary.
+     *
+     * Each cushion is copied to its position in 'raster', a Format_RGB32
+     * image; the tiles don't overlap, so the tasks never write the same
+     * pixels. It is also stored in 'rendered' at the same index as its
+     * parameters for the cushion cache.
+     **/
+    class CushionRenderTask: public QRunnable
+    {
+    public:
+
+	CushionRenderTask( const QVector<CushionParams> & params,
+			   uchar *			  raster,
+			   int				  bytesPerLine,
+			   const QRect &		  rasterRect,
+			   QImage *			  rendered,
+			   QAtomicInt &			  next ):
+	    _params( params ),
+	    _raster( raster ),
+	    _bytesPerLine( bytesPerLine ),
+	    _rasterRect( rasterRect ),
+	    _rendered( rendered ),
+	    _next( next )
+	    {}
+
+	virtual void run() Q_DECL_OVERRIDE
+	{
+	    TRACE_SCOPE( "treemap", "CushionRenderTask::run" );
+
+	    int i;
+
+	    while ( ( i = _next.fetchAndAddRelaxed( 1 ) ) < _params.size() )
+	    {
+		_rendered[ i ] = TreemapTile::renderCushion( _params.at( i ) );
+		copyCushion( _rendered[ i ], _params.at( i ).rect, _raster, _bytesPerLine, _rasterRect );
+	    }
+	}
+
+	/**
+	 * Copy 'cushion' to 'rect' in 'raster' which covers 'rasterRect'.
+	 **/
+	static void copyCushion( const QImage & cushion,
+				 const QRectF & rect,
+				 uchar *	raster,
+				 int		bytesPerLine,
+				 const QRect &	rasterRect )
+	{
+	    int x0 = qRound( rect.x() ) - rasterRect.x();
+	    int y0 = qRound( rect.y() ) - rasterRect.y();
+
+	    int width  = qMin( cushion.width(),	 rasterRect.width()  - x0 );
+	    int height = qMin( cushion.height(), rasterRect.height() - y0 );
+
+	    if ( x0 < 0 || y0 < 0 || width <= 0 )
+		return;
+
+	    for ( int y = 0; y < height; ++y )
+	    {
+		memcpy( raster + ( y0 + y ) * bytesPerLine + x0 * sizeof( QRgb ),
+			cushion.constScanLine( y ),
+			width * sizeof( QRgb ) );
+	    }
+	}
+
+    private:
+
+	const QVector<CushionParams> & _params;
+	uchar *			       _raster;
+	int			       _bytesPerLine;
+	QRect			       _rasterRect;
+	QImage *		       _rendered;
+	QAtomicInt &		       _next;
+    };
+
+
+    /**
+     * Add 'tile' and all tiles below it to 'tiles'.
+     **/
+    void collectTiles( TreemapTile * tile, QList<TreemapTile *> & tiles )
+    {
+	tiles << tile;
+
+	foreach ( QGraphicsItem * graphicsItem, tile->childItems() )
+	{
+	    TreemapTile * child = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	    if ( child )
+		collectTiles( child, tiles );
+	}
+    }
+
+
+    bool lessZValue( const TreemapTile * a, const TreemapTile * b )
+    {
+	return a->zValue() < b->zValue();
+    }
+
+}	// namespace
+
+
 TreemapView::TreemapView( QWidget * parent ):
     QGraphicsView( parent ),
     _tree(0),
@@ -35,23 +174,42 @@ TreemapView::TreemapView( QWidget * parent ):
     _selectionModelProxy(0),
     _cleanupCollection(0),
     _rebuilder(0),
+    _progressiveRebuilds(0),
     _rootTile(0),
+    _relayoutPending(false),
+    _rasterItem(0),
+    _keepSubtree(0),
+    _glRenderer(0),
     _currentItem(0),
     _currentItemRect(0),
     _newRoot(0),
     _useFixedColor(false),
-    _useDirGradient(true)
+    _minDirTileSize(0),
+    _useDirGradient(true),
+    _resizePreview(false),
+    _coarseRebuild(false)
 {
+    _cushionCache.setMaxCost( CushionCacheMaxKB );
+
     // logDebug() << endl;
 
     readSettings();
 
-    // Default values for light sources taken from Wiik / Wetering's paper
-    // about "cushion treemaps".
+    if ( _useOpenGL )
+    {
+	QOpenGLWidget * glWidget = new QOpenGLWidget();
+	CHECK_NEW( glWidget );
+
+	setViewport( glWidget );
+	setViewportUpdateMode( QGraphicsView::FullViewportUpdate );
+
+	_glRenderer = new TreemapGLRenderer();
+	CHECK_NEW( _glRenderer );
+    }
 
-    _lightX = 0.09759;
-    _lightY = 0.19518;
-    _lightZ = 0.9759;
+    _lightX = DefaultLightX;
+    _lightY = DefaultLightY;
+    _lightZ = DefaultLightZ;
 
     setHorizontalScrollBarPolicy( Qt::ScrollBarAlwaysOff );
     setVerticalScrollBarPolicy	( Qt::ScrollBarAlwaysOff );
@@ -61,6 +219,15 @@ TreemapView::TreemapView( QWidget * parent ):
 
     connect( _rebuilder, SIGNAL( rebuild() ),
 	     this,	 SLOT  ( rebuildTreemapDelayed() ) );
+
+    _progressiveRebuilds = new ScheduledUpdate( this, LowPriority, ProgressiveRebuildMinInterval );
+    CHECK_NEW( _progressiveRebuilds );
+
+    _progressiveRebuilds->setCostFactor( ProgressiveRebuildTimeFactor );
+    _progressiveRebuilds->setWidget( this );
+
+    connect( _progressiveRebuilds, SIGNAL( update() ),
+	     this,		   SLOT	 ( progressiveRebuildTimeout() ) );
 }
 
 
@@ -70,6 +237,21 @@ TreemapView::~TreemapView()
     // There is no settings dialog for this class because the settings are all
     // pretty obscure - strictly for experts.
     writeSettings();
+
+    if ( _glRenderer )
+    {
+	// The OpenGL objects can only be deleted in their context
+
+	QOpenGLWidget * glWidget = qobject_cast<QOpenGLWidget *>( viewport() );
+
+	if ( glWidget )
+	    glWidget->makeCurrent();
+
+	delete _glRenderer;
+
+	if ( glWidget )
+	    glWidget->doneCurrent();
+    }
 }
 
 
@@ -78,12 +260,49 @@ void TreemapView::clear()
     if ( scene() )
 	qDeleteAll( scene()->items() );
 
+    _tiles.clear();
+    _relayoutTiles.clear();
+    _relayoutPending = false;
+    _rasterItem	     = 0;
+
+    if ( _glRenderer )
+	_glRenderer->clear();
+
     _currentItem     = 0;
     _currentItemRect = 0;
     _rootTile	     = 0;
 }
 
 
+void TreemapView::clearingSubtree( DirInfo * subtree )
+{
+    Q_UNUSED( subtree );
+
+    // Like in deleteNotify(): The treemap root might be outside of that
+    // subtree, e.g. when cold subtrees are spilled to disk
+
+    if ( _rootTile && _rootTile->orig() != _tree->firstToplevel() && _savedRootUrl.isEmpty() )
+	_savedRootUrl = _rootTile->orig()->debugUrl();
+
+    clear();
+}
+
+
+void TreemapView::checkSpill( DirInfo * dir, bool * keep_ret )
+{
+    if ( *keep_ret || ! _rootTile )
+	return;
+
+    // A subdivided tile shows the children, and zooming out needs the
+    // ancestors of the treemap root
+
+    TreemapTile * tile = _tiles.value( dir, 0 );
+
+    if ( ( tile && ! tile->childItems().isEmpty() ) || _rootTile->orig()->isInSubtree( dir ) )
+	*keep_ret = true;
+}
+
+
 void TreemapView::setDirTree( DirTree * newTree )
 {
     // logDebug() << endl;
@@ -113,8 +332,23 @@ void TreemapView::setDirTree( DirTree * newTree )
     connect( _tree, SIGNAL( clearing() ),
 	     this,  SLOT  ( clear()    ) );
 
+    connect( _tree, SIGNAL( clearingSubtree( DirInfo * ) ),
+	     this,  SLOT  ( clearingSubtree( DirInfo * ) ) );
+
+    connect( _tree, SIGNAL( checkingSpill( DirInfo *, bool * ) ),
+	     this,  SLOT  ( checkSpill	 ( DirInfo *, bool * ) ) );
+
+    connect( _tree, SIGNAL( subtreesSpilled() ),
+	     this,  SLOT  ( rebuildTreemap()  ) );
+
+    connect( _tree, SIGNAL( startingReading()		 ),
+	     this,  SLOT  ( startProgressiveRebuilds() ) );
+
     connect( _tree, SIGNAL( finished()	     ),
 	     this,  SLOT  ( rebuildTreemap() ) );
+
+    connect( _tree, SIGNAL( diffChanged()    ),
+	     this,  SLOT  ( rebuildTreemap() ) );
 }
 
 
@@ -163,6 +397,8 @@ void TreemapView::readSettings()
     _forceCushionGrid	= settings.value( "ForceCushionGrid" , false ).toBool();
     _useDirGradient	= settings.value( "UseDirGradient"   , true  ).toBool();
     _minTileSize	= settings.value( "MinTileSize"	     , DefaultMinTileSize ).toInt();
+    _progressiveRebuild = settings.value( "ProgressiveRebuild", true  ).toBool();
+    _useOpenGL		= settings.value( "UseOpenGL"	      , false ).toBool();
 
     _currentItemColor	= readColorEntry( settings, "CurrentItemColor"	, Qt::red		     );
     _selectedItemsColor = readColorEntry( settings, "SelectedItemsColor", Qt::yellow		     );
@@ -172,6 +408,7 @@ void TreemapView::readSettings()
     _dirFillColor	= readColorEntry( settings, "DirFillColor"	, QColor( 0x10, 0x7d, 0xb4 ) );
     _dirGradientStart	= readColorEntry( settings, "DirGradientStart"	, QColor( 0x60, 0x60, 0x70 ) );
     _dirGradientEnd	= readColorEntry( settings, "DirGradientEnd"	, QColor( 0x70, 0x70, 0x80 ) );
+    _estimatedColor	= readColorEntry( settings, "EstimatedColor"	, QColor( 0xc0, 0xc0, 0xc0 ) );
 
     settings.endGroup();
 }
@@ -192,6 +429,8 @@ void TreemapView::writeSettings()
     settings.setValue( "ForceCushionGrid"  , _forceCushionGrid	 );
     settings.setValue( "UseDirGradient"	   , _useDirGradient	 );
     settings.setValue( "MinTileSize"	   , _minTileSize	 );
+    settings.setValue( "ProgressiveRebuild", _progressiveRebuild );
+    settings.setValue( "UseOpenGL"	   , _useOpenGL		 );
 
     writeColorEntry( settings, "CurrentItemColor"  , _currentItemColor	 );
     writeColorEntry( settings, "SelectedItemsColor", _selectedItemsColor );
@@ -201,6 +440,7 @@ void TreemapView::writeSettings()
     writeColorEntry( settings, "DirFillColor"	   , _dirFillColor	 );
     writeColorEntry( settings, "DirGradientStart"  , _dirGradientStart	 );
     writeColorEntry( settings, "DirGradientEnd"	   , _dirGradientEnd	 );
+    writeColorEntry( settings, "EstimatedColor"	   , _estimatedColor	 );
 
     settings.endGroup();
 }
@@ -225,7 +465,16 @@ void TreemapView::zoomIn()
 	FileInfo * newRoot = newRootTile->orig();
 
 	if ( newRoot->isDirInfo() )
-	    rebuildTreemap( newRoot );
+	{
+	    // A subtree that is still pending in a cache file would only be
+	    // one big tile
+
+	    if ( newRoot->toDirInfo()->isPendingSubtree() && _tree )
+		_tree->loadPendingSubtree( newRoot->toDirInfo() );
+
+	    if ( ! zoomInTile( newRootTile ) )
+		rebuildTreemap( newRoot );
+	}
     }
 }
 
@@ -240,14 +489,198 @@ void TreemapView::zoomOut()
     if ( newRoot->parent() && newRoot->parent() != _tree->root() )
 	newRoot = newRoot->parent();
 
-    rebuildTreemap( newRoot );
+    if ( ! zoomOutTo( newRoot ) )
+	rebuildTreemap( newRoot );
 }
 
 
 void TreemapView::resetZoom()
 {
     if ( _tree && _tree->firstToplevel() )
-	rebuildTreemap( _tree->firstToplevel() );
+    {
+	if ( ! zoomOutTo( _tree->firstToplevel() ) )
+	    rebuildTreemap( _tree->firstToplevel() );
+    }
+}
+
+
+bool TreemapView::zoomInTile( TreemapTile * newRootTile )
+{
+    if ( ! _squarify || ! _rootTile || _relayoutPending )
+	return false;
+
+    QRectF oldRect = newRootTile->rect();
+    QRectF newRect = sceneRect();
+
+    if ( oldRect.isEmpty() || newRect.isEmpty() )
+	return false;
+
+    // logDebug() << "Zooming into " << newRootTile << " without a rebuild" << endl;
+
+    // Everything outside the new root tile goes away
+
+    newRootTile->setParentTile( 0 );
+
+    QList<TreemapTile *> oldTiles;
+    collectTiles( _rootTile, oldTiles );
+
+    foreach ( TreemapTile * tile, oldTiles )
+	forgetTile( tile );
+
+    delete _rootTile;	// This deletes the other tiles as well
+    _rootTile = newRootTile;
+
+    double sx = newRect.width()	 / oldRect.width();
+    double sy = newRect.height() / oldRect.height();
+
+    _rootTile->rescale( sx, newRect.x() - sx * oldRect.x(),
+			sy, newRect.y() - sy * oldRect.y() );
+
+    // Directory tiles that were too small to be subdivided before might be
+    // big enough now
+
+    QList<TreemapTile *> tiles;
+    collectTiles( _rootTile, tiles );
+
+    foreach ( TreemapTile * tile, tiles )
+    {
+	if ( tile->orig()->isDirInfo() && tile->childItems().isEmpty() )
+	    tile->relayoutChildren();
+    }
+
+    finishZoom();
+
+    return true;
+}
+
+
+bool TreemapView::zoomOutTo( FileInfo * newRoot )
+{
+    if ( ! _squarify || ! _rootTile || _relayoutPending || ! newRoot )
+	return false;
+
+    TreemapTile * oldRoot = _rootTile;
+    FileInfo    * oldOrig = oldRoot->orig();
+    QRectF	  oldRect = oldRoot->rect();
+
+    if ( newRoot == oldOrig || ! oldOrig->isInSubtree( newRoot ) || oldRect.isEmpty() )
+	return false;
+
+    // logDebug() << "Zooming out to " << newRoot << " without a rebuild" << endl;
+
+    // Lay out the new root without the subtree of the old one; that one
+    // keeps its old tiles.
+
+    _keepSubtree = oldOrig;
+    _rootTile	 = new TreemapTile( this,	// parentView
+				    0,		// parentTile
+				    newRoot,	// orig
+				    sceneRect(),
+				    TreemapAuto );
+    CHECK_NEW( _rootTile );
+    _keepSubtree = 0;
+
+    TreemapTile * newTile = findTile( oldOrig );
+
+    if ( newTile != oldRoot )
+    {
+	// The old tiles get the ridges of the new ancestors of the old root
+	// tile on top of their own
+
+	QRectF newRect = newTile->rect();
+	double sx      = newRect.width()  / oldRect.width();
+	double sy      = newRect.height() / oldRect.height();
+
+	foreach ( QGraphicsItem * graphicsItem, oldRoot->childItems() )
+	{
+	    TreemapTile * tile = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	    if ( tile )
+	    {
+		tile->setParentTile( newTile );
+		tile->rescale( sx, newRect.x() - sx * oldRect.x(),
+			       sy, newRect.y() - sy * oldRect.y() );
+		tile->addCushionSurface( newTile->cushionSurface() );
+	    }
+	}
+
+	pruneTiles( newTile );
+    }
+    else
+    {
+	// The old root didn't get a tile at all
+
+	QList<TreemapTile *> oldTiles;
+	collectTiles( oldRoot, oldTiles );
+	oldTiles.removeFirst();	// 'oldRoot' itself
+
+	foreach ( TreemapTile * tile, oldTiles )
+	    forgetTile( tile );
+    }
+
+    forgetTile( oldRoot );
+    delete oldRoot;
+
+    finishZoom();
+
+    return true;
+}
+
+
+void TreemapView::pruneTiles( TreemapTile * tile )
+{
+    foreach ( QGraphicsItem * graphicsItem, tile->childItems() )
+    {
+	TreemapTile * child = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	if ( ! child )
+	    continue;
+
+	QRectF rect = child->rect();
+
+	if ( qMin( rect.width(), rect.height() ) < _minTileSize )
+	{
+	    QList<TreemapTile *> tiles;
+	    collectTiles( child, tiles );
+
+	    foreach ( TreemapTile * oldTile, tiles )
+		forgetTile( oldTile );
+
+	    delete child;	// This deletes its children as well
+	}
+	else
+	{
+	    pruneTiles( child );
+	}
+    }
+}
+
+
+void TreemapView::finishZoom()
+{
+    // The old raster doesn't fit any of the tiles anymore
+
+    if ( _rasterItem )
+    {
+	delete _rasterItem;
+	_rasterItem = 0;
+    }
+
+    if ( _doCushionShading )
+    {
+	if ( _glRenderer )
+	    prepareGLTiles();
+	else
+	    renderCushions();
+    }
+
+    if ( _selectionModel )
+    {
+	updateSelection( _selectionModel->selectedItems() );
+	updateCurrentItem( _selectionModel->currentItem() );
+    }
+
+    emit treemapChanged();
 }
 
 
@@ -290,6 +723,15 @@ bool TreemapView::canZoomOut() const
 
 void TreemapView::rebuildTreemap()
 {
+    if ( _relayoutPending && _rootTile )
+    {
+	// Only some items were deleted, and deleteNotify() found that most of
+	// the treemap can stay as it is
+
+	relayoutTiles();
+	return;
+    }
+
     FileInfo * root = 0;
 
     if ( ! _savedRootUrl.isEmpty() )
@@ -302,7 +744,10 @@ void TreemapView::rebuildTreemap()
     if ( ! root )
 	root = _rootTile ? _rootTile->orig() : _tree->firstToplevel();
 
-    rebuildTreemap( root, sceneRect().size() );
+    // A stretched preview while resizing has the old scene size; use the
+    // new one
+
+    rebuildTreemap( root, _resizePreview ? QSizeF() : sceneRect().size() );
     _savedRootUrl = "";
 }
 
@@ -310,6 +755,8 @@ void TreemapView::rebuildTreemap()
 void TreemapView::rebuildTreemap( FileInfo *	 newRoot,
 				  const QSizeF & newSz )
 {
+    TRACE_SCOPE( "treemap", "TreemapView::rebuildTreemap" );
+
     // logDebug() << endl;
 
     QSizeF newSize = newSz;
@@ -321,6 +768,12 @@ void TreemapView::rebuildTreemap( FileInfo *	 newRoot,
     // Delete all old stuff.
     clear();
 
+    if ( _resizePreview )
+    {
+	resetTransform();
+	_resizePreview = false;
+    }
+
 
     if ( ! scene() )
     {
@@ -329,6 +782,11 @@ void TreemapView::rebuildTreemap( FileInfo *	 newRoot,
 	setScene( scene );
     }
 
+    // Keep the treemap coarse while the tree is still being read and for
+    // previews while resizing
+
+    _minDirTileSize = ( _tree && _tree->isBusy() ) || _coarseRebuild ? ProgressiveMinDirTileSize : 0;
+
     QRectF rect = QRectF( 0.0, 0.0, (double) newSize.width(), (double) newSize.height() );
     scene()->setSceneRect( rect );
 
@@ -348,6 +806,14 @@ void TreemapView::rebuildTreemap( FileInfo *	 newRoot,
 					 newRoot,	// orig
 					 rect,
 					 TreemapAuto );
+
+	    if ( _doCushionShading )
+	    {
+		if ( _glRenderer )
+		    prepareGLTiles();
+		else
+		    renderCushions();
+	    }
 	}
 
 
@@ -368,6 +834,244 @@ void TreemapView::rebuildTreemap( FileInfo *	 newRoot,
 }
 
 
+void TreemapView::renderCushions( TreemapTile * parentTile )
+{
+    TRACE_SCOPE( "treemap", "TreemapView::renderCushions" );
+
+    QList<TreemapTile *>   tiles;
+    QList<TreemapTile *>   cushionTiles;
+    QVector<CushionParams> params;	// the ones that are not in the cache
+    QVector<CushionParams> cachedParams;
+    qreal pixels = 0.0;
+    QRect rasterRect;
+
+    if ( parentTile && _rasterItem )
+    {
+	collectTiles( parentTile, tiles );
+	rasterRect = parentTile->rect().toAlignedRect() & sceneRect().toAlignedRect();
+    }
+    else
+    {
+	parentTile = 0;
+	rasterRect = QRect( QPoint( 0, 0 ), sceneRect().size().toSize() );
+
+	foreach ( QGraphicsItem * graphicsItem, scene()->items() )
+	{
+	    TreemapTile * tile = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	    if ( tile )
+		tiles << tile;
+	}
+    }
+
+    // Parents first so their children are painted on top of them
+
+    std::sort( tiles.begin(), tiles.end(), lessZValue );
+
+    QImage raster( rasterRect.size(), QImage::Format_RGB32 );
+
+    if ( raster.isNull() )
+	return;
+
+    raster.fill( QColor( 0x60, 0x60, 0x60 ) );
+
+    QPainter painter( &raster );
+    painter.translate( -rasterRect.topLeft() );
+
+    foreach ( TreemapTile * tile, tiles )
+    {
+	if ( tile->needsCushion() )
+	{
+	    CushionParams cushionParams = tile->cushionParams();
+	    cushionTiles << tile;
+
+	    if ( _cushionCache.contains( cushionParams ) )
+	    {
+		cachedParams << cushionParams;
+	    }
+	    else
+	    {
+		params << cushionParams;
+		pixels += tile->rect().width() * tile->rect().height();
+	    }
+	}
+	else if ( tile->brush().style() != Qt::NoBrush )
+	{
+	    painter.fillRect( tile->rect(), tile->brush() );
+	}
+    }
+
+    painter.end();
+
+    foreach ( const CushionParams & cushionParams, cachedParams )
+    {
+	CushionRenderTask::copyCushion( *_cushionCache.object( cushionParams ), cushionParams.rect,
+					raster.bits(), raster.bytesPerLine(), rasterRect );
+    }
+
+    QVector<QImage> rendered( params.size() );
+    QAtomicInt next( 0 );
+
+    if ( pixels < ParallelCushionMinPixels )
+    {
+	// Starting the threads would cost more here
+
+	CushionRenderTask task( params, raster.bits(), raster.bytesPerLine(), rasterRect,
+				rendered.data(), next );
+	task.run();
+    }
+    else
+    {
+	int threads = qMax( 1, QThread::idealThreadCount() );
+	_threadPool.setMaxThreadCount( threads );
+
+	for ( int i = 0; i < threads; ++i )
+	{
+	    _threadPool.start( new CushionRenderTask( params, raster.bits(), raster.bytesPerLine(),
+							     rasterRect, rendered.data(), next ) );
+	}
+
+	_threadPool.waitForDone();
+    }
+
+    for ( int i = 0; i < params.size(); ++i )
+    {
+	QImage * cushion = new QImage( rendered.at( i ) );
+	CHECK_NEW( cushion );
+
+	_cushionCache.insert( params.at( i ), cushion, qMax( 1, cushion->byteCount() / 1024 ) );
+    }
+
+    if ( _forceCushionGrid )
+    {
+	painter.begin( &raster );
+	painter.translate( -rasterRect.topLeft() );
+	painter.setPen( QPen( _cushionGridColor, 1 ) );
+
+	foreach ( TreemapTile * tile, cushionTiles )
+	{
+	    QRectF rect = tile->rect();
+
+	    if ( rect.x() > 0 )
+		painter.drawLine( rect.topLeft(), rect.bottomLeft() );
+
+	    if ( rect.y() > 0 )
+		painter.drawLine( rect.topLeft(), rect.topRight() );
+	}
+
+	painter.end();
+    }
+
+    // From now on, the tiles don't paint anything themselves unless they
+    // are selected, and there is no pixmap for each of them anymore.
+
+    foreach ( TreemapTile * tile, tiles )
+	tile->setInRaster();
+
+    if ( parentTile )
+    {
+	QPixmap pixmap = _rasterItem->pixmap();
+
+	painter.begin( &pixmap );
+	painter.drawImage( rasterRect.topLeft(), raster );
+	painter.end();
+
+	_rasterItem->setPixmap( pixmap );
+	return;
+    }
+
+    _rasterItem = new QGraphicsPixmapItem( QPixmap::fromImage( raster ) );
+    CHECK_NEW( _rasterItem );
+
+    _rasterItem->setZValue( -1.0 );
+    scene()->addItem( _rasterItem );
+
+    // logDebug() << "Rendered " << cushionTiles.size() << " cushions into one raster" << endl;
+}
+
+
+void TreemapView::prepareGLTiles()
+{
+    TRACE_SCOPE( "treemap", "TreemapView::prepareGLTiles" );
+
+    QList<TreemapTile *> tiles;
+
+    foreach ( QGraphicsItem * graphicsItem, scene()->items() )
+    {
+	TreemapTile * tile = dynamic_cast<TreemapTile *>( graphicsItem );
+
+	if ( tile )
+	    tiles << tile;
+    }
+
+    // Parents first so their children are drawn on top of them
+
+    std::sort( tiles.begin(), tiles.end(), lessZValue );
+    _glRenderer->clear();
+
+    foreach ( TreemapTile * tile, tiles )
+    {
+	const QBrush & brush = tile->brush();
+
+	if ( tile->needsCushion() )
+	{
+	    _glRenderer->addCushion( tile->cushionParams() );
+	}
+	else if ( brush.gradient() && brush.gradient()->stops().size() >= 2 )
+	{
+	    _glRenderer->addRect( tile->rect(),
+				  brush.gradient()->stops().first().second,
+				  brush.gradient()->stops().last().second );
+	}
+	else if ( brush.style() != Qt::NoBrush )
+	{
+	    _glRenderer->addRect( tile->rect(), brush.color(), brush.color() );
+	}
+    }
+
+    // Just like with the raster image, the tiles don't paint anything
+    // themselves unless they are selected.
+
+    foreach ( TreemapTile * tile, tiles )
+	tile->setInRaster();
+
+    viewport()->update();
+}
+
+
+void TreemapView::drawBackground( QPainter * painter, const QRectF & rect )
+{
+    QGraphicsView::drawBackground( painter, rect );
+
+    if ( ! _glRenderer || ! _doCushionShading || ! _rootTile )
+	return;
+
+    QMatrix4x4 matrix;
+    matrix.ortho( 0.0, viewport()->width(), viewport()->height(), 0.0, -1.0, 1.0 );
+    matrix *= QMatrix4x4( painter->transform() );
+
+    painter->beginNativePainting();
+    _glRenderer->render( matrix,
+			 viewport()->size() * viewport()->devicePixelRatio(),
+			 _ambientLight, _lightX, _lightY, _lightZ );
+    painter->endNativePainting();
+
+    if ( _forceCushionGrid )
+    {
+	painter->setPen( QPen( _cushionGridColor, 1 ) );
+
+	foreach ( const QRectF & cushionRect, _glRenderer->cushionRects() )
+	{
+	    if ( cushionRect.x() > 0 )
+		painter->drawLine( cushionRect.topLeft(), cushionRect.bottomLeft() );
+
+	    if ( cushionRect.y() > 0 )
+		painter->drawLine( cushionRect.topLeft(), cushionRect.topRight() );
+	}
+    }
+}
+
+
 void TreemapView::scheduleRebuildTreemap( FileInfo * newRoot )
 {
     _newRoot = newRoot;
@@ -381,8 +1085,28 @@ void TreemapView::rebuildTreemapDelayed()
 }
 
 
-void TreemapView::deleteNotify( FileInfo * )
+void TreemapView::startProgressiveRebuilds()
 {
+    if ( _progressiveRebuild )
+	_progressiveRebuilds->requestLater();
+}
+
+
+void TreemapView::progressiveRebuildTimeout()
+{
+    if ( ! _tree || ! _tree->isBusy() )
+	return;	  // The finished() signal already rebuilt the treemap
+
+    rebuildTreemap();
+    _progressiveRebuilds->request();
+}
+
+
+void TreemapView::deleteNotify( FileInfo * node )
+{
+    if ( _rootTile && relayoutOnDelete( node ) )
+	return;
+
     if ( _rootTile )
     {
 	if ( _rootTile->orig() != _tree->firstToplevel() )
@@ -418,6 +1142,150 @@ void TreemapView::deleteNotify( FileInfo * )
 }
 
 
+bool TreemapView::relayoutOnDelete( FileInfo * node )
+{
+    // The simple (non-squarified) layout adds its ridges to the parent's
+    // cushion surface while laying out the children, so it can't do that
+    // twice. While reading, there is no childDeleted() signal afterwards,
+    // and the treemap is rebuilt anyway when reading is finished.
+
+    if ( ! node || ! _squarify || _tree->isBusy() )
+	return false;
+
+    FileInfo * root = _rootTile->orig();
+
+    if ( node == root || root->isInSubtree( node ) )
+	return false;
+
+    if ( ! node->isInSubtree( root ) )
+    {
+	// Nothing in this treemap changes (it is zoomed in elsewhere)
+
+	_relayoutPending = true;
+	return true;
+    }
+
+    if ( root->totalAllocatedSize() == 0 )
+	return false;
+
+    TreemapTile * tile = 0;
+
+    for ( FileInfo * parent = node->parent(); parent && ! tile; parent = parent->parent() )
+	tile = findTile( parent );
+
+    if ( ! tile )
+	return false;
+
+    QRectF rootRect = _rootTile->rect();
+    double scale    = rootRect.width() * rootRect.height() / root->totalAllocatedSize();
+    double pixels   = node->totalAllocatedSize() * scale;
+
+    if ( pixels < 1.0 && ! findTile( node ) )
+    {
+	// Too small to make any visible difference
+
+	_relayoutPending = true;
+	return true;
+    }
+
+    while ( tile != _rootTile &&
+	    pixels > MaxRelayoutGrowth * tile->rect().width() * tile->rect().height() )
+    {
+	tile = tile->parentTile();
+    }
+
+    if ( tile == _rootTile )	// That's a complete rebuild anyway
+	return false;
+
+    // All tiles that are already waiting for their new children and that
+    // are inside this one are deleted now together with its other children
+
+    QMutableSetIterator<TreemapTile *> it( _relayoutTiles );
+
+    while ( it.hasNext() )
+    {
+	for ( TreemapTile * parent = it.next()->parentTile(); parent; parent = parent->parentTile() )
+	{
+	    if ( parent == tile )
+	    {
+		it.remove();
+		break;
+	    }
+	}
+    }
+
+    deleteChildTiles( tile );
+    _relayoutTiles.insert( tile );
+    _relayoutPending = true;
+
+    return true;
+}
+
+
+void TreemapView::relayoutTiles()
+{
+    TRACE_SCOPE( "treemap", "TreemapView::relayoutTiles" );
+
+    // logDebug() << "Laying out " << _relayoutTiles.size() << " tiles again" << endl;
+
+    foreach ( TreemapTile * tile, _relayoutTiles )
+    {
+	tile->relayoutChildren();
+
+	if ( _rasterItem )
+	    renderCushions( tile );
+    }
+
+    if ( _glRenderer && _doCushionShading )
+	prepareGLTiles();
+
+    _relayoutTiles.clear();
+    _relayoutPending = false;
+
+    if ( _selectionModel )
+    {
+	updateSelection( _selectionModel->selectedItems() );
+	updateCurrentItem( _selectionModel->currentItem() );
+    }
+
+    emit treemapChanged();
+}
+
+
+void TreemapView::deleteChildTiles( TreemapTile * tile )
+{
+    QList<TreemapTile *> tiles;
+    collectTiles( tile, tiles );
+    tiles.removeFirst();	// 'tile' itself
+
+    foreach ( TreemapTile * child, tiles )
+	forgetTile( child );
+
+    foreach ( QGraphicsItem * graphicsItem, tile->childItems() )
+	delete graphicsItem;	// This deletes their children as well
+}
+
+
+void TreemapView::forgetTile( TreemapTile * tile )
+{
+    // After zooming out, there might already be a new tile for that item
+
+    if ( _tiles.value( tile->orig() ) == tile )
+	_tiles.remove( tile->orig() );
+
+    if ( tile->highlighter() )
+	delete tile->highlighter();
+
+    if ( tile == _currentItem )
+    {
+	_currentItem = 0;
+
+	if ( _currentItemRect )
+	    _currentItemRect->hide();
+    }
+}
+
+
 void TreemapView::resizeEvent( QResizeEvent * event )
 {
     // logDebug() << endl;
@@ -445,11 +1313,45 @@ void TreemapView::resizeEvent( QResizeEvent * event )
     else if ( _rootTile )
     {
 	// logDebug() << "Auto-resizing treemap" << endl;
+
+	// Rebuilding the full treemap for each step while dragging a splitter
+	// would be far too slow: Show a preview now and the real thing when
+	// resizing pauses
+
+	showResizePreview( visibleSize() );
 	scheduleRebuildTreemap( _rootTile->orig() );
     }
 }
 
 
+void TreemapView::showResizePreview( const QSize & newSize )
+{
+    QSizeF oldSize = sceneRect().size();
+
+    if ( oldSize.isEmpty() || newSize.isEmpty() || ! _rootTile )
+	return;
+
+    qreal scaleX     = newSize.width()	/ oldSize.width();
+    qreal scaleY     = newSize.height() / oldSize.height();
+    qreal distortion = qMax( scaleX, scaleY ) / qMin( scaleX, scaleY );
+
+    if ( distortion <= ResizePreviewMaxDistortion )
+    {
+	setTransform( QTransform::fromScale( scaleX, scaleY ) );
+	_resizePreview = true;
+    }
+    else
+    {
+	// The new scene has the new size, so the next steps are stretched
+	// from this one
+
+	_coarseRebuild = true;
+	rebuildTreemap( _rootTile->orig(), newSize );
+	_coarseRebuild = false;
+    }
+}
+
+
 void TreemapView::disable()
 {
     // logDebug() << "Disabling treemap view" << endl;
@@ -605,20 +1507,9 @@ void TreemapView::updateCurrentItem( FileInfo * currentItem )
 
 
 
-TreemapTile * TreemapView::findTile( const FileInfo * fileInfo )
+void TreemapView::addTile( TreemapTile * tile )
 {
-    if ( ! fileInfo || ! scene() )
-	return 0;
-
-    foreach ( QGraphicsItem * graphicsItem, scene()->items() )
-    {
-	TreemapTile * tile = dynamic_cast<TreemapTile *>(graphicsItem);
-
-	if ( tile && tile->orig() == fileInfo )
-	    return tile;
-    }
-
-    return 0;
+    _tiles.insert( tile->orig(), tile );
 }
 
 
@@ -643,6 +1534,9 @@ QColor TreemapView::tileColor( FileInfo * file )
     if ( _useFixedColor )
 	return _fixedColor;
 
+    if ( file && _tree && _tree->diff() )
+	return sizeDeltaColor( file );
+
     if ( file )
     {
 	if ( file->isFile() )
@@ -669,6 +1563,26 @@ QColor TreemapView::tileColor( FileInfo * file )
 }
 
 
+QColor TreemapView::sizeDeltaColor( FileInfo * file )
+{
+    QColor unchanged( 0xb0, 0xb0, 0xb0 );
+    double change = _tree->diff()->sizeChange( file );
+
+    if ( change == 0.0 )
+	return unchanged;
+
+    QColor changed = change > 0.0 ? QColor( 0xff, 0x20, 0x20 ) : QColor( 0x20, 0x50, 0xff );
+
+    // Make even small changes stand out against the unchanged files
+
+    double weight = 0.3 + 0.7 * qMin( 1.0, qAbs( change ) );
+
+    return QColor( unchanged.red()   + weight * ( changed.red()   - unchanged.red()   ),
+		   unchanged.green() + weight * ( changed.green() - unchanged.green() ),
+		   unchanged.blue()  + weight * ( changed.blue()  - unchanged.blue()  ) );
+}
+
+
 void TreemapView::sendHoverEnter( FileInfo * node )
 {
     emit hoverEnter( node );
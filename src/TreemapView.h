@@ -13,8 +13,13 @@
 
 #include <QGraphicsView>
 #include <QGraphicsRectItem>
+#include <QCache>
+#include <QHash>
+#include <QSet>
+#include <QThreadPool>
 
 #include "FileInfo.h"
+#include "TreemapTile.h"	// CushionParams
 
 
 #define MinAmbientLight		   0
@@ -27,9 +32,18 @@
 #define DefaultHeightScaleFactor   ( DefaultHeightScalePercent / 100.0 )
 
 #define DefaultMinTileSize	   3
+#define CushionCacheMaxKB	   ( 64 * 1024 )
+#define ProgressiveMinDirTileSize  40
 #define CushionHeight		   1.0
 
+// Default values for light sources taken from Wiik / Wetering's paper
+// about "cushion treemaps"
+#define DefaultLightX		   0.09759
+#define DefaultLightY		   0.19518
+#define DefaultLightZ		   0.9759
 
+
+class QGraphicsPixmapItem;
 class QMouseEvent;
 class QSettings;
 
@@ -44,6 +58,8 @@ namespace QDirStat
     class CleanupCollection;
     class FileInfoSet;
     class DelayedRebuilder;
+    class TreemapGLRenderer;
+    class ScheduledUpdate;
 
 
     /**
@@ -117,20 +133,34 @@ namespace QDirStat
 	CleanupCollection * cleanupCollection() const { return _cleanupCollection; }
 
 	/**
-	 * Search the treemap for a tile that corresponds to the specified
-	 * FileInfo node. Returns 0 if there is none.
-	 *
-	 * Notice: This is an expensive operation since all treemap tiles need
-	 * to be searched.
+	 * Return the treemap tile that corresponds to the specified FileInfo
+	 * node or 0 if there is none.
+	 **/
+	TreemapTile * findTile( const FileInfo * node ) const
+	    { return _tiles.value( node, 0 ); }
+
+	/**
+	 * Add 'tile' to the tiles that findTile() can find. This is called
+	 * by each tile when it is created.
 	 **/
-	TreemapTile * findTile( const FileInfo * node );
+	void addTile( TreemapTile * tile );
 
 	/**
 	 * Returns a suitable color for 'file' based on a set of internal rules
 	 * (according to filename extension, MIME type or permissions).
+	 *
+	 * While the tree is compared with a cache file, this is the color for
+	 * the size delta instead (see sizeDeltaColor()).
 	 **/
 	QColor tileColor( FileInfo * file );
 
+	/**
+	 * Return the color for the size delta of 'file' compared to a cache
+	 * file: Grey for unchanged, red for grown, blue for shrunk files;
+	 * the more it changed relative to its size, the more intense.
+	 **/
+	QColor sizeDeltaColor( FileInfo * file );
+
 	/**
 	 * Use a fixed color for all tiles. To undo this, set an invalid QColor
 	 * with the QColor default constructor.
@@ -195,6 +225,19 @@ namespace QDirStat
 	 **/
 	void clear();
 
+	/**
+	 * Notification that the children of 'subtree' are about to be
+	 * deleted: Clear the treemap, but remember where it was zoomed to
+	 * for the next rebuildTreemap().
+	 **/
+	void clearingSubtree( DirInfo * subtree );
+
+	/**
+	 * Notification that the children of 'dir' might be spilled to disk:
+	 * Keep them if the treemap shows them.
+	 **/
+	void checkSpill( DirInfo * dir, bool * keep_ret );
+
 	/**
 	 * Disable this treemap view: Clear its contents, resize it to below
 	 * the update threshold and hide it.
@@ -271,6 +314,14 @@ namespace QDirStat
 	 **/
 	void scheduleRebuildTreemap( FileInfo * newRoot );
 
+	/**
+	 * Show a preview of the treemap at 'newSize' while the view is being
+	 * resized: The current treemap stretched to the new size or, if that
+	 * would distort it too much, a coarse treemap (like the one while
+	 * reading, see minDirTileSize()). The next rebuild replaces it.
+	 **/
+	void showResizePreview( const QSize & newSize );
+
 	/**
 	 * Returns the visible size of the viewport presuming no scrollbars are
 	 * needed - which makes a lot more sense than fiddling with scrollbars
@@ -345,6 +396,32 @@ namespace QDirStat
 	 **/
 	int minTileSize() const { return _minTileSize; }
 
+	/**
+	 * Returns the minimum size in pixels in width and height of a
+	 * directory tile that is subdivided into tiles for its children, or 0
+	 * for no limit. This is only set while the tree is still being read
+	 * to keep the treemap coarse so rebuilding it is fast.
+	 **/
+	int minDirTileSize() const { return _minDirTileSize; }
+
+	/**
+	 * Returns the thread pool for rendering cushions and laying out
+	 * tiles. The main thread always waits until it is done with them.
+	 **/
+	QThreadPool * threadPool() { return &_threadPool; }
+
+	/**
+	 * Returns the directory whose old tiles are kept while the treemap
+	 * is laid out for zooming out, or 0 if there is none.
+	 **/
+	FileInfo * keepSubtree() const { return _keepSubtree; }
+
+	/**
+	 * Returns 'true' if the treemap stays visible while the tree is being
+	 * read and is rebuilt from time to time.
+	 **/
+	bool progressiveRebuild() const { return _progressiveRebuild; }
+
 	/**
 	 * Returns the cushion grid color.
 	 **/
@@ -384,6 +461,12 @@ namespace QDirStat
          **/
         const QColor & dirGradientEnd() const { return _dirGradientEnd; }
 
+	/**
+	 * Returns the color of the hatching of directory tiles whose size is
+	 * only estimated (see DirInfo::isEstimated()).
+	 **/
+	const QColor & estimatedColor() const { return _estimatedColor; }
+
 
 	/**
 	 * Returns the intensity of ambient light for cushion shading
@@ -461,6 +544,20 @@ namespace QDirStat
 	 **/
 	void rebuildTreemapDelayed();
 
+	/**
+	 * Start rebuilding the treemap from time to time while the tree is
+	 * being read if progressiveRebuild() is set.
+	 **/
+	void startProgressiveRebuilds();
+
+	/**
+	 * Rebuild the treemap with what is read so far and request the next
+	 * rebuild; the UpdateScheduler adapts the time until then to how
+	 * long this took and postpones it while the treemap is hidden. This
+	 * stops when reading is finished.
+	 **/
+	void progressiveRebuildTimeout();
+
     protected:
 
 	/**
@@ -472,6 +569,92 @@ namespace QDirStat
 	 **/
 	virtual void resizeEvent( QResizeEvent * event ) Q_DECL_OVERRIDE;
 
+	/**
+	 * Draw the background: With OpenGL, this is where the cushions are
+	 * shaded.
+	 *
+	 * Reimplemented from QGraphicsView.
+	 **/
+	virtual void drawBackground( QPainter * painter, const QRectF & rect ) Q_DECL_OVERRIDE;
+
+	/**
+	 * Hand all tiles over to the OpenGL renderer. Like with
+	 * renderCushions(), the tiles themselves only paint anything after
+	 * this when they are selected.
+	 **/
+	void prepareGLTiles();
+
+	/**
+	 * Paint all tiles into one raster image that is shown below them:
+	 * The directories in the main thread, then the cushions in worker
+	 * threads. This waits until they are all done; the old treemap stays
+	 * on the screen meanwhile since there is no repaint in between.
+	 *
+	 * After this, the tiles themselves only paint anything when they are
+	 * selected; they are still there for selecting and hovering.
+	 *
+	 * With 'parentTile', only the area of that tile is painted again into
+	 * the existing raster image.
+	 *
+	 * The cushions are kept in a cache (up to CushionCacheMaxKB) so they
+	 * are not rendered again when the same tiles come back with the
+	 * next rebuild.
+	 **/
+	void renderCushions( TreemapTile * parentTile = 0 );
+
+	/**
+	 * Prepare for deleting 'node' by only laying out the smallest tile
+	 * around it again that can absorb the size change: Delete that tile's
+	 * children now and remember the tile for relayoutTiles(). Return
+	 * 'false' if the whole treemap needs to be rebuilt instead.
+	 **/
+	bool relayoutOnDelete( FileInfo * node );
+
+	/**
+	 * Create the children of all tiles that relayoutOnDelete() prepared
+	 * again, now that the sizes in their subtrees are up to date.
+	 **/
+	void relayoutTiles();
+
+	/**
+	 * Delete all child tiles of 'tile' together with their highlighters.
+	 **/
+	void deleteChildTiles( TreemapTile * tile );
+
+	/**
+	 * Remove 'tile' from the tiles that findTile() can find and delete
+	 * its highlighter before the tile itself is deleted.
+	 **/
+	void forgetTile( TreemapTile * tile );
+
+	/**
+	 * Zoom into 'newRootTile' without laying out the treemap again: Keep
+	 * its tiles, stretch them to the whole scene and only create the
+	 * children of directory tiles that were too small to get any before.
+	 * Return 'false' if the treemap needs to be rebuilt instead.
+	 **/
+	bool zoomInTile( TreemapTile * newRootTile );
+
+	/**
+	 * Zoom out to 'newRoot', an ancestor of the current root, without
+	 * laying out the subtree of the current root again: Its tiles are
+	 * shrunk into the new tile for it. Return 'false' if the treemap
+	 * needs to be rebuilt instead.
+	 **/
+	bool zoomOutTo( FileInfo * newRoot );
+
+	/**
+	 * Delete all tiles below 'tile' that are smaller than minTileSize()
+	 * after zooming out.
+	 **/
+	void pruneTiles( TreemapTile * tile );
+
+	/**
+	 * Render the cushions again and sync the selection after zoomInTile()
+	 * or zoomOutTo() changed the tiles.
+	 **/
+	void finishZoom();
+
 
 	// Data members
 
@@ -480,7 +663,16 @@ namespace QDirStat
 	SelectionModelProxy * _selectionModelProxy;
 	CleanupCollection   * _cleanupCollection;
         DelayedRebuilder    * _rebuilder;
+	QThreadPool	      _threadPool;
+	QCache<CushionParams, QImage> _cushionCache;
+	ScheduledUpdate	    * _progressiveRebuilds;
 	TreemapTile	    * _rootTile;
+	QHash<const FileInfo *, TreemapTile *> _tiles;
+	QSet<TreemapTile *>   _relayoutTiles;
+	bool		      _relayoutPending;
+	QGraphicsPixmapItem * _rasterItem;
+	FileInfo	    * _keepSubtree;
+	TreemapGLRenderer   * _glRenderer;
 	TreemapTile	    * _currentItem;
 	HighlightRect	    * _currentItemRect;
 	FileInfo	    * _newRoot;
@@ -492,7 +684,12 @@ namespace QDirStat
 	bool   _ensureContrast;
 	bool   _useFixedColor;
 	int    _minTileSize;
+	int    _minDirTileSize;
+	bool   _progressiveRebuild;
+	bool   _useOpenGL;
         bool   _useDirGradient;
+	bool   _resizePreview;	// The scene is stretched to the view size
+	bool   _coarseRebuild;
 
 	QColor _currentItemColor;
 	QColor _selectedItemsColor;
@@ -502,6 +699,7 @@ namespace QDirStat
 	QColor _dirFillColor;
         QColor _dirGradientStart;
         QColor _dirGradientEnd;
+	QColor _estimatedColor;
 	QColor _fixedColor;
 
 	int    _ambientLight;
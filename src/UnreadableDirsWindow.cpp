@@ -15,6 +15,7 @@
 #include "SelectionModel.h"
 #include "SettingsHelpers.h"
 #include "HeaderTweaker.h"
+#include "SignalBlocker.h"
 #include "Logger.h"
 #include "Exception.h"
 
@@ -85,14 +86,10 @@ void UnreadableDirsWindow::populate( FileInfo * newSubtree )
     clear();
     _subtree = newSubtree;
 
-    logDebug() << "Locating all unreadable dirs below " << _subtree.url() << endl;
+    logDebug() << "Listing all unreadable dirs below " << _subtree.url() << endl;
 
-    populateRecursive( newSubtree ? newSubtree : _subtree() );
-    _ui->treeWidget->sortByColumn( 0, Qt::AscendingOrder );
-
-    int count = _ui->treeWidget->topLevelItemCount();
-    _ui->totalLabel->setText( QString( "Total: %1" ).arg( count ) );
-    logDebug() << count << " directories" << endl;
+    addItems( newSubtree ? newSubtree : _subtree() );
+    logDebug() << _ui->treeWidget->topLevelItemCount() << " directories" << endl;
 
     // Make sure something is selected, even if this window is not the active
     // one (for example because the user just clicked on another suffix in the
@@ -116,44 +113,126 @@ void UnreadableDirsWindow::populate( FileInfo * newSubtree )
 }
 
 
-void UnreadableDirsWindow::populateRecursive( FileInfo * subtree )
+void UnreadableDirsWindow::addItems( FileInfo * subtree )
 {
-    if ( ! subtree || ! subtree->isDirInfo() )
-	return;
-
-    DirInfo * dir = subtree->toDirInfo();
+    DirTree * tree = _subtree.tree();
 
-    if ( dir->readError() )
+    if ( tree && subtree )
     {
-	UnreadableDirListItem * searchResultItem =
-	    new UnreadableDirListItem( dir->url(),
-				       dir->userName(),
-				       dir->groupName(),
-				       dir->symbolicPermissions(),
-				       dir->octalPermissions() );
-	CHECK_NEW( searchResultItem );
-
-	_ui->treeWidget->addTopLevelItem( searchResultItem );
+	// Deleted directories that are not freed yet are not in the subtree
+	// anymore
+
+	foreach ( DirInfo * dir, tree->unreadableDirs() )
+	{
+	    if ( dir->isInSubtree( subtree ) )
+		addItem( dir );
+	}
+
+	connect( tree, SIGNAL( unreadableDirAdded( DirInfo * ) ),
+		 this, SLOT  ( addUnreadableDir  ( DirInfo * ) ),
+		 Qt::UniqueConnection );
+
+	connect( tree, SIGNAL( clearing() ),
+		 this, SLOT  ( clear()	  ),
+		 Qt::UniqueConnection );
+
+	connect( tree, SIGNAL( childDeleted() ),
+		 this, SLOT  ( refresh()      ),
+		 Qt::UniqueConnection );
+
+	connect( tree, SIGNAL( subtreeCleared( DirInfo * ) ),
+		 this, SLOT  ( refresh()		 ),
+		 Qt::UniqueConnection );
+
+	connect( tree, SIGNAL( finished() ),
+		 this, SLOT  ( refresh()  ),
+		 Qt::UniqueConnection );
     }
 
+    updateTotal();
+}
+
+
+void UnreadableDirsWindow::addItem( DirInfo * dir )
+{
+    QString path = dir->url();
 
-    // Recurse through any subdirectories
+    // Binary search for the position: The items are sorted by path
 
-    FileInfo * child = dir->firstChild();
+    int first = 0;
+    int last  = _ui->treeWidget->topLevelItemCount();
 
-    while ( child )
+    while ( first < last )
     {
-	if ( child->isDir() )
-	    populateRecursive( child );
+	int middle = ( first + last ) / 2;
+	UnreadableDirListItem * item =
+	    static_cast<UnreadableDirListItem *>( _ui->treeWidget->topLevelItem( middle ) );
+
+	if ( item->path() == path )	// Read again and still unreadable
+	    return;
+
+	if ( item->path() < path )
+	    first = middle + 1;
+	else
+	    last = middle;
+    }
+
+    UnreadableDirListItem * searchResultItem =
+	new UnreadableDirListItem( path,
+				   dir->userName(),
+				   dir->groupName(),
+				   dir->symbolicPermissions(),
+				   dir->octalPermissions() );
+    CHECK_NEW( searchResultItem );
+
+    _ui->treeWidget->insertTopLevelItem( first, searchResultItem );
+}
+
+
+void UnreadableDirsWindow::addUnreadableDir( DirInfo * dir )
+{
+    FileInfo * subtree = _subtree();
+
+    if ( ! subtree || ! dir->isInSubtree( subtree ) )
+	return;
+
+    addItem( dir );
+    updateTotal();
+}
+
+
+void UnreadableDirsWindow::refresh()
+{
+    // Not the topmost item like in populate(): That would select it in the
+    // main window each time something changes in the tree.
+
+    QTreeWidgetItem * current = _ui->treeWidget->currentItem();
+    QString currentPath = current ?
+	static_cast<UnreadableDirListItem *>( current )->path() : QString();
 
-	child = child->next();
+    SignalBlocker blocker( _ui->treeWidget );
+
+    clear();
+    addItems( _subtree() );
+
+    for ( int i = 0; i < _ui->treeWidget->topLevelItemCount() && ! currentPath.isEmpty(); ++i )
+    {
+	UnreadableDirListItem * item =
+	    static_cast<UnreadableDirListItem *>( _ui->treeWidget->topLevelItem( i ) );
+
+	if ( item->path() == currentPath )
+	{
+	    _ui->treeWidget->setCurrentItem( item );
+	    break;
+	}
     }
+}
 
-    if ( dir->attic() )
-        populateRecursive( dir->attic() );
 
-    // No need to recurse through dot entries; they can't have any read error
-    // or any subdirectory children which might have a read error.
+void UnreadableDirsWindow::updateTotal()
+{
+    int count = _ui->treeWidget->topLevelItemCount();
+    _ui->totalLabel->setText( QString( "Total: %1" ).arg( count ) );
 }
 
 
@@ -21,6 +21,7 @@
 
 namespace QDirStat
 {
+    class DirInfo;
     class DirTree;
     class FileTypeStats;
     class MimeCategory;
@@ -81,11 +82,13 @@ namespace QDirStat
     public slots:
 
 	/**
-	 * Populate the window: Locate unreadable directories in 'subtree'.
+	 * Populate the window: Show the unreadable directories in 'subtree'.
 	 *
-	 * This clears the old search results first, then searches the subtree
-	 * and populates the search result list with the directories could not
-	 * be read.
+	 * This clears the old results first, then takes the directories that
+	 * could not be read from the tree's list of them (see
+	 * DirTree::unreadableDirs()), so this does not need to search the
+	 * tree. From now on, the window is kept up to date while the tree is
+	 * being read.
 	 **/
 	void populate( FileInfo * newSubtree );
 
@@ -107,24 +110,47 @@ namespace QDirStat
 	 **/
 	void selectResult( QTreeWidgetItem * item );
 
+	/**
+	 * Notification that directory 'dir' could not be read: Add it if it
+	 * is in the subtree of this window.
+	 **/
+	void addUnreadableDir( DirInfo * dir );
 
-    protected:
+	/**
+	 * Populate the window again for the same subtree, e.g. because
+	 * directories were deleted.
+	 **/
+	void refresh();
 
 	/**
 	 * Clear all data and widget contents.
 	 **/
 	void clear();
 
+
+    protected:
+
 	/**
 	 * One-time initialization of the widgets in this window.
 	 **/
 	void initWidgets();
 
 	/**
-	 * Recursively find unreadable directories in a subtree and add an
-	 * entry to the tree widget for each one.
+	 * Add an entry for 'dir' to the tree widget at its sorted position
+	 * unless there is one already.
+	 **/
+	void addItem( DirInfo * dir );
+
+	/**
+	 * Add entries for the unreadable directories in 'subtree' and notice
+	 * changes in the tree from now on.
+	 **/
+	void addItems( FileInfo * subtree );
+
+	/**
+	 * Show the number of directories.
 	 **/
-	void populateRecursive( FileInfo * subtree );
+	void updateTotal();
 
 
 	//
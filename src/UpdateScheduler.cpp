@@ -0,0 +1,278 @@
+/*
+ *   File name: UpdateScheduler.cpp
+ *   Summary:	Spreading display updates over frames for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <algorithm>	// std::stable_sort()
+
+#include "UpdateScheduler.h"
+#include "Exception.h"
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * The order of the due updates in a frame, taken at the start of the
+     * frame (the waiting times go on while sorting).
+     **/
+    struct DueUpdate
+    {
+	ScheduledUpdate * update;
+	bool		  overdue;
+	int		  priority;
+	qint64		  waitingTime;
+    };
+
+
+    bool runsBefore( const DueUpdate & a, const DueUpdate & b )
+    {
+	if ( a.overdue != b.overdue )
+	    return a.overdue;
+
+	if ( a.priority != b.priority )
+	    return a.priority > b.priority;
+
+	return a.waitingTime > b.waitingTime;
+    }
+
+}	// namespace
+
+
+
+ScheduledUpdate::ScheduledUpdate( QObject *	 parent,
+				  UpdatePriority priority,
+				  int		 minIntervalMillisec ):
+    QObject( parent ),
+    _priority( priority ),
+    _minInterval( minIntervalMillisec ),
+    _costFactor( 0 ),
+    _lastCost( 0 ),
+    _pending( false )
+{
+    UpdateScheduler::instance()->add( this );
+}
+
+
+ScheduledUpdate::~ScheduledUpdate()
+{
+    UpdateScheduler::instance()->remove( this );
+}
+
+
+void ScheduledUpdate::request()
+{
+    if ( ! _pending )
+    {
+	_pending = true;
+	_requested.start();
+    }
+
+    UpdateScheduler::instance()->schedule();
+}
+
+
+void ScheduledUpdate::requestLater()
+{
+    _lastCost = 0;
+    _lastRun.start();
+    request();
+}
+
+
+void ScheduledUpdate::cancel()
+{
+    _pending = false;
+}
+
+
+bool ScheduledUpdate::isHidden() const
+{
+    return _widget && ( ! _widget->isVisible() || _widget->window()->isMinimized() );
+}
+
+
+int ScheduledUpdate::timeUntilDue() const
+{
+    if ( ! _lastRun.isValid() )
+	return 0;
+
+    qint64 interval = qMax( _minInterval, _costFactor * _lastCost );
+
+    return (int) qMax( (qint64) 0, interval - _lastRun.elapsed() );
+}
+
+
+bool ScheduledUpdate::isDue() const
+{
+    return _pending && timeUntilDue() == 0 && ! isHidden();
+}
+
+
+qint64 ScheduledUpdate::waitingTime() const
+{
+    return _pending ? _requested.elapsed() : 0;
+}
+
+
+void ScheduledUpdate::run()
+{
+    // The consumer might request the next update while doing this one
+
+    _pending = false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    emit update();
+
+    _lastCost = (int) timer.elapsed();
+    _lastRun.start();
+}
+
+
+
+
+UpdateScheduler * UpdateScheduler::_instance = 0;
+
+
+UpdateScheduler * UpdateScheduler::instance()
+{
+    if ( ! _instance )
+    {
+	_instance = new UpdateScheduler();
+	CHECK_NEW( _instance );
+    }
+
+    return _instance;
+}
+
+
+UpdateScheduler::UpdateScheduler():
+    QObject(),
+    _frameBudget( UPDATE_FRAME_BUDGET_MILLISEC ),
+    _frameGap( 0 ),
+    _inFrame( false )
+{
+    _frameTimer.setSingleShot( true );
+
+    connect( &_frameTimer, SIGNAL( timeout()  ),
+	     this,	   SLOT	 ( runFrame() ) );
+}
+
+
+void UpdateScheduler::add( ScheduledUpdate * update )
+{
+    if ( update && ! _updates.contains( update ) )
+	_updates << update;
+}
+
+
+void UpdateScheduler::remove( ScheduledUpdate * update )
+{
+    _updates.removeAll( update );
+}
+
+
+void UpdateScheduler::schedule()
+{
+    // The end of the frame takes care of requests from the updates
+
+    if ( _inFrame )
+	return;
+
+    int minDelay = 0;
+
+    if ( _lastFrameEnd.isValid() )
+	minDelay = (int) qMax( (qint64) 0, _frameGap - _lastFrameEnd.elapsed() );
+
+    scheduleNextFrame( minDelay );
+}
+
+
+void UpdateScheduler::runFrame()
+{
+    QElapsedTimer frameTime;
+    frameTime.start();
+
+    QList<DueUpdate> due;
+
+    foreach ( ScheduledUpdate * update, _updates )
+    {
+	if ( update->isDue() )
+	{
+	    DueUpdate entry;
+	    entry.update      = update;
+	    entry.waitingTime = update->waitingTime();
+	    entry.overdue     = entry.waitingTime >= UPDATE_MAX_WAIT_MILLISEC;
+	    entry.priority    = update->priority();
+	    due << entry;
+	}
+    }
+
+    std::stable_sort( due.begin(), due.end(), runsBefore );
+
+    _inFrame = true;
+    int done = 0;
+
+    foreach ( const DueUpdate & entry, due )
+    {
+	// An update might have deleted another one or done its work
+
+	if ( ! _updates.contains( entry.update ) || ! entry.update->isDue() )
+	    continue;
+
+	// After the first update, only what still fits into the budget:
+	// A cheap one with a lower priority might.
+
+	qint64 remaining = _frameBudget - frameTime.elapsed();
+
+	if ( done > 0 && ( remaining <= 0 || entry.update->lastCost() > remaining ) )
+	    continue;
+
+	entry.update->run();
+	++done;
+    }
+
+    _inFrame = false;
+
+    // Leave at least as much time to the GUI as this frame took
+
+    int elapsed = (int) frameTime.elapsed();
+    _frameGap	= qMax( UPDATE_FRAME_MILLISEC - elapsed, elapsed );
+    _lastFrameEnd.start();
+
+    scheduleNextFrame( _frameGap );
+}
+
+
+void UpdateScheduler::scheduleNextFrame( int minDelay )
+{
+    int delay = -1;
+
+    foreach ( ScheduledUpdate * update, _updates )
+    {
+	if ( ! update->isPending() )
+	    continue;
+
+	int updateDelay = update->isHidden() ?
+	    UPDATE_HIDDEN_POLL_MILLISEC : update->timeUntilDue();
+
+	if ( delay < 0 || updateDelay < delay )
+	    delay = updateDelay;
+    }
+
+    if ( delay < 0 )	// Nothing to do: No frames
+    {
+	_frameTimer.stop();
+	return;
+    }
+
+    _frameTimer.start( qMax( delay, minDelay ) );
+}
@@ -0,0 +1,290 @@
+/*
+ *   File name: UpdateScheduler.h
+ *   Summary:	Spreading display updates over frames for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef UpdateScheduler_h
+#define UpdateScheduler_h
+
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QPointer>
+#include <QTimer>
+#include <QWidget>
+
+
+// Time between two frames and how much of that the updates may use
+#define UPDATE_FRAME_MILLISEC		40
+#define UPDATE_FRAME_BUDGET_MILLISEC	15
+
+// Pending updates of hidden widgets are checked this often
+#define UPDATE_HIDDEN_POLL_MILLISEC	500
+
+// An update that waited this long goes first, whatever its priority
+#define UPDATE_MAX_WAIT_MILLISEC	2000
+
+
+namespace QDirStat
+{
+    /**
+     * Priorities of scheduled updates: Higher priorities go first in a
+     * frame.
+     **/
+    enum UpdatePriority
+    {
+	LowPriority,	// Expensive and optional, like rebuilding the treemap
+	NormalPriority, // Things that show the latest numbers
+	HighPriority	// Keeping views consistent, like inserting new rows
+    };
+
+
+    /**
+     * One kind of display update of one consumer (a view, the status bar)
+     * that the UpdateScheduler runs when there is time for it: Call
+     * request() whenever there is something to update, and connect to the
+     * update() signal to do it. Like with AdaptiveTimer, requests that
+     * come in before the update is done are merged into one.
+     *
+     * An update runs at most every minInterval() millisec. With a cost
+     * factor, the interval also stretches to that many times what the last
+     * update took, so an expensive update leaves the GUI some room.
+     *
+     * An update with a widget only runs while that widget is visible (and
+     * its window is not minimized); until then, it stays pending.
+     **/
+    class ScheduledUpdate: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Constructor.
+	 **/
+	ScheduledUpdate( QObject *	parent,
+			 UpdatePriority priority	    = NormalPriority,
+			 int		minIntervalMillisec = 0 );
+
+	/**
+	 * Destructor.
+	 **/
+	virtual ~ScheduledUpdate();
+
+	/**
+	 * Return the priority of this update.
+	 **/
+	UpdatePriority priority() const { return _priority; }
+
+	/**
+	 * Return the minimum time between two updates.
+	 **/
+	int minInterval() const { return _minInterval; }
+
+	/**
+	 * Set the minimum time between two updates.
+	 **/
+	void setMinInterval( int millisec ) { _minInterval = millisec; }
+
+	/**
+	 * Return the cost factor. 0 means that the time an update takes does
+	 * not stretch the interval.
+	 **/
+	int costFactor() const { return _costFactor; }
+
+	/**
+	 * Set the cost factor: After an update that took t millisec, the
+	 * next one runs at the earliest after 'factor' * t millisec.
+	 **/
+	void setCostFactor( int factor ) { _costFactor = factor; }
+
+	/**
+	 * Set the widget that this update is for. The update is postponed
+	 * while it is not visible. 0 means to always update.
+	 **/
+	void setWidget( QWidget * widget ) { _widget = widget; }
+
+	/**
+	 * Return 'true' if an update is requested and not done yet.
+	 **/
+	bool isPending() const { return _pending; }
+
+	/**
+	 * Return 'true' if this update may run now: It is pending, the
+	 * interval is over and its widget is visible.
+	 **/
+	bool isDue() const;
+
+	/**
+	 * Return 'true' if this update waits only because its widget is not
+	 * visible.
+	 **/
+	bool isHidden() const;
+
+	/**
+	 * Return the number of millisec until the interval is over.
+	 **/
+	int timeUntilDue() const;
+
+	/**
+	 * Return the number of millisec that this update has been pending.
+	 **/
+	qint64 waitingTime() const;
+
+	/**
+	 * Return how long the last update took in millisec.
+	 **/
+	int lastCost() const { return _lastCost; }
+
+	/**
+	 * Send the update() signal now and measure how long it takes. This
+	 * is what UpdateScheduler calls.
+	 **/
+	void run();
+
+
+    public slots:
+
+	/**
+	 * Request an update.
+	 **/
+	void request();
+
+	/**
+	 * Request an update, but not before the interval is over from now
+	 * on, as if an update had just been done.
+	 **/
+	void requestLater();
+
+	/**
+	 * Drop a pending update, e.g. because the consumer does it right
+	 * away anyway.
+	 **/
+	void cancel();
+
+
+    signals:
+
+	/**
+	 * Emitted when the scheduler runs this update.
+	 **/
+	void update();
+
+
+    protected:
+
+	UpdatePriority	  _priority;
+	int		  _minInterval;
+	int		  _costFactor;
+	int		  _lastCost;
+	bool		  _pending;
+	QPointer<QWidget> _widget;
+	QElapsedTimer	  _lastRun;	// invalid before the first update
+	QElapsedTimer	  _requested;
+
+    };	// class ScheduledUpdate
+
+
+
+    /**
+     * Central scheduler for the display updates (ScheduledUpdate) of all
+     * views, so they don't all land in the same frame while a directory
+     * tree is being read: Every UPDATE_FRAME_MILLISEC, it runs the updates
+     * that are due, the highest priorities first, until the frame budget
+     * (UPDATE_FRAME_BUDGET_MILLISEC) is used up; the rest wait for the
+     * next frames. An update that waited for UPDATE_MAX_WAIT_MILLISEC goes
+     * first.
+     *
+     * At least one update runs in each frame, even if it takes longer than
+     * the budget. The next frame then starts only after the same time
+     * again, so the GUI can still handle user input.
+     *
+     * Without any pending updates, there are no frames; updates that only
+     * wait for hidden widgets are checked every UPDATE_HIDDEN_POLL_MILLISEC.
+     *
+     * This is for the main (GUI) thread only.
+     **/
+    class UpdateScheduler: public QObject
+    {
+	Q_OBJECT
+
+    public:
+
+	/**
+	 * Return the singleton instance of this class.
+	 **/
+	static UpdateScheduler * instance();
+
+	/**
+	 * Return the time budget of one frame in millisec.
+	 **/
+	int frameBudget() const { return _frameBudget; }
+
+	/**
+	 * Set the time budget of one frame in millisec.
+	 **/
+	void setFrameBudget( int millisec ) { _frameBudget = millisec; }
+
+	/**
+	 * Register 'update'. ScheduledUpdate does this itself.
+	 **/
+	void add( ScheduledUpdate * update );
+
+	/**
+	 * Unregister 'update'.
+	 **/
+	void remove( ScheduledUpdate * update );
+
+	/**
+	 * Notification that an update was requested: Start the frames if
+	 * they are not running.
+	 **/
+	void schedule();
+
+
+    protected slots:
+
+	/**
+	 * Run the updates of one frame.
+	 **/
+	void runFrame();
+
+
+    protected:
+
+	/**
+	 * Constructor. Use instance() instead.
+	 **/
+	UpdateScheduler();
+
+	/**
+	 * Start the frame timer for the next frame that is needed, if any,
+	 * 'minDelay' millisec from now at the earliest.
+	 **/
+	void scheduleNextFrame( int minDelay );
+
+
+	//
+	// Data members
+	//
+
+	static UpdateScheduler * _instance;
+
+	QList<ScheduledUpdate *> _updates;
+	QTimer			 _frameTimer;
+	int			 _frameBudget;
+	int			 _frameGap;	// at least this long after the last frame
+	QElapsedTimer		 _lastFrameEnd;
+	bool			 _inFrame;
+
+    };	// class UpdateScheduler
+
+}	// namespace QDirStat
+
+
+#endif	// UpdateScheduler_h
@@ -0,0 +1,184 @@
+/*
+ *   File name: ZfsDatasets.cpp
+ *   Summary:	ZFS dataset sizes from the dataset properties for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+
+#include "ZfsDatasets.h"
+#include "MountPoints.h"
+#include "SysUtil.h"
+#include "Logger.h"
+
+#define ZFS_TIMEOUT_SEC		30
+
+
+using namespace QDirStat;
+
+
+namespace
+{
+    /**
+     * Dataset usage by mount path as read with updateCacheAsync().
+     **/
+    QHash<QString, DatasetUsage> usageCache;
+
+
+    /**
+     * Return the path of the zfs command or an empty string if there is
+     * none.
+     **/
+    QString zfsCommand()
+    {
+	QStringList candidates;
+	candidates << "/usr/sbin/zfs" << "/sbin/zfs" << "/usr/bin/zfs";
+
+	foreach ( const QString & command, candidates )
+	{
+	    if ( SysUtil::haveCommand( command ) )
+		return command;
+	}
+
+	return QString();
+    }
+
+
+    /**
+     * Return the arguments of "zfs list" for all filesystem datasets, one
+     * per line without a header, separated by tabs, with exact numbers.
+     **/
+    QStringList zfsListArgs()
+    {
+	return QStringList()
+	    << "list" << "-H" << "-p" << "-t" << "filesystem"
+	    << "-o" << "name,used,usedbysnapshots,usedbychildren,referenced";
+    }
+
+
+    /**
+     * Parse one line of the output of "zfs list". The result is invalid if
+     * the "used" size is not known (e.g. "-").
+     **/
+    DatasetUsage parseLine( const QString & line )
+    {
+	DatasetUsage usage;
+	QStringList fields = line.split( '\t' );
+
+	if ( fields.size() < 5 )
+	    return usage;
+
+	bool ok = false;
+
+	usage.name		= fields.at( 0 );
+	usage.used		= fields.at( 1 ).toLongLong( &ok );
+	usage.usedBySnapshots	= fields.at( 2 ).toLongLong();
+	usage.usedByChildren	= fields.at( 3 ).toLongLong();
+	usage.referenced	= fields.at( 4 ).toLongLong();
+
+	if ( ! ok )
+	    usage.used = -1;
+
+	return usage;
+    }
+
+
+    /**
+     * Fill the cache from the output of "zfs list": Each mounted dataset
+     * by its mount path. Datasets with a legacy mount point are mounted
+     * with the dataset name as the device, so this works for them, too.
+     **/
+    void fillCache( const QString & output, int exitCode )
+    {
+	usageCache.clear();
+
+	if ( exitCode != 0 )
+	{
+	    logWarning() << "Can't read the ZFS datasets" << endl;
+	    return;
+	}
+
+	QHash<QString, DatasetUsage> datasets;
+
+	foreach ( const QString & line, output.split( '\n', QString::SkipEmptyParts ) )
+	{
+	    DatasetUsage usage = parseLine( line );
+
+	    if ( usage.isValid() )
+		datasets.insert( usage.name, usage );
+	}
+
+	foreach ( MountPoint * mountPoint, MountPoints::normalMountPoints() )
+	{
+	    if ( ! mountPoint->isZfs() || ! datasets.contains( mountPoint->device() ) )
+		continue;
+
+	    DatasetUsage usage = datasets.value( mountPoint->device() );
+	    usageCache.insert( mountPoint->path(), usage );
+
+	    logDebug() << "ZFS dataset " << usage.name << " at " << mountPoint->path()
+		       << ": " << formatSize( usage.used ) << " used" << endl;
+	}
+
+	logInfo() << "Read " << datasets.size() << " ZFS datasets, "
+		  << usageCache.size() << " mounted" << endl;
+    }
+
+}	// namespace
+
+
+
+bool ZfsDatasets::isAvailable()
+{
+    return ! zfsCommand().isEmpty();
+}
+
+
+void ZfsDatasets::updateCacheAsync( QObject * context, UpdateCallback callback )
+{
+    QString command = zfsCommand();
+
+    if ( command.isEmpty() || ! MountPoints::hasZfs() )
+    {
+	usageCache.clear();
+
+	if ( callback )
+	    callback();
+
+	return;
+    }
+
+    SysUtil::runCommandAsync( command, zfsListArgs(), context,
+			      [=]( const QString & output, int exitCode )
+	{
+	    fillCache( output, exitCode );
+
+	    if ( callback )
+		callback();
+	},
+	ZFS_TIMEOUT_SEC,
+	true,		// logCommand
+	false,		// logOutput
+	false );	// ignoreErrCode
+}
+
+
+DatasetUsage ZfsDatasets::cachedUsage( const QString & path )
+{
+    return usageCache.value( path );
+}
+
+
+QString ZfsDatasets::summary( const DatasetUsage & usage )
+{
+    return QObject::tr( "ZFS: %1 used (%2 by snapshots, %3 by children), %4 referenced" )
+	.arg( formatSize( usage.used ) )
+	.arg( formatSize( qMax( usage.usedBySnapshots, (FileSize) 0 ) ) )
+	.arg( formatSize( qMax( usage.usedByChildren,  (FileSize) 0 ) ) )
+	.arg( formatSize( qMax( usage.referenced,      (FileSize) 0 ) ) );
+}
@@ -0,0 +1,111 @@
+/*
+ *   File name: ZfsDatasets.h
+ *   Summary:	ZFS dataset sizes from the dataset properties for QDirStat
+ *   License:	GPL V2 - See file LICENSE for details.
+ *
+ *   Author:	Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ */
+
+
+#ifndef ZfsDatasets_h
+#define ZfsDatasets_h
+
+
+#include <functional>
+
+#include <QString>
+
+#include "FileInfo.h"	// FileSize
+
+
+class QObject;
+
+
+namespace QDirStat
+{
+    /**
+     * The disk usage of one ZFS dataset as ZFS keeps track of it anyway:
+     * 'used' is everything that would be freed if the dataset and all its
+     * descendants were destroyed; that includes 'usedBySnapshots' (of this
+     * dataset) and 'usedByChildren' (the child datasets with their
+     * snapshots). 'referenced' is what the files of this dataset itself
+     * take, some of which may be shared with its snapshots.
+     **/
+    struct DatasetUsage
+    {
+	DatasetUsage():
+	    used( -1 ),
+	    usedBySnapshots( -1 ),
+	    usedByChildren( -1 ),
+	    referenced( -1 )
+	    {}
+
+	bool isValid() const { return used >= 0; }
+
+	/**
+	 * Return what reading the mount point of the dataset would find,
+	 * including the child datasets that are mounted below it: Snapshots
+	 * are not part of the directory tree.
+	 **/
+	FileSize subtreeSize() const
+	    { return qMax( used - qMax( usedBySnapshots, (FileSize) 0 ), referenced ); }
+
+	QString	 name;
+	FileSize used;
+	FileSize usedBySnapshots;
+	FileSize usedByChildren;
+	FileSize referenced;
+    };
+
+
+    /**
+     * Reading the sizes of ZFS datasets from their properties, so an
+     * overview of a storage pool is available without reading any
+     * directories.
+     *
+     * This uses the "zfs list" command. It is started asynchronously since
+     * it can take a while on a pool with many datasets and snapshots. If
+     * there is no zfs command, there simply is no usage information.
+     *
+     * This is only for the main thread.
+     **/
+    namespace ZfsDatasets
+    {
+	/**
+	 * Callback for updateCacheAsync().
+	 **/
+	typedef std::function<void()> UpdateCallback;
+
+	/**
+	 * Return 'true' if the zfs command is available.
+	 **/
+	bool isAvailable();
+
+	/**
+	 * Start reading the usage of all mounted ZFS datasets and remember
+	 * them for cachedUsage(); then call 'callback'. If 'context' is
+	 * destroyed before that, the callback is never called.
+	 *
+	 * The callback is also called (right away) if there is nothing to
+	 * read: if there is no zfs command or no ZFS mount.
+	 **/
+	void updateCacheAsync( QObject * context, UpdateCallback callback );
+
+	/**
+	 * Return the usage of the ZFS dataset that is mounted at 'path' as
+	 * last read with updateCacheAsync(). This does no system calls, so it
+	 * is cheap enough for the views.
+	 **/
+	DatasetUsage cachedUsage( const QString & path );
+
+	/**
+	 * Return a one-line summary of 'usage' for the user.
+	 **/
+	QString summary( const DatasetUsage & usage );
+
+    }	// namespace ZfsDatasets
+
+}	// namespace QDirStat
+
+
+#endif	// ZfsDatasets_h
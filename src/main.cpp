@@ -8,13 +8,29 @@
 
 
 #include <iostream>	// cerr
+#include <unistd.h>	// STDIN_FILENO
 
 #include <QApplication>
+#include <QTimer>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QLocalSocket>
+#include <QScopedPointer>
 #include "MainWindow.h"
+#include "DirTree.h"
+#include "DirTreeCache.h"
 #include "DirTreeModel.h"
+#include "Benchmark.h"
+#include "ColumnarExporter.h"
+#include "TreemapExporter.h"
+#include "ExcludeRules.h"
 #include "PkgFilter.h"
+#include "RemoteAgent.h"
+#include "ScanDaemon.h"
+#include "SizeHistory.h"
 #include "Settings.h"
 #include "Logger.h"
+#include "Tracer.h"
 #include "Exception.h"
 #include "Version.h"
 
@@ -23,6 +39,8 @@ using std::cerr;
 static const char * progName = "qdirstat";
 static bool fatal = false;
 
+#define DefaultTreemapExportSize "4096x4096"
+
 
 void usage( const QStringList & argList )
 {
@@ -32,8 +50,25 @@ void usage( const QStringList & argList )
 	 << "  " << progName << " [--slow-update|-s] [<directory-name>]\n"
 	 << "  " << progName << " pkg:/pkgpattern\n"
 	 << "  " << progName << " unpkg:/dir\n"
+	 << "  " << progName << " ssh://[user@]host[,[user@]host...]/path\n"
+	 << "  " << progName << " ext4:<image-file-or-device>\n"
+	 << "  " << progName << " ntfs:<image-file-or-device>\n"
+	 << "  " << progName << " ncdu:<ncdu-export-file>\n"
+	 << "  " << progName << " filelist:<file-list>\n"
 	 << "  " << progName << " --dont-ask|-d\n"
-	 << "  " << progName << " --cache|-c <cache-file-name>\n"
+	 << "  " << progName << " --cache|-c <cache-file-name> [<delta-file-name> ...]\n"
+	 << "  " << progName << " --caches <cache-file-name> <cache-file-name> [...]\n"
+	 << "  " << progName << " --scan-to-cache <directory-name> <cache-file-name>\n"
+	 << "  " << progName << " --update-cache <directory-name> <cache-file-name>\n"
+	 << "  " << progName << " --export-columns <cache-file-name> <columns-file-name>\n"
+	 << "  " << progName << " --export-treemap <cache-file-name> <png-file-name> [<width>x<height>]\n"
+	 << "  " << progName << " --add-to-history <cache-file-name> <history-file-name>\n"
+	 << "  " << progName << " --scan-to-delta <directory-name> <delta-file-name> <cache-file-name> [<delta-file-name> ...]\n"
+	 << "  " << progName << " --benchmark <directory-name> [<label>]\n"
+	 << "  " << progName << " --micro-benchmark <cache-file-name> [<label>]\n"
+	 << "  " << progName << " --agent <directory-name>|-\n"
+	 << "  " << progName << " --daemon <socket-name> <directory-name> [<directory-name> ...]\n"
+	 << "  " << progName << " --query <socket-name> <json-request>\n"
 	 << "  " << progName << " --help|-h\n"
 	 << "\n"
 	 << "\n"
@@ -45,6 +80,13 @@ void usage( const QStringList & argList )
          << "- Exact match: \"pkg:/=mypkg\"\n"
          << "- All packages: \"pkg:/\"\n"
 	 << "\n"
+	 << "\n"
+	 << "Environment:\n"
+	 << "\n"
+	 << "- QDIRSTAT_TRACE=<trace-file-name>: Write a trace of reading and\n"
+	 << "  rendering in the Chrome trace event format (for chrome://tracing\n"
+	 << "  or https://ui.perfetto.dev) to that file upon exit\n"
+	 << "\n"
 	 << std::endl;
 
     logError() << "FATAL: Bad command line args: " << argList.join( " " ) << endl;
@@ -91,15 +133,395 @@ bool commandLineSwitch( const QString & longName,
 }
 
 
+/**
+ * Read directory 'dirName' without any GUI and write the result to cache
+ * file 'cacheFileName'. This uses the same settings (exclude rules, worker
+ * threads etc.) as the GUI. Return the exit code for the program.
+ *
+ * With 'update', an existing binary cache file 'cacheFileName' is used as
+ * the baseline: Only directories that changed since it was written are
+ * read again.
+ *
+ * If 'baseFileNames' is not empty, 'cacheFileName' is written as a delta
+ * cache file against the first of them with the others (older delta cache
+ * files) applied to it.
+ *
+ * Otherwise, a gzip cache file is written while reading (see
+ * IncrementalCacheWriter), and the subtrees that are written are released
+ * from memory right away.
+ **/
+int scanToCache( const QString & dirName, const QString & cacheFileName, bool update,
+		 const QStringList & baseFileNames = QStringList() )
+{
+    QDirStat::DirTree tree;
+    tree.readSettings();
+    QDirStat::ExcludeRules::instance()->readSettings();
+
+    bool ok = false;
+
+    if ( update && QFileInfo( cacheFileName ).exists() )
+    {
+	if ( ! tree.setCacheBaseline( cacheFileName ) )
+	    logWarning() << "Reading all of " << dirName << " again" << endl;
+    }
+
+    QScopedPointer<QDirStat::IncrementalCacheWriter> writer;
+
+    if ( baseFileNames.isEmpty() &&
+	 ! cacheFileName.endsWith( BINARY_CACHE_SUFFIX ) &&
+	 ! cacheFileName.endsWith( COLUMNAR_EXPORT_SUFFIX ) )
+    {
+	writer.reset( new QDirStat::IncrementalCacheWriter( cacheFileName, &tree,
+							    tree.cacheCompressionLevel() ) );
+	CHECK_NEW( writer.data() );
+
+	if ( writer->ok() )
+	    writer->setReleaseWritten( true );
+	else
+	    writer.reset();	// Try again at the end
+    }
+
+    QObject::connect( &tree, &QDirStat::DirTree::finished, [&]()
+	{
+	    // The baseline is still mapped, and it is about to be overwritten
+
+	    tree.setCacheBaseline( "" );
+
+	    if ( writer )
+	    {
+		logInfo() << "Finishing cache file " << cacheFileName << endl;
+		ok = writer->finish();
+	    }
+	    else
+	    {
+		logInfo() << "Writing cache file " << cacheFileName << endl;
+
+		if ( baseFileNames.isEmpty() )
+		    ok = tree.writeCache( cacheFileName );
+		else
+		    ok = tree.writeCacheDelta( cacheFileName, baseFileNames.first(), baseFileNames.mid( 1 ) );
+	    }
+
+	    if ( ! ok )
+		logError() << "Writing cache file " << cacheFileName << " failed" << endl;
+
+	    QCoreApplication::quit();
+	} );
+
+    QObject::connect( &tree, &QDirStat::DirTree::aborted, [&]()
+	{
+	    logError() << "Reading " << dirName << " was aborted" << endl;
+	    QCoreApplication::quit();
+	} );
+
+    // Start reading only from the event loop: If there is nothing to do
+    // (e.g. if 'dirName' is a plain file), DirTree emits finished()
+    // immediately, and quit() would be lost before exec().
+
+    QTimer::singleShot( 0, &tree, [&]() { tree.startReading( dirName ); } );
+    QCoreApplication::exec();
+
+    if ( ! ok )
+	cerr << progName << ": Could not write " << qPrintable( cacheFileName ) << std::endl;
+
+    QDirStat::Settings::fixFileOwners();
+
+    return ok ? 0 : 1;
+}
+
+
+/**
+ * Read directory 'dirName' without any GUI as the remote agent for a
+ * QDirStat on another host (see RemoteReadJob): The directories are written
+ * to stdout as they are read. With AGENT_ASSIGNMENTS_PATH ("-") instead of
+ * a directory, read the assignments of a distributed scan from stdin. Return
+ * the exit code for the program.
+ **/
+int runAgent( const QString & dirName )
+{
+    bool assignments = dirName == AGENT_ASSIGNMENTS_PATH;
+
+    if ( ! assignments && ! QFileInfo( dirName ).isDir() )
+    {
+	cerr << progName << ": Not a directory: " << qPrintable( dirName ) << std::endl;
+	return 1;
+    }
+
+    QDirStat::DirTree tree;
+    tree.readSettings();
+    QDirStat::ExcludeRules::instance()->readSettings();
+
+    QDirStat::RemoteAgent agent( &tree, stdout );
+
+    QObject::connect( &agent, &QDirStat::RemoteAgent::done, []() { QCoreApplication::quit(); } );
+
+    if ( assignments )
+	agent.readAssignments( STDIN_FILENO );
+    else
+	QTimer::singleShot( 0, &tree, [&]() { tree.startReading( dirName ); } );
+
+    QCoreApplication::exec();
+
+    return agent.ok() ? 0 : 1;
+}
+
+
+/**
+ * Read and watch 'dirs' without any GUI and answer queries about them on
+ * local socket 'socketName' until the program is killed (see ScanDaemon).
+ * Return the exit code for the program.
+ **/
+int runDaemon( const QString & socketName, const QStringList & dirs )
+{
+    QDirStat::ExcludeRules::instance()->readSettings();
+    QDirStat::ScanDaemon daemon;
+
+    if ( ! daemon.start( socketName, dirs ) )
+    {
+	cerr << progName << ": Could not start the daemon on " << qPrintable( socketName ) << std::endl;
+	return 1;
+    }
+
+    return QCoreApplication::exec();
+}
+
+
+/**
+ * Send JSON request 'request' to the ScanDaemon on local socket
+ * 'socketName' and write the response to stdout. Return the exit code for
+ * the program.
+ **/
+int queryDaemon( const QString & socketName, const QString & request )
+{
+    QLocalSocket socket;
+    socket.connectToServer( socketName );
+
+    if ( ! socket.waitForConnected( 5000 ) )
+    {
+	cerr << progName << ": Can't connect to " << qPrintable( socketName ) << ": "
+	     << qPrintable( socket.errorString() ) << std::endl;
+	return 1;
+    }
+
+    socket.write( request.toUtf8().trimmed() + '\n' );
+
+    // Writing a cache file may take a while
+
+    while ( ! socket.canReadLine() && socket.waitForReadyRead( 120 * 1000 ) )
+	;
+
+    if ( ! socket.canReadLine() )
+    {
+	cerr << progName << ": No response from " << qPrintable( socketName ) << std::endl;
+	return 1;
+    }
+
+    QByteArray response = socket.readLine();
+    fwrite( response.constData(), response.size(), 1, stdout );
+
+    return response.startsWith( "{\"error\"" ) ? 1 : 0;
+}
+
+
+/**
+ * Read cache file 'cacheFileName' without any GUI and export the tree as
+ * columnar data to 'columnsFileName' (see ColumnarExporter). Return the exit
+ * code for the program.
+ **/
+int exportColumns( const QString & cacheFileName, const QString & columnsFileName )
+{
+    QDirStat::DirTree tree;
+    bool ok = tree.readCacheNow( cacheFileName );
+
+    if ( ok )
+    {
+	QDirStat::ColumnarExporter exporter( columnsFileName, &tree );
+	ok = exporter.ok();
+    }
+
+    if ( ! ok )
+	cerr << progName << ": Could not export " << qPrintable( cacheFileName )
+	     << " to " << qPrintable( columnsFileName ) << std::endl;
+
+    return ok ? 0 : 1;
+}
+
+
+/**
+ * Read cache file 'cacheFileName' without any GUI and add the totals of its
+ * directories as a new scan to size history file 'historyFileName' (see
+ * SizeHistory), which is created if it does not exist yet. The time of the
+ * scan is the time the cache file was written. Return the exit code for the
+ * program.
+ **/
+int addToHistory( const QString & cacheFileName, const QString & historyFileName )
+{
+    QDirStat::Settings settings;
+    settings.beginGroup( "SizeHistory" );
+    int maxScans = settings.value( "MaxScans", SIZE_HISTORY_DEFAULT_MAX_SCANS ).toInt();
+    settings.setDefaultValue( "MaxScans", maxScans );
+    settings.endGroup();
+
+    QDirStat::SizeHistory history;
+    history.setMaxScans( maxScans );
+
+    QDirStat::DirTree tree;
+    QDirStat::FileInfo * toplevel = 0;
+    bool ok = tree.readCacheNow( cacheFileName );
+
+    if ( ok )
+    {
+	toplevel = tree.firstToplevel();
+	ok = toplevel && toplevel->isDirInfo();
+    }
+
+    if ( ok && QFileInfo( historyFileName ).exists() )
+	ok = history.load( historyFileName );
+
+    if ( ok )
+    {
+	time_t scanTime = QFileInfo( cacheFileName ).lastModified().toMSecsSinceEpoch() / 1000;
+	history.addScan( toplevel->toDirInfo(), scanTime );
+	ok = history.save( historyFileName );
+    }
+
+    if ( ! ok )
+	cerr << progName << ": Could not add " << qPrintable( cacheFileName )
+	     << " to " << qPrintable( historyFileName ) << std::endl;
+
+    QDirStat::Settings::fixFileOwners();
+
+    return ok ? 0 : 1;
+}
+
+
+/**
+ * Read cache file 'cacheFileName' without any GUI and write its treemap with
+ * 'sizeArg' ("<width>x<height>") pixels to PNG file 'imageFileName' (see
+ * TreemapExporter). Return the exit code for the program.
+ **/
+int exportTreemap( const QString & cacheFileName,
+		   const QString & imageFileName,
+		   const QString & sizeArg )
+{
+    QStringList sizeList = sizeArg.split( 'x' );
+    QSize size;
+
+    if ( sizeList.size() == 2 )
+	size = QSize( sizeList.at(0).toInt(), sizeList.at(1).toInt() );
+
+    if ( size.isEmpty() )
+    {
+	cerr << progName << ": Bad treemap size " << qPrintable( sizeArg ) << std::endl;
+	return 1;
+    }
+
+    QDirStat::DirTree tree;
+    bool ok = tree.readCacheNow( cacheFileName );
+
+    if ( ok )
+    {
+	QDirStat::TreemapExporter exporter( imageFileName, &tree, size );
+	ok = exporter.ok();
+    }
+
+    if ( ! ok )
+	cerr << progName << ": Could not export the treemap of " << qPrintable( cacheFileName )
+	     << " to " << qPrintable( imageFileName ) << std::endl;
+
+    return ok ? 0 : 1;
+}
+
+
 int main( int argc, char *argv[] )
 {
     Logger logger( "/tmp/qdirstat-$USER", "qdirstat.log" );
     logVersion();
 
+    // Tracing is enabled with QDIRSTAT_TRACE=<file>; the trace file is
+    // written when this goes out of scope at the end of main() (after the
+    // application object).
+    QDirStat::Tracer tracer( QString::fromLocal8Bit( qgetenv( "QDIRSTAT_TRACE" ) ) );
+
     // Set org/app name for QSettings
     QCoreApplication::setOrganizationName( "QDirStat" );
     QCoreApplication::setApplicationName ( "QDirStat" );
 
+    if ( argc >= 3 && argc <= 4 && QString( argv[1] ) == "--micro-benchmark" )
+    {
+	// The model needs a QApplication for its icons and the palette, but
+	// not a display
+
+	if ( qgetenv( "QT_QPA_PLATFORM" ).isEmpty() )
+	    qputenv( "QT_QPA_PLATFORM", "offscreen" );
+
+	QApplication app( argc, argv );
+	QStringList argList = QCoreApplication::arguments();
+	QDirStat::Benchmark benchmark( argList.at(2), argList.size() == 4 ? argList.at(3) : QString() );
+
+	return benchmark.runMicro();
+    }
+
+    for ( int i = 1; i < argc; ++i )
+    {
+	if ( QString( argv[i] ) == "--scan-to-cache" ||
+	     QString( argv[i] ) == "--update-cache"  ||
+	     QString( argv[i] ) == "--scan-to-delta"  ||
+	     QString( argv[i] ) == "--export-columns" ||
+	     QString( argv[i] ) == "--export-treemap" ||
+	     QString( argv[i] ) == "--add-to-history" ||
+	     QString( argv[i] ) == "--agent"	      ||
+	     QString( argv[i] ) == "--daemon"	      ||
+	     QString( argv[i] ) == "--query"	      ||
+	     QString( argv[i] ) == "--benchmark"	)
+	{
+	    // Headless mode: No QApplication (which would need a display), no
+	    // widgets at all.
+
+	    QCoreApplication app( argc, argv );
+	    QStringList argList = QCoreApplication::arguments();
+	    argList.removeFirst(); // Remove program name
+
+	    if ( argList.size() >= 4 && argList.first() == "--scan-to-delta" )
+		return scanToCache( argList.at(1), argList.at(2), false, argList.mid( 3 ) );
+
+	    if ( argList.size() == 2 && argList.first() == "--agent" )
+		return runAgent( argList.at(1) );
+
+	    if ( argList.size() >= 3 && argList.first() == "--daemon" )
+		return runDaemon( argList.at(1), argList.mid( 2 ) );
+
+	    if ( argList.size() == 3 && argList.first() == "--query" )
+		return queryDaemon( argList.at(1), argList.at(2) );
+
+	    if ( argList.size() == 3 && argList.first() == "--export-columns" )
+		return exportColumns( argList.at(1), argList.at(2) );
+
+	    if ( argList.size() == 3 && argList.first() == "--add-to-history" )
+		return addToHistory( argList.at(1), argList.at(2) );
+
+	    if ( ( argList.size() == 3 || argList.size() == 4 ) && argList.first() == "--export-treemap" )
+		return exportTreemap( argList.at(1), argList.at(2),
+				      argList.size() == 4 ? argList.at(3) : DefaultTreemapExportSize );
+
+	    if ( ( argList.size() == 2 || argList.size() == 3 ) && argList.first() == "--benchmark" )
+	    {
+		QDirStat::Benchmark benchmark( argList.at(1), argList.size() == 3 ? argList.at(2) : QString() );
+		return benchmark.run();
+	    }
+
+	    bool update = argList.first() == "--update-cache";
+
+	    if ( argList.size() != 3 || ( argList.first() != "--scan-to-cache" && ! update ) )
+	    {
+		usage( argList );
+		return 1;
+	    }
+
+	    return scanToCache( argList.at(1), argList.at(2), update );
+	}
+    }
+
     QApplication app( argc, argv);
     QStringList argList = QCoreApplication::arguments();
     argList.removeFirst(); // Remove program name
@@ -124,11 +546,21 @@ int main( int argc, char *argv[] )
 
 	if ( arg == "--cache" || arg == "-c" )
 	{
-	    if ( argList.size() == 2 )
+	    if ( argList.size() >= 2 )
 	    {
 		QString cacheFileName = argList.at(1);
 		logDebug() << "Reading cache file " << cacheFileName << endl;
-		mainWin->readCache( cacheFileName );
+		mainWin->readCache( cacheFileName, argList.mid( 2 ) );
+	    }
+	    else
+		usage( argList );
+	}
+	else if ( arg == "--caches" )
+	{
+	    if ( argList.size() >= 2 )
+	    {
+		logDebug() << "Reading " << argList.size() - 1 << " cache files" << endl;
+		mainWin->readCaches( argList.mid( 1 ) );
 	    }
 	    else
 		usage( argList );
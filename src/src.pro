@@ -11,8 +11,8 @@
 
 TEMPLATE	 = app
 
-QT		+= widgets
-CONFIG		+= debug
+QT		+= widgets network
+CONFIG		+= debug c++11
 DEPENDPATH	+= .
 MOC_DIR		 = .moc
 OBJECTS_DIR	 = .obj
@@ -46,69 +46,132 @@ INSTALLS	+= TARGET desktop icons
 QMAKE_CXXFLAGS	+=  -Wno-deprecated -Wno-deprecated-declarations
 
 
+# Query the rpm database in-process if librpm is installed.
+# Disable with  qmake CONFIG+=no_librpm
+
+!no_librpm:packagesExist(rpm) {
+    DEFINES	+= HAVE_LIBRPM=1
+    LIBS	+= -lrpm -lrpmio
+}
+
+
+# Read and write zstd compressed cache files if libzstd is installed.
+# Disable with  qmake CONFIG+=no_libzstd
+
+!no_libzstd:packagesExist(libzstd) {
+    DEFINES	+= HAVE_LIBZSTD=1
+    LIBS	+= -lzstd
+}
+
+
+# Read ext2/3/4 filesystem images ("ext4:/dev/sdb1") if libext2fs is installed.
+# Disable with  qmake CONFIG+=no_libext2fs
+
+!no_libext2fs:packagesExist(ext2fs) {
+    DEFINES	+= HAVE_LIBEXT2FS=1
+    LIBS	+= -lext2fs -lcom_err
+}
+
+
 SOURCES	  = main.cpp			\
 	    ActionManager.cpp		\
 	    AdaptiveTimer.cpp		\
+	    AggregateInfo.cpp		\
+	    AllFilesModel.cpp		\
+	    AllFilesWindow.cpp		\
 	    Attic.cpp			\
+	    Benchmark.cpp		\
 	    BreadcrumbNavigator.cpp	\
+	    BtrfsQgroups.cpp		\
+	    BtrfsSnapshots.cpp		\
 	    BucketsTableModel.cpp	\
+	    BulkInodeStat.cpp	\
 	    BusyPopup.cpp		\
 	    Cleanup.cpp			\
 	    CleanupCollection.cpp	\
 	    CleanupConfigPage.cpp	\
+	    ColumnarExporter.cpp	\
 	    ConfigDialog.cpp		\
+	    ContainerLayers.cpp		\
 	    DataColumns.cpp		\
 	    DebugHelpers.cpp		\
 	    DelayedRebuilder.cpp	\
 	    DirInfo.cpp			\
+	    DirListModel.cpp		\
 	    DirReadJob.cpp		\
 	    DirSaver.cpp		\
 	    DirTree.cpp			\
 	    DirTreeCache.cpp		\
+	    DirTreeDiff.cpp		\
 	    DirTreeModel.cpp		\
 	    DirTreePatternFilter.cpp	\
 	    DirTreePkgFilter.cpp	\
 	    DirTreeView.cpp		\
+	    DirWatcher.cpp		\
 	    DotEntry.cpp		\
+	    DuplicateFilesWindow.cpp	\
+	    DuplicateFinder.cpp		\
+	    DpkgDatabase.cpp		\
 	    DpkgPkgManager.cpp		\
 	    Exception.cpp		\
 	    ExcludeRules.cpp		\
 	    ExcludeRulesConfigPage.cpp	\
 	    ExistingDirCompleter.cpp	\
 	    ExistingDirValidator.cpp	\
+	    Ext4Image.cpp		\
 	    FileDetailsView.cpp		\
 	    FileInfo.cpp		\
 	    FileInfoIterator.cpp	\
 	    FileInfoSet.cpp		\
 	    FileInfoSorter.cpp		\
+	    FileQuery.cpp		\
 	    FileSizeLabel.cpp		\
+	    FileAgeStatsWindow.cpp	\
 	    FileMTimeStats.cpp		\
 	    FileSizeStats.cpp		\
 	    FileSizeStatsWindow.cpp	\
 	    FileSystemsWindow.cpp	\
+	    FileTypeIndex.cpp		\
 	    FileTypeStats.cpp		\
+	    FileTypeStatsModel.cpp	\
 	    FileTypeStatsWindow.cpp	\
+	    FindFilesDialog.cpp		\
 	    GeneralConfigPage.cpp	\
+	    HardLinkIndex.cpp		\
 	    HeaderTweaker.cpp		\
 	    HistogramDraw.cpp		\
 	    HistogramItems.cpp		\
 	    HistogramOverflowPanel.cpp	\
 	    HistogramView.cpp		\
+	    ImportReader.cpp		\
+	    IoUringStatx.cpp		\
 	    ListEditor.cpp		\
+	    LocalDirReader.cpp		\
 	    LocateFilesWindow.cpp	\
 	    LocateFileTypeWindow.cpp	\
 	    Logger.cpp			\
 	    MainWindow.cpp		\
+	    MemoryStats.cpp		\
 	    MessagePanel.cpp		\
 	    MimeCategorizer.cpp		\
 	    MimeCategory.cpp		\
 	    MimeCategoryConfigPage.cpp	\
 	    MountPoints.cpp		\
+	    MTimeHistogram.cpp		\
+	    NameIndex.cpp		\
+	    NodePool.cpp		\
+	    NtfsMft.cpp			\
 	    OpenDirDialog.cpp		\
 	    OpenPkgDialog.cpp		\
 	    OutputWindow.cpp		\
+	    OwnerNames.cpp		\
+	    OwnerUsage.cpp		\
+	    OwnerUsageWindow.cpp	\
+	    PacManDatabase.cpp		\
 	    PacManPkgManager.cpp	\
 	    PanelMessage.cpp		\
+	    ParallelDeleter.cpp	\
+	    ParallelWalker.cpp	\
 	    PathSelector.cpp		\
 	    PercentBar.cpp		\
 	    PercentileStats.cpp		\
@@ -118,91 +181,149 @@ SOURCES	  = main.cpp			\
 	    PkgManager.cpp		\
 	    PkgQuery.cpp		\
 	    PkgReader.cpp		\
+	    PkgStatCache.cpp		\
 	    PopupLabel.cpp		\
 	    Process.cpp			\
 	    ProcessStarter.cpp		\
+	    QuantileSketch.cpp		\
+	    ReadScheduler.cpp		\
 	    Refresher.cpp		\
+	    RemoteAgent.cpp		\
+	    RpmDatabase.cpp		\
 	    RpmPkgManager.cpp		\
+	    ScanDaemon.cpp		\
+	    ScanStats.cpp		\
+	    ScanStatsWindow.cpp		\
 	    SelectionModel.cpp		\
 	    Settings.cpp		\
 	    SettingsHelpers.cpp		\
+	    SharedExtents.cpp		\
 	    ShowUnpkgFilesDialog.cpp	\
 	    SizeColDelegate.cpp		\
+	    SizeHistogram.cpp		\
+	    SizeHistory.cpp		\
+	    SparseFiles.cpp		\
 	    StdCleanup.cpp		\
 	    Subtree.cpp			\
+	    SubtreeEstimator.cpp		\
+	    SubtreeSpiller.cpp		\
 	    SysUtil.cpp			\
 	    SystemFileChecker.cpp	\
+	    Tracer.cpp			\
 	    Trash.cpp			\
+	    TrashJob.cpp		\
+	    TreemapExporter.cpp	\
+	    TreemapGLRenderer.cpp	\
+	    TreemapLayout.cpp		\
 	    TreemapTile.cpp		\
 	    TreemapView.cpp		\
+	    TreeSnapshot.cpp		\
             TreeWalker.cpp              \
 	    UnpkgSettings.cpp		\
-	    UnreadableDirsWindow.cpp
+	    UnreadableDirsWindow.cpp	\
+	    UpdateScheduler.cpp		\
+	    ZfsDatasets.cpp
 
 
 HEADERS	  =				\
 	    ActionManager.h		\
 	    AdaptiveTimer.h		\
+	    AggregateInfo.h		\
+	    AllFilesModel.h		\
+	    AllFilesWindow.h		\
 	    Attic.h			\
+	    Benchmark.h			\
 	    BreadcrumbNavigator.h	\
+	    BtrfsQgroups.h		\
+	    BtrfsSnapshots.h		\
 	    BucketsTableModel.h		\
+	    BulkInodeStat.h		\
 	    BusyPopup.h			\
 	    Cleanup.h			\
 	    CleanupCollection.h		\
 	    CleanupConfigPage.h		\
+	    ColumnarExporter.h		\
 	    ConfigDialog.h		\
+	    ContainerLayers.h		\
 	    DataColumns.h		\
 	    DebugHelpers.h		\
 	    DelayedRebuilder.h		\
 	    DirInfo.h			\
+	    DirListModel.h		\
 	    DirReadJob.h		\
 	    DirSaver.h			\
 	    DirTree.h			\
 	    DirTreeCache.h		\
+	    DirTreeDiff.h		\
 	    DirTreeFilter.h		\
 	    DirTreeModel.h		\
 	    DirTreePatternFilter.h	\
 	    DirTreePkgFilter.h		\
 	    DirTreeView.h		\
+	    DirWatcher.h		\
 	    DotEntry.h			\
+	    DuplicateFilesWindow.h	\
+	    DuplicateFinder.h		\
+	    DpkgDatabase.h		\
 	    DpkgPkgManager.h		\
 	    Exception.h			\
 	    ExcludeRules.h		\
 	    ExcludeRulesConfigPage.h	\
 	    ExistingDirCompleter.h	\
 	    ExistingDirValidator.h	\
+	    Ext4Image.h		\
 	    FileDetailsView.h		\
 	    FileInfo.h			\
 	    FileInfoIterator.h		\
 	    FileInfoSet.h		\
 	    FileInfoSorter.h		\
+	    FileQuery.h			\
 	    FileSizeLabel.h		\
+	    FileAgeStatsWindow.h	\
 	    FileMTimeStats.h		\
 	    FileSizeStats.h		\
 	    FileSizeStatsWindow.h	\
+	    FileTypeIndex.h		\
 	    FileTypeStats.h		\
+	    FileTypeStatsModel.h	\
 	    FileSystemsWindow.h		\
 	    FileTypeStatsWindow.h	\
+	    FindFilesDialog.h		\
 	    GeneralConfigPage.h		\
+	    HardLinkIndex.h		\
 	    HeaderTweaker.h		\
 	    HistogramItems.h		\
 	    HistogramView.h		\
+	    ImportReader.h		\
+	    IoUringStatx.h		\
 	    ListEditor.h		\
 	    ListMover.h			\
+	    LocalDirReader.h		\
 	    LocateFilesWindow.h         \
 	    LocateFileTypeWindow.h	\
 	    Logger.h			\
 	    MainWindow.h		\
+	    MemoryStats.h		\
 	    MessagePanel.h		\
 	    MimeCategorizer.h		\
 	    MimeCategory.h		\
 	    MimeCategoryConfigPage.h	\
 	    MountPoints.h		\
+	    MTimeHistogram.h		\
+	    NameIndex.h			\
+	    NodePool.h			\
+	    NtfsMft.h			\
 	    OpenDirDialog.h		\
 	    OpenPkgDialog.h		\
 	    OutputWindow.h		\
+	    OwnerNames.h		\
+	    OwnerUsage.h		\
+	    OwnerUsageWindow.h		\
+	    PacManDatabase.h		\
 	    PacManPkgManager.h		\
 	    PanelMessage.h		\
+	    ParallelDeleter.h		\
+	    ParallelWalker.h		\
 	    PathSelector.h		\
 	    PercentBar.h		\
 	    PercentileStats.h		\
@@ -212,29 +333,51 @@ HEADERS	  =				\
 	    PkgManager.h		\
 	    PkgQuery.h			\
 	    PkgReader.h			\
+	    PkgStatCache.h		\
 	    PopupLabel.h		\
 	    Process.h			\
 	    ProcessStarter.h		\
 	    Qt4Compat.h			\
+	    QuantileSketch.h		\
+	    ReadScheduler.h		\
 	    Refresher.h			\
+	    RemoteAgent.h		\
+	    RpmDatabase.h		\
 	    RpmPkgManager.h		\
+	    ScanDaemon.h		\
+	    ScanStats.h			\
+	    ScanStatsWindow.h		\
 	    SelectionModel.h		\
 	    Settings.h			\
 	    SettingsHelpers.h		\
+	    SharedExtents.h		\
 	    ShowUnpkgFilesDialog.h	\
 	    SignalBlocker.h		\
 	    SizeColDelegate.h		\
+	    SizeHistogram.h		\
+	    SizeHistory.h		\
+	    SparseFiles.h		\
 	    StdCleanup.h		\
 	    Subtree.h			\
+	    SubtreeEstimator.h		\
+	    SubtreeSpiller.h		\
 	    SysUtil.h			\
 	    SystemFileChecker.h		\
+	    Tracer.h			\
 	    Trash.h			\
+	    TrashJob.h			\
+	    TreemapExporter.h		\
+	    TreemapGLRenderer.h		\
+	    TreemapLayout.h		\
 	    TreemapTile.h		\
             TreemapView.h		\
+	    TreeSnapshot.h		\
             TreeWalker.h                \
 	    UnpkgSettings.cpp		\
 	    UnreadableDirsWindow.h	\
-	    Version.h
+	    UpdateScheduler.h		\
+	    Version.h			\
+	    ZfsDatasets.h
 
 
 
@@ -245,9 +388,14 @@ FORMS	  = main-window.ui		   \
 	    general-config-page.ui	   \
 	    mime-category-config-page.ui   \
 	    exclude-rules-config-page.ui   \
+	    all-files-window.ui		   \
+	    duplicate-files-window.ui	   \
+	    file-age-stats-window.ui	   \
+	    owner-usage-window.ui	   \
 	    file-size-stats-window.ui	   \
 	    file-type-stats-window.ui	   \
 	    filesystems-window.ui	   \
+	    find-files-dialog.ui	   \
 	    locate-files-window.ui	   \
 	    locate-file-type-window.ui	   \
 	    open-dir-dialog.ui		   \
@@ -256,6 +404,7 @@ FORMS	  = main-window.ui		   \
 	    file-details-view.ui	   \
 	    message-panel.ui		   \
 	    panel-message.ui		   \
+	    scan-stats-window.ui	   \
 	    unreadable-dirs-window.ui
 
 